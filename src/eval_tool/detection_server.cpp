@@ -0,0 +1,582 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "detection_server.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <boost/asio.hpp>
+#include "../implicit_shape_model/utils/point_cloud_loader.h"
+
+void writeDetectionLogEntry(std::ostream &out, int number, const ism3d::VotingMaximum &maximum)
+{
+    out << number << ", ";
+    out << maximum.classId << ", ";
+    out << maximum.weight << ", ";
+    out << maximum.voteIndices.size() << ", ";
+    out << maximum.position[0] << ", ";
+    out << maximum.position[1] << ", ";
+    out << maximum.position[2] << ", ";
+    out << maximum.boundingBox.size[0] << ", ";
+    out << maximum.boundingBox.size[1] << ", ";
+    out << maximum.boundingBox.size[2] << ", ";
+    out << maximum.boundingBox.rotQuat.R_component_1() << ", ";
+    out << maximum.boundingBox.rotQuat.R_component_2() << ", ";
+    out << maximum.boundingBox.rotQuat.R_component_3() << ", ";
+    out << maximum.boundingBox.rotQuat.R_component_4() << std::endl;
+}
+
+const std::size_t DetectionServer::MaxLineLength;
+
+DetectionServer::DetectionServer(ism3d::ImplicitShapeModel &ism, int maxBatchSize, int batchWindowMs,
+                                 int maxCloudPoints)
+    : m_ism(ism), m_max_batch_size(std::max(maxBatchSize, 1)), m_batch_window_ms(std::max(batchWindowMs, 0)),
+      m_max_cloud_points(std::max(maxCloudPoints, 0)), m_stopping(false), m_num_requests(0), m_num_failed(0), m_num_batches(0), m_num_batched(0), m_num_reloads(0),
+      m_max_queue_depth(0),
+      m_total_wait(0), m_max_wait(0), m_total_latency(0), m_max_latency(0)
+{
+}
+
+DetectionServer::~DetectionServer()
+{
+    finish();
+}
+
+bool DetectionServer::run(const std::string &endpoint)
+{
+    m_detection = std::thread(&DetectionServer::detectionLoop, this);
+
+    // a number is a port on the loopback interface, "<address>:<port>" a port on the given address, anything else
+    // the path of a Unix socket
+    auto isNumber = [](const std::string &text)
+    {
+        return !text.empty() && text.size() <= 5 && std::all_of(text.begin(), text.end(), ::isdigit);
+    };
+    boost::asio::ip::address address = boost::asio::ip::address_v4::loopback();
+    std::string port = endpoint;
+    const std::string::size_type colon = endpoint.rfind(':');
+    if (!isNumber(endpoint) && colon != std::string::npos && isNumber(endpoint.substr(colon + 1)))
+    {
+        // IPv6 addresses are written in brackets
+        std::string host = endpoint.substr(0, colon);
+        if (host.size() > 2 && host.front() == '[' && host.back() == ']')
+            host = host.substr(1, host.size() - 2);
+        boost::system::error_code error;
+        const boost::asio::ip::address hostAddress = boost::asio::ip::address::from_string(host, error);
+        if (!error)
+        {
+            address = hostAddress;
+            port = endpoint.substr(colon + 1);
+        }
+    }
+
+    bool served;
+    if (isNumber(port))
+    {
+        if (std::stoi(port) > 65535)
+        {
+            std::cerr << "invalid port: " << port << std::endl;
+            served = false;
+        }
+        else
+        {
+            served = serve<boost::asio::ip::tcp>(boost::asio::ip::tcp::endpoint(address, std::stoi(port)));
+        }
+    }
+    else
+    {
+        // the socket file of a previous server would prevent binding
+        std::remove(endpoint.c_str());
+        served = serve<boost::asio::local::stream_protocol>(boost::asio::local::stream_protocol::endpoint(endpoint));
+        std::remove(endpoint.c_str());
+    }
+
+    finish();
+    return served;
+}
+
+template<typename Protocol>
+bool DetectionServer::serve(const typename Protocol::endpoint &endpoint)
+{
+    boost::asio::io_service service;
+    typename Protocol::acceptor acceptor(service);
+    boost::system::error_code error;
+    acceptor.open(endpoint.protocol(), error);
+    if (!error)
+        acceptor.bind(endpoint, error);
+    if (!error)
+        acceptor.listen(boost::asio::socket_base::max_connections, error);
+    if (error)
+    {
+        std::cerr << "could not listen for detection requests: " << error.message() << std::endl;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop_listening = [&service]() { service.stop(); };
+    }
+
+    // each connection is served by its own thread with blocking reads and writes
+    std::shared_ptr<typename Protocol::socket> socket;
+    std::function<void()> accept = [&]()
+    {
+        socket = std::make_shared<typename Protocol::socket>(service);
+        acceptor.async_accept(*socket, [&](const boost::system::error_code &acceptError)
+        {
+            if (!acceptError)
+            {
+                std::shared_ptr<typename Protocol::socket> connectionSocket = socket;
+                std::lock_guard<std::mutex> lock(m_mutex);
+                reapConnections();
+
+                ConnectionPtr connection = std::make_shared<Connection>();
+                connection->finished = false;
+                connection->close = [connectionSocket]()
+                {
+                    boost::system::error_code ignored;
+                    connectionSocket->shutdown(Protocol::socket::shutdown_both, ignored);
+                };
+                connection->thread = std::thread([this, connection, connectionSocket]()
+                {
+                    serveConnection(*connectionSocket);
+
+                    // the client sees the end of the connection before the thread is joined
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    connection->close();
+                    connection->finished = true;
+                });
+                m_connections.push_back(connection);
+            }
+            accept();
+        });
+    };
+    accept();
+
+    std::cout << "waiting for detection requests" << std::endl;
+    service.run();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop_listening = nullptr;
+    }
+
+    // the sockets belong to the service of this function
+    finish();
+    return true;
+}
+
+template<typename Socket>
+void DetectionServer::serveConnection(Socket &socket)
+{
+    auto writeResponse = [](std::ostream &out, const Response &response)
+    {
+        if (!response.ok)
+        {
+            out << "ERROR " << response.error << "\n";
+            return;
+        }
+        out << "OK " << response.maxima.size() << "\n";
+        for (int i = 0; i < (int)response.maxima.size(); i++)
+            writeDetectionLogEntry(out, i, response.maxima[i]);
+    };
+
+    auto failedResponse = [this](const std::string &message)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_num_requests++;
+        m_num_failed++;
+        Response response;
+        response.ok = false;
+        response.error = message;
+        return response;
+    };
+
+    // read_until fails if the buffer is full before the end of the line
+    boost::asio::streambuf buffer(MaxLineLength);
+    std::istream input(&buffer);
+    boost::system::error_code error;
+    while (true)
+    {
+        boost::asio::read_until(socket, buffer, '\n', error);
+        if (error == boost::asio::error::not_found)
+        {
+            std::ostringstream answer;
+            writeResponse(answer, failedResponse("request line longer than " + std::to_string(MaxLineLength) +
+                                                 " characters"));
+            boost::asio::write(socket, boost::asio::buffer(answer.str()), error);
+            break;
+        }
+        if (error)
+            break;
+
+        std::string line;
+        std::getline(input, line);
+        std::istringstream request(line);
+        std::string command;
+        request >> command;
+
+        std::ostringstream answer;
+        bool close = false;
+        try
+        {
+            if (command == "detect")
+            {
+                std::string path;
+                std::getline(request >> std::ws, path);
+                bool hasNormals = false;
+                pcl::PointCloud<PointNormalT>::Ptr points = ism3d::PointCloudLoader::load(path, &hasNormals);
+                writeResponse(answer, points ? detect(points, hasNormals) : failedResponse("could not load point cloud: " + path));
+            }
+            else if (command == "cloud")
+            {
+                int numPoints = -1;
+                int hasNormals = 0;
+                request >> numPoints >> hasNormals;
+                if (!request || numPoints < 0)
+                {
+                    // the size of the following data is unknown, so the connection can not continue
+                    writeResponse(answer, failedResponse("invalid cloud request: " + line));
+                    close = true;
+                }
+                else if (numPoints > m_max_cloud_points)
+                {
+                    // the following data is not read
+                    writeResponse(answer, failedResponse("the cloud exceeds the maximum of " +
+                                                         std::to_string(m_max_cloud_points) + " points"));
+                    close = true;
+                }
+                else
+                {
+                    // part of the values may already have been read with the line
+                    std::vector<float> values((std::size_t)numPoints * 9);
+                    const std::size_t bytes = values.size() * sizeof(float);
+                    const std::size_t buffered = std::min(buffer.size(), bytes);
+                    input.read((char*)values.data(), buffered);
+                    if (bytes > buffered)
+                        boost::asio::read(socket, boost::asio::buffer((char*)values.data() + buffered, bytes - buffered), error);
+                    if (error)
+                        break;
+
+                    pcl::PointCloud<PointNormalT>::Ptr points(new pcl::PointCloud<PointNormalT>());
+                    points->resize(numPoints);
+                    for (int i = 0; i < numPoints; i++)
+                    {
+                        const float *value = &values[(std::size_t)i * 9];
+                        PointNormalT &point = points->at(i);
+                        point.x = value[0];
+                        point.y = value[1];
+                        point.z = value[2];
+                        ism3d::setPointColor(point, (uint8_t)value[3], (uint8_t)value[4], (uint8_t)value[5]);
+                        point.normal_x = value[6];
+                        point.normal_y = value[7];
+                        point.normal_z = value[8];
+                        point.curvature = 0;
+                    }
+                    writeResponse(answer, detect(points, hasNormals != 0));
+                }
+            }
+            else if (command == "reload")
+            {
+                std::string path;
+                std::getline(request >> std::ws, path);
+                const Response response = reload(path);
+                if (response.ok)
+                {
+                    answer << "OK " << response.changed.size() << "\n";
+                    for (const std::string &name : response.changed)
+                        answer << name << "\n";
+                }
+                else
+                {
+                    answer << "ERROR " << response.error << "\n";
+                }
+            }
+            else if (command == "metrics")
+            {
+                writeMetrics(answer);
+                answer << "END\n";
+            }
+            else if (command == "shutdown")
+            {
+                answer << "OK 0\n";
+                stop();
+                close = true;
+            }
+            else
+            {
+                answer << "ERROR unknown request: " << command << "\n";
+            }
+        }
+        catch (const std::exception &e)
+        {
+            // a cloud request may have been interrupted while its data was read
+            answer.str("");
+            writeResponse(answer, failedResponse(e.what()));
+            close = command == "cloud";
+        }
+        catch (...)
+        {
+            answer.str("");
+            writeResponse(answer, failedResponse("an exception occurred"));
+            close = command == "cloud";
+        }
+
+        boost::asio::write(socket, boost::asio::buffer(answer.str()), error);
+        if (error || close)
+            break;
+    }
+}
+
+DetectionServer::Response DetectionServer::detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals)
+{
+    RequestPtr request = std::make_shared<Request>();
+    request->points = points;
+    request->hasNormals = hasNormals;
+    return enqueue(request);
+}
+
+DetectionServer::Response DetectionServer::reload(const std::string &filename)
+{
+    RequestPtr request = std::make_shared<Request>();
+    request->hasNormals = false;
+    request->reloadFile = filename;
+    return enqueue(request);
+}
+
+DetectionServer::Response DetectionServer::enqueue(RequestPtr request)
+{
+    std::future<Response> response = request->response.get_future();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping)
+        {
+            Response stopped;
+            stopped.ok = false;
+            stopped.error = "the server is shutting down";
+            return stopped;
+        }
+        m_queue.push_back(request);
+        m_max_queue_depth = std::max(m_max_queue_depth, (int)m_queue.size());
+    }
+    m_queue_changed.notify_all();
+    return response.get();
+}
+
+bool DetectionServer::takeBatch(std::vector<RequestPtr> &batch)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_queue_changed.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+    if (m_queue.empty())
+        return false;
+
+    batch.clear();
+    if (!m_queue.front()->reloadFile.empty())
+    {
+        batch.push_back(m_queue.front());
+        m_queue.pop_front();
+        return true;
+    }
+
+    // the window starts when the first request of the batch was queued
+    const long waited = (long)(m_queue.front()->timer.elapsed().wall / 1000000);
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+            std::chrono::milliseconds(std::max(m_batch_window_ms - waited, 0L));
+    m_queue_changed.wait_until(lock, deadline, [this]()
+    {
+        return m_stopping || (int)m_queue.size() >= m_max_batch_size;
+    });
+
+    // detections queued after a reload wait for it
+    while (!m_queue.empty() && (int)batch.size() < m_max_batch_size && m_queue.front()->reloadFile.empty())
+    {
+        const double wait = m_queue.front()->timer.elapsed().wall / 1e6;
+        m_total_wait += wait;
+        m_max_wait = std::max(m_max_wait, wait);
+        batch.push_back(m_queue.front());
+        m_queue.pop_front();
+    }
+    return true;
+}
+
+void DetectionServer::detectionLoop()
+{
+    std::vector<RequestPtr> batch;
+    while (takeBatch(batch))
+    {
+        if (!batch.front()->reloadFile.empty())
+        {
+            executeReload(*batch.front());
+            continue;
+        }
+
+        std::vector<pcl::PointCloud<PointNormalT>::Ptr> pointClouds;
+        std::vector<bool> hasNormals;
+        for (const RequestPtr &request : batch)
+        {
+            pointClouds.push_back(request->points);
+            hasNormals.push_back(request->hasNormals);
+        }
+
+        std::vector<std::tuple<std::vector<ism3d::VotingMaximum>, std::map<std::string, double> > > results;
+        std::string error;
+        try
+        {
+            results = m_ism.detectBatch(pointClouds, hasNormals);
+        }
+        catch (const ism3d::Exception &e)
+        {
+            error = e.what();
+        }
+        catch (...)
+        {
+            error = "an exception occurred";
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_num_batches++;
+        for (int i = 0; i < (int)batch.size(); i++)
+        {
+            Response response;
+            response.ok = error.empty();
+            response.error = error;
+            if (response.ok)
+            {
+                response.maxima = std::get<0>(results[i]);
+
+                // sum up the steps of all clouds, activation cache entries are counters
+                for (const std::pair<const std::string, double> &time : std::get<1>(results[i]))
+                {
+                    if (time.first.find("activation_cache") == 0)
+                        m_step_times[time.first] = time.second;
+                    else if (time.first != "complete")
+                        m_step_times[time.first] += time.second;
+                }
+            }
+            else
+            {
+                m_num_failed++;
+            }
+
+            const double latency = batch[i]->timer.elapsed().wall / 1e6;
+            m_num_requests++;
+            m_num_batched++;
+            m_total_latency += latency;
+            m_max_latency = std::max(m_max_latency, latency);
+            batch[i]->response.set_value(response);
+        }
+    }
+}
+
+void DetectionServer::executeReload(Request &request)
+{
+    // the model is only used by this thread, so no detection is running
+    Response response;
+    try
+    {
+        response.ok = m_ism.reloadParameters(request.reloadFile, response.changed, response.error);
+    }
+    catch (const ism3d::Exception &e)
+    {
+        response.ok = false;
+        response.error = e.what();
+    }
+    if (response.ok)
+        std::cout << "reloaded " << response.changed.size() << " parameters from " << request.reloadFile << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (response.ok)
+            m_num_reloads++;
+    }
+    request.response.set_value(response);
+}
+
+void DetectionServer::writeMetrics(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    out << "requests " << m_num_requests << "\n";
+    out << "failed_requests " << m_num_failed << "\n";
+    out << "batches " << m_num_batches << "\n";
+    out << "reloads " << m_num_reloads << "\n";
+    out << "mean_batch_size " << (m_num_batches > 0 ? (double)m_num_batched / m_num_batches : 0.0) << "\n";
+    out << "queue_depth " << m_queue.size() << "\n";
+    out << "max_queue_depth " << m_max_queue_depth << "\n";
+    out << "mean_queue_wait_ms " << (m_num_batched > 0 ? m_total_wait / m_num_batched : 0.0) << "\n";
+    out << "max_queue_wait_ms " << m_max_wait << "\n";
+    out << "mean_latency_ms " << (m_num_batched > 0 ? m_total_latency / m_num_batched : 0.0) << "\n";
+    out << "max_latency_ms " << m_max_latency << "\n";
+    for (const std::pair<const std::string, double> &time : m_step_times)
+    {
+        if (time.first.find("activation_cache") == 0)
+            out << time.first << " " << time.second << "\n";
+        else
+            out << "time_" << time.first << "_ms " << time.second << "\n";
+    }
+
+    // the recall monitor is thread safe, its statistics are accumulated over all detections of the model
+    const ism3d::Codebook *codebook = m_ism.getCodebook();
+    if (codebook && codebook->useRecallMonitor())
+    {
+        const ism3d::RecallMonitor::Statistics recall = codebook->getRecallMonitor().getStatistics();
+        out << "ann_recall_samples " << recall.samples << "\n";
+        out << "ann_recall_dropped " << recall.dropped << "\n";
+        out << "ann_recall " << recall.recall << "\n";
+        out << "ann_mean_distance_ratio " << recall.meanDistanceRatio << "\n";
+        out << "ann_max_distance_ratio " << recall.maxDistanceRatio << "\n";
+    }
+}
+
+void DetectionServer::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+    m_queue_changed.notify_all();
+    if (m_stop_listening)
+        m_stop_listening();
+}
+
+void DetectionServer::reapConnections()
+{
+    // a finished thread only has to return, which does not need the lock
+    for (std::list<ConnectionPtr>::iterator it = m_connections.begin(); it != m_connections.end();)
+    {
+        if ((*it)->finished)
+        {
+            (*it)->thread.join();
+            it = m_connections.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void DetectionServer::finish()
+{
+    stop();
+    if (m_detection.joinable())
+        m_detection.join();
+
+    // connections waiting for the next request are closed
+    std::list<ConnectionPtr> connections;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (const ConnectionPtr &connection : m_connections)
+            connection->close();
+        connections.swap(m_connections);
+    }
+    for (const ConnectionPtr &connection : connections)
+        connection->thread.join();
+}
@@ -0,0 +1,167 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DETECTION_SERVER_H
+#define ISM3D_DETECTION_SERVER_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/timer/timer.hpp>
+
+#include "../implicit_shape_model/implicit_shape_model.h"
+
+// writes a maximum in the format of the detection log: number, classID, weight, num-votes, position X Y Z,
+// bounding box size X Y Z, bounding Box rotation quaternion w x y z
+void writeDetectionLogEntry(std::ostream &out, int number, const ism3d::VotingMaximum &maximum);
+
+/**
+ * @brief The DetectionServer class
+ * Keeps a loaded implicit shape model and answers detection requests of clients connected over TCP or a Unix
+ * socket, so that the model is read and the index is built only once. Each connection is served by its own thread,
+ * requests of all connections are queued and detected together in batches with ImplicitShapeModel::detectBatch().
+ *
+ * The protocol is line based, each request is answered before the next request of the connection is read:
+ *   detect <path>                       detect in a point cloud file (.pcd or .ply) readable by the server
+ *   cloud <num points> <has normals>    detect in a point cloud sent after the line as num points * 9 float32
+ *                                       values in host byte order: x y z r g b normal_x normal_y normal_z
+ *   metrics                             the metrics of the server, one "name value" line each, ended by "END"
+ *   reload <path>                       apply the detection parameters of an ism file readable by the server, see
+ *                                       ImplicitShapeModel::reloadParameters(), between two batches
+ *   shutdown                            stop the server after the queued requests are answered
+ * A detection is answered with "OK <num maxima>" followed by one line per maximum as in the detection log, errors
+ * are answered with "ERROR <message>". A reload is answered with "OK <num parameters>" followed by one line per
+ * changed parameter. Request lines are limited to MaxLineLength characters and clouds to the maximum number of points
+ * of the server, a connection that exceeds a limit is answered with an error and closed.
+ *
+ * The requests are not authenticated, so TCP servers listen on the loopback interface unless an address is given.
+ */
+class DetectionServer
+{
+public:
+    /**
+     * @param ism the trained implicit shape model, only used by the detection thread of the server
+     * @param maxBatchSize the maximum number of point clouds detected together
+     * @param batchWindowMs the time a batch waits for further requests after its first request was queued
+     * @param maxCloudPoints the maximum number of points of a cloud sent with a request
+     */
+    DetectionServer(ism3d::ImplicitShapeModel &ism, int maxBatchSize, int batchWindowMs, int maxCloudPoints);
+    ~DetectionServer();
+
+    /**
+     * @brief Serve requests until a client sends "shutdown".
+     * @param endpoint a port number to listen on the loopback interface, "<address>:<port>" to listen on the given
+     *                 address, e.g. "0.0.0.0:5000" for all interfaces, or the path of a Unix socket
+     * @return false if the endpoint could not be opened
+     */
+    bool run(const std::string &endpoint);
+
+    // the metrics as returned to clients
+    void writeMetrics(std::ostream &out);
+
+    // the maximum length of a request line
+    static const std::size_t MaxLineLength = 4096;
+
+private:
+    struct Response
+    {
+        bool ok;
+        std::string error;
+        std::vector<ism3d::VotingMaximum> maxima;
+        std::vector<std::string> changed; // the parameters applied by a reload
+    };
+
+    struct Request
+    {
+        pcl::PointCloud<PointNormalT>::Ptr points;
+        bool hasNormals;
+        std::string reloadFile; // not empty for a reload, which is executed alone between two batches
+        boost::timer::cpu_timer timer; // started when the request is queued
+        std::promise<Response> response;
+    };
+    typedef std::shared_ptr<Request> RequestPtr;
+
+    struct Connection
+    {
+        std::thread thread;
+        std::function<void()> close;
+        bool finished; // set by the thread when the connection was closed, guarded by m_mutex
+    };
+    typedef std::shared_ptr<Connection> ConnectionPtr;
+
+    template<typename Protocol>
+    bool serve(const typename Protocol::endpoint &endpoint);
+
+    // reads requests from a connection until it is closed, the stream is a connected socket
+    template<typename Socket>
+    void serveConnection(Socket &socket);
+
+    // joins the threads of the closed connections, m_mutex has to be locked
+    void reapConnections();
+
+    // queues a request and waits for its detection
+    Response detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals);
+
+    // queues a reload of the parameters and waits until it was applied
+    Response reload(const std::string &filename);
+
+    // queues a request and waits for its response, fails if the server is shutting down
+    Response enqueue(RequestPtr request);
+
+    // takes the next batch, a reload is taken alone, false if the server stops and no request is left
+    bool takeBatch(std::vector<RequestPtr> &batch);
+
+    void detectionLoop();
+
+    void executeReload(Request &request);
+
+    // stops listening and the detection of further requests
+    void stop();
+
+    // waits for the queued requests to be answered and closes all connections
+    void finish();
+
+    ism3d::ImplicitShapeModel &m_ism;
+    int m_max_batch_size;
+    int m_batch_window_ms;
+    int m_max_cloud_points;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queue_changed;
+    std::deque<RequestPtr> m_queue;
+    bool m_stopping;
+    std::function<void()> m_stop_listening;
+    std::list<ConnectionPtr> m_connections;
+    std::thread m_detection;
+
+    // metrics, times in milliseconds, guarded by m_mutex
+    long m_num_requests;
+    long m_num_failed;
+    long m_num_batches;
+    long m_num_batched; // requests that were detected in a batch
+    long m_num_reloads; // reloads that were applied
+    int m_max_queue_depth;
+    double m_total_wait;
+    double m_max_wait;
+    double m_total_latency;
+    double m_max_latency;
+    std::map<std::string, double> m_step_times;
+};
+
+#endif // ISM3D_DETECTION_SERVER_H
@@ -0,0 +1,177 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "latency_report.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+
+namespace
+{
+    double getCounter(const std::map<std::string, double> &counters, const std::string &name)
+    {
+        std::map<std::string, double>::const_iterator it = counters.find(name);
+        return it != counters.end() ? it->second : -1.0;
+    }
+
+    // unknown counters are empty fields
+    std::string formatCounter(double value)
+    {
+        if (value < 0)
+            return "";
+        std::ostringstream stream;
+        stream << std::fixed << std::setprecision(0) << value;
+        return stream.str();
+    }
+
+    void writeQuantiles(std::ostream &out, std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        out << std::setw(12) << LatencyReport::percentile(values, 0.5)
+            << std::setw(12) << LatencyReport::percentile(values, 0.9)
+            << std::setw(12) << LatencyReport::percentile(values, 0.99)
+            << std::setw(12) << (values.empty() ? 0.0 : values.back()) << "\n";
+    }
+}
+
+void LatencyReport::add(int index, const std::string &pointCloud, const std::map<std::string, double> &times,
+                        const std::map<std::string, double> &counters)
+{
+    Record record;
+    record.index = index;
+    record.pointCloud = pointCloud;
+    record.points = getCounter(counters, "points");
+    record.keypoints = getCounter(counters, "keypoints");
+    record.votes = getCounter(counters, "votes");
+
+    // activation cache entries are counters, not times
+    for (const std::pair<const std::string, double> &entry : times)
+    {
+        if (entry.first.find("activation_cache") != 0)
+            record.times[entry.first] = entry.second;
+    }
+    m_records.push_back(record);
+}
+
+double LatencyReport::percentile(const std::vector<double> &sorted, double q)
+{
+    if (sorted.empty())
+        return 0.0;
+    const int rank = std::max((int)std::ceil(q * sorted.size()) - 1, 0);
+    return sorted[std::min(rank, (int)sorted.size() - 1)];
+}
+
+std::vector<std::string> LatencyReport::getStages() const
+{
+    // the complete time first, then the stages by name
+    std::set<std::string> names;
+    for (const Record &record : m_records)
+    {
+        for (const std::pair<const std::string, double> &entry : record.times)
+            names.insert(entry.first);
+    }
+
+    std::vector<std::string> stages;
+    if (names.erase("complete"))
+        stages.push_back("complete");
+    stages.insert(stages.end(), names.begin(), names.end());
+    return stages;
+}
+
+bool LatencyReport::writeCsv(const std::string &file) const
+{
+    std::ofstream out(file.c_str(), std::ios::out);
+    const std::vector<std::string> stages = getStages();
+    out << "index,file,points,keypoints,votes";
+    for (const std::string &stage : stages)
+        out << "," << stage << "_ms";
+    out << "\n";
+
+    for (const Record &record : m_records)
+    {
+        // quotes in the file name are doubled
+        std::string file = record.pointCloud;
+        for (std::size_t pos = file.find('"'); pos != std::string::npos; pos = file.find('"', pos + 2))
+            file.insert(pos, 1, '"');
+
+        out << record.index << ",\"" << file << "\"," << formatCounter(record.points) << ","
+            << formatCounter(record.keypoints) << "," << formatCounter(record.votes);
+        for (const std::string &stage : stages)
+        {
+            std::map<std::string, double>::const_iterator it = record.times.find(stage);
+            out << ",";
+            if (it != record.times.end())
+                out << it->second;
+        }
+        out << "\n";
+    }
+    out.close();
+    return (bool)out;
+}
+
+void LatencyReport::writeSummary(std::ostream &out, double wallSeconds) const
+{
+    const int numClouds = (int)m_records.size();
+    const std::ios::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "\nthroughput: " << (wallSeconds > 0 ? numClouds / wallSeconds : 0.0) << " point clouds/s ("
+        << numClouds << " point clouds in " << wallSeconds << " [s])\n";
+
+    out << "latency per point cloud [ms]:\n";
+    out << std::left << std::setw(20) << "stage" << std::right << std::setw(12) << "p50" << std::setw(12) << "p90"
+        << std::setw(12) << "p99" << std::setw(12) << "max" << "\n";
+    for (const std::string &stage : getStages())
+    {
+        std::vector<double> values;
+        for (const Record &record : m_records)
+        {
+            std::map<std::string, double>::const_iterator it = record.times.find(stage);
+            if (it != record.times.end())
+                values.push_back(it->second);
+        }
+        out << std::left << std::setw(20) << stage << std::right;
+        writeQuantiles(out, values);
+    }
+
+    // the complete time by input size in buckets of [2^k, 2^(k+1)) points, -1 for unknown sizes
+    std::map<int, std::vector<double> > buckets;
+    for (const Record &record : m_records)
+    {
+        std::map<std::string, double>::const_iterator it = record.times.find("complete");
+        if (it == record.times.end())
+            continue;
+        const int bucket = record.points >= 1 ? (int)std::floor(std::log2(record.points)) : -1;
+        buckets[bucket].push_back(it->second);
+    }
+
+    out << "complete latency by input size [ms]:\n";
+    out << std::left << std::setw(20) << "points" << std::right << std::setw(8) << "clouds" << std::setw(12) << "p50"
+        << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "max" << "\n";
+    for (const std::pair<const int, std::vector<double> > &bucket : buckets)
+    {
+        std::string range = "unknown";
+        if (bucket.first >= 0)
+        {
+            const long long lower = 1LL << bucket.first;
+            range = std::to_string(lower) + "-" + std::to_string(2 * lower - 1);
+        }
+        out << std::left << std::setw(20) << range << std::right << std::setw(8) << bucket.second.size();
+        writeQuantiles(out, bucket.second);
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,74 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_LATENCY_REPORT_H
+#define ISM3D_LATENCY_REPORT_H
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The LatencyReport class
+ * Collects the stage times and the work counters of each point cloud of a detection run. The summary reports the
+ * distribution of the latencies instead of their sums: the percentiles of each stage, the throughput of the run
+ * and the percentiles of the complete time by input size, in buckets of powers of two points. The records of all
+ * point clouds are written as CSV, one line per point cloud.
+ */
+class LatencyReport
+{
+public:
+    // counters that are unknown for a point cloud, e.g. in streaming detection, are -1
+    struct Record
+    {
+        int index; // in the test list
+        std::string pointCloud;
+        double points;
+        double keypoints;
+        double votes;
+        std::map<std::string, double> times; // stage times in milliseconds
+    };
+
+    /**
+     * @brief Add the results of a point cloud.
+     * @param index the index of the point cloud in the test list
+     * @param pointCloud the file of the point cloud
+     * @param times the times of the detection, counters (activation_cache_*) are skipped
+     * @param counters the counters of the detection statistics, "points", "keypoints" and "votes" are used
+     */
+    void add(int index, const std::string &pointCloud, const std::map<std::string, double> &times,
+             const std::map<std::string, double> &counters);
+
+    const std::vector<Record>& getRecords() const
+    {
+        return m_records;
+    }
+
+    // writes the records with one column per stage, returns false if the file could not be written
+    bool writeCsv(const std::string &file) const;
+
+    /**
+     * @brief Write the percentiles of the stages, the throughput and the latency by input size.
+     * @param out the summary
+     * @param wallSeconds the wall time of the run, for the throughput
+     */
+    void writeSummary(std::ostream &out, double wallSeconds) const;
+
+    // the value at quantile q of sorted values (nearest rank), 0 without values
+    static double percentile(const std::vector<double> &sorted, double q);
+
+private:
+    std::vector<std::string> getStages() const;
+
+    std::vector<Record> m_records;
+};
+
+#endif // ISM3D_LATENCY_REPORT_H
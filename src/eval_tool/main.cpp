@@ -34,191 +34,1906 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <omp.h>
+#include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
 #include <boost/program_options/errors.hpp>
 #include "../implicit_shape_model/implicit_shape_model.h"
+#include "../implicit_shape_model/detection_session.h"
+#include "../implicit_shape_model/streaming_detector.h"
+#include "../implicit_shape_model/utils/memory_report.h"
+#include "detection_server.h"
+#include "latency_report.h"
+#include "result_log.h"
+#include "time_sketch.h"
 
 
 bool write_log_to_files = true;
 bool log_info = true;
 
 
-int main(int argc, char **argv)
+// counts the classification results of the detected maxima and writes them to a summary file
+struct DetectionSummary
 {
-    boost::program_options::options_description generic("Generic options");
-    boost::program_options::options_description training("Training");
-    boost::program_options::options_description detection("Detection");
+    DetectionSummary()
+        : numCorrectClasses(0), numCorrect80(0), numCorrectGlobal(0), numBothCorrect(0), numOnlyGlobalCorrect(0)
+    {
+    }
+
+    void add(std::ofstream &summaryFile, const std::string &pointCloud, unsigned trueID,
+             const std::vector<ism3d::VotingMaximum> &maxima)
+    {
+        int classId, classId80, classIdglobal;
+        classify(maxima, trueID, classId, classId80, classIdglobal);
+        add(summaryFile, pointCloud, trueID, classId, classId80, classIdglobal);
+    }
+
+    // the classified class, the class among the maxima above 80% of the best one and the global class, -1 if none
+    static void classify(const std::vector<ism3d::VotingMaximum> &maxima, unsigned trueID,
+                         int &classId, int &classId80, int &classIdglobal)
+    {
+        classId = -1;
+        classIdglobal = -1;
+        classId80 = -1;
+        if(maxima.size() > 0)
+        {
+            classId = maxima.at(0).classId;
+            classIdglobal = maxima.at(0).globalHypothesis.first;
+        }
+
+        // check for classification including non-best maxima
+        for (int i = 0; i < (int)maxima.size(); i++)
+        {
+            const ism3d::VotingMaximum& maximum = maxima[i];
+            if(maximum.weight < maxima[0].weight * 0.8) break;
+
+            classId80 = maximum.classId;
+            if(classId80 == trueID) break;
+        }
+    }
+
+    void add(std::ofstream &summaryFile, const std::string &pointCloud, unsigned trueID,
+             int classId, int classId80, int classIdglobal)
+    {
+        // only display additional classifiers if they are different from normal classification
+        summaryFile << "file: " << pointCloud << ", ground truth class: " << trueID << ", classified class: " << classId;
+
+        if(classId != classIdglobal)
+        {
+            summaryFile << ", global class: " << classIdglobal;
+        }
+        summaryFile << std::endl;
+
+        // count correct matches
+        // normal classifier
+        if(((int)trueID) == classId)
+        {
+            numCorrectClasses++;
+        }
+        if(((int)trueID) == classId80)
+        {
+            numCorrect80++;
+        }
+        // global classifier
+        if(((int)trueID) == classIdglobal)
+        {
+            numCorrectGlobal++;
+        }
+        // both correct
+        if((int)trueID == classId && (int)trueID == classIdglobal)
+        {
+            numBothCorrect++;
+        }
+        // global correct, normal wrong
+        if((int)trueID != classId && (int)trueID == classIdglobal)
+        {
+            numOnlyGlobalCorrect++;
+        }
+    }
+
+    void writeResults(std::ofstream &summaryFile, int numClouds) const
+    {
+        summaryFile << "\n\n result: " << numCorrectClasses << " of " << numClouds << " shapes classified correctly ("
+                    << ((float)numCorrectClasses/numClouds)*100.0f << " %)\n";
+        summaryFile << " result: " << numCorrect80 << " of " << numClouds << " shapes classified correctly ("
+                    << ((float)numCorrect80/numClouds)*100.0f << " %) [above 80% of top result's score]\n";
+
+        summaryFile << " result: " << numCorrectGlobal << " of " << numClouds << " shapes classified correctly with global descriptors ("
+                    << ((float)numCorrectGlobal/numClouds)*100.0f << " %)\n\n";
+        summaryFile << " both correct: " << numBothCorrect << " (" << ((float)numBothCorrect/numClouds)*100.0f << " %)\n";
+        summaryFile << " only global correct: " << numOnlyGlobalCorrect << " (" << ((float)numOnlyGlobalCorrect/numClouds)*100.0f << " %)\n\n\n";
+    }
+
+    int numCorrectClasses;
+    int numCorrect80;
+
+    int numCorrectGlobal;
+    int numBothCorrect;
+    int numOnlyGlobalCorrect;
+};
+
+
+// writes the detected maxima of a point cloud to a detection log file in the output folder
+void writeDetectionLog(const std::string &folder, const std::string &ismFile, const std::string &pointCloud,
+                       unsigned trueID, const std::vector<ism3d::VotingMaximum> &maxima)
+{
+    unsigned tmp = pointCloud.find_last_of('/');
+    if(tmp == std::string::npos) tmp = 0;
+    std::string fileWithoutFolder = pointCloud.substr(tmp+1);
+
+    std::string outFileName = folder;
+    outFileName.append("/");
+    outFileName.append(fileWithoutFolder);
+    outFileName.append(".txt");
+
+    std::ofstream file;
+    file.open(outFileName.c_str(), std::ios::out);
+    file << "ISM3D detection log, filename: " << ismFile << ", point cloud: " << pointCloud << ", ground truth class ID: " << trueID << "\n";
+    file << "number, classID, weight, num-votes, position X Y Z, bounding box size X Y Z, bounding Box rotation quaternion w x y z \n";
+
+    for (int i = 0; i < (int)maxima.size(); i++)
+    {
+        writeDetectionLogEntry(file, i, maxima[i]);
+    }
+
+    file.close();
+}
+
+
+// writes the processing time of each step, summed over all point clouds, to the summary file
+void writeSummaryTimes(std::ofstream &summaryFile, std::map<std::string, double> &times)
+{
+    double time_sum = 0;
+    for(auto it : times)
+    {
+        // activation cache entries are counters, not times
+        if(it.first == "complete" || it.first.find("activation_cache") == 0) continue;
+        time_sum += (it.second / 1000);
+    }
+    summaryFile << "\n\n\ncomplete time: " << times["complete"] / 1000 << " [s]" << ", sum all steps: " << time_sum << " [s]" << std::endl;
+    summaryFile << "times per step:\n";
+    summaryFile << "create flann index: " << std::setw(10) << std::setfill(' ') << times["flann"] / 1000 << " [s]" << std::endl;
+    summaryFile << "compute normals:    " << std::setw(10) << std::setfill(' ') << times["normals"] / 1000 << " [s]" << std::endl;
+    summaryFile << "compute keypoints:  " << std::setw(10) << std::setfill(' ') << times["keypoints"] / 1000 << " [s]" << std::endl;
+    summaryFile << "compute features:   " << std::setw(10) << std::setfill(' ') << times["features"] / 1000 << " [s]" << std::endl;
+    summaryFile << "cast votes:         " << std::setw(10) << std::setfill(' ') << times["voting"] / 1000 << " [s]" << std::endl;
+    summaryFile << "find maxima:        " << std::setw(10) << std::setfill(' ') << times["maxima"] / 1000 << " [s]" << std::endl;
+    if(times.find("activation_cache_hit_rate") != times.end())
+    {
+        summaryFile << "activation cache:   " << times["activation_cache_hits"] << " hits, " <<
+                       times["activation_cache_misses"] << " misses, hit rate " <<
+                       times["activation_cache_hit_rate"] * 100.0 << " %" << std::endl;
+    }
+}
+
+
+// writes the detection logs and the summary of a binary result log (see ResultLogWriter) to the output folder, as if
+// the detection had written the text files
+bool convertResultLog(const std::string &resultFile, const std::string &folder)
+{
+    ResultLogReader reader(resultFile);
+    if (!reader.good())
+    {
+        std::cerr << "could not read result log: " << resultFile << std::endl;
+        return false;
+    }
+
+    std::ofstream summaryFile((boost::filesystem::path(folder) / "summary.txt").string().c_str(), std::ios::out);
+    DetectionSummary summary;
+    std::map<std::string, double> times;
+    std::string ismFile;
+    int numClouds = 0;
+    double totalTime = 0;
+
+    while (reader.next())
+    {
+        if (reader.getType() == ResultLogWriter::RunRecord)
+        {
+            ismFile = reader.getName();
+        }
+        else if (reader.getType() == ResultLogWriter::CloudRecord)
+        {
+            if (write_log_to_files)
+                writeDetectionLog(folder, ismFile, reader.getName(), reader.getTrueId(), reader.getMaxima());
+            summary.add(summaryFile, reader.getName(), reader.getTrueId(), reader.getMaxima());
+            numClouds++;
+        }
+        else if (reader.getName() == "total")
+        {
+            totalTime = reader.getValue();
+        }
+        else
+        {
+            times[reader.getName()] = reader.getValue();
+        }
+    }
+    if (reader.failed())
+    {
+        std::cerr << "result log is corrupt after " << numClouds << " point clouds: " << resultFile << std::endl;
+        return false;
+    }
+
+    writeSummaryTimes(summaryFile, times);
+    summary.writeResults(summaryFile, numClouds);
+    summaryFile << " Total processing time: " << std::fixed << std::setprecision(4) << totalTime << " seconds \n";
+    summaryFile.close();
+    return true;
+}
+
+
+// parses a shard given as i/n, with 0 <= i < n
+bool parseShard(const std::string &value, int &shardIndex, int &numShards)
+{
+    char separator = 0;
+    std::istringstream stream(value);
+    return (stream >> shardIndex >> separator >> numShards) && separator == '/' && numShards > 0 &&
+            shardIndex >= 0 && shardIndex < numShards;
+}
+
+
+std::string getShardName(int shardIndex, int numShards)
+{
+    return "shard_" + std::to_string(shardIndex) + "_of_" + std::to_string(numShards);
+}
+
+
+// the partial results of a shard of the test list detected with --shard, written to <shard name>.json in the output
+// folder and combined into the summary of the whole list with --merge-shards
+struct ShardResults
+{
+    struct Cloud
+    {
+        int index; // in the test list
+        std::string pointCloud;
+        unsigned trueID;
+        int classId;
+        int classId80;
+        int classIdglobal;
+    };
+
+    ShardResults()
+        : shardIndex(0), numShards(1), numListed(0), totalTime(0)
+    {
+    }
+
+    void add(int index, const std::string &pointCloud, unsigned trueID, const std::vector<ism3d::VotingMaximum> &maxima,
+             const std::map<std::string, double> &cloudTimes)
+    {
+        Cloud cloud;
+        cloud.index = index;
+        cloud.pointCloud = pointCloud;
+        cloud.trueID = trueID;
+        DetectionSummary::classify(maxima, trueID, cloud.classId, cloud.classId80, cloud.classIdglobal);
+        clouds.push_back(cloud);
+
+        // activation cache entries are counters
+        for (const std::pair<const std::string, double> &entry : cloudTimes)
+        {
+            if (entry.first.find("activation_cache") != 0)
+                stages[entry.first].add(entry.second);
+        }
+    }
+
+    Json::Value toJson() const
+    {
+        Json::Value object(Json::objectValue);
+        object["ism"] = ismFile;
+        object["shard_index"] = shardIndex;
+        object["num_shards"] = numShards;
+        object["num_listed"] = numListed;
+        object["total_s"] = totalTime;
+        for (const std::pair<const std::string, double> &entry : times)
+            object["times"][entry.first] = entry.second;
+        for (const std::pair<const std::string, TimeSketch> &stage : stages)
+            object["stages"][stage.first] = stage.second.toJson();
+
+        Json::Value cloudArray(Json::arrayValue);
+        for (const Cloud &cloud : clouds)
+        {
+            Json::Value entry(Json::objectValue);
+            entry["index"] = cloud.index;
+            entry["file"] = cloud.pointCloud;
+            entry["ground_truth"] = cloud.trueID;
+            entry["class"] = cloud.classId;
+            entry["class_80"] = cloud.classId80;
+            entry["global_class"] = cloud.classIdglobal;
+            cloudArray.append(entry);
+        }
+        object["clouds"] = cloudArray;
+        return object;
+    }
+
+    bool fromJson(const Json::Value &object)
+    {
+        if (!object.isObject() || !object["shard_index"].isInt() || !object["num_shards"].isInt() ||
+                !object["num_listed"].isInt() || !object["clouds"].isArray())
+            return false;
+
+        ismFile = object["ism"].asString();
+        shardIndex = object["shard_index"].asInt();
+        numShards = object["num_shards"].asInt();
+        numListed = object["num_listed"].asInt();
+        totalTime = object["total_s"].asDouble();
+        for (const std::string &name : object["times"].getMemberNames())
+            times[name] = object["times"][name].asDouble();
+        for (const std::string &name : object["stages"].getMemberNames())
+        {
+            if (!stages[name].fromJson(object["stages"][name]))
+                return false;
+        }
+
+        for (const Json::Value &entry : object["clouds"])
+        {
+            Cloud cloud;
+            cloud.index = entry["index"].asInt();
+            cloud.pointCloud = entry["file"].asString();
+            cloud.trueID = entry["ground_truth"].asUInt();
+            cloud.classId = entry["class"].asInt();
+            cloud.classId80 = entry["class_80"].asInt();
+            cloud.classIdglobal = entry["global_class"].asInt();
+            if (cloud.index < 0 || cloud.index >= numListed)
+                return false;
+            clouds.push_back(cloud);
+        }
+        return true;
+    }
+
+    std::string ismFile;
+    int shardIndex;
+    int numShards;
+    int numListed;                              // the number of point clouds of the whole test list
+    std::vector<Cloud> clouds;
+    std::map<std::string, TimeSketch> stages;   // the times of each point cloud by stage in milliseconds
+    std::map<std::string, double> times;        // the summed times and the counters of the summary
+    double totalTime;                           // wall time of the shard in seconds
+};
+
+
+// combines the partial results of all shards of a test list into the summary of the whole list: summary.txt in the
+// format of a detection without shards and summary.json with the sums and percentiles of the stage times; the
+// detection logs of shards that were written to other folders are copied to the output folder
+bool mergeShards(const std::vector<std::string> &shardFiles, const std::string &folder)
+{
+    std::vector<ShardResults> shards(shardFiles.size());
+    for (int s = 0; s < (int)shardFiles.size(); s++)
+    {
+        std::ifstream stream(shardFiles[s].c_str());
+        Json::Value object;
+        Json::Reader reader;
+        if (!stream || !reader.parse(stream, object) || !shards[s].fromJson(object))
+        {
+            std::cerr << "could not read shard results: " << shardFiles[s] << std::endl;
+            return false;
+        }
+    }
+    if (shards.empty())
+        return false;
+
+    // every shard of the same run is needed exactly once
+    const int numShards = shards[0].numShards;
+    const int numListed = shards[0].numListed;
+    std::vector<int> shardFile(numShards, -1);
+    for (int s = 0; s < (int)shards.size(); s++)
+    {
+        const ShardResults &shard = shards[s];
+        if (shard.numShards != numShards || shard.numListed != numListed || shard.ismFile != shards[0].ismFile)
+        {
+            std::cerr << "shard results of different runs: " << shardFiles[0] << ", " << shardFiles[s] << std::endl;
+            return false;
+        }
+        if (shardFile[shard.shardIndex] >= 0)
+        {
+            std::cerr << "shard " << shard.shardIndex << " is given twice: " << shardFiles[shardFile[shard.shardIndex]]
+                      << ", " << shardFiles[s] << std::endl;
+            return false;
+        }
+        shardFile[shard.shardIndex] = s;
+    }
+    for (int i = 0; i < numShards; i++)
+    {
+        if (shardFile[i] < 0)
+        {
+            std::cerr << "the results of shard " << getShardName(i, numShards) << " are missing" << std::endl;
+            return false;
+        }
+    }
+
+    // the point clouds in the order of the test list
+    std::vector<std::pair<const ShardResults::Cloud*, int> > clouds;
+    for (int s = 0; s < (int)shards.size(); s++)
+        for (const ShardResults::Cloud &cloud : shards[s].clouds)
+            clouds.push_back(std::make_pair(&cloud, s));
+    std::sort(clouds.begin(), clouds.end(), [](const std::pair<const ShardResults::Cloud*, int> &a,
+                                               const std::pair<const ShardResults::Cloud*, int> &b)
+    {
+        return a.first->index < b.first->index;
+    });
+    if ((int)clouds.size() != numListed)
+        std::cerr << "the shards contain " << clouds.size() << " of " << numListed << " point clouds" << std::endl;
+
+    // times are summed, the activation cache counters of the shards are combined, the run took as long as the
+    // slowest shard
+    std::map<std::string, double> times;
+    std::map<std::string, TimeSketch> stages;
+    double totalTime = 0;
+    for (const ShardResults &shard : shards)
+    {
+        for (const std::pair<const std::string, double> &entry : shard.times)
+        {
+            if (entry.first != "activation_cache_hit_rate")
+                times[entry.first] += entry.second;
+        }
+        for (const std::pair<const std::string, TimeSketch> &stage : shard.stages)
+            stages[stage.first].merge(stage.second);
+        totalTime = std::max(totalTime, shard.totalTime);
+    }
+    if (times.count("activation_cache_hits"))
+    {
+        double lookups = times["activation_cache_hits"] + times["activation_cache_misses"];
+        times["activation_cache_hit_rate"] = lookups > 0 ? times["activation_cache_hits"] / lookups : 0.0;
+    }
+
+    std::ofstream summaryFile((boost::filesystem::path(folder) / "summary.txt").string().c_str(), std::ios::out);
+    DetectionSummary summary;
+    int numCopied = 0;
+    for (const std::pair<const ShardResults::Cloud*, int> &entry : clouds)
+    {
+        const ShardResults::Cloud &cloud = *entry.first;
+        summary.add(summaryFile, cloud.pointCloud, cloud.trueID, cloud.classId, cloud.classId80, cloud.classIdglobal);
+
+        // the detection log has the name of the point cloud, see writeDetectionLog()
+        const boost::filesystem::path shardFolder = boost::filesystem::absolute(shardFiles[entry.second]).parent_path();
+        const boost::filesystem::path logName = boost::filesystem::path(cloud.pointCloud).filename().string() + ".txt";
+        if (boost::filesystem::exists(shardFolder / logName) && !boost::filesystem::equivalent(shardFolder, folder))
+        {
+            boost::filesystem::copy_file(shardFolder / logName, boost::filesystem::path(folder) / logName,
+                                         boost::filesystem::copy_option::overwrite_if_exists);
+            numCopied++;
+        }
+    }
+    writeSummaryTimes(summaryFile, times);
+    summary.writeResults(summaryFile, clouds.size());
+    summaryFile << " Total processing time: " << std::fixed << std::setprecision(4) << totalTime << " seconds \n";
+    summaryFile.close();
+
+    Json::Value result(Json::objectValue);
+    result["ism"] = shards[0].ismFile;
+    result["num_shards"] = numShards;
+    result["num_clouds"] = (int)clouds.size();
+    result["correct"] = summary.numCorrectClasses;
+    result["correct_80"] = summary.numCorrect80;
+    result["correct_global"] = summary.numCorrectGlobal;
+    result["total_s"] = totalTime;
+    for (const std::pair<const std::string, TimeSketch> &stage : stages)
+    {
+        Json::Value &entry = result["stages"][stage.first];
+        entry["count"] = (Json::UInt64)stage.second.getCount();
+        entry["sum_ms"] = stage.second.getSum();
+        entry["mean_ms"] = stage.second.getCount() > 0 ? stage.second.getSum() / stage.second.getCount() : 0.0;
+        entry["median_ms"] = stage.second.quantile(0.5);
+        entry["p95_ms"] = stage.second.quantile(0.95);
+        entry["p99_ms"] = stage.second.quantile(0.99);
+        entry["max_ms"] = stage.second.getMax();
+        entry["sketch"] = stage.second.toJson();
+    }
+    std::ofstream resultStream((boost::filesystem::path(folder) / "summary.json").string().c_str(), std::ios::out);
+    Json::StyledWriter writer;
+    resultStream << writer.write(result);
+    resultStream.close();
+
+    std::cout << "merged " << numShards << " shards with " << clouds.size() << " point clouds";
+    if (numCopied > 0)
+        std::cout << ", " << numCopied << " detection logs copied";
+    std::cout << std::endl;
+    return (int)clouds.size() == numListed;
+}
+
+
+// detects in the point clouds of the loader with one session per job, each with an equal share of the threads, the
+// results are passed to the callback in input order with the counters of their detection, the time to create the
+// index is added to the first point cloud
+bool detectParallel(ism3d::ImplicitShapeModel &ism, std::shared_ptr<ism3d::PointCloudLoader> loader, int numClouds, int jobs,
+                    const std::function<void(int, const std::vector<ism3d::VotingMaximum>&,
+                                             const std::map<std::string, double>&,
+                                             const std::map<std::string, double>&)> &callback)
+{
+    jobs = std::max(std::min(jobs, numClouds), 1);
+    const int threads = std::max(omp_get_max_threads() / jobs, 1);
+    std::cout << "detecting with " << jobs << " jobs and " << threads << " threads each" << std::endl;
+
+    boost::timer::cpu_timer timer_flann;
+    std::vector<std::shared_ptr<ism3d::DetectionSession> > sessions;
+    for (int i = 0; i < jobs; i++)
+    {
+        sessions.push_back(ism.createSession());
+        sessions.back()->setNumThreads(threads);
+    }
+    const double flannTime = timer_flann.elapsed().wall / 1e6;
+
+    struct Result
+    {
+        Result() : done(false) {}
+        bool done;
+        std::vector<ism3d::VotingMaximum> maxima;
+        std::map<std::string, double> times;
+        std::map<std::string, double> counters;
+    };
+    std::vector<Result> results(numClouds);
+    std::mutex mutex;
+    std::condition_variable resultReady;
+    int nextCloud = 0;
+    int failedCloud = numClouds; // the first point cloud that could not be loaded
+    std::exception_ptr error;
+
+    std::vector<std::thread> workers;
+    for (int w = 0; w < jobs; w++)
+    {
+        workers.emplace_back([&, w]()
+        {
+            // the OpenMP loops of this thread share the cores with the other jobs
+            omp_set_num_threads(threads);
+            try
+            {
+                while (true)
+                {
+                    // the clouds are taken in order, so that the loader can prefetch them
+                    int index;
+                    bool hasNormals = false;
+                    pcl::PointCloud<PointNormalT>::Ptr points;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (nextCloud >= failedCloud || error)
+                            break;
+                        index = nextCloud++;
+                        points = loader->next(&hasNormals);
+                        if (points.get() == 0)
+                        {
+                            failedCloud = index;
+                            resultReady.notify_all();
+                            break;
+                        }
+                    }
+
+                    Result result;
+                    sessions[w]->detect(points, hasNormals, result.maxima, result.times);
+                    result.counters = sessions[w]->getLastDetectionStatistics().counters;
+                    result.done = true;
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    results[index] = result;
+                    resultReady.notify_all();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                resultReady.notify_all();
+            }
+        });
+    }
+
+    // the results are passed on in input order while the workers continue
+    try
+    {
+        for (int i = 0; i < numClouds; i++)
+        {
+            Result result;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                resultReady.wait(lock, [&]() { return results[i].done || error || i >= failedCloud; });
+                if (!results[i].done)
+                    break;
+                std::swap(result, results[i]);
+            }
+
+            if (i == 0)
+                result.times["flann"] += flannTime;
+            callback(i, result.maxima, result.times, result.counters);
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+            error = std::current_exception();
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+    if (error)
+        std::rethrow_exception(error);
+    return failedCloud == numClouds;
+}
+
+// reads a dataset list with a filename and a class id per line, the first line may be "# train" or "# test"
+bool readDatasetList(const std::string &listFile, std::vector<std::string> &filenames, std::vector<unsigned> &labels)
+{
+    std::ifstream infile(listFile);
+    if (!infile)
+        return false;
+
+    std::string file;
+    std::string label;
+    while(infile >> file >> label)
+    {
+        if(file == "#")
+            continue;
+        filenames.push_back(file);
+        labels.push_back(std::stoul(label));
+    }
+    return !filenames.empty();
+}
+
+// computes the normals of the point clouds of a dataset list with ImplicitShapeModel::add_normals and the normal
+// parameters of the ism file, jobs point clouds at a time with an equal share of the threads; the clouds are written
+// to the folder below the directory common to all clouds, clouds whose output is newer than the input are skipped,
+// and the list is written to the folder with the paths of the clouds with normals
+bool addNormalsToDataset(const std::string &ismFile, const std::string &listFile, int jobs, const std::string &folder)
+{
+    std::vector<std::string> files;
+    std::vector<unsigned> labels;
+    if (!readDatasetList(listFile, files, labels))
+    {
+        std::cerr << "could not read the dataset list: " << listFile << std::endl;
+        return false;
+    }
+
+    // the mode line of the list is kept
+    std::string header;
+    {
+        std::ifstream infile(listFile);
+        std::string first, second;
+        if (infile >> first >> second && first == "#")
+            header = first + " " + second;
+    }
+
+    ism3d::ImplicitShapeModel ism;
+    ism.setLogging(log_info);
+    ism.setSignalsState(false);
+    if (!ism.readObject(ismFile, true))
+    {
+        std::cerr << "could not read ism from file: " << ismFile << std::endl;
+        return false;
+    }
+
+    // the output keeps the directories of the clouds below their common directory, e.g. one per class
+    std::vector<boost::filesystem::path> parents;
+    for (const std::string &file : files)
+        parents.push_back(boost::filesystem::absolute(file).parent_path());
+    boost::filesystem::path common = parents[0];
+    for (const boost::filesystem::path &parent : parents)
+    {
+        boost::filesystem::path prefix;
+        for (auto a = common.begin(), b = parent.begin(); a != common.end() && b != parent.end() && *a == *b; ++a, ++b)
+            prefix /= *a;
+        common = prefix;
+    }
+
+    const int numFiles = (int)files.size();
+    std::vector<boost::filesystem::path> targets(numFiles);
+    for (int i = 0; i < numFiles; i++)
+    {
+        boost::filesystem::path target = folder;
+        auto component = parents[i].begin();
+        for (auto it = common.begin(); it != common.end(); ++it)
+            ++component;
+        for (; component != parents[i].end(); ++component)
+            target /= *component;
+        targets[i] = target / (boost::filesystem::path(files[i]).stem().string() + ".pcd");
+    }
+
+    jobs = std::max(std::min(jobs > 0 ? jobs : omp_get_max_threads(), numFiles), 1);
+    const int threads = std::max(omp_get_max_threads() / jobs, 1);
+    std::cout << "computing normals with " << jobs << " jobs and " << threads << " threads each" << std::endl;
+
+    std::mutex mutex;
+    int nextFile = 0;
+    int numSkipped = 0;
+    std::vector<std::string> failed;
+    std::vector<std::thread> workers;
+    for (int w = 0; w < jobs; w++)
+    {
+        workers.emplace_back([&]()
+        {
+            omp_set_num_threads(threads);
+            while (true)
+            {
+                int index;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (nextFile >= numFiles)
+                        break;
+                    index = nextFile++;
+                }
+
+                bool success = false;
+                bool skipped = false;
+                try
+                {
+                    const boost::filesystem::path &target = targets[index];
+                    if (boost::filesystem::exists(target) &&
+                            boost::filesystem::last_write_time(target) >= boost::filesystem::last_write_time(files[index]))
+                    {
+                        skipped = true;
+                        success = true;
+                    }
+                    else
+                    {
+                        boost::system::error_code ec;
+                        boost::filesystem::create_directories(target.parent_path(), ec);
+                        success = ism.add_normals(files[index], target.parent_path().string(), threads);
+                    }
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << files[index] << ": " << e.what() << std::endl;
+                }
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (skipped)
+                    numSkipped++;
+                if (!success)
+                    failed.push_back(files[index]);
+                else if (!skipped)
+                    std::cout << "computed normals of " << files[index] << std::endl;
+            }
+        });
+    }
+    for (std::thread &worker : workers)
+        worker.join();
+
+    const boost::filesystem::path listOut = boost::filesystem::path(folder) / boost::filesystem::path(listFile).filename();
+    std::ofstream list(listOut.string());
+    if (!header.empty())
+        list << header << std::endl;
+    for (int i = 0; i < numFiles; i++)
+        list << targets[i].string() << " " << labels[i] << std::endl;
+    if (!list)
+    {
+        std::cerr << "could not write the dataset list: " << listOut.string() << std::endl;
+        return false;
+    }
+
+    std::cout << "normals of " << numFiles - numSkipped - (int)failed.size() << " point clouds computed, " << numSkipped
+              << " up to date, the list is written to " << listOut.string() << std::endl;
+    for (const std::string &file : failed)
+        std::cerr << "could not compute the normals of " << file << std::endl;
+    return failed.empty();
+}
+
+// the median and the 95th percentile (nearest rank) of the repeated measurements of a stage
+std::pair<double, double> getMedianAndP95(std::vector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+    const int n = (int)samples.size();
+    double median = n % 2 == 1 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    int p95 = std::max((int)std::ceil(0.95 * n) - 1, 0);
+    return std::make_pair(median, samples[p95]);
+}
+
+// trains the config on the training list and detects the test list repeatedly, writes the median and 95th
+// percentile of each stage and the peak resident memory to perf.json in the output folder and compares the
+// medians with a baseline written the same way, returns false if a stage is slower than the baseline by more
+// than the tolerance in percent
+bool runPerformanceTest(const std::string &configFile, const std::string &trainList, const std::string &testList,
+                        int repetitions, const std::string &folder, const std::string &baselineFile, double tolerance)
+{
+    std::vector<std::string> models, pointClouds;
+    std::vector<unsigned> classIds, groundtruth;
+    if (!readDatasetList(trainList, models, classIds) || !readDatasetList(testList, pointClouds, groundtruth))
+    {
+        std::cerr << "could not read the dataset lists: " << trainList << ", " << testList << std::endl;
+        return false;
+    }
+    boost::filesystem::create_directories(folder);
+    const std::string ismFile = (boost::filesystem::path(folder) / "perf.ism").string();
+
+    // wall times in milliseconds of each repetition by stage
+    std::map<std::string, std::vector<double> > samples;
+    for (int r = 0; r < repetitions; r++)
+    {
+        std::cout << "performance test repetition " << r + 1 << " of " << repetitions << std::endl;
+        std::map<std::string, double> times;
+
+        {
+            boost::timer::cpu_timer timer;
+            ism3d::ImplicitShapeModel ism;
+            ism.setLogging(log_info);
+            ism.setSignalsState(false);
+            if (!ism.readObject(configFile, true))
+            {
+                std::cerr << "could not read ism from file, performance test stopped: " << configFile << std::endl;
+                return false;
+            }
+            for (int i = 0; i < (int)models.size(); i++)
+            {
+                if (!ism.addTrainingModel(models[i], classIds[i]))
+                {
+                    std::cerr << "could not add training model: " << models[i] << ", class " << classIds[i] << std::endl;
+                    return false;
+                }
+            }
+            ism.train();
+            times["train"] = timer.elapsed().wall / 1e6;
+
+            boost::timer::cpu_timer timer_write;
+            if (!ism.writeObject(ismFile))
+            {
+                std::cerr << "could not write ism" << std::endl;
+                return false;
+            }
+            times["write"] = timer_write.elapsed().wall / 1e6;
+        }
+
+        ism3d::ImplicitShapeModel ism;
+        ism.setLogging(log_info);
+        ism.setSignalsState(false);
+        boost::timer::cpu_timer timer_load;
+        if (!ism.readObject(ismFile))
+        {
+            std::cerr << "could not read ism from file, performance test stopped: " << ismFile << std::endl;
+            return false;
+        }
+        times["load"] = timer_load.elapsed().wall / 1e6;
+
+        // the detection stages are summed over the test clouds, activation cache entries are counters
+        boost::timer::cpu_timer timer_detect;
+        std::shared_ptr<ism3d::PointCloudLoader> loader = ism.createPointCloudLoader(pointClouds);
+        bool detected = ism.detectBatch(loader, pointClouds.size(), [&](int, const std::vector<ism3d::VotingMaximum>&,
+                                                                        const std::map<std::string, double>& cloudTimes)
+        {
+            for (const std::pair<const std::string, double> &entry : cloudTimes)
+            {
+                if (entry.first != "complete" && entry.first.find("activation_cache") != 0)
+                    times["detect_" + entry.first] += entry.second;
+            }
+        });
+        if (!detected)
+        {
+            std::cerr << "detection failed" << std::endl;
+            return false;
+        }
+        times["detect"] = timer_detect.elapsed().wall / 1e6;
+
+        for (const std::pair<const std::string, double> &entry : times)
+            samples[entry.first].push_back(entry.second);
+    }
+
+    Json::Value result(Json::objectValue);
+    result["config"] = configFile;
+    result["train_list"] = trainList;
+    result["test_list"] = testList;
+    result["repetitions"] = repetitions;
+    result["peak_rss_mb"] = ism3d::MemoryReport::getPeakResidentBytes() / (1024.0 * 1024.0);
+    for (const std::pair<const std::string, std::vector<double> > &stage : samples)
+    {
+        std::pair<double, double> statistics = getMedianAndP95(stage.second);
+        result["stages"][stage.first]["median_ms"] = statistics.first;
+        result["stages"][stage.first]["p95_ms"] = statistics.second;
+    }
+
+    const std::string resultFile = (boost::filesystem::path(folder) / "perf.json").string();
+    std::ofstream resultStream(resultFile.c_str(), std::ios::out);
+    Json::StyledWriter writer;
+    resultStream << writer.write(result);
+    resultStream.close();
+    std::cout << "performance results written to " << resultFile << std::endl;
+
+    if (baselineFile.empty())
+        return true;
+
+    std::ifstream baselineStream(baselineFile.c_str());
+    Json::Value baseline;
+    Json::Reader reader;
+    if (!baselineStream || !reader.parse(baselineStream, baseline) || !baseline["stages"].isObject())
+    {
+        std::cerr << "could not read performance baseline: " << baselineFile << std::endl;
+        return false;
+    }
+
+    // stages below a millisecond are too noisy to be compared, they are only reported
+    const double minTime = 1.0;
+    bool passed = true;
+    std::cout << std::setw(24) << std::left << "stage" << std::right << std::setw(14) << "baseline [ms]"
+              << std::setw(14) << "median [ms]" << std::setw(14) << "p95 [ms]" << std::setw(10) << "change" << std::endl;
+    for (const std::string &stage : result["stages"].getMemberNames())
+    {
+        const Json::Value &current = result["stages"][stage];
+        std::cout << std::setw(24) << std::left << stage << std::right;
+        if (!baseline["stages"].isMember(stage))
+        {
+            std::cout << std::setw(14) << "-" << std::setw(14) << current["median_ms"].asDouble()
+                      << std::setw(14) << current["p95_ms"].asDouble() << std::endl;
+            continue;
+        }
+
+        double reference = baseline["stages"][stage]["median_ms"].asDouble();
+        double change = reference > 0 ? (current["median_ms"].asDouble() / reference - 1.0) * 100.0 : 0.0;
+        bool regressed = reference >= minTime && change > tolerance;
+        std::cout << std::setw(14) << reference << std::setw(14) << current["median_ms"].asDouble()
+                  << std::setw(14) << current["p95_ms"].asDouble() << std::setw(9) << std::fixed
+                  << std::setprecision(1) << change << "%" << std::defaultfloat << std::setprecision(6)
+                  << (regressed ? "  REGRESSION" : "") << std::endl;
+        passed = passed && !regressed;
+    }
+
+    if (baseline.isMember("peak_rss_mb"))
+    {
+        double reference = baseline["peak_rss_mb"].asDouble();
+        double change = reference > 0 ? (result["peak_rss_mb"].asDouble() / reference - 1.0) * 100.0 : 0.0;
+        bool regressed = change > tolerance;
+        std::cout << "peak resident memory: " << result["peak_rss_mb"].asDouble() << " MB, baseline " << reference
+                  << " MB" << (regressed ? "  REGRESSION" : "") << std::endl;
+        passed = passed && !regressed;
+    }
+
+    if (!passed)
+        std::cerr << "performance regressed by more than " << tolerance << " % against the baseline " << baselineFile << std::endl;
+    return passed;
+}
+
+// detects each point cloud of the test list at several input sizes, fits the cost model of the ism to the
+// measurements and stores it alongside the ism file
+bool runCalibration(const std::string &ismFile, const std::string &testList)
+{
+    std::vector<std::string> pointClouds;
+    std::vector<unsigned> groundtruth;
+    if (!readDatasetList(testList, pointClouds, groundtruth))
+    {
+        std::cerr << "could not read the dataset list: " << testList << std::endl;
+        return false;
+    }
+
+    ism3d::ImplicitShapeModel ism;
+    ism.setLogging(log_info);
+    ism.setSignalsState(false);
+    if (!ism.readObject(ismFile))
+    {
+        std::cerr << "could not read ism from file, calibration stopped: " << ismFile << std::endl;
+        return false;
+    }
+
+    // every n-th point of a cloud, the subsampled clouds are unorganized
+    const std::vector<int> steps = {1, 2, 4};
+    std::vector<ism3d::DetectionStatistics> samples;
+    std::shared_ptr<ism3d::PointCloudLoader> loader = ism.createPointCloudLoader(pointClouds);
+    for (int i = 0; i < (int)pointClouds.size(); i++)
+    {
+        bool hasNormals = false;
+        pcl::PointCloud<ism3d::PointNormalT>::Ptr points = loader->next(&hasNormals);
+        if (points.get() == 0)
+        {
+            std::cerr << "could not load point cloud: " << pointClouds[i] << std::endl;
+            return false;
+        }
+
+        std::cout << "calibrating on " << pointClouds[i] << std::endl;
+        for (int step : steps)
+        {
+            pcl::PointCloud<ism3d::PointNormalT>::Ptr subsampled(new pcl::PointCloud<ism3d::PointNormalT>());
+            for (std::size_t j = 0; j < points->size(); j += step)
+                subsampled->push_back(points->at(j));
+            ism.detect(subsampled, hasNormals);
+            samples.push_back(ism.getLastDetectionStatistics());
+        }
+    }
+
+    if (!ism.fitCostModel(samples))
+    {
+        std::cerr << "could not fit the cost model" << std::endl;
+        return false;
+    }
+
+    // the error of the fit on the calibration detections, the index is built once and not predicted
+    double sumError = 0;
+    for (const ism3d::DetectionStatistics &sample : samples)
+    {
+        if (!sample.counters.count("points") || !sample.times.count("detection"))
+            continue;
+        double measured = sample.times.at("detection") - (sample.times.count("index") ? sample.times.at("index") : 0.0);
+        double predicted = ism.estimateDetectionCost((int)sample.counters.at("points")).milliseconds;
+        sumError += measured > 0 ? std::abs(predicted - measured) / measured : 0.0;
+    }
+    std::cout << "mean relative error of the cost model: " << 100.0 * sumError / samples.size() << " %" << std::endl;
+
+    const std::string costFile = ism3d::DetectionCostModel::getFilename(ismFile);
+    if (!ism.getCostModel().save(costFile))
+    {
+        std::cerr << "could not write the cost model: " << costFile << std::endl;
+        return false;
+    }
+    std::cout << "cost model written to " << costFile << std::endl;
+    return true;
+}
+
+// writes the configuration with replaced parameters of the implicit shape model to a file in the folder
+bool writeConfig(const Json::Value &config, const std::string &file)
+{
+    std::ofstream stream(file.c_str(), std::ios::out);
+    Json::StyledWriter writer;
+    stream << writer.write(config);
+    return stream.good();
+}
+
+// k-fold cross-validation of a config on a dataset list: the features of all models are computed once into the
+// feature cache, then the folds are trained from the cached features and tested on their held out point clouds,
+// numJobs folds at a time, each with an equal share of the threads; the accuracy and the stage times of each fold
+// are written to cv_summary.txt in the output folder
+bool runCrossValidation(const std::string &configFile, const std::string &datasetList, int numFolds, int numJobs,
+                        const std::string &folder)
+{
+    std::vector<std::string> files;
+    std::vector<unsigned> labels;
+    if (!readDatasetList(datasetList, files, labels))
+    {
+        std::cerr << "could not read the dataset list: " << datasetList << std::endl;
+        return false;
+    }
+    if (numFolds < 2 || numFolds > (int)files.size())
+    {
+        std::cerr << "the number of folds has to be between 2 and the number of point clouds" << std::endl;
+        return false;
+    }
+    numJobs = numJobs > 0 ? std::min(numJobs, numFolds) : numFolds;
+    boost::filesystem::create_directories(folder);
+
+    // the folds load the features from the configured feature cache, or from one in the output folder
+    Json::Value config;
+    std::ifstream configStream(configFile.c_str());
+    Json::Reader reader;
+    if (!configStream || !reader.parse(configStream, config) || !config["ObjectConfig"]["Parameters"].isObject())
+    {
+        std::cerr << "could not read the config: " << configFile << std::endl;
+        return false;
+    }
+    Json::Value &parameters = config["ObjectConfig"]["Parameters"];
+    if (parameters["FeatureCacheDirectory"].asString().empty())
+        parameters["FeatureCacheDirectory"] = (boost::filesystem::path(folder) / "feature_cache").string();
+    const int numThreads = parameters["NumThreads"].asInt() > 0 ? parameters["NumThreads"].asInt() : omp_get_max_threads();
+
+    const std::string featureConfigFile = (boost::filesystem::path(folder) / "cv_features.ism").string();
+    const std::string foldConfigFile = (boost::filesystem::path(folder) / "cv_fold.ism").string();
+    bool written = writeConfig(config, featureConfigFile);
+    parameters["NumThreads"] = std::max(1, numThreads / numJobs);
+    written = written && writeConfig(config, foldConfigFile);
+    if (!written)
+    {
+        std::cerr << "could not write the fold configs to " << folder << std::endl;
+        return false;
+    }
+
+    // the point clouds of each class are distributed round robin over the folds
+    std::vector<int> folds(files.size());
+    std::map<unsigned, int> numOfClass;
+    for (int i = 0; i < (int)files.size(); i++)
+        folds[i] = numOfClass[labels[i]]++ % numFolds;
+
+    std::cout << "computing the features of " << files.size() << " point clouds" << std::endl;
+    boost::timer::cpu_timer timer_features;
+    {
+        ism3d::ImplicitShapeModel ism;
+        ism.setLogging(log_info);
+        ism.setSignalsState(false);
+        if (!ism.readObject(featureConfigFile, true))
+        {
+            std::cerr << "could not read ism from file, cross-validation stopped: " << featureConfigFile << std::endl;
+            return false;
+        }
+        for (int i = 0; i < (int)files.size(); i++)
+        {
+            if (!ism.addTrainingModel(files[i], labels[i]))
+            {
+                std::cerr << "could not add training model: " << files[i] << ", class " << labels[i] << std::endl;
+                return false;
+            }
+        }
+        ism.cacheTrainingFeatures();
+    }
+    const double featuresTime = timer_features.elapsed().wall / 1e6;
+
+    struct FoldResult
+    {
+        FoldResult() : numTraining(0), numTest(0), valid(false)
+        {
+            times["train"] = 0;
+            times["detect"] = 0;
+        }
+        int numTraining;
+        int numTest;
+        bool valid;
+        DetectionSummary summary;
+        std::map<std::string, double> times; // train, detect and the detection stages summed over the test clouds
+    };
+    std::vector<FoldResult> results(numFolds);
+
+    auto runFold = [&](int fold)
+    {
+        FoldResult &result = results[fold];
+        ism3d::ImplicitShapeModel ism;
+        ism.setLogging(log_info);
+        ism.setSignalsState(false);
+        if (!ism.readObject(foldConfigFile, true))
+        {
+            std::cerr << "could not read ism from file: " << foldConfigFile << std::endl;
+            return;
+        }
+
+        std::vector<std::string> testFiles;
+        std::vector<unsigned> testLabels;
+        for (int i = 0; i < (int)files.size(); i++)
+        {
+            if (folds[i] == fold)
+            {
+                testFiles.push_back(files[i]);
+                testLabels.push_back(labels[i]);
+            }
+            else if (ism.addTrainingModel(files[i], labels[i]))
+            {
+                result.numTraining++;
+            }
+        }
+        result.numTest = (int)testFiles.size();
+
+        boost::timer::cpu_timer timer_train;
+        ism.train();
+        result.times["train"] = timer_train.elapsed().wall / 1e6;
+
+        const std::string summaryFileName = (boost::filesystem::path(folder) / ("fold_" + std::to_string(fold) + "_summary.txt")).string();
+        std::ofstream summaryFile(summaryFileName.c_str(), std::ios::out);
+        boost::timer::cpu_timer timer_detect;
+        std::shared_ptr<ism3d::PointCloudLoader> loader = ism.createPointCloudLoader(testFiles);
+        result.valid = ism.detectBatch(loader, testFiles.size(), [&](int index, const std::vector<ism3d::VotingMaximum> &maxima,
+                                                                     const std::map<std::string, double> &cloudTimes)
+        {
+            result.summary.add(summaryFile, testFiles[index], testLabels[index], maxima);
+            for (const std::pair<const std::string, double> &entry : cloudTimes)
+            {
+                if (entry.first != "complete" && entry.first.find("activation_cache") != 0)
+                    result.times["detect_" + entry.first] += entry.second;
+            }
+        });
+        result.times["detect"] = timer_detect.elapsed().wall / 1e6;
+        result.summary.writeResults(summaryFile, result.numTest);
+        summaryFile.close();
+    };
+
+    // the folds are taken in order by the jobs
+    std::cout << "training and testing " << numFolds << " folds, " << numJobs << " at a time" << std::endl;
+    boost::timer::cpu_timer timer_folds;
+    int nextFold = 0;
+    std::mutex mutex;
+    std::exception_ptr error;
+    auto job = [&]()
+    {
+        while (true)
+        {
+            int fold;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (nextFold == numFolds || error)
+                    return;
+                fold = nextFold++;
+            }
+            try
+            {
+                runFold(fold);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> jobs;
+    for (int i = 0; i < numJobs; i++)
+        jobs.push_back(std::thread(job));
+    for (std::thread &thread : jobs)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+    const double foldsTime = timer_folds.elapsed().wall / 1e6;
+
+    // accuracy of the top maximum of each fold, the stage times summed over the folds
+    const std::string summaryFileName = (boost::filesystem::path(folder) / "cv_summary.txt").string();
+    std::ofstream summaryFile(summaryFileName.c_str(), std::ios::out);
+    summaryFile << "cross-validation of " << configFile << " on " << datasetList << " with " << numFolds << " folds\n\n";
+    summaryFile << "fold  training  test  accuracy [%]  train [s]  detect [s]\n";
+    bool valid = true;
+    double sumAccuracy = 0, sumSquaredAccuracy = 0;
+    std::map<std::string, double> stageTimes;
+    for (int fold = 0; fold < numFolds; fold++)
+    {
+        const FoldResult &result = results[fold];
+        const double accuracy = result.numTest > 0 ? 100.0 * result.summary.numCorrectClasses / result.numTest : 0.0;
+        sumAccuracy += accuracy;
+        sumSquaredAccuracy += accuracy * accuracy;
+        valid = valid && result.valid;
+        for (const std::pair<const std::string, double> &entry : result.times)
+            stageTimes[entry.first] += entry.second;
+
+        summaryFile << std::setw(4) << fold << std::setw(10) << result.numTraining << std::setw(6) << result.numTest
+                    << std::setw(14) << std::fixed << std::setprecision(2) << accuracy
+                    << std::setw(11) << result.times.at("train") / 1000 << std::setw(12) << result.times.at("detect") / 1000
+                    << (result.valid ? "" : "  (detection failed)") << "\n";
+    }
+    const double meanAccuracy = sumAccuracy / numFolds;
+    const double stdAccuracy = std::sqrt(std::max(sumSquaredAccuracy / numFolds - meanAccuracy * meanAccuracy, 0.0));
+    summaryFile << "\nmean accuracy: " << meanAccuracy << " % (standard deviation " << stdAccuracy << " %)\n";
+    summaryFile << "\nshared features: " << featuresTime / 1000 << " [s], folds: " << foldsTime / 1000 << " [s]\n";
+    summaryFile << "times per stage summed over the folds:\n";
+    for (const std::pair<const std::string, double> &entry : stageTimes)
+        summaryFile << "  " << std::setw(22) << std::left << entry.first << std::right << std::setw(10) << entry.second / 1000 << " [s]\n";
+    summaryFile.close();
+
+    std::cout << "mean accuracy over " << numFolds << " folds: " << meanAccuracy << " % (standard deviation "
+              << stdAccuracy << " %), summary written to " << summaryFileName << std::endl;
+    return valid;
+}
+
+int main(int argc, char **argv)
+{
+    boost::program_options::options_description generic("Generic options");
+    boost::program_options::options_description training("Training");
+    boost::program_options::options_description detection("Detection");
+    boost::program_options::options_description tuning("Index tuning");
+    boost::program_options::options_description performance("Performance");
+    boost::program_options::options_description conversion("Data conversion");
+
+    generic.add_options()
+            ("help,h", "Display this help message")
+            ("verbose,v", "Print the memory used by the loaded ism and by the votes of each detection, and the voting report if enabled")
+            ("output,o", boost::program_options::value<std::string>(), "The output folder (created automatically) for ism files after training or the detection log after detection")
+            ("inputfile,f", boost::program_options::value<std::string>(), "Input file (for training or testing) containing the input clouds and their corresponding labels (replaces m and c in training and p and g in testing");
+
+    training.add_options()
+            ("train,t", boost::program_options::value<std::string>(), "Train an implicit shape model")
+            ("inplace,i", "Overwrite the loaded ism file")
+            ("incremental,u", "Add the training models to the trained ism given with -t instead of training from scratch")
+            ("models,m", boost::program_options::value<std::vector<std::string> >()->multitoken()->composing(), "Specifiy a list of training models")
+            ("classes,c", boost::program_options::value<std::vector<unsigned> >()->multitoken()->composing(), "Specifiy a list of class ids for the given training models")
+            ("extract-shard,x", boost::program_options::value<std::string>(), "Only compute the features of slice i of n of the training models, given as i/n with 0 <= i < n, and write them as a feature shard to the file given with -o")
+            ("shards", boost::program_options::value<std::vector<std::string> >()->multitoken()->composing(), "Specify the feature shards of all slices to train from instead of computing the features of training models");
+
+    detection.add_options()
+            ("detect,d", boost::program_options::value<std::string>(), "Detect using a trained implicit shape model")
+            ("pointclouds,p", boost::program_options::value<std::vector<std::string> >()->multitoken()->composing(), "Specify a list of input point clouds")
+            ("groundtruth,g", boost::program_options::value<std::vector<unsigned> >()->multitoken()->composing(), "Specifiy a list of ground truth class ids for the given pointclouds")
+            ("sweep,s", boost::program_options::value<std::string>(), "Detect with every combination of the parameter values in the given json file, e.g. {\"Voting\": {\"Bandwidth\": [0.1, 0.2]}, \"Codebook\": {\"UseClassWeight\": [true, false]}}, features and activations are computed once per point cloud, one summary per combination is written to the output folder")
+            ("budget,b", boost::program_options::value<double>(), "Detect each point cloud within the given time budget in milliseconds, starting with coarse keypoints that are refined while time remains")
+            ("stream", "Detect the point clouds as consecutive frames of a static camera, only the changed regions of a frame are computed again")
+            ("jobs,j", boost::program_options::value<int>(), "Number of point clouds detected concurrently, each with an equal share of the threads (default: 1, the point clouds are detected in a pipeline), with --cv the number of folds trained and tested concurrently")
+            ("serve,e", boost::program_options::value<std::string>(), "Keep the implicit shape model given with -d loaded and serve detection requests on the given TCP port of the loopback interface, <address>:<port> (e.g. 0.0.0.0:5000 for all interfaces, requests are not authenticated) or Unix socket path until a client sends \"shutdown\", see eval_tool/detection_server.h for the protocol")
+            ("batch-size", boost::program_options::value<int>(), "Maximum number of point clouds detected together in server mode (default: 8)")
+            ("batch-window", boost::program_options::value<int>(), "Time in milliseconds the server waits for further requests to fill a batch (default: 10)")
+            ("max-cloud-points", boost::program_options::value<int>(), "Maximum number of points of a cloud sent to the server, larger clouds are rejected (default: 10000000)")
+            ("load-classes", boost::program_options::value<std::vector<unsigned> >()->multitoken()->composing(), "Only load the given class ids of the ism for detection, the votes and global features of other classes are skipped")
+            ("result-log", "Write the maxima, times and counters of all point clouds to results.bin in the output folder instead of the text detection logs and summary, see --convert-results")
+            ("convert-results", boost::program_options::value<std::string>(), "Write the detection logs and the summary of a results.bin written with --result-log to the output folder")
+            ("shard", boost::program_options::value<std::string>(), "Only detect slice i of n of the point clouds, given as i/n with 0 <= i < n: every n-th point cloud starting with the i-th; the detection logs, a partial summary and the partial results shard_<i>_of_<n>.json are written to the output folder")
+            ("merge-shards", boost::program_options::value<std::vector<std::string> >()->multitoken(), "Combine the partial results shard_<i>_of_<n>.json of all shards of a test list into summary.txt and summary.json with the sums and percentiles of the stage times in the output folder, detection logs in the folders of the shards are copied to it");
+
+    tuning.add_options()
+            ("autotune,a", boost::program_options::value<std::string>(), "Tune the codebook index of a trained implicit shape model and write the selected setting to the ism file")
+            ("recall,r", boost::program_options::value<float>(), "Target recall of the index tuning (default: 0.95), also tunes the index after training with -t")
+            ("neighbors,k", boost::program_options::value<int>(), "Number of neighbors for which the recall is measured (default: 1)");
+
+    performance.add_options()
+            ("perf", boost::program_options::value<std::string>(), "Train the given config on --train-list and detect --test-list repeatedly, the median and 95th percentile of each stage and the peak resident memory are written to perf.json in the output folder")
+            ("train-list", boost::program_options::value<std::string>(), "Dataset list of the training models for --perf and of all point clouds for --cv, in the format of -f")
+            ("test-list", boost::program_options::value<std::string>(), "Dataset list of the test point clouds for --perf and --calibrate, in the format of -f")
+            ("repetitions", boost::program_options::value<int>(), "Number of repetitions of each stage for --perf (default: 5)")
+            ("baseline", boost::program_options::value<std::string>(), "A perf.json of an earlier run, exits with an error if the median of a stage or the peak resident memory exceeds it by more than --tolerance")
+            ("tolerance", boost::program_options::value<double>(), "Allowed regression against the baseline in percent (default: 10)")
+            ("calibrate", boost::program_options::value<std::string>(), "Detect --test-list with the given ism at several input sizes, fit a model of the detection time and memory and store it alongside the ism file")
+            ("cv", boost::program_options::value<std::string>(), "Cross-validate the given config on the point clouds of --train-list: the features of all point clouds are computed once into the feature cache (FeatureCacheDirectory, else in the output folder), the folds are trained from them and tested on their held out point clouds, --jobs folds at a time (default: all), the accuracy and stage times of each fold are written to cv_summary.txt in the output folder")
+            ("folds", boost::program_options::value<int>(), "Number of folds for --cv, the point clouds of each class are distributed round robin (default: 5)");
+
+    conversion.add_options()
+            ("export-json", boost::program_options::value<std::vector<std::string> >()->multitoken(), "Write the data of the given ism file as json to the given file: --export-json <ism> <json>")
+            ("pack-floats", "Write arrays of floating point numbers as base64 strings with --export-json")
+            ("import-json", boost::program_options::value<std::vector<std::string> >()->multitoken(), "Read the json data written with --export-json and save it as ism with the configuration of the given ism file: --import-json <json> <ism>")
+            ("chunk-model", boost::program_options::value<std::vector<std::string> >()->multitoken(), "Rewrite the data of the given ism file with its codebook distributions in chunks that are decoded in parallel on loading, optionally with the number of distributions per chunk (default: 4096): --chunk-model <ism> [<size>]")
+            ("add-normals", boost::program_options::value<std::vector<std::string> >()->multitoken(), "Compute the normals of all point clouds of a dataset list in the format of -f with the normal parameters of the given ism file and write them to the output folder, --jobs point clouds at a time (default: one per core); clouds whose output is newer than the input are skipped and the list is written to the output folder with the paths of the clouds with normals: --add-normals <ism> <list>");
+
+
+    boost::program_options::options_description desc;
+    desc.add(generic).add(training).add(detection).add(tuning).add(performance).add(conversion);
+
+    // parse command line arguments
+    boost::program_options::variables_map variables;
+    try {
+        boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).run(), variables);
+        boost::program_options::notify(variables);
+    }
+    catch (std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    // show help
+    if (variables.count("help") || variables.size() == 0) {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+    else {
+
+        std::vector<std::string> filenames;
+        std::vector<unsigned> labels;
+        std::string mode = "";
+
+        if(variables.count("inputfile"))
+        {
+            // manually parse input file if available, then adapt it to boost params
+            std::string input_file = variables["inputfile"].as<std::string>();
+
+            // parse input
+            std::ifstream infile(input_file);
+            std::string file;
+            std::string label;
+
+            while(infile >> file >> label)
+            {
+                // special treatment of first line: determine mode
+                if(file == "#" && (label == "train" || label == "test"))
+                {
+                    mode = label;
+                }
+                else // other lines contain a filename and a label
+                {
+                    filenames.push_back(file);
+                    labels.push_back(std::stoul(label));
+                }
+            }
+        }
+
+        try {
+            // train the ISM
+            if ((variables.count("train") && mode == "") || mode == "train")
+            {
+                std::cout << "starting the training process" << std::endl;
+
+                std::string ismFile;
+                try // allows to use -t or -d for ism-files when input file with dataset is specified with -f
+                {
+                    ismFile = variables["train"].as<std::string>();
+                }
+                catch(std::exception& e)
+                {
+                    ismFile = variables["detect"].as<std::string>();
+                }
+
+                // try to read the file
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false); // disable signals since we are using command line, no GUI
+
+                // incremental training needs the trained data as well
+                bool incremental = variables.count("incremental") > 0;
+                if (!ism.readObject(ismFile, !incremental))
+                {
+                    std::cerr << "could not read ism from file, training stopped: " << ismFile << std::endl;
+                    return 1;
+                }
+
+                // set output filename
+                if (variables.count("output"))
+                {
+                    std::string outFilename = variables["output"].as<std::string>();
+                    ism.setOutputFilename(outFilename);
+                }
+
+                // add the training models to the ism
+                if ((variables.count("models") && variables.count("classes")) ||
+                        (filenames.size() > 0 && labels.size() > 0))
+                {
+                    std::vector<std::string> models;
+                    std::vector<unsigned> classIds;
+
+                    if(variables.count("models")) // input directly from command line
+                    {
+                        models = variables["models"].as<std::vector<std::string> >();
+                        classIds = variables["classes"].as<std::vector<unsigned> >();
+                    }
+                    else if(filenames.size() > 0) // input inside file given on command line
+                    {
+                        models = filenames;
+                        classIds = labels;
+                    }
+
+                    if (models.size() == classIds.size())
+                    {
+                        for (int i = 0; i < (int)models.size(); i++)
+                        {
+                            std::string filename = models[i];
+                            unsigned classId = classIds[i];
+
+                            // add the training model to the ISM
+                            if (!ism.addTrainingModel(filename, classId))
+                            {
+                                std::cerr << "could not add training model: " << filename << ", class " << classId << std::endl;
+                                return 1;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        std::cerr << "number of models does not match the number of class ids" << std::endl;
+                        return 1;
+                    }
+                }
+
+                // a feature shard of a slice of the training models is written instead of a trained ism
+                if (variables.count("extract-shard"))
+                {
+                    int shardIndex = -1, numShards = 0;
+                    if (!parseShard(variables["extract-shard"].as<std::string>(), shardIndex, numShards))
+                    {
+                        std::cerr << "the feature shard has to be given as i/n with 0 <= i < n" << std::endl;
+                        return 1;
+                    }
+                    if (!variables.count("output"))
+                    {
+                        std::cerr << "no output file for the feature shard specified" << std::endl;
+                        return 1;
+                    }
+
+                    ism.extractFeatureShard(variables["output"].as<std::string>(), shardIndex, numShards);
+                    return 0;
+                }
+
+                if (variables.count("shards"))
+                {
+                    for (const std::string &shard : variables["shards"].as<std::vector<std::string> >())
+                        ism.addFeatureShard(shard);
+                }
+
+                // train
+                if (incremental)
+                {
+                    if (!ism.trainIncremental())
+                    {
+                        std::cerr << "could not add the training models to the trained ism" << std::endl;
+                        return 1;
+                    }
+                }
+                else
+                {
+                    ism.train();
+                }
+
+                // select the cheapest index setting on the training descriptors
+                if (variables.count("recall"))
+                {
+                    int k = variables.count("neighbors") ? variables["neighbors"].as<int>() : 1;
+                    if (!ism.autotuneIndex(variables["recall"].as<float>(), k))
+                        std::cerr << "the target recall was not reached, the most accurate setting is used" << std::endl;
+                }
+
+                // write the ism data
+                if (variables.count("inplace"))
+                {
+                    if (!ism.writeObject(ismFile, ismFile + "d"))
+                    {
+                        std::cerr << "could not write ism" << std::endl;
+                        return 1;
+                    }
+                }
+                else if (variables.count("output"))
+                {
+                    std::string outFilename = variables["output"].as<std::string>();
+                    if (!ism.writeObject(outFilename))
+                    {
+                        std::cerr << "could not write ism" << std::endl;
+                        return 1;
+                    }
+                }
+                else
+                {
+                    std::cerr << "the trained ism is not saved" << std::endl;
+                    return 1;
+                }
+            }
+
+            // tune the index of a trained ISM
+            if (variables.count("autotune"))
+            {
+                std::cout << "starting the index tuning" << std::endl;
+
+                std::string ismFile = variables["autotune"].as<std::string>();
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false);
+
+                if (!ism.readObject(ismFile))
+                {
+                    std::cerr << "could not read ism from file, tuning stopped: " << ismFile << std::endl;
+                    return 1;
+                }
+
+                float recall = variables.count("recall") ? variables["recall"].as<float>() : 0.95f;
+                int k = variables.count("neighbors") ? variables["neighbors"].as<int>() : 1;
+                if (!ism.autotuneIndex(recall, k))
+                    std::cerr << "the target recall was not reached, the most accurate setting is used" << std::endl;
+
+                if (!ism.writeObject(ismFile, ismFile + "d"))
+                {
+                    std::cerr << "could not write ism" << std::endl;
+                    return 1;
+                }
+            }
+
+            // write the text files of a binary result log
+            if (variables.count("convert-results"))
+            {
+                if (!variables.count("output"))
+                {
+                    std::cerr << "converting the result log needs an output folder" << std::endl;
+                    return 1;
+                }
+                boost::filesystem::create_directories(variables["output"].as<std::string>());
+                if (!convertResultLog(variables["convert-results"].as<std::string>(), variables["output"].as<std::string>()))
+                    return 1;
+            }
+
+            // combine the partial results of the shards of a test list
+            if (variables.count("merge-shards"))
+            {
+                if (!variables.count("output"))
+                {
+                    std::cerr << "merging the shards needs an output folder" << std::endl;
+                    return 1;
+                }
+                boost::filesystem::create_directories(variables["output"].as<std::string>());
+                if (!mergeShards(variables["merge-shards"].as<std::vector<std::string> >(), variables["output"].as<std::string>()))
+                    return 1;
+            }
+
+            // write the data of a trained ISM as json
+            if (variables.count("export-json"))
+            {
+                std::vector<std::string> files = variables["export-json"].as<std::vector<std::string> >();
+                if (files.size() != 2)
+                {
+                    std::cerr << "--export-json needs an ism file and a json file" << std::endl;
+                    return 1;
+                }
+
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false);
+                if (!ism.readObject(files[0]))
+                {
+                    std::cerr << "could not read ism from file: " << files[0] << std::endl;
+                    return 1;
+                }
+                if (!ism.writeJsonData(files[1], variables.count("pack-floats") > 0))
+                {
+                    std::cerr << "could not write json data: " << files[1] << std::endl;
+                    return 1;
+                }
+            }
+
+            // save json data as ISM with the configuration of an ism file
+            if (variables.count("import-json"))
+            {
+                std::vector<std::string> files = variables["import-json"].as<std::vector<std::string> >();
+                if (files.size() != 2)
+                {
+                    std::cerr << "--import-json needs a json file and an ism file" << std::endl;
+                    return 1;
+                }
+
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false);
+                if (!ism.readObject(files[1], true) || !ism.readJsonData(files[0]))
+                {
+                    std::cerr << "could not read json data: " << files[0] << std::endl;
+                    return 1;
+                }
+                if (!ism.writeObject(files[1], files[1] + "d"))
+                {
+                    std::cerr << "could not write ism" << std::endl;
+                    return 1;
+                }
+            }
+
+            // convert the data of a trained ISM to the chunked archive layout
+            if (variables.count("chunk-model"))
+            {
+                std::vector<std::string> args = variables["chunk-model"].as<std::vector<std::string> >();
+                if (args.empty() || args.size() > 2)
+                {
+                    std::cerr << "--chunk-model needs an ism file and optionally a chunk size" << std::endl;
+                    return 1;
+                }
+                int chunkSize = args.size() == 2 ? std::atoi(args[1].c_str()) : 4096;
+                if (chunkSize <= 0)
+                {
+                    std::cerr << "the chunk size must be positive" << std::endl;
+                    return 1;
+                }
 
-    generic.add_options()
-            ("help,h", "Display this help message")
-            ("output,o", boost::program_options::value<std::string>(), "The output folder (created automatically) for ism files after training or the detection log after detection")
-            ("inputfile,f", boost::program_options::value<std::string>(), "Input file (for training or testing) containing the input clouds and their corresponding labels (replaces m and c in training and p and g in testing");
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false);
+                if (!ism.readObject(args[0]))
+                {
+                    std::cerr << "could not read ism from file: " << args[0] << std::endl;
+                    return 1;
+                }
+                ism.setArchiveChunkSize(chunkSize);
+                if (!ism.writeObject(args[0], args[0] + "d"))
+                {
+                    std::cerr << "could not write ism" << std::endl;
+                    return 1;
+                }
+            }
 
-    training.add_options()
-            ("train,t", boost::program_options::value<std::string>(), "Train an implicit shape model")
-            ("inplace,i", "Overwrite the loaded ism file")
-            ("models,m", boost::program_options::value<std::vector<std::string> >()->multitoken()->composing(), "Specifiy a list of training models")
-            ("classes,c", boost::program_options::value<std::vector<unsigned> >()->multitoken()->composing(), "Specifiy a list of class ids for the given training models");
+            // precompute the normals of a dataset
+            if (variables.count("add-normals"))
+            {
+                std::vector<std::string> files = variables["add-normals"].as<std::vector<std::string> >();
+                if (files.size() != 2 || !variables.count("output"))
+                {
+                    std::cerr << "--add-normals needs an ism file, a dataset list and an output folder" << std::endl;
+                    return 1;
+                }
 
-    detection.add_options()
-            ("detect,d", boost::program_options::value<std::string>(), "Detect using a trained implicit shape model")
-            ("pointclouds,p", boost::program_options::value<std::vector<std::string> >()->multitoken()->composing(), "Specify a list of input point clouds")
-            ("groundtruth,g", boost::program_options::value<std::vector<unsigned> >()->multitoken()->composing(), "Specifiy a list of ground truth class ids for the given pointclouds");
+                int jobs = variables.count("jobs") ? variables["jobs"].as<int>() : 0;
+                if (!addNormalsToDataset(files[0], files[1], jobs, variables["output"].as<std::string>()))
+                    return 1;
+            }
 
+            // compare the stage times of training and detection with a baseline
+            if (variables.count("perf"))
+            {
+                std::cout << "starting the performance test" << std::endl;
 
-    boost::program_options::options_description desc;
-    desc.add(generic).add(training).add(detection);
+                if (!variables.count("train-list") || !variables.count("test-list") || !variables.count("output"))
+                {
+                    std::cerr << "the performance test needs a training list, a test list and an output folder" << std::endl;
+                    return 1;
+                }
 
-    // parse command line arguments
-    boost::program_options::variables_map variables;
-    try {
-        boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).run(), variables);
-        boost::program_options::notify(variables);
-    }
-    catch (std::exception& e) {
-        std::cerr << e.what() << std::endl;
-    }
+                int repetitions = variables.count("repetitions") ? variables["repetitions"].as<int>() : 5;
+                double tolerance = variables.count("tolerance") ? variables["tolerance"].as<double>() : 10.0;
+                std::string baseline = variables.count("baseline") ? variables["baseline"].as<std::string>() : "";
+                if (!runPerformanceTest(variables["perf"].as<std::string>(), variables["train-list"].as<std::string>(),
+                                        variables["test-list"].as<std::string>(), std::max(repetitions, 1),
+                                        variables["output"].as<std::string>(), baseline, tolerance))
+                    return 1;
+            }
 
-    // show help
-    if (variables.count("help") || variables.size() == 0) {
-        std::cout << desc << std::endl;
-        return 1;
-    }
-    else {
+            // k-fold cross-validation of a config with features shared by the folds
+            if (variables.count("cv"))
+            {
+                std::cout << "starting the cross-validation" << std::endl;
 
-        std::vector<std::string> filenames;
-        std::vector<unsigned> labels;
-        std::string mode = "";
+                if (!variables.count("train-list") || !variables.count("output"))
+                {
+                    std::cerr << "the cross-validation needs a dataset list given with --train-list and an output folder" << std::endl;
+                    return 1;
+                }
 
-        if(variables.count("inputfile"))
-        {
-            // manually parse input file if available, then adapt it to boost params
-            std::string input_file = variables["inputfile"].as<std::string>();
+                int folds = variables.count("folds") ? variables["folds"].as<int>() : 5;
+                int jobs = variables.count("jobs") ? variables["jobs"].as<int>() : 0;
+                if (!runCrossValidation(variables["cv"].as<std::string>(), variables["train-list"].as<std::string>(),
+                                        folds, jobs, variables["output"].as<std::string>()))
+                    return 1;
+            }
 
-            // parse input
-            std::ifstream infile(input_file);
-            std::string file;
-            std::string label;
+            // fit the cost model of a trained ism on this hardware
+            if (variables.count("calibrate"))
+            {
+                std::cout << "starting the calibration" << std::endl;
 
-            while(infile >> file >> label)
+                if (!variables.count("test-list"))
+                {
+                    std::cerr << "the calibration needs a test list" << std::endl;
+                    return 1;
+                }
+                if (!runCalibration(variables["calibrate"].as<std::string>(), variables["test-list"].as<std::string>()))
+                    return 1;
+            }
+
+            // serve detection requests with a loaded ISM
+            if (variables.count("serve") && variables.count("detect"))
             {
-                // special treatment of first line: determine mode
-                if(file == "#" && (label == "train" || label == "test"))
+                std::cout << "starting the detection server" << std::endl;
+
+                std::string ismFile = variables["detect"].as<std::string>();
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false);
+
+                if (variables.count("load-classes"))
                 {
-                    mode = label;
+                    std::vector<unsigned> loadClasses = variables["load-classes"].as<std::vector<unsigned> >();
+                    ism.setLoadClasses(std::set<unsigned>(loadClasses.begin(), loadClasses.end()));
                 }
-                else // other lines contain a filename and a label
+                if (!ism.readObject(ismFile))
                 {
-                    filenames.push_back(file);
-                    labels.push_back(std::stoul(label));
+                    std::cerr << "could not read ism from file, server stopped: " << ismFile << std::endl;
+                    return 1;
                 }
+
+                int batchSize = variables.count("batch-size") ? variables["batch-size"].as<int>() : 8;
+                int batchWindow = variables.count("batch-window") ? variables["batch-window"].as<int>() : 10;
+                int maxCloudPoints = variables.count("max-cloud-points") ? variables["max-cloud-points"].as<int>() : 10000000;
+                DetectionServer server(ism, batchSize, batchWindow, maxCloudPoints);
+                if (!server.run(variables["serve"].as<std::string>()))
+                    return 1;
+
+                std::cout << "detection server stopped" << std::endl;
+                server.writeMetrics(std::cout);
             }
-        }
 
-        try {
-            // train the ISM
-            if ((variables.count("train") && mode == "") || mode == "train")
+            // detect with a grid of voting and codebook parameters
+            if (!variables.count("serve") && variables.count("sweep") && ((variables.count("detect") && mode == "") || mode == "test"))
             {
-                std::cout << "starting the training process" << std::endl;
+                std::cout << "starting the parameter sweep" << std::endl;
 
                 std::string ismFile;
                 try // allows to use -t or -d for ism-files when input file with dataset is specified with -f
                 {
-                    ismFile = variables["train"].as<std::string>();
+                    ismFile = variables["detect"].as<std::string>();
                 }
                 catch(std::exception& e)
                 {
-                    ismFile = variables["detect"].as<std::string>();
+                    ismFile = variables["train"].as<std::string>();
                 }
 
-                // try to read the file
-                ism3d::ImplicitShapeModel ism;
-                ism.setLogging(log_info);
-                ism.setSignalsState(false); // disable signals since we are using command line, no GUI
-
-                if (!ism.readObject(ismFile, true))
+                std::vector<std::string> pointClouds;
+                std::vector<unsigned> groundtruth;
+                if(variables.count("pointclouds") && variables.count("groundtruth")) // input directly from command line
                 {
-                    std::cerr << "could not read ism from file, training stopped: " << ismFile << std::endl;
+                    pointClouds = variables["pointclouds"].as<std::vector<std::string> >();
+                    groundtruth = variables["groundtruth"].as<std::vector<unsigned> >();
+                }
+                else if(filenames.size() > 0) // input inside file given on command line
+                {
+                    pointClouds = filenames;
+                    groundtruth = labels;
+                }
+                if (pointClouds.empty() || pointClouds.size() != groundtruth.size())
+                {
+                    std::cerr << "number of pointclouds does not match the number of groundtruth ids" << std::endl;
                     return 1;
                 }
-
-                // set output filename
-                if (variables.count("output"))
+                if (!variables.count("output"))
                 {
-                    std::string outFilename = variables["output"].as<std::string>();
-                    ism.setOutputFilename(outFilename);
+                    std::cerr << "no output folder specified, the parameter sweep needs an output folder" << std::endl;
+                    return 1;
                 }
 
-                // add the training models to the ism
-                if ((variables.count("models") && variables.count("classes")) ||
-                        (filenames.size() > 0 && labels.size() > 0))
+                // read the grid, each parameter maps to a list of values
+                std::string gridFile = variables["sweep"].as<std::string>();
+                std::ifstream gridStream(gridFile.c_str());
+                Json::Value grid;
+                Json::Reader reader;
+                if (!gridStream || !reader.parse(gridStream, grid) || !grid.isObject())
                 {
-                    std::vector<std::string> models;
-                    std::vector<unsigned> classIds;
+                    std::cerr << "could not read parameter grid: " << gridFile << std::endl;
+                    return 1;
+                }
 
-                    if(variables.count("models")) // input directly from command line
-                    {
-                        models = variables["models"].as<std::vector<std::string> >();
-                        classIds = variables["classes"].as<std::vector<unsigned> >();
-                    }
-                    else if(filenames.size() > 0) // input inside file given on command line
+                // expand the grid into all combinations of parameter values
+                std::vector<Json::Value> settings(1, Json::Value(Json::objectValue));
+                for (const std::string &object : grid.getMemberNames())
+                {
+                    if ((object != "Voting" && object != "Codebook") || !grid[object].isObject())
                     {
-                        models = filenames;
-                        classIds = labels;
+                        std::cerr << "parameter grid may only contain the objects Voting and Codebook: " << object << std::endl;
+                        return 1;
                     }
-
-                    if (models.size() == classIds.size())
+                    for (const std::string &name : grid[object].getMemberNames())
                     {
-                        for (int i = 0; i < (int)models.size(); i++)
+                        const Json::Value &values = grid[object][name];
+                        if (!values.isArray() || values.empty())
                         {
-                            std::string filename = models[i];
-                            unsigned classId = classIds[i];
+                            std::cerr << "parameter grid needs a list of values for parameter " << name << std::endl;
+                            return 1;
+                        }
 
-                            // add the training model to the ISM
-                            if (!ism.addTrainingModel(filename, classId))
+                        std::vector<Json::Value> expanded;
+                        for (const Json::Value &setting : settings)
+                        {
+                            for (const Json::Value &value : values)
                             {
-                                std::cerr << "could not add training model: " << filename << ", class " << classId << std::endl;
-                                return 1;
+                                expanded.push_back(setting);
+                                expanded.back()[object][name] = value;
                             }
                         }
-                    }
-                    else
-                    {
-                        std::cerr << "number of models does not match the number of class ids" << std::endl;
-                        return 1;
+                        settings.swap(expanded);
                     }
                 }
+                std::cout << "sweeping " << settings.size() << " parameter settings" << std::endl;
 
-                // train
-                ism.train();
+                ism3d::ImplicitShapeModel ism;
+                ism.setLogging(log_info);
+                ism.setSignalsState(false);
+                if (variables.count("load-classes"))
+                {
+                    std::vector<unsigned> loadClasses = variables["load-classes"].as<std::vector<unsigned> >();
+                    ism.setLoadClasses(std::set<unsigned>(loadClasses.begin(), loadClasses.end()));
+                }
+                if (!ism.readObject(ismFile))
+                {
+                    std::cerr << "could not read ism from file, detection stopped: " << ismFile << std::endl;
+                    return 1;
+                }
 
-                // write the ism data
-                if (variables.count("inplace"))
+                // one folder with a summary for each setting
+                std::string folder = variables["output"].as<std::string>();
+                std::vector<std::string> settingNames(settings.size());
+                std::vector<std::shared_ptr<std::ofstream> > summaryFiles(settings.size());
+                std::vector<DetectionSummary> summaries(settings.size());
+                Json::FastWriter writer;
+                for (int j = 0; j < (int)settings.size(); j++)
                 {
-                    if (!ism.writeObject(ismFile, ismFile + "d"))
-                    {
-                        std::cerr << "could not write ism" << std::endl;
-                        return 1;
-                    }
+                    std::ostringstream name;
+                    name << "setting_" << std::setw(4) << std::setfill('0') << j;
+                    settingNames[j] = name.str();
+                    boost::filesystem::path path = boost::filesystem::path(folder) / settingNames[j];
+                    boost::filesystem::create_directories(path);
+
+                    summaryFiles[j] = std::make_shared<std::ofstream>((path / "summary.txt").string().c_str(), std::ios::out);
+                    *summaryFiles[j] << "parameters: " << writer.write(settings[j]) << std::endl;
                 }
-                else if (variables.count("output"))
+
+                boost::timer::cpu_timer timer;
+                std::map<std::string, double> times;
+                std::shared_ptr<ism3d::PointCloudLoader> loader = ism.createPointCloudLoader(pointClouds);
+                for (unsigned i = 0; i < pointClouds.size(); i++)
                 {
-                    std::string outFilename = variables["output"].as<std::string>();
-                    if (!ism.writeObject(outFilename))
+                    std::cout << "Processing file: " << pointClouds[i] << std::endl;
+                    bool hasNormals = false;
+                    pcl::PointCloud<ism3d::PointNormalT>::Ptr points = loader->next(&hasNormals);
+                    std::vector<std::vector<ism3d::VotingMaximum> > maxima;
+                    std::map<std::string, double> cloudTimes;
+                    if (!ism.detect(points, hasNormals, settings, maxima, cloudTimes))
                     {
-                        std::cerr << "could not write ism" << std::endl;
+                        std::cerr << "detection failed" << std::endl;
                         return 1;
                     }
+                    times["complete"] += cloudTimes["complete"];
+
+                    for (int j = 0; j < (int)settings.size(); j++)
+                        summaries[j].add(*summaryFiles[j], pointClouds[i], groundtruth[i], maxima[j]);
                 }
-                else
+
+                // the overview lists the classification rate of every setting
+                std::ofstream overviewFile((boost::filesystem::path(folder) / "sweep.txt").string().c_str(), std::ios::out);
+                overviewFile << "ISM3D parameter sweep, filename: " << ismFile << ", parameter grid: " << gridFile << "\n";
+                overviewFile << "setting, correct, correct above 80%, parameters\n";
+                for (int j = 0; j < (int)settings.size(); j++)
                 {
-                    std::cerr << "the trained ism is not saved" << std::endl;
-                    return 1;
+                    summaries[j].writeResults(*summaryFiles[j], pointClouds.size());
+                    summaryFiles[j]->close();
+                    overviewFile << settingNames[j] << ", " << ((float)summaries[j].numCorrectClasses/pointClouds.size())*100.0f << " %, "
+                                 << ((float)summaries[j].numCorrect80/pointClouds.size())*100.0f << " %, " << writer.write(settings[j]);
                 }
+                overviewFile << "\n\ncomplete time: " << times["complete"] / 1000 << " [s]" << std::endl;
+                overviewFile << " Total processing time: " << timer.format(4, "%w") << " seconds \n";
             }
 
             // detect the ISM
-            if ((variables.count("detect") && mode == "") || mode == "test")
+            if (!variables.count("serve") && !variables.count("sweep") && ((variables.count("detect") && mode == "") || mode == "test"))
             {
                 std::cout << "starting the detection process" << std::endl;
 
@@ -237,12 +1952,25 @@ int main(int argc, char **argv)
                 ism.setLogging(log_info);
                 ism.setSignalsState(false); // disable signals since we are using command line, no GUI
 
+                if (variables.count("load-classes"))
+                {
+                    std::vector<unsigned> loadClasses = variables["load-classes"].as<std::vector<unsigned> >();
+                    ism.setLoadClasses(std::set<unsigned>(loadClasses.begin(), loadClasses.end()));
+                }
                 if (!ism.readObject(ismFile))
                 {
                     std::cerr << "could not read ism from file, detection stopped: " << ismFile << std::endl;
                     return 1;
                 }
-                else if ((variables.count("pointclouds") && variables.count("groundtruth")) ||
+
+                const bool verbose = variables.count("verbose") > 0;
+                if (verbose)
+                {
+                    std::cout << "memory usage of the loaded ism:" << std::endl;
+                    ism.memoryUsage().write(std::cout, 2);
+                }
+
+                if ((variables.count("pointclouds") && variables.count("groundtruth")) ||
                          (filenames.size() > 0 && labels.size() > 0))  // load pointclouds and groundtruth
                 {
                     std::vector<std::string> pointClouds;
@@ -259,14 +1987,53 @@ int main(int argc, char **argv)
                         groundtruth = labels;
                     }
 
+                    // a shard detects every n-th point cloud of the list, starting with the i-th
+                    const bool sharded = variables.count("shard") > 0;
+                    ShardResults shardResults;
+                    std::vector<int> listIndices;
+                    if (sharded)
+                    {
+                        if (!parseShard(variables["shard"].as<std::string>(), shardResults.shardIndex, shardResults.numShards))
+                        {
+                            std::cerr << "the shard has to be given as i/n with 0 <= i < n" << std::endl;
+                            return 1;
+                        }
+                        if (!variables.count("output"))
+                        {
+                            std::cerr << "no output folder specified, a shard needs an output folder for its results" << std::endl;
+                            return 1;
+                        }
+                        if (variables.count("stream"))
+                        {
+                            std::cerr << "the consecutive frames of --stream can not be sharded" << std::endl;
+                            return 1;
+                        }
+
+                        if (pointClouds.size() == groundtruth.size())
+                        {
+                            std::vector<std::string> shardClouds;
+                            std::vector<unsigned> shardGroundtruth;
+                            for (int i = shardResults.shardIndex; i < (int)pointClouds.size(); i += shardResults.numShards)
+                            {
+                                listIndices.push_back(i);
+                                shardClouds.push_back(pointClouds[i]);
+                                shardGroundtruth.push_back(groundtruth[i]);
+                            }
+                            shardResults.ismFile = ismFile;
+                            shardResults.numListed = pointClouds.size();
+                            pointClouds.swap(shardClouds);
+                            groundtruth.swap(shardGroundtruth);
+                            std::cout << "detecting shard " << shardResults.shardIndex << " of " << shardResults.numShards
+                                      << " with " << pointClouds.size() << " of " << shardResults.numListed
+                                      << " point clouds" << std::endl;
+                        }
+                    }
+                    const std::string outputPrefix = sharded ? getShardName(shardResults.shardIndex, shardResults.numShards) + "_" : "";
+
                     // prepare summary
                     std::ofstream summaryFile;
-                    int numCorrectClasses = 0;
-                    int numCorrect80 = 0;
-
-                    int numCorrectGlobal = 0;
-                    int numBothCorrect = 0;
-                    int numOnlyGlobalCorrect = 0;
+                    DetectionSummary summary;
+                    std::shared_ptr<ResultLogWriter> resultLog;
 
                     //std::cout << "preparing output folder" << std::endl;
 
@@ -279,11 +2046,25 @@ int main(int argc, char **argv)
                         int unused = std::system(command.c_str());
                         sleep(1);
 
-                        // summary file
-                        std::string outFile = variables["output"].as<std::string>();
-                        std::string outFileName = outFile;
-                        outFileName.append("/summary.txt");
-                        summaryFile.open(outFileName.c_str(), std::ios::out);
+                        if (variables.count("result-log"))
+                        {
+                            // one buffered binary file for all point clouds instead of the text files
+                            resultLog = std::make_shared<ResultLogWriter>(folder + "/" + outputPrefix + "results.bin");
+                            if (!resultLog->good())
+                            {
+                                std::cerr << "could not create the result log in " << folder << std::endl;
+                                return 1;
+                            }
+                            resultLog->writeRun(ismFile);
+                        }
+                        else
+                        {
+                            // summary file
+                            std::string outFile = variables["output"].as<std::string>();
+                            std::string outFileName = outFile;
+                            outFileName.append("/" + outputPrefix + "summary.txt");
+                            summaryFile.open(outFileName.c_str(), std::ios::out);
+                        }
                     }
                     else
                     {
@@ -295,155 +2076,194 @@ int main(int argc, char **argv)
                         boost::timer::cpu_timer timer;
 
                         std::map<std::string, double> times;
-                        for(unsigned i = 0; i < pointClouds.size(); i++)
+                        LatencyReport latency;
+
+                        // sessions and streaming detectors do not update the statistics of the model
+                        int jobs = variables.count("jobs") ? variables["jobs"].as<int>() : 1;
+                        const bool printDetectionMemory = jobs <= 1 && !variables.count("stream");
+
+                        // the next clouds are loaded while detecting in the current one, the detection overlaps
+                        // the features, the activation and the maxima search of consecutive clouds
+                        std::shared_ptr<ism3d::PointCloudLoader> loader = ism.createPointCloudLoader(pointClouds);
+                        auto processResult = [&](int i, const std::vector<ism3d::VotingMaximum>& maxima,
+                                                 const std::map<std::string, double>& cloudTimes,
+                                                 const std::map<std::string, double>& counters)
                         {
-                            // detect
                             std::string pointCloud = pointClouds.at(i);
                             unsigned trueID = groundtruth.at(i);
-                            std::vector<ism3d::VotingMaximum> maxima;
+                            std::cout << "Processed file: " << pointCloud << std::endl;
 
-                            std::cout << "Processing file: " << pointCloud << std::endl;
-                            if (!ism.detect(pointCloud, maxima, times))
+                            // the latencies are reported per point cloud, the sums hide the outliers
+                            latency.add(sharded ? listIndices.at(i) : i, pointCloud, cloudTimes, counters);
+
+                            // the statistics are those of this cloud if the model detected it itself
+                            if (verbose && printDetectionMemory)
                             {
-                                std::cerr << "detection failed" << std::endl;
-                                return 1;
+                                const std::map<std::string, double> &counters = ism.getLastDetectionStatistics().counters;
+                                for (auto it = counters.lower_bound("vote_bytes"); it != counters.end() &&
+                                     it->first.find("vote_bytes") == 0; it++)
+                                {
+                                    std::cout << "  " << it->first << ": " << std::fixed << std::setprecision(3)
+                                              << it->second / (1024.0 * 1024.0) << " MB" << std::defaultfloat
+                                              << std::setprecision(6) << std::endl;
+                                }
+
+                                const ism3d::VotingReport &report = ism.getLastVotingReport();
+                                if (!report.classes.empty())
+                                {
+                                    Json::FastWriter writer;
+                                    std::cout << "  voting report: " << writer.write(report.toJson());
+                                }
+                            }
+
+                            // sum up the steps of all clouds, activation cache entries are counters
+                            for(auto it : cloudTimes)
+                            {
+                                if(it.first.find("activation_cache") == 0)
+                                    times[it.first] = it.second;
+                                else if(it.first != "complete")
+                                    times[it.first] += it.second;
                             }
-                            else
+
+                            //std::cout << "detected " << maxima.size() << " maxima" << std::endl;
+
+                            if (sharded)
+                                shardResults.add(listIndices.at(i), pointCloud, trueID, maxima, cloudTimes);
+
+                            // write detected maxima to detection log file
+                            if (variables.count("output"))
                             {
-                                //std::cout << "detected " << maxima.size() << " maxima" << std::endl;
+                                if(resultLog)
+                                {
+                                    // the text files are written later by converting the result log
+                                    resultLog->writeCloud(pointCloud, trueID, maxima);
+                                    return;
+                                }
+
+                                if(write_log_to_files)
+                                {
+                                    std::cout << "writing detection log" << std::endl;
+                                    writeDetectionLog(variables["output"].as<std::string>(), ismFile, pointCloud, trueID, maxima);
+                                }
+
+                                // writing summary file
+                                summary.add(summaryFile, pointCloud, trueID, maxima);
+                            }
+                        };
 
-                                // write detected maxima to detection log file
-                                if (variables.count("output"))
+                        // many small point clouds leave most cores idle within a detection, so several are detected
+                        // concurrently, the results are processed in input order
+                        bool detected = true;
+                        if (variables.count("budget"))
+                        {
+                            // each point cloud gets the whole budget, so they are detected one after another
+                            double budget = variables["budget"].as<double>();
+                            for (int i = 0; i < (int)pointClouds.size() && detected; i++)
+                            {
+                                bool hasNormals = false;
+                                pcl::PointCloud<PointNormalT>::Ptr points = loader->next(&hasNormals);
+                                detected = points.get() != 0;
+                                if (detected)
+                                {
+                                    std::map<std::string, double> cloudTimes;
+                                    std::vector<ism3d::VotingMaximum> maxima;
+                                    std::tie(maxima, cloudTimes) = ism.detect(points, hasNormals, budget);
+                                    processResult(i, maxima, cloudTimes, ism.getLastDetectionStatistics().counters);
+                                }
+                            }
+                        }
+                        else if (variables.count("stream"))
+                        {
+                            // each frame is compared with the previous one, so they are detected one after another
+                            std::shared_ptr<ism3d::StreamingDetector> streaming = ism.createStreamingDetector();
+                            for (int i = 0; i < (int)pointClouds.size() && detected; i++)
+                            {
+                                bool hasNormals = false;
+                                pcl::PointCloud<PointNormalT>::Ptr points = loader->next(&hasNormals);
+                                detected = points.get() != 0;
+                                if (detected)
                                 {
-                                    if(write_log_to_files)
-                                    {
-                                        unsigned tmp = pointCloud.find_last_of('/');
-                                        if(tmp == std::string::npos) tmp = 0;
-                                        std::string fileWithoutFolder = pointCloud.substr(tmp+1);
-
-                                        std::cout << "writing detection log" << std::endl;
-                                        std::string outFile = variables["output"].as<std::string>();
-                                        std::string outFileName = outFile;
-                                        outFileName.append("/");
-                                        outFileName.append(fileWithoutFolder);
-                                        outFileName.append(".txt");
-
-                                        std::ofstream file;
-                                        file.open(outFileName.c_str(), std::ios::out);
-                                        file << "ISM3D detection log, filename: " << ismFile << ", point cloud: " << pointCloud << ", ground truth class ID: " << trueID << "\n";
-                                        file << "number, classID, weight, num-votes, position X Y Z, bounding box size X Y Z, bounding Box rotation quaternion w x y z \n";
-
-                                        for (int i = 0; i < (int)maxima.size(); i++)
-                                        {
-                                            const ism3d::VotingMaximum& maximum = maxima[i];
-
-                                            file << i << ", ";
-                                            file << maximum.classId << ", ";
-                                            file << maximum.weight << ", ";
-                                            file << maximum.voteIndices.size() << ", ";
-                                            file << maximum.position[0] << ", ";
-                                            file << maximum.position[1] << ", ";
-                                            file << maximum.position[2] << ", ";
-                                            file << maximum.boundingBox.size[0] << ", ";
-                                            file << maximum.boundingBox.size[1] << ", ";
-                                            file << maximum.boundingBox.size[2] << ", ";
-                                            file << maximum.boundingBox.rotQuat.R_component_1() << ", ";
-                                            file << maximum.boundingBox.rotQuat.R_component_2() << ", ";
-                                            file << maximum.boundingBox.rotQuat.R_component_3() << ", ";
-                                            file << maximum.boundingBox.rotQuat.R_component_4() << std::endl;
-                                        }
-
-                                        file.close();
-                                    }
-
-                                    // writing summary file
-                                    int classId = -1;
-                                    int classIdglobal = -1;
-                                    int classId80 = -1;
-                                    if(maxima.size() > 0)
-                                    {
-                                        classId = maxima.at(0).classId;
-                                        classIdglobal = maxima.at(0).globalHypothesis.first;
-                                    }
-
-                                    // check for classification including non-best maxima
-                                    for (int i = 0; i < (int)maxima.size(); i++)
-                                    {
-                                        const ism3d::VotingMaximum& maximum = maxima[i];
-                                        if(maximum.weight < maxima[0].weight * 0.8) break;
-
-                                        classId80 = maximum.classId;
-                                        if(classId80 == trueID) break;
-                                    }
-
-
-                                    // only display additional classifiers if they are different from normal classification
-                                    summaryFile << "file: " << pointCloud << ", ground truth class: " << trueID << ", classified class: " << classId;
-
-                                    if(classId != classIdglobal)
-                                    {
-                                        summaryFile << ", global class: " << classIdglobal;
-                                    }
-                                    summaryFile << std::endl;
-
-                                    // count correct matches
-                                    // normal classifier
-                                    if(((int)trueID) == classId)
-                                    {
-                                        numCorrectClasses++;
-                                    }
-                                    if(((int)trueID) == classId80)
-                                    {
-                                        numCorrect80++;
-                                    }
-                                    // global classifier
-                                    if(((int)trueID) == classIdglobal)
-                                    {
-                                        numCorrectGlobal++;
-                                    }
-                                    // both correct
-                                    if((int)trueID == classId && (int)trueID == classIdglobal)
-                                    {
-                                        numBothCorrect++;
-                                    }
-                                    // global correct, normal wrong
-                                    if((int)trueID != classId && (int)trueID == classIdglobal)
-                                    {
-                                        numOnlyGlobalCorrect++;
-                                    }
+                                    std::map<std::string, double> cloudTimes;
+                                    std::vector<ism3d::VotingMaximum> maxima;
+                                    std::tie(maxima, cloudTimes) = streaming->detect(points, hasNormals);
+
+                                    // streaming detectors keep no statistics, only the input size is known
+                                    std::map<std::string, double> counters;
+                                    counters["points"] = points->size();
+                                    processResult(i, maxima, cloudTimes, counters);
                                 }
                             }
                         }
+                        else if (jobs > 1)
+                        {
+                            detected = detectParallel(ism, loader, pointClouds.size(), jobs, processResult);
+                        }
+                        else
+                        {
+                            // the statistics of the model are those of the point cloud passed to the callback
+                            detected = ism.detectBatch(loader, pointClouds.size(), [&](int i, const std::vector<ism3d::VotingMaximum>& maxima,
+                                                                                       const std::map<std::string, double>& cloudTimes)
+                            {
+                                processResult(i, maxima, cloudTimes, ism.getLastDetectionStatistics().counters);
+                            });
+                        }
+                        if (!detected)
+                        {
+                            std::cerr << "detection failed" << std::endl;
+                            return 1;
+                        }
+                        times["complete"] = timer.elapsed().wall / 1e6;
+
+                        // the stage times and counters of each point cloud
+                        if (variables.count("output"))
+                        {
+                            const std::string latencyFile = variables["output"].as<std::string>() + "/" + outputPrefix + "latency.csv";
+                            if (!latency.writeCsv(latencyFile))
+                                std::cerr << "could not write the latencies: " << latencyFile << std::endl;
+                        }
+
+                        if (sharded)
+                        {
+                            // the partial results are merged with the other shards by --merge-shards
+                            shardResults.times = times;
+                            shardResults.totalTime = timer.elapsed().wall / 1e9;
+                            const std::string shardFile = variables["output"].as<std::string>() + "/" +
+                                    getShardName(shardResults.shardIndex, shardResults.numShards) + ".json";
+                            std::ofstream shardStream(shardFile.c_str(), std::ios::out);
+                            Json::StyledWriter writer;
+                            shardStream << writer.write(shardResults.toJson());
+                            shardStream.close();
+                            if (!shardStream)
+                            {
+                                std::cerr << "could not write the shard results: " << shardFile << std::endl;
+                                return 1;
+                            }
+                        }
 
-                        // write processing time details to summary
-                        double time_sum = 0;
-                        for(auto it : times)
+                        if (resultLog)
+                        {
+                            // the times and counters of the run, the summary is computed when converting
+                            for (auto it : times)
+                                resultLog->writeValue(it.first, it.second);
+                            resultLog->writeValue("total", timer.elapsed().wall / 1e9);
+                            if (!resultLog->close())
+                            {
+                                std::cerr << "could not write the result log" << std::endl;
+                                return 1;
+                            }
+                        }
+                        else
                         {
-                            if(it.first == "complete") continue;
-                            time_sum += (it.second / 1000);
+                            // write processing time details to summary
+                            writeSummaryTimes(summaryFile, times);
+                            latency.writeSummary(summaryFile, timer.elapsed().wall / 1e9);
+
+                            // complete and close summary file
+                            summary.writeResults(summaryFile, pointClouds.size());
+
+                            summaryFile << " Total processing time: " << timer.format(4, "%w") << " seconds \n";
+                            summaryFile.close();
                         }
-                        summaryFile << "\n\n\ncomplete time: " << times["complete"] / 1000 << " [s]" << ", sum all steps: " << time_sum << " [s]" << std::endl;
-                        summaryFile << "times per step:\n";
-                        summaryFile << "create flann index: " << std::setw(10) << std::setfill(' ') << times["flann"] / 1000 << " [s]" << std::endl;
-                        summaryFile << "compute normals:    " << std::setw(10) << std::setfill(' ') << times["normals"] / 1000 << " [s]" << std::endl;
-                        summaryFile << "compute keypoints:  " << std::setw(10) << std::setfill(' ') << times["keypoints"] / 1000 << " [s]" << std::endl;
-                        summaryFile << "compute features:   " << std::setw(10) << std::setfill(' ') << times["features"] / 1000 << " [s]" << std::endl;
-                        summaryFile << "cast votes:         " << std::setw(10) << std::setfill(' ') << times["voting"] / 1000 << " [s]" << std::endl;
-                        summaryFile << "find maxima:        " << std::setw(10) << std::setfill(' ') << times["maxima"] / 1000 << " [s]" << std::endl;
-
-                        // complete and close summary file
-                        summaryFile << "\n\n result: " << numCorrectClasses << " of " << pointClouds.size() << " shapes classified correctly ("
-                                    << ((float)numCorrectClasses/pointClouds.size())*100.0f << " %)\n";
-                        summaryFile << " result: " << numCorrect80 << " of " << pointClouds.size() << " shapes classified correctly ("
-                                    << ((float)numCorrect80/pointClouds.size())*100.0f << " %) [above 80% of top result's score]\n";
-
-                        summaryFile << " result: " << numCorrectGlobal << " of " << pointClouds.size() << " shapes classified correctly with global descriptors ("
-                                    << ((float)numCorrectGlobal/pointClouds.size())*100.0f << " %)\n\n";
-                        summaryFile << " both correct: " << numBothCorrect << " (" << ((float)numBothCorrect/pointClouds.size())*100.0f << " %)\n";
-                        summaryFile << " only global correct: " << numOnlyGlobalCorrect << " (" << ((float)numOnlyGlobalCorrect/pointClouds.size())*100.0f << " %)\n\n\n";
-
-                        summaryFile << " Total processing time: " << timer.format(4, "%w") << " seconds \n";
-                        summaryFile.close();
 
                     }
                     else
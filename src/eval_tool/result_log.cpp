@@ -0,0 +1,214 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "result_log.h"
+
+#include <cstring>
+
+namespace
+{
+    // the records of a run are written in large blocks instead of one write per maximum
+    const std::size_t BufferSize = 1 << 20;
+
+    // a corrupt count must not allocate unbounded memory
+    const uint32_t MaxStringLength = 1 << 16;
+}
+
+const char ResultLogWriter::Magic[8] = {'I', 'S', 'M', 'R', 'L', 'O', 'G', '1'};
+
+ResultLogWriter::ResultLogWriter(const std::string &file)
+    : m_buffer(BufferSize)
+{
+    // the buffer has to be set before the file is opened
+    m_stream.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+    m_stream.open(file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    m_stream.write(Magic, sizeof(Magic));
+}
+
+bool ResultLogWriter::good() const
+{
+    return m_stream.is_open() && m_stream.good();
+}
+
+void ResultLogWriter::writeRun(const std::string &ismFile)
+{
+    writeRaw((uint8_t)RunRecord);
+    writeString(ismFile);
+}
+
+void ResultLogWriter::writeCloud(const std::string &pointCloud, unsigned trueId,
+                                 const std::vector<ism3d::VotingMaximum> &maxima)
+{
+    writeRaw((uint8_t)CloudRecord);
+    writeString(pointCloud);
+    writeRaw((uint32_t)trueId);
+    writeRaw((uint32_t)maxima.size());
+
+    for (const ism3d::VotingMaximum &maximum : maxima)
+    {
+        MaximumRecord record;
+        record.classId = maximum.classId;
+        record.globalClassId = maximum.globalHypothesis.first;
+        record.weight = maximum.weight;
+        record.globalScore = maximum.globalHypothesis.second;
+        record.numVotes = maximum.voteIndices.size();
+        for (int i = 0; i < 3; i++)
+        {
+            record.position[i] = maximum.position[i];
+            record.boxSize[i] = maximum.boundingBox.size[i];
+        }
+        record.boxRotation[0] = maximum.boundingBox.rotQuat.R_component_1();
+        record.boxRotation[1] = maximum.boundingBox.rotQuat.R_component_2();
+        record.boxRotation[2] = maximum.boundingBox.rotQuat.R_component_3();
+        record.boxRotation[3] = maximum.boundingBox.rotQuat.R_component_4();
+        writeRaw(record);
+    }
+}
+
+void ResultLogWriter::writeValue(const std::string &name, double value)
+{
+    writeRaw((uint8_t)ValueRecord);
+    writeString(name);
+    writeRaw(value);
+}
+
+bool ResultLogWriter::close()
+{
+    if (!m_stream.is_open())
+        return false;
+    m_stream.flush();
+    bool written = m_stream.good();
+    m_stream.close();
+    return written;
+}
+
+void ResultLogWriter::writeString(const std::string &value)
+{
+    writeRaw((uint32_t)value.size());
+    m_stream.write(value.data(), value.size());
+}
+
+
+ResultLogReader::ResultLogReader(const std::string &file)
+    : m_buffer(BufferSize), m_failed(false), m_type(ResultLogWriter::RunRecord), m_true_id(0), m_value(0)
+{
+    m_stream.rdbuf()->pubsetbuf(m_buffer.data(), m_buffer.size());
+    m_stream.open(file.c_str(), std::ios::in | std::ios::binary);
+
+    char magic[sizeof(ResultLogWriter::Magic)];
+    if (!m_stream.read(magic, sizeof(magic)) ||
+            std::memcmp(magic, ResultLogWriter::Magic, sizeof(magic)) != 0)
+        m_failed = true;
+}
+
+bool ResultLogReader::good() const
+{
+    return m_stream.is_open() && !m_failed;
+}
+
+bool ResultLogReader::next()
+{
+    if (!good())
+        return false;
+
+    uint8_t type;
+    if (!readRaw(type))
+        return false; // end of file
+
+    m_maxima.clear();
+    m_failed = true;
+    if (!readString(m_name))
+        return false;
+
+    if (type == ResultLogWriter::RunRecord)
+    {
+        m_type = ResultLogWriter::RunRecord;
+    }
+    else if (type == ResultLogWriter::CloudRecord)
+    {
+        m_type = ResultLogWriter::CloudRecord;
+        uint32_t trueId, numMaxima;
+        if (!readRaw(trueId) || !readRaw(numMaxima))
+            return false;
+        m_true_id = trueId;
+
+        for (uint32_t i = 0; i < numMaxima; i++)
+        {
+            ResultLogWriter::MaximumRecord record;
+            if (!readRaw(record))
+                return false;
+
+            ism3d::VotingMaximum maximum;
+            maximum.classId = record.classId;
+            maximum.globalHypothesis = std::pair<int, float>(record.globalClassId, record.globalScore);
+            maximum.weight = record.weight;
+            // only the number of votes is stored
+            maximum.voteIndices.resize(record.numVotes, -1);
+            maximum.position = Eigen::Vector3f(record.position[0], record.position[1], record.position[2]);
+            maximum.boundingBox.position = maximum.position;
+            maximum.boundingBox.size = Eigen::Vector3f(record.boxSize[0], record.boxSize[1], record.boxSize[2]);
+            maximum.boundingBox.rotQuat = boost::math::quaternion<float>(record.boxRotation[0], record.boxRotation[1],
+                                                                         record.boxRotation[2], record.boxRotation[3]);
+            m_maxima.push_back(maximum);
+        }
+    }
+    else if (type == ResultLogWriter::ValueRecord)
+    {
+        m_type = ResultLogWriter::ValueRecord;
+        if (!readRaw(m_value))
+            return false;
+    }
+    else
+    {
+        return false;
+    }
+
+    m_failed = false;
+    return true;
+}
+
+bool ResultLogReader::failed() const
+{
+    return m_failed;
+}
+
+ResultLogWriter::RecordType ResultLogReader::getType() const
+{
+    return m_type;
+}
+
+const std::string& ResultLogReader::getName() const
+{
+    return m_name;
+}
+
+unsigned ResultLogReader::getTrueId() const
+{
+    return m_true_id;
+}
+
+const std::vector<ism3d::VotingMaximum>& ResultLogReader::getMaxima() const
+{
+    return m_maxima;
+}
+
+double ResultLogReader::getValue() const
+{
+    return m_value;
+}
+
+bool ResultLogReader::readString(std::string &value)
+{
+    uint32_t length;
+    if (!readRaw(length) || length > MaxStringLength)
+        return false;
+    value.resize(length);
+    return length == 0 || (bool)m_stream.read(&value[0], length);
+}
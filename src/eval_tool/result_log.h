@@ -0,0 +1,132 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_RESULT_LOG_H
+#define ISM3D_RESULT_LOG_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "../implicit_shape_model/voting/voting.h"
+
+/**
+ * @brief The ResultLogWriter class
+ * Appends the results of a detection run to one binary file through a large buffer instead of formatting a text
+ * file per point cloud. The file starts with the magic "ISMRLOG1" and consists of records of a one byte type:
+ *   run    the ism file: string
+ *   cloud  the point cloud: string, ground truth class id: uint32, number of maxima: uint32, followed by one
+ *          fixed size MaximumRecord per maximum
+ *   value  a time or counter of the run: name string, value float64
+ * Strings are stored as uint32 length followed by the characters, all numbers in host byte order. ResultLogReader
+ * reads the records back, e.g. to write the text detection logs and the summary.
+ */
+class ResultLogWriter
+{
+public:
+    static const char Magic[8];
+
+    enum RecordType
+    {
+        RunRecord = 1,
+        CloudRecord = 2,
+        ValueRecord = 3
+    };
+
+    // the fixed layout of a maximum in the file, only four byte members so that there is no padding
+    struct MaximumRecord
+    {
+        uint32_t classId;
+        int32_t globalClassId;
+        float weight;
+        float globalScore;
+        uint32_t numVotes;
+        float position[3];
+        float boxSize[3];
+        float boxRotation[4]; // quaternion w x y z
+    };
+
+    explicit ResultLogWriter(const std::string &file);
+
+    bool good() const;
+
+    void writeRun(const std::string &ismFile);
+    void writeCloud(const std::string &pointCloud, unsigned trueId, const std::vector<ism3d::VotingMaximum> &maxima);
+    void writeValue(const std::string &name, double value);
+
+    /**
+     * @brief Flush the buffer and close the file.
+     * @return true if all records were written
+     */
+    bool close();
+
+private:
+    void writeString(const std::string &value);
+
+    template<typename T>
+    void writeRaw(const T &value)
+    {
+        m_stream.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    std::vector<char> m_buffer;
+    std::ofstream m_stream;
+};
+
+/**
+ * @brief The ResultLogReader class
+ * Reads the records of a file written by ResultLogWriter one after another.
+ */
+class ResultLogReader
+{
+public:
+    explicit ResultLogReader(const std::string &file);
+
+    bool good() const;
+
+    /**
+     * @brief Read the next record.
+     * @return false at the end of the file or on an error, see failed()
+     */
+    bool next();
+
+    bool failed() const;
+
+    ResultLogWriter::RecordType getType() const;
+
+    // the ism file of a run record, the point cloud of a cloud record or the name of a value record
+    const std::string& getName() const;
+
+    unsigned getTrueId() const;
+    const std::vector<ism3d::VotingMaximum>& getMaxima() const;
+    double getValue() const;
+
+private:
+    bool readString(std::string &value);
+
+    template<typename T>
+    bool readRaw(T &value)
+    {
+        return (bool)m_stream.read(reinterpret_cast<char*>(&value), sizeof(T));
+    }
+
+    std::vector<char> m_buffer;
+    std::ifstream m_stream;
+    bool m_failed;
+
+    ResultLogWriter::RecordType m_type;
+    std::string m_name;
+    unsigned m_true_id;
+    std::vector<ism3d::VotingMaximum> m_maxima;
+    double m_value;
+};
+
+#endif // ISM3D_RESULT_LOG_H
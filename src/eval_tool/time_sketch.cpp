@@ -0,0 +1,129 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "time_sketch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+namespace
+{
+    // smaller values, e.g. stages that did not run, are counted as 0
+    const double MinValue = 1e-6;
+}
+
+const double TimeSketch::RelativeAccuracy = 0.01;
+
+TimeSketch::TimeSketch()
+    : m_zero_count(0), m_count(0), m_sum(0), m_min(0), m_max(0)
+{
+    // the values of bucket i are in (gamma^(i-1), gamma^i]
+    const double gamma = (1 + RelativeAccuracy) / (1 - RelativeAccuracy);
+    m_log_gamma = std::log(gamma);
+}
+
+void TimeSketch::add(double value)
+{
+    value = std::max(value, 0.0);
+    if (value < MinValue)
+        m_zero_count++;
+    else
+        m_buckets[getBucket(value)]++;
+
+    m_min = m_count > 0 ? std::min(m_min, value) : value;
+    m_max = m_count > 0 ? std::max(m_max, value) : value;
+    m_count++;
+    m_sum += value;
+}
+
+void TimeSketch::merge(const TimeSketch &other)
+{
+    if (other.m_count == 0)
+        return;
+
+    for (const std::pair<const int, uint64_t> &bucket : other.m_buckets)
+        m_buckets[bucket.first] += bucket.second;
+    m_zero_count += other.m_zero_count;
+    m_min = m_count > 0 ? std::min(m_min, other.m_min) : other.m_min;
+    m_max = m_count > 0 ? std::max(m_max, other.m_max) : other.m_max;
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+}
+
+double TimeSketch::quantile(double q) const
+{
+    if (m_count == 0)
+        return 0.0;
+
+    // nearest rank, the estimate of the bucket is clamped to the exact range of the values
+    const uint64_t rank = (uint64_t)std::max(std::ceil(std::min(std::max(q, 0.0), 1.0) * m_count), 1.0);
+    uint64_t seen = m_zero_count;
+    if (seen >= rank)
+        return 0.0;
+    for (const std::pair<const int, uint64_t> &bucket : m_buckets)
+    {
+        seen += bucket.second;
+        if (seen >= rank)
+            return std::min(std::max(getBucketValue(bucket.first), m_min), m_max);
+    }
+    return m_max;
+}
+
+Json::Value TimeSketch::toJson() const
+{
+    Json::Value object(Json::objectValue);
+    object["count"] = (Json::UInt64)m_count;
+    object["sum"] = m_sum;
+    object["min"] = getMin();
+    object["max"] = getMax();
+    object["zeros"] = (Json::UInt64)m_zero_count;
+    Json::Value buckets(Json::objectValue);
+    for (const std::pair<const int, uint64_t> &bucket : m_buckets)
+        buckets[std::to_string(bucket.first)] = (Json::UInt64)bucket.second;
+    object["buckets"] = buckets;
+    return object;
+}
+
+bool TimeSketch::fromJson(const Json::Value &object)
+{
+    *this = TimeSketch();
+    if (!object.isObject() || !object["count"].isIntegral() || !object["buckets"].isObject())
+        return false;
+
+    m_count = object["count"].asUInt64();
+    m_sum = object["sum"].asDouble();
+    m_min = object["min"].asDouble();
+    m_max = object["max"].asDouble();
+    m_zero_count = object["zeros"].asUInt64();
+
+    uint64_t counted = m_zero_count;
+    const Json::Value &buckets = object["buckets"];
+    for (const std::string &name : buckets.getMemberNames())
+    {
+        if (!buckets[name].isIntegral())
+            return false;
+        m_buckets[std::stoi(name)] = buckets[name].asUInt64();
+        counted += buckets[name].asUInt64();
+    }
+    return counted == m_count;
+}
+
+int TimeSketch::getBucket(double value) const
+{
+    return (int)std::ceil(std::log(value) / m_log_gamma);
+}
+
+double TimeSketch::getBucketValue(int bucket) const
+{
+    // the value with the same relative error to both bounds of the bucket
+    const double gamma = std::exp(m_log_gamma);
+    return 2 * std::exp(bucket * m_log_gamma) / (gamma + 1);
+}
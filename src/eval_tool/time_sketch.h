@@ -0,0 +1,79 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_TIME_SKETCH_H
+#define ISM3D_TIME_SKETCH_H
+
+#include <cstdint>
+#include <map>
+
+#include <jsoncpp/json/json.h>
+
+/**
+ * @brief The TimeSketch class
+ * A mergeable summary of the distribution of non-negative values, e.g. the stage times of the point clouds of an
+ * evaluation. The values are counted in logarithmic buckets, so that quantiles are estimated with a relative error
+ * of at most RelativeAccuracy independent of the number of values, and the sketches of the shards of a run are
+ * merged by adding the counts of their buckets. The count, sum, minimum and maximum are exact.
+ */
+class TimeSketch
+{
+public:
+    static const double RelativeAccuracy;
+
+    TimeSketch();
+
+    void add(double value);
+    void merge(const TimeSketch &other);
+
+    /**
+     * @brief Estimate a quantile of the values.
+     * @param q the quantile in [0, 1], e.g. 0.95
+     * @return the estimate, 0 without values
+     */
+    double quantile(double q) const;
+
+    uint64_t getCount() const
+    {
+        return m_count;
+    }
+
+    double getSum() const
+    {
+        return m_sum;
+    }
+
+    double getMin() const
+    {
+        return m_count > 0 ? m_min : 0.0;
+    }
+
+    double getMax() const
+    {
+        return m_count > 0 ? m_max : 0.0;
+    }
+
+    Json::Value toJson() const;
+    bool fromJson(const Json::Value &object);
+
+private:
+    int getBucket(double value) const;
+    double getBucketValue(int bucket) const;
+
+    double m_log_gamma;
+    std::map<int, uint64_t> m_buckets;
+    uint64_t m_zero_count; // values too small for a bucket
+    uint64_t m_count;
+    double m_sum;
+    double m_min;
+    double m_max;
+};
+
+#endif // ISM3D_TIME_SKETCH_H
@@ -32,6 +32,33 @@ std::vector<std::shared_ptr<Codeword> > ActivationStrategy::operate(const ISMFea
     return activatedWords;
 }
 
+std::vector<std::shared_ptr<Codeword> > ActivationStrategy::operate(const ISMFeature& feature,
+                                                                      const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                                      const Distance* distance,
+                                                                      std::vector<float> &distances)
+{
+    LOG_ASSERT(distance);
+    m_distance = distance;
+    distances.clear();
+    std::vector<std::shared_ptr<Codeword> > activatedWords = activateWithDistances(feature, codewords, distances);
+    if (distances.size() != activatedWords.size())
+        distances.clear();
+    return activatedWords;
+}
+
+std::vector<std::shared_ptr<Codeword> > ActivationStrategy::activateWithDistances(const ISMFeature& feature,
+                                                                                    const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                                                    std::vector<float> &) const
+{
+    return activate(feature, codewords);
+}
+
+void ActivationStrategy::prepare(const std::vector<std::shared_ptr<Codeword> >&, const Distance* distance)
+{
+    LOG_ASSERT(distance);
+    m_distance = distance;
+}
+
 const Distance& ActivationStrategy::distance() const
 {
     LOG_ASSERT(m_distance);
@@ -26,6 +26,34 @@ namespace ism3d
     class Codeword;
     class Distance;
 
+    /**
+     * @brief The ActivationResult struct
+     * Flat (CSR) result of a batched activation. The codewords activated by query i are stored in
+     * codewordIndices[offsets[i]] to codewordIndices[offsets[i+1]-1], the corresponding distances
+     * between query descriptor and codeword at the same positions in distances. Codeword indices
+     * refer to the codeword list (and flann dataset) used for activation.
+     */
+    struct ActivationResult
+    {
+        std::vector<int> offsets;
+        std::vector<int> codewordIndices;
+        std::vector<float> distances;
+        std::vector<unsigned> classes; // the candidate classes of a class cascade, only their votes are cast; empty for all
+
+        int numQueries() const
+        {
+            return offsets.empty() ? 0 : (int)offsets.size() - 1;
+        }
+
+        void clear()
+        {
+            offsets.clear();
+            codewordIndices.clear();
+            distances.clear();
+            classes.clear();
+        }
+    };
+
     /**
      * @brief The ActivationStrategy class
      * The activation strategy matches a feature against codewords and returns those codewords
@@ -48,11 +76,39 @@ namespace ism3d
                                                              const std::vector<std::shared_ptr<Codeword> >& codewords,
                                                              const Distance* distance);
 
+        /**
+         * @brief Match the feature against a list of codewords as above and get the distances to the activated
+         * codewords, if the strategy computes them during the activation
+         * @param feature the feature to match against the codebook
+         * @param codewords a list of codewords
+         * @param distance the distance measure which determines the distance between feature and codeword
+         * @param distances output: the distance to each activated codeword, empty if they were not computed
+         * @return a list of activated codewords
+         */
+        std::vector<std::shared_ptr<Codeword> > operate(const ISMFeature& feature,
+                                                             const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                             const Distance* distance,
+                                                             std::vector<float> &distances);
+
+        /**
+         * @brief Prepare the activation against a list of codewords, e.g. by building a search structure. Must be
+         * called before activating features in parallel with operate().
+         * @param codewords the list of codewords that will be passed to operate()
+         * @param distance the distance measure which determines the distance between feature and codeword
+         */
+        virtual void prepare(const std::vector<std::shared_ptr<Codeword> >& codewords, const Distance* distance);
+
     protected:
         ActivationStrategy();
 
         virtual std::vector<std::shared_ptr<Codeword> > activate(const ISMFeature&,
                                                                    const std::vector<std::shared_ptr<Codeword> >&) const = 0;
+
+        // strategies that compare the feature with the codewords report the distances, so that they are not computed
+        // again when casting votes; by default no distances are reported
+        virtual std::vector<std::shared_ptr<Codeword> > activateWithDistances(const ISMFeature& feature,
+                                                                                const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                                                std::vector<float> &distances) const;
         const Distance& distance() const;
         const Distance* m_distance;
     };
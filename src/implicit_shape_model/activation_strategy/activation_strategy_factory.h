@@ -15,6 +15,7 @@
 #include "activation_strategy_threshold.h"
 #include "activation_strategy_knn.h"
 #include "activation_strategy_inn.h"
+#include "activation_strategy_vocabulary_tree.h"
 
 namespace ism3d
 {
@@ -27,6 +28,8 @@ namespace ism3d
             return new ActivationStrategyINN();
         else if (type == ActivationStrategyThreshold::getTypeStatic())
             return new ActivationStrategyThreshold();
+        else if (type == ActivationStrategyVocabularyTree::getTypeStatic())
+            return new ActivationStrategyVocabularyTree();
         else
             return 0;
     }
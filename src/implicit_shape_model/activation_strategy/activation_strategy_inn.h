@@ -17,6 +17,9 @@
 #include "../utils/utils.h"
 #include "../utils/distance.h"
 
+#include <algorithm>
+#include <omp.h>
+
 namespace ism3d
 {
 /**
@@ -36,51 +39,117 @@ public:
     template<typename T>
     std::vector<std::shared_ptr<Codeword> > activateINN(const ISMFeature& feature,
                                                           const std::vector<std::shared_ptr<Codeword> >& codewords,
-                                                          const flann::Index<T> index,
+                                                          const KnnIndex<T> &index,
                                                           const bool flann_exact_match) const
     {
+        // a batch of a single query
+        std::vector<float> descriptor(feature.descriptor.begin(), feature.descriptor.end());
+        flann::Matrix<float> query(descriptor.data(), 1, descriptor.size());
+        ActivationResult result;
+        activateINNBatch(query, codewords, index, flann_exact_match, 1, result);
+
         std::vector<std::shared_ptr<Codeword> > activatedCodewords;
+        if (result.codewordIndices[0] >= 0)
+            activatedCodewords.push_back(codewords[result.codewordIndices[0]]);
+        return activatedCodewords;
+    }
 
-        // insert the query point
-        flann::Matrix<float> query(new float[feature.descriptor.size()], 1, feature.descriptor.size());
-        for(int i = 0; i < feature.descriptor.size(); i++)
+    /**
+     * @brief Activate the best matching codeword for a whole batch of features using iterative nearest neighbors.
+     * Each iteration runs a single flann search over the queries that are still active, a query stops iterating
+     * once its nearest codeword is the same as in the previous iteration.
+     * @param queries all query descriptors, one per row, stored contiguously (not modified)
+     * @param codewords the codewords the flann index was built on
+     * @param index the nearest neighbor index built on the codewords
+     * @param flann_exact_match true to use exact search
+     * @param num_threads number of threads for the index search (0: use all available cores)
+     * @param result output: activated codeword index per query, the distance refers to the last updated query
+     */
+    template<typename T>
+    void activateINNBatch(const flann::Matrix<float> &queries,
+                          const std::vector<std::shared_ptr<Codeword> >& codewords,
+                          const KnnIndex<T> &index,
+                          const bool flann_exact_match,
+                          const int num_threads,
+                          ActivationResult &result) const
+    {
+        const int num_queries = (int)queries.rows;
+        const int dim = (int)queries.cols;
+
+        result.offsets.resize(num_queries + 1);
+        for (int i = 0; i <= num_queries; i++)
+            result.offsets[i] = i;
+        result.codewordIndices.assign(num_queries, -1);
+        result.distances.assign(num_queries, 0.0f);
+
+        if (num_queries == 0 || codewords.empty())
+            return;
+
+        // the queries are updated in every iteration, so work on a copy; the rows of the active queries are kept
+        // at the front of the copy in the order of their features
+        std::vector<float> query_data(queries.ptr(), queries.ptr() + num_queries * dim);
+        std::vector<int> active(num_queries);
+        for (int q = 0; q < num_queries; q++)
+            active[q] = q;
+        std::vector<int> active_indices(num_queries);
+        std::vector<float> active_distances(num_queries);
+
+        for(int it = 0; it < m_num_iterations && !active.empty(); it++)
         {
-            query[0][i] = feature.descriptor.at(i);
-        }
-
-        // prepare results
-        std::vector<std::vector<int> > indices;
-        std::vector<std::vector<float> > distances;
+            const int num_active = (int)active.size();
+            flann::Matrix<float> query(query_data.data(), num_active, dim);
+            flann::Matrix<int> indices(active_indices.data(), num_active, 1);
+            flann::Matrix<float> distances(active_distances.data(), num_active, 1);
 
-        for(int it = 0; it < m_num_iterations; it++)
-        {
             // INN: identification step
-            flann::SearchParams params = flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-            index.knnSearch(query, indices, distances, 1, params);
+            index.knnSearch(query, indices, distances, 1, flann_exact_match, num_threads);
 
-            // INN: estimation step
-            std::vector<float> neighbor = codewords[indices[0][0]]->getData();
-            float factor = 0;
-            for(int i = 0; i < feature.descriptor.size(); i++)
+            std::vector<char> stable(num_active, 0);
+#pragma omp parallel for num_threads(num_threads > 0 ? num_threads : omp_get_max_threads())
+            for (int a = 0; a < num_active; a++)
             {
-                factor += neighbor[i] * query[0][i];
+                const int q = active[a];
+                const int neighbor_index = indices[a][0];
+                stable[a] = it > 0 && neighbor_index == result.codewordIndices[q];
+                result.codewordIndices[q] = neighbor_index;
+                result.distances[q] = distances[a][0];
+                if (neighbor_index < 0 || stable[a])
+                {
+                    stable[a] = 1;
+                    continue;
+                }
+
+                // INN: estimation step
+                const std::vector<float> &neighbor = codewords[neighbor_index]->getData();
+                float *query_row = query[a];
+                float factor = 0;
+                for(int i = 0; i < dim; i++)
+                {
+                    factor += neighbor[i] * query_row[i];
+                }
+                // INN: update step
+                for(int i = 0; i < dim; i++)
+                {
+                    query_row[i] = query_row[i] + m_residual_weight*(query_row[i] - factor*neighbor[i]);
+                }
             }
-            // INN: update step
-            for(int i = 0; i < feature.descriptor.size(); i++)
+
+            // drop the queries whose neighbor did not change
+            int next = 0;
+            for (int a = 0; a < num_active; a++)
             {
-                query[0][i] = query[0][i] + m_residual_weight*(query[0][i] - factor*neighbor[i]);
+                if (stable[a])
+                    continue;
+                if (next != a)
+                {
+                    std::copy(query_data.begin() + (std::size_t)a * dim, query_data.begin() + (std::size_t)(a + 1) * dim,
+                              query_data.begin() + (std::size_t)next * dim);
+                    active[next] = active[a];
+                }
+                next++;
             }
+            active.resize(next);
         }
-
-        delete[] query.ptr();
-
-        // create output data
-        for (int i = 0; i < (int)indices[0].size(); i++)
-        {
-            activatedCodewords.push_back(codewords[indices[0][i]]);
-        }
-
-        return activatedCodewords;
     }
 
 protected:
@@ -17,6 +17,8 @@
 #include "../utils/utils.h"
 #include "../utils/distance.h"
 
+#include <omp.h>
+
 namespace ism3d
 {
 /**
@@ -41,7 +43,7 @@ public:
     template<typename T>
     std::vector<std::shared_ptr<Codeword> > activateKNN(const ISMFeature& feature,
                                                         const std::vector<std::shared_ptr<Codeword> >& codewords,
-                                                        const flann::Index<T> index,
+                                                        const KnnIndex<T> &index,
                                                         const bool flann_exact_match) const
     {
         std::vector<std::shared_ptr<Codeword> > activatedCodewords;
@@ -63,8 +65,7 @@ public:
         // prepare results
         std::vector<std::vector<int> > indices;
         std::vector<std::vector<float> > distances;
-        flann::SearchParams params = flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-        index.knnSearch(query, indices, distances, m_k, params);
+        index.knnSearch(query, indices, distances, m_k, flann_exact_match);
 
         delete[] query.ptr();
 
@@ -74,40 +75,61 @@ public:
             activatedCodewords.push_back(codewords[indices[0][i]]);
         }
 
-        //        // TODO VS: fix using binary descriptors with flann, look for flann::LshIndexParams
-        //        // convert query to bitset for b-shot
-        //        std::bitset<352> queryb;
-        //        queryb.reset();
-        //        for(int i = 0; i < feature.descriptor.size(); i++)
-        //        {
-        //            if(feature.descriptor.at(i) == 1.0) queryb.set(i);
-        //        }
-        //        // iterate over all features (here codewords are used instead of the flann index)
-        //        int min_dist = 999;
-        //        int min_idx = -1;
-        //        for(int c = 0; c < (int)codewords.size(); c++)
-        //        {
-        //            // convert each codeword descriptor
-        //            std::vector<float> descr = codewords.at(c)->getData();
-        //            std::bitset<352> temp;
-        //            temp.reset();
-        //            for(int i = 0; i < descr.size(); i++)
-        //            {
-        //                if(descr.at(i) == 1.0) temp.set(i);
-        //            }
-        //            // compute distance on bitset
-        //            int dist = (int)(queryb ^ temp).count();
-        //            if(dist < min_dist)
-        //            {
-        //                min_dist = dist;
-        //                min_idx = c;
-        //            }
-        //        }
-        //        activatedCodewords.push_back(codewords[min_idx]);
-
         return activatedCodewords;
     }
 
+    /**
+     * @brief Activate the k best matching codewords for a whole batch of features with a single index search.
+     * @param queries all query descriptors, one per row, stored contiguously
+     * @param codewords the codewords the flann index was built on
+     * @param index the nearest neighbor index built on the codewords
+     * @param flann_exact_match true to use exact search
+     * @param num_threads number of threads for the index search (0: use all available cores)
+     * @param result output: activated codeword indices and distances per query
+     */
+    template<typename T>
+    void activateKNNBatch(const flann::Matrix<float> &queries,
+                          const std::vector<std::shared_ptr<Codeword> >& codewords,
+                          const KnnIndex<T> &index,
+                          const bool flann_exact_match,
+                          const int num_threads,
+                          ActivationResult &result) const
+    {
+        const int num_queries = (int)queries.rows;
+        const int k = std::min(m_k, (int)codewords.size());
+
+        result.offsets.resize(num_queries + 1);
+        for (int i = 0; i <= num_queries; i++)
+            result.offsets[i] = i * k;
+        result.codewordIndices.resize(num_queries * k);
+        result.distances.resize(num_queries * k);
+
+        if (num_queries == 0 || k == 0)
+            return;
+
+        // no need to search, every codeword is activated by every query
+        if ((int)codewords.size() <= m_k)
+        {
+            T dist_func;
+#pragma omp parallel for num_threads(num_threads > 0 ? num_threads : omp_get_max_threads())
+            for (int i = 0; i < num_queries; i++)
+            {
+                for (int j = 0; j < k; j++)
+                {
+                    const std::vector<float> &data = codewords[j]->getData();
+                    result.codewordIndices[i * k + j] = j;
+                    result.distances[i * k + j] = dist_func(queries[i], data.begin(), queries.cols);
+                }
+            }
+            return;
+        }
+
+        // search directly into the result buffers
+        flann::Matrix<int> indices(result.codewordIndices.data(), num_queries, k);
+        flann::Matrix<float> distances(result.distances.data(), num_queries, k);
+        index.knnSearch(queries, indices, distances, k, flann_exact_match, num_threads);
+    }
+
 
 protected:
 
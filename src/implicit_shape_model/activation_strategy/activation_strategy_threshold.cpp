@@ -18,6 +18,7 @@ namespace ism3d
     ActivationStrategyThreshold::ActivationStrategyThreshold()
     {
         addParameter(m_threshold, "Threshold", 1.0f);
+        addParameter(m_max_neighbors, "MaxNeighbors", 0);
     }
 
     ActivationStrategyThreshold::~ActivationStrategyThreshold()
@@ -13,11 +13,17 @@
 
 #include "activation_strategy.h"
 
+#include "../utils/knn_index.h"
+
+#include <omp.h>
+#include <algorithm>
+
 namespace ism3d
 {
     /**
      * @brief The ActivationStrategyThreshold class
-     * Activates the codewords that have a matching distance to the feature below a threshold.
+     * Activates the codewords that have a matching distance to the feature below a threshold. The codebook
+     * activates all features at once with a radius search in the codeword index.
      */
     class ActivationStrategyThreshold
             : public ActivationStrategy
@@ -29,12 +35,89 @@ namespace ism3d
         static std::string getTypeStatic();
         std::string getType() const;
 
+        float getThreshold() const
+        {
+            return m_threshold;
+        }
+
+        // 0 if all codewords below the threshold are activated
+        int getMaxNeighbors() const
+        {
+            return std::max(m_max_neighbors, 0);
+        }
+
+        // true if the codewords are compared exhaustively instead of searched in the index
+        bool searchesExhaustively(int num_codewords) const
+        {
+            return m_max_neighbors > 0 && num_codewords <= m_max_neighbors;
+        }
+
+        /**
+         * @brief Activate the codewords below the distance threshold for a whole batch of features with a single
+         * radius search in the index. All codewords below the threshold are activated, unless MaxNeighbors limits
+         * them to the closest ones.
+         * @param queries all query descriptors, one per row, stored contiguously
+         * @param codewords the codewords the index was built on
+         * @param index the nearest neighbor index built on the codewords
+         * @param flann_exact_match true to use exact search
+         * @param num_threads number of threads for the index search (0: use all available cores)
+         * @param result output: activated codeword indices and distances per query
+         */
+        template<typename T>
+        void activateThresholdBatch(const flann::Matrix<float> &queries,
+                                    const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                    const KnnIndex<T> &index,
+                                    const bool flann_exact_match,
+                                    const int num_threads,
+                                    ActivationResult &result) const
+        {
+            const int num_queries = (int)queries.rows;
+            result.clear();
+            result.offsets.resize(num_queries + 1, 0);
+            if (num_queries == 0 || codewords.empty())
+                return;
+
+            std::vector<std::vector<int> > indices(num_queries);
+            std::vector<std::vector<float> > distances(num_queries);
+            if (searchesExhaustively((int)codewords.size()))
+            {
+                // small codebooks are compared exhaustively, as the activation without index
+                T dist_func;
+#pragma omp parallel for num_threads(num_threads > 0 ? num_threads : omp_get_max_threads())
+                for (int i = 0; i < num_queries; i++)
+                {
+                    for (int j = 0; j < (int)codewords.size(); j++)
+                    {
+                        const float dist = dist_func(queries[i], codewords[j]->getData().begin(), queries.cols);
+                        if (dist < m_threshold)
+                        {
+                            indices[i].push_back(j);
+                            distances[i].push_back(dist);
+                        }
+                    }
+                }
+            }
+            else
+            {
+                index.radiusSearch(queries, indices, distances, m_threshold, std::max(m_max_neighbors, 0),
+                                   flann_exact_match, num_threads);
+            }
+
+            for (int i = 0; i < num_queries; i++)
+            {
+                result.codewordIndices.insert(result.codewordIndices.end(), indices[i].begin(), indices[i].end());
+                result.distances.insert(result.distances.end(), distances[i].begin(), distances[i].end());
+                result.offsets[i + 1] = (int)result.codewordIndices.size();
+            }
+        }
+
     protected:
 
         std::vector<std::shared_ptr<Codeword> > activate(const ISMFeature& feature,
                                                            const std::vector<std::shared_ptr<Codeword> >& codewords) const;
     private:
         float m_threshold;
+        int m_max_neighbors; // maximum number of codewords activated by a feature in the index search, 0: unlimited
     };
 }
 
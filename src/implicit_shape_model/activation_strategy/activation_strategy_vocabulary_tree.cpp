@@ -0,0 +1,120 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "activation_strategy_vocabulary_tree.h"
+
+#include "../codebook/codebook.h"
+#include "../utils/distance.h"
+#include "../utils/exception.h"
+
+#include <algorithm>
+
+namespace ism3d
+{
+    ActivationStrategyVocabularyTree::ActivationStrategyVocabularyTree()
+    {
+        addParameter(m_k, "K", 1);
+        addParameter(m_branching, "Branching", 10);
+        addParameter(m_depth, "Depth", 6);
+        addParameter(m_iterations, "Iterations", 20);
+    }
+
+    ActivationStrategyVocabularyTree::~ActivationStrategyVocabularyTree()
+    {
+    }
+
+    void ActivationStrategyVocabularyTree::prepare(const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                   const Distance* distance)
+    {
+        ActivationStrategy::prepare(codewords, distance);
+
+        std::vector<int> ids(codewords.size());
+        for (int i = 0; i < (int)codewords.size(); i++)
+            ids[i] = codewords[i]->getId();
+
+        // the tree of a loaded codebook or a previous activation is reused
+        const int dim = codewords.empty() ? 0 : (int)codewords[0]->getData().size();
+        if (ids == m_codeword_ids && !m_tree.empty() && m_tree.getDim() == dim)
+            return;
+
+        std::vector<float> data((size_t)codewords.size() * dim);
+        for (int i = 0; i < (int)codewords.size(); i++)
+        {
+            const std::vector<float>& descriptor = codewords[i]->getData();
+            if ((int)descriptor.size() != dim)
+                throw RuntimeException("vocabulary tree activation requires codeword descriptors of equal length");
+            std::copy(descriptor.begin(), descriptor.end(), data.begin() + (size_t)i * dim);
+        }
+
+        m_tree.build(data.data(), codewords.size(), dim, m_branching, m_depth, m_iterations, *distance);
+        m_codeword_ids = ids;
+        LOG_INFO("built vocabulary tree with " << m_tree.getNumLeaves() << " leaves on " << codewords.size() << " codewords");
+    }
+
+    std::vector<std::shared_ptr<Codeword> > ActivationStrategyVocabularyTree::activate(const ISMFeature& feature,
+                                                       const std::vector<std::shared_ptr<Codeword> >& codewords) const
+    {
+        std::vector<float> distances;
+        return activateWithDistances(feature, codewords, distances);
+    }
+
+    std::vector<std::shared_ptr<Codeword> > ActivationStrategyVocabularyTree::activateWithDistances(const ISMFeature& feature,
+                                                       const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                       std::vector<float> &distances) const
+    {
+        std::vector<std::shared_ptr<Codeword> > activatedCodewords;
+        if (codewords.size() != m_codeword_ids.size())
+            throw RuntimeException("vocabulary tree activation was not prepared for the codewords");
+
+        // candidates are the codewords of the closest leaves
+        std::vector<int> rows;
+        m_tree.search(feature.descriptor.data(), m_k, distance(), rows);
+
+        std::vector<std::pair<float, int> > candidates;
+        candidates.reserve(rows.size());
+        for (int row : rows)
+        {
+            const std::vector<float>& data = codewords[row]->getData();
+            candidates.push_back({distance()(feature.descriptor.data(), data.data(), (int)data.size()), row});
+        }
+
+        const int k = std::min(m_k, (int)candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + k, candidates.end());
+        for (int i = 0; i < k; i++)
+        {
+            activatedCodewords.push_back(codewords[candidates[i].second]);
+            distances.push_back(candidates[i].first);
+        }
+
+        return activatedCodewords;
+    }
+
+    void ActivationStrategyVocabularyTree::iSaveData(boost::archive::binary_oarchive &oa) const
+    {
+        oa << m_codeword_ids;
+        m_tree.saveData(oa);
+    }
+
+    bool ActivationStrategyVocabularyTree::iLoadData(boost::archive::binary_iarchive &ia)
+    {
+        ia >> m_codeword_ids;
+        return m_tree.loadData(ia);
+    }
+
+    std::string ActivationStrategyVocabularyTree::getTypeStatic()
+    {
+        return "VocabularyTree";
+    }
+
+    std::string ActivationStrategyVocabularyTree::getType() const
+    {
+        return ActivationStrategyVocabularyTree::getTypeStatic();
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_ACTIVATIONSTRATEGYVOCABULARYTREE_H
+#define ISM3D_ACTIVATIONSTRATEGYVOCABULARYTREE_H
+
+#include "activation_strategy.h"
+#include "../utils/vocabulary_tree.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ActivationStrategyVocabularyTree class
+     * Activates the k best matching codewords among those in the leaves of a vocabulary tree that are closest to
+     * the feature. The tree is built on the codeword descriptors when the codewords change and is saved with the
+     * codebook. A feature descends the tree with branching * depth distance evaluations, further leaves are only
+     * visited if the first one contains less than k codewords.
+     */
+    class ActivationStrategyVocabularyTree
+            : public ActivationStrategy
+    {
+    public:
+        ActivationStrategyVocabularyTree();
+        ~ActivationStrategyVocabularyTree();
+
+        static std::string getTypeStatic();
+        std::string getType() const;
+
+        void prepare(const std::vector<std::shared_ptr<Codeword> >& codewords, const Distance* distance);
+
+    protected:
+        std::vector<std::shared_ptr<Codeword> > activate(const ISMFeature& feature,
+                                                           const std::vector<std::shared_ptr<Codeword> >& codewords) const;
+        std::vector<std::shared_ptr<Codeword> > activateWithDistances(const ISMFeature& feature,
+                                                                        const std::vector<std::shared_ptr<Codeword> >& codewords,
+                                                                        std::vector<float> &distances) const;
+
+        void iSaveData(boost::archive::binary_oarchive &oa) const;
+        bool iLoadData(boost::archive::binary_iarchive &ia);
+
+    private:
+        int m_k;
+        int m_branching;
+        int m_depth;
+        int m_iterations;
+
+        // ids of the codewords the tree was built on, the rows of the tree are indices into this list
+        std::vector<int> m_codeword_ids;
+        VocabularyTree m_tree;
+    };
+}
+
+#endif // ISM3D_ACTIVATIONSTRATEGYVOCABULARYTREE_H
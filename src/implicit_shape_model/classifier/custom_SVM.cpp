@@ -10,12 +10,20 @@
 
 
 #include "custom_SVM.h"
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <iterator>
+#include <map>
 #include <set>
+#include <omp.h>
+#include <boost/filesystem.hpp>
 #include "../utils/utils.h"
+#include "../utils/tar_archive.h"
 
 CustomSVM::CustomSVM(std::string output_file_name)
+    : m_num_features(0), m_num_threads(0), m_num_classes(0), m_has_pairwise_model(false)
 {    
     m_output_file_name = output_file_name;
 }
@@ -36,121 +44,236 @@ void CustomSVM::setData(std::vector< std::vector<float> > &training_data, std::v
     m_num_classes = unique.size();
 }
 
-int CustomSVM::prepareTrainingData(int run_id, int num_runs)
+void CustomSVM::setNumThreads(int num_threads)
+{
+    m_num_threads = num_threads;
+}
+
+int CustomSVM::getNumThreadsToUse() const
+{
+    return m_num_threads > 0 ? m_num_threads : omp_get_max_threads();
+}
+
+int CustomSVM::prepareTrainingData(bool one_vs_all)
 {
     // get dimensions
     m_num_features = m_training_data.size();
-    int dim_feature;
-    if(m_num_features > 1)
+    if(m_num_features < 2)
     {
-        dim_feature = (m_training_data.at(0)).size();
+        LOG_ERROR("No data to train SVM available - no global features?");
+        return 0;
     }
-    else
+    int dim_feature = (m_training_data.at(0)).size();
+
+    // convert to SVM format, the data is shared by all runs
+    m_train_data_mat.create(m_num_features, dim_feature, CV_32FC1);
+    for(int i = 0; i < m_num_features; i++)
     {
-        LOG_ERROR("No data to train SVM available - no global features?");
+        float *row = m_train_data_mat.ptr<float>(i);
+        for(int j = 0; j < dim_feature; j++)
+        {
+            row[j] = (m_training_data.at(i)).at(j);
+        }
     }
 
-    // determine label for training this iteration
-    int train_label = 0;
-    if(num_runs != 1) // 1 vs all training
+    m_run_labels.clear();
+    m_run_train_labels.clear();
+    if(!one_vs_all)
     {
-        int distinct_label_counter = 0;
-        int cur_label = -1;
+        cv::Mat labels_mat(m_num_features, 1, CV_32SC1);
+        for(int i = 0; i < m_num_features; i++)
+            labels_mat.at<int>(i) = m_labels.at(i);
+        m_run_labels.push_back(labels_mat);
+        m_run_train_labels.push_back(0);
+        return 1;
+    }
 
-        for(int lab : m_labels)
-        {
-            // if label changes, increment label counter
-            if(distinct_label_counter == 0 || lab != cur_label)
-            {
-                cur_label = lab;
-                distinct_label_counter++;
-            }
+    // 1 vs all training: one run for each distinct label in order of appearance
+    for(int lab : m_labels)
+    {
+        if(std::find(m_run_train_labels.begin(), m_run_train_labels.end(), lab) == m_run_train_labels.end())
+            m_run_train_labels.push_back(lab);
+    }
 
-            if(distinct_label_counter == run_id)
-            {
-                train_label = lab;
-                break;
-            }
-        }
+    for(int train_label : m_run_train_labels)
+    {
+        cv::Mat labels_mat(m_num_features, 1, CV_32SC1);
+        for(int i = 0; i < m_num_features; i++)
+            labels_mat.at<int>(i) = m_labels.at(i) == train_label ? train_label : -1;
+        m_run_labels.push_back(labels_mat);
     }
+    return (int)m_run_labels.size();
+}
 
-    // convert to SVM format
-    int labels_arr[m_num_features];
+std::vector<int> CustomSVM::assignFolds(int k_fold) const
+{
+    std::map<int, int> class_counts;
+    std::vector<int> folds(m_num_features);
     for(int i = 0; i < m_num_features; i++)
+        folds[i] = class_counts[m_labels.at(i)]++ % k_fold;
+    return folds;
+}
+
+std::vector<double> CustomSVM::getGridValues(const CvParamGrid &grid)
+{
+    // the same values as visited by OpenCV's train_auto
+    std::vector<double> values;
+    double value = grid.min_val;
+    do
     {
-        if(num_runs != 1 && m_labels.at(i) != train_label) // only do this check in 1 vs all training
-            labels_arr[i] = -1;
-        else
-            labels_arr[i] = m_labels.at(i);
+        values.push_back(value);
+        if(grid.min_val == grid.max_val || grid.step <= 1)
+            break;
+        value *= grid.step;
     }
-    cv::Mat labelsMat(m_num_features, 1, CV_32SC1, labels_arr);
+    while(value < grid.max_val);
+    return values;
+}
 
-    float training_data_arr[m_num_features][dim_feature];
-    for(int i = 0; i < m_num_features; i++)
+std::vector<float> CustomSVM::crossValidate(const std::vector<GridPoint> &grid, const cv::SVMParams &svm_params,
+                                            const std::vector<int> &folds, int k_fold) const
+{
+    // the training and test features of each fold
+    std::vector<cv::Mat> train_idx(k_fold);
+    std::vector<std::vector<int> > test_idx(k_fold);
+    for(int k = 0; k < k_fold; k++)
     {
-        for(int j = 0; j < dim_feature; j++)
+        std::vector<int> train;
+        for(int i = 0; i < m_num_features; i++)
         {
-            training_data_arr[i][j] = (float)(m_training_data.at(i)).at(j);
+            if(folds[i] == k)
+                test_idx[k].push_back(i);
+            else
+                train.push_back(i);
         }
+        train_idx[k] = cv::Mat(train, true);
     }
-    cv::Mat trainingDataMat(m_num_features, dim_feature, CV_32FC1, training_data_arr);
 
-    m_labels_mat = labelsMat.clone();
-    m_train_data_mat = trainingDataMat.clone();
+    // each fold of each grid point is trained independently
+    const int num_tasks = (int)grid.size() * k_fold;
+    std::vector<int> errors(num_tasks, 0);
 
-    return train_label;
-}
+    #pragma omp parallel for schedule(dynamic) num_threads(getNumThreadsToUse())
+    for(int task = 0; task < num_tasks; task++)
+    {
+        const GridPoint &point = grid[task / k_fold];
+        const int k = task % k_fold;
+        if(train_idx[k].empty() || test_idx[k].empty())
+            continue;
 
+        cv::SVMParams params = svm_params;
+        params.C = point.C;
+        params.gamma = point.gamma;
+        const cv::Mat &labels = m_run_labels[point.run];
 
-void CustomSVM::trainSimple(cv::SVMParams svm_params, bool one_vs_all)
-{
-    if(m_training_data.size() == 0)
-    {
-        LOG_INFO("No training data set! Training not possible!");
+        try
+        {
+            cv::SVM model;
+            model.train(m_train_data_mat, labels, cv::Mat(), train_idx[k], params);
+            for(int i : test_idx[k])
+            {
+                if(cvRound(model.predict(m_train_data_mat.row(i))) != labels.at<int>(i))
+                    errors[task]++;
+            }
+        }
+        catch(const cv::Exception &e)
+        {
+            LOG_WARN("SVM cross validation failed for C: " << point.C << ", gamma: " << point.gamma << ": " << e.what());
+            errors[task] = test_idx[k].size();
+        }
     }
 
-    int num_runs = 1; // for normal training
-    if(one_vs_all)
+    std::vector<float> grid_errors(grid.size(), 0);
+    for(int task = 0; task < num_tasks; task++)
+        grid_errors[task / k_fold] += errors[task];
+    for(float &error : grid_errors)
+        error /= m_num_features;
+    return grid_errors;
+}
+
+std::vector<CustomSVM::GridPoint> CustomSVM::selectBest(const std::vector<GridPoint> &grid, const std::vector<float> &errors) const
+{
+    std::vector<GridPoint> best(m_run_labels.size(), GridPoint{-1, 0, 0});
+    std::vector<float> best_errors(m_run_labels.size(), 0);
+    for(int i = 0; i < (int)grid.size(); i++)
     {
-        num_runs = m_num_classes; // for 1 vs all
+        const int run = grid[i].run;
+        if(best[run].run < 0 || errors[i] < best_errors[run])
+        {
+            best[run] = grid[i];
+            best_errors[run] = errors[i];
+        }
     }
+    return best;
+}
 
-    std::vector<std::string> saved_files;
+std::vector<std::string> CustomSVM::trainRuns(const std::vector<cv::SVMParams> &run_params) const
+{
+    const int num_runs = (int)run_params.size();
+    std::vector<std::string> saved_files(num_runs);
 
+    // each run trains an independent model
+    #pragma omp parallel for schedule(dynamic) num_threads(getNumThreadsToUse())
     for(int i = 0; i < num_runs; i++)
     {
         LOG_INFO("training loop " << (i+1) << " of " << num_runs);
-        clear();
-        int train_label = prepareTrainingData(i+1, num_runs);
-
-        train(m_train_data_mat, m_labels_mat, cv::Mat(), cv::Mat(), svm_params);
 
         // save trained file
         std::stringstream sstr;
-        std::string complete_name;
-        if(num_runs == 1)
-            sstr << "";
-        else
-            sstr << "_" << std::setfill('0') << std::setw(5) << std::to_string(train_label);
+        if(num_runs != 1)
+            sstr << "_" << std::setfill('0') << std::setw(5) << std::to_string(m_run_train_labels[i]);
+        saved_files[i] = m_output_file_name + sstr.str() + ".svm";
 
-        complete_name = m_output_file_name + sstr.str() + ".svm";
-        saved_files.push_back(complete_name);
-        save(complete_name.c_str());
+        try
+        {
+            cv::SVM model;
+            model.train(m_train_data_mat, m_run_labels[i], cv::Mat(), cv::Mat(), run_params[i]);
+            model.save(saved_files[i].c_str());
+        }
+        catch(const cv::Exception &e)
+        {
+            LOG_ERROR("SVM training failed for " << saved_files[i] << ": " << e.what());
+        }
     }
+    return saved_files;
+}
 
+void CustomSVM::packModels(const std::vector<std::string> &saved_files) const
+{
     // if several files were generated ...
     if(saved_files.size() > 1)
     {
         // ... put them into a .tar
-        std::stringstream sstr;
-        sstr << "tar -czf " << m_output_file_name + ".svm.tar.gz";
-        for(std::string s : saved_files)
-            sstr << " " << s;
-        int ignored = std::system(sstr.str().c_str());
+        std::string archive = m_output_file_name + ".svm.tar.gz";
+        if(!ism3d::TarArchive::pack(archive, saved_files))
+        {
+            LOG_ERROR("could not pack SVM files into " << archive << ", keeping the individual files");
+            return;
+        }
+
         // ... then delete the individual files
-        for(std::string s : saved_files)
-            ignored = std::system(("rm "+ s).c_str());
+        for(const std::string &s : saved_files)
+        {
+            boost::system::error_code error;
+            boost::filesystem::remove(s, error);
+        }
+    }
+}
+
+
+void CustomSVM::trainSimple(cv::SVMParams svm_params, bool one_vs_all)
+{
+    if(m_training_data.size() == 0)
+    {
+        LOG_INFO("No training data set! Training not possible!");
     }
+
+    int num_runs = prepareTrainingData(one_vs_all);
+    if(num_runs == 0)
+        return;
+
+    std::vector<cv::SVMParams> run_params(num_runs, svm_params);
+    packModels(trainRuns(run_params));
 }
 
 
@@ -161,127 +284,213 @@ void CustomSVM::trainAutomatically(cv::SVMParams svm_params, int k_fold, bool on
         LOG_ERROR("No training data set! Training not possible!");
     }
 
-    int num_runs = 1; // for normal training
-    if(one_vs_all)
+    int num_runs = prepareTrainingData(one_vs_all);
+    if(num_runs == 0)
+        return;
+
+    if(k_fold < 2)
     {
-        num_runs = m_num_classes; // for 1 vs all
+        LOG_WARN("invalid number of folds " << k_fold << " for SVM cross validation, using 2 folds");
+        k_fold = 2;
+    }
+    std::vector<int> folds = assignFolds(k_fold);
+
+    // set up search grid for parameter optimization
+    CvParamGrid c_grid = CvSVM::get_default_grid(CvSVM::C);
+    c_grid.min_val = 0.00001;
+    c_grid.max_val = 4096;
+    c_grid.step = 2;
+    // if using too many features increase step size
+    if(m_num_features > 1000)
+    {
+        c_grid.min_val = 0.001;
+        c_grid.max_val = 1000;
+        c_grid.step = 10;
     }
 
-    std::vector<std::string> saved_files;
+    CvParamGrid gamma_grid = CvSVM::get_default_grid(CvSVM::GAMMA);
+    gamma_grid.min_val = 0.000001;
+    gamma_grid.max_val = 8;
+    gamma_grid.step = sqrt(2);
+    // if using too many features increase step size
+    if(m_num_features > 1000)
+    {
+        gamma_grid.min_val = 0.0001;
+        gamma_grid.max_val = 10;
+        gamma_grid.step = 10;
+    }
 
-    //#pragma omp parallel for
+    // the grids of all runs are evaluated together
+    std::vector<GridPoint> grid;
     for(int i = 0; i < num_runs; i++)
     {
-        LOG_INFO("training loop " << (i+1) << " of " << num_runs);
-        clear();
-        int train_label = prepareTrainingData(i+1, num_runs);
-
-        // set up search grid for parameter optimization
-        CvParamGrid c_grid = get_default_grid(CvSVM::C);
-        c_grid.min_val = 0.00001;
-        c_grid.max_val = 4096;
-        c_grid.step = 2;
-        // if using too many features increase step size
-        if(m_num_features > 1000)
+        for(double c : getGridValues(c_grid))
         {
-            c_grid.min_val = 0.001;
-            c_grid.max_val = 1000;
-            c_grid.step = 10;
+            for(double gamma : getGridValues(gamma_grid))
+                grid.push_back(GridPoint{i, c, gamma});
         }
+    }
+    LOG_INFO("cross validating " << grid.size() << " SVM parameter sets with " << k_fold << " folds");
+    std::vector<GridPoint> best = selectBest(grid, crossValidate(grid, svm_params, folds, k_fold));
 
-        CvParamGrid gamma_grid = get_default_grid(CvSVM::GAMMA);
-        gamma_grid.min_val = 0.000001;
-        gamma_grid.max_val = 8;
-        gamma_grid.step = sqrt(2);
-        // if using too many features increase step size
-        if(m_num_features > 1000)
-        {
-            gamma_grid.min_val = 0.0001;
-            gamma_grid.max_val = 10;
-            gamma_grid.step = 10;
-        }
-
-        train_auto(m_train_data_mat, m_labels_mat, cv::Mat(), cv::Mat(), svm_params, k_fold, c_grid, gamma_grid);
-
-        cv::SVMParams best_params = get_params();
-        LOG_INFO("    SVM best params are: C: " << best_params.C << ", gamma: " << best_params.gamma);
+    // ------------ use finer grid ------------
+    LOG_INFO("auto-training SVM with finer grid");
 
-        // ------------ use finer grid ------------
-        LOG_INFO("auto-training SVM with finer grid");
+    std::vector<GridPoint> fine_grid;
+    for(int i = 0; i < num_runs; i++)
+    {
+        LOG_INFO("    SVM " << (i+1) << " best params are: C: " << best[i].C << ", gamma: " << best[i].gamma);
 
-        c_grid.min_val = best_params.C / (c_grid.step * c_grid.step);
-        if(c_grid.min_val < 0.00001)
+        CvParamGrid c_fine = c_grid;
+        c_fine.min_val = best[i].C / (c_grid.step * c_grid.step);
+        if(c_fine.min_val < 0.00001)
         {
-            LOG_INFO("    c grid min too small: " << c_grid.min_val);
-            c_grid.min_val = 0.00001;
+            LOG_INFO("    c grid min too small: " << c_fine.min_val);
+            c_fine.min_val = 0.00001;
         }
-        c_grid.max_val = best_params.C * (c_grid.step * c_grid.step);
-        c_grid.step = sqrt(c_grid.step);
+        c_fine.max_val = best[i].C * (c_grid.step * c_grid.step);
+        c_fine.step = sqrt(c_grid.step);
 
-        gamma_grid.min_val = best_params.gamma / (gamma_grid.step * gamma_grid.step);
-        if(gamma_grid.min_val < 0.0001)
+        CvParamGrid gamma_fine = gamma_grid;
+        gamma_fine.min_val = best[i].gamma / (gamma_grid.step * gamma_grid.step);
+        if(gamma_fine.min_val < 0.0001)
         {
-            LOG_INFO("    gamma grid min too small: " << gamma_grid.min_val);
-            gamma_grid.min_val = 0.0001;
+            LOG_INFO("    gamma grid min too small: " << gamma_fine.min_val);
+            gamma_fine.min_val = 0.0001;
         }
-        gamma_grid.max_val = best_params.gamma * (gamma_grid.step * gamma_grid.step);
-        gamma_grid.step = sqrt(gamma_grid.step);
+        gamma_fine.max_val = best[i].gamma * (gamma_grid.step * gamma_grid.step);
+        gamma_fine.step = sqrt(gamma_grid.step);
 
-        LOG_INFO("    C grid (min/max/step): " << c_grid.min_val << " " << c_grid.max_val << " " << c_grid.step);
-        LOG_INFO("    Gamma grid (min/max/step): " << gamma_grid.min_val << " " << gamma_grid.max_val << " " << gamma_grid.step);
+        LOG_INFO("    C grid (min/max/step): " << c_fine.min_val << " " << c_fine.max_val << " " << c_fine.step);
+        LOG_INFO("    Gamma grid (min/max/step): " << gamma_fine.min_val << " " << gamma_fine.max_val << " " << gamma_fine.step);
 
         // only refine grid with valid parameters
-        if(c_grid.min_val < c_grid.max_val && gamma_grid.min_val < gamma_grid.max_val)
+        if(c_fine.min_val < c_fine.max_val && gamma_fine.min_val < gamma_fine.max_val)
         {
-            train_auto(m_train_data_mat, m_labels_mat, cv::Mat(), cv::Mat(), svm_params, k_fold, c_grid, gamma_grid);
-
-            best_params = get_params();
-            LOG_INFO("    SVM best params after fine grid are: C: " << best_params.C << ", gamma: " << best_params.gamma);
+            for(double c : getGridValues(c_fine))
+            {
+                for(double gamma : getGridValues(gamma_fine))
+                    fine_grid.push_back(GridPoint{i, c, gamma});
+            }
         }
         else
         {
             LOG_INFO("    skipping grid refinement ...");
         }
+    }
 
-        // save trained file
-        std::stringstream sstr;
-        std::string complete_name;
-        if(num_runs == 1)
-            sstr << "";
-        else
-            sstr << "_" << std::setfill('0') << std::setw(5) << std::to_string(train_label);
+    if(!fine_grid.empty())
+    {
+        std::vector<GridPoint> best_fine = selectBest(fine_grid, crossValidate(fine_grid, svm_params, folds, k_fold));
+        for(int i = 0; i < num_runs; i++)
+        {
+            if(best_fine[i].run < 0)
+                continue;
+            best[i] = best_fine[i];
+            LOG_INFO("    SVM " << (i+1) << " best params after fine grid are: C: " << best[i].C << ", gamma: " << best[i].gamma);
+        }
+    }
+
+    std::vector<cv::SVMParams> run_params(num_runs, svm_params);
+    for(int i = 0; i < num_runs; i++)
+    {
+        run_params[i].C = best[i].C;
+        run_params[i].gamma = best[i].gamma;
+    }
+    packModels(trainRuns(run_params));
+}
 
-        complete_name = m_output_file_name+sstr.str()+".svm";
-        //#pragma omp critical
+bool CustomSVM::readModel(cv::SVM &svm, const std::string &contents, const std::string &name)
+{
+    try
+    {
+        cv::FileStorage storage(contents, cv::FileStorage::READ | cv::FileStorage::MEMORY);
+        cv::FileNode node = storage.getFirstTopLevelNode();
+        if(node.empty())
         {
-            saved_files.push_back(complete_name);
+            LOG_ERROR("no SVM model in " << name);
+            return false;
         }
-        save(complete_name.c_str());
+        svm.read(*storage, *node);
+    }
+    catch(const cv::Exception &e)
+    {
+        LOG_ERROR("could not read SVM model " << name << ": " << e.what());
+        return false;
     }
+    return true;
+}
 
-    // if several files were generated ...
-    if(saved_files.size() > 1)
+bool CustomSVM::loadModels(const std::string &svm_file, bool one_vs_all, const std::set<unsigned> &class_ids)
+{
+    clear();
+    m_has_pairwise_model = false;
+    m_one_vs_all_models.clear();
+
+    if(!one_vs_all)
     {
-        // ... put them into a .tar
-        std::stringstream sstr;
-        sstr << "tar -czf " << m_output_file_name + ".svm.tar.gz";
-        for(std::string s : saved_files)
-            sstr << " " << s;
-        int ignored = std::system(sstr.str().c_str());
-        // ... then delete the individual files
-        for(std::string s : saved_files)
-            ignored = std::system(("rm "+ s).c_str());
+        std::ifstream in(svm_file.c_str(), std::ios::binary);
+        std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if(!in.good() && !in.eof())
+        {
+            LOG_ERROR("could not read SVM file " << svm_file);
+            return false;
+        }
+        m_has_pairwise_model = readModel(*this, contents, svm_file);
+        return m_has_pairwise_model;
     }
+
+    // the 1 vs all models are read from the archive without unpacking it
+    std::vector<std::pair<std::string, std::vector<char> > > entries;
+    if(!ism3d::TarArchive::read(svm_file, entries))
+        return false;
+
+    for(const std::pair<std::string, std::vector<char> > &entry : entries)
+    {
+        // the label is the number between the last '_' and the extension of the file name
+        const std::string &name = entry.first;
+        std::size_t start = name.find_last_of('_');
+        if(start == std::string::npos)
+        {
+            LOG_ERROR("no label in SVM file name " << name);
+            return false;
+        }
+
+        OneVsAllModel model;
+        model.label = std::atoi(name.substr(start + 1).c_str());
+        if(!class_ids.empty() && !class_ids.count(model.label))
+            continue;
+        model.svm = std::make_shared<cv::SVM>();
+        if(!readModel(*model.svm, std::string(entry.second.begin(), entry.second.end()), name))
+            return false;
+        m_one_vs_all_models.push_back(model);
+    }
+    return !m_one_vs_all_models.empty();
+}
+
+bool CustomSVM::hasModels() const
+{
+    return m_has_pairwise_model || !m_one_vs_all_models.empty();
 }
 
-CustomSVM::SVMResponse CustomSVM::predictUnifyScore(cv::Mat test_data, std::vector<std::string> &svm_files)
+std::size_t CustomSVM::getSupportVectorBytes() const
+{
+    std::size_t bytes = 0;
+    if(m_has_pairwise_model)
+        bytes += (std::size_t)get_support_vector_count() * get_var_count() * sizeof(float);
+    for(const OneVsAllModel &model : m_one_vs_all_models)
+        bytes += (std::size_t)model.svm->get_support_vector_count() * model.svm->get_var_count() * sizeof(float);
+    return bytes;
+}
+
+CustomSVM::SVMResponse CustomSVM::predictUnifyScore(const cv::Mat &test_data) const
 {
     CustomSVM::SVMResponse response;
 
-    if(svm_files.size() > 1)
+    if(!m_one_vs_all_models.empty())
     {
         // OpenCV multiple SVMs to simulate an 1 vs all SVM
-        response = predictWithScore(test_data, svm_files); // the lower the score, the better
+        response = predictWithScoreOneVsAll(test_data); // the lower the score, the better
 
         // switch sign and normalize to [0|1] to make score compatible with other score
         for(float &sc : response.all_scores)
@@ -290,64 +499,72 @@ CustomSVM::SVMResponse CustomSVM::predictUnifyScore(cv::Mat test_data, std::vect
         }
         response.score = response.all_scores[response.label];
     }
-    else if(svm_files.size() == 1)
+    else if(m_has_pairwise_model)
     {
         // OpenCV SVM with additional score
-        response = predictWithScore(test_data, svm_files[0]);
+        response = predictWithScore(test_data);
     }
     else
-        LOG_ERROR("no svm files provided for SVM classification!");
+        LOG_ERROR("no svm models loaded for SVM classification!");
 
     return response;
 }
 
+std::vector<CustomSVM::SVMResponse> CustomSVM::predictUnifyScoreBatch(const cv::Mat &samples) const
+{
+    std::vector<CustomSVM::SVMResponse> responses(samples.rows);
+    if(m_one_vs_all_models.empty() && !m_has_pairwise_model)
+    {
+        LOG_ERROR("no svm models loaded for SVM classification!");
+        return responses;
+    }
+
+    // a row is a header to the sample, it is not copied
+    #pragma omp parallel for schedule(dynamic) num_threads(getNumThreadsToUse())
+    for(int i = 0; i < samples.rows; i++)
+        responses[i] = predictUnifyScore(samples.row(i));
+    return responses;
+}
+
 
 
 // NOTE: see https://github.com/opencv/opencv/blob/master/modules/ml/src/svm.cpp
-CustomSVM::SVMResponse CustomSVM::predictWithScore(cv::Mat test_data, std::vector<std::string> &svm_files)
+CustomSVM::SVMResponse CustomSVM::predictWithScoreOneVsAll(const cv::Mat &test_data) const
 {
     // call each 2 class svm
-    m_num_classes = svm_files.size();
     std::pair<int, float> best_result = {-1, 1};
-    m_scores.resize(m_num_classes);
-    for(std::string svm_string : svm_files)
+    // the scores are indexed by label, only the models of some classes may be loaded
+    int max_label = 0;
+    for(const OneVsAllModel &model : m_one_vs_all_models)
+        max_label = std::max(max_label, model.label);
+    std::vector<float> scores(max_label + 1, 0);
+    for(const OneVsAllModel &model : m_one_vs_all_models)
     {
         // predict result
-        clear();
-        load(svm_string.c_str());
-        float score = predict(test_data, true);
-        // get label
-        int start = svm_string.find_last_of('_');
-        int end = svm_string.find_last_of('.');
-        std::string label_string = svm_string.substr(start+1, end);
-        int label = std::atoi(label_string.c_str());
+        float score = model.svm->predict(test_data, true);
         // store result
         if(score < best_result.second) // the smaller the score, the better; positive score means: object not recognized
         {
-            best_result = {label, score};
+            best_result = {model.label, score};
         }
-        m_scores.at(label) = score;
+        scores.at(model.label) = score;
     }
 
     // create result object
     CustomSVM::SVMResponse svm_response;
     svm_response.label = best_result.first;
     svm_response.score = best_result.second;
-    svm_response.all_scores = m_scores;
+    svm_response.all_scores = scores;
     return svm_response;
 }
 
 
 // NOTE: see https://github.com/opencv/opencv/blob/master/modules/ml/src/svm.cpp
-CustomSVM::SVMResponse CustomSVM::predictWithScore(cv::Mat test_data, std::string &svm_file)
+CustomSVM::SVMResponse CustomSVM::predictWithScore(const cv::Mat &test_data) const
 {
-    // load svm
-    clear();
-    load(svm_file.c_str());
-
     // get important parameters
     int feature_dim = test_data.cols; // size of descriptor
-    m_num_classes = class_labels->cols;
+    int num_classes = class_labels->cols;
     int num_sv = get_support_vector_count();
     float gamma = -params.gamma;
 
@@ -368,13 +585,13 @@ CustomSVM::SVMResponse CustomSVM::predictWithScore(cv::Mat test_data, std::strin
     }
 
     // calc votes and distances
-    std::vector<int> class_votes(m_num_classes, 0);
-    m_sums_of_sigmoids = std::vector<float>(m_num_classes, 0);
+    std::vector<int> class_votes(num_classes, 0);
+    std::vector<float> sums_of_sigmoids(num_classes, 0);
 
     int dfi = 0;
-    for(int i = 0; i < m_num_classes; i++)
+    for(int i = 0; i < num_classes; i++)
     {
-        for(int j = i+1; j < m_num_classes; j++, dfi++)
+        for(int j = i+1; j < num_classes; j++, dfi++)
         {
             const CvSVMDecisionFunc df = decision_func[dfi];
             double sum = -df.rho;
@@ -395,68 +612,38 @@ CustomSVM::SVMResponse CustomSVM::predictWithScore(cv::Mat test_data, std::strin
                 class_votes.at(j)++;
 
             // store confidence for classes
-            m_sums_of_sigmoids.at(i) += sigmoid(sum);
-            m_sums_of_sigmoids.at(j) += sigmoid(-sum);
+            sums_of_sigmoids.at(i) += sigmoid(sum);
+            sums_of_sigmoids.at(j) += sigmoid(-sum);
         }
     }
 
     // find class index with most votes
     int k = 0;
-    std::vector<int> same_votes_idx; // holds all indices with the same (highest) number of votes
-    for(int i = 0; i < m_num_classes; i++)
+    for(int i = 0; i < num_classes; i++)
     {
         if(class_votes.at(i) > class_votes.at(k))
-        {
             k = i;
-            same_votes_idx.clear();
-            same_votes_idx.push_back(i);
-        }
-        else if(class_votes.at(i) == class_votes.at(k))
-        {
-            same_votes_idx.push_back(i);
-        }
     }
 
     // finally the result (this is the result of the standard OpenCV SVM)
     cv::Mat labels(class_labels);
     int result_label_std_svm = labels.at<int>(k);
 
+    // the score of each class is its average sigmoid
+    std::vector<float> scores;
+    for(float sum : sums_of_sigmoids)
+        scores.push_back(sum / ((float)num_classes - 1.0f));
+
     // create result object
     CustomSVM::SVMResponse svm_response;
-    computeScores();
     svm_response.label = result_label_std_svm;
-    svm_response.score = getScore(result_label_std_svm);  // the higher the score, the better
-    svm_response.all_scores = m_scores;
+    svm_response.score = result_label_std_svm >= 0 && result_label_std_svm < (int)scores.size() ?
+                scores.at(result_label_std_svm) : 0;  // the higher the score, the better
+    svm_response.all_scores = scores;
 
     return svm_response;
 }
 
-void CustomSVM::computeScores()
-{
-    m_scores.clear();
-
-    for(int i = 0; i < m_sums_of_sigmoids.size(); i++)
-    {
-        float avg_of_sigm = m_sums_of_sigmoids.at(i) / ((float)m_num_classes - 1.0f);
-        m_scores.push_back(avg_of_sigm);
-    }
-}
-
-float CustomSVM::getScore(int class_id)
-{
-    if(m_scores.size() == 0)
-    {
-        LOG_ERROR("before calling the function \"getScore\" you must call the function \"predictWithDistance\"!");
-        return 0;
-    }
-    if(class_id == -1)
-    {
-        LOG_ERROR("invalid class id " << class_id);
-        return 9999;
-    }
-    return m_scores.at(class_id);
-}
-
 float CustomSVM::sigmoid(float x)
 {
     return 1.0 / (1.0 + std::exp(-x));
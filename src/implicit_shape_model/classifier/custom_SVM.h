@@ -11,6 +11,8 @@
 #ifndef CUSTOM_SVM_H
 #define CUSTOM_SVM_H
 
+#include <memory>
+#include <set>
 #include <opencv2/ml/ml.hpp>
 
 class CustomSVM : public cv::SVM
@@ -30,33 +32,82 @@ public:
 
     void setData(std::vector< std::vector<float> > &training_data, std::vector<int> &labels);
 
+    // the number of threads for training, 0 uses the OpenMP default
+    void setNumThreads(int num_threads);
+
     void trainSimple(cv::SVMParams svm_params, bool one_vs_all);
     void trainAutomatically(cv::SVMParams svm_params, int k_fold, bool one_vs_all);
 
-    SVMResponse predictUnifyScore(cv::Mat test_data, std::vector<std::string> &svm_files);
-    SVMResponse predictWithScore(cv::Mat test_data, std::vector<std::string> &svm_files); // 1 vs all SVM (simulated by multiple 2 class SVMs)
-    SVMResponse predictWithScore(cv::Mat test_data, std::string &svm_file); // pairwise 1 vs 1 SVM
+    // loads the trained models once, either a single pairwise 1 vs 1 SVM or an archive of 1 vs all SVMs that is read
+    // in memory; the models stay resident and the prediction is const and can be called from several threads; with
+    // class ids only the 1 vs all SVMs of these classes are loaded, a pairwise SVM is always loaded completely
+    bool loadModels(const std::string &svm_file, bool one_vs_all, const std::set<unsigned> &class_ids = std::set<unsigned>());
+    bool hasModels() const;
+    std::size_t getSupportVectorBytes() const;
+
+    SVMResponse predictUnifyScore(const cv::Mat &test_data) const;
+    // predicts each row of the samples as with predictUnifyScore(), the rows are predicted in parallel
+    std::vector<SVMResponse> predictUnifyScoreBatch(const cv::Mat &samples) const;
+    SVMResponse predictWithScoreOneVsAll(const cv::Mat &test_data) const; // 1 vs all SVM (simulated by multiple 2 class SVMs)
+    SVMResponse predictWithScore(const cv::Mat &test_data) const; // pairwise 1 vs 1 SVM
 
 private:
 
     // training
-    int prepareTrainingData(int run_id, int num_runs);
+    struct GridPoint
+    {
+        int run;
+        double C;
+        double gamma;
+    };
+
+    // prepares the training data and the labels of each run, returns the number of runs
+    int prepareTrainingData(bool one_vs_all);
+
+    // assigns each training feature to one of k folds, the features of each class are spread over all folds
+    std::vector<int> assignFolds(int k_fold) const;
+
+    // the k-fold cross validation error of each grid point, all grid points are evaluated in parallel
+    std::vector<float> crossValidate(const std::vector<GridPoint> &grid, const cv::SVMParams &svm_params,
+                                     const std::vector<int> &folds, int k_fold) const;
+
+    // the grid point with the lowest error for each run, the first one in grid order if several have the same error
+    std::vector<GridPoint> selectBest(const std::vector<GridPoint> &grid, const std::vector<float> &errors) const;
+
+    // trains the model of each run in parallel and saves it, returns the file names of the models
+    std::vector<std::string> trainRuns(const std::vector<cv::SVMParams> &run_params) const;
+
+    // packs multiple model files into one archive
+    void packModels(const std::vector<std::string> &saved_files) const;
+
+    static std::vector<double> getGridValues(const CvParamGrid &grid);
+
+    int getNumThreadsToUse() const;
 
     std::vector< std::vector<float> > m_training_data;
     std::vector<int> m_labels;
-    cv::Mat m_labels_mat;
     cv::Mat m_train_data_mat;
+    std::vector<cv::Mat> m_run_labels;
+    std::vector<int> m_run_train_labels;
     int m_num_features;
+    int m_num_threads;
     std::string m_output_file_name;
 
     // prediction
-    float getScore(int class_id);
-    float sigmoid(float x);
-    void computeScores();
+    struct OneVsAllModel
+    {
+        int label;
+        std::shared_ptr<cv::SVM> svm;
+    };
+
+    // reads a model saved by cv::SVM::save() from its contents
+    static bool readModel(cv::SVM &svm, const std::string &contents, const std::string &name);
+
+    static float sigmoid(float x);
 
     int m_num_classes;
-    std::vector<float> m_sums_of_sigmoids;
-    std::vector<float> m_scores;
+    bool m_has_pairwise_model;
+    std::vector<OneVsAllModel> m_one_vs_all_models;
 };
 
 #endif // CUSTOM_SVM_H
@@ -0,0 +1,159 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "random_feature_svm.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <omp.h>
+
+#include "../utils/utils.h"
+
+RandomFeatureSVM::RandomFeatureSVM(const Params &params)
+    : m_params(params), m_max_label(-1)
+{
+    m_params.numFeatures = std::max(m_params.numFeatures, 1);
+    m_params.epochs = std::max(m_params.epochs, 1);
+}
+
+bool RandomFeatureSVM::train(const std::vector<std::vector<float> > &samples, const std::vector<int> &labels)
+{
+    m_labels.clear();
+    m_max_label = -1;
+    if(samples.empty() || samples.size() != labels.size())
+        return false;
+
+    const int num_samples = (int)samples.size();
+    const int dim = (int)samples[0].size();
+    RowMatrix descriptors(num_samples, dim);
+    for(int i = 0; i < num_samples; i++)
+    {
+        if((int)samples[i].size() != dim)
+        {
+            LOG_ERROR("the descriptors for the linear SVM differ in length");
+            return false;
+        }
+        descriptors.row(i) = Eigen::Map<const Eigen::RowVectorXf>(samples[i].data(), dim);
+    }
+
+    // the Fourier transform of exp(-gamma * |d|^2) is a normal distribution with variance 2 * gamma
+    std::mt19937 random(m_params.seed);
+    std::normal_distribution<float> frequency(0.0f, std::sqrt(2.0f * m_params.gamma));
+    std::uniform_real_distribution<float> phase(0.0f, 2.0f * (float)M_PI);
+    m_frequencies.resize(dim, m_params.numFeatures);
+    for(int j = 0; j < m_params.numFeatures; j++)
+        for(int i = 0; i < dim; i++)
+            m_frequencies(i, j) = frequency(random);
+    m_phases.resize(m_params.numFeatures);
+    for(int j = 0; j < m_params.numFeatures; j++)
+        m_phases[j] = phase(random);
+
+    const RowMatrix features = mapFeatures(descriptors);
+    const Eigen::VectorXf norms = features.rowwise().squaredNorm();
+
+    m_labels = labels;
+    std::sort(m_labels.begin(), m_labels.end());
+    m_labels.erase(std::unique(m_labels.begin(), m_labels.end()), m_labels.end());
+    m_max_label = m_labels.back();
+    m_weights = Eigen::MatrixXf::Zero(features.cols(), m_labels.size());
+
+    // dual coordinate descent for the L1 loss SVM (Hsieh et al. 2008), one label against all others
+#pragma omp parallel for schedule(dynamic)
+    for(int l = 0; l < (int)m_labels.size(); l++)
+    {
+        Eigen::VectorXf w = Eigen::VectorXf::Zero(features.cols());
+        std::vector<float> alpha(num_samples, 0.0f);
+        std::vector<int> order(num_samples);
+        std::iota(order.begin(), order.end(), 0);
+        std::mt19937 shuffle(m_params.seed + l);
+
+        for(int epoch = 0; epoch < m_params.epochs; epoch++)
+        {
+            std::shuffle(order.begin(), order.end(), shuffle);
+            for(int i : order)
+            {
+                if(norms[i] <= 0)
+                    continue;
+                const float y = labels[i] == m_labels[l] ? 1.0f : -1.0f;
+                const float gradient = y * features.row(i).dot(w) - 1.0f;
+                const float updated = std::min(std::max(alpha[i] - gradient / norms[i], 0.0f), m_params.c);
+                if(updated != alpha[i])
+                {
+                    w += ((updated - alpha[i]) * y) * features.row(i).transpose();
+                    alpha[i] = updated;
+                }
+            }
+        }
+        m_weights.col(l) = w;
+    }
+
+    LOG_INFO("trained linear SVMs for " << m_labels.size() << " classes on " << num_samples << " global features with "
+             << m_params.numFeatures << " random features");
+    return true;
+}
+
+bool RandomFeatureSVM::isTrained() const
+{
+    return !m_labels.empty();
+}
+
+std::vector<CustomSVM::SVMResponse> RandomFeatureSVM::predict(const cv::Mat &samples) const
+{
+    std::vector<CustomSVM::SVMResponse> responses(samples.rows);
+    if(!isTrained() || samples.rows == 0)
+        return responses;
+    if(samples.cols != m_frequencies.rows() || samples.type() != CV_32FC1 || !samples.isContinuous())
+    {
+        LOG_ERROR("the descriptors do not match the linear SVM");
+        return responses;
+    }
+
+    // one product for all samples and all classes
+    const Eigen::Map<const RowMatrix> descriptors(samples.ptr<float>(0), samples.rows, samples.cols);
+    const RowMatrix decisions = mapFeatures(descriptors) * m_weights;
+
+    for(int i = 0; i < samples.rows; i++)
+    {
+        // as in CustomSVM, a decision value of 1 on the margin of the class maps to 1, -1 to 0
+        CustomSVM::SVMResponse &response = responses[i];
+        response.all_scores.assign(m_max_label + 1, 0.0f);
+        response.label = -1;
+        response.score = 0;
+        for(int l = 0; l < (int)m_labels.size(); l++)
+        {
+            const float score = (decisions(i, l) + 1.0f) * 0.5f;
+            response.all_scores[m_labels[l]] = score;
+            if(response.label < 0 || score > response.score)
+            {
+                response.label = m_labels[l];
+                response.score = score;
+            }
+        }
+    }
+    return responses;
+}
+
+std::size_t RandomFeatureSVM::getBytes() const
+{
+    return (m_frequencies.size() + m_phases.size() + m_weights.size()) * sizeof(float);
+}
+
+RandomFeatureSVM::RowMatrix RandomFeatureSVM::mapFeatures(const Eigen::Ref<const RowMatrix> &descriptors) const
+{
+    const float scale = std::sqrt(2.0f / m_params.numFeatures);
+    RowMatrix features(descriptors.rows(), m_params.numFeatures + 1);
+    features.leftCols(m_params.numFeatures).noalias() = descriptors * m_frequencies;
+    features.leftCols(m_params.numFeatures).rowwise() += m_phases;
+    features.leftCols(m_params.numFeatures) = features.leftCols(m_params.numFeatures).array().cos() * scale;
+    features.col(m_params.numFeatures).setOnes();
+    return features;
+}
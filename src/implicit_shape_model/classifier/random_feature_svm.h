@@ -0,0 +1,77 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef RANDOM_FEATURE_SVM_H
+#define RANDOM_FEATURE_SVM_H
+
+#include <cstddef>
+#include <vector>
+#include <Eigen/Core>
+
+#include "custom_SVM.h"
+
+/**
+ * @brief The RandomFeatureSVM class
+ * One vs all linear SVMs over random Fourier features that approximate the RBF kernel of CustomSVM. A descriptor is
+ * mapped to numFeatures features cos(w * x + b), with the frequencies w drawn from the Fourier transform of the
+ * kernel exp(-gamma * |x - y|^2), so that the dot product of two mapped descriptors approximates the kernel. The
+ * prediction of all classes and all descriptors is then a single dense matrix product, independent of the number
+ * of training samples, instead of a kernel evaluation per support vector and class.
+ */
+class RandomFeatureSVM
+{
+public:
+    struct Params
+    {
+        Params() : numFeatures(1024), gamma(2.96f), c(7.41f), epochs(20), seed(0) {}
+
+        int numFeatures;    // number of random Fourier features
+        float gamma;        // of the approximated RBF kernel
+        float c;            // soft margin parameter of the linear SVMs
+        int epochs;         // passes of the dual coordinate descent over the training samples
+        unsigned seed;      // of the random frequencies, a fixed seed yields the same classifier for the same data
+    };
+
+    explicit RandomFeatureSVM(const Params &params = Params());
+
+    /**
+     * @brief Train a linear SVM per label, the labels are trained in parallel.
+     * @param samples the descriptors, all of equal length
+     * @param labels the label of each descriptor
+     * @return false if there are no samples or the descriptor lengths differ
+     */
+    bool train(const std::vector<std::vector<float> > &samples, const std::vector<int> &labels);
+
+    bool isTrained() const;
+
+    /**
+     * @brief Predict each row of the samples, the scores are compatible with CustomSVM::predictUnifyScore() of a one
+     * vs all SVM: all_scores is indexed by label and maps the decision value to [0, 1] around 0.5.
+     * @param samples one descriptor per row, CV_32FC1
+     */
+    std::vector<CustomSVM::SVMResponse> predict(const cv::Mat &samples) const;
+
+    std::size_t getBytes() const;
+
+private:
+    typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+
+    // maps the descriptors in the rows to their random features and a constant 1 for the bias
+    RowMatrix mapFeatures(const Eigen::Ref<const RowMatrix> &descriptors) const;
+
+    Params m_params;
+    Eigen::MatrixXf m_frequencies;  // dimension x numFeatures
+    Eigen::RowVectorXf m_phases;    // numFeatures
+    Eigen::MatrixXf m_weights;      // numFeatures + 1 x labels, the last row is the bias
+    std::vector<int> m_labels;      // the label of each column of the weights
+    int m_max_label;
+};
+
+#endif // RANDOM_FEATURE_SVM_H
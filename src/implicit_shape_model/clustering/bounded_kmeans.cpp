@@ -0,0 +1,224 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "bounded_kmeans.h"
+#include "../utils/utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <omp.h>
+
+namespace ism3d
+{
+    BoundedKMeans::BoundedKMeans(int maxIterations, flann::flann_centers_init_t centersInit, unsigned seed)
+        : m_max_iterations(maxIterations), m_centers_init(centersInit), m_seed(seed)
+    {
+    }
+
+    float BoundedKMeans::distance(const float *a, const float *b, int dim) const
+    {
+        // the bounds need a metric, the kernel returns the squared distance
+        return std::sqrt(std::max(m_dist(a, b, dim), 0.0f));
+    }
+
+    void BoundedKMeans::findClosest(const float *descriptor, const std::vector<float> &centers, int k, int dim,
+                                    int &closest, float &closestDist, float &secondDist) const
+    {
+        closest = 0;
+        closestDist = std::numeric_limits<float>::max();
+        secondDist = std::numeric_limits<float>::max();
+        for (int c = 0; c < k; c++) {
+            float dist = distance(descriptor, centers.data() + (size_t)c * dim, dim);
+            if (dist < closestDist) {
+                secondDist = closestDist;
+                closestDist = dist;
+                closest = c;
+            }
+            else if (dist < secondDist) {
+                secondDist = dist;
+            }
+        }
+    }
+
+    void BoundedKMeans::seedCenters(const FeatureBlock &block, int k, std::vector<float> &centers) const
+    {
+        const int numFeatures = block.size();
+        const int dim = block.dim();
+        std::mt19937 rng(m_seed);
+        std::vector<int> seeds;
+
+        if (m_centers_init == flann::FLANN_CENTERS_RANDOM) {
+            // distinct random features
+            std::vector<int> order(numFeatures);
+            for (int i = 0; i < numFeatures; i++)
+                order[i] = i;
+            for (int i = 0; i < k; i++) {
+                std::uniform_int_distribution<int> pick(i, numFeatures - 1);
+                std::swap(order[i], order[pick(rng)]);
+            }
+            seeds.assign(order.begin(), order.begin() + k);
+        }
+        else {
+            // k-means++ draws the next center proportional to the squared distance to the closest center, gonzales
+            // takes the farthest feature
+            std::vector<float> minDists(numFeatures, std::numeric_limits<float>::max());
+            seeds.push_back(std::uniform_int_distribution<int>(0, numFeatures - 1)(rng));
+            while ((int)seeds.size() < k) {
+                const float *last = block.descriptor(seeds.back());
+                double sum = 0;
+                #pragma omp parallel for reduction(+:sum) schedule(static)
+                for (int i = 0; i < numFeatures; i++) {
+                    minDists[i] = std::min(minDists[i], m_dist(block.descriptor(i), last, dim));
+                    sum += minDists[i];
+                }
+
+                int next = -1;
+                if (m_centers_init == flann::FLANN_CENTERS_KMEANSPP && sum > 0) {
+                    double threshold = std::uniform_real_distribution<double>(0, sum)(rng);
+                    for (int i = 0; i < numFeatures && next < 0; i++) {
+                        threshold -= minDists[i];
+                        if (threshold <= 0 && minDists[i] > 0)
+                            next = i;
+                    }
+                }
+                if (next < 0)
+                    next = std::max_element(minDists.begin(), minDists.end()) - minDists.begin();
+                seeds.push_back(next);
+            }
+        }
+
+        centers.resize((size_t)k * dim);
+        for (int c = 0; c < k; c++)
+            std::copy(block.descriptor(seeds[c]), block.descriptor(seeds[c]) + dim, centers.begin() + (size_t)c * dim);
+    }
+
+    void BoundedKMeans::cluster(const FeatureBlock &block, int k, std::vector<float> &centers, std::vector<int> &indices)
+    {
+        const int numFeatures = block.size();
+        const int dim = block.dim();
+        k = std::min(k, numFeatures);
+        centers.clear();
+        indices.assign(numFeatures, 0);
+        if (k <= 0)
+            return;
+
+        m_dist.setDimension(dim);
+        seedCenters(block, k, centers);
+
+        // initial assignment with all distances, upper bound to the own center, lower bound to all others
+        std::vector<float> upper(numFeatures);
+        std::vector<float> lower(numFeatures);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < numFeatures; i++)
+            findClosest(block.descriptor(i), centers, k, dim, indices[i], upper[i], lower[i]);
+        long long numDistances = (long long)numFeatures * k;
+
+        // the sums of the clusters are updated with the features that changed their cluster
+        std::vector<double> sums((size_t)k * dim, 0);
+        std::vector<int> counts(k, 0);
+        for (int i = 0; i < numFeatures; i++) {
+            const float *descriptor = block.descriptor(i);
+            double *sum = sums.data() + (size_t)indices[i] * dim;
+            for (int j = 0; j < dim; j++)
+                sum[j] += descriptor[j];
+            counts[indices[i]]++;
+        }
+
+        std::vector<float> previousCenters;
+        std::vector<float> moved(k);
+        std::vector<float> separation(k);
+        std::vector<int> assigned(numFeatures);
+        int iteration = 0;
+        for (; iteration < m_max_iterations; iteration++) {
+            // move the centers to the means of their clusters, an empty cluster keeps its center
+            previousCenters = centers;
+            for (int c = 0; c < k; c++) {
+                if (counts[c] == 0)
+                    continue;
+                for (int j = 0; j < dim; j++)
+                    centers[(size_t)c * dim + j] = sums[(size_t)c * dim + j] / counts[c];
+            }
+
+            // the bounds follow the movement of the centers
+            int farthest = 0;
+            for (int c = 0; c < k; c++) {
+                moved[c] = distance(previousCenters.data() + (size_t)c * dim, centers.data() + (size_t)c * dim, dim);
+                if (moved[c] > moved[farthest])
+                    farthest = c;
+            }
+            float secondMoved = 0;
+            for (int c = 0; c < k; c++) {
+                if (c != farthest)
+                    secondMoved = std::max(secondMoved, moved[c]);
+            }
+
+            // half the distance of each center to its closest other center
+            #pragma omp parallel for schedule(dynamic, 16)
+            for (int c = 0; c < k; c++) {
+                float minDist = std::numeric_limits<float>::max();
+                for (int other = 0; other < k; other++) {
+                    if (other != c)
+                        minDist = std::min(minDist, distance(centers.data() + (size_t)c * dim, centers.data() + (size_t)other * dim, dim));
+                }
+                separation[c] = 0.5f * minDist;
+            }
+            numDistances += (long long)k * (k + 1);
+
+            long long iterationDistances = 0;
+            #pragma omp parallel for reduction(+:iterationDistances) schedule(static)
+            for (int i = 0; i < numFeatures; i++) {
+                const int own = indices[i];
+                upper[i] += moved[own];
+                lower[i] -= own == farthest ? secondMoved : moved[farthest];
+                assigned[i] = own;
+
+                const float bound = std::max(separation[own], lower[i]);
+                if (upper[i] <= bound)
+                    continue;
+
+                // tighten the upper bound before comparing to all centers
+                const float *descriptor = block.descriptor(i);
+                upper[i] = distance(descriptor, centers.data() + (size_t)own * dim, dim);
+                iterationDistances++;
+                if (upper[i] <= bound)
+                    continue;
+
+                findClosest(descriptor, centers, k, dim, assigned[i], upper[i], lower[i]);
+                iterationDistances += k;
+            }
+            numDistances += iterationDistances;
+
+            // move the features that changed their cluster
+            int changed = 0;
+            for (int i = 0; i < numFeatures; i++) {
+                if (assigned[i] == indices[i])
+                    continue;
+                const float *descriptor = block.descriptor(i);
+                double *from = sums.data() + (size_t)indices[i] * dim;
+                double *to = sums.data() + (size_t)assigned[i] * dim;
+                for (int j = 0; j < dim; j++) {
+                    from[j] -= descriptor[j];
+                    to[j] += descriptor[j];
+                }
+                counts[indices[i]]--;
+                counts[assigned[i]]++;
+                indices[i] = assigned[i];
+                changed++;
+            }
+            if (changed == 0)
+                break;
+        }
+
+        LOG_INFO("k-means converged after " << iteration << " iterations with " << numDistances <<
+                 " distances, lloyd's algorithm computes " << (long long)numFeatures * k << " per iteration");
+    }
+}
@@ -0,0 +1,67 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_BOUNDEDKMEANS_H
+#define ISM3D_BOUNDEDKMEANS_H
+
+#include <vector>
+#include <flann/flann.h>
+
+#include "../utils/distance.h"
+#include "../utils/feature_block.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The BoundedKMeans class
+     * Exact euclidean k-means (Lloyd's algorithm) with the bounds of Hamerly (2010): each feature keeps an upper
+     * bound of the distance to its center and a lower bound of the distance to every other center, both are
+     * updated by the movement of the centers. A feature is only compared to the centers if its bounds no longer
+     * prove that its center is the closest one, after the first iterations most features are skipped. The result
+     * equals that of Lloyd's algorithm apart from ties and rounding. The assignment is computed in parallel with
+     * the vectorized distance kernels, the centers are updated incrementally from the features that changed their
+     * cluster.
+     */
+    class BoundedKMeans
+    {
+    public:
+        /**
+         * @param maxIterations the maximum number of iterations
+         * @param centersInit the seeding of the centers: k-means++, Gonzales (farthest first) or random features
+         * @param seed the seed of the random seeding
+         */
+        BoundedKMeans(int maxIterations, flann::flann_centers_init_t centersInit, unsigned seed = 0);
+
+        /**
+         * @brief Cluster the features.
+         * @param block the descriptors of the features
+         * @param k the number of clusters, at most the number of features
+         * @param centers output: k rows of descriptor length
+         * @param indices output: the cluster index of each feature
+         */
+        void cluster(const FeatureBlock &block, int k, std::vector<float> &centers, std::vector<int> &indices);
+
+    private:
+        float distance(const float *a, const float *b, int dim) const;
+
+        void seedCenters(const FeatureBlock &block, int k, std::vector<float> &centers) const;
+
+        // finds the closest and the second closest center of the feature
+        void findClosest(const float *descriptor, const std::vector<float> &centers, int k, int dim,
+                         int &closest, float &closestDist, float &secondDist) const;
+
+        int m_max_iterations;
+        flann::flann_centers_init_t m_centers_init;
+        unsigned m_seed;
+        DistanceEuclidean m_dist;
+    };
+}
+
+#endif // ISM3D_BOUNDEDKMEANS_H
@@ -11,12 +11,22 @@
 #include "clustering_agglomerative.h"
 #include "../utils/ism_feature.h"
 #include "../utils/distance.h"
+#include "../utils/flann_helper.h"
+#include "../utils/exception.h"
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <omp.h>
 
 namespace ism3d
 {
     ClusteringAgglomerative::ClusteringAgglomerative()
     {
         addParameter(m_threshold, "Threshold", 1.2f);
+        addParameter(m_method, "Method", std::string("Greedy"));
+        addParameter(m_max_matrix_features, "MaxMatrixFeatures", 10000);
+        addParameter(m_graph_neighbors, "GraphNeighbors", 16);
     }
 
     ClusteringAgglomerative::~ClusteringAgglomerative()
@@ -28,6 +38,281 @@ namespace ism3d
         if (features->size() == 0)
             return;
 
+        if (m_method == "Greedy") {
+            processGreedy(features);
+            return;
+        }
+        if (m_method != "NNChain")
+            throw BadParamException("invalid agglomerative clustering method: " + m_method);
+
+        // clusters are merged as long as their similarity, the inverse distance, reaches the threshold
+        const float max_distance = m_threshold > 0 ? 1.0f / m_threshold : std::numeric_limits<float>::infinity();
+
+        FeatureBlock::Ptr block = std::make_shared<FeatureBlock>();
+        if (!block->assign(*features))
+            throw RuntimeException("agglomerative clustering requires descriptors of equal length");
+
+        std::vector<t_descriptor_indices> clusters;
+        if ((int)features->size() <= m_max_matrix_features) {
+            LOG_INFO("clustering " << features->size() << " features with the nearest neighbor chain algorithm");
+            clusterNNChain(*block, max_distance, clusters);
+        }
+        else {
+            LOG_INFO("clustering " << features->size() << " features on a nearest neighbor graph with " <<
+                     m_graph_neighbors << " neighbors");
+            clusterGraph(block, max_distance, clusters);
+        }
+
+        assignClusters(*block, clusters);
+    }
+
+    void ClusteringAgglomerative::clusterNNChain(const FeatureBlock& block, float max_distance,
+                                                 std::vector<t_descriptor_indices>& clusters) const
+    {
+        const int num = block.size();
+        const int dim = block.dim();
+        const Distance& distance = getDistance();
+
+        // condensed upper triangle of the distance matrix
+        std::vector<float> matrix((std::size_t)num * (num - 1) / 2);
+        auto entry = [num](int i, int j) -> std::size_t {
+            if (i > j)
+                std::swap(i, j);
+            return (std::size_t)i * num - (std::size_t)i * (i + 1) / 2 + (j - i - 1);
+        };
+
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (int i = 0; i < num; i++) {
+            const float* data1 = block.descriptor(i);
+            float* row = matrix.data() + entry(i, i + 1);
+            for (int j = i + 1; j < num; j++)
+                row[j - i - 1] = distance(data1, block.descriptor(j), dim);
+        }
+
+        // clusters are represented by their smallest feature index, finished clusters can not be merged anymore
+        std::vector<int> sizes(num, 1);
+        std::vector<char> open(num, 1);
+        clusters.assign(num, t_descriptor_indices());
+        for (int i = 0; i < num; i++)
+            clusters[i].push_back(i);
+
+        std::vector<int> chain;
+        int next_start = 0;
+        while (true) {
+            if (chain.empty()) {
+                while (next_start < num && !open[next_start])
+                    next_start++;
+                if (next_start == num)
+                    break;
+                chain.push_back(next_start);
+            }
+
+            // nearest open neighbor of the chain's end, the previous chain element wins ties
+            const int current = chain.back();
+            const int previous = chain.size() > 1 ? chain[chain.size() - 2] : -1;
+            int nearest = previous;
+            float nearest_distance = previous >= 0 ? matrix[entry(current, previous)] :
+                                                     std::numeric_limits<float>::infinity();
+            for (int k = 0; k < num; k++) {
+                if (!open[k] || k == current)
+                    continue;
+                const float dist = matrix[entry(current, k)];
+                if (dist < nearest_distance) {
+                    nearest_distance = dist;
+                    nearest = k;
+                }
+            }
+
+            // distances along the chain decrease, so no cluster of the chain is merged anymore; for average
+            // linkage the distance to a merged cluster is never below the distances to its parts
+            if (nearest < 0 || nearest_distance > max_distance) {
+                for (int k : chain)
+                    open[k] = 0;
+                chain.clear();
+                continue;
+            }
+
+            if (nearest != previous) {
+                chain.push_back(nearest);
+                continue;
+            }
+
+            // reciprocal nearest neighbors: merge j into i with the Lance-Williams update for average linkage
+            chain.pop_back();
+            chain.pop_back();
+            const int i = std::min(current, previous);
+            const int j = std::max(current, previous);
+            const float weight_i = (float)sizes[i] / (sizes[i] + sizes[j]);
+            const float weight_j = (float)sizes[j] / (sizes[i] + sizes[j]);
+
+            #pragma omp parallel for if(num > 10000)
+            for (int k = 0; k < num; k++) {
+                if (!open[k] || k == i || k == j)
+                    continue;
+                float& dist_ik = matrix[entry(i, k)];
+                dist_ik = weight_i * dist_ik + weight_j * matrix[entry(j, k)];
+            }
+
+            sizes[i] += sizes[j];
+            open[j] = 0;
+            clusters[i].insert(clusters[i].end(), clusters[j].begin(), clusters[j].end());
+            clusters[j].clear();
+        }
+
+        clusters.erase(std::remove_if(clusters.begin(), clusters.end(),
+                                      [](const t_descriptor_indices& cluster) { return cluster.empty(); }),
+                       clusters.end());
+    }
+
+    void ClusteringAgglomerative::clusterGraph(FeatureBlock::ConstPtr block, float max_distance,
+                                               std::vector<t_descriptor_indices>& clusters) const
+    {
+        const int num = block->size();
+        const int dim = block->dim();
+        const Distance& distance = getDistance();
+        const int k_search = std::min(std::max(m_graph_neighbors, 1), num - 1) + 1;
+
+        // the index only selects the neighbors, their distances are computed with the clustering distance
+        FlannHelper flann_helper(block);
+        flann_helper.buildIndex(distance.getType(), 4);
+        std::vector<std::vector<int> > neighbors;
+        std::vector<std::vector<float> > neighbor_distances;
+        flann_helper.knnSearch(block->getMatrix(), neighbors, neighbor_distances, k_search, false, omp_get_max_threads());
+
+        float missing_distance = 0;
+        #pragma omp parallel for reduction(max:missing_distance)
+        for (int i = 0; i < num; i++) {
+            neighbor_distances[i].resize(neighbors[i].size());
+            for (int n = 0; n < (int)neighbors[i].size(); n++) {
+                const float dist = distance(block->descriptor(i), block->descriptor(neighbors[i][n]), dim);
+                neighbor_distances[i][n] = dist;
+                missing_distance = std::max(missing_distance, dist);
+            }
+        }
+
+        // the sum and number of known feature distances between two clusters
+        struct Link
+        {
+            double sum;
+            double count;
+        };
+        std::vector<std::unordered_map<int, Link> > links(num);
+        for (int i = 0; i < num; i++) {
+            for (int n = 0; n < (int)neighbors[i].size(); n++) {
+                const int j = neighbors[i][n];
+                if (j < 0 || j == i || links[i].count(j))
+                    continue;
+                links[i][j] = Link{neighbor_distances[i][n], 1};
+                links[j][i] = Link{neighbor_distances[i][n], 1};
+            }
+        }
+        neighbors.clear();
+        neighbor_distances.clear();
+
+        std::vector<double> sizes(num, 1);
+        std::vector<int> versions(num, 0);
+        auto linkDistance = [&](int a, int b, const Link& link) -> float {
+            // the unknown distances are approximated by the largest neighbor distance
+            const double pairs = sizes[a] * sizes[b];
+            return (float)((link.sum + (pairs - link.count) * missing_distance) / pairs);
+        };
+
+        // candidate merges ordered by distance, entries of changed clusters are skipped
+        struct Candidate
+        {
+            float distance;
+            int a;
+            int b;
+            int version_a;
+            int version_b;
+
+            bool operator<(const Candidate& other) const
+            {
+                return distance > other.distance;
+            }
+        };
+        std::priority_queue<Candidate> candidates;
+        for (int i = 0; i < num; i++) {
+            for (auto it = links[i].begin(); it != links[i].end(); it++) {
+                if (i < it->first)
+                    candidates.push(Candidate{linkDistance(i, it->first, it->second), i, it->first, 0, 0});
+            }
+        }
+
+        clusters.assign(num, t_descriptor_indices());
+        for (int i = 0; i < num; i++)
+            clusters[i].push_back(i);
+
+        while (!candidates.empty()) {
+            const Candidate candidate = candidates.top();
+            candidates.pop();
+            if (clusters[candidate.a].empty() || clusters[candidate.b].empty() ||
+                    versions[candidate.a] != candidate.version_a || versions[candidate.b] != candidate.version_b)
+                continue;
+            if (candidate.distance > max_distance)
+                break;
+
+            // merge the cluster with fewer links into the other one
+            int i = candidate.a;
+            int j = candidate.b;
+            if (links[i].size() < links[j].size())
+                std::swap(i, j);
+
+            links[i].erase(j);
+            for (auto it = links[j].begin(); it != links[j].end(); it++) {
+                if (it->first == i)
+                    continue;
+                Link& link = links[i][it->first];
+                link.sum += it->second.sum;
+                link.count += it->second.count;
+                links[it->first].erase(j);
+                links[it->first][i] = link;
+            }
+            links[j].clear();
+
+            sizes[i] += sizes[j];
+            versions[i]++;
+            clusters[i].insert(clusters[i].end(), clusters[j].begin(), clusters[j].end());
+            clusters[j].clear();
+
+            for (auto it = links[i].begin(); it != links[i].end(); it++) {
+                candidates.push(Candidate{linkDistance(i, it->first, it->second), i, it->first,
+                                          versions[i], versions[it->first]});
+            }
+        }
+
+        // clusters are ordered by their smallest feature index as in the other methods
+        for (t_descriptor_indices& cluster : clusters)
+            std::sort(cluster.begin(), cluster.end());
+        clusters.erase(std::remove_if(clusters.begin(), clusters.end(),
+                                      [](const t_descriptor_indices& cluster) { return cluster.empty(); }),
+                       clusters.end());
+        std::sort(clusters.begin(), clusters.end(),
+                  [](const t_descriptor_indices& a, const t_descriptor_indices& b) { return a[0] < b[0]; });
+    }
+
+    void ClusteringAgglomerative::assignClusters(const FeatureBlock& block, const std::vector<t_descriptor_indices>& clusters)
+    {
+        const int dim = block.dim();
+        m_centers.assign(clusters.size(), t_center(dim, 0.0f));
+        m_indices.resize(block.size());
+
+        #pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)clusters.size(); i++) {
+            t_center& center = m_centers[i];
+            for (int index : clusters[i]) {
+                const float* data = block.descriptor(index);
+                for (int k = 0; k < dim; k++)
+                    center[k] += data[k];
+                m_indices[index] = i;
+            }
+            for (int k = 0; k < dim; k++)
+                center[k] /= clusters[i].size();
+        }
+    }
+
+    void ClusteringAgglomerative::processGreedy(pcl::PointCloud<ISMFeature>::ConstPtr features)
+    {
         // clusters
         std::list<t_cluster_center> clusters;
 
@@ -100,12 +385,15 @@ namespace ism3d
         const t_descriptor_indices& indices1 = center1.second;
         const t_descriptor_indices& indices2 = center2.second;
 
+        const Distance& distance = getDistance();
         float dist = 0;
         for (int i = 0; i < (int)indices1.size(); i++) {
             const ISMFeature& feat1 = features->at(indices1[i]);
+            const float* data1 = feat1.descriptor.data();
+            const int size = (int)feat1.descriptor.size();
             for (int j = 0; j < (int)indices2.size(); j++) {
                 const ISMFeature& feat2 = features->at(indices2[j]);
-                dist += getDistance()(feat1.descriptor, feat2.descriptor);
+                dist += distance(data1, feat2.descriptor.data(), size);
             }
         }
 
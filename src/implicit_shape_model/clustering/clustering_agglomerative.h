@@ -12,6 +12,7 @@
 #define ISM3D_CLUSTERINGAGGLOMERATIVE_H
 
 #include "clustering.h"
+#include "../utils/feature_block.h"
 
 #include <list>
 
@@ -22,6 +23,14 @@ namespace ism3d
      * Performs an agglomerative clustering on the input data. The algorithm starts with the input features
      * as individual clusters and iteratively merges the two most similar clusters as long as their similarity
      * is above a threshold. The number of clusters is only determined by the threshold.
+     *
+     * The similarity of two clusters is the inverse of the average distance between their features (average
+     * linkage). The default method "Greedy" compares all pairs of clusters in each step and halves the center on
+     * each merge. The method "NNChain" finds the merges with the nearest neighbor chain algorithm on a distance
+     * matrix that is updated with the Lance-Williams formula, which results in the same partition in O(n^2) time
+     * and memory. For more features than fit the matrix, the clusters are merged on a k nearest neighbor graph
+     * instead, the distances of features that are not neighbors are approximated by the largest neighbor
+     * distance. NNChain uses the means of the cluster features as centers, so its codebooks differ from Greedy.
      */
     class ClusteringAgglomerative
             : public Clustering
@@ -41,6 +50,19 @@ namespace ism3d
         typedef std::vector<int> t_descriptor_indices;
         typedef std::pair<t_center, t_descriptor_indices> t_cluster_center;
 
+        void processGreedy(pcl::PointCloud<ISMFeature>::ConstPtr);
+
+        // exact average linkage, merges up to the given distance
+        void clusterNNChain(const FeatureBlock &block, float max_distance,
+                            std::vector<t_descriptor_indices> &clusters) const;
+
+        // approximate average linkage on the k nearest neighbor graph, merges up to the given distance
+        void clusterGraph(FeatureBlock::ConstPtr block, float max_distance,
+                          std::vector<t_descriptor_indices> &clusters) const;
+
+        // sets the cluster indices and the mean of each cluster as center
+        void assignClusters(const FeatureBlock &block, const std::vector<t_descriptor_indices> &clusters);
+
         float clusterDistance(const t_cluster_center&,
                               const t_cluster_center&,
                               pcl::PointCloud<ISMFeature>::ConstPtr);
@@ -54,6 +76,9 @@ namespace ism3d
                    const std::list<t_cluster_center>::iterator&);
 
         float m_threshold;
+        std::string m_method;
+        int m_max_matrix_features;
+        int m_graph_neighbors;
     };
 }
 
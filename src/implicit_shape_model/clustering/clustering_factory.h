@@ -17,6 +17,8 @@
 #include "clustering_kmeans_factor.h"
 #include "clustering_kmeans_thumb_rule.h"
 #include "clustering_kmeans_hartigan.h"
+#include "clustering_kmeans_mini_batch.h"
+#include "clustering_vocabulary_tree.h"
 #include "clustering_none.h"
 
 namespace ism3d
@@ -32,6 +34,10 @@ namespace ism3d
             return new ClusteringKMeansThumbRule();
         else if (type == ClusteringKMeansHartigan::getTypeStatic())
             return new ClusteringKMeansHartigan();
+        else if (type == ClusteringKMeansMiniBatch::getTypeStatic())
+            return new ClusteringKMeansMiniBatch();
+        else if (type == ClusteringVocabularyTree::getTypeStatic())
+            return new ClusteringVocabularyTree();
         else if (type == ClusteringAgglomerative::getTypeStatic())
             return new ClusteringAgglomerative();
         else if (type == ClusteringNone::getTypeStatic())
@@ -12,6 +12,8 @@
 #include "../features/features.h"
 #include "../utils/utils.h"
 #include "../utils/distance.h"
+#include "../utils/distance_dispatch.h"
+#include "bounded_kmeans.h"
 
 namespace ism3d
 {
@@ -23,6 +25,7 @@ namespace ism3d
         addParameter(m_iterations, "Iterations", 1000);
         addParameter(m_centersInit, "CentersInit", flann::FLANN_CENTERS_KMEANSPP);
         addParameter(m_cbIndex, "CbIndex", 0.5f);
+        addParameter(m_use_bounded, "UseBoundedKMeans", false);
     }
 
     ClusteringKMeans::~ClusteringKMeans()
@@ -40,18 +43,46 @@ namespace ism3d
         LOG_INFO("clustering " << features->size() << " features into " <<
                  m_desiredClusters << " clusters");
 
-        if (getDistance().getType() == DistanceEuclidean::getTypeStatic())
-            cluster<DistanceEuclidean::DistanceType>(features);
-        else {
+        IndexDistance distance = toIndexDistance(getDistance().getType());
+        if (distance != IndexDistance::Euclidean && distance != IndexDistance::Hamming)
             LOG_WARN("The k-means algorithm is only defined on euclidean distance. Using other distance metrices may lead to unexpected results.");
-            if (getDistance().getType() == DistanceChiSquared::getTypeStatic())
-                cluster<DistanceChiSquared::DistanceType>(features);
-            else if (getDistance().getType() == DistanceHellinger::getTypeStatic())
-                cluster<DistanceHellinger::DistanceType>(features);
-            else if (getDistance().getType() == DistanceHistIntersection::getTypeStatic())
-                cluster<DistanceHistIntersection::DistanceType>(features);
-            else
-                throw RuntimeException("invalid distance type: " + getDistance().getType());
+
+        if (m_use_bounded && (distance == IndexDistance::Euclidean || distance == IndexDistance::Hamming))
+        {
+            FeatureBlock block;
+            if (!block.assign(*features))
+                throw RuntimeException("k-means clustering requires descriptors of equal length");
+
+            std::vector<float> centers;
+            BoundedKMeans kmeans(m_iterations, m_centersInit);
+            kmeans.cluster(block, m_desiredClusters, centers, m_indices);
+
+            const int dim = block.dim();
+            m_centers.resize(centers.size() / std::max(dim, 1));
+            for (int i = 0; i < (int)m_centers.size(); i++)
+                m_centers[i].assign(centers.begin() + (size_t)i * dim, centers.begin() + (size_t)(i + 1) * dim);
+            return;
+        }
+
+        switch (distance)
+        {
+        case IndexDistance::Euclidean:
+        case IndexDistance::Hamming:
+            // for binary descriptors the squared euclidean distance equals the hamming distance, centers are
+            // binarized when packed for matching
+            cluster<DistanceEuclidean::DistanceType>(features);
+            break;
+        case IndexDistance::ChiSquared:
+            cluster<DistanceChiSquared::DistanceType>(features);
+            break;
+        case IndexDistance::Hellinger:
+            cluster<DistanceHellinger::DistanceType>(features);
+            break;
+        case IndexDistance::HistIntersection:
+            cluster<DistanceHistIntersection::DistanceType>(features);
+            break;
+        default:
+            throw RuntimeException("invalid distance type: " + getDistance().getType());
         }
     }
 
@@ -15,6 +15,7 @@
 
 #include <flann/flann.h>
 #include "../utils/ism_feature.h"
+#include "../utils/feature_block.h"
 #include "../utils/utils.h"
 
 namespace ism3d
@@ -24,6 +25,7 @@ namespace ism3d
      * Performs a k-means clustering on the input data. The number of clusters is determined by a
      * cluster count factor, which is multiplied by the number of input features. It can also be
      * specified explicitly by setting the factor to 0 and using the "DesiredClusters" parameter.
+     * With "UseBoundedKMeans" the euclidean clustering is computed by BoundedKMeans instead of flann.
      */
     class ClusteringKMeans
             : public Clustering
@@ -39,15 +41,17 @@ namespace ism3d
 
         void cluster(pcl::PointCloud<ISMFeature>::ConstPtr, int);
 
+        int m_iterations;
+        flann_centers_init_t m_centersInit;
+
     private:
         template <typename DistanceType>
         void cluster(pcl::PointCloud<ISMFeature>::ConstPtr);
 
         int m_desiredClusters;
         int m_branching;    // has influence on the obtained cluster count
-        int m_iterations;
-        flann_centers_init_t m_centersInit;
         float m_cbIndex;
+        bool m_use_bounded;
     };
 
     template <typename DistanceType>
@@ -74,16 +78,10 @@ namespace ism3d
         // fill input data
         ElementType* input = new ElementType[featureCount * descriptorSize];
         flann::Matrix<ElementType> inputMatrix(input, featureCount, descriptorSize);
-        for (int i = 0; i < featureCount; i++) {
-            const ISMFeature& feature = features->at(i);
-
-            if ((int)feature.descriptor.size() != descriptorSize) {
-                LOG_ERROR("invalid descriptor size");
-                return;
-            }
-
-            for (int j = 0; j < descriptorSize; j++)
-                inputMatrix[i][j] = feature.descriptor[j];
+        if (!FeatureBlock::copyDescriptors(*features, input, descriptorSize)) {
+            LOG_ERROR("invalid descriptor size");
+            delete[] input;
+            return;
         }
 
         // create output data for cluster centers
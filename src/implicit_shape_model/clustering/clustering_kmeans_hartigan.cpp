@@ -9,6 +9,12 @@
  */
 
 #include "clustering_kmeans_hartigan.h"
+#include "../utils/distance_dispatch.h"
+#include "../utils/exception.h"
+
+#include <algorithm>
+#include <limits>
+#include <omp.h>
 
 namespace ism3d
 {
@@ -23,72 +29,158 @@ namespace ism3d
 
     void ClusteringKMeansHartigan::process(pcl::PointCloud<ISMFeature>::ConstPtr features)
     {
-        cluster(features, 1);
-
-        //int maxK = features->size() - 1;
-        int maxK = m_maxK;
-
-        std::vector<std::vector<std::vector<float> > > centers(maxK);
-        std::vector<std::vector<int> > indices(maxK);
-        std::vector<float> dispersions(maxK);
-
-        // iterative clustering
-        for (int i = 0; i < maxK; i++) {
-            cluster(features, i + 1);
-
-            centers[i] = m_centers;
-            indices[i] = m_indices;
-            dispersions[i] = withinClusterSumOfSquares(m_centers, features);
-        }
-
-        // compute hartigan's index
-        int bestK = 0;
+        if (features->size() == 0)
+            return;
+
+        IndexDistance distance = toIndexDistance(getDistance().getType());
+        if (distance != IndexDistance::Euclidean && distance != IndexDistance::Hamming)
+            LOG_WARN("The k-means algorithm is only defined on euclidean distance. Using the euclidean distance for Hartigan's index.");
+
+        FeatureBlock block;
+        if (!block.assign(*features))
+            throw RuntimeException("k-means clustering requires descriptors of equal length");
+
+        const int numFeatures = block.size();
+        const int maxK = std::min(m_maxK, numFeatures);
+        LOG_INFO("clustering " << numFeatures << " features into up to " << maxK << " clusters");
+
+        // one cluster containing all features
+        Solution previous;
+        previous.k = 1;
+        previous.indices.assign(numFeatures, 0);
+        updateCenters(block, previous);
+        refine(block, previous);
+
+        // hartigan's index compares the dispersions of k and k + 1 clusters, the best solution is moved out of
+        // the previous one as soon as its index is known
+        Solution best = previous;
+        int bestK = 1;
         float maxValue = 0;
-        std::vector<float> hartigansIndex(maxK - 1);
-        for (int i = 0; i < (int)hartigansIndex.size(); i++) {
-            int numClusters = i + 1;
-            float factor = (features->size() - numClusters - 1);
-            float index = ((dispersions[i] / dispersions[i + 1]) - 1) * factor;
-
-            hartigansIndex[i] = index;
-
+        for (int k = 2; k <= maxK && previous.dispersion > 0; k++) {
+            Solution current;
+            split(block, previous, current);
+            refine(block, current);
+
+            float factor = numFeatures - previous.k - 1;
+            float index = current.dispersion > 0 ? ((previous.dispersion / current.dispersion) - 1) * factor :
+                                                   std::numeric_limits<float>::max();
             if (index > maxValue) {
                 maxValue = index;
-                bestK = i + 1;
+                bestK = previous.k;
+                best = std::move(previous);
             }
+            previous = std::move(current);
         }
 
         LOG_INFO("best value for k: " << bestK);
 
         // choose clustering which matches the best determined number for k
-        m_centers = centers[bestK - 1];
-        m_indices = indices[bestK - 1];
+        const int dim = block.dim();
+        m_centers.resize(best.k);
+        for (int i = 0; i < best.k; i++)
+            m_centers[i].assign(best.centers.begin() + (size_t)i * dim, best.centers.begin() + (size_t)(i + 1) * dim);
+        m_indices = std::move(best.indices);
     }
 
-    float ClusteringKMeansHartigan::withinClusterSumOfSquares(const std::vector<std::vector<float> >& clusters,
-                                                              pcl::PointCloud<ISMFeature>::ConstPtr data)
+    void ClusteringKMeansHartigan::split(const FeatureBlock& block, const Solution& previous, Solution& current) const
     {
-        float compactness = 0.0f;
-        for (unsigned int i_point = 0; i_point < (int)data->size(); i_point++)
-        {
-            const ISMFeature& sample = data->at(i_point);
+        // split the cluster with the highest dispersion, its farthest member becomes the new center
+        const int split = std::max_element(previous.dispersions.begin(), previous.dispersions.end()) - previous.dispersions.begin();
+        int farthest = -1;
+        for (int i = 0; i < block.size(); i++) {
+            if (previous.indices[i] == split && (farthest < 0 || previous.distances[i] > previous.distances[farthest]))
+                farthest = i;
+        }
+
+        current.k = previous.k + 1;
+        current.indices = previous.indices;
+        current.centers = previous.centers;
+        current.centers.insert(current.centers.end(), block.descriptor(farthest), block.descriptor(farthest) + block.dim());
+    }
 
-            int k_best = 0;
-            float min_dist = std::numeric_limits<float>::max ();
+    void ClusteringKMeansHartigan::refine(const FeatureBlock& block, Solution& solution) const
+    {
+        solution.distances.resize(block.size());
+        for (int iteration = 0; ; iteration++) {
+            bool changed = assign(block, solution);
+            if (!changed || iteration >= m_iterations)
+                break;
+            updateCenters(block, solution);
+        }
 
-            for (int i_cluster = 0; i_cluster < (int)clusters.size(); i_cluster++)
-            {
-                const std::vector<float>& cluster = clusters[i_cluster];
-                float dist = m_dist(sample.descriptor, cluster);
-                if (dist < min_dist)
-                {
-                    min_dist = dist;
-                    k_best = i_cluster;
+        // the distances of the last assignment are those to the current centers
+        solution.dispersions.assign(solution.k, 0);
+        for (int i = 0; i < block.size(); i++)
+            solution.dispersions[solution.indices[i]] += solution.distances[i];
+        solution.dispersion = 0;
+        for (double dispersion : solution.dispersions)
+            solution.dispersion += dispersion;
+    }
+
+    bool ClusteringKMeansHartigan::assign(const FeatureBlock& block, Solution& solution) const
+    {
+        const int dim = block.dim();
+        int changed = 0;
+
+        #pragma omp parallel for reduction(+:changed) schedule(static)
+        for (int i = 0; i < block.size(); i++) {
+            const float* descriptor = block.descriptor(i);
+            int best = 0;
+            float minDist = std::numeric_limits<float>::max();
+            for (int c = 0; c < solution.k; c++) {
+                float dist = m_dist(descriptor, solution.centers.data() + (size_t)c * dim, dim);
+                if (dist < minDist) {
+                    minDist = dist;
+                    best = c;
                 }
             }
-            compactness += min_dist;
+
+            if (solution.indices[i] != best)
+                changed++;
+            solution.indices[i] = best;
+            solution.distances[i] = minDist;
+        }
+        return changed > 0;
+    }
+
+    void ClusteringKMeansHartigan::updateCenters(const FeatureBlock& block, Solution& solution) const
+    {
+        const int dim = block.dim();
+        std::vector<double> sums((size_t)solution.k * dim, 0);
+        std::vector<int> counts(solution.k, 0);
+
+        #pragma omp parallel
+        {
+            std::vector<double> localSums((size_t)solution.k * dim, 0);
+            std::vector<int> localCounts(solution.k, 0);
+
+            #pragma omp for schedule(static) nowait
+            for (int i = 0; i < block.size(); i++) {
+                const int c = solution.indices[i];
+                const float* descriptor = block.descriptor(i);
+                double* sum = localSums.data() + (size_t)c * dim;
+                for (int j = 0; j < dim; j++)
+                    sum[j] += descriptor[j];
+                localCounts[c]++;
+            }
+
+            #pragma omp critical
+            {
+                for (size_t j = 0; j < sums.size(); j++)
+                    sums[j] += localSums[j];
+                for (int c = 0; c < solution.k; c++)
+                    counts[c] += localCounts[c];
+            }
+        }
+
+        solution.centers.resize((size_t)solution.k * dim);
+        for (int c = 0; c < solution.k; c++) {
+            // an empty cluster keeps its center, it may win features in the next assignment
+            if (counts[c] == 0)
+                continue;
+            for (int j = 0; j < dim; j++)
+                solution.centers[(size_t)c * dim + j] = sums[(size_t)c * dim + j] / counts[c];
         }
-        return compactness;
     }
 
     std::string ClusteringKMeansHartigan::getTypeStatic()
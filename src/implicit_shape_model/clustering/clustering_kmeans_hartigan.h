@@ -16,6 +16,12 @@
 
 namespace ism3d
 {
+    /**
+     * @brief The ClusteringKMeansHartigan class
+     * Performs a k-means clustering for each k from 1 to "MaxK" and chooses the k that maximizes Hartigan's index.
+     * Each k is warm started from the solution for k - 1 by splitting the cluster with the highest dispersion and
+     * refined by Lloyd iterations. Only the current, the previous and the best solution are kept in memory.
+     */
     class ClusteringKMeansHartigan
             : public ClusteringKMeans
     {
@@ -30,8 +36,20 @@ namespace ism3d
         void process(pcl::PointCloud<ISMFeature>::ConstPtr);
 
     private:
-        float withinClusterSumOfSquares(const std::vector<std::vector<float> >&,
-                                        pcl::PointCloud<ISMFeature>::ConstPtr);
+        struct Solution
+        {
+            int k;
+            std::vector<float> centers;         // k rows of descriptor length
+            std::vector<int> indices;           // cluster index of each feature
+            std::vector<float> distances;       // squared distance of each feature to its center
+            std::vector<double> dispersions;    // within cluster sum of squares of each cluster
+            double dispersion;                  // within cluster sum of squares of all clusters
+        };
+
+        void split(const FeatureBlock&, const Solution&, Solution&) const;
+        void refine(const FeatureBlock&, Solution&) const;
+        bool assign(const FeatureBlock&, Solution&) const;
+        void updateCenters(const FeatureBlock&, Solution&) const;
 
         DistanceEuclidean m_dist;
         int m_maxK;
@@ -0,0 +1,241 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "clustering_kmeans_mini_batch.h"
+#include "../utils/distance.h"
+#include "../utils/distance_dispatch.h"
+#include "../utils/exception.h"
+#include "../utils/feature_block.h"
+#include "../utils/flann_helper.h"
+#include "../utils/utils.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <omp.h>
+
+namespace ism3d
+{
+    ClusteringKMeansMiniBatch::ClusteringKMeansMiniBatch()
+    {
+        addParameter(m_clusterCount, "ClusterCount", 10);
+        addParameter(m_batchSize, "BatchSize", 4096);
+        addParameter(m_batchIterations, "BatchIterations", 500);
+        addParameter(m_seedSamples, "SeedSamples", 100000);
+    }
+
+    ClusteringKMeansMiniBatch::~ClusteringKMeansMiniBatch()
+    {
+    }
+
+    void ClusteringKMeansMiniBatch::process(pcl::PointCloud<ISMFeature>::ConstPtr features)
+    {
+        if (features->size() == 0)
+            return;
+
+        const int numFeatures = features->size();
+        const int dim = features->at(0).descriptor.size();
+        for (int i = 0; i < numFeatures; i++) {
+            if ((int)features->at(i).descriptor.size() != dim)
+                throw RuntimeException("k-means clustering requires descriptors of equal length");
+        }
+
+        IndexDistance distance = toIndexDistance(getDistance().getType());
+        if (distance != IndexDistance::Euclidean && distance != IndexDistance::Hamming)
+            LOG_WARN("The k-means algorithm is only defined on euclidean distance. Using other distance metrices may lead to unexpected results.");
+
+        const int clusterCount = std::max(1, std::min(m_clusterCount, numFeatures));
+        LOG_INFO("clustering " << numFeatures << " features into " << clusterCount << " clusters with mini-batches of " <<
+                 m_batchSize << " features");
+
+        // the seed is fixed to obtain reproducible codebooks
+        std::mt19937 rng(42);
+        std::vector<float> centers;
+        seedCenters(features, clusterCount, rng, centers);
+        const int numCenters = centers.size() / dim;
+
+        const int batchSize = std::max(1, m_batchSize);
+        std::uniform_int_distribution<int> pick(0, numFeatures - 1);
+        std::vector<int> batch(batchSize);
+        std::vector<int> assignment(batchSize);
+        std::vector<int> memberStart(numCenters + 1);
+        std::vector<int> members(batchSize);
+        std::vector<int> counts(numCenters, 0);
+
+        for (int iteration = 0; iteration < m_batchIterations; iteration++) {
+            for (int b = 0; b < batchSize; b++)
+                batch[b] = pick(rng);
+            assignBatch(features, batch, centers, assignment);
+
+            // sort the batch by center, each center is then updated independently in batch order
+            std::fill(memberStart.begin(), memberStart.end(), 0);
+            for (int b = 0; b < batchSize; b++)
+                memberStart[assignment[b] + 1]++;
+            std::partial_sum(memberStart.begin(), memberStart.end(), memberStart.begin());
+            std::vector<int> next(memberStart.begin(), memberStart.end() - 1);
+            for (int b = 0; b < batchSize; b++)
+                members[next[assignment[b]]++] = batch[b];
+
+            #pragma omp parallel for schedule(dynamic, 16)
+            for (int c = 0; c < numCenters; c++) {
+                float* center = centers.data() + (size_t)c * dim;
+                for (int m = memberStart[c]; m < memberStart[c + 1]; m++) {
+                    // the learning rate of a center decreases with the number of features it has seen
+                    const float* descriptor = features->at(members[m]).descriptor.data();
+                    const float eta = 1.0f / ++counts[c];
+                    for (int j = 0; j < dim; j++)
+                        center[j] += eta * (descriptor[j] - center[j]);
+                }
+            }
+        }
+
+        assignAll(features, centers);
+    }
+
+    void ClusteringKMeansMiniBatch::seedCenters(pcl::PointCloud<ISMFeature>::ConstPtr features, int clusterCount,
+                                                std::mt19937& rng, std::vector<float>& centers) const
+    {
+        const int numFeatures = features->size();
+        const int dim = features->at(0).descriptor.size();
+        const Distance& distance = getDistance();
+
+        // k-means++ on a random sample of the features
+        std::vector<int> sample(numFeatures);
+        std::iota(sample.begin(), sample.end(), 0);
+        if (m_seedSamples > 0 && numFeatures > std::max(m_seedSamples, clusterCount)) {
+            std::shuffle(sample.begin(), sample.end(), rng);
+            sample.resize(std::max(m_seedSamples, clusterCount));
+        }
+        const int numSamples = sample.size();
+
+        centers.clear();
+        centers.reserve((size_t)clusterCount * dim);
+        std::vector<float> minDist(numSamples, std::numeric_limits<float>::max());
+        int chosen = std::uniform_int_distribution<int>(0, numSamples - 1)(rng);
+        for (int c = 0; c < clusterCount; c++) {
+            const float* center = features->at(sample[chosen]).descriptor.data();
+            centers.insert(centers.end(), center, center + dim);
+            if (c + 1 == clusterCount)
+                break;
+
+            double total = 0;
+            #pragma omp parallel for reduction(+:total) schedule(static)
+            for (int i = 0; i < numSamples; i++) {
+                const float dist = distance(features->at(sample[i]).descriptor.data(), center, dim);
+                minDist[i] = std::min(minDist[i], dist);
+                total += minDist[i];
+            }
+
+            // all remaining samples coincide with a center
+            if (total <= 0) {
+                LOG_WARN("only " << c + 1 << " distinct cluster centers found");
+                break;
+            }
+
+            // the next center is chosen with a probability proportional to its distance to the nearest center
+            double threshold = std::uniform_real_distribution<double>(0, total)(rng);
+            chosen = numSamples - 1;
+            for (int i = 0; i < numSamples; i++) {
+                threshold -= minDist[i];
+                if (threshold <= 0 && minDist[i] > 0) {
+                    chosen = i;
+                    break;
+                }
+            }
+        }
+    }
+
+    void ClusteringKMeansMiniBatch::assignBatch(pcl::PointCloud<ISMFeature>::ConstPtr features, const std::vector<int>& batch,
+                                                const std::vector<float>& centers, std::vector<int>& assignment) const
+    {
+        const int dim = features->at(0).descriptor.size();
+        const int numCenters = centers.size() / dim;
+        const Distance& distance = getDistance();
+
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < (int)batch.size(); b++) {
+            const float* descriptor = features->at(batch[b]).descriptor.data();
+            int best = 0;
+            float minDist = std::numeric_limits<float>::max();
+            for (int c = 0; c < numCenters; c++) {
+                float dist = distance(descriptor, centers.data() + (size_t)c * dim, dim);
+                if (dist < minDist) {
+                    minDist = dist;
+                    best = c;
+                }
+            }
+            assignment[b] = best;
+        }
+    }
+
+    void ClusteringKMeansMiniBatch::assignAll(pcl::PointCloud<ISMFeature>::ConstPtr features, const std::vector<float>& centers)
+    {
+        const int numFeatures = features->size();
+        const int dim = features->at(0).descriptor.size();
+        const int numCenters = centers.size() / dim;
+
+        // few centers are compared exhaustively, otherwise a kd-tree on the centers is searched in chunks
+        const int maxExhaustiveCenters = 256;
+        std::vector<int> indices(numFeatures);
+        if (numCenters <= maxExhaustiveCenters) {
+            std::vector<int> all(numFeatures);
+            std::iota(all.begin(), all.end(), 0);
+            assignBatch(features, all, centers, indices);
+        }
+        else {
+            FeatureBlock::Ptr block = std::make_shared<FeatureBlock>(numCenters, dim);
+            std::copy(centers.begin(), centers.end(), block->data());
+            FlannHelper flannHelper(block);
+            flannHelper.buildIndex(getDistance().getType(), 4);
+
+            const int chunkSize = 65536;
+            std::vector<float> chunk((size_t)std::min(chunkSize, numFeatures) * dim);
+            std::vector<std::vector<int> > neighbors;
+            std::vector<std::vector<float> > distances;
+            for (int start = 0; start < numFeatures; start += chunkSize) {
+                const int count = std::min(chunkSize, numFeatures - start);
+                for (int i = 0; i < count; i++) {
+                    const std::vector<float>& descriptor = features->at(start + i).descriptor;
+                    std::copy(descriptor.begin(), descriptor.end(), chunk.begin() + (size_t)i * dim);
+                }
+                flann::Matrix<float> queries(chunk.data(), count, dim);
+                flannHelper.knnSearch(queries, neighbors, distances, 1, false, omp_get_max_threads());
+                for (int i = 0; i < count; i++)
+                    indices[start + i] = neighbors[i][0];
+            }
+        }
+
+        // remove centers without features
+        std::vector<int> remap(numCenters, -1);
+        for (int i = 0; i < numFeatures; i++)
+            remap[indices[i]] = 0;
+        m_centers.clear();
+        for (int c = 0; c < numCenters; c++) {
+            if (remap[c] < 0)
+                continue;
+            remap[c] = m_centers.size();
+            m_centers.push_back(std::vector<float>(centers.begin() + (size_t)c * dim, centers.begin() + (size_t)(c + 1) * dim));
+        }
+
+        m_indices.resize(numFeatures);
+        for (int i = 0; i < numFeatures; i++)
+            m_indices[i] = remap[indices[i]];
+    }
+
+    std::string ClusteringKMeansMiniBatch::getTypeStatic()
+    {
+        return "KMeansMiniBatch";
+    }
+
+    std::string ClusteringKMeansMiniBatch::getType() const
+    {
+        return ClusteringKMeansMiniBatch::getTypeStatic();
+    }
+}
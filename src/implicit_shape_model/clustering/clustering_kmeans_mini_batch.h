@@ -0,0 +1,55 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CLUSTERINGKMEANSMINIBATCH_H
+#define ISM3D_CLUSTERINGKMEANSMINIBATCH_H
+
+#include "clustering.h"
+#include "../utils/ism_feature.h"
+
+#include <random>
+
+namespace ism3d
+{
+    /**
+     * @brief The ClusteringKMeansMiniBatch class
+     * Performs a mini-batch k-means clustering (Sculley, Web-Scale K-Means Clustering) for large feature sets.
+     * Centers are seeded with k-means++ on a random sample and updated with a per-center learning rate from
+     * random batches. The descriptors are read in place from the input features, only the centers, one batch
+     * and the seeding sample are held in addition. Finally, each feature is assigned to its nearest center and
+     * centers without features are removed.
+     */
+    class ClusteringKMeansMiniBatch
+            : public Clustering
+    {
+    public:
+        ClusteringKMeansMiniBatch();
+        ~ClusteringKMeansMiniBatch();
+
+        static std::string getTypeStatic();
+        std::string getType() const;
+
+    protected:
+        void process(pcl::PointCloud<ISMFeature>::ConstPtr);
+
+    private:
+        void seedCenters(pcl::PointCloud<ISMFeature>::ConstPtr, int, std::mt19937&, std::vector<float>&) const;
+        void assignBatch(pcl::PointCloud<ISMFeature>::ConstPtr, const std::vector<int>&, const std::vector<float>&,
+                         std::vector<int>&) const;
+        void assignAll(pcl::PointCloud<ISMFeature>::ConstPtr, const std::vector<float>&);
+
+        int m_clusterCount;
+        int m_batchSize;
+        int m_batchIterations;
+        int m_seedSamples;
+    };
+}
+
+#endif // ISM3D_CLUSTERINGKMEANSMINIBATCH_H
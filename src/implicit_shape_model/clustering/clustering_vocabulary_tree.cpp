@@ -0,0 +1,72 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "clustering_vocabulary_tree.h"
+#include "../utils/distance.h"
+#include "../utils/distance_dispatch.h"
+#include "../utils/exception.h"
+#include "../utils/feature_block.h"
+#include "../utils/utils.h"
+#include "../utils/vocabulary_tree.h"
+
+namespace ism3d
+{
+    ClusteringVocabularyTree::ClusteringVocabularyTree()
+    {
+        addParameter(m_branching, "Branching", 10);
+        addParameter(m_depth, "Depth", 4);
+        addParameter(m_iterations, "Iterations", 1000);
+    }
+
+    ClusteringVocabularyTree::~ClusteringVocabularyTree()
+    {
+    }
+
+    void ClusteringVocabularyTree::process(pcl::PointCloud<ISMFeature>::ConstPtr features)
+    {
+        if (features->size() == 0)
+            return;
+
+        IndexDistance distance = toIndexDistance(getDistance().getType());
+        if (distance != IndexDistance::Euclidean && distance != IndexDistance::Hamming)
+            LOG_WARN("The k-means algorithm is only defined on euclidean distance. Using other distance metrices may lead to unexpected results.");
+
+        FeatureBlock block;
+        if (!block.assign(*features))
+            throw RuntimeException("vocabulary tree clustering requires descriptors of equal length");
+
+        LOG_INFO("clustering " << block.size() << " features with a vocabulary tree of branching factor " <<
+                 m_branching << " and depth " << m_depth);
+
+        VocabularyTree tree;
+        tree.build(block.data(), block.size(), block.dim(), m_branching, m_depth, m_iterations, getDistance());
+
+        // each leaf is a cluster with the mean of its features as center
+        const int numLeaves = tree.getNumLeaves();
+        const std::vector<int>& rows = tree.getLeafRows();
+        m_centers.resize(numLeaves);
+        m_indices.resize(block.size());
+        for (int leaf = 0; leaf < numLeaves; leaf++) {
+            m_centers[leaf].assign(tree.getLeafCenter(leaf), tree.getLeafCenter(leaf) + block.dim());
+            for (int i = tree.getLeafOffset(leaf); i < tree.getLeafOffset(leaf + 1); i++)
+                m_indices[rows[i]] = leaf;
+        }
+    }
+
+    std::string ClusteringVocabularyTree::getTypeStatic()
+    {
+        return "VocabularyTree";
+    }
+
+    std::string ClusteringVocabularyTree::getType() const
+    {
+        return ClusteringVocabularyTree::getTypeStatic();
+    }
+}
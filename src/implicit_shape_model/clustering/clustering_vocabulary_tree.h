@@ -0,0 +1,45 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CLUSTERINGVOCABULARYTREE_H
+#define ISM3D_CLUSTERINGVOCABULARYTREE_H
+
+#include "clustering.h"
+#include "../utils/ism_feature.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ClusteringVocabularyTree class
+     * Clusters the input features with a hierarchical k-means tree of the given branching factor and depth, each
+     * leaf of the tree is a cluster. Combined with the "VocabularyTree" activation strategy, the codewords are
+     * activated by descending a tree of the same shape.
+     */
+    class ClusteringVocabularyTree
+            : public Clustering
+    {
+    public:
+        ClusteringVocabularyTree();
+        ~ClusteringVocabularyTree();
+
+        static std::string getTypeStatic();
+        std::string getType() const;
+
+    protected:
+        void process(pcl::PointCloud<ISMFeature>::ConstPtr);
+
+    private:
+        int m_branching;
+        int m_depth;
+        int m_iterations;
+    };
+}
+
+#endif // ISM3D_CLUSTERINGVOCABULARYTREE_H
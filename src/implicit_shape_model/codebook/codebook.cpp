@@ -12,26 +12,43 @@
 #include "codebook_factory.h"
 #include "../utils/utils.h"
 #include "../utils/distance.h"
-
+#include "../utils/feature_block.h"
+#include "../utils/feature_store.h"
+#include "../utils/json_stream.h"
+#include "../utils/flann_helper.h"
+#include "../utils/profiler_markers.h"
+#include "../utils/cancellation.h"
+#include "../utils/block_compression.h"
+
+#include <cmath>
 #include <random>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <sstream>
+#include <omp.h>
 
 #include "codeword_distribution.h"
 #include "../activation_strategy/activation_strategy.h"
 #include "../activation_strategy/activation_strategy_knn.h"
 #include "../activation_strategy/activation_strategy_inn.h"
 #include "../activation_strategy/activation_strategy_threshold.h"
+#include "../voting/voting.h"
 
 namespace ism3d
 {
 Codebook::Codebook()
-    : m_activationStrategy(0)
+    : m_activationStrategy(0), m_dense_tables_valid(false), m_codeword_entries_valid(false)
 {
     m_activationStrategy = new ActivationStrategyKNN();
+    resolveActivationStrategy();
 
     addParameter(m_useClassWeight, "UseClassWeight", false);
     addParameter(m_useVoteWeight, "UseVoteWeight", false);
     addParameter(m_useMatchingWeight, "UseMatchingWeight", false);
     addParameter(m_useCodewordWeight, "UseCodewordWeight", false);
+    addParameter(m_max_votes_per_activation, "MaxVotesPerActivation", 0);
 
     addParameter(m_use_partial_shot, "UsePartialShot", false);
     addParameter(m_partial_shot_type, "PartialShotType", std::string("front"));
@@ -39,6 +56,34 @@ Codebook::Codebook()
     addParameter(m_use_random_codebook, "UseRandomCodebook", false);
     addParameter(m_random_codebook_factor, "RandomCodebookFactor", 1.0f);
     addParameter(m_directly_assign_codewords, "DirectlyAssignCodewords", false);
+    addParameter(m_activation_threads, "ActivationThreads", 0);
+    addParameter(m_sigma_samples, "SigmaSamples", 0);
+
+    addParameter(m_compression, "Compression", std::string("None"));
+    addParameter(m_vote_storage, "VoteStorage", std::string("Float"));
+    addParameter(m_codeword_order, "CodewordOrder", std::string("Id"));
+    addParameter(m_warm_up_codewords, "WarmUpCodewords", std::string(""));
+    addParameter(m_pq_subspaces, "PQSubspaces", 32);
+    addParameter(m_pq_centroids, "PQCentroids", 256);
+    addParameter(m_pq_iterations, "PQIterations", 20);
+    addParameter(m_pq_training_samples, "PQTrainingSamples", 25600);
+    addParameter(m_pq_rerank, "PQRerank", 0);
+
+    addParameter(m_use_activation_cache, "UseActivationCache", false);
+    addParameter(m_activation_cache_cell_size, "ActivationCacheCellSize", 0.005f);
+    addParameter(m_activation_cache_signature_step, "ActivationCacheSignatureStep", 0.1f);
+    addParameter(m_activation_cache_tolerance, "ActivationCacheTolerance", 0.01f);
+    addParameter(m_activation_cache_memory, "ActivationCacheMemory", 64);
+    addParameter(m_use_scene_deduplication, "UseSceneDeduplication", false);
+    addParameter(m_scene_deduplication_step, "SceneDeduplicationStep", 0.01f);
+    addParameter(m_recall_sample_rate, "RecallSampleRate", 0.0f);
+    addParameter(m_recall_max_pending, "RecallMaxPending", 10000);
+    addParameter(m_archive_chunk_size, "ArchiveChunkSize", 0);
+
+    addParameter(m_prune_target_size, "PruneTargetSize", 0);
+    addParameter(m_prune_vote_budget, "PruneVoteBudget", 0);
+    addParameter(m_prune_samples, "PruneSamples", 10000);
+    addParameter(m_prune_neighbors, "PruneNeighbors", 10);
 }
 
 Codebook::~Codebook()
@@ -47,54 +92,317 @@ Codebook::~Codebook()
     m_distribution.clear();
 }
 
+namespace
+{
+typedef std::vector<std::shared_ptr<CodewordDistribution> >::iterator DistributionIterator;
+
+// copies the descriptors of the features into one row-major query buffer, partial descriptors are gathered with the
+// plan; false if a descriptor has a different length
+bool copyQueries(const pcl::PointCloud<ISMFeature> &features, const std::vector<int> *partial_plan, int source_dim,
+                 std::vector<float> &data, flann::Matrix<float> &queries)
+{
+    const int dim = partial_plan ? (int)partial_plan->size() : source_dim;
+    data.resize(features.size() * (size_t)dim);
+    queries = flann::Matrix<float>(data.data(), features.size(), dim);
+    return partial_plan ? FeatureBlock::gatherDescriptors(features, *partial_plan, data.data(), source_dim) :
+                          FeatureBlock::copyDescriptors(features, data.data(), dim);
+}
+
+// copies the given rows of a query matrix into a new one
+void selectQueries(const flann::Matrix<float> &queries, const std::vector<int> &rows, std::vector<float> &data,
+                   flann::Matrix<float> &selected)
+{
+    data.resize(rows.size() * queries.cols);
+    for (int j = 0; j < (int)rows.size(); j++)
+        std::copy(queries[rows[j]], queries[rows[j]] + queries.cols, data.begin() + (size_t)j * queries.cols);
+    selected = flann::Matrix<float>(data.data(), rows.size(), queries.cols);
+}
+
+// the class of most features of a codeword, or of most of its votes if the features are not known
+unsigned getDominantClass(const CodewordDistribution &distribution)
+{
+    std::map<unsigned, int> counts;
+    const std::vector<unsigned> &featureClasses = distribution.getCodeword()->getFeatureClasses();
+    if (!featureClasses.empty())
+    {
+        for (unsigned classId : featureClasses)
+            counts[classId]++;
+    }
+    else
+    {
+        for (unsigned classId : distribution.getClassIds())
+            counts[classId]++;
+    }
+
+    unsigned dominant = 0;
+    int maxCount = 0;
+    for (std::map<unsigned, int>::const_iterator it = counts.begin(); it != counts.end(); it++)
+    {
+        if (it->second > maxCount)
+        {
+            dominant = it->first;
+            maxCount = it->second;
+        }
+    }
+    return dominant;
+}
+
+// sorts the distributions into the leaf order of a kd-tree over their descriptors: each range is split at the median
+// of the descriptor dimension with the largest extent, estimated on a sample of the range
+void sortKdTreeLeaves(DistributionIterator first, DistributionIterator last)
+{
+    const int leafSize = 16;
+    const int maxSamples = 256;
+    const int size = (int)(last - first);
+    if (size <= leafSize)
+        return;
+
+    const std::vector<float> &firstData = (*first)->getCodeword()->getData();
+    std::vector<float> minValues(firstData);
+    std::vector<float> maxValues(firstData);
+    const int step = std::max(1, size / maxSamples);
+    for (int i = step; i < size; i += step)
+    {
+        const std::vector<float> &data = first[i]->getCodeword()->getData();
+        for (int j = 0; j < (int)std::min(data.size(), minValues.size()); j++)
+        {
+            minValues[j] = std::min(minValues[j], data[j]);
+            maxValues[j] = std::max(maxValues[j], data[j]);
+        }
+    }
+
+    int split = 0;
+    for (int j = 1; j < (int)minValues.size(); j++)
+    {
+        if (maxValues[j] - minValues[j] > maxValues[split] - minValues[split])
+            split = j;
+    }
+    if (minValues.empty() || maxValues[split] <= minValues[split])
+        return;
+
+    DistributionIterator middle = first + size / 2;
+    std::nth_element(first, middle, last, [split](const std::shared_ptr<CodewordDistribution> &a,
+                                                  const std::shared_ptr<CodewordDistribution> &b)
+    {
+        return a->getCodeword()->getData()[split] < b->getCodeword()->getData()[split];
+    });
+    sortKdTreeLeaves(first, middle);
+    sortKdTreeLeaves(middle, last);
+}
+
+typedef std::shared_ptr<const std::vector<std::shared_ptr<CodewordDistribution> > > DistributionList;
+
+// a flat model section filled with one array of each distribution, one after another; the distributions are kept
+// alive until the writer is closed
+template<typename T>
+FlatModelWriter::FillFunction fillDistributions(DistributionList entries,
+                                                const std::function<FlatArray<T>(const CodewordDistribution&)> &get)
+{
+    return [entries, get](char *data)
+    {
+        T *values = (T*)data;
+        for (const std::shared_ptr<CodewordDistribution> &entry : *entries)
+        {
+            const FlatArray<T> array = get(*entry);
+            values = std::copy(array.begin(), array.end(), values);
+        }
+    };
+}
+
+// the per-vote data of the distributions of a codebook in contiguous arrays, see Codebook::packVotes()
+struct PackedVotes
+{
+    std::vector<Eigen::Vector3f> votes;
+    std::vector<float> weights;
+    std::vector<unsigned> classIds;
+    std::vector<float> boundingBoxes;
+    std::vector<int> classIndices;
+    std::vector<float> classWeights;
+    std::vector<unsigned> weightedClassIds;
+    std::vector<float> weightedClassWeights;
+};
+
+// resolves the index of the flann helper to the activation specialized on its distance
+struct ActivateVisitor
+{
+    Codebook &codebook;
+    const std::vector<std::shared_ptr<Codeword> > &codewords;
+    const FeatureStore &features;
+    const std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes;
+    const Distance *distance;
+    const FlannHelper &flannHelper;
+    bool flannExactMatch;
+
+    template<typename T>
+    void operator()(T)
+    {
+        codebook.activate(codewords, features, boundingBoxes, distance, *flannHelper.getIndex<T>(), flannExactMatch);
+    }
+};
+
+struct CastVotesVisitor
+{
+    const Codebook &codebook;
+    pcl::PointCloud<ISMFeature>::Ptr features;
+    const Distance *distance;
+    Voting &voting;
+    const FlannHelper &flannHelper;
+    bool flannExactMatch;
+
+    template<typename T>
+    void operator()(T)
+    {
+        codebook.castVotes(features, distance, voting, *flannHelper.getIndex<T>(), flannExactMatch);
+    }
+};
+
+struct ActivateFeaturesVisitor
+{
+    const Codebook &codebook;
+    pcl::PointCloud<ISMFeature>::Ptr features;
+    const Distance *distance;
+    const FlannHelper &flannHelper;
+    bool flannExactMatch;
+    ActivationResult &activation;
+
+    template<typename T>
+    void operator()(T)
+    {
+        codebook.activateFeatures(features, distance, *flannHelper.getIndex<T>(), flannExactMatch, activation);
+    }
+};
+}
+
+void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords,
+                        const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+                        const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
+                        const Distance* distance, const FlannHelper &flann_helper, const bool flann_exact_match)
+{
+    // the features stay in memory, the store only shares them
+    FeatureStore store;
+    for (auto it = features.begin(); it != features.end(); it++)
+    {
+        for (int i = 0; i < (int)it->second.size(); i++)
+            store.store(it->first, i, it->second[i]);
+    }
+    activate(codewords, store, boundingBoxes, distance, flann_helper, flann_exact_match);
+}
+
+void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords,
+                        const FeatureStore& features,
+                        const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
+                        const Distance* distance, const FlannHelper &flann_helper, const bool flann_exact_match)
+{
+    if(!visitIndexDistance(flann_helper.getIndexDistance(),
+                           ActivateVisitor{*this, codewords, features, boundingBoxes, distance, flann_helper, flann_exact_match}))
+        throw RuntimeException("invalid distance type for codebook activation");
+}
+
+void Codebook::castVotes(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance, Voting& voting,
+                         const FlannHelper &flann_helper, const bool flann_exact_match) const
+{
+    if(!visitIndexDistance(flann_helper.getIndexDistance(),
+                           CastVotesVisitor{*this, features, distance, voting, flann_helper, flann_exact_match}))
+        throw RuntimeException("invalid distance type for casting votes");
+}
+
+struct Codebook::CascadeVisitor
+{
+    const Codebook &codebook;
+    const flann::Matrix<float> &queries;
+    const std::vector<std::shared_ptr<Codeword> > &codewords;
+    const FlannHelper &flannHelper;
+    bool flannExactMatch;
+    ActivationResult &activation;
+
+    template<typename T>
+    void operator()(T)
+    {
+        codebook.activateBatch(queries, codewords, *flannHelper.getIndex<T>(), flannExactMatch, omp_get_max_threads(), activation);
+    }
+};
+
+void Codebook::activateFeatures(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance,
+                                const FlannHelper &flann_helper, const bool flann_exact_match, ActivationResult &activation) const
+{
+    // with a class cascade, the nearest neighbors and threshold activations only search the candidate classes
+    if(flann_helper.hasClassCascade() && !isEmpty() && !features->empty() &&
+            (m_activation_type == ActivationKNN || m_activation_type == ActivationThreshold))
+    {
+        const int source_dim = (int)features->at(0).descriptor.size();
+        const std::vector<int> *partial_plan = m_use_partial_shot ? &getPartialShotPlan(source_dim) : 0;
+        std::vector<float> query_data;
+        flann::Matrix<float> queries;
+        if(copyQueries(*features, partial_plan, source_dim, query_data, queries) &&
+                activateCascade(queries, flann_helper, flann_exact_match, activation))
+            return;
+    }
+
+    if(!visitIndexDistance(flann_helper.getIndexDistance(),
+                           ActivateFeaturesVisitor{*this, features, distance, flann_helper, flann_exact_match, activation}))
+        throw RuntimeException("invalid distance type for casting votes");
+}
+
 template
 void Codebook::activate<flann::L2<float> >(const std::vector<std::shared_ptr<Codeword> >& codewords,
-const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+const FeatureStore& features,
 const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
-const Distance* distance, flann::Index<flann::L2<float>> &index,
+const Distance* distance, KnnIndex<flann::L2<float>> &index,
 const bool flann_exact_match);
 
 template
 void Codebook::activate<flann::ChiSquareDistance<float> >(const std::vector<std::shared_ptr<Codeword> >& codewords,
-const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+const FeatureStore& features,
 const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
-const Distance* distance, flann::Index<flann::ChiSquareDistance<float>> &index,
+const Distance* distance, KnnIndex<flann::ChiSquareDistance<float>> &index,
 const bool flann_exact_match);
 
 template
 void Codebook::activate<flann::HellingerDistance<float> >(const std::vector<std::shared_ptr<Codeword> >& codewords,
-const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+const FeatureStore& features,
 const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
-const Distance* distance, flann::Index<flann::HellingerDistance<float>> &index,
+const Distance* distance, KnnIndex<flann::HellingerDistance<float>> &index,
 const bool flann_exact_match);
 
 template
 void Codebook::activate<flann::HistIntersectionDistance<float> >(const std::vector<std::shared_ptr<Codeword> >& codewords,
-const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+const FeatureStore& features,
+const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
+const Distance* distance, KnnIndex<flann::HistIntersectionDistance<float>> &index,
+const bool flann_exact_match);
+
+template
+void Codebook::activate<BinaryHamming<float> >(const std::vector<std::shared_ptr<Codeword> >& codewords,
+const FeatureStore& features,
 const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
-const Distance* distance, flann::Index<flann::HistIntersectionDistance<float>> &index,
+const Distance* distance, KnnIndex<BinaryHamming<float>> &index,
 const bool flann_exact_match);
 
 
 template<typename T>
 void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords,
-                        const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+                        const FeatureStore& features,
                         const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
-                        const Distance* distance, flann::Index<T> &index, const bool flann_exact_match)
+                        const Distance* distance, KnnIndex<T> &index, const bool flann_exact_match)
 {
-    LOG_ASSERT(features.size() == boundingBoxes.size());
+    const std::vector<unsigned> classIds = features.getClassIds();
+    LOG_ASSERT(classIds.size() == boundingBoxes.size());
+
+    const int numThreads = m_activation_threads > 0 ? m_activation_threads : omp_get_max_threads();
 
     // for every class
     LOG_INFO("Starting step 1");
     int tmp_cnt = 0;
+    // with direct assignment the features of the store belong to the last codewords, models added to a trained
+    // codebook have their codewords appended to the existing ones
     int global_feature_counter = 0;
-    for (std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >::const_iterator it = features.begin();
-         it != features.end(); it++)
+    if(m_directly_assign_codewords)
+        global_feature_counter = std::max((int)codewords.size() - (int)features.getNumFeatures(), 0);
+    for (unsigned classId : classIds)
     {
-        LOG_INFO("Processing class " << (tmp_cnt+1) << " of " << features.size());
+        LOG_INFO("Processing class " << (tmp_cnt+1) << " of " << classIds.size());
         tmp_cnt++;
-        unsigned classId = it->first;
-        const std::vector<pcl::PointCloud<ISMFeature>::Ptr>& classModelFeatures = it->second;
+        const std::vector<pcl::PointCloud<ISMFeature>::Ptr> classModelFeatures = features.loadClass(classId);
 
         std::map<unsigned, std::vector<Utils::BoundingBox> >::const_iterator bbIt = boundingBoxes.find(classId);
         if (bbIt == boundingBoxes.end()) {
@@ -108,132 +416,111 @@ void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords
             continue;
         }
 
-        pcl::PointCloud<ISMFeature> accumulatedFeatures;
-        std::map<int, int> allActivatedCodewords; // TODO VS: refactor to std::vector<int> (second argument of map is never read)
+        // features that were activated for this class before, only when models are added to a trained codebook
+        const int previousFeatures = m_classSigmas.find(classId) == m_classSigmas.end() ? 0 : getNumOfFeaturesForClass(classId);
 
-        // for every model in the class
-//#pragma omp parallel for
+        // the features of the class in model order, each with the index of its model
+        pcl::PointCloud<ISMFeature> accumulatedFeatures;
+        std::vector<int> featureModels;
         for (int i = 0; i < (int)classModelFeatures.size(); i++)
         {
-            const Utils::BoundingBox& boundingBox = boundingBoxesClass[i];
-            pcl::PointCloud<ISMFeature>::Ptr modelFeatures = classModelFeatures[i];
-
-            // for every feature in the model
-            //#pragma omp parallel for shared(keypoints, descriptors, codebook, modelCenter, boundingBox)
-            for (int j = 0; j < (int)modelFeatures->size(); j++)
+            accumulatedFeatures.insert(accumulatedFeatures.end(), classModelFeatures[i]->begin(), classModelFeatures[i]->end());
+            featureModels.insert(featureModels.end(), classModelFeatures[i]->size(), i);
+        }
+        const int numFeatures = (int)accumulatedFeatures.size();
+
+        // all descriptors of the class in one contiguous buffer for the index search and the class variance
+        const int dim = numFeatures > 0 ? (int)accumulatedFeatures.at(0).descriptor.size() : 0;
+        std::vector<float> query_data;
+        flann::Matrix<float> queries;
+        if (!copyQueries(accumulatedFeatures, 0, dim, query_data, queries))
+            throw RuntimeException("invalid descriptor size, unable to activate codewords");
+
+        // activate codewords with all features of the class
+        ActivationResult activation;
+        activateTraining(accumulatedFeatures, queries, codewords, distance, index, flann_exact_match, global_feature_counter,
+                         numThreads, activation);
+        global_feature_counter += numFeatures; // count how many features have been processed
+
+        // each thread creates the distribution entries of a contiguous range of features, the fragments are merged
+        // in feature order, so the votes of every entry are in the same order as in a serial activation
+        const int numFragments = std::max(std::min(numThreads, numFeatures), 1);
+        std::vector<distribution_t> fragments(numFragments);
+#pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+        for (int f = 0; f < numFragments; f++)
+        {
+            distribution_t &fragment = fragments[f];
+            const int begin = (int)((long long)numFeatures * f / numFragments);
+            const int end = (int)((long long)numFeatures * (f + 1) / numFragments);
+            for (int j = begin; j < end; j++)
             {
-                const ISMFeature& feature = modelFeatures->at(j);
+                const ISMFeature& feature = accumulatedFeatures.at(j);
+                const Utils::BoundingBox& boundingBox = boundingBoxesClass[featureModels[j]];
 
-//#pragma omp critical
+                // for every activated codeword
+                for (int k = activation.offsets[j]; k < activation.offsets[j + 1]; k++)
                 {
-                    accumulatedFeatures.push_back(feature);
-                }
+                    if (activation.codewordIndices[k] < 0)
+                        continue;
+                    const std::shared_ptr<Codeword>& codeword = codewords[activation.codewordIndices[k]];
 
-                // activate codeword with the current feature
-                std::vector<std::shared_ptr<Codeword> > activatedCodewords;
-                if(m_activationStrategy->getType() == "KNN")
-                {
-                    // features and codewords have same order in their lists
-                    // if k == 1 and no clustering is used, every feature activates its own codeword
-                    if(m_directly_assign_codewords)
-                    {
-                        activatedCodewords.push_back(codewords[global_feature_counter]);
-                    }
-                    else
-                    {
-                        ActivationStrategyKNN* asknn = dynamic_cast<ActivationStrategyKNN*>(m_activationStrategy);
-                        activatedCodewords = asknn->activateKNN(feature, codewords, index, flann_exact_match);
-                    }
-                }
-                else if(m_activationStrategy->getType() == "INN")
-                {
-                    ActivationStrategyINN* asinn = dynamic_cast<ActivationStrategyINN*>(m_activationStrategy);
-                    activatedCodewords = asinn->activateINN(feature, codewords, index, flann_exact_match);
-                }
-                else
-                {
-                    activatedCodewords = m_activationStrategy->operate(feature, codewords, distance);
-                }
+                    // if the codeword has not yet been activated, create a new distribution entry
+                    std::shared_ptr<CodewordDistribution>& entry = fragment[codeword->getId()];
+                    if (!entry)
+                        entry = std::shared_ptr<CodewordDistribution>(new CodewordDistribution);
 
-                // for every activated codeword
-                for (int k = 0; k < (int)activatedCodewords.size(); k++)
-                {
-                    const std::shared_ptr<Codeword>& codeword = activatedCodewords[k];
-
-//#pragma omp critical
-                    {
-                        allActivatedCodewords[codeword->getId()] = 1;
-
-                        // if the codeword has not yet been activated, create a new distribution entry
-                        if (m_distribution.find(codeword->getId()) == m_distribution.end())
-                        {
-                            m_distribution[codeword->getId()] =
-                                    std::shared_ptr<CodewordDistribution>(new CodewordDistribution);
-                        }
-
-                        // add the codeword to the distribution
-                        m_distribution[codeword->getId()]->addCodeword(codeword, feature, classId, boundingBox);
-                    }
+                    // add the codeword to the distribution
+                    entry->addCodeword(codeword, feature, classId, boundingBox);
                 }
-
-                global_feature_counter++; // count how many features have been processed
             }
         }
 
-        // distribution was changed, fill list with codewords
-        m_codewords.clear();
-        for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
-            m_codewords.push_back(it->second->getCodeword());
-
-        // compute the mean distance between all class-specific features and their activated codewords
-        float mean = 0;     // mean of distances between all features and all activated codewords inside the class
-        int meanCount = 0;
-        for (int i = 0; i < accumulatedFeatures.size(); i++)
+        std::map<int, int> allActivatedCodewords; // TODO VS: refactor to std::vector<int> (second argument of map is never read)
+        for (distribution_t &fragment : fragments)
         {
-            const ISMFeature& feature = accumulatedFeatures.at(i);
-
-            for (std::map<int, int>::const_iterator it = allActivatedCodewords.begin(); it != allActivatedCodewords.end(); it++)
+            for (distribution_t::iterator it = fragment.begin(); it != fragment.end(); it++)
             {
-                int id = it->first;
-                const std::shared_ptr<Codeword>& codeword = getCodewordById(id);
+                allActivatedCodewords[it->first] = 1;
 
-                mean += (*distance)(feature.descriptor, codeword->getData());
-                meanCount++;
+                distribution_t::iterator existing = m_distribution.find(it->first);
+                if (existing == m_distribution.end())
+                    m_distribution[it->first] = it->second;
+                else
+                    existing->second->addDistribution(it->second);
             }
+            fragment.clear();
         }
 
-        mean /= meanCount;
-
-        // compute the corresponding class-specific variance
-        float variance = 0;
-        for (int i = 0; i < accumulatedFeatures.size(); i++)
-        {
-            const ISMFeature& feature = accumulatedFeatures.at(i);
+        // distribution was changed, fill list with codewords
+        m_recall_codewords.reset();
+        m_codewords.clear();
+        for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+            m_codewords.push_back(it->second->getCodeword());
 
-            for (std::map<int, int>::const_iterator it = allActivatedCodewords.begin(); it != allActivatedCodewords.end(); it++) {
-                int id = it->first;
-                const std::shared_ptr<Codeword>& codeword = getCodewordById(id);
+        std::vector<std::shared_ptr<Codeword> > classCodewords;
+        classCodewords.reserve(allActivatedCodewords.size());
+        for (std::map<int, int>::const_iterator it = allActivatedCodewords.begin(); it != allActivatedCodewords.end(); it++)
+            classCodewords.push_back(getCodewordById(it->first));
 
-                float dist = (*distance)(feature.descriptor, codeword->getData());  // current distance between feature and one of the codewords
-                float diff = dist - mean;  // distance of distance
+        // variance of the distances between all class-specific features and their activated codewords
+        float variance = computeClassVariance(queries, classCodewords, distance, numThreads, classId);
 
-                variance += diff * diff;
-            }
+        // store class-specific variance, pooled with the variance of previously activated features of the class
+        if(previousFeatures > 0)
+        {
+            const int newFeatures = (int)accumulatedFeatures.size();
+            variance = (previousFeatures * m_classSigmas[classId] + newFeatures * variance) / (previousFeatures + newFeatures);
         }
-        variance /= meanCount - 1;
-
-        // store class-specific variance
         m_classSigmas[classId] = variance;
     }
 
     // remove all codewords that have more than 1 vote in KNN activation with k = 1 or in INN
     bool clean_up = false;
-    if(m_activationStrategy->getType() == "KNN")
+    if(m_activation_type == ActivationKNN)
     {
-        ActivationStrategyKNN* asknn = dynamic_cast<ActivationStrategyKNN*>(m_activationStrategy);
-        if(asknn->getK() == 1) clean_up = true;
+        if(m_activation_knn->getK() == 1) clean_up = true;
     }
-    else if(m_activationStrategy->getType() == "INN")
+    else if(m_activation_type == ActivationINN)
     {
         clean_up = true;
     }
@@ -251,6 +538,18 @@ void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords
         m_distribution = clean_distribution;
     }
 
+    computeWeights(distance);
+
+    LOG_INFO("Size of distribution at the end of training: " << m_distribution.size());
+}
+
+void Codebook::computeWeights(const Distance* distance)
+{
+    // the terms are computed from the complete distribution
+    m_term1.clear();
+    m_term2.clear();
+    m_term3.clear();
+
     LOG_INFO("Starting step 2");
     // compute weights for each codeword (center weights)
     for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++) {
@@ -326,7 +625,7 @@ void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords
         const std::shared_ptr<Codeword>& codeword = entry->getCodeword();
 
         // get the number of words voting for a class
-        const std::vector<unsigned>& classIds = entry->getClassIds();
+        const FlatArray<unsigned> classIds = entry->getClassIds();
         for (int k = 0; k < (int)classIds.size(); k++)
         {
             unsigned classId = classIds[k];
@@ -392,30 +691,158 @@ void Codebook::activate(const std::vector<std::shared_ptr<Codeword> >& codewords
         entry->setClassWeights(classWeights);
     }
 
-    LOG_INFO("Size of distribution at the end of training: " << m_distribution.size());
+    // search structures of the activation strategy are built on the final codewords and saved with the codebook
+    std::vector<std::shared_ptr<Codeword> > finalCodewords;
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        finalCodewords.push_back(it->second->getCodeword());
+    m_activationStrategy->prepare(finalCodewords, distance);
+
+    m_dense_tables_valid = false;
+    m_codeword_entries_valid = false;
+    m_recall_codewords.reset();
+    m_activation_cache.clear();
+}
+
+int Codebook::prune(const flann::Matrix<float>& queries, const std::vector<unsigned>& query_classes,
+                    const std::vector<int>& query_codeword_ids, const Distance* distance,
+                    const FlannHelper& flann_helper, const bool flann_exact_match)
+{
+    if (!usePruning() || m_distribution.empty())
+        return 0;
+    LOG_ASSERT(query_classes.size() == queries.rows && query_codeword_ids.size() == queries.rows);
+
+    // activate the nearest codewords with the queries, the codeword of a query is excluded from its neighbors, so
+    // that the queries act as held out data; a hit is correct in the share of the votes of the codeword that go to
+    // the class of the query
+    const std::vector<int>& rowIds = flann_helper.getCodewordIds();
+    const int k = std::max(m_prune_neighbors, 1);
+    std::unordered_map<int, std::pair<float, float> > hits; // codeword id to correct and wrong activations
+    if (queries.rows > 0 && !rowIds.empty())
+    {
+        std::vector<std::vector<int> > indices;
+        std::vector<std::vector<float> > distances;
+        flann_helper.knnSearch(queries, indices, distances, std::min(k + 1, (int)rowIds.size()), flann_exact_match,
+                               omp_get_max_threads());
+        for (int q = 0; q < (int)queries.rows; q++)
+        {
+            int numHits = 0;
+            for (int index : indices[q])
+            {
+                if (numHits == k)
+                    break;
+                if (index < 0 || index >= (int)rowIds.size() || rowIds[index] == query_codeword_ids[q])
+                    continue;
+                numHits++;
+
+                distribution_t::const_iterator it = m_distribution.find(rowIds[index]);
+                if (it == m_distribution.end())
+                    continue;
+                const float share = it->second->getNumVotesForClass(query_classes[q]) / (float)it->second->getNumVotes();
+                std::pair<float, float> &codewordHits = hits[it->first];
+                codewordHits.first += share;
+                codewordHits.second += 1 - share;
+            }
+        }
+    }
+
+    // the utility is the purity of the voted classes, one minus their normalized entropy, times the ratio of
+    // correct and wrong activations
+    const int numClasses = (int)getClasses().size();
+    struct Utility
+    {
+        float utility;
+        int id;
+        int votes;
+    };
+    std::vector<Utility> utilities;
+    utilities.reserve(m_distribution.size());
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+    {
+        const std::shared_ptr<CodewordDistribution>& entry = it->second;
+        const int numVotes = entry->getNumVotes();
+        float purity = 1;
+        if (numClasses > 1 && numVotes > 0)
+        {
+            float entropy = 0;
+            for (unsigned classId : entry->getDistinctClassIds())
+            {
+                const float p = entry->getNumVotesForClass(classId) / (float)numVotes;
+                if (p > 0)
+                    entropy -= p * std::log(p);
+            }
+            purity = 1 - entropy / std::log((float)numClasses);
+        }
+
+        std::unordered_map<int, std::pair<float, float> >::const_iterator hit = hits.find(it->first);
+        const float correct = hit == hits.end() ? 0 : hit->second.first;
+        const float wrong = hit == hits.end() ? 0 : hit->second.second;
+        Utility utility = {purity * (1 + correct) / (1 + wrong), it->first, numVotes};
+        utilities.push_back(utility);
+    }
+    std::stable_sort(utilities.begin(), utilities.end(), [](const Utility &a, const Utility &b)
+    {
+        return a.utility > b.utility;
+    });
+
+    // keep the most useful codewords within the size and vote budgets, the most useful one is always kept
+    std::vector<int> removed;
+    int numKept = 0;
+    long long numVotes = 0;
+    for (const Utility &utility : utilities)
+    {
+        if ((m_prune_target_size > 0 && numKept >= m_prune_target_size) ||
+                (m_prune_vote_budget > 0 && numKept > 0 && numVotes + utility.votes > m_prune_vote_budget))
+        {
+            removed.push_back(utility.id);
+        }
+        else
+        {
+            numKept++;
+            numVotes += utility.votes;
+        }
+    }
+    if (removed.empty())
+        return 0;
+
+    LOG_INFO("pruning " << removed.size() << " of " << m_distribution.size() << " codewords, " << numKept <<
+             " codewords with " << numVotes << " votes are kept");
+    for (int id : removed)
+        m_distribution.erase(id);
+
+    m_recall_codewords.reset();
+    m_codewords.clear();
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        m_codewords.push_back(it->second->getCodeword());
+
+    computeWeights(distance);
+    return (int)removed.size();
 }
 
 
 template
 void Codebook::castVotes<flann::L2<float> >(pcl::PointCloud<ISMFeature>::ConstPtr features,
-    const Distance* distance, Voting& voting, flann::Index<flann::L2<float> > &index, const bool flann_exact_match) const;
+    const Distance* distance, Voting& voting, KnnIndex<flann::L2<float> > &index, const bool flann_exact_match) const;
 
 template
 void Codebook::castVotes<flann::ChiSquareDistance<float> >(pcl::PointCloud<ISMFeature>::ConstPtr features,
-    const Distance* distance, Voting& voting, flann::Index<flann::ChiSquareDistance<float> > &index, const bool flann_exact_match) const;
+    const Distance* distance, Voting& voting, KnnIndex<flann::ChiSquareDistance<float> > &index, const bool flann_exact_match) const;
 
 template
 void Codebook::castVotes<flann::HellingerDistance<float> >(pcl::PointCloud<ISMFeature>::ConstPtr features,
-    const Distance* distance, Voting& voting, flann::Index<flann::HellingerDistance<float> > &index, const bool flann_exact_match) const;
+    const Distance* distance, Voting& voting, KnnIndex<flann::HellingerDistance<float> > &index, const bool flann_exact_match) const;
 
 template
 void Codebook::castVotes<flann::HistIntersectionDistance<float> >(pcl::PointCloud<ISMFeature>::ConstPtr features,
-    const Distance* distance, Voting& voting, flann::Index<flann::HistIntersectionDistance<float> > &index, const bool flann_exact_match) const;
+    const Distance* distance, Voting& voting, KnnIndex<flann::HistIntersectionDistance<float> > &index, const bool flann_exact_match) const;
+
+template
+void Codebook::castVotes<BinaryHamming<float> >(pcl::PointCloud<ISMFeature>::ConstPtr features,
+    const Distance* distance, Voting& voting, KnnIndex<BinaryHamming<float> > &index, const bool flann_exact_match) const;
 
 template<typename T>
 void Codebook::castVotes(pcl::PointCloud<ISMFeature>::ConstPtr features,
                          const Distance* distance, Voting& voting,
-                         flann::Index<T> &index, const bool flann_exact_match) const
+                         KnnIndex<T> &index, const bool flann_exact_match) const
 {
     pcl::PointCloud<ISMFeature>::Ptr features_new(new pcl::PointCloud<ISMFeature>());
     pcl::copyPointCloud(*features, *features_new);
@@ -427,176 +854,905 @@ void Codebook::castVotes(pcl::PointCloud<ISMFeature>::ConstPtr features,
 template
 void Codebook::castVotes<flann::L2<float> >(pcl::PointCloud<ISMFeature>::Ptr features,
 const Distance* distance, Voting& voting,
-flann::Index<flann::L2<float> > &index,
+KnnIndex<flann::L2<float> > &index,
 const bool flann_exact_match) const;
 
 template
 void Codebook::castVotes<flann::ChiSquareDistance<float> >(pcl::PointCloud<ISMFeature>::Ptr features,
 const Distance* distance, Voting& voting,
-flann::Index<flann::ChiSquareDistance<float> > &index,
+KnnIndex<flann::ChiSquareDistance<float> > &index,
 const bool flann_exact_match) const;
 
 template
 void Codebook::castVotes<flann::HellingerDistance<float> >(pcl::PointCloud<ISMFeature>::Ptr features,
 const Distance* distance, Voting& voting,
-flann::Index<flann::HellingerDistance<float> > &index,
+KnnIndex<flann::HellingerDistance<float> > &index,
 const bool flann_exact_match) const;
 
 template
 void Codebook::castVotes<flann::HistIntersectionDistance<float> >(pcl::PointCloud<ISMFeature>::Ptr features,
 const Distance* distance, Voting& voting,
-flann::Index<flann::HistIntersectionDistance<float> > &index,
+KnnIndex<flann::HistIntersectionDistance<float> > &index,
+const bool flann_exact_match) const;
+
+template
+void Codebook::castVotes<BinaryHamming<float> >(pcl::PointCloud<ISMFeature>::Ptr features,
+const Distance* distance, Voting& voting,
+KnnIndex<BinaryHamming<float> > &index,
 const bool flann_exact_match) const;
 
 template<typename T>
-void Codebook::castVotes(pcl::PointCloud<ISMFeature>::Ptr features,
-                         const Distance* distance, Voting& voting, flann::Index<T> &index, const bool flann_exact_match) const
+bool Codebook::activateBatch(const flann::Matrix<float> &queries, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                             KnnIndex<T> &index, const bool flann_exact_match, int num_threads, ActivationResult &activation) const
 {
-    // NOTE: refer to http://www.matheboard.de/archive/30610/thread.html
+    // a detection that can be cancelled searches in chunks and stops after the chunk in which it was cancelled,
+    // the queries are independent, so the result is the same
+    const int chunkSize = 4096;
+    const CancellationToken &cancellation = CancellationToken::current();
+    if(cancellation.isCancellable() && (int)queries.rows > chunkSize)
+    {
+        activation.clear();
+        activation.offsets.push_back(0);
+        bool has_distances = true;
+        for(int first = 0; first < (int)queries.rows; first += chunkSize)
+        {
+            CancellationToken::check();
+            const int last = std::min(first + chunkSize, (int)queries.rows);
+            const flann::Matrix<float> chunkQueries(queries[first], last - first, queries.cols, queries.stride);
+            ActivationResult chunk;
+            has_distances = activateChunk(chunkQueries, codewords, index, flann_exact_match, num_threads, chunk);
+            const int base = (int)activation.codewordIndices.size();
+            for(int i = 1; i < (int)chunk.offsets.size(); i++)
+                activation.offsets.push_back(base + chunk.offsets[i]);
+            activation.codewordIndices.insert(activation.codewordIndices.end(), chunk.codewordIndices.begin(), chunk.codewordIndices.end());
+            activation.distances.insert(activation.distances.end(), chunk.distances.begin(), chunk.distances.end());
+        }
+        return has_distances;
+    }
+    return activateChunk(queries, codewords, index, flann_exact_match, num_threads, activation);
+}
 
-    if (isEmpty())
-        return;
+template<typename T>
+bool Codebook::activateChunk(const flann::Matrix<float> &queries, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                             KnnIndex<T> &index, const bool flann_exact_match, int num_threads, ActivationResult &activation) const
+{
+    if(m_activation_type == ActivationKNN)
+    {
+        m_activation_knn->activateKNNBatch(queries, codewords, index, flann_exact_match, num_threads, activation);
+        if(!flann_exact_match && m_recall_sample_rate > 0)
+            sampleRecall<T>(queries, codewords, activation);
+        return true;
+    }
+    else if(m_activation_type == ActivationThreshold)
+    {
+        m_activation_threshold->activateThresholdBatch(queries, codewords, index, flann_exact_match, num_threads, activation);
+        if(!flann_exact_match && m_recall_sample_rate > 0)
+            sampleRecall<T>(queries, codewords, activation);
+        return true;
+    }
+    else
+    {
+        // INN distances refer to the updated queries, not to the original descriptors
+        m_activation_inn->activateINNBatch(queries, codewords, index, flann_exact_match, num_threads, activation);
+        return false;
+    }
+}
 
-    // reduce descriptor for partial shot
-    if(m_use_partial_shot)
+template<typename T>
+void Codebook::sampleRecall(const flann::Matrix<float> &queries, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                            const ActivationResult &activation) const
+{
+    // small codebooks are searched exhaustively by the activation strategies
+    int k;
+    float radius;
+    bool exhaustive;
+    if(m_activation_type == ActivationKNN)
     {
-        int hist_size = 11;
-        std::string desc_type = "SHOT";
-        int shot_length = 352;
-        int cshot_length = 1344;
+        k = m_activation_knn->getK();
+        radius = std::numeric_limits<float>::max();
+        exhaustive = (int)codewords.size() <= k;
+    }
+    else
+    {
+        // without a limit all codewords inside of the radius are expected
+        const int max_neighbors = m_activation_threshold->getMaxNeighbors();
+        k = max_neighbors > 0 ? max_neighbors : std::numeric_limits<int>::max();
+        radius = m_activation_threshold->getThreshold();
+        exhaustive = m_activation_threshold->searchesExhaustively((int)codewords.size());
+    }
+    if(exhaustive)
+        return;
+
+    m_recall_monitor.configure(m_recall_sample_rate, m_recall_max_pending);
+    const std::vector<int> rows = m_recall_monitor.selectSamples((int)queries.rows);
+    if(rows.empty())
+        return;
 
-        // create signature mask in case partial shot is used
-        std::vector<bool> signature_mask = getSignatureMask();
+    std::vector<RecallMonitor::Sample> samples(rows.size());
+    for(int i = 0; i < (int)rows.size(); i++)
+    {
+        const int row = rows[i];
+        samples[i].descriptor.assign(queries[row], queries[row] + queries.cols);
+        samples[i].approximate.assign(activation.codewordIndices.begin() + activation.offsets[row],
+                                      activation.codewordIndices.begin() + activation.offsets[row + 1]);
+    }
 
-        for (int i = 0; i < (int)features->size(); i++)
+    // the search keeps the codewords alive, the codebook may be retrained or reloaded in the meantime
+    std::shared_ptr<const std::vector<std::shared_ptr<Codeword> > > searched = getRecallCodewords(codewords);
+    m_recall_monitor.submit(samples, k, radius, [searched](const float *descriptor, int dim, std::vector<float> &distances)
+    {
+        T dist_func;
+        distances.resize(searched->size());
+        for(int j = 0; j < (int)searched->size(); j++)
         {
-            const ISMFeature& feature = features->at(i);
-            if(feature.descriptor.size() > shot_length)
-            {
-                desc_type = "CSHOT";
-            }
+            // compressed codewords without their descriptor are never expected
+            const std::vector<float> &data = (*searched)[j]->getData();
+            distances[j] = (int)data.size() == dim ? dist_func(descriptor, data.begin(), dim) : std::numeric_limits<float>::max();
+        }
+    });
+}
 
-            // prepare partial descriptor
-            std::vector<float> partial_descriptor;
+std::shared_ptr<const std::vector<std::shared_ptr<Codeword> > > Codebook::getRecallCodewords(
+        const std::vector<std::shared_ptr<Codeword> > &codewords) const
+{
+    if (&codewords != &getCodewords())
+        return std::make_shared<const std::vector<std::shared_ptr<Codeword> > >(codewords);
 
-            // handle SHOT or geometrical part of CSHOT
-            for (int j = 0; j < shot_length; j++)
-            {
-                int signature_index = (j/hist_size);
-                if(signature_mask.at(signature_index))
-                {
-                    partial_descriptor.push_back(feature.descriptor[j]);
-                    //std::cout << j << " ";
-                }
-                else
-                {
-                    //std::cout << std::endl << "not using signature index: " << signature_index << std::endl;
-                    j += (hist_size-1); // add 1 less because loop also adds 1
-                }
-            }
+    std::lock_guard<std::mutex> lock(m_detection_mutex);
+    if (!m_recall_codewords)
+        m_recall_codewords = std::make_shared<const std::vector<std::shared_ptr<Codeword> > >(codewords);
+    return m_recall_codewords;
+}
 
-            if(desc_type == "CSHOT")
-            {
-                // handle color part of cshot
-                hist_size = 31;
-                for (int j = shot_length; j < feature.descriptor.size(); j++)
-                {
-                    int signature_index = ((j-shot_length)/hist_size);
-                    if(signature_mask.at(signature_index))
-                    {
-                        partial_descriptor.push_back(feature.descriptor[j]);
-                    }
-                    else
-                    {
-                        //std::cout << std::endl << "not using signature index: " << signature_index << std::endl;
-                        j += (hist_size-1); // add 1 less because loop also adds 1
-                    }
-                }
-            }
+template<typename T>
+void Codebook::activateTraining(const pcl::PointCloud<ISMFeature> &features, const flann::Matrix<float> &queries,
+                                const std::vector<std::shared_ptr<Codeword> > &codewords,
+                                const Distance* distance, KnnIndex<T> &index, const bool flann_exact_match,
+                                int first_codeword, int num_threads, ActivationResult &activation) const
+{
+    const int num_features = (int)features.size();
+    activation.clear();
+    activation.offsets.resize(num_features + 1, 0);
+    if (num_features == 0)
+        return;
 
-            features->at(i).descriptor = partial_descriptor;
-            //std::cout << "descriptor has size: " << feature.descriptor.size() << std::endl;
+    if(m_activation_type == ActivationKNN && m_directly_assign_codewords)
+    {
+        // features and codewords have same order in their lists
+        // if k == 1 and no clustering is used, every feature activates its own codeword
+        activation.codewordIndices.resize(num_features);
+        for (int i = 0; i < num_features; i++)
+        {
+            activation.codewordIndices[i] = first_codeword + i < (int)codewords.size() ? first_codeword + i : -1;
+            activation.offsets[i + 1] = i + 1;
         }
     }
-
-    std::vector<std::shared_ptr<CodewordDistribution> > activatedEntries;
-    std::map<unsigned, std::vector<int> > featureIndizes;
-
-    const std::vector<std::shared_ptr<Codeword>> codewords = getCodewords();
-
-
-#pragma omp parallel for
-    for (int i = 0; i < (int)features->size(); i++)
+    else if(m_activation_type != ActivationOther)
     {
-        const ISMFeature& feature = features->at(i);
-
-        // activate codeword with keypoint
-        std::vector<std::shared_ptr<Codeword> > activatedCodewords;
-        if(m_activationStrategy->getType() == "KNN")
+        // all descriptors of the class are searched at once
+        activateBatch(queries, codewords, index, flann_exact_match, num_threads, activation);
+    }
+    else
+    {
+        std::map<int, int> codewordIndexById;
+        for (int i = 0; i < (int)codewords.size(); i++)
+            codewordIndexById[codewords[i]->getId()] = i;
+
+        std::vector<std::vector<std::shared_ptr<Codeword> > > activatedPerFeature(num_features);
+        m_activationStrategy->prepare(codewords, distance);
+#pragma omp parallel for num_threads(num_threads)
+        for (int i = 0; i < num_features; i++)
         {
-            ActivationStrategyKNN* asknn = dynamic_cast<ActivationStrategyKNN*>(m_activationStrategy);
-            activatedCodewords = asknn->activateKNN(feature, codewords, index, flann_exact_match);
+            activatedPerFeature[i] = m_activationStrategy->operate(features.at(i), codewords, distance);
         }
-        else if(m_activationStrategy->getType() == "INN")
+
+        for (int i = 0; i < num_features; i++)
         {
-            ActivationStrategyINN* asinn = dynamic_cast<ActivationStrategyINN*>(m_activationStrategy);
-            activatedCodewords = asinn->activateINN(feature, codewords, index, flann_exact_match);
+            for (const std::shared_ptr<Codeword>& codeword : activatedPerFeature[i])
+                activation.codewordIndices.push_back(codewordIndexById[codeword->getId()]);
+            activation.offsets[i + 1] = (int)activation.codewordIndices.size();
         }
-        else
+    }
+}
+
+float Codebook::computeClassVariance(const flann::Matrix<float> &features, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                                     const Distance* distance, int num_threads, unsigned seed) const
+{
+    const int num_features = (int)features.rows;
+    const int num_codewords = (int)codewords.size();
+    const int dim = (int)features.cols;
+    const long long num_pairs = (long long)num_features * num_codewords;
+
+    // the codeword descriptors in one contiguous buffer, each distance is computed by the vectorized kernel
+    std::vector<float> codewordData((size_t)num_codewords * dim);
+    for (int j = 0; j < num_codewords; j++)
+    {
+        const std::vector<float> &data = codewords[j]->getData();
+        if ((int)data.size() != dim)
+            throw RuntimeException("descriptor size of the features does not match the codewords");
+        std::copy(data.begin(), data.end(), codewordData.begin() + (size_t)j * dim);
+    }
+
+    if (m_sigma_samples > 0 && num_pairs > m_sigma_samples)
+    {
+        // distances of uniformly drawn feature and codeword pairs, the same pairs are drawn for any number of threads
+        std::mt19937_64 rng(seed);
+        std::uniform_int_distribution<long long> pairDist(0, num_pairs - 1);
+        std::vector<long long> pairs(m_sigma_samples);
+        for (long long &pair : pairs)
+            pair = pairDist(rng);
+
+        std::vector<double> distances(pairs.size());
+#pragma omp parallel for num_threads(num_threads)
+        for (int i = 0; i < (int)pairs.size(); i++)
         {
-            activatedCodewords = m_activationStrategy->operate(feature, codewords, distance);
+            const int feature = (int)(pairs[i] / num_codewords);
+            const int codeword = (int)(pairs[i] % num_codewords);
+            distances[i] = (*distance)(features[feature], codewordData.data() + (size_t)codeword * dim, dim);
         }
 
-        // cast votes for each activated codeword
-        for (int j = 0; j < (int)activatedCodewords.size(); j++)
+        const double n = (double)distances.size();
+        double mean = 0;
+        for (double dist : distances)
+            mean += dist;
+        mean /= n;
+        double m2 = 0;
+        double m4 = 0;
+        for (double dist : distances)
         {
-            const std::shared_ptr<Codeword>& codeword = activatedCodewords[j];
+            const double delta2 = (dist - mean) * (dist - mean);
+            m2 += delta2;
+            m4 += delta2 * delta2;
+        }
+        const double variance = m2 / (n - 1);
 
-            // m_distribution maps a codeword id to its corresponding vote distribution
-            if (m_distribution.find(codeword->getId()) == m_distribution.end())
-            {
-                LOG_WARN("codeword not found in distribution, skipping");
-                continue;
-            }
+        // 95 % confidence interval of the sample variance, its standard error follows from the fourth central moment
+        const double varianceError = std::sqrt(std::max(m4 / n - variance * variance * (n - 3) / (n - 1), 0.0) / n);
+        LOG_INFO("class variance " << variance << " +- " << 1.96 * varianceError << " (95 % confidence) from " <<
+                 distances.size() << " of " << num_pairs << " distances");
+        return (float)variance;
+    }
 
-            std::shared_ptr<CodewordDistribution> entry = m_distribution.find(codeword->getId())->second;
+    // single pass over all pairs (Welford), the partial results of the threads are combined in feature order
+    const int numFragments = std::max(std::min(num_threads, num_features), 1);
+    std::vector<double> fragmentMean(numFragments, 0);
+    std::vector<double> fragmentM2(numFragments, 0);
+    std::vector<long long> fragmentCount(numFragments, 0);
+#pragma omp parallel for num_threads(num_threads) schedule(static, 1)
+    for (int f = 0; f < numFragments; f++)
+    {
+        double mean = 0;
+        double m2 = 0;
+        long long count = 0;
+        const int begin = (int)((long long)num_features * f / numFragments);
+        const int end = (int)((long long)num_features * (f + 1) / numFragments);
+        for (int i = begin; i < end; i++)
+        {
+            const float *feature = features[i];
+            for (int j = 0; j < num_codewords; j++)
+            {
+                float dist = (*distance)(feature, codewordData.data() + (size_t)j * dim, dim);  // current distance between feature and one of the codewords
+                count++;
+                double delta = dist - mean;
+                mean += delta / count;
+                m2 += delta * (dist - mean);
+            }
+        }
+        fragmentMean[f] = mean;
+        fragmentM2[f] = m2;
+        fragmentCount[f] = count;
+    }
 
-            if (!entry.get()) {
-                LOG_ERROR("invalid entry, skipping");
-                continue;
+    double mean = 0;     // mean of distances between all features and all activated codewords inside the class
+    double m2 = 0;       // sum of squared differences from the running mean
+    long long meanCount = 0;
+    for (int f = 0; f < numFragments; f++)
+    {
+        if (fragmentCount[f] == 0)
+            continue;
+        const long long count = meanCount + fragmentCount[f];
+        double delta = fragmentMean[f] - mean;
+        mean += delta * fragmentCount[f] / count;
+        m2 += fragmentM2[f] + delta * delta * meanCount * fragmentCount[f] / count;
+        meanCount = count;
+    }
+    return (float)(m2 / (meanCount - 1));
+}
+
+template<typename T>
+bool Codebook::activateCached(const pcl::PointCloud<ISMFeature> &features, const flann::Matrix<float> &queries, const Distance &distance,
+                              const std::vector<std::shared_ptr<Codeword> > &codewords, KnnIndex<T> &index,
+                              const bool flann_exact_match, ActivationResult &activation) const
+{
+    const int num_features = (int)queries.rows;
+    const int dim = (int)queries.cols;
+
+    // features that are close to a feature of a previous frame reuse its activation
+    std::vector<std::vector<int> > cachedIndices(num_features);
+    std::vector<std::vector<float> > cachedDistances(num_features);
+    std::vector<int> missing;
+    {
+        std::lock_guard<std::mutex> lock(m_detection_mutex);
+        m_activation_cache.configure(m_activation_cache_cell_size, m_activation_cache_signature_step,
+                                     m_activation_cache_tolerance, (size_t)m_activation_cache_memory * 1024 * 1024);
+        m_activation_cache.setNumCodewords((int)codewords.size());
+
+        for (int i = 0; i < num_features; i++)
+        {
+            const ISMFeature& feature = features.at(i);
+            if (!m_activation_cache.lookup(queries[i], dim, feature.x, feature.y, feature.z, distance,
+                                           cachedIndices[i], cachedDistances[i]))
+                missing.push_back(i);
+        }
+    }
+
+    // search the index only for the remaining features
+    ActivationResult missingActivation;
+    bool has_distances = m_activation_type != ActivationINN;
+    if (!missing.empty())
+    {
+        std::vector<float> missing_data;
+        flann::Matrix<float> missing_queries;
+        selectQueries(queries, missing, missing_data, missing_queries);
+        has_distances = activateBatch(missing_queries, codewords, index, flann_exact_match, omp_get_max_threads(), missingActivation);
+    }
+
+    // merge both results in feature order and store the new activations, the index is searched without the lock
+    std::lock_guard<std::mutex> lock(m_detection_mutex);
+    activation.clear();
+    activation.offsets.resize(num_features + 1, 0);
+    int next_missing = 0;
+    for (int i = 0; i < num_features; i++)
+    {
+        if (next_missing < (int)missing.size() && missing[next_missing] == i)
+        {
+            const int begin = missingActivation.offsets[next_missing];
+            const int count = missingActivation.offsets[next_missing + 1] - begin;
+            activation.codewordIndices.insert(activation.codewordIndices.end(), missingActivation.codewordIndices.begin() + begin,
+                                              missingActivation.codewordIndices.begin() + begin + count);
+            activation.distances.insert(activation.distances.end(), missingActivation.distances.begin() + begin,
+                                        missingActivation.distances.begin() + begin + count);
+
+            const ISMFeature& feature = features.at(i);
+            m_activation_cache.insert(queries[i], dim, feature.x, feature.y, feature.z,
+                                      missingActivation.codewordIndices.data() + begin, missingActivation.distances.data() + begin, count);
+            next_missing++;
+        }
+        else
+        {
+            activation.codewordIndices.insert(activation.codewordIndices.end(), cachedIndices[i].begin(), cachedIndices[i].end());
+            activation.distances.insert(activation.distances.end(), cachedDistances[i].begin(), cachedDistances[i].end());
+        }
+        activation.offsets[i + 1] = (int)activation.codewordIndices.size();
+    }
+
+    return has_distances;
+}
+
+int Codebook::groupSceneDescriptors(const flann::Matrix<float> &queries, std::vector<int> &groupOf, std::vector<int> &representatives) const
+{
+    const int num_features = (int)queries.rows;
+    const int dim = (int)queries.cols;
+    const float step = m_scene_deduplication_step > 0 ? m_scene_deduplication_step : 1e-6f;
+
+    // each descriptor is quantized with the step and hashed
+    std::vector<int> quantized((size_t)num_features * dim);
+    std::vector<size_t> hashes(num_features);
+#pragma omp parallel for
+    for (int i = 0; i < num_features; i++)
+    {
+        const float *descriptor = queries[i];
+        int *cells = quantized.data() + (size_t)i * dim;
+        size_t hash = 14695981039346656037ULL;
+        for (int d = 0; d < dim; d++)
+        {
+            cells[d] = (int)std::floor(descriptor[d] / step);
+            hash = (hash ^ (size_t)(unsigned)cells[d]) * 1099511628211ULL;
+        }
+        hashes[i] = hash;
+    }
+
+    // the first feature of each quantized descriptor represents the group
+    groupOf.resize(num_features);
+    representatives.clear();
+    std::unordered_multimap<size_t, int> groupsByHash;
+    for (int i = 0; i < num_features; i++)
+    {
+        const int *cells = quantized.data() + (size_t)i * dim;
+        int group = -1;
+        auto range = groupsByHash.equal_range(hashes[i]);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            const int *other = quantized.data() + (size_t)representatives[it->second] * dim;
+            if (std::equal(cells, cells + dim, other))
+            {
+                group = it->second;
+                break;
+            }
+        }
+        if (group < 0)
+        {
+            group = (int)representatives.size();
+            representatives.push_back(i);
+            groupsByHash.insert(std::make_pair(hashes[i], group));
+        }
+        groupOf[i] = group;
+    }
+    return (int)representatives.size();
+}
+
+template<typename T>
+void Codebook::castVotes(pcl::PointCloud<ISMFeature>::Ptr features,
+                         const Distance* distance, Voting& voting, KnnIndex<T> &index, const bool flann_exact_match) const
+{
+    // NOTE: refer to http://www.matheboard.de/archive/30610/thread.html
+
+    if (isEmpty())
+        return;
+
+    ActivationResult activation;
+    activateFeatures(features, distance, index, flann_exact_match, activation);
+    castVotes(*features, activation, voting);
+}
+
+template<typename T>
+void Codebook::activateFeatures(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance, KnnIndex<T> &index,
+                                const bool flann_exact_match, ActivationResult &activation) const
+{
+    activation.clear();
+    activation.offsets.resize(features->size() + 1, 0);
+    if (isEmpty())
+        return;
+
+    // partial shot descriptors are gathered into the query matrix with the precomputed plan, the detected features
+    // are shared with the caller and are not changed
+    const std::vector<int> *partial_plan = 0;
+    if(m_use_partial_shot && !features->empty())
+        partial_plan = &getPartialShotPlan(features->at(0).descriptor.size());
+
+    const std::vector<std::shared_ptr<Codeword>> &codewords = getCodewords();
+    const int num_features = (int)features->size();
+
+    // gather all descriptors in one contiguous query matrix, the activation strategies use the features directly
+    // unless partial descriptors are needed
+    const int source_dim = num_features > 0 ? (int)features->at(0).descriptor.size() : 0;
+    const int dim = partial_plan ? (int)partial_plan->size() : source_dim;
+    const bool use_index = m_activation_type != ActivationOther;
+    std::vector<float> query_data;
+    flann::Matrix<float> queries;
+    if(use_index || partial_plan)
+    {
+        if (!copyQueries(*features, partial_plan, source_dim, query_data, queries))
+        {
+            LOG_ERROR("invalid descriptor size, unable to cast votes");
+            activation.clear();
+            activation.offsets.resize(num_features + 1, 0);
+            return;
+        }
+    }
+
+    // activate codewords with all features, the result maps each feature to its activated codeword indices
+    bool has_distances = false; // true if the activation already provides the descriptor distances
+    if(use_index)
+    {
+        // features with equal quantized descriptors, e.g. on planes, share the activation of a representative
+        std::vector<int> groupOf;
+        std::vector<int> representatives;
+        if(m_use_scene_deduplication && groupSceneDescriptors(queries, groupOf, representatives) < num_features)
+        {
+            const int num_groups = (int)representatives.size();
+            LOG_INFO("activating " << num_groups << " representatives of " << num_features << " features");
+            std::vector<float> representative_data;
+            flann::Matrix<float> representative_queries;
+            selectQueries(queries, representatives, representative_data, representative_queries);
+
+            // the activation cache is keyed on the position
+            pcl::PointCloud<ISMFeature> representativeFeatures;
+            representativeFeatures.resize(num_groups);
+            for (int g = 0; g < num_groups; g++)
+                representativeFeatures.at(g).getVector3fMap() = features->at(representatives[g]).getVector3fMap();
+
+            ActivationResult groupActivation;
+            if(m_use_activation_cache)
+                has_distances = activateCached(representativeFeatures, representative_queries, *distance, codewords, index, flann_exact_match, groupActivation);
+            else
+                has_distances = activateBatch(representative_queries, codewords, index, flann_exact_match, omp_get_max_threads(), groupActivation);
+
+            // the votes are still cast from the keypoint and reference frame of each member
+            activation.clear();
+            activation.offsets.resize(num_features + 1, 0);
+            for (int i = 0; i < num_features; i++)
+            {
+                const int begin = groupActivation.offsets[groupOf[i]];
+                const int end = groupActivation.offsets[groupOf[i] + 1];
+                activation.codewordIndices.insert(activation.codewordIndices.end(), groupActivation.codewordIndices.begin() + begin,
+                                                  groupActivation.codewordIndices.begin() + end);
+                if (has_distances)
+                    activation.distances.insert(activation.distances.end(), groupActivation.distances.begin() + begin,
+                                                groupActivation.distances.begin() + end);
+                activation.offsets[i + 1] = (int)activation.codewordIndices.size();
             }
+        }
+        else if(m_use_activation_cache)
+        {
+            has_distances = activateCached(*features, queries, *distance, codewords, index, flann_exact_match, activation);
+        }
+        else
+        {
+            has_distances = activateBatch(queries, codewords, index, flann_exact_match, omp_get_max_threads(), activation);
+        }
+    }
+    else
+    {
+        std::map<int, int> codewordIndexById;
+        for (int i = 0; i < (int)codewords.size(); i++)
+            codewordIndexById[codewords[i]->getId()] = i;
 
-#pragma omp critical
+        std::vector<std::vector<std::shared_ptr<Codeword> > > activatedPerFeature(num_features);
+        std::vector<std::vector<float> > distancesPerFeature(num_features);
+        {
+            std::lock_guard<std::mutex> lock(m_detection_mutex);
+            m_activationStrategy->prepare(codewords, distance);
+        }
+#pragma omp parallel for
+        for (int i = 0; i < num_features; i++)
+        {
+            if (partial_plan)
             {
-                featureIndizes[entry->getCodewordId()].push_back(i); // maps an activated codeword id to the activating feature index
-                if(featureIndizes[entry->getCodewordId()].size() == 1) // avoids dublicate activated entries
-                {
-                    activatedEntries.push_back(entry);
-                }
+                ISMFeature partial = features->at(i);
+                partial.descriptor.assign(queries[i], queries[i] + dim);
+                activatedPerFeature[i] = m_activationStrategy->operate(partial, codewords, distance, distancesPerFeature[i]);
+            }
+            else
+                activatedPerFeature[i] = m_activationStrategy->operate(features->at(i), codewords, distance, distancesPerFeature[i]);
+        }
+
+        // the strategy reports the distances for all features or for none
+        has_distances = true;
+        for (int i = 0; i < num_features; i++)
+        {
+            for (const std::shared_ptr<Codeword>& codeword : activatedPerFeature[i])
+                activation.codewordIndices.push_back(codewordIndexById[codeword->getId()]);
+            activation.offsets[i + 1] = (int)activation.codewordIndices.size();
+            if (has_distances && distancesPerFeature[i].size() == activatedPerFeature[i].size())
+                activation.distances.insert(activation.distances.end(), distancesPerFeature[i].begin(), distancesPerFeature[i].end());
+            else
+                has_distances = false;
+        }
+    }
+
+    // the distances are computed here unless the activation reported them, e.g. the flann search distances which
+    // are the values of the distance functors, so that votes can be cast several times from one activation
+    if (!has_distances)
+    {
+        activation.distances.assign(activation.codewordIndices.size(), 0.0f);
+#pragma omp parallel for
+        for (int i = 0; i < num_features; i++)
+        {
+            for (int j = activation.offsets[i]; j < activation.offsets[i + 1]; j++)
+            {
+                const int codewordIndex = activation.codewordIndices[j];
+                if (codewordIndex < 0)
+                    activation.distances[j] = 0.0f;
+                else if (query_data.empty())
+                    activation.distances[j] = (*distance)(codewords[codewordIndex]->getData(), features->at(i).descriptor);
+                else
+                    activation.distances[j] = (*distance)(codewords[codewordIndex]->getData().data(), queries[i], dim);
+            }
+        }
+    }
+}
+
+bool Codebook::activateCascade(const flann::Matrix<float> &queries, const FlannHelper &flann_helper, const bool flann_exact_match,
+                               ActivationResult &activation) const
+{
+    const std::vector<unsigned> classes = flann_helper.selectClasses(queries, flann_exact_match, omp_get_max_threads());
+    if(classes.empty())
+        return false;
+
+    // the rows of the class indices are mapped to the rows of the full index, which are the codebook indices
+    const std::vector<std::shared_ptr<Codeword>> &codewords = getCodewords();
+    std::vector<ActivationResult> classActivations;
+    classActivations.reserve(classes.size());
+    for(unsigned classId : classes)
+    {
+        const std::vector<int> *rows = 0;
+        const FlannHelper *classIndex = flann_helper.getClassPartition(classId, rows);
+        if(!classIndex)
+            continue;
+
+        std::vector<std::shared_ptr<Codeword> > classCodewords;
+        classCodewords.reserve(rows->size());
+        for(int row : *rows)
+            classCodewords.push_back(codewords[row]);
+
+        classActivations.push_back(ActivationResult());
+        ActivationResult &result = classActivations.back();
+        visitIndexDistance(classIndex->getIndexDistance(),
+                           CascadeVisitor{*this, queries, classCodewords, *classIndex, flann_exact_match, result});
+        for(int &codewordIndex : result.codewordIndices)
+        {
+            if(codewordIndex >= 0)
+                codewordIndex = (*rows)[codewordIndex];
+        }
+    }
+
+    // codewords with votes of several candidate classes are found in each of their indices, they are activated
+    // once; the nearest neighbors of a feature are the nearest ones over all candidate classes
+    const int num_features = (int)queries.rows;
+    const int k = m_activation_type == ActivationKNN ? m_activation_knn->getK() : 0;
+    activation.clear();
+    activation.offsets.resize(num_features + 1, 0);
+    activation.classes = classes;
+    std::vector<std::pair<float, int> > matches;
+    for(int i = 0; i < num_features; i++)
+    {
+        matches.clear();
+        for(const ActivationResult &result : classActivations)
+        {
+            for(int j = result.offsets[i]; j < result.offsets[i + 1]; j++)
+            {
+                if(result.codewordIndices[j] >= 0)
+                    matches.push_back(std::make_pair(result.distances[j], result.codewordIndices[j]));
+            }
+        }
+        std::sort(matches.begin(), matches.end());
+        matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+        if(k > 0 && (int)matches.size() > k)
+            matches.resize(k);
+
+        for(const std::pair<float, int> &match : matches)
+        {
+            activation.codewordIndices.push_back(match.second);
+            activation.distances.push_back(match.first);
+        }
+        activation.offsets[i + 1] = (int)activation.codewordIndices.size();
+    }
+    LOG_INFO("class cascade activated the codewords of " << classes.size() << " candidate classes");
+    return true;
+}
+
+std::vector<std::map<unsigned, int> > Codebook::getClassVoteCounts(const std::vector<std::shared_ptr<Codeword> > &codewords) const
+{
+    std::vector<std::map<unsigned, int> > counts(codewords.size());
+    for(int i = 0; i < (int)codewords.size(); i++)
+    {
+        if(!codewords[i])
+            continue;
+        distribution_t::const_iterator it = m_distribution.find(codewords[i]->getId());
+        if(it == m_distribution.end())
+            continue;
+        for(unsigned classId : it->second->getClassIds())
+            counts[i][classId]++;
+    }
+    return counts;
+}
+
+void Codebook::castVotes(const pcl::PointCloud<ISMFeature> &features, const ActivationResult &activation, Voting& voting) const
+{
+    if (isEmpty())
+        return;
+    ProfilerStage profilerStage("cast_votes");
+
+    const std::vector<std::shared_ptr<Codeword>> &codewords = getCodewords();
+    const int num_features = activation.numQueries();
+
+    prepareDenseTables();
+    prepareCodewordEntries();
+
+    // the distribution of each codeword index, the hot loops below use neither shared pointers nor lookups by id
+    const int num_codewords = (int)codewords.size();
+    const std::vector<CodewordDistribution*> &entries = m_codeword_entries;
+
+    // the temporaries are allocated in the arena of the detection
+    const ArenaAllocator<int> arena(&voting.getArena());
+
+    // pass 1: obtain the feature index of each activation and count activations per codeword
+    const int num_activations = (int)activation.codewordIndices.size();
+    ArenaVector<int> activationFeature(num_activations, 0, arena);
+    ArenaVector<int> codewordOffsets(num_codewords + 1, 0, arena);
+    int num_missing = 0;
+#pragma omp parallel for reduction(+:num_missing)
+    for (int i = 0; i < num_features; i++)
+    {
+        for (int j = activation.offsets[i]; j < activation.offsets[i + 1]; j++)
+        {
+            activationFeature[j] = i;
+            int codewordIndex = activation.codewordIndices[j];
+            if (codewordIndex < 0)
+                continue;
+
+            // m_distribution maps a codeword id to its corresponding vote distribution
+            if (!entries[codewordIndex])
+            {
+                num_missing++;
+                continue;
             }
+
+#pragma omp atomic
+            codewordOffsets[codewordIndex + 1]++;
         }
     }
+    if (num_missing > 0)
+        LOG_WARN(num_missing << " activated codeword(s) not found in distribution, skipping");
+
+    // exclusive prefix sum turns counts into offsets of a CSR array keyed by codeword index
+    ArenaVector<int> activatedEntries(arena);
+    for (int i = 0; i < num_codewords; i++)
+    {
+        if (codewordOffsets[i + 1] > 0)
+            activatedEntries.push_back(i);
+        codewordOffsets[i + 1] += codewordOffsets[i];
+    }
+
+    // the votes of a lazily mapped codeword are read as a whole on its first activation, while the activations are
+    // sorted into segments
+    if (m_flat_model && m_flat_model->getPrefetch() == "Lazy")
+    {
+        for (int codewordIndex : activatedEntries)
+            entries[codewordIndex]->pageIn();
+    }
 
-    // actually cast votes
+    // pass 2: scatter activation indices into their codeword's segment
+    ArenaVector<int> codewordActivations(codewordOffsets[num_codewords], 0, arena);
+    ArenaVector<int> fillPosition(codewordOffsets.begin(), codewordOffsets.end() - 1, arena);
 #pragma omp parallel for
+    for (int j = 0; j < num_activations; j++)
+    {
+        int codewordIndex = activation.codewordIndices[j];
+        if (codewordIndex < 0 || !entries[codewordIndex])
+            continue;
+
+        int pos;
+#pragma omp atomic capture
+        pos = fillPosition[codewordIndex]++;
+        codewordActivations[pos] = j;
+    }
+
+    // restore the feature order inside the segments, which is lost by the parallel scatter
+#pragma omp parallel for schedule(dynamic, 16)
     for (int i = 0; i < (int)activatedEntries.size(); i++)
     {
-        std::shared_ptr<CodewordDistribution> entry = activatedEntries[i];
-        std::shared_ptr<Codeword> codeword = entry->getCodeword();
-        std::vector<int> featInd = featureIndizes[codeword->getId()];
+        int codewordIndex = activatedEntries[i];
+        std::sort(codewordActivations.begin() + codewordOffsets[codewordIndex],
+                  codewordActivations.begin() + codewordOffsets[codewordIndex + 1]);
+    }
+
+    // the work of a segment is its number of activations times the votes of the distribution and varies by orders
+    // of magnitude between codewords: large segments are split into chunks of about equal work, and the chunks are
+    // dispatched in the order of decreasing work, so that no thread is left with a large segment at the end
+    struct VoteChunk
+    {
+        int codewordIndex;
+        int begin;
+        int end;
+        long long work;
+    };
+    long long totalWork = 0;
+    for (int codewordIndex : activatedEntries)
+    {
+        const int numVotes = entries[codewordIndex]->getNumVotes();
+        const long long votesPerActivation = std::max(m_max_votes_per_activation > 0 ? std::min(numVotes, m_max_votes_per_activation) : numVotes, 1);
+        totalWork += votesPerActivation * (codewordOffsets[codewordIndex + 1] - codewordOffsets[codewordIndex]);
+    }
+    const long long chunkWork = std::max(totalWork / (16LL * omp_get_max_threads()), 1LL);
+    std::vector<VoteChunk> chunks;
+    chunks.reserve(activatedEntries.size());
+    for (int codewordIndex : activatedEntries)
+    {
+        const int numVotes = entries[codewordIndex]->getNumVotes();
+        const long long votesPerActivation = std::max(m_max_votes_per_activation > 0 ? std::min(numVotes, m_max_votes_per_activation) : numVotes, 1);
+        const int chunkSize = (int)std::max(chunkWork / votesPerActivation, 1LL);
+        for (int begin = codewordOffsets[codewordIndex]; begin < codewordOffsets[codewordIndex + 1]; begin += chunkSize)
+        {
+            const int end = std::min(begin + chunkSize, codewordOffsets[codewordIndex + 1]);
+            chunks.push_back({codewordIndex, begin, end, votesPerActivation * (end - begin)});
+        }
+    }
+    std::stable_sort(chunks.begin(), chunks.end(), [](const VoteChunk &a, const VoteChunk &b)
+    {
+        return a.work > b.work;
+    });
+
+    // the votes of classes that are not candidates of a cascade activation are given a negative sigma, they fail
+    // the distance check of the distribution like votes of too distant matches
+    std::vector<float> candidateSigmas;
+    if (!activation.classes.empty())
+    {
+        candidateSigmas.assign(m_dense_class_sigmas.size(), -1.0f);
+        for (unsigned classId : activation.classes)
+        {
+            std::map<unsigned, int>::const_iterator it = m_dense_class_indices.find(classId);
+            if (it != m_dense_class_indices.end())
+                candidateSigmas[it->second] = m_dense_class_sigmas[it->second];
+        }
+    }
+    const std::vector<float> &classSigmas = activation.classes.empty() ? m_dense_class_sigmas : candidateSigmas;
 
-        for (int j = 0; j < (int)featInd.size(); j++)
+    // actually cast votes, each worker of this loop votes into a slot of its own, also when the loop runs nested in
+    // another team or concurrently with other vote loops
+    const std::vector<Voting::VoteSlot*> slots = voting.acquireSlots(omp_get_max_threads());
+#pragma omp parallel for schedule(dynamic, 1) num_threads(slots.size())
+    for (int i = 0; i < (int)chunks.size(); i++)
+    {
+        const VoteChunk &chunk = chunks[i];
+        const CodewordDistribution* entry = entries[chunk.codewordIndex];
+        Voting::VoteSlot &slot = *slots[omp_get_thread_num()];
+        for (int j = chunk.begin; j < chunk.end; j++)
         {
-            const ISMFeature& feature = features->at(featInd[j]);
-            entry->castVotes(feature, distance, m_classSigmas, m_useClassWeight, m_useVoteWeight,
-                             m_useMatchingWeight, m_useCodewordWeight, voting, m_distribution);
+            int activationIndex = codewordActivations[j];
+            const ISMFeature& feature = features.at(activationFeature[activationIndex]);
+            entry->castVotes(feature, activation.distances[activationIndex], classSigmas, m_useClassWeight, m_useVoteWeight,
+                             m_useMatchingWeight, m_useCodewordWeight, m_max_votes_per_activation, voting, slot);
         }
     }
+    voting.releaseSlots(slots);
+
+    // collect votes from the slots
+    voting.mergeVotes();
+}
+
+
+void Codebook::prepareDenseTables() const
+{
+    std::lock_guard<std::mutex> lock(m_detection_mutex);
+    if (m_dense_tables_valid)
+        return;
+
+    // compact class index for each class occurring in the codebook
+    std::map<unsigned, int> classIndices;
+    for (std::map<unsigned, float>::const_iterator it = m_classSigmas.begin(); it != m_classSigmas.end(); it++)
+        classIndices.insert({it->first, (int)classIndices.size()});
+
+    m_dense_class_sigmas.clear();
+    for (std::map<unsigned, int>::const_iterator it = classIndices.begin(); it != classIndices.end(); it++)
+        m_dense_class_sigmas.push_back(m_classSigmas.find(it->first)->second);
+    m_dense_class_indices = classIndices;
+
+    // per-vote tables of each distribution
+    std::vector<std::shared_ptr<CodewordDistribution> > entries;
+    entries.reserve(m_distribution.size());
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        entries.push_back(it->second);
+
+    // the votes are counted to warn only once
+    int numMissing = 0;
+#pragma omp parallel for reduction(+:numMissing)
+    for (int i = 0; i < (int)entries.size(); i++)
+        numMissing += entries[i]->prepareVoting(classIndices);
+    if (numMissing > 0)
+        LOG_WARN("no class weight found for " << numMissing << " vote(s), using a weight of 1");
+
+    // the packed votes include the class tables
+    if (m_codeword_order == "CoActivation")
+        packVotes();
+
+    m_dense_tables_valid = true;
 }
 
+void Codebook::prepareCodewordEntries() const
+{
+    std::lock_guard<std::mutex> lock(m_detection_mutex);
+    if (m_codeword_entries_valid)
+        return;
+
+    const std::vector<std::shared_ptr<Codeword> > &codewords = getCodewords();
+    m_codeword_entries.assign(codewords.size(), 0);
+    for (int i = 0; i < (int)codewords.size(); i++)
+    {
+        distribution_t::const_iterator it = m_distribution.find(codewords[i]->getId());
+        if (it != m_distribution.end())
+            m_codeword_entries[i] = it->second.get();
+    }
+    m_codeword_entries_valid = true;
+}
 
 void Codebook::addDistribution(std::shared_ptr<CodewordDistribution> distribution)
 {
+    m_dense_tables_valid = false;
+    m_codeword_entries_valid = false;
+    m_recall_codewords.reset();
+
     std::shared_ptr<CodewordDistribution> distr = getDistributionById(distribution->getCodewordId());
     if (distr.get())
         distr->addDistribution(distribution);
@@ -606,6 +1762,9 @@ void Codebook::addDistribution(std::shared_ptr<CodewordDistribution> distributio
 
 bool Codebook::removeDistribution(int id)
 {
+    m_dense_tables_valid = false;
+    m_codeword_entries_valid = false;
+    m_recall_codewords.reset();
     for (distribution_t::iterator it = m_distribution.begin(); it != m_distribution.end(); it++) {
         if (it->first == id)
         {
@@ -626,6 +1785,7 @@ bool Codebook::removeDistributions(const std::vector<int>& ids)
     }
 
     // distribution was changed, fill list with codewords
+    m_recall_codewords.reset();
     m_codewords.clear();
     for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
         m_codewords.push_back(it->second->getCodeword());
@@ -649,7 +1809,7 @@ std::shared_ptr<CodewordDistribution> Codebook::getDistributionById(int id) cons
     return std::shared_ptr<CodewordDistribution>();
 }
 
-std::vector<std::shared_ptr<Codeword>> Codebook::getCodewords(std::string warn) const
+const std::vector<std::shared_ptr<Codeword>>& Codebook::getCodewords(std::string warn) const
 {
     if(m_use_partial_shot)
     {
@@ -702,6 +1862,53 @@ int Codebook::getNumCodewordsForClass(unsigned classId) const
     return numCodewords;
 }
 
+std::size_t Codebook::getMemoryUsage() const
+{
+    std::size_t bytes = m_compressed_codes.capacity() + m_compressed_codeword_ids.capacity() * sizeof(int);
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        bytes += it->second->getMemoryUsage();
+    return bytes;
+}
+
+void Codebook::iMemoryUsage(MemoryUsage &usage) const
+{
+    MemoryUsage &codewords = usage.addPart("codewords");
+    for (const std::vector<std::shared_ptr<Codeword> > *list : {&m_codewords, &m_partial_codewords})
+    {
+        codewords.bytes += list->capacity() * sizeof(std::shared_ptr<Codeword>);
+        for (const std::shared_ptr<Codeword> &codeword : *list)
+        {
+            if (!codeword)
+                continue;
+            codewords.bytes += sizeof(Codeword) + codeword->getData().capacity() * sizeof(float) +
+                    codeword->getFeatureClasses().capacity() * sizeof(unsigned) +
+                    codeword->getFeaturePositions().capacity() * sizeof(Eigen::Vector3f);
+        }
+    }
+
+    // the map nodes are counted with the vote vectors
+    MemoryUsage &distributions = usage.addPart("distributions");
+    MemoryUsage votes("vote vectors", m_distribution.size() * (sizeof(distribution_t::value_type) + 4 * sizeof(void*)));
+    MemoryUsage boundingBoxes("bounding boxes");
+    MemoryUsage trainingData("training data");
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        it->second->addMemoryUsage(votes, boundingBoxes, trainingData);
+    if (m_compact_vote_table)
+        boundingBoxes.bytes += m_compact_vote_table->boxSizes.capacity() * sizeof(Eigen::Vector3f);
+    distributions.addPart(votes);
+    distributions.addPart(boundingBoxes);
+    distributions.addPart(trainingData);
+
+    MemoryUsage &compressed = usage.addPart("compressed codes", m_compressed_codes.capacity() +
+                                            m_compressed_codeword_ids.capacity() * sizeof(int));
+    if (m_quantizer)
+        compressed.bytes += (std::size_t)m_quantizer->getDim() * m_quantizer->getNumCentroids() * sizeof(float);
+    if (m_scalar_quantizer && m_scalar_quantizer->getPrecision() == ScalarQuantizer::UInt8)
+        compressed.bytes += (std::size_t)m_scalar_quantizer->getDim() * 2 * sizeof(float);
+
+    usage.addPart("activation cache", m_activation_cache.getMemoryUsage());
+}
+
 int Codebook::getNumOfFeaturesForClass(unsigned classId) const
 {
     int numFeatures = 0;
@@ -744,49 +1951,332 @@ bool Codebook::isEmpty() const
 
 void Codebook::clear()
 {
+    m_flat_model.reset();
     m_distribution.clear();
+    m_classSigmas.clear();
+    m_dense_tables_valid = false;
+    m_codeword_entries_valid = false;
+    m_recall_codewords.reset();
+    m_activation_cache.clear();
+    m_quantizer.reset();
+    m_scalar_quantizer.reset();
+    m_compressed_codes.clear();
+    m_compressed_codeword_ids.clear();
 }
 
-Json::Value Codebook::iChildConfigsToJson() const
+void Codebook::compress()
 {
-    Json::Value children(Json::objectValue);
-
-    children["ActivationStrategy"] = m_activationStrategy->configToJson();
+    m_quantizer.reset();
+    m_scalar_quantizer.reset();
+    m_compressed_codes.clear();
+    m_compressed_codeword_ids.clear();
 
-    return children;
-}
+    if(m_use_partial_shot)
+    {
+        LOG_WARN("compression is not available with partial shot, codewords are not compressed");
+        return;
+    }
 
-bool Codebook::iChildConfigsFromJson(const Json::Value& children)
-{
-    const Json::Value* activationStrategy = &children["ActivationStrategy"];
+    const std::vector<std::shared_ptr<Codeword> > &codewords = getCodewords();
+    if(codewords.empty())
+        return;
 
-    if (activationStrategy->isNull() || !activationStrategy->isObject())
-        return false;
+    const int num_codewords = (int)codewords.size();
+    const int dim = (int)codewords[0]->getData().size();
+    std::vector<float> descriptors((size_t)num_codewords * dim);
+    for(int i = 0; i < num_codewords; i++)
+    {
+        const std::vector<float>& data = codewords[i]->getData();
+        if((int)data.size() != dim)
+        {
+            LOG_ERROR("invalid codeword descriptor size, codewords are not compressed");
+            return;
+        }
+        std::copy(data.begin(), data.end(), descriptors.begin() + (size_t)i * dim);
+    }
+    flann::Matrix<float> dataset(descriptors.data(), num_codewords, dim);
 
-    // NOTE: as m_distribution is a map and the respective keys are only stored as data, it
-    // will be initialized later in iDataFromJson
+    std::shared_ptr<ProductQuantizer> quantizer;
+    std::shared_ptr<ScalarQuantizer> scalarQuantizer;
+    int code_size;
+    if(m_compression == "PQ")
+    {
+        quantizer = std::make_shared<ProductQuantizer>();
+        quantizer->train(dataset, m_pq_subspaces, m_pq_centroids, m_pq_iterations, m_pq_training_samples);
+        code_size = quantizer->getNumSubspaces();
+    }
+    else
+    {
+        scalarQuantizer = std::make_shared<ScalarQuantizer>();
+        const ScalarQuantizer::Precision precision = m_compression == "FP16" ? ScalarQuantizer::FP16 :
+                                                     m_compression == "Binary" ? ScalarQuantizer::Binary : ScalarQuantizer::UInt8;
+        scalarQuantizer->train(dataset, precision);
+        code_size = scalarQuantizer->getCodeSize();
+    }
 
-    // clear
-    delete m_activationStrategy;
+    m_compressed_codes.resize((size_t)num_codewords * code_size);
+    m_compressed_codeword_ids.resize(num_codewords);
+#pragma omp parallel for
+    for(int i = 0; i < num_codewords; i++)
+    {
+        if(quantizer)
+            quantizer->encode(dataset[i], &m_compressed_codes[(size_t)i * code_size]);
+        else
+            scalarQuantizer->encode(dataset[i], &m_compressed_codes[(size_t)i * code_size]);
+        m_compressed_codeword_ids[i] = codewords[i]->getId();
+    }
+    m_quantizer = quantizer;
+    m_scalar_quantizer = scalarQuantizer;
+    m_codeword_dim = dim;
 
-    // create child objects
-    m_activationStrategy = Factory<ActivationStrategy>::create(*activationStrategy);
+    // activation strategies other than KNN compute the distances to the activated codewords themselves,
+    // re-ranking is only done for product quantization
+    if((!quantizer || m_pq_rerank <= 0) && m_activation_type == ActivationKNN)
+    {
+        for(const std::shared_ptr<Codeword>& codeword : codewords)
+            codeword->releaseData();
+    }
+    else
+    {
+        LOG_INFO("keeping codeword descriptors for re-ranking or activation strategy " << m_activationStrategy->getType());
+    }
+
+    LOG_INFO("compressed " << num_codewords << " codewords from " << dim * sizeof(float) << " to " <<
+             code_size << " bytes each");
+}
+
+bool Codebook::getCompressedCodes(const std::vector<std::shared_ptr<Codeword> >& codewords, std::vector<uint8_t>& codes) const
+{
+    if(!isCompressed())
+        return false;
+
+    std::map<int, int> rowById;
+    for(int i = 0; i < (int)m_compressed_codeword_ids.size(); i++)
+        rowById[m_compressed_codeword_ids[i]] = i;
+
+    const int code_size = m_quantizer ? m_quantizer->getNumSubspaces() : m_scalar_quantizer->getCodeSize();
+    codes.resize(codewords.size() * code_size);
+    for(int i = 0; i < (int)codewords.size(); i++)
+    {
+        std::map<int, int>::const_iterator it = rowById.find(codewords[i]->getId());
+        if(it == rowById.end())
+            return false;
+        std::copy(m_compressed_codes.begin() + (size_t)it->second * code_size,
+                  m_compressed_codes.begin() + (size_t)(it->second + 1) * code_size,
+                  codes.begin() + (size_t)i * code_size);
+    }
+    return true;
+}
+
+void Codebook::saveCompressedData(boost::archive::binary_oarchive &oa) const
+{
+    bool compressed = m_quantizer.get() != 0;
+    oa << compressed;
+    if(compressed)
+    {
+        m_quantizer->saveData(oa);
+        oa << m_compressed_codes;
+        oa << m_compressed_codeword_ids;
+    }
+}
+
+bool Codebook::loadCompressedData(boost::archive::binary_iarchive &ia)
+{
+    m_quantizer.reset();
+    m_scalar_quantizer.reset();
+    m_compressed_codes.clear();
+    m_compressed_codeword_ids.clear();
+
+    bool compressed;
+    ia >> compressed;
+    if(!compressed)
+        return true;
+
+    std::shared_ptr<ProductQuantizer> quantizer = std::make_shared<ProductQuantizer>();
+    if(!quantizer->loadData(ia))
+    {
+        LOG_ERROR("could not read product quantizer");
+        return false;
+    }
+    ia >> m_compressed_codes;
+    ia >> m_compressed_codeword_ids;
+
+    m_quantizer = quantizer;
+    m_codeword_dim = m_quantizer->getDim();
+    retainFilteredCodes();
+    return true;
+}
+
+void Codebook::saveScalarQuantizedData(boost::archive::binary_oarchive &oa) const
+{
+    bool compressed = m_scalar_quantizer.get() != 0;
+    oa << compressed;
+    if(compressed)
+    {
+        m_scalar_quantizer->saveData(oa);
+        oa << m_compressed_codes;
+        oa << m_compressed_codeword_ids;
+    }
+}
+
+bool Codebook::loadScalarQuantizedData(boost::archive::binary_iarchive &ia)
+{
+    bool compressed;
+    ia >> compressed;
+    if(!compressed)
+        return true;
+
+    std::shared_ptr<ScalarQuantizer> quantizer = std::make_shared<ScalarQuantizer>();
+    if(!quantizer->loadData(ia))
+    {
+        LOG_ERROR("could not read scalar quantizer");
+        return false;
+    }
+
+    std::vector<uint8_t> codes;
+    std::vector<int> codewordIds;
+    ia >> codes;
+    ia >> codewordIds;
+    if(codes.size() != codewordIds.size() * quantizer->getCodeSize())
+    {
+        LOG_ERROR("invalid scalar quantization codes");
+        return false;
+    }
+
+    m_quantizer.reset();
+    m_scalar_quantizer = quantizer;
+    m_compressed_codes.swap(codes);
+    m_compressed_codeword_ids.swap(codewordIds);
+    m_codeword_dim = m_scalar_quantizer->getDim();
+    retainFilteredCodes();
+    return true;
+}
+
+void Codebook::setClassFilter(const std::set<unsigned>& classIds)
+{
+    m_class_filter = classIds;
+}
+
+bool Codebook::retainFilteredClasses(CodewordDistribution &distribution) const
+{
+    return m_class_filter.empty() || distribution.retainClasses(m_class_filter) > 0;
+}
+
+void Codebook::retainFilteredCodes()
+{
+    if(m_class_filter.empty() || m_compressed_codeword_ids.empty())
+        return;
+
+    const std::size_t code_size = m_compressed_codes.size() / m_compressed_codeword_ids.size();
+    std::vector<uint8_t> codes;
+    std::vector<int> codewordIds;
+    for(int i = 0; i < (int)m_compressed_codeword_ids.size(); i++)
+    {
+        if(m_distribution.find(m_compressed_codeword_ids[i]) == m_distribution.end())
+            continue;
+        codewordIds.push_back(m_compressed_codeword_ids[i]);
+        codes.insert(codes.end(), m_compressed_codes.begin() + i * code_size, m_compressed_codes.begin() + (i + 1) * code_size);
+    }
+    m_compressed_codes.swap(codes);
+    m_compressed_codeword_ids.swap(codewordIds);
+}
+
+Json::Value Codebook::iChildConfigsToJson() const
+{
+    Json::Value children(Json::objectValue);
+
+    children["ActivationStrategy"] = m_activationStrategy->configToJson();
+
+    return children;
+}
+
+bool Codebook::iChildConfigsFromJson(const Json::Value& children)
+{
+    const Json::Value* activationStrategy = &children["ActivationStrategy"];
+
+    if (activationStrategy->isNull() || !activationStrategy->isObject())
+        return false;
+
+    // NOTE: as m_distribution is a map and the respective keys are only stored as data, it
+    // will be initialized later in iDataFromJson
+
+    // clear
+    delete m_activationStrategy;
+
+    // create child objects
+    m_activationStrategy = Factory<ActivationStrategy>::create(*activationStrategy);
 
     if (!m_activationStrategy)
         return false;
 
+    resolveActivationStrategy();
     return true;
 }
 
+void Codebook::resolveActivationStrategy()
+{
+    m_activation_knn = dynamic_cast<ActivationStrategyKNN*>(m_activationStrategy);
+    m_activation_inn = dynamic_cast<ActivationStrategyINN*>(m_activationStrategy);
+    m_activation_threshold = dynamic_cast<ActivationStrategyThreshold*>(m_activationStrategy);
+    if (m_activation_knn)
+        m_activation_type = ActivationKNN;
+    else if (m_activation_inn)
+        m_activation_type = ActivationINN;
+    else if (m_activation_threshold)
+        m_activation_type = ActivationThreshold;
+    else
+        m_activation_type = ActivationOther;
+}
+
 void Codebook::iSaveData(boost::archive::binary_oarchive &oa) const
 {
+    std::shared_ptr<const CodewordDistribution::CompactVoteTable> table;
+    if (m_vote_storage == "Compact")
+        table = createCompactVoteTable();
+
+    // a negative size marks the layout of the distributions: -1 for compact distributions, -2 for chunked
+    // distributions followed by whether they are compact; compact distributions are preceded by the bounding
+    // box sizes they reference
+    if (m_archive_chunk_size > 0)
+    {
+        int chunked_marker = -2;
+        oa << chunked_marker;
+        int compact = table ? 1 : 0;
+        oa << compact;
+    }
+    else if (table)
+    {
+        int compact_marker = -1;
+        oa << compact_marker;
+    }
+
+    if (table)
+    {
+        int box_sizes_size = table->boxSizes.size();
+        oa << box_sizes_size;
+        for (int i = 0; i < box_sizes_size; i++)
+        {
+            oa << table->boxSizes[i][0];
+            oa << table->boxSizes[i][1];
+            oa << table->boxSizes[i][2];
+        }
+    }
+
     int distribution_size = m_distribution.size();
     oa << distribution_size;
-    for (std::map<int, std::shared_ptr<CodewordDistribution> >::const_iterator it = m_distribution.begin();
-         it != m_distribution.end(); it++)
+    if (m_archive_chunk_size > 0)
     {
-        const std::shared_ptr<CodewordDistribution>& entry = it->second;
-        entry->saveData(oa);
+        saveDistributionChunks(oa, getStorageOrder(), table);
+    }
+    else
+    {
+        for (const std::shared_ptr<CodewordDistribution> &entry : getStorageOrder())
+        {
+            if (table)
+                entry->saveCompactData(oa, table);
+            else
+                entry->saveData(oa);
+        }
     }
 
     int class_sigmas_size = m_classSigmas.size();
@@ -801,178 +2291,656 @@ void Codebook::iSaveData(boost::archive::binary_oarchive &oa) const
     m_activationStrategy->saveData(oa);
 }
 
-bool Codebook::iLoadData(boost::archive::binary_iarchive &ia)
+bool Codebook::iLoadData(boost::archive::binary_iarchive &ia)
+{
+    // clear
+    m_flat_model.reset();
+    m_compact_vote_table.reset();
+    m_distribution.clear();
+
+    // NOTE: this is only for debug to write out the indices of randomly selected codewords; check absolute path below
+    // NOTE: to write out indices selected by a feature weighting algorithm check the same debug flag in implicit_shape_model.cpp
+    bool debug_flag_write_out = false && m_use_random_codebook;
+    // NOTE: this is only for debug to read in the indices of selected codewords; check absolute path below
+    bool debug_flag_read_in = false && !m_use_random_codebook;
+
+    std::ofstream ofs;
+
+    if(debug_flag_write_out)
+    {
+        std::string path = "/home/vseib/Desktop/cwids/out.txt";
+        LOG_INFO("Writing out file with randomly selected codeword indices to " << path);
+        ofs.open(path, std::ofstream::out);
+    }
+
+    std::vector<int> indices_to_use;
+    if(debug_flag_read_in)
+    {
+        std::string path = "/home/vseib/Desktop/cwids/best.txt";
+        LOG_INFO("Reading in file with provided codeword indices from " << path);
+        std::ifstream ifs;
+        ifs.open(path, std::ifstream::in);
+        std::string line;
+        while(std::getline(ifs, line))
+        {
+            std::istringstream iss(line);
+            int a;
+            if (!(iss >> a)) { break; }
+            indices_to_use.push_back(a);
+        }
+        ifs.close();
+    }
+
+    // create distribution
+    int distribution_size;
+    ia >> distribution_size;
+
+    // archives with compact or chunked distributions start with a negative marker, see iSaveData()
+    const bool chunked = distribution_size == -2;
+    bool compact = distribution_size == -1;
+    if (chunked)
+    {
+        int compact_flag;
+        ia >> compact_flag;
+        compact = compact_flag != 0;
+    }
+
+    std::shared_ptr<CodewordDistribution::CompactVoteTable> table;
+    if (compact)
+    {
+        table = std::make_shared<CodewordDistribution::CompactVoteTable>();
+        int box_sizes_size;
+        ia >> box_sizes_size;
+        table->boxSizes.resize(box_sizes_size);
+        for (int i = 0; i < box_sizes_size; i++)
+        {
+            ia >> table->boxSizes[i][0];
+            ia >> table->boxSizes[i][1];
+            ia >> table->boxSizes[i][2];
+        }
+        m_compact_vote_table = table;
+    }
+    if (distribution_size < 0)
+        ia >> distribution_size;
+    LOG_INFO("Loading codebook with size: " << distribution_size);
+
+    std::vector<std::shared_ptr<CodewordDistribution> > entries;
+    if (chunked && !loadDistributionChunks(ia, distribution_size, table, entries))
+        return false;
+
+    for(int i = 0; i < distribution_size; i++)
+    {
+        std::shared_ptr<CodewordDistribution> entry;
+        if(chunked)
+        {
+            // the chunks are decoded and filtered already
+            entry = entries[i];
+            if(!entry)
+                continue;
+        }
+        else
+        {
+            entry.reset(new CodewordDistribution());
+            if(!entry.get())
+            {
+                LOG_ERROR("Could not create codeword distribution with index " << i << "!");
+                return false;
+            }
+
+            if(table ? !entry->loadCompactData(ia, table) : !entry->loadData(ia))
+            {
+                LOG_ERROR("Could not read codeword distribution with index " << i << "!");
+                return false;
+            }
+
+            // distributions of other classes are only read from the archive
+            if(!retainFilteredClasses(*entry))
+                continue;
+        }
+
+        // for random codebook: skip features while loading
+        if(m_use_random_codebook)
+        {
+            std::random_device rd;
+            std::mt19937 mt(rd());
+            std::uniform_int_distribution<int> dist(0, distribution_size);
+            if(dist(mt) > m_random_codebook_factor * distribution_size)
+                continue;
+        }
+
+        if(debug_flag_read_in)
+        {
+            int id = entry->getCodewordId();
+            bool found = false;
+            for(int xxx = 0; xxx < indices_to_use.size(); xxx++)
+            {
+                if(indices_to_use.at(xxx) == id)
+                {
+                    found = true;
+                    break;
+                }
+            }
+            if(found) m_distribution[entry->getCodewordId()] = entry;
+        }
+        else // this is the normal case
+        {
+            m_distribution[entry->getCodewordId()] = entry;
+        }
+
+        if(debug_flag_write_out) ofs << entry->getCodewordId() << std::endl;
+    }
+    if(m_use_random_codebook) LOG_INFO("Reduced codebook size: " << m_distribution.size());
+    if(debug_flag_read_in) LOG_INFO("Loaded codebook size: " << m_distribution.size());
+    if(debug_flag_write_out) ofs.close();
+    if(!m_class_filter.empty()) LOG_INFO("Codebook size of the loaded classes: " << m_distribution.size());
+
+    if(m_distribution.empty())
+    {
+        LOG_ERROR("the codebook contains no codewords of the classes to load");
+        return false;
+    }
+    initCodewords();
+
+    // distributions of float archives, or decoded by the class filter
+    if(m_vote_storage == "Compact")
+        compactVotes();
+
+    // fill class sigmas
+    int class_sigmas_size;
+    ia >> class_sigmas_size;
+    m_classSigmas.clear();
+    for (int i = 0; i < class_sigmas_size; i++)
+    {
+        int classId;
+        float sigma;
+        ia >> classId;
+        ia >> sigma;
+        m_classSigmas[classId] = sigma;
+    }
+    m_dense_tables_valid = false;
+
+    m_activationStrategy->loadData(ia);
+
+    return true;
+}
+
+void Codebook::saveDistributionChunks(boost::archive::binary_oarchive &oa,
+                                      const std::vector<std::shared_ptr<CodewordDistribution> > &order,
+                                      const std::shared_ptr<const CodewordDistribution::CompactVoteTable> &table) const
+{
+    // the chunks are encoded in parallel, each into an archive without header
+    const int num_chunks = ((int)order.size() + m_archive_chunk_size - 1) / m_archive_chunk_size;
+    std::vector<std::string> chunks(num_chunks);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int chunk = 0; chunk < num_chunks; chunk++)
+    {
+        std::ostringstream stream;
+        {
+            boost::archive::binary_oarchive chunk_oa(stream, boost::archive::no_header);
+            const int end = std::min((chunk + 1) * m_archive_chunk_size, (int)order.size());
+            for (int i = chunk * m_archive_chunk_size; i < end; i++)
+            {
+                if (table)
+                    order[i]->saveCompactData(chunk_oa, table);
+                else
+                    order[i]->saveData(chunk_oa);
+            }
+        }
+        chunks[chunk] = stream.str();
+    }
+
+    // the offset table has one entry per chunk and the total size
+    std::vector<std::uint64_t> offsets(1, 0);
+    for (const std::string &chunk : chunks)
+        offsets.push_back(offsets.back() + chunk.size());
+
+    oa << m_archive_chunk_size;
+    oa << offsets;
+    for (const std::string &chunk : chunks)
+        oa.save_binary(chunk.data(), chunk.size());
+}
+
+bool Codebook::loadDistributionChunks(boost::archive::binary_iarchive &ia, int distribution_size,
+                                      const std::shared_ptr<const CodewordDistribution::CompactVoteTable> &table,
+                                      std::vector<std::shared_ptr<CodewordDistribution> > &entries) const
+{
+    int chunk_size;
+    std::vector<std::uint64_t> offsets;
+    ia >> chunk_size;
+    ia >> offsets;
+
+    const int num_chunks = chunk_size > 0 ? (distribution_size + chunk_size - 1) / chunk_size : -1;
+    if ((int)offsets.size() != num_chunks + 1 || offsets.front() != 0 || !std::is_sorted(offsets.begin(), offsets.end()))
+    {
+        LOG_ERROR("invalid offset table of the codebook chunks");
+        return false;
+    }
+
+    // the chunks are read as a whole, decoding them is what takes the time
+    std::vector<char> data(offsets.back());
+    ia.load_binary(data.data(), data.size());
+
+    entries.assign(distribution_size, std::shared_ptr<CodewordDistribution>());
+    std::vector<char> failed(num_chunks, 0);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int chunk = 0; chunk < num_chunks; chunk++)
+    {
+        try
+        {
+            MemoryStreamBuffer buffer(data.data() + offsets[chunk], offsets[chunk + 1] - offsets[chunk]);
+            std::istream stream(&buffer);
+            boost::archive::binary_iarchive chunk_ia(stream, boost::archive::no_header);
+            const int end = std::min((chunk + 1) * chunk_size, distribution_size);
+            for (int i = chunk * chunk_size; i < end; i++)
+            {
+                std::shared_ptr<CodewordDistribution> entry = std::make_shared<CodewordDistribution>();
+                if (table ? !entry->loadCompactData(chunk_ia, table) : !entry->loadData(chunk_ia))
+                {
+                    failed[chunk] = 1;
+                    break;
+                }
+
+                // distributions of other classes are only decoded
+                if (retainFilteredClasses(*entry))
+                    entries[i] = entry;
+            }
+        }
+        catch (const boost::archive::archive_exception&)
+        {
+            failed[chunk] = 1;
+        }
+    }
+
+    for (int chunk = 0; chunk < num_chunks; chunk++)
+    {
+        if (failed[chunk])
+        {
+            LOG_ERROR("Could not read the codeword distributions of chunk " << chunk << "!");
+            return false;
+        }
+    }
+    LOG_INFO("decoded " << distribution_size << " codeword distributions in " << num_chunks << " chunks");
+    return true;
+}
+
+std::shared_ptr<CodewordDistribution::CompactVoteTable> Codebook::createCompactVoteTable() const
+{
+    std::shared_ptr<CodewordDistribution::CompactVoteTable> table = std::make_shared<CodewordDistribution::CompactVoteTable>();
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+    {
+        for (int i = 0; i < it->second->getNumVotes(); i++)
+            table->boxSizes.push_back(it->second->getBoundingBox(i).size);
+    }
+    table->finalize();
+    return table;
+}
+
+void Codebook::compactVotes()
+{
+    // a loaded table contains the sizes of all votes, including those of distributions decoded after loading
+    if (!m_compact_vote_table)
+        m_compact_vote_table = createCompactVoteTable();
+
+    std::size_t bytesBefore = getMemoryUsage();
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        it->second->compactVotes(m_compact_vote_table);
+    m_dense_tables_valid = false;
+    LOG_INFO("compact vote storage: " << m_compact_vote_table->boxSizes.size() << " bounding box sizes, distributions use "
+             << getMemoryUsage() / (1024 * 1024) << " MB instead of " << bytesBefore / (1024 * 1024) << " MB");
+}
+
+void Codebook::initCodewords()
+{
+    initCodewords(getStorageOrder());
+}
+
+void Codebook::initCodewords(const std::vector<std::shared_ptr<CodewordDistribution> > &order)
+{
+    // fill list with codewords
+    m_codeword_entries_valid = false;
+    m_recall_codewords.reset();
+    m_codewords.clear();
+    for (const std::shared_ptr<CodewordDistribution> &entry : order)
+        m_codewords.push_back(entry->getCodeword());
+
+    m_codeword_dim = m_codewords.at(0)->getData().size();
+
+    // fill list with partial codewords
+    if(m_use_partial_shot)
+    {
+        buildPartialShotPlans();
+
+        LOG_INFO("creating partial shot descriptors");
+        for (const std::shared_ptr<CodewordDistribution> &entry : order)
+        {
+            std::shared_ptr<Codeword> cw = entry->getCodeword();
+            const std::vector<float>& descriptor = cw->getData();
+            const std::vector<int>& plan = getPartialShotPlan(descriptor.size());
+
+            std::vector<float> partial_descriptor(plan.size());
+            for (int j = 0; j < (int)plan.size(); j++)
+                partial_descriptor[j] = descriptor[plan[j]];
+
+            cw->setData(partial_descriptor, cw->getNumFeatures(), cw->getWeight());
+            m_codeword_dim = partial_descriptor.size();
+            m_partial_codewords.push_back(cw);
+        }
+    }
+}
+
+std::vector<std::shared_ptr<CodewordDistribution> > Codebook::getStorageOrder() const
+{
+    std::vector<std::shared_ptr<CodewordDistribution> > order;
+    order.reserve(m_distribution.size());
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        order.push_back(it->second);
+    if (m_codeword_order != "CoActivation")
+        return order;
+
+    // the codewords of a class are activated by the same scene regions, those with similar descriptors by the same
+    // scene features
+    std::map<unsigned, std::vector<std::shared_ptr<CodewordDistribution> > > classes;
+    for (const std::shared_ptr<CodewordDistribution> &entry : order)
+        classes[getDominantClass(*entry)].push_back(entry);
+
+    order.clear();
+    for (std::map<unsigned, std::vector<std::shared_ptr<CodewordDistribution> > >::iterator it = classes.begin();
+         it != classes.end(); it++)
+    {
+        sortKdTreeLeaves(it->second.begin(), it->second.end());
+        order.insert(order.end(), it->second.begin(), it->second.end());
+    }
+    return order;
+}
+
+void Codebook::packVotes() const
 {
-    // clear
-    m_distribution.clear();
-
-    // NOTE: this is only for debug to write out the indices of randomly selected codewords; check absolute path below
-    // NOTE: to write out indices selected by a feature weighting algorithm check the same debug flag in implicit_shape_model.cpp
-    bool debug_flag_write_out = false && m_use_random_codebook;
-    // NOTE: this is only for debug to read in the indices of selected codewords; check absolute path below
-    bool debug_flag_read_in = false && !m_use_random_codebook;
-
-    std::ofstream ofs;
-
-    if(debug_flag_write_out)
+    // mapped distributions are already stored in order, compact distributions keep their own encoding
+    std::vector<std::shared_ptr<CodewordDistribution> > entries;
+    std::size_t numVotes = 0, numClassWeights = 0;
+    for (const std::shared_ptr<CodewordDistribution> &entry : getStorageOrder())
     {
-        std::string path = "/home/vseib/Desktop/cwids/out.txt";
-        LOG_INFO("Writing out file with randomly selected codeword indices to " << path);
-        ofs.open(path, std::ofstream::out);
+        if (entry->isMapped() || entry->isCompact())
+            continue;
+        entries.push_back(entry);
+        numVotes += entry->getNumVotes();
+        numClassWeights += entry->getClassWeights().size();
     }
+    if (entries.empty())
+        return;
 
-    std::vector<int> indices_to_use;
-    if(debug_flag_read_in)
+    std::shared_ptr<PackedVotes> packed = std::make_shared<PackedVotes>();
+    packed->votes.reserve(numVotes);
+    packed->weights.reserve(numVotes);
+    packed->classIds.reserve(numVotes);
+    packed->boundingBoxes.reserve(7 * numVotes);
+    packed->classIndices.reserve(numVotes);
+    packed->classWeights.reserve(numVotes);
+    packed->weightedClassIds.reserve(numClassWeights);
+    packed->weightedClassWeights.reserve(numClassWeights);
+
+    std::vector<std::size_t> voteOffsets(1, 0), classWeightOffsets(1, 0);
+    for (const std::shared_ptr<CodewordDistribution> &entry : entries)
     {
-        std::string path = "/home/vseib/Desktop/cwids/best.txt";
-        LOG_INFO("Reading in file with provided codeword indices from " << path);
-        std::ifstream ifs;
-        ifs.open(path, std::ifstream::in);
-        std::string line;
-        while(std::getline(ifs, line))
+        const FlatArray<Eigen::Vector3f> votes = entry->getVotes();
+        const FlatArray<float> weights = entry->getWeights();
+        const FlatArray<unsigned> classIds = entry->getClassIds();
+        const FlatArray<int> classIndices = entry->getVoteClassIndices();
+        const FlatArray<float> classWeights = entry->getVoteClassWeights();
+        packed->votes.insert(packed->votes.end(), votes.begin(), votes.end());
+        packed->weights.insert(packed->weights.end(), weights.begin(), weights.end());
+        packed->classIds.insert(packed->classIds.end(), classIds.begin(), classIds.end());
+        packed->classIndices.insert(packed->classIndices.end(), classIndices.begin(), classIndices.end());
+        packed->classWeights.insert(packed->classWeights.end(), classWeights.begin(), classWeights.end());
+        for (int i = 0; i < entry->getNumVotes(); i++)
         {
-            std::istringstream iss(line);
-            int a;
-            if (!(iss >> a)) { break; }
-            indices_to_use.push_back(a);
+            // the same layout as in the flat model
+            const Utils::BoundingBox bbox = entry->getBoundingBox(i);
+            const float values[7] = {bbox.rotQuat.R_component_1(), bbox.rotQuat.R_component_2(),
+                                     bbox.rotQuat.R_component_3(), bbox.rotQuat.R_component_4(),
+                                     bbox.size[0], bbox.size[1], bbox.size[2]};
+            packed->boundingBoxes.insert(packed->boundingBoxes.end(), values, values + 7);
         }
-        ifs.close();
+        voteOffsets.push_back(packed->votes.size());
+
+        std::map<unsigned, float> weightedClasses = entry->getClassWeights();
+        for (std::map<unsigned, float>::const_iterator it = weightedClasses.begin(); it != weightedClasses.end(); it++)
+        {
+            packed->weightedClassIds.push_back(it->first);
+            packed->weightedClassWeights.push_back(it->second);
+        }
+        classWeightOffsets.push_back(packed->weightedClassIds.size());
     }
 
-    // create distribution
-    int distribution_size;
-    ia >> distribution_size;
-    LOG_INFO("Loading codebook with size: " << distribution_size);
+    // the arrays are not resized anymore, the distributions refer to their slices
+    const FlatArray<Eigen::Vector3f> votes(packed->votes);
+    const FlatArray<float> weights(packed->weights);
+    const FlatArray<unsigned> classIds(packed->classIds);
+    const FlatArray<float> boundingBoxes(packed->boundingBoxes);
+    const FlatArray<int> classIndices(packed->classIndices);
+    const FlatArray<float> classWeights(packed->classWeights);
+    const FlatArray<unsigned> weightedClassIds(packed->weightedClassIds);
+    const FlatArray<float> weightedClassWeights(packed->weightedClassWeights);
+    for (int i = 0; i < (int)entries.size(); i++)
+    {
+        const std::size_t first = voteOffsets[i];
+        const std::size_t last = voteOffsets[i + 1];
+        CodewordDistribution::MappedVotes mapped;
+        mapped.packed = packed;
+        mapped.votes = votes.slice(first, last);
+        mapped.weights = weights.slice(first, last);
+        mapped.classIds = classIds.slice(first, last);
+        mapped.boundingBoxes = boundingBoxes.slice(7 * first, 7 * last);
+        mapped.classIndices = classIndices.slice(first, last);
+        mapped.classWeights = classWeights.slice(first, last);
+        mapped.weightedClassIds = weightedClassIds.slice(classWeightOffsets[i], classWeightOffsets[i + 1]);
+        mapped.weightedClassWeights = weightedClassWeights.slice(classWeightOffsets[i], classWeightOffsets[i + 1]);
+        entries[i]->setMappedVotes(entries[i]->getCodeword(), mapped);
+    }
+    LOG_INFO("packed " << numVotes << " votes of " << entries.size() << " codewords in co-activation order");
+}
 
-    for(int i = 0; i < distribution_size; i++)
+void Codebook::saveFlatData(FlatModelWriter &writer, boost::archive::binary_oarchive &oa) const
+{
+    // the class tables of the votes are stored, so that they are not created on the first detection
+    prepareDenseTables();
+    const std::vector<std::shared_ptr<CodewordDistribution> > order = getStorageOrder();
+
+    std::vector<int> ids, numFeatures;
+    std::vector<float> weights;
+    std::vector<uint64_t> descriptorOffsets(1, 0), featureClassOffsets(1, 0), voteOffsets(1, 0), classWeightOffsets(1, 0);
+    std::vector<unsigned> classWeightIds;
+    std::vector<float> classWeightValues;
+    for (const std::shared_ptr<CodewordDistribution> &entry : order)
     {
-        std::shared_ptr<CodewordDistribution> entry(new CodewordDistribution());
-        if(!entry.get())
+        const std::shared_ptr<Codeword>& codeword = entry->getCodeword();
+        ids.push_back(codeword->getId());
+        numFeatures.push_back(codeword->getNumFeatures());
+        weights.push_back(codeword->getWeight());
+        descriptorOffsets.push_back(descriptorOffsets.back() + codeword->getData().size());
+        featureClassOffsets.push_back(featureClassOffsets.back() + codeword->getFeatureClasses().size());
+        voteOffsets.push_back(voteOffsets.back() + entry->getNumVotes());
+
+        std::map<unsigned, float> classWeights = entry->getClassWeights();
+        for (std::map<unsigned, float>::const_iterator weight = classWeights.begin(); weight != classWeights.end(); weight++)
         {
-            LOG_ERROR("Could not create codeword distribution with index " << i << "!");
-            return false;
+            classWeightIds.push_back(weight->first);
+            classWeightValues.push_back(weight->second);
         }
+        classWeightOffsets.push_back(classWeightIds.size());
+    }
 
-        if(!entry->loadData(ia))
+    writer.addSection("codebook.codeword_ids", ids);
+    writer.addSection("codebook.codeword_num_features", numFeatures);
+    writer.addSection("codebook.codeword_weights", weights);
+    writer.addSection("codebook.descriptor_offsets", descriptorOffsets);
+    writer.addSection("codebook.feature_class_offsets", featureClassOffsets);
+    writer.addSection("codebook.vote_offsets", voteOffsets);
+    writer.addSection("codebook.class_weight_offsets", classWeightOffsets);
+    writer.addSection("codebook.class_weight_ids", classWeightIds);
+    writer.addSection("codebook.class_weight_values", classWeightValues);
+
+    // the large arrays are filled distribution by distribution when the writer is closed, the sections
+    // concurrently, see fillDistributions()
+    DistributionList entries = std::make_shared<const std::vector<std::shared_ptr<CodewordDistribution> > >(order);
+    const uint64_t numVotes = voteOffsets.back();
+    writer.addSection("codebook.descriptors", descriptorOffsets.back() * sizeof(float), fillDistributions<float>(entries,
+                      [](const CodewordDistribution &entry) { return FlatArray<float>(entry.getCodeword()->getData()); }));
+    writer.addSection("codebook.feature_classes", featureClassOffsets.back() * sizeof(unsigned), fillDistributions<unsigned>(entries,
+                      [](const CodewordDistribution &entry) { return FlatArray<unsigned>(entry.getCodeword()->getFeatureClasses()); }));
+    // flat models store float votes, compact votes are decoded
+    writer.addSection("codebook.votes", numVotes * sizeof(Eigen::Vector3f), [entries](char *data)
+    {
+        Eigen::Vector3f *votes = (Eigen::Vector3f*)data;
+        for (const std::shared_ptr<CodewordDistribution> &entry : *entries)
         {
-            LOG_ERROR("Could not read codeword distribution with index " << i << "!");
-            return false;
+            for (int i = 0; i < entry->getNumVotes(); i++)
+                *votes++ = entry->getVote(i);
         }
-
-        // for random codebook: skip features while loading
-        if(m_use_random_codebook)
+    });
+    writer.addSection("codebook.vote_weights", numVotes * sizeof(float), [entries](char *data)
+    {
+        float *weights = (float*)data;
+        for (const std::shared_ptr<CodewordDistribution> &entry : *entries)
         {
-            std::random_device rd;
-            std::mt19937 mt(rd());
-            std::uniform_int_distribution<int> dist(0, distribution_size);
-            if(dist(mt) > m_random_codebook_factor * distribution_size)
-                continue;
+            for (int i = 0; i < entry->getNumWeights(); i++)
+                *weights++ = entry->getWeight(i);
         }
-
-        if(debug_flag_read_in)
+    });
+    writer.addSection("codebook.vote_class_ids", numVotes * sizeof(unsigned), fillDistributions<unsigned>(entries,
+                      [](const CodewordDistribution &entry) { return entry.getClassIds(); }));
+    writer.addSection("codebook.vote_class_indices", numVotes * sizeof(int), fillDistributions<int>(entries,
+                      [](const CodewordDistribution &entry) { return entry.getVoteClassIndices(); }));
+    writer.addSection("codebook.vote_class_weights", numVotes * sizeof(float), fillDistributions<float>(entries,
+                      [](const CodewordDistribution &entry) { return entry.getVoteClassWeights(); }));
+    writer.addSection("codebook.vote_boxes", 7 * numVotes * sizeof(float), [entries](char *data)
+    {
+        float *values = (float*)data;
+        for (const std::shared_ptr<CodewordDistribution> &entry : *entries)
         {
-            int id = entry->getCodewordId();
-            bool found = false;
-            for(int xxx = 0; xxx < indices_to_use.size(); xxx++)
+            for (int i = 0; i < entry->getNumVotes(); i++)
             {
-                if(indices_to_use.at(xxx) == id)
-                {
-                    found = true;
-                    break;
-                }
+                // as in the archive, the position of the bounding box is not stored
+                const Utils::BoundingBox bbox = entry->getBoundingBox(i);
+                *values++ = bbox.rotQuat.R_component_1();
+                *values++ = bbox.rotQuat.R_component_2();
+                *values++ = bbox.rotQuat.R_component_3();
+                *values++ = bbox.rotQuat.R_component_4();
+                *values++ = bbox.size[0];
+                *values++ = bbox.size[1];
+                *values++ = bbox.size[2];
             }
-            if(found) m_distribution[entry->getCodewordId()] = entry;
-        }
-        else // this is the normal case
-        {
-            m_distribution[entry->getCodewordId()] = entry;
         }
+    });
 
-        if(debug_flag_write_out) ofs << entry->getCodewordId() << std::endl;
+    int class_sigmas_size = m_classSigmas.size();
+    oa << class_sigmas_size;
+    for (std::map<unsigned, float>::const_iterator it = m_classSigmas.begin(); it != m_classSigmas.end(); it++) {
+        int classId = it->first;
+        float sigma = it->second;
+        oa << classId;
+        oa << sigma;
     }
-    if(m_use_random_codebook) LOG_INFO("Reduced codebook size: " << m_distribution.size());
-    if(debug_flag_read_in) LOG_INFO("Loaded codebook size: " << m_distribution.size());
-    if(debug_flag_write_out) ofs.close();
 
-    // fill list with codewords
-    m_codewords.clear();
-    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
-        m_codewords.push_back(it->second->getCodeword());
+    m_activationStrategy->saveData(oa);
+}
 
-    m_codeword_dim = m_codewords.at(0)->getData().size();
+bool Codebook::loadFlatData(const std::shared_ptr<const FlatModel> &model, boost::archive::binary_iarchive &ia)
+{
+    m_flat_model.reset();
+    m_compact_vote_table.reset();
+    m_distribution.clear();
 
-    // fill list with partial codewords
-    if(m_use_partial_shot)
+    const FlatArray<int> ids = model->getSection<int>("codebook.codeword_ids");
+    const FlatArray<int> numFeatures = model->getSection<int>("codebook.codeword_num_features");
+    const FlatArray<float> weights = model->getSection<float>("codebook.codeword_weights");
+    const FlatArray<uint64_t> descriptorOffsets = model->getSection<uint64_t>("codebook.descriptor_offsets");
+    const FlatArray<uint64_t> featureClassOffsets = model->getSection<uint64_t>("codebook.feature_class_offsets");
+    const FlatArray<uint64_t> voteOffsets = model->getSection<uint64_t>("codebook.vote_offsets");
+    const FlatArray<uint64_t> classWeightOffsets = model->getSection<uint64_t>("codebook.class_weight_offsets");
+    const FlatArray<unsigned> classWeightIds = model->getSection<unsigned>("codebook.class_weight_ids");
+    const FlatArray<float> classWeightValues = model->getSection<float>("codebook.class_weight_values");
+    const FlatArray<float> descriptors = model->getSection<float>("codebook.descriptors");
+    const FlatArray<unsigned> featureClasses = model->getSection<unsigned>("codebook.feature_classes");
+    const FlatArray<Eigen::Vector3f> votes = model->getSection<Eigen::Vector3f>("codebook.votes");
+    const FlatArray<float> voteWeights = model->getSection<float>("codebook.vote_weights");
+    const FlatArray<unsigned> voteClassIds = model->getSection<unsigned>("codebook.vote_class_ids");
+    const FlatArray<int> voteClassIndices = model->getSection<int>("codebook.vote_class_indices");
+    const FlatArray<float> voteClassWeights = model->getSection<float>("codebook.vote_class_weights");
+    const FlatArray<float> voteBoxes = model->getSection<float>("codebook.vote_boxes");
+
+    // the offset tables must cover the arrays they index
+    const std::size_t size = ids.size();
+    const std::size_t numVotes = votes.size();
+    if (numFeatures.size() != size || weights.size() != size ||
+            descriptorOffsets.size() != size + 1 || descriptorOffsets[size] != descriptors.size() ||
+            featureClassOffsets.size() != size + 1 || featureClassOffsets[size] != featureClasses.size() ||
+            voteOffsets.size() != size + 1 || voteOffsets[size] != numVotes ||
+            classWeightOffsets.size() != size + 1 || classWeightOffsets[size] != classWeightIds.size() ||
+            classWeightValues.size() != classWeightIds.size() || voteWeights.size() != numVotes ||
+            voteClassIds.size() != numVotes || voteClassIndices.size() != numVotes ||
+            voteClassWeights.size() != numVotes || voteBoxes.size() != 7 * numVotes)
     {
-        int hist_size = 11;
-        std::string desc_type = "SHOT";
-        int shot_length = 352;
-        int cshot_length = 1344;
+        LOG_ERROR("the codebook sections of the flat model are not consistent");
+        return false;
+    }
 
-        LOG_INFO("creating partial shot descriptors");
-        for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
-        {
-            std::shared_ptr<Codeword> cw = it->second->getCodeword();
-            std::vector<float> descriptor = cw->getData();
+    // the votes of a codeword are read on its first activation, reading ahead would read those of its neighbors
+    if (model->getPrefetch() == "Lazy")
+    {
+        model->adviseRandom("codebook.votes");
+        model->adviseRandom("codebook.vote_weights");
+        model->adviseRandom("codebook.vote_class_ids");
+        model->adviseRandom("codebook.vote_class_indices");
+        model->adviseRandom("codebook.vote_class_weights");
+        model->adviseRandom("codebook.vote_boxes");
+    }
 
-            // create signature mask
-            std::vector<bool> signature_mask = getSignatureMask();
+    if (m_use_random_codebook)
+        LOG_WARN("random codebooks are not supported with flat models, loading the complete codebook");
 
-            if(descriptor.size() > shot_length)
-            {
-                desc_type = "CSHOT";
-            }
+    LOG_INFO("Mapping codebook with size: " << size);
+    std::vector<std::shared_ptr<CodewordDistribution> > order;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        std::shared_ptr<Codeword> codeword(new Codeword());
+        codeword->restore(ids[i], descriptors.slice(descriptorOffsets[i], descriptorOffsets[i + 1]), numFeatures[i],
+                          weights[i], featureClasses.slice(featureClassOffsets[i], featureClassOffsets[i + 1]));
+
+        const uint64_t first = voteOffsets[i];
+        const uint64_t last = voteOffsets[i + 1];
+        CodewordDistribution::MappedVotes mapped;
+        mapped.model = model;
+        mapped.votes = votes.slice(first, last);
+        mapped.weights = voteWeights.slice(first, last);
+        mapped.classIds = voteClassIds.slice(first, last);
+        mapped.boundingBoxes = voteBoxes.slice(7 * first, 7 * last);
+        mapped.classIndices = voteClassIndices.slice(first, last);
+        mapped.classWeights = voteClassWeights.slice(first, last);
+        mapped.weightedClassIds = classWeightIds.slice(classWeightOffsets[i], classWeightOffsets[i + 1]);
+        mapped.weightedClassWeights = classWeightValues.slice(classWeightOffsets[i], classWeightOffsets[i + 1]);
 
-            // prepare partial descriptor
-            std::vector<float> partial_descriptor;
-            if(desc_type == "SHOT")
-                partial_descriptor.reserve(shot_length/2);
-            else if(desc_type == "CSHOT")
-                partial_descriptor.reserve(cshot_length/2);
+        std::shared_ptr<CodewordDistribution> entry(new CodewordDistribution());
+        entry->setMappedVotes(codeword, mapped);
 
-            // handle SHOT or geometrical part of CSHOT
-            for (int j = 0; j < shot_length; j++)
-            {
-                int signature_index = (j/hist_size);
-                if(signature_mask.at(signature_index))
-                {
-                    partial_descriptor.push_back(descriptor[j]);
-                    //std::cout << j << " ";
-                }
-                else
-                {
-                    //std::cout << std::endl << "not using signature index: " << signature_index << std::endl;
-                    j += (hist_size-1); // add 1 less because loop also adds 1
-                }
-            }
+        // distributions shared with other classes are copied, the others stay mapped
+        if (!retainFilteredClasses(*entry))
+            continue;
 
-            if(desc_type == "CSHOT")
-            {
-                // handle color part of cshot
-                hist_size = 31;
-                for (int j = shot_length; j < descriptor.size(); j++)
-                {
-                    int signature_index = ((j-shot_length)/hist_size);
-                    if(signature_mask.at(signature_index))
-                    {
-                        partial_descriptor.push_back(descriptor[j]);
-                        //std::cout << j << " ";
-                    }
-                    else
-                    {
-                        //std::cout << std::endl << "not using signature index: " << signature_index << std::endl;
-                        j += (hist_size-1); // add 1 less because loop also adds 1
-                    }
-                }
-            }
+        // the codewords keep the order in which they were stored
+        m_distribution.insert(std::make_pair(ids[i], entry));
+        order.push_back(entry);
+    }
+    if (!m_class_filter.empty())
+        LOG_INFO("Codebook size of the loaded classes: " << m_distribution.size());
 
-            cw->setData(partial_descriptor, cw->getNumFeatures(), cw->getWeight());
-            m_codeword_dim = partial_descriptor.size();
-            m_partial_codewords.push_back(cw);
-        }
+    if (m_distribution.empty())
+    {
+        LOG_ERROR("the codebook contains no codewords of the classes to load");
+        return false;
     }
+    initCodewords(order);
 
-    // fill class sigmas
     int class_sigmas_size;
     ia >> class_sigmas_size;
     m_classSigmas.clear();
@@ -985,11 +2953,75 @@ bool Codebook::iLoadData(boost::archive::binary_iarchive &ia)
         m_classSigmas[classId] = sigma;
     }
 
+    // the stored class tables were created with the class indices of these sigmas, see prepareDenseTables()
+    m_dense_class_sigmas.clear();
+    for (std::map<unsigned, float>::const_iterator it = m_classSigmas.begin(); it != m_classSigmas.end(); it++)
+        m_dense_class_sigmas.push_back(it->second);
+    m_dense_tables_valid = true;
+
     m_activationStrategy->loadData(ia);
 
+    m_flat_model = model;
+    warmUpCodewords();
     return true;
 }
 
+void Codebook::warmUpCodewords() const
+{
+    if (m_warm_up_codewords.empty())
+        return;
+
+    // either a list of codeword ids or a voting report with its most voting codewords
+    std::ifstream file(m_warm_up_codewords.c_str());
+    Json::Value json;
+    Json::Reader reader;
+    if (!file || !reader.parse(file, json))
+    {
+        LOG_WARN("could not read the codewords to warm up from " << m_warm_up_codewords);
+        return;
+    }
+    if (json.isObject())
+        json = json["top_codewords"];
+    if (!json.isArray())
+    {
+        LOG_WARN("no codewords to warm up in " << m_warm_up_codewords);
+        return;
+    }
+
+    int numPagedIn = 0;
+    for (Json::ArrayIndex i = 0; i < json.size(); i++)
+    {
+        const Json::Value &id = json[i].isObject() ? json[i]["id"] : json[i];
+        if (!id.isInt())
+            continue;
+        distribution_t::const_iterator it = m_distribution.find(id.asInt());
+        if (it != m_distribution.end() && it->second->pageIn())
+            numPagedIn++;
+    }
+    LOG_INFO("paging in the votes of " << numPagedIn << " codewords to warm up");
+}
+
+FlatArray<float> Codebook::getMappedDescriptors(std::shared_ptr<const FlatModel> &model) const
+{
+    model.reset();
+    if (!m_flat_model || m_use_partial_shot)
+        return FlatArray<float>();
+
+    // the codebook must still consist of the stored codewords with descriptors of equal length
+    const FlatArray<int> ids = m_flat_model->getSection<int>("codebook.codeword_ids");
+    const FlatArray<float> descriptors = m_flat_model->getSection<float>("codebook.descriptors");
+    if (ids.empty() || ids.size() != m_codewords.size() || descriptors.size() != ids.size() * (std::size_t)m_codeword_dim)
+        return FlatArray<float>();
+    for (std::size_t i = 0; i < ids.size(); i++)
+    {
+        if (m_codewords[i]->getId() != ids[i])
+            return FlatArray<float>();
+    }
+
+    model = m_flat_model;
+    return descriptors;
+}
+
 Json::Value Codebook::iDataToJson() const
 {
     Json::Value data(Json::objectValue);
@@ -1002,6 +3034,15 @@ Json::Value Codebook::iDataToJson() const
         jsonDistribution.append(jsonEntry);
     }
 
+    data["ActivationStrategy"] = m_activationStrategy->dataToJson();
+    data["Distribution"] = jsonDistribution;
+    data["ClassSigmas"] = classSigmasToJson();
+
+    return data;
+}
+
+Json::Value Codebook::classSigmasToJson() const
+{
     Json::Value classSigmas(Json::arrayValue);
     for (std::map<unsigned, float>::const_iterator it = m_classSigmas.begin(); it != m_classSigmas.end(); it++) {
         int classId = it->first;
@@ -1011,12 +3052,113 @@ Json::Value Codebook::iDataToJson() const
         sigmaEntry["Sigma"] = Json::Value(sigma);
         classSigmas.append(sigmaEntry);
     }
+    return classSigmas;
+}
 
-    data["ActivationStrategy"] = m_activationStrategy->dataToJson();
-    data["Distribution"] = jsonDistribution;
-    data["ClassSigmas"] = classSigmas;
+bool Codebook::classSigmasFromJson(const Json::Value &classSigmas)
+{
+    if (classSigmas.isNull() || !classSigmas.isArray())
+        return false;
 
-    return data;
+    m_classSigmas.clear();
+    for (int i = 0; i < classSigmas.size(); i++) {
+        Json::Value sigmaEntry = classSigmas[i];
+        int classId = sigmaEntry["ClassId"].asUInt();
+        float sigma = sigmaEntry["Sigma"].asFloat();
+        m_classSigmas[classId] = sigma;
+    }
+    m_dense_tables_valid = false;
+    return true;
+}
+
+void Codebook::iDataToJsonStream(JsonStreamWriter &writer) const
+{
+    // the same members as iDataToJson(), only one distribution is converted at a time
+    writer.beginObject();
+    writer.key("ActivationStrategy");
+    m_activationStrategy->dataToJsonStream(writer);
+    writer.key("ClassSigmas");
+    writer.value(classSigmasToJson());
+    writer.key("Distribution");
+    writer.beginArray();
+    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
+        it->second->dataToJsonStream(writer);
+    writer.endArray();
+    writer.endObject();
+}
+
+bool Codebook::iDataFromJsonStream(JsonStreamReader &reader)
+{
+    if (!m_activationStrategy || m_distribution.size() > 0)
+        return false;
+
+    // clear
+    m_flat_model.reset();
+    m_compact_vote_table.reset();
+
+    // the members are read in any order, the distributions one at a time
+    bool hasActivationStrategy = false, hasDistribution = false, hasClassSigmas = false;
+    std::mt19937 mt((std::random_device())());
+    std::uniform_real_distribution<float> keep(0.0f, 1.0f);
+    if (!reader.beginObject())
+        return false;
+    std::string key;
+    while (reader.nextMember(key))
+    {
+        if (key == "ActivationStrategy")
+        {
+            if (!m_activationStrategy->dataFromJsonStream(reader))
+                return false;
+            hasActivationStrategy = true;
+        }
+        else if (key == "ClassSigmas")
+        {
+            Json::Value classSigmas;
+            if (!reader.readValue(classSigmas) || !classSigmasFromJson(classSigmas))
+                return false;
+            hasClassSigmas = true;
+        }
+        else if (key == "Distribution")
+        {
+            if (!reader.beginArray())
+                return false;
+            while (reader.nextElement())
+            {
+                Json::Value distrEntry;
+                if (!reader.readValue(distrEntry) || !distrEntry.isObject())
+                    return false;
+
+                std::shared_ptr<CodewordDistribution> entry(Factory<CodewordDistribution>::create(distrEntry));
+                if (!entry.get() || !entry->dataFromJson(distrEntry))
+                    return false;
+
+                // the size of the codebook is not known in advance, the random codebook keeps each codeword with
+                // the probability given by the factor
+                if (!retainFilteredClasses(*entry) || (m_use_random_codebook && keep(mt) > m_random_codebook_factor))
+                    continue;
+                m_distribution[entry->getCodewordId()] = entry;
+            }
+            hasDistribution = true;
+        }
+        else if (!reader.skipValue())
+        {
+            return false;
+        }
+    }
+    if (reader.failed() || !hasActivationStrategy || !hasDistribution || !hasClassSigmas)
+        return false;
+
+    LOG_INFO("Loaded codebook with size: " << m_distribution.size());
+    if (m_distribution.empty())
+    {
+        LOG_ERROR("the codebook contains no codewords of the classes to load");
+        return false;
+    }
+    initCodewords();
+
+    if (m_vote_storage == "Compact")
+        compactVotes();
+    return true;
 }
 
 bool Codebook::iDataFromJson(const Json::Value& object)
@@ -1116,99 +3258,16 @@ bool Codebook::iDataFromJson(const Json::Value& object)
         if(debug_flag_write_out) ofs << entry->getCodewordId() << std::endl;
     }
     if(m_use_random_codebook) LOG_INFO("Reduced codebook size: " << m_distribution.size());
-    if(debug_flag_read_in) LOG_INFO("Loaded codebook size: " << m_distribution.size())
+    if(debug_flag_read_in) LOG_INFO("Loaded codebook size: " << m_distribution.size());
 
             if(debug_flag_write_out) ofs.close();
 
 
-    // fill list with codewords
-    m_codewords.clear();
-    for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
-        m_codewords.push_back(it->second->getCodeword());
-
-    m_codeword_dim = m_codewords.at(0)->getData().size();
-
-    // fill list with partial codewords
-    if(m_use_partial_shot)
-    {
-        int hist_size = 11;
-        std::string desc_type = "SHOT";
-        int shot_length = 352;
-        int cshot_length = 1344;
-
-        LOG_INFO("creating partial shot descriptors");
-        for (distribution_t::const_iterator it = m_distribution.begin(); it != m_distribution.end(); it++)
-        {
-            std::shared_ptr<Codeword> cw = it->second->getCodeword();
-            std::vector<float> descriptor = cw->getData();
-
-            // create signature mask
-            std::vector<bool> signature_mask = getSignatureMask();
-
-            if(descriptor.size() > shot_length)
-            {
-                desc_type = "CSHOT";
-            }
-
-            // prepare partial descriptor
-            std::vector<float> partial_descriptor;
-            if(desc_type == "SHOT")
-                partial_descriptor.reserve(shot_length/2);
-            else if(desc_type == "CSHOT")
-                partial_descriptor.reserve(cshot_length/2);
-
-            // handle SHOT or geometrical part of CSHOT
-            for (int j = 0; j < shot_length; j++)
-            {
-                int signature_index = (j/hist_size);
-                if(signature_mask.at(signature_index))
-                {
-                    partial_descriptor.push_back(descriptor[j]);
-                    //std::cout << j << " ";
-                }
-                else
-                {
-                    //std::cout << std::endl << "not using signature index: " << signature_index << std::endl;
-                    j += (hist_size-1); // add 1 less because loop also adds 1
-                }
-            }
-
-            if(desc_type == "CSHOT")
-            {
-                // handle color part of cshot
-                hist_size = 31;
-                for (int j = shot_length; j < descriptor.size(); j++)
-                {
-                    int signature_index = ((j-shot_length)/hist_size);
-                    if(signature_mask.at(signature_index))
-                    {
-                        partial_descriptor.push_back(descriptor[j]);
-                        //std::cout << j << " ";
-                    }
-                    else
-                    {
-                        //std::cout << std::endl << "not using signature index: " << signature_index << std::endl;
-                        j += (hist_size-1); // add 1 less because loop also adds 1
-                    }
-                }
-            }
-
-            cw->setData(partial_descriptor, cw->getNumFeatures(), cw->getWeight());
-            m_codeword_dim = partial_descriptor.size();
-            m_partial_codewords.push_back(cw);
-        }
-    }
+    initCodewords();
 
 
     // fill class sigmas
-    m_classSigmas.clear();
-    for (int i = 0; i < classSigmas->size(); i++) {
-        Json::Value sigmaEntry = (*classSigmas)[i];
-        int classId = sigmaEntry["ClassId"].asUInt();
-        float sigma = sigmaEntry["Sigma"].asFloat();
-        m_classSigmas[classId] = sigma;
-    }
-    return true;
+    return classSigmasFromJson(*classSigmas);
 }
 
 std::vector<bool> Codebook::getSignatureMask() const
@@ -1296,6 +3355,35 @@ std::vector<bool> Codebook::getSignatureMask() const
 
     return result;
 }
+
+void Codebook::buildPartialShotPlans()
+{
+    // SHOT descriptor has 32 signature bins with 11 values each, CSHOT appends 32 color histograms with 31 values each
+    const int shot_hist_size = 11;
+    const int color_hist_size = 31;
+    const int shot_length = 352;
+    const int cshot_length = 1344;
+
+    const std::vector<bool> signature_mask = getSignatureMask();
+    m_partial_shot_plan.clear();
+    for (int j = 0; j < shot_length; j++)
+    {
+        if(signature_mask[j / shot_hist_size])
+            m_partial_shot_plan.push_back(j);
+    }
+
+    m_partial_cshot_plan = m_partial_shot_plan;
+    for (int j = shot_length; j < cshot_length; j++)
+    {
+        if(signature_mask[(j - shot_length) / color_hist_size])
+            m_partial_cshot_plan.push_back(j);
+    }
+}
+
+const std::vector<int>& Codebook::getPartialShotPlan(std::size_t descriptor_size) const
+{
+    return descriptor_size > 352 ? m_partial_cshot_plan : m_partial_shot_plan;
+}
 }
 
 
@@ -14,10 +14,18 @@
 #include "../utils/json_object.h"
 #include "../utils/utils.h"
 #include "../utils/ism_feature.h"
+#include "../utils/knn_index.h"
+#include "../utils/product_quantizer.h"
+#include "../utils/scalar_quantizer.h"
+#include "../utils/activation_cache.h"
+#include "../utils/recall_monitor.h"
+#include "../utils/flat_model.h"
 #include "codeword.h"
 
 #include <list>
+#include <set>
 #include <string>
+#include <mutex>
 #include <fstream>
 #include <boost/shared_ptr.hpp>
 
@@ -31,9 +39,15 @@
 namespace ism3d
 {
     class ActivationStrategy;
+    class ActivationStrategyKNN;
+    class ActivationStrategyINN;
+    class ActivationStrategyThreshold;
     class CodewordDistribution;
     class Distance;
     class Voting;
+    class FlannHelper;
+    class FeatureStore;
+    struct ActivationResult;
 
     /**
      * @brief The Codebook class
@@ -55,17 +69,19 @@ namespace ism3d
         ~Codebook();
 
         /**
-         * @brief Activate codewords with detected features based on the activation strategy.
+         * @brief Activate codewords with detected features based on the activation strategy. The features of a class
+         * are matched with batched index searches and the distribution entries are created by ActivationThreads
+         * threads, the result is the same for any number of threads.
          * @param codewords the codewords which shall be activated with the features
-         * @param features the features for each model in a class
+         * @param features the features for each model in a class, loaded one class at a time
          * @param boundingBoxes the bounding boxes for each model in a class
          * @param distance the distance measure to compare codewords to features
          */
         template<typename T>
         void activate(const std::vector<std::shared_ptr<Codeword> >& codewords,
-                      const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+                      const FeatureStore& features,
                       const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
-                      const Distance* distance, flann::Index<T> &index, const bool flann_exact_match);
+                      const Distance* distance, KnnIndex<T> &index, const bool flann_exact_match);
 
         /**
          * @brief Activate the codebook using detected features and cast the votes from activated codewords
@@ -76,13 +92,94 @@ namespace ism3d
          */
         template<typename T>
         void castVotes(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance, Voting& voting,
-                        flann::Index<T>& index, const bool flann_exact_match) const;
+                        KnnIndex<T>& index, const bool flann_exact_match) const;
 
 
         // as above, but used for const pointer
         template<typename T>
         void castVotes(pcl::PointCloud<ISMFeature>::ConstPtr features, const Distance* distance, Voting& voting,
-                        flann::Index<T> &index, const bool flann_exact_match) const;
+                        KnnIndex<T> &index, const bool flann_exact_match) const;
+
+        // activates the codebook without casting votes, see below
+        template<typename T>
+        void activateFeatures(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance, KnnIndex<T> &index,
+                              const bool flann_exact_match, ActivationResult &activation) const;
+
+        /**
+         * @brief Activate codewords as above, with the code path specialized on the distance of the index.
+         * @param flann_helper the helper holding the index that was built on the codewords
+         */
+        void activate(const std::vector<std::shared_ptr<Codeword> >& codewords,
+                      const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> >& features,
+                      const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
+                      const Distance* distance, const FlannHelper &flann_helper, const bool flann_exact_match);
+
+        /**
+         * @brief Activate codewords as above, with the features of the models read from a feature store, so that
+         * only the features of one class are in memory at a time.
+         */
+        void activate(const std::vector<std::shared_ptr<Codeword> >& codewords,
+                      const FeatureStore& features,
+                      const std::map<unsigned, std::vector<Utils::BoundingBox> >& boundingBoxes,
+                      const Distance* distance, const FlannHelper &flann_helper, const bool flann_exact_match);
+
+        /**
+         * @brief Cast votes as above, with the code path specialized on the distance of the index.
+         * @param flann_helper the helper holding the index that was built on the codewords
+         */
+        void castVotes(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance, Voting& voting,
+                       const FlannHelper &flann_helper, const bool flann_exact_match) const;
+
+        /**
+         * @brief Activate the codebook using detected features without casting votes, castVotes() with the
+         * activation then casts the votes. An activation can be used to cast votes several times, e.g. with
+         * different weight parameters.
+         * @param features the detected features, they are not changed by partial descriptors
+         * @param distance the distance measure to compare codewords to features
+         * @param flann_helper the helper holding the index that was built on the codewords
+         * @param activation output: the activated codewords of each feature with the descriptor distances, codeword
+         * indices refer to getCodewords()
+         */
+        void activateFeatures(pcl::PointCloud<ISMFeature>::Ptr features, const Distance* distance,
+                              const FlannHelper &flann_helper, const bool flann_exact_match, ActivationResult &activation) const;
+
+        // the nearest neighbor and threshold activations can be restricted to the classes of a class cascade
+        bool supportsClassCascade() const
+        {
+            return m_activation_type == ActivationKNN || m_activation_type == ActivationThreshold;
+        }
+
+        /**
+         * @brief Get the number of votes of each class for the given codewords, in their order.
+         */
+        std::vector<std::map<unsigned, int> > getClassVoteCounts(const std::vector<std::shared_ptr<Codeword> > &codewords) const;
+
+        /**
+         * @brief Cast the votes of an activation computed with activateFeatures() into a voting space, using the
+         * current weight parameters.
+         * @param features the features the activation was computed with
+         * @param activation the activation
+         * @param voting the class representing the voting space in which votes shall be cast
+         */
+        void castVotes(const pcl::PointCloud<ISMFeature> &features, const ActivationResult &activation, Voting& voting) const;
+
+        /**
+         * @brief Remove the codewords of lowest utility after the activation, until at most PruneTargetSize
+         * codewords with at most PruneVoteBudget votes are left. The utility of a codeword is the purity of the
+         * classes it votes for times the ratio of its correct and wrong activations by held out features. The
+         * weights are recomputed, the index has to be rebuilt on the remaining codewords.
+         * @param queries descriptors of training features, each activates its PruneNeighbors nearest codewords
+         * @param query_classes the class id of each query
+         * @param query_codeword_ids the id of the codeword each query was clustered into, it is excluded from the
+         * neighbors of the query, or -1
+         * @param distance the distance measure the codebook was activated with
+         * @param flann_helper the helper holding the index that was built on the codewords
+         * @param flann_exact_match whether the queries are searched exactly
+         * @return the number of removed codewords
+         */
+        int prune(const flann::Matrix<float>& queries, const std::vector<unsigned>& query_classes,
+                  const std::vector<int>& query_codeword_ids, const Distance* distance,
+                  const FlannHelper& flann_helper, const bool flann_exact_match);
 
         /**
          * @brief Add another distribution entry to the codebook. If the codebook already contains a distribution
@@ -123,7 +220,7 @@ namespace ism3d
          * @brief Get all codewords contained in the codebook.
          * @return a list of codewords
          */
-        std::vector<std::shared_ptr<Codeword> > getCodewords(std::string warn = "") const;
+        const std::vector<std::shared_ptr<Codeword> >& getCodewords(std::string warn = "") const;
         std::vector<std::shared_ptr<Codeword> > getCompleteCodewords() const;
         std::vector<std::shared_ptr<Codeword> > getPartialCodewords() const;
 
@@ -154,6 +251,13 @@ namespace ism3d
          */
         int getNumOfFeaturesForClass(unsigned classId) const;
 
+        /**
+         * @brief Estimate the memory used by the codeword distributions and compressed codes, the codewords
+         * themselves are not included.
+         * @return the number of bytes
+         */
+        std::size_t getMemoryUsage() const;
+
         /**
          * @brief Get the class ids
          * @return the vector containing the class ids for the current codebook
@@ -171,6 +275,104 @@ namespace ism3d
          */
         void clear();
 
+        /**
+         * @brief Restrict the following loads to the votes of the given classes. Distributions without votes of
+         * these classes are skipped while loading, distributions shared with other classes only keep the votes of
+         * these classes and the compressed codes of skipped codewords are dropped. The class sigmas are kept, so that
+         * the compact class indices match the complete model.
+         * @param classIds the classes to load, empty for all classes
+         */
+        void setClassFilter(const std::set<unsigned>& classIds);
+
+        /**
+         * @brief Replace the codeword descriptors by product quantization codes or by reduced precision scalar
+         * quantization codes, binary descriptors by codes of one bit per dimension. The descriptors are only kept if they are needed for re-ranking or by an activation
+         * strategy that computes its own distances.
+         */
+        void compress();
+
+        /**
+         * @brief Get the product or scalar quantization codes of the given codewords.
+         * @param codewords the codewords
+         * @param codes output: the codes in the order of the codewords
+         * @return false if a codeword has no code
+         */
+        bool getCompressedCodes(const std::vector<std::shared_ptr<Codeword> >& codewords, std::vector<uint8_t>& codes) const;
+
+        // the compressed data is stored separately, so that models without compression can still be read
+        void saveCompressedData(boost::archive::binary_oarchive &oa) const;
+        bool loadCompressedData(boost::archive::binary_iarchive &ia);
+
+        // scalar quantization is stored after all other model data, so that models written before can still be read
+        void saveScalarQuantizedData(boost::archive::binary_oarchive &oa) const;
+        bool loadScalarQuantizedData(boost::archive::binary_iarchive &ia);
+
+        /**
+         * @brief Store the codebook in a flat model instead of saveData(). The codewords and the per-vote data of the
+         * distributions are written as sections of contiguous arrays in the order of the codeword ids, the per-codeword
+         * parts are indexed by offset tables. The class sigmas and the activation strategy are written to the archive.
+         * @param writer the flat model
+         * @param oa the archive for the remaining data
+         */
+        void saveFlatData(FlatModelWriter &writer, boost::archive::binary_oarchive &oa) const;
+
+        /**
+         * @brief Load a codebook stored with saveFlatData(). The distributions read their votes from the mapped model,
+         * the codewords are created with a copy of their descriptors.
+         * @param model the mapped flat model
+         * @param ia the archive with the remaining data
+         * @return false if the sections of the model are not consistent
+         */
+        bool loadFlatData(const std::shared_ptr<const FlatModel> &model, boost::archive::binary_iarchive &ia);
+
+        /**
+         * @brief Get the descriptors of the codewords in the mapped flat model the codebook was loaded from, so that
+         * an index can use them without a copy.
+         * @param model output: the flat model, the descriptors are valid while it is kept
+         * @return the descriptors of getCodewords() in their order, empty if the codebook was not loaded from a flat
+         * model, was changed since or uses partial descriptors
+         */
+        FlatArray<float> getMappedDescriptors(std::shared_ptr<const FlatModel> &model) const;
+
+        bool useCompression() const
+        {
+            return m_compression == "PQ" || m_compression == "FP16" || m_compression == "UInt8" || m_compression == "Binary";
+        }
+
+        bool usePruning() const
+        {
+            return m_prune_target_size > 0 || m_prune_vote_budget > 0;
+        }
+
+        // number of training features used as held out data for pruning
+        int getPruneSamples() const
+        {
+            return m_prune_samples;
+        }
+
+        bool isCompressed() const
+        {
+            return m_quantizer.get() != 0 || m_scalar_quantizer.get() != 0;
+        }
+
+        // the product quantizer, null if the codebook is not compressed or uses scalar quantization
+        std::shared_ptr<const ProductQuantizer> getQuantizer() const
+        {
+            return m_quantizer;
+        }
+
+        // the scalar quantizer, null if the codebook is not compressed or uses product quantization
+        std::shared_ptr<const ScalarQuantizer> getScalarQuantizer() const
+        {
+            return m_scalar_quantizer;
+        }
+
+        // number of approximate nearest codewords that are re-ranked with the exact distance
+        int getNumRerank() const
+        {
+            return m_pq_rerank;
+        }
+
         bool usePartialShot() const
         {
             return m_use_partial_shot;
@@ -186,6 +388,35 @@ namespace ism3d
             return m_codewords.size();
         }
 
+        bool useActivationCache() const
+        {
+            return m_use_activation_cache;
+        }
+
+        // activations cached across detections, see UseActivationCache
+        const ActivationCache& getActivationCache() const
+        {
+            return m_activation_cache;
+        }
+
+        // recall of the approximate codeword search sampled during detection, see RecallSampleRate
+        const RecallMonitor& getRecallMonitor() const
+        {
+            return m_recall_monitor;
+        }
+
+        bool useRecallMonitor() const
+        {
+            return m_recall_sample_rate > 0;
+        }
+
+        // the number of distributions per independently decoded chunk of the model archive, 0 writes them one
+        // after another, see ArchiveChunkSize
+        void setArchiveChunkSize(int chunkSize)
+        {
+            m_archive_chunk_size = chunkSize;
+        }
+
     protected:
         Json::Value iChildConfigsToJson() const;
         bool iChildConfigsFromJson(const Json::Value&);
@@ -196,10 +427,127 @@ namespace ism3d
         Json::Value iDataToJson() const;
         bool iDataFromJson(const Json::Value&);
 
+        // the distributions are written and read one by one
+        void iDataToJsonStream(JsonStreamWriter &writer) const;
+        bool iDataFromJsonStream(JsonStreamReader &reader);
+
+        void iMemoryUsage(MemoryUsage &usage) const;
+
     private:
 
         std::vector<bool> getSignatureMask() const;
 
+        // builds the descriptor indices kept by partial shot from the signature mask
+        void buildPartialShotPlans();
+
+        // the descriptor indices kept by partial shot for a SHOT or CSHOT descriptor of the given length
+        const std::vector<int>& getPartialShotPlan(std::size_t descriptor_size) const;
+
+        // computes the codeword and class weights from the distribution and prepares the activation strategy
+        void computeWeights(const Distance* distance);
+
+        // builds the compact class index tables used for vote casting if the codebook changed
+        void prepareDenseTables() const;
+
+        // maps the codeword indices of getCodewords() to their distributions if the codebook changed
+        void prepareCodewordEntries() const;
+
+        // fills the lists of codewords from the loaded distributions, in storage order or in the given order
+        void initCodewords();
+        void initCodewords(const std::vector<std::shared_ptr<CodewordDistribution> > &order);
+
+        // the distributions in the order in which their codewords and votes are stored, see CodewordOrder
+        std::vector<std::shared_ptr<CodewordDistribution> > getStorageOrder() const;
+
+        // copies the per-vote data of the owned distributions into contiguous arrays in the storage order
+        void packVotes() const;
+
+        // applies the class filter to a loaded distribution, returns false if it has no votes left
+        bool retainFilteredClasses(CodewordDistribution &distribution) const;
+
+        // drops the compressed codes of codewords that were not loaded because of the class filter
+        void retainFilteredCodes();
+
+        // sets the activation type and the typed pointers after m_activationStrategy was created
+        void resolveActivationStrategy();
+
+        // requests the pages of the mapped votes of the codewords listed in the warm up file
+        void warmUpCodewords() const;
+
+        // the class sigmas as stored in the json data
+        Json::Value classSigmasToJson() const;
+        bool classSigmasFromJson(const Json::Value &classSigmas);
+
+        // collects the bounding box sizes of all votes for compact vote storage
+        std::shared_ptr<CodewordDistribution::CompactVoteTable> createCompactVoteTable() const;
+
+        // stores the votes of all distributions compactly, see CodewordDistribution::compactVotes()
+        void compactVotes();
+
+        // writes the distributions in chunks of m_archive_chunk_size, each chunk is an archive of its own
+        // and the archive starts with the offsets of the chunks
+        void saveDistributionChunks(boost::archive::binary_oarchive &oa,
+                                    const std::vector<std::shared_ptr<CodewordDistribution> > &order,
+                                    const std::shared_ptr<const CodewordDistribution::CompactVoteTable> &table) const;
+
+        // decodes the chunks written by saveDistributionChunks() in parallel, distributions removed by the class
+        // filter are left empty
+        bool loadDistributionChunks(boost::archive::binary_iarchive &ia, int distribution_size,
+                                    const std::shared_ptr<const CodewordDistribution::CompactVoteTable> &table,
+                                    std::vector<std::shared_ptr<CodewordDistribution> > &entries) const;
+
+        // activates the codewords with the query descriptors, returns true if the result contains the descriptor distances;
+        // in chunks if the detection can be cancelled, see CancellationToken
+        template<typename T>
+        bool activateBatch(const flann::Matrix<float> &queries, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                           KnnIndex<T> &index, const bool flann_exact_match, int num_threads, ActivationResult &activation) const;
+
+        // activates the codewords with all query descriptors at once
+        template<typename T>
+        bool activateChunk(const flann::Matrix<float> &queries, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                           KnnIndex<T> &index, const bool flann_exact_match, int num_threads, ActivationResult &activation) const;
+
+        // queues a sample of the queries of an approximate search for the exact search of the recall monitor
+        template<typename T>
+        void sampleRecall(const flann::Matrix<float> &queries, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                          const ActivationResult &activation) const;
+
+        // the codewords kept alive for the exact searches of the recall monitor, a list other than getCodewords() is
+        // copied, since it may be released before the search
+        std::shared_ptr<const std::vector<std::shared_ptr<Codeword> > > getRecallCodewords(
+                const std::vector<std::shared_ptr<Codeword> > &codewords) const;
+
+        // activates the codewords with the training features of a class, with direct assignment the feature i
+        // activates the codeword first_codeword + i
+        template<typename T>
+        void activateTraining(const pcl::PointCloud<ISMFeature> &features, const flann::Matrix<float> &queries,
+                              const std::vector<std::shared_ptr<Codeword> > &codewords, const Distance* distance, KnnIndex<T> &index, const bool flann_exact_match,
+                              int first_codeword, int num_threads, ActivationResult &activation) const;
+
+        // variance of the distances between the features and the codewords over all pairs, or over SigmaSamples
+        // randomly drawn pairs
+        float computeClassVariance(const flann::Matrix<float> &features, const std::vector<std::shared_ptr<Codeword> > &codewords,
+                                   const Distance* distance, int num_threads, unsigned seed) const;
+
+        // groups the descriptors of a detection that are equal after quantization with SceneDeduplicationStep,
+        // groupOf maps each feature to its group, the first feature of a group represents it; returns the
+        // number of groups
+        int groupSceneDescriptors(const flann::Matrix<float> &queries, std::vector<int> &groupOf, std::vector<int> &representatives) const;
+
+        // activates the codewords of the candidate classes selected by the class cascade of the index, each candidate
+        // class is searched in its own index; returns false if the cascade does not exclude any class
+        bool activateCascade(const flann::Matrix<float> &queries, const FlannHelper &flann_helper, const bool flann_exact_match,
+                             ActivationResult &activation) const;
+
+        // searches a class index of the cascade with activateBatch()
+        struct CascadeVisitor;
+
+        // as above, but reuses the activations of features seen in previous detections
+        template<typename T>
+        bool activateCached(const pcl::PointCloud<ISMFeature> &features, const flann::Matrix<float> &queries, const Distance &distance,
+                            const std::vector<std::shared_ptr<Codeword> > &codewords, KnnIndex<T> &index,
+                            const bool flann_exact_match, ActivationResult &activation) const;
+
         typedef std::map<int, std::shared_ptr<CodewordDistribution> > distribution_t; // maps codeword id to corresponding distribution
         distribution_t m_distribution;
 
@@ -208,24 +556,100 @@ namespace ism3d
         std::map<unsigned, float> m_term3;
 
         ActivationStrategy* m_activationStrategy;
+        // the type of m_activationStrategy, resolved once when the strategy is created, see resolveActivationStrategy()
+        enum ActivationType { ActivationKNN, ActivationINN, ActivationThreshold, ActivationOther };
+        ActivationType m_activation_type;
+        ActivationStrategyKNN* m_activation_knn; // m_activationStrategy if its type is KNN, else null
+        ActivationStrategyINN* m_activation_inn; // m_activationStrategy if its type is INN, else null
+        ActivationStrategyThreshold* m_activation_threshold; // m_activationStrategy if its type is Threshold, else null
         std::map<unsigned, float> m_classSigmas;
+
+        // class sigmas indexed by compact class index, created lazily from m_classSigmas and m_distribution
+        mutable std::vector<float> m_dense_class_sigmas;
+        mutable std::map<unsigned, int> m_dense_class_indices;
+        mutable bool m_dense_tables_valid;
+
+        // the distribution of each codeword of getCodewords() in its order, null for codewords without distribution,
+        // created lazily from m_distribution
+        mutable std::vector<CodewordDistribution*> m_codeword_entries;
+        mutable bool m_codeword_entries_valid;
+
+        // getCodewords() as searched by the exact searches of the recall monitor, shared by all sampled chunks,
+        // created lazily and released when the codewords change
+        mutable std::shared_ptr<const std::vector<std::shared_ptr<Codeword> > > m_recall_codewords;
         bool m_useClassWeight;
         bool m_useVoteWeight;
         bool m_useMatchingWeight;
         bool m_useCodewordWeight;
+        int m_max_votes_per_activation; // votes with the highest learned weights cast per activation, 0 for all
 
         bool m_use_random_codebook;
         float m_random_codebook_factor;
 
         bool m_directly_assign_codewords; // with knn=1 activation, directly assign features to codewords instead of flann matching
+        int m_activation_threads; // threads used for activation in training, 0 uses the OpenMP default
+        int m_sigma_samples; // number of feature and codeword pairs sampled for the class sigmas, 0 uses all pairs
 
         int m_codeword_dim; // feature dimensions (i.e. length of descriptor)
+        std::shared_ptr<const FlatModel> m_flat_model; // the flat model the codebook was loaded from, if any
+        std::string m_warm_up_codewords; // json file of codeword ids whose votes are paged in on loading a flat model
+        std::set<unsigned> m_class_filter; // the classes loaded by the next load, empty for all classes
 
         bool m_use_partial_shot;
         std::string m_partial_shot_type;
+        std::vector<int> m_partial_shot_plan; // SHOT descriptor indices of the signature bins in the mask
+        std::vector<int> m_partial_cshot_plan; // CSHOT descriptor indices of the signature bins in the mask
 
         std::vector<std::shared_ptr<Codeword> > m_codewords;
         std::vector<std::shared_ptr<Codeword> > m_partial_codewords;
+
+        std::string m_compression; // "None", "PQ", "FP16", "UInt8" or "Binary"
+        std::string m_vote_storage; // "Float" or "Compact"
+        std::string m_codeword_order; // "Id" or "CoActivation"
+
+        // the bounding box sizes referenced by compact distributions, null if no distribution is compact
+        std::shared_ptr<const CodewordDistribution::CompactVoteTable> m_compact_vote_table;
+        int m_pq_subspaces;
+        int m_pq_centroids;
+        int m_pq_iterations;
+        int m_pq_training_samples;
+        int m_pq_rerank;
+
+        // product or scalar quantization codes, row i belongs to the codeword with id m_compressed_codeword_ids[i]
+        std::shared_ptr<ProductQuantizer> m_quantizer;
+        std::shared_ptr<ScalarQuantizer> m_scalar_quantizer;
+        std::vector<uint8_t> m_compressed_codes;
+        std::vector<int> m_compressed_codeword_ids;
+
+        // activations of previous detections, keyed on keypoint position and descriptor signature
+        bool m_use_activation_cache;
+        float m_activation_cache_cell_size;
+        float m_activation_cache_signature_step;
+        float m_activation_cache_tolerance; // maximum descriptor distance for reusing an activation
+        int m_activation_cache_memory;      // in MB
+        mutable ActivationCache m_activation_cache;
+
+        // fraction of the approximate activation queries searched exactly in the background, 0 disables it
+        float m_recall_sample_rate;
+        int m_recall_max_pending; // sampled queries waiting for their exact search at most
+        mutable RecallMonitor m_recall_monitor;
+
+        // distributions per chunk of the model archive, decoded in parallel on loading; 0 for the sequential layout
+        int m_archive_chunk_size;
+
+        // features of a detection with equal quantized descriptors are activated once
+        bool m_use_scene_deduplication;
+        float m_scene_deduplication_step;
+
+        // guards the state that concurrent detections share: the activation cache, the dense tables and the
+        // preparation of the activation strategy
+        mutable std::mutex m_detection_mutex;
+
+        // pruning after the activation, a limit of 0 disables it
+        int m_prune_target_size;
+        int m_prune_vote_budget;
+        int m_prune_samples;
+        int m_prune_neighbors; // nearest codewords activated by a held out feature
     };
 }
 
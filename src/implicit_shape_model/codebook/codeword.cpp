@@ -13,7 +13,7 @@
 
 namespace ism3d
 {
-    int Codeword::m_maxId = 0;
+    std::atomic<int> Codeword::m_maxId(0);
 
     Codeword::Codeword(const std::vector<float>& data, int numFeatures, float weight)
     {
@@ -21,22 +21,29 @@ namespace ism3d
         m_numFeatures = numFeatures;
         m_weight = weight;
 
-        m_id = m_maxId;
-        m_maxId++;
+        m_id = m_maxId++;
     }
 
     Codeword::Codeword()
     {
-        m_id = m_maxId;
+        m_id = m_maxId++;
         m_numFeatures = 0;
         m_weight = 1.0f;
-        m_maxId++;
     }
 
     Codeword::~Codeword()
     {
     }
 
+    void Codeword::reserveId(int id)
+    {
+        // raise the next id atomically, codewords may be created or loaded concurrently
+        int next = m_maxId.load();
+        while (next <= id && !m_maxId.compare_exchange_weak(next, id + 1))
+        {
+        }
+    }
+
     void Codeword::setData(const std::vector<float>& data, int numFeatures, float weight)
     {
         m_data = std::vector<float>(data);
@@ -44,11 +51,28 @@ namespace ism3d
         m_weight = weight;
     }
 
+    void Codeword::restore(int id, FlatArray<float> data, int numFeatures, float weight, FlatArray<unsigned> featureClasses)
+    {
+        m_id = id;
+        m_data.assign(data.begin(), data.end());
+        m_numFeatures = numFeatures;
+        m_weight = weight;
+        m_featureClasses.assign(featureClasses.begin(), featureClasses.end());
+
+        // codewords created after loading must not reuse the loaded ids
+        reserveId(m_id);
+    }
+
     const std::vector<float>& Codeword::getData() const
     {
         return m_data;
     }
 
+    void Codeword::releaseData()
+    {
+        std::vector<float>().swap(m_data);
+    }
+
     int Codeword::getId() const
     {
         return m_id;
@@ -86,7 +110,7 @@ namespace ism3d
         oa << m_numFeatures;
         oa << m_weight;
 
-        m_maxId = m_id + 1; // TODO VS: remove this
+        reserveId(m_id); // TODO VS: remove this
 
         oa << m_featureClasses;
         oa << m_data;
@@ -100,6 +124,9 @@ namespace ism3d
         ia >> m_featureClasses;
         ia >> m_data;
 
+        // codewords created after loading must not reuse the loaded ids
+        reserveId(m_id);
+
         return true;
     }
 
@@ -110,7 +137,7 @@ namespace ism3d
         object["NumFeatures"] = m_numFeatures;
         object["Weight"] = m_weight;
 
-        m_maxId = m_id + 1;
+        reserveId(m_id);
 
         Json::Value classes(Json::arrayValue);
         classes.resize(m_featureClasses.size());
@@ -151,6 +178,7 @@ namespace ism3d
         }
 
         m_id = id->asInt();
+        reserveId(m_id);
         m_numFeatures = numFeatures->asInt();
         m_featureClasses.resize(classes->size());
         m_data.resize(dataArray->size());
@@ -13,11 +13,14 @@
 
 #include "../utils/json_object.h"
 
+#include <atomic>
 #include <vector>
 #include <fstream>
 #include <Eigen/Core>
 #include <boost/shared_ptr.hpp>
 
+#include "../utils/flat_model.h"
+
 namespace ism3d
 {
     /**
@@ -54,6 +57,21 @@ namespace ism3d
          */
         const std::vector<float>& getData() const;
 
+        /**
+         * @brief Free the data vector, used if the codebook stores the descriptors in compressed form.
+         */
+        void releaseData();
+
+        /**
+         * @brief Restore a codeword stored in a flat model, see Codebook::loadFlatData().
+         * @param id the stored codeword id
+         * @param data the data vector
+         * @param numFeatures the number of features from which the codeword was learned
+         * @param weight computed weight of the descriptor that represents the codeword
+         * @param featureClasses the classes of the features from which the codeword was learned
+         */
+        void restore(int id, FlatArray<float> data, int numFeatures, float weight, FlatArray<unsigned> featureClasses);
+
         /**
          * @brief Get the codeword id.
          * @return the codeword id
@@ -88,7 +106,10 @@ namespace ism3d
         bool iDataFromJson(const Json::Value&);
 
     private:
-        static int m_maxId;
+        // makes sure that ids allocated later are larger than the given id
+        static void reserveId(int id);
+
+        static std::atomic<int> m_maxId; // the next id, allocated atomically so that codewords can be created in parallel
         int m_id;
         float m_weight; // descriptor weight
         std::vector<float> m_data; // this is the descriptor
@@ -16,8 +16,14 @@
 #include "../voting/voting.h"
 #include "../utils/utils.h"
 #include "../utils/distance.h"
+#include "../utils/distance_kernels.h"
 #include "../utils/exception.h"
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+
 namespace ism3d
 {
     inline float gaussDist(float sigmaSqr, float dist)
@@ -25,8 +31,59 @@ namespace ism3d
         return (1 / sqrt(2*M_PI*sigmaSqr)) * exp(-pow(dist, 2) / (2 * sigmaSqr));
     }
 
+    namespace
+    {
+        // the vote vectors and learned weights read by castVotesKernel(), owned or mapped
+        struct FloatVotes
+        {
+            FlatArray<Eigen::Vector3f> votes;
+            FlatArray<float> weights;
+
+            int size() const { return (int)votes.size(); }
+            const Eigen::Vector3f& vote(int i) const { return votes[i]; }
+            float weight(int i) const { return weights[i]; }
+        };
+
+        // the vote vectors and learned weights stored by compactVotes()
+        struct CompactVoteReader
+        {
+            const int16_t *votes;
+            const uint16_t *weights;
+            float scale;
+            int count;
+
+            int size() const { return count; }
+            Eigen::Vector3f vote(int i) const
+            {
+                return scale * Eigen::Vector3f((float)votes[3 * i], (float)votes[3 * i + 1], (float)votes[3 * i + 2]);
+            }
+            float weight(int i) const { return DistanceKernels::halfToFloat(weights[i]); }
+        };
+
+        const float QuaternionScale = 32767.0f;
+
+        bool lessSize(const Eigen::Vector3f& a, const Eigen::Vector3f& b)
+        {
+            return std::lexicographical_compare(a.data(), a.data() + 3, b.data(), b.data() + 3);
+        }
+    }
+
+    void CodewordDistribution::CompactVoteTable::finalize()
+    {
+        std::sort(boxSizes.begin(), boxSizes.end(), lessSize);
+        boxSizes.erase(std::unique(boxSizes.begin(), boxSizes.end()), boxSizes.end());
+    }
+
+    uint32_t CodewordDistribution::CompactVoteTable::findBoxSize(const Eigen::Vector3f& size) const
+    {
+        std::vector<Eigen::Vector3f>::const_iterator it = std::lower_bound(boxSizes.begin(), boxSizes.end(), size, lessSize);
+        LOG_ASSERT(it != boxSizes.end() && *it == size);
+        return it - boxSizes.begin();
+    }
+
 
     CodewordDistribution::CodewordDistribution()
+        : m_paged_in(false)
     {
     }
 
@@ -47,6 +104,8 @@ namespace ism3d
         else if (m_codeword->getId() != codeword->getId())
             throw RuntimeException("codeword ids not matching");
 
+        makeOwned();
+
         // get activation position, relative to object center
         Eigen::Vector3f keyPos(feature.x, feature.y, feature.z);
         Eigen::Vector3f center = boundingBox.position;
@@ -59,7 +118,9 @@ namespace ism3d
         m_votes.push_back(vote);
         m_classIds.push_back(classId);
 
-        m_features.push_back(feature);
+        // only the pose of the feature is needed for the vote weights, not its descriptor
+        m_featurePositions.push_back(keyPos);
+        m_featureFrames.push_back(feature.referenceFrame);
         m_modelCenters.push_back(center);
 
         // transform bounding box coordinate system into reference frame
@@ -71,101 +132,207 @@ namespace ism3d
     }
 
     void CodewordDistribution::castVotes(const ISMFeature& feature,
-                                         const Distance* distance,
-                                         const std::map<unsigned, float>& classSigmas, //NOTE: sigmas were stored as sigma^2 (variance)
+                                         float dist,
+                                         const std::vector<float>& classSigmas, //NOTE: sigmas were stored as sigma^2 (variance)
                                          bool useClassWeight,
                                          bool useVoteWeight,
                                          bool useMatchingWeight,
                                          bool useCodewordWeight,
+                                         int maxVotes,
                                          Voting& voting,
-                                         const std::map<int, std::shared_ptr<CodewordDistribution> > &distribution) const
+                                         Voting::VoteSlot& slot) const
     {
-        LOG_ASSERT(m_votes.size() == m_weights.size());
-        LOG_ASSERT(m_votes.size() == m_boundingBoxes.size());
-        LOG_ASSERT(m_votes.size() == m_classIds.size());
+        LOG_ASSERT(getNumVotes() == getNumWeights());
+        LOG_ASSERT(getNumVotes() == (int)getClassIds().size());
+        LOG_ASSERT(getNumVotes() == (int)getVoteClassIndices().size());
 
-        float dist = (*distance)(m_codeword->getData(), feature.descriptor);
+        // select the kernel for the storage of the votes and the weight flags, so that neither is checked for each vote
+        int flags = (useClassWeight ? 1 : 0) | (useVoteWeight ? 2 : 0) | (useMatchingWeight ? 4 : 0) | (useCodewordWeight ? 8 : 0);
+        if (isCompact())
+        {
+            const CompactVoteReader votes = {m_compact.votes.data(), m_compact.weights.data(), m_compact.voteScale, getNumVotes()};
+            castVotesWith(votes, flags, feature, dist, classSigmas, maxVotes, voting, slot);
+        }
+        else
+        {
+            const FloatVotes votes = {getVotes(), getWeights()};
+            castVotesWith(votes, flags, feature, dist, classSigmas, maxVotes, voting, slot);
+        }
+    }
 
-        // compute vote position
-        for (int i = 0; i < (int)m_votes.size(); i++)
+    template<typename Votes>
+    void CodewordDistribution::castVotesWith(const Votes& votes,
+                                             int flags,
+                                             const ISMFeature& feature,
+                                             float dist,
+                                             const std::vector<float>& classSigmas,
+                                             int maxVotes,
+                                             Voting& voting,
+                                             Voting::VoteSlot& slot) const
+    {
+        switch (flags)
         {
-            const Eigen::Vector3f& vote = m_votes[i];
-            unsigned classId = m_classIds[i];
+        case 0:  castVotesKernel<Votes, false, false, false, false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 1:  castVotesKernel<Votes, true,  false, false, false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 2:  castVotesKernel<Votes, false, true,  false, false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 3:  castVotesKernel<Votes, true,  true,  false, false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 4:  castVotesKernel<Votes, false, false, true,  false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 5:  castVotesKernel<Votes, true,  false, true,  false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 6:  castVotesKernel<Votes, false, true,  true,  false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 7:  castVotesKernel<Votes, true,  true,  true,  false>(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 8:  castVotesKernel<Votes, false, false, false, true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 9:  castVotesKernel<Votes, true,  false, false, true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 10: castVotesKernel<Votes, false, true,  false, true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 11: castVotesKernel<Votes, true,  true,  false, true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 12: castVotesKernel<Votes, false, false, true,  true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 13: castVotesKernel<Votes, true,  false, true,  true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        case 14: castVotesKernel<Votes, false, true,  true,  true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        default: castVotesKernel<Votes, true,  true,  true,  true >(votes, feature, dist, classSigmas, maxVotes, voting, slot); break;
+        }
+    }
 
-            // find weight for class
-            std::map<unsigned, float>::const_iterator it = m_classWeights.find(classId);
-            float classWeight = 1.0f;
-            if (it != m_classWeights.end())
-                classWeight = it->second;
-            else
-                LOG_WARN("no class weight found for class " << classId);
+    template<typename Votes, bool UseClassWeight, bool UseVoteWeight, bool UseMatchingWeight, bool UseCodewordWeight>
+    void CodewordDistribution::castVotesKernel(const Votes& votes,
+                                               const ISMFeature& feature,
+                                               float dist,
+                                               const std::vector<float>& classSigmas,
+                                               int maxVotes,
+                                               Voting& voting,
+                                               Voting::VoteSlot& slot) const
+    {
+        // the votes and weights are owned, mapped from a flat model or compact, the class data is owned or mapped
+        const FlatArray<unsigned> classIds = getClassIds();
+        const FlatArray<int> voteClassIndices = getVoteClassIndices();
+        const FlatArray<float> voteClassWeights = getVoteClassWeights();
+
+        // votes are sorted by learned weight, so the first ones are the most reliable
+        int numVotes = votes.size();
+        if (maxVotes > 0 && maxVotes < numVotes)
+            numVotes = maxVotes;
+        if (numVotes == 0)
+            return;
 
-            // find sigma for class
-            it = classSigmas.find(classId);
-            float classSigma = 0;
-            if (it != classSigmas.end()) {
-                classSigma = it->second;
-            }
-            else
-            {
-                LOG_WARN("no sigma found for class " << classId);
-                classSigma = 1;
-            }
+        // weigh the votes first, features whose votes are all rejected do not need the reference frame rotation
+        static thread_local std::vector<int> accepted;
+        static thread_local std::vector<float> acceptedWeights;
+        accepted.clear();
+        acceptedWeights.clear();
 
-            // compute likelihood weight to replace old matching weight
-            float matching_weight = gaussDist(classSigma, dist); // NOTE: classSigma is actually class variance, so no square needed
+        const float codewordWeight = m_codeword->getWeight();
+        for (int i = 0; i < numVotes; i++)
+        {
+            // no sigma found for class
+            int classIndex = voteClassIndices[i];
+            float classSigma = classIndex >= 0 ? classSigmas[classIndex] : 1.0f;
 
-            // learned weight per vote
-            float voteWeight = m_weights[i];
+            if (std::abs(dist) > 2*classSigma)
+                continue;
 
             // compute vote weight
             float weight = 1.0f;
-            weight = useClassWeight ? weight * classWeight : weight;
-            weight = useVoteWeight ? weight * voteWeight : weight;
-            weight = useMatchingWeight ? weight * matching_weight : weight;
-            weight = useCodewordWeight ? weight * m_codeword->getWeight() : weight;
+            if (UseClassWeight)
+                weight *= voteClassWeights[i];
+            if (UseVoteWeight)
+                weight *= votes.weight(i); // learned weight per vote
+            if (UseMatchingWeight)
+                weight *= gaussDist(classSigma, dist); // NOTE: classSigma is actually class variance, so no square needed
+            if (UseCodewordWeight)
+                weight *= codewordWeight;
 
-            if(abs(dist) > 2*classSigma)
-            {
-                //LOG_ERROR("------------ discarding vote due to big distance, dist: " << dist << ", sigma: " << classSigma);
+            if (weight < std::numeric_limits<float>::epsilon())
                 continue;
-            }
 
-            //LOG_ASSERT(weight >= 0.0f);
-            //LOG_ASSERT(weight <= 1.0f);
-            if(weight < 0 || weight > 1)
+            accepted.push_back(i);
+            acceptedWeights.push_back(weight);
+        }
+
+        if (accepted.empty())
+            return;
+
+        // rotation of the reference frame, computed once for all votes of this feature
+        boost::math::quaternion<float> rotQuat;
+        Utils::getRotQuaternion(feature.referenceFrame, rotQuat);
+        Eigen::Matrix3f rotation;
+        for (int c = 0; c < 3; c++)
+        {
+            Eigen::Vector3f axis = Eigen::Vector3f::Unit(c);
+            Utils::quatRotate(rotQuat, axis); // same transformation as Utils::rotateBack
+            rotation.col(c) = axis;
+        }
+
+        Eigen::Vector3f keyPos(feature.x, feature.y, feature.z);
+        const RegionOfInterest &regionOfInterest = voting.getRegionOfInterest();
+
+        // only the vote mass of each class is needed, the votes are accumulated without an activation
+        if (voting.isClassificationOnly())
+        {
+            for (int k = 0; k < (int)accepted.size(); k++)
             {
-                //LOG_ERROR("weight: " << weight << ", sigma: " << classSigma << ", dist: " << dist );
+                int i = accepted[k];
+                Eigen::Vector3f center = rotation * votes.vote(i) + keyPos;
+                if (regionOfInterest.contains(center))
+                    voting.accumulateVote(slot, center, acceptedWeights[k], classIds[i]);
             }
+            return;
+        }
 
-            if (weight < std::numeric_limits<float>::epsilon())
+        // the activation is registered with the first vote that passes, all votes of this feature share it
+        bool activated = false;
+        unsigned activationId = 0;
+
+        for (int k = 0; k < (int)accepted.size(); k++)
+        {
+            int i = accepted[k];
+            Eigen::Vector3f center = rotation * votes.vote(i) + keyPos;
+
+            // votes outside of the region of interest can not form a detection
+            if (!regionOfInterest.contains(center))
                 continue;
 
+            if (!activated)
+            {
+                activationId = voting.addActivation(slot, this, rotQuat, keyPos);
+                activated = true;
+            }
+
             // cast vote into voting space
-            castVote(vote, feature.referenceFrame, feature, m_boundingBoxes[i], weight, classId, voting, m_codeword->getId());
+            voting.vote(slot, center, acceptedWeights[k], classIds[i], activationId, i);
         }
     }
 
-    void CodewordDistribution::castVote(const Eigen::Vector3f& vote,
-                                        const pcl::ReferenceFrame& refFrame,
-                                        const ISMFeature& feature,
-                                        Utils::BoundingBox boundingBox,
-                                        float weight,
-                                        unsigned classId,
-                                        Voting& voting,
-                                        int codewordId) const
+    int CodewordDistribution::prepareVoting(const std::map<unsigned, int>& classIndices)
     {
-        Eigen::Vector3f keyPos(feature.x, feature.y, feature.z);
+        // distributions of models trained before the votes were sorted, compact votes are always sorted
+        if (!isCompact())
+        {
+            makeOwned();
+            sortVotesByWeight();
+        }
 
-        // transform center position using reference frame
-        Eigen::Vector3f center = keyPos + Utils::rotateBack(vote, refFrame);
+        m_voteClassIndices.resize(m_classIds.size());
+        m_voteClassWeights.resize(m_classIds.size());
 
-        // transform bounding box coordinate system from reference frame back into world coordinate system
-        boost::math::quaternion<float> rotQuat;
-        Utils::getRotQuaternion(refFrame, rotQuat);
-        boundingBox.rotQuat = boundingBox.rotQuat * rotQuat;
+        int numMissing = 0;
+        for (int i = 0; i < (int)m_classIds.size(); i++)
+        {
+            unsigned classId = m_classIds[i];
+
+            std::map<unsigned, int>::const_iterator indexIt = classIndices.find(classId);
+            m_voteClassIndices[i] = indexIt != classIndices.end() ? indexIt->second : -1;
 
-        voting.vote(center, weight, classId, keyPos, boundingBox, codewordId);
+            // find weight for class
+            std::map<unsigned, float>::const_iterator it = m_classWeights.find(classId);
+            if (it != m_classWeights.end())
+            {
+                m_voteClassWeights[i] = it->second;
+            }
+            else
+            {
+                m_voteClassWeights[i] = 1.0f;
+                numMissing++;
+            }
+        }
+        return numMissing;
     }
 
     void CodewordDistribution::computeWeights()
@@ -185,7 +352,8 @@ namespace ism3d
 
         const float sigma = 0.5f;
 
-        LOG_ASSERT(m_votes.size() == m_features.size());
+        makeOwned();
+        LOG_ASSERT(m_votes.size() == m_featurePositions.size());
         LOG_ASSERT(m_votes.size() == m_modelCenters.size());
 
         // get all the votes for this codeword
@@ -196,14 +364,13 @@ namespace ism3d
 
             // compute a list of weights for each vote and activating keypoint
             std::vector<float> listOfWeights;
-            for (int j = 0; j < (int)m_features.size(); j++)
+            for (int j = 0; j < (int)m_featurePositions.size(); j++)
             {
-                const ISMFeature& feature = m_features[j];
                 const Utils::BoundingBox& boundingBox = m_boundingBoxes[j];
 
                 // transform vote back into world coordinate system
-                Eigen::Vector3f keyPos(feature.x, feature.y, feature.z);
-                Eigen::Vector3f center = keyPos + Utils::rotateBack(vote, feature.referenceFrame);
+                const Eigen::Vector3f& keyPos = m_featurePositions[j];
+                Eigen::Vector3f center = keyPos + Utils::rotateBack(vote, m_featureFrames[j]);
 
                 // compute a normalized center with respect to the bounding box
                 Eigen::Vector3f boxHalfSize = boundingBox.size;// * 0.5f;
@@ -228,7 +395,7 @@ namespace ism3d
             }
 
             LOG_ASSERT(listOfWeights.size() > 0);
-            LOG_ASSERT(listOfWeights.size() == m_features.size());
+            LOG_ASSERT(listOfWeights.size() == m_featurePositions.size());
 
             // compute median over weights
             float median = 0;
@@ -240,6 +407,97 @@ namespace ism3d
 
             m_weights[i] = median;
         }
+
+        sortVotesByWeight();
+    }
+
+    template<typename T, typename A>
+    static void permute(std::vector<T, A> &values, const std::vector<int> &order)
+    {
+        if (values.size() != order.size())
+            return;
+
+        std::vector<T, A> permuted;
+        permuted.reserve(values.size());
+        for (int index : order)
+            permuted.push_back(values[index]);
+        values.swap(permuted);
+    }
+
+    void CodewordDistribution::sortVotesByWeight()
+    {
+        if (m_weights.size() != m_votes.size() ||
+                std::is_sorted(m_weights.begin(), m_weights.end(), std::greater<float>()))
+            return;
+
+        // a stable order keeps votes of equal weight in the order of training
+        std::vector<int> order(m_weights.size());
+        for (int i = 0; i < (int)order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return m_weights[a] > m_weights[b]; });
+
+        // all per-vote data, the training data is only present before the distribution is saved
+        permute(m_votes, order);
+        permute(m_weights, order);
+        permute(m_classIds, order);
+        permute(m_boundingBoxes, order);
+        permute(m_originalVotes, order);
+        permute(m_featurePositions, order);
+        permute(m_featureFrames, order);
+        permute(m_modelCenters, order);
+    }
+
+    template<typename T, typename A>
+    static void select(std::vector<T, A> &values, const std::vector<int> &indices, std::size_t numVotes)
+    {
+        if (values.size() != numVotes)
+            return;
+
+        std::vector<T, A> selected;
+        selected.reserve(indices.size());
+        for (int index : indices)
+            selected.push_back(values[index]);
+        values.swap(selected);
+    }
+
+    void CodewordDistribution::selectVotes(const std::vector<int>& votes)
+    {
+        // the dense tables of prepareVoting() stay valid, they do not depend on the other votes
+        const std::size_t numVotes = m_votes.size();
+        select(m_votes, votes, numVotes);
+        select(m_weights, votes, numVotes);
+        select(m_classIds, votes, numVotes);
+        select(m_boundingBoxes, votes, numVotes);
+        select(m_voteClassIndices, votes, numVotes);
+        select(m_voteClassWeights, votes, numVotes);
+        select(m_originalVotes, votes, numVotes);
+        select(m_featurePositions, votes, numVotes);
+        select(m_featureFrames, votes, numVotes);
+        select(m_modelCenters, votes, numVotes);
+    }
+
+    int CodewordDistribution::retainClasses(const std::set<unsigned>& classIds)
+    {
+        const FlatArray<unsigned> voteClassIds = getClassIds();
+        std::vector<int> kept;
+        for (int i = 0; i < (int)voteClassIds.size(); i++)
+        {
+            if (classIds.count(voteClassIds[i]))
+                kept.push_back(i);
+        }
+        if (kept.empty() || kept.size() == voteClassIds.size())
+            return (int)kept.size();
+
+        makeOwned();
+        selectVotes(kept);
+        for (std::map<unsigned, float>::iterator it = m_classWeights.begin(); it != m_classWeights.end(); )
+        {
+            if (classIds.count(it->first))
+                it++;
+            else
+                it = m_classWeights.erase(it);
+        }
+        return (int)kept.size();
     }
 
     void CodewordDistribution::addDistribution(std::shared_ptr<CodewordDistribution> distribution)
@@ -249,11 +507,15 @@ namespace ism3d
             return;
         }
 
+        makeOwned();
+        distribution->makeOwned();
+
         m_votes.insert(m_votes.end(), distribution->m_votes.begin(), distribution->m_votes.end());
         m_classIds.insert(m_classIds.end(), distribution->m_classIds.begin(), distribution->m_classIds.end());
         m_boundingBoxes.insert(m_boundingBoxes.end(), distribution->m_boundingBoxes.begin(), distribution->m_boundingBoxes.end());
         m_originalVotes.insert(m_originalVotes.end(), distribution->m_originalVotes.begin(), distribution->m_originalVotes.end());
-        m_features.insert(m_features.end(), distribution->m_features.begin(), distribution->m_features.end());
+        m_featurePositions.insert(m_featurePositions.end(), distribution->m_featurePositions.begin(), distribution->m_featurePositions.end());
+        m_featureFrames.insert(m_featureFrames.end(), distribution->m_featureFrames.begin(), distribution->m_featureFrames.end());
         m_modelCenters.insert(m_modelCenters.end(), distribution->m_modelCenters.begin(), distribution->m_modelCenters.end());
 
         // recompute weights
@@ -263,9 +525,249 @@ namespace ism3d
 
     void CodewordDistribution::setClassWeights(std::map<unsigned, float> classWeights)
     {
+        makeOwned();
         m_classWeights = classWeights;
     }
 
+    void CodewordDistribution::setMappedVotes(const std::shared_ptr<Codeword>& codeword, const MappedVotes& votes)
+    {
+        // the owned data is released, packing the votes of a codebook must not keep two copies
+        m_codeword = codeword;
+        std::vector<Eigen::Vector3f>().swap(m_votes);
+        std::vector<float>().swap(m_weights);
+        std::vector<unsigned>().swap(m_classIds);
+        std::vector<Utils::BoundingBox>().swap(m_boundingBoxes);
+        m_classWeights.clear();
+        std::vector<int>().swap(m_voteClassIndices);
+        std::vector<float>().swap(m_voteClassWeights);
+        m_compact = CompactVotes();
+        m_mapped = votes;
+        m_paged_in = false;
+    }
+
+    bool CodewordDistribution::isMapped() const
+    {
+        return m_mapped.model.get() != 0 || m_mapped.packed.get() != 0;
+    }
+
+    bool CodewordDistribution::pageIn() const
+    {
+        // the flag is only written once, later activations only read it
+        if (!m_mapped.model || m_paged_in.load(std::memory_order_relaxed) || m_paged_in.exchange(true))
+            return false;
+
+        const FlatModel &model = *m_mapped.model;
+        model.prefetch(m_mapped.votes.begin(), m_mapped.votes.size() * sizeof(Eigen::Vector3f));
+        model.prefetch(m_mapped.weights.begin(), m_mapped.weights.size() * sizeof(float));
+        model.prefetch(m_mapped.classIds.begin(), m_mapped.classIds.size() * sizeof(unsigned));
+        model.prefetch(m_mapped.boundingBoxes.begin(), m_mapped.boundingBoxes.size() * sizeof(float));
+        model.prefetch(m_mapped.classIndices.begin(), m_mapped.classIndices.size() * sizeof(int));
+        model.prefetch(m_mapped.classWeights.begin(), m_mapped.classWeights.size() * sizeof(float));
+        return true;
+    }
+
+    void CodewordDistribution::compactVotes(const std::shared_ptr<const CompactVoteTable>& table)
+    {
+        if (isCompact())
+            return;
+
+        // the training data, if any, is sorted along with the votes
+        makeOwned();
+        sortVotesByWeight();
+
+        std::vector<unsigned> classIds;
+        CompactVotes compact = encodeVotes(table, classIds);
+        m_classIds.swap(classIds);
+        std::vector<Eigen::Vector3f>().swap(m_votes);
+        std::vector<float>().swap(m_weights);
+        std::vector<Utils::BoundingBox>().swap(m_boundingBoxes);
+        m_compact = compact;
+    }
+
+    bool CodewordDistribution::isCompact() const
+    {
+        return m_compact.table.get() != 0;
+    }
+
+    CodewordDistribution::CompactVotes CodewordDistribution::encodeVotes(const std::shared_ptr<const CompactVoteTable>& table,
+                                                                         std::vector<unsigned>& classIds) const
+    {
+        const int numVotes = getNumVotes();
+        const bool hasWeights = getNumWeights() == numVotes;
+
+        // the votes are encoded sorted by weight, a stable order as in sortVotesByWeight()
+        std::vector<int> order(numVotes);
+        for (int i = 0; i < numVotes; i++)
+            order[i] = i;
+        if (hasWeights)
+            std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return getWeight(a) > getWeight(b); });
+
+        // the largest component is mapped to the largest 16 bit integer
+        float maxComponent = 0;
+        for (int i = 0; i < numVotes; i++)
+            maxComponent = std::max(maxComponent, getVote(i).cwiseAbs().maxCoeff());
+
+        CompactVotes compact;
+        compact.table = table;
+        compact.voteScale = maxComponent > 0 ? maxComponent / 32767.0f : 1.0f;
+        compact.votes.reserve(3 * numVotes);
+        compact.weights.reserve(hasWeights ? numVotes : 0);
+        compact.rotations.reserve(4 * numVotes);
+        compact.boxSizes.reserve(numVotes);
+
+        const FlatArray<unsigned> voteClassIds = getClassIds();
+        classIds.clear();
+        classIds.reserve(numVotes);
+        for (int index : order)
+        {
+            const Eigen::Vector3f vote = getVote(index);
+            for (int c = 0; c < 3; c++)
+                compact.votes.push_back((int16_t)std::lround(vote[c] / compact.voteScale));
+
+            if (hasWeights)
+                compact.weights.push_back(DistanceKernels::floatToHalf(getWeight(index)));
+
+            const Utils::BoundingBox bbox = getBoundingBox(index);
+            const float quat[4] = {bbox.rotQuat.R_component_1(), bbox.rotQuat.R_component_2(),
+                                   bbox.rotQuat.R_component_3(), bbox.rotQuat.R_component_4()};
+            for (int q = 0; q < 4; q++)
+                compact.rotations.push_back((int16_t)std::lround(std::max(-1.0f, std::min(1.0f, quat[q])) * QuaternionScale));
+            compact.boxSizes.push_back(table->findBoxSize(bbox.size));
+
+            classIds.push_back(voteClassIds[index]);
+        }
+        return compact;
+    }
+
+    void CodewordDistribution::saveCompactData(boost::archive::binary_oarchive &oa,
+                                               const std::shared_ptr<const CompactVoteTable>& table) const
+    {
+        m_codeword->saveData(oa);
+
+        std::vector<unsigned> classIds;
+        const CompactVotes compact = encodeVotes(table, classIds);
+        oa << compact.voteScale;
+        oa << compact.votes;
+        oa << compact.weights;
+        oa << classIds;
+
+        const std::map<unsigned, float> classWeights = getClassWeights();
+        int class_weights_size = classWeights.size();
+        oa << class_weights_size;
+        for (std::map<unsigned, float>::const_iterator it = classWeights.begin(); it != classWeights.end(); it++)
+        {
+            int classId = it->first;
+            float weight = it->second;
+            oa << classId;
+            oa << weight;
+        }
+
+        oa << compact.rotations;
+        oa << compact.boxSizes;
+    }
+
+    bool CodewordDistribution::loadCompactData(boost::archive::binary_iarchive &ia,
+                                               const std::shared_ptr<const CompactVoteTable>& table)
+    {
+        m_codeword = std::shared_ptr<Codeword>(new Codeword());
+        if(!m_codeword->loadData(ia))
+        {
+            LOG_ERROR("Could not read codeword!");
+            return false;
+        }
+
+        m_mapped = MappedVotes();
+        m_compact = CompactVotes();
+        m_votes.clear();
+        m_weights.clear();
+        m_classIds.clear();
+        m_classWeights.clear();
+        m_boundingBoxes.clear();
+        m_voteClassIndices.clear();
+        m_voteClassWeights.clear();
+
+        CompactVotes compact;
+        compact.table = table;
+        ia >> compact.voteScale;
+        ia >> compact.votes;
+        ia >> compact.weights;
+        ia >> m_classIds;
+
+        int weights_size;
+        ia >> weights_size;
+        for (int i = 0; i < weights_size; i++)
+        {
+            int classId;
+            float weight;
+            ia >> classId;
+            ia >> weight;
+            m_classWeights[classId] = weight;
+        }
+
+        ia >> compact.rotations;
+        ia >> compact.boxSizes;
+
+        const std::size_t numVotes = compact.boxSizes.size();
+        bool valid = compact.votes.size() == 3 * numVotes && compact.rotations.size() == 4 * numVotes &&
+                m_classIds.size() == numVotes && (compact.weights.empty() || compact.weights.size() == numVotes);
+        for (std::size_t i = 0; valid && i < numVotes; i++)
+            valid = compact.boxSizes[i] < table->boxSizes.size();
+        if (!valid)
+        {
+            LOG_ERROR("corrupt compact codeword distribution");
+            return false;
+        }
+
+        m_compact = compact;
+        return true;
+    }
+
+    void CodewordDistribution::makeOwned()
+    {
+        if (isCompact())
+        {
+            const int numVotes = getNumVotes();
+            m_votes.resize(numVotes);
+            m_boundingBoxes.resize(numVotes);
+            for (int i = 0; i < numVotes; i++)
+            {
+                m_votes[i] = getVote(i);
+                m_boundingBoxes[i] = getBoundingBox(i);
+            }
+            m_weights.resize(m_compact.weights.size());
+            for (int i = 0; i < (int)m_weights.size(); i++)
+                m_weights[i] = getWeight(i);
+            m_compact = CompactVotes();
+            return;
+        }
+
+        if (!isMapped())
+            return;
+
+        const int numVotes = (int)m_mapped.votes.size();
+        m_boundingBoxes.resize(numVotes);
+        for (int i = 0; i < numVotes; i++)
+            m_boundingBoxes[i] = getBoundingBox(i);
+
+        m_votes.assign(m_mapped.votes.begin(), m_mapped.votes.end());
+        m_weights.assign(m_mapped.weights.begin(), m_mapped.weights.end());
+        m_classIds.assign(m_mapped.classIds.begin(), m_mapped.classIds.end());
+        m_classWeights = getClassWeights();
+        m_voteClassIndices.assign(m_mapped.classIndices.begin(), m_mapped.classIndices.end());
+        m_voteClassWeights.assign(m_mapped.classWeights.begin(), m_mapped.classWeights.end());
+        m_mapped = MappedVotes();
+    }
+
+    FlatArray<int> CodewordDistribution::getVoteClassIndices() const
+    {
+        return isMapped() ? m_mapped.classIndices : FlatArray<int>(m_voteClassIndices);
+    }
+
+    FlatArray<float> CodewordDistribution::getVoteClassWeights() const
+    {
+        return isMapped() ? m_mapped.classWeights : FlatArray<float>(m_voteClassWeights);
+    }
+
     const std::shared_ptr<Codeword>& CodewordDistribution::getCodeword() const
     {
         return m_codeword;
@@ -276,9 +778,18 @@ namespace ism3d
         return m_codeword->getId();
     }
 
-    const std::vector<Eigen::Vector3f>& CodewordDistribution::getVotes() const
+    FlatArray<Eigen::Vector3f> CodewordDistribution::getVotes() const
     {
-        return m_votes;
+        return isMapped() ? m_mapped.votes : FlatArray<Eigen::Vector3f>(m_votes);
+    }
+
+    Eigen::Vector3f CodewordDistribution::getVote(int vote) const
+    {
+        if (!isCompact())
+            return getVotes()[vote];
+
+        const int16_t *values = m_compact.votes.data() + 3 * vote;
+        return m_compact.voteScale * Eigen::Vector3f((float)values[0], (float)values[1], (float)values[2]);
     }
 
     const std::vector<Eigen::Vector3f>& CodewordDistribution::getOriginalVotes() const
@@ -289,20 +800,42 @@ namespace ism3d
             return m_votes;
     }
 
-    const std::vector<float>& CodewordDistribution::getWeights() const
+    FlatArray<float> CodewordDistribution::getWeights() const
+    {
+        return isMapped() ? m_mapped.weights : FlatArray<float>(m_weights);
+    }
+
+    float CodewordDistribution::getWeight(int vote) const
     {
-        return m_weights;
+        return isCompact() ? DistanceKernels::halfToFloat(m_compact.weights[vote]) : getWeights()[vote];
     }
 
-    const std::vector<unsigned>& CodewordDistribution::getClassIds() const
+    int CodewordDistribution::getNumWeights() const
     {
-        return m_classIds;
+        return isCompact() ? m_compact.weights.size() : getWeights().size();
+    }
+
+    FlatArray<unsigned> CodewordDistribution::getClassIds() const
+    {
+        return isMapped() ? m_mapped.classIds : FlatArray<unsigned>(m_classIds);
+    }
+
+    std::map<unsigned, float> CodewordDistribution::getClassWeights() const
+    {
+        if (!isMapped())
+            return m_classWeights;
+
+        std::map<unsigned, float> classWeights;
+        for (int i = 0; i < (int)m_mapped.weightedClassIds.size(); i++)
+            classWeights[m_mapped.weightedClassIds[i]] = m_mapped.weightedClassWeights[i];
+        return classWeights;
     }
 
     bool CodewordDistribution::hasClassId(unsigned classId) const
     {
-        for (int i = 0; i < (int)m_classIds.size(); i++) {
-            unsigned id = m_classIds[i];
+        const FlatArray<unsigned> classIds = getClassIds();
+        for (int i = 0; i < (int)classIds.size(); i++) {
+            unsigned id = classIds[i];
             if (id == classId)
                 return true;
         }
@@ -311,30 +844,107 @@ namespace ism3d
 
     std::vector<unsigned> CodewordDistribution::getDistinctClassIds() const
     {
+        const FlatArray<unsigned> voteClassIds = getClassIds();
         std::vector<unsigned> classIds;
-        for (int i = 0; i < (int)m_classIds.size(); i++) {
-            unsigned classId = m_classIds[i];
+        for (int i = 0; i < (int)voteClassIds.size(); i++) {
+            unsigned classId = voteClassIds[i];
             if (std::find(classIds.begin(), classIds.end(), classId) == classIds.end())
                 classIds.push_back(classId);
         }
         return classIds;
     }
 
-    const std::vector<Utils::BoundingBox>& CodewordDistribution::getBoundingBoxes() const
+    Utils::BoundingBox CodewordDistribution::getBoundingBox(int vote) const
     {
-        return m_boundingBoxes;
+        if (isCompact())
+        {
+            const int16_t *values = m_compact.rotations.data() + 4 * vote;
+            Utils::BoundingBox bbox;
+            bbox.rotQuat = boost::math::quaternion<float>(values[0] / QuaternionScale, values[1] / QuaternionScale,
+                                                          values[2] / QuaternionScale, values[3] / QuaternionScale);
+            bbox.size = m_compact.table->boxSizes[m_compact.boxSizes[vote]];
+            return bbox;
+        }
+
+        if (!isMapped())
+            return m_boundingBoxes[vote];
+
+        // the position is not stored, as in iSaveData()
+        const float *values = m_mapped.boundingBoxes.begin() + 7 * vote;
+        Utils::BoundingBox bbox;
+        bbox.rotQuat = boost::math::quaternion<float>(values[0], values[1], values[2], values[3]);
+        bbox.size = Eigen::Vector3f(values[4], values[5], values[6]);
+        return bbox;
     }
 
     int CodewordDistribution::getNumVotes() const
     {
-        return m_votes.size();
+        return isCompact() ? m_compact.boxSizes.size() : getVotes().size();
+    }
+
+    std::size_t CodewordDistribution::getMemoryUsage() const
+    {
+        // mapped data of a flat model is counted as well, it is resident once it was read
+        return sizeof(*this) +
+                m_mapped.votes.size() * sizeof(Eigen::Vector3f) +
+                (m_mapped.weights.size() + m_mapped.boundingBoxes.size() + m_mapped.classWeights.size()) * sizeof(float) +
+                m_mapped.classIds.size() * sizeof(unsigned) +
+                m_mapped.classIndices.size() * sizeof(int) +
+                m_votes.capacity() * sizeof(Eigen::Vector3f) +
+                m_weights.capacity() * sizeof(float) +
+                m_classIds.capacity() * sizeof(unsigned) +
+                m_boundingBoxes.capacity() * sizeof(Utils::BoundingBox) +
+                m_classWeights.size() * (sizeof(std::pair<unsigned, float>) + 4 * sizeof(void*)) +
+                m_voteClassIndices.capacity() * sizeof(int) +
+                m_voteClassWeights.capacity() * sizeof(float) +
+                m_originalVotes.capacity() * sizeof(Eigen::Vector3f) +
+                m_featurePositions.capacity() * sizeof(Eigen::Vector3f) +
+                m_featureFrames.capacity() * sizeof(pcl::ReferenceFrame) +
+                m_modelCenters.capacity() * sizeof(Eigen::Vector3f) +
+                (m_compact.votes.capacity() + m_compact.weights.capacity() + m_compact.rotations.capacity()) * sizeof(int16_t) +
+                m_compact.boxSizes.capacity() * sizeof(uint32_t);
+    }
+
+    void CodewordDistribution::addMemoryUsage(MemoryUsage &votes, MemoryUsage &boundingBoxes, MemoryUsage &trainingData) const
+    {
+        // the unused capacity is not assigned to a class
+        const std::size_t voteBytes = (isCompact() ? 4 * sizeof(int16_t) : sizeof(Eigen::Vector3f) + sizeof(float)) +
+                sizeof(unsigned) + (getVoteClassIndices().empty() ? 0 : sizeof(int) + sizeof(float));
+        const std::size_t boxBytes = isCompact() ? 4 * sizeof(int16_t) + sizeof(uint32_t) :
+                                                   isMapped() ? 7 * sizeof(float) : sizeof(Utils::BoundingBox);
+        for (unsigned classId : getClassIds())
+        {
+            votes.addClassBytes(classId, voteBytes);
+            boundingBoxes.addClassBytes(classId, boxBytes);
+        }
+
+        votes.bytes += sizeof(*this) +
+                m_mapped.votes.size() * sizeof(Eigen::Vector3f) +
+                (m_mapped.weights.size() + m_mapped.classWeights.size()) * sizeof(float) +
+                m_mapped.classIds.size() * sizeof(unsigned) +
+                m_mapped.classIndices.size() * sizeof(int) +
+                m_votes.capacity() * sizeof(Eigen::Vector3f) +
+                m_weights.capacity() * sizeof(float) +
+                m_classIds.capacity() * sizeof(unsigned) +
+                m_classWeights.size() * (sizeof(std::pair<unsigned, float>) + 4 * sizeof(void*)) +
+                m_voteClassIndices.capacity() * sizeof(int) +
+                m_voteClassWeights.capacity() * sizeof(float) +
+                (m_compact.votes.capacity() + m_compact.weights.capacity()) * sizeof(int16_t);
+        boundingBoxes.bytes += m_boundingBoxes.capacity() * sizeof(Utils::BoundingBox) +
+                m_mapped.boundingBoxes.size() * sizeof(float) +
+                m_compact.rotations.capacity() * sizeof(int16_t) + m_compact.boxSizes.capacity() * sizeof(uint32_t);
+        trainingData.bytes += m_originalVotes.capacity() * sizeof(Eigen::Vector3f) +
+                m_featurePositions.capacity() * sizeof(Eigen::Vector3f) +
+                m_featureFrames.capacity() * sizeof(pcl::ReferenceFrame) +
+                m_modelCenters.capacity() * sizeof(Eigen::Vector3f);
     }
 
     int CodewordDistribution::getNumVotesForClass(unsigned classId) const
     {
+        const FlatArray<unsigned> classIds = getClassIds();
         int numVotes = 0;
-        for (int i = 0; i < (int)m_classIds.size(); i++) {
-            if (m_classIds[i] == classId)
+        for (int i = 0; i < (int)classIds.size(); i++) {
+            if (classIds[i] == classId)
                 numVotes++;
         }
         return numVotes;
@@ -344,21 +954,27 @@ namespace ism3d
     {
         m_codeword->saveData(oa);
 
-        int votes_size = m_votes.size();
+        int votes_size = getNumVotes();
         oa << votes_size;
-        for (int i = 0; i < (int)m_votes.size(); i++)
+        for (int i = 0; i < votes_size; i++)
         {
-            oa << m_votes[i][0];
-            oa << m_votes[i][1];
-            oa << m_votes[i][2];
+            const Eigen::Vector3f vote = getVote(i);
+            oa << vote[0];
+            oa << vote[1];
+            oa << vote[2];
         }
 
-        oa << m_weights;
-        oa << m_classIds;
+        std::vector<float> weights(getNumWeights());
+        for (int i = 0; i < (int)weights.size(); i++)
+            weights[i] = getWeight(i);
+        const FlatArray<unsigned> classIds = getClassIds();
+        oa << weights;
+        oa << std::vector<unsigned>(classIds.begin(), classIds.end());
 
-        int class_weights_size = m_classWeights.size();
+        const std::map<unsigned, float> classWeights = getClassWeights();
+        int class_weights_size = classWeights.size();
         oa << class_weights_size;
-        for (std::map<unsigned, float>::const_iterator it = m_classWeights.begin(); it != m_classWeights.end(); it++)
+        for (std::map<unsigned, float>::const_iterator it = classWeights.begin(); it != classWeights.end(); it++)
         {
             int classId = it->first;
             float weight = it->second;
@@ -366,11 +982,11 @@ namespace ism3d
             oa << weight;
         }
 
-        int bounding_box_size = m_boundingBoxes.size();
+        int bounding_box_size = votes_size;
         oa << bounding_box_size;
-        for (int i = 0; i < (int)m_boundingBoxes.size(); i++)
+        for (int i = 0; i < bounding_box_size; i++)
         {
-            const Utils::BoundingBox& bbox = m_boundingBoxes[i];
+            const Utils::BoundingBox bbox = getBoundingBox(i);
             float quat1 = bbox.rotQuat.R_component_1();
             float quat2 = bbox.rotQuat.R_component_2();
             float quat3 = bbox.rotQuat.R_component_3();
@@ -401,6 +1017,8 @@ namespace ism3d
             return false;
         }
 
+        m_mapped = MappedVotes();
+        m_compact = CompactVotes();
         m_votes.clear();
         m_weights.clear();
         m_classIds.clear();
@@ -459,20 +1077,23 @@ namespace ism3d
     {
         Json::Value data(Json::objectValue);
 
+        const int numVotes = getNumVotes();
         Json::Value jsonVotes(Json::arrayValue);
-        for (int i = 0; i < (int)m_votes.size(); i++)
-            jsonVotes.append(Utils::vector3fToJson(m_votes[i]));
+        for (int i = 0; i < numVotes; i++)
+            jsonVotes.append(Utils::vector3fToJson(getVote(i)));
 
         Json::Value jsonWeights(Json::arrayValue);
-        for (int i = 0; i < (int)m_weights.size(); i++)
-            jsonWeights.append(Json::Value(m_weights[i]));
+        for (int i = 0; i < getNumWeights(); i++)
+            jsonWeights.append(Json::Value(getWeight(i)));
 
+        const FlatArray<unsigned> classIds = getClassIds();
         Json::Value jsonClassIds(Json::arrayValue);
-        for (int i = 0; i < (int)m_classIds.size(); i++)
-            jsonClassIds.append(Json::Value(m_classIds[i]));
+        for (int i = 0; i < (int)classIds.size(); i++)
+            jsonClassIds.append(Json::Value(classIds[i]));
 
+        const std::map<unsigned, float> classWeights = getClassWeights();
         Json::Value jsonClassWeights(Json::arrayValue);
-        for (std::map<unsigned, float>::const_iterator it = m_classWeights.begin(); it != m_classWeights.end(); it++) {
+        for (std::map<unsigned, float>::const_iterator it = classWeights.begin(); it != classWeights.end(); it++) {
             int classId = it->first;
             float weight = it->second;
             Json::Value weightEntry(Json::objectValue);
@@ -482,8 +1103,8 @@ namespace ism3d
         }
 
         Json::Value jsonBoundingBoxes(Json::arrayValue);
-        for (int i = 0; i < (int)m_boundingBoxes.size(); i++) {
-            const Utils::BoundingBox& bbox = m_boundingBoxes[i];
+        for (int i = 0; i < numVotes; i++) {
+            const Utils::BoundingBox bbox = getBoundingBox(i);
             Json::Value jsonBoundingBox(Json::objectValue);
 
             jsonBoundingBox["Quat"] = Utils::quatToJson(bbox.rotQuat);
@@ -523,6 +1144,8 @@ namespace ism3d
         if (!m_codeword.get() || !m_codeword->dataFromJson(*jsonCodeword))
             return false;
 
+        m_mapped = MappedVotes();
+        m_compact = CompactVotes();
         m_votes.clear();
         m_weights.clear();
         m_classIds.clear();
@@ -11,11 +11,17 @@
 #ifndef ISM3D_CODEWORDDISTRIBUTION_H
 #define ISM3D_CODEWORDDISTRIBUTION_H
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <set>
 #include <Eigen/Core>
 #include <pcl/point_types.h>
 
 #include "../utils/utils.h"
 #include "../utils/json_object.h"
+#include "../utils/flat_model.h"
+#include "../voting/voting.h"
 
 namespace ism3d
 {
@@ -23,7 +29,6 @@ namespace ism3d
     class Codeword;
     class ISMFeature;
     class BoundingBox;
-    class Voting;
 
     /**
      * @brief The CodewordDistribution class
@@ -37,6 +42,44 @@ namespace ism3d
             : public JSONObject
     {
     public:
+        /**
+         * @brief The per-vote data of a distribution stored in a flat model, see Codebook::loadFlatData(), or packed
+         * with the data of the other distributions of a codebook, see Codebook::packVotes(). The votes are sorted by
+         * weight and the class tables were created by prepareVoting() with the class indices of the codebook.
+         */
+        struct MappedVotes
+        {
+            std::shared_ptr<const FlatModel> model; // keeps the mapping alive, null if the data is owned or packed
+            std::shared_ptr<const void> packed; // keeps the packed data alive, null if the data is owned or mapped
+            FlatArray<Eigen::Vector3f> votes;
+            FlatArray<float> weights;
+            FlatArray<unsigned> classIds;
+            FlatArray<float> boundingBoxes; // rotation quaternion and size, 7 values per vote
+            FlatArray<int> classIndices;
+            FlatArray<float> classWeights;
+            FlatArray<unsigned> weightedClassIds; // the class weights of the distribution
+            FlatArray<float> weightedClassWeights;
+        };
+
+        /**
+         * @brief The bounding box sizes referenced by the compact distributions of a codebook, see compactVotes().
+         * There is one size per training model, so that the votes only store an index instead of the size.
+         */
+        struct CompactVoteTable
+        {
+            std::vector<Eigen::Vector3f> boxSizes; // sorted lexicographically and without duplicates
+
+            /**
+             * @brief Sort the sizes and remove duplicates, required before findBoxSize().
+             */
+            void finalize();
+
+            /**
+             * @brief Get the index of a size, the size has to be contained in the table.
+             */
+            uint32_t findBoxSize(const Eigen::Vector3f& size) const;
+        };
+
         CodewordDistribution();
         ~CodewordDistribution();
 
@@ -53,31 +96,110 @@ namespace ism3d
                          const Utils::BoundingBox& boundingBox);
 
         /**
-         * @brief Cast all votes for this codeword distribution into the voting space.
+         * @brief Cast all votes for this codeword distribution into the voting space. Requires prepareVoting() to be
+         * called after the distribution was changed.
          * @param feature the feature that activated the codeword
-         * @param distance the distance measure
-         * @param classSigmas a map of sigmas for each class
+         * @param dist the distance between the feature descriptor and the codeword
+         * @param classSigmas class sigmas indexed by the compact class index passed to prepareVoting()
          * @param useClassWeight true to use statistical weights
          * @param useVoteWeight true to use center weights
          * @param useMatchingWeight true to use matching weights
          * @param useCodewordWeight true to use codeword weights
+         * @param maxVotes the maximum number of votes, the votes with the highest learned weights are cast first,
+         * 0 casts all votes
          * @param voting the voting space
-         * @param distribution codeword distribution with all codewords and votes
+         * @param slot the slot of the calling worker, see Voting::acquireSlots()
          */
         void castVotes(const ISMFeature& feature,
-                       const Distance* distance,
-                       const std::map<unsigned, float>& classSigmas,
+                       float dist,
+                       const std::vector<float>& classSigmas,
                        bool useClassWeight,
                        bool useVoteWeight,
                        bool useMatchingWeight,
                        bool useCodewordWeight,
-                       Voting& voting, const std::map<int, std::shared_ptr<CodewordDistribution> > &distribution) const;
+                       int maxVotes,
+                       Voting& voting,
+                       Voting::VoteSlot& slot) const;
+
+        /**
+         * @brief Create the dense per-vote tables used by castVotes().
+         * @param classIndices maps class ids to a compact class index
+         * @return the number of votes without a class weight, they are weighted with 1
+         */
+        int prepareVoting(const std::map<unsigned, int>& classIndices);
+
+        /**
+         * @brief Get the compact class index of each vote created by prepareVoting(), -1 for classes without index.
+         */
+        FlatArray<int> getVoteClassIndices() const;
 
         /**
-         * @brief Compute learned weights.
+         * @brief Get the class weight of each vote created by prepareVoting().
+         */
+        FlatArray<float> getVoteClassWeights() const;
+
+        /**
+         * @brief Compute learned weights, the votes are sorted by decreasing weight afterwards.
          */
         void computeWeights();
 
+        /**
+         * @brief Read the per-vote data from a mapped flat model or from packed data instead of owning it. Changing
+         * the distribution copies the data first, so that the model file is never written.
+         * @param codeword the codeword
+         * @param votes the per-vote data
+         */
+        void setMappedVotes(const std::shared_ptr<Codeword>& codeword, const MappedVotes& votes);
+
+        /**
+         * @brief Check if the per-vote data is read from a mapped flat model or from packed data.
+         */
+        bool isMapped() const;
+
+        /**
+         * @brief Request the pages of the mapped per-vote data on the first call, so that they are read as a whole
+         * instead of page by page while voting. Does nothing for owned or packed data and on later calls.
+         * @return true if the pages were requested by this call
+         */
+        bool pageIn() const;
+
+        /**
+         * @brief Store the per-vote data compactly: the vote vectors as 16 bit integers relative to the largest vote
+         * component of the distribution, the learned weights as half precision floats, the bounding box rotations as
+         * 16 bit integers and the bounding box sizes as an index into a table shared by the codebook. The votes are
+         * sorted by weight first. Changing the distribution restores the float data first.
+         * @param table the table, has to contain the bounding box sizes of all votes
+         */
+        void compactVotes(const std::shared_ptr<const CompactVoteTable>& table);
+
+        /**
+         * @brief Check if the per-vote data is stored compactly.
+         */
+        bool isCompact() const;
+
+        /**
+         * @brief Save the distribution with compact per-vote data, see compactVotes().
+         * @param oa the archive
+         * @param table the table, has to contain the bounding box sizes of all votes
+         */
+        void saveCompactData(boost::archive::binary_oarchive &oa, const std::shared_ptr<const CompactVoteTable>& table) const;
+
+        /**
+         * @brief Load a distribution saved by saveCompactData(), the per-vote data stays compact.
+         * @param ia the archive
+         * @param table the table that was used for saving
+         * @return false if the data could not be read
+         */
+        bool loadCompactData(boost::archive::binary_iarchive &ia, const std::shared_ptr<const CompactVoteTable>& table);
+
+        /**
+         * @brief Remove the votes of all other classes. A distribution whose votes all belong to the classes is not
+         * changed and stays mapped.
+         * @param classIds the classes to keep
+         * @return the number of remaining votes
+         */
+        int retainClasses(const std::set<unsigned>& classIds);
+
         /**
          * @brief Add another distribution with the same associated codeword.
          * @param distribution the distribution to add
@@ -104,9 +226,16 @@ namespace ism3d
 
         /**
          * @brief Get the votes for this codeword relative to the feature position.
-         * @return the votes
+         * @return the votes, empty if the votes are stored compactly, see getVote()
+         */
+        FlatArray<Eigen::Vector3f> getVotes() const;
+
+        /**
+         * @brief Get a vote for this codeword relative to the feature position, in any storage.
+         * @param vote the index of the vote
+         * @return the vote
          */
-        const std::vector<Eigen::Vector3f>& getVotes() const;
+        Eigen::Vector3f getVote(int vote) const;
 
         /**
          * @brief Get the original votes for this codeword. They are given in absolute positions
@@ -117,15 +246,34 @@ namespace ism3d
 
         /**
          * @brief Get the learned weights for each vote vector.
-         * @return the learned weights
+         * @return the learned weights, empty if the votes are stored compactly, see getWeight()
          */
-        const std::vector<float>& getWeights() const;
+        FlatArray<float> getWeights() const;
+
+        /**
+         * @brief Get the learned weight of a vote vector, in any storage.
+         * @param vote the index of the vote
+         * @return the learned weight
+         */
+        float getWeight(int vote) const;
+
+        /**
+         * @brief Get the number of learned weights, equal to the number of votes once the weights were computed.
+         * @return the number of learned weights
+         */
+        int getNumWeights() const;
 
         /**
          * @brief Get class ids for each vote vector.
          * @return the list of class ids
          */
-        const std::vector<unsigned>& getClassIds() const;
+        FlatArray<unsigned> getClassIds() const;
+
+        /**
+         * @brief Get the class weights of this distribution.
+         * @return the class weights by class id
+         */
+        std::map<unsigned, float> getClassWeights() const;
 
         /**
          * @brief Check if a class id has a corresponding vote.
@@ -141,10 +289,11 @@ namespace ism3d
         std::vector<unsigned> getDistinctClassIds() const;
 
         /**
-         * @brief Get the bounding boxes for each vote vector.
-         * @return the list of bounding boxes.
+         * @brief Get the bounding box of a vote vector.
+         * @param vote the index of the vote
+         * @return the bounding box in the reference frame of the activating feature
          */
-        const std::vector<Utils::BoundingBox>& getBoundingBoxes() const;
+        Utils::BoundingBox getBoundingBox(int vote) const;
 
         /**
          * @brief Get the number of votes contained in the distribution.
@@ -152,6 +301,21 @@ namespace ism3d
          */
         int getNumVotes() const;
 
+        /**
+         * @brief Estimate the memory used by the distribution, excluding the codeword.
+         * @return the number of bytes
+         */
+        std::size_t getMemoryUsage() const;
+
+        /**
+         * @brief Add the memory used by the distribution to the parts of a memory usage, the vote vectors and
+         * bounding boxes are split by the class of their votes.
+         * @param votes the part of the vote vectors with their weights and class data
+         * @param boundingBoxes the part of the bounding boxes
+         * @param trainingData the part of the data only needed during training
+         */
+        void addMemoryUsage(MemoryUsage &votes, MemoryUsage &boundingBoxes, MemoryUsage &trainingData) const;
+
         /**
          * @brief Get the number of votes for the given class id.
          * @param classId the class id
@@ -167,13 +331,49 @@ namespace ism3d
         bool iDataFromJson(const Json::Value&);
 
     private:
-        void castVote(const Eigen::Vector3f&,
-                      const pcl::ReferenceFrame&,
-                      const ISMFeature&,
-                      Utils::BoundingBox,
-                      float,
-                      unsigned,
-                      Voting&, int codewordId) const;
+        template<typename Votes>
+        void castVotesWith(const Votes& votes,
+                           int flags,
+                           const ISMFeature& feature,
+                           float dist,
+                           const std::vector<float>& classSigmas,
+                           int maxVotes,
+                           Voting& voting,
+                           Voting::VoteSlot& slot) const;
+
+        template<typename Votes, bool UseClassWeight, bool UseVoteWeight, bool UseMatchingWeight, bool UseCodewordWeight>
+        void castVotesKernel(const Votes& votes,
+                             const ISMFeature& feature,
+                             float dist,
+                             const std::vector<float>& classSigmas,
+                             int maxVotes,
+                             Voting& voting,
+                             Voting::VoteSlot& slot) const;
+
+        // keeps the per-vote data of the given votes, in their order
+        void selectVotes(const std::vector<int>& votes);
+
+        // sorts all per-vote data by decreasing learned weight, if it is not sorted yet
+        void sortVotesByWeight();
+
+        // copies mapped or compact per-vote data into the vectors below before the distribution is changed
+        void makeOwned();
+
+        // the per-vote data stored by compactVotes(), with the votes sorted by weight
+        struct CompactVotes
+        {
+            std::shared_ptr<const CompactVoteTable> table; // null if the data is not compact
+            float voteScale;                    // a vote component is voteScale * votes[i]
+            std::vector<int16_t> votes;         // 3 per vote
+            std::vector<uint16_t> weights;      // half precision
+            std::vector<int16_t> rotations;     // bounding box rotation quaternion scaled by 32767, 4 per vote
+            std::vector<uint32_t> boxSizes;     // index into the table
+
+            CompactVotes() : voteScale(0) {}
+        };
+
+        // encodes the owned or mapped per-vote data, classIds receives the class ids in the order of the encoded votes
+        CompactVotes encodeVotes(const std::shared_ptr<const CompactVoteTable>& table, std::vector<unsigned>& classIds) const;
 
         // saved with the distribution
         std::shared_ptr<Codeword> m_codeword;             // the associated codeword
@@ -183,9 +383,21 @@ namespace ism3d
         std::vector<Utils::BoundingBox> m_boundingBoxes;    // bounding boxes for vote vectors
         std::map<unsigned, float> m_classWeights;
 
+        // created by prepareVoting(), used during detection
+        std::vector<int> m_voteClassIndices;                // compact class index per vote vector
+        std::vector<float> m_voteClassWeights;              // class weight per vote vector
+
+        // used instead of the vectors above if the distribution was loaded from a flat model
+        MappedVotes m_mapped;
+        mutable std::atomic<bool> m_paged_in; // pageIn() was called for the mapped data
+
+        // used instead of the votes, weights and bounding boxes above if the data is compact, the class ids are owned
+        CompactVotes m_compact;
+
         // not saved with the distribution, only needed during training
         std::vector<Eigen::Vector3f> m_originalVotes;       // contains votes before any transformation
-        std::vector<ISMFeature> m_features;
+        std::vector<Eigen::Vector3f> m_featurePositions;  // positions of the activating features
+        std::vector<pcl::ReferenceFrame, Eigen::aligned_allocator<pcl::ReferenceFrame> > m_featureFrames;
         std::vector<Eigen::Vector3f> m_modelCenters;
     };
 }
@@ -0,0 +1,112 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "detection_observer.h"
+
+namespace ism3d
+{
+
+ObserverDispatcher::ObserverDispatcher(std::shared_ptr<DetectionObserver> observer)
+    : m_observer(observer), m_stop(false), m_num_dropped(0)
+{
+    for (int i = 0; i < NumKinds; i++)
+        m_pending[i] = false;
+    m_thread = std::thread(&ObserverDispatcher::run, this);
+}
+
+ObserverDispatcher::~ObserverDispatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+void ObserverDispatcher::postPointCloud(pcl::PointCloud<PointT>::ConstPtr points)
+{
+    std::shared_ptr<DetectionObserver> observer = m_observer;
+    post(PointCloud, [observer, points]() { observer->onPointCloud(points); });
+}
+
+void ObserverDispatcher::postNormals(pcl::PointCloud<PointT>::ConstPtr points, pcl::PointCloud<pcl::Normal>::ConstPtr normals)
+{
+    std::shared_ptr<DetectionObserver> observer = m_observer;
+    post(Normals, [observer, points, normals]() { observer->onNormals(points, normals); });
+}
+
+void ObserverDispatcher::postFeatures(pcl::PointCloud<ISMFeature>::ConstPtr features)
+{
+    std::shared_ptr<DetectionObserver> observer = m_observer;
+    post(Features, [observer, features]() { observer->onFeatures(features); });
+}
+
+void ObserverDispatcher::postBoundingBox(const Utils::BoundingBox &boundingBox)
+{
+    std::shared_ptr<DetectionObserver> observer = m_observer;
+    post(BoundingBox, [observer, boundingBox]() { observer->onBoundingBox(boundingBox); });
+}
+
+void ObserverDispatcher::postMaxima(const std::vector<VotingMaximum> &maxima)
+{
+    // the maxima are returned to the caller as well, the observer gets a copy
+    std::shared_ptr<const std::vector<VotingMaximum> > snapshot = std::make_shared<const std::vector<VotingMaximum> >(maxima);
+    std::shared_ptr<DetectionObserver> observer = m_observer;
+    post(Maxima, [observer, snapshot]() { observer->onMaxima(snapshot); });
+}
+
+int ObserverDispatcher::getNumDropped() const
+{
+    return m_num_dropped;
+}
+
+void ObserverDispatcher::post(Kind kind, std::function<void()> delivery)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending[kind])
+    {
+        m_num_dropped++;
+        return;
+    }
+    m_queue.push_back(std::make_pair(kind, std::move(delivery)));
+    m_pending[kind] = true;
+    m_condition.notify_one();
+}
+
+void ObserverDispatcher::run()
+{
+    while (true)
+    {
+        // a result of this kind is accepted again as soon as the observer gets busy with this one, so that it
+        // receives a recent result when it is done
+        std::pair<Kind, std::function<void()> > next;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+            if (m_stop)
+                return;
+            next = std::move(m_queue.front());
+            m_queue.pop_front();
+            m_pending[next.first] = false;
+        }
+
+        try
+        {
+            next.second();
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARN("detection observer failed: " << e.what());
+        }
+    }
+}
+
+}
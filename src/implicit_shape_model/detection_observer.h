@@ -0,0 +1,115 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DETECTION_OBSERVER_H
+#define ISM3D_DETECTION_OBSERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/utils.h"
+#include "utils/ism_feature.h"
+#include "voting/voting.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The DetectionObserver class
+     * Receives the intermediate results of training and detection, e.g. for visualization. The results are shared
+     * snapshots that are not changed afterwards, they are delivered on the thread of an ObserverDispatcher, so the
+     * observer may keep them as long as it wants without copying. Calls are made one at a time.
+     */
+    class DetectionObserver
+    {
+    public:
+        virtual ~DetectionObserver()
+        {
+        }
+
+        virtual void onPointCloud(pcl::PointCloud<PointT>::ConstPtr points)
+        {
+        }
+
+        virtual void onNormals(pcl::PointCloud<PointT>::ConstPtr points, pcl::PointCloud<pcl::Normal>::ConstPtr normals)
+        {
+        }
+
+        virtual void onFeatures(pcl::PointCloud<ISMFeature>::ConstPtr features)
+        {
+        }
+
+        virtual void onBoundingBox(const Utils::BoundingBox &boundingBox)
+        {
+        }
+
+        virtual void onMaxima(std::shared_ptr<const std::vector<VotingMaximum> > maxima)
+        {
+        }
+    };
+
+    /**
+     * @brief The ObserverDispatcher class
+     * Delivers the results posted by training and detection to an observer on a separate thread. Posting never
+     * waits for the observer: while a result of the same kind is still waiting for delivery, the new result is
+     * dropped, so a slow observer sees fewer results instead of slowing down the detection. Posting is thread safe.
+     */
+    class ObserverDispatcher
+    {
+    public:
+        explicit ObserverDispatcher(std::shared_ptr<DetectionObserver> observer);
+
+        // waits for the result that is being delivered, results waiting for delivery are dropped
+        ~ObserverDispatcher();
+
+        void postPointCloud(pcl::PointCloud<PointT>::ConstPtr points);
+        void postNormals(pcl::PointCloud<PointT>::ConstPtr points, pcl::PointCloud<pcl::Normal>::ConstPtr normals);
+        void postFeatures(pcl::PointCloud<ISMFeature>::ConstPtr features);
+        void postBoundingBox(const Utils::BoundingBox &boundingBox);
+        void postMaxima(const std::vector<VotingMaximum> &maxima);
+
+        // the number of results dropped because the observer was busy
+        int getNumDropped() const;
+
+    private:
+        enum Kind
+        {
+            PointCloud,
+            Normals,
+            Features,
+            BoundingBox,
+            Maxima,
+            NumKinds
+        };
+
+        ObserverDispatcher(const ObserverDispatcher&) = delete;
+        ObserverDispatcher& operator=(const ObserverDispatcher&) = delete;
+
+        void post(Kind kind, std::function<void()> delivery);
+        void run();
+
+        std::shared_ptr<DetectionObserver> m_observer;
+
+        std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::deque<std::pair<Kind, std::function<void()> > > m_queue; // at most one result of each kind
+        bool m_pending[NumKinds];
+        bool m_stop;
+        std::atomic<int> m_num_dropped;
+        std::thread m_thread;
+    };
+}
+
+#endif // ISM3D_DETECTION_OBSERVER_H
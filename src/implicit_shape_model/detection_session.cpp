@@ -0,0 +1,236 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "detection_session.h"
+#include "activation_strategy/activation_strategy.h"
+#include "utils/factory.h"
+#include "utils/point_cloud_loader.h"
+
+namespace ism3d
+{
+
+DetectionSession::DetectionSession(const ImplicitShapeModel &model)
+    : m_model(model), m_num_threads(0)
+{
+    // the index was built by the model before, it is only searched
+    m_flann_helper = model.m_flann_helper;
+
+    m_keypointsDetector.reset(Factory<Keypoints>::create(model.m_keypointsDetector->configToJson()));
+    m_featureDescriptor.reset(Factory<Features>::create(model.m_featureDescriptor->configToJson()));
+    m_globalFeatureDescriptor.reset(Factory<Features>::create(model.m_globalFeatureDescriptor->configToJson()));
+
+    m_voting.reset(model.m_voting->createDetectionCopy());
+    m_voting->setGlobalFeatureDescriptor(m_globalFeatureDescriptor.get());
+    m_voting->setMVBBParams(model.m_mvbbEpsilon, model.m_mvbbLeafSize);
+    m_voting->setLeanMaxima(model.m_lean_output);
+    m_voting->setRegionOfInterest(model.m_region_of_interest);
+    m_voting->setClassMaximaCallback(model.m_class_maxima_callback, model.m_priority_classes);
+    m_estimators.reset(new EstimatorCache());
+}
+
+DetectionSession::~DetectionSession()
+{
+}
+
+std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> >
+DetectionSession::detect(pcl::PointCloud<PointNormalT>::ConstPtr points, bool hasNormals)
+{
+    std::map<std::string, double> times;
+    std::vector<VotingMaximum> maxima = detectPoints(points, hasNormals, true, times);
+    return std::make_tuple(maxima, times);
+}
+
+std::future<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > >
+DetectionSession::detectAsync(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals,
+                              const CancellationToken &token)
+{
+    return std::async(std::launch::async, [this, pointCloud, hasNormals, token]()
+    {
+        CancellationToken::Scope scope(token);
+        return detect(pointCloud, hasNormals);
+    });
+}
+
+bool DetectionSession::detect(const std::string& filename, std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times)
+{
+    bool hasNormals = false;
+    pcl::PointCloud<PointNormalT>::Ptr points = PointCloudLoader::load(filename, &hasNormals);
+    return detect(points, hasNormals, maxima, times);
+}
+
+bool DetectionSession::detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals,
+                              std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times)
+{
+    if (points.get() == 0)
+        return false;
+
+    if(m_model.m_setColorToZero)
+    {
+        LOG_INFO("Setting color to 0 in loaded model");
+        for(int i = 0; i < points->size(); i++)
+        {
+            setPointColor(points->at(i), 0, 0, 0);
+        }
+    }
+
+    // the normals of loaded files are known, so the first normal is not checked
+    maxima = detectPoints(points, hasNormals, false, times);
+    return true;
+}
+
+void DetectionSession::setNumThreads(int numThreads)
+{
+    m_num_threads = numThreads;
+}
+
+void DetectionSession::setRegionsOfInterest(const std::vector<Utils::BoundingBox>& regionsOfInterest)
+{
+    m_voting->setRegionOfInterest(RegionOfInterest(regionsOfInterest));
+}
+
+void DetectionSession::setClassMaximaCallback(const Voting::ClassMaximaCallback& callback,
+                                              const std::vector<unsigned>& priorityClasses)
+{
+    m_voting->setClassMaximaCallback(callback, priorityClasses);
+}
+
+const Voting* DetectionSession::getVoting() const
+{
+    return m_voting.get();
+}
+
+const DetectionStatistics& DetectionSession::getLastDetectionStatistics() const
+{
+    return m_last_statistics;
+}
+
+std::vector<VotingMaximum> DetectionSession::detectPoints(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals,
+                                                          bool checkFirstNormal, std::map<std::string, double> &times)
+{
+    times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    std::vector<VotingMaximum> maxima;
+    ThreadScope threads(m_model.getStageThreads(0, m_num_threads), m_model.m_cpus);
+
+    // measure the time
+    boost::timer::cpu_timer timer;
+
+    // compute features with the detectors and descriptors of this session, the trace counts the work of this
+    // detection
+    DetectionTrace trace;
+    ImplicitShapeModel::FeaturePipeline pipeline = getFeaturePipeline();
+    pipeline.trace = &trace;
+    ImplicitShapeModel::DetectionInput input;
+    if (!m_model.computeDetectionFeatures(pipeline, points_in, hasNormals, checkFirstNormal, input, times))
+    {
+        m_last_statistics = trace.getStatistics();
+        return maxima;
+    }
+
+    maxima = detectFeatures(input, timer, times, &trace);
+    times["complete"] += m_model.getElapsedTime(timer, "milliseconds");
+    m_last_statistics = trace.getStatistics();
+    return maxima;
+}
+
+ImplicitShapeModel::FeaturePipeline DetectionSession::getFeaturePipeline()
+{
+    ImplicitShapeModel::FeaturePipeline pipeline = {m_keypointsDetector.get(), m_featureDescriptor.get(),
+                                                    m_globalFeatureDescriptor.get(), &m_voxelFiltering,
+                                                    m_model.getStageThreads(m_model.m_threads_features, m_num_threads),
+                                                    &m_voting->getRegionOfInterest()};
+    pipeline.numNormalThreads = m_model.getStageThreads(m_model.m_threads_normals, m_num_threads);
+    // global features are computed on all points with normals
+    pipeline.lazyNormals = m_model.m_lazyNormals && !m_model.m_single_object_mode && !m_voting->usesGlobalFeatures();
+    pipeline.earlyExitVoting = m_voting.get();
+    pipeline.estimators = m_estimators;
+    return pipeline;
+}
+
+std::vector<VotingMaximum> DetectionSession::detectFeatures(const ImplicitShapeModel::DetectionInput &input,
+                                                            boost::timer::cpu_timer &timer,
+                                                            std::map<std::string, double> &times,
+                                                            DetectionTrace *trace)
+{
+    std::vector<VotingMaximum> maxima;
+
+    // the global classification is the result, there are no local features
+    if(input.globalEarlyExit)
+    {
+        maxima.push_back(input.globalMaximum);
+        if(m_model.m_enable_signals)
+        {
+            timer.stop();
+            m_model.m_signalMaxima(maxima);
+            timer.resume();
+        }
+        if(m_model.m_dispatcher)
+            m_model.m_dispatcher->postMaxima(maxima);
+        return maxima;
+    }
+
+    if(m_model.m_enable_signals)
+    {
+        timer.stop();
+        m_model.m_signalFeatures(input.features);
+        timer.resume();
+    }
+    if(m_model.m_dispatcher)
+        m_model.m_dispatcher->postFeatures(input.features);
+
+    CancellationToken::check();
+    LOG_INFO("activating codewords");
+    boost::timer::cpu_timer timer_voting;
+    ActivationResult activation;
+    const Codebook* codebook = m_model.m_codebook;
+    {
+        ThreadScope activationThreads(m_model.getStageThreads(m_model.m_threads_activation, m_num_threads));
+        codebook->activateFeatures(input.features, m_model.m_distance, *m_flann_helper, m_model.m_flann_exact_match, activation);
+    }
+
+    // forward global feature to voting class in single object mode
+    if(m_model.m_single_object_mode) m_voting->setGlobalFeatures(input.globalFeatures);
+
+    CancellationToken::check();
+    LOG_INFO("casting votes");
+    {
+        ThreadScope votingThreads(m_model.getStageThreads(m_model.m_threads_voting, m_num_threads));
+        m_voting->clear();
+        codebook->castVotes(*input.features, activation, *m_voting);
+    }
+    times["voting"] += m_model.getElapsedTime(timer_voting, "milliseconds");
+
+    CancellationToken::check();
+    LOG_INFO("finding maxima");
+    boost::timer::cpu_timer timer_maxima;
+    {
+        ThreadScope maximaThreads(m_model.getStageThreads(m_model.m_threads_maxima, m_num_threads));
+        maxima = m_voting->findMaxima(input.pointsWithoutNaN, input.normalsWithoutNaN, input.search);
+        if (trace)
+            m_model.countVotes(*trace, activation, *m_voting);
+        if (m_model.m_lean_output)
+            m_voting->releaseVotes();
+    }
+    times["maxima"] += m_model.getElapsedTime(timer_maxima, "milliseconds");
+    CancellationToken::check();
+    LOG_INFO("detected " << maxima.size() << " maxima");
+
+    if(m_model.m_enable_signals)
+    {
+        timer.stop();
+        m_model.m_signalMaxima(maxima);
+        timer.resume();
+    }
+    if(m_model.m_dispatcher)
+        m_model.m_dispatcher->postMaxima(maxima);
+
+    return maxima;
+}
+
+}
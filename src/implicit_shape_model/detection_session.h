@@ -0,0 +1,152 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DETECTION_SESSION_H
+#define ISM3D_DETECTION_SESSION_H
+
+#include <future>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "implicit_shape_model.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The DetectionSession class
+     * Detects objects with a trained implicit shape model that is shared with other sessions. The codebook, the
+     * codebook index and the global features are only read, each session owns the state of a detection: its
+     * detectors and descriptors, the votes and the time measurements. Several sessions can detect concurrently,
+     * one session detects in one point cloud at a time. Create sessions with ImplicitShapeModel::createSession(),
+     * the model must not be trained, loaded or otherwise changed while sessions are used.
+     */
+    class DetectionSession
+    {
+    public:
+        ~DetectionSession();
+
+        /**
+         * @brief Detect unknown object instances using the shared implicit shape model.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @return a tuple with list of detected object positions, time measurements of this detection
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true);
+
+        /**
+         * @brief Detect unknown object instances using the shared implicit shape model.
+         * @param points a point cloud as loaded from file
+         * @param hasNormals whether the file contains normals, as returned by the loader
+         * @param maxima return paramerter: a list of detected object positions
+         * @param times map for time measurements of this detection
+         * @return true if no error occured
+         */
+        bool detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals,
+                    std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times);
+
+        /**
+         * @brief Detect unknown object instances using the shared implicit shape model.
+         * @param filename the filename to the point cloud in which objects should be detected
+         * @param maxima return paramerter: a list of detected object positions
+         * @param times map for time measurements of this detection
+         * @return true if no error occured
+         */
+        bool detect(const std::string& filename, std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times);
+
+        /**
+         * @brief Detect unknown object instances on a separate thread, see ImplicitShapeModel::detectAsync(). The
+         * session must not be used or destroyed until the future is ready.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @param token the token that cancels the detection
+         * @return the future result, it throws a CancelledException if the detection was cancelled
+         */
+        std::future<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > >
+            detectAsync(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true,
+                        const CancellationToken &token = CancellationToken());
+
+        /**
+         * @brief Set the maximum number of threads of each stage of the detection, e.g. to share the cores between
+         * sessions that detect concurrently on the threads of a thread pool. The stages use the thread
+         * configuration of the model up to this limit, the limit of the calling thread is restored after each
+         * detection.
+         * @param numThreads the number of threads, 0 uses the configuration of the model
+         */
+        void setNumThreads(int numThreads);
+
+        /**
+         * @brief Set the regions of interest of the following detections of this session, initially the regions of
+         * the model, see ImplicitShapeModel::detect() with regions of interest.
+         * @param regionsOfInterest oriented boxes, an empty list detects in the whole point cloud
+         */
+        void setRegionsOfInterest(const std::vector<Utils::BoundingBox>& regionsOfInterest);
+
+        /**
+         * @brief Set the class maxima callback of the following detections of this session, initially the callback
+         * of the model, see ImplicitShapeModel::setClassMaximaCallback().
+         * @param callback called on the detecting thread with the class id and its maxima, empty to remove it
+         * @param priorityClasses the classes searched first, in this order
+         */
+        void setClassMaximaCallback(const Voting::ClassMaximaCallback& callback,
+                                    const std::vector<unsigned>& priorityClasses = std::vector<unsigned>());
+
+        /**
+         * @brief Get the voting of this session, holding the votes of the last detection.
+         * @return the voting
+         */
+        const Voting* getVoting() const;
+
+        /**
+         * @brief Get the stage times and counters of the last detection of this session, e.g. the number of points,
+         * keypoints and votes, see ImplicitShapeModel::getLastDetectionStatistics().
+         * @return the statistics of the last detection
+         */
+        const DetectionStatistics& getLastDetectionStatistics() const;
+
+    private:
+        friend class ImplicitShapeModel;
+        friend class EnsembleDetector;
+        friend class TiledDetector;
+        friend class ShardedDetector;
+
+        DetectionSession(const ImplicitShapeModel &model);
+
+        // checkFirstNormal disables the normals if the first normal is invalid
+        std::vector<VotingMaximum> detectPoints(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals,
+                                                bool checkFirstNormal, std::map<std::string, double> &times);
+
+        // the detectors and descriptors of this session with the thread configuration of the model
+        ImplicitShapeModel::FeaturePipeline getFeaturePipeline();
+
+        // activates the codewords, casts the votes and finds the maxima of the computed features, the timer of the
+        // whole detection is paused while signals are handled; the votes are counted if a trace is given
+        std::vector<VotingMaximum> detectFeatures(const ImplicitShapeModel::DetectionInput &input,
+                                                  boost::timer::cpu_timer &timer,
+                                                  std::map<std::string, double> &times,
+                                                  DetectionTrace *trace = 0);
+
+        const ImplicitShapeModel &m_model;
+        std::shared_ptr<FlannHelper> m_flann_helper;
+        int m_num_threads;
+
+        std::unique_ptr<Keypoints> m_keypointsDetector;
+        std::unique_ptr<Features> m_featureDescriptor;
+        std::unique_ptr<Features> m_globalFeatureDescriptor;
+        VoxelHashGrid m_voxelFiltering;
+        EstimatorCache::Ptr m_estimators; // estimators and searches reused from frame to frame
+        std::unique_ptr<Voting> m_voting;
+        DetectionStatistics m_last_statistics;
+    };
+}
+
+#endif // ISM3D_DETECTION_SESSION_H
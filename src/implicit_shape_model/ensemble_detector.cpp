@@ -0,0 +1,176 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "ensemble_detector.h"
+#include "utils/shared_search.h"
+
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <omp.h>
+
+namespace ism3d
+{
+
+EnsembleDetector::EnsembleDetector(const std::vector<ImplicitShapeModel*> &models)
+    : m_num_threads(0), m_num_groups(0)
+{
+    for (ImplicitShapeModel *model : models)
+        m_sessions.push_back(model->createSession());
+}
+
+EnsembleDetector::~EnsembleDetector()
+{
+}
+
+void EnsembleDetector::setNumThreads(int numThreads)
+{
+    m_num_threads = numThreads;
+}
+
+int EnsembleDetector::getNumGroups() const
+{
+    return m_num_groups;
+}
+
+std::vector<std::vector<int> > EnsembleDetector::groupModels(bool hasNormals) const
+{
+    std::vector<std::vector<int> > groups;
+    std::map<std::string, int> groupOfKey;
+    for (int i = 0; i < (int)m_sessions.size(); i++)
+    {
+        const DetectionSession &session = *m_sessions[i];
+
+        // the preprocessed points of a region of interest are cropped with the margin of the model
+        if (!session.m_voting->getRegionOfInterest().empty())
+        {
+            groups.push_back(std::vector<int>(1, i));
+            continue;
+        }
+
+        const std::string key = session.m_model.getPreprocessingKey(hasNormals);
+        std::map<std::string, int>::const_iterator it = groupOfKey.find(key);
+        if (it == groupOfKey.end())
+        {
+            groupOfKey[key] = (int)groups.size();
+            groups.push_back(std::vector<int>(1, i));
+        }
+        else
+        {
+            groups[it->second].push_back(i);
+        }
+    }
+    return groups;
+}
+
+std::tuple<std::vector<EnsembleMaximum>, std::map<std::string, double> >
+EnsembleDetector::detect(pcl::PointCloud<PointNormalT>::ConstPtr points, bool hasNormals)
+{
+    std::map<std::string, double> times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    std::vector<EnsembleMaximum> maxima;
+    m_num_groups = 0;
+    if (m_sessions.empty())
+        return std::make_tuple(maxima, times);
+
+    boost::timer::cpu_timer timer;
+
+    // the normals are checked before grouping, since the groups depend on whether normals are computed
+    if (hasNormals)
+    {
+        for (const PointNormalT &point : points->points)
+        {
+            if (!pcl::isFinite(point))
+                continue;
+            if (point.normal_x == 0 && point.normal_y == 0 && point.normal_z == 0 ||
+                    pcl_isnan(point.normal_x) || pcl_isnan(point.curvature))
+                hasNormals = false;
+            break;
+        }
+    }
+
+    const int numThreads = m_num_threads > 0 ? m_num_threads : omp_get_max_threads();
+    std::vector<std::vector<int> > groups = groupModels(hasNormals);
+    LOG_INFO("detecting with " << m_sessions.size() << " models in " << groups.size() << " preprocessing groups");
+
+    std::vector<std::vector<VotingMaximum> > modelMaxima(m_sessions.size());
+    std::vector<std::map<std::string, double> > modelTimes(m_sessions.size());
+    for (const std::vector<int> &group : groups)
+    {
+        // the first model of the group computes the shared stages with all threads
+        DetectionSession &first = *m_sessions[group[0]];
+        first.setNumThreads(numThreads);
+        ImplicitShapeModel::PreprocessedInput preprocessed;
+        bool valid;
+        {
+            ThreadScope threads(numThreads, first.m_model.m_cpus);
+            valid = first.m_model.preprocessDetectionInput(first.getFeaturePipeline(), points, hasNormals, false,
+                                                           preprocessed, times);
+        }
+        if (!valid)
+            continue;
+        m_num_groups++;
+
+        // each model describes the preprocessed points with its own search over the shared spatial indices
+        const int modelThreads = std::max(1, numThreads / (int)group.size());
+        std::exception_ptr error;
+        std::mutex mutex;
+        auto describe = [&](int model)
+        {
+            try
+            {
+                DetectionSession &session = *m_sessions[model];
+                session.setNumThreads(modelThreads);
+                ThreadScope threads(modelThreads, session.m_model.m_cpus);
+                boost::timer::cpu_timer timer_model;
+
+                ImplicitShapeModel::PreprocessedInput own = preprocessed;
+                own.search = preprocessed.search->fork();
+                ImplicitShapeModel::DetectionInput input;
+                session.m_model.describeDetectionInput(session.getFeaturePipeline(), own, input, modelTimes[model]);
+                modelMaxima[model] = session.detectFeatures(input, timer_model, modelTimes[model]);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (int i = 1; i < (int)group.size(); i++)
+            workers.push_back(std::thread(describe, group[i]));
+        describe(group[0]);
+        for (std::thread &worker : workers)
+            worker.join();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    // the maxima of all models, the strongest first
+    for (int i = 0; i < (int)m_sessions.size(); i++)
+    {
+        for (const VotingMaximum &maximum : modelMaxima[i])
+            maxima.push_back(EnsembleMaximum{i, maximum});
+        for (const auto &time : modelTimes[i])
+            times[time.first] += time.second;
+    }
+    std::stable_sort(maxima.begin(), maxima.end(), [](const EnsembleMaximum &a, const EnsembleMaximum &b)
+    {
+        return a.maximum.weight > b.maximum.weight;
+    });
+
+    times["complete"] = m_sessions[0]->m_model.getElapsedTime(timer, "milliseconds");
+    return std::make_tuple(maxima, times);
+}
+
+}
@@ -0,0 +1,85 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_ENSEMBLE_DETECTOR_H
+#define ISM3D_ENSEMBLE_DETECTOR_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "implicit_shape_model.h"
+#include "detection_session.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The EnsembleMaximum struct
+     * A maximum detected by one model of an ensemble.
+     */
+    struct EnsembleMaximum
+    {
+        int model; // index of the model in the ensemble
+        VotingMaximum maximum;
+    };
+
+    /**
+     * @brief The EnsembleDetector class
+     * Detects objects with several trained implicit shape models in the same point cloud. Models whose voxel
+     * filtering, normal estimation and keypoint detection are configured equally form a group, these stages are
+     * computed once per group with the detectors of its first model. The descriptors, the activation, the voting
+     * and the maxima of the models of a group are computed concurrently, each model on its share of the threads.
+     * Models with a region of interest crop the point cloud and form a group of their own. The detector holds a
+     * DetectionSession of each model, the models must not be trained, loaded or otherwise changed while it is used.
+     */
+    class EnsembleDetector
+    {
+    public:
+        /**
+         * @brief Create a detector for the models, builds their codebook indices if they are not available yet.
+         * @param models the trained models, they must outlive the detector
+         */
+        EnsembleDetector(const std::vector<ImplicitShapeModel*> &models);
+        ~EnsembleDetector();
+
+        /**
+         * @brief Detect unknown object instances with all models.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @return a tuple with the maxima of all models sorted by their weight, time measurements of this detection:
+         * the stages of the models are summed up, "complete" is the duration of the whole detection
+         */
+        std::tuple<std::vector<EnsembleMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true);
+
+        /**
+         * @brief Set the number of threads shared by the models of a group.
+         * @param numThreads the number of threads, 0 uses the OpenMP default
+         */
+        void setNumThreads(int numThreads);
+
+        /**
+         * @brief Get the number of groups that were preprocessed in the last detection.
+         * @return the number of groups
+         */
+        int getNumGroups() const;
+
+    private:
+        // groups the models by the configuration of their preprocessing, in the order of the models
+        std::vector<std::vector<int> > groupModels(bool hasNormals) const;
+
+        std::vector<std::shared_ptr<DetectionSession> > m_sessions;
+        int m_num_threads;
+        int m_num_groups;
+    };
+}
+
+#endif // ISM3D_ENSEMBLE_DETECTOR_H
@@ -13,19 +13,26 @@
 #include "../utils/utils.h"
 #include "../utils/distance.h"
 #include "../utils/debug_utils.h"
+#include "../utils/feature_block.h"
+#include "../utils/flann_helper.h"
+#include "ranking_context.h"
 
+#include <algorithm>
 #include <fstream>
+#include <memory>
+#include <omp.h>
 
 namespace ism3d
 {
 FeatureRanking::FeatureRanking()
-    : m_numThreads(1)
+    : m_flann_checks(128), m_numThreads(0)
 {
     addParameter(m_k_search, "KSearch", 10);
     addParameter(m_dist_thresh, "DistanceThreshold", 0.1f);
     addParameter(m_factor, "Factor", 0.75f);
     addParameter(m_extractList, "ExtractFromList", std::string("front"));
     addParameter(m_iterative_ranking, "UseIterativeRanking", false);
+    addParameter(m_incremental_rescoring, "UseIncrementalRescoring", false);
     addParameter(m_score_threshold, "ScoreThreshold", 0.0f);
 }
 
@@ -41,9 +48,8 @@ bool FeatureRanking::keepFeatureWithScore(float score)
         return score != 0;
 }
 
-std::tuple<std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr>>, pcl::PointCloud<ISMFeature>::Ptr,
-std::vector<unsigned>>
-FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr>> &features, int num_kd_trees, bool flann_exact_match)
+std::vector<int> FeatureRanking::operator()(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr>> &features,
+                                            int num_kd_trees, bool flann_exact_match, int flann_checks)
 {
     // iterative ranking is only defined properly if using "front"
     if(m_iterative_ranking)
@@ -53,13 +59,47 @@ FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFea
 
     m_num_kd_trees = num_kd_trees;
     m_flann_exact_match = flann_exact_match;
+    m_flann_checks = flann_checks;
     int num_input_features = countFeatures(features);
 
+    // the descriptors are copied once into a block shared by all iterations, features are referred to by row
+    std::vector<std::vector<int> > rows(features.size());
+    int dim = 0;
+    for(auto it = features.begin(); it != features.end() && dim == 0; it++)
+    {
+        for(const pcl::PointCloud<ISMFeature>::Ptr &cloud : it->second)
+        {
+            if(!cloud->empty())
+            {
+                dim = (int)cloud->at(0).descriptor.size();
+                break;
+            }
+        }
+    }
+    std::shared_ptr<FeatureBlock> block = std::make_shared<FeatureBlock>(num_input_features, dim);
+    int row = 0;
+    int class_index = 0;
+    for(auto it = features.begin(); it != features.end(); it++, class_index++)
+    {
+        for(const pcl::PointCloud<ISMFeature>::Ptr &cloud : it->second)
+        {
+            for(const ISMFeature &feature : cloud->points)
+            {
+                block->set(row, feature);
+                block->classIds[row] = class_index;
+                rows[class_index].push_back(row);
+                row++;
+            }
+        }
+    }
+    RankingContext context(block, rows, m_num_kd_trees);
+    context.setSharedIndexParams(m_shared_dist_type, m_shared_params);
+    m_shared_index.reset();
+    m_graph = NeighborGraph();
+
     bool terminate_selection;
     // variables to hold the result
-    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr>> features_reduced;
-    pcl::PointCloud<ISMFeature>::Ptr all_features_reduced(new pcl::PointCloud<ISMFeature>());
-    std::vector<unsigned> all_feature_classes_reduced;
+    std::vector<std::vector<int> > rows_reduced;
 
     // remove features with low scores
     int iter_cnt = 0;
@@ -68,12 +108,10 @@ FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFea
         // init values for next loop
         LOG_INFO("feature ranking iteration " << iter_cnt);
         terminate_selection = true;
-        features_reduced.clear();
-        all_features_reduced->clear();
-        all_feature_classes_reduced.clear();
+        rows_reduced.assign(context.numClasses(), std::vector<int>());
 
         // compute scores
-        std::map<unsigned, std::vector<float>> scores = iComputeScores(features);
+        std::map<unsigned, std::vector<float>> scores = iComputeScores(context);
         std::map<unsigned, std::vector<std::pair<int, float>>> index_score_map;
 
         if(getType() != "Uniform")
@@ -86,14 +124,10 @@ FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFea
             DebugUtils::writeOutForDebug(index_score_map, getType());
         }
 
-        std::map<unsigned, std::vector<std::vector<float>>> feature_scores = unflatten_list(scores, features);
-
-        // NOTE: this is only for debug to write out the indices selected by a feature ranking algorithm; check absolute path below
+        // NOTE: this is only for debug to write out the rows selected by a feature ranking algorithm; check absolute path below
         // NOTE: to write out additional information about selected features by a feature ranking algorithm check same flag farther down in this file
         // NOTE: to write out indices randomly selected during recognition, check the same debug flag in codebook.cpp
-        // NOTE: to write out the actual feature vectors see below the next for loop
         bool debug_flag_write_out = false;
-        int temp_idx = 0;
         std::ofstream ofs;
         if(debug_flag_write_out) ofs.open("/home/vseib/Desktop/cwids/selected_idxs.txt", std::ofstream::out);
 
@@ -104,50 +138,29 @@ FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFea
         }
 
         // remove features with score zero
-        for(auto it : feature_scores)
+        for(int c = 0; c < context.numClasses(); c++)
         {
-            unsigned class_id = it.first;
-            std::vector<std::vector<float> > scores_doublelist = it.second;
-            features_reduced.insert({class_id, std::vector<pcl::PointCloud<ISMFeature>::Ptr>()});
-            for(int i = 0; i < scores_doublelist.size(); i++)
-            {
-                pcl::PointCloud<ISMFeature>::Ptr cloud(new pcl::PointCloud<ISMFeature>());
-                features_reduced.at(class_id).push_back(cloud);
-            }
-
-            for(int first_idx = 0; first_idx < scores_doublelist.size(); first_idx++)
+            const std::vector<int> &class_rows = context.rows(c);
+            const std::vector<float> &class_scores = scores.at(c);
+            for(int i = 0; i < (int)class_rows.size(); i++)
             {
-                for(int second_idx = 0; second_idx < scores_doublelist.at(first_idx).size(); second_idx++)
+                if(keepFeatureWithScore(class_scores.at(i)))
+                {
+                    rows_reduced[c].push_back(class_rows[i]);
+                    if(debug_flag_write_out) ofs << class_rows[i] << std::endl;
+                }
+                else
                 {
-                    float score = scores_doublelist.at(first_idx).at(second_idx);
-
-                    if(keepFeatureWithScore(score))
-                    {
-                        ISMFeature current_feature = features.at(class_id).at(first_idx)->at(second_idx);
-                        features_reduced.at(class_id).at(first_idx)->push_back(current_feature);
-                        all_features_reduced->push_back(current_feature);
-                        all_feature_classes_reduced.push_back(class_id);
-
-                        if(debug_flag_write_out) ofs << temp_idx << std::endl;
-                    }
-                    else
-                    {
-                        terminate_selection = false;
-                    }
-                    if(debug_flag_write_out) temp_idx++;
+                    terminate_selection = false;
                 }
             }
         }
         if(debug_flag_write_out) ofs.close();
 
-        // NOTE: for debug only - write features to file before and after reduction
-        //DebugUtils::writeToFile(features, "features_all");
-        //DebugUtils::writeToFile(features_reduced, "features_reduced");
-
         if(m_iterative_ranking)
         {
             // check whether each class still has features
-            if(isClassDeleted(features_reduced))
+            if(isClassDeleted(rows_reduced))
             {
                 LOG_WARN("score threshold " << m_score_threshold << " too low - removes at least 1 class completely!");
                 m_score_threshold *= 1.5;
@@ -155,12 +168,13 @@ FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFea
             }
             else
             {
-                int num_reduced = countFeatures(features_reduced);
-                int num_before = countFeatures(features);
+                // views of classes without removed features are kept for the next iteration
+                int num_before = context.numFeatures();
+                context.setRows(rows_reduced);
+                int num_reduced = context.numFeatures();
                 float ratio_left = ((float) num_reduced) / ((float) num_before);
 
                 LOG_INFO("number of features after iteration " << iter_cnt-1 << ": " << num_reduced);
-                features = features_reduced;
 
                 // abort early: don't wait hundreds of iterations where only 1 or 2 features get removed per iteration
                 if(ratio_left > 0.95)
@@ -173,11 +187,68 @@ FeatureRanking::operator()(std::map<unsigned, std::vector<pcl::PointCloud<ISMFea
     }
     while(m_iterative_ranking && !terminate_selection);
 
-    int num_output_features = countFeatures(features_reduced);
+    // the rows are ordered by class and ascending within each class, so the selection is ascending
+    std::vector<int> selected;
+    for(const std::vector<int> &class_rows : rows_reduced)
+        selected.insert(selected.end(), class_rows.begin(), class_rows.end());
+
+    int num_output_features = (int)selected.size();
+
+    // the index on all features covers exactly the selected features only if none was removed
+    if(num_output_features == num_input_features)
+        m_shared_index = context.getSharedIndex();
+    m_graph = NeighborGraph();
     LOG_INFO("input features: " << num_input_features << ", output features: " << num_output_features << ", output ratio: "
               << (((float)num_output_features)/(num_input_features)));
 
-    return std::make_tuple(features_reduced, all_features_reduced, all_feature_classes_reduced);
+    return selected;
+}
+
+void FeatureRanking::selectFeatures(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                    const std::vector<int> &selected,
+                                    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features_selected,
+                                    pcl::PointCloud<ISMFeature>::Ptr all_features_selected,
+                                    std::vector<unsigned> &all_feature_classes_selected)
+{
+    features_selected.clear();
+    all_features_selected->clear();
+    all_features_selected->reserve(selected.size());
+    all_feature_classes_selected.clear();
+    all_feature_classes_selected.reserve(selected.size());
+
+    int next = 0;
+    int begin = 0;
+    for(auto it = features.begin(); it != features.end(); it++)
+    {
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> &class_selected = features_selected[it->first];
+        for(const pcl::PointCloud<ISMFeature>::Ptr &cloud : it->second)
+        {
+            const int end = begin + (int)cloud->size();
+            const int first = next;
+            while(next < (int)selected.size() && selected[next] < end)
+                next++;
+
+            if(next - first == (int)cloud->size())
+            {
+                class_selected.push_back(cloud);
+            }
+            else
+            {
+                pcl::PointCloud<ISMFeature>::Ptr model(new pcl::PointCloud<ISMFeature>());
+                model->reserve(next - first);
+                for(int k = first; k < next; k++)
+                    model->push_back(cloud->at(selected[k] - begin));
+                class_selected.push_back(model);
+            }
+
+            for(int k = first; k < next; k++)
+            {
+                all_features_selected->push_back(cloud->at(selected[k] - begin));
+                all_feature_classes_selected.push_back(it->first);
+            }
+            begin = end;
+        }
+    }
 }
 
 
@@ -289,58 +360,52 @@ void FeatureRanking::computeScoreThreshold(const std::map<unsigned, std::vector<
 }
 
 
-bool FeatureRanking::isClassDeleted(const FeatureMapT& features_reduced)
+bool FeatureRanking::isClassDeleted(const std::vector<std::vector<int> > &rows_reduced)
 {
-    bool class_deleted = false;
-    for(auto class_features : features_reduced)
+    for(const std::vector<int> &class_rows : rows_reduced)
     {
-        int num_features = countFeatures(class_features.second);
-        if(num_features == 0)
-        {
-            class_deleted = true;
-            break;
-        }
+        if(class_rows.empty())
+            return true;
     }
-    return class_deleted;
+    return false;
 }
 
 
-std::map<unsigned, std::vector<std::vector<float>>> FeatureRanking::unflatten_list(std::map<unsigned, std::vector<float> > &scores_flat_list,
-                                                                                FeatureMapT &features)
+void FeatureRanking::setNumThreads(int numThreads)
 {
-    // unflatten scores list
-    std::map<unsigned, std::vector<std::vector<float> > > scores;
-    for(int class_id = 0; class_id < features.size(); class_id++)
-    {
-        int object_index = 0;
-        scores.insert({class_id, std::vector<std::vector<float>>(features.at(class_id).size())});
-        for(int i = 0; i < scores_flat_list.at(class_id).size(); i++)
-        {
-            if(scores.at(class_id).at(object_index).size() == features.at(class_id).at(object_index)->size())
-            {
-                do
-                {
-                    object_index++;
-                }
-                while(features.at(class_id).at(object_index)->size() == 0);
-            }
+    m_numThreads = numThreads;
+}
 
-            float next_score = scores_flat_list.at(class_id).at(i);
-            scores.at(class_id).at(object_index).push_back(next_score);
-        }
-    }
-    return scores;
+bool FeatureRanking::keepsAllFeatures() const
+{
+    // uniform scores are never zero
+    return getType() == "Uniform" && !m_iterative_ranking;
 }
 
+void FeatureRanking::setSharedIndexParams(const std::string &dist_type, const KnnIndexParams &params)
+{
+    m_shared_dist_type = dist_type;
+    m_shared_params = params;
+}
 
-void FeatureRanking::setNumThreads(int numThreads)
+std::shared_ptr<FlannHelper> FeatureRanking::takeSharedIndex()
 {
-    m_numThreads = numThreads;
+    std::shared_ptr<FlannHelper> index = m_shared_index;
+    m_shared_index.reset();
+    return index;
 }
 
 int FeatureRanking::getNumThreads() const
 {
-    return m_numThreads;
+    return m_numThreads > 0 ? m_numThreads : omp_get_max_threads();
+}
+
+flann::SearchParams FeatureRanking::getSearchParams() const
+{
+    // batched queries are distributed over the threads by flann
+    flann::SearchParams params = m_flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(m_flann_checks);
+    params.cores = getNumThreads();
+    return params;
 }
 
 int FeatureRanking::countFeatures(const FeatureMapT &features)
@@ -363,102 +428,147 @@ int FeatureRanking::countFeatures(const std::vector<pcl::PointCloud<ISMFeature>:
     return num;
 }
 
-pcl::PointCloud<ISMFeature>::Ptr FeatureRanking::createCloudWithClassIds(const FeatureRanking::FeatureMapT &features,
-                                                                    bool filter, unsigned filter_class, bool inverse)
+void FeatureRanking::findNeighborsOfClass(RankingContext &context, int class_index, int k,
+                                          std::vector<std::vector<int> > &indices,
+                                          std::vector<std::vector<float> > &distances)
 {
-    pcl::PointCloud<ISMFeature>::Ptr result(new pcl::PointCloud<ISMFeature>());
-    for(auto it : features) // loop over pairs in map
+    if(!m_iterative_ranking || !m_incremental_rescoring)
     {
-        for(auto it2 : it.second) // loop over vector elements
-        {
-            for(ISMFeature f : it2->points) // loop over points
-            {
-                f.classId = it.first;
-                if(filter)
-                {
-                    if(inverse && filter_class != it.first)
-                    {
-                        result->push_back(f);
-                    }
-                    else if(!inverse && filter_class == it.first)
-                    {
-                        result->push_back(f);
-                    }
-                }
-                else
-                    result->push_back(f);
-            }
-        }
+        context.allIndex().knnSearch(context.classDescriptors(class_index), indices, distances, k, getSearchParams());
+        return;
     }
-    result->height = 1;
-    result->width = result->points.size();
-    result->is_dense = false;
-    return result;
-}
 
-std::vector<int> FeatureRanking::findSimilarFeatures(pcl::KdTreeFLANN<ISMFeature> &kdtree, ISMFeature &feature)
-{
-    std::vector<int> pointIdNNSearch(m_k_search);
-    std::vector<float> pointNNSquaredDistance(m_k_search);
-    if(!kdtree.nearestKSearch(feature, m_k_search, pointIdNNSearch, pointNNSquaredDistance) > 0)
-        LOG_WARN("Error during nearest neighbor search.");
-
-    // use distance threshold to define equal features
-    std::vector<int> result;
-    for(int i = 0; i < pointIdNNSearch.size(); i++)
+    updateNeighborGraph(context, k);
+    const std::vector<int> &class_rows = context.rows(class_index);
+    indices.assign(class_rows.size(), std::vector<int>());
+    distances.assign(class_rows.size(), std::vector<float>());
+    for(int q = 0; q < (int)class_rows.size(); q++)
     {
-        if(pointNNSquaredDistance.at(i) < m_dist_thresh)
-            result.push_back(pointIdNNSearch.at(i));
+        const int row = class_rows[q];
+        for(int neighbor : m_graph.neighbors[row])
+            indices[q].push_back(m_graph.positions[neighbor]);
+        distances[q] = m_graph.distances[row];
     }
-    return result;
 }
 
-flann::Matrix<float> FeatureRanking::createFlannDataset(pcl::PointCloud<ISMFeature>::Ptr &class_features)
+void FeatureRanking::updateNeighborGraph(RankingContext &context, int k)
 {
-    // create a dataset with all features for matching / activation
-    int descriptor_size = class_features->at(0).descriptor.size();
-    flann::Matrix<float> dataset(new float[class_features->size() * descriptor_size],
-            class_features->size(), descriptor_size);
+    const FeatureBlock &block = context.block();
+    if(!m_graph.index || m_graph.k != k)
+    {
+        // the first iteration searches all features, the rows of the index are the rows of the block
+        m_graph = NeighborGraph();
+        m_graph.k = k;
+        m_graph.index = std::make_shared<RankingContext::IndexT>(block.getMatrix(), flann::KDTreeIndexParams(m_num_kd_trees));
+        m_graph.index->buildIndex();
+        m_graph.neighbors.resize(block.size());
+        m_graph.distances.resize(block.size());
+        m_graph.active.assign(block.size(), 1);
+        m_graph.num_rows = block.size();
+
+        std::vector<int> rows(block.size());
+        for(int row = 0; row < block.size(); row++)
+            rows[row] = row;
+        searchNeighborGraph(block, rows);
+    }
 
-    // build dataset
-    for(int i = 0; i < class_features->size(); i++)
+    // rows are only removed, an unchanged number of rows means unchanged rows
+    if(context.numFeatures() != m_graph.num_rows)
     {
-        ISMFeature ism_feat = class_features->at(i);
-        std::vector<float> descriptor = ism_feat.descriptor;
-        for(int j = 0; j < (int)descriptor.size(); j++)
+        std::vector<char> active(block.size(), 0);
+        for(const std::vector<int> &class_rows : context.classRows())
+        {
+            for(int row : class_rows)
+                active[row] = 1;
+        }
+
+        std::vector<char> removed(block.size(), 0);
+        for(int row = 0; row < block.size(); row++)
         {
-            dataset[i][j] = descriptor.at(j);
+            if(m_graph.active[row] && !active[row])
+            {
+                removed[row] = 1;
+                m_graph.index->removePoint(row);
+                m_graph.neighbors[row].clear();
+                m_graph.distances[row].clear();
+            }
         }
+        m_graph.active = active;
+        m_graph.num_rows = context.numFeatures();
+
+        // the neighbors of a feature are only searched again if one of them was removed
+        std::vector<int> requery;
+        for(int row = 0; row < block.size(); row++)
+        {
+            if(!active[row])
+                continue;
+            for(int neighbor : m_graph.neighbors[row])
+            {
+                if(removed[neighbor])
+                {
+                    requery.push_back(row);
+                    break;
+                }
+            }
+        }
+        LOG_INFO("searching the neighbors of " << requery.size() << " of " << m_graph.num_rows << " features again");
+        searchNeighborGraph(block, requery);
     }
 
-    return dataset;
+    const std::vector<int> &all_rows = context.allRows();
+    m_graph.positions.assign(block.size(), -1);
+    for(int i = 0; i < (int)all_rows.size(); i++)
+        m_graph.positions[all_rows[i]] = i;
 }
 
+void FeatureRanking::searchNeighborGraph(const FeatureBlock &block, const std::vector<int> &rows)
+{
+    if(rows.empty())
+        return;
+
+    // the descriptors of the rows are gathered into one query matrix
+    const int dim = block.dim();
+    std::vector<float> query_buffer(rows.size() * dim);
+    for(int q = 0; q < (int)rows.size(); q++)
+        std::copy(block.descriptor(rows[q]), block.descriptor(rows[q]) + dim, query_buffer.begin() + (size_t)q * dim);
+    flann::Matrix<float> queries(query_buffer.data(), rows.size(), dim);
+
+    std::vector<std::vector<int> > indices;
+    std::vector<std::vector<float> > distances;
+    m_graph.index->knnSearch(queries, indices, distances, m_graph.k, getSearchParams());
+    for(int q = 0; q < (int)rows.size(); q++)
+    {
+        m_graph.neighbors[rows[q]] = indices[q];
+        m_graph.distances[rows[q]] = distances[q];
+    }
+}
 
-std::vector<float> FeatureRanking::findNeighborsDistances(flann::Index<flann::L2<float> > &index, flann::Matrix<float> &query)
+std::vector<std::vector<float> > FeatureRanking::findNeighborsDistances(flann::Index<flann::L2<float> > &index,
+                                                                        const flann::Matrix<float> &queries)
 {
     std::vector<std::vector<int> > indices;
     std::vector<std::vector<float> > distances;
-    flann::SearchParams params = m_flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-    index.knnSearch(query, indices, distances, m_k_search, params);
-    return distances.at(0);
+    flann::SearchParams params = getSearchParams();
+    index.knnSearch(queries, indices, distances, m_k_search, params);
+    return distances;
 }
 
 
-std::vector<int> FeatureRanking::findSimilarFeaturesFlann(flann::Index<flann::L2<float> > &index, flann::Matrix<float> &query)
+std::vector<std::vector<int> > FeatureRanking::findSimilarFeaturesFlann(flann::Index<flann::L2<float> > &index,
+                                                                        const flann::Matrix<float> &queries)
 {
     std::vector<std::vector<int> > indices;
     std::vector<std::vector<float> > distances;
-    flann::SearchParams params = m_flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-    index.knnSearch(query, indices, distances, m_k_search, params);
+    flann::SearchParams params = getSearchParams();
+    index.knnSearch(queries, indices, distances, m_k_search, params);
     // use distance threshold to define equal features
-    std::vector<int> result;
-    if(indices.size() > 0)
+    std::vector<std::vector<int> > result(indices.size());
+    for(int q = 0; q < (int)indices.size(); q++)
     {
-        for(int i = 0; i < indices.at(0).size(); i++)
+        for(int i = 0; i < (int)indices.at(q).size(); i++)
         {
-            if(distances.at(0).at(i) < m_dist_thresh)
-                result.push_back(indices.at(0).at(i));
+            if(distances.at(q).at(i) < m_dist_thresh)
+                result[q].push_back(indices.at(q).at(i));
         }
     }
     return result;
@@ -11,16 +11,18 @@
 #ifndef ISM3D_FEATURE_RANKING_H
 #define ISM3D_FEATURE_RANKING_H
 
+#include <algorithm>
+
 #include "../utils/json_object.h"
 #include "../utils/utils.h"
 #include "../utils/ism_feature.h"
+#include "ranking_context.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/pcl_base.h>
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <pcl/search/search.h>
-#include <pcl/kdtree/kdtree_flann.h>
 
 namespace ism3d
 {
@@ -40,25 +42,60 @@ namespace ism3d
         virtual ~FeatureRanking();
 
         /**
-         * @brief Interface function to compute scores on descriptors in the input point cloud.
-         * @param features map assigning each class an input point cloud with computed features
+         * @brief Interface function to compute scores on the descriptors of all training features and select the
+         * features to keep. The descriptors are copied once into a shared feature block, the features themselves
+         * are not copied.
+         * @param features map assigning each class the computed features of each model
          * @param num_kd_trees number of flann kdtrees to use for index
          * @param flann_exact_match if true flann will find exact nearest neighbor
-         * @return a map with feature scores representing the structure of the input features map
+         * @param flann_checks number of leaves to check in approximate searches
+         * @return the ascending indices of the selected features among all features in the order of classes, models
+         * and features
          */
-    std::tuple<std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr>>,
-            pcl::PointCloud<ISMFeature>::Ptr,
-            std::vector<unsigned>>
-    operator()(
-            std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
-            int num_kd_trees = 4, bool flann_exact_match = false);
+        std::vector<int> operator()(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                    int num_kd_trees = 4, bool flann_exact_match = false, int flann_checks = 128);
 
         /**
-         * @brief Set the number of threads to use. The derived classes do not need to use it.
-         * @param numThreads the number of threads to use
+         * @brief Collect the selected features. Models of which all features are selected share their point cloud
+         * with the input.
+         * @param features map assigning each class the computed features of each model
+         * @param selected the ascending indices of the selected features as returned by the ranking
+         * @param features_selected output: the selected features of each model for each class
+         * @param all_features_selected output: all selected features in one cloud
+         * @param all_feature_classes_selected output: the class id of each feature in all_features_selected
+         */
+        static void selectFeatures(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                   const std::vector<int> &selected,
+                                   std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features_selected,
+                                   pcl::PointCloud<ISMFeature>::Ptr all_features_selected,
+                                   std::vector<unsigned> &all_feature_classes_selected);
+
+        /**
+         * @brief Set the number of threads to use for the nearest neighbor searches of the ranking.
+         * @param numThreads the number of threads to use, 0 uses the OpenMP default
          */
         void setNumThreads(int numThread);
 
+        /**
+         * @brief Whether the ranking keeps all features in their order, in that case it does not need to be applied.
+         * @return true for the uniform ranking without iterations
+         */
+        bool keepsAllFeatures() const;
+
+        /**
+         * @brief Build the index on all features so that it can be reused after the ranking, see takeSharedIndex().
+         * @param dist_type the distance type of the index, an empty type disables sharing
+         * @param params the backend parameters of the index
+         */
+        void setSharedIndexParams(const std::string &dist_type, const KnnIndexParams &params);
+
+        /**
+         * @brief Release the index on all features of the last ranking. It is only available if sharing was enabled,
+         * the ranking searched all features and selected every feature, its rows are then the selected features.
+         * @return the index on all features or an empty pointer
+         */
+        std::shared_ptr<FlannHelper> takeSharedIndex();
+
     protected:
         FeatureRanking();
 
@@ -73,41 +110,43 @@ namespace ism3d
 
         void computeScoreThreshold(const std::map<unsigned, std::vector<std::pair<int, float>>> &index_score_map);
 
-        bool isClassDeleted(const FeatureMapT& features_reduced);
-
-        std::map<unsigned, std::vector<std::vector<float>>> unflatten_list(
-                std::map<unsigned, std::vector<float>> &scores_flat_list,
-                FeatureMapT &features);
+        bool isClassDeleted(const std::vector<std::vector<int> > &rows_reduced);
 
+        // the number of threads to use, the OpenMP default if no positive number was set
         int getNumThreads() const;
 
-        virtual std::map<unsigned, std::vector<float> > iComputeScores(
-                const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &f) = 0;
-
-        int countFeatures(const FeatureMapT &features);
-        int countFeatures(const std::vector<pcl::PointCloud<ISMFeature>::Ptr> &features);
+        // the search parameters of the ranking for searches with all threads
+        flann::SearchParams getSearchParams() const;
 
-        // puts all features into one cloud, if desired only returns one specific class (filter_class)
-        // or all others (inverse)
-        pcl::PointCloud<ISMFeature>::Ptr createCloudWithClassIds
-            (const FeatureRanking::FeatureMapT &features,
-             bool filter = false, unsigned filter_class = 0, bool inverse = false);
+        // computes a score for each feature, the scores of class index c are given in the order of context.rows(c)
+        virtual std::map<unsigned, std::vector<float> > iComputeScores(RankingContext &context) = 0;
 
-        flann::Matrix<float> createFlannDataset(pcl::PointCloud<ISMFeature>::Ptr &class_features);
+        // the k nearest neighbors of the features of a class among all features as positions in context.allRows(),
+        // in the order of context.rows(class_index); with incremental rescoring the neighbors are kept between
+        // iterations and only the features that lost a neighbor are searched again
+        void findNeighborsOfClass(RankingContext &context, int class_index, int k,
+                                  std::vector<std::vector<int> > &indices, std::vector<std::vector<float> > &distances);
 
-        std::vector<float> findNeighborsDistances(flann::Index<flann::L2<float> > &index, flann::Matrix<float> &query);
+        int countFeatures(const FeatureMapT &features);
+        int countFeatures(const std::vector<pcl::PointCloud<ISMFeature>::Ptr> &features);
 
-        std::vector<int> findSimilarFeaturesFlann(flann::Index<flann::L2<float> > &index, flann::Matrix<float> &query);
+        // the distances to the neighbors of each query
+        std::vector<std::vector<float> > findNeighborsDistances(flann::Index<flann::L2<float> > &index,
+                                                                const flann::Matrix<float> &queries);
 
-        std::vector<int> findSimilarFeatures(pcl::KdTreeFLANN<ISMFeature> &kdtree, ISMFeature &feature);
+        // the neighbors of each query that are closer than the distance threshold
+        std::vector<std::vector<int> > findSimilarFeaturesFlann(flann::Index<flann::L2<float> > &index,
+                                                                const flann::Matrix<float> &queries);
 
         int m_k_search;
         float m_dist_thresh;
         float m_factor;
         bool m_iterative_ranking;
+        bool m_incremental_rescoring;
         float m_score_threshold;
         int m_num_kd_trees;
         bool m_flann_exact_match;
+        int m_flann_checks;
 
         std::string m_extractList;
 
@@ -120,43 +159,43 @@ namespace ism3d
             std::vector<float> class_distances(num_classes, 0);
             int k_search = 11;
 
-            // loop over all features extracted from the input model
-            for(int fe = 0; fe < features->size(); fe++)
-            {
-                // insert the query point
-                ISMFeature feature = features->at(fe);
-                flann::Matrix<float> query(new float[feature.descriptor.size()], 1, feature.descriptor.size());
-                for(int i = 0; i < feature.descriptor.size(); i++)
-                {
-                    query[0][i] = feature.descriptor.at(i);
-                }
+            if(features->empty())
+                return class_distances;
 
-                // prepare results
-                std::vector<std::vector<int> > indices;
-                std::vector<std::vector<float> > distances;
-                flann::SearchParams params = exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-                index.knnSearch(query, indices, distances, k_search, params);
+            // all features extracted from the input model are searched at once
+            const int dim = (int)features->at(0).descriptor.size();
+            std::vector<float> query_buffer(features->size() * dim);
+            for(int fe = 0; fe < (int)features->size(); fe++)
+            {
+                const std::vector<float> &descriptor = features->at(fe).descriptor;
+                std::copy(descriptor.begin(), descriptor.end(), query_buffer.begin() + (size_t)fe * dim);
+            }
+            flann::Matrix<float> queries(query_buffer.data(), features->size(), dim);
 
-                delete[] query.ptr();
+            // prepare results
+            std::vector<std::vector<int> > indices;
+            std::vector<std::vector<float> > distances;
+            flann::SearchParams params = exact_match ? flann::SearchParams(-1) : flann::SearchParams(m_flann_checks);
+            params.cores = getNumThreads();
+            index.knnSearch(queries, indices, distances, k_search, params);
 
+            for(int fe = 0; fe < (int)distances.size(); fe++)
+            {
                 // background distance
                 float dist_b = 0;
-                if(distances.size() > 0 && distances.at(0).size() > 1)
+                if(distances.at(fe).size() > 1)
                 {
-                    dist_b = distances.at(0).back(); // get last element
+                    dist_b = distances.at(fe).back(); // get last element
                 }
 
                 std::vector<unsigned> used_classes;
-                if(distances.size() > 0 && distances.at(0).size() > 0)
+                for(int i = 0; i + 1 < (int)distances[fe].size(); i++)
                 {
-                    for(int i = 0; i < distances[0].size()-1; i++)
+                    unsigned class_idx = class_look_up[indices[fe][i]];
+                    if(!Utils::containsValue(used_classes, class_idx))
                     {
-                        unsigned class_idx = class_look_up[indices[0][i]];
-                        if(!Utils::containsValue(used_classes, class_idx))
-                        {
-                            class_distances.at(class_idx) += distances[0][i] - dist_b;
-                            used_classes.push_back(class_idx);
-                        }
+                        class_distances.at(class_idx) += distances[fe][i] - dist_b;
+                        used_classes.push_back(class_idx);
                     }
                 }
             }
@@ -166,7 +205,37 @@ namespace ism3d
 
     private:
 
+        /**
+         * @brief The NeighborGraph struct
+         * The nearest neighbors of all features for incremental rescoring. The index is built on all rows of the
+         * block, rows that are removed in an iteration are removed from the index.
+         */
+        struct NeighborGraph
+        {
+            NeighborGraph() : k(0), num_rows(0) {}
+
+            int k;
+            int num_rows;                                   // number of rows the graph is up to date with
+            std::shared_ptr<RankingContext::IndexT> index;
+            std::vector<std::vector<int> > neighbors;       // block rows of the neighbors of each block row
+            std::vector<std::vector<float> > distances;
+            std::vector<char> active;                       // rows that were not removed
+            std::vector<int> positions;                     // position of each active row in allRows()
+        };
+
+        // brings the graph up to date with the rows of the context
+        void updateNeighborGraph(RankingContext &context, int k);
+
+        // searches the neighbors of the given rows in the index of the graph
+        void searchNeighborGraph(const FeatureBlock &block, const std::vector<int> &rows);
+
+        NeighborGraph m_graph;
+
         int m_numThreads;
+
+        std::string m_shared_dist_type;
+        KnnIndexParams m_shared_params;
+        std::shared_ptr<FlannHelper> m_shared_index;
     };
 }
 
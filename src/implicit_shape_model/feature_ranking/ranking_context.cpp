@@ -0,0 +1,208 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "ranking_context.h"
+#include "../utils/distance.h"
+#include "../utils/flann_helper.h"
+
+#include <algorithm>
+
+namespace ism3d
+{
+RankingContext::RankingContext(FeatureBlock::ConstPtr block, const std::vector<std::vector<int> > &rows, int num_kd_trees)
+    : m_block(block), m_num_kd_trees(num_kd_trees)
+{
+    setRows(rows);
+}
+
+int RankingContext::numFeatures() const
+{
+    int num = 0;
+    for(const std::vector<int> &class_rows : m_rows)
+        num += (int)class_rows.size();
+    return num;
+}
+
+void RankingContext::setRows(const std::vector<std::vector<int> > &rows)
+{
+    bool changed = rows.size() != m_rows.size();
+    m_class_views.resize(rows.size());
+    m_other_views.resize(rows.size());
+    for(int c = 0; c < (int)rows.size(); c++)
+    {
+        if(c < (int)m_rows.size() && m_rows[c] == rows[c])
+            continue;
+
+        m_class_views[c] = View();
+        changed = true;
+    }
+
+    if(changed)
+    {
+        m_all_view = View();
+        for(View &view : m_other_views)
+            view = View();
+    }
+
+    m_rows = rows;
+    m_offsets.assign(m_rows.size(), 0);
+    for(int c = 1; c < (int)m_rows.size(); c++)
+        m_offsets[c] = m_offsets[c - 1] + (int)m_rows[c - 1].size();
+}
+
+const std::vector<int> &RankingContext::allRows()
+{
+    return allView().rows;
+}
+
+const std::vector<int> &RankingContext::otherRows(int class_index)
+{
+    return otherView(class_index).rows;
+}
+
+const flann::Matrix<float> &RankingContext::classDescriptors(int class_index)
+{
+    return getDescriptors(classView(class_index));
+}
+
+const flann::Matrix<float> &RankingContext::allDescriptors()
+{
+    return getDescriptors(allView());
+}
+
+const flann::Matrix<float> &RankingContext::otherDescriptors(int class_index)
+{
+    return getDescriptors(otherView(class_index));
+}
+
+RankingContext::IndexT &RankingContext::classIndex(int class_index)
+{
+    return getIndex(classView(class_index));
+}
+
+RankingContext::IndexT &RankingContext::allIndex()
+{
+    return getIndex(allView());
+}
+
+RankingContext::IndexT &RankingContext::otherIndex(int class_index)
+{
+    return getIndex(otherView(class_index));
+}
+
+RankingContext::View &RankingContext::classView(int class_index)
+{
+    View &view = m_class_views[class_index];
+    if(!view.valid)
+    {
+        view.rows = m_rows[class_index];
+        view.valid = true;
+    }
+    return view;
+}
+
+RankingContext::View &RankingContext::allView()
+{
+    if(!m_all_view.valid)
+    {
+        m_all_view.rows.reserve(numFeatures());
+        for(const std::vector<int> &class_rows : m_rows)
+            m_all_view.rows.insert(m_all_view.rows.end(), class_rows.begin(), class_rows.end());
+        m_all_view.valid = true;
+    }
+    return m_all_view;
+}
+
+RankingContext::View &RankingContext::otherView(int class_index)
+{
+    View &view = m_other_views[class_index];
+    if(!view.valid)
+    {
+        view.rows.reserve(numFeatures() - m_rows[class_index].size());
+        for(int c = 0; c < (int)m_rows.size(); c++)
+        {
+            if(c != class_index)
+                view.rows.insert(view.rows.end(), m_rows[c].begin(), m_rows[c].end());
+        }
+        view.valid = true;
+    }
+    return view;
+}
+
+const flann::Matrix<float> &RankingContext::getDescriptors(View &view) const
+{
+    if(view.has_descriptors)
+        return view.descriptors;
+
+    const std::vector<int> &rows = view.rows;
+    const int dim = m_block->dim();
+    bool consecutive = true;
+    for(int i = 1; i < (int)rows.size() && consecutive; i++)
+        consecutive = rows[i] == rows[0] + i;
+
+    if(!rows.empty() && consecutive)
+    {
+        view.descriptors = flann::Matrix<float>(const_cast<float*>(m_block->descriptor(rows[0])), rows.size(), dim);
+    }
+    else
+    {
+        view.buffer.resize(rows.size() * dim);
+        for(int i = 0; i < (int)rows.size(); i++)
+            std::copy(m_block->descriptor(rows[i]), m_block->descriptor(rows[i]) + dim, view.buffer.begin() + (size_t)i * dim);
+        view.descriptors = flann::Matrix<float>(view.buffer.data(), rows.size(), dim);
+    }
+    view.has_descriptors = true;
+    return view.descriptors;
+}
+
+void RankingContext::setSharedIndexParams(const std::string &dist_type, const KnnIndexParams &params)
+{
+    m_shared_dist_type = dist_type;
+    m_shared_params = params;
+}
+
+bool RankingContext::coversBlock(const View &view) const
+{
+    if((int)view.rows.size() != m_block->size())
+        return false;
+    for(int i = 0; i < (int)view.rows.size(); i++)
+    {
+        if(view.rows[i] != i)
+            return false;
+    }
+    return true;
+}
+
+RankingContext::IndexT &RankingContext::getIndex(View &view) const
+{
+    if(!view.index && &view == &m_all_view && m_shared_dist_type == DistanceEuclidean::getTypeStatic() &&
+            m_shared_params.type == "KDTree" && coversBlock(view))
+    {
+        // the helper keeps the block alive and owns the kd-trees, the view refers to its flann index
+        std::shared_ptr<FlannHelper> helper = std::make_shared<FlannHelper>(m_block);
+        helper->buildIndex(m_shared_dist_type, m_shared_params);
+        typedef flann::L2<float> DistanceT;
+        std::shared_ptr<FlannKdTreeIndex<DistanceT> > index =
+                std::dynamic_pointer_cast<FlannKdTreeIndex<DistanceT> >(helper->getIndex<DistanceT>());
+        if(index)
+        {
+            view.index = std::shared_ptr<IndexT>(index, &index->getFlannIndex());
+            m_shared_index = helper;
+        }
+    }
+
+    if(!view.index)
+    {
+        view.index = std::make_shared<IndexT>(getDescriptors(view), flann::KDTreeIndexParams(m_num_kd_trees));
+        view.index->buildIndex();
+    }
+    return *view.index;
+}
+}
@@ -0,0 +1,150 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_RANKING_CONTEXT_H
+#define ISM3D_RANKING_CONTEXT_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <flann/flann.hpp>
+
+#include "../utils/feature_block.h"
+#include "../utils/knn_index.h"
+
+namespace ism3d
+{
+    class FlannHelper;
+
+    /**
+     * @brief The RankingContext class
+     * The features seen by a ranking. The descriptors of all training features are stored once in a shared feature
+     * block, ordered by class, model and feature. A ranking refers to features only by their rows in the block, the
+     * class ids of the block hold the class index of each row. The context builds the views of a class, of all
+     * classes and of all other classes, their descriptor matrices and their flann indices on first use and keeps
+     * them until the rows change, so that they are shared by all steps of a ranking. If the rows are replaced in an
+     * iteration, the views of classes whose rows did not change are kept.
+     * If index sharing is enabled, the index on all features is built as a flann helper directly on the block as
+     * long as the view covers every row of the block, so that it can be handed on as codeword index after training.
+     */
+    class RankingContext
+    {
+    public:
+        typedef flann::Index<flann::L2<float> > IndexT;
+
+        /**
+         * @brief Create a context.
+         * @param block the descriptors of all features
+         * @param rows the rows of each class index in ascending order
+         * @param num_kd_trees the number of kd trees of the flann indices
+         */
+        RankingContext(FeatureBlock::ConstPtr block, const std::vector<std::vector<int> > &rows, int num_kd_trees);
+
+        const FeatureBlock &block() const
+        {
+            return *m_block;
+        }
+
+        int numClasses() const
+        {
+            return (int)m_rows.size();
+        }
+
+        int numFeatures() const;
+
+        // the rows of the given class index
+        const std::vector<int> &rows(int class_index) const
+        {
+            return m_rows[class_index];
+        }
+
+        const std::vector<std::vector<int> > &classRows() const
+        {
+            return m_rows;
+        }
+
+        /**
+         * @brief Replace the rows of each class, e.g. after an iteration removed features.
+         * @param rows the new rows of each class index in ascending order
+         */
+        void setRows(const std::vector<std::vector<int> > &rows);
+
+        // the rows of all classes in class order
+        const std::vector<int> &allRows();
+
+        // the position of the first row of the given class index in allRows()
+        int classOffset(int class_index) const
+        {
+            return m_offsets[class_index];
+        }
+
+        // the rows of all classes except the given class index in class order
+        const std::vector<int> &otherRows(int class_index);
+
+        // the descriptors of the rows as matrices with one descriptor per row, consecutive rows are not copied
+        const flann::Matrix<float> &classDescriptors(int class_index);
+        const flann::Matrix<float> &allDescriptors();
+        const flann::Matrix<float> &otherDescriptors(int class_index);
+
+        // the flann indices on the descriptors, the result indices are positions in the rows of the view
+        IndexT &classIndex(int class_index);
+        IndexT &allIndex();
+        IndexT &otherIndex(int class_index);
+
+        /**
+         * @brief Build the index on all features as a shareable flann helper, see getSharedIndex().
+         * @param dist_type the distance type of the shared index, only the euclidean distance can be shared
+         * @param params the backend parameters of the shared index, only kd-trees can be shared
+         */
+        void setSharedIndexParams(const std::string &dist_type, const KnnIndexParams &params);
+
+        // the shared index on all rows of the block in block order, empty if it was not built
+        std::shared_ptr<FlannHelper> getSharedIndex() const
+        {
+            return m_shared_index;
+        }
+
+    private:
+        struct View
+        {
+            View() : valid(false), has_descriptors(false) {}
+
+            bool valid;
+            bool has_descriptors;
+            std::vector<int> rows;
+            std::vector<float> buffer;
+            flann::Matrix<float> descriptors;
+            std::shared_ptr<IndexT> index;
+        };
+
+        View &classView(int class_index);
+        View &allView();
+        View &otherView(int class_index);
+
+        const flann::Matrix<float> &getDescriptors(View &view) const;
+        IndexT &getIndex(View &view) const;
+        bool coversBlock(const View &view) const;
+
+        FeatureBlock::ConstPtr m_block;
+        std::vector<std::vector<int> > m_rows;
+        std::vector<int> m_offsets;
+        int m_num_kd_trees;
+
+        std::string m_shared_dist_type;
+        KnnIndexParams m_shared_params;
+        mutable std::shared_ptr<FlannHelper> m_shared_index;
+
+        std::vector<View> m_class_views;
+        std::vector<View> m_other_views;
+        View m_all_view;
+    };
+}
+
+#endif // ISM3D_RANKING_CONTEXT_H
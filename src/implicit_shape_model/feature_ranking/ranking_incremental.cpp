@@ -20,70 +20,45 @@ RankingIncremental::~RankingIncremental()
 {
 }
 
-std::map<unsigned, std::vector<float> > RankingIncremental::iComputeScores(
-        const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features)
+std::map<unsigned, std::vector<float> > RankingIncremental::iComputeScores(RankingContext &context)
 {
     std::map<unsigned, std::vector<float> > temp_scores;
-    std::map<unsigned, int> class_index_offsets;
-
-    pcl::PointCloud<ISMFeature>::Ptr all_features = createCloudWithClassIds(features, false);
 
     LOG_INFO("starting incremental ranking");
-    // determine class index offsets
-    class_index_offsets.insert({0,0});
-    for(int i = 0; i < features.size(); i++)
+    for(int i = 0; i < context.numClasses(); i++)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
-        int cur_offset = class_index_offsets.at(i);
-        // set offset for next class
-        if(i != features.size() - 1)
-            class_index_offsets.insert({i+1, cur_offset+current_class_features->size()});
         // init activated count
-        temp_scores.insert({i, std::vector<float>(current_class_features->size(), 0)});
+        temp_scores.insert({i, std::vector<float>(context.rows(i).size(), 0)});
     }
 
-    // create flann index
-    flann::Matrix<float> dataset = createFlannDataset(all_features);
-    flann::Index<flann::L2<float> > index(dataset, flann::KDTreeIndexParams(m_num_kd_trees));
-    index.buildIndex();
+    // the flann index on all features is built once by the context, or the neighbors are kept between iterations
+    const FeatureBlock &block = context.block();
+    const std::vector<int> &all_rows = context.allRows();
 
-    // find activated features
-    for(int i = 0; i < features.size(); i++)
+    // find activated features, all features of a class are searched at once
+    for(int i = 0; i < context.numClasses(); i++)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
-
-        for(ISMFeature query_feature : current_class_features->points)
-        {
-            // insert the query point
-            flann::Matrix<float> query(new float[query_feature.descriptor.size()], 1, query_feature.descriptor.size());
-            for(int j = 0; j < query_feature.descriptor.size(); j++)
-            {
-                query[0][j] = query_feature.descriptor.at(j);
-            }
+        const std::vector<int> &class_rows = context.rows(i);
+        if(class_rows.empty())
+            continue;
 
-            // prepare results
-            std::vector<std::vector<int> > indices;
-            std::vector<std::vector<float> > distances;
-            flann::SearchParams params = m_flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-            index.knnSearch(query, indices, distances, m_k_search + 1, params);
+        // prepare results
+        std::vector<std::vector<int> > indices;
+        std::vector<std::vector<float> > distances;
+        findNeighborsOfClass(context, i, m_k_search + 1, indices, distances);
 
-            if(distances.size() > 0 && distances.at(0).size() > 0)
+        for(int q = 0; q < (int)class_rows.size(); q++)
+        {
+            for(int dist_idx = 0; dist_idx + 1 < (int)distances[q].size(); dist_idx++)
             {
-                for(int dist_idx = 0; dist_idx < distances[0].size()-1; dist_idx++)
-                {
-                    int feat_idx = indices[0][dist_idx];
-                    unsigned class_id = all_features->at(feat_idx).classId;
-                    int offset = class_index_offsets.at(class_id);
-                    float dist_b = distances[0][dist_idx+1];
-                    temp_scores.at(class_id).at(feat_idx - offset) += distances[0][dist_idx] - dist_b;
-                }
+                int feat_idx = indices[q][dist_idx];
+                unsigned class_id = block.classIds[all_rows[feat_idx]];
+                int offset = context.classOffset(class_id);
+                float dist_b = distances[q][dist_idx+1];
+                temp_scores.at(class_id).at(feat_idx - offset) += distances[q][dist_idx] - dist_b;
             }
-            // delete flann pointer
-            delete[] query.ptr();
         }
     }
-    // delete flann pointers
-    delete[] dataset.ptr();
 
     return temp_scores;
 }
@@ -22,77 +22,60 @@ RankingKnnActivation::~RankingKnnActivation()
 {
 }
 
-std::map<unsigned, std::vector<float> > RankingKnnActivation::iComputeScores(
-        const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr>> &features)
+std::map<unsigned, std::vector<float> > RankingKnnActivation::iComputeScores(RankingContext &context)
 {
     std::map<unsigned, std::vector<float>> temp_scores;
-    std::map<unsigned, int> class_index_offsets;
-
-    pcl::PointCloud<ISMFeature>::Ptr all_features = createCloudWithClassIds(features, false);
 
     LOG_INFO("starting knn activation ranking");
-    // determine class index offsets
-    class_index_offsets.insert({0,0});
-    for(int i = 0; i < features.size(); i++)
+    for(int i = 0; i < context.numClasses(); i++)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
-        int cur_offset = class_index_offsets.at(i);
-        // set offset for next class
-        if(i != features.size() - 1)
-            class_index_offsets.insert({i+1, cur_offset+current_class_features->size()});
         // init activated count
-        temp_scores.insert({i, std::vector<float>(current_class_features->size(), 0)});
+        temp_scores.insert({i, std::vector<float>(context.rows(i).size(), 0)});
     }
 
-    // create flann index
-    flann::Matrix<float> dataset = createFlannDataset(all_features);
-    flann::Index<flann::L2<float> > index(dataset, flann::KDTreeIndexParams(m_num_kd_trees));
-    index.buildIndex();
+    // the flann index on all features is built once by the context, or the neighbors are kept between iterations
+    const FeatureBlock &block = context.block();
+    const std::vector<int> &all_rows = context.allRows();
+
+    // NOTE: this is for backward compatibility: overwrite type 0 by 1
+    m_score_increment_type = m_score_increment_type == 0 ? 1 : m_score_increment_type;
 
-    // find activated features
-    for(int i = 0; i < features.size(); i++)
+    // validate increment type
+    if(m_score_increment_type > 3 || m_score_increment_type < 1)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
+        LOG_WARN("Invalid score increment type: " << m_score_increment_type << "! Using type 1 instead.");
+        m_score_increment_type = 1;
+    }
 
-        for(ISMFeature query_feature : current_class_features->points)
-        {
-            // insert the query point
-            flann::Matrix<float> query(new float[query_feature.descriptor.size()], 1, query_feature.descriptor.size());
-            for(int j = 0; j < query_feature.descriptor.size(); j++)
-            {
-                query[0][j] = query_feature.descriptor.at(j);
-            }
+    // find activated features, all features of a class are searched at once
+    for(int i = 0; i < context.numClasses(); i++)
+    {
+        const std::vector<int> &class_rows = context.rows(i);
+        if(class_rows.empty())
+            continue;
 
-            std::vector<std::vector<int> > indices;
-            std::vector<std::vector<float> > distances;
-            flann::SearchParams params = m_flann_exact_match ? flann::SearchParams(-1) : flann::SearchParams(128);
-            index.knnSearch(query, indices, distances, m_k_search+1, params);
-            std::vector<int> similar_features = indices.at(0);
+        std::vector<std::vector<int> > indices;
+        std::vector<std::vector<float> > distances;
+        findNeighborsOfClass(context, i, m_k_search + 1, indices, distances);
 
-            float query_center_dist = query_feature.centerDist;
+        for(int q = 0; q < (int)class_rows.size(); q++)
+        {
+            const std::vector<int> &similar_features = indices.at(q);
+            float query_center_dist = block.centerDists[class_rows[q]];
 
-            for(int idx = 0; idx < similar_features.size()-1; idx++)
+            for(int idx = 0; idx + 1 < (int)similar_features.size(); idx++)
             {
                 int feat_idx = similar_features.at(idx);
-                unsigned class_id = all_features->at(feat_idx).classId;
-                int offset = class_index_offsets.at(class_id);
+                int feat_row = all_rows[feat_idx];
+                unsigned class_id = block.classIds[feat_row];
+                int offset = context.classOffset(class_id);
 
                 // compute distance-dependent score
-                float feat_center_dist = all_features->at(feat_idx).centerDist;
+                float feat_center_dist = block.centerDists[feat_row];
                 float score_dist_rate = exp(std::fabs(feat_center_dist - query_center_dist));
                 score_dist_rate = m_use_feature_position ? score_dist_rate : 1; // if position is not used, set score to 1
 
-                float current_dist = distances.at(0).at(idx);
-
-                // NOTE: this is for backward compatibility: overwrite type 0 by 1
-                m_score_increment_type = m_score_increment_type == 0 ? 1 : m_score_increment_type;
-
-                // validate increment type
-                if(m_score_increment_type > 3 || m_score_increment_type < 1)
-                {
-                    LOG_WARN("Invalid score increment type: " << m_score_increment_type << "! Using type 1 instead.");
-                    m_score_increment_type = 1;
-                }
+                float current_dist = distances.at(q).at(idx);
 
                 // update depending on increment type
                 if(m_score_increment_type == 1)
@@ -102,13 +85,8 @@ std::map<unsigned, std::vector<float> > RankingKnnActivation::iComputeScores(
                 else if(m_score_increment_type == 3)
                     temp_scores.at(class_id).at(feat_idx - offset) += score_dist_rate * exp(current_dist);
             }
-
-            // delete flann pointer
-            delete[] query.ptr();
         }
     }
-    // delete flann pointers
-    delete[] dataset.ptr();
 
     return temp_scores;
 }
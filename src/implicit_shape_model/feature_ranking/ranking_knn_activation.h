@@ -30,7 +30,7 @@ namespace ism3d
         std::string getType() const;
 
     protected:
-        std::map<unsigned, std::vector<float> > iComputeScores(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features);
+        std::map<unsigned, std::vector<float> > iComputeScores(RankingContext &context);
 
     private:
 
@@ -12,7 +12,6 @@
 #define ISM3D_RANKINGNAIVEBAYES_H
 
 #include "feature_ranking.h"
-#include <pcl/kdtree/kdtree_flann.h>
 
 namespace ism3d
 {
@@ -31,7 +30,7 @@ namespace ism3d
         std::string getType() const;
 
     protected:
-        std::map<unsigned, std::vector<float> > iComputeScores(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features);
+        std::map<unsigned, std::vector<float> > iComputeScores(RankingContext &context);
 
     private:
 
@@ -10,6 +10,8 @@
 
 #include "ranking_strangeness.h"
 
+#include <algorithm>
+
 namespace ism3d
 {
 RankingStrangeness::RankingStrangeness()
@@ -20,61 +22,48 @@ RankingStrangeness::~RankingStrangeness()
 {
 }
 
-std::map<unsigned, std::vector<float> > RankingStrangeness::iComputeScores(
-        const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features)
+std::map<unsigned, std::vector<float> > RankingStrangeness::iComputeScores(RankingContext &context)
 {
     std::map<unsigned, std::vector<float> > temp_scores;
-    std::map<unsigned, int> class_index_offsets;
 
     LOG_INFO("starting strangeness ranking");
-    // determine class index offsets
-    class_index_offsets.insert({0,0});
-    for(int i = 0; i < features.size(); i++)
+    for(int i = 0; i < context.numClasses(); i++)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
-        int cur_offset = class_index_offsets.at(i);
-        // set offset for next class
-        if(i != features.size() - 1)
-            class_index_offsets.insert({i+1, cur_offset+current_class_features->size()});
         // init activated count
-        temp_scores.insert({i, std::vector<float>(current_class_features->size(), 0)});
+        temp_scores.insert({i, std::vector<float>(context.rows(i).size(), 0)});
     }
 
-    // create a separate flann index for each class
-    std::vector<flann::Matrix<float>> datasets;
-    std::vector<flann::Index<flann::L2<float>>> flann_indices;
-    for(int i = 0; i < features.size(); i++)
+    // a separate flann index for each class, built once by the context
+    std::vector<RankingContext::IndexT*> flann_indices;
+    for(int i = 0; i < context.numClasses(); i++)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
-
-        flann::Matrix<float> dataset_current = createFlannDataset(current_class_features);
-        datasets.push_back(dataset_current);
-        flann::Index<flann::L2<float> > index_current(dataset_current, flann::KDTreeIndexParams(m_num_kd_trees));
-        index_current.buildIndex();
-        flann_indices.push_back(index_current);
+        flann_indices.push_back(&context.classIndex(i));
     }
 
-    // loop over features
-    for(int i = 0; i < features.size(); i++)
+    // loop over features, all features of a class are searched at once in each index
+    for(int i = 0; i < context.numClasses(); i++)
     {
-        pcl::PointCloud<ISMFeature>::Ptr current_class_features = createCloudWithClassIds(features, true, i, false);
+        const std::vector<int> &class_rows = context.rows(i);
+        if(class_rows.empty())
+            continue;
 
-        for(int feat_idx = 0; feat_idx < current_class_features->size(); feat_idx++)
-        {
-            ISMFeature query_feature = current_class_features->at(feat_idx);
-            // insert the query point
-            flann::Matrix<float> query(new float[query_feature.descriptor.size()], 1, query_feature.descriptor.size());
-            for(int j = 0; j < query_feature.descriptor.size(); j++)
-            {
-                query[0][j] = query_feature.descriptor.at(j);
-            }
+        const flann::Matrix<float> &queries = context.classDescriptors(i);
+
+        // each search is distributed over the threads by flann
+        std::vector<std::vector<std::vector<float> > > dist_lists;
+        for(int j = 0; j < (int)flann_indices.size(); j++)
+            dist_lists.push_back(findNeighborsDistances(*flann_indices.at(j), queries));
 
+        std::vector<float> &class_scores = temp_scores.at(i);
+        #pragma omp parallel for num_threads(getNumThreads())
+        for(int feat_idx = 0; feat_idx < (int)class_rows.size(); feat_idx++)
+        {
             std::vector<float> all_dist_sums;
-            for(int j = 0; j < flann_indices.size(); j++)
+            for(int j = 0; j < (int)flann_indices.size(); j++)
             {
-                std::vector<float> dist_list = findNeighborsDistances(flann_indices.at(j), query);
+                const std::vector<float> &dist_list = dist_lists.at(j).at(feat_idx);
                 float sum = 0;
-                for(int k = 0; k < dist_list.size(); k++)
+                for(int k = 0; k < (int)dist_list.size(); k++)
                 {
                     sum += dist_list.at(k);
                 }
@@ -85,19 +74,10 @@ std::map<unsigned, std::vector<float> > RankingStrangeness::iComputeScores(
             all_dist_sums.at(i) = -1; //replace by smallest dummy
             std::sort(all_dist_sums.begin(), all_dist_sums.end());
             score /= all_dist_sums.at(1); // take second value, since the first value is dummy
-            temp_scores.at(i).at(feat_idx) = score;
-
-            // delete flann pointer
-            delete[] query.ptr();
+            class_scores[feat_idx] = score;
         }
     }
 
-    // delete flann pointers
-    for(int i = 0; i < datasets.size(); i++)
-    {
-        delete[] datasets.at(i).ptr();
-    }
-
     return temp_scores;
 }
 
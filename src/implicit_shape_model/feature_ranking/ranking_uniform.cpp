@@ -20,21 +20,14 @@ namespace ism3d
     {
     }
 
-    std::map<unsigned, std::vector<float> > RankingUniform::iComputeScores(
-            const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features)
+    std::map<unsigned, std::vector<float> > RankingUniform::iComputeScores(RankingContext &context)
     {
         LOG_INFO("starting uniform ranking");
         std::map<unsigned, std::vector<float> > scores;
 
-        for(auto it : features)
+        for(int class_index = 0; class_index < context.numClasses(); class_index++)
         {
-            unsigned class_id = it.first;
-            int num_features = 0;
-            for(auto it2 : it.second)
-            {
-                num_features += it2->size();
-            }
-            scores.insert({class_id, std::vector<float>(num_features, 1.0f)});
+            scores.insert({class_index, std::vector<float>(context.rows(class_index).size(), 1.0f)});
         }
 
         return scores;
@@ -12,8 +12,14 @@
 #include "features_factory.h"
 #include "../utils/utils.h"
 #include "../utils/distance.h"
+#include "../utils/neighborhood_cache.h"
+#include "../utils/exception.h"
+#ifdef USE_CUDA
+#include "../utils/cuda_shot.h"
+#endif
 
 #define PCL_NO_PRECOMPILE
+#include <pcl/common/io.h>
 #include <pcl/features/board.h>
 
 #ifdef WITH_PCL_GREATER_1_8
@@ -31,6 +37,7 @@ Features::Features()
 {
     addParameter(m_referenceFrameRadius, "ReferenceFrameRadius", 0.2f);
     addParameter(m_referenceFrameType, "ReferenceFrameType", std::string("SHOT"));
+    addParameter(m_use_neighborhood_cache, "UseNeighborhoodCache", false);
 }
 
 Features::~Features()
@@ -50,6 +57,14 @@ pcl::PointCloud<ISMFeature>::ConstPtr Features::operator()(pcl::PointCloud<Point
     pcl::PointCloud<pcl::ReferenceFrame>::Ptr cleanReferenceFrames(new pcl::PointCloud<pcl::ReferenceFrame>());
     pcl::PointCloud<PointT>::Ptr cleanKeypoints(new pcl::PointCloud<PointT>());
 
+    // reference frames and descriptors search around the same keypoints, their neighborhoods are computed once
+    NeighborhoodCache::Ptr neighborhoodCache;
+    if(m_use_neighborhood_cache && keypoints->size() != 0)
+    {
+        neighborhoodCache.reset(new NeighborhoodCache(search, keypoints, getSupportRadius(), m_numThreads));
+        search = neighborhoodCache;
+    }
+
     // this means we are computing a LOCAL feature, so we need reference frames and clean keypoints
     if(keypoints->size() != 0)
     {
@@ -63,6 +78,7 @@ pcl::PointCloud<ISMFeature>::ConstPtr Features::operator()(pcl::PointCloud<Point
 
         // sort out invalid reference frames and associated keypoints
         unsigned missedFrames = 0;
+        std::vector<int> cleanKeypointIndices;
         for (int i = 0; i < (int)referenceFrames->size(); i++) {
             const pcl::ReferenceFrame& frame = referenceFrames->at(i);
             if (pcl_isfinite (frame.x_axis[0]) &&
@@ -70,12 +86,16 @@ pcl::PointCloud<ISMFeature>::ConstPtr Features::operator()(pcl::PointCloud<Point
                     pcl_isfinite (frame.z_axis[0])) {
                 cleanReferenceFrames->push_back(frame);
                 cleanKeypoints->push_back(keypoints->at(i));
+                cleanKeypointIndices.push_back(i);
             }
             else
                 missedFrames++;
         }
         LOG_ASSERT(cleanReferenceFrames->size() == cleanKeypoints->size());
 
+        if(neighborhoodCache)
+            neighborhoodCache->setQueryCloud(cleanKeypoints, cleanKeypointIndices);
+
         if(missedFrames > 0)
             LOG_WARN("found " << missedFrames << " invalid reference frame(s), discarding associated keypoint(s)");
     }
@@ -93,11 +113,20 @@ pcl::PointCloud<ISMFeature>::ConstPtr Features::operator()(pcl::PointCloud<Point
         LOG_ASSERT(features->size() == cleanKeypoints->size() || features->size() == 1);
 
     LOG_INFO("obtained " << features->size() << " " << getType() << " descriptors");
+    if(neighborhoodCache)
+        LOG_INFO("neighborhood cache answered " << neighborhoodCache->getNumCachedSearches() << " searches, " <<
+                 neighborhoodCache->getNumForwardedSearches() << " searches were forwarded");
 
+    // features with NaN descriptors are dropped in the same pass, the remaining features are moved to the front
+    int numValid = 0;
     for (int i = 0; i < (int)features->size(); i++)
     {
         ISMFeature& feature = features->at(i);
 
+        const std::vector<float> &descriptor = feature.descriptor;
+        if (std::any_of(descriptor.begin(), descriptor.end(), [](float value) { return std::isnan(value); }))
+            continue;
+
         // skip if computing global featues that do not return their reference frame and keypoint
         if(cleanReferenceFrames->size() != 0)
         {
@@ -110,19 +139,95 @@ pcl::PointCloud<ISMFeature>::ConstPtr Features::operator()(pcl::PointCloud<Point
             // store reference frame
             feature.referenceFrame = cleanReferenceFrames->at(i);
         }
+
+        if (numValid != i)
+            std::swap(features->points[numValid], feature);
+        numValid++;
     }
 
+    if (numValid < (int)features->size())
+        LOG_WARN("Found " << (int)features->size() - numValid << " NaN features!");
+
+    features->points.resize(numValid);
+    features->width = numValid;
+    features->height = 1;
+    features->is_dense = true; // marks the features as free of NaN values
+
     return features;
 }
 
+std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> Features::computeGlobalFeatures(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                                   pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                                   const std::vector<std::vector<int> > &regions,
+                                                                                   pcl::search::Search<PointT>::Ptr search)
+{
+    LOG_ASSERT(points->size() == normals->size());
+
+    std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> regionFeatures(regions.size());
+    const int numRegions = (int)regions.size();
+    const int numThreads = std::max(std::min(getNumThreadsToUse(), numRegions), 1);
+
+    #pragma omp parallel num_threads(numThreads)
+    {
+        // state of the thread, reused for all of its regions
+        pcl::PointCloud<PointT>::Ptr regionPoints(new pcl::PointCloud<PointT>());
+        pcl::PointCloud<pcl::Normal>::Ptr regionNormals(new pcl::PointCloud<pcl::Normal>());
+        pcl::search::Search<PointT>::Ptr regionSearch = EstimatorCache::acquire<pcl::search::KdTree<PointT> >(m_estimators);
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int r = 0; r < numRegions; r++)
+        {
+            pcl::PointCloud<ISMFeature>::Ptr features = iComputeRegionDescriptors(points, normals, regions[r], search,
+                                                                                  regionPoints, regionNormals, regionSearch);
+
+            // drop features with NaN descriptors
+            features->points.erase(std::remove_if(features->points.begin(), features->points.end(), [](const ISMFeature &feature)
+            {
+                return std::any_of(feature.descriptor.begin(), feature.descriptor.end(), [](float value) { return std::isnan(value); });
+            }), features->points.end());
+            features->width = (uint32_t)features->points.size();
+            features->height = 1;
+            features->is_dense = true;
+
+            regionFeatures[r] = features;
+        }
+    }
+
+    return regionFeatures;
+}
+
+pcl::PointCloud<ISMFeature>::Ptr Features::iComputeRegionDescriptors(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                     pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                     const std::vector<int> &region,
+                                                                     pcl::search::Search<PointT>::Ptr search,
+                                                                     pcl::PointCloud<PointT>::Ptr regionPoints,
+                                                                     pcl::PointCloud<pcl::Normal>::Ptr regionNormals,
+                                                                     pcl::search::Search<PointT>::Ptr regionSearch)
+{
+    pcl::copyPointCloud(*points, region, *regionPoints);
+    pcl::copyPointCloud(*normals, region, *regionNormals);
+
+    // global descriptors are computed on the whole region, without keypoints and reference frames
+    pcl::PointCloud<pcl::ReferenceFrame>::Ptr noReferenceFrames(new pcl::PointCloud<pcl::ReferenceFrame>());
+    pcl::PointCloud<PointT>::Ptr noKeypoints(new pcl::PointCloud<PointT>());
+    return iComputeDescriptors(regionPoints, regionNormals, regionPoints, regionNormals, noReferenceFrames, noKeypoints, regionSearch);
+}
+
 void Features::setNumThreads(int numThreads)
 {
     m_numThreads = numThreads;
 }
 
+void Features::setEstimatorCache(const EstimatorCache::Ptr &estimators)
+{
+    m_estimators = estimators;
+}
+
 int Features::getNumThreads() const
 {
-    return m_numThreads;
+    // the PCL estimators called inside of a parallel region, e.g. for the regions of the global features, run
+    // with a single thread instead of opening nested teams
+    return omp_in_parallel() ? 1 : m_numThreads;
 }
 
 float Features::getCloudRadius(pcl::PointCloud<PointT>::ConstPtr &cloud) const
@@ -183,7 +288,9 @@ pcl::PointCloud<pcl::ReferenceFrame>::ConstPtr Features::computeBOARDReferenceFr
                                                                                      pcl::search::Search<PointT>::Ptr search) const
 {
     pcl::PointCloud<pcl::ReferenceFrame>::Ptr referenceFrames(new pcl::PointCloud<pcl::ReferenceFrame>());
-    pcl::BOARDLocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> refEst;
+    boost::shared_ptr<pcl::BOARDLocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> > refEstPtr =
+            EstimatorCache::acquire<pcl::BOARDLocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> >(m_estimators);
+    pcl::BOARDLocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> &refEst = *refEstPtr;
 
     if (points->isOrganized()) {
         refEst.setSearchSurface(points);
@@ -211,7 +318,9 @@ pcl::PointCloud<pcl::ReferenceFrame>::ConstPtr Features::computeFLAREReferenceFr
                                                                                      pcl::search::Search<PointT>::Ptr search) const
 {
     pcl::PointCloud<pcl::ReferenceFrame>::Ptr referenceFrames(new pcl::PointCloud<pcl::ReferenceFrame>());
-    pcl::FLARELocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> refEst;
+    boost::shared_ptr<pcl::FLARELocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> > refEstPtr =
+            EstimatorCache::acquire<pcl::FLARELocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> >(m_estimators);
+    pcl::FLARELocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> &refEst = *refEstPtr;
 
     if (points->isOrganized()) {
         refEst.setSearchSurface(points);
@@ -237,9 +346,12 @@ pcl::PointCloud<pcl::ReferenceFrame>::ConstPtr Features::computeSHOTReferenceFra
                                                                                     pcl::search::Search<PointT>::Ptr search) const
 {
     pcl::PointCloud<pcl::ReferenceFrame>::Ptr referenceFrames(new pcl::PointCloud<pcl::ReferenceFrame>());
-    pcl::SHOTLocalReferenceFrameEstimationOMP<PointT, pcl::ReferenceFrame> refEst;
+    boost::shared_ptr<pcl::SHOTLocalReferenceFrameEstimationOMP<PointT, pcl::ReferenceFrame> > refEstPtr =
+            EstimatorCache::acquire<pcl::SHOTLocalReferenceFrameEstimationOMP<PointT, pcl::ReferenceFrame> >(m_estimators);
+    pcl::SHOTLocalReferenceFrameEstimationOMP<PointT, pcl::ReferenceFrame> &refEst = *refEstPtr;
 
     refEst.setRadiusSearch(m_referenceFrameRadius);
+    refEst.setNumberOfThreads(getNumThreads());
     refEst.setInputCloud(keypoints);
     refEst.setSearchSurface(points);
     refEst.setSearchMethod(search);
@@ -256,7 +368,9 @@ pcl::PointCloud<pcl::ReferenceFrame>::ConstPtr Features::computeSHOTNAReferenceF
                                                                                       pcl::search::Search<PointT>::Ptr search) const
 {
     pcl::PointCloud<pcl::ReferenceFrame>::Ptr referenceFrames(new pcl::PointCloud<pcl::ReferenceFrame>());
-    pcl::SHOTNALocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> refEst;
+    boost::shared_ptr<pcl::SHOTNALocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> > refEstPtr =
+            EstimatorCache::acquire<pcl::SHOTNALocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> >(m_estimators);
+    pcl::SHOTNALocalReferenceFrameEstimation<PointT, pcl::Normal, pcl::ReferenceFrame> &refEst = *refEstPtr;
 
     if (points->isOrganized()) {
         refEst.setSearchSurface(points);
@@ -280,16 +394,135 @@ void Features::normalizeDescriptors(pcl::PointCloud<ISMFeature>::Ptr &features)
 {
     for(ISMFeature &f : features->points)
     {
-        float sum = 0;
         std::vector<float> &descr = f.descriptor;
+        const float scale = getNormalizationScale((int)descr.size());
         for(int i = 0; i < descr.size(); i++)
         {
-            sum += i;
+            descr.at(i) *= scale;
         }
-        for(int i = 0; i < descr.size(); i++)
+    }
+}
+
+pcl::PointCloud<ISMFeature>::Ptr Features::convertDescriptors(const std::vector<float> &descriptors, int dimension) const
+{
+    pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
+    const int numDescriptors = dimension > 0 ? (int)(descriptors.size() / dimension) : 0;
+    features->resize(numDescriptors);
+
+    #pragma omp parallel for num_threads(getNumThreadsToUse()) if(numDescriptors > 64)
+    for (int i = 0; i < numDescriptors; i++)
+    {
+        const float *data = descriptors.data() + (size_t)i * dimension;
+        features->points[i].descriptor.assign(data, data + dimension);
+    }
+
+    return features;
+}
+
+bool Features::computeSHOTOnDevice(pcl::PointCloud<PointT>::ConstPtr surface,
+                                   pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                   pcl::PointCloud<pcl::ReferenceFrame>::ConstPtr referenceFrames,
+                                   pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                   pcl::search::Search<PointT>::Ptr search,
+                                   double radius, bool color, std::vector<float> &descriptors) const
+{
+#ifdef USE_CUDA
+    if(!CudaShot::isAvailable())
+    {
+        LOG_WARN("No CUDA device available, computing " << getType() << " descriptors on the CPU!");
+        return false;
+    }
+
+    LOG_ASSERT(referenceFrames->size() == keypoints->size());
+    const int numPoints = (int)surface->size();
+    const int numKeypoints = (int)keypoints->size();
+
+    // the neighborhoods are searched on the host, with a neighborhood cache they are already computed
+    search->setInputCloud(surface);
+    std::vector<std::vector<int> > neighborIndices(numKeypoints);
+    std::vector<std::vector<float> > neighborSqrDistances(numKeypoints);
+
+    #pragma omp parallel for schedule(dynamic, 16) num_threads(getNumThreadsToUse())
+    for(int i = 0; i < numKeypoints; i++)
+    {
+        if(search->radiusSearch(*keypoints, i, radius, neighborIndices[i], neighborSqrDistances[i]) == 0)
+        {
+            neighborIndices[i].clear();
+            neighborSqrDistances[i].clear();
+        }
+    }
+
+    // compressed neighborhoods
+    std::vector<int> offsets(numKeypoints + 1, 0);
+    for(int i = 0; i < numKeypoints; i++)
+        offsets[i + 1] = offsets[i] + (int)neighborIndices[i].size();
+
+    std::vector<int> neighbors(offsets.back());
+    std::vector<float> sqrDistances(offsets.back());
+    for(int i = 0; i < numKeypoints; i++)
+    {
+        std::copy(neighborIndices[i].begin(), neighborIndices[i].end(), neighbors.begin() + offsets[i]);
+        std::copy(neighborSqrDistances[i].begin(), neighborSqrDistances[i].end(), sqrDistances.begin() + offsets[i]);
+    }
+
+    std::vector<float> points(numPoints * 3);
+    std::vector<float> pointNormals(normals ? numPoints * 3 : 0);
+    std::vector<unsigned char> rgb(color ? numPoints * 3 : 0);
+    for(int i = 0; i < numPoints; i++)
+    {
+        const PointT &point = surface->points[i];
+        points[3 * i] = point.x;
+        points[3 * i + 1] = point.y;
+        points[3 * i + 2] = point.z;
+        if(normals)
         {
-            descr.at(i) /= sum;
+            const pcl::Normal &normal = normals->points[i];
+            pointNormals[3 * i] = normal.normal_x;
+            pointNormals[3 * i + 1] = normal.normal_y;
+            pointNormals[3 * i + 2] = normal.normal_z;
         }
+        if(color)
+        {
+            getPointColor(point, rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2]);
+        }
+    }
+
+    std::vector<float> keypointPositions(numKeypoints * 3);
+    std::vector<unsigned char> keypointRgb(numKeypoints * 3);
+    std::vector<float> frames(numKeypoints * 9);
+    for(int i = 0; i < numKeypoints; i++)
+    {
+        const PointT &keypoint = keypoints->points[i];
+        const pcl::ReferenceFrame &frame = referenceFrames->points[i];
+        keypointPositions[3 * i] = keypoint.x;
+        keypointPositions[3 * i + 1] = keypoint.y;
+        keypointPositions[3 * i + 2] = keypoint.z;
+        getPointColor(keypoint, keypointRgb[3 * i], keypointRgb[3 * i + 1], keypointRgb[3 * i + 2]);
+        std::copy(frame.x_axis, frame.x_axis + 3, frames.begin() + 9 * i);
+        std::copy(frame.y_axis, frame.y_axis + 3, frames.begin() + 9 * i + 3);
+        std::copy(frame.z_axis, frame.z_axis + 3, frames.begin() + 9 * i + 6);
     }
+
+    try
+    {
+        CudaShot shot;
+        shot.upload(points.data(), normals ? pointNormals.data() : 0, color ? rgb.data() : 0, numPoints);
+
+        descriptors.resize((size_t)numKeypoints * CudaShot::getDescriptorLength(color));
+        shot.compute(keypointPositions.data(), keypointRgb.data(), frames.data(), numKeypoints,
+                     offsets.data(), neighbors.data(), sqrDistances.data(), (float)radius, descriptors.data());
+    }
+    catch(const RuntimeException &e)
+    {
+        LOG_WARN("CUDA computation failed (" << e.what() << "), computing " << getType() << " descriptors on the CPU!");
+        descriptors.clear();
+        return false;
+    }
+
+    return true;
+#else
+    LOG_WARN("Built without CUDA support, computing " << getType() << " descriptors on the CPU!");
+    return false;
+#endif
 }
 }
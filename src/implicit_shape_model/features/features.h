@@ -14,12 +14,21 @@
 #include "../utils/ism_feature.h"
 #include "../utils/json_object.h"
 #include "../utils/utils.h"
+#include "../utils/parallel_tasks.h"
+#include "../utils/estimator_cache.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/pcl_base.h>
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <pcl/search/search.h>
+#include <pcl/search/kdtree.h>
+#include <pcl/search/organized.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <omp.h>
 
 namespace ism3d
 {
@@ -31,6 +40,9 @@ namespace ism3d
     class Features
             : public JSONObject
     {
+        // computes the descriptors of its children on shared reference frames and neighborhoods
+        friend class FeaturesMulti;
+
     public:
         virtual ~Features();
 
@@ -51,16 +63,58 @@ namespace ism3d
                                                          pcl::PointCloud<PointT>::ConstPtr keypoints,
                                                          pcl::search::Search<PointT>::Ptr search);
 
+        /**
+         * @brief Compute global features on several regions of one point cloud, e.g. on the regions around the
+         * maxima of a scene. The regions are computed in parallel, each thread reuses its search and its region
+         * buffers for all of its regions. Features with NaN descriptors are dropped as in operator().
+         * @param points the input point cloud
+         * @param normals normals for the input point cloud (normals->size() == points->size())
+         * @param regions the point indices of each region
+         * @param search a search on the input point cloud, shared by descriptors that compute on the regions in place
+         * @return the features of each region, in the order of the regions
+         */
+        std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> computeGlobalFeatures(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                                 pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                                 const std::vector<std::vector<int> > &regions,
+                                                                                 pcl::search::Search<PointT>::Ptr search);
+
         /**
          * @brief Set the number of threads to use. The derived classes do not need to use it.
          * @param numThreads the number of threads to use
          */
         void setNumThreads(int numThread);
 
+        /**
+         * @brief Set the cache the estimators and searches are leased from, so that they are reused by the next
+         * computation instead of being constructed again.
+         * @param estimators the cache of the session, an empty pointer to construct them for each computation
+         */
+        void setEstimatorCache(const EstimatorCache::Ptr &estimators);
+
+        // radius around a keypoint whose points are used by its reference frame and descriptor
+        double getSupportRadius() const
+        {
+            return std::max((double)m_referenceFrameRadius, getDescriptorRadius());
+        }
+
+        // radius around a keypoint whose normals are read by its reference frame and descriptor, 0 if the radius
+        // of the descriptor is not known
+        double getNormalSupportRadius() const
+        {
+            return getDescriptorRadius() > 0 ? getSupportRadius() : 0;
+        }
+
     protected:
         Features();
 
         int getNumThreads() const;
+
+        // number of threads for parallel sections, a value of 0 uses the OpenMP default, one thread inside of a
+        // parallel region
+        int getNumThreadsToUse() const
+        {
+            return ParallelTasks::getNestedThreads(m_numThreads);
+        }
         virtual pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
                                                                      pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                                      pcl::PointCloud<PointT>::ConstPtr,
@@ -69,11 +123,179 @@ namespace ism3d
                                                                      pcl::PointCloud<PointT>::Ptr,
                                                                      pcl::search::Search<PointT>::Ptr) = 0;
 
+        /**
+         * @brief Compute the global descriptors of one region, called in parallel by computeGlobalFeatures. The
+         * default copies the region into the given buffers and computes iComputeDescriptors on the copy with the
+         * search of the thread. Descriptors that can compute on the indices of the whole input override it.
+         * @param points the input point cloud
+         * @param normals normals for the input point cloud
+         * @param region the point indices of the region
+         * @param search a search on the input point cloud, shared by all threads
+         * @param regionPoints buffer of the thread for the points of the region
+         * @param regionNormals buffer of the thread for the normals of the region
+         * @param regionSearch search of the thread, set to the region by the descriptor
+         */
+        virtual pcl::PointCloud<ISMFeature>::Ptr iComputeRegionDescriptors(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                           pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                           const std::vector<int> &region,
+                                                                           pcl::search::Search<PointT>::Ptr search,
+                                                                           pcl::PointCloud<PointT>::Ptr regionPoints,
+                                                                           pcl::PointCloud<pcl::Normal>::Ptr regionNormals,
+                                                                           pcl::search::Search<PointT>::Ptr regionSearch);
+
+        // largest radius of the neighborhood searches around keypoints in iComputeDescriptors, if known
+        virtual double getDescriptorRadius() const
+        {
+            return 0;
+        }
+
         float getCloudRadius(pcl::PointCloud<PointT>::ConstPtr &cloud) const;
 
         void normalizeDescriptors(pcl::PointCloud<ISMFeature>::Ptr &features) const;
 
+        // scale applied by normalizeDescriptors to a descriptor of the given size: trained models expect the
+        // inverse sum of the bin indices, not of the bin values
+        static float getNormalizationScale(int size)
+        {
+            return size > 1 ? 2.0f / ((float)size * (size - 1)) : 1.0f;
+        }
+
+        /**
+         * @brief Convert the descriptors computed by a PCL estimator into features. Each descriptor is written into
+         * its feature storage in a single pass, which also applies the scale of normalizeDescriptors if requested.
+         * Features with NaN values are kept here to stay aligned with the keypoints, they are dropped by operator()
+         * when the keypoint positions are assigned.
+         * @param descriptors the PCL descriptors
+         * @param field the descriptor array of the PCL type, e.g. &pcl::SHOT352::descriptor
+         * @param normalize true to normalize the descriptors as normalizeDescriptors does
+         * @return the features in the order of the descriptors
+         */
+        template<typename PointOutT, std::size_t N>
+        pcl::PointCloud<ISMFeature>::Ptr convertDescriptors(const pcl::PointCloud<PointOutT> &descriptors,
+                                                            float (PointOutT::*field)[N], bool normalize = false) const
+        {
+            pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
+            features->resize(descriptors.size());
+
+            const int numDescriptors = (int)descriptors.size();
+            const float scale = normalize ? getNormalizationScale((int)N) : 1.0f;
+
+            #pragma omp parallel for num_threads(getNumThreadsToUse()) if(numDescriptors > 64)
+            for (int i = 0; i < numDescriptors; i++)
+            {
+                const float *data = descriptors.points[i].*field;
+                std::vector<float> &descriptor = features->points[i].descriptor;
+
+                if (!normalize)
+                {
+                    descriptor.assign(data, data + N);
+                    continue;
+                }
+
+                descriptor.resize(N);
+                float *out = descriptor.data();
+                #pragma omp simd
+                for (int j = 0; j < (int)N; j++)
+                    out[j] = data[j] * scale;
+            }
+
+            return features;
+        }
+
+        /**
+         * @brief Convert contiguous descriptors, e.g. computed on the GPU, into features.
+         * @param descriptors the descriptors, one after another
+         * @param dimension the length of each descriptor
+         * @return the features in the order of the descriptors
+         */
+        pcl::PointCloud<ISMFeature>::Ptr convertDescriptors(const std::vector<float> &descriptors, int dimension) const;
+
+        /**
+         * @brief Compute SHOT or color SHOT descriptors with the CUDA backend in a single batch. The neighborhoods
+         * are searched on the host with the given search, the surface is uploaded once and all descriptors are
+         * computed in one kernel launch. Without CUDA support or device the caller falls back to PCL.
+         * @param surface the search surface
+         * @param normals the normals of the surface, or an empty pointer to ignore normals (SHORT_SHOT)
+         * @param referenceFrames the reference frames of the keypoints
+         * @param keypoints the keypoints
+         * @param search the search of the pipeline
+         * @param radius the descriptor radius
+         * @param color true to compute color SHOT
+         * @param descriptors output: the descriptors, one after another
+         * @return true if the descriptors were computed, false if the caller has to use the CPU
+         */
+        bool computeSHOTOnDevice(pcl::PointCloud<PointT>::ConstPtr surface,
+                                 pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                 pcl::PointCloud<pcl::ReferenceFrame>::ConstPtr referenceFrames,
+                                 pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                 pcl::search::Search<PointT>::Ptr search,
+                                 double radius, bool color, std::vector<float> &descriptors) const;
+
+        /**
+         * @brief Compute descriptors with a PCL estimator that does not parallelize itself. The input points are
+         * split into contiguous chunks, one per thread. Each chunk is computed by its own estimator, since
+         * estimators and searches keep state during compute. The first chunk uses the search set by configure,
+         * the other chunks a search of the same kind. Estimators and searches are leased from the estimator cache.
+         * @param configure function that sets the input, surface, search and parameters of an estimator
+         * @param numPoints the number of input points of the estimator
+         * @param output the descriptors in the order of the input points
+         */
+        template<typename Estimator, typename PointOutT, typename Configure>
+        void computeParallel(const Configure &configure, int numPoints, pcl::PointCloud<PointOutT> &output) const
+        {
+            typedef typename Estimator::PointCloudIn::PointType PointInT;
+
+            const int numThreads = std::min(getNumThreadsToUse(), numPoints);
+
+            if (numThreads <= 1)
+            {
+                // a cached estimator may still hold the indices of a chunk
+                boost::shared_ptr<Estimator> estimator = EstimatorCache::acquire<Estimator>(m_estimators);
+                estimator->setIndices(boost::shared_ptr<std::vector<int> >());
+                configure(*estimator);
+                estimator->compute(output);
+                return;
+            }
+
+            std::vector<pcl::PointCloud<PointOutT> > chunks(numThreads);
+
+            #pragma omp parallel for num_threads(numThreads)
+            for (int i = 0; i < numThreads; i++)
+            {
+                boost::shared_ptr<Estimator> estimator = EstimatorCache::acquire<Estimator>(m_estimators);
+                configure(*estimator);
+
+                typename Estimator::KdTreePtr search = estimator->getSearchMethod();
+                if (i > 0 && search)
+                {
+                    if (dynamic_cast<pcl::search::OrganizedNeighbor<PointInT>*>(search.get()))
+                        search = EstimatorCache::acquire<pcl::search::OrganizedNeighbor<PointInT> >(m_estimators);
+                    else
+                        search = EstimatorCache::acquire<pcl::search::KdTree<PointInT> >(m_estimators);
+                    estimator->setSearchMethod(search);
+                }
+
+                boost::shared_ptr<std::vector<int> > indices(new std::vector<int>());
+                for (int j = (numPoints * i) / numThreads; j < (numPoints * (i + 1)) / numThreads; j++)
+                    indices->push_back(j);
+                estimator->setIndices(indices);
+                estimator->compute(chunks[i]);
+            }
+
+            // merge the chunks in order
+            output.clear();
+            output.is_dense = true;
+            for (int i = 0; i < numThreads; i++)
+            {
+                output.points.insert(output.points.end(), chunks[i].points.begin(), chunks[i].points.end());
+                output.is_dense = output.is_dense && chunks[i].is_dense;
+            }
+            output.width = (uint32_t)output.points.size();
+            output.height = 1;
+        }
+
         int m_numThreads;
+        EstimatorCache::Ptr m_estimators;
 
 
     private:
@@ -109,6 +331,7 @@ namespace ism3d
 
         float m_referenceFrameRadius;
         std::string m_referenceFrameType;
+        bool m_use_neighborhood_cache;
     };
 }
 
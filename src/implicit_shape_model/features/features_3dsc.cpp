@@ -9,16 +9,22 @@
  */
 
 #include "features_3dsc.h"
+#include "../utils/exception.h"
+#include "../utils/shape_context.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/3dsc.h>
 
+#include <algorithm>
+#include <random>
+
 
 namespace ism3d
 {
     Features3DSC::Features3DSC()
     {
         addParameter(m_radius, "Radius", 0.1);
+        addParameter(m_implementation, "Implementation", std::string("PCL"));
     }
 
     Features3DSC::~Features3DSC()
@@ -33,39 +39,68 @@ namespace ism3d
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
+        if (m_implementation != "PCL" && m_implementation != "BinTables")
+            throw BadParamExceptionType<std::string>("invalid implementation", m_implementation);
 
-        // Object for storing the 3DSC descriptors for each point.
-        pcl::PointCloud<pcl::ShapeContext1980>::Ptr descriptors(new pcl::PointCloud<pcl::ShapeContext1980>());
+        if (m_implementation == "PCL")
+        {
+            // Object for storing the 3DSC descriptors for each point.
+            pcl::PointCloud<pcl::ShapeContext1980>::Ptr descriptors(new pcl::PointCloud<pcl::ShapeContext1980>());
 
-        // 3DSC estimation object.
-        pcl::ShapeContext3DEstimation<PointT, pcl::Normal, pcl::ShapeContext1980> sc3d;
-        sc3d.setInputCloud(keypoints);
-        sc3d.setSearchSurface(pointCloudWithoutNaNNormals);
-        sc3d.setInputNormals(normalsWithoutNaN);
-        sc3d.setSearchMethod(search);
-        // Search radius, to look for neighbors. It will also be the radius of the support sphere.
-        sc3d.setRadiusSearch(m_radius);
-        // The minimal radius value for the search sphere, to avoid being too sensitive in bins close to the center of the sphere.
-        sc3d.setMinimalRadius(m_radius / 10.0);
-        // Radius used to compute the local point density for the neighbors (the density is the number of points within that radius).
-//        sc3d.setPointDensityRadius(0.05 / 5.0);
+            // 3DSC estimation object.
+            typedef pcl::ShapeContext3DEstimation<PointT, pcl::Normal, pcl::ShapeContext1980> Estimator;
+            computeParallel<Estimator>([&](Estimator &sc3d)
+            {
+                sc3d.setInputCloud(keypoints);
+                sc3d.setSearchSurface(pointCloudWithoutNaNNormals);
+                sc3d.setInputNormals(normalsWithoutNaN);
+                sc3d.setSearchMethod(search);
+                // Search radius, to look for neighbors. It will also be the radius of the support sphere.
+                sc3d.setRadiusSearch(m_radius);
+                // The minimal radius value for the search sphere, to avoid being too sensitive in bins close to the center of the sphere.
+                sc3d.setMinimalRadius(m_radius / 10.0);
+            }, (int)keypoints->size(), *descriptors);
 
-        sc3d.compute(*descriptors);
+            // create descriptor point cloud
+            return convertDescriptors(*descriptors, &pcl::ShapeContext1980::descriptor);
+        }
 
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
+        // 12 azimuth, 11 elevation and 15 radius bins as in PCL, the minimal radius avoids being too sensitive in
+        // bins close to the center of the sphere
+        const ShapeContext &shapeContext = ShapeContext::get(12, 11, 15, m_radius / 10.0, m_radius);
 
-        for (int i = 0; i < (int)descriptors->size(); i++)
+        // the normal of the closest neighbor is the z axis, a random orthogonal vector the x axis, each keypoint draws
+        // it from its own generator so that the result does not depend on the threads
+        auto frames = [&](int keypoint, const std::vector<int> &indices, const std::vector<float> &sqrDists,
+                          Eigen::Vector3f &xAxis, Eigen::Vector3f &zAxis)
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::ShapeContext1980& sc = descriptors->at(i);
+            const int closest = indices[std::min_element(sqrDists.begin(), sqrDists.end()) - sqrDists.begin()];
+            zAxis = normalsWithoutNaN->points[closest].getNormalVector3fMap();
+            if (!zAxis.allFinite())
+                return false;
 
-            // store the descriptor
-            feature.descriptor.resize(1980);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = sc.descriptor[j];
-        }
+            std::mt19937 rng(12345 + keypoint);
+            std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+            xAxis = Eigen::Vector3f(uniform(rng), uniform(rng), uniform(rng));
+            if (zAxis[2] != 0)
+                xAxis[2] = -(zAxis[0] * xAxis[0] + zAxis[1] * xAxis[1]) / zAxis[2];
+            else if (zAxis[1] != 0)
+                xAxis[1] = -(zAxis[0] * xAxis[0] + zAxis[2] * xAxis[2]) / zAxis[1];
+            else if (zAxis[0] != 0)
+                xAxis[0] = -(zAxis[1] * xAxis[1] + zAxis[2] * xAxis[2]) / zAxis[0];
+            else
+                return false;
+            xAxis.normalize();
+            return true;
+        };
+
+        // the density of a neighbor is the number of points within 0.2 as in PCL
+        search->setInputCloud(pointCloudWithoutNaNNormals);
+        std::vector<float> descriptors;
+        shapeContext.compute(*pointCloudWithoutNaNNormals, *keypoints, *search, 0.2f, frames, getNumThreadsToUse(), descriptors);
+
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(descriptors, shapeContext.getSize());
 
         return features;
     }
@@ -18,6 +18,10 @@ namespace ism3d
     /**
      * @brief The Features3DSC class
      * Computes features using the 3D Shape Context descriptor.
+     * The "PCL" implementation uses PCL's estimator. The "BinTables" implementation bins the neighbors with
+     * precomputed tables and draws the x axis of each keypoint from its own generator, so that the descriptors do
+     * not depend on the threads. Its descriptors differ from PCL's, models have to be trained with the same
+     * implementation that is used for detection.
      */
     class Features3DSC
             : public Features
@@ -30,6 +34,11 @@ namespace ism3d
         std::string getType() const;
 
     protected:
+        double getDescriptorRadius() const
+        {
+            return m_radius;
+        }
+
         pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
                                                              pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                              pcl::PointCloud<PointT>::ConstPtr,
@@ -41,6 +50,7 @@ namespace ism3d
     private:
 
         double m_radius;
+        std::string m_implementation;
     };
 }
 
@@ -46,7 +46,9 @@ namespace ism3d
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
 
-        pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> shotEst;
+        boost::shared_ptr<pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> > shotEstPtr =
+                EstimatorCache::acquire<pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> >(m_estimators);
+        pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> &shotEst = *shotEstPtr;
         Eigen::Vector4d centroid;
 
         if (pointCloud->isOrganized()) {
@@ -66,6 +68,7 @@ namespace ism3d
 
         // parameters
         shotEst.setRadiusSearch(m_radius);
+        shotEst.setNumberOfThreads(getNumThreads());
 
         // compute features
         pcl::PointCloud<pcl::SHOT352>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT352>());
@@ -30,6 +30,11 @@ namespace ism3d
         std::string getType() const;
 
     protected:
+        double getDescriptorRadius() const
+        {
+            return m_radius;
+        }
+
         pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
                                                              pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                              pcl::PointCloud<PointT>::ConstPtr,
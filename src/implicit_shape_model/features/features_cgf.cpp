@@ -5,12 +5,14 @@
 
 #include "../third_party/cgf/cgf.cpp"
 #include "../third_party/cnpy/cnpy.h"
+#include "../utils/exception.h"
 
 namespace ism3d
 {
     FeaturesCGF::FeaturesCGF()
     {
         addParameter(m_radius, "Radius", 0.1);
+        addParameter(m_embedding_weights, "EmbeddingWeights", std::string("cgf_embedding_910000.npz"));
     }
 
     FeaturesCGF::~FeaturesCGF()
@@ -27,41 +29,36 @@ namespace ism3d
     {
 
         // NOTE: this block of code generates and computes the CGF
-        // (three steps: generate raw features, convert to npy format and apply embedding)
+        // (two steps: generate raw features and apply embedding)
         // using the code in  third_party/cgf/cgf.cpp   provided at    https://github.com/marckhoury/CGF
         //
         // NOTE: in order to use this feature descriptor you need to download the trained weights from the above repository
-
-        // generate raw features
-        std::string raw_output = "raw_cgf.lzf";
-        std::vector<std::string> argv = {
-          "",
-          "-s", std::to_string(m_radius),       // feature support
-          "-m", std::to_string(m_radius*0.05),  // smallest subdivision
-          "-l", std::to_string(m_radius*0.75),  // lrf radius
-          "-t", std::to_string(8),              // number of threads
-          "-o", raw_output                      // output file
-        };
-        cgf_main(argv, pointCloudWithoutNaNNormals, keypoints);
-
-        // convert raw features to npy format
-        std::string compressed_output = "raw_compressed_cgf";
-        std::string command_compress = "python compress.py " + raw_output + " 2244 " + compressed_output;
-        int unused = std::system(command_compress.c_str());
-
-        // apply feature embedding
-        std::string feature_file = "features_cgf";
-        std::string model_file_with_path = "embed_model_910000.ckpt";
-        std::string command_embed = "python embedding.py --evaluate=True --checkpoint_model="+model_file_with_path
-                +" --output_file="+ feature_file + " " + compressed_output + ".npz";
-        unused = std::system(command_embed.c_str());
-
-        // read computed features
-        std::map<std::string, cnpy::NpyArray> arrs = cnpy::npz_load(feature_file+".npz");
-        cnpy::NpyArray arr = arrs["data"];
-        std::vector<float> loaded_data = arr.as_vec<float>();
-        int num_features = arr.shape[0];
-        int num_dims = arr.shape[1];
+        // and export them with third_party/cgf/export_weights.py
+
+        loadEmbedding();
+
+        // generate raw features, all pretrained models use 17 x 11 x 12 bins
+        const int num_bins_radius = 17;
+        const int num_bins_polar = 11;
+        const int num_bins_azimuth = 12;
+        std::vector<std::vector<double> > intensities = compute_intensities(pointCloudWithoutNaNNormals, keypoints,
+                                                                            num_bins_radius, num_bins_polar, num_bins_azimuth,
+                                                                            m_radius,         // feature support
+                                                                            m_radius*0.75,    // lrf radius
+                                                                            m_radius*0.05,    // smallest subdivision
+                                                                            getNumThreadsToUse());
+
+        // apply feature embedding to all keypoints at once
+        const int raw_dims = num_bins_radius * num_bins_polar * num_bins_azimuth;
+        Eigen::MatrixXf histograms(intensities.size(), raw_dims);
+        for (int i = 0; i < (int)intensities.size(); i++)
+        {
+            for (int j = 0; j < raw_dims; j++)
+                histograms(i, j) = (float)intensities[i][j];
+        }
+        Eigen::MatrixXf embedded = embed(histograms);
+        int num_features = embedded.rows();
+        int num_dims = embedded.cols();
 
         Eigen::Vector4d centroid;
         pcl::compute3DCentroid(*pointCloudWithoutNaNNormals, centroid);
@@ -77,20 +74,84 @@ namespace ism3d
             // store the descriptor
             feature.descriptor.resize(num_dims);
             for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = loaded_data[i*num_dims + j];
+                feature.descriptor[j] = embedded(i, j);
 
             // store distance to centroid
             PointT keyp = keypoints->at(i);
             feature.centerDist = (Eigen::Vector3d(keyp.x, keyp.y, keyp.z)-Eigen::Vector3d(centroid.x(), centroid.y(), centroid.z())).norm();
         }
 
-        // delete generated files
-        std::string cleanup_command = "rm " + raw_output + " " + compressed_output + ".npz" + " " + feature_file + ".npz";
-        unused = std::system(cleanup_command.c_str());
-
         return features;
     }
 
+    void FeaturesCGF::loadEmbedding()
+    {
+        if (!m_layers.empty() && m_loaded_weights == m_embedding_weights)
+            return;
+
+        // the exported file contains weights_<i> and biases_<i> for each layer i, the last layer is linear
+        std::map<std::string, cnpy::NpyArray> arrays = cnpy::npz_load(m_embedding_weights);
+        std::vector<DenseLayer> layers;
+        for (int i = 0; ; i++)
+        {
+            std::map<std::string, cnpy::NpyArray>::const_iterator weights = arrays.find("weights_" + std::to_string(i));
+            std::map<std::string, cnpy::NpyArray>::const_iterator biases = arrays.find("biases_" + std::to_string(i));
+            if (weights == arrays.end() || biases == arrays.end())
+                break;
+
+            const cnpy::NpyArray &w = weights->second;
+            const cnpy::NpyArray &b = biases->second;
+            if (w.shape.size() != 2 || b.num_vals != w.shape[1] || w.fortran_order ||
+                    (w.word_size != sizeof(float) && w.word_size != sizeof(double)) || b.word_size != w.word_size)
+                throw RuntimeException("invalid CGF embedding layer " + std::to_string(i) + " in " + m_embedding_weights);
+            if (!layers.empty() && (int)w.shape[0] != layers.back().weights.cols())
+                throw RuntimeException("CGF embedding layer dimensions do not match in " + m_embedding_weights);
+
+            DenseLayer layer;
+            layer.weights.resize(w.shape[0], w.shape[1]);
+            layer.biases.resize(w.shape[1]);
+            for (int row = 0; row < (int)w.shape[0]; row++)
+            {
+                for (int col = 0; col < (int)w.shape[1]; col++)
+                {
+                    size_t index = row * w.shape[1] + col;
+                    layer.weights(row, col) = w.word_size == sizeof(float) ? w.data<float>()[index] : (float)w.data<double>()[index];
+                }
+            }
+            for (int col = 0; col < (int)w.shape[1]; col++)
+                layer.biases(col) = b.word_size == sizeof(float) ? b.data<float>()[col] : (float)b.data<double>()[col];
+            layer.relu = true;
+            layers.push_back(layer);
+        }
+
+        if (layers.empty())
+            throw RuntimeException("no CGF embedding layers found in " + m_embedding_weights);
+        layers.back().relu = false;
+
+        LOG_INFO("loaded CGF embedding with " << layers.size() << " layers, " << layers.front().weights.rows() <<
+                 " input and " << layers.back().weights.cols() << " output dimensions");
+        m_layers.swap(layers);
+        m_loaded_weights = m_embedding_weights;
+    }
+
+    Eigen::MatrixXf FeaturesCGF::embed(const Eigen::MatrixXf &histograms) const
+    {
+        if (histograms.cols() != m_layers.front().weights.rows())
+            throw RuntimeException("CGF histogram length does not match the embedding input dimension");
+
+        // each row is one keypoint, a layer is a single matrix product for all keypoints
+        Eigen::MatrixXf activations = histograms;
+        for (const DenseLayer &layer : m_layers)
+        {
+            Eigen::MatrixXf output = activations * layer.weights;
+            output.rowwise() += layer.biases;
+            if (layer.relu)
+                output = output.cwiseMax(0.0f);
+            activations.swap(output);
+        }
+        return activations;
+    }
+
     std::string FeaturesCGF::getTypeStatic()
     {
         return "CGF";
@@ -3,12 +3,16 @@
 
 #include "features.h"
 
+#include <Eigen/Core>
+
 namespace ism3d
 {
     /**
      * @brief The FeaturesCGF class
      * Computes features using the Compact Geometric Features
      * see https://marckhoury.github.io/CGF/ and https://github.com/marckhoury/CGF
+     * The raw spherical histograms are computed in memory and embedded with the dense layers of the trained
+     * network. The weights are exported once from the trained checkpoint with third_party/cgf/export_weights.py.
      */
     class FeaturesCGF
             : public Features
@@ -31,7 +35,22 @@ namespace ism3d
 
     private:
 
+        struct DenseLayer
+        {
+            Eigen::MatrixXf weights; // input dimension x output dimension
+            Eigen::RowVectorXf biases;
+            bool relu;
+        };
+
+        void loadEmbedding();
+        Eigen::MatrixXf embed(const Eigen::MatrixXf &histograms) const;
+
         double m_radius;
+        std::string m_embedding_weights;
+
+        // layers of the embedding loaded from m_embedding_weights
+        std::vector<DenseLayer> m_layers;
+        std::string m_loaded_weights;
     };
 }
 
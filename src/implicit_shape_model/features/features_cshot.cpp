@@ -9,6 +9,7 @@
  */
 
 #include "features_cshot.h"
+#include "../utils/exception.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/shot_omp.h>
@@ -19,6 +20,7 @@ namespace ism3d
     FeaturesCSHOT::FeaturesCSHOT()
     {
         addParameter(m_radius, "Radius", 0.1);
+        addParameter(m_backend, "Backend", std::string("CPU"));
     }
 
     FeaturesCSHOT::~FeaturesCSHOT()
@@ -33,45 +35,55 @@ namespace ism3d
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
+#ifdef ISM3D_COLORLESS_POINTS
+        throw RuntimeException("CSHOT requires colored points, the library is built with ISM3D_COLORLESS_POINTS");
+#else
+        if (m_backend != "CPU" && m_backend != "CUDA")
+            throw BadParamExceptionType<std::string>("invalid backend", m_backend);
+
+        pcl::PointCloud<PointT>::ConstPtr surface = pointCloudWithoutNaNNormals;
+        pcl::PointCloud<pcl::Normal>::ConstPtr surfaceNormals = normalsWithoutNaN;
+        if (pointCloud->isOrganized()) {
+            surface = pointCloud;
+            surfaceNormals = normals;
+        }
 
-        pcl::SHOTColorEstimationOMP<PointT, pcl::Normal, pcl::SHOT1344> shotEst;
         Eigen::Vector4d centroid;
+        pcl::compute3DCentroid(*surface, centroid);
 
-        if (pointCloud->isOrganized()) {
-            shotEst.setSearchSurface(pointCloud);
-            shotEst.setInputNormals(normals);
-            pcl::compute3DCentroid(*pointCloud, centroid);
+        pcl::PointCloud<ISMFeature>::Ptr features;
+        std::vector<float> descriptors;
+        if (m_backend == "CUDA" && computeSHOTOnDevice(surface, surfaceNormals, referenceFrames, keypoints, search,
+                                                       m_radius, true, descriptors))
+        {
+            features = convertDescriptors(descriptors, 1344);
         }
-        else {
-            shotEst.setSearchSurface(pointCloudWithoutNaNNormals);
-            shotEst.setInputNormals(normalsWithoutNaN);
-            pcl::compute3DCentroid(*pointCloudWithoutNaNNormals, centroid);
+        else
+        {
+            boost::shared_ptr<pcl::SHOTColorEstimationOMP<PointT, pcl::Normal, pcl::SHOT1344> > shotEstPtr =
+                    EstimatorCache::acquire<pcl::SHOTColorEstimationOMP<PointT, pcl::Normal, pcl::SHOT1344> >(m_estimators);
+            pcl::SHOTColorEstimationOMP<PointT, pcl::Normal, pcl::SHOT1344> &shotEst = *shotEstPtr;
+            shotEst.setSearchSurface(surface);
+            shotEst.setInputNormals(surfaceNormals);
+            shotEst.setInputCloud(keypoints);
+            shotEst.setInputReferenceFrames(referenceFrames);
+            shotEst.setSearchMethod(search);
+
+            // parameters
+            shotEst.setRadiusSearch(m_radius);
+            shotEst.setNumberOfThreads(getNumThreads());
+
+            // compute features
+            pcl::PointCloud<pcl::SHOT1344>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT1344>());
+            shotEst.compute(*shotFeatures);
+
+            // create descriptor point cloud
+            features = convertDescriptors(*shotFeatures, &pcl::SHOT1344::descriptor);
         }
 
-        shotEst.setInputCloud(keypoints);
-        shotEst.setInputReferenceFrames(referenceFrames);
-        shotEst.setSearchMethod(search);
-
-        // parameters
-        shotEst.setRadiusSearch(m_radius);
-
-        // compute features
-        pcl::PointCloud<pcl::SHOT1344>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT1344>());
-        shotEst.compute(*shotFeatures);
-
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(shotFeatures->size());
-
-        for (int i = 0; i < (int)shotFeatures->size(); i++)
+        for (int i = 0; i < (int)features->size(); i++)
         {
             ISMFeature& feature = features->at(i);
-            const pcl::SHOT1344& shot = shotFeatures->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(1344);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = shot.descriptor[j];
 
             // store distance to centroid
             PointT keyp = keypoints->at(i);
@@ -79,6 +91,7 @@ namespace ism3d
         }
 
         return features;
+#endif
     }
 
     std::string FeaturesCSHOT::getTypeStatic()
@@ -9,6 +9,7 @@
  */
 
 #include "features_cshot_global.h"
+#include "../utils/exception.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/shot_omp.h>
@@ -32,7 +33,9 @@ namespace ism3d
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
-
+#ifdef ISM3D_COLORLESS_POINTS
+        throw RuntimeException("CSHOT requires colored points, the library is built with ISM3D_COLORLESS_POINTS");
+#else
         pcl::SHOTColorEstimationOMP<PointT, pcl::Normal, pcl::SHOT1344> shotEst;
 
         if (pointCloud->isOrganized()) {
@@ -80,22 +83,13 @@ namespace ism3d
         shotEst.compute(*shotFeatures);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(shotFeatures->size());
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*shotFeatures, &pcl::SHOT1344::descriptor);
 
-        for (int i = 0; i < (int)shotFeatures->size(); i++)
-        {
-            ISMFeature& feature = features->at(i);
+        for (ISMFeature& feature : features->points)
             feature.globalDescriptorRadius = cloud_radius;
-            const pcl::SHOT1344& shot = shotFeatures->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(1344);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = shot.descriptor[j];
-        }
 
         return features;
+#endif
     }
 
     std::string FeaturesCSHOTGlobal::getTypeStatic()
@@ -57,24 +57,11 @@ namespace ism3d
         float cloud_radius = getCloudRadius(pointCloudWithoutNaNNormals);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::VFHSignature308::histogram, true);
 
-        for (int i = 0; i < (int)descriptors->size(); i++)
-        {
-            ISMFeature& feature = features->at(i);
+        for (ISMFeature& feature : features->points)
             feature.globalDescriptorRadius = cloud_radius;
 
-            const pcl::VFHSignature308& cvfhd = descriptors->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(308);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = cvfhd.histogram[j];
-        }
-
-        normalizeDescriptors(features);
-
         return features;
     }
 
@@ -43,23 +43,13 @@ namespace ism3d
         esf.compute(*descriptor);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptor->size());
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptor, &pcl::ESFSignature640::histogram);
 
         // compute cloud radius
         float cloud_radius = getCloudRadius(pointCloudWithoutNaNNormals);
 
-        for (int i = 0; i < (int)descriptor->size(); i++)
-        {
-            ISMFeature& feature = features->at(i);
+        for (ISMFeature& feature : features->points)
             feature.globalDescriptorRadius = cloud_radius;
-            const pcl::ESFSignature640& esf = descriptor->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(640);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = esf.histogram[j];
-        }
 
         return features;
     }
@@ -9,16 +9,25 @@
  */
 
 #include "features_esf_local.h"
+#include "../utils/exception.h"
+#include "../utils/occupancy_grid.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/esf.h>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
 
 namespace ism3d
 {
     FeaturesESFLocal::FeaturesESFLocal()
     {
         addParameter(m_radius, "Radius", 0.1f);
+        addParameter(m_implementation, "Implementation", std::string("PCL"));
+        addParameter(m_num_samples, "NumSamples", 20000);
     }
 
     FeaturesESFLocal::~FeaturesESFLocal()
@@ -32,6 +41,26 @@ namespace ism3d
                                                                          pcl::PointCloud<pcl::ReferenceFrame>::Ptr referenceFrames,
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
+    {
+        if (m_implementation != "PCL" && m_implementation != "Shared")
+            throw BadParamExceptionType<std::string>("invalid implementation", m_implementation);
+        if (m_implementation == "Shared" && m_num_samples <= 0)
+            throw BadParamExceptionType<int>("invalid number of samples", m_num_samples);
+
+        pcl::PointCloud<pcl::ESFSignature640>::Ptr all_descriptors;
+        if (m_implementation == "Shared")
+            all_descriptors = computeShared(pointCloudWithoutNaNNormals, keypoints, search);
+        else
+            all_descriptors = computePCL(pointCloudWithoutNaNNormals, keypoints);
+
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*all_descriptors, &pcl::ESFSignature640::histogram);
+
+        return features;
+    }
+
+    pcl::PointCloud<pcl::ESFSignature640>::Ptr FeaturesESFLocal::computePCL(pcl::PointCloud<PointT>::ConstPtr pointCloudWithoutNaNNormals,
+                                                                            pcl::PointCloud<PointT>::Ptr keypoints) const
     {
         // NOTE: local ESF: extract points in a radius and use them as input cloud
 
@@ -61,42 +90,260 @@ namespace ism3d
         // radius search
         std::vector<std::vector<int> > indices;
         std::vector<std::vector<float> > distances;
-        index.radiusSearch(query, indices, distances, m_radius, flann::SearchParams(128));
+        flann::SearchParams params(128);
+        params.cores = getNumThreadsToUse();
+        index.radiusSearch(query, indices, distances, m_radius, params);
 
-        // ESF estimation object
-        pcl::ESFEstimation<PointT, pcl::ESFSignature640> esf;
-        // Object for storing the ESF descriptor
-        pcl::PointCloud<pcl::ESFSignature640>::Ptr descriptor(new pcl::PointCloud<pcl::ESFSignature640>);
+        // the neighborhoods are independent, each thread uses its own estimation object
         pcl::PointCloud<pcl::ESFSignature640>::Ptr all_descriptors(new pcl::PointCloud<pcl::ESFSignature640>);
+        all_descriptors->resize(indices.size());
 
-        pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
-        for(const std::vector<int> &idxs : indices)
+        #pragma omp parallel for schedule(dynamic) num_threads(getNumThreadsToUse())
+        for(int i = 0; i < (int)indices.size(); i++)
         {
-            cloud->clear();
-            for(int idx : idxs)
+            // ESF estimation object
+            pcl::ESFEstimation<PointT, pcl::ESFSignature640> esf;
+            // Object for storing the ESF descriptor
+            pcl::PointCloud<pcl::ESFSignature640> descriptor;
+
+            pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+            for(int idx : indices[i])
                 cloud->push_back(pointCloudWithoutNaNNormals->at(idx));
 
             esf.setInputCloud(cloud);
-            esf.compute(*descriptor);
-            all_descriptors->push_back(descriptor->at(0));
+            esf.compute(descriptor);
+            all_descriptors->at(i) = descriptor.at(0);
         }
 
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(all_descriptors->size());
+        return all_descriptors;
+    }
 
-        for (int i = 0; i < (int)all_descriptors->size(); i++)
+    namespace
+    {
+        const int ESF_BINS = 64;
+
+        enum LineClass { LINE_IN = 0, LINE_OUT = 1, LINE_MIX = 2 };
+
+        // buffers of one thread, reused for all of its keypoints
+        struct ESFWorkspace
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::ESFSignature640& esf = all_descriptors->at(i);
+            std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > positions;
+            std::vector<float> d2;
+            std::vector<int> d2Classes;
+            std::vector<float> d3;
+            std::vector<int> d3Classes;
+        };
 
-            // store the descriptor
-            feature.descriptor.resize(640);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = esf.histogram[j];
+        // classifies the line between two positions like PCL's ESF by the occupied voxels it passes
+        int classifyLine(const OccupancyGrid &grid, const Eigen::Vector3f &from, const Eigen::Vector3f &to,
+                         int &numVoxels, int &numOccupied, float &ratio)
+        {
+            const Eigen::Vector3i voxelFrom = from.array().floor().cast<int>();
+            const Eigen::Vector3i voxelTo = to.array().floor().cast<int>();
+            grid.traceLine(voxelFrom, voxelTo, numVoxels, numOccupied);
+
+            if (numOccupied >= numVoxels - 1)
+                return LINE_IN;
+            if (numOccupied <= 7)
+                return LINE_OUT;
+            ratio = numOccupied / (float)numVoxels;
+            return LINE_MIX;
         }
 
-        return features;
+        int getAngleBin(const Eigen::Vector3f &u, const Eigen::Vector3f &v)
+        {
+            const float cosine = std::min(std::abs(u.dot(v)), 1.0f);
+            return (int)std::round(std::acos(cosine) / (float)M_PI_2 * (ESF_BINS - 1));
+        }
+
+        // the descriptor of the positions in grid units, false if no triplet could be sampled
+        bool computeESF(const OccupancyGrid &grid, ESFWorkspace &workspace, int numSamples, std::mt19937 &rng,
+                        float *histogram)
+        {
+            const std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > &positions = workspace.positions;
+            if (positions.size() < 3)
+                return false;
+
+            // A3 histograms are filled while sampling, D2 and D3 after their maxima are known
+            double a3In[ESF_BINS] = {0}, a3Out[ESF_BINS] = {0}, a3Mix[ESF_BINS] = {0};
+            float d2In[ESF_BINS] = {0}, d2Out[ESF_BINS] = {0}, d2Mix[ESF_BINS] = {0}, d2Ratio[ESF_BINS] = {0};
+            double d3In[ESF_BINS] = {0}, d3Out[ESF_BINS] = {0}, d3Mix[ESF_BINS] = {0};
+
+            workspace.d2.clear();
+            workspace.d2Classes.clear();
+            workspace.d3.clear();
+            workspace.d3Classes.clear();
+
+            std::uniform_int_distribution<int> distribution(0, (int)positions.size() - 1);
+
+            // degenerate triplets are drawn again, a neighborhood of degenerate triplets only must not stall
+            const long long maxAttempts = 10LL * numSamples + 100;
+            int numAccepted = 0;
+            for (long long attempt = 0; attempt < maxAttempts && numAccepted < numSamples; attempt++)
+            {
+                const int index1 = distribution(rng);
+                const int index2 = distribution(rng);
+                const int index3 = distribution(rng);
+                if (index1 == index2 || index1 == index3 || index2 == index3)
+                    continue;
+
+                const Eigen::Vector3f &p1 = positions[index1];
+                const Eigen::Vector3f &p2 = positions[index2];
+                const Eigen::Vector3f &p3 = positions[index3];
+                Eigen::Vector3f v21 = p2 - p1;
+                Eigen::Vector3f v31 = p3 - p1;
+                Eigen::Vector3f v23 = p2 - p3;
+                const float a = v21.norm();
+                const float b = v31.norm();
+                const float c = v23.norm();
+                const float s = (a + b + c) * 0.5f;
+                const float heron = s * (s - a) * (s - b) * (s - c);
+                if (heron <= 0.001f)
+                    continue;
+
+                v21 /= a;
+                v31 /= b;
+                v23 /= c;
+                const int th1 = getAngleBin(v21, v31);
+                const int th2 = getAngleBin(v23, v31);
+                const int th3 = getAngleBin(v23, v21);
+                if (th1 < 0 || th1 >= ESF_BINS || th2 < 0 || th2 >= ESF_BINS || th3 < 0 || th3 >= ESF_BINS)
+                    continue;
+                numAccepted++;
+
+                int count12, count13, count23;
+                int occupied12, occupied13, occupied23;
+                float ratio12 = 0, ratio13 = 0, ratio23 = 0;
+                const int class12 = classifyLine(grid, p1, p2, count12, occupied12, ratio12);
+                const int class13 = classifyLine(grid, p1, p3, count13, occupied13, ratio13);
+                const int class23 = classifyLine(grid, p2, p3, count23, occupied23, ratio23);
+
+                workspace.d2.push_back(a);
+                workspace.d2.push_back(b);
+                workspace.d2.push_back(c);
+                workspace.d2Classes.push_back(class12);
+                workspace.d2Classes.push_back(class13);
+                workspace.d2Classes.push_back(class23);
+                if (class12 == LINE_MIX)
+                    d2Ratio[(int)std::round(ratio12 * (ESF_BINS - 1))]++;
+                if (class13 == LINE_MIX)
+                    d2Ratio[(int)std::round(ratio13 * (ESF_BINS - 1))]++;
+                if (class23 == LINE_MIX)
+                    d2Ratio[(int)std::round(ratio23 * (ESF_BINS - 1))]++;
+
+                // each angle is weighted with the length of the opposite side
+                const int sumOccupied = occupied12 + occupied13 + occupied23;
+                const int sumVoxels = count12 + count13 + count23;
+                double *a3;
+                int d3Class;
+                if (sumOccupied <= 21)
+                {
+                    a3 = a3Out;
+                    d3Class = LINE_OUT;
+                }
+                else if (sumVoxels - sumOccupied < 4)
+                {
+                    a3 = a3In;
+                    d3Class = LINE_IN;
+                }
+                else
+                {
+                    a3 = a3Mix;
+                    d3Class = LINE_MIX;
+                }
+                a3[th1] += count23 / 32.0;
+                a3[th2] += count12 / 32.0;
+                a3[th3] += count13 / 32.0;
+
+                workspace.d3.push_back(std::sqrt(std::sqrt(heron)));
+                workspace.d3Classes.push_back(d3Class);
+            }
+            if (numAccepted == 0)
+                return false;
+
+            const float maxD2 = *std::max_element(workspace.d2.begin(), workspace.d2.end());
+            const float maxD3 = *std::max_element(workspace.d3.begin(), workspace.d3.end());
+            for (int i = 0; i < (int)workspace.d2.size(); i++)
+            {
+                const int bin = (int)std::round(workspace.d2[i] / maxD2 * (ESF_BINS - 1));
+                float *d2 = workspace.d2Classes[i] == LINE_IN ? d2In : (workspace.d2Classes[i] == LINE_OUT ? d2Out : d2Mix);
+                d2[bin]++;
+            }
+            for (int i = 0; i < (int)workspace.d3.size(); i++)
+            {
+                const int bin = (int)std::round(workspace.d3[i] / maxD3 * (ESF_BINS - 1));
+                double *d3 = workspace.d3Classes[i] == LINE_IN ? d3In : (workspace.d3Classes[i] == LINE_OUT ? d3Out : d3Mix);
+                d3[bin]++;
+            }
+
+            // same layout and weights as PCL's ESF, normalized to a sum of one
+            double sum = 0;
+            for (int j = 0; j < ESF_BINS; j++)
+            {
+                histogram[j] = (float)a3In[j] * 0.5f;
+                histogram[ESF_BINS + j] = (float)a3Out[j] * 0.5f;
+                histogram[2 * ESF_BINS + j] = (float)a3Mix[j] * 0.5f;
+                histogram[3 * ESF_BINS + j] = (float)d3In[j] * 0.5f;
+                histogram[4 * ESF_BINS + j] = (float)d3Out[j] * 0.5f;
+                histogram[5 * ESF_BINS + j] = (float)d3Mix[j] * 0.5f;
+                histogram[6 * ESF_BINS + j] = d2In[j] * 0.5f;
+                histogram[7 * ESF_BINS + j] = d2Out[j] * 0.5f;
+                histogram[8 * ESF_BINS + j] = d2Mix[j];
+                histogram[9 * ESF_BINS + j] = d2Ratio[j];
+            }
+            for (int j = 0; j < 10 * ESF_BINS; j++)
+                sum += histogram[j];
+            if (!(sum > 0))
+                return false;
+            for (int j = 0; j < 10 * ESF_BINS; j++)
+                histogram[j] = (float)(histogram[j] / sum);
+            return true;
+        }
+    }
+
+    pcl::PointCloud<pcl::ESFSignature640>::Ptr FeaturesESFLocal::computeShared(pcl::PointCloud<PointT>::ConstPtr pointCloudWithoutNaNNormals,
+                                                                               pcl::PointCloud<PointT>::Ptr keypoints,
+                                                                               pcl::search::Search<PointT>::Ptr search) const
+    {
+        // PCL's ESF scales each neighborhood to a grid of 64 voxels, a radius of 32 voxels gives the same resolution
+        OccupancyGrid grid;
+        grid.build(*pointCloudWithoutNaNNormals, m_radius / 32.0f);
+
+        const int numKeypoints = (int)keypoints->size();
+        pcl::PointCloud<pcl::ESFSignature640>::Ptr all_descriptors(new pcl::PointCloud<pcl::ESFSignature640>);
+        all_descriptors->resize(numKeypoints);
+
+        // the neighborhoods are answered by the neighborhood cache if the pipeline uses one
+        search->setInputCloud(pointCloudWithoutNaNNormals);
+
+        #pragma omp parallel num_threads(getNumThreadsToUse())
+        {
+            ESFWorkspace workspace;
+            std::vector<int> indices;
+            std::vector<float> sqrDists;
+            std::mt19937 rng;
+
+            #pragma omp for schedule(dynamic)
+            for (int i = 0; i < numKeypoints; i++)
+            {
+                float *histogram = all_descriptors->points[i].histogram;
+
+                workspace.positions.clear();
+                if (pcl::isFinite(keypoints->points[i]) &&
+                        search->radiusSearch(*keypoints, i, m_radius, indices, sqrDists) > 0)
+                {
+                    for (int index : indices)
+                        workspace.positions.push_back(grid.toGrid(pointCloudWithoutNaNNormals->points[index].getVector3fMap()));
+                }
+
+                // seeded by the keypoint, the descriptors do not depend on the number of threads
+                rng.seed(i);
+                if (!computeESF(grid, workspace, m_num_samples, rng, histogram))
+                    std::fill(histogram, histogram + 10 * ESF_BINS, std::numeric_limits<float>::quiet_NaN());
+            }
+        }
+
+        return all_descriptors;
     }
 
     std::string FeaturesESFLocal::getTypeStatic()
@@ -18,6 +18,9 @@ namespace ism3d
     /**
      * @brief The FeaturesESFLocal class
      * Computes features locally using the Ensemble of Shape Functions descriptor.
+     * The "PCL" implementation runs PCL's ESF on each keypoint neighborhood. The "Shared" implementation builds a
+     * single occupancy grid of the scene for the line tests of all neighborhoods, takes the neighborhoods from
+     * the search of the pipeline and samples the triplets of each keypoint in parallel with its own random stream.
      */
     class FeaturesESFLocal
             : public Features
@@ -30,6 +33,11 @@ namespace ism3d
         std::string getType() const;
 
     protected:
+        double getDescriptorRadius() const
+        {
+            return m_radius;
+        }
+
         pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
                                                              pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                              pcl::PointCloud<PointT>::ConstPtr,
@@ -39,7 +47,15 @@ namespace ism3d
                                                              pcl::search::Search<PointT>::Ptr);
 
     private:
+        pcl::PointCloud<pcl::ESFSignature640>::Ptr computePCL(pcl::PointCloud<PointT>::ConstPtr,
+                                                             pcl::PointCloud<PointT>::Ptr) const;
+        pcl::PointCloud<pcl::ESFSignature640>::Ptr computeShared(pcl::PointCloud<PointT>::ConstPtr,
+                                                                pcl::PointCloud<PointT>::Ptr,
+                                                                pcl::search::Search<PointT>::Ptr) const;
+
         float m_radius;
+        std::string m_implementation;
+        int m_num_samples;
 
     };
 }
@@ -20,7 +20,7 @@
 #include "features_short_shot.h"
 #include "features_cshot.h"
 #include "features_cshot_global.h"
-//#include "features_short_cshot.h"  TODO VS: re-implement short c-shot
+#include "features_short_cshot.h"
 #include "features_rift.h"
 #include "features_esf.h"
 #include "features_3dsc.h"
@@ -36,6 +36,7 @@
 #include "features_usc_global.h"
 #include "features_esf_local.h"
 #include "features_cgf.h"
+#include "features_multi.h"
 #include "features_dummy.h"
 
 namespace ism3d
@@ -57,8 +58,8 @@ namespace ism3d
             return new FeaturesCSHOT();
         else if (type == FeaturesCGF::getTypeStatic())
             return new FeaturesCGF();
-//        else if (type == FeaturesSHORTCSHOT::getTypeStatic())
-//            return new FeaturesSHORTCSHOT();
+        else if (type == FeaturesSHORTCSHOT::getTypeStatic())
+            return new FeaturesSHORTCSHOT();
         else if (type == FeaturesRIFT::getTypeStatic())
             return new FeaturesRIFT(); // works only with color data!
         else if (type == Features3DSC::getTypeStatic())
@@ -91,6 +92,8 @@ namespace ism3d
             return new FeaturesCSHOTGlobal(); // global feature!
         else if (type == FeaturesUSCGlobal::getTypeStatic())
             return new FeaturesUSCGlobal(); // global feature!
+        else if (type == FeaturesMulti::getTypeStatic())
+            return new FeaturesMulti(); // combination of the descriptors listed in its children
         else if (type == FeaturesDummy::getTypeStatic())
             return new FeaturesDummy(); // global feature dummy to be able to use old config files without global features
         else
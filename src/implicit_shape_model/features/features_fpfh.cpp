@@ -9,9 +9,7 @@
  */
 
 #include "features_fpfh.h"
-
-#define PCL_NO_PRECOMPILE
-#include <pcl/features/fpfh_omp.h>
+#include "../utils/point_feature_histograms.h"
 
 namespace ism3d
 {
@@ -32,41 +30,17 @@ namespace ism3d
                                                                        pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
-        pcl::FPFHEstimationOMP<PointT, pcl::Normal, pcl::FPFHSignature33> fpfhEst;
-
-        if (pointCloud->isOrganized()) {
-            fpfhEst.setSearchSurface(pointCloud);
-            fpfhEst.setInputNormals(normals);
-        }
-        else {
-            fpfhEst.setSearchSurface(pointCloudWithoutNaNNormals);
-            fpfhEst.setInputNormals(normalsWithoutNaN);
-        }
-
-        fpfhEst.setInputCloud(keypoints);
-        fpfhEst.setSearchMethod(search);
-        fpfhEst.setNumberOfThreads(getNumThreads());
+        // the neighborhoods are searched on the surface with normals as in PCL
+        pcl::PointCloud<PointT>::ConstPtr surface = pointCloud->isOrganized() ? pointCloud : pointCloudWithoutNaNNormals;
+        pcl::PointCloud<pcl::Normal>::ConstPtr surfaceNormals = pointCloud->isOrganized() ? normals : normalsWithoutNaN;
+        search->setInputCloud(surface);
 
-        // parameters
-        fpfhEst.setRadiusSearch(m_radius);
-
-        // compute features
-        pcl::PointCloud<pcl::FPFHSignature33>::Ptr fpfhFeatures(new pcl::PointCloud<pcl::FPFHSignature33>());
-        fpfhEst.compute(*fpfhFeatures);
+        PointFeatureHistograms histograms(*surface, *surfaceNormals, *search, m_radius, getNumThreadsToUse());
+        std::vector<float> descriptors;
+        histograms.computeFPFH(*keypoints, descriptors);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(fpfhFeatures->size());
-
-        for (int i = 0; i < (int)fpfhFeatures->size(); i++) {
-            ISMFeature& feature = features->at(i);
-            const pcl::FPFHSignature33& fpfh = fpfhFeatures->at(i);
-
-            // store actual descriptor
-            feature.descriptor.resize(33);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = fpfh.histogram[j];
-        }
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(descriptors, PointFeatureHistograms::FPFHSize);
 
         return features;
     }
@@ -50,22 +50,10 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesGRSD::iComputeDescriptors(pcl::PointClo
     float cloud_radius = getCloudRadius(pointCloudWithoutNaNNormals);
 
     // create descriptor point cloud
-    pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-    features->resize(descriptors->size());
+    pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::GRSDSignature21::histogram, true);
 
-    for (int i = 0; i < (int)descriptors->size(); i++)
-    {
-        ISMFeature& feature = features->at(i);
+    for (ISMFeature& feature : features->points)
         feature.globalDescriptorRadius = cloud_radius;
-        const pcl::GRSDSignature21& grsdsig = descriptors->at(i);
-
-        // store the descriptor
-        feature.descriptor.resize(21);
-        for (int j = 0; j < feature.descriptor.size(); j++)
-            feature.descriptor[j] = grsdsig.histogram[j];
-    }
-
-    normalizeDescriptors(features);
 
     return features;
 }
@@ -0,0 +1,194 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "features_multi.h"
+#include "../utils/factory.h"
+#include "../utils/exception.h"
+
+#define PCL_NO_PRECOMPILE
+#include <cmath>
+#include <string>
+
+namespace ism3d
+{
+    FeaturesMulti::FeaturesMulti()
+        : m_keep_feature_sets(false)
+    {
+        addParameter(m_normalize_parts, "NormalizeParts", true);
+    }
+
+    FeaturesMulti::~FeaturesMulti()
+    {
+        clearDescriptors();
+    }
+
+    std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> FeaturesMulti::computeFeatureSets(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                                         pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                                         pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaNNormals,
+                                                                                         pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN,
+                                                                                         pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                                                                         pcl::search::Search<PointT>::Ptr search)
+    {
+        m_keep_feature_sets = true;
+        try
+        {
+            (*this)(points, normals, pointsWithoutNaNNormals, normalsWithoutNaN, keypoints, search);
+        }
+        catch (...)
+        {
+            m_keep_feature_sets = false;
+            throw;
+        }
+        m_keep_feature_sets = false;
+
+        std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> featureSets;
+        featureSets.swap(m_feature_sets);
+        return featureSets;
+    }
+
+    double FeaturesMulti::getDescriptorRadius() const
+    {
+        double radius = 0;
+        for (const Features *descriptor : m_descriptors)
+            radius = std::max(radius, descriptor->getDescriptorRadius());
+        return radius;
+    }
+
+    pcl::PointCloud<ISMFeature>::Ptr FeaturesMulti::iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr pointCloud,
+                                                                         pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                         pcl::PointCloud<PointT>::ConstPtr pointCloudWithoutNaNNormals,
+                                                                         pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN,
+                                                                         pcl::PointCloud<pcl::ReferenceFrame>::Ptr referenceFrames,
+                                                                         pcl::PointCloud<PointT>::Ptr keypoints,
+                                                                         pcl::search::Search<PointT>::Ptr search)
+    {
+        m_feature_sets.clear();
+
+        // all children describe the same keypoints with the same reference frames
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> featureSets;
+        for (Features *descriptor : m_descriptors)
+        {
+            LOG_INFO("computing " << descriptor->getType() << " descriptors");
+            descriptor->setNumThreads(getNumThreads());
+            descriptor->setEstimatorCache(m_estimators);
+            pcl::PointCloud<ISMFeature>::Ptr featureSet = descriptor->iComputeDescriptors(pointCloud, normals,
+                                                                                          pointCloudWithoutNaNNormals, normalsWithoutNaN,
+                                                                                          referenceFrames, keypoints, search);
+            if (!featureSets.empty() && featureSet->size() != featureSets.front()->size())
+                throw RuntimeException("descriptor " + descriptor->getType() + " computed " +
+                                       std::to_string(featureSet->size()) + " features instead of " +
+                                       std::to_string(featureSets.front()->size()) + ", cannot combine descriptors");
+            featureSets.push_back(featureSet);
+        }
+
+        if (featureSets.empty())
+            throw RuntimeException("multi descriptor has no child descriptors");
+
+        // concatenate the descriptors of each keypoint
+        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
+        features->resize(featureSets.front()->size());
+        for (int i = 0; i < (int)features->size(); i++)
+        {
+            ISMFeature &feature = features->at(i);
+            feature = featureSets.front()->at(i);
+            feature.descriptor.clear();
+
+            for (const pcl::PointCloud<ISMFeature>::Ptr &featureSet : featureSets)
+            {
+                const std::vector<float> &part = featureSet->at(i).descriptor;
+
+                float scale = 1;
+                if (m_normalize_parts)
+                {
+                    float norm = 0;
+                    for (float value : part)
+                        norm += value * value;
+                    if (norm > 0)
+                        scale = 1.0f / std::sqrt(norm);
+                }
+
+                for (float value : part)
+                    feature.descriptor.push_back(value * scale);
+            }
+        }
+
+        if (m_keep_feature_sets)
+        {
+            // the base class only sets keypoint positions and reference frames on the combined features
+            for (const pcl::PointCloud<ISMFeature>::Ptr &featureSet : featureSets)
+            {
+                for (int i = 0; i < (int)featureSet->size() && referenceFrames->size() != 0; i++)
+                {
+                    ISMFeature &feature = featureSet->at(i);
+                    const PointT &keypoint = keypoints->at(i);
+                    feature.x = keypoint.x;
+                    feature.y = keypoint.y;
+                    feature.z = keypoint.z;
+                    feature.referenceFrame = referenceFrames->at(i);
+                }
+                m_feature_sets.push_back(featureSet);
+            }
+        }
+
+        return features;
+    }
+
+    Json::Value FeaturesMulti::iChildConfigsToJson() const
+    {
+        Json::Value children(Json::objectValue);
+
+        Json::Value descriptors(Json::arrayValue);
+        for (const Features *descriptor : m_descriptors)
+            descriptors.append(descriptor->configToJson());
+        children["Descriptors"] = descriptors;
+
+        return children;
+    }
+
+    bool FeaturesMulti::iChildConfigsFromJson(const Json::Value& children)
+    {
+        const Json::Value *descriptors = &children["Descriptors"];
+
+        if (descriptors->isNull() || !descriptors->isArray() || descriptors->size() == 0)
+        {
+            LOG_ERROR("multi descriptor needs a non-empty list of descriptors");
+            return false;
+        }
+
+        clearDescriptors();
+
+        for (Json::ArrayIndex i = 0; i < descriptors->size(); i++)
+        {
+            Features *child = Factory<Features>::create((*descriptors)[i]);
+            if (!child)
+                return false;
+            m_descriptors.push_back(child);
+        }
+
+        return true;
+    }
+
+    void FeaturesMulti::clearDescriptors()
+    {
+        for (Features *descriptor : m_descriptors)
+            delete descriptor;
+        m_descriptors.clear();
+    }
+
+    std::string FeaturesMulti::getTypeStatic()
+    {
+        return "Multi";
+    }
+
+    std::string FeaturesMulti::getType() const
+    {
+        return FeaturesMulti::getTypeStatic();
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURESMULTI_H
+#define ISM3D_FEATURESMULTI_H
+
+#include "features.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The FeaturesMulti class
+     * Computes several descriptors in a single pass. The child descriptors are configured in the "Descriptors"
+     * list of the children. Normals and keypoints are computed once by the pipeline. Reference frames are
+     * computed once with the parameters of this object, the reference frame parameters of the children are
+     * ignored. With UseNeighborhoodCache the keypoint neighborhoods are searched once at the largest radius of
+     * all children. The resulting features contain the concatenated descriptors of all children, the separate
+     * feature sets are available with computeFeatureSets.
+     */
+    class FeaturesMulti
+            : public Features
+    {
+    public:
+        FeaturesMulti();
+        ~FeaturesMulti();
+
+        static std::string getTypeStatic();
+        std::string getType() const;
+
+        /**
+         * @brief Compute the features of each child descriptor on the same reference frames and neighborhoods.
+         * The arguments are the same as for operator().
+         * @return one feature point cloud per child descriptor, in the order of the configuration
+         */
+        std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> computeFeatureSets(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                              pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                              pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaNNormals,
+                                                                              pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN,
+                                                                              pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                                                              pcl::search::Search<PointT>::Ptr search);
+
+    protected:
+        double getDescriptorRadius() const;
+
+        pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
+                                                             pcl::PointCloud<pcl::Normal>::ConstPtr,
+                                                             pcl::PointCloud<PointT>::ConstPtr,
+                                                             pcl::PointCloud<pcl::Normal>::ConstPtr,
+                                                             pcl::PointCloud<pcl::ReferenceFrame>::Ptr,
+                                                             pcl::PointCloud<PointT>::Ptr,
+                                                             pcl::search::Search<PointT>::Ptr);
+
+        Json::Value iChildConfigsToJson() const;
+        bool iChildConfigsFromJson(const Json::Value&);
+
+    private:
+        void clearDescriptors();
+
+        std::vector<Features*> m_descriptors;
+
+        // scale the descriptor of each child to unit length before concatenation
+        bool m_normalize_parts;
+
+        // feature sets of the last computation, only kept for computeFeatureSets
+        bool m_keep_feature_sets;
+        std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> m_feature_sets;
+    };
+}
+
+#endif // ISM3D_FEATURESMULTI_H
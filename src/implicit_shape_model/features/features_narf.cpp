@@ -16,6 +16,8 @@
 #include <pcl/keypoints/narf_keypoint.h>
 #include <pcl/features/narf_descriptor.h>
 
+#include <limits>
+
 namespace ism3d
 {
     FeaturesNARF::FeaturesNARF()
@@ -27,6 +29,45 @@ namespace ism3d
     {
     }
 
+    boost::shared_ptr<pcl::RangeImagePlanar> FeaturesNARF::createOrganizedRangeImage(const pcl::PointCloud<PointT> &cloud)
+    {
+        boost::shared_ptr<pcl::RangeImagePlanar> rangeImage;
+        if (!cloud.isOrganized())
+            return rangeImage;
+
+        // each pixel of the sensor is a pixel of the range image, the focal lengths are fitted to the layout:
+        // u - cx = fx * x / z and v - cy = fy * y / z
+        const int width = (int)cloud.width;
+        const int height = (int)cloud.height;
+        const float centerX = width / 2.0f;
+        const float centerY = height / 2.0f;
+        std::vector<float> depth(cloud.size(), std::numeric_limits<float>::quiet_NaN());
+        double sumX = 0, sqrSumX = 0, sumY = 0, sqrSumY = 0;
+        for (int v = 0; v < height; v++)
+        {
+            for (int u = 0; u < width; u++)
+            {
+                const PointT &point = cloud.at(u, v);
+                if (!pcl::isFinite(point) || point.z <= 0)
+                    continue;
+                depth[v * width + u] = point.z;
+                const double x = point.x / point.z;
+                const double y = point.y / point.z;
+                sumX += (u - centerX) * x;
+                sqrSumX += x * x;
+                sumY += (v - centerY) * y;
+                sqrSumY += y * y;
+            }
+        }
+        if (sqrSumX <= 0 || sqrSumY <= 0 || sumX <= 0 || sumY <= 0)
+            return rangeImage;
+
+        LOG_INFO("creating a range image from the organized point cloud");
+        rangeImage.reset(new pcl::RangeImagePlanar());
+        rangeImage->setDepthImage(depth.data(), width, height, centerX, centerY, sumX / sqrSumX, sumY / sqrSumY);
+        return rangeImage;
+    }
+
     pcl::PointCloud<ISMFeature>::Ptr FeaturesNARF::iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr pointCloud,
                                                                          pcl::PointCloud<pcl::Normal>::ConstPtr normals,
                                                                          pcl::PointCloud<PointT>::ConstPtr pointCloudWithoutNaNNormals,
@@ -36,81 +77,94 @@ namespace ism3d
                                                                          pcl::search::Search<PointT>::Ptr search)
     {
 
-        // TODO VS: test with organized point clouds
-
         // NOTE: code taken from http://robotica.unileon.es/index.php/PCL/OpenNI_tutorial_4:_3D_object_recognition_(descriptors)#NARF
 
-        // first we need to create a range image from the point cloud
-        LOG_INFO("creating a planar projection of the point cloud");
-
-        // Parameters needed by the planar range image object:
-        // Image size. Both Kinect and Xtion work at 640x480.
-        int imageSizeX = 640;
-        int imageSizeY = 480;
-        // Center of projection. here, we choose the middle of the image.
-        float centerX = 640.0f / 2.0f;
-        float centerY = 480.0f / 2.0f;
-        // Focal length. The value seen here has been taken from the original depth images.
-        // It is safe to use the same value vertically and horizontally.
-        float focalLengthX = 525.0f, focalLengthY = focalLengthX;
-        // Sensor pose. Thankfully, the cloud includes the data.
-        Eigen::Affine3f sensorPose = Eigen::Affine3f(Eigen::Translation3f(pointCloud->sensor_origin_[0],
-                                     pointCloud->sensor_origin_[1],
-                                     pointCloud->sensor_origin_[2])) *
-                                     Eigen::Affine3f(pointCloud->sensor_orientation_);
-        // Noise level. If greater than 0, values of neighboring points will be averaged.
-        // This would set the search radius (e.g., 0.03 == 3cm).
-        float noiseLevel = 0.0f;
-        // Minimum range. If set, any point closer to the sensor than this will be ignored.
-        float minimumRange = 0.0f;
-
-        // Planar range image object.
-        pcl::RangeImagePlanar rangeImage;
-        rangeImage.createFromPointCloudWithFixedSize(*pointCloud, imageSizeX, imageSizeY,
-                centerX, centerY, focalLengthX, focalLengthY, sensorPose, pcl::RangeImage::CAMERA_FRAME, noiseLevel, minimumRange);
-
-        // Object for storing the keypoints' indices.
-        pcl::PointCloud<int>::Ptr keypoints(new pcl::PointCloud<int>);
-
-        // Border extractor object.
-        pcl::RangeImageBorderExtractor borderExtractor;
-        // Keypoint detection object.
-        pcl::NarfKeypoint detector(&borderExtractor);
-        detector.setRangeImage(&rangeImage);
-        // The support size influences how big the surface of interest will be, when finding keypoints from the border information.
-        detector.getParameters().support_size = m_radius;
-        detector.compute(*keypoints);
+        boost::shared_ptr<pcl::RangeImagePlanar> rangeImage;
+        std::vector<int> keypoints_list;
+        {
+            // the range image and the border keypoints only depend on the cloud
+            std::lock_guard<std::mutex> lock(m_cache_mutex);
+            if (pointCloud != m_cached_cloud)
+            {
+                m_range_image = createOrganizedRangeImage(*pointCloud);
+                if (!m_range_image)
+                {
+                    // first we need to create a range image from the point cloud
+                    LOG_INFO("creating a planar projection of the point cloud");
+
+                    // Parameters needed by the planar range image object:
+                    // Image size. Both Kinect and Xtion work at 640x480.
+                    int imageSizeX = 640;
+                    int imageSizeY = 480;
+                    // Center of projection. here, we choose the middle of the image.
+                    float centerX = 640.0f / 2.0f;
+                    float centerY = 480.0f / 2.0f;
+                    // Focal length. The value seen here has been taken from the original depth images.
+                    // It is safe to use the same value vertically and horizontally.
+                    float focalLengthX = 525.0f, focalLengthY = focalLengthX;
+                    // Sensor pose. Thankfully, the cloud includes the data.
+                    Eigen::Affine3f sensorPose = Eigen::Affine3f(Eigen::Translation3f(pointCloud->sensor_origin_[0],
+                                                 pointCloud->sensor_origin_[1],
+                                                 pointCloud->sensor_origin_[2])) *
+                                                 Eigen::Affine3f(pointCloud->sensor_orientation_);
+                    // Noise level. If greater than 0, values of neighboring points will be averaged.
+                    // This would set the search radius (e.g., 0.03 == 3cm).
+                    float noiseLevel = 0.0f;
+                    // Minimum range. If set, any point closer to the sensor than this will be ignored.
+                    float minimumRange = 0.0f;
+
+                    // Planar range image object.
+                    m_range_image.reset(new pcl::RangeImagePlanar());
+                    m_range_image->createFromPointCloudWithFixedSize(*pointCloud, imageSizeX, imageSizeY,
+                            centerX, centerY, focalLengthX, focalLengthY, sensorPose, pcl::RangeImage::CAMERA_FRAME, noiseLevel, minimumRange);
+                }
+
+                // Object for storing the keypoints' indices.
+                pcl::PointCloud<int> keypoints;
+
+                // Border extractor object.
+                pcl::RangeImageBorderExtractor borderExtractor;
+                // Keypoint detection object.
+                pcl::NarfKeypoint detector(&borderExtractor);
+                detector.setRangeImage(m_range_image.get());
+                // The support size influences how big the surface of interest will be, when finding keypoints from the border information.
+                detector.getParameters().support_size = m_radius;
+                detector.compute(keypoints);
+
+                // The NARF estimator needs the indices in a vector, not a cloud.
+                m_keypoints.assign(keypoints.points.begin(), keypoints.points.end());
+                m_cached_cloud = pointCloud;
+            }
+            rangeImage = m_range_image;
+            keypoints_list = m_keypoints;
+        }
 
         // Object for storing the NARF descriptors.
         pcl::PointCloud<pcl::Narf36>::Ptr descriptors(new pcl::PointCloud<pcl::Narf36>);
 
-        // The NARF estimator needs the indices in a vector, not a cloud.
-        std::vector<int> keypoints_list;
-        keypoints_list.resize(keypoints->points.size());
-        for (unsigned int i = 0; i < keypoints->size(); ++i)
-            keypoints_list[i] = keypoints->points[i];
-        // NARF estimation object.
-        pcl::NarfDescriptor narf(&rangeImage, &keypoints_list);
-        // Support size: choose the same value you used for keypoint extraction.
-        narf.getParameters().support_size = m_radius;
-        narf.getParameters().rotation_invariant = true;
-        narf.compute(*descriptors);
-
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
+        // the range image is only read, the keypoints are split into one chunk per thread
+        const int numThreads = std::max(1, std::min(getNumThreadsToUse(), (int)keypoints_list.size()));
+        std::vector<pcl::PointCloud<pcl::Narf36> > chunks(numThreads);
 
-        for (int i = 0; i < (int)descriptors->size(); i++)
+        #pragma omp parallel for num_threads(numThreads)
+        for (int i = 0; i < numThreads; i++)
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::Narf36& narfd = descriptors->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(36);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = narfd.descriptor[j];
+            std::vector<int> chunk_list(keypoints_list.begin() + (keypoints_list.size() * i) / numThreads,
+                                        keypoints_list.begin() + (keypoints_list.size() * (i + 1)) / numThreads);
+            // NARF estimation object.
+            pcl::NarfDescriptor narf(rangeImage.get(), &chunk_list);
+            // Support size: choose the same value you used for keypoint extraction.
+            narf.getParameters().support_size = m_radius;
+            narf.getParameters().rotation_invariant = true;
+            narf.compute(chunks[i]);
         }
 
+        for (int i = 0; i < numThreads; i++)
+            descriptors->insert(descriptors->end(), chunks[i].begin(), chunks[i].end());
+
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::Narf36::descriptor);
+
         return features;
     }
 
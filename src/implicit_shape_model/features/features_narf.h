@@ -13,11 +13,22 @@
 
 #include "features.h"
 
+#include <mutex>
+
+namespace pcl
+{
+    class RangeImagePlanar;
+}
+
 namespace ism3d
 {
     /**
      * @brief The FeaturesNARF class
      * Computes features using the Normal Aligned Radial Feature Descriptor.
+     * The keypoints are detected on the borders of a planar range image of the cloud. Organized clouds are
+     * converted into a range image with their own layout, unorganized clouds are projected into a fixed size
+     * image. The range image and the keypoints of the last cloud are kept and reused if the same cloud is
+     * described again.
      */
     class FeaturesNARF
             : public Features
@@ -39,8 +50,15 @@ namespace ism3d
                                                              pcl::search::Search<PointT>::Ptr);
 
     private:
+        // the range image of an organized cloud in the camera frame, null if the cloud is not organized
+        static boost::shared_ptr<pcl::RangeImagePlanar> createOrganizedRangeImage(const pcl::PointCloud<PointT> &cloud);
 
         double m_radius;
+
+        std::mutex m_cache_mutex;
+        pcl::PointCloud<PointT>::ConstPtr m_cached_cloud;
+        boost::shared_ptr<pcl::RangeImagePlanar> m_range_image;
+        std::vector<int> m_keypoints;
     };
 }
 
@@ -9,9 +9,7 @@
  */
 
 #include "features_pfh.h"
-
-#define PCL_NO_PRECOMPILE
-#include <pcl/features/pfh.h>
+#include "../utils/point_feature_histograms.h"
 
 namespace ism3d
 {
@@ -32,40 +30,17 @@ namespace ism3d
                                                                       pcl::PointCloud<PointT>::Ptr keypoints,
                                                                       pcl::search::Search<PointT>::Ptr search)
     {
-        pcl::PFHEstimation<PointT, pcl::Normal, pcl::PFHSignature125> pfhEst;
-
-        if (pointCloud->isOrganized()) {
-            pfhEst.setSearchSurface(pointCloud);
-            pfhEst.setInputNormals(normals);
-        }
-        else {
-            pfhEst.setSearchSurface(pointCloudWithoutNaNNormals);
-            pfhEst.setInputNormals(normalsWithoutNaN);
-        }
-
-        pfhEst.setInputCloud(keypoints);
-        pfhEst.setSearchMethod(search);
+        // the neighborhoods are searched on the surface with normals as in PCL
+        pcl::PointCloud<PointT>::ConstPtr surface = pointCloud->isOrganized() ? pointCloud : pointCloudWithoutNaNNormals;
+        pcl::PointCloud<pcl::Normal>::ConstPtr surfaceNormals = pointCloud->isOrganized() ? normals : normalsWithoutNaN;
+        search->setInputCloud(surface);
 
-        // parameters
-        pfhEst.setRadiusSearch(m_radius);
-
-        // compute features
-        pcl::PointCloud<pcl::PFHSignature125>::Ptr pfhFeatures(new pcl::PointCloud<pcl::PFHSignature125>());
-        pfhEst.compute(*pfhFeatures);
+        PointFeatureHistograms histograms(*surface, *surfaceNormals, *search, m_radius, getNumThreadsToUse());
+        std::vector<float> descriptors;
+        histograms.computePFH(*keypoints, descriptors);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(pfhFeatures->size());
-
-        for (int i = 0; i < (int)pfhFeatures->size(); i++) {
-            ISMFeature& feature = features->at(i);
-            const pcl::PFHSignature125& pfh = pfhFeatures->at(i);
-
-            // store actual descriptor
-            feature.descriptor.resize(125);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = pfh.histogram[j];
-        }
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(descriptors, PointFeatureHistograms::PFHSize);
 
         return features;
     }
@@ -15,6 +15,8 @@
 #include <pcl/features/intensity_gradient.h>
 #include <pcl/features/rift.h>
 
+#include <limits>
+
 namespace ism3d
 {
     FeaturesRIFT::FeaturesRIFT()
@@ -52,47 +54,84 @@ namespace ism3d
         pcl::PointCloud<PointT> keypoints_cloud = *keypoints;
         pcl::PointCloudXYZRGBtoXYZI(keypoints_cloud, *keypointsIntensity);
 
-        // Object for storing the intensity gradients.
-        pcl::PointCloud<pcl::IntensityGradient>::Ptr gradients(new pcl::PointCloud<pcl::IntensityGradient>);
+        pcl::search::KdTree<pcl::PointXYZI>::Ptr kdtree(new pcl::search::KdTree<pcl::PointXYZI>);
+        kdtree->setInputCloud(cloudIntensity);
+
+        // RIFT only reads the gradients of the neighbors of the points it searches. PCL's RIFT searches the surface
+        // point with the index of the keypoint, not the keypoint itself, so the neighbors of both are collected.
+        const int numKeypoints = (int)keypointsIntensity->size();
+        const int numPoints = (int)cloudIntensity->size();
+        std::vector<std::vector<int> > neighbors(2 * numKeypoints);
+
+        #pragma omp parallel num_threads(getNumThreadsToUse())
+        {
+            std::vector<float> distances;
+
+            #pragma omp for schedule(dynamic, 16)
+            for (int i = 0; i < numKeypoints; i++)
+            {
+                if (pcl::isFinite(keypointsIntensity->points[i]))
+                    kdtree->radiusSearch(keypointsIntensity->points[i], m_radius, neighbors[2 * i], distances);
+                if (i < numPoints)
+                    kdtree->radiusSearch(cloudIntensity->points[i], m_radius, neighbors[2 * i + 1], distances);
+            }
+        }
 
-        // Compute the intensity gradients.
+        std::vector<char> needed(numPoints, 0);
+        for (const std::vector<int> &indices : neighbors)
+        {
+            for (int index : indices)
+                needed[index] = 1;
+        }
+        pcl::IndicesPtr gradientIndices(new std::vector<int>());
+        for (int index = 0; index < numPoints; index++)
+        {
+            if (needed[index])
+                gradientIndices->push_back(index);
+        }
+
+        // Compute the intensity gradients of these points only, the gradient of a point only depends on its own
+        // neighbors, so that they equal the gradients of the whole cloud.
+        pcl::PointCloud<pcl::IntensityGradient> neededGradients;
         pcl::IntensityGradientEstimation <pcl::PointXYZI, pcl::Normal, pcl::IntensityGradient,
             pcl::common::IntensityFieldAccessor<pcl::PointXYZI> > ge;
         ge.setInputCloud(cloudIntensity);
         ge.setInputNormals(normalsWithoutNaN);
+        ge.setIndices(gradientIndices);
         ge.setRadiusSearch(m_radius);
-        ge.compute(*gradients);
+        ge.setNumberOfThreads(getNumThreadsToUse());
+        if (!gradientIndices->empty())
+            ge.compute(neededGradients);
 
-        pcl::search::KdTree<pcl::PointXYZI>::Ptr kdtree(new pcl::search::KdTree<pcl::PointXYZI>);
+        // Object for storing the intensity gradients, the gradients that are never read stay NaN.
+        pcl::PointCloud<pcl::IntensityGradient>::Ptr gradients(new pcl::PointCloud<pcl::IntensityGradient>);
+        pcl::IntensityGradient invalid;
+        invalid.gradient_x = invalid.gradient_y = invalid.gradient_z = std::numeric_limits<float>::quiet_NaN();
+        gradients->points.assign(numPoints, invalid);
+        gradients->width = numPoints;
+        gradients->height = 1;
+        gradients->is_dense = false;
+        for (int n = 0; n < (int)gradientIndices->size(); n++)
+            gradients->points[(*gradientIndices)[n]] = neededGradients.points[n];
 
         // Object for storing the RIFT descriptor for each point.
         pcl::PointCloud<pcl::Histogram<rift_size> >::Ptr descriptors(new pcl::PointCloud<pcl::Histogram<rift_size> >());
 
         // RIFT estimation object
-        pcl::RIFTEstimation<pcl::PointXYZI, pcl::IntensityGradient, pcl::Histogram<rift_size> > rift;
-        rift.setInputCloud(keypointsIntensity);
-        rift.setSearchSurface(cloudIntensity);
-        rift.setSearchMethod(kdtree);
-        rift.setInputGradient(gradients); // Set the intensity gradients to use.
-        rift.setRadiusSearch(m_radius); // Radius, to get all neighbors within.
-        rift.setNrDistanceBins(rift_distance_bins); // Set the number of bins to use in the distance dimension.
-        rift.setNrGradientBins(rift_gradient_bins); // Set the number of bins to use in the gradient orientation dimension.
-        rift.compute(*descriptors);
-
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
-
-        for (int i = 0; i < (int)descriptors->size(); i++)
+        typedef pcl::RIFTEstimation<pcl::PointXYZI, pcl::IntensityGradient, pcl::Histogram<rift_size> > Estimator;
+        computeParallel<Estimator>([&](Estimator &rift)
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::Histogram<rift_size>& riftd = descriptors->at(i);
+            rift.setInputCloud(keypointsIntensity);
+            rift.setSearchSurface(cloudIntensity);
+            rift.setSearchMethod(kdtree);
+            rift.setInputGradient(gradients); // Set the intensity gradients to use.
+            rift.setRadiusSearch(m_radius); // Radius, to get all neighbors within.
+            rift.setNrDistanceBins(rift_distance_bins); // Set the number of bins to use in the distance dimension.
+            rift.setNrGradientBins(rift_gradient_bins); // Set the number of bins to use in the gradient orientation dimension.
+        }, (int)keypoints->size(), *descriptors);
 
-            // store the descriptor
-            feature.descriptor.resize(rift_size);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = riftd.histogram[j];
-        }
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::Histogram<rift_size>::histogram);
 
         return features;
     }
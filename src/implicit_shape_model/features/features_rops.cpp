@@ -13,6 +13,7 @@
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/rops_estimation.h>
 #include <pcl/surface/gp3.h>
+#include <pcl/common/io.h>
 
 namespace ism3d
 {
@@ -38,14 +39,46 @@ namespace ism3d
         // Object for storing the ROPS descriptor for each point.
         pcl::PointCloud<pcl::Histogram<desc_length> >::Ptr descriptors(new pcl::PointCloud<pcl::Histogram<desc_length> >());
 
+        // only the support regions of the keypoints are triangulated, the triangles of a point depend on the points
+        // within the triangulation radius around it, so the regions are enlarged by that radius
+        search->setInputCloud(pointCloudWithoutNaNNormals);
+        const int numKeypoints = (int)keypoints->size();
+        std::vector<std::vector<int> > regions(numKeypoints);
+
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(getNumThreadsToUse())
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            std::vector<float> distances;
+            if (pcl::isFinite(keypoints->points[i]))
+                search->radiusSearch(keypoints->points[i], 2 * m_radius, regions[i], distances);
+        }
+
+        std::vector<int> regionIndices;
+        std::vector<char> inRegion(pointCloudWithoutNaNNormals->size(), 0);
+        for (const std::vector<int> &region : regions)
+        {
+            for (int index : region)
+            {
+                if (!inRegion[index])
+                {
+                    inRegion[index] = 1;
+                    regionIndices.push_back(index);
+                }
+            }
+        }
+
         // Object for storing both the points and the normals.
         pcl::PointCloud<PointNormalT>::Ptr cloudNormals(new pcl::PointCloud<PointNormalT>);
+        pcl::PointCloud<PointT> regionPoints;
+        pcl::PointCloud<pcl::Normal> regionNormals;
+        pcl::copyPointCloud(*pointCloudWithoutNaNNormals, regionIndices, regionPoints);
+        pcl::copyPointCloud(*normalsWithoutNaN, regionIndices, regionNormals);
 
-        LOG_INFO("starting triangulation");
+        LOG_INFO("starting triangulation of " << regionIndices.size() << " of " << pointCloudWithoutNaNNormals->size() << " points");
 
         // Perform triangulation.
-        pcl::concatenateFields(*pointCloudWithoutNaNNormals, *normalsWithoutNaN, *cloudNormals);
-        pcl::search::KdTree<PointNormalT>::Ptr kdtree(new pcl::search::KdTree<PointNormalT>);
+        pcl::concatenateFields(regionPoints, regionNormals, *cloudNormals);
+        pcl::search::KdTree<PointNormalT>::Ptr kdtree = EstimatorCache::acquire<pcl::search::KdTree<PointNormalT> >(m_estimators);
         kdtree->setInputCloud(cloudNormals);
         pcl::GreedyProjectionTriangulation<PointNormalT> triangulation;
         pcl::PolygonMesh triangles;
@@ -61,36 +94,33 @@ namespace ism3d
         triangulation.reconstruct(triangles);
         LOG_INFO("triangulation finished");
 
-        // RoPs estimation object.
-        pcl::ROPSEstimation<PointT, pcl::Histogram<desc_length> > rops;
-        rops.setInputCloud(keypoints);
-        rops.setSearchSurface(pointCloudWithoutNaNNormals);
-        rops.setSearchMethod(search);
-        rops.setRadiusSearch(m_radius);
-        rops.setTriangles(triangles.polygons);
-        // Number of partition bins that is used for distribution matrix calculation.
-        rops.setNumberOfPartitionBins(5);
-        // The greater the number of rotations is, the bigger the resulting descriptor.
-        // Make sure to change the histogram size accordingly.
-        rops.setNumberOfRotations(3);
-        // Support radius that is used to crop the local surface of the point.
-        rops.setSupportRadius(m_radius);
-        rops.compute(*descriptors);
-
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
+        // the estimator indexes the search surface
+        for (pcl::Vertices &polygon : triangles.polygons)
+        {
+            for (uint32_t &vertex : polygon.vertices)
+                vertex = regionIndices[vertex];
+        }
 
-        for (int i = 0; i < (int)descriptors->size(); i++)
+        // RoPs estimation object.
+        typedef pcl::ROPSEstimation<PointT, pcl::Histogram<desc_length> > Estimator;
+        computeParallel<Estimator>([&](Estimator &rops)
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::Histogram<desc_length>& ropsd = descriptors->at(i);
+            rops.setInputCloud(keypoints);
+            rops.setSearchSurface(pointCloudWithoutNaNNormals);
+            rops.setSearchMethod(search);
+            rops.setRadiusSearch(m_radius);
+            rops.setTriangles(triangles.polygons);
+            // Number of partition bins that is used for distribution matrix calculation.
+            rops.setNumberOfPartitionBins(5);
+            // The greater the number of rotations is, the bigger the resulting descriptor.
+            // Make sure to change the histogram size accordingly.
+            rops.setNumberOfRotations(3);
+            // Support radius that is used to crop the local surface of the point.
+            rops.setSupportRadius(m_radius);
+        }, (int)keypoints->size(), *descriptors);
 
-            // store the descriptor
-            feature.descriptor.resize(desc_length);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = ropsd.histogram[j];
-        }
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::Histogram<desc_length>::histogram);
 
         return features;
     }
@@ -38,24 +38,25 @@ namespace ism3d
         pcl::PointCloud<pcl::PrincipalRadiiRSD>::Ptr descriptors(new pcl::PointCloud<pcl::PrincipalRadiiRSD>());
 
         // RSD estimation object.
-        pcl::RSDEstimation<PointT, pcl::Normal, pcl::PrincipalRadiiRSD> rsd;
-        rsd.setInputCloud(keypoints);
-        rsd.setSearchSurface(pointCloudWithoutNaNNormals);
-        rsd.setInputNormals(normalsWithoutNaN);
-        rsd.setSearchMethod(search);
-
-        // Search radius, to look for neighbors. Note: the value given here has to be
-        // larger than the radius used to estimate the normals.
-        rsd.setRadiusSearch(m_radius);
-        // Plane radius. Any radius larger than this is considered infinite (a plane).
-        rsd.setPlaneRadius(m_radius);
-        // Do we want to save the full distance-angle histograms?
-        if(m_use_hist)
-            rsd.setSaveHistograms(true);
-        else
-            rsd.setSaveHistograms(false);
-
-        rsd.compute(*descriptors);
+        typedef pcl::RSDEstimation<PointT, pcl::Normal, pcl::PrincipalRadiiRSD> Estimator;
+        computeParallel<Estimator>([&](Estimator &rsd)
+        {
+            rsd.setInputCloud(keypoints);
+            rsd.setSearchSurface(pointCloudWithoutNaNNormals);
+            rsd.setInputNormals(normalsWithoutNaN);
+            rsd.setSearchMethod(search);
+
+            // Search radius, to look for neighbors. Note: the value given here has to be
+            // larger than the radius used to estimate the normals.
+            rsd.setRadiusSearch(m_radius);
+            // Plane radius. Any radius larger than this is considered infinite (a plane).
+            rsd.setPlaneRadius(m_radius);
+            // Do we want to save the full distance-angle histograms?
+            if(m_use_hist)
+                rsd.setSaveHistograms(true);
+            else
+                rsd.setSaveHistograms(false);
+        }, (int)keypoints->size(), *descriptors);
 
         LOG_INFO("RSD obtained " << descriptors->size() << " descriptors!");
 
@@ -1,14 +1,19 @@
 
 #include "features_short_cshot.h"
+#include "../utils/shot_kernels.h"
+#include "../utils/exception.h"
 
 namespace ism3d
 {
 FeaturesSHORTCSHOT::FeaturesSHORTCSHOT() :
     nr_shape_bins_ (10), nr_color_bins_ (30),
-    sqradius_ (0), radius3_4_ (0), radius1_4_ (0), radius1_2_ (0),
-    nr_grid_sector_ (32), maxAngularSectors_ (32), descLength_ (0)
+    sqradius_ (0), nr_grid_sector_ (32), descLength_ (0)
 {
     addParameter(m_radius, "Radius", 0.1);
+
+    // fill the color conversion tables before descriptors are computed in parallel
+    float L, A, B;
+    RGB2CIELAB(0, 0, 0, L, A, B);
 }
 
 FeaturesSHORTCSHOT::~FeaturesSHORTCSHOT()
@@ -23,6 +28,10 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesSHORTCSHOT::iComputeDescriptors(pcl::Po
                                                                         pcl::PointCloud<PointT>::Ptr keypoints,
                                                                         pcl::search::Search<PointT>::Ptr search)
 {
+#ifdef ISM3D_COLORLESS_POINTS
+    throw RuntimeException("SHORT_CSHOT requires colored points, the library is built with ISM3D_COLORLESS_POINTS");
+#endif
+
     // init params
     if (pointCloud->isOrganized())
         surface_ = pointCloud;
@@ -51,14 +60,15 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesSHORTCSHOT::iComputeDescriptors(pcl::Po
     descLength_ += nr_grid_sector_ * (nr_color_bins_+1);
 
     sqradius_ = search_radius_ * search_radius_;
-    radius3_4_ = (search_radius_*3) / 4;
-    radius1_4_ = search_radius_ / 4;
-    radius1_2_ = search_radius_ / 2;
 
     output->is_dense = true;
+    // invalid points are counted to warn once instead of per point
+    int numInvalidFrames = 0;
+    int numSmallNeighborhoods = 0;
+
     // Iterating over the entire index vector
     #ifdef _OPENMP
-    #pragma omp parallel for num_threads(m_numThreads)
+    #pragma omp parallel for num_threads(getNumThreadsToUse()) reduction(+:numInvalidFrames,numSmallNeighborhoods)
     #endif
     for (size_t idx = 0; idx < indices_->size (); ++idx)
     {
@@ -74,8 +84,8 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesSHORTCSHOT::iComputeDescriptors(pcl::Po
                 !pcl_isfinite (current_frame.y_axis[0]) ||
                 !pcl_isfinite (current_frame.z_axis[0]))
         {
-            LOG_WARN("The local reference frame is not valid! Aborting description of point with index " << (*indices_)[idx])
-                    lrf_is_nan = true;
+            numInvalidFrames++;
+            lrf_is_nan = true;
         }
 
         if (lrf_is_nan || search_->radiusSearch((*input_)[(*indices_)[idx]], search_radius_, nn_indices, nn_dists) == 0)
@@ -91,6 +101,8 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesSHORTCSHOT::iComputeDescriptors(pcl::Po
         }
 
         // Estimate the SHOT descriptor at each patch
+        if (nn_indices.size () < 5)
+            numSmallNeighborhoods++;
         computePointSHOT (static_cast<int> (idx), nn_indices, nn_dists, shot);
 
         // Copy into the resultant cloud
@@ -104,6 +116,11 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesSHORTCSHOT::iComputeDescriptors(pcl::Po
         }
     }
 
+    if (numInvalidFrames > 0)
+        LOG_WARN("The local reference frame is not valid! Aborting description of " << numInvalidFrames << " point(s)");
+    if (numSmallNeighborhoods > 0)
+        LOG_WARN("Neighborhood has less than 5 vertexes. Aborting description of " << numSmallNeighborhoods << " point(s)");
+
     // create descriptor point cloud
     pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
     features->resize(output->size());
@@ -144,7 +161,6 @@ void FeaturesSHORTCSHOT::computePointSHOT(
     //Skip the current feature if the number of its neighbors is not sufficient for its description
     if (indices.size () < 5)
     {
-        LOG_WARN("Warning! Neighborhood has less than 5 vertexes. Aborting description of point with index " << (*indices_)[index]);
         shot.setConstant(descLength_, 1, std::numeric_limits<float>::quiet_NaN () );
         return;
     }
@@ -153,9 +169,8 @@ void FeaturesSHORTCSHOT::computePointSHOT(
     // compute binDistanceColor
     binDistanceColor.resize (nNeighbors);
 
-    unsigned char redRef = input_->points[(*indices_)[index]].r;
-    unsigned char greenRef = input_->points[(*indices_)[index]].g;
-    unsigned char blueRef = input_->points[(*indices_)[index]].b;
+    unsigned char redRef, greenRef, blueRef;
+    getPointColor(input_->points[(*indices_)[index]], redRef, greenRef, blueRef);
 
     float LRef, aRef, bRef;
 
@@ -166,9 +181,8 @@ void FeaturesSHORTCSHOT::computePointSHOT(
 
     for (size_t i_idx = 0; i_idx < indices.size (); ++i_idx)
     {
-      unsigned char red = surface_->points[indices[i_idx]].r;
-      unsigned char green = surface_->points[indices[i_idx]].g;
-      unsigned char blue = surface_->points[indices[i_idx]].b;
+      unsigned char red, green, blue;
+      getPointColor(surface_->points[indices[i_idx]], red, green, blue);
 
       float L, a, b;
 
@@ -208,203 +222,35 @@ void FeaturesSHORTCSHOT::interpolateDoubleChannel(const std::vector<int> &indice
 
   int shapeToColorStride = nr_grid_sector_*(nr_bins_shape+1);
 
-  Eigen::Vector4f current_frame_x (current_frame.x_axis[0], current_frame.x_axis[1], current_frame.x_axis[2], 0);
-  Eigen::Vector4f current_frame_y (current_frame.y_axis[0], current_frame.y_axis[1], current_frame.y_axis[2], 0);
-  Eigen::Vector4f current_frame_z (current_frame.z_axis[0], current_frame.z_axis[1], current_frame.z_axis[2], 0);
-
-  for (size_t i_idx = 0; i_idx < indices.size (); ++i_idx)
+  // neighbor coordinates relative to the keypoint, one array per coordinate for the vectorized kernel
+  const int nNeighbors = static_cast<int> (indices.size ());
+  std::vector<float> x (nNeighbors), y (nNeighbors), z (nNeighbors);
+  for (int i_idx = 0; i_idx < nNeighbors; ++i_idx)
   {
-    // binDistanceShape becomes a constant without normals
-    double binDistanceShape = 5.0;
-
-    Eigen::Vector4f delta = surface_->points[indices[i_idx]].getVector4fMap () - central_point;
-    delta[3] = 0;
-
-    // Compute the Euclidean norm
-    double distance = sqrt (sqr_dists[i_idx]);
-
-    if (areEquals (distance, 0.0))
-      continue;
-
-    double xInFeatRef = delta.dot (current_frame_x);
-    double yInFeatRef = delta.dot (current_frame_y);
-    double zInFeatRef = delta.dot (current_frame_z);
-
-    // To avoid numerical problems afterwards
-    if (fabs (yInFeatRef) < 1E-30)
-      yInFeatRef  = 0;
-    if (fabs (xInFeatRef) < 1E-30)
-      xInFeatRef  = 0;
-    if (fabs (zInFeatRef) < 1E-30)
-      zInFeatRef  = 0;
-
-    unsigned char bit4 = ((yInFeatRef > 0) || ((yInFeatRef == 0.0) && (xInFeatRef < 0))) ? 1 : 0;
-    unsigned char bit3 = static_cast<unsigned char> (((xInFeatRef > 0) || ((xInFeatRef == 0.0) && (yInFeatRef > 0))) ? !bit4 : bit4);
-
-    assert (bit3 == 0 || bit3 == 1);
-
-    int desc_index = (bit4<<3) + (bit3<<2);
-
-    desc_index = desc_index << 1;
-
-    if ((xInFeatRef * yInFeatRef > 0) || (xInFeatRef == 0.0))
-      desc_index += (fabs (xInFeatRef) >= fabs (yInFeatRef)) ? 0 : 4;
-    else
-      desc_index += (fabs (xInFeatRef) > fabs (yInFeatRef)) ? 4 : 0;
-
-    desc_index += zInFeatRef > 0 ? 1 : 0;
-
-    // 2 RADII
-    desc_index += (distance > radius1_2_) ? 2 : 0;
-
-    int step_index_shape = static_cast<int>(floor (binDistanceShape +0.5));
-    int step_index_color = static_cast<int>(floor (binDistanceColor[i_idx] +0.5));
-
-    int volume_index_shape = desc_index * (nr_bins_shape+1);
-    int volume_index_color = shapeToColorStride + desc_index * (nr_bins_color+1);
-
-    //Interpolation on the cosine (adjacent bins in the histrogram)
-    binDistanceShape -= step_index_shape;
-    binDistanceColor[i_idx] -= step_index_color;
-
-    double intWeightShape = (1- fabs (binDistanceShape));
-    double intWeightColor = (1- fabs (binDistanceColor[i_idx]));
-
-    if (binDistanceShape > 0)
-      shot[volume_index_shape + ((step_index_shape + 1) % nr_bins_shape)] += static_cast<float> (binDistanceShape);
-    else
-      shot[volume_index_shape + ((step_index_shape - 1 + nr_bins_shape) % nr_bins_shape)] -= static_cast<float> (binDistanceShape);
-
-    if (binDistanceColor[i_idx] > 0)
-      shot[volume_index_color + ((step_index_color+1) % nr_bins_color)] += static_cast<float> (binDistanceColor[i_idx]);
-    else
-      shot[volume_index_color + ((step_index_color - 1 + nr_bins_color) % nr_bins_color)] -= static_cast<float> (binDistanceColor[i_idx]);
-
-    //Interpolation on the distance (adjacent husks)
-
-    if (distance > radius1_2_)   //external sphere
-    {
-      double radiusDistance = (distance - radius3_4_) / radius1_2_;
-
-      if (distance > radius3_4_) //most external sector, votes only for itself
-      {
-        intWeightShape += 1 - radiusDistance; //weight=1-d
-        intWeightColor += 1 - radiusDistance; //weight=1-d
-      }
-      else  //3/4 of radius, votes also for the internal sphere
-      {
-        intWeightShape += 1 + radiusDistance;
-        intWeightColor += 1 + radiusDistance;
-        shot[(desc_index - 2) * (nr_bins_shape+1) + step_index_shape] -= static_cast<float> (radiusDistance);
-        shot[shapeToColorStride + (desc_index - 2) * (nr_bins_color+1) + step_index_color] -= static_cast<float> (radiusDistance);
-      }
-    }
-    else    //internal sphere
-    {
-      double radiusDistance = (distance - radius1_4_) / radius1_2_;
-
-      if (distance < radius1_4_) //most internal sector, votes only for itself
-      {
-        intWeightShape += 1 + radiusDistance;
-        intWeightColor += 1 + radiusDistance; //weight=1-d
-      }
-      else  //3/4 of radius, votes also for the external sphere
-      {
-        intWeightShape += 1 - radiusDistance; //weight=1-d
-        intWeightColor += 1 - radiusDistance; //weight=1-d
-        shot[(desc_index + 2) * (nr_bins_shape+1) + step_index_shape] += static_cast<float> (radiusDistance);
-        shot[shapeToColorStride + (desc_index + 2) * (nr_bins_color+1) + step_index_color] += static_cast<float> (radiusDistance);
-      }
-    }
-
-    //Interpolation on the inclination (adjacent vertical volumes)
-    double inclinationCos = zInFeatRef / distance;
-    if (inclinationCos < - 1.0)
-      inclinationCos = - 1.0;
-    if (inclinationCos > 1.0)
-      inclinationCos = 1.0;
-
-    double inclination = acos (inclinationCos);
+    const PointT &point = surface_->points[indices[i_idx]];
+    x[i_idx] = point.x - central_point[0];
+    y[i_idx] = point.y - central_point[1];
+    z[i_idx] = point.z - central_point[2];
+  }
 
-    assert (inclination >= 0.0 && inclination <= PST_RAD_180);
+  float frame[9];
+  for (int d = 0; d < 3; ++d)
+  {
+    frame[d + 0] = current_frame.x_axis[d];
+    frame[d + 3] = current_frame.y_axis[d];
+    frame[d + 6] = current_frame.z_axis[d];
+  }
 
-    if (inclination > PST_RAD_90 || (fabs (inclination - PST_RAD_90) < 1e-30 && zInFeatRef <= 0))
-    {
-      double inclinationDistance = (inclination - PST_RAD_135) / PST_RAD_90;
-      if (inclination > PST_RAD_135)
-      {
-        intWeightShape += 1 - inclinationDistance;
-        intWeightColor += 1 - inclinationDistance;
-      }
-      else
-      {
-        intWeightShape += 1 + inclinationDistance;
-        intWeightColor += 1 + inclinationDistance;
-        assert ((desc_index + 1) * (nr_bins_shape+1) + step_index_shape >= 0 && (desc_index + 1) * (nr_bins_shape+1) + step_index_shape < descLength_);
-        assert (shapeToColorStride + (desc_index + 1) * (nr_bins_color+ 1) + step_index_color >= 0 && shapeToColorStride + (desc_index + 1) * (nr_bins_color+1) + step_index_color < descLength_);
-        shot[(desc_index + 1) * (nr_bins_shape+1) + step_index_shape] -= static_cast<float> (inclinationDistance);
-        shot[shapeToColorStride + (desc_index + 1) * (nr_bins_color+1) + step_index_color] -= static_cast<float> (inclinationDistance);
-      }
-    }
-    else
-    {
-      double inclinationDistance = (inclination - PST_RAD_45) / PST_RAD_90;
-      if (inclination < PST_RAD_45)
-      {
-        intWeightShape += 1 + inclinationDistance;
-        intWeightColor += 1 + inclinationDistance;
-      }
-      else
-      {
-        intWeightShape += 1 - inclinationDistance;
-        intWeightColor += 1 - inclinationDistance;
-        assert ((desc_index - 1) * (nr_bins_shape+1) + step_index_shape >= 0 && (desc_index - 1) * (nr_bins_shape+1) + step_index_shape < descLength_);
-        assert (shapeToColorStride + (desc_index - 1) * (nr_bins_color+ 1) + step_index_color >= 0 && shapeToColorStride + (desc_index - 1) * (nr_bins_color+1) + step_index_color < descLength_);
-        shot[(desc_index - 1) * (nr_bins_shape+1) + step_index_shape] += static_cast<float> (inclinationDistance);
-        shot[shapeToColorStride + (desc_index - 1) * (nr_bins_color+1) + step_index_color] += static_cast<float> (inclinationDistance);
-      }
-    }
+  ShotBins bins;
+  ShotKernels::computeVolumes (x.data (), y.data (), z.data (), sqr_dists.data (), nNeighbors, frame,
+                               static_cast<float> (search_radius_), bins);
 
-    if (yInFeatRef != 0.0 || xInFeatRef != 0.0)
-    {
-      //Interpolation on the azimuth (adjacent horizontal volumes)
-      double azimuth = atan2 (yInFeatRef, xInFeatRef);
-
-      int sel = desc_index >> 2;
-      double angularSectorSpan = PST_RAD_45;
-      double angularSectorStart = - PST_RAD_PI_7_8;
-
-      double azimuthDistance = (azimuth - (angularSectorStart + angularSectorSpan*sel)) / angularSectorSpan;
-      assert ((azimuthDistance < 0.5 || areEquals (azimuthDistance, 0.5)) && (azimuthDistance > - 0.5 || areEquals (azimuthDistance, - 0.5)));
-      azimuthDistance = (std::max)(- 0.5, std::min (azimuthDistance, 0.5));
-
-      if (azimuthDistance > 0)
-      {
-        intWeightShape += 1 - azimuthDistance;
-        intWeightColor += 1 - azimuthDistance;
-        int interp_index = (desc_index + 4) % maxAngularSectors_;
-        assert (interp_index * (nr_bins_shape+1) + step_index_shape >= 0 && interp_index * (nr_bins_shape+1) + step_index_shape < descLength_);
-        assert (shapeToColorStride + interp_index * (nr_bins_color+1) + step_index_color >= 0 && shapeToColorStride + interp_index * (nr_bins_color+1) + step_index_color < descLength_);
-        shot[interp_index * (nr_bins_shape+1) + step_index_shape] += static_cast<float> (azimuthDistance);
-        shot[shapeToColorStride + interp_index * (nr_bins_color+1) + step_index_color] += static_cast<float> (azimuthDistance);
-      }
-      else
-      {
-        int interp_index = (desc_index - 4 + maxAngularSectors_) % maxAngularSectors_;
-        intWeightShape += 1 + azimuthDistance;
-        intWeightColor += 1 + azimuthDistance;
-        assert (interp_index * (nr_bins_shape+1) + step_index_shape >= 0 && interp_index * (nr_bins_shape+1) + step_index_shape < descLength_);
-        assert (shapeToColorStride + interp_index * (nr_bins_color+1) + step_index_color >= 0 && shapeToColorStride + interp_index * (nr_bins_color+1) + step_index_color < descLength_);
-        shot[interp_index * (nr_bins_shape+1) + step_index_shape] -= static_cast<float> (azimuthDistance);
-        shot[shapeToColorStride + interp_index * (nr_bins_color+1) + step_index_color] -= static_cast<float> (azimuthDistance);
-      }
-    }
+  // binDistanceShape becomes a constant without normals
+  std::vector<float> binDistanceShape (nNeighbors, 5.0f);
+  std::vector<float> binDistanceColorFloat (binDistanceColor.begin (), binDistanceColor.end ());
 
-    assert (volume_index_shape + step_index_shape >= 0 &&  volume_index_shape + step_index_shape < descLength_);
-    assert (volume_index_color + step_index_color >= 0 &&  volume_index_color + step_index_color < descLength_);
-    shot[volume_index_shape + step_index_shape] += static_cast<float> (intWeightShape);
-    shot[volume_index_color + step_index_color] += static_cast<float> (intWeightColor);
-  }
+  ShotKernels::accumulate (bins, binDistanceShape.data (), nr_bins_shape, shot.data ());
+  ShotKernels::accumulate (bins, binDistanceColorFloat.data (), nr_bins_color, shot.data () + shapeToColorStride);
 }
 
 
@@ -81,11 +81,7 @@ private:
     int nr_shape_bins_;
     int nr_color_bins_;
     float sqradius_;
-    float radius3_4_;
-    float radius1_4_;
-    float radius1_2_;
-    int nr_grid_sector_;
-    int maxAngularSectors_;
+    int nr_grid_sector_; // the histogram kernel uses the fixed grid of 32 volumes
     int descLength_;
 };
 }
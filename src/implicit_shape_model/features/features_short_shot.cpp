@@ -9,6 +9,7 @@
  */
 
 #include "features_short_shot.h"
+#include "../utils/exception.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/shot_omp.h>
@@ -19,6 +20,7 @@ namespace ism3d
     FeaturesSHORTSHOT::FeaturesSHORTSHOT()
     {
         addParameter(m_radius, "Radius", 0.1);
+        addParameter(m_backend, "Backend", std::string("CPU"));
     }
 
     FeaturesSHORTSHOT::~FeaturesSHORTSHOT()
@@ -33,49 +35,59 @@ namespace ism3d
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
+        if (m_backend != "CPU" && m_backend != "CUDA")
+            throw BadParamExceptionType<std::string>("invalid backend", m_backend);
+
+        pcl::PointCloud<PointT>::ConstPtr surface = pointCloudWithoutNaNNormals;
+        if (pointCloud->isOrganized())
+            surface = pointCloud;
 
-        pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> shotEst;
         Eigen::Vector4d centroid;
+        pcl::compute3DCentroid(*surface, centroid);
 
-        if (pointCloud->isOrganized()) {
-            shotEst.setSearchSurface(pointCloud);
-            pcl::PointCloud<pcl::Normal>::Ptr fake_normals(new pcl::PointCloud<pcl::Normal>());
-            fake_normals->points.resize(normals->size());
-            shotEst.setInputNormals(fake_normals);
-            pcl::compute3DCentroid(*pointCloud, centroid);
-        }
-        else {
-            shotEst.setSearchSurface(pointCloudWithoutNaNNormals);
+        // the shape is described without normals, i.e. all votes fall into the center bin of each histogram
+        std::vector<float> descriptors;
+        if (m_backend != "CUDA" || !computeSHOTOnDevice(surface, pcl::PointCloud<pcl::Normal>::ConstPtr(), referenceFrames,
+                                                        keypoints, search, m_radius, false, descriptors))
+        {
+            boost::shared_ptr<pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> > shotEstPtr =
+                    EstimatorCache::acquire<pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> >(m_estimators);
+            pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> &shotEst = *shotEstPtr;
+            shotEst.setSearchSurface(surface);
             pcl::PointCloud<pcl::Normal>::Ptr fake_normals(new pcl::PointCloud<pcl::Normal>());
-            fake_normals->points.resize(normalsWithoutNaN->size());
+            fake_normals->points.resize(surface->size());
             shotEst.setInputNormals(fake_normals);
-            pcl::compute3DCentroid(*pointCloudWithoutNaNNormals, centroid);
-        }
+            shotEst.setInputCloud(keypoints);
+            shotEst.setInputReferenceFrames(referenceFrames);
+            shotEst.setSearchMethod(search);
 
-        shotEst.setInputCloud(keypoints);
-        shotEst.setInputReferenceFrames(referenceFrames);
-        shotEst.setSearchMethod(search);
+            // parameters
+            shotEst.setRadiusSearch(m_radius);
+            shotEst.setNumberOfThreads(getNumThreads());
 
-        // parameters
-        shotEst.setRadiusSearch(m_radius);
+            // compute features
+            pcl::PointCloud<pcl::SHOT352>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT352>());
+            shotEst.compute(*shotFeatures);
 
-        // compute features
-        pcl::PointCloud<pcl::SHOT352>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT352>());
-        shotEst.compute(*shotFeatures);
+            descriptors.resize(shotFeatures->size() * 352);
+            for (int i = 0; i < (int)shotFeatures->size(); i++)
+                std::copy(shotFeatures->at(i).descriptor, shotFeatures->at(i).descriptor + 352, descriptors.begin() + i * 352);
+        }
 
         // create descriptor point cloud
+        const int numFeatures = (int)(descriptors.size() / 352);
         pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(shotFeatures->size());
+        features->resize(numFeatures);
 
-        for (int i = 0; i < (int)shotFeatures->size(); i++)
+        for (int i = 0; i < numFeatures; i++)
         {
             ISMFeature& feature = features->at(i);
-            const pcl::SHOT352& shot = shotFeatures->at(i);
+            const float *shot = descriptors.data() + i * 352;
 
             // store the descriptor: only one value per histogram
             feature.descriptor.resize(32);
             for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = shot.descriptor[5+j*11];
+                feature.descriptor[j] = shot[5+j*11];
 
             // store distance to centroid
             PointT keyp = keypoints->at(i);
@@ -9,6 +9,7 @@
  */
 
 #include "features_shot.h"
+#include "../utils/exception.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/shot_omp.h>
@@ -19,6 +20,7 @@ namespace ism3d
     FeaturesSHOT::FeaturesSHOT()
     {
         addParameter(m_radius, "Radius", 0.1);
+        addParameter(m_backend, "Backend", std::string("CPU"));
     }
 
     FeaturesSHOT::~FeaturesSHOT()
@@ -33,45 +35,52 @@ namespace ism3d
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
+        if (m_backend != "CPU" && m_backend != "CUDA")
+            throw BadParamExceptionType<std::string>("invalid backend", m_backend);
 
-        pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> shotEst;
-        Eigen::Vector4d centroid;
-
+        pcl::PointCloud<PointT>::ConstPtr surface = pointCloudWithoutNaNNormals;
+        pcl::PointCloud<pcl::Normal>::ConstPtr surfaceNormals = normalsWithoutNaN;
         if (pointCloud->isOrganized()) {
-            shotEst.setSearchSurface(pointCloud);
-            shotEst.setInputNormals(normals);
-            pcl::compute3DCentroid(*pointCloud, centroid);
-        }
-        else {
-            shotEst.setSearchSurface(pointCloudWithoutNaNNormals);
-            shotEst.setInputNormals(normalsWithoutNaN);
-            pcl::compute3DCentroid(*pointCloudWithoutNaNNormals, centroid);
+            surface = pointCloud;
+            surfaceNormals = normals;
         }
 
-        shotEst.setInputCloud(keypoints);
-        shotEst.setInputReferenceFrames(referenceFrames);
-        shotEst.setSearchMethod(search);
-
-        // parameters
-        shotEst.setRadiusSearch(m_radius);
-
-        // compute features
-        pcl::PointCloud<pcl::SHOT352>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT352>());
-        shotEst.compute(*shotFeatures);
+        Eigen::Vector4d centroid;
+        pcl::compute3DCentroid(*surface, centroid);
 
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(shotFeatures->size());
+        pcl::PointCloud<ISMFeature>::Ptr features;
+        std::vector<float> descriptors;
+        if (m_backend == "CUDA" && computeSHOTOnDevice(surface, surfaceNormals, referenceFrames, keypoints, search,
+                                                       m_radius, false, descriptors))
+        {
+            features = convertDescriptors(descriptors, 352);
+        }
+        else
+        {
+            boost::shared_ptr<pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> > shotEstPtr =
+                    EstimatorCache::acquire<pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> >(m_estimators);
+            pcl::SHOTEstimationOMP<PointT, pcl::Normal, pcl::SHOT352> &shotEst = *shotEstPtr;
+            shotEst.setSearchSurface(surface);
+            shotEst.setInputNormals(surfaceNormals);
+            shotEst.setInputCloud(keypoints);
+            shotEst.setInputReferenceFrames(referenceFrames);
+            shotEst.setSearchMethod(search);
+
+            // parameters
+            shotEst.setRadiusSearch(m_radius);
+            shotEst.setNumberOfThreads(getNumThreads());
+
+            // compute features
+            pcl::PointCloud<pcl::SHOT352>::Ptr shotFeatures(new pcl::PointCloud<pcl::SHOT352>());
+            shotEst.compute(*shotFeatures);
+
+            // create descriptor point cloud
+            features = convertDescriptors(*shotFeatures, &pcl::SHOT352::descriptor);
+        }
 
-        for (int i = 0; i < (int)shotFeatures->size(); i++)
+        for (int i = 0; i < (int)features->size(); i++)
         {
             ISMFeature& feature = features->at(i);
-            const pcl::SHOT352& shot = shotFeatures->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(352);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = shot.descriptor[j];
 
             // store distance to centroid
             PointT keyp = keypoints->at(i);
@@ -30,6 +30,11 @@ namespace ism3d
         std::string getType() const;
 
     protected:
+        double getDescriptorRadius() const
+        {
+            return m_radius;
+        }
+
         pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
                                                              pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                              pcl::PointCloud<PointT>::ConstPtr,
@@ -41,6 +46,7 @@ namespace ism3d
     private:
 
         double m_radius;
+        std::string m_backend; // CPU or CUDA
     };
 }
 
@@ -81,20 +81,10 @@ namespace ism3d
         shotEst.compute(*shotFeatures);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(shotFeatures->size());
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*shotFeatures, &pcl::SHOT352::descriptor);
 
-        for (int i = 0; i < (int)shotFeatures->size(); i++)
-        {
-            ISMFeature& feature = features->at(i);
+        for (ISMFeature& feature : features->points)
             feature.globalDescriptorRadius = cloud_radius;
-            const pcl::SHOT352& shot = shotFeatures->at(i);
-
-            // store the descriptor
-            feature.descriptor.resize(352);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = shot.descriptor[j];
-        }
 
         return features;
     }
@@ -58,30 +58,19 @@ namespace ism3d
         pcl::PointCloud<pcl::Histogram<desc_length> >::Ptr descriptors(new pcl::PointCloud<pcl::Histogram<desc_length> >());
 
         // Spin image estimation object.
-        pcl::SpinImageEstimation<PointT, pcl::Normal, pcl::Histogram<desc_length> > si;
-        si.setInputCloud(keypoints);
-        si.setSearchSurface(pointCloudWithoutNaNNormals);
-        si.setInputNormals(filtered_normals);
-        si.setRadiusSearch(m_radius);
-        // Set the resolution of the spin image (the number of bins along one dimension).
-        si.setImageWidth(8);
-
-        si.compute(*descriptors);
-
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
-
-        for (int i = 0; i < (int)descriptors->size(); i++)
+        typedef pcl::SpinImageEstimation<PointT, pcl::Normal, pcl::Histogram<desc_length> > Estimator;
+        computeParallel<Estimator>([&](Estimator &si)
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::Histogram<desc_length>& spin = descriptors->at(i);
+            si.setInputCloud(keypoints);
+            si.setSearchSurface(pointCloudWithoutNaNNormals);
+            si.setInputNormals(filtered_normals);
+            si.setRadiusSearch(m_radius);
+            // Set the resolution of the spin image (the number of bins along one dimension).
+            si.setImageWidth(8);
+        }, (int)keypoints->size(), *descriptors);
 
-            // store the descriptor
-            feature.descriptor.resize(desc_length);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = spin.histogram[j];
-        }
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::Histogram<desc_length>::histogram);
 
         return features;
     }
@@ -9,9 +9,12 @@
  */
 
 #include "features_usc.h"
+#include "../utils/exception.h"
+#include "../utils/shape_context.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/usc.h>
+#include <pcl/features/shot_lrf_omp.h>
 
 
 namespace ism3d
@@ -19,6 +22,7 @@ namespace ism3d
     FeaturesUSC::FeaturesUSC()
     {
         addParameter(m_radius, "Radius", 0.1);
+        addParameter(m_implementation, "Implementation", std::string("PCL"));
     }
 
     FeaturesUSC::~FeaturesUSC()
@@ -33,42 +37,63 @@ namespace ism3d
                                                                          pcl::PointCloud<PointT>::Ptr keypoints,
                                                                        pcl::search::Search<PointT>::Ptr search)
     {
+        if (m_implementation != "PCL" && m_implementation != "BinTables")
+            throw BadParamExceptionType<std::string>("invalid implementation", m_implementation);
 
-        // Object for storing the USC descriptors for each point.
-        pcl::PointCloud<pcl::UniqueShapeContext1960>::Ptr descriptors(new pcl::PointCloud<pcl::UniqueShapeContext1960>());
-
-        // USC estimation object.
-        pcl::UniqueShapeContext<PointT, pcl::UniqueShapeContext1960, pcl::ReferenceFrame> usc;
-        usc.setSearchSurface(pointCloudWithoutNaNNormals);
-        usc.setInputCloud(keypoints);
-
-        // Search radius, to look for neighbors. It will also be the radius of the support sphere.
-        usc.setRadiusSearch(m_radius);
-        // The minimal radius value for the search sphere, to avoid being too sensitive in bins close to the center of the sphere.
-        usc.setMinimalRadius(m_radius / 10.0);
-//        // Radius used to compute the local point density for the neighbors (the density is the number of points within that radius).
-//        usc.setPointDensityRadius(m_radius / 5.0);
+        if (m_implementation == "PCL")
+        {
+            // Object for storing the USC descriptors for each point.
+            pcl::PointCloud<pcl::UniqueShapeContext1960>::Ptr descriptors(new pcl::PointCloud<pcl::UniqueShapeContext1960>());
+
+            // USC estimation object.
+            typedef pcl::UniqueShapeContext<PointT, pcl::UniqueShapeContext1960, pcl::ReferenceFrame> Estimator;
+            computeParallel<Estimator>([&](Estimator &usc)
+            {
+                usc.setSearchSurface(pointCloudWithoutNaNNormals);
+                usc.setInputCloud(keypoints);
+
+                // Search radius, to look for neighbors. It will also be the radius of the support sphere.
+                usc.setRadiusSearch(m_radius);
+                // The minimal radius value for the search sphere, to avoid being too sensitive in bins close to the center of the sphere.
+                usc.setMinimalRadius(m_radius / 10.0);
+
+                // Set the radius to compute the Local Reference Frame.
+                float lrf_radius = m_radius <= 0.1 ? 0.1 : m_radius - 0.1;
+                usc.setLocalRadius(lrf_radius);
+            }, (int)keypoints->size(), *descriptors);
+
+            // create descriptor point cloud
+            return convertDescriptors(*descriptors, &pcl::UniqueShapeContext1960::descriptor);
+        }
 
-        // Set the radius to compute the Local Reference Frame.
+        // the SHOT reference frames of the keypoints, computed with the local radius of PCL's estimator
+        search->setInputCloud(pointCloudWithoutNaNNormals);
+        pcl::PointCloud<pcl::ReferenceFrame>::Ptr frames(new pcl::PointCloud<pcl::ReferenceFrame>());
+        pcl::SHOTLocalReferenceFrameEstimationOMP<PointT, pcl::ReferenceFrame> refEst;
         float lrf_radius = m_radius <= 0.1 ? 0.1 : m_radius - 0.1;
-        usc.setLocalRadius(lrf_radius);
-
-        usc.compute(*descriptors);
-
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptors->size());
-
-        for (int i = 0; i < (int)descriptors->size(); i++)
+        refEst.setRadiusSearch(lrf_radius);
+        refEst.setNumberOfThreads(getNumThreadsToUse());
+        refEst.setInputCloud(keypoints);
+        refEst.setSearchSurface(pointCloudWithoutNaNNormals);
+        refEst.setSearchMethod(search);
+        refEst.compute(*frames);
+
+        // 14 azimuth, 14 elevation and 10 radius bins as in PCL, the minimal radius avoids being too sensitive in
+        // bins close to the center of the sphere, the density of a neighbor is the number of points within 0.1
+        const ShapeContext &shapeContext = ShapeContext::get(14, 14, 10, m_radius / 10.0, m_radius);
+        std::vector<float> descriptors;
+        shapeContext.compute(*pointCloudWithoutNaNNormals, *keypoints, *search, 0.1f,
+                             [&](int keypoint, const std::vector<int>&, const std::vector<float>&,
+                                 Eigen::Vector3f &xAxis, Eigen::Vector3f &zAxis)
         {
-            ISMFeature& feature = features->at(i);
-            const pcl::UniqueShapeContext1960& usc = descriptors->at(i);
+            const pcl::ReferenceFrame &frame = frames->points[keypoint];
+            xAxis = Eigen::Map<const Eigen::Vector3f>(frame.x_axis);
+            zAxis = Eigen::Map<const Eigen::Vector3f>(frame.z_axis);
+            return xAxis.allFinite() && zAxis.allFinite();
+        }, getNumThreadsToUse(), descriptors);
 
-            // store the descriptor
-            feature.descriptor.resize(1960);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = usc.descriptor[j];
-        }
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(descriptors, shapeContext.getSize());
 
         return features;
     }
@@ -18,6 +18,9 @@ namespace ism3d
     /**
      * @brief The FeaturesUSC class
      * Computes features using the Unique Shape Context descriptor.
+     * The "PCL" implementation uses PCL's estimator. The "BinTables" implementation uses the precomputed bin tables
+     * of 3DSC with the SHOT reference frames of the keypoints. It does not have the off by one binning of PCL's USC,
+     * so its descriptors differ and models have to be trained with the implementation used for detection.
      */
     class FeaturesUSC
             : public Features
@@ -30,6 +33,11 @@ namespace ism3d
         std::string getType() const;
 
     protected:
+        double getDescriptorRadius() const
+        {
+            return m_radius;
+        }
+
         pcl::PointCloud<ISMFeature>::Ptr iComputeDescriptors(pcl::PointCloud<PointT>::ConstPtr,
                                                              pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                              pcl::PointCloud<PointT>::ConstPtr,
@@ -41,6 +49,7 @@ namespace ism3d
     private:
 
         double m_radius;
+        std::string m_implementation;
     };
 }
 
@@ -9,16 +9,21 @@
  */
 
 #include "features_usc_global.h"
+#include "../utils/exception.h"
+#include "../utils/shape_context.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/features/usc.h>
+#include <pcl/features/shot_lrf_omp.h>
 #include <pcl/common/centroid.h>
+#include <pcl/search/kdtree.h>
 
 
 namespace ism3d
 {
 FeaturesUSCGlobal::FeaturesUSCGlobal()
 {
+    addParameter(m_implementation, "Implementation", std::string("PCL"));
 }
 
 FeaturesUSCGlobal::~FeaturesUSCGlobal()
@@ -33,17 +38,11 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesUSCGlobal::iComputeDescriptors(pcl::Poi
                                                                         pcl::PointCloud<PointT>::Ptr keypoints,
                                                                         pcl::search::Search<PointT>::Ptr search)
 {
-
-    // Object for storing the USC descriptors for each point.
-    pcl::PointCloud<pcl::UniqueShapeContext1960>::Ptr descriptors(new pcl::PointCloud<pcl::UniqueShapeContext1960>());
-
-    // USC estimation object.
-    pcl::UniqueShapeContext<PointT, pcl::UniqueShapeContext1960, pcl::ReferenceFrame> usc;
-    usc.setSearchSurface(pointCloudWithoutNaNNormals);
+    if (m_implementation != "PCL" && m_implementation != "BinTables")
+        throw BadParamExceptionType<std::string>("invalid implementation", m_implementation);
 
     // compute cloud radius
     float cloud_radius = getCloudRadius(pointCloudWithoutNaNNormals);
-    usc.setRadiusSearch(cloud_radius);
 
     // for global USC use centroid instead of keypoints
     Eigen::Vector4f centroid4f;
@@ -58,38 +57,71 @@ pcl::PointCloud<ISMFeature>::Ptr FeaturesUSCGlobal::iComputeDescriptors(pcl::Poi
     centroid_cloud->width = 1;
     centroid_cloud->is_dense = false;
 
-    usc.setInputCloud(centroid_cloud);
+    if (m_implementation == "PCL")
+    {
+        // Object for storing the USC descriptors for each point.
+        pcl::PointCloud<pcl::UniqueShapeContext1960>::Ptr descriptors(new pcl::PointCloud<pcl::UniqueShapeContext1960>());
 
-    // Search radius, to look for neighbors. It will also be the radius of the support sphere.
-    usc.setRadiusSearch(cloud_radius);
-    // The minimal radius value for the search sphere, to avoid being too sensitive in bins close to the center of the sphere.
-    usc.setMinimalRadius(cloud_radius / 10.0);
-    //        // Radius used to compute the local point density for the neighbors (the density is the number of points within that radius).
-    //        usc.setPointDensityRadius(m_radius / 5.0);
+        // USC estimation object.
+        pcl::UniqueShapeContext<PointT, pcl::UniqueShapeContext1960, pcl::ReferenceFrame> usc;
+        usc.setSearchSurface(pointCloudWithoutNaNNormals);
+        usc.setInputCloud(centroid_cloud);
 
-    // Set the radius to compute the Local Reference Frame.
-    float lrf_radius = cloud_radius <= 0.1 ? 0.1 : cloud_radius - 0.1;
-    usc.setLocalRadius(lrf_radius);
+        // Search radius, to look for neighbors. It will also be the radius of the support sphere.
+        usc.setRadiusSearch(cloud_radius);
+        // The minimal radius value for the search sphere, to avoid being too sensitive in bins close to the center of the sphere.
+        usc.setMinimalRadius(cloud_radius / 10.0);
 
+        // Set the radius to compute the Local Reference Frame.
+        float lrf_radius = cloud_radius <= 0.1 ? 0.1 : cloud_radius - 0.1;
+        usc.setLocalRadius(lrf_radius);
 
-    usc.compute(*descriptors);
+        usc.compute(*descriptors);
 
-    // create descriptor point cloud
-    pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-    features->resize(descriptors->size());
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptors, &pcl::UniqueShapeContext1960::descriptor);
 
-    for (int i = 0; i < (int)descriptors->size(); i++)
-    {
-        ISMFeature& feature = features->at(i);
-        feature.globalDescriptorRadius = cloud_radius;
-        const pcl::UniqueShapeContext1960& usc = descriptors->at(i);
+        for (ISMFeature& feature : features->points)
+            feature.globalDescriptorRadius = cloud_radius;
 
-        // store the descriptor
-        feature.descriptor.resize(1960);
-        for (int j = 0; j < feature.descriptor.size(); j++)
-            feature.descriptor[j] = usc.descriptor[j];
+        return features;
     }
 
+    // the whole cloud is the support of the descriptor
+    pcl::search::Search<PointT>::Ptr kdtree(new pcl::search::KdTree<PointT>());
+    kdtree->setInputCloud(pointCloudWithoutNaNNormals);
+
+    // Set the radius to compute the Local Reference Frame.
+    pcl::PointCloud<pcl::ReferenceFrame>::Ptr frames(new pcl::PointCloud<pcl::ReferenceFrame>());
+    pcl::SHOTLocalReferenceFrameEstimationOMP<PointT, pcl::ReferenceFrame> refEst;
+    float lrf_radius = cloud_radius <= 0.1 ? 0.1 : cloud_radius - 0.1;
+    refEst.setRadiusSearch(lrf_radius);
+    refEst.setNumberOfThreads(getNumThreadsToUse());
+    refEst.setInputCloud(centroid_cloud);
+    refEst.setSearchSurface(pointCloudWithoutNaNNormals);
+    refEst.setSearchMethod(kdtree);
+    refEst.compute(*frames);
+
+    // the bins of USC, the minimal radius avoids being too sensitive in bins close to the center of the sphere, the
+    // tables are not shared since the radius differs for each cloud
+    const ShapeContext shapeContext(14, 14, 10, cloud_radius / 10.0, cloud_radius);
+    std::vector<float> descriptors;
+    shapeContext.compute(*pointCloudWithoutNaNNormals, *centroid_cloud, *kdtree, 0.1f,
+                         [&](int keypoint, const std::vector<int>&, const std::vector<float>&,
+                             Eigen::Vector3f &xAxis, Eigen::Vector3f &zAxis)
+    {
+        const pcl::ReferenceFrame &frame = frames->points[keypoint];
+        xAxis = Eigen::Map<const Eigen::Vector3f>(frame.x_axis);
+        zAxis = Eigen::Map<const Eigen::Vector3f>(frame.z_axis);
+        return xAxis.allFinite() && zAxis.allFinite();
+    }, getNumThreadsToUse(), descriptors);
+
+    // create descriptor point cloud
+    pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(descriptors, shapeContext.getSize());
+
+    for (ISMFeature& feature : features->points)
+        feature.globalDescriptorRadius = cloud_radius;
+
     return features;
 }
 
@@ -18,6 +18,7 @@ namespace ism3d
     /**
      * @brief The FeaturesUSCGlobal class
      * Computes a global feature using the Unique Shape Context descriptor.
+     * The "PCL" implementation uses PCL's estimator, "BinTables" the precomputed bin tables of the local USC.
      */
     class FeaturesUSCGlobal
             : public Features
@@ -39,6 +40,7 @@ namespace ism3d
                                                              pcl::search::Search<PointT>::Ptr);
 
     private:
+        std::string m_implementation;
     };
 }
 
@@ -11,6 +11,7 @@
 #include "features_vfh.h"
 
 #define PCL_NO_PRECOMPILE
+#include <pcl/common/io.h>
 #include <pcl/features/vfh.h>
 
 
@@ -51,21 +52,47 @@ namespace ism3d
         float cloud_radius = getCloudRadius(pointCloudWithoutNaNNormals);
 
         // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
-        features->resize(descriptor->size());
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptor, &pcl::VFHSignature308::histogram);
 
-        for (int i = 0; i < (int)descriptor->size(); i++)
-        {
-            ISMFeature& feature = features->at(i);
+        for (ISMFeature& feature : features->points)
             feature.globalDescriptorRadius = cloud_radius;
 
-            const pcl::VFHSignature308& vfhd = descriptor->at(i);
+        return features;
+    }
+
+    pcl::PointCloud<ISMFeature>::Ptr FeaturesVFH::iComputeRegionDescriptors(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                            pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                            const std::vector<int> &region,
+                                                                            pcl::search::Search<PointT>::Ptr search,
+                                                                            pcl::PointCloud<PointT>::Ptr regionPoints,
+                                                                            pcl::PointCloud<pcl::Normal>::Ptr regionNormals,
+                                                                            pcl::search::Search<PointT>::Ptr regionSearch)
+    {
+        // VFH only reads the points and normals of its indices, but the estimator would set up a search on the
+        // whole input unless it already searches the input
+        if (!search || search->getInputCloud() != points || region.empty())
+            return Features::iComputeRegionDescriptors(points, normals, region, search, regionPoints, regionNormals, regionSearch);
 
-            // store the descriptor
-            feature.descriptor.resize(308);
-            for (int j = 0; j < feature.descriptor.size(); j++)
-                feature.descriptor[j] = vfhd.histogram[j];
-        }
+        pcl::PointCloud<pcl::VFHSignature308>::Ptr descriptor(new pcl::PointCloud<pcl::VFHSignature308>);
+
+        pcl::VFHEstimation<PointT, pcl::Normal, pcl::VFHSignature308> vfh;
+        vfh.setInputCloud(points);
+        vfh.setIndices(boost::make_shared<std::vector<int> >(region));
+        vfh.setSearchSurface(points);
+        vfh.setInputNormals(normals);
+        vfh.setSearchMethod(search);
+        vfh.setNormalizeBins(true);
+        vfh.setNormalizeDistance(false);
+        vfh.compute(*descriptor);
+
+        pcl::copyPointCloud(*points, region, *regionPoints);
+        pcl::PointCloud<PointT>::ConstPtr constRegionPoints = regionPoints;
+        float cloud_radius = getCloudRadius(constRegionPoints);
+
+        pcl::PointCloud<ISMFeature>::Ptr features = convertDescriptors(*descriptor, &pcl::VFHSignature308::histogram);
+
+        for (ISMFeature& feature : features->points)
+            feature.globalDescriptorRadius = cloud_radius;
 
         return features;
     }
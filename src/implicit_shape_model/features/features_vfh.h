@@ -38,6 +38,15 @@ namespace ism3d
                                                              pcl::PointCloud<PointT>::Ptr,
                                                              pcl::search::Search<PointT>::Ptr);
 
+        // computes on the indices of the region in the input instead of a copy of the region
+        pcl::PointCloud<ISMFeature>::Ptr iComputeRegionDescriptors(pcl::PointCloud<PointT>::ConstPtr,
+                                                                   pcl::PointCloud<pcl::Normal>::ConstPtr,
+                                                                   const std::vector<int>&,
+                                                                   pcl::search::Search<PointT>::Ptr,
+                                                                   pcl::PointCloud<PointT>::Ptr,
+                                                                   pcl::PointCloud<pcl::Normal>::Ptr,
+                                                                   pcl::search::Search<PointT>::Ptr);
+
     private:
 
     };
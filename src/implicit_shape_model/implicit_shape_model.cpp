@@ -32,6 +32,9 @@
  */
 
 #include "implicit_shape_model.h"
+#include "detection_session.h"
+#include "streaming_detector.h"
+#include "tiled_detector.h"
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/search/kdtree.h>
@@ -44,9 +47,23 @@
 #include <pcl/common/centroid.h>
 
 #include <fstream>
+#include <sstream>
 
 #include <iostream>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
 #include <omp.h>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <boost/filesystem.hpp>
 
 #include <opencv2/ml/ml.hpp>
 
@@ -56,14 +73,31 @@
 #include "feature_ranking/ranking_uniform.h"
 #include "clustering/clustering_agglomerative.h"
 #include "voting/voting_hough_3d.h"
+#include "utils/feature_cache.h"
+#include "utils/feature_store.h"
+#include "utils/json_stream.h"
 #include "voting/voting_mean_shift.h"
 
 #include "classifier/custom_SVM.h"
 #include "utils/distance.h"
 #include "utils/point_cloud_resizing.h"
+#include "utils/point_cloud_loader.h"
 #include "utils/normal_orientation.h"
 #include "utils/factory.h"
 #include "utils/exception.h"
+#include "utils/index_tuner.h"
+#include "utils/memory_report.h"
+#include "utils/flat_model.h"
+#include "utils/metric_embedding.h"
+#include "utils/training_checkpoint.h"
+#include "utils/feature_shard.h"
+#include "utils/feature_deduplication.h"
+#include "activation_strategy/activation_strategy.h"
+#include "utils/shared_search.h"
+#include "utils/bounded_queue.h"
+#ifdef USE_CUDA
+#include "utils/cuda_matcher.h"
+#endif
 
 #include <log4cxx/patternlayout.h>
 #include <log4cxx/consoleappender.h>
@@ -83,14 +117,32 @@ ImplicitShapeModel::ImplicitShapeModel() : m_distance(0)
     addParameter(m_distanceType, "DistanceType", std::string("Euclidean"));
     addParameter(m_useVoxelFiltering, "UseVoxelFiltering", false);
     addParameter(m_voxelLeafSize, "VoxelLeafSize", 0.01f);
+    addParameter(m_useOrganizedPipeline, "UseOrganizedPipeline", false);
     addParameter(m_normalRadius, "NormalRadius", 0.05f);
+    addParameter(m_lazyNormals, "LazyNormals", false);
     addParameter(m_consistentNormalsK, "ConsistentNormalsK", 10);
     addParameter(m_consistentNormalsMethod, "ConsistentNormalsMethod", 2);
     addParameter(m_numThreads, "NumThreads", 0);
+    addParameter(m_threads_normals, "NumThreadsNormals", 0);
+    addParameter(m_threads_features, "NumThreadsFeatures", 0);
+    addParameter(m_threads_activation, "NumThreadsActivation", 0);
+    addParameter(m_threads_voting, "NumThreadsVoting", 0);
+    addParameter(m_threads_maxima, "NumThreadsMaxima", 0);
+    addParameter(m_cpu_affinity, "CpuAffinity", std::string(""));
     addParameter(m_bbType, "BoundingBoxType", std::string("MVBB"));
+    addParameter(m_mvbbEpsilon, "MVBBEpsilon", 0.0f);
+    addParameter(m_mvbbLeafSize, "MVBBLeafSize", 0.0f);
+    addParameter(m_prefetchClouds, "PrefetchClouds", 2);
+    addParameter(m_prefetchMemoryMB, "PrefetchMemoryMB", 0);
+    addParameter(m_trainingWorkers, "TrainingWorkers", 1);
+    addParameter(m_trainingMemoryMB, "TrainingMemoryMB", 0);
     addParameter(m_setColorToZero, "SetColorToZero", false);
     addParameter(m_enableVotingAnalysis, "EnableVotingAnalysis", false);
     addParameter(m_votingAnalysisOutputPath, "VotingAnalysisOutputPath", std::string("/home/vseib/Desktop/"));
+    addParameter(m_votingAnalysisSampling, "VotingAnalysisSampling", 1);
+    addParameter(m_votingAnalysisMaxVotes, "VotingAnalysisMaxVotes", 100000);
+    addParameter(m_votingAnalysisQueueSize, "VotingAnalysisQueueSize", 2);
+    addParameter(m_votingAnalysisTrajectories, "VotingAnalysisTrajectories", false);
     addParameter(m_use_svm, "UseSvmTraining", false);
     addParameter(m_svm_auto_train, "SvmAutoTrain", false);
     addParameter(m_svm_1_vs_all_train, "SvmOneVsAllTraining", false);
@@ -100,6 +152,47 @@ ImplicitShapeModel::ImplicitShapeModel() : m_distance(0)
     addParameter(m_single_object_mode, "SingleObjectMode", false);
     addParameter(m_num_kd_trees, "FLANNNumKDTrees", 4);
     addParameter(m_flann_exact_match, "FLANNExactMatch", false);
+    addParameter(m_index_params.type, "FLANNIndexType", std::string("KDTree"));
+    addParameter(m_index_params.checks, "FLANNChecks", 128);
+    addParameter(m_index_params.hnsw_m, "HNSWM", 16);
+    addParameter(m_index_params.hnsw_ef_construction, "HNSWEfConstruction", 200);
+    addParameter(m_index_params.hnsw_ef_search, "HNSWEfSearch", 128);
+    addParameter(m_index_params.mih_tables, "MIHTables", 0);
+    addParameter(m_index_params.embed_histograms, "FLANNEmbedHistograms", false);
+    addParameter(m_index_params.embedding_order, "FLANNEmbeddingOrder", 2);
+    addParameter(m_index_params.embedding_rerank, "FLANNEmbeddingRerank", 0);
+    addParameter(m_feature_cache_directory, "FeatureCacheDirectory", std::string(""));
+    addParameter(m_streaming_training, "StreamingTraining", false);
+    addParameter(m_feature_store_directory, "FeatureStoreDirectory", std::string(""));
+    addParameter(m_feature_store_memory_mb, "FeatureStoreMemoryMB", 4096);
+    addParameter(m_checkpoint_directory, "CheckpointDirectory", std::string(""));
+    addParameter(m_use_feature_deduplication, "UseFeatureDeduplication", false);
+    addParameter(m_deduplication_descriptor_distance, "DeduplicationDescriptorDistance", 0.01f);
+    addParameter(m_deduplication_vote_distance, "DeduplicationVoteDistance", 0.005f);
+    addParameter(m_anytime_levels, "AnytimeLevels", 3);
+    addParameter(m_streaming_leaf_size, "StreamingLeafSize", 0.05f);
+    addParameter(m_streaming_change_tolerance, "StreamingChangeTolerance", 0.1f);
+    addParameter(m_detection_tile_size, "DetectionTileSize", 0.0f);
+    addParameter(m_detection_tile_workers, "DetectionTileWorkers", 1);
+    addParameter(m_trace_file, "TraceFile", std::string(""));
+    addParameter(m_voting_report, "VotingReport", false);
+    addParameter(m_voting_report_top_codewords, "VotingReportTopCodewords", 10);
+    addParameter(m_flat_model, "FlatModel", false);
+    addParameter(m_flat_model_prefetch, "FlatModelPrefetch", std::string("None"));
+    addParameter(m_flat_model_huge_pages, "FlatModelHugePages", false);
+    addParameter(m_compress_model, "CompressModel", false);
+    addParameter(m_use_projection, "UseDescriptorProjection", false);
+    addParameter(m_projection_whitening, "ProjectionWhitening", false);
+    addParameter(m_projection_variance, "ProjectionVariance", 0.95f);
+    addParameter(m_projection_max_dim, "ProjectionMaxDim", 0);
+    addParameter(m_projection_samples, "ProjectionSamples", 50000);
+    addParameter(m_lean_output, "LeanOutput", false);
+    addParameter(m_use_class_cascade, "UseClassCascade", false);
+    addParameter(m_cascade_fraction, "CascadeCodebookFraction", 0.02f);
+    addParameter(m_cascade_top_classes, "CascadeTopClasses", 5);
+    addParameter(m_use_feature_rejection, "UseFeatureRejection", false);
+    addParameter(m_feature_rejection_rate, "FeatureRejectionRate", 0.0f);
+    addParameter(m_feature_rejection_samples, "FeatureRejectionSamples", 50000);
 
     init();
 }
@@ -126,6 +219,19 @@ void ImplicitShapeModel::setLogging(bool l)
         log4cxx::Logger::getRootLogger()->setLevel(log4cxx::Level::getWarn());
 }
 
+void ImplicitShapeModel::setObserver(std::shared_ptr<DetectionObserver> observer)
+{
+    // results still pending for the previous observer are discarded
+    m_dispatcher.reset();
+    if (observer)
+        m_dispatcher.reset(new ObserverDispatcher(observer));
+}
+
+std::shared_ptr<VotingCapture> ImplicitShapeModel::getVotingCapture() const
+{
+    return m_capture;
+}
+
 void ImplicitShapeModel::init()
 {
     iPostInitConfig();
@@ -134,6 +240,8 @@ void ImplicitShapeModel::init()
     m_index_created = false;
 
     m_processing_times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    m_num_traces = 0;
+    m_estimators.reset(new EstimatorCache());
 
     m_codebook = new Codebook();
     m_keypointsDetector = new KeypointsVoxelGrid();
@@ -148,9 +256,19 @@ void ImplicitShapeModel::clear()
 {
     m_trainingModelsFilenames.clear();
     m_trainingModelHasNormals.clear();
+    m_feature_shards.clear();
     m_codebook->clear();
     m_clustering->clear();
     m_voting->clear();
+    m_tuning_descriptors.clear();
+    m_tuning_codeword_ids.clear();
+    m_projection.clear();
+    m_feature_rejection.clear();
+}
+
+void ImplicitShapeModel::setLoadClasses(const std::set<unsigned>& classIds)
+{
+    m_load_classes = classIds;
 }
 
 bool ImplicitShapeModel::addTrainingModel(const std::string& filename, unsigned classId)
@@ -163,51 +281,127 @@ bool ImplicitShapeModel::addTrainingModel(const std::string& filename, unsigned
     return true;
 }
 
-pcl::PointCloud<PointNormalT>::Ptr ImplicitShapeModel::loadPointCloud(const std::string& filename)
+void ImplicitShapeModel::addFeatureShard(const std::string& filename)
 {
-    pcl::PointCloud<PointNormalT>::Ptr pointCloud(new pcl::PointCloud<PointNormalT>());
+    m_feature_shards.push_back(filename);
+}
 
-    // filename needs to have at least an extension like .pcd or .ply
-    if (filename.size() < 5) {
-        LOG_ERROR("invalid filename: " << filename);
-        return pcl::PointCloud<PointNormalT>::Ptr();
+void ImplicitShapeModel::extractFeatureShard(const std::string& filename, int shardIndex, int numShards)
+{
+    if (numShards < 1 || shardIndex < 0 || shardIndex >= numShards)
+        throw BadParamException("invalid feature shard " + std::to_string(shardIndex) + " of " + std::to_string(numShards));
+
+    FeatureShard shard;
+    shard.key = getFeatureShardKey();
+    shard.shard_index = shardIndex;
+    shard.num_shards = numShards;
+
+    // select the slice of the training models, the models of all classes are distributed round robin
+    std::map<unsigned, std::vector<std::string> > allFilenames;
+    std::map<unsigned, std::vector<bool> > allHaveNormals;
+    allFilenames.swap(m_trainingModelsFilenames);
+    allHaveNormals.swap(m_trainingModelHasNormals);
+    int modelNumber = 0;
+    for (auto it = allFilenames.begin(); it != allFilenames.end(); it++)
+    {
+        for (int j = 0; j < (int)it->second.size(); j++)
+        {
+            if (modelNumber++ % numShards != shardIndex)
+                continue;
+            m_trainingModelsFilenames[it->first].push_back(it->second[j]);
+            m_trainingModelHasNormals[it->first].push_back(allHaveNormals[it->first][j]);
+            shard.model_indices[it->first].push_back(j);
+        }
     }
 
-    std::string extension = filename.substr(filename.size() - 4, 4);
+    LOG_INFO("computing feature shard " << shardIndex + 1 << " of " << numShards << " with " << modelNumber / numShards +
+             (modelNumber % numShards > shardIndex ? 1 : 0) << " of " << modelNumber << " models");
 
-    // load the point cloud
-    if (extension == ".pcd") {
-        if (pcl::io::loadPCDFile(filename, *pointCloud) < 0) {
-            LOG_ERROR("could not load pcd file: " << filename);
-            return pcl::PointCloud<PointNormalT>::Ptr();
-        }
-    }
-    else if (extension == ".ply") {
-        if (pcl::io::loadPLYFile(filename, *pointCloud) < 0) {
-            LOG_ERROR("could not load ply file: " << filename);
-            return pcl::PointCloud<PointNormalT>::Ptr();
-        }
+    boost::timer::cpu_timer timer;
+    try
+    {
+        if (!m_trainingModelsFilenames.empty())
+            computeTrainingData(0, timer, shard.features, shard.global_features, shard.bounding_boxes);
     }
-    else {
-        LOG_ERROR("Unknown extension: " << extension);
-        return pcl::PointCloud<PointNormalT>::Ptr();
+    catch (...)
+    {
+        m_trainingModelsFilenames.swap(allFilenames);
+        m_trainingModelHasNormals.swap(allHaveNormals);
+        throw;
     }
+    m_trainingModelsFilenames.swap(allFilenames);
+    m_trainingModelHasNormals.swap(allHaveNormals);
 
-    if (pointCloud->size() == 0) {
-        LOG_ERROR("point cloud is empty");
-        return pcl::PointCloud<PointNormalT>::Ptr();
-    }
+    if (!shard.write(filename))
+        throw RuntimeException("could not write feature shard: " + filename);
+    LOG_INFO("feature shard written to " << filename << ", elapsed time: " << getElapsedTime(timer, "seconds") << " [s]");
+}
+
+void ImplicitShapeModel::cacheTrainingFeatures()
+{
+    if (m_feature_cache_directory.empty())
+        throw BadParamException("caching training features needs a FeatureCacheDirectory");
+
+    LOG_INFO("caching the features of the training models in " << m_feature_cache_directory);
+    boost::timer::cpu_timer timer;
+    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > features;
+    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > globalFeatures;
+    std::map<unsigned, std::vector<Utils::BoundingBox> > boundingBoxes;
+    if (!m_trainingModelsFilenames.empty())
+        computeTrainingData(0, timer, features, globalFeatures, boundingBoxes);
+    LOG_INFO("training features cached, elapsed time: " << getElapsedTime(timer, "seconds") << " [s]");
+}
+
+pcl::PointCloud<PointNormalT>::Ptr ImplicitShapeModel::loadPointCloud(const std::string& filename, bool *hasNormals)
+{
+    return PointCloudLoader::load(filename, hasNormals);
+}
+
+std::shared_ptr<DetectionSession> ImplicitShapeModel::createSession()
+{
+    createDetectionIndex();
+    return std::shared_ptr<DetectionSession>(new DetectionSession(*this));
+}
+
+std::future<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > >
+ImplicitShapeModel::detectAsync(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals,
+                                const CancellationToken &token)
+{
+    // the session is owned by the task
+    std::shared_ptr<DetectionSession> session = createSession();
+    return std::async(std::launch::async, [session, pointCloud, hasNormals, token]()
+    {
+        CancellationToken::Scope scope(token);
+        return session->detect(pointCloud, hasNormals);
+    });
+}
+
+std::shared_ptr<StreamingDetector> ImplicitShapeModel::createStreamingDetector()
+{
+    createDetectionIndex();
+    return std::shared_ptr<StreamingDetector>(new StreamingDetector(*this));
+}
 
-    return pointCloud;
+std::shared_ptr<PointCloudLoader> ImplicitShapeModel::createPointCloudLoader(const std::vector<std::string>& filenames) const
+{
+    return std::make_shared<PointCloudLoader>(filenames, m_prefetchClouds, (std::size_t)m_prefetchMemoryMB * 1024 * 1024);
+}
+
+std::shared_ptr<FeatureStore> ImplicitShapeModel::createFeatureStore() const
+{
+    return std::make_shared<FeatureStore>(m_feature_store_directory, (std::size_t)m_feature_store_memory_mb * 1024 * 1024);
 }
 
 
 void ImplicitShapeModel::train()
 {
+    ThreadScope threads(m_numThreads, m_cpus);
+    ProfilerStage profilerStage("training_data");
+
     // clear data
     m_codebook->clear();
 
-    if (m_trainingModelsFilenames.size() == 0) {
+    if (m_trainingModelsFilenames.size() == 0 && m_feature_shards.empty()) {
         LOG_WARN("no training models found");
         return;
     }
@@ -221,167 +415,556 @@ void ImplicitShapeModel::train()
     std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > globalFeatures;
     std::map<unsigned, std::vector<Utils::BoundingBox> > boundingBoxes;
 
-    // compute features for all models and all classes
-    for (auto it = m_trainingModelsFilenames.begin(); it != m_trainingModelsFilenames.end(); it++)
+    // in streaming training the local features are kept in a store that writes them to disk beyond its budget
+    std::shared_ptr<FeatureStore> featureStore;
+    if (m_streaming_training)
+        featureStore = createFeatureStore();
+
+    // resume after the last stage whose checkpoint matches the configuration, a stage is only resumed if the
+    // checkpoints of the stages it reads match as well
+    std::shared_ptr<TrainingCheckpoint> checkpoint;
+    std::vector<std::string> checkpointKeys;
+    int resumeStage = -1;
+    if (!m_checkpoint_directory.empty() && featureStore)
     {
-        unsigned classId = it->first;
+        LOG_WARN("training checkpoints are not supported in streaming training");
+    }
+    else if (!m_checkpoint_directory.empty())
+    {
+        checkpoint = std::make_shared<TrainingCheckpoint>(m_checkpoint_directory);
+        checkpointKeys = getCheckpointKeys();
+        std::vector<bool> valid(TrainingCheckpoint::NumStages);
+        for (int stage = 0; stage < TrainingCheckpoint::NumStages; stage++)
+            valid[stage] = checkpoint->isValid((TrainingCheckpoint::Stage)stage, checkpointKeys[stage]);
+
+        // all stages need the bounding boxes and global features, the clustering needs the ranked features
+        if (valid[TrainingCheckpoint::TrainingData])
+        {
+            // the projection is fitted on the ranked features and is not part of the activation checkpoint
+            if (valid[TrainingCheckpoint::Activation] && !m_use_projection)
+                resumeStage = TrainingCheckpoint::Activation;
+            else if (valid[TrainingCheckpoint::Ranking])
+                resumeStage = valid[TrainingCheckpoint::Clustering] ? TrainingCheckpoint::Clustering : TrainingCheckpoint::Ranking;
+            else
+                resumeStage = TrainingCheckpoint::TrainingData;
+            LOG_INFO("resuming training after stage " << TrainingCheckpoint::getStageName((TrainingCheckpoint::Stage)resumeStage));
+        }
+    }
+
+    if (resumeStage >= TrainingCheckpoint::TrainingData)
+    {
+        // the local features are only needed if the ranking is computed
+        if (!checkpoint->loadTrainingData(checkpointKeys[TrainingCheckpoint::TrainingData],
+                                          resumeStage == TrainingCheckpoint::TrainingData ? &features : 0,
+                                          globalFeatures, boundingBoxes))
+            throw RuntimeException("could not read the training data checkpoint");
+    }
+    else
+    {
+        if (!m_feature_shards.empty())
+            loadFeatureShards(featureStore.get(), features, globalFeatures, boundingBoxes);
+        else
+            computeTrainingData(featureStore.get(), timer, features, globalFeatures, boundingBoxes);
+        if (checkpoint)
+            checkpoint->storeTrainingData(checkpointKeys[TrainingCheckpoint::TrainingData], features, globalFeatures, boundingBoxes);
+    }
 
-        LOG_ASSERT(m_trainingModelsFilenames.size() == m_trainingModelHasNormals.size());
+    // estimated sizes of the data held after each stage, the feature store accounts for its features itself
+    MemoryReport memoryReport;
+    if (!featureStore)
+        memoryReport.add("training data", "local features", MemoryReport::estimateBytes(features));
+    memoryReport.add("training data", "global features", MemoryReport::estimateBytes(globalFeatures));
+    memoryReport.endStage("training data");
+    profilerStage.next("svm");
 
-        const std::vector<std::string>& model_filenames = it->second;
-        const std::vector<bool>& modelsHaveNormals = m_trainingModelHasNormals[classId];
+    LOG_ASSERT(resumeStage > TrainingCheckpoint::TrainingData ||
+               (featureStore ? featureStore->getClassIds().size() : features.size()) == boundingBoxes.size());
 
-        LOG_ASSERT(model_filenames.size() == modelsHaveNormals.size());
+    // train SVM with global features
+    if(m_use_svm)
+    {
+        LOG_INFO("Training SVM");
+        trainSVM(globalFeatures);
+    }
 
-        LOG_INFO("-------------------------------------------------------------------");
-        LOG_INFO("training class " << classId << " with " << model_filenames.size() << " models");
+    // store average sizes as a hint for bandwidth during detection
+    m_voting->determineAverageBoundingBoxDimensions(boundingBoxes);
+    // forward global feature to voting class to store them
+    m_voting->forwardGlobalFeatures(globalFeatures);
 
-        for (int j = 0; j < (int)model_filenames.size(); j++)
+    if (resumeStage < TrainingCheckpoint::Activation)
+    {
+        profilerStage.next("ranking");
+
+        // collapse near duplicate features of each class, the ranking checkpoint contains the deduplicated features
+        if (m_use_feature_deduplication && resumeStage < TrainingCheckpoint::Ranking)
+            deduplicateFeatures(featureStore.get(), features, boundingBoxes);
+
+        LOG_INFO("computing feature ranking");
+        m_feature_rejection.clear();
+        // remove features with low scores
+        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > features_ranked;
+        pcl::PointCloud<ISMFeature>::Ptr allFeatures_ranked(new pcl::PointCloud<ISMFeature>());
+        std::vector<unsigned> allFeatureClasses_ranked;
+        std::shared_ptr<FeatureStore> rankedFeatureStore;
+        m_featureRanking->setNumThreads(m_numThreads);
+
+        // without clustering the codewords are the ranked features, so the index the ranking builds on all features
+        // is the codeword index if the ranking keeps every feature and the index types match
+        const bool shareIndex = m_clustering->getType() == "None" &&
+                m_distance->getType() == DistanceEuclidean::getTypeStatic() && m_index_params.type == "KDTree";
+        m_featureRanking->setSharedIndexParams(shareIndex ? m_distance->getType() : "", m_index_params);
+        std::shared_ptr<FlannHelper> sharedIndex;
+
+        if (m_use_feature_rejection && (resumeStage >= TrainingCheckpoint::Ranking || m_featureRanking->keepsAllFeatures()))
+            LOG_WARN("the feature rejection is fitted on the features removed by the ranking, no feature rejection is fitted");
+
+        if (resumeStage >= TrainingCheckpoint::Ranking)
         {
-            pcl::PointCloud<PointNormalT>::Ptr model = loadPointCloud(model_filenames[j]);
+            if (!checkpoint->loadRanking(checkpointKeys[TrainingCheckpoint::Ranking], features_ranked))
+                throw RuntimeException("could not read the ranking checkpoint");
 
-            if(m_setColorToZero)
+            // the list of all ranked features follows the order of the ranked features per model
+            for (auto it = features_ranked.begin(); it != features_ranked.end(); it++)
+            {
+                for (const pcl::PointCloud<ISMFeature>::Ptr &modelFeatures : it->second)
+                {
+                    allFeatures_ranked->insert(allFeatures_ranked->end(), modelFeatures->begin(), modelFeatures->end());
+                    allFeatureClasses_ranked.insert(allFeatureClasses_ranked.end(), modelFeatures->size(), it->first);
+                }
+            }
+        }
+        else if (featureStore && m_featureRanking->keepsAllFeatures())
+        {
+            // the stored features are the ranked features, only the list of all features for clustering is created
+            rankedFeatureStore = featureStore;
+            allFeatures_ranked->reserve(featureStore->getNumFeatures());
+            for (unsigned classId : featureStore->getClassIds())
             {
-                LOG_INFO("Setting color to 0 in loaded model");
-                for(int i = 0; i < model->size(); i++)
+                for (int i = 0; i < featureStore->getNumModels(classId); i++)
                 {
-                    model->at(i).r = 0;
-                    model->at(i).g = 0;
-                    model->at(i).b = 0;
+                    pcl::PointCloud<ISMFeature>::Ptr modelFeatures = featureStore->load(classId, i);
+                    allFeatures_ranked->insert(allFeatures_ranked->end(), modelFeatures->begin(), modelFeatures->end());
+                    allFeatureClasses_ranked.insert(allFeatureClasses_ranked.end(), modelFeatures->size(), classId);
                 }
             }
+        }
+        else if (featureStore)
+        {
+            // the ranking needs all features, only the ranked features are kept afterwards
+            features = featureStore->loadAll();
+            featureStore.reset();
+
+            std::vector<int> selected = (*m_featureRanking)(features, m_num_kd_trees, m_flann_exact_match, m_index_params.checks);
+            if (m_use_feature_rejection)
+                fitFeatureRejection(features, selected);
+            FeatureRanking::selectFeatures(features, selected, features_ranked, allFeatures_ranked, allFeatureClasses_ranked);
+            sharedIndex = m_featureRanking->takeSharedIndex();
+            features.clear();
+
+            rankedFeatureStore = createFeatureStore();
+            for (auto it = features_ranked.begin(); it != features_ranked.end(); it++)
+            {
+                for (int i = 0; i < (int)it->second.size(); i++)
+                    rankedFeatureStore->store(it->first, i, it->second[i]);
+            }
+            features_ranked.clear();
+        }
+        else
+        {
+            std::vector<int> selected = (*m_featureRanking)(features, m_num_kd_trees, m_flann_exact_match, m_index_params.checks);
+            if (m_use_feature_rejection)
+                fitFeatureRejection(features, selected);
+            FeatureRanking::selectFeatures(features, selected, features_ranked, allFeatures_ranked, allFeatureClasses_ranked);
+            sharedIndex = m_featureRanking->takeSharedIndex();
+
+            // models that were selected completely are shared with the ranked features
+            features.clear();
+            if (checkpoint)
+                checkpoint->storeRanking(checkpointKeys[TrainingCheckpoint::Ranking], features_ranked);
+        }
+        // the codewords, their activation and the index are computed in the projected descriptor space
+        m_projection.clear();
+        if (m_use_projection && !allFeatures_ranked->empty())
+        {
+            LOG_INFO("fitting descriptor projection");
+            fitProjection(*allFeatures_ranked);
+            if (m_projection.isTrained())
+            {
+                m_projection.project(*allFeatures_ranked, m_numThreads);
+                projectTrainingFeatures(features_ranked, rankedFeatureStore);
+                sharedIndex.reset(); // built on the original descriptors
+            }
+        }
 
-            // compute bounding box
-            Utils::BoundingBox boundingBox;
-            if (m_bbType == "MVBB")
-                boundingBox = Utils::computeMVBB<PointNormalT>(model);
-            else if (m_bbType == "AABB")
-                boundingBox = Utils::computeAABB<PointNormalT>(model);
-            else
-                throw BadParamExceptionType<std::string>("invalid bounding box type", m_bbType);
+        memoryReport.add("ranking", "ranked features", MemoryReport::estimateBytes(features_ranked));
+        memoryReport.add("ranking", "list of ranked features", MemoryReport::estimateBytes(*allFeatures_ranked));
+        memoryReport.endStage("ranking");
+        profilerStage.next("clustering");
 
-            if(m_enable_signals)
+        // cluster descriptors and extract cluster centers
+        std::vector<std::vector<float> > resumedCenters;
+        std::vector<int> resumedIndices;
+        if (resumeStage == TrainingCheckpoint::Clustering)
+        {
+            if (!checkpoint->loadClustering(checkpointKeys[TrainingCheckpoint::Clustering], resumedCenters, resumedIndices))
+                throw RuntimeException("could not read the clustering checkpoint");
+        }
+        else
+        {
+            LOG_INFO("clustering");
+            if (!allFeatures_ranked->empty())
+                m_distance->setDimension((int)allFeatures_ranked->at(0).descriptor.size());
+            (*m_clustering)(allFeatures_ranked, m_distance);
+            if (checkpoint)
+                checkpoint->storeClustering(checkpointKeys[TrainingCheckpoint::Clustering],
+                                            m_clustering->getClusterCenters(), m_clustering->getClusterIndices());
+        }
+        const bool resumedClustering = resumeStage == TrainingCheckpoint::Clustering;
+        const std::vector<std::vector<float> >& clusterCenters = resumedClustering ? resumedCenters : m_clustering->getClusterCenters();
+        const std::vector<int>& clusterIndices = resumedClustering ? resumedIndices : m_clustering->getClusterIndices();
+
+        // compute which cluster indices are assigned which feature indices
+        std::vector<std::vector<int> > clusters(clusterCenters.size()); // each position: list of feature indices of a cluster
+        for (int i = 0; i < (int)allFeatures_ranked->size(); i++)
+        {
+            int clusterIndex = clusterIndices[i]; // this index indicates which cluster the feature i belongs to
+            clusters[clusterIndex].push_back(i);
+        }
+        // NOTE: if no clustering is used, clusterIndices are just ascending numbers (0, 1, 2, 3, ...)
+        // in that case, clusters at each position have size == 1
+        LOG_ASSERT(clusterIndices.size() == allFeatures_ranked->size());
+
+        std::size_t centerBytes = clusterCenters.capacity() * sizeof(std::vector<float>);
+        for (const std::vector<float>& center : clusterCenters)
+            centerBytes += center.capacity() * sizeof(float);
+        memoryReport.add("clustering", "cluster centers", centerBytes);
+        memoryReport.add("clustering", "cluster indices", clusterIndices.capacity() * sizeof(int));
+        memoryReport.endStage("clustering");
+        profilerStage.next("codewords");
+
+        // create codewords and add them to the codebook - NOTE: if no clustering is used: a codeword is just one feature and its center vector
+        LOG_INFO("creating codewords");
+        std::vector<std::shared_ptr<Codeword> > codewords;
+        for (int i = 0; i < (int)clusterCenters.size(); i++)
+        {
+            // init with uniform weights, deduplicated features contribute the number of features they stand for
+            float weight = 0;
+            for (int j = 0; j < (int)clusters[i].size(); j++)
+                weight += allFeatures_ranked->at(clusters[i][j]).weight;
+            weight = clusters[i].empty() ? 1.0f : weight / clusters[i].size();
+            std::shared_ptr<Codeword> codeword(new Codeword(clusterCenters[i], clusters[i].size(), weight));
+
+            for (int j = 0; j < (int)clusters[i].size(); j++)
             {
-                timer.stop();
-                m_signalBoundingBox(boundingBox);
-                timer.resume();
+                codeword->addFeature(allFeatures_ranked->at(clusters[i][j]).getVector3fMap(),
+                                     allFeatureClasses_ranked[clusters[i][j]]);
             }
+            codewords.push_back(codeword);
+        }
+
+        // keep a sample of the training descriptors for tuning the index, a descriptor that forms a codeword on its
+        // own is identical to the codeword and is excluded from its neighbors during tuning
+        const int maxTuningDescriptors = 10000;
+        std::vector<int> samples(allFeatures_ranked->size());
+        std::iota(samples.begin(), samples.end(), 0);
+        std::mt19937 rng(42);
+        std::shuffle(samples.begin(), samples.end(), rng);
+        const int numTuningSamples = std::min((int)samples.size(), maxTuningDescriptors);
+        m_tuning_descriptors.clear();
+        m_tuning_codeword_ids.clear();
+        for(int s = 0; s < numTuningSamples; s++)
+        {
+            int clusterIndex = clusterIndices[samples[s]];
+            m_tuning_descriptors.push_back(allFeatures_ranked->at(samples[s]).descriptor);
+            m_tuning_codeword_ids.push_back(clusters[clusterIndex].size() == 1 ? codewords[clusterIndex]->getId() : -1);
+        }
 
-            // check first normal
-            bool hasNormals = modelsHaveNormals[j];
-            if (hasNormals) {
-                const PointNormalT& firstNormal = model->at(0);
-                if (firstNormal.normal_x == 0 && firstNormal.normal_y == 0 && firstNormal.normal_z == 0 ||
-                        pcl_isnan(firstNormal.normal_x) ||
-                        pcl_isnan(firstNormal.normal_y) ||
-                        pcl_isnan(firstNormal.normal_z) ||
-                        pcl_isnan(firstNormal.curvature)
-                        )
-                    hasNormals = false;
+        // a sample of the training features acts as held out data for pruning the codebook, each feature only
+        // activates the codewords besides the one of its cluster
+        const int dim = codewords.at(0)->getData().size();
+        std::vector<float> pruneDescriptors;
+        std::vector<unsigned> pruneClasses;
+        std::vector<int> pruneCodewordIds;
+        if(m_codebook->usePruning())
+        {
+            const int numPruneSamples = std::min((int)samples.size(), std::max(m_codebook->getPruneSamples(), 0));
+            pruneDescriptors.reserve((size_t)numPruneSamples * dim);
+            for(int s = 0; s < numPruneSamples; s++)
+            {
+                const std::vector<float>& descriptor = allFeatures_ranked->at(samples[s]).descriptor;
+                pruneDescriptors.insert(pruneDescriptors.end(), descriptor.begin(), descriptor.begin() + dim);
+                pruneClasses.push_back(allFeatureClasses_ranked[samples[s]]);
+                pruneCodewordIds.push_back(codewords[clusterIndices[samples[s]]]->getId());
             }
+        }
 
-            // compute features
-            pcl::PointCloud<ISMFeature>::ConstPtr model_features;
-            pcl::PointCloud<ISMFeature>::ConstPtr global_features;
-            std::tie(model_features, global_features, std::ignore, std::ignore) = computeFeatures(model, hasNormals, timer, timer, true);
+        // the codewords own the cluster centers now, the list of all features was only needed for clustering, the
+        // activation uses the ranked features per class
+        m_clustering->clear();
+        std::vector<std::vector<float> >().swap(resumedCenters);
+        std::vector<int>().swap(resumedIndices);
+        std::vector<std::vector<int> >().swap(clusters);
+        allFeatures_ranked.reset();
+        allFeatureClasses_ranked.clear();
+        allFeatureClasses_ranked.shrink_to_fit();
+
+        std::size_t codewordBytes = 0;
+        for (const std::shared_ptr<Codeword>& codeword : codewords)
+        {
+            codewordBytes += sizeof(Codeword) + codeword->getData().capacity() * sizeof(float) +
+                    codeword->getFeaturePositions().capacity() * sizeof(Eigen::Vector3f) +
+                    codeword->getFeatureClasses().capacity() * sizeof(unsigned);
+        }
+        std::size_t tuningBytes = 0;
+        for (const std::vector<float>& descriptor : m_tuning_descriptors)
+            tuningBytes += descriptor.capacity() * sizeof(float);
+        memoryReport.add("codewords", "codewords", codewordBytes);
+        memoryReport.add("codewords", "index tuning descriptors", tuningBytes);
+        memoryReport.endStage("codewords");
+        profilerStage.next("index");
+
+        LOG_INFO("activating codewords");
+        if (sharedIndex && sharedIndex->dataset.rows == codewords.size() &&
+                sharedIndex->dataset.cols == codewords.at(0)->getData().size())
+        {
+            // the rows of the ranking index are the codewords in codebook order, its dataset is the ranking's block
+            LOG_INFO("reusing the index of the feature ranking for the codewords");
+            sharedIndex->setCodewords(codewords);
+            m_flann_helper = sharedIndex;
+        }
+        else
+        {
+            m_flann_helper = std::make_shared<FlannHelper>(codewords.at(0)->getData().size(), codewords.size());
+            m_flann_helper->createDataset(codewords);
+            m_flann_helper->buildIndex(m_distance->getType(), m_index_params);
+        }
+        sharedIndex.reset();
+        memoryReport.add("index", "index dataset", m_flann_helper->dataset.rows * m_flann_helper->dataset.cols * sizeof(float));
+        memoryReport.endStage("index");
+        profilerStage.next("activation");
 
-            // check for NAN features
-            pcl::PointCloud<ISMFeature>::Ptr modelFeatures_cleaned = removeNaNFeatures(model_features);
-            pcl::PointCloud<ISMFeature>::Ptr globalFeatures_cleaned = removeNaNFeatures(global_features);
+        if (rankedFeatureStore)
+        {
+            // the activation loads the features class by class
+            m_codebook->activate(codewords, *rankedFeatureStore, boundingBoxes, m_distance, *m_flann_helper, m_flann_exact_match);
+        }
+        else
+        {
+            m_codebook->activate(codewords, features_ranked, boundingBoxes, m_distance, *m_flann_helper, m_flann_exact_match);
+            features_ranked.clear();
+        }
 
-            if(m_enable_signals)
+        // remove the codewords of low utility and rebuild the index on the remaining ones
+        if(m_codebook->usePruning())
+        {
+            LOG_INFO("pruning codewords");
+            flann::Matrix<float> pruneQueries(pruneDescriptors.data(), pruneClasses.size(), dim);
+            if(m_codebook->prune(pruneQueries, pruneClasses, pruneCodewordIds, m_distance, *m_flann_helper, m_flann_exact_match) > 0)
             {
-                timer.stop();
-                m_signalFeatures(modelFeatures_cleaned);
-                timer.resume();
+                std::vector<std::shared_ptr<Codeword> > prunedCodewords = m_codebook->getCodewords();
+                m_flann_helper = std::make_shared<FlannHelper>(prunedCodewords.at(0)->getData().size(), prunedCodewords.size());
+                m_flann_helper->createDataset(prunedCodewords);
+                m_flann_helper->buildIndex(m_distance->getType(), m_index_params);
+
+                // tuning descriptors of removed codewords have no identical codeword any more
+                for(int &id : m_tuning_codeword_ids)
+                {
+                    if(id >= 0 && !m_codebook->containsCodewordWithId(id))
+                        id = -1;
+                }
             }
+            std::vector<float>().swap(pruneDescriptors);
+        }
 
-            // concatenate features
-            features[classId].push_back(modelFeatures_cleaned);
-            globalFeatures[classId].push_back(globalFeatures_cleaned);
-            boundingBoxes[classId].push_back(boundingBox);
+        // the codebook is stored before the compression, which only depends on the codebook
+        if (checkpoint)
+        {
+            checkpoint->storeActivation(checkpointKeys[TrainingCheckpoint::Activation], *m_codebook,
+                                        m_tuning_descriptors, m_tuning_codeword_ids);
         }
     }
+    else
+    {
+        if (!checkpoint->loadActivation(checkpointKeys[TrainingCheckpoint::Activation], *m_codebook,
+                                        m_tuning_descriptors, m_tuning_codeword_ids))
+            throw RuntimeException("could not read the activation checkpoint");
 
-    LOG_ASSERT(features.size() == boundingBoxes.size());
+        std::vector<std::shared_ptr<Codeword> > codewords = m_codebook->getCodewords();
+        m_flann_helper = std::make_shared<FlannHelper>(codewords.at(0)->getData().size(), codewords.size());
+        m_flann_helper->createDataset(codewords);
+        m_flann_helper->buildIndex(m_distance->getType(), m_index_params);
+    }
 
-    // train SVM with global features
-    if(m_use_svm)
+    // replace the codeword descriptors by compact codes, the index for detection is then built on the codes
+    if(m_codebook->useCompression())
     {
-        LOG_INFO("Training SVM");
-        trainSVM(globalFeatures);
+        m_codebook->compress();
+        if(m_codebook->isCompressed())
+            m_flann_helper.reset();
     }
 
-    // store average sizes as a hint for bandwidth during detection
-    m_voting->determineAverageBoundingBoxDimensions(boundingBoxes);
-    // forward global feature to voting class to store them
-    m_voting->forwardGlobalFeatures(globalFeatures);
+    memoryReport.add("activation", "codeword distributions", m_codebook->getMemoryUsage());
+    memoryReport.endStage("activation");
+    profilerStage.stop();
 
-    LOG_INFO("computing feature ranking"); // TODO VS: avoid copying features for ranking
-    // remove features with low scores
-    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > features_ranked;
-    pcl::PointCloud<ISMFeature>::Ptr allFeatures_ranked(new pcl::PointCloud<ISMFeature>());
-    std::vector<unsigned> allFeatureClasses_ranked;
+    // keep the index for detection and for saving, if it matches the codebook order
+    m_index_created = isFlannIndexValid();
 
-    std::tie(features_ranked, allFeatures_ranked, allFeatureClasses_ranked) =
-            (*m_featureRanking)(features, m_num_kd_trees, m_flann_exact_match);
+    // the global feature index uses the same backend whether the codeword index is kept or not
+    m_voting->setDistanceType(m_distance->getType());
+    m_voting->setIndexParams(m_index_params);
 
-    // cluster descriptors and extract cluster centers
-    LOG_INFO("clustering");
-    (*m_clustering)(allFeatures_ranked, m_distance);
-    const std::vector<std::vector<float> > clusterCenters = m_clustering->getClusterCenters();
-    const std::vector<int> clusterIndices = m_clustering->getClusterIndices();
+    // global features are stored with an index as well
+    initGlobalFeatureIndex(0);
 
-    // compute which cluster indices are assigned which feature indices
-    std::vector<std::vector<int> > clusters(clusterCenters.size()); // each position: list of feature indices of a cluster
-    for (int i = 0; i < (int)allFeatures_ranked->size(); i++)
+    if(m_enable_signals)
     {
-        int clusterIndex = clusterIndices[i]; // this index indicates which cluster the feature i belongs to
-        clusters[clusterIndex].push_back(i);
+        timer.stop();
+        m_signalCodebook(*m_codebook);
+        timer.resume();
     }
-    // NOTE: if no clustering is used, clusterIndices are just ascending numbers (0, 1, 2, 3, ...)
-    // in that case, clusters at each position have size == 1
-    LOG_ASSERT(clusterIndices.size() == allFeatures_ranked->size());
 
+    // cpu time (%t) sums up the time used by all threads, so use wall time (%w) instead to show
+    // performance increase in multithreading
+    LOG_INFO("training processing time: " << timer.format(4, "%w") << " seconds");
+    LOG_INFO("total processing time: " << timer_all.format(4, "%w") << " seconds");
+    memoryReport.log();
+}
 
-    // create codewords and add them to the codebook - NOTE: if no clustering is used: a codeword is just one feature and its center vector
-    LOG_INFO("creating codewords");
-    std::vector<std::shared_ptr<Codeword> > codewords;
-    for (int i = 0; i < (int)clusterCenters.size(); i++)
-    {
-        std::shared_ptr<Codeword> codeword(new Codeword(clusterCenters[i], clusters[i].size(), 1.0f)); // init with uniform weights
 
-        for (int j = 0; j < (int)clusters[i].size(); j++)
-        {
-            codeword->addFeature(allFeatures_ranked->at(clusters[i][j]).getVector3fMap(),
-                                 allFeatureClasses_ranked[clusters[i][j]]);
-        }
-        codewords.push_back(codeword);
+bool ImplicitShapeModel::trainIncremental()
+{
+    ThreadScope threads(m_numThreads, m_cpus);
+    if (m_codebook->getSize() == 0) {
+        LOG_WARN("the codebook is not trained, use train() instead");
+        return false;
+    }
+    if (m_codebook->isCompressed()) {
+        LOG_WARN("models can not be added to a compressed codebook");
+        return false;
+    }
+    if (m_trainingModelsFilenames.size() == 0) {
+        LOG_WARN("no training models found");
+        return false;
     }
 
-    LOG_INFO("activating codewords");
-    m_flann_helper = std::make_shared<FlannHelper>(codewords.at(0)->getData().size(), codewords.size());
-    m_flann_helper->createDataset(codewords);
-    m_flann_helper->buildIndex(m_distance->getType(), m_num_kd_trees);
+    // measure the time
+    boost::timer::cpu_timer timer;
+    boost::timer::cpu_timer timer_all;
 
-    // create index depending on distance type
-    if(m_distance->getType() == "Euclidean")
-    {
-        m_codebook->activate(codewords, features_ranked, boundingBoxes, m_distance, *m_flann_helper->getIndexL2(), m_flann_exact_match);
-    }
-    else if(m_distance->getType() == "ChiSquared")
+    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > features;
+    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > globalFeatures;
+    std::map<unsigned, std::vector<Utils::BoundingBox> > boundingBoxes;
+
+    std::shared_ptr<FeatureStore> featureStore;
+    if (m_streaming_training)
+        featureStore = createFeatureStore();
+
+    computeTrainingData(featureStore.get(), timer, features, globalFeatures, boundingBoxes);
+    if (m_projection.isTrained())
+        projectTrainingFeatures(features, featureStore);
+
+    LOG_ASSERT((featureStore ? featureStore->getClassIds().size() : features.size()) == boundingBoxes.size());
+
+    // the ranking scores features against all features of the training set, which is not available anymore
+    LOG_INFO("feature ranking is not applied to the added models");
+
+    // visits the features of all added models in the order of classes and models
+    auto forEachModel = [&](const std::function<void(unsigned, const pcl::PointCloud<ISMFeature>&)> &visit)
     {
-        m_codebook->activate(codewords, features_ranked, boundingBoxes, m_distance, *m_flann_helper->getIndexChi(), m_flann_exact_match);
-    }
-    else if(m_distance->getType() == "Hellinger")
+        if (featureStore)
+        {
+            for (unsigned classId : featureStore->getClassIds())
+            {
+                for (int i = 0; i < featureStore->getNumModels(classId); i++)
+                    visit(classId, *featureStore->load(classId, i));
+            }
+        }
+        else
+        {
+            for (auto it = features.begin(); it != features.end(); it++)
+            {
+                for (const pcl::PointCloud<ISMFeature>::Ptr &modelFeatures : it->second)
+                    visit(it->first, *modelFeatures);
+            }
+        }
+    };
+
+    std::vector<std::shared_ptr<Codeword> > codewords = m_codebook->getCodewords();
+    const int descriptorSize = codewords.at(0)->getData().size();
+
+    if (m_clustering->getType() == "None")
     {
-        m_codebook->activate(codewords, features_ranked, boundingBoxes, m_distance, *m_flann_helper->getIndexHel(), m_flann_exact_match);
+        // without clustering each feature forms a codeword, the new codewords are appended to the trained ones
+        LOG_INFO("creating codewords");
+        forEachModel([&](unsigned classId, const pcl::PointCloud<ISMFeature> &modelFeatures)
+        {
+            for (const ISMFeature &feature : modelFeatures.points)
+            {
+                std::shared_ptr<Codeword> codeword(new Codeword(feature.descriptor, 1, 1.0f));
+                codeword->addFeature(feature.getVector3fMap(), classId);
+                codewords.push_back(codeword);
+            }
+        });
+
+        // the index types have no common way to add points, so the index is rebuilt on all codewords
+        m_flann_helper = std::make_shared<FlannHelper>(descriptorSize, codewords.size());
+        m_flann_helper->createDataset(codewords);
+        m_flann_helper->buildIndex(m_distance->getType(), m_index_params);
     }
-    else if(m_distance->getType() == "HistIntersection")
+    else
     {
-        m_codebook->activate(codewords, features_ranked, boundingBoxes, m_distance, *m_flann_helper->getIndexHist(), m_flann_exact_match);
+        // the cluster centers are kept, each new feature is assigned to its nearest codeword
+        if (!isFlannIndexValid())
+        {
+            m_flann_helper = std::make_shared<FlannHelper>(descriptorSize, codewords.size());
+            m_flann_helper->createDataset(codewords);
+            m_flann_helper->buildIndex(m_distance->getType(), m_index_params);
+        }
+
+        LOG_INFO("assigning features to codewords");
+        forEachModel([&](unsigned classId, const pcl::PointCloud<ISMFeature> &modelFeatures)
+        {
+            if (modelFeatures.empty())
+                return;
+
+            std::vector<float> descriptors(modelFeatures.size() * descriptorSize);
+            if (!FeatureBlock::copyDescriptors(modelFeatures, descriptors.data(), descriptorSize))
+                throw RuntimeException("descriptor size of the added models does not match the codebook");
+
+            flann::Matrix<float> queries(descriptors.data(), modelFeatures.size(), descriptorSize);
+            std::vector<std::vector<int> > indices;
+            std::vector<std::vector<float> > distances;
+            m_flann_helper->knnSearch(queries, indices, distances, 1, m_flann_exact_match, m_numThreads);
+
+            for (int i = 0; i < (int)modelFeatures.size(); i++)
+            {
+                if (!indices[i].empty() && indices[i][0] >= 0)
+                    codewords[indices[i][0]]->addFeature(modelFeatures.at(i).getVector3fMap(), classId);
+            }
+        });
     }
 
+    LOG_INFO("activating codewords");
+    if (featureStore)
+        m_codebook->activate(codewords, *featureStore, boundingBoxes, m_distance, *m_flann_helper, m_flann_exact_match);
+    else
+        m_codebook->activate(codewords, features, boundingBoxes, m_distance, *m_flann_helper, m_flann_exact_match);
+
+    // bounding box statistics are added for new classes, global features are added to the trained ones
+    m_voting->addAverageBoundingBoxDimensions(boundingBoxes);
+    m_voting->addGlobalFeatures(globalFeatures);
+
+    if (m_use_svm)
+        LOG_WARN("the SVM is not retrained with the added models, train from scratch to include them");
+
+    m_index_created = isFlannIndexValid();
+    m_voting->setDistanceType(m_distance->getType());
+    m_voting->setIndexParams(m_index_params);
+
+    initGlobalFeatureIndex(0);
+
     if(m_enable_signals)
     {
         timer.stop();
@@ -389,280 +972,543 @@ void ImplicitShapeModel::train()
         timer.resume();
     }
 
-    // cpu time (%t) sums up the time used by all threads, so use wall time (%w) instead to show
-    // performance increase in multithreading
     LOG_INFO("training processing time: " << timer.format(4, "%w") << " seconds");
     LOG_INFO("total processing time: " << timer_all.format(4, "%w") << " seconds");
+    return true;
 }
 
 
-bool ImplicitShapeModel::add_normals(const std::string& filename, const std::string& folder)
+void ImplicitShapeModel::computeTrainingData(FeatureStore *featureStore, boost::timer::cpu_timer &timer,
+                                             std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                             std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures,
+                                             std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes)
 {
-    pcl::PointCloud<PointNormalT>::Ptr points_in = loadPointCloud(filename);
+    // features of unchanged models and feature configurations are loaded instead of recomputed
+    std::shared_ptr<FeatureCache> featureCache;
+    if (!m_feature_cache_directory.empty())
+        featureCache.reset(new FeatureCache(m_feature_cache_directory));
 
-    if (points_in.get() == 0)
-        return false;
+    // models are loaded in the background in the order of training
+    std::vector<std::string> allFilenames;
+    for (auto it = m_trainingModelsFilenames.begin(); it != m_trainingModelsFilenames.end(); it++)
+        allFilenames.insert(allFilenames.end(), it->second.begin(), it->second.end());
+    std::shared_ptr<PointCloudLoader> loader = createPointCloudLoader(allFilenames);
 
-    if (points_in->empty())
+    LOG_ASSERT(m_trainingModelsFilenames.size() == m_trainingModelHasNormals.size());
+
+    int numWorkers = std::max(m_trainingWorkers, 1);
+    if (numWorkers > 1 && m_enable_signals)
     {
-        LOG_WARN("point cloud is empty");
+        LOG_WARN("signals are enabled, training models are processed by a single worker");
+        numWorkers = 1;
     }
 
-    // filter out nan points
-    std::vector<int> dummy;
-    pcl::PointCloud<PointNormalT>::Ptr points(new pcl::PointCloud<PointNormalT>());
-    pcl::removeNaNFromPointCloud(*points_in, *points, dummy);
-    points->is_dense = false;
-
-    pcl::search::Search<PointT>::Ptr searchTree;
-    if (points->isOrganized())
+    if (numWorkers > 1)
     {
-        searchTree = pcl::search::OrganizedNeighbor<PointT>::Ptr(new pcl::search::OrganizedNeighbor<PointT>());
+        trainFeaturesParallel(numWorkers, loader, featureCache.get(), featureStore, features, globalFeatures, boundingBoxes);
     }
     else
     {
-        searchTree = pcl::search::KdTree<PointT>::Ptr(new pcl::search::KdTree<PointT>());
-    }
+        // bounding boxes in computation, the oldest is finished first to limit the number of models kept in memory
+        struct PendingBoundingBox
+        {
+            unsigned classId;
+            int index;
+            std::future<Utils::BoundingBox> boundingBox;
+        };
+        std::deque<PendingBoundingBox> pendingBoxes;
+        const int maxPendingBoxes = std::max(omp_get_max_threads(), 1);
+
+        auto resolveBoundingBox = [&]()
+        {
+            PendingBoundingBox &pending = pendingBoxes.front();
+            Utils::BoundingBox boundingBox = pending.boundingBox.get();
+            boundingBoxes[pending.classId][pending.index] = boundingBox;
+            pendingBoxes.pop_front();
 
-    pcl::PointCloud<PointT>::Ptr pointCloud(new pcl::PointCloud<PointT>());
-    pcl::PointCloud<pcl::Normal>::Ptr normals;
-    pcl::PointCloud<PointT>::Ptr pointsWithoutNaN;
-    pcl::PointCloud<pcl::Normal>::Ptr normalsWithoutNaN;
+            if(m_enable_signals)
+            {
+                timer.stop();
+                m_signalBoundingBox(boundingBox);
+                timer.resume();
+            }
+            if(m_dispatcher)
+                m_dispatcher->postBoundingBox(boundingBox);
+        };
 
-    // extract position point cloud
-    pcl::copyPointCloud(*points, *pointCloud);
+        FeaturePipeline pipeline = getFeaturePipeline();
 
-    LOG_INFO("computing normals");
-    computeNormals(pointCloud, normals, searchTree);
+        // compute features for all models and all classes
+        for (auto it = m_trainingModelsFilenames.begin(); it != m_trainingModelsFilenames.end(); it++)
+        {
+            unsigned classId = it->first;
 
-    LOG_ASSERT(normals->size() == pointCloud->size());
+            const std::vector<std::string>& model_filenames = it->second;
+            const std::vector<bool>& modelsHaveNormals = m_trainingModelHasNormals[classId];
 
-    // filter normals with NaN and corresponding points
-    filterNormals(pointCloud, normals, pointsWithoutNaN, normalsWithoutNaN);
+            LOG_ASSERT(model_filenames.size() == modelsHaveNormals.size());
 
-    LOG_ASSERT(pointsWithoutNaN.get() != 0);
-    LOG_ASSERT(normalsWithoutNaN.get() != 0);
-    LOG_ASSERT(pointsWithoutNaN->size() == normalsWithoutNaN->size());
-
-    pcl::PointCloud<PointNormalT>::Ptr points_out(new pcl::PointCloud<PointNormalT>());
-    pcl::concatenateFields(*pointsWithoutNaN, *normalsWithoutNaN, *points_out);
+            LOG_INFO("-------------------------------------------------------------------");
+            LOG_INFO("training class " << classId << " with " << model_filenames.size() << " models");
+            boundingBoxes[classId].resize(model_filenames.size());
 
-    // save result
-    std::string file = filename.substr(filename.find_last_of('/')+1);
-    //pcl::io::savePCDFileBinary(folder+"/"+file, *points_out);
-    pcl::io::savePCDFileBinaryCompressed(folder+"/"+file, *points_out);
+            for (int j = 0; j < (int)model_filenames.size(); j++)
+            {
+                bool fileHasNormals = false;
+                pcl::PointCloud<PointNormalT>::Ptr model = loader->next(&fileHasNormals);
+                if (model.get() == 0)
+                    throw RuntimeException("could not load training model: " + model_filenames[j]);
+
+                prepareTrainingModel(*model);
+
+                // compute bounding boxes of several models in parallel while features are computed
+                if ((int)pendingBoxes.size() >= maxPendingBoxes)
+                    resolveBoundingBox();
+                PendingBoundingBox pending = {classId, j, std::async(std::launch::async,
+                                                                     &ImplicitShapeModel::computeBoundingBox, this,
+                                                                     pcl::PointCloud<PointNormalT>::ConstPtr(model))};
+                pendingBoxes.push_back(std::move(pending));
+
+                // the loader determines whether the file contains normals
+                bool hasNormals = modelsHaveNormals[j] && fileHasNormals;
+
+                pcl::PointCloud<ISMFeature>::Ptr modelFeatures_cleaned;
+                pcl::PointCloud<ISMFeature>::Ptr globalFeatures_cleaned;
+                computeTrainingFeatures(pipeline, model_filenames[j], model, hasNormals, featureCache.get(), timer,
+                                        modelFeatures_cleaned, globalFeatures_cleaned);
+
+                if(m_enable_signals)
+                {
+                    timer.stop();
+                    m_signalFeatures(modelFeatures_cleaned);
+                    timer.resume();
+                }
+                if(m_dispatcher)
+                    m_dispatcher->postFeatures(modelFeatures_cleaned);
+
+                // concatenate features
+                if (featureStore)
+                    featureStore->store(classId, j, modelFeatures_cleaned);
+                else
+                    features[classId].push_back(modelFeatures_cleaned);
+                globalFeatures[classId].push_back(globalFeatures_cleaned);
+            }
+        }
 
-    return true;
+        while (!pendingBoxes.empty())
+            resolveBoundingBox();
+    }
 }
 
-bool ImplicitShapeModel::detect(const std::string& filename, std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times)
-{
-    pcl::PointCloud<PointNormalT>::Ptr points = loadPointCloud(filename);
 
-    if(m_setColorToZero)
+void ImplicitShapeModel::loadFeatureShards(FeatureStore *featureStore,
+                                           std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                           std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures,
+                                           std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes)
+{
+    const std::string key = getFeatureShardKey();
+    std::vector<bool> merged;
+    for (const std::string &filename : m_feature_shards)
     {
-        LOG_INFO("Setting color to 0 in loaded model");
-        for(int i = 0; i < points->size(); i++)
+        FeatureShard shard;
+        if (!shard.read(filename))
+            throw RuntimeException("could not read feature shard: " + filename);
+        if (shard.key != key)
+            throw RuntimeException("feature shard " + filename + " was computed with a different feature configuration");
+
+        if (merged.empty())
+            merged.resize(shard.num_shards, false);
+        if (shard.num_shards != merged.size() || shard.shard_index >= merged.size() || merged[shard.shard_index])
+            throw RuntimeException("feature shard " + filename + " does not complement the shards merged before");
+        merged[shard.shard_index] = true;
+        LOG_INFO("merging feature shard " << shard.shard_index + 1 << " of " << shard.num_shards << " from " << filename);
+
+        // models are put at their index in the training list of their class
+        for (auto it = shard.model_indices.begin(); it != shard.model_indices.end(); it++)
         {
-            points->at(i).r = 0;
-            points->at(i).g = 0;
-            points->at(i).b = 0;
+            const unsigned classId = it->first;
+            std::vector<pcl::PointCloud<ISMFeature>::Ptr> &classGlobalFeatures = globalFeatures[classId];
+            std::vector<Utils::BoundingBox> &classBoxes = boundingBoxes[classId];
+            for (int j = 0; j < (int)it->second.size(); j++)
+            {
+                const unsigned index = it->second[j];
+                if (classGlobalFeatures.size() <= index)
+                {
+                    classGlobalFeatures.resize(index + 1);
+                    classBoxes.resize(index + 1);
+                    if (!featureStore)
+                        features[classId].resize(index + 1);
+                }
+                if (classGlobalFeatures[index])
+                    throw RuntimeException("feature shard " + filename + " contains a model merged before");
+
+                classGlobalFeatures[index] = shard.global_features[classId][j];
+                classBoxes[index] = shard.bounding_boxes[classId][j];
+                if (featureStore)
+                    featureStore->store(classId, index, shard.features[classId][j]);
+                else
+                    features[classId][index] = shard.features[classId][j];
+            }
         }
     }
 
-    if (points.get() == 0)
-        return false;
-
-    std::tie(maxima, times) = detect(points, true); // NOTE: true is assumed because of point type, needs to be checked later
-    return true;
+    if (std::find(merged.begin(), merged.end(), false) != merged.end())
+        throw RuntimeException("feature shards are missing, " + std::to_string(std::count(merged.begin(), merged.end(), true)) +
+                               " of " + std::to_string(merged.size()) + " shards given");
+    for (auto it = globalFeatures.begin(); it != globalFeatures.end(); it++)
+    {
+        if (std::find(it->second.begin(), it->second.end(), pcl::PointCloud<ISMFeature>::Ptr()) != it->second.end())
+            throw RuntimeException("feature shards are missing models of class " + std::to_string(it->first));
+    }
 }
 
-std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
-ImplicitShapeModel::detect(pcl::PointCloud<PointT>::ConstPtr points)
+void ImplicitShapeModel::deduplicateFeatures(FeatureStore *featureStore,
+                                             std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                             const std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes)
 {
-    pcl::PointCloud<PointNormalT>::Ptr pointCloud(new pcl::PointCloud<PointNormalT>());
-    pcl::copyPointCloud(*points, *pointCloud);
-    return detect(pointCloud, false);
+    LOG_INFO("deduplicating features");
+    FeatureDeduplication deduplication(*m_distance, m_deduplication_descriptor_distance, m_deduplication_vote_distance);
+    std::size_t numRemoved = 0;
+    std::size_t numFeatures = 0;
+    for (auto it = boundingBoxes.begin(); it != boundingBoxes.end(); it++)
+    {
+        const unsigned classId = it->first;
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> classFeatures = featureStore ? featureStore->loadClass(classId) : features[classId];
+        for (const pcl::PointCloud<ISMFeature>::Ptr &modelFeatures : classFeatures)
+            numFeatures += modelFeatures->size();
+        const int classRemoved = deduplication.apply(classFeatures, it->second);
+        numRemoved += classRemoved;
+        if (classRemoved == 0)
+            continue;
+
+        if (featureStore)
+        {
+            for (int i = 0; i < (int)classFeatures.size(); i++)
+                featureStore->store(classId, i, classFeatures[i]);
+        }
+        else
+        {
+            features[classId] = classFeatures;
+        }
+    }
+    LOG_INFO("removed " << numRemoved << " of " << numFeatures << " features as near duplicates");
 }
 
-std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
-ImplicitShapeModel::detect(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals)
+void ImplicitShapeModel::fitProjection(const pcl::PointCloud<ISMFeature> &features)
 {
-        /* 1.) Detect Keypoints + Keypoint-Features
-         * 2.) Activate Codebook with Keypoints
-         * 3.) Each activated Codeword casts its Activation-Distribution into Houghspace
-         * 4.) Search Houghspace for maxima
-         * 5.) The model can be considered found according to some heuristics in Houghspace
-         */
-
-    if (points_in->empty())
+    // a random sample of the features, the same for each training
+    const int dim = (int)features.at(0).descriptor.size();
+    std::vector<int> samples(features.size());
+    std::iota(samples.begin(), samples.end(), 0);
+    std::mt19937 rng(42);
+    std::shuffle(samples.begin(), samples.end(), rng);
+    const int numSamples = m_projection_samples > 0 ? std::min((int)samples.size(), m_projection_samples) : (int)samples.size();
+
+    std::vector<float> descriptors((size_t)numSamples * dim);
+    for (int s = 0; s < numSamples; s++)
     {
-        LOG_WARN("point cloud is empty");
-        return std::make_tuple(std::vector<VotingMaximum>(), m_processing_times);
+        const std::vector<float> &descriptor = features.at(samples[s]).descriptor;
+        if ((int)descriptor.size() != dim)
+            throw RuntimeException("descriptor projection needs descriptors of equal size");
+        std::copy(descriptor.begin(), descriptor.end(), descriptors.begin() + (size_t)s * dim);
     }
 
-    // measure the time
-    boost::timer::cpu_timer timer;
-    boost::timer::cpu_timer timer_features;
-
-    // filter out nan points
-    std::vector<int> dummy;
-    pcl::PointCloud<PointNormalT>::Ptr points(new pcl::PointCloud<PointNormalT>());
-    pcl::removeNaNFromPointCloud(*points_in, *points, dummy);
-    points->is_dense = false;
+    if (m_distance->getType() != DistanceEuclidean::getTypeStatic())
+        LOG_WARN("projected descriptors have negative values, the distance " << m_distance->getType() << " may not apply");
+    m_projection.fit(descriptors.data(), numSamples, dim, m_projection_variance, m_projection_max_dim, m_projection_whitening);
+}
 
-    // check first normal
-    if (hasNormals)
+void ImplicitShapeModel::fitFeatureRejection(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                             const std::vector<int> &selected)
+{
+    // the features in the order of the ranking, labeled with its selection
+    std::vector<const ISMFeature*> all;
+    for (auto it = features.begin(); it != features.end(); it++)
     {
-        const PointNormalT& firstNormal = points->at(0);
-        if (firstNormal.normal_x == 0 &&
-                firstNormal.normal_y == 0 &&
-                firstNormal.normal_z == 0 ||
-                pcl_isnan(firstNormal.normal_x) ||
-                pcl_isnan(firstNormal.curvature)
-                )
-            hasNormals = false;
+        for (const pcl::PointCloud<ISMFeature>::Ptr &modelFeatures : it->second)
+        {
+            for (const ISMFeature &feature : modelFeatures->points)
+                all.push_back(&feature);
+        }
     }
-
-    // compute features
-    pcl::PointCloud<ISMFeature>::ConstPtr features;
-    pcl::PointCloud<ISMFeature>::ConstPtr globalFeatures;
-    pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN;
-    pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN;
-    bool compute_global = m_single_object_mode;
-    boost::timer::cpu_timer timer_normals;
-    timer_normals.stop();
-    boost::timer::cpu_timer timer_keypoints;
-    timer_keypoints.stop();
-    std::tie(features, globalFeatures, pointsWithoutNaN, normalsWithoutNaN) = computeFeatures(points, hasNormals, timer_normals, timer_keypoints,
-                                                                                              compute_global);
-    m_processing_times["normals"] += getElapsedTime(timer_normals, "milliseconds");
-    m_processing_times["keypoints"] += getElapsedTime(timer_keypoints, "milliseconds");
-    m_processing_times["features"] -= getElapsedTime(timer_normals, "milliseconds");
-    m_processing_times["features"] -= getElapsedTime(timer_keypoints, "milliseconds");
-
-    // check for NAN features
-    pcl::PointCloud<ISMFeature>::Ptr features_cleaned = removeNaNFeatures(features);
-    pcl::PointCloud<ISMFeature>::Ptr globalFeatures_cleaned = removeNaNFeatures(globalFeatures);
-    m_processing_times["features"] += getElapsedTime(timer_features, "milliseconds");
-
-    if(m_enable_signals)
+    if (all.empty())
+        return;
+    std::vector<char> kept(all.size(), 0);
+    for (int index : selected)
+        kept[index] = 1;
+
+    // a random sample of the features, the same for each training
+    const int dim = (int)all[0]->descriptor.size();
+    std::vector<int> samples(all.size());
+    std::iota(samples.begin(), samples.end(), 0);
+    std::mt19937 rng(42);
+    std::shuffle(samples.begin(), samples.end(), rng);
+    const int numSamples = m_feature_rejection_samples > 0 ? std::min((int)samples.size(), m_feature_rejection_samples) : (int)samples.size();
+
+    std::vector<float> descriptors((size_t)numSamples * dim);
+    std::vector<char> sampleKept(numSamples);
+    for (int s = 0; s < numSamples; s++)
     {
-        timer.stop();
-        m_signalFeatures(features_cleaned);
-        timer.resume();
+        const std::vector<float> &descriptor = all[samples[s]]->descriptor;
+        if ((int)descriptor.size() != dim)
+            throw RuntimeException("feature rejection needs descriptors of equal size");
+        std::copy(descriptor.begin(), descriptor.end(), descriptors.begin() + (size_t)s * dim);
+        sampleKept[s] = kept[samples[s]];
     }
 
-    boost::timer::cpu_timer timer_flann;
-    if(!m_index_created)
+    LOG_INFO("fitting feature rejection");
+    m_feature_rejection.fit(descriptors.data(), sampleKept, numSamples, dim);
+}
+
+void ImplicitShapeModel::projectTrainingFeatures(std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                                 std::shared_ptr<FeatureStore> &featureStore) const
+{
+    for (auto it = features.begin(); it != features.end(); it++)
     {
-        LOG_INFO("creating flann index");
-        std::vector<std::shared_ptr<Codeword>> codewords = m_codebook->getCodewords();
-        m_flann_helper = std::make_shared<FlannHelper>(m_codebook->getDim(), m_codebook->getSize());
-        m_flann_helper->createDataset(codewords);
-        m_flann_helper->buildIndex(m_distance->getType(), m_num_kd_trees);
-        m_index_created = true;
-        m_voting->setDistanceType(m_distance->getType());
+        for (const pcl::PointCloud<ISMFeature>::Ptr &modelFeatures : it->second)
+            m_projection.project(*modelFeatures, m_numThreads);
     }
-    m_processing_times["flann"] += getElapsedTime(timer_flann, "milliseconds");
 
-    // activate codebook with current keypoints and cast votes
-    LOG_INFO("activating codewords and casting votes");
-    m_voting->clear();
-
-    boost::timer::cpu_timer timer_voting;
-    // use index depending on distance type
-    if(m_distance->getType() == "Euclidean")
+    // stored features must not be changed, the models are projected one by one into a new store
+    if (featureStore)
     {
-        m_codebook->castVotes(features_cleaned, m_distance, *m_voting, *m_flann_helper->getIndexL2(), m_flann_exact_match);
+        std::shared_ptr<FeatureStore> projected = createFeatureStore();
+        for (unsigned classId : featureStore->getClassIds())
+        {
+            for (int i = 0; i < featureStore->getNumModels(classId); i++)
+            {
+                pcl::PointCloud<ISMFeature>::Ptr modelFeatures(new pcl::PointCloud<ISMFeature>(*featureStore->load(classId, i)));
+                m_projection.project(*modelFeatures, m_numThreads);
+                projected->store(classId, i, modelFeatures);
+            }
+        }
+        featureStore = projected;
     }
-    else if(m_distance->getType() == "ChiSquared")
+}
+
+void ImplicitShapeModel::trainFeaturesParallel(int numWorkers, std::shared_ptr<PointCloudLoader> loader,
+                                               FeatureCache *featureCache, FeatureStore *featureStore,
+                                               std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                               std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures,
+                                               std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes)
+{
+    // all models in the order of training, which is the order of the loader
+    struct TrainingModel
     {
-        m_codebook->castVotes(features_cleaned, m_distance, *m_voting, *m_flann_helper->getIndexChi(), m_flann_exact_match);
-    }
-    else if(m_distance->getType() == "Hellinger")
+        unsigned classId;
+        int index;
+        bool hasNormals;
+        pcl::PointCloud<ISMFeature>::Ptr features;
+        pcl::PointCloud<ISMFeature>::Ptr globalFeatures;
+        Utils::BoundingBox boundingBox;
+    };
+    std::vector<TrainingModel> models;
+    for (auto it = m_trainingModelsFilenames.begin(); it != m_trainingModelsFilenames.end(); it++)
     {
-        m_codebook->castVotes(features_cleaned, m_distance, *m_voting, *m_flann_helper->getIndexHel(), m_flann_exact_match);
+        unsigned classId = it->first;
+        const std::vector<bool>& modelsHaveNormals = m_trainingModelHasNormals[classId];
+        LOG_ASSERT(it->second.size() == modelsHaveNormals.size());
+
+        LOG_INFO("training class " << classId << " with " << it->second.size() << " models");
+        for (int j = 0; j < (int)it->second.size(); j++)
+        {
+            TrainingModel model;
+            model.classId = classId;
+            model.index = j;
+            model.hasNormals = modelsHaveNormals[j];
+            models.push_back(model);
+        }
     }
-    else if(m_distance->getType() == "HistIntersection")
+
+    // each worker uses its own detectors and descriptors with an equal share of the threads
+    numWorkers = std::max(std::min(numWorkers, (int)models.size()), 1);
+    const int totalThreads = m_numThreads > 0 ? m_numThreads : omp_get_max_threads();
+    const int workerThreads = std::max(totalThreads / numWorkers, 1);
+    LOG_INFO("computing training features with " << numWorkers << " workers and " << workerThreads << " threads each");
+
+    std::vector<std::unique_ptr<Keypoints> > keypointsDetectors;
+    std::vector<std::unique_ptr<Features> > featureDescriptors;
+    std::vector<std::unique_ptr<Features> > globalFeatureDescriptors;
+    std::vector<VoxelHashGrid> voxelFilterings(numWorkers);
+    std::vector<FeaturePipeline> pipelines;
+    for (int i = 0; i < numWorkers; i++)
     {
-        m_codebook->castVotes(features_cleaned, m_distance, *m_voting, *m_flann_helper->getIndexHist(), m_flann_exact_match);
+        keypointsDetectors.emplace_back(Factory<Keypoints>::create(m_keypointsDetector->configToJson()));
+        featureDescriptors.emplace_back(Factory<Features>::create(m_featureDescriptor->configToJson()));
+        globalFeatureDescriptors.emplace_back(Factory<Features>::create(m_globalFeatureDescriptor->configToJson()));
+
+        FeaturePipeline pipeline = {keypointsDetectors.back().get(), featureDescriptors.back().get(),
+                                    globalFeatureDescriptors.back().get(), &voxelFilterings[i], workerThreads};
+        pipeline.estimators.reset(new EstimatorCache());
+        pipelines.push_back(pipeline);
     }
-    m_processing_times["voting"] += getElapsedTime(timer_voting, "milliseconds");
 
-    // analyze voting spaces - only for debug
-    std::map<unsigned, pcl::PointCloud<PointT>::Ptr > all_votings;
-    if(m_enableVotingAnalysis)
+    // models are taken in order, a model is only started while the models in computation fit into the memory budget
+    const std::size_t maxBytes = (std::size_t)m_trainingMemoryMB * 1024 * 1024;
+    std::mutex mutex;
+    std::condition_variable memoryReleased;
+    std::size_t nextModel = 0;
+    std::size_t bytesInComputation = 0;
+    std::exception_ptr error;
+
+    auto worker = [&](int workerIndex)
     {
-        all_votings = analyzeVotingSpacesForDebug(m_voting->getVotes(), points);
-    }
+        // parallel regions without an explicit number of threads use the share of the worker
+        ThreadScope threads(workerThreads, m_cpus);
+        boost::timer::cpu_timer timer;
 
-    // forward global feature to voting class in single object mode
-    if(m_single_object_mode) m_voting->setGlobalFeatures(globalFeatures_cleaned);
+        while (true)
+        {
+            std::size_t modelIndex;
+            std::size_t bytes;
+            bool fileHasNormals = false;
+            pcl::PointCloud<PointNormalT>::Ptr model;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                memoryReleased.wait(lock, [&]() {
+                    return error || maxBytes == 0 || bytesInComputation == 0 || bytesInComputation < maxBytes;
+                });
+                if (error || nextModel == models.size())
+                    return;
+
+                modelIndex = nextModel++;
+                const TrainingModel &trainingModel = models[modelIndex];
+                const std::string &filename = m_trainingModelsFilenames.at(trainingModel.classId)[trainingModel.index];
+                model = loader->next(&fileHasNormals);
+                if (model.get() == 0)
+                {
+                    error = std::make_exception_ptr(RuntimeException("could not load training model: " + filename));
+                    memoryReleased.notify_all();
+                    return;
+                }
 
-    LOG_INFO("finding maxima");
-    boost::timer::cpu_timer timer_maxima;
-    std::vector<VotingMaximum> positions = m_voting->findMaxima(pointsWithoutNaN, normalsWithoutNaN);
-    m_processing_times["maxima"] += getElapsedTime(timer_maxima, "milliseconds");
-    LOG_INFO("detected " << positions.size() << " maxima");
+                bytes = model->size() * sizeof(PointNormalT);
+                bytesInComputation += bytes;
+            }
 
-    // only debug
-    if(m_enableVotingAnalysis)
-    {
-        addMaximaForDebug(all_votings, positions);
-    }
+            try
+            {
+                TrainingModel &trainingModel = models[modelIndex];
+                const std::string &filename = m_trainingModelsFilenames.at(trainingModel.classId)[trainingModel.index];
 
-    if(m_enable_signals)
-    {
-        timer.stop();
-        m_signalMaxima(positions);
-        timer.resume();
-    }
+                prepareTrainingModel(*model);
+                trainingModel.boundingBox = computeBoundingBox(model);
 
-    // cpu time (%t) sums up the time used by all threads, so use wall time (%w) instead to show
-    // performance increase in multithreading
-    LOG_INFO("detection processing time: " << timer.format(4, "%w") << " seconds");
+                // the loader determines whether the file contains normals
+                bool hasNormals = trainingModel.hasNormals && fileHasNormals;
+                computeTrainingFeatures(pipelines[workerIndex], filename, model, hasNormals, featureCache, timer,
+                                        trainingModel.features, trainingModel.globalFeatures);
 
-    // measure time
-    m_processing_times["complete"] += getElapsedTime(timer, "milliseconds");
+                // the store writes the features to disk beyond its budget, so they are not kept until the merge
+                if (featureStore)
+                {
+                    featureStore->store(trainingModel.classId, trainingModel.index, trainingModel.features);
+                    trainingModel.features.reset();
+                }
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+
+            model.reset();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                bytesInComputation -= bytes;
+            }
+            memoryReleased.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < numWorkers; i++)
+        workers.push_back(std::thread(worker, i));
+    for (int i = 0; i < numWorkers; i++)
+        workers[i].join();
 
-    return std::make_tuple(positions, m_processing_times);
+    if (error)
+        std::rethrow_exception(error);
+
+    // merge in the order of training, independent of the order in which the workers finished
+    for (int i = 0; i < (int)models.size(); i++)
+    {
+        const TrainingModel &model = models[i];
+        if (model.index == 0)
+            boundingBoxes[model.classId].resize(m_trainingModelsFilenames[model.classId].size());
+
+        if (!featureStore)
+            features[model.classId].push_back(model.features);
+        globalFeatures[model.classId].push_back(model.globalFeatures);
+        boundingBoxes[model.classId][model.index] = model.boundingBox;
+    }
 }
 
-// TODO VS move this method to utils
-double ImplicitShapeModel::getElapsedTime(boost::timer::cpu_timer timer, std::string format)
+
+void ImplicitShapeModel::prepareTrainingModel(pcl::PointCloud<PointNormalT> &model) const
 {
-    // measure time
-    auto nano = boost::chrono::nanoseconds(timer.elapsed().wall);
-    if(format == "seconds")
+    if(m_setColorToZero)
     {
-        auto msec = boost::chrono::duration_cast<boost::chrono::seconds>(nano);
-        return msec.count();
+        LOG_INFO("Setting color to 0 in loaded model");
+        for(int i = 0; i < model.size(); i++)
+        {
+            setPointColor(model.at(i), 0, 0, 0);
+        }
     }
-    else //if (format == "milliseconds")
+}
+
+
+void ImplicitShapeModel::computeTrainingFeatures(const FeaturePipeline &pipeline, const std::string &filename,
+                                                 pcl::PointCloud<PointNormalT>::ConstPtr model, bool hasNormals,
+                                                 FeatureCache *featureCache, boost::timer::cpu_timer &timer,
+                                                 pcl::PointCloud<ISMFeature>::Ptr &modelFeatures,
+                                                 pcl::PointCloud<ISMFeature>::Ptr &globalFeatures)
+{
+    std::string cache_key;
+    if (featureCache)
+        cache_key = FeatureCache::computeKey(filename, getFeatureCacheConfig(hasNormals));
+
+    if (!cache_key.empty() && featureCache->load(cache_key, modelFeatures, globalFeatures))
     {
-        auto msec = boost::chrono::duration_cast<boost::chrono::milliseconds>(nano);
-        return msec.count();
+        LOG_INFO("loaded " << modelFeatures->size() << " local and " << globalFeatures->size() <<
+                 " global features from feature cache");
+        return;
     }
-}
 
+    // compute features
+    pcl::PointCloud<ISMFeature>::ConstPtr model_features;
+    pcl::PointCloud<ISMFeature>::ConstPtr global_features;
+    std::tie(model_features, global_features, std::ignore, std::ignore, std::ignore) =
+            computeFeatures(pipeline, model, hasNormals, timer, timer, true);
 
+    // check for NAN features
+    modelFeatures = removeNaNFeatures(model_features);
+    globalFeatures = removeNaNFeatures(global_features);
 
-std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
-pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr >
-ImplicitShapeModel::computeFeatures(pcl::PointCloud<PointNormalT>::ConstPtr points,
-                                    bool hasNormals, boost::timer::cpu_timer& timer_normals, boost::timer::cpu_timer& timer_keypoints,
-                                    bool compute_global)
+    if (!cache_key.empty())
+        featureCache->store(cache_key, modelFeatures, globalFeatures);
+}
+
+
+bool ImplicitShapeModel::add_normals(const std::string& filename, const std::string& folder, int numThreads)
 {
-    if (m_useVoxelFiltering) {
-        // filter cloud to get a uniform point distribution
-        LOG_INFO("performing voxel filtering");
-        pcl::PointCloud<PointNormalT>::Ptr filtered(new pcl::PointCloud<PointNormalT>());
-        m_voxelFiltering.setInputCloud(points);
-        m_voxelFiltering.filter(*filtered);
-        points = filtered;
+    pcl::PointCloud<PointNormalT>::Ptr points_in = loadPointCloud(filename);
+
+    if (points_in.get() == 0)
+        return false;
+
+    if (points_in->empty())
+    {
+        LOG_WARN("point cloud is empty");
     }
 
+    // filter out nan points
+    std::vector<int> dummy;
+    pcl::PointCloud<PointNormalT>::Ptr points(new pcl::PointCloud<PointNormalT>());
+    pcl::removeNaNFromPointCloud(*points_in, *points, dummy);
+    points->is_dense = false;
+
     pcl::search::Search<PointT>::Ptr searchTree;
     if (points->isOrganized())
     {
@@ -675,36 +1521,14 @@ ImplicitShapeModel::computeFeatures(pcl::PointCloud<PointNormalT>::ConstPtr poin
 
     pcl::PointCloud<PointT>::Ptr pointCloud(new pcl::PointCloud<PointT>());
     pcl::PointCloud<pcl::Normal>::Ptr normals;
-    pcl::PointCloud<PointT>::Ptr pointsWithoutNaN;
-    pcl::PointCloud<pcl::Normal>::Ptr normalsWithoutNaN;
+    pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN;
+    pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN;
 
     // extract position point cloud
     pcl::copyPointCloud(*points, *pointCloud);
 
-    if(m_enable_signals)
-    {
-        m_signalPointCloud(pointCloud);
-    }
-
-    // skip normals on certain descriptors
-    std::string descr_type = m_featureDescriptor->getType();
-
-    // TODO VS: add descriptor type that can be checked for "needNormals" and "isBinary"
-    if (!hasNormals && (descr_type != "SHORT_SHOT" && descr_type != "SHORT_CSHOT"))
-    {
-        // compute normals on the model
-        timer_normals.start();
-        LOG_INFO("computing normals");
-        computeNormals(pointCloud, normals, searchTree);
-        timer_normals.stop();
-    }
-    else
-    {
-        // extract normals point cloud
-        LOG_INFO("extracting normals");
-        normals = pcl::PointCloud<pcl::Normal>::Ptr(new pcl::PointCloud<pcl::Normal>());
-        pcl::copyPointCloud(*points, *normals);
-    }
+    LOG_INFO("computing normals");
+    computeNormals(pointCloud, normals, searchTree, getStageThreads(m_threads_normals, numThreads));
 
     LOG_ASSERT(normals->size() == pointCloud->size());
 
@@ -715,73 +1539,1668 @@ ImplicitShapeModel::computeFeatures(pcl::PointCloud<PointNormalT>::ConstPtr poin
     LOG_ASSERT(normalsWithoutNaN.get() != 0);
     LOG_ASSERT(pointsWithoutNaN->size() == normalsWithoutNaN->size());
 
-    if(m_enable_signals)
-    {
-        m_signalNormals(pointsWithoutNaN, normalsWithoutNaN);
-    }
-
-    // detect interesting keypoints
-    LOG_INFO("computing keypoints");
-    timer_keypoints.start();
-    m_keypointsDetector->setNumThreads(m_numThreads);
-    pcl::PointCloud<PointT>::ConstPtr keypoints = (*m_keypointsDetector)(pointCloud, normals,
-                                                                         pointsWithoutNaN, normalsWithoutNaN,
-                                                                         searchTree);
-    timer_keypoints.stop();
-
-    // compute descriptors for keypoints
-    LOG_INFO("computing features");
-    m_featureDescriptor->setNumThreads(m_numThreads);
-    pcl::PointCloud<ISMFeature>::ConstPtr features = (*m_featureDescriptor)(pointCloud, normals,
-                                                                            pointsWithoutNaN, normalsWithoutNaN,
-                                                                            keypoints,
-                                                                            searchTree);
-
-    // reference frames can be invalid, in which case associated keypoints are discarded
-    LOG_ASSERT(features->size() <= keypoints->size());
+    pcl::PointCloud<PointNormalT>::Ptr points_out(new pcl::PointCloud<PointNormalT>());
+    pcl::concatenateFields(*pointsWithoutNaN, *normalsWithoutNaN, *points_out);
 
-    // in training compute global features
-    if(compute_global)
-    {
-        // compute global descriptors for objects
-        LOG_INFO("computing global features");
-        pcl::PointCloud<PointT>::ConstPtr dummy_keypoints(new pcl::PointCloud<PointT>());
-        m_globalFeatureDescriptor->setNumThreads(m_numThreads);
-        pcl::PointCloud<ISMFeature>::ConstPtr global_features = (*m_globalFeatureDescriptor)(pointCloud, normals,
-                                                                                             pointsWithoutNaN, normalsWithoutNaN,
-                                                                                             dummy_keypoints,
-                                                                                             searchTree);
-        return std::make_tuple(features, global_features, pointsWithoutNaN, normalsWithoutNaN);
-    }
-    else // for recognition global features need to be computed later
-    {
-        // create descriptor point cloud
-        pcl::PointCloud<ISMFeature>::Ptr global_features(new pcl::PointCloud<ISMFeature>());
-        return std::make_tuple(features, global_features, pointsWithoutNaN, normalsWithoutNaN);
-    }
+    // save result, clouds of other formats are written as PCD as well
+    std::string file = boost::filesystem::path(filename).stem().string() + ".pcd";
+    //pcl::io::savePCDFileBinary(folder+"/"+file, *points_out);
+    return pcl::io::savePCDFileBinaryCompressed(folder+"/"+file, *points_out) == 0;
 }
 
-const Codebook* ImplicitShapeModel::getCodebook() const
+bool ImplicitShapeModel::detect(const std::string& filename, std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times)
 {
-    return m_codebook;
+    bool hasNormals = false;
+    pcl::PointCloud<PointNormalT>::Ptr points = loadPointCloud(filename, &hasNormals);
+    return detect(points, hasNormals, maxima, times);
 }
 
-const Voting* ImplicitShapeModel::getVoting() const
+bool ImplicitShapeModel::detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals,
+                                std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times)
 {
-    return m_voting;
-}
+    std::vector<std::vector<VotingMaximum> > settingMaxima;
+    if (!detect(points, hasNormals, std::vector<Json::Value>(1, Json::Value(Json::objectValue)), settingMaxima, times))
+        return false;
 
+    maxima = settingMaxima[0];
+    return true;
+}
+
+bool ImplicitShapeModel::detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals, const std::vector<Json::Value>& settings,
+                                std::vector<std::vector<VotingMaximum> >& maxima, std::map<std::string, double> &times)
+{
+    if (points.get() == 0 || settings.empty())
+        return false;
+
+    // settings are checked before the detection
+    const Json::Value votingConfig = m_voting->configToJson();
+    const Json::Value codebookConfig = m_codebook->configToJson();
+    for (const Json::Value& setting : settings)
+    {
+        if (!setting.isObject() || !hasParameters(votingConfig, setting["Voting"]) ||
+                !hasParameters(codebookConfig, setting["Codebook"]))
+        {
+            LOG_ERROR("invalid parameter setting: " << toJsonString(setting, false));
+            return false;
+        }
+    }
+
+    if(m_setColorToZero)
+    {
+        LOG_INFO("Setting color to 0 in loaded model");
+        for(int i = 0; i < points->size(); i++)
+        {
+            setPointColor(points->at(i), 0, 0, 0);
+        }
+    }
+
+    // the normals of loaded files are known, so the first normal is not checked
+    detectPoints(points, hasNormals, false, settings, maxima, times);
+    return true;
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detect(pcl::PointCloud<PointT>::ConstPtr points)
+{
+    pcl::PointCloud<PointNormalT>::Ptr pointCloud(new pcl::PointCloud<PointNormalT>());
+    pcl::copyPointCloud(*points, *pointCloud);
+    return detect(pointCloud, false);
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detect(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals)
+{
+    return detectPoints(points_in, hasNormals, true);
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detect(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals,
+                           const std::vector<Utils::BoundingBox>& regionsOfInterest)
+{
+    RegionOfInterest previous = m_region_of_interest;
+    m_region_of_interest = RegionOfInterest(regionsOfInterest);
+    try
+    {
+        std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>> result = detectPoints(points_in, hasNormals, true);
+        m_region_of_interest = previous;
+        return result;
+    }
+    catch (...)
+    {
+        m_region_of_interest = previous;
+        throw;
+    }
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detect(const PointBufferView &view)
+{
+    // the conversion already removes the invalid points, so the pipeline does not copy the input again
+    boost::timer::cpu_timer timer;
+    const bool keepOrganized = m_useOrganizedPipeline && !m_useVoxelFiltering;
+    pcl::PointCloud<PointNormalT>::ConstPtr points = view.toPointCloud(keepOrganized);
+    const double conversionTime = getElapsedTime(timer, "milliseconds");
+
+    std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>> result = detectPoints(points, view.normals != 0, true);
+    std::get<1>(result)["input"] = conversionTime;
+    return result;
+}
+
+void ImplicitShapeModel::setRegionsOfInterest(const std::vector<Utils::BoundingBox>& regionsOfInterest)
+{
+    m_region_of_interest = RegionOfInterest(regionsOfInterest);
+}
+
+void ImplicitShapeModel::setClassMaximaCallback(const Voting::ClassMaximaCallback& callback,
+                                                const std::vector<unsigned>& priorityClasses)
+{
+    m_class_maxima_callback = callback;
+    m_priority_classes = priorityClasses;
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detectPoints(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, bool checkFirstNormal)
+{
+    // large scenes are detected tile by tile, regions of interest and the single object mode use the whole scene
+    if (m_detection_tile_size > 0 && m_region_of_interest.empty() && !m_single_object_mode)
+    {
+        TiledDetector detector(*this, m_detection_tile_size, m_detection_tile_workers);
+        std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>> result = detector.detect(points_in, hasNormals);
+        addProcessingTimes(std::get<1>(result));
+        return result;
+    }
+
+    std::vector<std::vector<VotingMaximum> > maxima;
+    std::map<std::string, double> times;
+    detectPoints(points_in, hasNormals, checkFirstNormal, std::vector<Json::Value>(1, Json::Value(Json::objectValue)), maxima, times);
+    return std::make_tuple(maxima[0], times);
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detect(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, double timeBudget)
+{
+    return detectAnytime(points_in, hasNormals, true, timeBudget);
+}
+
+std::tuple<std::vector<VotingMaximum>,std::map<std::string, double>>
+ImplicitShapeModel::detectAnytime(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, bool checkFirstNormal,
+                                  double timeBudget)
+{
+    std::vector<VotingMaximum> maxima;
+    std::map<std::string, double> times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    ThreadScope threads(m_numThreads, m_cpus);
+
+    // measure the time
+    boost::timer::cpu_timer timer;
+    auto elapsed = [&timer]() { return timer.elapsed().wall / 1e6; };
+    DetectionTrace trace;
+    DetectionTrace::Stage stageDetection(&trace, "detection");
+
+    boost::timer::cpu_timer timer_flann;
+    DetectionTrace::Stage stageIndex(&trace, "index");
+    createDetectionIndex();
+    stageIndex.stop();
+    times["flann"] += getElapsedTime(timer_flann, "milliseconds");
+
+    // only the voxel grid has a keypoint density that can be coarsened
+    KeypointsVoxelGrid *voxelKeypoints = dynamic_cast<KeypointsVoxelGrid*>(m_keypointsDetector);
+    const int numLevels = voxelKeypoints ? std::max(m_anytime_levels, 1) : 1;
+
+    pcl::PointCloud<PointNormalT>::ConstPtr points = points_in;
+    double levelTime = 0;
+    double maximaTime = 0;
+    int numLevelsDone = 0;
+    for (int level = numLevels - 1; level >= 0; level--)
+    {
+        // halving the leaf size of keypoints on surfaces about quadruples the keypoints and the time
+        if (numLevelsDone > 0 && elapsed() + 4 * levelTime > timeBudget)
+            break;
+
+        boost::timer::cpu_timer timer_level;
+        const double normalsBefore = times["normals"];
+
+        FeaturePipeline pipeline = getFeaturePipeline();
+        pipeline.regionOfInterest = &m_region_of_interest;
+        pipeline.trace = &trace;
+        std::unique_ptr<Keypoints> coarseKeypoints;
+        if (level > 0)
+        {
+            Json::Value config = m_keypointsDetector->configToJson();
+            config["Parameters"]["LeafSize"] = voxelKeypoints->getLeafSize() * (1 << level);
+            coarseKeypoints.reset(Factory<Keypoints>::create(config));
+            pipeline.keypointsDetector = coarseKeypoints.get();
+        }
+
+        LOG_INFO("anytime detection level " << numLevelsDone << ", keypoint leaf size factor " << (1 << level));
+        DetectionInput input;
+        if (!computeDetectionFeatures(pipeline, points, hasNormals, checkFirstNormal, input, times))
+            break;
+
+        // finer levels reuse the filtered points and their normals
+        if (numLevelsDone == 0 && level > 0)
+        {
+            pcl::PointCloud<PointNormalT>::Ptr pointsWithNormals(new pcl::PointCloud<PointNormalT>());
+            pcl::concatenateFields(*input.pointsWithoutNaN, *input.normalsWithoutNaN, *pointsWithNormals);
+            points = pointsWithNormals;
+            hasNormals = true;
+            checkFirstNormal = false;
+        }
+
+        LOG_INFO("activating codewords");
+        boost::timer::cpu_timer timer_voting;
+        ActivationResult activation;
+        DetectionTrace::Stage stageActivation(&trace, "activation");
+        {
+            ThreadScope activationThreads(getStageThreads(m_threads_activation));
+            m_codebook->activateFeatures(input.features, m_distance, *m_flann_helper, m_flann_exact_match, activation);
+        }
+        stageActivation.stop();
+
+        // features with the closest codewords vote first
+        const int numFeatures = activation.numQueries();
+        std::vector<std::pair<float, int> > order(numFeatures);
+        for (int i = 0; i < numFeatures; i++)
+        {
+            float closest = std::numeric_limits<float>::max();
+            for (int j = activation.offsets[i]; j < activation.offsets[i + 1]; j++)
+                closest = std::min(closest, activation.distances[j]);
+            order[i] = {closest, i};
+        }
+        std::stable_sort(order.begin(), order.end());
+
+        // forward global feature to voting class in single object mode
+        if(m_single_object_mode) m_voting->setGlobalFeatures(input.globalFeatures);
+
+        // votes are cast in chunks until the time for the maxima search is needed, the first level uses a tenth
+        // of the budget as estimate
+        LOG_INFO("casting votes");
+        ThreadScope votingThreads(getStageThreads(m_threads_voting));
+        m_voting->clear();
+        m_voting->setMVBBParams(m_mvbbEpsilon, m_mvbbLeafSize);
+        m_voting->setLeanMaxima(m_lean_output);
+        m_voting->setRegionOfInterest(m_region_of_interest);
+        m_voting->setClassMaximaCallback(m_class_maxima_callback, m_priority_classes);
+        const double maximaReserve = numLevelsDone > 0 ? maximaTime : 0.1 * timeBudget;
+        const int chunkSize = std::max(numFeatures / 10, 1);
+        int numVoted = 0;
+        DetectionTrace::Stage stageVotes(&trace, "votes");
+        while (numVoted < numFeatures && (numLevelsDone == 0 || numVoted == 0 || elapsed() + maximaReserve < timeBudget))
+        {
+            const int end = std::min(numVoted + chunkSize, numFeatures);
+            pcl::PointCloud<ISMFeature> chunkFeatures;
+            ActivationResult chunkActivation;
+            chunkActivation.offsets.push_back(0);
+            chunkActivation.classes = activation.classes;
+            for (int k = numVoted; k < end; k++)
+            {
+                const int i = order[k].second;
+                chunkFeatures.push_back(input.features->at(i));
+                for (int j = activation.offsets[i]; j < activation.offsets[i + 1]; j++)
+                {
+                    chunkActivation.codewordIndices.push_back(activation.codewordIndices[j]);
+                    chunkActivation.distances.push_back(activation.distances[j]);
+                }
+                chunkActivation.offsets.push_back((int)chunkActivation.codewordIndices.size());
+            }
+            m_codebook->castVotes(chunkFeatures, chunkActivation, *m_voting);
+            numVoted = end;
+        }
+        stageVotes.stop();
+        times["voting"] += getElapsedTime(timer_voting, "milliseconds");
+        if (numVoted < numFeatures)
+            LOG_INFO("time budget reached, " << numVoted << " of " << numFeatures << " features voted");
+
+        LOG_INFO("finding maxima");
+        boost::timer::cpu_timer timer_maxima;
+        ThreadScope maximaThreads(getStageThreads(m_threads_maxima));
+        DetectionTrace::Stage stageMaxima(&trace, "maxima");
+        maxima = m_voting->findMaxima(input.pointsWithoutNaN, input.normalsWithoutNaN, input.search);
+        stageMaxima.stop();
+        countVotes(trace, activation, *m_voting);
+        reportVotes(*m_voting, maxima);
+        if (m_lean_output)
+            m_voting->releaseVotes();
+        maximaTime = getElapsedTime(timer_maxima, "milliseconds");
+        times["maxima"] += maximaTime;
+        LOG_INFO("detected " << maxima.size() << " maxima");
+
+        // the normals are only computed on the first level
+        levelTime = getElapsedTime(timer_level, "milliseconds") - (times["normals"] - normalsBefore);
+        numLevelsDone++;
+        if (numVoted < numFeatures)
+            break;
+    }
+
+    if(m_enable_signals)
+    {
+        timer.stop();
+        m_signalMaxima(maxima);
+        timer.resume();
+    }
+    if(m_dispatcher)
+        m_dispatcher->postMaxima(maxima);
+
+    LOG_INFO("anytime detection processing time: " << timer.format(4, "%w") << " seconds with " << numLevelsDone << " level(s)");
+    times["complete"] += getElapsedTime(timer, "milliseconds");
+    stageDetection.stop();
+    finishTrace(trace);
+
+    // the times of this detection are returned, the totals are kept as in detect()
+    addProcessingTimes(times);
+    return std::make_tuple(maxima, times);
+}
+
+void ImplicitShapeModel::detectPoints(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, bool checkFirstNormal,
+                                      const std::vector<Json::Value>& settings, std::vector<std::vector<VotingMaximum> >& maxima,
+                                      std::map<std::string, double> &times)
+{
+        /* 1.) Detect Keypoints + Keypoint-Features
+         * 2.) Activate Codebook with Keypoints
+         * 3.) Each activated Codeword casts its Activation-Distribution into Houghspace
+         * 4.) Search Houghspace for maxima
+         * 5.) The model can be considered found according to some heuristics in Houghspace
+         */
+
+    maxima.assign(settings.size(), std::vector<VotingMaximum>());
+    times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    ThreadScope threads(m_numThreads, m_cpus);
+
+    // measure the time
+    boost::timer::cpu_timer timer;
+    DetectionTrace trace;
+    DetectionTrace::Stage stageDetection(&trace, "detection");
+
+    // compute features
+    DetectionInput input;
+    FeaturePipeline pipeline = getFeaturePipeline();
+    pipeline.regionOfInterest = &m_region_of_interest;
+    pipeline.trace = &trace;
+    pipeline.earlyExitVoting = m_voting;
+    m_voting->setMVBBParams(m_mvbbEpsilon, m_mvbbLeafSize);
+    m_voting->setLeanMaxima(m_lean_output);
+    if (!computeDetectionFeatures(pipeline, points_in, hasNormals, checkFirstNormal, input, times))
+    {
+        stageDetection.stop();
+        finishTrace(trace);
+        addProcessingTimes(times);
+        return;
+    }
+
+    // the global classification is the result of all settings
+    if (input.globalEarlyExit)
+    {
+        for (std::vector<VotingMaximum> &settingMaxima : maxima)
+            settingMaxima.assign(1, input.globalMaximum);
+        if(m_enable_signals)
+        {
+            timer.stop();
+            m_signalMaxima(maxima[0]);
+            timer.resume();
+        }
+        if(m_dispatcher)
+            m_dispatcher->postMaxima(maxima[0]);
+
+        times["complete"] += getElapsedTime(timer, "milliseconds");
+        stageDetection.stop();
+        finishTrace(trace);
+        addProcessingTimes(times);
+        return;
+    }
+    pcl::PointCloud<PointNormalT>::ConstPtr points = input.points;
+    pcl::PointCloud<ISMFeature>::Ptr features_cleaned = input.features;
+    pcl::PointCloud<ISMFeature>::Ptr globalFeatures_cleaned = input.globalFeatures;
+    pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN = input.pointsWithoutNaN;
+    pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN = input.normalsWithoutNaN;
+    pcl::search::Search<PointT>::Ptr search = input.search;
+
+    if(m_enable_signals)
+    {
+        timer.stop();
+        m_signalFeatures(features_cleaned);
+        timer.resume();
+    }
+    if(m_dispatcher)
+        m_dispatcher->postFeatures(features_cleaned);
+
+    boost::timer::cpu_timer timer_flann;
+    DetectionTrace::Stage stageIndex(&trace, "index");
+    createDetectionIndex();
+    stageIndex.stop();
+    times["flann"] += getElapsedTime(timer_flann, "milliseconds");
+
+    // activate codebook with current keypoints, the activation is shared by all settings
+    LOG_INFO("activating codewords");
+    boost::timer::cpu_timer timer_voting;
+    ActivationResult activation;
+    DetectionTrace::Stage stageActivation(&trace, "activation");
+    {
+        ThreadScope activationThreads(getStageThreads(m_threads_activation));
+        m_codebook->activateFeatures(features_cleaned, m_distance, *m_flann_helper, m_flann_exact_match, activation);
+    }
+    stageActivation.stop();
+    times["voting"] += getElapsedTime(timer_voting, "milliseconds");
+    CancellationToken::check();
+
+    // counters of the activation cache, accumulated over all detections
+    if(m_codebook->useActivationCache())
+    {
+        const ActivationCache& cache = m_codebook->getActivationCache();
+        times["activation_cache_hits"] = cache.getHits();
+        times["activation_cache_misses"] = cache.getMisses();
+        times["activation_cache_evictions"] = cache.getEvictions();
+        times["activation_cache_hit_rate"] = cache.getHitRate();
+    }
+
+    // statistics of the sampled exact searches, accumulated over all detections
+    if(m_codebook->useRecallMonitor())
+        countRecall(trace);
+
+    // forward global feature to voting class in single object mode
+    if(m_single_object_mode) m_voting->setGlobalFeatures(globalFeatures_cleaned);
+
+    // settings with the same codebook parameters share their votes, parameters are only changed if any setting
+    // changes them
+    const bool changeParameters = settings.size() > 1 || !settings[0].getMemberNames().empty();
+    const Json::Value votingConfig = m_voting->configToJson();
+    const Json::Value codebookConfig = m_codebook->configToJson();
+    std::vector<bool> done(settings.size(), false);
+    for (int i = 0; i < (int)settings.size(); i++)
+    {
+        if (done[i])
+            continue;
+
+        LOG_INFO("casting votes");
+        if (changeParameters)
+            applyParameters(*m_codebook, codebookConfig, settings[i]["Codebook"]);
+        // the vote buffers of the threads are sized when clearing, so the voting threads are set before
+        ThreadScope votingThreads(getStageThreads(m_threads_voting));
+        m_voting->clear();
+        m_voting->setMVBBParams(m_mvbbEpsilon, m_mvbbLeafSize);
+        m_voting->setLeanMaxima(m_lean_output);
+        m_voting->setRegionOfInterest(m_region_of_interest);
+        m_voting->setClassMaximaCallback(m_class_maxima_callback, m_priority_classes);
+
+        boost::timer::cpu_timer timer_votes;
+        DetectionTrace::Stage stageVotes(&trace, "votes");
+        m_codebook->castVotes(*features_cleaned, activation, *m_voting);
+        stageVotes.stop();
+        times["voting"] += getElapsedTime(timer_votes, "milliseconds");
+
+        // the voting analysis copies the sampled votes, the consumers serialize them on the capture thread
+        std::shared_ptr<VotingCaptureFrame> frame;
+        VotingMeanShift *meanShift = dynamic_cast<VotingMeanShift*>(m_voting);
+        if (m_capture && i == 0 && m_capture->beginDetection())
+        {
+            frame = m_capture->createFrame(points, m_voting->getVotes());
+            if (meanShift)
+                meanShift->setRecordTrajectories((m_capture->getChannels() & VotingCapture::ChannelTrajectories) != 0);
+        }
+
+        for (int j = i; j < (int)settings.size(); j++)
+        {
+            if (done[j] || settings[j]["Codebook"] != settings[i]["Codebook"])
+                continue;
+
+            LOG_INFO("finding maxima");
+            if (changeParameters)
+                applyParameters(*m_voting, votingConfig, settings[j]["Voting"]);
+            boost::timer::cpu_timer timer_maxima;
+            ThreadScope maximaThreads(getStageThreads(m_threads_maxima));
+            DetectionTrace::Stage stageMaxima(&trace, "maxima");
+            maxima[j] = m_voting->findMaxima(pointsWithoutNaN, normalsWithoutNaN, search);
+            stageMaxima.stop();
+            times["maxima"] += getElapsedTime(timer_maxima, "milliseconds");
+            if (j == 0)
+            {
+                countVotes(trace, activation, *m_voting);
+                reportVotes(*m_voting, maxima[j]);
+            }
+            LOG_INFO("detected " << maxima[j].size() << " maxima");
+            done[j] = true;
+        }
+
+        if (frame)
+        {
+            if (m_capture->getChannels() & VotingCapture::ChannelMaxima)
+            {
+                frame->maxima = maxima[0];
+                for (VotingMaximum &maximum : frame->maxima)
+                    std::vector<int>().swap(maximum.voteIndices);
+            }
+            if (meanShift)
+            {
+                m_capture->setTrajectories(*frame, meanShift->getTrajectories());
+                meanShift->setRecordTrajectories(false);
+            }
+            m_capture->post(frame);
+        }
+
+        // all settings with this codebook are done, the votes are cast again for the next one
+        if (m_lean_output)
+            m_voting->releaseVotes();
+    }
+
+    // restore the configured parameters
+    if (changeParameters)
+    {
+        applyParameters(*m_codebook, codebookConfig, Json::Value());
+        applyParameters(*m_voting, votingConfig, Json::Value());
+    }
+
+    // the maxima of a cancelled detection are incomplete, the parameters are restored before
+    CancellationToken::check();
+
+    if(m_enable_signals)
+    {
+        timer.stop();
+        m_signalMaxima(maxima[0]);
+        timer.resume();
+    }
+    if(m_dispatcher)
+        m_dispatcher->postMaxima(maxima[0]);
+
+    // cpu time (%t) sums up the time used by all threads, so use wall time (%w) instead to show
+    // performance increase in multithreading
+    LOG_INFO("detection processing time: " << timer.format(4, "%w") << " seconds");
+
+    // measure time
+    times["complete"] += getElapsedTime(timer, "milliseconds");
+    stageDetection.stop();
+    finishTrace(trace);
+    addProcessingTimes(times);
+}
+
+std::vector<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > >
+ImplicitShapeModel::detectBatch(const std::vector<pcl::PointCloud<PointNormalT>::Ptr>& pointClouds, const std::vector<bool>& hasNormals)
+{
+    LOG_ASSERT(pointClouds.size() == hasNormals.size());
+
+    // missing point clouds are detected as empty point clouds
+    int next = 0;
+    auto nextCloud = [&](bool *cloudHasNormals) -> pcl::PointCloud<PointNormalT>::Ptr
+    {
+        *cloudHasNormals = hasNormals[next];
+        pcl::PointCloud<PointNormalT>::Ptr points = pointClouds[next++];
+        return points ? points : pcl::PointCloud<PointNormalT>::Ptr(new pcl::PointCloud<PointNormalT>());
+    };
+
+    std::vector<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > > results(pointClouds.size());
+    detectPipelined((int)pointClouds.size(), nextCloud,
+                    [&](int index, const std::vector<VotingMaximum>& maxima, const std::map<std::string, double>& times)
+    {
+        results[index] = std::make_tuple(maxima, times);
+    });
+    return results;
+}
+
+bool ImplicitShapeModel::detectBatch(std::shared_ptr<PointCloudLoader> loader, int numClouds,
+                                     const std::function<void(int, const std::vector<VotingMaximum>&,
+                                                              const std::map<std::string, double>&)>& callback)
+{
+    return detectPipelined(numClouds, [&](bool *hasNormals) { return loader->next(hasNormals); }, callback);
+}
+
+bool ImplicitShapeModel::detectPipelined(int numClouds, const std::function<pcl::PointCloud<PointNormalT>::Ptr(bool*)>& next,
+                                         const std::function<void(int, const std::vector<VotingMaximum>&,
+                                                                  const std::map<std::string, double>&)>& callback)
+{
+    // a point cloud on its way through the pipeline, empty point clouds pass without detection
+    struct PipelineItem
+    {
+        int index;
+        bool valid;
+        DetectionInput input;
+        ActivationResult activation;
+        std::map<std::string, double> times;
+        boost::timer::cpu_timer timer;
+        DetectionTrace trace; // the stages are recorded by the threads of the pipeline
+    };
+    typedef std::shared_ptr<PipelineItem> ItemPtr;
+
+    // the votes and maxima are computed on the calling thread, the other stages set up their own threads
+    ThreadScope threads(m_numThreads, m_cpus);
+
+    boost::timer::cpu_timer timer;
+
+    // the index is built before the stages start, its time is accounted to the first point cloud
+    boost::timer::cpu_timer timer_flann;
+    createDetectionIndex();
+    const double flannTime = getElapsedTime(timer_flann, "milliseconds");
+    m_processing_times["flann"] += flannTime;
+
+    // the voting computes global features around maxima while the first stage computes the features of the next
+    // point cloud, so the first stage uses its own global descriptor
+    std::unique_ptr<Features> globalFeatureDescriptor(Factory<Features>::create(m_globalFeatureDescriptor->configToJson()));
+    FeaturePipeline pipeline = getFeaturePipeline();
+    pipeline.globalFeatureDescriptor = globalFeatureDescriptor.get();
+    pipeline.regionOfInterest = &m_region_of_interest;
+
+    // each queue holds one point cloud, so that a stage works at most one point cloud ahead of the next stage
+    BoundedQueue<ItemPtr> featureQueue(1);
+    BoundedQueue<ItemPtr> activationQueue(1);
+    std::mutex mutex;
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    bool loadFailed = false;
+
+    auto fail = [&]()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!error)
+            error = std::current_exception();
+        failed = true;
+        featureQueue.close();
+        activationQueue.close();
+    };
+
+    // stage 1: features
+    std::thread featureStage([&]()
+    {
+        ThreadScope threads(m_numThreads, m_cpus);
+        try
+        {
+            for (int i = 0; i < numClouds && !failed; i++)
+            {
+                bool hasNormals = false;
+                pcl::PointCloud<PointNormalT>::Ptr points = next(&hasNormals);
+                if (points.get() == 0)
+                {
+                    loadFailed = true;
+                    break;
+                }
+
+                if(m_setColorToZero)
+                {
+                    for(int j = 0; j < points->size(); j++)
+                    {
+                        setPointColor(points->at(j), 0, 0, 0);
+                    }
+                }
+
+                ItemPtr item = std::make_shared<PipelineItem>();
+                item->index = i;
+                item->times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+                if (i == 0)
+                    item->times["flann"] = flannTime;
+
+                // the normals of loaded files are known, so the first normal is not checked
+                pipeline.trace = &item->trace;
+                item->valid = computeDetectionFeatures(pipeline, points, hasNormals, false, item->input, item->times);
+                if (item->valid && m_enable_signals)
+                    m_signalFeatures(item->input.features);
+                if (item->valid && m_dispatcher)
+                    m_dispatcher->postFeatures(item->input.features);
+
+                if (!featureQueue.push(item))
+                    break;
+            }
+        }
+        catch (...)
+        {
+            fail();
+        }
+        featureQueue.close();
+    });
+
+    // stage 2: activation of the codebook
+    std::thread activationStage([&]()
+    {
+        ThreadScope threads(getStageThreads(m_threads_activation), m_cpus);
+        try
+        {
+            ItemPtr item;
+            while (!failed && featureQueue.pop(item))
+            {
+                if (item->valid)
+                {
+                    LOG_INFO("activating codewords");
+                    boost::timer::cpu_timer timer_voting;
+                    DetectionTrace::Stage stageActivation(&item->trace, "activation");
+                    m_codebook->activateFeatures(item->input.features, m_distance, *m_flann_helper, m_flann_exact_match,
+                                                 item->activation);
+                    stageActivation.stop();
+                    item->times["voting"] += getElapsedTime(timer_voting, "milliseconds");
+                }
+
+                // counters of the activation cache, accumulated over all detections
+                if(m_codebook->useActivationCache())
+                {
+                    const ActivationCache& cache = m_codebook->getActivationCache();
+                    item->times["activation_cache_hits"] = cache.getHits();
+                    item->times["activation_cache_misses"] = cache.getMisses();
+                    item->times["activation_cache_evictions"] = cache.getEvictions();
+                    item->times["activation_cache_hit_rate"] = cache.getHitRate();
+                }
+
+                if(m_codebook->useRecallMonitor())
+                    countRecall(item->trace);
+
+                if (!activationQueue.push(item))
+                    break;
+            }
+        }
+        catch (...)
+        {
+            fail();
+        }
+        activationQueue.close();
+    });
+
+    // stage 3: votes and maxima, the voting is only used by this stage
+    try
+    {
+        ItemPtr item;
+        while (!failed && activationQueue.pop(item))
+        {
+            std::vector<VotingMaximum> maxima;
+            if (item->valid)
+            {
+                // forward global feature to voting class in single object mode
+                if(m_single_object_mode) m_voting->setGlobalFeatures(item->input.globalFeatures);
+
+                LOG_INFO("casting votes");
+                ThreadScope votingThreads(getStageThreads(m_threads_voting));
+                m_voting->clear();
+                m_voting->setMVBBParams(m_mvbbEpsilon, m_mvbbLeafSize);
+                m_voting->setLeanMaxima(m_lean_output);
+                m_voting->setRegionOfInterest(m_region_of_interest);
+                m_voting->setClassMaximaCallback(m_class_maxima_callback, m_priority_classes);
+                boost::timer::cpu_timer timer_votes;
+                DetectionTrace::Stage stageVotes(&item->trace, "votes");
+                m_codebook->castVotes(*item->input.features, item->activation, *m_voting);
+                stageVotes.stop();
+                item->times["voting"] += getElapsedTime(timer_votes, "milliseconds");
+
+                LOG_INFO("finding maxima");
+                boost::timer::cpu_timer timer_maxima;
+                ThreadScope maximaThreads(getStageThreads(m_threads_maxima));
+                DetectionTrace::Stage stageMaxima(&item->trace, "maxima");
+                maxima = m_voting->findMaxima(item->input.pointsWithoutNaN, item->input.normalsWithoutNaN, item->input.search);
+                stageMaxima.stop();
+                countVotes(item->trace, item->activation, *m_voting);
+                reportVotes(*m_voting, maxima);
+                if (m_lean_output)
+                    m_voting->releaseVotes();
+                item->times["maxima"] += getElapsedTime(timer_maxima, "milliseconds");
+                LOG_INFO("detected " << maxima.size() << " maxima");
+
+                if(m_enable_signals)
+                    m_signalMaxima(maxima);
+                if (m_dispatcher)
+                    m_dispatcher->postMaxima(maxima);
+                item->times["complete"] = getElapsedTime(item->timer, "milliseconds");
+            }
+
+            // the total times sum up the stages, the complete time is the time of the whole batch
+            for (const std::pair<const std::string, double>& time : item->times)
+            {
+                if (time.first.find("activation_cache") == 0)
+                    m_processing_times[time.first] = time.second;
+                else if (time.first != "complete" && time.first != "flann")
+                    m_processing_times[time.first] += time.second;
+            }
+
+            finishTrace(item->trace);
+            callback(item->index, maxima, item->times);
+        }
+    }
+    catch (...)
+    {
+        fail();
+    }
+
+    featureStage.join();
+    activationStage.join();
+    if (error)
+        std::rethrow_exception(error);
+
+    // cpu time (%t) sums up the time used by all threads, so use wall time (%w) instead to show
+    // performance increase in multithreading
+    LOG_INFO("batch detection processing time: " << timer.format(4, "%w") << " seconds");
+    m_processing_times["complete"] += getElapsedTime(timer, "milliseconds");
+    return !loadFailed;
+}
+
+bool ImplicitShapeModel::computeDetectionFeatures(const FeaturePipeline &pipeline,
+                                                  pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals,
+                                                  bool checkFirstNormal, DetectionInput &input,
+                                                  std::map<std::string, double> &times) const
+{
+    PreprocessedInput preprocessed;
+    if (!preprocessDetectionInput(pipeline, points_in, hasNormals, checkFirstNormal, preprocessed, times))
+        return false;
+    describeDetectionInput(pipeline, preprocessed, input, times);
+    return true;
+}
+
+bool ImplicitShapeModel::preprocessDetectionInput(const FeaturePipeline &pipeline,
+                                                  pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals,
+                                                  bool checkFirstNormal, PreprocessedInput &preprocessed,
+                                                  std::map<std::string, double> &times) const
+{
+    if (points_in->empty())
+    {
+        LOG_WARN("point cloud is empty");
+        return false;
+    }
+
+    boost::timer::cpu_timer timer_features;
+
+    // organized clouds keep their image structure, invalid points stay in place as NAN points and are masked by
+    // the later stages, so that normals are estimated on the integral image and neighbors are searched in image
+    // space; voxel filtering destroys the structure anyway
+    const bool keepOrganized = m_useOrganizedPipeline && points_in->isOrganized() && !m_useVoxelFiltering;
+
+    // filter out nan points, the input is only copied if it contains any
+    pcl::PointCloud<PointNormalT>::ConstPtr points = points_in;
+    int numValidPoints = (int)points_in->size();
+    bool hasNaNPoints = false;
+    for (int i = 0; i < (int)points_in->size() && !hasNaNPoints; i++)
+        hasNaNPoints = !pcl::isFinite(points_in->points[i]);
+
+    if (hasNaNPoints && keepOrganized)
+    {
+        numValidPoints = 0;
+        for (const PointNormalT &point : points_in->points)
+            numValidPoints += pcl::isFinite(point) ? 1 : 0;
+    }
+    else if (hasNaNPoints)
+    {
+        std::vector<int> dummy;
+        pcl::PointCloud<PointNormalT>::Ptr points_filtered(new pcl::PointCloud<PointNormalT>());
+        pcl::removeNaNFromPointCloud(*points_in, *points_filtered, dummy);
+        points_filtered->is_dense = false;
+        points = points_filtered;
+        numValidPoints = (int)points->size();
+    }
+
+    // crop to the region of interest, keypoints near its border keep the points of their support
+    if (pipeline.regionOfInterest && !pipeline.regionOfInterest->empty())
+    {
+        const float margin = pipeline.featureDescriptor->getSupportRadius() + m_normalRadius;
+        pcl::PointCloud<PointNormalT>::Ptr points_cropped(new pcl::PointCloud<PointNormalT>());
+        const int numPoints = numValidPoints;
+        numValidPoints = 0;
+        if (keepOrganized)
+        {
+            // points outside of the region are masked
+            *points_cropped = *points;
+            const float nan = std::numeric_limits<float>::quiet_NaN();
+            for (PointNormalT &point : points_cropped->points)
+            {
+                if (!pcl::isFinite(point))
+                    continue;
+                if (pipeline.regionOfInterest->contains(point.getVector3fMap(), margin))
+                    numValidPoints++;
+                else
+                    point.x = point.y = point.z = nan;
+            }
+            points_cropped->is_dense = false;
+        }
+        else
+        {
+            points_cropped->reserve(points->size());
+            for (const PointNormalT &point : points->points)
+            {
+                if (pipeline.regionOfInterest->contains(point.getVector3fMap(), margin))
+                    points_cropped->push_back(point);
+            }
+            points_cropped->is_dense = points->is_dense;
+            numValidPoints = (int)points_cropped->size();
+        }
+        LOG_INFO("region of interest contains " << numValidPoints << " of " << numPoints << " points");
+        points = points_cropped;
+    }
+
+    if (numValidPoints == 0)
+    {
+        LOG_WARN("point cloud is empty");
+        return false;
+    }
+
+    if (pipeline.trace)
+        pipeline.trace->addCounter("points", numValidPoints);
+
+    // check first normal, of an organized cloud the normal of the first valid point
+    if (hasNormals && checkFirstNormal)
+    {
+        int first = 0;
+        while (!pcl::isFinite(points->points[first]))
+            first++;
+        const PointNormalT& firstNormal = points->at(first);
+        if (firstNormal.normal_x == 0 &&
+                firstNormal.normal_y == 0 &&
+                firstNormal.normal_z == 0 ||
+                pcl_isnan(firstNormal.normal_x) ||
+                pcl_isnan(firstNormal.curvature)
+                )
+            hasNormals = false;
+    }
+
+    // compute normals and keypoints
+    boost::timer::cpu_timer timer_normals;
+    timer_normals.stop();
+    boost::timer::cpu_timer timer_keypoints;
+    timer_keypoints.stop();
+    preprocessFeatures(pipeline, points, hasNormals, timer_normals, timer_keypoints, preprocessed);
+    preprocessed.points = points;
+    times["normals"] += getElapsedTime(timer_normals, "milliseconds");
+    times["keypoints"] += getElapsedTime(timer_keypoints, "milliseconds");
+    times["features"] -= getElapsedTime(timer_normals, "milliseconds");
+    times["features"] -= getElapsedTime(timer_keypoints, "milliseconds");
+    times["features"] += getElapsedTime(timer_features, "milliseconds");
+    return true;
+}
+
+void ImplicitShapeModel::describeDetectionInput(const FeaturePipeline &pipeline, const PreprocessedInput &preprocessed,
+                                                DetectionInput &input, std::map<std::string, double> &times) const
+{
+    boost::timer::cpu_timer timer_features;
+
+    input.points = preprocessed.points;
+    input.globalEarlyExit = false;
+
+    // a confident classification of the global features makes the local features unnecessary
+    bool compute_global = m_single_object_mode;
+    if (compute_global && pipeline.earlyExitVoting && pipeline.earlyExitVoting->usesGlobalEarlyExit())
+    {
+        input.globalFeatures = removeNaNFeatures(describeGlobalFeatures(pipeline, preprocessed));
+        compute_global = false;
+        if (pipeline.earlyExitVoting->classifyGlobalEarly(input.globalFeatures, preprocessed.pointsWithoutNaN,
+                                                          input.globalMaximum))
+        {
+            input.globalEarlyExit = true;
+            input.features.reset(new pcl::PointCloud<ISMFeature>());
+            input.pointsWithoutNaN = preprocessed.pointsWithoutNaN;
+            input.normalsWithoutNaN = preprocessed.normalsWithoutNaN;
+            input.search = preprocessed.search;
+            times["features"] += getElapsedTime(timer_features, "milliseconds");
+            if (pipeline.trace)
+                pipeline.trace->addCounter("features", 0);
+            return;
+        }
+    }
+
+    // compute features
+    pcl::PointCloud<ISMFeature>::ConstPtr features;
+    pcl::PointCloud<ISMFeature>::ConstPtr globalFeatures;
+    std::tie(features, globalFeatures, input.pointsWithoutNaN, input.normalsWithoutNaN, input.search) =
+            describeFeatures(pipeline, preprocessed, compute_global);
+
+    // check for NAN features, the codewords are stored in the projected descriptor space
+    input.features = removeNaNFeatures(features);
+    if (m_feature_rejection.isTrained() && m_feature_rejection_rate > 0)
+    {
+        // the rejection is fitted on the original descriptors
+        const int rejected = m_feature_rejection.reject(*input.features, m_feature_rejection_rate, pipeline.numThreads);
+        if (pipeline.trace)
+            pipeline.trace->addCounter("rejected_features", rejected);
+    }
+    if (m_projection.isTrained())
+        m_projection.project(*input.features, pipeline.numThreads);
+    if (!input.globalFeatures)
+        input.globalFeatures = removeNaNFeatures(globalFeatures);
+    times["features"] += getElapsedTime(timer_features, "milliseconds");
+    if (pipeline.trace)
+        pipeline.trace->addCounter("features", input.features->size());
+}
+
+std::string ImplicitShapeModel::getPreprocessingKey(bool hasNormals) const
+{
+    // normals are computed if they are not given, except for descriptors that do not use them
+    const std::string descr_type = m_featureDescriptor->getType();
+    const bool computeNormalsOnModel = !hasNormals && (descr_type != "SHORT_SHOT" && descr_type != "SHORT_CSHOT");
+
+    Json::Value config(Json::objectValue);
+    config["Keypoints"] = m_keypointsDetector->configToJson();
+    config["UseVoxelFiltering"] = m_useVoxelFiltering;
+    if (m_useVoxelFiltering)
+        config["VoxelLeafSize"] = m_voxelLeafSize;
+    config["UseOrganizedPipeline"] = m_useOrganizedPipeline;
+    config["ComputeNormals"] = computeNormalsOnModel;
+    if (computeNormalsOnModel)
+    {
+        config["NormalRadius"] = m_normalRadius;
+        config["ConsistentNormalsK"] = m_consistentNormalsK;
+        config["ConsistentNormalsMethod"] = m_consistentNormalsMethod;
+        config["LazyNormals"] = m_lazyNormals;
+        if (m_lazyNormals)
+            config["NormalSupportRadius"] = m_featureDescriptor->getNormalSupportRadius();
+    }
+    return toJsonString(config, false);
+}
+
+void ImplicitShapeModel::createDetectionIndex()
+{
+    std::lock_guard<std::mutex> lock(m_index_mutex);
+    if(m_index_created)
+    {
+        // the index may have been built in training or loaded with the model
+        createClassCascade();
+        m_flann_helper->releaseDataset();
+        return;
+    }
+
+    // with a cpu affinity, the index is allocated on the memory node of these cpus
+    LOG_INFO("creating flann index");
+    ThreadScope threads(m_numThreads, m_cpus);
+    std::vector<std::shared_ptr<Codeword>> codewords = m_codebook->getCodewords();
+    std::vector<uint8_t> codes;
+    if(m_codebook->isCompressed() && m_codebook->getCompressedCodes(codewords, codes))
+    {
+        std::vector<int> codewordIds;
+        for(const std::shared_ptr<Codeword>& codeword : codewords)
+            codewordIds.push_back(codeword->getId());
+
+        if(m_codebook->getScalarQuantizer())
+        {
+            m_flann_helper = std::make_shared<FlannHelper>(m_codebook->getDim(), 0);
+            m_flann_helper->buildQuantizedIndex(m_distance->getType(), m_codebook->getScalarQuantizer(), codes, codewordIds,
+                                                m_index_params);
+        }
+        else
+        {
+            // the uncompressed descriptors are only available and needed for re-ranking
+            const int rerank = m_codebook->getNumRerank();
+            m_flann_helper = std::make_shared<FlannHelper>(m_codebook->getDim(), rerank > 0 ? m_codebook->getSize() : 0);
+            if(rerank > 0)
+                m_flann_helper->createDataset(codewords);
+            m_flann_helper->buildQuantizedIndex(m_distance->getType(), m_codebook->getQuantizer(), codes, codewordIds, rerank);
+        }
+    }
+    else
+    {
+        m_flann_helper = createCodewordDataset(codewords);
+        m_flann_helper->buildIndex(m_distance->getType(), m_index_params);
+    }
+    m_index_created = true;
+    m_voting->setDistanceType(m_distance->getType());
+    m_voting->setIndexParams(m_index_params);
+    createClassCascade();
+
+    // the hamming index keeps the descriptors bit-packed, the float rows are only needed to build it
+    m_flann_helper->releaseDataset();
+}
+
+void ImplicitShapeModel::createClassCascade()
+{
+    if(!m_use_class_cascade || m_flann_helper->hasClassCascade())
+        return;
+    if(m_flann_helper->isQuantized())
+    {
+        LOG_WARN("the class cascade is not available for compressed codebooks");
+        return;
+    }
+    if(!m_codebook->supportsClassCascade())
+    {
+        LOG_WARN("the class cascade requires the KNN or Threshold activation strategy");
+        return;
+    }
+
+    LOG_INFO("creating class cascade");
+    ThreadScope threads(m_numThreads, m_cpus);
+    std::vector<std::shared_ptr<Codeword>> codewords = m_codebook->getCodewords();
+    const int numCenters = std::max((int)(codewords.size() * m_cascade_fraction), 1);
+    m_flann_helper->buildClassCascade(m_codebook->getClassVoteCounts(codewords), numCenters, m_cascade_top_classes);
+}
+
+bool ImplicitShapeModel::hasParameters(const Json::Value& config, const Json::Value& parameters)
+{
+    if (parameters.isNull())
+        return true;
+    if (!parameters.isObject())
+        return false;
+
+    for (const std::string& name : parameters.getMemberNames())
+    {
+        if (!config["Parameters"].isMember(name))
+            return false;
+    }
+    return true;
+}
+
+void ImplicitShapeModel::applyParameters(JSONObject& object, const Json::Value& config, const Json::Value& parameters)
+{
+    // without children the child objects are not recreated
+    Json::Value objectConfig = config;
+    objectConfig.removeMember("Children");
+    if (parameters.isObject())
+    {
+        for (const std::string& name : parameters.getMemberNames())
+            objectConfig["Parameters"][name] = parameters[name];
+    }
+    object.configFromJson(objectConfig);
+}
+
+// float parameters are written with the precision of a float, values of the file are compared with a tolerance
+static bool sameConfigValue(const Json::Value& current, const Json::Value& value)
+{
+    if (current.isDouble() && value.isNumeric())
+    {
+        const double a = current.asDouble();
+        const double b = value.asDouble();
+        return std::fabs(a - b) <= 1e-6 * std::max(1.0, std::max(std::fabs(a), std::fabs(b)));
+    }
+    if (current.isArray() && value.isArray())
+    {
+        if (current.size() != value.size())
+            return false;
+        for (Json::ArrayIndex i = 0; i < current.size(); i++)
+        {
+            if (!sameConfigValue(current[i], value[i]))
+                return false;
+        }
+        return true;
+    }
+    return current == value;
+}
+
+void ImplicitShapeModel::diffConfig(const Json::Value& current, const Json::Value& config, const std::string& path,
+                                    std::vector<std::pair<std::string, Json::Value> >& changes)
+{
+    if (!config.isObject())
+        return;
+
+    if (config.isMember("Type") && config["Type"] != current["Type"])
+    {
+        changes.push_back(std::make_pair(path + "Type", config["Type"]));
+        return;
+    }
+
+    // members of the file that are not parameters, like comments, are ignored
+    const Json::Value& parameters = config["Parameters"];
+    if (parameters.isObject())
+    {
+        for (const std::string& name : current["Parameters"].getMemberNames())
+        {
+            if (parameters.isMember(name) && !sameConfigValue(current["Parameters"][name], parameters[name]))
+                changes.push_back(std::make_pair(path + name, parameters[name]));
+        }
+    }
+
+    const Json::Value& children = config["Children"];
+    if (children.isObject())
+    {
+        for (const std::string& name : current["Children"].getMemberNames())
+            diffConfig(current["Children"][name], children[name], path + name + "/", changes);
+    }
+}
+
+bool ImplicitShapeModel::reloadParameters(const std::string &filename, std::vector<std::string> &changed, std::string &error)
+{
+    changed.clear();
+    error.clear();
+
+    std::ifstream file(filename.c_str());
+    Json::Value json;
+    Json::Reader reader;
+    if (!file || !reader.parse(file, json) || !json["ObjectConfig"].isObject())
+    {
+        error = "could not read the configuration of " + filename;
+        return false;
+    }
+
+    std::vector<std::pair<std::string, Json::Value> > changes;
+    diffConfig(configToJson(), json["ObjectConfig"], "", changes);
+
+    // the voting only uses the trained data through the codebook, except for the global feature classifier
+    static const std::set<std::string> votingTraining = {"Type", "UseGlobalFeatures", "GlobalFeaturesStrategy",
+                                                         "LinearSvmFeatures", "LinearSvmGamma", "LinearSvmC",
+                                                         "LinearSvmEpochs"};
+    // the other codebook parameters change its data, its index or its caches
+    static const std::set<std::string> codebookWeighting = {"UseClassWeight", "UseVoteWeight", "UseMatchingWeight",
+                                                            "UseCodewordWeight", "MaxVotesPerActivation"};
+
+    Json::Value votingParameters(Json::objectValue);
+    Json::Value codebookParameters(Json::objectValue);
+    std::vector<std::string> rejected;
+    for (const std::pair<std::string, Json::Value>& change : changes)
+    {
+        const std::string::size_type separator = change.first.find('/');
+        const std::string object = change.first.substr(0, separator == std::string::npos ? 0 : separator);
+        const std::string name = change.first.substr(separator == std::string::npos ? 0 : separator + 1);
+        if (name.find('/') == std::string::npos && object == "Voting" && votingTraining.count(name) == 0)
+            votingParameters[name] = change.second;
+        else if (name.find('/') == std::string::npos && object == "Codebook" && codebookWeighting.count(name) > 0)
+            codebookParameters[name] = change.second;
+        else
+            rejected.push_back(change.first);
+    }
+
+    if (!rejected.empty())
+    {
+        error = "parameters can not change without reloading or retraining the model:";
+        for (const std::string& name : rejected)
+            error += " " + name;
+        return false;
+    }
+
+    // the new configurations are checked on copies, so that invalid values leave the model unchanged
+    const Json::Value votingConfig = m_voting->configToJson();
+    const Json::Value codebookConfig = m_codebook->configToJson();
+    try
+    {
+        Json::Value checkVoting = votingConfig;
+        Json::Value checkCodebook = codebookConfig;
+        checkVoting.removeMember("Children");
+        checkCodebook.removeMember("Children");
+        for (const std::string& name : votingParameters.getMemberNames())
+            checkVoting["Parameters"][name] = votingParameters[name];
+        for (const std::string& name : codebookParameters.getMemberNames())
+            checkCodebook["Parameters"][name] = codebookParameters[name];
+        std::unique_ptr<Voting> voting(Factory<Voting>::create(checkVoting));
+        std::unique_ptr<Codebook> codebook(Factory<Codebook>::create(checkCodebook));
+    }
+    catch (const Exception& e)
+    {
+        error = std::string("invalid parameter values: ") + e.what();
+        return false;
+    }
+
+    applyParameters(*m_voting, votingConfig, votingParameters);
+    applyParameters(*m_codebook, codebookConfig, codebookParameters);
+
+    for (const std::pair<std::string, Json::Value>& change : changes)
+        changed.push_back(change.first);
+    LOG_INFO("reloaded " << changed.size() << " parameters from " << filename);
+    return true;
+}
+
+// TODO VS move this method to utils
+double ImplicitShapeModel::getElapsedTime(const boost::timer::cpu_timer &timer, const std::string &format) const
+{
+    // measure time
+    auto nano = boost::chrono::nanoseconds(timer.elapsed().wall);
+    if(format == "seconds")
+    {
+        auto msec = boost::chrono::duration_cast<boost::chrono::seconds>(nano);
+        return msec.count();
+    }
+    else //if (format == "milliseconds")
+    {
+        auto msec = boost::chrono::duration_cast<boost::chrono::milliseconds>(nano);
+        return msec.count();
+    }
+}
+
+
+
+std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
+pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr, pcl::search::Search<PointT>::Ptr >
+ImplicitShapeModel::computeFeatures(pcl::PointCloud<PointNormalT>::ConstPtr points,
+                                    bool hasNormals, boost::timer::cpu_timer& timer_normals, boost::timer::cpu_timer& timer_keypoints,
+                                    bool compute_global)
+{
+    return computeFeatures(getFeaturePipeline(), points, hasNormals, timer_normals, timer_keypoints, compute_global);
+}
+
+std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
+pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr, pcl::search::Search<PointT>::Ptr >
+ImplicitShapeModel::computeFeatures(const FeaturePipeline &pipeline, pcl::PointCloud<PointNormalT>::ConstPtr points,
+                                    bool hasNormals, boost::timer::cpu_timer& timer_normals, boost::timer::cpu_timer& timer_keypoints,
+                                    bool compute_global) const
+{
+    PreprocessedInput preprocessed;
+    preprocessFeatures(pipeline, points, hasNormals, timer_normals, timer_keypoints, preprocessed);
+    return describeFeatures(pipeline, preprocessed, compute_global);
+}
+
+void ImplicitShapeModel::preprocessFeatures(const FeaturePipeline &pipeline, pcl::PointCloud<PointNormalT>::ConstPtr points,
+                                            bool hasNormals, boost::timer::cpu_timer& timer_normals,
+                                            boost::timer::cpu_timer& timer_keypoints, PreprocessedInput &preprocessed) const
+{
+    if (m_useVoxelFiltering) {
+        // filter cloud to get a uniform point distribution
+        LOG_INFO("performing voxel filtering");
+        DetectionTrace::Stage stageFiltering(pipeline.trace, "voxel_filtering");
+        pcl::PointCloud<PointNormalT>::Ptr filtered(new pcl::PointCloud<PointNormalT>());
+        pipeline.voxelFiltering->setNumThreads(pipeline.numThreads);
+
+        // voxel grid keypoints are computed from the filtered voxels in the same pass
+        KeypointsVoxelGrid *voxelKeypoints = dynamic_cast<KeypointsVoxelGrid*>(pipeline.keypointsDetector);
+        if (voxelKeypoints)
+        {
+            pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
+            pipeline.voxelFiltering->filter(*points, m_voxelLeafSize, voxelKeypoints->getLeafSize(), *filtered, *keypoints);
+            voxelKeypoints->setPrecomputedKeypoints(keypoints);
+        }
+        else
+        {
+            pipeline.voxelFiltering->filter(*points, m_voxelLeafSize, *filtered);
+        }
+        points = filtered;
+    }
+
+    // all stages search the same clouds, each spatial index is built once
+    SharedSearch::Ptr searchTree(new SharedSearch(pipeline.estimators));
+
+    pcl::PointCloud<PointT>::Ptr pointCloud(new pcl::PointCloud<PointT>());
+    pcl::PointCloud<pcl::Normal>::Ptr normals;
+    pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN;
+    pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN;
+
+    // skip normals on certain descriptors
+    std::string descr_type = pipeline.featureDescriptor->getType();
+
+    // TODO VS: add descriptor type that can be checked for "needNormals" and "isBinary"
+    bool computeNormalsOnModel = !hasNormals && (descr_type != "SHORT_SHOT" && descr_type != "SHORT_CSHOT");
+
+    if (computeNormalsOnModel)
+    {
+        // extract position point cloud
+        pcl::copyPointCloud(*points, *pointCloud);
+    }
+    else
+    {
+        // extract position and normals point cloud in one pass
+        LOG_INFO("extracting normals");
+        normals = pcl::PointCloud<pcl::Normal>::Ptr(new pcl::PointCloud<pcl::Normal>());
+        splitPointCloud(*points, *pointCloud, *normals);
+    }
+
+    if(m_enable_signals)
+    {
+        m_signalPointCloud(pointCloud);
+    }
+    if(m_dispatcher)
+        m_dispatcher->postPointCloud(pointCloud);
+
+    // detect interesting keypoints, only keypoints in the region of interest and accepted by the filter are described
+    pcl::PointCloud<PointT>::ConstPtr keypoints;
+    auto detectKeypoints = [&]()
+    {
+        CancellationToken::check();
+        LOG_INFO("computing keypoints");
+        timer_keypoints.start();
+        DetectionTrace::Stage stageKeypoints(pipeline.trace, "keypoints");
+        pipeline.keypointsDetector->setNumThreads(pipeline.numThreads);
+        keypoints = (*pipeline.keypointsDetector)(pointCloud, normals, pointsWithoutNaN, normalsWithoutNaN, searchTree);
+
+        bool useRegion = pipeline.regionOfInterest && !pipeline.regionOfInterest->empty();
+        if (useRegion || pipeline.keypointFilter)
+        {
+            pcl::PointCloud<PointT>::Ptr keypointsInRegion(new pcl::PointCloud<PointT>());
+            keypointsInRegion->reserve(keypoints->size());
+            for (const PointT &keypoint : keypoints->points)
+            {
+                if (useRegion && !pipeline.regionOfInterest->contains(keypoint.getVector3fMap()))
+                    continue;
+                if (pipeline.keypointFilter && !pipeline.keypointFilter(keypoint))
+                    continue;
+                keypointsInRegion->push_back(keypoint);
+            }
+            keypoints = keypointsInRegion;
+        }
+        stageKeypoints.stop();
+        timer_keypoints.stop();
+        if (pipeline.trace)
+            pipeline.trace->addCounter("keypoints", keypoints->size());
+    };
+
+    // keypoints that only depend on the positions are detected first, then the descriptors only need the normals
+    // around them
+    const float supportRadius = pipeline.featureDescriptor->getNormalSupportRadius();
+    const bool lazyNormals = pipeline.lazyNormals && computeNormalsOnModel && !pointCloud->isOrganized() &&
+            (m_consistentNormalsMethod == 0 || m_consistentNormalsMethod == 1) && supportRadius > 0 &&
+            !pipeline.keypointsDetector->needsNormals();
+    if (lazyNormals)
+    {
+        // no normal is known yet
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        pcl::Normal unknown;
+        unknown.normal_x = unknown.normal_y = unknown.normal_z = unknown.curvature = nan;
+        normals = pcl::PointCloud<pcl::Normal>::Ptr(new pcl::PointCloud<pcl::Normal>(pointCloud->width, pointCloud->height, unknown));
+        pointsWithoutNaN = pcl::PointCloud<PointT>::ConstPtr(new pcl::PointCloud<PointT>());
+        normalsWithoutNaN = pcl::PointCloud<pcl::Normal>::ConstPtr(new pcl::PointCloud<pcl::Normal>());
+        detectKeypoints();
+        normals.reset();
+        pointsWithoutNaN.reset();
+        normalsWithoutNaN.reset();
+    }
+
+    if (computeNormalsOnModel)
+    {
+        // compute normals on the model
+        CancellationToken::check();
+        timer_normals.start();
+        DetectionTrace::Stage stageNormals(pipeline.trace, "normals");
+        LOG_INFO("computing normals");
+        const int numNormalThreads = pipeline.numNormalThreads > 0 ? pipeline.numNormalThreads : pipeline.numThreads;
+        if (lazyNormals)
+            computeSupportNormals(pointCloud, keypoints, supportRadius, normals, searchTree, numNormalThreads,
+                                  pipeline.estimators);
+        else
+            computeNormals(pointCloud, normals, searchTree, numNormalThreads, pipeline.estimators);
+        stageNormals.stop();
+        timer_normals.stop();
+    }
+
+    LOG_ASSERT(normals->size() == pointCloud->size());
+
+    // filter normals with NaN and corresponding points
+    filterNormals(pointCloud, normals, pointsWithoutNaN, normalsWithoutNaN);
+
+    LOG_ASSERT(pointsWithoutNaN.get() != 0);
+    LOG_ASSERT(normalsWithoutNaN.get() != 0);
+    LOG_ASSERT(pointsWithoutNaN->size() == normalsWithoutNaN->size());
+
+    if(m_enable_signals)
+    {
+        m_signalNormals(pointsWithoutNaN, normalsWithoutNaN);
+    }
+    if(m_dispatcher)
+        m_dispatcher->postNormals(pointsWithoutNaN, normalsWithoutNaN);
+
+    if (!lazyNormals)
+        detectKeypoints();
+
+    preprocessed.pointCloud = pointCloud;
+    preprocessed.normals = normals;
+    preprocessed.pointsWithoutNaN = pointsWithoutNaN;
+    preprocessed.normalsWithoutNaN = normalsWithoutNaN;
+    preprocessed.keypoints = keypoints;
+    preprocessed.search = searchTree;
+}
+
+std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
+pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr, pcl::search::Search<PointT>::Ptr >
+ImplicitShapeModel::describeFeatures(const FeaturePipeline &pipeline, const PreprocessedInput &preprocessed,
+                                     bool compute_global) const
+{
+    pcl::PointCloud<PointT>::ConstPtr pointCloud = preprocessed.pointCloud;
+    pcl::PointCloud<pcl::Normal>::ConstPtr normals = preprocessed.normals;
+    pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN = preprocessed.pointsWithoutNaN;
+    pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN = preprocessed.normalsWithoutNaN;
+    pcl::PointCloud<PointT>::ConstPtr keypoints = preprocessed.keypoints;
+    SharedSearch::Ptr searchTree = preprocessed.search;
+
+    // compute descriptors for keypoints
+    CancellationToken::check();
+    LOG_INFO("computing features");
+    DetectionTrace::Stage stageDescriptors(pipeline.trace, "descriptors");
+    pipeline.featureDescriptor->setNumThreads(pipeline.numThreads);
+    pipeline.featureDescriptor->setEstimatorCache(pipeline.estimators);
+    pcl::PointCloud<ISMFeature>::ConstPtr features = (*pipeline.featureDescriptor)(pointCloud, normals,
+                                                                            pointsWithoutNaN, normalsWithoutNaN,
+                                                                            keypoints,
+                                                                            searchTree);
+
+    stageDescriptors.stop();
+
+    // reference frames can be invalid, in which case associated keypoints are discarded
+    LOG_ASSERT(features->size() <= keypoints->size());
+
+    // in training compute global features
+    if(compute_global)
+    {
+        pcl::PointCloud<ISMFeature>::ConstPtr global_features = describeGlobalFeatures(pipeline, preprocessed);
+        return std::make_tuple(features, global_features, pointsWithoutNaN, normalsWithoutNaN, searchTree);
+    }
+    else // for recognition global features need to be computed later
+    {
+        // create descriptor point cloud
+        pcl::PointCloud<ISMFeature>::Ptr global_features(new pcl::PointCloud<ISMFeature>());
+        return std::make_tuple(features, global_features, pointsWithoutNaN, normalsWithoutNaN, searchTree);
+    }
+}
+
+pcl::PointCloud<ISMFeature>::ConstPtr ImplicitShapeModel::describeGlobalFeatures(const FeaturePipeline &pipeline,
+                                                                                 const PreprocessedInput &preprocessed) const
+{
+    // compute global descriptors for objects
+    LOG_INFO("computing global features");
+    DetectionTrace::Stage stageGlobal(pipeline.trace, "global_descriptors");
+    pcl::PointCloud<PointT>::ConstPtr dummy_keypoints(new pcl::PointCloud<PointT>());
+    pipeline.globalFeatureDescriptor->setNumThreads(pipeline.numThreads);
+    pipeline.globalFeatureDescriptor->setEstimatorCache(pipeline.estimators);
+    return (*pipeline.globalFeatureDescriptor)(preprocessed.pointCloud, preprocessed.normals,
+                                               preprocessed.pointsWithoutNaN, preprocessed.normalsWithoutNaN,
+                                               dummy_keypoints, preprocessed.search);
+}
+
+ImplicitShapeModel::FeaturePipeline ImplicitShapeModel::getFeaturePipeline()
+{
+    FeaturePipeline pipeline = {m_keypointsDetector, m_featureDescriptor, m_globalFeatureDescriptor, &m_voxelFiltering,
+                                getStageThreads(m_threads_features)};
+    pipeline.numNormalThreads = getStageThreads(m_threads_normals);
+    pipeline.estimators = m_estimators;
+    return pipeline;
+}
+
+int ImplicitShapeModel::getStageThreads(int stageThreads, int limit) const
+{
+    int numThreads = stageThreads > 0 ? stageThreads : m_numThreads;
+    if (limit > 0)
+        numThreads = numThreads > 0 ? std::min(numThreads, limit) : limit;
+    return numThreads;
+}
+
+void ImplicitShapeModel::setArchiveChunkSize(int chunk_size)
+{
+    if (m_flat_model && chunk_size > 0)
+        LOG_WARN("ArchiveChunkSize is ignored for flat models");
+    m_codebook->setArchiveChunkSize(chunk_size);
+}
+
+const Codebook* ImplicitShapeModel::getCodebook() const
+{
+    return m_codebook;
+}
+
+const Voting* ImplicitShapeModel::getVoting() const
+{
+    return m_voting;
+}
+
+const DetectionStatistics& ImplicitShapeModel::getLastDetectionStatistics() const
+{
+    return m_last_statistics;
+}
+
+const VotingReport& ImplicitShapeModel::getLastVotingReport() const
+{
+    return m_last_voting_report;
+}
+
+bool ImplicitShapeModel::fitCostModel(const std::vector<DetectionStatistics> &samples)
+{
+    DetectionCostModel costModel;
+    for (const DetectionStatistics &sample : samples)
+        costModel.addSample(sample);
+    // the classes are those the model stores data for
+    const MemoryUsage usage = memoryUsage();
+    if (!costModel.fit(usage.getTotalBytes(), m_codebook->getSize(), (int)usage.getTotalClassBytes().size()))
+        return false;
+    m_cost_model = costModel;
+    return true;
+}
+
+bool ImplicitShapeModel::loadCostModel(const std::string &filename)
+{
+    return m_cost_model.load(filename);
+}
+
+const DetectionCostModel& ImplicitShapeModel::getCostModel() const
+{
+    return m_cost_model;
+}
+
+DetectionCost ImplicitShapeModel::estimateDetectionCost(int numPoints) const
+{
+    return m_cost_model.estimate(numPoints);
+}
+
+void ImplicitShapeModel::iMemoryUsage(MemoryUsage &usage) const
+{
+    usage.name = "ImplicitShapeModel";
+    usage.addPart(m_codebook->memoryUsage());
+    if (m_flann_helper)
+        usage.addPart(m_flann_helper->memoryUsage());
+    usage.addPart(m_voting->memoryUsage());
+
+    std::size_t tuningBytes = m_tuning_descriptors.capacity() * sizeof(std::vector<float>) +
+            m_tuning_codeword_ids.capacity() * sizeof(int);
+    for (const std::vector<float> &descriptor : m_tuning_descriptors)
+        tuningBytes += descriptor.capacity() * sizeof(float);
+    usage.addPart("index tuning descriptors", tuningBytes);
+}
+
+void ImplicitShapeModel::addProcessingTimes(const std::map<std::string, double> &times)
+{
+    for (const std::pair<const std::string, double>& time : times)
+    {
+        if (time.first.find("activation_cache") == 0)
+            m_processing_times[time.first] = time.second;
+        else
+            m_processing_times[time.first] += time.second;
+    }
+}
+
+void ImplicitShapeModel::countVotes(DetectionTrace &trace, const ActivationResult &activation, const Voting &voting) const
+{
+    trace.addCounter("activated_codewords", activation.codewordIndices.size());
+
+    // the votes and maxima are those of the last search for maxima
+    std::size_t numVotes = 0;
+    std::size_t voteBytes = 0;
+    for (const std::pair<const unsigned, std::vector<Voting::Vote> >& classVotes : voting.getVotes())
+    {
+        const std::size_t bytes = classVotes.second.capacity() * sizeof(Voting::Vote);
+        trace.setCounter("votes_class_" + std::to_string(classVotes.first), classVotes.second.size());
+        trace.setCounter("vote_bytes_class_" + std::to_string(classVotes.first), bytes);
+        numVotes += classVotes.second.size();
+        voteBytes += bytes;
+    }
+    trace.setCounter("votes", numVotes);
+    trace.setCounter("vote_bytes", voteBytes);
+    for (const std::pair<const std::string, double>& counter : voting.getCounters())
+        trace.setCounter(counter.first, counter.second);
+}
+
+void ImplicitShapeModel::countRecall(DetectionTrace &trace) const
+{
+    const RecallMonitor::Statistics recall = m_codebook->getRecallMonitor().getStatistics();
+    trace.setCounter("ann_recall_samples", recall.samples);
+    trace.setCounter("ann_recall_dropped", recall.dropped);
+    trace.setCounter("ann_recall", recall.recall);
+    trace.setCounter("ann_mean_distance_ratio", recall.meanDistanceRatio);
+    trace.setCounter("ann_max_distance_ratio", recall.maxDistanceRatio);
+}
+
+void ImplicitShapeModel::reportVotes(const Voting &voting, const std::vector<VotingMaximum> &maxima)
+{
+    if (m_voting_report)
+        m_last_voting_report = voting.createReport(maxima, m_voting_report_top_codewords);
+}
+
+void ImplicitShapeModel::finishTrace(const DetectionTrace &trace)
+{
+    m_last_statistics = trace.getStatistics();
+    if (m_trace_file.empty())
+        return;
+
+    // the array is not terminated, which the trace format allows, so that every detection is appended at once
+    if (!m_trace_stream.is_open())
+    {
+        m_trace_stream.open(m_trace_file.c_str(), std::ios::out | std::ios::trunc);
+        if (!m_trace_stream)
+        {
+            LOG_WARN("could not open trace file " << m_trace_file);
+            m_trace_stream.close();
+            return;
+        }
+        m_trace_stream << "[\n";
+    }
+    trace.writeChromeTrace(m_trace_stream, m_num_traces == 0, m_num_traces);
+    m_num_traces++;
+}
+
+
+Utils::BoundingBox ImplicitShapeModel::computeBoundingBox(pcl::PointCloud<PointNormalT>::ConstPtr model) const
+{
+    if (m_bbType == "MVBB")
+        return Utils::computeMVBB<PointNormalT>(model, m_mvbbEpsilon, m_mvbbLeafSize);
+    else if (m_bbType == "AABB")
+        return Utils::computeAABB<PointNormalT>(model);
+    else
+        throw BadParamExceptionType<std::string>("invalid bounding box type", m_bbType);
+}
 
 void ImplicitShapeModel::computeNormals(pcl::PointCloud<PointT>::ConstPtr model,
                                         pcl::PointCloud<pcl::Normal>::Ptr& normals,
-                                        pcl::search::Search<PointT>::Ptr searchTree) const
+                                        pcl::search::Search<PointT>::Ptr searchTree,
+                                        int numThreads,
+                                        const EstimatorCache::Ptr &estimators) const
 {
     LOG_ASSERT(normals.get() == 0);
     normals = pcl::PointCloud<pcl::Normal>::Ptr(new pcl::PointCloud<pcl::Normal>());
 
     if (model->isOrganized())
     {
-        pcl::IntegralImageNormalEstimation<PointT, pcl::Normal> normalEst;
+        // the integral images of a reused estimator keep their memory if the size of the cloud does not change
+        boost::shared_ptr<pcl::IntegralImageNormalEstimation<PointT, pcl::Normal> > normalEstPtr =
+                EstimatorCache::acquire<pcl::IntegralImageNormalEstimation<PointT, pcl::Normal> >(estimators);
+        pcl::IntegralImageNormalEstimation<PointT, pcl::Normal> &normalEst = *normalEstPtr;
         normalEst.setInputCloud(model);
         normalEst.setNormalEstimationMethod(normalEst.AVERAGE_3D_GRADIENT);
         normalEst.setMaxDepthChangeFactor(0.02f);
@@ -797,12 +3216,16 @@ void ImplicitShapeModel::computeNormals(pcl::PointCloud<PointT>::ConstPtr model,
     {
         LOG_INFO("computing consistent normal orientation (using method " << m_consistentNormalsMethod <<")");
 
-        // prepare PCL normal estimation object
-        pcl::NormalEstimationOMP<PointT, pcl::Normal> normalEst;
+        // prepare PCL normal estimation object, a reused one is reset to all points and the sensor origin
+        boost::shared_ptr<pcl::NormalEstimationOMP<PointT, pcl::Normal> > normalEstPtr =
+                EstimatorCache::acquire<pcl::NormalEstimationOMP<PointT, pcl::Normal> >(estimators);
+        pcl::NormalEstimationOMP<PointT, pcl::Normal> &normalEst = *normalEstPtr;
         normalEst.setInputCloud(model);
+        normalEst.setIndices(pcl::IndicesPtr());
+        normalEst.useSensorOriginAsViewPoint();
         normalEst.setSearchMethod(searchTree);
         normalEst.setRadiusSearch(m_normalRadius);
-        normalEst.setNumberOfThreads(m_numThreads);
+        normalEst.setNumberOfThreads(numThreads);
 
         NormalOrientation orient(m_consistentNormalsK, m_normalRadius);
 
@@ -847,146 +3270,848 @@ void ImplicitShapeModel::computeNormals(pcl::PointCloud<PointT>::ConstPtr model,
 #ifdef USE_VCGLIB
         else if(m_consistentNormalsMethod == 3)
         {
-            orient.computeUsingEMST(model, normals);
+            orient.computeUsingEMST(model, normals);
+        }
+#endif
+        else if(m_consistentNormalsMethod == 4)
+        {
+            // a single estimation provides normals and curvature, the orientation only flips normals
+            normalEst.compute(*normals);
+            orient.orientUsingMST(model, normals, searchTree, numThreads);
+        }
+        else
+        {
+            LOG_WARN("Invalid consistent normals method: " << m_consistentNormalsMethod << "! Skipping consistent normals.");
+        }
+    }
+}
+
+
+void ImplicitShapeModel::computeSupportNormals(pcl::PointCloud<PointT>::ConstPtr model,
+                                               pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                               float radius,
+                                               pcl::PointCloud<pcl::Normal>::Ptr& normals,
+                                               pcl::search::Search<PointT>::Ptr searchTree,
+                                               int numThreads,
+                                               const EstimatorCache::Ptr &estimators) const
+{
+    LOG_ASSERT(normals.get() == 0);
+    LOG_ASSERT(!model->isOrganized());
+    LOG_ASSERT(m_consistentNormalsMethod == 0 || m_consistentNormalsMethod == 1);
+
+    // union of the support regions of the keypoints
+    std::vector<std::vector<int> > regions(keypoints->size());
+    searchTree->setInputCloud(model);
+    #pragma omp parallel for schedule(dynamic, 16) num_threads(numThreads > 0 ? numThreads : omp_get_max_threads())
+    for (int i = 0; i < (int)keypoints->size(); i++)
+    {
+        std::vector<float> distances;
+        if (pcl::isFinite(keypoints->points[i]))
+            searchTree->radiusSearch(keypoints->points[i], radius, regions[i], distances);
+    }
+
+    std::vector<char> inSupport(model->size(), 0);
+    pcl::IndicesPtr support(new std::vector<int>());
+    for (const std::vector<int> &region : regions)
+    {
+        for (int index : region)
+        {
+            if (!inSupport[index])
+            {
+                inSupport[index] = 1;
+                support->push_back(index);
+            }
+        }
+    }
+    std::sort(support->begin(), support->end());
+    LOG_INFO("computing " << support->size() << " of " << model->size() << " normals in the support regions of " <<
+             keypoints->size() << " keypoints");
+
+    boost::shared_ptr<pcl::NormalEstimationOMP<PointT, pcl::Normal> > normalEstPtr =
+            EstimatorCache::acquire<pcl::NormalEstimationOMP<PointT, pcl::Normal> >(estimators);
+    pcl::NormalEstimationOMP<PointT, pcl::Normal> &normalEst = *normalEstPtr;
+    normalEst.setInputCloud(model);
+    normalEst.setIndices(support);
+    normalEst.setSearchMethod(searchTree);
+    normalEst.setRadiusSearch(m_normalRadius);
+    normalEst.setNumberOfThreads(numThreads);
+
+    if (m_consistentNormalsMethod == 1)
+    {
+        // equal to computeNormals(): point normals toward the centroid, then invert them
+        Eigen::Vector4f centroid;
+        pcl::compute3DCentroid(*model, centroid);
+        normalEst.setViewPoint(centroid[0], centroid[1], centroid[2]);
+    }
+    else
+    {
+        normalEst.useSensorOriginAsViewPoint();
+    }
+
+    pcl::PointCloud<pcl::Normal> supportNormals;
+    normalEst.compute(supportNormals);
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    pcl::Normal unknown;
+    unknown.normal_x = unknown.normal_y = unknown.normal_z = unknown.curvature = nan;
+    normals = pcl::PointCloud<pcl::Normal>::Ptr(new pcl::PointCloud<pcl::Normal>(model->width, model->height, unknown));
+    for (int i = 0; i < (int)support->size(); i++)
+    {
+        pcl::Normal &normal = normals->points[(*support)[i]];
+        normal = supportNormals.points[i];
+        if (m_consistentNormalsMethod == 1)
+        {
+            normal.normal_x *= -1;
+            normal.normal_y *= -1;
+            normal.normal_z *= -1;
+        }
+    }
+}
+
+void ImplicitShapeModel::filterNormals(pcl::PointCloud<PointT>::ConstPtr model,
+                                       pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                       pcl::PointCloud<PointT>::ConstPtr& modelWithoutNaN,
+                                       pcl::PointCloud<pcl::Normal>::ConstPtr& normalsWithoutNaN) const
+{
+    LOG_ASSERT(modelWithoutNaN.get() == 0);
+    LOG_ASSERT(normalsWithoutNaN.get() == 0);
+
+    // indices of the points with valid normals
+    std::vector<int> mapping;
+    mapping.reserve(normals->size());
+    for (int i = 0; i < (int)normals->size(); i++)
+    {
+        // masked points of organized clouds can have valid normals
+        const pcl::Normal &normal = normals->points[i];
+        if (pcl_isfinite(normal.normal_x) && pcl_isfinite(normal.normal_y) && pcl_isfinite(normal.normal_z) &&
+                pcl::isFinite(model->points[i]))
+            mapping.push_back(i);
+    }
+
+    // unorganized clouds without NaN normals are used as they are
+    if (mapping.size() == normals->size() && !model->isOrganized())
+    {
+        modelWithoutNaN = model;
+        normalsWithoutNaN = normals;
+        return;
+    }
+
+    // create new point clouds without NaN normals
+    pcl::PointCloud<PointT>::Ptr filteredModel(new pcl::PointCloud<PointT>());
+    pcl::PointCloud<pcl::Normal>::Ptr filteredNormals(new pcl::PointCloud<pcl::Normal>());
+    pcl::copyPointCloud(*model, mapping, *filteredModel);
+    pcl::copyPointCloud(*normals, mapping, *filteredNormals);
+    filteredModel->is_dense = true;
+    filteredNormals->is_dense = true;
+
+    modelWithoutNaN = filteredModel;
+    normalsWithoutNaN = filteredNormals;
+}
+
+void ImplicitShapeModel::splitPointCloud(const pcl::PointCloud<PointNormalT> &points,
+                                         pcl::PointCloud<PointT> &positions,
+                                         pcl::PointCloud<pcl::Normal> &normals) const
+{
+    const int numPoints = (int)points.size();
+    positions.header = points.header;
+    positions.points.resize(numPoints);
+    positions.width = points.width;
+    positions.height = points.height;
+    positions.is_dense = points.is_dense;
+    positions.sensor_origin_ = points.sensor_origin_;
+    positions.sensor_orientation_ = points.sensor_orientation_;
+    normals.header = points.header;
+    normals.points.resize(numPoints);
+    normals.width = points.width;
+    normals.height = points.height;
+    normals.is_dense = points.is_dense;
+    normals.sensor_origin_ = points.sensor_origin_;
+    normals.sensor_orientation_ = points.sensor_orientation_;
+
+    #pragma omp parallel for if(numPoints > 10000)
+    for (int i = 0; i < numPoints; i++)
+    {
+        const PointNormalT &point = points.points[i];
+        PointT &position = positions.points[i];
+        position.x = point.x;
+        position.y = point.y;
+        position.z = point.z;
+        copyPointColor(point, position);
+
+        pcl::Normal &normal = normals.points[i];
+        normal.normal_x = point.normal_x;
+        normal.normal_y = point.normal_y;
+        normal.normal_z = point.normal_z;
+        normal.curvature = point.curvature;
+    }
+}
+
+std::string ImplicitShapeModel::getFeatureCacheConfig(bool hasNormals) const
+{
+    // everything that changes the features computed from a model file
+    Json::Value config(Json::objectValue);
+    config["Keypoints"] = m_keypointsDetector->configToJson();
+    config["Features"] = m_featureDescriptor->configToJson();
+    config["GlobalFeatures"] = m_globalFeatureDescriptor->configToJson();
+    config["UseVoxelFiltering"] = m_useVoxelFiltering;
+    config["VoxelLeafSize"] = m_voxelLeafSize;
+    config["NormalRadius"] = m_normalRadius;
+    config["ConsistentNormalsK"] = m_consistentNormalsK;
+    config["ConsistentNormalsMethod"] = m_consistentNormalsMethod;
+    config["SetColorToZero"] = m_setColorToZero;
+    config["HasNormals"] = hasNormals;
+    return toJsonString(config, false);
+}
+
+Json::Value ImplicitShapeModel::getTrainingDataConfig() const
+{
+    // the feature configuration besides the normals, which depend on the files
+    Json::Value config(Json::objectValue);
+    config["Features"] = getFeatureCacheConfig(false);
+    config["BoundingBoxType"] = m_bbType;
+    config["MVBBEpsilon"] = m_mvbbEpsilon;
+    config["MVBBLeafSize"] = m_mvbbLeafSize;
+    return config;
+}
+
+std::string ImplicitShapeModel::getFeatureShardKey() const
+{
+    return FeatureCache::computeConfigKey(toJsonString(getTrainingDataConfig(), false));
+}
+
+std::vector<std::string> ImplicitShapeModel::getCheckpointKeys() const
+{
+    // training data: the feature configuration and the files identified by their size and modification time
+    Json::Value config = getTrainingDataConfig();
+    Json::Value files(Json::arrayValue);
+    for (auto it = m_trainingModelsFilenames.begin(); it != m_trainingModelsFilenames.end(); it++)
+    {
+        for (const std::string &filename : it->second)
+        {
+            boost::system::error_code error;
+            Json::Value file(Json::objectValue);
+            file["ClassId"] = it->first;
+            file["Name"] = filename;
+            file["Size"] = std::to_string(boost::filesystem::file_size(filename, error));
+            file["Time"] = std::to_string(boost::filesystem::last_write_time(filename, error));
+            files.append(file);
+        }
+    }
+    for (const std::string &filename : m_feature_shards)
+    {
+        boost::system::error_code error;
+        Json::Value file(Json::objectValue);
+        file["Shard"] = filename;
+        file["Size"] = std::to_string(boost::filesystem::file_size(filename, error));
+        file["Time"] = std::to_string(boost::filesystem::last_write_time(filename, error));
+        files.append(file);
+    }
+    config["Files"] = files;
+
+    std::vector<std::string> keys(TrainingCheckpoint::NumStages);
+    keys[TrainingCheckpoint::TrainingData] = FeatureCache::computeConfigKey(toJsonString(config, false));
+
+    config = Json::Value(Json::objectValue);
+    config["Previous"] = keys[TrainingCheckpoint::TrainingData];
+    config["FeatureWeighting"] = m_featureRanking->configToJson();
+    config["UseFeatureDeduplication"] = m_use_feature_deduplication;
+    config["DeduplicationDescriptorDistance"] = m_deduplication_descriptor_distance;
+    config["DeduplicationVoteDistance"] = m_deduplication_vote_distance;
+    config["FLANNNumKDTrees"] = m_num_kd_trees;
+    config["FLANNExactMatch"] = m_flann_exact_match;
+    config["FLANNChecks"] = m_index_params.checks;
+    keys[TrainingCheckpoint::Ranking] = FeatureCache::computeConfigKey(toJsonString(config, false));
+
+    config = Json::Value(Json::objectValue);
+    config["Previous"] = keys[TrainingCheckpoint::Ranking];
+    config["Clustering"] = m_clustering->configToJson();
+    config["DistanceType"] = m_distanceType;
+    if (m_use_projection)
+    {
+        config["ProjectionWhitening"] = m_projection_whitening;
+        config["ProjectionVariance"] = m_projection_variance;
+        config["ProjectionMaxDim"] = m_projection_max_dim;
+        config["ProjectionSamples"] = m_projection_samples;
+    }
+    keys[TrainingCheckpoint::Clustering] = FeatureCache::computeConfigKey(toJsonString(config, false));
+
+    // the activation matches with the index built with the flann parameters
+    config = Json::Value(Json::objectValue);
+    config["Previous"] = keys[TrainingCheckpoint::Clustering];
+    config["Codebook"] = m_codebook->configToJson();
+    config["FLANNIndexType"] = m_index_params.type;
+    config["HNSWM"] = m_index_params.hnsw_m;
+    config["HNSWEfConstruction"] = m_index_params.hnsw_ef_construction;
+    config["HNSWEfSearch"] = m_index_params.hnsw_ef_search;
+    config["MIHTables"] = m_index_params.mih_tables;
+    config["FLANNEmbedHistograms"] = m_index_params.embed_histograms;
+    config["FLANNEmbeddingOrder"] = m_index_params.embedding_order;
+    config["FLANNEmbeddingRerank"] = m_index_params.embedding_rerank;
+    keys[TrainingCheckpoint::Activation] = FeatureCache::computeConfigKey(toJsonString(config, false));
+
+    return keys;
+}
+
+Json::Value ImplicitShapeModel::iChildConfigsToJson() const
+{
+    Json::Value children(Json::objectValue);
+
+    children["Codebook"] = m_codebook->configToJson();
+    children["Keypoints"] = m_keypointsDetector->configToJson();
+    children["Features"] = m_featureDescriptor->configToJson();
+    children["GlobalFeatures"] = m_globalFeatureDescriptor->configToJson();
+    children["Clustering"] = m_clustering->configToJson();
+    children["Voting"] = m_voting->configToJson();
+    children["FeatureWeighting"] = m_featureRanking->configToJson(); // TODO VS: rename config entry to FeatureRanking in future
+
+    return children;
+}
+
+bool ImplicitShapeModel::iChildConfigsFromJson(const Json::Value& object)
+{
+    const Json::Value *codebook = &(object["Codebook"]);
+    const Json::Value *keypoints = &(object["Keypoints"]);
+    const Json::Value *features = &(object["Features"]);
+    const Json::Value *global_features = &(object["GlobalFeatures"]);
+    const Json::Value *clustering = &(object["Clustering"]);
+    const Json::Value *voting = &(object["Voting"]);
+    const Json::Value *feature_ranking = &(object["FeatureWeighting"]);
+
+    if (codebook->isNull() || !codebook->isObject() ||
+            keypoints->isNull() || !keypoints->isObject() ||
+            features->isNull() || !features->isObject() ||
+            clustering->isNull() || !clustering->isObject() ||
+            voting->isNull() || !voting->isObject() ||
+            feature_ranking->isNull() || !feature_ranking->isObject()) {
+        LOG_ERROR("could not find necessary json entries");
+        return false;
+    }
+
+    // handle global features separately to be able to use old configs and trained files
+    bool use_dummy = false;
+    Json::Value dummy(Json::objectValue);
+    dummy["Type"] = Json::Value("Dummy");
+
+    if (global_features->isNull() || !global_features->isObject())
+    {
+        use_dummy = true;
+        LOG_WARN("No global feature descriptor available, using Dummy global feature!");
+    }
+
+    // clear
+    delete m_codebook;
+    delete m_keypointsDetector;
+    delete m_featureDescriptor;
+    delete m_globalFeatureDescriptor;
+    delete m_clustering;
+    delete m_voting;
+    delete m_featureRanking;
+
+    // create new child objects
+    m_codebook = Factory<Codebook>::create(*codebook);
+    m_keypointsDetector = Factory<Keypoints>::create(*keypoints);
+    m_featureDescriptor = Factory<Features>::create(*features);
+    m_globalFeatureDescriptor = use_dummy ? Factory<Features>::create(dummy) : Factory<Features>::create(*global_features);
+    m_clustering = Factory<Clustering>::create(*clustering);
+    m_voting = Factory<Voting>::create(*voting);
+    m_featureRanking = Factory<FeatureRanking>::create(*feature_ranking);
+
+    if (!m_codebook || !m_keypointsDetector || !m_featureDescriptor || !m_globalFeatureDescriptor ||
+            !m_clustering || !m_voting || !m_featureRanking)
+        throw RuntimeException("Could not create object(s). The configuration file might be corrupted.");
+
+    // set global descriptor for the detection step
+    m_voting->setGlobalFeatureDescriptor(m_globalFeatureDescriptor);
+
+    return true;
+}
+
+void ImplicitShapeModel::iSaveData(boost::archive::binary_oarchive &oa) const
+{
+    m_codebook->saveData(oa);
+    m_keypointsDetector->saveData(oa);
+    m_featureDescriptor->saveData(oa);
+    m_globalFeatureDescriptor->saveData(oa);
+    m_clustering->saveData(oa);
+    m_voting->saveData(oa);
+    m_featureRanking->saveData(oa);
+
+    // the flann index is stored after all child objects, so that models without index can still be read
+    std::vector<char> indexData;
+    if(saveFlannIndexHeader(oa, indexData))
+        oa << indexData;
+
+    // compressed codewords, the index on the codes is rebuilt on the first detection
+    m_codebook->saveCompressedData(oa);
+
+    // index for global features
+    m_voting->saveGlobalFeatureIndex(oa);
+
+    // scalar quantized codewords
+    m_codebook->saveScalarQuantizedData(oa);
+
+    // projection of the local descriptors into the space of the codewords
+    m_projection.saveData(oa);
+
+    // predictor of the discriminativeness of scene features
+    m_feature_rejection.saveData(oa);
+}
+
+bool ImplicitShapeModel::iLoadData(boost::archive::binary_iarchive &ia)
+{
+    // objects have to be initialized already
+    if (!m_codebook || !m_keypointsDetector || !m_featureDescriptor || !m_globalFeatureDescriptor ||
+            !m_clustering || !m_voting || !m_featureRanking) {
+        LOG_ERROR("object is not initialized");
+        return false;
+    }
+
+    // with a cpu affinity, the codebook is allocated on the memory node of these cpus
+    ThreadScope threads(0, m_cpus);
+
+    // TODO VS: this is necessary since objects are created before config is read in json_object.cpp
+    m_voting->setSVMPath(m_svm_path);
+    m_codebook->setClassFilter(m_load_classes);
+    m_voting->setClassFilter(m_load_classes);
+    m_projection.clear();
+    m_feature_rejection.clear();
+
+    // init data for objects
+    if (!m_codebook->loadData(ia) ||
+            !m_keypointsDetector->loadData(ia) ||
+            !m_featureDescriptor->loadData(ia) ||
+            !m_globalFeatureDescriptor->loadData(ia) ||
+            !m_clustering->loadData(ia) ||
+            !m_voting->loadData(ia) ||
+            !m_featureRanking->loadData(ia))
+    {
+        LOG_ERROR("could not load child objects");
+        return false;
+    }
+
+    // load the stored flann index, if any; otherwise it is built on the first detection
+    m_index_created = false;
+    try
+    {
+        bool hasIndex;
+        ia >> hasIndex;
+        if(hasIndex)
+        {
+            std::string distType;
+            KnnIndexParams params = m_index_params;
+            std::vector<int> codewordIds;
+            std::vector<char> indexData;
+            ia >> distType;
+            ia >> params.type;
+            ia >> params.kd_trees;
+            ia >> params.hnsw_m;
+            ia >> params.hnsw_ef_construction;
+            ia >> codewordIds;
+            ia >> indexData;
+            loadFlannIndex(distType, params, codewordIds, indexData);
+        }
+    }
+    catch(const boost::archive::archive_exception&)
+    {
+        LOG_INFO("no flann index stored, it will be built on the first detection");
+        initGlobalFeatureIndex(0);
+        return true;
+    }
+
+    try
+    {
+        if(!m_codebook->loadCompressedData(ia))
+            return false;
+    }
+    catch(const boost::archive::archive_exception&)
+    {
+        LOG_INFO("model contains no compressed codebook");
+        initGlobalFeatureIndex(0);
+        return true;
+    }
+
+    initGlobalFeatureIndex(&ia);
+
+    try
+    {
+        if(!m_codebook->loadScalarQuantizedData(ia))
+            return false;
+    }
+    catch(const boost::archive::archive_exception&)
+    {
+        LOG_INFO("model contains no scalar quantized codebook");
+        if(m_codebook->isCompressed())
+            m_index_created = false;
+        return true;
+    }
+
+    try
+    {
+        if(!m_projection.loadData(ia))
+        {
+            LOG_ERROR("invalid descriptor projection");
+            return false;
+        }
+    }
+    catch(const boost::archive::archive_exception&)
+    {
+        m_projection.clear();
+        LOG_INFO("model contains no descriptor projection");
+        if(m_codebook->isCompressed())
+            m_index_created = false;
+        return true;
+    }
+
+    try
+    {
+        if(!m_feature_rejection.loadData(ia))
+        {
+            LOG_ERROR("invalid feature rejection");
+            return false;
+        }
+    }
+    catch(const boost::archive::archive_exception&)
+    {
+        m_feature_rejection.clear();
+        LOG_INFO("model contains no feature rejection");
+    }
+
+    if(m_codebook->isCompressed())
+        m_index_created = false;
+    return true;
+}
+
+bool ImplicitShapeModel::iUseFlatData() const
+{
+    return m_flat_model;
+}
+
+bool ImplicitShapeModel::iUseCompressedData() const
+{
+    // flat models are mapped and can not be compressed
+    if (m_compress_model && m_flat_model)
+        LOG_WARN("CompressModel is ignored for flat models");
+    return m_compress_model && !m_flat_model;
+}
+
+bool ImplicitShapeModel::iSaveFlatData(const std::string &file) const
+{
+    FlatModelWriter writer(file, m_numThreads);
+
+    // the codebook is written as flat sections, the other objects are small and stored in an archive section in
+    // the order of iSaveData()
+    std::ostringstream archive;
+    {
+        boost::archive::binary_oarchive oa(archive);
+        m_codebook->saveFlatData(writer, oa);
+        m_keypointsDetector->saveData(oa);
+        m_featureDescriptor->saveData(oa);
+        m_globalFeatureDescriptor->saveData(oa);
+        m_clustering->saveData(oa);
+        m_voting->saveData(oa);
+        m_featureRanking->saveData(oa);
+
+        std::vector<char> indexData;
+        if(saveFlannIndexHeader(oa, indexData))
+            writer.addSection("flann_index", indexData);
+
+        m_codebook->saveCompressedData(oa);
+        m_voting->saveGlobalFeatureIndex(oa);
+        m_codebook->saveScalarQuantizedData(oa);
+        m_projection.saveData(oa);
+        m_feature_rejection.saveData(oa);
+    }
+
+    const std::string data = archive.str();
+    writer.addSection("archive", data.data(), data.size());
+    return writer.close();
+}
+
+bool ImplicitShapeModel::iLoadFlatData(const std::string &file)
+{
+    // objects have to be initialized already
+    if (!m_codebook || !m_keypointsDetector || !m_featureDescriptor || !m_globalFeatureDescriptor ||
+            !m_clustering || !m_voting || !m_featureRanking) {
+        LOG_ERROR("object is not initialized");
+        return false;
+    }
+
+    // processes and models mapping the same file share its pages
+    FlatModel::MapOptions options;
+    options.prefetch = m_flat_model_prefetch;
+    options.hugePages = m_flat_model_huge_pages;
+    std::shared_ptr<const FlatModel> model = FlatModel::open(file, options);
+    if (!model)
+        return false;
+
+    // the mapped pages are shared, only the copied codeword descriptors are allocated on the memory node of these cpus
+    ThreadScope threads(0, m_cpus);
+
+    m_voting->setSVMPath(m_svm_path);
+    m_codebook->setClassFilter(m_load_classes);
+    m_voting->setClassFilter(m_load_classes);
+    m_projection.clear();
+    m_feature_rejection.clear();
+
+    const FlatArray<char> archiveData = model->getSection<char>("archive");
+    std::istringstream archive(std::string(archiveData.begin(), archiveData.end()));
+    boost::archive::binary_iarchive ia(archive);
+    if (!m_codebook->loadFlatData(model, ia) ||
+            !m_keypointsDetector->loadData(ia) ||
+            !m_featureDescriptor->loadData(ia) ||
+            !m_globalFeatureDescriptor->loadData(ia) ||
+            !m_clustering->loadData(ia) ||
+            !m_voting->loadData(ia) ||
+            !m_featureRanking->loadData(ia))
+    {
+        LOG_ERROR("could not load child objects");
+        return false;
+    }
+
+    m_index_created = false;
+    bool hasIndex;
+    ia >> hasIndex;
+    if(hasIndex)
+    {
+        std::string distType;
+        KnnIndexParams params = m_index_params;
+        std::vector<int> codewordIds;
+        ia >> distType;
+        ia >> params.type;
+        ia >> params.kd_trees;
+        ia >> params.hnsw_m;
+        ia >> params.hnsw_ef_construction;
+        ia >> codewordIds;
+
+        const FlatArray<char> index = model->getSection<char>("flann_index");
+        loadFlannIndex(distType, params, codewordIds, std::vector<char>(index.begin(), index.end()));
+    }
+
+    // flat models are always written with all optional parts
+    if(!m_codebook->loadCompressedData(ia))
+        return false;
+    initGlobalFeatureIndex(&ia);
+    if(!m_codebook->loadScalarQuantizedData(ia))
+        return false;
+
+    // flat models written before the descriptor projection end here
+    try
+    {
+        if(!m_projection.loadData(ia))
+        {
+            LOG_ERROR("invalid descriptor projection");
+            return false;
         }
-#endif
-        else
+    }
+    catch(const boost::archive::archive_exception&)
+    {
+        m_projection.clear();
+    }
+
+    // and before the feature rejection
+    try
+    {
+        if(!m_feature_rejection.loadData(ia))
         {
-            LOG_WARN("Invalid consistent normals method: " << m_consistentNormalsMethod << "! Skipping consistent normals.");
+            LOG_ERROR("invalid feature rejection");
+            return false;
         }
     }
-}
+    catch(const boost::archive::archive_exception&)
+    {
+        m_feature_rejection.clear();
+    }
 
+    if(m_codebook->isCompressed())
+        m_index_created = false;
 
-void ImplicitShapeModel::filterNormals(pcl::PointCloud<PointT>::ConstPtr model,
-                                       pcl::PointCloud<pcl::Normal>::ConstPtr normals,
-                                       pcl::PointCloud<PointT>::Ptr& modelWithoutNaN,
-                                       pcl::PointCloud<pcl::Normal>::Ptr& normalsWithoutNaN)
+    LOG_INFO("mapped " << model->getMappedBytes() / (1024 * 1024) << " MB of flat model data");
+    return true;
+}
+
+bool ImplicitShapeModel::saveFlannIndexHeader(boost::archive::binary_oarchive &oa, std::vector<char> &indexData) const
 {
-    LOG_ASSERT(modelWithoutNaN.get() == 0);
-    LOG_ASSERT(normalsWithoutNaN.get() == 0);
+    bool hasIndex = m_index_created && isFlannIndexValid() && !m_flann_helper->isQuantized() &&
+            !m_flann_helper->isEmbedded() && m_flann_helper->saveIndex(indexData);
+    oa << hasIndex;
+    if(hasIndex)
+    {
+        std::string distType = m_flann_helper->getDistType();
+        const KnnIndexParams& params = m_flann_helper->getIndexParams();
+        std::vector<int> codewordIds = m_flann_helper->getCodewordIds();
+        oa << distType;
+        oa << params.type;
+        oa << params.kd_trees;
+        oa << params.hnsw_m;
+        oa << params.hnsw_ef_construction;
+        oa << codewordIds;
+    }
+    return hasIndex;
+}
 
-    // filter NaN normals
-    std::vector<int> mapping;
-    normalsWithoutNaN = pcl::PointCloud<pcl::Normal>::Ptr(new pcl::PointCloud<pcl::Normal>());
-    pcl::removeNaNNormalsFromPointCloud(*normals, *normalsWithoutNaN, mapping);
+std::shared_ptr<FlannHelper> ImplicitShapeModel::createCodewordDataset(std::vector<std::shared_ptr<Codeword> > &codewords) const
+{
+    std::shared_ptr<const FlatModel> model;
+    const FlatArray<float> descriptors = m_codebook->getMappedDescriptors(model);
+    if (model)
+    {
+        std::shared_ptr<FlannHelper> helper = std::make_shared<FlannHelper>(model, descriptors, m_codebook->getDim());
+        helper->setCodewords(codewords);
+        return helper;
+    }
 
-    // create new point cloud without NaN normals
-    modelWithoutNaN = pcl::PointCloud<PointT>::Ptr(new pcl::PointCloud<PointT>());
-    for (int i = 0; i < (int)mapping.size(); i++)
-        modelWithoutNaN->push_back(model->at(mapping[i]));
+    std::shared_ptr<FlannHelper> helper = std::make_shared<FlannHelper>(m_codebook->getDim(), m_codebook->getSize());
+    helper->createDataset(codewords);
+    return helper;
 }
 
-Json::Value ImplicitShapeModel::iChildConfigsToJson() const
+void ImplicitShapeModel::loadFlannIndex(const std::string &distType, const KnnIndexParams &params,
+                                        const std::vector<int> &codewordIds, const std::vector<char> &indexData)
 {
-    Json::Value children(Json::objectValue);
+    if(!m_load_classes.empty())
+    {
+        LOG_INFO("the stored flann index covers all classes, it is rebuilt over the codewords of the loaded classes");
+        return;
+    }
 
-    children["Codebook"] = m_codebook->configToJson();
-    children["Keypoints"] = m_keypointsDetector->configToJson();
-    children["Features"] = m_featureDescriptor->configToJson();
-    children["GlobalFeatures"] = m_globalFeatureDescriptor->configToJson();
-    children["Clustering"] = m_clustering->configToJson();
-    children["Voting"] = m_voting->configToJson();
-    children["FeatureWeighting"] = m_featureRanking->configToJson(); // TODO VS: rename config entry to FeatureRanking in future
+    // the index is only used if it was built with the current configuration, search parameters may differ;
+    // embedded indices are not stored, a stored index is not used if the distance is to be embedded
+    const bool embed = m_index_params.embed_histograms && MetricEmbedding::isSupported(toIndexDistance(distType));
+    if(!embed && distType == m_distance->getType() && params.type == m_index_params.type &&
+            params.kd_trees == m_index_params.kd_trees && params.hnsw_m == m_index_params.hnsw_m &&
+            params.hnsw_ef_construction == m_index_params.hnsw_ef_construction)
+    {
+        std::vector<std::shared_ptr<Codeword>> codewords = m_codebook->getCodewords();
+        m_flann_helper = createCodewordDataset(codewords);
+        if(m_flann_helper->getCodewordIds() == codewordIds && m_flann_helper->loadIndex(distType, params, indexData))
+        {
+            m_index_created = true;
+            m_voting->setDistanceType(distType);
+            m_voting->setIndexParams(m_index_params);
+        }
+    }
 
-    return children;
+    if(!m_index_created)
+        LOG_WARN("stored flann index does not match the codebook or configuration, it will be rebuilt");
 }
 
-bool ImplicitShapeModel::iChildConfigsFromJson(const Json::Value& object)
+void ImplicitShapeModel::initGlobalFeatureIndex(boost::archive::binary_iarchive *ia)
 {
-    const Json::Value *codebook = &(object["Codebook"]);
-    const Json::Value *keypoints = &(object["Keypoints"]);
-    const Json::Value *features = &(object["Features"]);
-    const Json::Value *global_features = &(object["GlobalFeatures"]);
-    const Json::Value *clustering = &(object["Clustering"]);
-    const Json::Value *voting = &(object["Voting"]);
-    const Json::Value *feature_ranking = &(object["FeatureWeighting"]);
+    // the index for global features is loaded or built here and not concurrently during the first detection
+    m_distance->setDimension(m_codebook->getDim());
+    m_voting->setDistanceType(m_distance->getType());
+    m_voting->setIndexParams(m_index_params);
 
-    if (codebook->isNull() || !codebook->isObject() ||
-            keypoints->isNull() || !keypoints->isObject() ||
-            features->isNull() || !features->isObject() ||
-            clustering->isNull() || !clustering->isObject() ||
-            voting->isNull() || !voting->isObject() ||
-            feature_ranking->isNull() || !feature_ranking->isObject()) {
-        LOG_ERROR("could not find necessary json entries");
-        return false;
+    if(ia)
+    {
+        try
+        {
+            m_voting->loadGlobalFeatureIndex(*ia);
+        }
+        catch(const boost::archive::archive_exception&)
+        {
+            LOG_INFO("no flann index for global features stored");
+        }
     }
 
-    // handle global features separately to be able to use old configs and trained files
-    bool use_dummy = false;
-    Json::Value dummy(Json::objectValue);
-    dummy["Type"] = Json::Value("Dummy");
+    m_voting->buildGlobalFeatureIndex();
+}
 
-    if (global_features->isNull() || !global_features->isObject())
+bool ImplicitShapeModel::autotuneIndex(float target_recall, int k, int num_queries)
+{
+    if(m_codebook->getSize() == 0)
     {
-        use_dummy = true;
-        LOG_WARN("No global feature descriptor available, using Dummy global feature!");
+        LOG_WARN("the codebook is empty, train or load a model before tuning the index");
+        return false;
+    }
+    if(m_distance->getType() == "Hamming" || m_codebook->isCompressed())
+    {
+        LOG_WARN("binary and compressed codebooks are searched exhaustively, there is nothing to tune");
+        return false;
+    }
+    if(m_index_params.type == "CUDA")
+    {
+        LOG_INFO("the CUDA index is exact, there is nothing to tune");
+        return true;
     }
 
-    // clear
-    delete m_codebook;
-    delete m_keypointsDetector;
-    delete m_featureDescriptor;
-    delete m_globalFeatureDescriptor;
-    delete m_clustering;
-    delete m_voting;
-    delete m_featureRanking;
+    std::vector<std::shared_ptr<Codeword>> codewords = m_codebook->getCodewords();
+    FlannHelper flannHelper(m_codebook->getDim(), m_codebook->getSize());
+    flannHelper.createDataset(codewords);
+
+    std::map<int, int> codewordRows;
+    for(int i = 0; i < (int)codewords.size(); i++)
+        codewordRows[codewords[i]->getId()] = i;
+
+    // without training descriptors, e.g. for a loaded model, the codewords are used as queries
+    bool useTrainingDescriptors = !m_tuning_descriptors.empty();
+    std::vector<int> samples(useTrainingDescriptors ? m_tuning_descriptors.size() : codewords.size());
+    std::iota(samples.begin(), samples.end(), 0);
+    std::mt19937 rng(42);
+    std::shuffle(samples.begin(), samples.end(), rng);
+    samples.resize(std::min((int)samples.size(), std::max(num_queries, 1)));
+
+    const int dim = m_codebook->getDim();
+    flann::Matrix<float> queries(new float[samples.size() * dim], samples.size(), dim);
+    std::vector<int> excluded(samples.size(), -1);
+    for(int q = 0; q < (int)samples.size(); q++)
+    {
+        const std::vector<float>& descriptor = useTrainingDescriptors ? m_tuning_descriptors[samples[q]] :
+                                                                        codewords[samples[q]]->getData();
+        std::copy(descriptor.begin(), descriptor.begin() + dim, queries[q]);
+
+        if(!useTrainingDescriptors)
+            excluded[q] = samples[q];
+        else if(m_tuning_codeword_ids[samples[q]] >= 0 && codewordRows.count(m_tuning_codeword_ids[samples[q]]))
+            excluded[q] = codewordRows[m_tuning_codeword_ids[samples[q]]];
+    }
 
-    // create new child objects
-    m_codebook = Factory<Codebook>::create(*codebook);
-    m_keypointsDetector = Factory<Keypoints>::create(*keypoints);
-    m_featureDescriptor = Factory<Features>::create(*features);
-    m_globalFeatureDescriptor = use_dummy ? Factory<Features>::create(dummy) : Factory<Features>::create(*global_features);
-    m_clustering = Factory<Clustering>::create(*clustering);
-    m_voting = Factory<Voting>::create(*voting);
-    m_featureRanking = Factory<FeatureRanking>::create(*feature_ranking);
+    KnnIndexParams params = m_index_params;
+    IndexTuner tuner(k, target_recall);
+    bool reached = tuner.tune(m_distance->getType(), flannHelper.dataset, queries, excluded, params);
+    delete[] queries.ptr();
 
-    if (!m_codebook || !m_keypointsDetector || !m_featureDescriptor || !m_globalFeatureDescriptor ||
-            !m_clustering || !m_voting || !m_featureRanking)
-        throw RuntimeException("Could not create object(s). The configuration file might be corrupted.");
+    if(tuner.getResults().empty() || (!reached && m_flann_exact_match))
+        return false;
 
-    // set global descriptor for the detection step
-    m_voting->setGlobalFeatureDescriptor(m_globalFeatureDescriptor);
+    if(m_index_params.type == "HNSW")
+        LOG_INFO("selected HNSW index with ef " << params.hnsw_ef_search);
+    else
+        LOG_INFO("selected KDTree index with " << params.kd_trees << " trees and " << params.checks << " checks");
 
-    return true;
-}
+    if(m_flann_exact_match)
+    {
+        LOG_INFO("disabling exact matching in favor of the tuned approximate search");
+        m_flann_exact_match = false;
+    }
+    m_index_params = params;
+    m_num_kd_trees = params.kd_trees;
 
-void ImplicitShapeModel::iSaveData(boost::archive::binary_oarchive &oa) const
-{
-    m_codebook->saveData(oa);
-    m_keypointsDetector->saveData(oa);
-    m_featureDescriptor->saveData(oa);
-    m_globalFeatureDescriptor->saveData(oa);
-    m_clustering->saveData(oa);
-    m_voting->saveData(oa);
-    m_featureRanking->saveData(oa);
+    // the index is rebuilt with the new parameters on the next detection
+    m_flann_helper.reset();
+    m_index_created = false;
+    return reached;
 }
 
-bool ImplicitShapeModel::iLoadData(boost::archive::binary_iarchive &ia)
+bool ImplicitShapeModel::isFlannIndexValid() const
 {
-    // objects have to be initialized already
-    if (!m_codebook || !m_keypointsDetector || !m_featureDescriptor || !m_globalFeatureDescriptor ||
-            !m_clustering || !m_voting || !m_featureRanking) {
-        LOG_ERROR("object is not initialized");
+    if(!m_flann_helper || !m_flann_helper->m_index_created || m_flann_helper->getDistType() != m_distance->getType())
         return false;
-    }
 
-    // TODO VS: this is necessary since objects are created before config is read in json_object.cpp
-    m_voting->setSVMPath(m_svm_path);
+    // a compressed codebook is searched on its codes
+    if(m_flann_helper->isQuantized() != m_codebook->isCompressed())
+        return false;
 
-    // init data for objects
-    if (!m_codebook->loadData(ia) ||
-            !m_keypointsDetector->loadData(ia) ||
-            !m_featureDescriptor->loadData(ia) ||
-            !m_globalFeatureDescriptor->loadData(ia) ||
-            !m_clustering->loadData(ia) ||
-            !m_voting->loadData(ia) ||
-            !m_featureRanking->loadData(ia))
-    {
-        LOG_ERROR("could not load child objects");
+    // the index returns dataset rows, which must correspond to the codebook order used during detection
+    const std::vector<std::shared_ptr<Codeword>> &codewords = m_codebook->getCodewords();
+    const std::vector<int>& codewordIds = m_flann_helper->getCodewordIds();
+    if(codewordIds.size() != codewords.size())
         return false;
+    for(int i = 0; i < (int)codewords.size(); i++)
+    {
+        if(!codewords[i] || codewords[i]->getId() != codewordIds[i])
+            return false;
     }
-
     return true;
 }
 
@@ -1000,6 +4125,10 @@ Json::Value ImplicitShapeModel::iDataToJson() const
     data["Clustering"] = m_clustering->dataToJson();
     data["Voting"] = m_voting->dataToJson();
     data["FeatureWeighting"] = m_featureRanking->dataToJson();
+    if (m_projection.isTrained())
+        data["DescriptorProjection"] = m_projection.dataToJson();
+    if (m_feature_rejection.isTrained())
+        data["FeatureRejection"] = m_feature_rejection.dataToJson();
     return data;
 }
 
@@ -1076,6 +4205,136 @@ bool ImplicitShapeModel::iDataFromJson(const Json::Value& object)
         LOG_ERROR("could not create child objects");
         return false;
     }
+
+    m_projection.clear();
+    if (object.isMember("DescriptorProjection") && !m_projection.dataFromJson(object["DescriptorProjection"])) {
+        LOG_ERROR("invalid descriptor projection");
+        return false;
+    }
+
+    m_feature_rejection.clear();
+    if (object.isMember("FeatureRejection") && !m_feature_rejection.dataFromJson(object["FeatureRejection"])) {
+        LOG_ERROR("invalid feature rejection");
+        return false;
+    }
+
+    initGlobalFeatureIndex(0);
+    return true;
+}
+
+void ImplicitShapeModel::iDataToJsonStream(JsonStreamWriter &writer) const
+{
+    // the same members as iDataToJson(), each child is written by its own stream
+    writer.beginObject();
+    writer.key("Codebook");
+    m_codebook->dataToJsonStream(writer);
+    writer.key("Keypoints");
+    m_keypointsDetector->dataToJsonStream(writer);
+    writer.key("Features");
+    m_featureDescriptor->dataToJsonStream(writer);
+    writer.key("GlobalFeatures");
+    m_globalFeatureDescriptor->dataToJsonStream(writer);
+    writer.key("Clustering");
+    m_clustering->dataToJsonStream(writer);
+    writer.key("Voting");
+    m_voting->dataToJsonStream(writer);
+    writer.key("FeatureWeighting");
+    m_featureRanking->dataToJsonStream(writer);
+    if (m_projection.isTrained())
+    {
+        writer.key("DescriptorProjection");
+        writer.value(m_projection.dataToJson());
+    }
+    if (m_feature_rejection.isTrained())
+    {
+        writer.key("FeatureRejection");
+        writer.value(m_feature_rejection.dataToJson());
+    }
+    writer.endObject();
+}
+
+bool ImplicitShapeModel::iDataFromJsonStream(JsonStreamReader &reader)
+{
+    // objects have to be initialized already
+    if (!m_codebook || !m_keypointsDetector || !m_featureDescriptor || !m_globalFeatureDescriptor ||
+            !m_clustering || !m_voting || !m_featureRanking) {
+        LOG_ERROR("object is not initialized");
+        return false;
+    }
+
+    // the children check that the stored types match theirs, e.g. that the descriptor type did not change
+    std::map<std::string, JSONObject*> children;
+    children["Codebook"] = m_codebook;
+    children["Keypoints"] = m_keypointsDetector;
+    children["Features"] = m_featureDescriptor;
+    children["GlobalFeatures"] = m_globalFeatureDescriptor;
+    children["Clustering"] = m_clustering;
+    children["Voting"] = m_voting;
+    children["FeatureWeighting"] = m_featureRanking;
+
+    std::set<std::string> found;
+    m_projection.clear();
+    m_feature_rejection.clear();
+    if (!reader.beginObject())
+        return false;
+    std::string key;
+    while (reader.nextMember(key))
+    {
+        if (key == "DescriptorProjection")
+        {
+            Json::Value projection;
+            if (!reader.readValue(projection) || !m_projection.dataFromJson(projection))
+            {
+                LOG_ERROR("invalid descriptor projection");
+                return false;
+            }
+            continue;
+        }
+        if (key == "FeatureRejection")
+        {
+            Json::Value rejection;
+            if (!reader.readValue(rejection) || !m_feature_rejection.dataFromJson(rejection))
+            {
+                LOG_ERROR("invalid feature rejection");
+                return false;
+            }
+            continue;
+        }
+
+        std::map<std::string, JSONObject*>::iterator child = children.find(key);
+        if (child == children.end())
+        {
+            if (!reader.skipValue())
+                return false;
+            continue;
+        }
+        if (!child->second->dataFromJsonStream(reader))
+        {
+            LOG_ERROR("could not read the json data of " << key);
+            return false;
+        }
+        found.insert(key);
+    }
+    if (reader.failed())
+        return false;
+
+    if (!found.count("Codebook") || !found.count("Keypoints") || !found.count("Features") ||
+            !found.count("Clustering") || !found.count("Voting")) {
+        LOG_ERROR("could not find necessary json entries");
+        return false;
+    }
+
+    // for backward compatibility the following objects give an error, but do not return false
+    if (!found.count("FeatureWeighting"))
+        LOG_ERROR("could not find \"FeatureWeighting\" object in json file");
+    if (!found.count("GlobalFeatures"))
+    {
+        LOG_WARN("No global features available in data file, using Dummy global feature!");
+        if (m_globalFeatureDescriptor->getType() != "Dummy")
+            throw RuntimeException("Cannot change global descriptor type after learning.");
+    }
+
+    initGlobalFeatureIndex(0);
     return true;
 }
 
@@ -1092,27 +4351,61 @@ void ImplicitShapeModel::iPostInitConfig()
         m_distance = new DistanceHellinger;
     else if (m_distanceType == DistanceHistIntersection::getTypeStatic())
         m_distance = new DistanceHistIntersection;
+    else if (m_distanceType == DistanceHamming::getTypeStatic())
+        m_distance = new DistanceHamming;
     else
         throw RuntimeException("invalid distance type: " + m_distanceType);
 
-    m_voxelFiltering.setLeafSize(m_voxelLeafSize, m_voxelLeafSize, m_voxelLeafSize);
+    // the thread limits only apply while this model trains or detects, other models and the caller keep theirs
+    if (!ThreadScope::parseCpuList(m_cpu_affinity, m_cpus))
+        throw RuntimeException("invalid cpu affinity: " + m_cpu_affinity);
 
-    // m_numThreads == 0 is the default, so don't change anything
-    if (m_numThreads > 0)
-        omp_set_num_threads(m_numThreads);
-
-    LOG_INFO("OpenMP is using " << omp_get_max_threads() << " threads");
+    LOG_INFO("OpenMP is using " << (m_numThreads > 0 ? m_numThreads : omp_get_max_threads()) << " threads");
 
     if(m_flann_exact_match && m_num_kd_trees > 1)
     {
         LOG_WARN("It does not make sense to use more than 1 kd-tree with exact nearest neighbor!");
         m_num_kd_trees = 1;
     }
+    m_index_params.kd_trees = m_num_kd_trees;
+
+    if(m_index_params.type != "KDTree" && m_index_params.type != "HNSW" && m_index_params.type != "CUDA")
+        throw RuntimeException("invalid flann index type: " + m_index_params.type);
+
+    if(m_index_params.type == "CUDA")
+    {
+#ifdef USE_CUDA
+        if(!CudaMatcher::isAvailable())
+        {
+            LOG_WARN("No CUDA device available, using KDTree index!");
+            m_index_params.type = "KDTree";
+        }
+#else
+        LOG_WARN("Built without CUDA support, using KDTree index!");
+        m_index_params.type = "KDTree";
+#endif
+    }
+
+    // the voting analysis only exists while it is enabled, frames of the previous configuration are written first
+    m_capture.reset();
+    if (m_enableVotingAnalysis)
+    {
+        m_capture = std::make_shared<VotingCapture>(m_votingAnalysisQueueSize, m_votingAnalysisSampling,
+                                                    m_votingAnalysisMaxVotes);
+        int channels = VotingCapture::ChannelVotes | VotingCapture::ChannelMaxima;
+        if (m_votingAnalysisTrajectories)
+            channels |= VotingCapture::ChannelTrajectories;
+        m_capture->subscribe(channels, VotingCapture::createPCDWriter(m_votingAnalysisOutputPath));
+    }
 }
 
 
-pcl::PointCloud<ISMFeature>::Ptr ImplicitShapeModel::removeNaNFeatures(pcl::PointCloud<ISMFeature>::ConstPtr modelFeatures)
+pcl::PointCloud<ISMFeature>::Ptr ImplicitShapeModel::removeNaNFeatures(pcl::PointCloud<ISMFeature>::ConstPtr modelFeatures) const
 {
+    // features computed by Features::operator() are already free of NaN values, they are not copied again
+    if(modelFeatures->is_dense)
+        return boost::const_pointer_cast<pcl::PointCloud<ISMFeature> >(modelFeatures);
+
     // check for NAN features
     pcl::PointCloud<ISMFeature>::Ptr modelFeatures_cleaned (new pcl::PointCloud<ISMFeature>());
     modelFeatures_cleaned->header = modelFeatures->header;
@@ -1175,6 +4468,7 @@ void ImplicitShapeModel::trainSVM(std::map<unsigned, std::vector<pcl::PointCloud
     // train the SVM
     CustomSVM svm(m_output_file_name);
     svm.setData(training_data, labels);
+    svm.setNumThreads(m_numThreads);
 
     // find good params or use default
     if(m_svm_auto_train)
@@ -1201,83 +4495,4 @@ void ImplicitShapeModel::trainSVM(std::map<unsigned, std::vector<pcl::PointCloud
     }
 }
 
-
-// DEBUG
-
-std::map<unsigned, pcl::PointCloud<PointT>::Ptr > ImplicitShapeModel::analyzeVotingSpacesForDebug
-(const std::map<unsigned, std::vector<Voting::Vote> > &all_votes, pcl::PointCloud<PointNormalT>::Ptr points)
-{
-    std::map<unsigned, pcl::PointCloud<PointT>::Ptr > all_votings;
-    for (auto it : all_votes)
-    {
-        unsigned classId = it.first;
-        const std::vector<Voting::Vote>& votes = it.second; // all votes for this class
-
-        pcl::PointCloud<PointT>::Ptr dataset(new pcl::PointCloud<PointT>());
-
-        // include original points
-        for(auto p : points->points)
-        {
-            PointT origp;
-            origp.x = p.x;
-            origp.y = p.y;
-            origp.z = p.z;
-            origp.r = p.r;
-            origp.g = p.g;
-            origp.b = p.b;
-            dataset->push_back(origp);
-        }
-
-        // build dataset of votes
-        for (int i = 0; i < (int)votes.size(); i++)
-        {
-            const Voting::Vote& vote = votes[i];
-            PointT votePoint;
-            votePoint.x = vote.position[0];
-            votePoint.y = vote.position[1];
-            votePoint.z = vote.position[2];
-            votePoint.r = 0;
-            votePoint.g = 0;
-            votePoint.b = 255;
-            dataset->push_back(votePoint);
-        }
-        dataset->height = 1;
-        dataset->width = dataset->size();
-        dataset->is_dense = false;
-        all_votings.insert({classId, dataset});
-    }
-
-    return all_votings;
-}
-
-void ImplicitShapeModel::addMaximaForDebug(std::map<unsigned, pcl::PointCloud<PointT>::Ptr > &all_votings,
-                                           std::vector<VotingMaximum> &positions)
-{
-    for(VotingMaximum max : positions)
-    {
-        int classId = max.classId;
-        Eigen::Vector3f pos = max.position;
-        PointT votePoint;
-        votePoint.x = pos[0];
-        votePoint.y = pos[1];
-        votePoint.z = pos[2];
-        votePoint.r = 255;
-        votePoint.g = 0;
-        votePoint.b = 0;
-        all_votings.at(classId)->push_back(votePoint);
-    }
-
-    // check if path terminates in /
-    unsigned pos = m_votingAnalysisOutputPath.find_last_of('/');
-    if(pos != m_votingAnalysisOutputPath.size()-1)
-    {
-        m_votingAnalysisOutputPath = m_votingAnalysisOutputPath.append("/");
-    }
-
-    for(auto obj : all_votings)
-    {
-        pcl::io::savePCDFileBinary(m_votingAnalysisOutputPath+std::to_string(obj.first)+".pcd", *obj.second);
-    }
-}
-
 }
@@ -35,8 +35,15 @@
 #define ISM3D_IMPLICITSHAPEMODEL_H
 
 #include <map>
+#include <set>
 #include <vector>
 #include <tuple>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <boost/shared_ptr.hpp>
 #include <boost/signals2.hpp>
 #include <boost/timer/timer.hpp>
@@ -46,14 +53,25 @@
 #include "codebook/codebook.h"
 #include "utils/ism_feature.h"
 #include "utils/point_cloud_resizing.h"
+#include "utils/point_cloud_loader.h"
+#include "utils/voxel_hash_grid.h"
+#include "utils/point_buffer_view.h"
+#include "utils/detection_trace.h"
+#include "utils/thread_scope.h"
+#include "utils/cancellation.h"
+#include "utils/detection_cost_model.h"
+#include "utils/descriptor_projection.h"
+#include "utils/feature_rejection.h"
+#include "utils/estimator_cache.h"
 #include "keypoints/keypoints.h"
 #include "features/features.h"
 #include "feature_ranking/feature_ranking.h"
 #include "clustering/clustering.h"
 #include "voting/voting.h"
+#include "detection_observer.h"
+#include "voting_capture.h"
 
 #define PCL_NO_PRECOMPILE
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/search/search.h>
 #include <Eigen/Core>
 
@@ -62,6 +80,12 @@ namespace ism3d
     class Vote;
     class VotingMaximum;
     class Distance;
+    class FeatureCache;
+    class FeatureStore;
+    class DetectionSession;
+    class StreamingDetector;
+    class EnsembleDetector;
+    class SharedSearch;
 
     /**
      * @brief The ImplicitShapeModel class
@@ -88,6 +112,15 @@ namespace ism3d
          */
         void clear();
 
+        /**
+         * @brief Restrict the following readObject() calls to a subset of the trained classes. Only the votes,
+         * bounding boxes, global features and 1 vs all SVMs of these classes are kept while loading, codewords
+         * without votes of these classes are skipped and the codeword index is rebuilt over the remaining codewords.
+         * A model loaded with a subset only contains these classes when it is written again.
+         * @param classIds the classes to load, empty for all classes
+         */
+        void setLoadClasses(const std::set<unsigned>& classIds);
+
         /**
          * @brief Add a new training model for a specified class id.
          * @param filename the filename to the training model to add
@@ -96,18 +129,51 @@ namespace ism3d
          */
         bool addTrainingModel(const std::string& filename, unsigned classId);
 
+        /**
+         * @brief Add a feature shard written by extractFeatureShard(). If shards are added, train() merges them
+         * instead of computing the features of the training models. The shards of all slices are needed.
+         * @param filename the shard file
+         */
+        void addFeatureShard(const std::string& filename);
+
+        /**
+         * @brief Compute the local and global features and bounding boxes of a slice of the models added before
+         * and write them to a feature shard. The models are distributed round robin over the slices, so that
+         * independent runs, e.g. on several nodes, compute the training data of all models.
+         * @param filename the shard file
+         * @param shardIndex the index of the slice
+         * @param numShards the number of slices
+         */
+        void extractFeatureShard(const std::string& filename, int shardIndex, int numShards);
+
+        /**
+         * @brief Compute the features of the models added before and store them in the feature cache given with
+         * FeatureCacheDirectory, models that are in the cache already are skipped. Models trained later with the same
+         * feature configuration, e.g. on subsets of these models, load their features from the cache.
+         */
+        void cacheTrainingFeatures();
+
         /**
          * @brief Train the implicit shape model using all models added before
          */
         void train();
 
         /**
-         * @brief add_normals Computes normals for the filename specified and saves the cloud
+         * @brief Add the models added before to the trained implicit shape model without training from scratch.
+         * The feature ranking is not applied to the new models and the SVM is not retrained.
+         * @return false if there is no trained uncompressed codebook or no training model
+         */
+        bool trainIncremental();
+
+        /**
+         * @brief add_normals Computes normals for the filename specified and saves the cloud as PCD file with the
+         * name of the input file and the extension pcd, can be called concurrently
          * @param filename filename of the object to add_normals
          * @param folder folder to save the cloud with normals to
+         * @param numThreads the maximal number of threads for the normals, 0 for the configured number
          * @return true if no errors occured, false otherwise
          */
-        bool add_normals(const std::string& filename, const std::string& folder);
+        bool add_normals(const std::string& filename, const std::string& folder, int numThreads = 0);
 
         /**
          * @brief Detect unknown object instances using the implicit shape model.
@@ -124,15 +190,181 @@ namespace ism3d
          */
         std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true);
 
+        /**
+         * @brief Detect unknown object instances within a time budget. The detection starts with the keypoints of
+         * a coarse voxel grid and refines with twice the keypoint density per level (AnytimeLevels) while the next
+         * level is expected to fit into the remaining time. Votes are cast in the order of the activation distance
+         * of the features, so that the most confident features vote first, and voting stops when the time for the
+         * maxima search is needed. The coarsest level is always completed, other keypoint detectors than the voxel
+         * grid only use one level.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @param timeBudget the time budget in milliseconds
+         * @return a tuple with list of detected object positions of the finest level, time measurements of this detection
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals, double timeBudget);
+
+        /**
+         * @brief Detect unknown object instances in regions of interest. Keypoints are only detected and described
+         * inside the regions, the points around them are kept for the support of the descriptors, and votes
+         * outside of the regions are discarded.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @param regionsOfInterest oriented boxes with the full edge lengths as size, an empty list detects in
+         * the whole point cloud
+         * @return a tuple with list of detected object positions, time measurements
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals,
+                                                                                      const std::vector<Utils::BoundingBox>& regionsOfInterest);
+
+        /**
+         * @brief Set the regions of interest of all following detections and of sessions created afterwards,
+         * see detect() with regions of interest.
+         * @param regionsOfInterest oriented boxes, an empty list detects in the whole point cloud
+         */
+        void setRegionsOfInterest(const std::vector<Utils::BoundingBox>& regionsOfInterest);
+
+        /**
+         * @brief Deliver the maxima of each class during the following detections and the detections of sessions
+         * created afterwards as soon as the class is searched, see Voting::setClassMaximaCallback(). The priority
+         * classes are searched first in the given order, so that their maxima are available long before the
+         * detection returns. The delivered maxima are preliminary: they are not filtered against the maxima of
+         * other classes, normalized or verified with global features. With DetectionTileSize, the maxima of each
+         * tile are delivered, by several threads at a time with DetectionTileWorkers. Must not be called while
+         * detecting.
+         * @param callback called on the detecting thread with the class id and its maxima, empty to remove it
+         * @param priorityClasses the classes searched first, in this order
+         */
+        void setClassMaximaCallback(const Voting::ClassMaximaCallback& callback,
+                                    const std::vector<unsigned>& priorityClasses = std::vector<unsigned>());
+
+        /**
+         * @brief Detect unknown object instances in point data owned by the caller. The view is converted once
+         * into the input of the pipeline, points without finite coordinates are skipped during the conversion
+         * unless an organized view is kept organized (UseOrganizedPipeline). The view is not accessed afterwards.
+         * @param view the points in which objects should be detected, normals are used if the view has them
+         * @return a tuple with the maxima and the time measurements of this detection, "input" is the conversion
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(const PointBufferView &view);
+
         /**
          * @brief Detect unknown object instances using the implicit shape model.
          * @param filename the filename to the point cloud in which objects should be detected
          * @param maxima return paramerter: a list of detected object positions
-         * @param times map for time measurements
+         * @param times map for time measurements of this detection
          * @return true if no error occured
          */
         bool detect(const std::string& filename, std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times);
 
+        /**
+         * @brief Detect unknown object instances using the implicit shape model.
+         * @param points a point cloud as loaded from file
+         * @param hasNormals whether the file contains normals, as returned by the loader
+         * @param maxima return paramerter: a list of detected object positions
+         * @param times map for time measurements of this detection
+         * @return true if no error occured
+         */
+        bool detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals,
+                    std::vector<VotingMaximum>& maxima, std::map<std::string, double> &times);
+
+        /**
+         * @brief Detect unknown object instances with several settings of the voting and codebook parameters. The
+         * features are computed and the codebook is activated once, votes are cast once for each distinct setting
+         * of the codebook parameters and maxima are searched once for each setting. The configuration is restored
+         * afterwards.
+         * @param points a point cloud as loaded from file
+         * @param hasNormals whether the file contains normals, as returned by the loader
+         * @param settings objects with optional members "Voting" and "Codebook" that map parameter names to values,
+         * parameters that are not given keep their configured values
+         * @param maxima return paramerter: a list of detected object positions for each setting
+         * @param times map for time measurements of this detection
+         * @return false if a setting contains an unknown parameter
+         */
+        bool detect(pcl::PointCloud<PointNormalT>::Ptr points, bool hasNormals, const std::vector<Json::Value>& settings,
+                    std::vector<std::vector<VotingMaximum> >& maxima, std::map<std::string, double> &times);
+
+        /**
+         * @brief Detect unknown object instances in several point clouds. The detection runs as a pipeline of three
+         * stages connected by bounded queues: the features of a point cloud are computed while the codebook is
+         * activated with the features of the previous point cloud and votes are cast and maxima searched for the
+         * point cloud before that.
+         * @param pointClouds the point clouds as loaded from file
+         * @param hasNormals whether each point cloud contains normals, as returned by the loader
+         * @return for each point cloud in input order a tuple with the list of detected object positions and the
+         * time measurements of the point cloud, "complete" is the time it spent in the pipeline
+         */
+        std::vector<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > >
+            detectBatch(const std::vector<pcl::PointCloud<PointNormalT>::Ptr>& pointClouds, const std::vector<bool>& hasNormals);
+
+        /**
+         * @brief Detect unknown object instances in the point clouds of a loader with the pipeline of detectBatch().
+         * The point clouds are taken from the loader as the first stage proceeds, so only the point clouds in the
+         * pipeline are kept in memory.
+         * @param loader the loader
+         * @param numClouds the number of point clouds to take from the loader
+         * @param callback called in input order with the index, the detected maxima and the time measurements of
+         * each point cloud
+         * @return false if a point cloud could not be loaded, the following point clouds are not processed
+         */
+        bool detectBatch(std::shared_ptr<PointCloudLoader> loader, int numClouds,
+                         const std::function<void(int, const std::vector<VotingMaximum>&,
+                                                  const std::map<std::string, double>&)>& callback);
+
+        /**
+         * @brief Create a session that detects with this model, builds the codebook index if it is not available yet.
+         * Sessions share the trained data of this model and can detect concurrently, see DetectionSession.
+         * @return the session, it must not be used after the model was trained, loaded or destroyed
+         */
+        std::shared_ptr<DetectionSession> createSession();
+
+        /**
+         * @brief Detect unknown object instances on a separate thread with a session of its own, so that several
+         * requests can run concurrently, see createSession(). A cancelled detection stops at the next check of the
+         * token, its future then throws a CancelledException, see CancellationToken.
+         * @param pointCloud the point cloud in which objects should be detected, it must not be changed until the
+         * future is ready
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @param token the token that cancels the detection
+         * @return the future result as returned by DetectionSession::detect(), destroying it waits for the detection
+         */
+        std::future<std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > >
+            detectAsync(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true,
+                        const CancellationToken &token = CancellationToken());
+
+        /**
+         * @brief Create a detector for consecutive frames of a static camera that only computes the changed regions
+         * of each frame again, builds the codebook index if it is not available yet, see StreamingDetector.
+         * @return the detector, it must not be used after the model was trained, loaded or destroyed
+         */
+        std::shared_ptr<StreamingDetector> createStreamingDetector();
+
+        /**
+         * @brief Create a loader that loads the given point cloud files in the background, as configured by the
+         * parameters PrefetchClouds and PrefetchMemoryMB.
+         * @param filenames the point cloud files in the order in which they are processed
+         * @return the loader
+         */
+        std::shared_ptr<PointCloudLoader> createPointCloudLoader(const std::vector<std::string>& filenames) const;
+
+        /**
+         * @brief Select the search parameters of the approximate codebook index. The recall is measured on
+         * descriptors sampled during the last training, or on the codewords themselves if the model was loaded.
+         * The cheapest setting that reaches the target recall replaces the index parameters of the configuration,
+         * use writeObject() to store it.
+         * @param target_recall the required recall@k compared to the exact search
+         * @param k the number of neighbors for which the recall is measured
+         * @param num_queries the maximum number of query descriptors
+         * @return true if a setting reaches the target recall
+         */
+        bool autotuneIndex(float target_recall = 0.95f, int k = 1, int num_queries = 1000);
+
+        /**
+         * @brief Store the codebook distributions of the model archive in chunks that are decoded in parallel on
+         * loading, see the codebook parameter ArchiveChunkSize; use writeObject() to convert a loaded model.
+         * @param chunk_size the number of distributions per chunk, 0 to store them one after another
+         */
+        void setArchiveChunkSize(int chunk_size);
+
         /**
          * @brief Get the codebook for this implicit shape model.
          * @return the codebook for this implicit shape model
@@ -145,6 +377,63 @@ namespace ism3d
          */
         const Voting* getVoting() const;
 
+        /**
+         * @brief Get the stage times and work counters of the last detection of this model: the points, keypoints
+         * and features, the activated codewords, the votes and the bytes of the vote store in total and per class,
+         * the maxima and the counters of the voting. With TraceFile, the stages of each detection are also appended to that file in the
+         * Chrome trace event format. Detections of sessions and streaming detectors are not included.
+         * @return the statistics of the last detection
+         */
+        const DetectionStatistics& getLastDetectionStatistics() const;
+
+        /**
+         * @brief Get the voting report of the last detection of this model if VotingReport is enabled: the votes,
+         * their weights, the maxima and the mean shift work per class, and the codewords that cast the most votes.
+         * Unlike EnableVotingAnalysis, the report only consists of counters and can stay enabled. Detections of
+         * sessions and streaming detectors are not included.
+         * @return the report, empty if disabled
+         */
+        const VotingReport& getLastVotingReport() const;
+
+        /**
+         * @brief Fit the cost model of this model to detections of different input sizes on the current hardware,
+         * see DetectionCostModel. The eval tool fits it with --calibrate and stores it alongside the ism file.
+         * @param samples the statistics of the detections, see getLastDetectionStatistics()
+         * @return false if the samples do not cover at least two input sizes
+         */
+        bool fitCostModel(const std::vector<DetectionStatistics> &samples);
+
+        /**
+         * @brief Load a cost model stored by the calibration, see DetectionCostModel::getFilename().
+         * @param filename the cost model file
+         * @return false if the file could not be read
+         */
+        bool loadCostModel(const std::string &filename);
+
+        const DetectionCostModel& getCostModel() const;
+
+        /**
+         * @brief Predict the wall time and memory of a detection, e.g. for admission control of a service. Needs a
+         * cost model calibrated for this model on the same hardware.
+         * @param numPoints the number of input points
+         * @return the predicted cost, zero without a cost model
+         */
+        DetectionCost estimateDetectionCost(int numPoints) const;
+
+        /**
+         * @brief Apply the detection parameters of an ism file to this model without reading its data or rebuilding
+         * the index. Only parameters that do not depend on the trained data may change: those of the voting, except
+         * its type and the training parameters of the global feature classifier, and the vote weighting of the
+         * codebook. If the file changes any other parameter, nothing is applied. Parameters missing in the file keep
+         * their current values. Must not be called while detecting, sessions and streaming detectors created before
+         * keep the parameters they were created with.
+         * @param filename an ism file with the configuration of this model
+         * @param changed return parameter: the applied parameters as "Object/Name"
+         * @param error return parameter: the reason if the parameters were not applied
+         * @return false if the file could not be read or changes parameters that need to reload or retrain the model
+         */
+        bool reloadParameters(const std::string &filename, std::vector<std::string> &changed, std::string &error);
+
         /**
          * @brief Used to enable and disable signals (disable to speed up command line evaluation, enable for GUI)
          * @param s - new state (true: enabled, false: disabled) (default in constructor: true)
@@ -154,6 +443,21 @@ namespace ism3d
             m_enable_signals = s;
         }
 
+        /**
+         * @brief Deliver the intermediate results of training and detection to an observer on a separate thread.
+         * Unlike the signals, the observer never delays training or detection: while a result is waiting for the
+         * observer, newer results of the same kind are dropped. Must not be called while training or detecting.
+         * @param observer the observer, 0 to remove the current observer
+         */
+        void setObserver(std::shared_ptr<DetectionObserver> observer);
+
+        /**
+         * @brief Get the capture of the voting analysis, further consumers may subscribe to it. It only exists while
+         * EnableVotingAnalysis is set and is replaced when the configuration changes.
+         * @return the capture, 0 if the voting analysis is disabled
+         */
+        std::shared_ptr<VotingCapture> getVotingCapture() const;
+
         /**
          * @brief setLogging Whether or not INFO should be logged.
          * @param l if true logger level will be INFO, otherwise logger level will be WARN
@@ -174,41 +478,297 @@ namespace ism3d
         bool iChildConfigsFromJson(const Json::Value&);
         void iSaveData(boost::archive::binary_oarchive &oa) const;
         bool iLoadData(boost::archive::binary_iarchive &ia);
+        bool iUseFlatData() const;
+        bool iSaveFlatData(const std::string &file) const;
+        bool iLoadFlatData(const std::string &file);
+        bool iUseCompressedData() const;
         Json::Value iDataToJson() const;
         bool iDataFromJson(const Json::Value&);
+        void iDataToJsonStream(JsonStreamWriter &writer) const;
+        bool iDataFromJsonStream(JsonStreamReader &reader);
         void iPostInitConfig();
+        void iMemoryUsage(MemoryUsage &usage) const;
 
     private:
+        friend class DetectionSession;
+        friend class StreamingDetector;
+        friend class EnsembleDetector;
+        friend class TiledDetector;
+        friend class ShardedDetector;
+
         void init();
-        pcl::PointCloud<PointNormalT>::Ptr loadPointCloud(const std::string& filename);
 
-        // the tuple is: local features, global features, points without NAN, normals without NAN
+        // true if the flann index was built for exactly the current codewords with the current distance
+        bool isFlannIndexValid() const;
+
+        // passes the index configuration to the voting and loads or builds the index for global features
+        void initGlobalFeatureIndex(boost::archive::binary_iarchive *ia);
+
+        // writes the flag and the parameters of the stored flann index, returns the flag and the index data that
+        // follows them in the archive or in a section of a flat model
+        bool saveFlannIndexHeader(boost::archive::binary_oarchive &oa, std::vector<char> &indexData) const;
+
+        // creates the index helper with the codeword descriptors as dataset, shared with a mapped flat model if possible
+        std::shared_ptr<FlannHelper> createCodewordDataset(std::vector<std::shared_ptr<Codeword> > &codewords) const;
+
+        // uses a stored flann index if it was built for the codebook with the current configuration
+        void loadFlannIndex(const std::string &distType, const KnnIndexParams &params,
+                            const std::vector<int> &codewordIds, const std::vector<char> &indexData);
+        pcl::PointCloud<PointNormalT>::Ptr loadPointCloud(const std::string& filename, bool *hasNormals = 0);
+
+        // detects in the points, checkFirstNormal disables the normals if the first normal is invalid
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> >
+            detectPoints(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, bool checkFirstNormal);
+
+        // as above, within a time budget in milliseconds
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> >
+            detectAnytime(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, bool checkFirstNormal, double timeBudget);
+
+        // as above, with the maxima for each parameter setting, the times of this detection are returned and
+        // added to the total times
+        void detectPoints(pcl::PointCloud<PointNormalT>::ConstPtr points_in, bool hasNormals, bool checkFirstNormal,
+                          const std::vector<Json::Value>& settings, std::vector<std::vector<VotingMaximum> >& maxima,
+                          std::map<std::string, double> &times);
+
+        // adds the times of a detection to the total times, counters replace the previous values
+        void addProcessingTimes(const std::map<std::string, double> &times);
+
+        // records the counters of the activation and voting in the trace
+        void countVotes(DetectionTrace &trace, const ActivationResult &activation, const Voting &voting) const;
+
+        // records the running statistics of the recall monitor of the codebook in the trace
+        void countRecall(DetectionTrace &trace) const;
+
+        // keeps the voting report of a detection if enabled
+        void reportVotes(const Voting &voting, const std::vector<VotingMaximum> &maxima);
+
+        // keeps the statistics of a finished detection and appends it to the trace file if configured
+        void finishTrace(const DetectionTrace &trace);
+
+        // true if the parameters are null or an object of parameters that are part of the configuration
+        static bool hasParameters(const Json::Value& config, const Json::Value& parameters);
+
+        // sets the parameters of an object to its configuration with the given parameters replaced, child objects
+        // are kept
+        static void applyParameters(JSONObject& object, const Json::Value& config, const Json::Value& parameters);
+
+        // collects the parameters of a configuration that differ from the current configuration of an object and
+        // its children as "Object/Name", a different type is reported as "Object/Type"
+        static void diffConfig(const Json::Value& current, const Json::Value& config, const std::string& path,
+                               std::vector<std::pair<std::string, Json::Value> >& changes);
+
+        // configuration that the features of a training model depend on, part of the feature cache key
+        std::string getFeatureCacheConfig(bool hasNormals) const;
+
+        // configuration that the training data depends on besides the training models
+        Json::Value getTrainingDataConfig() const;
+
+        // configuration key of the feature shards, shards with different keys can not be merged
+        std::string getFeatureShardKey() const;
+
+        // configuration keys of the training checkpoint stages, the key of a stage covers all earlier stages
+        std::vector<std::string> getCheckpointKeys() const;
+
+        // the detectors and descriptors that compute the features of a point cloud, parallel training workers use
+        // their own copies configured like the members of this class
+        struct FeaturePipeline
+        {
+            Keypoints* keypointsDetector;
+            Features* featureDescriptor;
+            Features* globalFeatureDescriptor;
+            VoxelHashGrid* voxelFiltering;
+            int numThreads;
+            const RegionOfInterest* regionOfInterest; // detection only, null or empty for the whole point cloud
+            std::function<bool(const PointT&)> keypointFilter; // if set, only keypoints it accepts are described
+            DetectionTrace* trace; // if set, the stages and counters of the feature computation are recorded
+            int numNormalThreads; // threads of the normal estimation, 0 uses numThreads
+            bool lazyNormals; // normals are only estimated in the support regions of the keypoints, if possible
+            Voting* earlyExitVoting; // detection only, if set in single object mode the global features are computed
+                                     // and classified first, the local features are skipped if it is confident
+            EstimatorCache::Ptr estimators; // if set, the estimators and searches are reused from the last point cloud
+        };
+
+        FeaturePipeline getFeaturePipeline();
+
+        // the threads of a detection stage: its own configuration, else NumThreads, at most limit if limit > 0;
+        // 0 if neither is configured
+        int getStageThreads(int stageThreads, int limit = 0) const;
+
+        // the data of a point cloud that is passed from the feature computation to the later stages of the detection
+        struct DetectionInput
+        {
+            pcl::PointCloud<PointNormalT>::ConstPtr points;
+            pcl::PointCloud<ISMFeature>::Ptr features;
+            pcl::PointCloud<ISMFeature>::Ptr globalFeatures;
+            pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN;
+            pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN;
+            pcl::search::Search<PointT>::Ptr search;
+            bool globalEarlyExit; // the global classification is the result, features is empty
+            VotingMaximum globalMaximum;
+        };
+
+        // the result of the stages before the descriptors: voxel filtering, normals and keypoints, models with the
+        // same configuration of these stages can describe the same preprocessed input
+        struct PreprocessedInput
+        {
+            pcl::PointCloud<PointNormalT>::ConstPtr points; // without NAN points, cropped to the region of interest
+            pcl::PointCloud<PointT>::ConstPtr pointCloud; // positions after voxel filtering
+            pcl::PointCloud<pcl::Normal>::ConstPtr normals;
+            pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaN;
+            pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN;
+            pcl::PointCloud<PointT>::ConstPtr keypoints;
+            boost::shared_ptr<SharedSearch> search;
+        };
+
+        // filters NAN points and computes the features without NAN features, false if the point cloud is empty
+        bool computeDetectionFeatures(const FeaturePipeline &pipeline, pcl::PointCloud<PointNormalT>::ConstPtr points_in,
+                                      bool hasNormals, bool checkFirstNormal, DetectionInput &input,
+                                      std::map<std::string, double> &times) const;
+
+        // the two parts of computeDetectionFeatures(): filters NAN points and computes normals and keypoints, false
+        // if the point cloud is empty; describes the keypoints and removes NAN features
+        bool preprocessDetectionInput(const FeaturePipeline &pipeline, pcl::PointCloud<PointNormalT>::ConstPtr points_in,
+                                      bool hasNormals, bool checkFirstNormal, PreprocessedInput &preprocessed,
+                                      std::map<std::string, double> &times) const;
+        void describeDetectionInput(const FeaturePipeline &pipeline, const PreprocessedInput &preprocessed,
+                                    DetectionInput &input, std::map<std::string, double> &times) const;
+
+        // configuration of the stages of preprocessDetectionInput(), models with the same key compute the same
+        // preprocessed input from a point cloud
+        std::string getPreprocessingKey(bool hasNormals) const;
+
+        // builds the codebook index for detection if it is not available yet, can be called concurrently
+        void createDetectionIndex();
+
+        // builds the class cascade on the detection index if it is enabled and not built yet
+        void createClassCascade();
+
+        // runs the detection pipeline on numClouds point clouds returned by next, an empty point cloud stops the
+        // pipeline and returns false
+        bool detectPipelined(int numClouds, const std::function<pcl::PointCloud<PointNormalT>::Ptr(bool*)>& next,
+                             const std::function<void(int, const std::vector<VotingMaximum>&,
+                                                      const std::map<std::string, double>&)>& callback);
+
+        // the store for local features in streaming training, as configured by the FeatureStore parameters
+        std::shared_ptr<FeatureStore> createFeatureStore() const;
+
+        // computes the features and bounding boxes of all training models, local features are put into the
+        // feature store instead if one is given
+        void computeTrainingData(FeatureStore *featureStore, boost::timer::cpu_timer &timer,
+                                 std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                 std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures,
+                                 std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes);
+
+        // merges the training data of the feature shards in the order of the training models, local features are
+        // put into the feature store instead if one is given
+        void loadFeatureShards(FeatureStore *featureStore,
+                               std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                               std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures,
+                               std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes);
+
+        // collapses near duplicate features of each class before the ranking, local features are read from and
+        // written to the feature store instead if one is given
+        void deduplicateFeatures(FeatureStore *featureStore,
+                                 std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                 const std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes);
+
+        // fits the descriptor projection on a sample of the ranked features
+        void fitProjection(const pcl::PointCloud<ISMFeature> &features);
+
+        // fits the feature rejection on a sample of all training features, labeled with the selection of the ranking
+        void fitFeatureRejection(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                 const std::vector<int> &selected);
+
+        // projects the local descriptors of training models, the features of a store are replaced by a store with
+        // projected copies
+        void projectTrainingFeatures(std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                     std::shared_ptr<FeatureStore> &featureStore) const;
+
+        // computes the features and bounding boxes of all training models with several workers, the results are
+        // merged in the order of training, so they do not depend on the number of workers, local features are
+        // put into the feature store instead if one is given
+        void trainFeaturesParallel(int numWorkers, std::shared_ptr<PointCloudLoader> loader,
+                                   FeatureCache *featureCache, FeatureStore *featureStore,
+                                   std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                                   std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures,
+                                   std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes);
+
+        void prepareTrainingModel(pcl::PointCloud<PointNormalT> &model) const;
+
+        // loads the features of a training model from the cache or computes them without NAN features
+        void computeTrainingFeatures(const FeaturePipeline &pipeline, const std::string &filename,
+                                     pcl::PointCloud<PointNormalT>::ConstPtr model, bool hasNormals,
+                                     FeatureCache *featureCache, boost::timer::cpu_timer &timer,
+                                     pcl::PointCloud<ISMFeature>::Ptr &modelFeatures,
+                                     pcl::PointCloud<ISMFeature>::Ptr &globalFeatures);
+
+        // the tuple is: local features, global features, points without NAN, normals without NAN and the search
+        // that holds the spatial indices built for the input, to be reused by later stages of the detection
         std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
-                    pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr >
+                    pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr,
+                    pcl::search::Search<PointT>::Ptr >
             computeFeatures(pcl::PointCloud<PointNormalT>::ConstPtr, bool, boost::timer::cpu_timer&, boost::timer::cpu_timer &timer_keypoints,
                             bool compute_global);
 
+        std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
+                    pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr,
+                    pcl::search::Search<PointT>::Ptr >
+            computeFeatures(const FeaturePipeline &pipeline, pcl::PointCloud<PointNormalT>::ConstPtr, bool,
+                            boost::timer::cpu_timer&, boost::timer::cpu_timer &timer_keypoints, bool compute_global) const;
+
+        // the two parts of computeFeatures(): voxel filtering, normals and keypoints; descriptors
+        void preprocessFeatures(const FeaturePipeline &pipeline, pcl::PointCloud<PointNormalT>::ConstPtr, bool,
+                                boost::timer::cpu_timer&, boost::timer::cpu_timer &timer_keypoints,
+                                PreprocessedInput &preprocessed) const;
+
+        std::tuple<pcl::PointCloud<ISMFeature>::ConstPtr, pcl::PointCloud<ISMFeature>::ConstPtr,
+                    pcl::PointCloud<PointT>::ConstPtr, pcl::PointCloud<pcl::Normal>::ConstPtr,
+                    pcl::search::Search<PointT>::Ptr >
+            describeFeatures(const FeaturePipeline &pipeline, const PreprocessedInput &preprocessed,
+                             bool compute_global) const;
+
+        // the global features of the whole preprocessed point cloud
+        pcl::PointCloud<ISMFeature>::ConstPtr describeGlobalFeatures(const FeaturePipeline &pipeline,
+                                                                     const PreprocessedInput &preprocessed) const;
+
+        Utils::BoundingBox computeBoundingBox(pcl::PointCloud<PointNormalT>::ConstPtr model) const;
+
         void computeNormals(pcl::PointCloud<PointT>::ConstPtr,
                             pcl::PointCloud<pcl::Normal>::Ptr&,
-                            pcl::search::Search<PointT>::Ptr) const;
+                            pcl::search::Search<PointT>::Ptr,
+                            int numThreads,
+                            const EstimatorCache::Ptr &estimators = EstimatorCache::Ptr()) const;
+
+        // normals of the points within radius of the keypoints, the normals of all other points are NAN; only for
+        // unorganized clouds and the consistent normals methods 0 and 1, which orient each normal on its own
+        void computeSupportNormals(pcl::PointCloud<PointT>::ConstPtr model,
+                                   pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                   float radius,
+                                   pcl::PointCloud<pcl::Normal>::Ptr& normals,
+                                   pcl::search::Search<PointT>::Ptr searchTree,
+                                   int numThreads,
+                                   const EstimatorCache::Ptr &estimators = EstimatorCache::Ptr()) const;
 
         void filterNormals(pcl::PointCloud<PointT>::ConstPtr model,
                            pcl::PointCloud<pcl::Normal>::ConstPtr normals,
-                           pcl::PointCloud<PointT>::Ptr& modelWithoutNaN,
-                           pcl::PointCloud<pcl::Normal>::Ptr& normalsWithoutNaN);
-
-        // removes all features with NAN in the given input; output: filtered list
-        pcl::PointCloud<ISMFeature>::Ptr removeNaNFeatures(pcl::PointCloud<ISMFeature>::ConstPtr modelFeatures);
+                           pcl::PointCloud<PointT>::ConstPtr& modelWithoutNaN,
+                           pcl::PointCloud<pcl::Normal>::ConstPtr& normalsWithoutNaN) const;
 
-        std::map<unsigned, pcl::PointCloud<PointT>::Ptr > analyzeVotingSpacesForDebug
-                            (const std::map<unsigned, std::vector<Voting::Vote> > &all_votes,
-                             pcl::PointCloud<PointNormalT>::Ptr points);
+        // copies positions and normals of the points in a single pass
+        void splitPointCloud(const pcl::PointCloud<PointNormalT> &points,
+                             pcl::PointCloud<PointT> &positions,
+                             pcl::PointCloud<pcl::Normal> &normals) const;
 
-        void addMaximaForDebug(std::map<unsigned, pcl::PointCloud<PointT>::Ptr> &all_votings, std::vector<VotingMaximum> &positions);
+        // removes all features with NAN in the given input; output: filtered list
+        pcl::PointCloud<ISMFeature>::Ptr removeNaNFeatures(pcl::PointCloud<ISMFeature>::ConstPtr modelFeatures) const;
 
         void trainSVM(std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features);
 
-        pcl::VoxelGrid<PointNormalT> m_voxelFiltering;
+        VoxelHashGrid m_voxelFiltering;
+        EstimatorCache::Ptr m_estimators;
+        RegionOfInterest m_region_of_interest;
+        Voting::ClassMaximaCallback m_class_maxima_callback;
+        std::vector<unsigned> m_priority_classes;
         Codebook* m_codebook;
         Keypoints* m_keypointsDetector;
         Features* m_featureDescriptor;
@@ -219,18 +779,38 @@ namespace ism3d
 
         std::map<unsigned, std::vector<std::string> > m_trainingModelsFilenames;
         std::map<unsigned, std::vector<bool> > m_trainingModelHasNormals;
+        std::vector<std::string> m_feature_shards;
         Distance* m_distance;
         std::string m_distanceType;
         bool m_useVoxelFiltering;
         float m_voxelLeafSize;
+        bool m_useOrganizedPipeline; // organized detection input keeps its structure, NAN points are masked
         float m_normalRadius;
+        bool m_lazyNormals; // detection estimates normals only in the support regions of the keypoints
         int m_consistentNormalsK;
         int m_consistentNormalsMethod;
         int m_numThreads;
+        int m_threads_normals; // threads of the detection stages, 0 uses m_numThreads
+        int m_threads_features;
+        int m_threads_activation;
+        int m_threads_voting;
+        int m_threads_maxima;
+        std::string m_cpu_affinity;
+        std::vector<int> m_cpus; // parsed from m_cpu_affinity, empty to not pin threads
         std::string m_bbType;
+        float m_mvbbEpsilon;
+        float m_mvbbLeafSize;
+        int m_prefetchClouds;
+        int m_prefetchMemoryMB;
+        int m_trainingWorkers;
+        int m_trainingMemoryMB;
         bool m_setColorToZero;
         bool m_enableVotingAnalysis;
         std::string m_votingAnalysisOutputPath;
+        int m_votingAnalysisSampling;
+        int m_votingAnalysisMaxVotes;
+        int m_votingAnalysisQueueSize;
+        bool m_votingAnalysisTrajectories;
         bool m_svm_auto_train;
         double m_svm_param_c;
         double m_svm_param_gamma;
@@ -239,17 +819,66 @@ namespace ism3d
 
         int m_num_kd_trees;
         bool m_flann_exact_match;
+        KnnIndexParams m_index_params;
+        std::string m_feature_cache_directory;
+        bool m_streaming_training;
+        std::string m_feature_store_directory;
+        int m_feature_store_memory_mb;
+        std::string m_checkpoint_directory;
+        bool m_use_feature_deduplication;
+        float m_deduplication_descriptor_distance;
+        float m_deduplication_vote_distance;
+        int m_anytime_levels;
+        float m_streaming_leaf_size;
+        float m_streaming_change_tolerance;
+        float m_detection_tile_size;
+        int m_detection_tile_workers;
 
         std::map<int, std::pair<std::string, std::string> > m_id_objects_map; // maps class ids to pairs of <class_name, instance_name>
 
         bool m_enable_signals;
+        std::shared_ptr<ObserverDispatcher> m_dispatcher; // delivers to the observer, 0 without observer
+        std::shared_ptr<VotingCapture> m_capture; // voting analysis, 0 unless EnableVotingAnalysis
 
         std::shared_ptr<FlannHelper> m_flann_helper;
         bool m_index_created;
+        std::mutex m_index_mutex; // sessions can be created concurrently
+
+        // training descriptors for index tuning and the codeword they are identical to (-1: none), not stored
+        std::vector<std::vector<float> > m_tuning_descriptors;
+        std::vector<int> m_tuning_codeword_ids;
 
         // TODO VS temp
-        double getElapsedTime(boost::timer::cpu_timer timer, std::string format);
+        double getElapsedTime(const boost::timer::cpu_timer &timer, const std::string &format) const;
         std::map<std::string, double> m_processing_times;
+
+        std::string m_trace_file; // detections are appended in the Chrome trace event format, empty: disabled
+        std::ofstream m_trace_stream;
+        int m_num_traces;
+        DetectionStatistics m_last_statistics;
+        bool m_voting_report;
+        int m_voting_report_top_codewords;
+        VotingReport m_last_voting_report;
+        DetectionCostModel m_cost_model;
+        std::set<unsigned> m_load_classes; // the classes loaded by readObject(), empty for all classes
+        bool m_flat_model; // write the model data as a flat model that is mapped on loading
+        std::string m_flat_model_prefetch;
+        bool m_flat_model_huge_pages;
+        bool m_compress_model; // write the model data as block compressed archive, ignored for flat models
+        bool m_use_projection;
+        bool m_projection_whitening;
+        float m_projection_variance;
+        int m_projection_max_dim;
+        int m_projection_samples;
+        bool m_lean_output; // maxima without vote indices, the votes are released after the maxima search
+        bool m_use_class_cascade;
+        float m_cascade_fraction;
+        int m_cascade_top_classes;
+        DescriptorProjection m_projection; // learned in train(), codewords are stored in the projected space
+        bool m_use_feature_rejection;
+        float m_feature_rejection_rate; // fraction of the training features whose scene counterparts are rejected
+        int m_feature_rejection_samples;
+        FeatureRejection m_feature_rejection; // learned in train() on the original descriptors
     };
 }
 
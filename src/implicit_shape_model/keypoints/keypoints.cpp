@@ -12,11 +12,20 @@
 #include "keypoints_factory.h"
 #include "../utils/utils.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+#include <omp.h>
+
 namespace ism3d
 {
     Keypoints::Keypoints()
         : m_numThreads(1)
     {
+        addParameter(m_maxKeypoints, "MaxKeypoints", 0);
+        addParameter(m_budgetRadius, "BudgetRadius", 0.0f);
     }
 
     Keypoints::~Keypoints()
@@ -36,11 +45,122 @@ namespace ism3d
                                                                         pointsWithoutNaNNormals, normalsWithoutNaN,
                                                                         search);
 
+        if (m_maxKeypoints > 0 && (int)keypoints->size() > m_maxKeypoints)
+        {
+            LOG_INFO("reducing " << keypoints->size() << " keypoints to the budget of " << m_maxKeypoints);
+            keypoints = applyBudget(keypoints, normals, search);
+        }
+
         LOG_INFO("found " << keypoints->size() << " keypoints");
 
         return keypoints;
     }
 
+    pcl::PointCloud<PointT>::ConstPtr Keypoints::applyBudget(pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                                             pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                             pcl::search::Search<PointT>::Ptr search) const
+    {
+        // the saliency of a keypoint is the curvature at its nearest input point
+        const int numKeypoints = (int)keypoints->size();
+        std::vector<float> saliency(numKeypoints, -1.0f);
+        #pragma omp parallel for num_threads(getNumThreads())
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            std::vector<int> indices;
+            std::vector<float> distances;
+            if (!pcl::isFinite(keypoints->at(i)) || search->nearestKSearch(keypoints->at(i), 1, indices, distances) < 1)
+                continue;
+            const float curvature = normals->at(indices[0]).curvature;
+            if (std::isfinite(curvature))
+                saliency[i] = curvature;
+        }
+
+        std::vector<int> order(numKeypoints);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&saliency](int a, int b)
+        {
+            return saliency[a] > saliency[b];
+        });
+
+        // without a configured radius, each keypoint of the budget gets an equal share of the bounding box
+        float radius = m_budgetRadius;
+        if (radius <= 0)
+        {
+            Eigen::Vector3f min = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+            Eigen::Vector3f max = -min;
+            for (const PointT &keypoint : keypoints->points)
+            {
+                if (!pcl::isFinite(keypoint))
+                    continue;
+                min = min.cwiseMin(keypoint.getVector3fMap());
+                max = max.cwiseMax(keypoint.getVector3fMap());
+            }
+            const Eigen::Vector3f extent = (max - min).cwiseMax(Eigen::Vector3f::Constant(1e-6f));
+            radius = std::cbrt(extent.prod() / m_maxKeypoints);
+        }
+
+        // the taken keypoints are hashed in cells of the radius, a candidate checks the surrounding cells
+        const float cellSize = radius;
+        auto cellKey = [cellSize](const Eigen::Vector3f &position, int dx, int dy, int dz)
+        {
+            const long long x = (long long)std::floor(position[0] / cellSize) + dx;
+            const long long y = (long long)std::floor(position[1] / cellSize) + dy;
+            const long long z = (long long)std::floor(position[2] / cellSize) + dz;
+            return (x * 73856093LL) ^ (y * 19349663LL) ^ (z * 83492791LL);
+        };
+        std::unordered_multimap<long long, int> taken;
+        std::vector<char> selected(numKeypoints, 0);
+        std::vector<int> suppressed;
+        int numSelected = 0;
+        for (int index : order)
+        {
+            if (numSelected == m_maxKeypoints)
+                break;
+            const Eigen::Vector3f position = keypoints->at(index).getVector3fMap();
+            bool free = true;
+            for (int dx = -1; dx <= 1 && free; dx++)
+                for (int dy = -1; dy <= 1 && free; dy++)
+                    for (int dz = -1; dz <= 1 && free; dz++)
+                    {
+                        auto range = taken.equal_range(cellKey(position, dx, dy, dz));
+                        for (auto it = range.first; it != range.second; ++it)
+                        {
+                            if ((keypoints->at(it->second).getVector3fMap() - position).squaredNorm() < radius * radius)
+                            {
+                                free = false;
+                                break;
+                            }
+                        }
+                    }
+
+            if (free)
+            {
+                taken.insert(std::make_pair(cellKey(position, 0, 0, 0), index));
+                selected[index] = 1;
+                numSelected++;
+            }
+            else
+                suppressed.push_back(index);
+        }
+
+        // the budget that is left after the suppression is filled with the strongest suppressed keypoints
+        for (int i = 0; i < (int)suppressed.size() && numSelected < m_maxKeypoints; i++)
+        {
+            selected[suppressed[i]] = 1;
+            numSelected++;
+        }
+
+        // the keypoints keep their original order
+        pcl::PointCloud<PointT>::Ptr result(new pcl::PointCloud<PointT>());
+        result->reserve(numSelected);
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (selected[i])
+                result->push_back(keypoints->at(i));
+        }
+        return result;
+    }
+
     void Keypoints::setNumThreads(int numThreads)
     {
         m_numThreads = numThreads;
@@ -48,7 +168,8 @@ namespace ism3d
 
     int Keypoints::getNumThreads() const
     {
-        return m_numThreads;
+        // PCL estimators called inside of a parallel region run with a single thread instead of a nested team
+        return omp_in_parallel() ? 1 : m_numThreads;
     }
 }
 
@@ -27,6 +27,10 @@ namespace ism3d
      * Works as a functor and computes keypoints on the input point cloud. The resulting
      * keypoints are of the same type as the point cloud, but do not necessarily are
      * an element of the original input cloud.
+     * With MaxKeypoints, at most that many keypoints are returned: the keypoints are ranked by the curvature
+     * of their nearest point and a keypoint is only taken if no stronger one was taken within the budget
+     * radius, the remaining budget is filled with the suppressed keypoints. This bounds the cost of the
+     * following stages independently of the size of the input.
      */
     class Keypoints
             : public JSONObject
@@ -56,9 +60,20 @@ namespace ism3d
          */
         void setNumThreads(int numThreads);
 
+        // false if the keypoints only depend on the positions, then they can be computed before the normals
+        bool needsNormals() const
+        {
+            return m_maxKeypoints > 0 || iNeedsNormals();
+        }
+
     protected:
         Keypoints();
 
+        virtual bool iNeedsNormals() const
+        {
+            return true;
+        }
+
         virtual pcl::PointCloud<PointT>::ConstPtr iComputeKeypoints(pcl::PointCloud<PointT>::ConstPtr,
                                                                     pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                                     pcl::PointCloud<PointT>::ConstPtr,
@@ -68,7 +83,14 @@ namespace ism3d
         int getNumThreads() const;
 
     private:
+        // keeps the most salient keypoints up to the budget, spread by non-maximum suppression
+        pcl::PointCloud<PointT>::ConstPtr applyBudget(pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                                      pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                      pcl::search::Search<PointT>::Ptr search) const;
+
         int m_numThreads;
+        int m_maxKeypoints;
+        float m_budgetRadius;
     };
 }
 
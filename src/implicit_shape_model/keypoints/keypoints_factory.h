@@ -16,6 +16,7 @@
 #include "keypoints_iss3d.h"
 #include "keypoints_voxel_grid.h"
 #include "keypoints_sift3d.h"
+#include "keypoints_pixel_grid.h"
 
 namespace ism3d
 {
@@ -30,6 +31,8 @@ namespace ism3d
             return new KeypointsVoxelGrid();
         else if (type == KeypointsSIFT3D::getTypeStatic())
             return new KeypointsSIFT3D();
+        else if (type == KeypointsPixelGrid::getTypeStatic())
+            return new KeypointsPixelGrid();
         else
             return 0;
     }
@@ -10,8 +10,8 @@
 
 #include "keypoints_iss3d.h"
 
-#define PCL_NO_PRECOMPILE
-#include <pcl/keypoints/iss_3d.h>
+#include <Eigen/Eigenvalues>
+#include <omp.h>
 
 namespace ism3d
 {
@@ -34,41 +34,93 @@ namespace ism3d
                                                                         pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN,
                                                                         pcl::search::Search<PointT>::Ptr search)
     {
-        //const double normalRadius = 0.06;
-        //const double borderRadius = 0.01;
-
-        pcl::ISSKeypoint3D<PointT, PointT> iss;
-
-        if (points->isOrganized()) {
-            iss.setInputCloud(points);
-            iss.setNormals(normals);
+        pcl::PointCloud<PointT>::ConstPtr cloud = pointsWithoutNaNNormals;
+        if (points->isOrganized())
+            cloud = points;
+
+        const int numPoints = (int)cloud->size();
+        const int numThreads = getNumThreads() > 0 ? getNumThreads() : omp_get_max_threads();
+        search->setInputCloud(cloud);
+
+        computeSaliency(*cloud, *search, numThreads);
+
+        // a salient point is a keypoint if no point within the non maximum radius is more salient
+        m_isMaximum.assign(numPoints, 0);
+
+        #pragma omp parallel num_threads(numThreads)
+        {
+            std::vector<int> indices;
+            std::vector<float> sqrDistances;
+
+            #pragma omp for schedule(dynamic, 64)
+            for (int i = 0; i < numPoints; i++)
+            {
+                if (m_saliency[i] <= 0)
+                    continue;
+
+                search->radiusSearch(cloud->points[i], m_nonMaxRadius, indices, sqrDistances);
+                if ((int)indices.size() < m_minNeighbors)
+                    continue;
+
+                bool isMaximum = true;
+                for (int j = 0; j < (int)indices.size() && isMaximum; j++)
+                    isMaximum = m_saliency[i] >= m_saliency[indices[j]];
+                m_isMaximum[i] = isMaximum;
+            }
         }
-        else {
-            iss.setInputCloud(pointsWithoutNaNNormals);
-            iss.setNormals(normalsWithoutNaN);
-        }
-
-        iss.setSearchMethod(search);
-
-        iss.setSalientRadius(m_salientRadius);
-        iss.setNonMaxRadius(m_nonMaxRadius);
-
-        //iss.setNormalRadius(normalRadius);
-        //iss.setBorderRadius(borderRadius);
-
-        iss.setThreshold21(m_gamma21);
-        iss.setThreshold32(m_gamma32);
-        iss.setMinNeighbors(m_minNeighbors);
-        iss.setNumberOfThreads(4); // if more than that many threads are used the application crashes "sometimes"
-//        iss.setNumberOfThreads(getNumThreads());
 
         pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
-
-        iss.compute(*keypoints);
+        for (int i = 0; i < numPoints; i++) {
+            if (m_isMaximum[i])
+                keypoints->push_back(cloud->points[i]);
+        }
 
         return keypoints;
     }
 
+    void KeypointsISS3D::computeSaliency(const pcl::PointCloud<PointT> &cloud, pcl::search::Search<PointT> &search, int numThreads)
+    {
+        const int numPoints = (int)cloud.size();
+        m_saliency.assign(numPoints, 0);
+
+        #pragma omp parallel num_threads(numThreads)
+        {
+            std::vector<int> indices;
+            std::vector<float> sqrDistances;
+
+            #pragma omp for schedule(dynamic, 64)
+            for (int i = 0; i < numPoints; i++)
+            {
+                const PointT &point = cloud.points[i];
+                if (!pcl::isFinite(point))
+                    continue;
+
+                search.radiusSearch(point, m_salientRadius, indices, sqrDistances);
+                if ((int)indices.size() < m_minNeighbors)
+                    continue;
+
+                // scatter matrix of the neighbors around the point
+                const Eigen::Vector3d center = point.getVector3fMap().cast<double>();
+                Eigen::Matrix3d scatter = Eigen::Matrix3d::Zero();
+                for (int j = 0; j < (int)indices.size(); j++) {
+                    Eigen::Vector3d offset = cloud.points[indices[j]].getVector3fMap().cast<double>() - center;
+                    scatter += offset * offset.transpose();
+                }
+
+                // eigenvalues in increasing order
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(scatter, Eigen::EigenvaluesOnly);
+                const double e1 = solver.eigenvalues()[2];
+                const double e2 = solver.eigenvalues()[1];
+                const double e3 = solver.eigenvalues()[0];
+                if (!pcl_isfinite(e1) || !pcl_isfinite(e2) || !pcl_isfinite(e3) || e3 < 0)
+                    continue;
+
+                if (e2 / e1 < m_gamma21 && e3 / e2 < m_gamma32)
+                    m_saliency[i] = e3;
+            }
+        }
+    }
+
     std::string KeypointsISS3D::getTypeStatic()
     {
         return "ISS3D";
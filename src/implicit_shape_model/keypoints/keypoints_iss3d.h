@@ -13,11 +13,14 @@
 
 #include "keypoints.h"
 
+#include <vector>
+
 namespace ism3d
 {
     /**
      * @brief The KeypointsISS3D class
-     * Computes keypoints using intrinsic shape signatures.
+     * Computes keypoints using intrinsic shape signatures. The detection follows pcl::ISSKeypoint3D without border
+     * estimation. The scatter matrices and the non maximum suppression are computed in parallel on the given search.
      */
     class KeypointsISS3D
             : public Keypoints
@@ -37,11 +40,18 @@ namespace ism3d
                                                             pcl::search::Search<PointT>::Ptr);
 
     private:
+        // smallest eigenvalue of the scatter matrix of each point, 0 if the point is not salient
+        void computeSaliency(const pcl::PointCloud<PointT> &cloud, pcl::search::Search<PointT> &search, int numThreads);
+
         double m_salientRadius;
         double m_nonMaxRadius;
         double m_gamma21;
         double m_gamma32;
         int m_minNeighbors;
+
+        // kept between calls to reuse their memory
+        std::vector<double> m_saliency;
+        std::vector<char> m_isMaximum;
     };
 }
 
@@ -0,0 +1,102 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "keypoints_pixel_grid.h"
+
+#include <algorithm>
+#include <limits>
+#include <omp.h>
+
+namespace ism3d
+{
+    KeypointsPixelGrid::KeypointsPixelGrid()
+    {
+        addParameter(m_pixelStep, "PixelStep", 8);
+    }
+
+    KeypointsPixelGrid::~KeypointsPixelGrid()
+    {
+    }
+
+    pcl::PointCloud<PointT>::ConstPtr KeypointsPixelGrid::iComputeKeypoints(pcl::PointCloud<PointT>::ConstPtr points,
+                                                                            pcl::PointCloud<pcl::Normal>::ConstPtr normals,
+                                                                            pcl::PointCloud<PointT>::ConstPtr pointsWithoutNaNNormals,
+                                                                            pcl::PointCloud<pcl::Normal>::ConstPtr,
+                                                                            pcl::search::Search<PointT>::Ptr)
+    {
+        const int step = std::max(1, m_pixelStep);
+        pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
+
+        if (!points->isOrganized())
+        {
+            for (int i = 0; i < (int)pointsWithoutNaNNormals->size(); i += step * step)
+                keypoints->push_back(pointsWithoutNaNNormals->points[i]);
+            return keypoints;
+        }
+
+        const int width = (int)points->width;
+        const int height = (int)points->height;
+        const int cellsX = (width + step - 1) / step;
+        const int cellsY = (height + step - 1) / step;
+        const int numThreads = getNumThreads() > 0 ? getNumThreads() : omp_get_max_threads();
+
+        // index of the chosen pixel of each cell, -1 if the cell has no valid pixel
+        std::vector<int> chosen(cellsX * cellsY, -1);
+        #pragma omp parallel for num_threads(numThreads) schedule(static)
+        for (int cell = 0; cell < cellsX * cellsY; cell++)
+        {
+            const int startX = (cell % cellsX) * step;
+            const int startY = (cell / cellsX) * step;
+            const int endX = std::min(startX + step, width);
+            const int endY = std::min(startY + step, height);
+            const float centerX = 0.5f * (startX + endX - 1);
+            const float centerY = 0.5f * (startY + endY - 1);
+
+            float bestDistance = std::numeric_limits<float>::max();
+            for (int y = startY; y < endY; y++)
+            {
+                for (int x = startX; x < endX; x++)
+                {
+                    const int index = y * width + x;
+                    const pcl::Normal &normal = normals->points[index];
+                    if (!pcl::isFinite(points->points[index]) || !pcl_isfinite(normal.normal_x) ||
+                            !pcl_isfinite(normal.normal_y) || !pcl_isfinite(normal.normal_z))
+                        continue;
+
+                    const float distance = (x - centerX) * (x - centerX) + (y - centerY) * (y - centerY);
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        chosen[cell] = index;
+                    }
+                }
+            }
+        }
+
+        // in the order of the cells, independent of the number of threads
+        keypoints->reserve(chosen.size());
+        for (int index : chosen)
+        {
+            if (index >= 0)
+                keypoints->push_back(points->points[index]);
+        }
+        return keypoints;
+    }
+
+    std::string KeypointsPixelGrid::getTypeStatic()
+    {
+        return "PixelGrid";
+    }
+
+    std::string KeypointsPixelGrid::getType() const
+    {
+        return KeypointsPixelGrid::getTypeStatic();
+    }
+}
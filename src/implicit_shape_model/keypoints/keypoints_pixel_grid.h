@@ -0,0 +1,47 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_KEYPOINTSPIXELGRID_H
+#define ISM3D_KEYPOINTSPIXELGRID_H
+
+#include "keypoints.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The KeypointsPixelGrid class
+     * Computes keypoints by sampling an organized point cloud in image space: the image is divided into cells of
+     * PixelStep x PixelStep pixels and of each cell the valid point with a valid normal nearest to the cell center
+     * is a keypoint. Invalid pixels are skipped, so the point cloud is neither copied nor searched. Unorganized
+     * point clouds are sampled by taking every PixelStep * PixelStep-th point with a valid normal.
+     */
+    class KeypointsPixelGrid
+            : public Keypoints
+    {
+    public:
+        KeypointsPixelGrid();
+        ~KeypointsPixelGrid();
+
+        static std::string getTypeStatic();
+        std::string getType() const;
+
+    protected:
+        pcl::PointCloud<PointT>::ConstPtr iComputeKeypoints(pcl::PointCloud<PointT>::ConstPtr,
+                                                            pcl::PointCloud<pcl::Normal>::ConstPtr,
+                                                            pcl::PointCloud<PointT>::ConstPtr,
+                                                            pcl::PointCloud<pcl::Normal>::ConstPtr,
+                                                            pcl::search::Search<PointT>::Ptr);
+
+    private:
+        int m_pixelStep;
+    };
+}
+
+#endif // ISM3D_KEYPOINTSPIXELGRID_H
@@ -10,9 +10,59 @@
 
 #include "keypoints_sift3d.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <omp.h>
+
 namespace ism3d
 {
+    namespace
+    {
+        // same parameters as used with pcl::SIFTKeypoint before
+        const int NumOctaves = 3;
+        const int NumScalesPerOctave = 4;
+        const float MinContrast = 0.0f;
+        const int MinOctavePoints = 25;
+        const int ExtremaNeighbors = 25;
+
+        // reads the points of the input cloud with the curvature of their normals as intensity
+        struct SurfaceAccessor
+        {
+            const pcl::PointCloud<PointT> &points;
+            const pcl::PointCloud<pcl::Normal> &normals;
+
+            bool operator()(int index, pcl::PointXYZI &point) const
+            {
+                const PointT &input = points.points[index];
+                point.x = input.x;
+                point.y = input.y;
+                point.z = input.z;
+                point.intensity = normals.points[index].curvature;
+                return pcl::isFinite(input) && pcl_isfinite(point.intensity);
+            }
+        };
+
+        // reads the points of the previous octave
+        struct OctaveAccessor
+        {
+            const pcl::PointCloud<pcl::PointXYZI> &cloud;
+
+            bool operator()(int index, pcl::PointXYZI &point) const
+            {
+                point = cloud.points[index];
+                return true;
+            }
+        };
+    }
+
+    KeypointsSIFT3D::Octave::Octave()
+        : cloud(new pcl::PointCloud<pcl::PointXYZI>())
+    {
+    }
+
     KeypointsSIFT3D::KeypointsSIFT3D()
+        : m_octaves(NumOctaves)
     {
         addParameter(m_radius, "Radius", 0.05f);
     }
@@ -27,60 +77,223 @@ namespace ism3d
                                                                            pcl::PointCloud<pcl::Normal>::ConstPtr normalsWithoutNaN,
                                                                            pcl::search::Search<PointT>::Ptr search)
     {
-        // create new point cloud and set curvature as intensity (SIFT 3D will then use curvature as "intensity")
-        pcl::PointCloud<pcl::PointXYZI>::Ptr newCloud(new pcl::PointCloud<pcl::PointXYZI>());
+        // curvature is used as "intensity"
+        pcl::PointCloud<PointT>::ConstPtr surface = pointsWithoutNaNNormals;
+        pcl::PointCloud<pcl::Normal>::ConstPtr surfaceNormals = normalsWithoutNaN;
+        if (points->isOrganized())
+        {
+            surface = points;
+            surfaceNormals = normals;
+        }
 
-        pcl::SIFTKeypoint<pcl::PointXYZI, pcl::PointXYZI> sift;
+        pcl::PointCloud<PointT>::Ptr outKeypoints(new pcl::PointCloud<PointT>());
 
-        if (points->isOrganized())
+        // each octave is voxelized from the previous one with the scale of the octave as leaf size
+        float scale = m_radius;
+        for (int i = 0; i < NumOctaves; i++)
         {
-            for(int i = 0; i < points->size(); i++)
+            Octave &octave = m_octaves[i];
+            if (i == 0)
+            {
+                SurfaceAccessor accessor = {*surface, *surfaceNormals};
+                voxelize((int)surface->size(), accessor, scale, *octave.cloud);
+            }
+            else
             {
-                pcl::PointXYZI p;
-                p.x = points->at(i).x;
-                p.y = points->at(i).y;
-                p.z = points->at(i).z;
-                p.intensity = normals->at(i).curvature;
-                newCloud->push_back(p);
+                OctaveAccessor accessor = {*m_octaves[i - 1].cloud};
+                voxelize((int)m_octaves[i - 1].cloud->size(), accessor, scale, *octave.cloud);
             }
-            sift.setInputCloud(newCloud);
+
+            if ((int)octave.cloud->size() < MinOctavePoints)
+                break;
+
+            octave.tree.setInputCloud(octave.cloud);
+
+            std::vector<float> scales(NumScalesPerOctave + 3);
+            for (int j = 0; j < (int)scales.size(); j++)
+                scales[j] = scale * std::pow(2.0f, (float)(j - 1) / NumScalesPerOctave);
+
+            computeScaleSpace(octave, scales);
+            findScaleSpaceExtrema(octave, (int)scales.size() - 1, *outKeypoints);
+
+            scale *= 2;
         }
-        else
+
+        outKeypoints->width = (uint32_t)outKeypoints->size();
+        outKeypoints->height = 1;
+        outKeypoints->is_dense = true;
+        return outKeypoints;
+    }
+
+    template<typename Accessor>
+    void KeypointsSIFT3D::voxelize(int numPoints, const Accessor &accessor, float leafSize, pcl::PointCloud<pcl::PointXYZI> &output)
+    {
+        const float inverseLeafSize = 1.0f / leafSize;
+        output.clear();
+        m_voxelIndices.clear();
+
+        // voxel bounds of the valid points
+        pcl::PointXYZI point;
+        Eigen::Vector3i minVoxel = Eigen::Vector3i::Constant(std::numeric_limits<int>::max());
+        Eigen::Vector3i maxVoxel = Eigen::Vector3i::Constant(std::numeric_limits<int>::min());
+        for (int i = 0; i < numPoints; i++)
         {
-            for(int i = 0; i < pointsWithoutNaNNormals->size(); i++)
+            if (!accessor(i, point))
+                continue;
+
+            Eigen::Vector3i voxel((int)std::floor(point.x * inverseLeafSize), (int)std::floor(point.y * inverseLeafSize),
+                                  (int)std::floor(point.z * inverseLeafSize));
+            minVoxel = minVoxel.cwiseMin(voxel);
+            maxVoxel = maxVoxel.cwiseMax(voxel);
+        }
+
+        if (minVoxel.x() > maxVoxel.x())
+            return;
+
+        // points ordered by their voxel, voxels ordered by x, y and z as in pcl::VoxelGrid
+        const uint64_t sizeX = (uint64_t)(maxVoxel.x() - minVoxel.x()) + 1;
+        const uint64_t sizeY = (uint64_t)(maxVoxel.y() - minVoxel.y()) + 1;
+        for (int i = 0; i < numPoints; i++)
+        {
+            if (!accessor(i, point))
+                continue;
+
+            uint64_t x = (uint64_t)((int)std::floor(point.x * inverseLeafSize) - minVoxel.x());
+            uint64_t y = (uint64_t)((int)std::floor(point.y * inverseLeafSize) - minVoxel.y());
+            uint64_t z = (uint64_t)((int)std::floor(point.z * inverseLeafSize) - minVoxel.z());
+            m_voxelIndices.push_back(std::make_pair(x + y * sizeX + z * sizeX * sizeY, i));
+        }
+        std::sort(m_voxelIndices.begin(), m_voxelIndices.end());
+
+        // average position and intensity of each voxel
+        for (int first = 0; first < (int)m_voxelIndices.size(); )
+        {
+            int last = first;
+            Eigen::Vector4f sum = Eigen::Vector4f::Zero();
+            for (; last < (int)m_voxelIndices.size() && m_voxelIndices[last].first == m_voxelIndices[first].first; last++)
             {
-                pcl::PointXYZI p;
-                p.x = pointsWithoutNaNNormals->at(i).x;
-                p.y = pointsWithoutNaNNormals->at(i).y;
-                p.z = pointsWithoutNaNNormals->at(i).z;
-                p.intensity = normalsWithoutNaN->at(i).curvature;
-                newCloud->push_back(p);
+                accessor(m_voxelIndices[last].second, point);
+                sum += Eigen::Vector4f(point.x, point.y, point.z, point.intensity);
             }
-            sift.setInputCloud(newCloud);
+            sum /= (float)(last - first);
+
+            point.x = sum[0];
+            point.y = sum[1];
+            point.z = sum[2];
+            point.intensity = sum[3];
+            output.points.push_back(point);
+            first = last;
         }
 
-        pcl::search::Search<pcl::PointXYZI>::Ptr searchTree;
-        if (points->isOrganized())
+        output.width = (uint32_t)output.points.size();
+        output.height = 1;
+        output.is_dense = true;
+    }
+
+    void KeypointsSIFT3D::computeScaleSpace(Octave &octave, const std::vector<float> &scales) const
+    {
+        const pcl::PointCloud<pcl::PointXYZI> &cloud = *octave.cloud;
+        const int numPoints = (int)cloud.size();
+        const int numDifferences = (int)scales.size() - 1;
+        octave.differenceOfGaussians.resize((std::size_t)numPoints * numDifferences);
+
+        // only points within 3 standard deviations of the largest scale contribute
+        const float maxRadius = 3.0f * scales.back();
+
+        #pragma omp parallel num_threads(std::max(getNumThreads(), 1))
         {
-            searchTree = pcl::search::OrganizedNeighbor<pcl::PointXYZI>::Ptr(new pcl::search::OrganizedNeighbor<pcl::PointXYZI>());
+            std::vector<int> indices;
+            std::vector<float> sqrDistances;
+
+            #pragma omp for schedule(dynamic, 64)
+            for (int i = 0; i < numPoints; i++)
+            {
+                // neighbors are sorted by distance
+                octave.tree.radiusSearch(i, maxRadius, indices, sqrDistances);
+
+                float response = 0.0f;
+                float previousResponse;
+                for (int j = 0; j < (int)scales.size(); j++)
+                {
+                    const float sigmaSqr = scales[j] * scales[j];
+
+                    float numerator = 0.0f;
+                    float denominator = 0.0f;
+                    for (int k = 0; k < (int)indices.size() && sqrDistances[k] <= 9 * sigmaSqr; k++)
+                    {
+                        float weight = std::exp(-0.5f * sqrDistances[k] / sigmaSqr);
+                        numerator += cloud.points[indices[k]].intensity * weight;
+                        denominator += weight;
+                    }
+
+                    // Gaussian filter response, the difference to the previous scale is stored
+                    previousResponse = response;
+                    response = numerator / denominator;
+                    if (j > 0)
+                        octave.differenceOfGaussians[(std::size_t)i * numDifferences + j - 1] = response - previousResponse;
+                }
+            }
         }
-        else
+    }
+
+    void KeypointsSIFT3D::findScaleSpaceExtrema(const Octave &octave, int numScales, pcl::PointCloud<PointT> &keypoints)
+    {
+        const pcl::PointCloud<pcl::PointXYZI> &cloud = *octave.cloud;
+        const int numPoints = (int)cloud.size();
+        const std::vector<float> &differences = octave.differenceOfGaussians;
+        m_extremaCounts.assign(numPoints, 0);
+
+        #pragma omp parallel num_threads(std::max(getNumThreads(), 1))
         {
-            searchTree = pcl::search::KdTree<pcl::PointXYZI>::Ptr(new pcl::search::KdTree<pcl::PointXYZI>());
-        }
+            std::vector<int> indices(ExtremaNeighbors);
+            std::vector<float> sqrDistances(ExtremaNeighbors);
+            std::vector<float> minValues(numScales);
+            std::vector<float> maxValues(numScales);
 
-        sift.setSearchMethod(searchTree);
-        sift.setScales(m_radius, 4, 3);
-        sift.setMinimumContrast(0.0);
+            #pragma omp for schedule(dynamic, 64)
+            for (int i = 0; i < numPoints; i++)
+            {
+                const int numNeighbors = octave.tree.nearestKSearch(i, ExtremaNeighbors, indices, sqrDistances);
 
-        // compute keypoints
-        pcl::PointCloud<pcl::PointXYZI> keypoints;
-        sift.compute(keypoints);
+                // extreme values of the difference of Gaussians within the neighborhood at each scale
+                for (int j = 0; j < numScales; j++)
+                {
+                    minValues[j] = std::numeric_limits<float>::max();
+                    maxValues[j] = -std::numeric_limits<float>::max();
+                    for (int k = 0; k < numNeighbors; k++)
+                    {
+                        const float value = differences[(std::size_t)indices[k] * numScales + j];
+                        minValues[j] = std::min(minValues[j], value);
+                        maxValues[j] = std::max(maxValues[j], value);
+                    }
+                }
 
-        // discard all information but XYZ
-        pcl::PointCloud<PointT>::Ptr outKeypoints(new pcl::PointCloud<PointT>());
-        pcl::copyPointCloud(keypoints, *outKeypoints);
-        return outKeypoints;
+                // a point is a keypoint for each scale at which it is an extremum across the adjacent scales
+                for (int j = 1; j < numScales - 1; j++)
+                {
+                    const float value = differences[(std::size_t)i * numScales + j];
+                    if (std::fabs(value) < MinContrast)
+                        continue;
+
+                    if ((value == minValues[j] && value < minValues[j - 1] && value < minValues[j + 1]) ||
+                            (value == maxValues[j] && value > maxValues[j - 1] && value > maxValues[j + 1]))
+                        m_extremaCounts[i]++;
+                }
+            }
+        }
+
+        // keep the order of the serial detection
+        for (int i = 0; i < numPoints; i++)
+        {
+            for (int j = 0; j < m_extremaCounts[i]; j++)
+            {
+                PointT keypoint;
+                keypoint.x = cloud.points[i].x;
+                keypoint.y = cloud.points[i].y;
+                keypoint.z = cloud.points[i].z;
+                keypoints.push_back(keypoint);
+            }
+        }
     }
 
     std::string KeypointsSIFT3D::getTypeStatic()
@@ -14,13 +14,20 @@
 #include "keypoints.h"
 
 #define PCL_NO_PRECOMPILE
-#include <pcl/keypoints/sift_keypoint.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
 
 namespace ism3d
 {
     /**
      * @brief The KeypointsSIFT3D class
-     * Computes keyppoints using a 3d adapted version of the SIFT keypoint detector.
+     * Computes keyppoints using a 3d adapted version of the SIFT keypoint detector with the curvature as intensity.
+     * The detection follows pcl::SIFTKeypoint with 4 scales in each of 3 octaves. The first octave is voxelized
+     * directly from the points and normals without an intermediate intensity cloud, the octave pyramid, the search
+     * trees and the difference of Gaussians buffers are kept between calls and the scale space is computed in parallel.
      */
     class KeypointsSIFT3D
             : public Keypoints
@@ -40,7 +47,28 @@ namespace ism3d
                                                             pcl::search::Search<PointT>::Ptr);
 
     private:
+        struct Octave
+        {
+            Octave();
+
+            pcl::PointCloud<pcl::PointXYZI>::Ptr cloud;
+            pcl::KdTreeFLANN<pcl::PointXYZI> tree;
+            std::vector<float> differenceOfGaussians; // one row of scales per point
+        };
+
+        // averages points and intensities per voxel into the octave cloud, points are visited by index
+        template<typename Accessor>
+        void voxelize(int numPoints, const Accessor &accessor, float leafSize, pcl::PointCloud<pcl::PointXYZI> &output);
+
+        void computeScaleSpace(Octave &octave, const std::vector<float> &scales) const;
+        void findScaleSpaceExtrema(const Octave &octave, int numScales, pcl::PointCloud<PointT> &keypoints);
+
         float m_radius;
+
+        // kept between calls to reuse their memory
+        std::vector<Octave> m_octaves;
+        std::vector<std::pair<uint64_t, int> > m_voxelIndices;
+        std::vector<int> m_extremaCounts;
     };
 }
 
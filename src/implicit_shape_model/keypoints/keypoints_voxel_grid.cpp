@@ -11,7 +11,6 @@
 #include "keypoints_voxel_grid.h"
 
 #define PCL_NO_PRECOMPILE
-#include <pcl/filters/voxel_grid.h>
 #include <pcl/search/kdtree.h>
 
 namespace ism3d
@@ -31,17 +30,31 @@ namespace ism3d
                                                                             pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                                             pcl::search::Search<PointT>::Ptr)
     {
-        pcl::VoxelGrid<PointT> voxelGrid;
-        voxelGrid.setInputCloud(points);
-        voxelGrid.setLeafSize(m_leafSize, m_leafSize, m_leafSize);
+        if (m_precomputedKeypoints)
+        {
+            pcl::PointCloud<PointT>::ConstPtr keypoints = m_precomputedKeypoints;
+            m_precomputedKeypoints.reset();
+            return keypoints;
+        }
 
         // compute keypoints
         pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
-        voxelGrid.filter(*keypoints);
+        m_voxelGrid.setNumThreads(getNumThreads());
+        m_voxelGrid.filter(*points, m_leafSize, *keypoints);
 
         return keypoints;
     }
 
+    float KeypointsVoxelGrid::getLeafSize() const
+    {
+        return m_leafSize;
+    }
+
+    void KeypointsVoxelGrid::setPrecomputedKeypoints(pcl::PointCloud<PointT>::ConstPtr keypoints)
+    {
+        m_precomputedKeypoints = keypoints;
+    }
+
     std::string KeypointsVoxelGrid::getTypeStatic()
     {
         return "VoxelGrid";
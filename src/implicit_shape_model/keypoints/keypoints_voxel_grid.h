@@ -12,6 +12,7 @@
 #define ISM3D_KEYPOINTSVOXELGRID_H
 
 #include "keypoints.h"
+#include "../utils/voxel_hash_grid.h"
 
 namespace ism3d
 {
@@ -30,6 +31,15 @@ namespace ism3d
         static std::string getTypeStatic();
         std::string getType() const;
 
+        float getLeafSize() const;
+
+        /**
+         * @brief Set the keypoints for the next call, e.g. computed together with the voxel filtering of the input.
+         * They are used once instead of voxelizing the input again.
+         * @param keypoints the voxel centroids of the next input cloud at the leaf size of this object
+         */
+        void setPrecomputedKeypoints(pcl::PointCloud<PointT>::ConstPtr keypoints);
+
     protected:
         pcl::PointCloud<PointT>::ConstPtr iComputeKeypoints(pcl::PointCloud<PointT>::ConstPtr,
                                                             pcl::PointCloud<pcl::Normal>::ConstPtr,
@@ -37,8 +47,16 @@ namespace ism3d
                                                             pcl::PointCloud<pcl::Normal>::ConstPtr,
                                                             pcl::search::Search<PointT>::Ptr);
 
+        bool iNeedsNormals() const
+        {
+            return false;
+        }
+
     private:
         float m_leafSize;
+
+        VoxelHashGrid m_voxelGrid;
+        pcl::PointCloud<PointT>::ConstPtr m_precomputedKeypoints;
     };
 }
 
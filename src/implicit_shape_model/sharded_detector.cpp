@@ -0,0 +1,221 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "sharded_detector.h"
+#include "features/features.h"
+#include "utils/exception.h"
+#include "utils/shared_search.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <omp.h>
+
+namespace ism3d
+{
+
+ShardedDetector::ShardedDetector(const std::vector<ImplicitShapeModel*> &shards)
+    : m_num_threads(0)
+{
+    for (ImplicitShapeModel *shard : shards)
+        m_sessions.push_back(shard->createSession());
+}
+
+ShardedDetector::~ShardedDetector()
+{
+}
+
+void ShardedDetector::setNumThreads(int numThreads)
+{
+    m_num_threads = numThreads;
+}
+
+std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> >
+ShardedDetector::detect(pcl::PointCloud<PointNormalT>::ConstPtr points, bool hasNormals)
+{
+    std::map<std::string, double> times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    std::vector<VotingMaximum> maxima;
+    if (m_sessions.empty())
+        return std::make_tuple(maxima, times);
+
+    boost::timer::cpu_timer timer;
+
+    // the normals are checked once for all shards
+    if (hasNormals)
+    {
+        for (const PointNormalT &point : points->points)
+        {
+            if (!pcl::isFinite(point))
+                continue;
+            if (point.normal_x == 0 && point.normal_y == 0 && point.normal_z == 0 ||
+                    pcl_isnan(point.normal_x) || pcl_isnan(point.curvature))
+                hasNormals = false;
+            break;
+        }
+    }
+
+    // the descriptors of the first shard are used for all shards
+    DetectionSession &first = *m_sessions[0];
+    const std::string key = first.m_model.getPreprocessingKey(hasNormals);
+    const Json::Value descriptor = first.m_model.m_featureDescriptor->configToJson();
+    for (const std::shared_ptr<DetectionSession> &session : m_sessions)
+    {
+        if (session->m_model.getPreprocessingKey(hasNormals) != key ||
+                session->m_model.m_featureDescriptor->configToJson() != descriptor)
+            throw RuntimeException("the shards of a model must be configured equally up to the descriptors");
+    }
+
+    const int numThreads = m_num_threads > 0 ? m_num_threads : omp_get_max_threads();
+    LOG_INFO("detecting with " << m_sessions.size() << " shards");
+
+    ImplicitShapeModel::PreprocessedInput preprocessed;
+    ImplicitShapeModel::DetectionInput input;
+    {
+        first.setNumThreads(numThreads);
+        ThreadScope threads(numThreads, first.m_model.m_cpus);
+        // the shards merge their maxima, the global classification of one shard is not the result of all
+        ImplicitShapeModel::FeaturePipeline pipeline = first.getFeaturePipeline();
+        pipeline.earlyExitVoting = 0;
+        if (!first.m_model.preprocessDetectionInput(pipeline, points, hasNormals, false, preprocessed, times))
+        {
+            times["complete"] = first.m_model.getElapsedTime(timer, "milliseconds");
+            return std::make_tuple(maxima, times);
+        }
+        first.m_model.describeDetectionInput(pipeline, preprocessed, input, times);
+    }
+
+    // the features are not changed by the activation, each shard searches the points with its own search
+    const int shardThreads = std::max(1, numThreads / (int)m_sessions.size());
+    std::vector<std::vector<VotingMaximum> > shardMaxima(m_sessions.size());
+    std::vector<std::map<std::string, double> > shardTimes(m_sessions.size());
+    std::exception_ptr error;
+    std::mutex mutex;
+    auto work = [&](int shard)
+    {
+        try
+        {
+            DetectionSession &session = *m_sessions[shard];
+            session.setNumThreads(shardThreads);
+            session.m_voting->setNormalizeWeights(false);
+            ThreadScope threads(shardThreads, session.m_model.m_cpus);
+            boost::timer::cpu_timer timer_shard;
+
+            ImplicitShapeModel::DetectionInput own = input;
+            own.search = preprocessed.search->fork();
+            shardMaxima[shard] = session.detectFeatures(own, timer_shard, shardTimes[shard]);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < (int)m_sessions.size(); i++)
+        workers.push_back(std::thread(work, i));
+    work(0);
+    for (std::thread &worker : workers)
+        worker.join();
+    if (error)
+        std::rethrow_exception(error);
+
+    for (int i = 0; i < (int)m_sessions.size(); i++)
+    {
+        maxima.insert(maxima.end(), shardMaxima[i].begin(), shardMaxima[i].end());
+        for (const auto &time : shardTimes[i])
+            times[time.first] += time.second;
+    }
+
+    // maxima of classes of different shards are merged like the maxima of a single model
+    boost::timer::cpu_timer timer_maxima;
+    maxima = first.m_voting->mergePartialMaxima(maxima);
+    times["maxima"] += first.m_model.getElapsedTime(timer_maxima, "milliseconds");
+
+    times["complete"] = first.m_model.getElapsedTime(timer, "milliseconds");
+    return std::make_tuple(maxima, times);
+}
+
+bool ShardedDetector::writeShards(const std::string &modelFile, const std::vector<std::set<unsigned> > &shardClasses,
+                                  const std::string &manifestFile)
+{
+    boost::filesystem::path manifestPath(manifestFile);
+    const std::string stem = manifestPath.stem().string();
+
+    Json::Value manifest(Json::objectValue);
+    manifest["Model"] = modelFile;
+    manifest["Shards"] = Json::Value(Json::arrayValue);
+    for (int i = 0; i < (int)shardClasses.size(); i++)
+    {
+        if (shardClasses[i].empty())
+        {
+            LOG_ERROR("shard " << i << " has no classes");
+            return false;
+        }
+
+        // each shard only loads the codewords and votes of its classes
+        const std::string shardName = stem + ".shard" + std::to_string(i) + ".ism";
+        const std::string shardFile = (manifestPath.parent_path() / shardName).string();
+        LOG_INFO("writing shard " << i << " with " << shardClasses[i].size() << " classes to " << shardFile);
+        {
+            ImplicitShapeModel shard;
+            shard.setLoadClasses(shardClasses[i]);
+            if (!shard.readObject(modelFile) || !shard.writeObject(shardFile))
+                return false;
+        }
+
+        Json::Value shardJson(Json::objectValue);
+        shardJson["Model"] = shardName;
+        shardJson["Classes"] = Json::Value(Json::arrayValue);
+        for (unsigned classId : shardClasses[i])
+            shardJson["Classes"].append(classId);
+        manifest["Shards"].append(shardJson);
+    }
+
+    std::ofstream file(manifestFile.c_str());
+    if (!file)
+        return false;
+    Json::StyledWriter writer;
+    file << writer.write(manifest);
+    return (bool)file;
+}
+
+bool ShardedDetector::readManifest(const std::string &manifestFile, std::vector<std::string> &shardFiles,
+                                   std::vector<std::set<unsigned> > &shardClasses)
+{
+    std::ifstream file(manifestFile.c_str());
+    Json::Value manifest;
+    Json::Reader reader;
+    if (!file || !reader.parse(file, manifest) || !manifest["Shards"].isArray())
+        return false;
+
+    // the shard files are stored relative to the manifest
+    const boost::filesystem::path directory = boost::filesystem::path(manifestFile).parent_path();
+    shardFiles.clear();
+    shardClasses.clear();
+    for (const Json::Value &shard : manifest["Shards"])
+    {
+        if (!shard["Model"].isString() || !shard["Classes"].isArray())
+            return false;
+        shardFiles.push_back((directory / shard["Model"].asString()).string());
+        std::set<unsigned> classes;
+        for (const Json::Value &classId : shard["Classes"])
+            classes.insert(classId.asUInt());
+        shardClasses.push_back(classes);
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,90 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SHARDED_DETECTOR_H
+#define ISM3D_SHARDED_DETECTOR_H
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "implicit_shape_model.h"
+#include "detection_session.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ShardedDetector class
+     * Detects objects with a model that is split by classes into shards, e.g. if its codebook exceeds the memory of a
+     * single node. The shards are written by writeShards(), each shard is a model containing the codewords, votes,
+     * bounding boxes and global features of its classes. The voxel filtering, normals, keypoints and descriptors are
+     * computed once with the first shard and shared by all shards, which compute the activation, the voting and the
+     * maxima of their classes concurrently, each on its share of the threads. The maxima of all shards are filtered
+     * as configured in the voting (MaxFilterType), which merges close maxima of classes of different shards, and
+     * their weights are normalized over all classes. The region of interest of the first shard crops the points. The
+     * detector holds a DetectionSession of each shard, the shards must not be changed while it is used.
+     */
+    class ShardedDetector
+    {
+    public:
+        /**
+         * @brief Create a detector for the shards of a model.
+         * @param shards the shards, loaded with equal configurations of the stages up to the descriptors, they must
+         * outlive the detector
+         */
+        ShardedDetector(const std::vector<ImplicitShapeModel*> &shards);
+        ~ShardedDetector();
+
+        /**
+         * @brief Detect unknown object instances with all shards.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @return a tuple with the maxima of all classes, time measurements of this detection: the stages of the
+         * shards are summed up, "complete" is the duration of the whole detection
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true);
+
+        /**
+         * @brief Set the number of threads shared by the shards.
+         * @param numThreads the number of threads, 0 uses the OpenMP default
+         */
+        void setNumThreads(int numThreads);
+
+        /**
+         * @brief Split a trained model into shards of classes. Each shard is written next to the manifest as
+         * <manifest>.shard<i>.ism with its data file, the manifest lists the shard files and their classes.
+         * @param modelFile the trained model
+         * @param shardClasses the classes of each shard, a class should be part of a single shard
+         * @param manifestFile the manifest to write
+         * @return true if successful
+         */
+        static bool writeShards(const std::string &modelFile, const std::vector<std::set<unsigned> > &shardClasses,
+                                const std::string &manifestFile);
+
+        /**
+         * @brief Read the manifest written by writeShards().
+         * @param manifestFile the manifest
+         * @param shardFiles output: the model files of the shards, relative to the working directory
+         * @param shardClasses output: the classes of each shard
+         * @return true if successful
+         */
+        static bool readManifest(const std::string &manifestFile, std::vector<std::string> &shardFiles,
+                                 std::vector<std::set<unsigned> > &shardClasses);
+
+    private:
+        std::vector<std::shared_ptr<DetectionSession> > m_sessions;
+        int m_num_threads;
+    };
+}
+
+#endif // ISM3D_SHARDED_DETECTOR_H
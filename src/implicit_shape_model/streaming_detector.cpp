@@ -0,0 +1,297 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "streaming_detector.h"
+#include "utils/factory.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ism3d
+{
+
+StreamingDetector::StreamingDetector(const ImplicitShapeModel &model)
+    : m_model(model), m_has_previous(false), m_num_updated(0)
+{
+    // the index was built by the model before, it is only searched
+    m_flann_helper = model.m_flann_helper;
+    m_leaf_size = model.m_streaming_leaf_size;
+    m_tolerance = model.m_streaming_change_tolerance;
+
+    m_keypointsDetector.reset(Factory<Keypoints>::create(model.m_keypointsDetector->configToJson()));
+    m_featureDescriptor.reset(Factory<Features>::create(model.m_featureDescriptor->configToJson()));
+    m_globalFeatureDescriptor.reset(Factory<Features>::create(model.m_globalFeatureDescriptor->configToJson()));
+
+    m_voting.reset(model.m_voting->createDetectionCopy());
+    m_voting->setGlobalFeatureDescriptor(m_globalFeatureDescriptor.get());
+    m_voting->setMVBBParams(model.m_mvbbEpsilon, model.m_mvbbLeafSize);
+    m_voting->setLeanMaxima(model.m_lean_output);
+    m_voting->setRegionOfInterest(model.m_region_of_interest);
+    m_voting->setClassMaximaCallback(model.m_class_maxima_callback, model.m_priority_classes);
+    m_estimators.reset(new EstimatorCache());
+}
+
+StreamingDetector::~StreamingDetector()
+{
+}
+
+void StreamingDetector::reset()
+{
+    m_has_previous = false;
+    m_summaries.clear();
+    m_features.clear();
+    m_maxima.clear();
+}
+
+int StreamingDetector::getNumUpdatedFeatures() const
+{
+    return m_num_updated;
+}
+
+std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> >
+StreamingDetector::detect(pcl::PointCloud<PointNormalT>::ConstPtr points, bool hasNormals)
+{
+    std::map<std::string, double> times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}};
+    m_num_updated = 0;
+    ThreadScope threads(m_model.m_numThreads, m_model.m_cpus);
+
+    // measure the time
+    boost::timer::cpu_timer timer;
+
+    // compare the voxels with the frame the features were computed on
+    VoxelSummaries summaries;
+    summarize(*points, summaries);
+
+    const float margin = m_featureDescriptor->getSupportRadius() + m_model.m_normalRadius;
+    std::vector<VoxelKey> changed;
+    VoxelSet dirty;
+    if (m_has_previous)
+    {
+        dirty = findDirtyVoxels(summaries, margin, changed);
+        if (dirty.empty())
+        {
+            LOG_INFO("no voxel changed, keeping " << m_maxima.size() << " maxima");
+            times["complete"] += m_model.getElapsedTime(timer, "milliseconds");
+            return std::make_tuple(m_maxima, times);
+        }
+        LOG_INFO(changed.size() << " voxels changed, updating features in " << dirty.size() << " voxels");
+    }
+
+    // only keypoints near changed voxels are described
+    ImplicitShapeModel::FeaturePipeline pipeline = {m_keypointsDetector.get(), m_featureDescriptor.get(),
+                                                    m_globalFeatureDescriptor.get(), &m_voxelFiltering,
+                                                    m_model.getStageThreads(m_model.m_threads_features),
+                                                    &m_voting->getRegionOfInterest()};
+    pipeline.numNormalThreads = m_model.getStageThreads(m_model.m_threads_normals);
+    pipeline.estimators = m_estimators;
+    if (m_has_previous)
+    {
+        pipeline.keypointFilter = [this, &dirty](const PointT &keypoint)
+        {
+            return dirty.count(getVoxelKey(keypoint.getVector3fMap())) > 0;
+        };
+    }
+
+    ImplicitShapeModel::DetectionInput input;
+    if (!m_model.computeDetectionFeatures(pipeline, points, hasNormals, true, input, times))
+    {
+        // the next frame is detected completely
+        reset();
+        return std::make_tuple(m_maxima, times);
+    }
+    m_num_updated = (int)input.features->size();
+
+    if(m_model.m_enable_signals)
+    {
+        timer.stop();
+        m_model.m_signalFeatures(input.features);
+        timer.resume();
+    }
+    if(m_model.m_dispatcher)
+        m_model.m_dispatcher->postFeatures(input.features);
+
+    LOG_INFO("activating codewords of " << m_num_updated << " features");
+    boost::timer::cpu_timer timer_voting;
+    ActivationResult activation;
+    const Codebook* codebook = m_model.m_codebook;
+    {
+        ThreadScope activationThreads(m_model.getStageThreads(m_model.m_threads_activation));
+        codebook->activateFeatures(input.features, m_model.m_distance, *m_flann_helper, m_model.m_flann_exact_match, activation);
+    }
+
+    // retract the features of the dirty voxels and keep the new ones
+    if (m_has_previous)
+    {
+        for (const VoxelKey &key : dirty)
+            m_features.erase(key);
+    }
+    else
+    {
+        m_features.clear();
+    }
+
+    for (int i = 0; i < activation.numQueries(); i++)
+    {
+        const ISMFeature &feature = input.features->at(i);
+        VoxelFeatures &voxel = m_features[getVoxelKey(feature.getVector3fMap())];
+        if (!voxel.features)
+        {
+            voxel.features.reset(new pcl::PointCloud<ISMFeature>());
+            voxel.activation.offsets.push_back(0);
+        }
+        voxel.features->push_back(feature);
+        voxel.activation.codewordIndices.insert(voxel.activation.codewordIndices.end(),
+                                                activation.codewordIndices.begin() + activation.offsets[i],
+                                                activation.codewordIndices.begin() + activation.offsets[i + 1]);
+        voxel.activation.distances.insert(voxel.activation.distances.end(),
+                                          activation.distances.begin() + activation.offsets[i],
+                                          activation.distances.begin() + activation.offsets[i + 1]);
+        voxel.activation.offsets.push_back((int)voxel.activation.codewordIndices.size());
+    }
+
+    // votes of the kept features are cast again from their activations, which avoids descriptors and index searches
+    pcl::PointCloud<ISMFeature> features;
+    ActivationResult allActivations;
+    allActivations.offsets.push_back(0);
+    for (const auto &entry : m_features)
+    {
+        const VoxelFeatures &voxel = entry.second;
+        features += *voxel.features;
+        const int offset = (int)allActivations.codewordIndices.size();
+        allActivations.codewordIndices.insert(allActivations.codewordIndices.end(),
+                                              voxel.activation.codewordIndices.begin(), voxel.activation.codewordIndices.end());
+        allActivations.distances.insert(allActivations.distances.end(),
+                                        voxel.activation.distances.begin(), voxel.activation.distances.end());
+        for (int i = 1; i < (int)voxel.activation.offsets.size(); i++)
+            allActivations.offsets.push_back(offset + voxel.activation.offsets[i]);
+    }
+
+    // forward global feature to voting class in single object mode
+    if(m_model.m_single_object_mode) m_voting->setGlobalFeatures(input.globalFeatures);
+
+    LOG_INFO("casting votes of " << features.size() << " features");
+    {
+        ThreadScope votingThreads(m_model.getStageThreads(m_model.m_threads_voting));
+        m_voting->clear();
+        codebook->castVotes(features, allActivations, *m_voting);
+    }
+    times["voting"] += m_model.getElapsedTime(timer_voting, "milliseconds");
+
+    LOG_INFO("finding maxima");
+    boost::timer::cpu_timer timer_maxima;
+    {
+        ThreadScope maximaThreads(m_model.getStageThreads(m_model.m_threads_maxima));
+        m_maxima = m_voting->findMaxima(input.pointsWithoutNaN, input.normalsWithoutNaN, input.search);
+        if (m_model.m_lean_output)
+            m_voting->releaseVotes();
+    }
+    times["maxima"] += m_model.getElapsedTime(timer_maxima, "milliseconds");
+    LOG_INFO("detected " << m_maxima.size() << " maxima");
+
+    if(m_model.m_enable_signals)
+    {
+        timer.stop();
+        m_model.m_signalMaxima(m_maxima);
+        timer.resume();
+    }
+    if(m_model.m_dispatcher)
+        m_model.m_dispatcher->postMaxima(m_maxima);
+
+    // the changed voxels are compared with this frame from now on, unchanged voxels keep their reference so that
+    // slow changes are found when they add up
+    if (m_has_previous)
+    {
+        for (const VoxelKey &key : changed)
+        {
+            VoxelSummaries::const_iterator it = summaries.find(key);
+            if (it != summaries.end())
+                m_summaries[key] = it->second;
+            else
+                m_summaries.erase(key);
+        }
+    }
+    else
+    {
+        m_summaries.swap(summaries);
+        m_has_previous = true;
+    }
+
+    times["complete"] += m_model.getElapsedTime(timer, "milliseconds");
+    return std::make_tuple(m_maxima, times);
+}
+
+StreamingDetector::VoxelKey StreamingDetector::getVoxelKey(const Eigen::Vector3f &point) const
+{
+    const float inverse_leaf_size = 1.0f / m_leaf_size;
+    VoxelKey key;
+    key.x = (int64_t)std::floor(point[0] * inverse_leaf_size);
+    key.y = (int64_t)std::floor(point[1] * inverse_leaf_size);
+    key.z = (int64_t)std::floor(point[2] * inverse_leaf_size);
+    return key;
+}
+
+void StreamingDetector::summarize(const pcl::PointCloud<PointNormalT> &points, VoxelSummaries &summaries) const
+{
+    for (const PointNormalT &point : points.points)
+    {
+        if (!pcl::isFinite(point))
+            continue;
+
+        VoxelSummary &summary = summaries.insert(std::make_pair(getVoxelKey(point.getVector3fMap()),
+                                                                VoxelSummary{0, Eigen::Vector3f::Zero()})).first->second;
+        summary.numPoints++;
+        summary.sum += point.getVector3fMap();
+    }
+}
+
+bool StreamingDetector::hasChanged(const VoxelSummary *previous, const VoxelSummary *current) const
+{
+    if (!previous || !current)
+        return previous != current;
+
+    int maxPoints = std::max(previous->numPoints, current->numPoints);
+    if (std::abs(previous->numPoints - current->numPoints) > m_tolerance * maxPoints)
+        return true;
+
+    Eigen::Vector3f previousCentroid = previous->sum / (float)previous->numPoints;
+    Eigen::Vector3f currentCentroid = current->sum / (float)current->numPoints;
+    return (previousCentroid - currentCentroid).norm() > m_tolerance * m_leaf_size;
+}
+
+StreamingDetector::VoxelSet StreamingDetector::findDirtyVoxels(const VoxelSummaries &summaries, float radius,
+                                                               std::vector<VoxelKey> &changed) const
+{
+    changed.clear();
+    for (const auto &current : summaries)
+    {
+        VoxelSummaries::const_iterator previous = m_summaries.find(current.first);
+        if (hasChanged(previous != m_summaries.end() ? &previous->second : 0, &current.second))
+            changed.push_back(current.first);
+    }
+    for (const auto &previous : m_summaries)
+    {
+        if (summaries.find(previous.first) == summaries.end())
+            changed.push_back(previous.first);
+    }
+
+    // keypoints within the radius of a changed voxel describe changed points
+    const int range = (int)std::ceil(radius / m_leaf_size);
+    VoxelSet dirty;
+    for (const VoxelKey &key : changed)
+    {
+        for (int x = -range; x <= range; x++)
+            for (int y = -range; y <= range; y++)
+                for (int z = -range; z <= range; z++)
+                    dirty.insert(VoxelKey{key.x + x, key.y + y, key.z + z});
+    }
+    return dirty;
+}
+
+}
@@ -0,0 +1,136 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_STREAMING_DETECTOR_H
+#define ISM3D_STREAMING_DETECTOR_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "implicit_shape_model.h"
+#include "activation_strategy/activation_strategy.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The StreamingDetector class
+     * Detects objects in consecutive frames of a static camera, in which only small regions change between frames.
+     * The points of a frame are summarized per voxel (StreamingLeafSize) by their number and centroid, a voxel has
+     * changed if one of them differs from the previous frame by more than StreamingChangeTolerance. Features are
+     * kept with their codebook activations per voxel of their keypoint. Only keypoints in changed voxels or within
+     * the support and normal radius of them are described and matched again, the features of these voxels from the
+     * previous frame are retracted together with their votes. Frames without changed voxels return the maxima of
+     * the previous frame. Create detectors with ImplicitShapeModel::createStreamingDetector(), the model must not
+     * be trained, loaded or otherwise changed while detectors are used.
+     */
+    class StreamingDetector
+    {
+    public:
+        ~StreamingDetector();
+
+        /**
+         * @brief Detect unknown object instances in the next frame.
+         * @param pointCloud the frame in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @return a tuple with list of detected object positions, time measurements of this frame
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals = true);
+
+        /**
+         * @brief Forget the previous frames, the next frame is detected completely.
+         */
+        void reset();
+
+        /**
+         * @brief Get the number of keypoints that were described in the last frame.
+         * @return the number of keypoints
+         */
+        int getNumUpdatedFeatures() const;
+
+    private:
+        friend class ImplicitShapeModel;
+
+        StreamingDetector(const ImplicitShapeModel &model);
+
+        struct VoxelKey
+        {
+            int64_t x;
+            int64_t y;
+            int64_t z;
+
+            bool operator==(const VoxelKey &other) const
+            {
+                return x == other.x && y == other.y && z == other.z;
+            }
+        };
+
+        struct VoxelKeyHash
+        {
+            std::size_t operator()(const VoxelKey &key) const
+            {
+                uint64_t hash = (uint64_t)key.x * 73856093ULL;
+                hash ^= (uint64_t)key.y * 19349663ULL;
+                hash ^= (uint64_t)key.z * 83492791ULL;
+                return (std::size_t)hash;
+            }
+        };
+
+        struct VoxelSummary
+        {
+            int numPoints;
+            Eigen::Vector3f sum;
+        };
+
+        // the features of a previous frame with keypoints in one voxel and the codewords they activated
+        struct VoxelFeatures
+        {
+            pcl::PointCloud<ISMFeature>::Ptr features;
+            ActivationResult activation;
+        };
+
+        typedef std::unordered_map<VoxelKey, VoxelSummary, VoxelKeyHash> VoxelSummaries;
+        typedef std::unordered_set<VoxelKey, VoxelKeyHash> VoxelSet;
+
+        VoxelKey getVoxelKey(const Eigen::Vector3f &point) const;
+
+        void summarize(const pcl::PointCloud<PointNormalT> &points, VoxelSummaries &summaries) const;
+
+        bool hasChanged(const VoxelSummary *previous, const VoxelSummary *current) const;
+
+        // the changed voxels enlarged by the radius, in which features have to be computed again
+        VoxelSet findDirtyVoxels(const VoxelSummaries &summaries, float radius, std::vector<VoxelKey> &changed) const;
+
+        const ImplicitShapeModel &m_model;
+        std::shared_ptr<FlannHelper> m_flann_helper;
+        float m_leaf_size;
+        float m_tolerance;
+
+        std::unique_ptr<Keypoints> m_keypointsDetector;
+        std::unique_ptr<Features> m_featureDescriptor;
+        std::unique_ptr<Features> m_globalFeatureDescriptor;
+        VoxelHashGrid m_voxelFiltering;
+        EstimatorCache::Ptr m_estimators; // estimators and searches of the updates, kept between frames
+        std::unique_ptr<Voting> m_voting;
+
+        // state of the previous frame
+        bool m_has_previous;
+        VoxelSummaries m_summaries;
+        std::unordered_map<VoxelKey, VoxelFeatures, VoxelKeyHash> m_features;
+        std::vector<VotingMaximum> m_maxima;
+        int m_num_updated;
+    };
+}
+
+#endif // ISM3D_STREAMING_DETECTOR_H
@@ -0,0 +1,44 @@
+"""
+    Usage
+
+    python export_weights.py <pretrained model file> <output filename>
+
+    Example:
+    python export_weights.py embed_model_910000.ckpt cgf_embedding_910000.npz
+
+    Exports the dense layers of the embedding network in embedding.py as arrays weights_<i> and biases_<i>,
+    where i = 0 is the first layer. The CGF feature evaluates the exported layers in C++, so that neither
+    python nor tensorflow are needed when computing features.
+"""
+
+import sys
+import numpy as np
+import tensorflow as tf
+
+def main(argv):
+    checkpoint_model = argv[0]
+    output_name = argv[1]
+
+    reader = tf.train.NewCheckpointReader(checkpoint_model)
+    names = list(reader.get_variable_to_shape_map().keys())
+
+    arrays = {}
+    layer = 1
+    while True:
+        prefix = 'embedding/layer{0}/'.format(layer)
+        # skip the optimizer slots stored with the variables
+        weights = [n for n in names if n.startswith(prefix + 'weights/') and 'Adam' not in n]
+        biases = [n for n in names if n.startswith(prefix + 'biases/') and 'Adam' not in n]
+        if len(weights) != 1 or len(biases) != 1:
+            break
+        arrays['weights_{0}'.format(layer - 1)] = reader.get_tensor(weights[0]).astype(np.float32)
+        arrays['biases_{0}'.format(layer - 1)] = reader.get_tensor(biases[0]).astype(np.float32)
+        layer += 1
+
+    if not arrays:
+        sys.exit('No embedding layers found in {0}.'.format(checkpoint_model))
+
+    np.savez(output_name, **arrays)
+
+if __name__ == '__main__':
+    main(sys.argv[1:])
@@ -753,6 +753,8 @@ GDIAM_EXPORT gdiam_bbox   gdiam_approx_const_mvbb( gdiam_point  * start, int  si
 GDIAM_EXPORT gdiam_point  * gdiam_convert( gdiam_real  * start, int  size );
 GDIAM_EXPORT gdiam_bbox   gdiam_approx_mvbb( gdiam_point  * start, int  size,
                                 gdiam_real  eps ) ;
+GDIAM_EXPORT gdiam_bbox   gdiam_mvbb_optimize( gdiam_point  * start, int  size,
+                                  gdiam_bbox  bb_out, int  times  );
 GDIAM_EXPORT gdiam_bbox   gdiam_approx_mvbb_grid( gdiam_point  * start, int  size,
                                      int  grid_size );
 GDIAM_EXPORT gdiam_bbox   gdiam_approx_mvbb_grid_sample( gdiam_point  * start, int  size,
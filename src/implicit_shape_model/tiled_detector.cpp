@@ -0,0 +1,221 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "tiled_detector.h"
+#include "features/features.h"
+#include "utils/region_of_interest.h"
+
+#include <pcl/common/io.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <omp.h>
+
+namespace ism3d
+{
+
+TiledDetector::TiledDetector(ImplicitShapeModel &model, float tileSize, int numWorkers)
+    : m_model(model), m_tile_size(tileSize), m_num_workers(std::max(numWorkers, 1)), m_num_tiles(0)
+{
+}
+
+TiledDetector::~TiledDetector()
+{
+}
+
+int TiledDetector::getNumTiles() const
+{
+    return m_num_tiles;
+}
+
+std::vector<TiledDetector::Tile> TiledDetector::createTiles(const pcl::PointCloud<PointNormalT> &points, float margin) const
+{
+    std::vector<Tile> tiles;
+    Eigen::Vector3f min = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+    Eigen::Vector3f max = Eigen::Vector3f::Constant(-std::numeric_limits<float>::max());
+    for (const PointNormalT &point : points.points)
+    {
+        if (!pcl::isFinite(point))
+            continue;
+        min = min.cwiseMin(point.getVector3fMap());
+        max = max.cwiseMax(point.getVector3fMap());
+    }
+    if (min.x() > max.x())
+        return tiles;
+
+    Eigen::Vector3i numTiles;
+    for (int c = 0; c < 3; c++)
+        numTiles[c] = std::max(1, (int)std::ceil((max[c] - min[c]) / m_tile_size));
+    tiles.resize((std::size_t)numTiles.x() * numTiles.y() * numTiles.z());
+    for (int z = 0; z < numTiles.z(); z++)
+    {
+        for (int y = 0; y < numTiles.y(); y++)
+        {
+            for (int x = 0; x < numTiles.x(); x++)
+            {
+                Tile &tile = tiles[((std::size_t)z * numTiles.y() + y) * numTiles.x() + x];
+                tile.min = min + Eigen::Vector3f(x, y, z) * m_tile_size;
+                tile.hasPoints = false;
+            }
+        }
+    }
+
+    // a point belongs to the tiles whose enlarged region contains it, in each dimension these are consecutive
+    for (int i = 0; i < (int)points.size(); i++)
+    {
+        const PointNormalT &point = points.points[i];
+        if (!pcl::isFinite(point))
+            continue;
+
+        const Eigen::Vector3f relative = (point.getVector3fMap() - min) / m_tile_size;
+        Eigen::Vector3i first, last, own;
+        for (int c = 0; c < 3; c++)
+        {
+            const float offset = margin / m_tile_size;
+            first[c] = std::max(0, (int)std::floor(relative[c] - offset));
+            last[c] = std::min(numTiles[c] - 1, (int)std::floor(relative[c] + offset));
+            own[c] = std::min(numTiles[c] - 1, (int)std::floor(relative[c]));
+        }
+
+        for (int z = first.z(); z <= last.z(); z++)
+        {
+            for (int y = first.y(); y <= last.y(); y++)
+            {
+                for (int x = first.x(); x <= last.x(); x++)
+                {
+                    Tile &tile = tiles[((std::size_t)z * numTiles.y() + y) * numTiles.x() + x];
+                    tile.indices.push_back(i);
+                    if (x == own.x() && y == own.y() && z == own.z())
+                        tile.hasPoints = true;
+                }
+            }
+        }
+    }
+
+    tiles.erase(std::remove_if(tiles.begin(), tiles.end(), [](const Tile &tile) { return !tile.hasPoints; }),
+                tiles.end());
+    return tiles;
+}
+
+std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> >
+TiledDetector::detect(pcl::PointCloud<PointNormalT>::ConstPtr points, bool hasNormals)
+{
+    std::map<std::string, double> times = {{"complete",0}, {"features",0}, {"keypoints",0}, {"normals",0}, {"flann",0}, {"voting",0}, {"maxima",0}, {"tiling",0}};
+    std::vector<VotingMaximum> maxima;
+    boost::timer::cpu_timer timer;
+
+    // the normals are checked once for all tiles
+    if (hasNormals)
+    {
+        for (const PointNormalT &point : points->points)
+        {
+            if (!pcl::isFinite(point))
+                continue;
+            if (point.normal_x == 0 && point.normal_y == 0 && point.normal_z == 0 ||
+                    pcl_isnan(point.normal_x) || pcl_isnan(point.curvature))
+                hasNormals = false;
+            break;
+        }
+    }
+
+    // keypoints within the object radius of the tile vote for objects centered in it, their descriptors and
+    // normals need the points around them
+    std::vector<std::shared_ptr<DetectionSession> > sessions;
+    for (int i = 0; i < m_num_workers; i++)
+        sessions.push_back(m_model.createSession());
+    const float overlap = sessions[0]->m_voting->getMaxObjectRadius();
+    const float support = m_model.m_featureDescriptor->getSupportRadius() + m_model.m_normalRadius;
+
+    boost::timer::cpu_timer timer_tiling;
+    const std::vector<Tile> tiles = createTiles(*points, overlap + support);
+    times["tiling"] = m_model.getElapsedTime(timer_tiling, "milliseconds");
+    m_num_tiles = (int)tiles.size();
+    LOG_INFO("detecting in " << tiles.size() << " tiles of size " << m_tile_size << " with overlap " << overlap);
+
+    const int numThreads = m_model.m_numThreads > 0 ? m_model.m_numThreads : omp_get_max_threads();
+    const int numWorkers = std::min(m_num_workers, std::max((int)tiles.size(), 1));
+    const int workerThreads = std::max(1, numThreads / numWorkers);
+
+    std::vector<std::vector<VotingMaximum> > tileMaxima(tiles.size());
+    std::vector<std::map<std::string, double> > tileTimes(tiles.size());
+    std::atomic<int> nextTile(0);
+    std::exception_ptr error;
+    std::mutex mutex;
+    auto work = [&](int worker)
+    {
+        try
+        {
+            DetectionSession &session = *sessions[worker];
+            session.setNumThreads(workerThreads);
+            session.m_voting->setNormalizeWeights(false);
+
+            for (int t = nextTile++; t < (int)tiles.size(); t = nextTile++)
+            {
+                const Tile &tile = tiles[t];
+                pcl::PointCloud<PointNormalT>::Ptr tilePoints(new pcl::PointCloud<PointNormalT>());
+                pcl::copyPointCloud(*points, tile.indices, *tilePoints);
+
+                Utils::BoundingBox region;
+                region.position = tile.min + Eigen::Vector3f::Constant(0.5f * m_tile_size);
+                region.size = Eigen::Vector3f::Constant(m_tile_size + 2 * overlap);
+                session.setRegionsOfInterest(std::vector<Utils::BoundingBox>(1, region));
+
+                // each maximum is kept by the tile it lies in
+                Utils::BoundingBox core = region;
+                core.size = Eigen::Vector3f::Constant(m_tile_size);
+                const RegionOfInterest inside(std::vector<Utils::BoundingBox>(1, core));
+                for (const VotingMaximum &maximum : session.detectPoints(tilePoints, hasNormals, false, tileTimes[t]))
+                {
+                    if (inside.contains(maximum.position))
+                        tileMaxima[t].push_back(maximum);
+                }
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+                error = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < numWorkers; i++)
+        workers.push_back(std::thread(work, i));
+    work(0);
+    for (std::thread &worker : workers)
+        worker.join();
+    if (error)
+        std::rethrow_exception(error);
+
+    for (int t = 0; t < (int)tiles.size(); t++)
+    {
+        maxima.insert(maxima.end(), tileMaxima[t].begin(), tileMaxima[t].end());
+        for (const auto &time : tileTimes[t])
+        {
+            if (time.first != "complete")
+                times[time.first] += time.second;
+        }
+    }
+
+    // maxima at both sides of a tile border are merged like the maxima of a single detection
+    boost::timer::cpu_timer timer_maxima;
+    maxima = sessions[0]->m_voting->mergePartialMaxima(maxima);
+    times["maxima"] += m_model.getElapsedTime(timer_maxima, "milliseconds");
+
+    times["complete"] = m_model.getElapsedTime(timer, "milliseconds");
+    return std::make_tuple(maxima, times);
+}
+
+}
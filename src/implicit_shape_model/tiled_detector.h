@@ -0,0 +1,80 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_TILED_DETECTOR_H
+#define ISM3D_TILED_DETECTOR_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "implicit_shape_model.h"
+#include "detection_session.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The TiledDetector class
+     * Detects objects in large scenes tile by tile. The bounding box of the scene is divided into cubic tiles of
+     * DetectionTileSize, each tile is detected as a region of interest enlarged by the largest object radius of the
+     * model, so that the keypoints voting for objects centered in the tile are part of its detection. Only the
+     * points of the enlarged tile and the support of its descriptors are copied for a tile, the maxima of a tile
+     * are kept if they lie inside the tile. The maxima of all tiles are filtered as configured in the voting
+     * (MaxFilterType), which merges maxima found at both sides of a tile border, and their weights are normalized
+     * over the scene. DetectionTileWorkers tiles are detected concurrently, each on a share of the threads; a
+     * single worker keeps the memory of one tile at a time. Created by ImplicitShapeModel for detections with
+     * tiling, the model must not be changed while the detector is used.
+     */
+    class TiledDetector
+    {
+    public:
+        ~TiledDetector();
+
+        /**
+         * @brief Detect unknown object instances tile by tile.
+         * @param pointCloud the point cloud in which objects should be detected
+         * @param hasNormals specify whether the input point cloud contains normal information
+         * @return a tuple with the maxima of the scene, time measurements of this detection: the stages of the
+         * tiles are summed up, "complete" is the duration of the whole detection and "tiling" the partitioning of
+         * the points
+         */
+        std::tuple<std::vector<VotingMaximum>, std::map<std::string, double> > detect(pcl::PointCloud<PointNormalT>::ConstPtr pointCloud, bool hasNormals);
+
+        /**
+         * @brief Get the number of tiles with points that were detected in the last detection.
+         * @return the number of tiles
+         */
+        int getNumTiles() const;
+
+    private:
+        friend class ImplicitShapeModel;
+
+        TiledDetector(ImplicitShapeModel &model, float tileSize, int numWorkers);
+
+        struct Tile
+        {
+            Eigen::Vector3f min;            // corner of the tile without the overlap
+            std::vector<int> indices;       // points of the tile with the overlap and the support of the descriptors
+            bool hasPoints;                 // true if a point lies inside the tile
+        };
+
+        // assigns the points to all tiles whose enlarged region contains them
+        std::vector<Tile> createTiles(const pcl::PointCloud<PointNormalT> &points, float margin) const;
+
+        ImplicitShapeModel &m_model;
+        float m_tile_size;
+        int m_num_workers;
+        int m_num_tiles;
+    };
+}
+
+#endif // ISM3D_TILED_DETECTOR_H
@@ -0,0 +1,168 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "activation_cache.h"
+#include "distance.h"
+
+#include <cmath>
+
+namespace ism3d
+{
+    namespace
+    {
+        // number of descriptor blocks that form the signature
+        const int NumSignatureBlocks = 8;
+
+        inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+        {
+            // splitmix64 finalizer on the combined value
+            uint64_t z = seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+    }
+
+    ActivationCache::ActivationCache()
+        : m_cell_size(0.01f), m_signature_step(0.1f), m_tolerance(0.0f), m_memory_budget(0),
+          m_num_codewords(-1), m_memory(0), m_hits(0), m_misses(0), m_evictions(0)
+    {
+    }
+
+    void ActivationCache::configure(float cell_size, float signature_step, float tolerance, size_t memory_budget)
+    {
+        if (cell_size != m_cell_size || signature_step != m_signature_step)
+            clear();
+
+        m_cell_size = cell_size > 0 ? cell_size : 0.01f;
+        m_signature_step = signature_step > 0 ? signature_step : 0.1f;
+        m_tolerance = tolerance;
+        m_memory_budget = memory_budget;
+        evict();
+    }
+
+    void ActivationCache::setNumCodewords(int num_codewords)
+    {
+        if (num_codewords != m_num_codewords)
+        {
+            clear();
+            m_num_codewords = num_codewords;
+        }
+    }
+
+    bool ActivationCache::lookup(const float *descriptor, int dim, float x, float y, float z, const Distance &distance,
+                                 std::vector<int> &codeword_indices, std::vector<float> &distances)
+    {
+        int cell[3];
+        computeCell(x, y, z, cell);
+        std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it =
+                m_lookup.find(computeKey(descriptor, dim, cell));
+
+        if (it != m_lookup.end())
+        {
+            const Entry &entry = *it->second;
+            if (entry.cell[0] == cell[0] && entry.cell[1] == cell[1] && entry.cell[2] == cell[2] &&
+                    (int)entry.descriptor.size() == dim &&
+                    distance(entry.descriptor.data(), descriptor, dim) <= m_tolerance)
+            {
+                codeword_indices = entry.codewordIndices;
+                distances = entry.distances;
+                m_entries.splice(m_entries.begin(), m_entries, it->second);
+                m_hits++;
+                return true;
+            }
+        }
+
+        m_misses++;
+        return false;
+    }
+
+    void ActivationCache::insert(const float *descriptor, int dim, float x, float y, float z,
+                                 const int *codeword_indices, const float *distances, int count)
+    {
+        Entry entry;
+        computeCell(x, y, z, entry.cell);
+        entry.key = computeKey(descriptor, dim, entry.cell);
+        entry.descriptor.assign(descriptor, descriptor + dim);
+        entry.codewordIndices.assign(codeword_indices, codeword_indices + count);
+        entry.distances.assign(distances, distances + count);
+        entry.bytes = sizeof(Entry) + dim * sizeof(float) + count * (sizeof(int) + sizeof(float)) +
+                sizeof(std::pair<uint64_t, std::list<Entry>::iterator>);
+
+        if (entry.bytes > m_memory_budget)
+            return;
+
+        // the newer activation replaces the old one
+        std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it = m_lookup.find(entry.key);
+        if (it != m_lookup.end())
+        {
+            m_memory -= it->second->bytes;
+            m_entries.erase(it->second);
+            m_lookup.erase(it);
+        }
+
+        m_memory += entry.bytes;
+        m_entries.push_front(entry);
+        m_lookup[entry.key] = m_entries.begin();
+        evict();
+    }
+
+    void ActivationCache::clear()
+    {
+        m_entries.clear();
+        m_lookup.clear();
+        m_memory = 0;
+    }
+
+    void ActivationCache::resetCounters()
+    {
+        m_hits = 0;
+        m_misses = 0;
+        m_evictions = 0;
+    }
+
+    void ActivationCache::evict()
+    {
+        while (m_memory > m_memory_budget && !m_entries.empty())
+        {
+            const Entry &entry = m_entries.back();
+            m_memory -= entry.bytes;
+            m_lookup.erase(entry.key);
+            m_entries.pop_back();
+            m_evictions++;
+        }
+    }
+
+    void ActivationCache::computeCell(float x, float y, float z, int *cell) const
+    {
+        cell[0] = (int)std::floor(x / m_cell_size);
+        cell[1] = (int)std::floor(y / m_cell_size);
+        cell[2] = (int)std::floor(z / m_cell_size);
+    }
+
+    uint64_t ActivationCache::computeKey(const float *descriptor, int dim, const int *cell) const
+    {
+        uint64_t key = hashCombine(0, (uint64_t)(uint32_t)cell[0]);
+        key = hashCombine(key, (uint64_t)(uint32_t)cell[1]);
+        key = hashCombine(key, (uint64_t)(uint32_t)cell[2]);
+
+        // coarse signature: quantized sums over contiguous blocks of the descriptor
+        const int blockSize = (dim + NumSignatureBlocks - 1) / NumSignatureBlocks;
+        for (int start = 0; start < dim; start += blockSize)
+        {
+            float sum = 0;
+            const int end = start + blockSize < dim ? start + blockSize : dim;
+            for (int i = start; i < end; i++)
+                sum += descriptor[i];
+            key = hashCombine(key, (uint64_t)(int64_t)std::floor(sum / m_signature_step));
+        }
+        return key;
+    }
+}
@@ -0,0 +1,146 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_ACTIVATION_CACHE_H
+#define ISM3D_ACTIVATION_CACHE_H
+
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+namespace ism3d
+{
+    class Distance;
+
+    /**
+     * @brief The ActivationCache class
+     * Caches the codeword activations of features across consecutive detections on the same sensor. An entry is
+     * keyed on the quantized keypoint position and a coarse signature of the descriptor (quantized sums over
+     * blocks of the descriptor). A lookup is a hit if the stored descriptor with the same key is within the
+     * tolerance of the query descriptor, the stored activation (codeword indices and distances) is then reused
+     * instead of searching the index. The memory used by the entries is bounded, the least recently used
+     * entries are evicted first.
+     */
+    class ActivationCache
+    {
+    public:
+        ActivationCache();
+
+        /**
+         * @brief Set the cache parameters. Entries are removed if the key quantization changes.
+         * @param cell_size edge length of the position cells
+         * @param signature_step quantization step of the descriptor block sums
+         * @param tolerance maximum distance between query and stored descriptor for a hit
+         * @param memory_budget maximum number of bytes used by the entries
+         */
+        void configure(float cell_size, float signature_step, float tolerance, size_t memory_budget);
+
+        /**
+         * @brief Cached codeword indices refer to the codeword list of a codebook, the cache is cleared if the
+         * number of codewords changes.
+         * @param num_codewords the number of codewords
+         */
+        void setNumCodewords(int num_codewords);
+
+        /**
+         * @brief Look up the activation of a feature and mark a hit entry as most recently used.
+         * @param descriptor the descriptor of the feature
+         * @param dim the descriptor length
+         * @param x, y, z the keypoint position
+         * @param distance the distance used to compare descriptors
+         * @param codeword_indices output: the activated codeword indices on a hit
+         * @param distances output: the corresponding distances on a hit
+         * @return true on a hit
+         */
+        bool lookup(const float *descriptor, int dim, float x, float y, float z, const Distance &distance,
+                    std::vector<int> &codeword_indices, std::vector<float> &distances);
+
+        /**
+         * @brief Store the activation of a feature, an existing entry with the same key is replaced.
+         * @param descriptor the descriptor of the feature
+         * @param dim the descriptor length
+         * @param x, y, z the keypoint position
+         * @param codeword_indices the activated codeword indices
+         * @param distances the corresponding distances
+         * @param count the number of activated codewords
+         */
+        void insert(const float *descriptor, int dim, float x, float y, float z,
+                    const int *codeword_indices, const float *distances, int count);
+
+        // removes all entries, the counters are kept
+        void clear();
+
+        void resetCounters();
+
+        long getHits() const
+        {
+            return m_hits;
+        }
+
+        long getMisses() const
+        {
+            return m_misses;
+        }
+
+        long getEvictions() const
+        {
+            return m_evictions;
+        }
+
+        double getHitRate() const
+        {
+            return m_hits + m_misses > 0 ? (double)m_hits / (m_hits + m_misses) : 0.0;
+        }
+
+        size_t getMemoryUsage() const
+        {
+            return m_memory;
+        }
+
+        int getNumEntries() const
+        {
+            return (int)m_entries.size();
+        }
+
+    private:
+        struct Entry
+        {
+            uint64_t key;
+            int cell[3];
+            std::vector<float> descriptor;
+            std::vector<int> codewordIndices;
+            std::vector<float> distances;
+            size_t bytes;
+        };
+
+        uint64_t computeKey(const float *descriptor, int dim, const int *cell) const;
+        void computeCell(float x, float y, float z, int *cell) const;
+        void evict();
+
+        float m_cell_size;
+        float m_signature_step;
+        float m_tolerance;
+        size_t m_memory_budget;
+        int m_num_codewords;
+
+        // most recently used entries first
+        std::list<Entry> m_entries;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> m_lookup;
+        size_t m_memory;
+
+        long m_hits;
+        long m_misses;
+        long m_evictions;
+    };
+}
+
+#endif // ISM3D_ACTIVATION_CACHE_H
@@ -0,0 +1,56 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "binary_codes.h"
+
+namespace ism3d
+{
+    BinaryCodes::BinaryCodes()
+        : m_num_codes(0), m_num_bits(0), m_num_words(0)
+    {
+    }
+
+    void BinaryCodes::assign(const flann::Matrix<float> &data)
+    {
+        m_num_codes = (int)data.rows;
+        m_num_bits = (int)data.cols;
+        m_num_words = getNumWords(m_num_bits);
+        m_codes.assign((size_t)m_num_codes * m_num_words, 0);
+
+        for (int i = 0; i < m_num_codes; i++)
+            pack(data[i], m_num_bits, &m_codes[(size_t)i * m_num_words]);
+    }
+
+    void BinaryCodes::pack(const float *descriptor, int numBits, uint64_t *code)
+    {
+        const int numWords = getNumWords(numBits);
+        for (int w = 0; w < numWords; w++)
+            code[w] = 0;
+
+        for (int i = 0; i < numBits; i++)
+        {
+            if (descriptor[i] > 0.5f)
+                code[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+
+    uint32_t BinaryCodes::getSubstring(const uint64_t *code, int start, int length)
+    {
+        const int word = start / 64;
+        const int offset = start % 64;
+
+        uint64_t bits = code[word] >> offset;
+        if (offset + length > 64)
+            bits |= code[word + 1] << (64 - offset);
+
+        const uint64_t mask = length >= 64 ? ~(uint64_t)0 : (((uint64_t)1 << length) - 1);
+        return (uint32_t)(bits & mask);
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_BINARY_CODES_H
+#define ISM3D_BINARY_CODES_H
+
+#include <vector>
+#include <cstdint>
+#include <flann/flann.hpp>
+
+namespace ism3d
+{
+    /**
+     * @brief The BinaryCodes class
+     * Bit-packed storage for binary descriptors like B-SHOT, which are passed around as floats with values 0
+     * and 1. Each descriptor is packed into 64 bit words, values above 0.5 are set bits. Hamming distances are
+     * computed with popcount on whole words, e.g. a 352 dimensional B-SHOT descriptor needs 6 words (48 bytes)
+     * instead of 1408 bytes.
+     */
+    class BinaryCodes
+    {
+    public:
+        BinaryCodes();
+
+        /**
+         * @brief Pack all rows of a descriptor matrix.
+         * @param data the descriptors, one per row
+         */
+        void assign(const flann::Matrix<float> &data);
+
+        /**
+         * @brief Pack a single descriptor.
+         * @param descriptor the descriptor values
+         * @param numBits the descriptor size
+         * @param code output: must hold getNumWords(numBits) words
+         */
+        static void pack(const float *descriptor, int numBits, uint64_t *code);
+
+        static int getNumWords(int numBits)
+        {
+            return (numBits + 63) / 64;
+        }
+
+        static int hammingDistance(const uint64_t *code1, const uint64_t *code2, int numWords)
+        {
+            int distance = 0;
+            for (int i = 0; i < numWords; i++)
+                distance += __builtin_popcountll(code1[i] ^ code2[i]);
+            return distance;
+        }
+
+        /**
+         * @brief Extract consecutive bits of a code.
+         * @param code the code
+         * @param start the first bit
+         * @param length the number of bits, at most 32
+         * @return the bits, the first bit is the least significant one
+         */
+        static uint32_t getSubstring(const uint64_t *code, int start, int length);
+
+        int size() const
+        {
+            return m_num_codes;
+        }
+
+        int getNumBits() const
+        {
+            return m_num_bits;
+        }
+
+        int getNumWords() const
+        {
+            return m_num_words;
+        }
+
+        const uint64_t* getCode(int index) const
+        {
+            return &m_codes[(size_t)index * m_num_words];
+        }
+
+    private:
+        int m_num_codes;
+        int m_num_bits;
+        int m_num_words;
+        std::vector<uint64_t> m_codes;
+    };
+}
+
+#endif // ISM3D_BINARY_CODES_H
@@ -0,0 +1,164 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "block_compression.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <omp.h>
+
+#include "../third_party/liblzf-3.6/lzf.h"
+
+namespace ism3d
+{
+    namespace
+    {
+        const char Magic[8] = {'I', 'S', 'M', '3', 'D', 'L', 'Z', 'F'};
+        const uint32_t Version = 1;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t blockSize;
+            uint64_t size;
+            uint64_t numBlocks;
+        };
+    }
+
+    const std::size_t BlockCompression::DefaultBlockSize;
+
+    bool BlockCompression::write(const std::string &filename, const std::string &data, std::size_t blockSize)
+    {
+        const std::size_t numBlocks = (data.size() + blockSize - 1) / blockSize;
+
+        // the compressed size of each block, equal to the block size if the block is stored as is
+        std::vector<std::vector<char> > blocks(numBlocks);
+        std::vector<uint64_t> sizes(numBlocks);
+#pragma omp parallel for schedule(dynamic)
+        for (std::size_t i = 0; i < numBlocks; i++)
+        {
+            const char *block = data.data() + i * blockSize;
+            const std::size_t size = std::min(blockSize, data.size() - i * blockSize);
+
+            // lzf_compress returns 0 if the block does not fit into the output
+            blocks[i].resize(size);
+            unsigned compressed = lzf_compress(block, size, blocks[i].data(), size - 1);
+            if (compressed == 0)
+            {
+                std::memcpy(blocks[i].data(), block, size);
+                compressed = size;
+            }
+            blocks[i].resize(compressed);
+            sizes[i] = compressed;
+        }
+
+        Header header;
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.blockSize = blockSize;
+        header.size = data.size();
+        header.numBlocks = numBlocks;
+
+        std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+        file.write((const char*)&header, sizeof(header));
+        file.write((const char*)sizes.data(), sizes.size() * sizeof(uint64_t));
+        for (const std::vector<char> &block : blocks)
+            file.write(block.data(), block.size());
+        file.close();
+        if (!file)
+        {
+            LOG_ERROR("could not write compressed file " << filename);
+            return false;
+        }
+        return true;
+    }
+
+    bool BlockCompression::read(const std::string &filename, std::vector<char> &data)
+    {
+        std::ifstream file(filename.c_str(), std::ios::binary | std::ios::ate);
+        const std::streamoff fileSize = file.tellg();
+        file.seekg(0);
+
+        Header header;
+        if (!file.read((char*)&header, sizeof(header)) || std::memcmp(header.magic, Magic, sizeof(Magic)) != 0)
+        {
+            LOG_ERROR("not a compressed file: " << filename);
+            return false;
+        }
+        if (header.version != Version)
+        {
+            LOG_ERROR("compressed file " << filename << " has version " << header.version << ", expected " << Version);
+            return false;
+        }
+        if (header.blockSize == 0 || header.numBlocks != (header.size + header.blockSize - 1) / header.blockSize ||
+                header.numBlocks > (uint64_t)(fileSize - sizeof(header)) / sizeof(uint64_t))
+        {
+            LOG_ERROR("corrupt compressed file " << filename);
+            return false;
+        }
+
+        // the offsets of the blocks in the compressed data
+        std::vector<uint64_t> sizes(header.numBlocks);
+        file.read((char*)sizes.data(), sizes.size() * sizeof(uint64_t));
+        std::vector<uint64_t> offsets(header.numBlocks + 1, 0);
+        for (std::size_t i = 0; i < sizes.size(); i++)
+        {
+            if (sizes[i] > header.blockSize)
+            {
+                LOG_ERROR("corrupt compressed file " << filename);
+                return false;
+            }
+            offsets[i + 1] = offsets[i] + sizes[i];
+        }
+
+        std::vector<char> compressed(offsets.back());
+        if (!file.read(compressed.data(), compressed.size()))
+        {
+            LOG_ERROR("compressed file is truncated: " << filename);
+            return false;
+        }
+
+        data.resize(header.size);
+        bool valid = true;
+#pragma omp parallel for schedule(dynamic)
+        for (std::size_t i = 0; i < sizes.size(); i++)
+        {
+            char *block = data.data() + i * header.blockSize;
+            const std::size_t size = std::min((std::size_t)header.blockSize, (std::size_t)header.size - i * header.blockSize);
+            if (sizes[i] == size)
+            {
+                std::memcpy(block, compressed.data() + offsets[i], size);
+            }
+            else if (lzf_decompress(compressed.data() + offsets[i], sizes[i], block, size) != size)
+            {
+#pragma omp critical
+                valid = false;
+            }
+        }
+
+        if (!valid)
+        {
+            LOG_ERROR("could not decompress file " << filename);
+            return false;
+        }
+        return true;
+    }
+
+    bool BlockCompression::isCompressed(const std::string &filename)
+    {
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        Header header;
+        return file.read((char*)&header, sizeof(header)) && std::memcmp(header.magic, Magic, sizeof(Magic)) == 0;
+    }
+}
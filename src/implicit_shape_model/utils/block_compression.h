@@ -0,0 +1,69 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_BLOCK_COMPRESSION_H
+#define ISM3D_BLOCK_COMPRESSION_H
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The BlockCompression class
+     * Stores data as a file of independently LZF compressed blocks. The header is followed by the compressed size of
+     * each block and the blocks, so that all blocks can be located before decompressing any of them. Blocks are
+     * compressed and decompressed in parallel, a block that does not shrink is stored as is.
+     */
+    class BlockCompression
+    {
+    public:
+        static const std::size_t DefaultBlockSize = 1 << 20;
+
+        /**
+         * @brief Compress data into a file.
+         * @param filename the file
+         * @param data the data
+         * @param blockSize the uncompressed size of a block
+         * @return false if writing failed
+         */
+        static bool write(const std::string &filename, const std::string &data, std::size_t blockSize = DefaultBlockSize);
+
+        /**
+         * @brief Decompress a file.
+         * @param filename the file
+         * @param data the decompressed data
+         * @return false if the file could not be read or is corrupt
+         */
+        static bool read(const std::string &filename, std::vector<char> &data);
+
+        /**
+         * @brief Check whether a file starts with the header of a block compressed file.
+         */
+        static bool isCompressed(const std::string &filename);
+    };
+
+    /**
+     * @brief The MemoryStreamBuffer class
+     * A read only stream buffer over existing memory, to read an archive from decompressed data without a copy.
+     */
+    class MemoryStreamBuffer : public std::streambuf
+    {
+    public:
+        MemoryStreamBuffer(char *data, std::size_t size)
+        {
+            setg(data, data, data + size);
+        }
+    };
+}
+
+#endif // ISM3D_BLOCK_COMPRESSION_H
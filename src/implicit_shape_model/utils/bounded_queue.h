@@ -0,0 +1,90 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_BOUNDED_QUEUE_H
+#define ISM3D_BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+namespace ism3d
+{
+    /**
+     * @brief The BoundedQueue class
+     * Passes items between the threads of a pipeline in order. A producer waits while the queue holds the maximum
+     * number of items, a consumer waits while it is empty. Closing the queue wakes up all waiting threads, the
+     * remaining items can still be taken, further items are dropped.
+     */
+    template<typename T>
+    class BoundedQueue
+    {
+    public:
+        explicit BoundedQueue(int capacity)
+            : m_capacity(capacity > 0 ? capacity : 1), m_closed(false)
+        {
+        }
+
+        /**
+         * @brief Append an item, waits while the queue is full.
+         * @param item the item
+         * @return false if the queue was closed, the item is dropped then
+         */
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_full.wait(lock, [this]() { return m_closed || (int)m_items.size() < m_capacity; });
+            if (m_closed)
+                return false;
+
+            m_items.push_back(std::move(item));
+            m_not_empty.notify_one();
+            return true;
+        }
+
+        /**
+         * @brief Take the first item, waits while the queue is empty and open.
+         * @param item return parameter: the item
+         * @return false if the queue is closed and empty
+         */
+        bool pop(T &item)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_not_empty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+            if (m_items.empty())
+                return false;
+
+            item = std::move(m_items.front());
+            m_items.pop_front();
+            m_not_full.notify_one();
+            return true;
+        }
+
+        // no items can be added anymore, e.g. after the last item or after an error
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+            m_not_full.notify_all();
+            m_not_empty.notify_all();
+        }
+
+    private:
+        int m_capacity;
+        bool m_closed;
+        std::deque<T> m_items;
+        std::mutex m_mutex;
+        std::condition_variable m_not_full;
+        std::condition_variable m_not_empty;
+    };
+}
+
+#endif // ISM3D_BOUNDED_QUEUE_H
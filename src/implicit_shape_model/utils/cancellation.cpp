@@ -0,0 +1,58 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "cancellation.h"
+
+namespace ism3d
+{
+    namespace
+    {
+        thread_local CancellationToken currentToken;
+    }
+
+    CancellationToken::CancellationToken()
+    {
+    }
+
+    CancellationToken CancellationToken::create()
+    {
+        CancellationToken token;
+        token.m_cancelled = std::make_shared<std::atomic<bool> >(false);
+        return token;
+    }
+
+    void CancellationToken::cancel() const
+    {
+        if (m_cancelled)
+            m_cancelled->store(true, std::memory_order_relaxed);
+    }
+
+    const CancellationToken& CancellationToken::current()
+    {
+        return currentToken;
+    }
+
+    void CancellationToken::check()
+    {
+        if (currentToken.isCancelled())
+            throw CancelledException("the detection was cancelled");
+    }
+
+    CancellationToken::Scope::Scope(const CancellationToken &token)
+        : m_previous(currentToken)
+    {
+        currentToken = token;
+    }
+
+    CancellationToken::Scope::~Scope()
+    {
+        currentToken = m_previous;
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CANCELLATION_H
+#define ISM3D_CANCELLATION_H
+
+#include <atomic>
+#include <memory>
+
+#include "exception.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The CancellationToken class
+     * A flag shared by the copies of a token that requests a running detection to stop. The detection checks the
+     * token of its calling thread, set with a Scope, at its stage boundaries and throws a CancelledException there.
+     * Inside of the long parallel loops (activation chunks, mean shift seeds, maxima) the remaining iterations are
+     * skipped, so that a cancelled detection releases its threads quickly. The token of a parallel region has to be
+     * taken with current() before the region, OpenMP worker threads have no scope of their own.
+     */
+    class CancellationToken
+    {
+    public:
+        /**
+         * @brief Create a token that is never cancelled, see create().
+         */
+        CancellationToken();
+
+        // create a token that can be cancelled
+        static CancellationToken create();
+
+        // request the detections using this token to stop, can be called from any thread
+        void cancel() const;
+
+        bool isCancelled() const
+        {
+            return m_cancelled && m_cancelled->load(std::memory_order_relaxed);
+        }
+
+        // false for tokens that are never cancelled
+        bool isCancellable() const
+        {
+            return m_cancelled.get() != 0;
+        }
+
+        /**
+         * @brief Get the token of the calling thread.
+         * @return the token of the innermost scope, a token that is never cancelled outside of all scopes
+         */
+        static const CancellationToken& current();
+
+        /**
+         * @brief Throw a CancelledException if the token of the calling thread was cancelled.
+         */
+        static void check();
+
+        class Scope;
+
+    private:
+        std::shared_ptr<std::atomic<bool> > m_cancelled; // null if the token is never cancelled
+    };
+
+    /**
+     * @brief The CancellationToken::Scope class
+     * Sets the token of the calling thread until it is destroyed, the previous token is restored on destruction.
+     * Defined after CancellationToken, it holds a token by value and needs the complete type.
+     */
+    class CancellationToken::Scope
+    {
+    public:
+        explicit Scope(const CancellationToken &token);
+        ~Scope();
+
+    private:
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        CancellationToken m_previous;
+    };
+}
+
+#endif // ISM3D_CANCELLATION_H
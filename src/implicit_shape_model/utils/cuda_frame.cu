@@ -0,0 +1,108 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "cuda_frame.h"
+#include "exception.h"
+
+#include <memory>
+#include <string>
+
+namespace ism3d
+{
+    namespace
+    {
+        void checkCuda(cudaError_t error, const char *what)
+        {
+            if (error != cudaSuccess)
+                throw RuntimeException(std::string("CUDA error in ") + what + ": " + cudaGetErrorString(error));
+        }
+    }
+
+    CudaFrame::CudaFrame()
+        : m_stream(0), m_handle(0), m_device(NumBuffers, 0), m_device_bytes(NumBuffers, 0),
+          m_host(NumBuffers, 0), m_host_bytes(NumBuffers, 0)
+    {
+        // the stream does not synchronize with the default stream, other frames are not blocked
+        checkCuda(cudaStreamCreateWithFlags(&m_stream, cudaStreamNonBlocking), "cudaStreamCreate");
+    }
+
+    CudaFrame::~CudaFrame()
+    {
+        // the frames of threads that end with the process may outlive the CUDA context, errors are ignored
+        cudaStreamSynchronize(m_stream);
+        for (int i = 0; i < NumBuffers; i++)
+        {
+            cudaFree(m_device[i]);
+            cudaFreeHost(m_host[i]);
+        }
+        if (m_handle)
+            cublasDestroy(m_handle);
+        cudaStreamDestroy(m_stream);
+    }
+
+    CudaFrame& CudaFrame::get()
+    {
+        static thread_local std::unique_ptr<CudaFrame> frame;
+        if (!frame)
+            frame.reset(new CudaFrame());
+        return *frame;
+    }
+
+    cublasHandle_t CudaFrame::getBlasHandle()
+    {
+        if (!m_handle)
+        {
+            if (cublasCreate(&m_handle) != CUBLAS_STATUS_SUCCESS)
+                throw RuntimeException("cuBLAS error in cublasCreate");
+            cublasSetStream(m_handle, m_stream);
+        }
+        return m_handle;
+    }
+
+    void* CudaFrame::deviceBytes(Buffer buffer, std::size_t bytes)
+    {
+        if (bytes > m_device_bytes[buffer])
+        {
+            // work on the stream may still use the old buffer
+            synchronize();
+            cudaFree(m_device[buffer]);
+            m_device[buffer] = 0;
+            m_device_bytes[buffer] = 0;
+            checkCuda(cudaMalloc(&m_device[buffer], bytes), "cudaMalloc");
+            m_device_bytes[buffer] = bytes;
+        }
+        return m_device[buffer];
+    }
+
+    void* CudaFrame::hostBytes(Buffer buffer, std::size_t bytes)
+    {
+        if (bytes > m_host_bytes[buffer])
+        {
+            synchronize();
+            cudaFreeHost(m_host[buffer]);
+            m_host[buffer] = 0;
+            m_host_bytes[buffer] = 0;
+            checkCuda(cudaMallocHost(&m_host[buffer], bytes), "cudaMallocHost");
+            m_host_bytes[buffer] = bytes;
+        }
+        return m_host[buffer];
+    }
+
+    void CudaFrame::copyAsync(void *target, const void *source, std::size_t bytes, cudaMemcpyKind kind)
+    {
+        if (bytes > 0)
+            checkCuda(cudaMemcpyAsync(target, source, bytes, kind, m_stream), "cudaMemcpyAsync");
+    }
+
+    void CudaFrame::synchronize()
+    {
+        checkCuda(cudaStreamSynchronize(m_stream), "cudaStreamSynchronize");
+    }
+}
@@ -0,0 +1,123 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CUDA_FRAME_H
+#define ISM3D_CUDA_FRAME_H
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <cuda_runtime.h>
+#include <cublas_v2.h>
+
+namespace ism3d
+{
+    /**
+     * @brief The CudaFrame class
+     * The device resources of the frame a thread is working on: a CUDA stream, a cuBLAS handle bound to it,
+     * device buffers and pinned staging buffers. Transfers are copied through the pinned buffers and issued
+     * asynchronously on the stream, kernels are launched on the same stream. Each thread has its own frame, so
+     * that the frames of the detection pipeline and of concurrent sessions are in flight on the device at the
+     * same time instead of being serialized on the default stream. The buffers only grow and are kept for the
+     * next frame of the thread.
+     * This header depends on CUDA, it is only included by the CUDA implementations.
+     */
+    class CudaFrame
+    {
+    public:
+        // the buffers of the frame, each with a device and a pinned host part
+        enum Buffer
+        {
+            Queries,
+            QueryNorms,
+            Distances,
+            Indices,
+            ResultDistances,
+            Keypoints,
+            KeypointLabs,
+            Frames,
+            Offsets,
+            Neighbors,
+            SqrDistances,
+            Descriptors,
+            NumBuffers
+        };
+
+        ~CudaFrame();
+
+        // the frame of the calling thread, created on first use
+        static CudaFrame& get();
+
+        cudaStream_t getStream() const
+        {
+            return m_stream;
+        }
+
+        // created on first use, all its operations are issued on the stream of the frame
+        cublasHandle_t getBlasHandle();
+
+        // a device buffer of at least size elements, growing it discards its content
+        template<typename T>
+        T* device(Buffer buffer, std::size_t size)
+        {
+            return static_cast<T*>(deviceBytes(buffer, size * sizeof(T)));
+        }
+
+        /**
+         * @brief Copy data to the device buffer through the pinned buffer, the copy is asynchronous. The pinned
+         * buffer must not be used again before the frame is synchronized.
+         * @return the device buffer
+         */
+        template<typename T>
+        T* upload(Buffer buffer, const T *data, std::size_t size)
+        {
+            T *staging = static_cast<T*>(hostBytes(buffer, size * sizeof(T)));
+            if (size > 0)
+                std::memcpy(staging, data, size * sizeof(T));
+            T *target = device<T>(buffer, size);
+            copyAsync(target, staging, size * sizeof(T), cudaMemcpyHostToDevice);
+            return target;
+        }
+
+        /**
+         * @brief Copy size elements of device memory to the pinned buffer, the copy is asynchronous.
+         * @return the pinned buffer, valid after synchronize()
+         */
+        template<typename T>
+        const T* download(Buffer buffer, const T *data, std::size_t size)
+        {
+            T *staging = static_cast<T*>(hostBytes(buffer, size * sizeof(T)));
+            copyAsync(staging, data, size * sizeof(T), cudaMemcpyDeviceToHost);
+            return staging;
+        }
+
+        // wait for all work issued on the stream of the frame
+        void synchronize();
+
+    private:
+        CudaFrame();
+        CudaFrame(const CudaFrame&);
+        CudaFrame& operator=(const CudaFrame&);
+
+        void* deviceBytes(Buffer buffer, std::size_t bytes);
+        void* hostBytes(Buffer buffer, std::size_t bytes);
+        void copyAsync(void *target, const void *source, std::size_t bytes, cudaMemcpyKind kind);
+
+        cudaStream_t m_stream;
+        cublasHandle_t m_handle;
+        std::vector<void*> m_device;
+        std::vector<std::size_t> m_device_bytes;
+        std::vector<void*> m_host;
+        std::vector<std::size_t> m_host_bytes;
+    };
+}
+
+#endif // ISM3D_CUDA_FRAME_H
@@ -0,0 +1,333 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "cuda_hough.h"
+#include "exception.h"
+
+#include <cuda_runtime.h>
+#include <thrust/binary_search.h>
+#include <thrust/copy.h>
+#include <thrust/device_vector.h>
+#include <thrust/functional.h>
+#include <thrust/iterator/zip_iterator.h>
+#include <thrust/reduce.h>
+#include <thrust/remove.h>
+#include <thrust/sort.h>
+#include <thrust/system_error.h>
+#include <cfloat>
+#include <string>
+
+namespace ism3d
+{
+    namespace
+    {
+        const int BlockThreads = 256;
+
+        void checkCuda(cudaError_t error, const char *what)
+        {
+            if (error != cudaSuccess)
+                throw RuntimeException(std::string("CUDA error in ") + what + ": " + cudaGetErrorString(error));
+        }
+
+        struct Layout
+        {
+            double minCoord[3];
+            double binSize[3];
+            int binCount[3];
+            long long partialProducts[3];
+        };
+
+        // each vote writes 8 (bin, weight, voter) slots, unused slots get the bin -1
+        __global__ void voteKernel(const double *positions, const double *weights, int numVotes, Layout layout,
+                                   bool interpolation, long long *keys, double *values, int *voters)
+        {
+            const int vote = blockIdx.x * blockDim.x + threadIdx.x;
+            if (vote >= numVotes)
+                return;
+
+            long long *voteKeys = keys + 8 * (size_t)vote;
+            double *voteValues = values + 8 * (size_t)vote;
+            int *voteVoters = voters + 8 * (size_t)vote;
+            for (int n = 0; n < 8; n++)
+            {
+                voteKeys[n] = -1;
+                voteValues[n] = 0;
+                voteVoters[n] = vote;
+            }
+
+            // same computation as SparseHoughSpace3D::vote() and voteInt()
+            int central[3];
+            int direction[3];
+            double offset[3];
+            for (int i = 0; i < 3; i++)
+            {
+                const double pos = (positions[3 * vote + i] - layout.minCoord[i]) / layout.binSize[i];
+                central[i] = (int)floor(pos);
+                if (central[i] < 0 || central[i] >= layout.binCount[i])
+                    return;
+
+                const double rel = pos - central[i] - 0.5;
+                direction[i] = rel >= 0 ? 1 : -1;
+                offset[i] = fabs(rel);
+            }
+
+            const double weight = weights[vote];
+            if (!interpolation)
+            {
+                voteKeys[0] = layout.partialProducts[0] * central[0] + layout.partialProducts[1] * central[1] +
+                        layout.partialProducts[2] * central[2];
+                voteValues[0] = weight;
+                return;
+            }
+
+            for (int n = 0; n < 8; n++)
+            {
+                int coords[3] = {central[0], central[1], central[2]};
+                double binWeight = weight;
+                bool valid = true;
+                for (int i = 0; i < 3; i++)
+                {
+                    if ((n >> i) & 1)
+                    {
+                        coords[i] += direction[i];
+                        binWeight *= offset[i];
+                        if (coords[i] < 0 || coords[i] >= layout.binCount[i])
+                        {
+                            valid = false;
+                            break;
+                        }
+                    }
+                    else
+                        binWeight *= 1 - offset[i];
+                }
+
+                if (valid)
+                {
+                    voteKeys[n] = layout.partialProducts[0] * coords[0] + layout.partialProducts[1] * coords[1] +
+                            layout.partialProducts[2] * coords[2];
+                    voteValues[n] = binWeight;
+                }
+            }
+        }
+
+        __device__ int findBin(const long long *binKeys, int numBins, long long key)
+        {
+            int first = 0;
+            int count = numBins;
+            while (count > 0)
+            {
+                const int step = count / 2;
+                if (binKeys[first + step] < key)
+                {
+                    first += step + 1;
+                    count -= step + 1;
+                }
+                else
+                    count = step;
+            }
+            return first < numBins && binKeys[first] == key ? first : -1;
+        }
+
+        // a bin is a maximum if it reaches the threshold and none of its 26 neighbors has a larger value
+        __global__ void maximaKernel(const long long *binKeys, const double *binValues, int numBins, Layout layout,
+                                     double threshold, char *isMaximum)
+        {
+            const int bin = blockIdx.x * blockDim.x + threadIdx.x;
+            if (bin >= numBins)
+                return;
+
+            const double value = binValues[bin];
+            char maximum = value >= threshold ? 1 : 0;
+
+            const long long key = binKeys[bin];
+            const int coords[3] = {(int)(key % layout.binCount[0]),
+                                   (int)((key / layout.partialProducts[1]) % layout.binCount[1]),
+                                   (int)(key / layout.partialProducts[2])};
+
+            for (int n = 0; n < 27 && maximum; n++)
+            {
+                const int d[3] = {n % 3 - 1, (n / 3) % 3 - 1, n / 9 - 1};
+                if (d[0] == 0 && d[1] == 0 && d[2] == 0)
+                    continue;
+
+                bool inside = true;
+                long long neighborKey = 0;
+                for (int i = 0; i < 3; i++)
+                {
+                    const int c = coords[i] + d[i];
+                    inside = inside && c >= 0 && c < layout.binCount[i];
+                    neighborKey += layout.partialProducts[i] * c;
+                }
+                if (!inside)
+                    continue;
+
+                const int neighbor = findBin(binKeys, numBins, neighborKey);
+                if (neighbor >= 0 && binValues[neighbor] > value)
+                    maximum = 0;
+            }
+
+            isMaximum[bin] = maximum;
+        }
+
+        struct InvalidKey
+        {
+            __host__ __device__ bool operator()(const thrust::tuple<long long, double, int> &slot) const
+            {
+                return thrust::get<0>(slot) < 0;
+            }
+        };
+
+        struct IsMaximumPair
+        {
+            explicit IsMaximumPair(const char *isMaximum)
+                : isMaximum(isMaximum)
+            {
+            }
+
+            __host__ __device__ bool operator()(int bin) const
+            {
+                return isMaximum[bin] != 0;
+            }
+
+            const char *isMaximum;
+        };
+
+        int numBlocks(size_t num)
+        {
+            return (int)((num + BlockThreads - 1) / BlockThreads);
+        }
+    }
+
+    bool CudaHough::isAvailable()
+    {
+        int count = 0;
+        return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+    }
+
+    void CudaHough::findMaxima(const double *positions, const double *weights, int numVotes,
+                               const double *minCoord, const double *binSize, const int *binCount, bool interpolation,
+                               double minThreshold, std::vector<double> &maxima, std::vector<std::vector<int> > &voterIds)
+    {
+        maxima.clear();
+        voterIds.clear();
+        if (numVotes == 0)
+            return;
+
+        Layout layout;
+        for (int i = 0; i < 3; i++)
+        {
+            layout.minCoord[i] = minCoord[i];
+            layout.binSize[i] = binSize[i];
+            layout.binCount[i] = binCount[i];
+        }
+        layout.partialProducts[0] = 1;
+        layout.partialProducts[1] = binCount[0];
+        layout.partialProducts[2] = (long long)binCount[0] * binCount[1];
+
+        try
+        {
+            thrust::device_vector<double> devicePositions(positions, positions + 3 * (size_t)numVotes);
+            thrust::device_vector<double> deviceWeights(weights, weights + numVotes);
+
+            // all (bin, weight, voter) pairs in the order of voting
+            const size_t numSlots = 8 * (size_t)numVotes;
+            thrust::device_vector<long long> keys(numSlots);
+            thrust::device_vector<double> values(numSlots);
+            thrust::device_vector<int> voters(numSlots);
+            voteKernel<<<numBlocks(numVotes), BlockThreads>>>(
+                thrust::raw_pointer_cast(devicePositions.data()), thrust::raw_pointer_cast(deviceWeights.data()),
+                numVotes, layout, interpolation, thrust::raw_pointer_cast(keys.data()),
+                thrust::raw_pointer_cast(values.data()), thrust::raw_pointer_cast(voters.data()));
+            checkCuda(cudaGetLastError(), "voteKernel");
+
+            typedef thrust::zip_iterator<thrust::tuple<thrust::device_vector<long long>::iterator,
+                    thrust::device_vector<double>::iterator, thrust::device_vector<int>::iterator> > SlotIterator;
+            SlotIterator slotsBegin(thrust::make_tuple(keys.begin(), values.begin(), voters.begin()));
+            SlotIterator slotsEnd(thrust::make_tuple(keys.end(), values.end(), voters.end()));
+            const size_t numPairs = thrust::remove_if(slotsBegin, slotsEnd, InvalidKey()) - slotsBegin;
+            if (numPairs == 0)
+                return;
+            keys.resize(numPairs);
+            values.resize(numPairs);
+            voters.resize(numPairs);
+
+            // the stable sort keeps the voters of a bin in the order of voting
+            thrust::stable_sort_by_key(keys.begin(), keys.end(),
+                                       thrust::make_zip_iterator(thrust::make_tuple(values.begin(), voters.begin())));
+
+            thrust::device_vector<long long> binKeys(numPairs);
+            thrust::device_vector<double> binValues(numPairs);
+            const int numBins = (int)(thrust::reduce_by_key(keys.begin(), keys.end(), values.begin(),
+                                                            binKeys.begin(), binValues.begin()).first - binKeys.begin());
+            binKeys.resize(numBins);
+            binValues.resize(numBins);
+
+            // a negative threshold is relative to the global maximum
+            if (minThreshold < 0)
+            {
+                const double houghMaximum = thrust::reduce(binValues.begin(), binValues.end(), DBL_MIN,
+                                                           thrust::maximum<double>());
+                minThreshold = minThreshold >= -1 ? -minThreshold * houghMaximum : houghMaximum;
+            }
+
+            thrust::device_vector<char> isMaximum(numBins);
+            maximaKernel<<<numBlocks(numBins), BlockThreads>>>(
+                thrust::raw_pointer_cast(binKeys.data()), thrust::raw_pointer_cast(binValues.data()), numBins,
+                layout, minThreshold, thrust::raw_pointer_cast(isMaximum.data()));
+            checkCuda(cudaGetLastError(), "maximaKernel");
+
+            // the pairs of the maxima, still ordered by bin and then by voter
+            thrust::device_vector<int> pairBins(numPairs);
+            thrust::lower_bound(binKeys.begin(), binKeys.end(), keys.begin(), keys.end(), pairBins.begin());
+            thrust::device_vector<int> maximumPairBins(numPairs);
+            thrust::device_vector<int> maximumPairVoters(numPairs);
+            IsMaximumPair isMaximumPair(thrust::raw_pointer_cast(isMaximum.data()));
+            const size_t numMaximumPairs = thrust::copy_if(
+                        thrust::make_zip_iterator(thrust::make_tuple(pairBins.begin(), voters.begin())),
+                        thrust::make_zip_iterator(thrust::make_tuple(pairBins.end(), voters.end())),
+                        pairBins.begin(),
+                        thrust::make_zip_iterator(thrust::make_tuple(maximumPairBins.begin(), maximumPairVoters.begin())),
+                        isMaximumPair) - thrust::make_zip_iterator(thrust::make_tuple(maximumPairBins.begin(),
+                                                                                      maximumPairVoters.begin()));
+
+            std::vector<char> hostIsMaximum(numBins);
+            std::vector<double> hostBinValues(numBins);
+            std::vector<int> hostPairBins(numMaximumPairs);
+            std::vector<int> hostPairVoters(numMaximumPairs);
+            thrust::copy(isMaximum.begin(), isMaximum.end(), hostIsMaximum.begin());
+            thrust::copy(binValues.begin(), binValues.end(), hostBinValues.begin());
+            thrust::copy(maximumPairBins.begin(), maximumPairBins.begin() + numMaximumPairs, hostPairBins.begin());
+            thrust::copy(maximumPairVoters.begin(), maximumPairVoters.begin() + numMaximumPairs, hostPairVoters.begin());
+
+            // bins are sorted by key, so the maxima are reported in the order of SparseHoughSpace3D
+            std::vector<int> maximumIndex(numBins, -1);
+            for (int b = 0; b < numBins; b++)
+            {
+                if (hostIsMaximum[b])
+                {
+                    maximumIndex[b] = (int)maxima.size();
+                    maxima.push_back(hostBinValues[b]);
+                }
+            }
+
+            voterIds.resize(maxima.size());
+            for (size_t i = 0; i < numMaximumPairs; i++)
+                voterIds[maximumIndex[hostPairBins[i]]].push_back(hostPairVoters[i]);
+        }
+        catch (const thrust::system_error &e)
+        {
+            throw RuntimeException(std::string("CUDA error in Hough voting: ") + e.what());
+        }
+        catch (const std::bad_alloc &)
+        {
+            throw RuntimeException("CUDA error in Hough voting: out of device memory");
+        }
+    }
+}
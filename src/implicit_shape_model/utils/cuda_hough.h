@@ -0,0 +1,55 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CUDA_HOUGH_H
+#define ISM3D_CUDA_HOUGH_H
+
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The CudaHough class
+     * Casts votes into a 3d Hough space and finds its maxima on the GPU, with the bin layout, interpolation and
+     * maxima of SparseHoughSpace3D. Each vote emits its (bin, weight) pairs in parallel, the pairs are sorted by
+     * bin and reduced, so that only voted bins are stored as on the CPU. Each voted bin is then compared with
+     * its 26 neighbors in parallel. Bin values are summed in double precision, but in a different order than
+     * on the CPU.
+     * This header does not depend on CUDA, the implementation is only built with USE_CUDA.
+     */
+    class CudaHough
+    {
+    public:
+        /**
+         * @brief Check if a CUDA device is available.
+         */
+        static bool isAvailable();
+
+        /**
+         * @brief Vote and find the maxima, see SparseHoughSpace3D::vote(), voteInt() and findMaxima().
+         * @param positions x, y and z of each vote
+         * @param weights the weight of each vote
+         * @param numVotes the number of votes
+         * @param minCoord the minimum coordinate of the voting space
+         * @param binSize the bin size in each dimension
+         * @param binCount the number of bins in each dimension
+         * @param interpolation true to vote into the 8 surrounding bins with trilinear interpolation
+         * @param minThreshold the minimum bin value, a value in [-1, 0) is interpreted as fraction of the global
+         * maximum, a value below -1 only accepts the global maximum
+         * @param maxima output: the values of the maxima, ordered by linear bin index
+         * @param voterIds output: the votes of each maximum in increasing order
+         */
+        static void findMaxima(const double *positions, const double *weights, int numVotes,
+                               const double *minCoord, const double *binSize, const int *binCount, bool interpolation,
+                               double minThreshold, std::vector<double> &maxima, std::vector<std::vector<int> > &voterIds);
+    };
+}
+
+#endif // ISM3D_CUDA_HOUGH_H
@@ -0,0 +1,207 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CUDA_INDEX_H
+#define ISM3D_CUDA_INDEX_H
+
+#include <vector>
+#include <limits>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+#include "knn_index.h"
+#include "cuda_matcher.h"
+#include "exception.h"
+
+namespace ism3d
+{
+    // maps the flann distance functors to the distances of the CUDA matcher
+    template<typename T>
+    struct CudaDistanceKind;
+
+    template<>
+    struct CudaDistanceKind<flann::L2<float> >
+    {
+        static const CudaMatcher::DistanceKind value = CudaMatcher::Euclidean;
+    };
+
+    template<>
+    struct CudaDistanceKind<flann::ChiSquareDistance<float> >
+    {
+        static const CudaMatcher::DistanceKind value = CudaMatcher::ChiSquared;
+    };
+
+    template<>
+    struct CudaDistanceKind<flann::HellingerDistance<float> >
+    {
+        static const CudaMatcher::DistanceKind value = CudaMatcher::Hellinger;
+    };
+
+    template<>
+    struct CudaDistanceKind<flann::HistIntersectionDistance<float> >
+    {
+        static const CudaMatcher::DistanceKind value = CudaMatcher::HistIntersection;
+    };
+
+    /**
+     * @brief The CudaBruteForceIndex class
+     * Exact search on the GPU with the CudaMatcher. The dataset is uploaded by buildIndex() and stays on the
+     * device as long as the index exists, i.e. between detections. Searches are always exact, the exact flag
+     * and the number of cores are ignored.
+     */
+    template<typename T>
+    class CudaBruteForceIndex : public KnnIndex<T>
+    {
+    public:
+        explicit CudaBruteForceIndex(const flann::Matrix<float> &dataset)
+            : m_dataset(dataset)
+        {
+        }
+
+        void buildIndex()
+        {
+            m_matcher.upload(m_dataset.ptr(), (int)m_dataset.rows, (int)m_dataset.cols, CudaDistanceKind<T>::value);
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            std::vector<int> resultIndices;
+            std::vector<float> resultDistances;
+            search(queries, k, resultIndices, resultDistances);
+
+            for (int q = 0; q < (int)queries.rows; q++)
+            {
+                for (int j = 0; j < k; j++)
+                {
+                    indices[q][j] = resultIndices[(size_t)q * k + j];
+                    distances[q][j] = resultDistances[(size_t)q * k + j];
+                }
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            std::vector<int> resultIndices;
+            std::vector<float> resultDistances;
+            search(queries, k, resultIndices, resultDistances);
+
+            indices.assign(queries.rows, std::vector<int>());
+            distances.assign(queries.rows, std::vector<float>());
+            for (int q = 0; q < (int)queries.rows; q++)
+            {
+                for (int j = 0; j < k && resultIndices[(size_t)q * k + j] >= 0; j++)
+                {
+                    indices[q].push_back(resultIndices[(size_t)q * k + j]);
+                    distances[q].push_back(resultDistances[(size_t)q * k + j]);
+                }
+            }
+        }
+
+        // there is no index structure, the file only identifies the dataset
+        void save(const std::string &filename)
+        {
+            std::ofstream ofs(filename, std::ios::binary);
+            const int header[] = {s_version, (int)m_dataset.rows, (int)m_dataset.cols};
+            ofs.write(s_magic, sizeof(s_magic));
+            ofs.write((const char*)header, sizeof(header));
+            if (!ofs)
+                throw RuntimeException("could not write cuda index: " + filename);
+        }
+
+        // the copy of the dataset is held in device memory
+        std::size_t getMemoryUsage() const
+        {
+            return 0;
+        }
+
+        /**
+         * @brief Restore an index that was written with save() and upload the dataset.
+         * @param filename the index file
+         * @return false if the file does not match the dataset
+         */
+        bool load(const std::string &filename)
+        {
+            std::ifstream ifs(filename, std::ios::binary);
+            char magic[sizeof(s_magic)];
+            int header[3];
+            ifs.read(magic, sizeof(magic));
+            ifs.read((char*)header, sizeof(header));
+            if (!ifs || std::memcmp(magic, s_magic, sizeof(s_magic)) != 0 || header[0] != s_version ||
+                    header[1] != (int)m_dataset.rows || header[2] != (int)m_dataset.cols)
+                return false;
+
+            buildIndex();
+            return true;
+        }
+
+    private:
+        void search(const flann::Matrix<float> &queries, int k, std::vector<int> &indices, std::vector<float> &distances) const
+        {
+            indices.assign(queries.rows * k, -1);
+            distances.assign(queries.rows * k, std::numeric_limits<float>::max());
+            if (queries.rows == 0 || k <= 0)
+                return;
+
+            // the device only keeps up to MaxK neighbors per query, larger searches run on the cpu
+            if (k > CudaMatcher::MaxK)
+            {
+                searchHost(queries, k, indices, distances);
+                return;
+            }
+
+            // queries may have a row stride different from their size
+            std::vector<float> packed;
+            const float *data = queries.ptr();
+            if (queries.stride != queries.cols * sizeof(float))
+            {
+                packed.resize(queries.rows * queries.cols);
+                for (size_t q = 0; q < queries.rows; q++)
+                    std::copy(queries[q], queries[q] + queries.cols, packed.begin() + q * queries.cols);
+                data = packed.data();
+            }
+
+            m_matcher.knnSearch(data, (int)queries.rows, k, indices.data(), distances.data());
+        }
+
+        void searchHost(const flann::Matrix<float> &queries, int k, std::vector<int> &indices, std::vector<float> &distances) const
+        {
+            T distance;
+#pragma omp parallel for
+            for (int q = 0; q < (int)queries.rows; q++)
+            {
+                std::vector<std::pair<float, int> > candidates(m_dataset.rows);
+                for (int i = 0; i < (int)m_dataset.rows; i++)
+                    candidates[i] = std::make_pair(distance(queries[q], m_dataset[i], m_dataset.cols), i);
+
+                const int count = std::min(k, (int)candidates.size());
+                std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+                for (int j = 0; j < count; j++)
+                {
+                    indices[(size_t)q * k + j] = candidates[j].second;
+                    distances[(size_t)q * k + j] = candidates[j].first;
+                }
+            }
+        }
+
+        static constexpr char s_magic[8] = {'I', 'S', 'M', 'C', 'U', 'D', 'A', '\0'};
+        static const int s_version = 1;
+
+        flann::Matrix<float> m_dataset;
+        CudaMatcher m_matcher;
+    };
+
+    template<typename T>
+    constexpr char CudaBruteForceIndex<T>::s_magic[8];
+}
+
+#endif // ISM3D_CUDA_INDEX_H
@@ -0,0 +1,373 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "cuda_matcher.h"
+#include "cuda_frame.h"
+#include "exception.h"
+
+#include <cuda_runtime.h>
+#include <cublas_v2.h>
+#include <cfloat>
+#include <mutex>
+#include <string>
+#include <algorithm>
+
+namespace ism3d
+{
+    namespace
+    {
+        // memory for the distance matrix of one chunk of queries
+        const size_t DistanceBudget = (size_t)256 << 20;
+        const int TileSize = 16;
+        const int SelectThreads = 64;
+
+        void checkCuda(cudaError_t error, const char *what)
+        {
+            if (error != cudaSuccess)
+                throw RuntimeException(std::string("CUDA error in ") + what + ": " + cudaGetErrorString(error));
+        }
+
+        void checkCublas(cublasStatus_t status, const char *what)
+        {
+            if (status != CUBLAS_STATUS_SUCCESS)
+                throw RuntimeException(std::string("cuBLAS error in ") + what);
+        }
+
+        // per dimension terms of the flann distance functors
+        struct ChiSquaredOp
+        {
+            __device__ static float apply(float a, float b)
+            {
+                float sum = a + b;
+                float diff = a - b;
+                return sum > 0 ? diff * diff / sum : 0.0f;
+            }
+        };
+
+        struct HellingerOp
+        {
+            __device__ static float apply(float a, float b)
+            {
+                float diff = sqrtf(a) - sqrtf(b);
+                return diff * diff;
+            }
+        };
+
+        struct HistIntersectionOp
+        {
+            __device__ static float apply(float a, float b)
+            {
+                return fminf(a, b);
+            }
+        };
+
+        // distances[q * rows + r] between a chunk of queries and all dataset rows, both are staged in shared memory tiles
+        template<typename Op>
+        __global__ void pairwiseKernel(const float *queries, int numQueries, const float *dataset, int rows, int cols,
+                                       float *distances)
+        {
+            __shared__ float queryTile[TileSize][TileSize + 1];
+            __shared__ float dataTile[TileSize][TileSize + 1];
+
+            const int q = blockIdx.y * TileSize + threadIdx.y;
+            const int r = blockIdx.x * TileSize + threadIdx.x;
+            const int loadRow = blockIdx.x * TileSize + threadIdx.y;
+
+            float result = 0;
+            for (int d0 = 0; d0 < cols; d0 += TileSize)
+            {
+                const int d = d0 + threadIdx.x;
+                queryTile[threadIdx.y][threadIdx.x] = (q < numQueries && d < cols) ? queries[(size_t)q * cols + d] : 0.0f;
+                dataTile[threadIdx.y][threadIdx.x] = (loadRow < rows && d < cols) ? dataset[(size_t)loadRow * cols + d] : 0.0f;
+                __syncthreads();
+
+                const int length = min(TileSize, cols - d0);
+                for (int i = 0; i < length; i++)
+                    result += Op::apply(queryTile[threadIdx.y][i], dataTile[threadIdx.x][i]);
+                __syncthreads();
+            }
+
+            if (q < numQueries && r < rows)
+                distances[(size_t)q * rows + r] = result;
+        }
+
+        __global__ void rowNormsKernel(const float *data, int rows, int cols, float *norms)
+        {
+            const int r = blockIdx.x * blockDim.x + threadIdx.x;
+            if (r >= rows)
+                return;
+
+            float result = 0;
+            for (int d = 0; d < cols; d++)
+            {
+                float value = data[(size_t)r * cols + d];
+                result += value * value;
+            }
+            norms[r] = result;
+        }
+
+        // turns -2 * q.c into the squared euclidean distance |q|^2 + |c|^2 - 2 * q.c
+        __global__ void addNormsKernel(float *distances, int numQueries, int rows, const float *queryNorms,
+                                       const float *dataNorms)
+        {
+            const size_t i = (size_t)blockIdx.x * blockDim.x + threadIdx.x;
+            if (i >= (size_t)numQueries * rows)
+                return;
+
+            const int q = (int)(i / rows);
+            const int r = (int)(i % rows);
+            distances[i] = fmaxf(distances[i] + queryNorms[q] + dataNorms[r], 0.0f);
+        }
+
+        __device__ bool isBetter(float dist1, int index1, float dist2, int index2)
+        {
+            return dist1 < dist2 || (dist1 == dist2 && index1 >= 0 && (index2 < 0 || index1 < index2));
+        }
+
+        // one block per query, each thread collects the k best of a strided part of the row, the lists are merged pairwise
+        __global__ void selectKernel(const float *distances, int numQueries, int rows, int k,
+                                     int *outIndices, float *outDistances)
+        {
+            __shared__ float listDist[SelectThreads * CudaMatcher::MaxK];
+            __shared__ int listIndex[SelectThreads * CudaMatcher::MaxK];
+
+            const int q = blockIdx.x;
+            if (q >= numQueries)
+                return;
+            const float *row = distances + (size_t)q * rows;
+
+            float *myDist = listDist + threadIdx.x * k;
+            int *myIndex = listIndex + threadIdx.x * k;
+            for (int i = 0; i < k; i++)
+            {
+                myDist[i] = FLT_MAX;
+                myIndex[i] = -1;
+            }
+
+            for (int r = threadIdx.x; r < rows; r += blockDim.x)
+            {
+                float dist = row[r];
+                if (!isBetter(dist, r, myDist[k - 1], myIndex[k - 1]))
+                    continue;
+
+                // insertion into the sorted list
+                int pos = k - 1;
+                while (pos > 0 && isBetter(dist, r, myDist[pos - 1], myIndex[pos - 1]))
+                {
+                    myDist[pos] = myDist[pos - 1];
+                    myIndex[pos] = myIndex[pos - 1];
+                    pos--;
+                }
+                myDist[pos] = dist;
+                myIndex[pos] = r;
+            }
+            __syncthreads();
+
+            for (int stride = blockDim.x / 2; stride > 0; stride /= 2)
+            {
+                float mergedDist[CudaMatcher::MaxK];
+                int mergedIndex[CudaMatcher::MaxK];
+                if (threadIdx.x < stride)
+                {
+                    const float *otherDist = listDist + (threadIdx.x + stride) * k;
+                    const int *otherIndex = listIndex + (threadIdx.x + stride) * k;
+                    int a = 0;
+                    int b = 0;
+                    for (int i = 0; i < k; i++)
+                    {
+                        if (isBetter(myDist[a], myIndex[a], otherDist[b], otherIndex[b]))
+                        {
+                            mergedDist[i] = myDist[a];
+                            mergedIndex[i] = myIndex[a++];
+                        }
+                        else
+                        {
+                            mergedDist[i] = otherDist[b];
+                            mergedIndex[i] = otherIndex[b++];
+                        }
+                    }
+                }
+                __syncthreads();
+
+                if (threadIdx.x < stride)
+                {
+                    for (int i = 0; i < k; i++)
+                    {
+                        myDist[i] = mergedDist[i];
+                        myIndex[i] = mergedIndex[i];
+                    }
+                }
+                __syncthreads();
+            }
+
+            if (threadIdx.x == 0)
+            {
+                for (int i = 0; i < k; i++)
+                {
+                    outIndices[(size_t)q * k + i] = myIndex[i];
+                    outDistances[(size_t)q * k + i] = myDist[i];
+                }
+            }
+        }
+    }
+
+    struct CudaMatcher::Impl
+    {
+        Impl()
+            : rows(0), cols(0), kind(CudaMatcher::Euclidean), dataset(0), dataNorms(0)
+        {
+        }
+
+        ~Impl()
+        {
+            cudaFree(dataset);
+            cudaFree(dataNorms);
+        }
+
+        int rows;
+        int cols;
+        CudaMatcher::DistanceKind kind;
+
+        // resident dataset, the search buffers belong to the frame of the searching thread
+        float *dataset;
+        float *dataNorms;
+
+        std::mutex mutex;
+    };
+
+    CudaMatcher::CudaMatcher()
+        : m_impl(new Impl())
+    {
+    }
+
+    CudaMatcher::~CudaMatcher()
+    {
+    }
+
+    bool CudaMatcher::isAvailable()
+    {
+        int count = 0;
+        return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+    }
+
+    void CudaMatcher::upload(const float *dataset, int rows, int cols, DistanceKind kind)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+        cudaFree(m_impl->dataset);
+        cudaFree(m_impl->dataNorms);
+        m_impl->dataset = 0;
+        m_impl->dataNorms = 0;
+        m_impl->rows = rows;
+        m_impl->cols = cols;
+        m_impl->kind = kind;
+        if (rows == 0 || cols == 0)
+            return;
+
+        const size_t size = (size_t)rows * cols;
+        checkCuda(cudaMalloc((void**)&m_impl->dataset, size * sizeof(float)), "cudaMalloc");
+        checkCuda(cudaMemcpy(m_impl->dataset, dataset, size * sizeof(float), cudaMemcpyHostToDevice), "cudaMemcpy");
+
+        if (kind == Euclidean)
+        {
+            checkCuda(cudaMalloc((void**)&m_impl->dataNorms, rows * sizeof(float)), "cudaMalloc");
+            rowNormsKernel<<<(rows + 255) / 256, 256>>>(m_impl->dataset, rows, cols, m_impl->dataNorms);
+            checkCuda(cudaGetLastError(), "rowNormsKernel");
+        }
+
+        // the searches run on non-blocking streams, which do not wait for the default stream
+        checkCuda(cudaDeviceSynchronize(), "cudaDeviceSynchronize");
+    }
+
+    void CudaMatcher::knnSearch(const float *queries, int numQueries, int k, int *indices, float *distances) const
+    {
+        if (k > MaxK)
+            throw RuntimeException("CUDA matcher supports at most " + std::to_string(MaxK) + " neighbors");
+
+        const Impl &impl = *m_impl;
+        if (numQueries == 0 || k <= 0)
+            return;
+        if (impl.rows == 0)
+        {
+            std::fill(indices, indices + (size_t)numQueries * k, -1);
+            std::fill(distances, distances + (size_t)numQueries * k, FLT_MAX);
+            return;
+        }
+
+        // the queries and results of a chunk pass through the pinned buffers of the frame, the kernels run on
+        // its stream
+        CudaFrame &frame = CudaFrame::get();
+        cudaStream_t stream = frame.getStream();
+        const int chunk = (int)std::max<size_t>(1, std::min<size_t>(numQueries, DistanceBudget / ((size_t)impl.rows * sizeof(float))));
+        float *chunkDistances = frame.device<float>(CudaFrame::Distances, (size_t)chunk * impl.rows);
+        int *indicesOut = frame.device<int>(CudaFrame::Indices, (size_t)chunk * k);
+        float *distancesOut = frame.device<float>(CudaFrame::ResultDistances, (size_t)chunk * k);
+        float *queryNorms = impl.kind == Euclidean ? frame.device<float>(CudaFrame::QueryNorms, (size_t)chunk) : 0;
+
+        for (int first = 0; first < numQueries; first += chunk)
+        {
+            const int count = std::min(chunk, numQueries - first);
+            const float *chunkQueries = frame.upload(CudaFrame::Queries, queries + (size_t)first * impl.cols,
+                                                     (size_t)count * impl.cols);
+
+            const dim3 tileThreads(TileSize, TileSize);
+            const dim3 tileBlocks((impl.rows + TileSize - 1) / TileSize, (count + TileSize - 1) / TileSize);
+            switch (impl.kind)
+            {
+            case Euclidean:
+            {
+                // row-major distances (count x rows) are the column-major product dataset * queries^T
+                const float alpha = -2.0f;
+                const float beta = 0.0f;
+                checkCublas(cublasSgemm(frame.getBlasHandle(), CUBLAS_OP_T, CUBLAS_OP_N, impl.rows, count, impl.cols, &alpha,
+                                        impl.dataset, impl.cols, chunkQueries, impl.cols, &beta,
+                                        chunkDistances, impl.rows), "cublasSgemm");
+                rowNormsKernel<<<(count + 255) / 256, 256, 0, stream>>>(chunkQueries, count, impl.cols, queryNorms);
+                const size_t total = (size_t)count * impl.rows;
+                addNormsKernel<<<(unsigned)((total + 255) / 256), 256, 0, stream>>>(chunkDistances, count, impl.rows,
+                                                                                    queryNorms, impl.dataNorms);
+                break;
+            }
+            case ChiSquared:
+                pairwiseKernel<ChiSquaredOp><<<tileBlocks, tileThreads, 0, stream>>>(chunkQueries, count, impl.dataset,
+                                                                                     impl.rows, impl.cols, chunkDistances);
+                break;
+            case Hellinger:
+                pairwiseKernel<HellingerOp><<<tileBlocks, tileThreads, 0, stream>>>(chunkQueries, count, impl.dataset,
+                                                                                    impl.rows, impl.cols, chunkDistances);
+                break;
+            case HistIntersection:
+                pairwiseKernel<HistIntersectionOp><<<tileBlocks, tileThreads, 0, stream>>>(chunkQueries, count, impl.dataset,
+                                                                                           impl.rows, impl.cols, chunkDistances);
+                break;
+            }
+            checkCuda(cudaGetLastError(), "distance kernel");
+
+            selectKernel<<<count, SelectThreads, 0, stream>>>(chunkDistances, count, impl.rows, k, indicesOut, distancesOut);
+            checkCuda(cudaGetLastError(), "selectKernel");
+
+            const int *chunkIndices = frame.download(CudaFrame::Indices, (const int*)indicesOut, (size_t)count * k);
+            const float *chunkResults = frame.download(CudaFrame::ResultDistances, (const float*)distancesOut, (size_t)count * k);
+            frame.synchronize();
+            std::copy(chunkIndices, chunkIndices + (size_t)count * k, indices + (size_t)first * k);
+            std::copy(chunkResults, chunkResults + (size_t)count * k, distances + (size_t)first * k);
+        }
+    }
+
+    int CudaMatcher::getRows() const
+    {
+        return m_impl->rows;
+    }
+
+    int CudaMatcher::getCols() const
+    {
+        return m_impl->cols;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CUDA_MATCHER_H
+#define ISM3D_CUDA_MATCHER_H
+
+#include <memory>
+
+namespace ism3d
+{
+    /**
+     * @brief The CudaMatcher class
+     * Exact k nearest neighbor search by brute force on the GPU. The dataset is uploaded once and stays in
+     * device memory until the matcher is destroyed, so that repeated searches only transfer the queries.
+     * Euclidean distances are computed with a matrix multiplication, the histogram distances with a tiled
+     * kernel. All distances are the same as the corresponding flann functors. Queries are processed in
+     * chunks that keep the distance matrix below a fixed memory budget. Each searching thread uses the stream
+     * and buffers of its own CudaFrame, so that searches of different threads overlap on the device; the
+     * dataset must not be uploaded while searches are running.
+     * This header does not depend on CUDA, the implementation is only built with USE_CUDA.
+     */
+    class CudaMatcher
+    {
+    public:
+        enum DistanceKind
+        {
+            Euclidean,
+            ChiSquared,
+            Hellinger,
+            HistIntersection
+        };
+
+        // the largest number of neighbors that can be searched on the device
+        static const int MaxK = 64;
+
+        CudaMatcher();
+        ~CudaMatcher();
+
+        /**
+         * @brief Check if a CUDA device is available.
+         */
+        static bool isAvailable();
+
+        /**
+         * @brief Copy the dataset to the device, replacing a previous dataset.
+         * @param dataset the descriptors, one per row
+         * @param rows the number of descriptors
+         * @param cols the descriptor size
+         * @param kind the distance to use for searching
+         */
+        void upload(const float *dataset, int rows, int cols, DistanceKind kind);
+
+        /**
+         * @brief Search the k nearest neighbors of all queries. Rows with less than k results are filled with -1.
+         * @param queries the queries, one per row with the descriptor size of the dataset
+         * @param numQueries the number of queries
+         * @param k the number of neighbors, at most MaxK
+         * @param indices output: numQueries x k dataset rows
+         * @param distances output: numQueries x k distances
+         */
+        void knnSearch(const float *queries, int numQueries, int k, int *indices, float *distances) const;
+
+        int getRows() const;
+        int getCols() const;
+
+    private:
+        CudaMatcher(const CudaMatcher&);
+        CudaMatcher& operator=(const CudaMatcher&);
+
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
+}
+
+#endif // ISM3D_CUDA_MATCHER_H
@@ -0,0 +1,344 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "cuda_mean_shift.h"
+#include "exception.h"
+
+#include <cuda_runtime.h>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ism3d
+{
+    namespace
+    {
+        const int BlockThreads = 128;
+        const int NumNeighborCells = 27;
+
+        void checkCuda(cudaError_t error, const char *what)
+        {
+            if (error != cudaSuccess)
+                throw RuntimeException(std::string("CUDA error in ") + what + ": " + cudaGetErrorString(error));
+        }
+
+        template<typename T>
+        void uploadBuffer(T *&buffer, const T *data, size_t size)
+        {
+            cudaFree(buffer);
+            buffer = 0;
+            if (size == 0)
+                return;
+            checkCuda(cudaMalloc((void**)&buffer, size * sizeof(T)), "cudaMalloc");
+            checkCuda(cudaMemcpy(buffer, data, size * sizeof(T), cudaMemcpyHostToDevice), "cudaMemcpy");
+        }
+
+        // cells are ordered by z, y, x
+        __device__ bool cellLess(const int4 &a, int x, int y, int z)
+        {
+            if (a.z != z)
+                return a.z < z;
+            if (a.y != y)
+                return a.y < y;
+            return a.x < x;
+        }
+
+        __device__ int findCell(const int4 *cells, int numCells, int x, int y, int z)
+        {
+            int first = 0;
+            int count = numCells;
+            while (count > 0)
+            {
+                const int step = count / 2;
+                if (cellLess(cells[first + step], x, y, z))
+                {
+                    first += step + 1;
+                    count -= step + 1;
+                }
+                else
+                    count = step;
+            }
+
+            if (first < numCells && cells[first].x == x && cells[first].y == y && cells[first].z == z)
+                return first;
+            return -1;
+        }
+
+        // same interpolation as VotingMeanShift::lookupProfile()
+        __device__ float lookupProfile(const float *table, int tableSize, float u)
+        {
+            const float position = fminf(fmaxf(u, 0.0f), 1.0f) * tableSize;
+            const int index = min((int)position, tableSize - 1);
+            const float fraction = position - index;
+            return table[index] + fraction * (table[index + 1] - table[index]);
+        }
+
+        // one block per seed, the threads accumulate the votes of the cells around the center in shared memory
+        __global__ void meanShiftKernel(const float *x, const float *y, const float *z, const float *weights,
+                                        const int4 *cells, const int *cellOffsets, int numCells, float cellSize,
+                                        const float4 *seeds, int numSeeds, const float *shiftTable, int tableSize,
+                                        float bandwidth, float threshold, int maxIter,
+                                        float4 *centers, char *valid, int *iterations)
+        {
+            __shared__ float sumX[BlockThreads];
+            __shared__ float sumY[BlockThreads];
+            __shared__ float sumZ[BlockThreads];
+            __shared__ float sumWeight[BlockThreads];
+            __shared__ int count[BlockThreads];
+            __shared__ int rangeBegin[NumNeighborCells];
+            __shared__ int rangeEnd[NumNeighborCells];
+            __shared__ float4 center;
+            __shared__ bool done;
+            __shared__ bool found;
+            __shared__ int iter;
+
+            const int seed = blockIdx.x;
+            if (seed >= numSeeds)
+                return;
+
+            if (threadIdx.x == 0)
+            {
+                center = seeds[seed];
+                done = false;
+                found = true;
+                iter = 0;
+            }
+            __syncthreads();
+
+            const float bandwidthSqr = bandwidth * bandwidth;
+            const float invBandwidthSqr = 1.0f / bandwidthSqr;
+
+            while (!done)
+            {
+                // ranges of the 27 cells around the cell of the center
+                if (threadIdx.x < NumNeighborCells)
+                {
+                    const int dx = threadIdx.x % 3 - 1;
+                    const int dy = (threadIdx.x / 3) % 3 - 1;
+                    const int dz = threadIdx.x / 9 - 1;
+                    const int cell = findCell(cells, numCells,
+                                              (int)floorf(center.x / cellSize + 0.5f) + dx,
+                                              (int)floorf(center.y / cellSize + 0.5f) + dy,
+                                              (int)floorf(center.z / cellSize + 0.5f) + dz);
+                    rangeBegin[threadIdx.x] = cell < 0 ? 0 : cellOffsets[cell];
+                    rangeEnd[threadIdx.x] = cell < 0 ? 0 : cellOffsets[cell + 1];
+                }
+                __syncthreads();
+
+                float partialX = 0, partialY = 0, partialZ = 0, partialWeight = 0;
+                int partialCount = 0;
+                for (int c = 0; c < NumNeighborCells; c++)
+                {
+                    for (int i = rangeBegin[c] + threadIdx.x; i < rangeEnd[c]; i += blockDim.x)
+                    {
+                        const float dx = x[i] - center.x;
+                        const float dy = y[i] - center.y;
+                        const float dz = z[i] - center.z;
+                        const float distanceSqr = dx * dx + dy * dy + dz * dz;
+                        if (distanceSqr > bandwidthSqr)
+                            continue;
+
+                        const float g = lookupProfile(shiftTable, tableSize, distanceSqr * invBandwidthSqr) * weights[i];
+                        partialX += g * x[i];
+                        partialY += g * y[i];
+                        partialZ += g * z[i];
+                        partialWeight += g;
+                        partialCount++;
+                    }
+                }
+                sumX[threadIdx.x] = partialX;
+                sumY[threadIdx.x] = partialY;
+                sumZ[threadIdx.x] = partialZ;
+                sumWeight[threadIdx.x] = partialWeight;
+                count[threadIdx.x] = partialCount;
+                __syncthreads();
+
+                for (int stride = blockDim.x / 2; stride > 0; stride /= 2)
+                {
+                    if (threadIdx.x < stride)
+                    {
+                        sumX[threadIdx.x] += sumX[threadIdx.x + stride];
+                        sumY[threadIdx.x] += sumY[threadIdx.x + stride];
+                        sumZ[threadIdx.x] += sumZ[threadIdx.x + stride];
+                        sumWeight[threadIdx.x] += sumWeight[threadIdx.x + stride];
+                        count[threadIdx.x] += count[threadIdx.x + stride];
+                    }
+                    __syncthreads();
+                }
+
+                // same termination as VotingMeanShift::iDoMeanShift()
+                if (threadIdx.x == 0)
+                {
+                    if (count[0] == 0)
+                    {
+                        found = false;
+                        done = true;
+                    }
+                    else
+                    {
+                        float4 shifted = make_float4(sumX[0], sumY[0], sumZ[0], 0);
+                        if (sumWeight[0] != 0)
+                        {
+                            shifted.x /= sumWeight[0];
+                            shifted.y /= sumWeight[0];
+                            shifted.z /= sumWeight[0];
+                        }
+
+                        const float diffX = center.x - shifted.x;
+                        const float diffY = center.y - shifted.y;
+                        const float diffZ = center.z - shifted.z;
+                        const float diff = sqrtf(diffX * diffX + diffY * diffY + diffZ * diffZ);
+                        center = shifted;
+                        iter++;
+                        done = !(diff > threshold && iter <= maxIter);
+                    }
+                }
+                __syncthreads();
+            }
+
+            if (threadIdx.x == 0)
+            {
+                centers[seed] = center;
+                valid[seed] = found ? 1 : 0;
+                iterations[seed] = iter;
+            }
+        }
+    }
+
+    struct CudaMeanShift::Impl
+    {
+        Impl()
+            : numVotes(0), numCells(0), cellSize(0), x(0), y(0), z(0), weights(0), cells(0), cellOffsets(0)
+        {
+        }
+
+        ~Impl()
+        {
+            cudaFree(x);
+            cudaFree(y);
+            cudaFree(z);
+            cudaFree(weights);
+            cudaFree(cells);
+            cudaFree(cellOffsets);
+        }
+
+        int numVotes;
+        int numCells;
+        float cellSize;
+
+        // resident binned votes
+        float *x;
+        float *y;
+        float *z;
+        float *weights;
+        int4 *cells;
+        int *cellOffsets;
+
+        std::mutex mutex;
+    };
+
+    CudaMeanShift::CudaMeanShift()
+        : m_impl(new Impl())
+    {
+    }
+
+    CudaMeanShift::~CudaMeanShift()
+    {
+    }
+
+    bool CudaMeanShift::isAvailable()
+    {
+        int count = 0;
+        return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+    }
+
+    void CudaMeanShift::upload(const float *x, const float *y, const float *z, const float *weights, int numVotes,
+                               const int *cellCoords, const int *cellOffsets, int numCells, float cellSize)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+        uploadBuffer(m_impl->x, x, (size_t)numVotes);
+        uploadBuffer(m_impl->y, y, (size_t)numVotes);
+        uploadBuffer(m_impl->z, z, (size_t)numVotes);
+        uploadBuffer(m_impl->weights, weights, (size_t)numVotes);
+
+        std::vector<int4> cells(numCells);
+        for (int c = 0; c < numCells; c++)
+            cells[c] = make_int4(cellCoords[3 * c], cellCoords[3 * c + 1], cellCoords[3 * c + 2], 0);
+        uploadBuffer(m_impl->cells, cells.data(), cells.size());
+        uploadBuffer(m_impl->cellOffsets, cellOffsets, (size_t)numCells + 1);
+
+        m_impl->numVotes = numVotes;
+        m_impl->numCells = numCells;
+        m_impl->cellSize = cellSize;
+    }
+
+    void CudaMeanShift::shift(const float *seeds, int numSeeds, const float *shiftTable, int tableSize, float bandwidth,
+                              float threshold, int maxIter, float *centers, char *valid, int *iterations) const
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        if (numSeeds == 0)
+            return;
+
+        const Impl &impl = *m_impl;
+        float4 *deviceSeeds = 0;
+        float *deviceTable = 0;
+        float4 *deviceCenters = 0;
+        char *deviceValid = 0;
+        int *deviceIterations = 0;
+
+        try
+        {
+            std::vector<float4> buffer(numSeeds);
+            for (int i = 0; i < numSeeds; i++)
+                buffer[i] = make_float4(seeds[3 * i], seeds[3 * i + 1], seeds[3 * i + 2], 0);
+            uploadBuffer(deviceSeeds, buffer.data(), buffer.size());
+            uploadBuffer(deviceTable, shiftTable, (size_t)tableSize + 1);
+            checkCuda(cudaMalloc((void**)&deviceCenters, numSeeds * sizeof(float4)), "cudaMalloc");
+            checkCuda(cudaMalloc((void**)&deviceValid, numSeeds * sizeof(char)), "cudaMalloc");
+            checkCuda(cudaMalloc((void**)&deviceIterations, numSeeds * sizeof(int)), "cudaMalloc");
+
+            meanShiftKernel<<<numSeeds, BlockThreads>>>(impl.x, impl.y, impl.z, impl.weights, impl.cells,
+                                                        impl.cellOffsets, impl.numCells, impl.cellSize,
+                                                        deviceSeeds, numSeeds, deviceTable, tableSize, bandwidth,
+                                                        threshold, maxIter, deviceCenters, deviceValid,
+                                                        deviceIterations);
+            checkCuda(cudaGetLastError(), "meanShiftKernel");
+
+            checkCuda(cudaMemcpy(buffer.data(), deviceCenters, numSeeds * sizeof(float4), cudaMemcpyDeviceToHost),
+                      "cudaMemcpy");
+            checkCuda(cudaMemcpy(valid, deviceValid, numSeeds * sizeof(char), cudaMemcpyDeviceToHost), "cudaMemcpy");
+            checkCuda(cudaMemcpy(iterations, deviceIterations, numSeeds * sizeof(int), cudaMemcpyDeviceToHost),
+                      "cudaMemcpy");
+            for (int i = 0; i < numSeeds; i++)
+            {
+                centers[3 * i] = buffer[i].x;
+                centers[3 * i + 1] = buffer[i].y;
+                centers[3 * i + 2] = buffer[i].z;
+            }
+        }
+        catch (...)
+        {
+            cudaFree(deviceSeeds);
+            cudaFree(deviceTable);
+            cudaFree(deviceCenters);
+            cudaFree(deviceValid);
+            cudaFree(deviceIterations);
+            throw;
+        }
+
+        cudaFree(deviceSeeds);
+        cudaFree(deviceTable);
+        cudaFree(deviceCenters);
+        cudaFree(deviceValid);
+        cudaFree(deviceIterations);
+    }
+}
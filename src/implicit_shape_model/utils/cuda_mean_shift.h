@@ -0,0 +1,81 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CUDA_MEAN_SHIFT_H
+#define ISM3D_CUDA_MEAN_SHIFT_H
+
+#include <memory>
+
+namespace ism3d
+{
+    /**
+     * @brief The CudaMeanShift class
+     * Shifts mean shift seeds to their modes on the GPU. The votes are uploaded binned into the cells of a
+     * uniform grid, as in VoteGrid: sorted by cell, with the coordinates of the non-empty cells in increasing
+     * z, y, x order. All seeds are shifted in a single kernel launch with one thread block per seed, whose
+     * threads accumulate the kernel weighted votes of the 27 cells around the center in shared memory. The
+     * kernel profile is passed as a table over the squared normalized distance and interpolated linearly, as
+     * on the CPU, so that the modes equal the CPU modes up to the order of the float sums.
+     * This header does not depend on CUDA, the implementation is only built with USE_CUDA.
+     */
+    class CudaMeanShift
+    {
+    public:
+        CudaMeanShift();
+        ~CudaMeanShift();
+
+        /**
+         * @brief Check if a CUDA device is available.
+         */
+        static bool isAvailable();
+
+        /**
+         * @brief Copy the binned votes to the device, replacing previous votes.
+         * @param x the x coordinates of the votes, sorted by cell
+         * @param y the y coordinates of the votes, sorted by cell
+         * @param z the z coordinates of the votes, sorted by cell
+         * @param weights the weights of the votes, sorted by cell
+         * @param numVotes the number of votes
+         * @param cellCoords x, y and z coordinate of each non-empty cell, ordered by z, y, x
+         * @param cellOffsets numCells + 1 offsets, the votes of cell c are in [cellOffsets[c], cellOffsets[c + 1])
+         * @param numCells the number of non-empty cells
+         * @param cellSize the edge length of a cell, cells are centered on multiples of it
+         */
+        void upload(const float *x, const float *y, const float *z, const float *weights, int numVotes,
+                    const int *cellCoords, const int *cellOffsets, int numCells, float cellSize);
+
+        /**
+         * @brief Shift all seeds until they move less than the threshold or exceed the maximum number of
+         * iterations.
+         * @param seeds x, y and z of each seed
+         * @param numSeeds the number of seeds
+         * @param shiftTable the negative derivative of the kernel profile at tableSize + 1 squared normalized
+         * distances in [0, 1]
+         * @param tableSize the number of table intervals
+         * @param bandwidth the bandwidth, must not be larger than the cell size
+         * @param threshold the termination threshold
+         * @param maxIter the maximum number of iterations
+         * @param centers output: x, y and z of the mode of each seed
+         * @param valid output: 0 for seeds without votes in their bandwidth, as on the CPU
+         * @param iterations output: the iterations of each seed
+         */
+        void shift(const float *seeds, int numSeeds, const float *shiftTable, int tableSize, float bandwidth,
+                   float threshold, int maxIter, float *centers, char *valid, int *iterations) const;
+
+    private:
+        CudaMeanShift(const CudaMeanShift&);
+        CudaMeanShift& operator=(const CudaMeanShift&);
+
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
+}
+
+#endif // ISM3D_CUDA_MEAN_SHIFT_H
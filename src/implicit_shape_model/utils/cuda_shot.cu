@@ -0,0 +1,435 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "cuda_shot.h"
+#include "cuda_frame.h"
+#include "exception.h"
+
+#include <cuda_runtime.h>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ism3d
+{
+    namespace
+    {
+        const int BlockThreads = 128;
+        const int MinNeighbors = 5;
+
+        // same angles as the PCL implementation
+        const float Rad45 = 0.78539816339744830962f;
+        const float Rad90 = 1.5707963267948966192f;
+        const float Rad135 = 2.3561944901923449288f;
+        const float RadPi78 = 2.7488935718910690837f;
+
+        void checkCuda(cudaError_t error, const char *what)
+        {
+            if (error != cudaSuccess)
+                throw RuntimeException(std::string("CUDA error in ") + what + ": " + cudaGetErrorString(error));
+        }
+
+        // normalized CIELAB components (0 < L < 1, -1 < a, b < 1) with the lookup tables of pcl::SHOTColorEstimation
+        void rgbToLab(unsigned char r, unsigned char g, unsigned char b, float *lab)
+        {
+            struct Tables
+            {
+                Tables()
+                {
+                    for (int i = 0; i < 256; i++)
+                    {
+                        float f = static_cast<float>(i) / 255.0f;
+                        srgb[i] = f > 0.04045 ? powf((f + 0.055f) / 1.055f, 2.4f) : f / 12.92f;
+                    }
+                    for (int i = 0; i < 4000; i++)
+                    {
+                        float f = static_cast<float>(i) / 4000.0f;
+                        xyz[i] = f > 0.008856 ? powf(f, 0.3333f) : static_cast<float>((7.787 * f) + (16.0 / 116.0));
+                    }
+                }
+
+                float srgb[256];
+                float xyz[4000];
+            };
+            static const Tables tables;
+
+            const float fr = tables.srgb[r];
+            const float fg = tables.srgb[g];
+            const float fb = tables.srgb[b];
+
+            // white = D65
+            const float x = fr * 0.412453f + fg * 0.357580f + fb * 0.180423f;
+            const float y = fr * 0.212671f + fg * 0.715160f + fb * 0.072169f;
+            const float z = fr * 0.019334f + fg * 0.119193f + fb * 0.950227f;
+
+            const float vx = tables.xyz[int(x / 0.95047f * 4000)];
+            const float vy = tables.xyz[int(y * 4000)];
+            const float vz = tables.xyz[int(z / 1.08883f * 4000)];
+
+            const float L = fminf(116.0f * vy - 16.0f, 100.0f);
+            const float A = fmaxf(fminf(500.0f * (vx - vy), 120.0f), -120.0f);
+            const float B = fmaxf(fminf(200.0f * (vy - vz), 120.0f), -120.0f);
+
+            lab[0] = L / 100.0f;
+            lab[1] = A / 120.0f;
+            lab[2] = B / 120.0f;
+            lab[3] = 0;
+        }
+
+        // adds the vote of one channel, the own volume also receives the interpolation between adjacent histogram bins
+        __device__ void addVote(float *histograms, int numBins, float binDistance, int volume, float ownWeight,
+                                const int *adjacent, const float *adjacentWeights)
+        {
+            const int stepIndex = (int)floorf(binDistance + 0.5f);
+            const float fraction = binDistance - stepIndex;
+            float *ownHistogram = histograms + volume * (numBins + 1);
+
+            if (fraction > 0)
+                atomicAdd(ownHistogram + (stepIndex + 1) % numBins, fraction);
+            else
+                atomicAdd(ownHistogram + (stepIndex - 1 + numBins) % numBins, -fraction);
+            atomicAdd(ownHistogram + stepIndex, ownWeight + 1 - fabsf(fraction));
+
+            for (int k = 0; k < 3; k++)
+            {
+                if (adjacent[k] >= 0)
+                    atomicAdd(histograms + adjacent[k] * (numBins + 1) + stepIndex, adjacentWeights[k]);
+            }
+        }
+
+        // one block per keypoint, the histograms of the keypoint are accumulated in shared memory
+        __global__ void shotKernel(const float4 *points, const float4 *normals, const float4 *labs,
+                                   const float4 *keypoints, const float4 *keypointLabs, const float *frames,
+                                   int numKeypoints, const int *offsets, const int *neighbors, const float *sqrDistances,
+                                   float radius, int descriptorLength, float *descriptors)
+        {
+            extern __shared__ float histograms[];
+            __shared__ float partialNorms[BlockThreads];
+
+            const int keypoint = blockIdx.x;
+            if (keypoint >= numKeypoints)
+                return;
+
+            const float *frame = frames + keypoint * 9;
+            const int first = offsets[keypoint];
+            const int numNeighbors = offsets[keypoint + 1] - first;
+            float *descriptor = descriptors + (size_t)keypoint * descriptorLength;
+
+            if (numNeighbors < MinNeighbors || !isfinite(frame[0]) || !isfinite(frame[3]) || !isfinite(frame[6]))
+            {
+                for (int d = threadIdx.x; d < descriptorLength; d += blockDim.x)
+                    descriptor[d] = nanf("");
+                return;
+            }
+
+            for (int d = threadIdx.x; d < descriptorLength; d += blockDim.x)
+                histograms[d] = 0;
+            __syncthreads();
+
+            const float radius1_2 = radius / 2;
+            const float radius1_4 = radius / 4;
+            const float radius3_4 = radius * 3 / 4;
+            const float4 center = keypoints[keypoint];
+            const int shapeToColorStride = CudaShot::GridSectors * (CudaShot::ShapeBins + 1);
+
+            for (int n = threadIdx.x; n < numNeighbors; n += blockDim.x)
+            {
+                const int index = neighbors[first + n];
+                const float distance = sqrtf(sqrDistances[first + n]);
+                if (distance == 0)
+                    continue;
+
+                // the cosine between the normal and the z axis of the reference frame selects the shape bin
+                float binDistanceShape = CudaShot::ShapeBins / 2.0f;
+                if (normals)
+                {
+                    const float4 normal = normals[index];
+                    if (!isfinite(normal.x) || !isfinite(normal.y) || !isfinite(normal.z))
+                        continue;
+                    float cosine = normal.x * frame[6] + normal.y * frame[7] + normal.z * frame[8];
+                    cosine = fmaxf(fminf(cosine, 1.0f), -1.0f);
+                    binDistanceShape = (1.0f + cosine) * CudaShot::ShapeBins / 2;
+                }
+
+                // neighbor position in the local reference frame
+                const float4 point = points[index];
+                const float dx = point.x - center.x;
+                const float dy = point.y - center.y;
+                const float dz = point.z - center.z;
+                float x = dx * frame[0] + dy * frame[1] + dz * frame[2];
+                float y = dx * frame[3] + dy * frame[4] + dz * frame[5];
+                float z = dx * frame[6] + dy * frame[7] + dz * frame[8];
+                if (fabsf(x) < 1e-30f)
+                    x = 0;
+                if (fabsf(y) < 1e-30f)
+                    y = 0;
+                if (fabsf(z) < 1e-30f)
+                    z = 0;
+
+                // volume of the grid: 8 azimuth sectors, 2 elevations, 2 radii
+                const int bit4 = ((y > 0) || ((y == 0) && (x < 0))) ? 1 : 0;
+                const int bit3 = ((x > 0) || ((x == 0) && (y > 0))) ? !bit4 : bit4;
+                int volume = ((bit4 << 3) + (bit3 << 2)) << 1;
+                if ((x > 0 && y > 0) || (x < 0 && y < 0) || x == 0)
+                    volume += fabsf(x) >= fabsf(y) ? 0 : 4;
+                else
+                    volume += fabsf(x) > fabsf(y) ? 4 : 0;
+                volume += z > 0 ? 1 : 0;
+                volume += distance > radius1_2 ? 2 : 0;
+
+                // quadrilinear interpolation with the radial, inclination and azimuth neighbors of the volume
+                float ownWeight = 0;
+                int adjacent[3] = {-1, -1, -1};
+                float adjacentWeights[3] = {0, 0, 0};
+
+                if (distance > radius1_2)
+                {
+                    const float radiusDistance = (distance - radius3_4) / radius1_2;
+                    if (distance > radius3_4)
+                        ownWeight += 1 - radiusDistance;
+                    else
+                    {
+                        ownWeight += 1 + radiusDistance;
+                        adjacent[0] = volume - 2;
+                        adjacentWeights[0] = -radiusDistance;
+                    }
+                }
+                else
+                {
+                    const float radiusDistance = (distance - radius1_4) / radius1_2;
+                    if (distance < radius1_4)
+                        ownWeight += 1 + radiusDistance;
+                    else
+                    {
+                        ownWeight += 1 - radiusDistance;
+                        adjacent[0] = volume + 2;
+                        adjacentWeights[0] = radiusDistance;
+                    }
+                }
+
+                // the lower hemisphere is decided by the sign of z, which is exact where the rounded angle is not
+                const float inclination = acosf(fmaxf(fminf(z / distance, 1.0f), -1.0f));
+                if (z <= 0)
+                {
+                    const float inclinationDistance = (inclination - Rad135) / Rad90;
+                    if (inclination > Rad135)
+                        ownWeight += 1 - inclinationDistance;
+                    else
+                    {
+                        ownWeight += 1 + inclinationDistance;
+                        adjacent[1] = volume + 1;
+                        adjacentWeights[1] = -inclinationDistance;
+                    }
+                }
+                else
+                {
+                    const float inclinationDistance = (inclination - Rad45) / Rad90;
+                    if (inclination < Rad45)
+                        ownWeight += 1 + inclinationDistance;
+                    else
+                    {
+                        ownWeight += 1 - inclinationDistance;
+                        adjacent[1] = volume - 1;
+                        adjacentWeights[1] = inclinationDistance;
+                    }
+                }
+
+                if (y != 0 || x != 0)
+                {
+                    const float azimuth = atan2f(y, x);
+                    const int sector = volume >> 2;
+                    float azimuthDistance = (azimuth - (-RadPi78 + Rad45 * sector)) / Rad45;
+                    azimuthDistance = fmaxf(-0.5f, fminf(azimuthDistance, 0.5f));
+                    if (azimuthDistance > 0)
+                    {
+                        ownWeight += 1 - azimuthDistance;
+                        adjacent[2] = (volume + 4) % CudaShot::GridSectors;
+                        adjacentWeights[2] = azimuthDistance;
+                    }
+                    else
+                    {
+                        ownWeight += 1 + azimuthDistance;
+                        adjacent[2] = (volume - 4 + CudaShot::GridSectors) % CudaShot::GridSectors;
+                        adjacentWeights[2] = -azimuthDistance;
+                    }
+                }
+
+                addVote(histograms, CudaShot::ShapeBins, binDistanceShape, volume, ownWeight, adjacent, adjacentWeights);
+
+                if (labs)
+                {
+                    const float4 lab = labs[index];
+                    const float4 labRef = keypointLabs[keypoint];
+                    float colorDistance = (fabsf(labRef.x - lab.x) + (fabsf(labRef.y - lab.y) + fabsf(labRef.z - lab.z)) / 2) / 3;
+                    colorDistance = fmaxf(fminf(colorDistance, 1.0f), 0.0f);
+                    addVote(histograms + shapeToColorStride, CudaShot::ColorBins, colorDistance * CudaShot::ColorBins,
+                            volume, ownWeight, adjacent, adjacentWeights);
+                }
+            }
+            __syncthreads();
+
+            // L2 normalization of the complete descriptor, as in PCL
+            float norm = 0;
+            for (int d = threadIdx.x; d < descriptorLength; d += blockDim.x)
+                norm += histograms[d] * histograms[d];
+            partialNorms[threadIdx.x] = norm;
+            __syncthreads();
+
+            for (int stride = blockDim.x / 2; stride > 0; stride /= 2)
+            {
+                if (threadIdx.x < stride)
+                    partialNorms[threadIdx.x] += partialNorms[threadIdx.x + stride];
+                __syncthreads();
+            }
+
+            const float scale = 1.0f / sqrtf(partialNorms[0]);
+            for (int d = threadIdx.x; d < descriptorLength; d += blockDim.x)
+                descriptor[d] = histograms[d] * scale;
+        }
+
+        template<typename T>
+        void uploadBuffer(T *&buffer, const T *data, size_t size)
+        {
+            cudaFree(buffer);
+            buffer = 0;
+            if (size == 0)
+                return;
+            checkCuda(cudaMalloc((void**)&buffer, size * sizeof(T)), "cudaMalloc");
+            checkCuda(cudaMemcpy(buffer, data, size * sizeof(T), cudaMemcpyHostToDevice), "cudaMemcpy");
+        }
+
+        void toFloat4(const float *data, int num, std::vector<float4> &result)
+        {
+            result.resize(num);
+            for (int i = 0; i < num; i++)
+                result[i] = make_float4(data[3 * i], data[3 * i + 1], data[3 * i + 2], 0);
+        }
+
+        void toLab(const unsigned char *rgb, int num, std::vector<float4> &result)
+        {
+            result.resize(num);
+            for (int i = 0; i < num; i++)
+                rgbToLab(rgb[3 * i], rgb[3 * i + 1], rgb[3 * i + 2], &result[i].x);
+        }
+    }
+
+    struct CudaShot::Impl
+    {
+        Impl()
+            : numPoints(0), points(0), normals(0), labs(0)
+        {
+        }
+
+        ~Impl()
+        {
+            cudaFree(points);
+            cudaFree(normals);
+            cudaFree(labs);
+        }
+
+        int numPoints;
+
+        // resident surface
+        float4 *points;
+        float4 *normals;
+        float4 *labs;
+
+        std::mutex mutex;
+    };
+
+    CudaShot::CudaShot()
+        : m_impl(new Impl())
+    {
+    }
+
+    CudaShot::~CudaShot()
+    {
+    }
+
+    bool CudaShot::isAvailable()
+    {
+        int count = 0;
+        return cudaGetDeviceCount(&count) == cudaSuccess && count > 0;
+    }
+
+    void CudaShot::upload(const float *points, const float *normals, const unsigned char *rgb, int numPoints)
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+
+        std::vector<float4> buffer;
+        toFloat4(points, numPoints, buffer);
+        uploadBuffer(m_impl->points, buffer.data(), buffer.size());
+
+        buffer.clear();
+        if (normals)
+            toFloat4(normals, numPoints, buffer);
+        uploadBuffer(m_impl->normals, buffer.data(), buffer.size());
+
+        // colors are converted once per point instead of once per neighborhood
+        buffer.clear();
+        if (rgb)
+            toLab(rgb, numPoints, buffer);
+        uploadBuffer(m_impl->labs, buffer.data(), buffer.size());
+
+        // the descriptors are computed on non-blocking streams, which do not wait for the default stream
+        checkCuda(cudaDeviceSynchronize(), "cudaDeviceSynchronize");
+        m_impl->numPoints = numPoints;
+    }
+
+    void CudaShot::compute(const float *keypoints, const unsigned char *keypointRgb, const float *frames, int numKeypoints,
+                           const int *offsets, const int *neighbors, const float *sqrDistances, float radius,
+                           float *descriptors) const
+    {
+        std::lock_guard<std::mutex> lock(m_impl->mutex);
+        if (numKeypoints == 0)
+            return;
+
+        const Impl &impl = *m_impl;
+        const bool color = impl.labs != 0;
+        const int descriptorLength = getDescriptorLength(color);
+        const int numNeighbors = offsets[numKeypoints];
+
+        // the inputs and the descriptors pass through the pinned buffers of the frame, the kernel runs on its stream
+        CudaFrame &frame = CudaFrame::get();
+        std::vector<float4> buffer;
+        toFloat4(keypoints, numKeypoints, buffer);
+        const float4 *deviceKeypoints = frame.upload(CudaFrame::Keypoints, buffer.data(), buffer.size());
+        const float4 *deviceKeypointLabs = 0;
+        if (color)
+        {
+            std::vector<float4> labs;
+            toLab(keypointRgb, numKeypoints, labs);
+            deviceKeypointLabs = frame.upload(CudaFrame::KeypointLabs, labs.data(), labs.size());
+        }
+        const float *deviceFrames = frame.upload(CudaFrame::Frames, frames, (size_t)numKeypoints * 9);
+        const int *deviceOffsets = frame.upload(CudaFrame::Offsets, offsets, (size_t)numKeypoints + 1);
+        const int *deviceNeighbors = frame.upload(CudaFrame::Neighbors, neighbors, (size_t)numNeighbors);
+        const float *deviceSqrDistances = frame.upload(CudaFrame::SqrDistances, sqrDistances, (size_t)numNeighbors);
+
+        const size_t descriptorsSize = (size_t)numKeypoints * descriptorLength;
+        float *deviceDescriptors = frame.device<float>(CudaFrame::Descriptors, descriptorsSize);
+
+        shotKernel<<<numKeypoints, BlockThreads, descriptorLength * sizeof(float), frame.getStream()>>>(
+            impl.points, impl.normals, impl.labs, deviceKeypoints, deviceKeypointLabs, deviceFrames, numKeypoints,
+            deviceOffsets, deviceNeighbors, deviceSqrDistances, radius, descriptorLength, deviceDescriptors);
+        checkCuda(cudaGetLastError(), "shotKernel");
+
+        const float *result = frame.download(CudaFrame::Descriptors, (const float*)deviceDescriptors, descriptorsSize);
+        frame.synchronize();
+        std::copy(result, result + descriptorsSize, descriptors);
+    }
+
+    bool CudaShot::hasColor() const
+    {
+        return m_impl->labs != 0;
+    }
+}
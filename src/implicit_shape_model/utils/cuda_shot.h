@@ -0,0 +1,87 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CUDA_SHOT_H
+#define ISM3D_CUDA_SHOT_H
+
+#include <memory>
+
+namespace ism3d
+{
+    /**
+     * @brief The CudaShot class
+     * Computes SHOT and color SHOT descriptors on the GPU with the same grid, interpolation and normalization
+     * as the PCL estimators. The surface is uploaded once, then the descriptors of all keypoints are computed
+     * in a single kernel launch with one thread block per keypoint that accumulates its histograms in shared
+     * memory. The neighborhoods are searched on the host and passed as a compressed list, so that the search
+     * of the pipeline (e.g. the neighborhood cache) is used. Keypoints with invalid reference frames or less
+     * than 5 neighbors get NaN descriptors, like in PCL. The keypoints and descriptors pass through the pinned
+     * buffers of the CudaFrame of the calling thread and the kernel runs on its stream, so that the frames of
+     * different threads overlap on the device.
+     * This header does not depend on CUDA, the implementation is only built with USE_CUDA.
+     */
+    class CudaShot
+    {
+    public:
+        static const int ShapeBins = 10;
+        static const int ColorBins = 30;
+        static const int GridSectors = 32;
+
+        // 352 values for shape only, 1344 values with color
+        static int getDescriptorLength(bool color)
+        {
+            return GridSectors * (ShapeBins + 1) + (color ? GridSectors * (ColorBins + 1) : 0);
+        }
+
+        CudaShot();
+        ~CudaShot();
+
+        /**
+         * @brief Check if a CUDA device is available.
+         */
+        static bool isAvailable();
+
+        /**
+         * @brief Copy the surface to the device, replacing a previous surface.
+         * @param points x, y and z of each point
+         * @param normals x, y and z of each normal, or 0 to describe the shape without normals as SHORT_SHOT does
+         * @param rgb red, green and blue of each point to compute color SHOT, or 0 for shape only
+         * @param numPoints the number of points
+         */
+        void upload(const float *points, const float *normals, const unsigned char *rgb, int numPoints);
+
+        /**
+         * @brief Compute the descriptors of all keypoints.
+         * @param keypoints x, y and z of each keypoint
+         * @param keypointRgb red, green and blue of each keypoint, only used with color
+         * @param frames x, y and z axis of the reference frame of each keypoint
+         * @param numKeypoints the number of keypoints
+         * @param offsets numKeypoints + 1 offsets into neighbors, the neighbors of keypoint i are in [offsets[i], offsets[i + 1])
+         * @param neighbors the surface point indices of the neighbors
+         * @param sqrDistances the squared distances of the neighbors to their keypoint
+         * @param radius the descriptor radius
+         * @param descriptors output: numKeypoints x getDescriptorLength(color) values
+         */
+        void compute(const float *keypoints, const unsigned char *keypointRgb, const float *frames, int numKeypoints,
+                     const int *offsets, const int *neighbors, const float *sqrDistances, float radius,
+                     float *descriptors) const;
+
+        bool hasColor() const;
+
+    private:
+        CudaShot(const CudaShot&);
+        CudaShot& operator=(const CudaShot&);
+
+        struct Impl;
+        std::unique_ptr<Impl> m_impl;
+    };
+}
+
+#endif // ISM3D_CUDA_SHOT_H
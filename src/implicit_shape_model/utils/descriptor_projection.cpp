@@ -0,0 +1,228 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "descriptor_projection.h"
+#include "exception.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+#include <Eigen/Core>
+#include <Eigen/Eigenvalues>
+
+namespace ism3d
+{
+    namespace
+    {
+        typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+    }
+
+    DescriptorProjection::DescriptorProjection()
+    {
+        clear();
+    }
+
+    void DescriptorProjection::clear()
+    {
+        m_input_dim = 0;
+        m_output_dim = 0;
+        m_whiten = false;
+        m_explained_variance = 0;
+        m_mean.clear();
+        m_components.clear();
+        m_offset.clear();
+    }
+
+    void DescriptorProjection::fit(const float *descriptors, int rows, int dim, float explainedVariance, int maxDim, bool whiten)
+    {
+        clear();
+        if (rows < 2 || dim <= 0)
+            return;
+
+        Eigen::Map<const RowMatrix> data(descriptors, rows, dim);
+        const Eigen::VectorXd mean = data.cast<double>().colwise().sum().transpose() / rows;
+
+        // the covariance is accumulated over blocks of centered descriptors
+        const int blockRows = 4096;
+        Eigen::MatrixXd covariance = Eigen::MatrixXd::Zero(dim, dim);
+        for (int begin = 0; begin < rows; begin += blockRows)
+        {
+            const int n = std::min(blockRows, rows - begin);
+            const Eigen::MatrixXd block = data.middleRows(begin, n).cast<double>().rowwise() - mean.transpose();
+            covariance.noalias() += block.transpose() * block;
+        }
+        covariance /= rows - 1;
+
+        // the eigenvalues are sorted in increasing order
+        Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(covariance);
+        if (solver.info() != Eigen::Success)
+        {
+            LOG_ERROR("could not compute the principal components of the descriptors");
+            return;
+        }
+        const Eigen::VectorXd eigenvalues = solver.eigenvalues().cwiseMax(0.0);
+        const double total = eigenvalues.sum();
+        if (total <= 0)
+        {
+            LOG_ERROR("the descriptors have no variance, no projection is fitted");
+            return;
+        }
+
+        const int limit = maxDim > 0 ? std::min(maxDim, dim) : dim;
+        int outputDim = 0;
+        double explained = 0;
+        while (outputDim < limit && (outputDim == 0 || explained < explainedVariance * total))
+        {
+            explained += eigenvalues(dim - 1 - outputDim);
+            outputDim++;
+        }
+
+        m_input_dim = dim;
+        m_output_dim = outputDim;
+        m_whiten = whiten;
+        m_explained_variance = (float)(explained / total);
+        m_mean.resize(dim);
+        for (int j = 0; j < dim; j++)
+            m_mean[j] = (float)mean(j);
+
+        // components with almost no variance are not amplified beyond the noise of the largest ones
+        const double minVariance = eigenvalues(dim - 1) * 1e-6;
+        m_components.resize((size_t)outputDim * dim);
+        for (int i = 0; i < outputDim; i++)
+        {
+            const double scale = whiten ? 1.0 / std::sqrt(std::max(eigenvalues(dim - 1 - i), minVariance)) : 1.0;
+            for (int j = 0; j < dim; j++)
+                m_components[(size_t)i * dim + j] = (float)(solver.eigenvectors()(j, dim - 1 - i) * scale);
+        }
+
+        m_offset.resize(outputDim);
+        Eigen::Map<Eigen::VectorXf>(m_offset.data(), outputDim) =
+                Eigen::Map<const RowMatrix>(m_components.data(), outputDim, dim) *
+                Eigen::Map<const Eigen::VectorXf>(m_mean.data(), dim);
+
+        LOG_INFO("descriptor projection from " << dim << " to " << outputDim << " dimensions explains " <<
+                 m_explained_variance * 100 << "% of the variance");
+    }
+
+    void DescriptorProjection::project(const float *descriptors, int rows, float *projected, int numThreads) const
+    {
+        // blocks of descriptors are multiplied with the components, each thread projects whole blocks
+        const int blockRows = 256;
+        const int numBlocks = (rows + blockRows - 1) / blockRows;
+        Eigen::Map<const RowMatrix> components(m_components.data(), m_output_dim, m_input_dim);
+        Eigen::Map<const Eigen::RowVectorXf> offset(m_offset.data(), m_output_dim);
+
+        #pragma omp parallel for schedule(dynamic) num_threads(numThreads > 0 ? numThreads : omp_get_max_threads())
+        for (int block = 0; block < numBlocks; block++)
+        {
+            const int begin = block * blockRows;
+            const int n = std::min(blockRows, rows - begin);
+            Eigen::Map<const RowMatrix> input(descriptors + (size_t)begin * m_input_dim, n, m_input_dim);
+            Eigen::Map<RowMatrix> output(projected + (size_t)begin * m_output_dim, n, m_output_dim);
+            output.noalias() = input * components.transpose();
+            output.rowwise() -= offset;
+        }
+    }
+
+    void DescriptorProjection::project(pcl::PointCloud<ISMFeature> &features, int numThreads) const
+    {
+        const int rows = (int)features.size();
+        std::vector<float> descriptors((size_t)rows * m_input_dim);
+        for (int i = 0; i < rows; i++)
+        {
+            const std::vector<float> &descriptor = features.points[i].descriptor;
+            if ((int)descriptor.size() != m_input_dim)
+                throw RuntimeException("descriptor size does not match the descriptor projection");
+            std::copy(descriptor.begin(), descriptor.end(), descriptors.begin() + (size_t)i * m_input_dim);
+        }
+
+        std::vector<float> projected((size_t)rows * m_output_dim);
+        project(descriptors.data(), rows, projected.data(), numThreads);
+        for (int i = 0; i < rows; i++)
+        {
+            features.points[i].descriptor.assign(projected.begin() + (size_t)i * m_output_dim,
+                                                 projected.begin() + (size_t)(i + 1) * m_output_dim);
+        }
+    }
+
+    void DescriptorProjection::saveData(boost::archive::binary_oarchive &oa) const
+    {
+        oa << m_input_dim;
+        oa << m_output_dim;
+        oa << m_whiten;
+        oa << m_explained_variance;
+        oa << m_mean;
+        oa << m_components;
+        oa << m_offset;
+    }
+
+    bool DescriptorProjection::loadData(boost::archive::binary_iarchive &ia)
+    {
+        ia >> m_input_dim;
+        ia >> m_output_dim;
+        ia >> m_whiten;
+        ia >> m_explained_variance;
+        ia >> m_mean;
+        ia >> m_components;
+        ia >> m_offset;
+        return (int)m_mean.size() == m_input_dim && (int)m_offset.size() == m_output_dim &&
+                m_components.size() == (size_t)m_output_dim * m_input_dim;
+    }
+
+    Json::Value DescriptorProjection::dataToJson() const
+    {
+        Json::Value data(Json::objectValue);
+        data["InputDim"] = m_input_dim;
+        data["OutputDim"] = m_output_dim;
+        data["Whiten"] = m_whiten;
+        data["ExplainedVariance"] = m_explained_variance;
+        Json::Value mean(Json::arrayValue);
+        for (float value : m_mean)
+            mean.append(value);
+        data["Mean"] = mean;
+        Json::Value components(Json::arrayValue);
+        for (float value : m_components)
+            components.append(value);
+        data["Components"] = components;
+        return data;
+    }
+
+    bool DescriptorProjection::dataFromJson(const Json::Value &object)
+    {
+        clear();
+        const Json::Value &mean = object["Mean"];
+        const Json::Value &components = object["Components"];
+        if (!object["InputDim"].isInt() || !object["OutputDim"].isInt() || !mean.isArray() || !components.isArray())
+            return false;
+
+        const int inputDim = object["InputDim"].asInt();
+        const int outputDim = object["OutputDim"].asInt();
+        if ((int)mean.size() != inputDim || components.size() != (Json::ArrayIndex)(outputDim * inputDim))
+            return false;
+
+        m_input_dim = inputDim;
+        m_output_dim = outputDim;
+        m_whiten = object["Whiten"].asBool();
+        m_explained_variance = object["ExplainedVariance"].asFloat();
+        for (Json::ArrayIndex j = 0; j < mean.size(); j++)
+            m_mean.push_back(mean[j].asFloat());
+        for (Json::ArrayIndex j = 0; j < components.size(); j++)
+            m_components.push_back(components[j].asFloat());
+
+        // the offset is not stored, it follows from the mean and the components
+        m_offset.resize(outputDim);
+        Eigen::Map<Eigen::VectorXf>(m_offset.data(), outputDim) =
+                Eigen::Map<const RowMatrix>(m_components.data(), outputDim, inputDim) *
+                Eigen::Map<const Eigen::VectorXf>(m_mean.data(), inputDim);
+        return true;
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DESCRIPTOR_PROJECTION_H
+#define ISM3D_DESCRIPTOR_PROJECTION_H
+
+#include <vector>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <jsoncpp/json/json.h>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The DescriptorProjection class
+     * Learned linear projection of local descriptors onto their principal components. The principal components are
+     * fitted on training descriptors, the number of components is the smallest that explains the requested
+     * fraction of the variance, optionally limited. With whitening, each component is scaled to unit variance.
+     * Descriptors are projected in blocks with a matrix product, so that the projection of many descriptors uses
+     * the vectorized matrix multiplication of Eigen.
+     */
+    class DescriptorProjection
+    {
+    public:
+        DescriptorProjection();
+
+        /**
+         * @brief Fit the projection.
+         * @param descriptors the training descriptors, one after another
+         * @param rows the number of descriptors
+         * @param dim the descriptor dimension
+         * @param explainedVariance the fraction of the variance the components explain, 1 keeps all components
+         * @param maxDim the maximal number of components, 0 for no limit
+         * @param whiten scale the components to unit variance
+         */
+        void fit(const float *descriptors, int rows, int dim, float explainedVariance, int maxDim, bool whiten);
+
+        bool isTrained() const
+        {
+            return m_output_dim > 0;
+        }
+
+        int getInputDim() const
+        {
+            return m_input_dim;
+        }
+
+        int getOutputDim() const
+        {
+            return m_output_dim;
+        }
+
+        // the fraction of the variance of the training descriptors explained by the components
+        float getExplainedVariance() const
+        {
+            return m_explained_variance;
+        }
+
+        // project rows descriptors of getInputDim() values to getOutputDim() values each
+        void project(const float *descriptors, int rows, float *projected, int numThreads) const;
+
+        // replace the descriptors of features by their projections, throws if a descriptor has another dimension
+        void project(pcl::PointCloud<ISMFeature> &features, int numThreads) const;
+
+        void clear();
+
+        void saveData(boost::archive::binary_oarchive &oa) const;
+        bool loadData(boost::archive::binary_iarchive &ia);
+
+        Json::Value dataToJson() const;
+        bool dataFromJson(const Json::Value &object);
+
+    private:
+        int m_input_dim;
+        int m_output_dim;
+        bool m_whiten;
+        float m_explained_variance;
+        std::vector<float> m_mean;
+        std::vector<float> m_components; // getOutputDim() rows of getInputDim() values, scaled when whitening
+        std::vector<float> m_offset; // the projection of the mean, subtracted from the products
+    };
+}
+
+#endif // ISM3D_DESCRIPTOR_PROJECTION_H
@@ -0,0 +1,160 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "detection_arena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace ism3d
+{
+    namespace
+    {
+        const std::size_t MinBlockSize = 64 * 1024;
+
+        std::atomic<unsigned long long> nextArenaId(1);
+
+        // the sub-arena the calling thread used last, valid while the arena and its generation match
+        struct ThreadCache
+        {
+            unsigned long long arenaId;
+            unsigned generation;
+            void *subArena;
+        };
+        thread_local ThreadCache threadCache = {0, 0, 0};
+    }
+
+    class DetectionArena::SubArena
+    {
+    public:
+        SubArena()
+            : m_offset(0)
+        {
+        }
+
+        void* allocate(std::size_t bytes, std::size_t alignment)
+        {
+            if (!m_blocks.empty())
+            {
+                void *result = allocateFromLast(bytes, alignment);
+                if (result)
+                    return result;
+            }
+
+            // blocks grow geometrically, so that a sub-arena holds few blocks
+            std::size_t size = std::max(MinBlockSize, bytes + alignment);
+            if (!m_blocks.empty())
+                size = std::max(size, 2 * m_blocks.back().size);
+            addBlock(size);
+            return allocateFromLast(bytes, alignment);
+        }
+
+        void reset()
+        {
+            // the blocks are joined, so that the next detection of the same size fits into a single block
+            if (m_blocks.size() > 1)
+            {
+                std::size_t size = getCapacity();
+                m_blocks.clear();
+                addBlock(size);
+            }
+            m_offset = 0;
+        }
+
+        std::size_t getCapacity() const
+        {
+            std::size_t capacity = 0;
+            for (const Block &block : m_blocks)
+                capacity += block.size;
+            return capacity;
+        }
+
+    private:
+        struct Block
+        {
+            std::unique_ptr<char[]> data;
+            std::size_t size;
+        };
+
+        void addBlock(std::size_t size)
+        {
+            Block block;
+            block.data.reset(new char[size]);
+            block.size = size;
+            m_blocks.push_back(std::move(block));
+            m_offset = 0;
+        }
+
+        void* allocateFromLast(std::size_t bytes, std::size_t alignment)
+        {
+            const Block &block = m_blocks.back();
+            const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+            const std::uintptr_t aligned = (base + m_offset + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+            const std::size_t offset = aligned - base;
+            if (offset + bytes > block.size)
+                return 0;
+            m_offset = offset + bytes;
+            return block.data.get() + offset;
+        }
+
+        std::vector<Block> m_blocks;
+        std::size_t m_offset; // first free byte of the last block
+    };
+
+    DetectionArena::DetectionArena()
+        : m_id(nextArenaId++), m_generation(0), m_num_used(0)
+    {
+    }
+
+    DetectionArena::~DetectionArena()
+    {
+    }
+
+    void* DetectionArena::allocate(std::size_t bytes, std::size_t alignment)
+    {
+        return getLocal()->allocate(bytes, alignment);
+    }
+
+    void DetectionArena::reset()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (std::size_t i = 0; i < m_num_used; i++)
+            m_sub_arenas[i]->reset();
+        m_num_used = 0;
+        m_generation++;
+    }
+
+    std::size_t DetectionArena::getCapacity() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::size_t capacity = 0;
+        for (const std::unique_ptr<SubArena> &subArena : m_sub_arenas)
+            capacity += subArena->getCapacity();
+        return capacity;
+    }
+
+    DetectionArena::SubArena* DetectionArena::getLocal()
+    {
+        if (threadCache.arenaId == m_id && threadCache.generation == m_generation)
+            return static_cast<SubArena*>(threadCache.subArena);
+
+        // the first allocation of the thread since the last reset takes the next free sub-arena
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_num_used == m_sub_arenas.size())
+            m_sub_arenas.push_back(std::unique_ptr<SubArena>(new SubArena()));
+        SubArena *subArena = m_sub_arenas[m_num_used++].get();
+
+        threadCache.arenaId = m_id;
+        threadCache.generation = m_generation;
+        threadCache.subArena = subArena;
+        return subArena;
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DETECTION_ARENA_H
+#define ISM3D_DETECTION_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The DetectionArena class
+     * Monotonic memory for the temporaries of a detection. Every thread that allocates gets its own sub-arena, so
+     * threads neither lock nor share cache lines while allocating. Memory is never freed individually, reset()
+     * releases all allocations at once and keeps the memory for the next detection: the blocks of a sub-arena are
+     * joined into one block of the size used so far, so that after the first detections no more memory is
+     * requested from the system. reset() must not be called while the arena is used by other threads.
+     */
+    class DetectionArena
+    {
+    public:
+        DetectionArena();
+        ~DetectionArena();
+
+        /**
+         * @brief Allocate memory from the sub-arena of the calling thread.
+         * @param bytes the number of bytes
+         * @param alignment the alignment, a power of two
+         * @return the memory, valid until the next reset()
+         */
+        void* allocate(std::size_t bytes, std::size_t alignment);
+
+        /**
+         * @brief Release all allocations, the memory is kept for the next allocations.
+         */
+        void reset();
+
+        /**
+         * @brief Get the bytes held by all sub-arenas.
+         */
+        std::size_t getCapacity() const;
+
+    private:
+        DetectionArena(const DetectionArena&) = delete;
+        DetectionArena& operator=(const DetectionArena&) = delete;
+
+        class SubArena;
+        SubArena* getLocal();
+
+        const unsigned long long m_id; // unique over all arenas, identifies the arena in the thread caches
+        unsigned m_generation; // incremented by reset(), invalidates the sub-arenas cached by the threads
+        std::vector<std::unique_ptr<SubArena> > m_sub_arenas;
+        std::size_t m_num_used; // sub-arenas handed out to threads since the last reset
+        mutable std::mutex m_mutex;
+    };
+
+    /**
+     * @brief The ArenaAllocator class
+     * Standard allocator that allocates from a DetectionArena, from the sub-arena of the allocating thread.
+     * Containers can thus be filled by any thread. Deallocation does nothing, the memory is released by the next
+     * reset() of the arena, which must outlive the containers. Without an arena the global heap is used.
+     */
+    template<typename T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_move_assignment;
+        typedef std::true_type propagate_on_container_swap;
+
+        ArenaAllocator(DetectionArena *arena = 0)
+            : m_arena(arena)
+        {
+        }
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other)
+            : m_arena(other.getArena())
+        {
+        }
+
+        T* allocate(std::size_t n)
+        {
+            if (!m_arena)
+                return static_cast<T*>(::operator new(n * sizeof(T)));
+            return static_cast<T*>(m_arena->allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *p, std::size_t)
+        {
+            if (!m_arena)
+                ::operator delete(p);
+        }
+
+        DetectionArena* getArena() const
+        {
+            return m_arena;
+        }
+
+    private:
+        DetectionArena *m_arena;
+    };
+
+    template<typename T, typename U>
+    bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.getArena() == b.getArena();
+    }
+
+    template<typename T, typename U>
+    bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b)
+    {
+        return a.getArena() != b.getArena();
+    }
+
+    template<typename T>
+    using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+}
+
+#endif // ISM3D_DETECTION_ARENA_H
@@ -0,0 +1,249 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "detection_cost_model.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <fstream>
+#include <set>
+
+namespace ism3d
+{
+    namespace
+    {
+        // the quantity each stage depends on, stages of the index are built once and not modeled
+        enum Driver
+        {
+            Points,
+            Keypoints,
+            Votes
+        };
+
+        const std::vector<std::pair<std::string, Driver> >& getStageDrivers()
+        {
+            static const std::vector<std::pair<std::string, Driver> > drivers = {
+                {"voxel_filtering", Points}, {"normals", Points}, {"keypoints", Points},
+                {"descriptors", Keypoints}, {"global_descriptors", Keypoints}, {"activation", Keypoints},
+                {"votes", Votes}, {"maxima", Votes}, {"other", Points}};
+            return drivers;
+        }
+
+        // the input points, the points without NaNs and their normals
+        const double bytesPerPoint = sizeof(PointNormalT) + sizeof(PointT) + sizeof(pcl::Normal);
+
+        double getValue(const std::map<std::string, double> &values, const std::string &name)
+        {
+            std::map<std::string, double>::const_iterator it = values.find(name);
+            return it != values.end() ? it->second : 0;
+        }
+    }
+
+    DetectionCostModel::DetectionCostModel()
+        : m_valid(false), m_keypoints_per_point(0), m_votes_per_keypoint(0), m_bytes_per_vote(0),
+          m_model_bytes(0), m_codebook_size(0), m_num_classes(0)
+    {
+    }
+
+    void DetectionCostModel::addSample(const DetectionStatistics &statistics)
+    {
+        Sample sample;
+        sample.points = getValue(statistics.counters, "points");
+        sample.keypoints = getValue(statistics.counters, "keypoints");
+        sample.votes = getValue(statistics.counters, "votes");
+        sample.voteBytes = getValue(statistics.counters, "vote_bytes");
+
+        // the time of the detection that is not covered by a modeled stage
+        double other = getValue(statistics.times, "detection") - getValue(statistics.times, "index");
+        for (const std::pair<std::string, Driver> &stage : getStageDrivers())
+        {
+            if (stage.first == "other")
+                continue;
+            sample.times[stage.first] = getValue(statistics.times, stage.first);
+            other -= sample.times[stage.first];
+        }
+        sample.times["other"] = std::max(other, 0.0);
+        m_samples.push_back(sample);
+    }
+
+    bool DetectionCostModel::fit(std::size_t modelBytes, int codebookSize, int numClasses)
+    {
+        std::set<double> sizes;
+        for (const Sample &sample : m_samples)
+            sizes.insert(sample.points);
+        if (sizes.size() < 2)
+        {
+            LOG_WARN("the cost model needs detections of at least two input sizes");
+            return false;
+        }
+
+        std::vector<double> points, keypoints, votes, voteBytes;
+        for (const Sample &sample : m_samples)
+        {
+            points.push_back(sample.points);
+            keypoints.push_back(sample.keypoints);
+            votes.push_back(sample.votes);
+            voteBytes.push_back(sample.voteBytes);
+        }
+        m_keypoints_per_point = fitRatio(points, keypoints);
+        m_votes_per_keypoint = fitRatio(keypoints, votes);
+        m_bytes_per_vote = fitRatio(votes, voteBytes);
+
+        m_stages.clear();
+        for (const std::pair<std::string, Driver> &stage : getStageDrivers())
+        {
+            const std::vector<double> &x = stage.second == Points ? points : (stage.second == Keypoints ? keypoints : votes);
+            std::vector<double> y;
+            for (const Sample &sample : m_samples)
+                y.push_back(sample.times.at(stage.first));
+            m_stages[stage.first] = fitLine(x, y);
+        }
+
+        m_model_bytes = modelBytes;
+        m_codebook_size = codebookSize;
+        m_num_classes = numClasses;
+        m_valid = true;
+        return true;
+    }
+
+    DetectionCost DetectionCostModel::estimate(int numPoints) const
+    {
+        DetectionCost cost;
+        if (!m_valid)
+            return cost;
+
+        cost.numKeypoints = m_keypoints_per_point * numPoints;
+        cost.numVotes = m_votes_per_keypoint * cost.numKeypoints;
+        for (const std::pair<std::string, Driver> &stage : getStageDrivers())
+        {
+            std::map<std::string, Line>::const_iterator it = m_stages.find(stage.first);
+            if (it == m_stages.end())
+                continue;
+
+            const double x = stage.second == Points ? numPoints : (stage.second == Keypoints ? cost.numKeypoints : cost.numVotes);
+            const double milliseconds = std::max(it->second.intercept + it->second.slope * x, 0.0);
+            cost.stageMilliseconds[stage.first] = milliseconds;
+            cost.milliseconds += milliseconds;
+        }
+        cost.bytes = m_model_bytes + (std::size_t)(cost.numVotes * m_bytes_per_vote + numPoints * bytesPerPoint);
+        return cost;
+    }
+
+    bool DetectionCostModel::isValid() const
+    {
+        return m_valid;
+    }
+
+    Json::Value DetectionCostModel::toJson() const
+    {
+        Json::Value json(Json::objectValue);
+        json["keypoints_per_point"] = m_keypoints_per_point;
+        json["votes_per_keypoint"] = m_votes_per_keypoint;
+        json["bytes_per_vote"] = m_bytes_per_vote;
+        json["model_bytes"] = (Json::UInt64)m_model_bytes;
+        json["codebook_size"] = m_codebook_size;
+        json["classes"] = m_num_classes;
+        json["samples"] = (Json::UInt64)m_samples.size();
+        json["stages"] = Json::Value(Json::objectValue);
+        for (const std::pair<const std::string, Line> &stage : m_stages)
+        {
+            json["stages"][stage.first]["intercept_ms"] = stage.second.intercept;
+            json["stages"][stage.first]["slope_ms"] = stage.second.slope;
+        }
+        return json;
+    }
+
+    bool DetectionCostModel::fromJson(const Json::Value &json)
+    {
+        m_valid = false;
+        if (!json.isObject() || !json["stages"].isObject())
+            return false;
+
+        m_keypoints_per_point = json["keypoints_per_point"].asDouble();
+        m_votes_per_keypoint = json["votes_per_keypoint"].asDouble();
+        m_bytes_per_vote = json["bytes_per_vote"].asDouble();
+        m_model_bytes = (std::size_t)json["model_bytes"].asUInt64();
+        m_codebook_size = json["codebook_size"].asInt();
+        m_num_classes = json["classes"].asInt();
+        m_stages.clear();
+        for (const std::string &name : json["stages"].getMemberNames())
+        {
+            const Json::Value &stage = json["stages"][name];
+            Line line = {stage["intercept_ms"].asDouble(), stage["slope_ms"].asDouble()};
+            m_stages[name] = line;
+        }
+        m_valid = true;
+        return true;
+    }
+
+    bool DetectionCostModel::save(const std::string &filename) const
+    {
+        std::ofstream file(filename.c_str());
+        if (!file)
+            return false;
+        Json::StyledWriter writer;
+        file << writer.write(toJson());
+        return (bool)file;
+    }
+
+    bool DetectionCostModel::load(const std::string &filename)
+    {
+        std::ifstream file(filename.c_str());
+        Json::Value json;
+        Json::Reader reader;
+        if (!file || !reader.parse(file, json))
+            return false;
+        return fromJson(json);
+    }
+
+    std::string DetectionCostModel::getFilename(const std::string &ismFile)
+    {
+        return ismFile + ".cost.json";
+    }
+
+    DetectionCostModel::Line DetectionCostModel::fitLine(const std::vector<double> &x, const std::vector<double> &y)
+    {
+        // least squares, a negative slope from noisy samples is replaced by the mean
+        const double n = (double)x.size();
+        double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+        for (std::size_t i = 0; i < x.size(); i++)
+        {
+            sumX += x[i];
+            sumY += y[i];
+            sumXX += x[i] * x[i];
+            sumXY += x[i] * y[i];
+        }
+
+        Line line = {n > 0 ? sumY / n : 0, 0};
+        const double denominator = n * sumXX - sumX * sumX;
+        if (denominator > 0)
+        {
+            const double slope = (n * sumXY - sumX * sumY) / denominator;
+            if (slope > 0)
+            {
+                line.slope = slope;
+                line.intercept = (sumY - slope * sumX) / n;
+            }
+        }
+        return line;
+    }
+
+    double DetectionCostModel::fitRatio(const std::vector<double> &x, const std::vector<double> &y)
+    {
+        // least squares through the origin
+        double sumXX = 0, sumXY = 0;
+        for (std::size_t i = 0; i < x.size(); i++)
+        {
+            sumXX += x[i] * x[i];
+            sumXY += x[i] * y[i];
+        }
+        return sumXX > 0 ? sumXY / sumXX : 0;
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DETECTION_COST_MODEL_H
+#define ISM3D_DETECTION_COST_MODEL_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <jsoncpp/json/json.h>
+
+#include "detection_trace.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The DetectionCost struct
+     * The predicted wall time and memory of a detection.
+     */
+    struct DetectionCost
+    {
+        DetectionCost() : milliseconds(0), numKeypoints(0), numVotes(0), bytes(0) {}
+
+        double milliseconds;
+        std::map<std::string, double> stageMilliseconds;
+        double numKeypoints;
+        double numVotes;
+        std::size_t bytes; // the loaded model and the data of the detection
+    };
+
+    /**
+     * @brief The DetectionCostModel class
+     * Predicts the cost of a detection from the number of input points on the hardware it was calibrated on. The
+     * keypoints are modeled proportional to the points and the votes proportional to the keypoints. Each stage is a
+     * linear function of the quantity that drives it: the points for the filtering, normals and keypoints, the
+     * keypoints for the descriptors and the activation, the votes for the voting and the maxima. The codebook size
+     * and the classes are those of the calibrated model, a model is only valid for that model.
+     */
+    class DetectionCostModel
+    {
+    public:
+        DetectionCostModel();
+
+        /**
+         * @brief Add the statistics of a detection to the calibration.
+         * @param statistics the statistics, see ImplicitShapeModel::getLastDetectionStatistics()
+         */
+        void addSample(const DetectionStatistics &statistics);
+
+        /**
+         * @brief Fit the model to the samples added so far.
+         * @param modelBytes the memory used by the loaded model
+         * @param codebookSize the number of codewords of the model
+         * @param numClasses the number of classes of the model
+         * @return false if the samples do not cover at least two input sizes
+         */
+        bool fit(std::size_t modelBytes, int codebookSize, int numClasses);
+
+        /**
+         * @brief Predict the cost of a detection.
+         * @param numPoints the number of input points
+         * @return the predicted cost, zero if the model is not valid
+         */
+        DetectionCost estimate(int numPoints) const;
+
+        bool isValid() const;
+
+        Json::Value toJson() const;
+        bool fromJson(const Json::Value &json);
+
+        bool save(const std::string &filename) const;
+        bool load(const std::string &filename);
+
+        // the file of the cost model stored alongside an ism file
+        static std::string getFilename(const std::string &ismFile);
+
+    private:
+        struct Line
+        {
+            double intercept;
+            double slope;
+        };
+
+        struct Sample
+        {
+            double points;
+            double keypoints;
+            double votes;
+            double voteBytes;
+            std::map<std::string, double> times;
+        };
+
+        static Line fitLine(const std::vector<double> &x, const std::vector<double> &y);
+        static double fitRatio(const std::vector<double> &x, const std::vector<double> &y);
+
+        std::vector<Sample> m_samples;
+        bool m_valid;
+        double m_keypoints_per_point;
+        double m_votes_per_keypoint;
+        double m_bytes_per_vote;
+        std::size_t m_model_bytes;
+        int m_codebook_size;
+        int m_num_classes;
+        std::map<std::string, Line> m_stages;
+    };
+}
+
+#endif // ISM3D_DETECTION_COST_MODEL_H
@@ -0,0 +1,142 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "detection_trace.h"
+
+#include <algorithm>
+#include <jsoncpp/json/json.h>
+
+namespace ism3d
+{
+    namespace
+    {
+        // the timestamps of all traces share this origin, so that consecutive detections follow each other
+        std::chrono::steady_clock::time_point getEpoch()
+        {
+            static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+            return epoch;
+        }
+
+        void writeEvent(std::ostream &stream, const Json::Value &event, bool &first)
+        {
+            Json::FastWriter writer;
+            std::string line = writer.write(event);
+            if (!first)
+                stream << ",";
+            stream << line;
+            first = false;
+        }
+    }
+
+    DetectionTrace::Stage::Stage(DetectionTrace *trace, const std::string &name)
+        : m_trace(trace), m_stopped(trace == 0)
+    {
+        if (m_trace)
+        {
+            m_name = name;
+            m_marker.next(m_name.c_str());
+            m_start = std::chrono::steady_clock::now();
+            m_timer.start();
+        }
+    }
+
+    DetectionTrace::Stage::~Stage()
+    {
+        stop();
+    }
+
+    void DetectionTrace::Stage::stop()
+    {
+        if (m_stopped)
+            return;
+        m_timer.stop();
+        m_marker.stop();
+        m_trace->addSpan(m_name, m_start, m_timer.elapsed());
+        m_stopped = true;
+    }
+
+    DetectionTrace::DetectionTrace()
+    {
+        getEpoch();
+    }
+
+    void DetectionTrace::addCounter(const std::string &name, double value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_counters[name] += value;
+    }
+
+    void DetectionTrace::setCounter(const std::string &name, double value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_counters[name] = value;
+    }
+
+    DetectionStatistics DetectionTrace::getStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        DetectionStatistics statistics;
+        for (const Span &span : m_spans)
+        {
+            statistics.times[span.name] += span.wall / 1000.0;
+            statistics.cpuTimes[span.name] += span.cpu / 1000.0;
+        }
+        statistics.counters = m_counters;
+        return statistics;
+    }
+
+    void DetectionTrace::writeChromeTrace(std::ostream &stream, bool first, int processId) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // complete events, the cpu time is an argument
+        int64_t end = 0;
+        for (const Span &span : m_spans)
+        {
+            Json::Value event(Json::objectValue);
+            event["name"] = span.name;
+            event["ph"] = "X";
+            event["pid"] = processId;
+            event["tid"] = span.threadIndex;
+            event["ts"] = (Json::Int64)span.start;
+            event["dur"] = (Json::Int64)span.wall;
+            event["args"]["cpu_ms"] = span.cpu / 1000.0;
+            writeEvent(stream, event, first);
+            end = std::max(end, span.start + span.wall);
+        }
+
+        // counters are shown at the end of the detection
+        for (const std::pair<const std::string, double> &counter : m_counters)
+        {
+            Json::Value event(Json::objectValue);
+            event["name"] = counter.first;
+            event["ph"] = "C";
+            event["pid"] = processId;
+            event["ts"] = (Json::Int64)end;
+            event["args"]["value"] = counter.second;
+            writeEvent(stream, event, first);
+        }
+        stream.flush();
+    }
+
+    void DetectionTrace::addSpan(const std::string &name, std::chrono::steady_clock::time_point start,
+                                 const boost::timer::cpu_times &elapsed)
+    {
+        Span span;
+        span.name = name;
+        span.start = std::chrono::duration_cast<std::chrono::microseconds>(start - getEpoch()).count();
+        span.wall = elapsed.wall / 1000;
+        span.cpu = (elapsed.user + elapsed.system) / 1000;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        span.threadIndex = m_threads.insert({std::this_thread::get_id(), (int)m_threads.size()}).first->second;
+        m_spans.push_back(span);
+    }
+}
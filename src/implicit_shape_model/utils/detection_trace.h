@@ -0,0 +1,128 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DETECTION_TRACE_H
+#define ISM3D_DETECTION_TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/timer/timer.hpp>
+
+#include "profiler_markers.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The DetectionStatistics struct
+     * The measurements of a single detection: wall and cpu times in milliseconds summed per stage and the work
+     * counters. The cpu time is the time of the whole process while the stage ran, parallel loops add up the time
+     * of all their threads.
+     */
+    struct DetectionStatistics
+    {
+        std::map<std::string, double> times;
+        std::map<std::string, double> cpuTimes;
+        std::map<std::string, double> counters;
+    };
+
+    /**
+     * @brief The DetectionTrace class
+     * Records the stages of a single detection with the thread that ran them, and counters of the work done.
+     * Stages are measured by scoped DetectionTrace::Stage objects and may be recorded concurrently from several
+     * threads. The trace can be appended to a file in the Chrome trace event format (chrome://tracing, Perfetto).
+     */
+    class DetectionTrace
+    {
+    public:
+        /**
+         * @brief The Stage class
+         * Measures the time from its construction to its destruction or to stop(), without a trace it does nothing.
+         * With profiler markers compiled in, the stage is marked for external profilers as well, see ProfilerStage.
+         */
+        class Stage
+        {
+        public:
+            Stage(DetectionTrace *trace, const std::string &name);
+            ~Stage();
+
+            // records the stage if not stopped before
+            void stop();
+
+        private:
+            Stage(const Stage&) = delete;
+            Stage& operator=(const Stage&) = delete;
+
+            DetectionTrace *m_trace;
+            std::string m_name;
+            std::chrono::steady_clock::time_point m_start;
+            boost::timer::cpu_timer m_timer;
+            bool m_stopped;
+            ProfilerStage m_marker;
+        };
+
+        DetectionTrace();
+
+        /**
+         * @brief Add a value to a counter, counters start at 0.
+         * @param name the counter name
+         * @param value the value to add
+         */
+        void addCounter(const std::string &name, double value);
+
+        /**
+         * @brief Set a counter to a value.
+         * @param name the counter name
+         * @param value the value
+         */
+        void setCounter(const std::string &name, double value);
+
+        /**
+         * @brief Sum up the stages by name.
+         * @return the times and counters of this trace
+         */
+        DetectionStatistics getStatistics() const;
+
+        /**
+         * @brief Write the stages and counters as events of the Chrome trace event format. The events are written as
+         * elements of the array format, the array itself is opened by the caller and may be left unterminated.
+         * @param stream the output stream
+         * @param first whether these are the first events in the array
+         * @param processId the process id of the events, e.g. to separate detections
+         */
+        void writeChromeTrace(std::ostream &stream, bool first, int processId) const;
+
+    private:
+        struct Span
+        {
+            std::string name;
+            int threadIndex;
+            int64_t start; // microseconds since the first trace of the process
+            int64_t wall;  // microseconds
+            int64_t cpu;   // microseconds
+        };
+
+        void addSpan(const std::string &name, std::chrono::steady_clock::time_point start,
+                     const boost::timer::cpu_times &elapsed);
+
+        mutable std::mutex m_mutex;
+        std::vector<Span> m_spans;
+        std::map<std::thread::id, int> m_threads; // threads are numbered in the order of their first stage
+        std::map<std::string, double> m_counters;
+    };
+}
+
+#endif // ISM3D_DETECTION_TRACE_H
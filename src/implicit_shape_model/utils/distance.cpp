@@ -13,23 +13,32 @@
 namespace ism3d
 {
     // Distance
-    Distance::Distance()
+    Distance::Distance(DistanceKernels::Kernel kernel)
+        : m_generic_kernel(kernel), m_kernel(kernel)
     {
     }
 
+    void Distance::setDimension(int dim)
+    {
+        m_kernel = DistanceKernels::specialize(m_generic_kernel, dim);
+    }
+
     float Distance::operator()(const Eigen::VectorXf& vec1, const Eigen::VectorXf& vec2) const
     {
-        std::vector<float> data1(vec1.data(), vec1.data() + vec1.size());
-        std::vector<float> data2(vec2.data(), vec2.data() + vec2.size());
-        return getDistance(data1, data2);
+        return m_kernel(vec1.data(), vec2.data(), (int)vec1.size());
     }
 
     float Distance::operator()(const std::vector<float>& data1, const std::vector<float>& data2) const
     {
-        return getDistance(data1, data2);
+        return m_kernel(data1.data(), data2.data(), (int)data1.size());
     }
 
     // DistanceEuclidean
+    DistanceEuclidean::DistanceEuclidean()
+        : Distance(DistanceKernels::euclidean())
+    {
+    }
+
     std::string DistanceEuclidean::getType() const
     {
         return DistanceEuclidean::getTypeStatic();
@@ -40,12 +49,12 @@ namespace ism3d
         return "Euclidean";
     }
 
-    float DistanceEuclidean::getDistance(const std::vector<float>& data1, const std::vector<float>& data2) const
+    // DistanceChiSquared
+    DistanceChiSquared::DistanceChiSquared()
+        : Distance(DistanceKernels::chiSquared())
     {
-        return distance(data1.begin(), data2.begin(), data1.size());
     }
 
-    // DistanceChiSquared
     std::string DistanceChiSquared::getType() const
     {
         return DistanceChiSquared::getTypeStatic();
@@ -56,12 +65,12 @@ namespace ism3d
         return "ChiSquared";
     }
 
-    float DistanceChiSquared::getDistance(const std::vector<float>& data1, const std::vector<float>& data2) const
+    // DistanceHellinger
+    DistanceHellinger::DistanceHellinger()
+        : Distance(DistanceKernels::hellinger())
     {
-        return distance(data1.begin(), data2.begin(), data1.size());
     }
 
-    // DistanceHellinger
     std::string DistanceHellinger::getType() const
     {
         return DistanceHellinger::getTypeStatic();
@@ -72,12 +81,12 @@ namespace ism3d
         return "Hellinger";
     }
 
-    float DistanceHellinger::getDistance(const std::vector<float>& data1, const std::vector<float>& data2) const
+    // DistanceHistIntersection
+    DistanceHistIntersection::DistanceHistIntersection()
+        : Distance(DistanceKernels::histIntersection())
     {
-        return distance(data1.begin(), data2.begin(), data1.size());
     }
 
-    // DistanceHistIntersection
     std::string DistanceHistIntersection::getType() const
     {
         return DistanceHistIntersection::getTypeStatic();
@@ -88,8 +97,19 @@ namespace ism3d
         return "HistIntersection";
     }
 
-    float DistanceHistIntersection::getDistance(const std::vector<float>& data1, const std::vector<float>& data2) const
+    // DistanceHamming
+    DistanceHamming::DistanceHamming()
+        : Distance(DistanceKernels::hamming())
+    {
+    }
+
+    std::string DistanceHamming::getType() const
+    {
+        return DistanceHamming::getTypeStatic();
+    }
+
+    std::string DistanceHamming::getTypeStatic()
     {
-        return distance(data1.begin(), data2.begin(), data1.size());
+        return "Hamming";
     }
 }
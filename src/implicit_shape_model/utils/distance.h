@@ -14,12 +14,39 @@
 #include <vector>
 #include <flann/flann.hpp>
 #include <Eigen/Core>
+#include "distance_kernels.h"
 
 namespace ism3d
 {
+    /**
+     * @brief The BinaryHamming struct
+     * flann style distance functor for binary descriptors that are stored as floats with values 0 and 1.
+     * Values above 0.5 are set bits, the result is the number of differing bits.
+     */
+    template<class T>
+    struct BinaryHamming
+    {
+        typedef T ElementType;
+        typedef float ResultType;
+
+        template<typename Iterator1, typename Iterator2>
+        ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType /*worst_dist*/ = -1) const
+        {
+            ResultType result = 0;
+            for (size_t i = 0; i < size; i++)
+            {
+                if ((a[i] > 0.5f) != (b[i] > 0.5f))
+                    result += 1;
+            }
+            return result;
+        }
+    };
+
     /**
      * @brief The Distance struct
-     * The distance base class.
+     * The distance base class. The distance is computed by a vectorized kernel that is selected once at
+     * runtime and specialized for the descriptor dimension, the pointer overload avoids copies and can be used
+     * in inner loops.
      */
     struct Distance
     {
@@ -29,10 +56,20 @@ namespace ism3d
         float operator()(const Eigen::VectorXf&, const Eigen::VectorXf&) const;
         float operator()(const std::vector<float>&, const std::vector<float>&) const;
 
+        float operator()(const float *data1, const float *data2, int size) const
+        {
+            return m_kernel(data1, data2, size);
+        }
+
+        // selects the kernel unrolled for the descriptor dimension, if there is one; distances of other sizes
+        // are still computed. Must not be called while the distance is in use.
+        void setDimension(int dim);
+
     protected:
-        Distance();
+        Distance(DistanceKernels::Kernel kernel);
 
-        virtual float getDistance(const std::vector<float>&, const std::vector<float>&) const = 0;
+        DistanceKernels::Kernel m_generic_kernel;
+        DistanceKernels::Kernel m_kernel;
     };
 
     /**
@@ -44,14 +81,10 @@ namespace ism3d
     {
         typedef flann::L2<typename Distance::ElementType> DistanceType;
 
+        DistanceEuclidean();
+
         std::string getType() const;
         static std::string getTypeStatic();
-
-    protected:
-        float getDistance(const std::vector<float>&, const std::vector<float>&) const;
-
-    private:
-        DistanceType distance;
     };
 
 
@@ -64,14 +97,10 @@ namespace ism3d
     {
         typedef flann::ChiSquareDistance<typename Distance::ElementType> DistanceType;
 
+        DistanceChiSquared();
+
         std::string getType() const;
         static std::string getTypeStatic();
-
-    protected:
-        float getDistance(const std::vector<float>&, const std::vector<float>&) const;
-
-    private:
-        DistanceType distance;
     };
 
     /**
@@ -83,14 +112,10 @@ namespace ism3d
     {
         typedef flann::HellingerDistance<typename Distance::ElementType> DistanceType;
 
+        DistanceHellinger();
+
         std::string getType() const;
         static std::string getTypeStatic();
-
-    protected:
-        float getDistance(const std::vector<float>&, const std::vector<float>&) const;
-
-    private:
-        DistanceType distance;
     };
 
     /**
@@ -102,14 +127,25 @@ namespace ism3d
     {
         typedef flann::HistIntersectionDistance<typename Distance::ElementType> DistanceType;
 
+        DistanceHistIntersection();
+
         std::string getType() const;
         static std::string getTypeStatic();
+    };
 
-    protected:
-        float getDistance(const std::vector<float>&, const std::vector<float>&) const;
+    /**
+     * @brief The DistanceHamming struct
+     * The hamming distance class for binary descriptors.
+     */
+    struct DistanceHamming
+            : public Distance
+    {
+        typedef BinaryHamming<typename Distance::ElementType> DistanceType;
 
-    private:
-        DistanceType distance;
+        DistanceHamming();
+
+        std::string getType() const;
+        static std::string getTypeStatic();
     };
 }
 
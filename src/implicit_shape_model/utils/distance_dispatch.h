@@ -0,0 +1,118 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DISTANCE_DISPATCH_H
+#define ISM3D_DISTANCE_DISPATCH_H
+
+#include <string>
+#include <utility>
+#include "distance.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The IndexDistance enum
+     * The distances for which a nearest neighbor index can be built. The distance type string is resolved once
+     * when an index is built, afterwards visitIndexDistance() selects the code path specialized on the flann
+     * distance functor.
+     */
+    enum class IndexDistance
+    {
+        None,
+        Euclidean,
+        ChiSquared,
+        Hellinger,
+        HistIntersection,
+        Hamming
+    };
+
+    inline IndexDistance toIndexDistance(const std::string &type)
+    {
+        if (type == DistanceEuclidean::getTypeStatic())
+            return IndexDistance::Euclidean;
+        if (type == DistanceChiSquared::getTypeStatic())
+            return IndexDistance::ChiSquared;
+        if (type == DistanceHellinger::getTypeStatic())
+            return IndexDistance::Hellinger;
+        if (type == DistanceHistIntersection::getTypeStatic())
+            return IndexDistance::HistIntersection;
+        if (type == DistanceHamming::getTypeStatic())
+            return IndexDistance::Hamming;
+        return IndexDistance::None;
+    }
+
+    // maps the flann distance functors to their index distance
+    template<typename T>
+    struct IndexDistanceOf;
+
+    template<>
+    struct IndexDistanceOf<DistanceEuclidean::DistanceType>
+    {
+        static const IndexDistance value = IndexDistance::Euclidean;
+    };
+
+    template<>
+    struct IndexDistanceOf<DistanceChiSquared::DistanceType>
+    {
+        static const IndexDistance value = IndexDistance::ChiSquared;
+    };
+
+    template<>
+    struct IndexDistanceOf<DistanceHellinger::DistanceType>
+    {
+        static const IndexDistance value = IndexDistance::Hellinger;
+    };
+
+    template<>
+    struct IndexDistanceOf<DistanceHistIntersection::DistanceType>
+    {
+        static const IndexDistance value = IndexDistance::HistIntersection;
+    };
+
+    template<>
+    struct IndexDistanceOf<DistanceHamming::DistanceType>
+    {
+        static const IndexDistance value = IndexDistance::Hamming;
+    };
+
+    /**
+     * @brief Call the visitor with a default constructed flann functor of the given distance. The visitor
+     * provides a templated operator() taking the functor, overloads can handle single distances differently.
+     * @param distance the distance
+     * @param visitor the visitor
+     * @return false if the distance is None and the visitor was not called
+     */
+    template<typename Visitor>
+    bool visitIndexDistance(IndexDistance distance, Visitor &&visitor)
+    {
+        switch (distance)
+        {
+        case IndexDistance::Euclidean:
+            std::forward<Visitor>(visitor)(DistanceEuclidean::DistanceType());
+            return true;
+        case IndexDistance::ChiSquared:
+            std::forward<Visitor>(visitor)(DistanceChiSquared::DistanceType());
+            return true;
+        case IndexDistance::Hellinger:
+            std::forward<Visitor>(visitor)(DistanceHellinger::DistanceType());
+            return true;
+        case IndexDistance::HistIntersection:
+            std::forward<Visitor>(visitor)(DistanceHistIntersection::DistanceType());
+            return true;
+        case IndexDistance::Hamming:
+            std::forward<Visitor>(visitor)(DistanceHamming::DistanceType());
+            return true;
+        default:
+            return false;
+        }
+    }
+}
+
+#endif // ISM3D_DISTANCE_DISPATCH_H
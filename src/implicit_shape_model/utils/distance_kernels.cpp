@@ -0,0 +1,648 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "distance_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ISM3D_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__)
+#define ISM3D_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace ism3d
+{
+    namespace
+    {
+        struct KernelTable
+        {
+            DistanceKernels::Kernel euclidean;
+            DistanceKernels::Kernel chiSquared;
+            DistanceKernels::Kernel hellinger;
+            DistanceKernels::Kernel histIntersection;
+            DistanceKernels::Kernel hamming;
+            DistanceKernels::HalfKernel euclideanHalf;
+            DistanceKernels::ByteKernel euclideanByte;
+            const char *name;
+        };
+
+        // scalar versions, also used for the remainder of the vectorized versions
+
+        float euclideanScalar(const float *a, const float *b, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+            {
+                float diff = a[i] - b[i];
+                result += diff * diff;
+            }
+            return result;
+        }
+
+        float chiSquaredScalar(const float *a, const float *b, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+            {
+                float sum = a[i] + b[i];
+                if (sum > 0)
+                {
+                    float diff = a[i] - b[i];
+                    result += diff * diff / sum;
+                }
+            }
+            return result;
+        }
+
+        float hellingerScalar(const float *a, const float *b, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+            {
+                float diff = std::sqrt(a[i]) - std::sqrt(b[i]);
+                result += diff * diff;
+            }
+            return result;
+        }
+
+        float histIntersectionScalar(const float *a, const float *b, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+                result += a[i] < b[i] ? a[i] : b[i];
+            return result;
+        }
+
+        // binary descriptors stored as floats, values above 0.5 are set bits
+        float hammingScalar(const float *a, const float *b, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+            {
+                if ((a[i] > 0.5f) != (b[i] > 0.5f))
+                    result += 1;
+            }
+            return result;
+        }
+
+        float euclideanHalfScalar(const float *a, const uint16_t *b, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+            {
+                float diff = a[i] - DistanceKernels::halfToFloat(b[i]);
+                result += diff * diff;
+            }
+            return result;
+        }
+
+        float euclideanByteScalar(const float *a, const uint8_t *b, const float *offset, const float *scale, int size)
+        {
+            float result = 0;
+            for (int i = 0; i < size; i++)
+            {
+                float diff = a[i] - (offset[i] + scale[i] * b[i]);
+                result += diff * diff;
+            }
+            return result;
+        }
+
+#ifdef ISM3D_KERNELS_X86
+        __attribute__((target("avx2,fma")))
+        inline float horizontalSum(__m256 v)
+        {
+            __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+            sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+            return _mm_cvtss_f32(sum);
+        }
+
+        __attribute__((target("avx2,fma")))
+        float euclideanAVX2(const float *a, const float *b, int size)
+        {
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 16 <= size; i += 16)
+            {
+                __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+                __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+                acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+                acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+            }
+            for (; i + 8 <= size; i += 8)
+            {
+                __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+                acc0 = _mm256_fmadd_ps(d, d, acc0);
+            }
+            return horizontalSum(_mm256_add_ps(acc0, acc1)) + euclideanScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        float chiSquaredAVX2(const float *a, const float *b, int size)
+        {
+            const __m256 zero = _mm256_setzero_ps();
+            __m256 acc = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                __m256 va = _mm256_loadu_ps(a + i);
+                __m256 vb = _mm256_loadu_ps(b + i);
+                __m256 sum = _mm256_add_ps(va, vb);
+                __m256 diff = _mm256_sub_ps(va, vb);
+                // bins with an empty sum are masked out, which also removes the division by zero
+                __m256 valid = _mm256_cmp_ps(sum, zero, _CMP_GT_OQ);
+                __m256 term = _mm256_div_ps(_mm256_mul_ps(diff, diff), sum);
+                acc = _mm256_add_ps(acc, _mm256_and_ps(term, valid));
+            }
+            return horizontalSum(acc) + chiSquaredScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        float hellingerAVX2(const float *a, const float *b, int size)
+        {
+            __m256 acc = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                __m256 diff = _mm256_sub_ps(_mm256_sqrt_ps(_mm256_loadu_ps(a + i)), _mm256_sqrt_ps(_mm256_loadu_ps(b + i)));
+                acc = _mm256_fmadd_ps(diff, diff, acc);
+            }
+            return horizontalSum(acc) + hellingerScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        float histIntersectionAVX2(const float *a, const float *b, int size)
+        {
+            __m256 acc = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+                acc = _mm256_add_ps(acc, _mm256_min_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+            return horizontalSum(acc) + histIntersectionScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx2,fma,popcnt")))
+        float hammingAVX2(const float *a, const float *b, int size)
+        {
+            const __m256 half = _mm256_set1_ps(0.5f);
+            int count = 0;
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                __m256 bitsA = _mm256_cmp_ps(_mm256_loadu_ps(a + i), half, _CMP_GT_OQ);
+                __m256 bitsB = _mm256_cmp_ps(_mm256_loadu_ps(b + i), half, _CMP_GT_OQ);
+                count += _mm_popcnt_u32(_mm256_movemask_ps(_mm256_xor_ps(bitsA, bitsB)));
+            }
+            return (float)count + hammingScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx2,fma,f16c")))
+        float euclideanHalfAVX2(const float *a, const uint16_t *b, int size)
+        {
+            __m256 acc = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                __m256 vb = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(b + i)));
+                __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), vb);
+                acc = _mm256_fmadd_ps(d, d, acc);
+            }
+            return horizontalSum(acc) + euclideanHalfScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx2,fma")))
+        float euclideanByteAVX2(const float *a, const uint8_t *b, const float *offset, const float *scale, int size)
+        {
+            __m256 acc = _mm256_setzero_ps();
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                __m256 vb = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(b + i))));
+                vb = _mm256_fmadd_ps(_mm256_loadu_ps(scale + i), vb, _mm256_loadu_ps(offset + i));
+                __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), vb);
+                acc = _mm256_fmadd_ps(d, d, acc);
+            }
+            return horizontalSum(acc) + euclideanByteScalar(a + i, b + i, offset + i, scale + i, size - i);
+        }
+
+        __attribute__((target("avx512f")))
+        float euclideanAVX512(const float *a, const float *b, int size)
+        {
+            __m512 acc0 = _mm512_setzero_ps();
+            __m512 acc1 = _mm512_setzero_ps();
+            int i = 0;
+            for (; i + 32 <= size; i += 32)
+            {
+                __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+                __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+                acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+                acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+            }
+            for (; i < size; i += 16)
+            {
+                // the remainder is loaded with a mask, masked lanes are zero in both inputs
+                __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i));
+                acc0 = _mm512_fmadd_ps(d, d, acc0);
+            }
+            return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+        }
+
+        __attribute__((target("avx512f")))
+        float chiSquaredAVX512(const float *a, const float *b, int size)
+        {
+            const __m512 zero = _mm512_setzero_ps();
+            __m512 acc = _mm512_setzero_ps();
+            for (int i = 0; i < size; i += 16)
+            {
+                __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                __m512 va = _mm512_maskz_loadu_ps(mask, a + i);
+                __m512 vb = _mm512_maskz_loadu_ps(mask, b + i);
+                __m512 sum = _mm512_add_ps(va, vb);
+                __m512 diff = _mm512_sub_ps(va, vb);
+                __mmask16 valid = _mm512_cmp_ps_mask(sum, zero, _CMP_GT_OQ);
+                acc = _mm512_add_ps(acc, _mm512_maskz_div_ps(valid, _mm512_mul_ps(diff, diff), sum));
+            }
+            return _mm512_reduce_add_ps(acc);
+        }
+
+        __attribute__((target("avx512f")))
+        float hellingerAVX512(const float *a, const float *b, int size)
+        {
+            __m512 acc = _mm512_setzero_ps();
+            for (int i = 0; i < size; i += 16)
+            {
+                __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                __m512 diff = _mm512_sub_ps(_mm512_sqrt_ps(_mm512_maskz_loadu_ps(mask, a + i)),
+                                            _mm512_sqrt_ps(_mm512_maskz_loadu_ps(mask, b + i)));
+                acc = _mm512_fmadd_ps(diff, diff, acc);
+            }
+            return _mm512_reduce_add_ps(acc);
+        }
+
+        __attribute__((target("avx512f")))
+        float histIntersectionAVX512(const float *a, const float *b, int size)
+        {
+            __m512 acc = _mm512_setzero_ps();
+            for (int i = 0; i < size; i += 16)
+            {
+                __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                acc = _mm512_add_ps(acc, _mm512_min_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i)));
+            }
+            return _mm512_reduce_add_ps(acc);
+        }
+
+        __attribute__((target("avx512f,popcnt")))
+        float hammingAVX512(const float *a, const float *b, int size)
+        {
+            const __m512 half = _mm512_set1_ps(0.5f);
+            int count = 0;
+            for (int i = 0; i < size; i += 16)
+            {
+                __mmask16 mask = size - i >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (size - i)) - 1);
+                __mmask16 bitsA = _mm512_mask_cmp_ps_mask(mask, _mm512_maskz_loadu_ps(mask, a + i), half, _CMP_GT_OQ);
+                __mmask16 bitsB = _mm512_mask_cmp_ps_mask(mask, _mm512_maskz_loadu_ps(mask, b + i), half, _CMP_GT_OQ);
+                count += _mm_popcnt_u32((unsigned)(bitsA ^ bitsB));
+            }
+            return (float)count;
+        }
+
+        __attribute__((target("avx512f")))
+        float euclideanHalfAVX512(const float *a, const uint16_t *b, int size)
+        {
+            __m512 acc = _mm512_setzero_ps();
+            int i = 0;
+            for (; i + 16 <= size; i += 16)
+            {
+                __m512 vb = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i*)(b + i)));
+                __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), vb);
+                acc = _mm512_fmadd_ps(d, d, acc);
+            }
+            return _mm512_reduce_add_ps(acc) + euclideanHalfScalar(a + i, b + i, size - i);
+        }
+
+        __attribute__((target("avx512f")))
+        float euclideanByteAVX512(const float *a, const uint8_t *b, const float *offset, const float *scale, int size)
+        {
+            __m512 acc = _mm512_setzero_ps();
+            int i = 0;
+            for (; i + 16 <= size; i += 16)
+            {
+                __m512 vb = _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(b + i))));
+                vb = _mm512_fmadd_ps(_mm512_loadu_ps(scale + i), vb, _mm512_loadu_ps(offset + i));
+                __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), vb);
+                acc = _mm512_fmadd_ps(d, d, acc);
+            }
+            return _mm512_reduce_add_ps(acc) + euclideanByteScalar(a + i, b + i, offset + i, scale + i, size - i);
+        }
+#endif
+
+#ifdef ISM3D_KERNELS_NEON
+        float euclideanNEON(const float *a, const float *b, int size)
+        {
+            float32x4_t acc0 = vdupq_n_f32(0);
+            float32x4_t acc1 = vdupq_n_f32(0);
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+                float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+                acc0 = vfmaq_f32(acc0, d0, d0);
+                acc1 = vfmaq_f32(acc1, d1, d1);
+            }
+            return vaddvq_f32(vaddq_f32(acc0, acc1)) + euclideanScalar(a + i, b + i, size - i);
+        }
+
+        float chiSquaredNEON(const float *a, const float *b, int size)
+        {
+            const float32x4_t zero = vdupq_n_f32(0);
+            float32x4_t acc = vdupq_n_f32(0);
+            int i = 0;
+            for (; i + 4 <= size; i += 4)
+            {
+                float32x4_t va = vld1q_f32(a + i);
+                float32x4_t vb = vld1q_f32(b + i);
+                float32x4_t sum = vaddq_f32(va, vb);
+                float32x4_t diff = vsubq_f32(va, vb);
+                uint32x4_t valid = vcgtq_f32(sum, zero);
+                float32x4_t term = vdivq_f32(vmulq_f32(diff, diff), sum);
+                acc = vaddq_f32(acc, vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(term), valid)));
+            }
+            return vaddvq_f32(acc) + chiSquaredScalar(a + i, b + i, size - i);
+        }
+
+        float hellingerNEON(const float *a, const float *b, int size)
+        {
+            float32x4_t acc = vdupq_n_f32(0);
+            int i = 0;
+            for (; i + 4 <= size; i += 4)
+            {
+                float32x4_t diff = vsubq_f32(vsqrtq_f32(vld1q_f32(a + i)), vsqrtq_f32(vld1q_f32(b + i)));
+                acc = vfmaq_f32(acc, diff, diff);
+            }
+            return vaddvq_f32(acc) + hellingerScalar(a + i, b + i, size - i);
+        }
+
+        float histIntersectionNEON(const float *a, const float *b, int size)
+        {
+            float32x4_t acc = vdupq_n_f32(0);
+            int i = 0;
+            for (; i + 4 <= size; i += 4)
+                acc = vaddq_f32(acc, vminq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+            return vaddvq_f32(acc) + histIntersectionScalar(a + i, b + i, size - i);
+        }
+
+        float hammingNEON(const float *a, const float *b, int size)
+        {
+            const float32x4_t half = vdupq_n_f32(0.5f);
+            uint32x4_t acc = vdupq_n_u32(0);
+            int i = 0;
+            for (; i + 4 <= size; i += 4)
+            {
+                uint32x4_t differ = veorq_u32(vcgtq_f32(vld1q_f32(a + i), half), vcgtq_f32(vld1q_f32(b + i), half));
+                acc = vsubq_u32(acc, differ); // set lanes are all ones, i.e. -1
+            }
+            return (float)vaddvq_u32(acc) + hammingScalar(a + i, b + i, size - i);
+        }
+
+        float euclideanHalfNEON(const float *a, const uint16_t *b, int size)
+        {
+            float32x4_t acc = vdupq_n_f32(0);
+            int i = 0;
+            for (; i + 4 <= size; i += 4)
+            {
+                float32x4_t vb = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(b + i)));
+                float32x4_t d = vsubq_f32(vld1q_f32(a + i), vb);
+                acc = vfmaq_f32(acc, d, d);
+            }
+            return vaddvq_f32(acc) + euclideanHalfScalar(a + i, b + i, size - i);
+        }
+
+        float euclideanByteNEON(const float *a, const uint8_t *b, const float *offset, const float *scale, int size)
+        {
+            float32x4_t acc = vdupq_n_f32(0);
+            int i = 0;
+            for (; i + 8 <= size; i += 8)
+            {
+                uint16x8_t wide = vmovl_u8(vld1_u8(b + i));
+                float32x4_t b0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(wide)));
+                float32x4_t b1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(wide)));
+                float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vfmaq_f32(vld1q_f32(offset + i), vld1q_f32(scale + i), b0));
+                float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vfmaq_f32(vld1q_f32(offset + i + 4), vld1q_f32(scale + i + 4), b1));
+                acc = vfmaq_f32(acc, d0, d0);
+                acc = vfmaq_f32(acc, d1, d1);
+            }
+            return vaddvq_f32(acc) + euclideanByteScalar(a + i, b + i, offset + i, scale + i, size - i);
+        }
+#endif
+
+        // the dimensions of the common descriptors: FPFH, RoPS, VFH, SHOT, ESF, CSHOT and 3DSC
+        const int NumFixedDims = 7;
+        const int FixedDims[NumFixedDims] = {33, 135, 308, 352, 640, 1344, 1980};
+
+        // instantiations of a kernel for the fixed dimensions, in the order of FixedDims
+        struct FixedKernels
+        {
+            DistanceKernels::Kernel generic;
+            DistanceKernels::Kernel fixed[NumFixedDims];
+        };
+
+#define ISM3D_FIXED_KERNELS(wrapper, generic) \
+        {generic, {wrapper<generic, 33>, wrapper<generic, 135>, wrapper<generic, 308>, wrapper<generic, 352>, \
+                   wrapper<generic, 640>, wrapper<generic, 1344>, wrapper<generic, 1980>}}
+
+        // the generic kernel is inlined with a constant size, so that its loops are unrolled and the remainder
+        // disappears; other sizes, e.g. of global descriptors, take the generic path
+        template<DistanceKernels::Kernel Generic, int Dim>
+        __attribute__((flatten))
+        float fixedScalar(const float *a, const float *b, int size)
+        {
+            return size == Dim ? Generic(a, b, Dim) : Generic(a, b, size);
+        }
+
+#ifdef ISM3D_KERNELS_X86
+        template<DistanceKernels::Kernel Generic, int Dim>
+        __attribute__((target("avx2,fma,popcnt"), flatten))
+        float fixedAVX2(const float *a, const float *b, int size)
+        {
+            return size == Dim ? Generic(a, b, Dim) : Generic(a, b, size);
+        }
+
+        template<DistanceKernels::Kernel Generic, int Dim>
+        __attribute__((target("avx512f,popcnt"), flatten))
+        float fixedAVX512(const float *a, const float *b, int size)
+        {
+            return size == Dim ? Generic(a, b, Dim) : Generic(a, b, size);
+        }
+#endif
+
+        const std::vector<FixedKernels>& getFixedKernels()
+        {
+            static const std::vector<FixedKernels> kernels = {
+                ISM3D_FIXED_KERNELS(fixedScalar, euclideanScalar),
+                ISM3D_FIXED_KERNELS(fixedScalar, chiSquaredScalar),
+                ISM3D_FIXED_KERNELS(fixedScalar, hellingerScalar),
+                ISM3D_FIXED_KERNELS(fixedScalar, histIntersectionScalar),
+                ISM3D_FIXED_KERNELS(fixedScalar, hammingScalar),
+#ifdef ISM3D_KERNELS_X86
+                ISM3D_FIXED_KERNELS(fixedAVX2, euclideanAVX2),
+                ISM3D_FIXED_KERNELS(fixedAVX2, chiSquaredAVX2),
+                ISM3D_FIXED_KERNELS(fixedAVX2, hellingerAVX2),
+                ISM3D_FIXED_KERNELS(fixedAVX2, histIntersectionAVX2),
+                ISM3D_FIXED_KERNELS(fixedAVX2, hammingAVX2),
+                ISM3D_FIXED_KERNELS(fixedAVX512, euclideanAVX512),
+                ISM3D_FIXED_KERNELS(fixedAVX512, chiSquaredAVX512),
+                ISM3D_FIXED_KERNELS(fixedAVX512, hellingerAVX512),
+                ISM3D_FIXED_KERNELS(fixedAVX512, histIntersectionAVX512),
+                ISM3D_FIXED_KERNELS(fixedAVX512, hammingAVX512),
+#endif
+#ifdef ISM3D_KERNELS_NEON
+                ISM3D_FIXED_KERNELS(fixedScalar, euclideanNEON),
+                ISM3D_FIXED_KERNELS(fixedScalar, chiSquaredNEON),
+                ISM3D_FIXED_KERNELS(fixedScalar, hellingerNEON),
+                ISM3D_FIXED_KERNELS(fixedScalar, histIntersectionNEON),
+                ISM3D_FIXED_KERNELS(fixedScalar, hammingNEON),
+#endif
+            };
+            return kernels;
+        }
+
+#undef ISM3D_FIXED_KERNELS
+
+        KernelTable selectKernels()
+        {
+#ifdef ISM3D_KERNELS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f"))
+                return {euclideanAVX512, chiSquaredAVX512, hellingerAVX512, histIntersectionAVX512, hammingAVX512,
+                        euclideanHalfAVX512, euclideanByteAVX512, "AVX-512"};
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return {euclideanAVX2, chiSquaredAVX2, hellingerAVX2, histIntersectionAVX2, hammingAVX2,
+                        __builtin_cpu_supports("f16c") ? euclideanHalfAVX2 : euclideanHalfScalar, euclideanByteAVX2, "AVX2"};
+#endif
+#ifdef ISM3D_KERNELS_NEON
+            return {euclideanNEON, chiSquaredNEON, hellingerNEON, histIntersectionNEON, hammingNEON,
+                    euclideanHalfNEON, euclideanByteNEON, "NEON"};
+#endif
+            return {euclideanScalar, chiSquaredScalar, hellingerScalar, histIntersectionScalar, hammingScalar,
+                    euclideanHalfScalar, euclideanByteScalar, "scalar"};
+        }
+
+        const KernelTable& getKernels()
+        {
+            static const KernelTable kernels = selectKernels();
+            return kernels;
+        }
+    }
+
+    DistanceKernels::Kernel DistanceKernels::euclidean()
+    {
+        return getKernels().euclidean;
+    }
+
+    DistanceKernels::Kernel DistanceKernels::chiSquared()
+    {
+        return getKernels().chiSquared;
+    }
+
+    DistanceKernels::Kernel DistanceKernels::hellinger()
+    {
+        return getKernels().hellinger;
+    }
+
+    DistanceKernels::Kernel DistanceKernels::histIntersection()
+    {
+        return getKernels().histIntersection;
+    }
+
+    DistanceKernels::Kernel DistanceKernels::hamming()
+    {
+        return getKernels().hamming;
+    }
+
+    DistanceKernels::Kernel DistanceKernels::specialize(Kernel kernel, int dim)
+    {
+        const int *fixedDim = std::find(FixedDims, FixedDims + NumFixedDims, dim);
+        if (fixedDim == FixedDims + NumFixedDims)
+            return kernel;
+
+        for (const FixedKernels &kernels : getFixedKernels())
+        {
+            if (kernels.generic == kernel)
+                return kernels.fixed[fixedDim - FixedDims];
+        }
+        return kernel;
+    }
+
+    DistanceKernels::HalfKernel DistanceKernels::euclideanHalf()
+    {
+        return getKernels().euclideanHalf;
+    }
+
+    DistanceKernels::ByteKernel DistanceKernels::euclideanByte()
+    {
+        return getKernels().euclideanByte;
+    }
+
+    uint16_t DistanceKernels::floatToHalf(float value)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        const uint16_t sign = (uint16_t)((bits >> 16) & 0x8000);
+        const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+        // infinity and nan, nan keeps a set mantissa bit
+        if (magnitude >= 0x7F800000)
+            return sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x0200 : 0);
+        // values that round to 65520 or above overflow
+        if (magnitude >= 0x477FF000)
+            return sign | 0x7C00;
+        // subnormal half values are multiples of 2^-24, the conversion rounds to nearest even
+        if (magnitude < 0x38800000)
+            return sign | (uint16_t)std::nearbyint(std::fabs(value) * 16777216.0f);
+
+        uint32_t result = ((magnitude >> 23) - 112) << 10 | ((magnitude & 0x7FFFFF) >> 13);
+        const uint32_t rest = magnitude & 0x1FFF;
+        if (rest > 0x1000 || (rest == 0x1000 && (result & 1)))
+            result++; // a carry into the exponent is the correct result
+        return sign | (uint16_t)result;
+    }
+
+    float DistanceKernels::halfToFloat(uint16_t value)
+    {
+        const uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+        const uint32_t exponent = (value >> 10) & 0x1F;
+        const uint32_t mantissa = value & 0x3FF;
+
+        if (exponent == 0)
+        {
+            float result = (float)mantissa * (1.0f / 16777216.0f);
+            return sign ? -result : result;
+        }
+
+        uint32_t bits = sign | (exponent == 31 ? 0x7F800000 : (exponent + 112) << 23) | (mantissa << 13);
+        float result;
+        std::memcpy(&result, &bits, sizeof(result));
+        return result;
+    }
+
+    std::string DistanceKernels::getInstructionSet()
+    {
+        return getKernels().name;
+    }
+}
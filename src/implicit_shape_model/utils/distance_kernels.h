@@ -0,0 +1,60 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_DISTANCE_KERNELS_H
+#define ISM3D_DISTANCE_KERNELS_H
+
+#include <string>
+#include <cstdint>
+
+namespace ism3d
+{
+    /**
+     * @brief The DistanceKernels class
+     * Vectorized distances on contiguous float arrays. The results are those of the corresponding flann functors
+     * (squared euclidean, chi-squared, hellinger without square root, sum of minima for histogram intersection),
+     * apart from rounding differences caused by the summation order. The implementation is selected once at
+     * runtime: AVX-512 or AVX2 on x86 processors that support them, NEON on 64 bit ARM and scalar code otherwise.
+     * The squared euclidean distance is also available between a float query and reduced precision data (half
+     * precision floats or bytes with a per dimension offset and scale), the data is converted on the fly.
+     */
+    class DistanceKernels
+    {
+    public:
+        typedef float (*Kernel)(const float *data1, const float *data2, int size);
+        typedef float (*HalfKernel)(const float *query, const uint16_t *data, int size);
+        typedef float (*ByteKernel)(const float *query, const uint8_t *data, const float *offset, const float *scale, int size);
+
+        static Kernel euclidean();
+        static Kernel chiSquared();
+        static Kernel hellinger();
+        static Kernel histIntersection();
+        static Kernel hamming();
+
+        // the kernel for descriptors of the given dimension, unrolled for the dimensions of the common descriptors
+        // (e.g. 352 for SHOT, 33 for FPFH); the result still accepts other sizes
+        static Kernel specialize(Kernel kernel, int dim);
+
+        // squared euclidean distance to half precision data
+        static HalfKernel euclideanHalf();
+
+        // squared euclidean distance to byte data, the value of dimension i is offset[i] + scale[i] * data[i]
+        static ByteKernel euclideanByte();
+
+        // IEEE 754 half precision conversion, rounding to nearest even
+        static uint16_t floatToHalf(float value);
+        static float halfToFloat(uint16_t value);
+
+        // name of the selected instruction set
+        static std::string getInstructionSet();
+    };
+}
+
+#endif // ISM3D_DISTANCE_KERNELS_H
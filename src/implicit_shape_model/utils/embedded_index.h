@@ -0,0 +1,146 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_EMBEDDED_INDEX_H
+#define ISM3D_EMBEDDED_INDEX_H
+
+#include <vector>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+
+#include "knn_index.h"
+#include "metric_embedding.h"
+#include "exception.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The EmbeddedIndex class
+     * Searches a histogram distance with a euclidean index over the embedded dataset, see MetricEmbedding. The
+     * queries are embedded before each search. The candidates found in the embedding are ranked by their exact
+     * distance to the original descriptors, so that the reported distances are those of the functor T. Searching
+     * more candidates than requested (re-ranking) compensates for the approximation of inexact embeddings.
+     */
+    template<typename T>
+    class EmbeddedIndex : public KnnIndex<T>
+    {
+    public:
+        typedef flann::L2<float> EmbeddedDistance;
+        typedef std::pair<float, int> Candidate; // distance and dataset row
+
+        /**
+         * @param dataset the original descriptors, must outlive the index
+         * @param embedding the embedding of the descriptors
+         * @param rerank the number of candidates that are ranked with the exact distance (at least k)
+         */
+        EmbeddedIndex(const flann::Matrix<float> &dataset, std::shared_ptr<const MetricEmbedding> embedding, int rerank)
+            : m_dataset(dataset), m_embedding(embedding), m_rerank(rerank)
+        {
+            const int embeddedDim = m_embedding->getEmbeddedDim();
+            m_embedded_data.resize(m_dataset.rows * embeddedDim);
+            m_embedding->embed(m_dataset.ptr(), (int)m_dataset.rows, m_embedded_data.data(), 0);
+            m_embedded = flann::Matrix<float>(m_embedded_data.data(), m_dataset.rows, embeddedDim);
+        }
+
+        // the embedded descriptors, on which the euclidean index must be created
+        const flann::Matrix<float>& getEmbeddedDataset() const
+        {
+            return m_embedded;
+        }
+
+        void setIndex(std::shared_ptr<KnnIndex<EmbeddedDistance> > index)
+        {
+            m_index = index;
+        }
+
+        void buildIndex()
+        {
+            m_index->buildIndex();
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            std::vector<std::vector<int> > resultIndices;
+            std::vector<std::vector<float> > resultDistances;
+            knnSearch(queries, resultIndices, resultDistances, k, exact, cores);
+            for (std::size_t q = 0; q < queries.rows; q++)
+            {
+                for (int j = 0; j < k; j++)
+                {
+                    const bool found = j < (int)resultIndices[q].size();
+                    indices[q][j] = found ? resultIndices[q][j] : -1;
+                    distances[q][j] = found ? resultDistances[q][j] : std::numeric_limits<float>::max();
+                }
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+            const int embeddedDim = m_embedding->getEmbeddedDim();
+            std::vector<float> embeddedData((std::size_t)numQueries * embeddedDim);
+            m_embedding->embed(queries.ptr(), numQueries, embeddedData.data(), cores);
+            flann::Matrix<float> embeddedQueries(embeddedData.data(), numQueries, embeddedDim);
+
+            // exact embeddings preserve the order of the neighbors, they need no further candidates
+            const int numCandidates = m_embedding->isExact() ? k : std::max(k, m_rerank);
+            m_index->knnSearch(embeddedQueries, indices, distances, numCandidates, exact, cores);
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                result.reserve(indices[q].size());
+                for (int index : indices[q])
+                {
+                    if (index >= 0)
+                        result.push_back(Candidate(m_distance(queries[q], m_dataset[index], m_dataset.cols), index));
+                }
+                std::sort(result.begin(), result.end());
+                if ((int)result.size() > k)
+                    result.resize(k);
+
+                indices[q].resize(result.size());
+                distances[q].resize(result.size());
+                for (int j = 0; j < (int)result.size(); j++)
+                {
+                    indices[q][j] = result[j].second;
+                    distances[q][j] = result[j].first;
+                }
+            }
+        }
+
+        void save(const std::string &filename)
+        {
+            throw RuntimeException("embedded indices are not stored, they are rebuilt from the codebook");
+        }
+
+        // the index structure and the embedded dataset
+        std::size_t getMemoryUsage() const
+        {
+            return m_index->getMemoryUsage() + m_embedded_data.capacity() * sizeof(float);
+        }
+
+    private:
+        flann::Matrix<float> m_dataset;
+        std::shared_ptr<const MetricEmbedding> m_embedding;
+        int m_rerank;
+        std::vector<float> m_embedded_data;
+        flann::Matrix<float> m_embedded;
+        std::shared_ptr<KnnIndex<EmbeddedDistance> > m_index;
+        T m_distance;
+    };
+}
+
+#endif // ISM3D_EMBEDDED_INDEX_H
@@ -0,0 +1,47 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "estimator_cache.h"
+
+namespace ism3d
+{
+    EstimatorCache::EstimatorCache()
+        : m_num_created(0), m_num_reused(0)
+    {
+    }
+
+    int EstimatorCache::getNumCreated() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_num_created;
+    }
+
+    int EstimatorCache::getNumReused() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_num_reused;
+    }
+
+    void EstimatorCache::clear()
+    {
+        // destroyed outside of the lock, an object may hold leases itself
+        std::map<std::type_index, std::vector<boost::shared_ptr<void> > > available;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            available.swap(m_available);
+        }
+    }
+
+    void EstimatorCache::release(std::type_index type, const boost::shared_ptr<void> &object)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_available[type].push_back(object);
+    }
+}
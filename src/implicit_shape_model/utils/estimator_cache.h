@@ -0,0 +1,111 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_ESTIMATOR_CACHE_H
+#define ISM3D_ESTIMATOR_CACHE_H
+
+#include <map>
+#include <mutex>
+#include <typeindex>
+#include <vector>
+
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+
+namespace ism3d
+{
+    /**
+     * @brief The EstimatorCache class
+     * Keeps the PCL estimators and searches of a detection session from one detection to the next. An object is
+     * leased with acquire() and returned to the cache when the last copy of the lease is released, so that the
+     * next detection reconfigures it instead of constructing a new one and its internal buffers are reused.
+     * Objects are distinguished by type, threads that acquire the same type at the same time get different
+     * objects. A leased object keeps the configuration of its last use, e.g. input clouds, indices and view
+     * point, every user has to set all of them. The cache is thread safe and can be released before its leases.
+     */
+    class EstimatorCache
+            : public boost::enable_shared_from_this<EstimatorCache>
+    {
+    public:
+        typedef boost::shared_ptr<EstimatorCache> Ptr;
+
+        EstimatorCache();
+
+        // lease an object of the type, a cached one if available
+        template<typename T>
+        boost::shared_ptr<T> acquire()
+        {
+            boost::shared_ptr<T> object;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::vector<boost::shared_ptr<void> > &available = m_available[std::type_index(typeid(T))];
+                if (!available.empty())
+                {
+                    object = boost::static_pointer_cast<T>(available.back());
+                    available.pop_back();
+                    m_num_reused++;
+                }
+                else
+                {
+                    m_num_created++;
+                }
+            }
+            if (!object)
+                object.reset(new T());
+
+            // the lease owns the object and returns it on release
+            Release release = {boost::weak_ptr<EstimatorCache>(shared_from_this()), object, std::type_index(typeid(T))};
+            return boost::shared_ptr<T>(object.get(), release);
+        }
+
+        // a leased object of the cache if there is one, else a new object
+        template<typename T>
+        static boost::shared_ptr<T> acquire(const Ptr &cache)
+        {
+            return cache ? cache->acquire<T>() : boost::shared_ptr<T>(new T());
+        }
+
+        // number of objects constructed and number of leases of cached objects
+        int getNumCreated() const;
+        int getNumReused() const;
+
+        // releases the cached objects, leased objects are destroyed on release
+        void clear();
+
+    private:
+        EstimatorCache(const EstimatorCache&) = delete;
+        EstimatorCache& operator=(const EstimatorCache&) = delete;
+
+        struct Release
+        {
+            boost::weak_ptr<EstimatorCache> cache;
+            boost::shared_ptr<void> object;
+            std::type_index type;
+
+            void operator()(const void*)
+            {
+                Ptr owner = cache.lock();
+                if (owner)
+                    owner->release(type, object);
+                object.reset();
+            }
+        };
+
+        void release(std::type_index type, const boost::shared_ptr<void> &object);
+
+        std::map<std::type_index, std::vector<boost::shared_ptr<void> > > m_available;
+        int m_num_created;
+        int m_num_reused;
+        mutable std::mutex m_mutex;
+    };
+}
+
+#endif // ISM3D_ESTIMATOR_CACHE_H
@@ -47,4 +47,18 @@ namespace ism3d
         : Exception(message)
     {
     }
+
+    CancelledException::CancelledException(std::string message)
+        : m_message(message)
+    {
+    }
+
+    CancelledException::~CancelledException() throw()
+    {
+    }
+
+    const char* CancelledException::what() const throw()
+    {
+        return m_message.c_str();
+    }
 }
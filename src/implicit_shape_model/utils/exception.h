@@ -54,6 +54,19 @@ namespace ism3d
         BadParamException(std::string);
     };
 
+    // thrown when a detection is cancelled, see CancellationToken; it is expected and not logged as an error
+    class CancelledException
+            : public std::exception
+    {
+    public:
+        CancelledException(std::string);
+        virtual ~CancelledException() throw();
+        virtual const char* what() const throw();
+
+    private:
+        std::string m_message;
+    };
+
     template <typename T>
     class BadParamExceptionType
             : public BadParamException
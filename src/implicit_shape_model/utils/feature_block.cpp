@@ -0,0 +1,161 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "feature_block.h"
+#include "utils.h"
+
+namespace ism3d
+{
+    FeatureBlock::FeatureBlock()
+        : m_num_features(0), m_dim(0)
+    {
+    }
+
+    FeatureBlock::FeatureBlock(int num_features, int dim)
+        : m_num_features(0), m_dim(0)
+    {
+        resize(num_features, dim);
+    }
+
+    FeatureBlock::FeatureBlock(const pcl::PointCloud<ISMFeature> &features)
+        : m_num_features(0), m_dim(0)
+    {
+        if (!assign(features))
+            LOG_ERROR("features have different descriptor sizes, feature block is empty");
+    }
+
+    void FeatureBlock::resize(int num_features, int dim)
+    {
+        m_num_features = num_features;
+        m_dim = dim;
+        m_descriptors.resize((size_t)num_features * dim);
+        positions.resize(num_features);
+        referenceFrames.resize(num_features);
+        centerDists.resize(num_features);
+        globalDescriptorRadii.resize(num_features);
+        classIds.resize(num_features);
+        weights.resize(num_features);
+    }
+
+    bool FeatureBlock::assign(const pcl::PointCloud<ISMFeature> &features)
+    {
+        int dim = features.size() > 0 ? (int)features.at(0).descriptor.size() : 0;
+        resize((int)features.size(), dim);
+
+        if (!copyDescriptors(features, m_descriptors.data(), dim))
+        {
+            resize(0, 0);
+            return false;
+        }
+
+        for (int i = 0; i < (int)features.size(); i++)
+        {
+            const ISMFeature &feature = features.at(i);
+            positions[i] = Eigen::Vector3f(feature.x, feature.y, feature.z);
+            referenceFrames[i] = feature.referenceFrame;
+            centerDists[i] = feature.centerDist;
+            globalDescriptorRadii[i] = feature.globalDescriptorRadius;
+            classIds[i] = feature.classId;
+            weights[i] = feature.weight;
+        }
+        return true;
+    }
+
+    void FeatureBlock::set(int index, const ISMFeature &feature)
+    {
+        LOG_ASSERT(index >= 0 && index < m_num_features);
+        LOG_ASSERT((int)feature.descriptor.size() == m_dim);
+
+        std::copy(feature.descriptor.begin(), feature.descriptor.end(), descriptor(index));
+        positions[index] = Eigen::Vector3f(feature.x, feature.y, feature.z);
+        referenceFrames[index] = feature.referenceFrame;
+        centerDists[index] = feature.centerDist;
+        globalDescriptorRadii[index] = feature.globalDescriptorRadius;
+        classIds[index] = feature.classId;
+        weights[index] = feature.weight;
+    }
+
+    ISMFeature FeatureBlock::getFeature(int index) const
+    {
+        LOG_ASSERT(index >= 0 && index < m_num_features);
+
+        ISMFeature feature;
+        feature.x = positions[index].x();
+        feature.y = positions[index].y();
+        feature.z = positions[index].z();
+        feature.referenceFrame = referenceFrames[index];
+        feature.descriptor.assign(descriptor(index), descriptor(index) + m_dim);
+        feature.centerDist = centerDists[index];
+        feature.globalDescriptorRadius = globalDescriptorRadii[index];
+        feature.classId = classIds[index];
+        feature.weight = weights[index];
+        return feature;
+    }
+
+    pcl::PointCloud<ISMFeature>::Ptr FeatureBlock::toPointCloud() const
+    {
+        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
+        features->resize(m_num_features);
+        for (int i = 0; i < m_num_features; i++)
+            features->at(i) = getFeature(i);
+        return features;
+    }
+
+    flann::Matrix<float> FeatureBlock::getMatrix() const
+    {
+        return flann::Matrix<float>(const_cast<float*>(m_descriptors.data()), m_num_features, m_dim);
+    }
+
+    bool FeatureBlock::copyDescriptors(const pcl::PointCloud<ISMFeature> &features, float *out, int dim)
+    {
+        bool valid = true;
+
+#pragma omp parallel for reduction(&&:valid)
+        for (int i = 0; i < (int)features.size(); i++)
+        {
+            const std::vector<float> &descriptor = features.at(i).descriptor;
+            if ((int)descriptor.size() != dim)
+            {
+                valid = false;
+                continue;
+            }
+            std::copy(descriptor.begin(), descriptor.end(), out + (size_t)i * dim);
+        }
+
+        return valid;
+    }
+
+    bool FeatureBlock::gatherDescriptors(const pcl::PointCloud<ISMFeature> &features, const std::vector<int> &indices,
+                                         float *out, int source_dim)
+    {
+        bool valid = true;
+        const int *gather = indices.data();
+        const int dim = (int)indices.size();
+
+#pragma omp parallel for reduction(&&:valid)
+        for (int i = 0; i < (int)features.size(); i++)
+        {
+            const std::vector<float> &descriptor = features.at(i).descriptor;
+            if ((int)descriptor.size() != source_dim)
+            {
+                valid = false;
+                continue;
+            }
+
+            const float *in = descriptor.data();
+            float *row = out + (size_t)i * dim;
+#pragma omp simd
+            for (int j = 0; j < dim; j++)
+                row[j] = in[gather[j]];
+        }
+
+        return valid;
+    }
+}
@@ -0,0 +1,168 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURE_BLOCK_H
+#define ISM3D_FEATURE_BLOCK_H
+
+#include <vector>
+#include <memory>
+#include <flann/flann.hpp>
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+#include "ism_feature.h"
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace ism3d
+{
+    /**
+     * @brief The FeatureBlock class
+     * Structure-of-arrays representation of a set of features. All descriptors are stored in one aligned,
+     * row-major float buffer (one row per feature), the remaining feature data is stored in parallel arrays.
+     * The descriptor buffer can be wrapped by a flann::Matrix without copying. Blocks are contiguous copies of
+     * feature clouds for the clustering and ranking algorithms; descriptor estimators still produce per-point
+     * descriptors, which the codebook copies into plain query matrices for the nearest neighbor search.
+     */
+    class FeatureBlock
+    {
+    public:
+        typedef std::shared_ptr<FeatureBlock> Ptr;
+        typedef std::shared_ptr<const FeatureBlock> ConstPtr;
+
+        FeatureBlock();
+
+        /**
+         * @brief Create a block for the given number of features with the given descriptor length.
+         * @param num_features the number of features
+         * @param dim the descriptor length
+         */
+        FeatureBlock(int num_features, int dim);
+
+        /**
+         * @brief Create a block from a feature point cloud. All descriptors must have the same length.
+         * @param features the input features
+         */
+        explicit FeatureBlock(const pcl::PointCloud<ISMFeature> &features);
+
+        /**
+         * @brief Resize the block. Existing data is not preserved.
+         * @param num_features the number of features
+         * @param dim the descriptor length
+         */
+        void resize(int num_features, int dim);
+
+        /**
+         * @brief Fill the block from a feature point cloud.
+         * @param features the input features
+         * @return false if descriptors have different lengths
+         */
+        bool assign(const pcl::PointCloud<ISMFeature> &features);
+
+        /**
+         * @brief Store a single feature at the given row.
+         * @param index the row index
+         * @param feature the feature
+         */
+        void set(int index, const ISMFeature &feature);
+
+        /**
+         * @brief Convert one row back into an ISMFeature (allocates the descriptor).
+         * @param index the row index
+         * @return the feature
+         */
+        ISMFeature getFeature(int index) const;
+
+        /**
+         * @brief Convert the whole block back into a point cloud.
+         * @return the feature point cloud
+         */
+        pcl::PointCloud<ISMFeature>::Ptr toPointCloud() const;
+
+        /**
+         * @brief Wrap the descriptor buffer into a flann matrix. No data is copied, the matrix is only valid
+         * as long as the block is neither resized nor destroyed.
+         * @return a flann matrix referencing the descriptors
+         */
+        flann::Matrix<float> getMatrix() const;
+
+        /**
+         * @brief Copy the descriptors of a feature point cloud into a contiguous row-major buffer.
+         * @param features the input features
+         * @param out the output buffer, must hold features.size() * dim values
+         * @param dim the descriptor length
+         * @return false if a descriptor length does not match dim
+         */
+        static bool copyDescriptors(const pcl::PointCloud<ISMFeature> &features, float *out, int dim);
+
+        /**
+         * @brief Copy selected descriptor values of a feature point cloud into a contiguous row-major buffer.
+         * @param features the input features
+         * @param indices the descriptor indices copied into each row, in output order
+         * @param out the output buffer, must hold features.size() * indices.size() values
+         * @param source_dim the descriptor length of the input features
+         * @return false if a descriptor length does not match source_dim
+         */
+        static bool gatherDescriptors(const pcl::PointCloud<ISMFeature> &features, const std::vector<int> &indices,
+                                      float *out, int source_dim);
+
+        int size() const
+        {
+            return m_num_features;
+        }
+
+        int dim() const
+        {
+            return m_dim;
+        }
+
+        bool empty() const
+        {
+            return m_num_features == 0;
+        }
+
+        float* descriptor(int index)
+        {
+            return m_descriptors.data() + (size_t)index * m_dim;
+        }
+
+        const float* descriptor(int index) const
+        {
+            return m_descriptors.data() + (size_t)index * m_dim;
+        }
+
+        float* data()
+        {
+            return m_descriptors.data();
+        }
+
+        const float* data() const
+        {
+            return m_descriptors.data();
+        }
+
+        // parallel arrays, one entry per feature
+        std::vector<Eigen::Vector3f> positions;
+        std::vector<pcl::ReferenceFrame, Eigen::aligned_allocator<pcl::ReferenceFrame> > referenceFrames;
+        std::vector<float> centerDists;
+        std::vector<float> globalDescriptorRadii;
+        std::vector<int> classIds;
+        std::vector<float> weights;
+
+    private:
+        int m_num_features;
+        int m_dim;
+        std::vector<float, Eigen::aligned_allocator<float> > m_descriptors;
+    };
+}
+
+#endif // ISM3D_FEATURE_BLOCK_H
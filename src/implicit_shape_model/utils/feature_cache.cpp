@@ -0,0 +1,218 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "feature_cache.h"
+#include "utils.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+namespace ism3d
+{
+    namespace
+    {
+        const uint32_t CacheMagic = 0x46435349; // "ISCF"
+        const uint32_t CacheVersion = 2;
+
+        // two FNV-1a hashes with different offsets form a 128 bit key
+        struct Hash
+        {
+            Hash() : h1(0xcbf29ce484222325ULL), h2(0x84222325cbf29ce4ULL) {}
+
+            void update(const char *data, size_t size)
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    h1 = (h1 ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+                    h2 = (h2 ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+                    h2 ^= h2 >> 29;
+                }
+            }
+
+            uint64_t h1;
+            uint64_t h2;
+        };
+    }
+
+    FeatureCache::FeatureCache(const std::string &directory)
+        : m_directory(directory)
+    {
+        boost::system::error_code error;
+        boost::filesystem::create_directories(m_directory, error);
+        if (error)
+            LOG_WARN("could not create feature cache directory " << m_directory << ": " << error.message());
+    }
+
+    std::string FeatureCache::computeKey(const std::string &filename, const std::string &config)
+    {
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        if (!file)
+            return "";
+
+        Hash hash;
+        std::vector<char> buffer(1 << 20);
+        while (file)
+        {
+            file.read(buffer.data(), buffer.size());
+            hash.update(buffer.data(), file.gcount());
+        }
+
+        // separate contents and config, so that their boundary is part of the key
+        hash.update("\0", 1);
+        hash.update(config.data(), config.size());
+
+        char key[33];
+        snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)hash.h1, (unsigned long long)hash.h2);
+        return std::string(key);
+    }
+
+    std::string FeatureCache::computeConfigKey(const std::string &config)
+    {
+        Hash hash;
+        hash.update(config.data(), config.size());
+
+        char key[33];
+        snprintf(key, sizeof(key), "%016llx%016llx", (unsigned long long)hash.h1, (unsigned long long)hash.h2);
+        return std::string(key);
+    }
+
+    bool FeatureCache::load(const std::string &key, pcl::PointCloud<ISMFeature>::Ptr &features,
+                            pcl::PointCloud<ISMFeature>::Ptr &global_features) const
+    {
+        std::ifstream file(getPath(key).c_str(), std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t magic = 0, version = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&version, sizeof(version));
+        if (!file || magic != CacheMagic || version != CacheVersion)
+        {
+            LOG_WARN("ignoring invalid feature cache entry " << getPath(key));
+            return false;
+        }
+
+        pcl::PointCloud<ISMFeature>::Ptr local(new pcl::PointCloud<ISMFeature>());
+        pcl::PointCloud<ISMFeature>::Ptr global(new pcl::PointCloud<ISMFeature>());
+        if (!readCloud(file, *local) || !readCloud(file, *global))
+        {
+            LOG_WARN("ignoring truncated feature cache entry " << getPath(key));
+            return false;
+        }
+
+        features = local;
+        global_features = global;
+        return true;
+    }
+
+    bool FeatureCache::store(const std::string &key, pcl::PointCloud<ISMFeature>::ConstPtr features,
+                             pcl::PointCloud<ISMFeature>::ConstPtr global_features) const
+    {
+        std::string path = getPath(key);
+        std::string temp_path = path + "." + boost::filesystem::unique_path().string() + ".tmp";
+
+        {
+            std::ofstream file(temp_path.c_str(), std::ios::binary);
+            if (!file)
+            {
+                LOG_WARN("could not write feature cache entry " << temp_path);
+                return false;
+            }
+            file.write((const char*)&CacheMagic, sizeof(CacheMagic));
+            file.write((const char*)&CacheVersion, sizeof(CacheVersion));
+            writeCloud(file, *features);
+            writeCloud(file, *global_features);
+            if (!file)
+            {
+                LOG_WARN("could not write feature cache entry " << temp_path);
+                file.close();
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+
+        // rename is atomic, readers see either the old or the new entry
+        boost::system::error_code error;
+        boost::filesystem::rename(temp_path, path, error);
+        if (error)
+        {
+            LOG_WARN("could not write feature cache entry " << path << ": " << error.message());
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    void FeatureCache::writeCloud(std::ostream &file, const pcl::PointCloud<ISMFeature> &cloud)
+    {
+        uint64_t size = cloud.size();
+        file.write((const char*)&size, sizeof(size));
+        for (const ISMFeature &feature : cloud.points)
+        {
+            float values[15] = {feature.x, feature.y, feature.z,
+                                feature.referenceFrame.x_axis[0], feature.referenceFrame.x_axis[1], feature.referenceFrame.x_axis[2],
+                                feature.referenceFrame.y_axis[0], feature.referenceFrame.y_axis[1], feature.referenceFrame.y_axis[2],
+                                feature.referenceFrame.z_axis[0], feature.referenceFrame.z_axis[1], feature.referenceFrame.z_axis[2],
+                                feature.centerDist, feature.globalDescriptorRadius, feature.weight};
+            int32_t classId = feature.classId;
+            uint32_t dims = feature.descriptor.size();
+            file.write((const char*)values, sizeof(values));
+            file.write((const char*)&classId, sizeof(classId));
+            file.write((const char*)&dims, sizeof(dims));
+            file.write((const char*)feature.descriptor.data(), dims * sizeof(float));
+        }
+    }
+
+    bool FeatureCache::readCloud(std::istream &file, pcl::PointCloud<ISMFeature> &cloud)
+    {
+        uint64_t size = 0;
+        if (!file.read((char*)&size, sizeof(size)))
+            return false;
+
+        cloud.clear();
+        for (uint64_t i = 0; i < size; i++)
+        {
+            float values[15];
+            int32_t classId;
+            uint32_t dims;
+            if (!file.read((char*)values, sizeof(values)) ||
+                    !file.read((char*)&classId, sizeof(classId)) ||
+                    !file.read((char*)&dims, sizeof(dims)))
+                return false;
+
+            ISMFeature feature;
+            feature.x = values[0];
+            feature.y = values[1];
+            feature.z = values[2];
+            for (int j = 0; j < 3; j++)
+            {
+                feature.referenceFrame.x_axis[j] = values[3 + j];
+                feature.referenceFrame.y_axis[j] = values[6 + j];
+                feature.referenceFrame.z_axis[j] = values[9 + j];
+            }
+            feature.centerDist = values[12];
+            feature.globalDescriptorRadius = values[13];
+            feature.weight = values[14];
+            feature.classId = classId;
+            feature.descriptor.resize(dims);
+            if (!file.read((char*)feature.descriptor.data(), dims * sizeof(float)))
+                return false;
+            cloud.push_back(feature);
+        }
+        return true;
+    }
+
+    std::string FeatureCache::getPath(const std::string &key) const
+    {
+        return (boost::filesystem::path(m_directory) / (key + ".ismfc")).string();
+    }
+}
@@ -0,0 +1,97 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURE_CACHE_H
+#define ISM3D_FEATURE_CACHE_H
+
+#include <iostream>
+#include <string>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The FeatureCache class
+     * On-disk cache for the cleaned local and global features of a training model. An entry is addressed by a
+     * hash of the point cloud file contents and the configuration that was used to compute the features, so that
+     * entries stay valid across runs that only change parameters of later training steps. Entries are written to
+     * a temporary file first and then renamed, so that concurrent runs never read a partially written entry.
+     */
+    class FeatureCache
+    {
+    public:
+        /**
+         * @brief Create a cache in the given directory, the directory is created if it does not exist.
+         * @param directory the cache directory
+         */
+        FeatureCache(const std::string &directory);
+
+        /**
+         * @brief Compute the key of an entry.
+         * @param filename the point cloud file, its contents are part of the key
+         * @param config a string describing the configuration that the features depend on
+         * @return the key, or an empty string if the file could not be read
+         */
+        static std::string computeKey(const std::string &filename, const std::string &config);
+
+        /**
+         * @brief Compute a key from a configuration string only.
+         * @param config a string describing a configuration
+         * @return the key
+         */
+        static std::string computeConfigKey(const std::string &config);
+
+        /**
+         * @brief Load an entry.
+         * @param key the key of the entry
+         * @param features output: the local features
+         * @param global_features output: the global features
+         * @return true if the entry exists and is valid
+         */
+        bool load(const std::string &key, pcl::PointCloud<ISMFeature>::Ptr &features,
+                  pcl::PointCloud<ISMFeature>::Ptr &global_features) const;
+
+        /**
+         * @brief Store an entry, an existing entry with the same key is replaced.
+         * @param key the key of the entry
+         * @param features the local features
+         * @param global_features the global features
+         * @return true if the entry was written
+         */
+        bool store(const std::string &key, pcl::PointCloud<ISMFeature>::ConstPtr features,
+                   pcl::PointCloud<ISMFeature>::ConstPtr global_features) const;
+
+        /**
+         * @brief Write features in the binary format of the cache entries.
+         * @param file the output stream
+         * @param cloud the features
+         */
+        static void writeCloud(std::ostream &file, const pcl::PointCloud<ISMFeature> &cloud);
+
+        /**
+         * @brief Read features written by writeCloud().
+         * @param file the input stream
+         * @param cloud output: the features
+         * @return false if the stream ended early
+         */
+        static bool readCloud(std::istream &file, pcl::PointCloud<ISMFeature> &cloud);
+
+    private:
+        std::string getPath(const std::string &key) const;
+
+        std::string m_directory;
+    };
+}
+
+#endif // ISM3D_FEATURE_CACHE_H
@@ -0,0 +1,130 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "feature_deduplication.h"
+#include "distance.h"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace ism3d
+{
+    namespace
+    {
+        // packs the cell coordinates into a key, 21 bits per coordinate
+        uint64_t cellKey(int x, int y, int z)
+        {
+            const uint64_t mask = (1 << 21) - 1;
+            return ((uint64_t)x & mask) | (((uint64_t)y & mask) << 21) | (((uint64_t)z & mask) << 42);
+        }
+    }
+
+    FeatureDeduplication::FeatureDeduplication(const Distance &distance, float descriptor_distance, float vote_distance)
+        : m_distance(distance), m_descriptor_distance(descriptor_distance), m_vote_distance(vote_distance)
+    {
+    }
+
+    int FeatureDeduplication::apply(std::vector<pcl::PointCloud<ISMFeature>::Ptr> &models,
+                                    const std::vector<Utils::BoundingBox> &bounding_boxes) const
+    {
+        LOG_ASSERT(models.size() == bounding_boxes.size());
+        if (m_vote_distance <= 0)
+            return 0;
+
+        // the kept features with their votes, indexed by the cell of the vote
+        struct Representative
+        {
+            int model;
+            int index;
+            Eigen::Vector3f vote;
+        };
+        std::vector<Representative> representatives;
+        std::unordered_map<uint64_t, std::vector<int> > cells;
+        std::vector<std::vector<bool> > keep(models.size());
+
+        int numRemoved = 0;
+        for (int m = 0; m < (int)models.size(); m++)
+        {
+            pcl::PointCloud<ISMFeature> &features = *models[m];
+            keep[m].assign(features.size(), true);
+            for (int i = 0; i < (int)features.size(); i++)
+            {
+                const ISMFeature &feature = features[i];
+                Eigen::Vector3f keyPos(feature.x, feature.y, feature.z);
+                Eigen::Vector3f vote = Utils::rotateInto(bounding_boxes[m].position - keyPos, feature.referenceFrame);
+                const int cx = (int)std::floor(vote[0] / m_vote_distance);
+                const int cy = (int)std::floor(vote[1] / m_vote_distance);
+                const int cz = (int)std::floor(vote[2] / m_vote_distance);
+
+                // duplicates are within the vote distance and thus in the neighboring cells
+                int duplicate = -1;
+                for (int dx = -1; dx <= 1 && duplicate < 0; dx++)
+                {
+                    for (int dy = -1; dy <= 1 && duplicate < 0; dy++)
+                    {
+                        for (int dz = -1; dz <= 1 && duplicate < 0; dz++)
+                        {
+                            std::unordered_map<uint64_t, std::vector<int> >::const_iterator cell = cells.find(cellKey(cx + dx, cy + dy, cz + dz));
+                            if (cell == cells.end())
+                                continue;
+                            for (int r : cell->second)
+                            {
+                                const Representative &representative = representatives[r];
+                                const ISMFeature &other = models[representative.model]->at(representative.index);
+                                if ((representative.vote - vote).norm() <= m_vote_distance &&
+                                        other.descriptor.size() == feature.descriptor.size() &&
+                                        m_distance(other.descriptor.data(), feature.descriptor.data(),
+                                                   feature.descriptor.size()) <= m_descriptor_distance)
+                                {
+                                    duplicate = r;
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+
+                if (duplicate >= 0)
+                {
+                    const Representative &representative = representatives[duplicate];
+                    models[representative.model]->at(representative.index).weight += feature.weight;
+                    keep[m][i] = false;
+                    numRemoved++;
+                }
+                else
+                {
+                    Representative representative = {m, i, vote};
+                    cells[cellKey(cx, cy, cz)].push_back((int)representatives.size());
+                    representatives.push_back(representative);
+                }
+            }
+        }
+
+        if (numRemoved == 0)
+            return 0;
+
+        // the kept features replace the features of each model
+        for (int m = 0; m < (int)models.size(); m++)
+        {
+            pcl::PointCloud<ISMFeature>::Ptr kept(new pcl::PointCloud<ISMFeature>());
+            kept->reserve(models[m]->size());
+            for (int i = 0; i < (int)models[m]->size(); i++)
+            {
+                if (keep[m][i])
+                    kept->push_back(models[m]->at(i));
+            }
+            kept->height = 1;
+            kept->width = kept->size();
+            models[m] = kept;
+        }
+        return numRemoved;
+    }
+}
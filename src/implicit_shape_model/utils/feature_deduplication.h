@@ -0,0 +1,61 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURE_DEDUPLICATION_H
+#define ISM3D_FEATURE_DEDUPLICATION_H
+
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+#include "utils.h"
+
+namespace ism3d
+{
+    struct Distance;
+
+    /**
+     * @brief The FeatureDeduplication class
+     * Collapses near duplicate training features of a class, as produced by symmetric and repetitive models.
+     * Two features are duplicates if their descriptors are within a descriptor distance and their votes, the
+     * vectors to the center of their bounding box in their reference frame, are within a spatial distance. The
+     * first feature in model order is kept and accumulates the weights of its duplicates. Votes are hashed into
+     * a grid with the spatial distance as cell size, so that only features in neighboring cells are compared.
+     */
+    class FeatureDeduplication
+    {
+    public:
+        /**
+         * @brief Create a deduplication.
+         * @param distance the descriptor distance
+         * @param descriptor_distance the maximum descriptor distance of duplicates, in units of the distance
+         * @param vote_distance the maximum euclidean distance of the votes of duplicates
+         */
+        FeatureDeduplication(const Distance &distance, float descriptor_distance, float vote_distance);
+
+        /**
+         * @brief Collapse the duplicates in the features of all models of a class.
+         * @param models the features of each model, duplicates are removed
+         * @param bounding_boxes the bounding box of each model
+         * @return the number of removed features
+         */
+        int apply(std::vector<pcl::PointCloud<ISMFeature>::Ptr> &models,
+                  const std::vector<Utils::BoundingBox> &bounding_boxes) const;
+
+    private:
+        const Distance &m_distance;
+        float m_descriptor_distance;
+        float m_vote_distance;
+    };
+}
+
+#endif // ISM3D_FEATURE_DEDUPLICATION_H
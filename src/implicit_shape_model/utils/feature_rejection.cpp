@@ -0,0 +1,229 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "feature_rejection.h"
+#include "exception.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <omp.h>
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+namespace ism3d
+{
+    namespace
+    {
+        typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrix;
+    }
+
+    FeatureRejection::FeatureRejection()
+    {
+        clear();
+    }
+
+    void FeatureRejection::clear()
+    {
+        m_dim = 0;
+        m_weights.clear();
+        m_bias = 0;
+        m_quantiles.clear();
+    }
+
+    void FeatureRejection::fit(const float *descriptors, const std::vector<char> &kept, int rows, int dim)
+    {
+        clear();
+        const int numKept = (int)std::count(kept.begin(), kept.begin() + rows, 1);
+        if (dim <= 0 || numKept == 0 || numKept == rows)
+        {
+            LOG_WARN("the feature ranking kept " << numKept << " of " << rows << " features, no feature rejection is fitted");
+            return;
+        }
+
+        Eigen::Map<const RowMatrix> data(descriptors, rows, dim);
+        Eigen::VectorXd meanKept = Eigen::VectorXd::Zero(dim);
+        Eigen::VectorXd meanRemoved = Eigen::VectorXd::Zero(dim);
+        for (int i = 0; i < rows; i++)
+        {
+            if (kept[i])
+                meanKept += data.row(i).cast<double>().transpose();
+            else
+                meanRemoved += data.row(i).cast<double>().transpose();
+        }
+        meanKept /= numKept;
+        meanRemoved /= rows - numKept;
+
+        // the pooled covariance of both groups is accumulated over blocks of descriptors centered on their group
+        const int blockRows = 4096;
+        Eigen::MatrixXd covariance = Eigen::MatrixXd::Zero(dim, dim);
+        for (int begin = 0; begin < rows; begin += blockRows)
+        {
+            const int n = std::min(blockRows, rows - begin);
+            Eigen::MatrixXd block = data.middleRows(begin, n).cast<double>();
+            for (int i = 0; i < n; i++)
+                block.row(i) -= kept[begin + i] ? meanKept.transpose() : meanRemoved.transpose();
+            covariance.noalias() += block.transpose() * block;
+        }
+        covariance /= std::max(rows - 2, 1);
+
+        // the ridge keeps the solution stable for descriptor bins without variance, e.g. empty histogram bins
+        const double ridge = 1e-3 * covariance.trace() / dim + 1e-12;
+        covariance.diagonal().array() += ridge;
+        Eigen::VectorXd weights = covariance.ldlt().solve(meanKept - meanRemoved);
+
+        // scores are scaled to the within group standard deviation, the boundary is between the group means
+        const double scale = std::sqrt(std::max(weights.dot(covariance * weights), 1e-24));
+        weights /= scale;
+        m_dim = dim;
+        m_weights.resize(dim);
+        for (int j = 0; j < dim; j++)
+            m_weights[j] = (float)weights(j);
+        m_bias = (float)(-weights.dot(meanKept + meanRemoved) / 2);
+
+        std::vector<float> scores(rows);
+        Eigen::Map<Eigen::VectorXf>(scores.data(), rows) =
+                (data * Eigen::Map<const Eigen::VectorXf>(m_weights.data(), dim)).array() + m_bias;
+
+        // the area under the curve of kept against removed features from the ranks of the scores
+        std::vector<int> order(rows);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&scores](int a, int b) { return scores[a] < scores[b]; });
+        double rankSum = 0;
+        for (int r = 0; r < rows; r++)
+        {
+            if (kept[order[r]])
+                rankSum += r + 1;
+        }
+        const double auc = (rankSum - (double)numKept * (numKept + 1) / 2) / ((double)numKept * (rows - numKept));
+
+        m_quantiles.resize(NumQuantiles);
+        for (int q = 0; q < NumQuantiles; q++)
+            m_quantiles[q] = scores[order[(int)std::lround((double)q * (rows - 1) / (NumQuantiles - 1))]];
+
+        LOG_INFO("feature rejection fitted on " << rows << " features, area under the curve of kept against removed features: " << auc);
+    }
+
+    float FeatureRejection::getThreshold(float rejectionRate) const
+    {
+        if (m_quantiles.empty() || rejectionRate <= 0)
+            return -std::numeric_limits<float>::max();
+        if (rejectionRate >= 1)
+            return std::numeric_limits<float>::max();
+
+        const float position = rejectionRate * (NumQuantiles - 1);
+        const int lower = std::min((int)position, NumQuantiles - 2);
+        const float fraction = position - lower;
+        return m_quantiles[lower] + fraction * (m_quantiles[lower + 1] - m_quantiles[lower]);
+    }
+
+    void FeatureRejection::score(const pcl::PointCloud<ISMFeature> &features, std::vector<float> &scores, int numThreads) const
+    {
+        const int rows = (int)features.size();
+        scores.resize(rows);
+        Eigen::Map<const Eigen::VectorXf> weights(m_weights.data(), m_dim);
+
+        for (int i = 0; i < rows; i++)
+        {
+            if ((int)features.points[i].descriptor.size() != m_dim)
+                throw RuntimeException("descriptor size does not match the feature rejection");
+        }
+
+        #pragma omp parallel for num_threads(numThreads > 0 ? numThreads : omp_get_max_threads())
+        for (int i = 0; i < rows; i++)
+        {
+            const std::vector<float> &descriptor = features.points[i].descriptor;
+            scores[i] = Eigen::Map<const Eigen::VectorXf>(descriptor.data(), m_dim).dot(weights) + m_bias;
+        }
+    }
+
+    int FeatureRejection::reject(pcl::PointCloud<ISMFeature> &features, float rejectionRate, int numThreads) const
+    {
+        if (!isTrained() || rejectionRate <= 0 || features.empty())
+            return 0;
+
+        std::vector<float> scores;
+        score(features, scores, numThreads);
+        const float threshold = getThreshold(rejectionRate);
+
+        int next = 0;
+        for (int i = 0; i < (int)features.size(); i++)
+        {
+            if (scores[i] >= threshold)
+            {
+                if (next != i)
+                    features.points[next] = features.points[i];
+                next++;
+            }
+        }
+        const int removed = (int)features.size() - next;
+        features.points.resize(next);
+        features.width = next;
+        features.height = 1;
+        return removed;
+    }
+
+    void FeatureRejection::saveData(boost::archive::binary_oarchive &oa) const
+    {
+        oa << m_dim;
+        oa << m_weights;
+        oa << m_bias;
+        oa << m_quantiles;
+    }
+
+    bool FeatureRejection::loadData(boost::archive::binary_iarchive &ia)
+    {
+        ia >> m_dim;
+        ia >> m_weights;
+        ia >> m_bias;
+        ia >> m_quantiles;
+        return (int)m_weights.size() == m_dim && (m_dim == 0 || (int)m_quantiles.size() == NumQuantiles);
+    }
+
+    Json::Value FeatureRejection::dataToJson() const
+    {
+        Json::Value data(Json::objectValue);
+        data["Dim"] = m_dim;
+        data["Bias"] = m_bias;
+        Json::Value weights(Json::arrayValue);
+        for (float value : m_weights)
+            weights.append(value);
+        data["Weights"] = weights;
+        Json::Value quantiles(Json::arrayValue);
+        for (float value : m_quantiles)
+            quantiles.append(value);
+        data["Quantiles"] = quantiles;
+        return data;
+    }
+
+    bool FeatureRejection::dataFromJson(const Json::Value &object)
+    {
+        clear();
+        const Json::Value &weights = object["Weights"];
+        const Json::Value &quantiles = object["Quantiles"];
+        if (!object["Dim"].isInt() || !weights.isArray() || !quantiles.isArray())
+            return false;
+
+        const int dim = object["Dim"].asInt();
+        if ((int)weights.size() != dim || (int)quantiles.size() != NumQuantiles)
+            return false;
+
+        m_dim = dim;
+        m_bias = object["Bias"].asFloat();
+        for (Json::ArrayIndex j = 0; j < weights.size(); j++)
+            m_weights.push_back(weights[j].asFloat());
+        for (Json::ArrayIndex j = 0; j < quantiles.size(); j++)
+            m_quantiles.push_back(quantiles[j].asFloat());
+        return true;
+    }
+}
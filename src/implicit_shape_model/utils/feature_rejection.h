@@ -0,0 +1,95 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURE_REJECTION_H
+#define ISM3D_FEATURE_REJECTION_H
+
+#include <vector>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+#include <jsoncpp/json/json.h>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The FeatureRejection class
+     * Predicts from its descriptor whether a feature is discriminative, so that scene features that the feature
+     * ranking would have removed in training, e.g. on planar background, are rejected before the activation. The
+     * predictor is a linear discriminant fitted on the training features kept and removed by the ranking: the
+     * score of a descriptor is its projection onto the direction that separates both groups best relative to their
+     * pooled covariance, higher scores are more discriminative. The distribution of the scores of the training
+     * features is kept, so that the rejection rate is a detection parameter: the threshold is the score below which
+     * that fraction of the training features lies.
+     */
+    class FeatureRejection
+    {
+    public:
+        FeatureRejection();
+
+        /**
+         * @brief Fit the predictor.
+         * @param descriptors the training descriptors, one after another
+         * @param kept for each descriptor whether the ranking kept its feature
+         * @param rows the number of descriptors
+         * @param dim the descriptor dimension
+         */
+        void fit(const float *descriptors, const std::vector<char> &kept, int rows, int dim);
+
+        bool isTrained() const
+        {
+            return m_dim > 0;
+        }
+
+        int getDim() const
+        {
+            return m_dim;
+        }
+
+        // the score below which the fraction rejectionRate of the training features lies
+        float getThreshold(float rejectionRate) const;
+
+        // the scores of features, throws if a descriptor has another dimension
+        void score(const pcl::PointCloud<ISMFeature> &features, std::vector<float> &scores, int numThreads) const;
+
+        /**
+         * @brief Remove the features scored below the threshold of a rejection rate, the order of the remaining
+         * features is kept.
+         * @param features the features
+         * @param rejectionRate the fraction of the training features that would be rejected
+         * @param numThreads the number of threads, 0 for the OpenMP default
+         * @return the number of removed features
+         */
+        int reject(pcl::PointCloud<ISMFeature> &features, float rejectionRate, int numThreads) const;
+
+        void clear();
+
+        void saveData(boost::archive::binary_oarchive &oa) const;
+        bool loadData(boost::archive::binary_iarchive &ia);
+
+        Json::Value dataToJson() const;
+        bool dataFromJson(const Json::Value &object);
+
+    private:
+        static const int NumQuantiles = 101;
+
+        int m_dim;
+        std::vector<float> m_weights;
+        float m_bias;
+        std::vector<float> m_quantiles; // NumQuantiles evenly spaced quantiles of the training scores
+    };
+}
+
+#endif // ISM3D_FEATURE_REJECTION_H
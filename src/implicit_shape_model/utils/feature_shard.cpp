@@ -0,0 +1,156 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "feature_shard.h"
+#include "feature_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <boost/filesystem.hpp>
+
+namespace ism3d
+{
+    namespace
+    {
+        const uint32_t ShardMagic = 0x53465349; // "ISFS"
+        const uint32_t ShardVersion = 2;
+    }
+
+    bool FeatureShard::write(const std::string &filename) const
+    {
+        const std::string temp_path = filename + "." + boost::filesystem::unique_path().string() + ".tmp";
+        std::ofstream file(temp_path.c_str(), std::ios::binary);
+        if (!file)
+        {
+            LOG_ERROR("could not write feature shard " << temp_path);
+            return false;
+        }
+
+        uint32_t keySize = key.size();
+        uint32_t index = shard_index;
+        uint32_t count = num_shards;
+        uint32_t numClasses = model_indices.size();
+        file.write((const char*)&ShardMagic, sizeof(ShardMagic));
+        file.write((const char*)&ShardVersion, sizeof(ShardVersion));
+        file.write((const char*)&keySize, sizeof(keySize));
+        file.write(key.data(), keySize);
+        file.write((const char*)&index, sizeof(index));
+        file.write((const char*)&count, sizeof(count));
+        file.write((const char*)&numClasses, sizeof(numClasses));
+
+        // models are stored with their bounding box, global features and local features one after the other
+        for (auto it = model_indices.begin(); it != model_indices.end(); it++)
+        {
+            const unsigned classId = it->first;
+            const std::vector<pcl::PointCloud<ISMFeature>::Ptr> &classFeatures = features.at(classId);
+            const std::vector<pcl::PointCloud<ISMFeature>::Ptr> &classGlobalFeatures = global_features.at(classId);
+            const std::vector<Utils::BoundingBox> &classBoxes = bounding_boxes.at(classId);
+            LOG_ASSERT(classFeatures.size() == it->second.size() && classGlobalFeatures.size() == it->second.size() &&
+                       classBoxes.size() == it->second.size());
+
+            uint32_t fileClassId = classId;
+            uint32_t numModels = it->second.size();
+            file.write((const char*)&fileClassId, sizeof(fileClassId));
+            file.write((const char*)&numModels, sizeof(numModels));
+            for (uint32_t j = 0; j < numModels; j++)
+            {
+                const Utils::BoundingBox &box = classBoxes[j];
+                uint32_t modelIndex = it->second[j];
+                float values[10] = {box.position[0], box.position[1], box.position[2],
+                                    box.rotQuat.R_component_1(), box.rotQuat.R_component_2(),
+                                    box.rotQuat.R_component_3(), box.rotQuat.R_component_4(),
+                                    box.size[0], box.size[1], box.size[2]};
+                file.write((const char*)&modelIndex, sizeof(modelIndex));
+                file.write((const char*)values, sizeof(values));
+                FeatureCache::writeCloud(file, *classGlobalFeatures[j]);
+                FeatureCache::writeCloud(file, *classFeatures[j]);
+            }
+        }
+
+        file.close();
+        boost::system::error_code error;
+        if (file)
+            boost::filesystem::rename(temp_path, filename, error);
+        if (!file || error)
+        {
+            LOG_ERROR("could not write feature shard " << filename);
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool FeatureShard::read(const std::string &filename)
+    {
+        model_indices.clear();
+        features.clear();
+        global_features.clear();
+        bounding_boxes.clear();
+
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        if (!file)
+        {
+            LOG_ERROR("could not open feature shard " << filename);
+            return false;
+        }
+
+        uint32_t magic = 0, version = 0, keySize = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&version, sizeof(version));
+        file.read((char*)&keySize, sizeof(keySize));
+        if (!file || magic != ShardMagic || version != ShardVersion)
+        {
+            LOG_ERROR("not a feature shard: " << filename);
+            return false;
+        }
+
+        uint32_t index = 0, count = 0, numClasses = 0;
+        key.assign(keySize, 0);
+        bool success = (bool)file.read(&key[0], keySize) && (bool)file.read((char*)&index, sizeof(index)) &&
+                (bool)file.read((char*)&count, sizeof(count)) && (bool)file.read((char*)&numClasses, sizeof(numClasses));
+        shard_index = index;
+        num_shards = count;
+
+        for (uint32_t i = 0; success && i < numClasses; i++)
+        {
+            uint32_t classId = 0, numModels = 0;
+            success = file.read((char*)&classId, sizeof(classId)) && file.read((char*)&numModels, sizeof(numModels));
+            for (uint32_t j = 0; success && j < numModels; j++)
+            {
+                uint32_t modelIndex = 0;
+                float values[10];
+                pcl::PointCloud<ISMFeature>::Ptr globalCloud(new pcl::PointCloud<ISMFeature>());
+                pcl::PointCloud<ISMFeature>::Ptr cloud(new pcl::PointCloud<ISMFeature>());
+                success = file.read((char*)&modelIndex, sizeof(modelIndex)) && file.read((char*)values, sizeof(values)) &&
+                        FeatureCache::readCloud(file, *globalCloud) && FeatureCache::readCloud(file, *cloud);
+                if (!success)
+                    break;
+
+                Utils::BoundingBox box;
+                box.position = Eigen::Vector3f(values[0], values[1], values[2]);
+                box.rotQuat = boost::math::quaternion<float>(values[3], values[4], values[5], values[6]);
+                box.size = Eigen::Vector3f(values[7], values[8], values[9]);
+
+                model_indices[classId].push_back(modelIndex);
+                bounding_boxes[classId].push_back(box);
+                global_features[classId].push_back(globalCloud);
+                features[classId].push_back(cloud);
+            }
+        }
+
+        if (!success)
+        {
+            LOG_ERROR("truncated feature shard " << filename);
+            return false;
+        }
+        return true;
+    }
+}
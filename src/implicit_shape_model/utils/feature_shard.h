@@ -0,0 +1,67 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURE_SHARD_H
+#define ISM3D_FEATURE_SHARD_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The FeatureShard struct
+     * The training data of a slice of the training models: local features, global features and bounding boxes
+     * by class id. Shards are computed independently, e.g. on different nodes, and merged for training. Each
+     * model carries its index in the list of training models of its class, so that the merged training data is
+     * in the same order as if it had been computed in a single run. The key identifies the configuration the
+     * features were computed with, only shards with the same key can be merged.
+     */
+    struct FeatureShard
+    {
+        FeatureShard()
+            : shard_index(0), num_shards(1)
+        {
+        }
+
+        /**
+         * @brief Write the shard to a file, the file is written to a temporary file first and then renamed.
+         * @param filename the shard file
+         * @return true if the shard was written
+         */
+        bool write(const std::string &filename) const;
+
+        /**
+         * @brief Read a shard from a file.
+         * @param filename the shard file
+         * @return false if the file is missing, not a shard or truncated
+         */
+        bool read(const std::string &filename);
+
+        std::string key;
+        unsigned shard_index;
+        unsigned num_shards;
+
+        // per class id and model: the index of the model in its class, the features and the bounding box
+        std::map<unsigned, std::vector<unsigned> > model_indices;
+        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > features;
+        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > global_features;
+        std::map<unsigned, std::vector<Utils::BoundingBox> > bounding_boxes;
+    };
+}
+
+#endif // ISM3D_FEATURE_SHARD_H
@@ -0,0 +1,313 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "feature_store.h"
+#include "utils.h"
+#include "exception.h"
+
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+
+namespace ism3d
+{
+    namespace
+    {
+        // position, reference frame, center distance, global descriptor radius and weight, followed by class id
+        // and length
+        const int NumValues = 15;
+        const std::size_t FeatureHeaderBytes = NumValues * sizeof(float) + sizeof(int32_t) + sizeof(uint32_t);
+
+        void encodeFeature(const ISMFeature &feature, char *&out)
+        {
+            float values[NumValues] = {feature.x, feature.y, feature.z,
+                                       feature.referenceFrame.x_axis[0], feature.referenceFrame.x_axis[1], feature.referenceFrame.x_axis[2],
+                                       feature.referenceFrame.y_axis[0], feature.referenceFrame.y_axis[1], feature.referenceFrame.y_axis[2],
+                                       feature.referenceFrame.z_axis[0], feature.referenceFrame.z_axis[1], feature.referenceFrame.z_axis[2],
+                                       feature.centerDist, feature.globalDescriptorRadius, feature.weight};
+            int32_t classId = feature.classId;
+            uint32_t dims = feature.descriptor.size();
+            std::memcpy(out, values, sizeof(values));
+            out += sizeof(values);
+            std::memcpy(out, &classId, sizeof(classId));
+            out += sizeof(classId);
+            std::memcpy(out, &dims, sizeof(dims));
+            out += sizeof(dims);
+            std::memcpy(out, feature.descriptor.data(), dims * sizeof(float));
+            out += dims * sizeof(float);
+        }
+
+        bool decodeFeature(const char *&in, const char *end, ISMFeature &feature)
+        {
+            if ((std::size_t)(end - in) < FeatureHeaderBytes)
+                return false;
+
+            float values[NumValues];
+            int32_t classId;
+            uint32_t dims;
+            std::memcpy(values, in, sizeof(values));
+            in += sizeof(values);
+            std::memcpy(&classId, in, sizeof(classId));
+            in += sizeof(classId);
+            std::memcpy(&dims, in, sizeof(dims));
+            in += sizeof(dims);
+            if ((std::size_t)(end - in) < dims * sizeof(float))
+                return false;
+
+            feature.x = values[0];
+            feature.y = values[1];
+            feature.z = values[2];
+            for (int j = 0; j < 3; j++)
+            {
+                feature.referenceFrame.x_axis[j] = values[3 + j];
+                feature.referenceFrame.y_axis[j] = values[6 + j];
+                feature.referenceFrame.z_axis[j] = values[9 + j];
+            }
+            feature.centerDist = values[12];
+            feature.globalDescriptorRadius = values[13];
+            feature.weight = values[14];
+            feature.classId = classId;
+            feature.descriptor.resize(dims);
+            std::memcpy(feature.descriptor.data(), in, dims * sizeof(float));
+            in += dims * sizeof(float);
+            return true;
+        }
+    }
+
+    FeatureStore::FeatureStore()
+        : m_spillToDisk(false), m_maxResidentBytes(0), m_residentBytes(0)
+    {
+    }
+
+    FeatureStore::FeatureStore(const std::string &directory, std::size_t maxResidentBytes)
+        : m_spillToDisk(true), m_maxResidentBytes(maxResidentBytes), m_residentBytes(0)
+    {
+        boost::filesystem::path parent = directory.empty() ? boost::filesystem::temp_directory_path() :
+                                                             boost::filesystem::path(directory);
+        boost::filesystem::path path = parent / boost::filesystem::unique_path("ism_features_%%%%-%%%%-%%%%");
+
+        boost::system::error_code error;
+        boost::filesystem::create_directories(path, error);
+        if (error)
+            throw RuntimeException("could not create feature store directory " + path.string() + ": " + error.message());
+        m_directory = path.string();
+    }
+
+    FeatureStore::~FeatureStore()
+    {
+        for (auto it = m_classes.begin(); it != m_classes.end(); it++)
+        {
+            if (it->second.fd >= 0)
+                close(it->second.fd);
+        }
+
+        if (!m_directory.empty())
+        {
+            boost::system::error_code error;
+            boost::filesystem::remove_all(m_directory, error);
+        }
+    }
+
+    void FeatureStore::store(unsigned classId, int model, pcl::PointCloud<ISMFeature>::Ptr features)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        ClassFile &classFile = m_classes[classId];
+        if ((int)classFile.segments.size() <= model)
+            classFile.segments.resize(model + 1);
+
+        // the space of replaced segments in the file is not reused
+        Segment &segment = classFile.segments[model];
+        if (segment.resident)
+            m_residentBytes -= estimateBytes(*segment.resident);
+
+        segment = Segment();
+        segment.resident = features;
+        segment.numFeatures = features->size();
+        m_residentBytes += estimateBytes(*features);
+        m_residentOrder.push_back(std::make_pair(classId, model));
+
+        if (m_spillToDisk)
+            spill();
+    }
+
+    void FeatureStore::spill()
+    {
+        std::vector<char> buffer;
+        while (m_residentBytes > m_maxResidentBytes && !m_residentOrder.empty())
+        {
+            std::pair<unsigned, int> oldest = m_residentOrder.front();
+            m_residentOrder.pop_front();
+
+            // models can be queued several times if they were replaced
+            ClassFile &classFile = m_classes[oldest.first];
+            Segment &segment = classFile.segments[oldest.second];
+            if (!segment.resident)
+                continue;
+
+            if (classFile.fd < 0)
+            {
+                std::ostringstream filename;
+                filename << "class_" << oldest.first << ".seg";
+                std::string path = (boost::filesystem::path(m_directory) / filename.str()).string();
+                classFile.fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+                if (classFile.fd < 0)
+                    throw RuntimeException("could not create feature store file " + path);
+            }
+
+            const pcl::PointCloud<ISMFeature> &features = *segment.resident;
+            std::size_t size = 0;
+            for (const ISMFeature &feature : features.points)
+                size += FeatureHeaderBytes + feature.descriptor.size() * sizeof(float);
+
+            buffer.resize(size);
+            char *out = buffer.data();
+            for (const ISMFeature &feature : features.points)
+                encodeFeature(feature, out);
+
+            std::size_t written = 0;
+            while (written < size)
+            {
+                ssize_t result = pwrite(classFile.fd, buffer.data() + written, size - written, classFile.size + written);
+                if (result <= 0)
+                    throw RuntimeException("could not write to feature store in " + m_directory);
+                written += result;
+            }
+
+            segment.offset = classFile.size;
+            segment.size = size;
+            classFile.size += size;
+
+            m_residentBytes -= estimateBytes(features);
+            segment.resident.reset();
+        }
+    }
+
+    pcl::PointCloud<ISMFeature>::Ptr FeatureStore::decode(int fd, const Segment &segment) const
+    {
+        pcl::PointCloud<ISMFeature>::Ptr features(new pcl::PointCloud<ISMFeature>());
+        if (segment.numFeatures == 0)
+            return features;
+
+        // mappings start at a page boundary
+        const uint64_t pageSize = sysconf(_SC_PAGESIZE);
+        const uint64_t start = segment.offset - segment.offset % pageSize;
+        const uint64_t length = segment.offset + segment.size - start;
+        void *mapped = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, start);
+        if (mapped == MAP_FAILED)
+            throw RuntimeException("could not map feature store segment in " + m_directory);
+        madvise(mapped, length, MADV_SEQUENTIAL);
+
+        const char *in = (const char*)mapped + (segment.offset - start);
+        const char *end = in + segment.size;
+        features->points.resize(segment.numFeatures);
+        bool valid = true;
+        for (uint64_t i = 0; i < segment.numFeatures && valid; i++)
+            valid = decodeFeature(in, end, features->points[i]);
+        munmap(mapped, length);
+
+        if (!valid)
+            throw RuntimeException("corrupt feature store segment in " + m_directory);
+
+        features->width = features->points.size();
+        features->height = 1;
+        return features;
+    }
+
+    pcl::PointCloud<ISMFeature>::Ptr FeatureStore::load(unsigned classId, int model) const
+    {
+        int fd;
+        Segment segment;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_classes.find(classId);
+            if (it == m_classes.end() || model >= (int)it->second.segments.size())
+                return pcl::PointCloud<ISMFeature>::Ptr(new pcl::PointCloud<ISMFeature>());
+
+            fd = it->second.fd;
+            segment = it->second.segments[model];
+        }
+
+        if (segment.resident)
+            return segment.resident;
+        return decode(fd, segment);
+    }
+
+    std::vector<pcl::PointCloud<ISMFeature>::Ptr> FeatureStore::loadClass(unsigned classId) const
+    {
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> features(getNumModels(classId));
+        for (int i = 0; i < (int)features.size(); i++)
+            features[i] = load(classId, i);
+        return features;
+    }
+
+    std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > FeatureStore::loadAll() const
+    {
+        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > features;
+        for (unsigned classId : getClassIds())
+            features[classId] = loadClass(classId);
+        return features;
+    }
+
+    std::vector<unsigned> FeatureStore::getClassIds() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::vector<unsigned> classIds;
+        for (auto it = m_classes.begin(); it != m_classes.end(); it++)
+            classIds.push_back(it->first);
+        return classIds;
+    }
+
+    int FeatureStore::getNumModels(unsigned classId) const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_classes.find(classId);
+        return it == m_classes.end() ? 0 : (int)it->second.segments.size();
+    }
+
+    std::size_t FeatureStore::getNumFeatures() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::size_t numFeatures = 0;
+        for (auto it = m_classes.begin(); it != m_classes.end(); it++)
+        {
+            for (const Segment &segment : it->second.segments)
+                numFeatures += segment.numFeatures;
+        }
+        return numFeatures;
+    }
+
+    void FeatureStore::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_classes.begin(); it != m_classes.end(); it++)
+        {
+            if (it->second.fd < 0)
+                continue;
+            if (ftruncate(it->second.fd, 0) != 0)
+                LOG_WARN("could not truncate feature store file in " << m_directory);
+            close(it->second.fd);
+        }
+        m_classes.clear();
+        m_residentOrder.clear();
+        m_residentBytes = 0;
+    }
+
+    std::size_t FeatureStore::estimateBytes(const pcl::PointCloud<ISMFeature> &features)
+    {
+        std::size_t bytes = features.size() * sizeof(ISMFeature);
+        for (const ISMFeature &feature : features.points)
+            bytes += feature.descriptor.capacity() * sizeof(float);
+        return bytes;
+    }
+}
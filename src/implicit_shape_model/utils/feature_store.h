@@ -0,0 +1,131 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FEATURE_STORE_H
+#define ISM3D_FEATURE_STORE_H
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The FeatureStore class
+     * Holds the features of each training model of each class, so that training steps can visit them class by class
+     * without keeping all features in memory. The features of a model stay in memory until the stored features
+     * exceed the memory budget, then the oldest models are written as segments to one file per class. Loading a
+     * model that was written maps its segment and decodes it into a new point cloud. A store without a directory
+     * keeps all features in memory. Storing is thread safe, the files are removed by the destructor.
+     */
+    class FeatureStore
+    {
+    public:
+        /**
+         * @brief Create a store that keeps all features in memory.
+         */
+        FeatureStore();
+
+        /**
+         * @brief Create a store that writes features to disk.
+         * @param directory the directory in which a unique subdirectory for the segment files is created, the
+         * system temporary directory if empty
+         * @param maxResidentBytes the memory budget for features kept in memory, 0 writes all features to disk
+         */
+        FeatureStore(const std::string &directory, std::size_t maxResidentBytes);
+
+        ~FeatureStore();
+
+        /**
+         * @brief Store the features of a model, replacing previously stored features of the model. The features
+         * are shared with the caller while they are in memory and must not be changed afterwards.
+         * @param classId the class id of the model
+         * @param model the index of the model in its class
+         * @param features the features of the model
+         */
+        void store(unsigned classId, int model, pcl::PointCloud<ISMFeature>::Ptr features);
+
+        /**
+         * @brief Load the features of a model.
+         * @param classId the class id of the model
+         * @param model the index of the model in its class
+         * @return the features, an empty cloud if no features were stored for the model
+         */
+        pcl::PointCloud<ISMFeature>::Ptr load(unsigned classId, int model) const;
+
+        /**
+         * @brief Load the features of all models of a class.
+         * @param classId the class id
+         * @return the features of each model in the order of the model indices
+         */
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> loadClass(unsigned classId) const;
+
+        /**
+         * @brief Load the features of all models of all classes.
+         * @return the features of each model for each class id
+         */
+        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > loadAll() const;
+
+        std::vector<unsigned> getClassIds() const;
+        int getNumModels(unsigned classId) const;
+        std::size_t getNumFeatures() const;
+
+        /**
+         * @brief Remove all features and truncate the segment files, must not be called during loads.
+         */
+        void clear();
+
+    private:
+        struct Segment
+        {
+            Segment() : numFeatures(0), offset(0), size(0) {}
+
+            pcl::PointCloud<ISMFeature>::Ptr resident; // null if the segment was written to disk
+            uint64_t numFeatures;
+            uint64_t offset;
+            uint64_t size;
+        };
+
+        struct ClassFile
+        {
+            ClassFile() : fd(-1), size(0) {}
+
+            std::vector<Segment> segments;
+            int fd;
+            uint64_t size;
+        };
+
+        // writes the oldest resident segments to disk until the budget is met, the caller holds the mutex
+        void spill();
+
+        pcl::PointCloud<ISMFeature>::Ptr decode(int fd, const Segment &segment) const;
+
+        static std::size_t estimateBytes(const pcl::PointCloud<ISMFeature> &features);
+
+        std::string m_directory;
+        bool m_spillToDisk;
+        std::size_t m_maxResidentBytes;
+        std::size_t m_residentBytes;
+        std::map<unsigned, ClassFile> m_classes;
+        std::deque<std::pair<unsigned, int> > m_residentOrder;
+        mutable std::mutex m_mutex;
+    };
+}
+
+#endif // ISM3D_FEATURE_STORE_H
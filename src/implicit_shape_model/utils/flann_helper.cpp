@@ -9,18 +9,37 @@
  */
 
 #include "flann_helper.h"
+#include "hnsw_index.h"
+#include "mih_index.h"
+#include "pq_index.h"
+#include "sq_index.h"
+#include "embedded_index.h"
+#include "../clustering/bounded_kmeans.h"
+#ifdef USE_CUDA
+#include "cuda_index.h"
+#endif
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <boost/filesystem.hpp>
 
 namespace ism3d
 {
 
 FlannHelper::~FlannHelper()
 {
-    delete[] dataset.ptr();
+    if(m_owns_dataset)
+        delete[] dataset.ptr();
 }
 
 void FlannHelper::createDataset(std::vector<std::shared_ptr<Codeword>> &codewords)
 {
+    LOG_ASSERT(m_owns_dataset);
+
     // build dataset
+    m_codeword_ids.assign(codewords.size(), -1);
     for(int i = 0; i < (int)codewords.size(); i++)
     {
         const std::shared_ptr<Codeword>& codeword = codewords[i];
@@ -29,73 +48,515 @@ void FlannHelper::createDataset(std::vector<std::shared_ptr<Codeword>> &codeword
             LOG_WARN("invalid codeword, this might lead to errors");
             continue;
         }
+        m_codeword_ids[i] = codeword->getId();
 
-        std::vector<float> descriptor = codeword->getData();
-        for(int j = 0; j < (int)descriptor.size(); j++)
-        {
-            dataset[i][j] = descriptor.at(j);
-        }
+        const std::vector<float> &descriptor = codeword->getData();
+        std::copy(descriptor.begin(), descriptor.end(), dataset[i]);
     }
 }
 
 void FlannHelper::createDataset(pcl::PointCloud<ISMFeature>::Ptr global_features)
 {
+    LOG_ASSERT(m_owns_dataset);
+
     // build dataset
-    for(int i = 0; i < (int)global_features->size(); i++)
+    if(!FeatureBlock::copyDescriptors(*global_features, dataset.ptr(), dataset.cols))
+        LOG_ERROR("invalid descriptor size in global features");
+}
+
+void FlannHelper::setCodewords(const std::vector<std::shared_ptr<Codeword> > &codewords)
+{
+    LOG_ASSERT(codewords.size() == dataset.rows);
+
+    m_codeword_ids.assign(codewords.size(), -1);
+    for(int i = 0; i < (int)codewords.size(); i++)
     {
-        const ISMFeature feat = global_features->at(i);
-        std::vector<float> descriptor = feat.descriptor;
-        for(int j = 0; j < (int)descriptor.size(); j++)
-        {
-            dataset[i][j] = descriptor.at(j);
-        }
+        if(codewords[i])
+            m_codeword_ids[i] = codewords[i]->getId();
     }
 }
 
 void FlannHelper::buildIndex(std::string dist_type, int kd_trees)
 {
-    if(dist_type == "Euclidean")
+    KnnIndexParams params;
+    params.kd_trees = kd_trees;
+    buildIndex(dist_type, params);
+}
+
+namespace
+{
+// the size of the index structure for the distance functor it was built for
+struct IndexMemoryVisitor
+{
+    const FlannHelper &helper;
+    std::size_t &bytes;
+
+    template<typename T>
+    void operator()(T)
     {
-        m_index = std::make_shared<flann::Index<flann::L2<float>>>(dataset, flann::KDTreeIndexParams(kd_trees));
-        (std::static_pointer_cast<flann::Index<flann::L2<float>>>(m_index))->buildIndex();
+        bytes = helper.getIndex<T>()->getMemoryUsage();
     }
-    if(dist_type == "ChiSquared")
+};
+
+// builds the index backend selected in the params for a distance functor
+struct CreateIndexVisitor
+{
+    const flann::Matrix<float> &dataset;
+    const KnnIndexParams &params;
+    std::shared_ptr<void> &result;
+
+    template<typename T>
+    void operator()(T)
     {
-        m_index = std::make_shared<flann::Index<flann::ChiSquareDistance<float>>>(dataset, flann::KDTreeIndexParams(kd_trees));
-        (std::static_pointer_cast<flann::Index<flann::ChiSquareDistance<float>>>(m_index))->buildIndex();
+        // histogram distances are searched with the selected backend on their euclidean embedding
+        if(params.embed_histograms && MetricEmbedding::isSupported(IndexDistanceOf<T>::value))
+        {
+            std::shared_ptr<const MetricEmbedding> embedding =
+                    std::make_shared<MetricEmbedding>(IndexDistanceOf<T>::value, dataset.cols, params.embedding_order);
+            std::shared_ptr<EmbeddedIndex<T>> index = std::make_shared<EmbeddedIndex<T>>(dataset, embedding, params.embedding_rerank);
+            std::shared_ptr<void> euclidean;
+            CreateIndexVisitor{index->getEmbeddedDataset(), params, euclidean}(flann::L2<float>());
+            index->setIndex(std::static_pointer_cast<KnnIndex<flann::L2<float>>>(euclidean));
+            result = std::shared_ptr<KnnIndex<T>>(index);
+            return;
+        }
+
+        std::shared_ptr<KnnIndex<T>> index;
+        if(params.type == "HNSW")
+            index = std::make_shared<HnswIndex<T>>(dataset, params.hnsw_m, params.hnsw_ef_construction, params.hnsw_ef_search);
+#ifdef USE_CUDA
+        else if(params.type == "CUDA")
+            index = std::make_shared<CudaBruteForceIndex<T>>(dataset);
+#endif
+        else
+            index = std::make_shared<FlannKdTreeIndex<T>>(dataset, params.kd_trees, params.checks);
+        index->buildIndex();
+        result = index;
     }
-    if(dist_type == "Hellinger")
+
+    // binary descriptors are bit-packed and searched by multi-index hashing independent of the index type
+    void operator()(BinaryHamming<float>)
+    {
+        std::shared_ptr<KnnIndex<BinaryHamming<float>>> index =
+                std::make_shared<MultiIndexHashingIndex<BinaryHamming<float>>>(dataset, params.mih_tables);
+        index->buildIndex();
+        result = index;
+    }
+};
+
+// restores an index that was written with KnnIndex::save(), the result is empty if the file does not match
+struct LoadIndexVisitor
+{
+    const flann::Matrix<float> &dataset;
+    const KnnIndexParams &params;
+    const std::string &filename;
+    std::shared_ptr<void> &result;
+
+    template<typename T>
+    void operator()(T)
     {
-        m_index = std::make_shared<flann::Index<flann::HellingerDistance<float>>>(dataset, flann::KDTreeIndexParams(kd_trees));
-        (std::static_pointer_cast<flann::Index<flann::HellingerDistance<float>>>(m_index))->buildIndex();
+        if(params.type == "HNSW")
+        {
+            std::shared_ptr<HnswIndex<T>> index = std::make_shared<HnswIndex<T>>(dataset, params.hnsw_m,
+                                                                                 params.hnsw_ef_construction, params.hnsw_ef_search);
+            if(index->load(filename))
+                result = std::shared_ptr<KnnIndex<T>>(index);
+            return;
+        }
+#ifdef USE_CUDA
+        if(params.type == "CUDA")
+        {
+            std::shared_ptr<CudaBruteForceIndex<T>> index = std::make_shared<CudaBruteForceIndex<T>>(dataset);
+            if(index->load(filename))
+                result = std::shared_ptr<KnnIndex<T>>(index);
+            return;
+        }
+#endif
+        result = std::shared_ptr<KnnIndex<T>>(std::make_shared<FlannKdTreeIndex<T>>(dataset, filename, params.checks));
     }
-    if(dist_type == "HistIntersection")
+
+    void operator()(BinaryHamming<float>)
     {
-        m_index = std::make_shared<flann::Index<flann::HistIntersectionDistance<float>>>(dataset, flann::KDTreeIndexParams(kd_trees));
-        (std::static_pointer_cast<flann::Index<flann::HistIntersectionDistance<float>>>(m_index))->buildIndex();
+        std::shared_ptr<MultiIndexHashingIndex<BinaryHamming<float>>> index =
+                std::make_shared<MultiIndexHashingIndex<BinaryHamming<float>>>(dataset, params.mih_tables);
+        if(index->load(filename))
+            result = std::shared_ptr<KnnIndex<BinaryHamming<float>>>(index);
     }
+};
+
+struct CreateQuantizedIndexVisitor
+{
+    std::shared_ptr<const ProductQuantizer> quantizer;
+    const std::vector<uint8_t> &codes;
+    const flann::Matrix<float> &dataset;
+    int rerank;
+    std::shared_ptr<void> &result;
+
+    template<typename T>
+    void operator()(T)
+    {
+        std::shared_ptr<KnnIndex<T>> index = std::make_shared<ProductQuantizationIndex<T>>(quantizer, codes, dataset, rerank);
+        index->buildIndex();
+        result = index;
+    }
+};
+
+struct CreateScalarQuantizedIndexVisitor
+{
+    std::shared_ptr<const ScalarQuantizer> quantizer;
+    const std::vector<uint8_t> &codes;
+    const KnnIndexParams &params;
+    std::shared_ptr<void> &result;
+
+    template<typename T>
+    void operator()(T)
+    {
+        buildScalarQuantizationIndex<T>();
+    }
+
+    template<typename T>
+    void buildScalarQuantizationIndex()
+    {
+        std::shared_ptr<KnnIndex<T>> index = std::make_shared<ScalarQuantizationIndex<T>>(quantizer, codes);
+        index->buildIndex();
+        result = index;
+    }
+
+    // binary codes are searched by multi-index hashing, which packs the bits again, the decoded rows are temporary
+    void operator()(BinaryHamming<float>)
+    {
+        if(quantizer->getPrecision() != ScalarQuantizer::Binary)
+        {
+            buildScalarQuantizationIndex<BinaryHamming<float>>();
+            return;
+        }
+
+        const int dim = quantizer->getDim();
+        const std::size_t codeSize = quantizer->getCodeSize();
+        const std::size_t rows = codes.size() / codeSize;
+        std::vector<float> decoded(rows * dim);
+        for(std::size_t i = 0; i < rows; i++)
+            quantizer->decode(&codes[i * codeSize], &decoded[i * dim]);
+
+        std::shared_ptr<KnnIndex<BinaryHamming<float>>> index = std::make_shared<MultiIndexHashingIndex<BinaryHamming<float>>>(
+                flann::Matrix<float>(decoded.data(), rows, dim), params.mih_tables);
+        index->buildIndex();
+        result = index;
+    }
+};
+
+struct SaveIndexVisitor
+{
+    const FlannHelper &helper;
+    const std::string &filename;
+
+    template<typename T>
+    void operator()(T)
+    {
+        helper.getIndex<T>()->save(filename);
+    }
+};
+
+struct SearchVisitor
+{
+    const FlannHelper &helper;
+    const flann::Matrix<float> &queries;
+    std::vector<std::vector<int> > &indices;
+    std::vector<std::vector<float> > &distances;
+    int k;
+    bool exact;
+    int cores;
+
+    template<typename T>
+    void operator()(T)
+    {
+        helper.getIndex<T>()->knnSearch(queries, indices, distances, k, exact, cores);
+    }
+};
+}
+
+void FlannHelper::buildIndex(std::string dist_type, const KnnIndexParams &params)
+{
+    if(params.type != "KDTree" && params.type != "HNSW" && params.type != "CUDA")
+        LOG_WARN("unknown index type " << params.type << ", using KDTree");
+
+    IndexDistance distance = toIndexDistance(dist_type);
+    if(!visitIndexDistance(distance, CreateIndexVisitor{dataset, params, m_index}))
+        throw RuntimeException("invalid distance type for flann index: " + dist_type);
+
+    m_index_created = true;
+    m_quantized = false;
+    m_embedded = params.embed_histograms && MetricEmbedding::isSupported(distance);
+    m_dist_type = dist_type;
+    m_distance = distance;
+    m_index_params = params;
+}
+
+void FlannHelper::buildQuantizedIndex(std::string dist_type, std::shared_ptr<const ProductQuantizer> quantizer,
+                                      const std::vector<uint8_t> &codes, const std::vector<int> &codeword_ids, int rerank)
+{
+    IndexDistance distance = toIndexDistance(dist_type);
+    if(!visitIndexDistance(distance, CreateQuantizedIndexVisitor{quantizer, codes, dataset, rerank, m_index}))
+        throw RuntimeException("invalid distance type for flann index: " + dist_type);
+
     m_index_created = true;
+    m_quantized = true;
+    m_embedded = false;
     m_dist_type = dist_type;
+    m_distance = distance;
+    m_codeword_ids = codeword_ids;
 }
 
-std::shared_ptr<flann::Index<flann::L2<float>>> FlannHelper::getIndexL2()
+void FlannHelper::buildQuantizedIndex(std::string dist_type, std::shared_ptr<const ScalarQuantizer> quantizer,
+                                      const std::vector<uint8_t> &codes, const std::vector<int> &codeword_ids,
+                                      const KnnIndexParams &params)
 {
-    return std::static_pointer_cast<flann::Index<flann::L2<float>>>(m_index);
+    IndexDistance distance = toIndexDistance(dist_type);
+    if(!visitIndexDistance(distance, CreateScalarQuantizedIndexVisitor{quantizer, codes, params, m_index}))
+        throw RuntimeException("invalid distance type for flann index: " + dist_type);
+
+    m_index_created = true;
+    m_quantized = true;
+    m_embedded = false;
+    m_dist_type = dist_type;
+    m_distance = distance;
+    m_codeword_ids = codeword_ids;
+    m_index_params = params;
 }
 
-std::shared_ptr<flann::Index<flann::ChiSquareDistance<float>>> FlannHelper::getIndexChi()
+bool FlannHelper::releaseDataset()
 {
-    return std::static_pointer_cast<flann::Index<flann::ChiSquareDistance<float>>>(m_index);
+    if(!m_index_created || m_quantized || m_distance != IndexDistance::Hamming)
+        return false;
+
+    for(std::pair<const unsigned, ClassPartition> &entry : m_class_partitions)
+        entry.second.index->releaseDataset();
+
+    if(m_owns_dataset)
+        delete[] dataset.ptr();
+    dataset = flann::Matrix<float>(nullptr, 0, dataset.cols);
+    m_owns_dataset = false;
+    m_block.reset();
+    m_flat_model.reset();
+    return true;
 }
 
-std::shared_ptr<flann::Index<flann::HellingerDistance<float>>> FlannHelper::getIndexHel()
+bool FlannHelper::saveIndex(std::vector<char> &buffer)
 {
-    return std::static_pointer_cast<flann::Index<flann::HellingerDistance<float>>>(m_index);
+    if(!m_index_created)
+        return false;
+
+    // indices can only be serialized to files, so the index is written to a temporary file and read back
+    boost::filesystem::path tempFile = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("ism3d-flann-%%%%-%%%%-%%%%-%%%%.idx");
+
+    bool success = false;
+    try
+    {
+        visitIndexDistance(m_distance, SaveIndexVisitor{*this, tempFile.string()});
+
+        std::ifstream ifs(tempFile.string(), std::ios::binary);
+        if(ifs)
+        {
+            buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+            success = !buffer.empty();
+        }
+    }
+    catch(const std::exception &e)
+    {
+        LOG_ERROR("could not save flann index: " << e.what());
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(tempFile, ec);
+    return success;
 }
 
-std::shared_ptr<flann::Index<flann::HistIntersectionDistance<float>>> FlannHelper::getIndexHist()
+bool FlannHelper::loadIndex(std::string dist_type, const KnnIndexParams &params, const std::vector<char> &buffer)
 {
-    return std::static_pointer_cast<flann::Index<flann::HistIntersectionDistance<float>>>(m_index);
+    boost::filesystem::path tempFile = boost::filesystem::temp_directory_path() /
+            boost::filesystem::unique_path("ism3d-flann-%%%%-%%%%-%%%%-%%%%.idx");
+
+    bool success = false;
+    try
+    {
+        std::ofstream ofs(tempFile.string(), std::ios::binary);
+        ofs.write(buffer.data(), buffer.size());
+        ofs.close();
+
+        std::shared_ptr<void> index;
+        IndexDistance distance = toIndexDistance(dist_type);
+        visitIndexDistance(distance, LoadIndexVisitor{dataset, params, tempFile.string(), index});
+
+        if(index)
+        {
+            m_index = index;
+            m_index_created = true;
+            m_quantized = false;
+            m_embedded = false;
+            m_dist_type = dist_type;
+            m_distance = distance;
+            m_index_params = params;
+            success = true;
+        }
+    }
+    catch(const std::exception &e)
+    {
+        LOG_ERROR("could not load flann index: " << e.what());
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove(tempFile, ec);
+    return success;
+}
+
+void FlannHelper::knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                            std::vector<std::vector<float> > &distances, int k, bool exact, int cores) const
+{
+    if(!m_index_created)
+        throw RuntimeException("the flann index has not been created");
+    visitIndexDistance(m_distance, SearchVisitor{*this, queries, indices, distances, k, exact, cores});
+}
+
+void FlannHelper::buildClassCascade(const std::vector<std::map<unsigned, int> > &class_votes, int num_centers, int top_classes)
+{
+    if(!m_index_created || m_quantized || dataset.rows == 0)
+        throw RuntimeException("the class cascade requires an index built on the descriptors");
+    LOG_ASSERT(class_votes.size() == dataset.rows);
+
+    const int rows = (int)dataset.rows;
+    const int dim = (int)dataset.cols;
+    m_coarse_index.reset();
+    m_cascade_classes.clear();
+    m_coarse_class_fractions.clear();
+    m_class_partitions.clear();
+    m_cascade_top_classes = top_classes;
+
+    // the rows and the number of votes of each class
+    std::map<unsigned, double> classTotals;
+    for(int i = 0; i < rows; i++)
+    {
+        for(const std::pair<const unsigned, int> &entry : class_votes[i])
+        {
+            if(entry.second <= 0)
+                continue;
+            m_class_partitions[entry.first].rows.push_back(i);
+            classTotals[entry.first] += entry.second;
+        }
+    }
+    std::map<unsigned, int> classIndices;
+    for(const std::pair<const unsigned, double> &entry : classTotals)
+    {
+        classIndices[entry.first] = (int)m_cascade_classes.size();
+        m_cascade_classes.push_back(entry.first);
+    }
+    const int numClasses = (int)m_cascade_classes.size();
+
+    // the coarse codebook clusters the rows, the centers are searched with the distance of the index
+    FeatureBlock block(rows, dim);
+    for(int i = 0; i < rows; i++)
+        std::copy(dataset[i], dataset[i] + dim, block.descriptor(i));
+    std::vector<float> centers;
+    std::vector<int> assignment;
+    BoundedKMeans kmeans(10, flann::FLANN_CENTERS_KMEANSPP, 42);
+    kmeans.cluster(block, std::max(num_centers, 1), centers, assignment);
+    const int numCenters = (int)centers.size() / dim;
+
+    m_coarse_index = std::make_shared<FlannHelper>(dim, numCenters);
+    std::copy(centers.begin(), centers.end(), m_coarse_index->dataset.ptr());
+    m_coarse_index->buildIndex(m_dist_type, m_index_params);
+
+    // the votes of a class are normalized by all its votes, so that classes with many votes do not dominate the
+    // selection, and the fractions of a center sum up to one
+    m_coarse_class_fractions.assign((size_t)numCenters * numClasses, 0.0f);
+    for(int i = 0; i < rows; i++)
+    {
+        float *fractions = &m_coarse_class_fractions[(size_t)assignment[i] * numClasses];
+        for(const std::pair<const unsigned, int> &entry : class_votes[i])
+        {
+            if(entry.second > 0)
+                fractions[classIndices[entry.first]] += (float)(entry.second / classTotals[entry.first]);
+        }
+    }
+    for(int c = 0; c < numCenters; c++)
+    {
+        float *fractions = &m_coarse_class_fractions[(size_t)c * numClasses];
+        const float sum = std::accumulate(fractions, fractions + numClasses, 0.0f);
+        if(sum > 0)
+            std::transform(fractions, fractions + numClasses, fractions, [sum](float value) { return value / sum; });
+    }
+
+    // the index of a class copies the rows of the class, a row with votes of several classes is in each of them
+    for(std::pair<const unsigned, ClassPartition> &entry : m_class_partitions)
+    {
+        ClassPartition &partition = entry.second;
+        partition.index = std::make_shared<FlannHelper>(dim, (int)partition.rows.size());
+        for(int i = 0; i < (int)partition.rows.size(); i++)
+            std::copy(dataset[partition.rows[i]], dataset[partition.rows[i]] + dim, partition.index->dataset[i]);
+        partition.index->buildIndex(m_dist_type, m_index_params);
+    }
+
+    LOG_INFO("created class cascade with " << numCenters << " coarse codewords for " << numClasses << " classes");
+}
+
+std::vector<unsigned> FlannHelper::selectClasses(const flann::Matrix<float> &queries, bool exact, int cores) const
+{
+    const int numClasses = (int)m_cascade_classes.size();
+    std::vector<unsigned> selected;
+    if(!hasClassCascade() || m_cascade_top_classes <= 0 || m_cascade_top_classes >= numClasses || queries.rows == 0)
+        return selected;
+
+    std::vector<std::vector<int> > indices;
+    std::vector<std::vector<float> > distances;
+    m_coarse_index->knnSearch(queries, indices, distances, 1, exact, cores);
+
+    std::vector<double> scores(numClasses, 0.0);
+    for(const std::vector<int> &neighbors : indices)
+    {
+        if(neighbors.empty() || neighbors[0] < 0)
+            continue;
+        const float *fractions = &m_coarse_class_fractions[(size_t)neighbors[0] * numClasses];
+        for(int c = 0; c < numClasses; c++)
+            scores[c] += fractions[c];
+    }
+
+    std::vector<int> order(numClasses);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&scores](int a, int b) { return scores[a] > scores[b]; });
+    for(int i = 0; i < m_cascade_top_classes; i++)
+        selected.push_back(m_cascade_classes[order[i]]);
+    std::sort(selected.begin(), selected.end());
+    return selected;
+}
+
+const FlannHelper* FlannHelper::getClassPartition(unsigned class_id, const std::vector<int> *&rows) const
+{
+    std::map<unsigned, ClassPartition>::const_iterator it = m_class_partitions.find(class_id);
+    if(it == m_class_partitions.end())
+        return 0;
+    rows = &it->second.rows;
+    return it->second.index.get();
+}
+
+MemoryUsage FlannHelper::memoryUsage() const
+{
+    MemoryUsage usage("index");
+    usage.addPart("dataset", dataset.rows * dataset.cols * sizeof(float) + m_codeword_ids.capacity() * sizeof(int));
+
+    std::size_t indexBytes = 0;
+    if(m_index_created)
+        visitIndexDistance(m_distance, IndexMemoryVisitor{*this, indexBytes});
+    usage.addPart("structure", indexBytes);
+
+    if(hasClassCascade())
+    {
+        std::size_t cascadeBytes = m_coarse_index->memoryUsage().getTotalBytes() +
+                m_coarse_class_fractions.capacity() * sizeof(float);
+        for(const std::pair<const unsigned, ClassPartition> &entry : m_class_partitions)
+            cascadeBytes += entry.second.index->memoryUsage().getTotalBytes() + entry.second.rows.capacity() * sizeof(int);
+        usage.addPart("cascade", cascadeBytes);
+    }
+    return usage;
 }
 
 }
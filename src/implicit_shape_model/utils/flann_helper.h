@@ -11,11 +11,20 @@
 #ifndef ISM3D_FLANN_HELPER_H
 #define ISM3D_FLANN_HELPER_H
 
+#include <map>
 #include <vector>
 #include <flann/flann.hpp>
 #include "distance.h"
+#include "distance_dispatch.h"
+#include "exception.h"
 #include "../codebook/codeword.h"
 #include "ism_feature.h"
+#include "feature_block.h"
+#include "knn_index.h"
+#include "memory_usage.h"
+#include "product_quantizer.h"
+#include "scalar_quantizer.h"
+#include "flat_model.h"
 
 #include "utils.h"
 
@@ -30,6 +39,37 @@ public:
         dataset(new float[descriptor_size * num_codewords], num_codewords, descriptor_size)
     {
         m_index_created = false;
+        m_quantized = false;
+        m_embedded = false;
+        m_owns_dataset = true;
+        m_distance = IndexDistance::None;
+        m_cascade_top_classes = 0;
+    }
+
+    // uses the descriptors of the feature block as dataset without copying, the block is kept alive by the helper
+    FlannHelper(FeatureBlock::ConstPtr block) :
+        dataset(block->getMatrix()), m_block(block)
+    {
+        m_index_created = false;
+        m_quantized = false;
+        m_embedded = false;
+        m_owns_dataset = false;
+        m_distance = IndexDistance::None;
+        m_cascade_top_classes = 0;
+    }
+
+    // uses descriptors mapped from a flat model as dataset without copying, the model is kept alive by the helper,
+    // so that processes mapping the same model share the dataset
+    FlannHelper(std::shared_ptr<const FlatModel> model, FlatArray<float> descriptors, int descriptor_size) :
+        dataset(const_cast<float*>(descriptors.begin()), descriptors.size() / descriptor_size, descriptor_size),
+        m_flat_model(model)
+    {
+        m_index_created = false;
+        m_quantized = false;
+        m_embedded = false;
+        m_owns_dataset = false;
+        m_distance = IndexDistance::None;
+        m_cascade_top_classes = 0;
     }
 
     ~FlannHelper();
@@ -38,25 +78,138 @@ public:
 
     void createDataset(pcl::PointCloud<ISMFeature>::Ptr global_features);
 
+    // assigns the codewords to the rows of a dataset that already contains their descriptors in codebook order
+    void setCodewords(const std::vector<std::shared_ptr<Codeword> > &codewords);
+
+    // builds randomized kd-trees
     void buildIndex(std::string dist_type, int kd_trees);
 
+    // builds the index backend selected in params
+    void buildIndex(std::string dist_type, const KnnIndexParams &params);
+
+    // builds an exhaustive index on product quantization codes, the dataset is only used for re-ranking and may be empty
+    void buildQuantizedIndex(std::string dist_type, std::shared_ptr<const ProductQuantizer> quantizer,
+                             const std::vector<uint8_t> &codes, const std::vector<int> &codeword_ids, int rerank);
+
+    // builds an exhaustive index on scalar quantization codes, the dataset is not used, binary codes are searched by
+    // multi-index hashing with the tables of params
+    void buildQuantizedIndex(std::string dist_type, std::shared_ptr<const ScalarQuantizer> quantizer,
+                             const std::vector<uint8_t> &codes, const std::vector<int> &codeword_ids,
+                             const KnnIndexParams &params);
+
+    // frees the dataset of a built hamming index, which keeps the descriptors bit-packed, false for other indices;
+    // afterwards the dataset has no rows and neither the class cascade nor an index can be built on it
+    bool releaseDataset();
+
+    // serialize the built index into a byte buffer, the dataset itself is not stored
+    bool saveIndex(std::vector<char> &buffer);
+
+    // restore an index from a byte buffer, the dataset must already contain the data used when saving
+    bool loadIndex(std::string dist_type, const KnnIndexParams &params, const std::vector<char> &buffer);
+
+    const KnnIndexParams& getIndexParams() const
+    {
+        return m_index_params;
+    }
+
+    // searches with the index of the distance it was built for, see KnnIndex::knnSearch()
+    void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                   std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const;
+
+    IndexDistance getIndexDistance() const
+    {
+        return m_distance;
+    }
+
+    bool isQuantized() const
+    {
+        return m_quantized;
+    }
+
+    // true if a histogram distance is searched on its euclidean embedding, these indices are not stored
+    bool isEmbedded() const
+    {
+        return m_embedded;
+    }
+
+    /**
+     * @brief Build the class cascade over the dataset of the built index: a coarse codebook of num_centers k-means
+     * centers of the rows, each with the fractions of the votes of each class that fall into its rows, and an index
+     * per class over the rows with votes of that class. A detection selects the top_classes classes with the coarse
+     * codebook and only searches their indices, see selectClasses(). The per class indices use the distance and
+     * parameters of the index and copy the rows of their class.
+     * @param class_votes the number of votes of each class per dataset row
+     * @param num_centers the size of the coarse codebook
+     * @param top_classes the number of candidate classes of a detection
+     */
+    void buildClassCascade(const std::vector<std::map<unsigned, int> > &class_votes, int num_centers, int top_classes);
+
+    bool hasClassCascade() const
+    {
+        return !m_class_partitions.empty();
+    }
+
+    /**
+     * @brief Select the candidate classes of a detection: each query adds the class fractions of its nearest
+     * coarse center to the scores of the classes, the top_classes classes with the highest score are returned.
+     * @return the candidate classes ordered by class id, empty if the cascade does not exclude any class
+     */
+    std::vector<unsigned> selectClasses(const flann::Matrix<float> &queries, bool exact, int cores = 1) const;
+
+    // the index over the rows with votes of the class and the dataset rows of its rows, null for unknown classes
+    const FlannHelper* getClassPartition(unsigned class_id, const std::vector<int> *&rows) const;
+
+    // ids of the codewords in dataset order, only available if the dataset was created from codewords
+    const std::vector<int>& getCodewordIds() const
+    {
+        return m_codeword_ids;
+    }
+
     std::string getDistType()
     {
         return m_dist_type;
     }
 
+    // the dataset, including a shared feature block, and the index structure
+    MemoryUsage memoryUsage() const;
+
     bool m_index_created;
     flann::Matrix<float> dataset;
 
-    // TODO make this nicer
-    std::shared_ptr<flann::Index<flann::L2<float>>> getIndexL2();
-    std::shared_ptr<flann::Index<flann::ChiSquareDistance<float>>> getIndexChi();
-    std::shared_ptr<flann::Index<flann::HellingerDistance<float>>> getIndexHel();
-    std::shared_ptr<flann::Index<flann::HistIntersectionDistance<float>>> getIndexHist();
+    // the index for the flann distance functor T, which must be the one the index was built for
+    template<typename T>
+    std::shared_ptr<KnnIndex<T>> getIndex() const
+    {
+        if(!m_index_created || IndexDistanceOf<T>::value != m_distance)
+            throw RuntimeException("the flann index was not built for the requested distance");
+        return std::static_pointer_cast<KnnIndex<T>>(m_index);
+    }
 
     std::shared_ptr<void> m_index;
 
     std::string m_dist_type;
+
+private:
+    bool m_owns_dataset;
+    bool m_quantized;
+    bool m_embedded;
+    IndexDistance m_distance;
+    FeatureBlock::ConstPtr m_block;
+    std::shared_ptr<const FlatModel> m_flat_model;
+    std::vector<int> m_codeword_ids;
+    KnnIndexParams m_index_params;
+
+    // the class cascade, the coarse index is built over the centers, which are owned by its dataset
+    struct ClassPartition
+    {
+        std::vector<int> rows;
+        std::shared_ptr<FlannHelper> index;
+    };
+    std::shared_ptr<FlannHelper> m_coarse_index;
+    std::vector<unsigned> m_cascade_classes;
+    std::vector<float> m_coarse_class_fractions; // per center and class in m_cascade_classes
+    std::map<unsigned, ClassPartition> m_class_partitions;
+    int m_cascade_top_classes;
 };
 }
 
@@ -0,0 +1,441 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "flat_model.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <omp.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ism3d
+{
+    namespace
+    {
+        const char Magic[8] = {'I', 'S', 'M', '3', 'D', 'F', 'L', 'T'};
+        const uint32_t ByteOrderMark = 0x01020304;
+        const std::size_t MaxNameLength = 47;
+
+        struct Header
+        {
+            char magic[8];
+            uint32_t version;
+            uint32_t byteOrder;
+            uint64_t tableOffset;
+            uint64_t numSections;
+        };
+
+        struct TableEntry
+        {
+            char name[MaxNameLength + 1];
+            uint64_t offset;
+            uint64_t bytes;
+        };
+
+        bool isValidHeader(const Header &header)
+        {
+            return std::memcmp(header.magic, Magic, sizeof(Magic)) == 0;
+        }
+
+        // the models mapped in this process by file identity, a file that was replaced is mapped again
+        struct FileKey
+        {
+            dev_t device;
+            ino_t inode;
+            off_t size;
+            time_t modified;
+
+            bool operator<(const FileKey &other) const
+            {
+                if (device != other.device)
+                    return device < other.device;
+                if (inode != other.inode)
+                    return inode < other.inode;
+                if (size != other.size)
+                    return size < other.size;
+                return modified < other.modified;
+            }
+        };
+
+        std::mutex mappedModelsMutex;
+        std::map<FileKey, std::weak_ptr<const FlatModel> > mappedModels;
+    }
+
+    const uint32_t FlatModel::Version;
+    const std::size_t FlatModel::Alignment;
+
+    FlatModelWriter::FlatModelWriter(const std::string &filename, int numThreads)
+        : m_filename(filename), m_fd(-1), m_num_threads(numThreads), m_size(0), m_in_section(false), m_failed(false),
+          m_closed(false)
+    {
+        m_fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+        {
+            LOG_ERROR("could not open flat model file " << m_filename);
+            m_failed = true;
+        }
+
+        // the header is written last, the first section starts after it
+        m_size = FlatModel::Alignment;
+    }
+
+    FlatModelWriter::~FlatModelWriter()
+    {
+        if (!m_closed)
+            close();
+    }
+
+    bool FlatModelWriter::writeAt(const void *data, std::size_t bytes, uint64_t offset)
+    {
+        const char *remaining = (const char*)data;
+        while (bytes > 0 && !m_failed)
+        {
+            const ssize_t written = pwrite(m_fd, remaining, bytes, (off_t)offset);
+            if (written <= 0)
+            {
+                LOG_ERROR("could not write flat model file " << m_filename);
+                m_failed = true;
+                break;
+            }
+            remaining += written;
+            bytes -= written;
+            offset += written;
+        }
+        return !m_failed;
+    }
+
+    void FlatModelWriter::flush()
+    {
+        writeAt(m_buffer.data(), m_buffer.size(), m_size - m_buffer.size());
+        m_buffer.clear();
+    }
+
+    void FlatModelWriter::addSection(const std::string &name, const void *data, std::size_t bytes)
+    {
+        beginSection(name);
+        write(data, bytes);
+        endSection();
+    }
+
+    void FlatModelWriter::addSection(const std::string &name, std::size_t bytes, const FillFunction &fill)
+    {
+        beginSection(name);
+        m_sections.back().fill = fill;
+        m_sections.back().bytes = bytes;
+
+        // the region is skipped here, the file is resized before the sections are filled
+        flush();
+        m_size += bytes;
+        endSection();
+    }
+
+    void FlatModelWriter::beginSection(const std::string &name)
+    {
+        if (m_in_section)
+            endSection();
+        if (name.size() > MaxNameLength)
+            LOG_ERROR("flat model section name too long: " << name);
+
+        Section section = {name.substr(0, MaxNameLength), m_size, 0, FillFunction()};
+        m_sections.push_back(section);
+        m_in_section = true;
+    }
+
+    void FlatModelWriter::write(const void *data, std::size_t bytes)
+    {
+        // small parts are collected, large parts are written directly
+        static const std::size_t bufferSize = 1 << 20;
+        if (bytes == 0)
+            return;
+        if (m_buffer.size() + bytes > bufferSize)
+            flush();
+        if (bytes >= bufferSize)
+            writeAt(data, bytes, m_size);
+        else
+            m_buffer.insert(m_buffer.end(), (const char*)data, (const char*)data + bytes);
+        m_size += bytes;
+        m_sections.back().bytes += bytes;
+    }
+
+    void FlatModelWriter::endSection()
+    {
+        m_in_section = false;
+        pad();
+    }
+
+    void FlatModelWriter::pad()
+    {
+        // the next section starts aligned
+        const std::size_t padding = (FlatModel::Alignment - m_size % FlatModel::Alignment) % FlatModel::Alignment;
+        m_buffer.insert(m_buffer.end(), padding, 0);
+        m_size += padding;
+    }
+
+    bool FlatModelWriter::fillSections()
+    {
+        std::vector<const Section*> reserved;
+        for (const Section &section : m_sections)
+        {
+            if (section.fill && section.bytes > 0)
+                reserved.push_back(&section);
+        }
+        if (reserved.empty() || m_failed)
+            return !m_failed;
+
+        const int numThreads = m_num_threads > 0 ? m_num_threads : omp_get_max_threads();
+        void *mapping = mmap(0, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            // the sections are serialized directly into the page cache
+            #pragma omp parallel for schedule(dynamic, 1) num_threads(numThreads)
+            for (int i = 0; i < (int)reserved.size(); i++)
+                reserved[i]->fill((char*)mapping + reserved[i]->offset);
+            munmap(mapping, m_size);
+            return true;
+        }
+
+        // without a writable mapping, each section is serialized into a buffer of its own
+        LOG_WARN("could not map flat model file " << m_filename << ", filling the sections in memory");
+        bool success = true;
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(numThreads) reduction(&&:success)
+        for (int i = 0; i < (int)reserved.size(); i++)
+        {
+            std::vector<char> data(reserved[i]->bytes);
+            reserved[i]->fill(data.data());
+            std::size_t bytes = data.size();
+            uint64_t offset = reserved[i]->offset;
+            const char *remaining = data.data();
+            while (bytes > 0 && success)
+            {
+                const ssize_t written = pwrite(m_fd, remaining, bytes, (off_t)offset);
+                success = written > 0;
+                if (success)
+                {
+                    remaining += written;
+                    bytes -= written;
+                    offset += written;
+                }
+            }
+        }
+        if (!success)
+        {
+            LOG_ERROR("could not write flat model file " << m_filename);
+            m_failed = true;
+        }
+        return success;
+    }
+
+    bool FlatModelWriter::close()
+    {
+        if (m_in_section)
+            endSection();
+        m_closed = true;
+        if (m_fd < 0)
+            return false;
+
+        Header header;
+        std::memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = FlatModel::Version;
+        header.byteOrder = ByteOrderMark;
+        header.tableOffset = m_size;
+        header.numSections = m_sections.size();
+
+        for (const Section &section : m_sections)
+        {
+            TableEntry entry;
+            std::memset(&entry, 0, sizeof(entry));
+            std::strncpy(entry.name, section.name.c_str(), MaxNameLength);
+            entry.offset = section.offset;
+            entry.bytes = section.bytes;
+            m_buffer.insert(m_buffer.end(), (const char*)&entry, (const char*)&entry + sizeof(entry));
+            m_size += sizeof(entry);
+        }
+        flush();
+
+        // the reserved regions are holes of the file until they are filled
+        if (!m_failed && ftruncate(m_fd, (off_t)m_size) != 0)
+        {
+            LOG_ERROR("could not resize flat model file " << m_filename);
+            m_failed = true;
+        }
+        fillSections();
+
+        // the header marks the file as complete, it is written after all sections
+        writeAt(&header, sizeof(header), 0);
+        if (!m_failed && fsync(m_fd) != 0)
+        {
+            LOG_ERROR("could not sync flat model file " << m_filename);
+            m_failed = true;
+        }
+        ::close(m_fd);
+        m_fd = -1;
+        return !m_failed;
+    }
+
+    FlatModel::FlatModel()
+        : m_data(0), m_length(0)
+    {
+    }
+
+    FlatModel::~FlatModel()
+    {
+        if (m_data)
+            munmap((void*)m_data, m_length);
+    }
+
+    bool FlatModel::isFlatModel(const std::string &filename)
+    {
+        std::ifstream file(filename.c_str(), std::ios::binary);
+        Header header;
+        return file.read((char*)&header, sizeof(header)) && isValidHeader(header);
+    }
+
+    std::shared_ptr<const FlatModel> FlatModel::open(const std::string &filename, const MapOptions &options)
+    {
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            LOG_ERROR("could not open flat model file " << filename);
+            return std::shared_ptr<const FlatModel>();
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(Header))
+        {
+            LOG_ERROR("not a flat model file: " << filename);
+            ::close(fd);
+            return std::shared_ptr<const FlatModel>();
+        }
+
+        // the lock is held until the new mapping is registered, so that a file is only mapped once
+        std::lock_guard<std::mutex> lock(mappedModelsMutex);
+        const FileKey key = {info.st_dev, info.st_ino, info.st_size, info.st_mtime};
+        std::map<FileKey, std::weak_ptr<const FlatModel> >::iterator existing = mappedModels.find(key);
+        if (existing != mappedModels.end())
+        {
+            std::shared_ptr<const FlatModel> model = existing->second.lock();
+            if (model)
+            {
+                ::close(fd);
+                return model;
+            }
+            mappedModels.erase(existing);
+        }
+
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (options.prefetch == "Populate")
+            flags |= MAP_POPULATE;
+#endif
+
+        // the mapping stays valid after closing the file
+        void *mapped = mmap(0, info.st_size, PROT_READ, flags, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            LOG_ERROR("could not map flat model file " << filename);
+            return std::shared_ptr<const FlatModel>();
+        }
+
+        if (options.prefetch == "WillNeed" && madvise(mapped, info.st_size, MADV_WILLNEED) != 0)
+            LOG_WARN("could not prefetch flat model file " << filename);
+#ifdef MADV_HUGEPAGE
+        if (options.hugePages && madvise(mapped, info.st_size, MADV_HUGEPAGE) != 0)
+            LOG_WARN("huge pages are not supported for flat model file " << filename);
+#else
+        if (options.hugePages)
+            LOG_WARN("huge pages are not supported on this platform");
+#endif
+
+        std::shared_ptr<FlatModel> model(new FlatModel());
+        model->m_filename = filename;
+        model->m_prefetch = options.prefetch;
+        model->m_data = (const char*)mapped;
+        model->m_length = info.st_size;
+
+        Header header;
+        std::memcpy(&header, model->m_data, sizeof(header));
+        if (!isValidHeader(header))
+        {
+            LOG_ERROR("not a flat model file: " << filename);
+            return std::shared_ptr<const FlatModel>();
+        }
+        if (header.byteOrder != ByteOrderMark)
+        {
+            LOG_ERROR("flat model file " << filename << " was written on a machine with a different byte order");
+            return std::shared_ptr<const FlatModel>();
+        }
+        if (header.version != Version)
+        {
+            LOG_ERROR("flat model file " << filename << " has version " << header.version << ", expected " << Version);
+            return std::shared_ptr<const FlatModel>();
+        }
+        if (header.tableOffset > model->m_length ||
+                header.numSections > (model->m_length - header.tableOffset) / sizeof(TableEntry))
+        {
+            LOG_ERROR("corrupt flat model file " << filename);
+            return std::shared_ptr<const FlatModel>();
+        }
+
+        const TableEntry *table = (const TableEntry*)(model->m_data + header.tableOffset);
+        for (uint64_t i = 0; i < header.numSections; i++)
+        {
+            const TableEntry &entry = table[i];
+            if (entry.offset % Alignment != 0 || entry.offset > header.tableOffset ||
+                    entry.bytes > header.tableOffset - entry.offset)
+            {
+                LOG_ERROR("corrupt flat model file " << filename);
+                return std::shared_ptr<const FlatModel>();
+            }
+            std::string name(entry.name, strnlen(entry.name, sizeof(entry.name)));
+            model->m_sections[name] = std::make_pair(entry.offset, entry.bytes);
+        }
+
+        mappedModels[key] = model;
+        return model;
+    }
+
+    bool FlatModel::hasSection(const std::string &name) const
+    {
+        return m_sections.find(name) != m_sections.end();
+    }
+
+    void FlatModel::prefetch(const void *data, std::size_t bytes) const
+    {
+        // madvise() needs a page aligned start
+        static const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+        const char *first = (const char*)data;
+        const char *last = std::min(first + bytes, m_data + m_length);
+        if (bytes == 0 || first < m_data || first >= last)
+            return;
+
+        const char *start = m_data + (first - m_data) / pageSize * pageSize;
+        madvise((void*)start, last - start, MADV_WILLNEED);
+    }
+
+    void FlatModel::adviseRandom(const std::string &name) const
+    {
+        std::map<std::string, std::pair<uint64_t, uint64_t> >::const_iterator it = m_sections.find(name);
+        if (it == m_sections.end() || it->second.second == 0)
+            return;
+
+        // the sections start aligned to Alignment only, the advice covers the pages around it
+        static const std::size_t pageSize = sysconf(_SC_PAGESIZE);
+        const std::size_t start = it->second.first / pageSize * pageSize;
+        if (madvise((void*)(m_data + start), it->second.first + it->second.second - start, MADV_RANDOM) != 0)
+            LOG_WARN("could not advise random access to section " << name << " of flat model file " << m_filename);
+    }
+}
@@ -0,0 +1,245 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_FLAT_MODEL_H
+#define ISM3D_FLAT_MODEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The FlatArray struct
+     * A read only view of a contiguous array, either of a vector or of a section of a mapped flat model.
+     */
+    template<typename T>
+    struct FlatArray
+    {
+        FlatArray() : data(0), count(0) {}
+        FlatArray(const T *data, std::size_t count) : data(data), count(count) {}
+        template<typename A>
+        FlatArray(const std::vector<T, A> &values) : data(values.data()), count(values.size()) {}
+
+        const T& operator[](std::size_t i) const { return data[i]; }
+        const T* begin() const { return data; }
+        const T* end() const { return data + count; }
+        std::size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        // the elements [first, last)
+        FlatArray<T> slice(std::size_t first, std::size_t last) const { return FlatArray<T>(data + first, last - first); }
+
+        const T *data;
+        std::size_t count;
+    };
+
+    /**
+     * @brief The FlatModelWriter class
+     * Writes named sections of raw data to a flat model file. Sections start at offsets aligned to
+     * FlatModel::Alignment, the section table follows the last section and the header at the start of the file
+     * points to it. The data is written in the byte order and layout of the writing machine, the header records the
+     * byte order so that a mismatching file is rejected instead of misread.
+     * Sections of a known size are reserved when they are added and filled by close(): the file is resized once,
+     * mapped and the sections are serialized concurrently into their regions, so that writing is bound by the disk
+     * and not by one thread. The file is synced once at the end.
+     */
+    class FlatModelWriter
+    {
+    public:
+        /**
+         * @param filename the file
+         * @param numThreads the number of threads filling the reserved sections, 0 uses the OpenMP default
+         */
+        explicit FlatModelWriter(const std::string &filename, int numThreads = 0);
+        ~FlatModelWriter();
+
+        // fills the reserved region of a section, called concurrently with the other fill functions
+        typedef std::function<void(char *data)> FillFunction;
+
+        template<typename T, typename A>
+        void addSection(const std::string &name, const std::vector<T, A> &values)
+        {
+            addSection(name, values.data(), values.size() * sizeof(T));
+        }
+
+        void addSection(const std::string &name, const void *data, std::size_t bytes);
+
+        /**
+         * @brief Reserve a section that is filled by close(), everything the fill function refers to has to be
+         * alive until then.
+         * @param name the section name, at most 47 characters
+         * @param bytes the size of the section
+         * @param fill writes exactly bytes bytes
+         */
+        void addSection(const std::string &name, std::size_t bytes, const FillFunction &fill);
+
+        /**
+         * @brief Write a section in parts, so that large sections need not be assembled in memory.
+         * @param name the section name, at most 47 characters
+         */
+        void beginSection(const std::string &name);
+
+        template<typename T>
+        void write(FlatArray<T> values)
+        {
+            write(values.begin(), values.size() * sizeof(T));
+        }
+
+        void write(const void *data, std::size_t bytes);
+        void endSection();
+
+        /**
+         * @brief Fill the reserved sections, write the section table and the header and sync the file.
+         * @return false if writing failed
+         */
+        bool close();
+
+    private:
+        FlatModelWriter(const FlatModelWriter&) = delete;
+        FlatModelWriter& operator=(const FlatModelWriter&) = delete;
+
+        struct Section
+        {
+            std::string name;
+            uint64_t offset;
+            uint64_t bytes;
+            FillFunction fill; // empty for sections that were written when they were added
+        };
+
+        // writes data at an offset of the file, false on errors
+        bool writeAt(const void *data, std::size_t bytes, uint64_t offset);
+        void flush();
+        void pad();
+        bool fillSections();
+
+        std::string m_filename;
+        int m_fd;
+        int m_num_threads;
+        uint64_t m_size;
+        std::vector<Section> m_sections;
+
+        // the streamed data not yet written, it starts at the offset m_size - m_buffer.size()
+        std::vector<char> m_buffer;
+        bool m_in_section;
+        bool m_failed;
+        bool m_closed;
+    };
+
+    /**
+     * @brief The FlatModel class
+     * A flat model file mapped into memory. Opening only maps the file and reads the section table, the pages of a
+     * section are read by the system on first access and can be dropped again under memory pressure. The mapping is
+     * read only and shared, so processes that map the same file share its pages in the page cache and models opened
+     * several times in one process share one mapping. All state that changes during detection is kept outside of the
+     * mapping. Objects referring to sections keep a pointer to the model to keep the mapping alive.
+     */
+    class FlatModel
+    {
+    public:
+        static const uint32_t Version = 1;
+        static const std::size_t Alignment = 64;
+
+        /**
+         * @brief How the pages are brought into memory.
+         */
+        struct MapOptions
+        {
+            MapOptions() : prefetch("None"), hugePages(false) {}
+
+            // "None" reads pages on first access, "WillNeed" starts reading the whole file in the background,
+            // "Populate" reads the whole file before open() returns, "Lazy" reads pages on first access like "None",
+            // but the objects of the model request the pages they need as a whole on first use, see prefetch(), and
+            // sections advised with adviseRandom() are not read ahead
+            std::string prefetch;
+
+            // back the mapping with transparent huge pages where the kernel supports them for read only files
+            bool hugePages;
+        };
+
+        ~FlatModel();
+
+        /**
+         * @brief Map a flat model file, or return the mapping of the file if it is already mapped in this process.
+         * @param filename the file
+         * @param options how the pages are brought into memory, only used for a new mapping
+         * @return the model, or null if the file could not be mapped or is not a flat model of this version
+         */
+        static std::shared_ptr<const FlatModel> open(const std::string &filename, const MapOptions &options = MapOptions());
+
+        /**
+         * @brief Check whether a file starts with the header of a flat model.
+         */
+        static bool isFlatModel(const std::string &filename);
+
+        bool hasSection(const std::string &name) const;
+
+        /**
+         * @brief Start reading the pages of a part of the mapping in the background.
+         * @param data the start of the part, has to be within the mapping
+         * @param bytes the size of the part
+         */
+        void prefetch(const void *data, std::size_t bytes) const;
+
+        /**
+         * @brief Advise the system that a section is accessed in random order, so that a page fault does not read
+         * ahead into the following pages.
+         */
+        void adviseRandom(const std::string &name) const;
+
+        /**
+         * @brief Get a section as an array.
+         * @param name the section name
+         * @return the array, empty if the section does not exist or its size is not a multiple of the element size
+         */
+        template<typename T>
+        FlatArray<T> getSection(const std::string &name) const
+        {
+            std::map<std::string, std::pair<uint64_t, uint64_t> >::const_iterator it = m_sections.find(name);
+            if (it == m_sections.end() || it->second.second % sizeof(T) != 0)
+                return FlatArray<T>();
+            return FlatArray<T>((const T*)(m_data + it->second.first), it->second.second / sizeof(T));
+        }
+
+        std::size_t getMappedBytes() const
+        {
+            return m_length;
+        }
+
+        const std::string& getFilename() const
+        {
+            return m_filename;
+        }
+
+        // the prefetch option of the mapping, see MapOptions
+        const std::string& getPrefetch() const
+        {
+            return m_prefetch;
+        }
+
+    private:
+        FlatModel();
+        FlatModel(const FlatModel&) = delete;
+        FlatModel& operator=(const FlatModel&) = delete;
+
+        std::string m_filename;
+        std::string m_prefetch;
+        const char *m_data;
+        std::size_t m_length;
+        std::map<std::string, std::pair<uint64_t, uint64_t> > m_sections; // name to offset and bytes
+    };
+}
+
+#endif // ISM3D_FLAT_MODEL_H
@@ -0,0 +1,515 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_HNSW_INDEX_H
+#define ISM3D_HNSW_INDEX_H
+
+#include <vector>
+#include <queue>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <limits>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+
+#include "knn_index.h"
+#include "exception.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The HnswIndex class
+     * Hierarchical navigable small world graph (Malkov and Yashunin, 2018) over a flann dataset. Each point
+     * is inserted into a random number of graph layers, where the number of points decreases exponentially
+     * with the layer. A search descends greedily through the upper layers and performs a beam search with a
+     * candidate list of size ef in layer 0. Unlike kd-trees, the search quality does not degrade with high
+     * descriptor dimensions. The dataset is not copied and must stay valid as long as the index is used.
+     */
+    template<typename T>
+    class HnswIndex : public KnnIndex<T>
+    {
+    public:
+        typedef std::pair<float, int> Candidate; // distance and dataset row
+
+        HnswIndex(const flann::Matrix<float> &dataset, int m, int ef_construction, int ef_search)
+            : m_dataset(dataset), m_num_points((int)dataset.rows), m_dim((int)dataset.cols),
+              m_m(std::max(m, 2)), m_max_m0(2 * std::max(m, 2)), m_ef_construction(std::max(ef_construction, 1)),
+              m_ef_search(std::max(ef_search, 1)), m_entry_point(-1), m_max_level(-1),
+              m_node_locks(0), m_global_lock(0)
+        {
+        }
+
+        void buildIndex()
+        {
+            m_entry_point = -1;
+            m_max_level = -1;
+            if (m_num_points == 0)
+                return;
+
+            // random layers are drawn in advance, so that the graph layout does not depend on the thread count
+            std::mt19937 rng(42);
+            std::uniform_real_distribution<double> uniform(0.0, 1.0);
+            const double levelMult = 1.0 / std::log((double)m_m);
+            m_levels.resize(m_num_points);
+            m_upper_links.assign(m_num_points, std::vector<int>());
+            for (int i = 0; i < m_num_points; i++)
+            {
+                m_levels[i] = (int)(-std::log(std::max(uniform(rng), 1e-12)) * levelMult);
+                m_upper_links[i].assign(m_levels[i] * (m_m + 1), 0);
+            }
+            m_links0.assign((size_t)m_num_points * (m_max_m0 + 1), 0);
+
+            m_entry_point = 0;
+            m_max_level = m_levels[0];
+
+            std::unique_ptr<std::mutex[]> nodeLocks(new std::mutex[m_num_points]);
+            std::mutex globalLock;
+            m_node_locks = nodeLocks.get();
+            m_global_lock = &globalLock;
+
+#pragma omp parallel for schedule(dynamic, 64)
+            for (int i = 1; i < m_num_points; i++)
+                insert(i);
+
+            m_node_locks = 0;
+            m_global_lock = 0;
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                if (exact)
+                    searchExhaustive(queries[q], k, result);
+                else
+                    search(queries[q], k, result);
+
+                for (int j = 0; j < k; j++)
+                {
+                    indices[q][j] = j < (int)result.size() ? result[j].second : -1;
+                    distances[q][j] = j < (int)result.size() ? result[j].first : std::numeric_limits<float>::max();
+                }
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+            indices.resize(numQueries);
+            distances.resize(numQueries);
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                if (exact)
+                    searchExhaustive(queries[q], k, result);
+                else
+                    search(queries[q], k, result);
+
+                indices[q].resize(result.size());
+                distances[q].resize(result.size());
+                for (int j = 0; j < (int)result.size(); j++)
+                {
+                    indices[q][j] = result[j].second;
+                    distances[q][j] = result[j].first;
+                }
+            }
+        }
+
+        // the candidate list size of approximate searches can be changed without rebuilding the graph
+        void setEfSearch(int ef_search)
+        {
+            m_ef_search = std::max(ef_search, 1);
+        }
+
+        void save(const std::string &filename)
+        {
+            std::ofstream ofs(filename, std::ios::binary);
+            if (!ofs)
+                throw RuntimeException("could not open file for writing: " + filename);
+
+            const int header[] = {s_version, m_num_points, m_dim, m_m, m_max_m0, m_ef_construction,
+                                  m_entry_point, m_max_level};
+            ofs.write(s_magic, sizeof(s_magic));
+            ofs.write((const char*)header, sizeof(header));
+            ofs.write((const char*)m_levels.data(), m_levels.size() * sizeof(int));
+            ofs.write((const char*)m_links0.data(), m_links0.size() * sizeof(int));
+            for (int i = 0; i < m_num_points; i++)
+                ofs.write((const char*)m_upper_links[i].data(), m_upper_links[i].size() * sizeof(int));
+
+            if (!ofs)
+                throw RuntimeException("could not write hnsw index: " + filename);
+        }
+
+        // the graph and the visited lists kept for searches
+        std::size_t getMemoryUsage() const
+        {
+            std::size_t bytes = m_levels.capacity() * sizeof(int) + m_links0.capacity() * sizeof(int) +
+                    m_upper_links.capacity() * sizeof(std::vector<int>);
+            for (const std::vector<int> &links : m_upper_links)
+                bytes += links.capacity() * sizeof(int);
+
+            std::lock_guard<std::mutex> lock(m_visited_mutex);
+            for (const std::unique_ptr<VisitedList> &list : m_visited_pool)
+                bytes += list->tags.capacity() * sizeof(unsigned);
+            return bytes;
+        }
+
+        /**
+         * @brief Restore an index that was written with save(). The dataset must be the one used for building.
+         * @param filename the index file
+         * @return false if the file does not match the dataset
+         */
+        bool load(const std::string &filename)
+        {
+            std::ifstream ifs(filename, std::ios::binary);
+            char magic[sizeof(s_magic)];
+            int header[8];
+            ifs.read(magic, sizeof(magic));
+            ifs.read((char*)header, sizeof(header));
+            if (!ifs || std::memcmp(magic, s_magic, sizeof(s_magic)) != 0 || header[0] != s_version ||
+                    header[1] != m_num_points || header[2] != m_dim)
+                return false;
+
+            m_m = header[3];
+            m_max_m0 = header[4];
+            m_ef_construction = header[5];
+            m_entry_point = header[6];
+            m_max_level = header[7];
+
+            m_levels.resize(m_num_points);
+            ifs.read((char*)m_levels.data(), m_levels.size() * sizeof(int));
+            m_links0.resize((size_t)m_num_points * (m_max_m0 + 1));
+            ifs.read((char*)m_links0.data(), m_links0.size() * sizeof(int));
+            m_upper_links.assign(m_num_points, std::vector<int>());
+            for (int i = 0; i < m_num_points && ifs; i++)
+            {
+                m_upper_links[i].resize(m_levels[i] * (m_m + 1));
+                ifs.read((char*)m_upper_links[i].data(), m_upper_links[i].size() * sizeof(int));
+            }
+
+            return (bool)ifs;
+        }
+
+    private:
+        // marks visited nodes with the id of the current search, so it does not need to be cleared
+        struct VisitedList
+        {
+            std::vector<unsigned> tags;
+            unsigned current;
+
+            explicit VisitedList(int size) : tags(size, 0), current(0)
+            {
+            }
+
+            void next()
+            {
+                if (++current == 0)
+                {
+                    std::fill(tags.begin(), tags.end(), 0);
+                    current = 1;
+                }
+            }
+        };
+
+        float distance(const float *query, int id) const
+        {
+            return m_distance(query, m_dataset[id], m_dim);
+        }
+
+        // links of a node in a layer, the first entry is the number of links
+        int* getLinks(int id, int level)
+        {
+            return level == 0 ? &m_links0[(size_t)id * (m_max_m0 + 1)] : &m_upper_links[id][(level - 1) * (m_m + 1)];
+        }
+
+        const int* getLinks(int id, int level) const
+        {
+            return level == 0 ? &m_links0[(size_t)id * (m_max_m0 + 1)] : &m_upper_links[id][(level - 1) * (m_m + 1)];
+        }
+
+        // copy the links of a node, locks the node while the graph is built
+        void copyLinks(int id, int level, std::vector<int> &links) const
+        {
+            if (m_node_locks)
+            {
+                std::lock_guard<std::mutex> lock(m_node_locks[id]);
+                const int *data = getLinks(id, level);
+                links.assign(data + 1, data + 1 + data[0]);
+            }
+            else
+            {
+                const int *data = getLinks(id, level);
+                links.assign(data + 1, data + 1 + data[0]);
+            }
+        }
+
+        std::unique_ptr<VisitedList> acquireVisitedList() const
+        {
+            std::lock_guard<std::mutex> lock(m_visited_mutex);
+            if (m_visited_pool.empty())
+                return std::unique_ptr<VisitedList>(new VisitedList(m_num_points));
+
+            std::unique_ptr<VisitedList> list = std::move(m_visited_pool.back());
+            m_visited_pool.pop_back();
+            return list;
+        }
+
+        void releaseVisitedList(std::unique_ptr<VisitedList> list) const
+        {
+            std::lock_guard<std::mutex> lock(m_visited_mutex);
+            m_visited_pool.push_back(std::move(list));
+        }
+
+        // move to the closest neighbor as long as the distance decreases
+        void greedySearch(const float *query, Candidate &current, int level) const
+        {
+            std::vector<int> links;
+            bool changed = true;
+            while (changed)
+            {
+                changed = false;
+                copyLinks(current.second, level, links);
+                for (int neighbor : links)
+                {
+                    float dist = distance(query, neighbor);
+                    if (dist < current.first)
+                    {
+                        current = Candidate(dist, neighbor);
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        // beam search in one layer, the result is sorted by increasing distance
+        void searchLayer(const float *query, const Candidate &entry, int ef, int level, std::vector<Candidate> &result) const
+        {
+            std::unique_ptr<VisitedList> visited = acquireVisitedList();
+            visited->next();
+
+            std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > candidates;
+            std::priority_queue<Candidate> best;
+            candidates.push(entry);
+            best.push(entry);
+            visited->tags[entry.second] = visited->current;
+
+            std::vector<int> links;
+            while (!candidates.empty())
+            {
+                Candidate current = candidates.top();
+                if (current.first > best.top().first && (int)best.size() >= ef)
+                    break;
+                candidates.pop();
+
+                copyLinks(current.second, level, links);
+                for (int neighbor : links)
+                {
+                    if (visited->tags[neighbor] == visited->current)
+                        continue;
+                    visited->tags[neighbor] = visited->current;
+
+                    float dist = distance(query, neighbor);
+                    if ((int)best.size() < ef || dist < best.top().first)
+                    {
+                        candidates.push(Candidate(dist, neighbor));
+                        best.push(Candidate(dist, neighbor));
+                        if ((int)best.size() > ef)
+                            best.pop();
+                    }
+                }
+            }
+
+            releaseVisitedList(std::move(visited));
+
+            result.resize(best.size());
+            for (int i = (int)best.size() - 1; i >= 0; i--)
+            {
+                result[i] = best.top();
+                best.pop();
+            }
+        }
+
+        // keep candidates that are closer to the base point than to any already selected neighbor
+        void selectNeighbors(std::vector<Candidate> &candidates, int m) const
+        {
+            if ((int)candidates.size() <= m)
+                return;
+
+            std::vector<Candidate> selected;
+            selected.reserve(m);
+            for (const Candidate &candidate : candidates)
+            {
+                bool keep = true;
+                for (const Candidate &other : selected)
+                {
+                    if (distance(m_dataset[candidate.second], other.second) < candidate.first)
+                    {
+                        keep = false;
+                        break;
+                    }
+                }
+                if (keep)
+                {
+                    selected.push_back(candidate);
+                    if ((int)selected.size() >= m)
+                        break;
+                }
+            }
+            candidates.swap(selected);
+        }
+
+        void insert(int id)
+        {
+            const int level = m_levels[id];
+            const float *query = m_dataset[id];
+
+            // the global lock is kept while inserting a node that becomes the new entry point
+            std::unique_lock<std::mutex> globalLock(*m_global_lock);
+            const int maxLevel = m_max_level;
+            Candidate current(0, m_entry_point);
+            if (level <= maxLevel)
+                globalLock.unlock();
+
+            current.first = distance(query, current.second);
+            for (int l = maxLevel; l > level; l--)
+                greedySearch(query, current, l);
+
+            std::vector<Candidate> candidates;
+            for (int l = std::min(level, maxLevel); l >= 0; l--)
+            {
+                searchLayer(query, current, m_ef_construction, l, candidates);
+                current = candidates[0];
+
+                std::vector<Candidate> neighbors = candidates;
+                selectNeighbors(neighbors, m_m);
+                {
+                    std::lock_guard<std::mutex> lock(m_node_locks[id]);
+                    int *links = getLinks(id, l);
+                    links[0] = (int)neighbors.size();
+                    for (int i = 0; i < (int)neighbors.size(); i++)
+                        links[i + 1] = neighbors[i].second;
+                }
+
+                // add the reverse links, shrink the neighbor lists that overflow
+                const int maxM = l == 0 ? m_max_m0 : m_m;
+                for (const Candidate &neighbor : neighbors)
+                {
+                    std::lock_guard<std::mutex> lock(m_node_locks[neighbor.second]);
+                    int *links = getLinks(neighbor.second, l);
+                    if (links[0] < maxM)
+                    {
+                        links[++links[0]] = id;
+                        continue;
+                    }
+
+                    const float *base = m_dataset[neighbor.second];
+                    std::vector<Candidate> linkCandidates;
+                    linkCandidates.reserve(links[0] + 1);
+                    linkCandidates.push_back(Candidate(neighbor.first, id));
+                    for (int i = 1; i <= links[0]; i++)
+                        linkCandidates.push_back(Candidate(distance(base, links[i]), links[i]));
+                    std::sort(linkCandidates.begin(), linkCandidates.end());
+                    selectNeighbors(linkCandidates, maxM);
+
+                    links[0] = (int)linkCandidates.size();
+                    for (int i = 0; i < (int)linkCandidates.size(); i++)
+                        links[i + 1] = linkCandidates[i].second;
+                }
+            }
+
+            if (level > maxLevel)
+            {
+                m_entry_point = id;
+                m_max_level = level;
+            }
+        }
+
+        void search(const float *query, int k, std::vector<Candidate> &result) const
+        {
+            result.clear();
+            if (m_entry_point < 0)
+                return;
+
+            Candidate current(distance(query, m_entry_point), m_entry_point);
+            for (int l = m_max_level; l > 0; l--)
+                greedySearch(query, current, l);
+
+            searchLayer(query, current, std::max(m_ef_search, k), 0, result);
+            if ((int)result.size() > k)
+                result.resize(k);
+        }
+
+        void searchExhaustive(const float *query, int k, std::vector<Candidate> &result) const
+        {
+            std::priority_queue<Candidate> best;
+            for (int i = 0; i < m_num_points; i++)
+            {
+                float dist = distance(query, i);
+                if ((int)best.size() < k)
+                    best.push(Candidate(dist, i));
+                else if (dist < best.top().first)
+                {
+                    best.pop();
+                    best.push(Candidate(dist, i));
+                }
+            }
+
+            result.resize(best.size());
+            for (int i = (int)best.size() - 1; i >= 0; i--)
+            {
+                result[i] = best.top();
+                best.pop();
+            }
+        }
+
+        static constexpr char s_magic[8] = {'I', 'S', 'M', 'H', 'N', 'S', 'W', '\0'};
+        static const int s_version = 1;
+
+        flann::Matrix<float> m_dataset;
+        int m_num_points;
+        int m_dim;
+        T m_distance;
+
+        int m_m;
+        int m_max_m0;
+        int m_ef_construction;
+        int m_ef_search;
+
+        int m_entry_point;
+        int m_max_level;
+        std::vector<int> m_levels;
+        std::vector<int> m_links0;                      // layer 0, fixed size per node
+        std::vector<std::vector<int> > m_upper_links;   // layers above 0, only for nodes in these layers
+
+        // only valid while building
+        std::mutex *m_node_locks;
+        std::mutex *m_global_lock;
+
+        mutable std::mutex m_visited_mutex;
+        mutable std::vector<std::unique_ptr<VisitedList> > m_visited_pool;
+    };
+
+    template<typename T>
+    constexpr char HnswIndex<T>::s_magic[8];
+}
+
+#endif // ISM3D_HNSW_INDEX_H
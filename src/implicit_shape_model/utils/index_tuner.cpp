@@ -0,0 +1,210 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "index_tuner.h"
+#include "hnsw_index.h"
+#include "distance_dispatch.h"
+#include "utils.h"
+
+#include <limits>
+#include <algorithm>
+#include <boost/timer/timer.hpp>
+
+namespace ism3d
+{
+    IndexTuner::IndexTuner(int k, float target_recall)
+        : m_k(std::max(k, 1)), m_target_recall(target_recall)
+    {
+        m_tree_grid = {1, 2, 4, 8, 16};
+        m_checks_grid = {16, 32, 64, 128, 256, 512, 1024, 2048};
+        m_ef_grid = {16, 24, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+    }
+
+    bool IndexTuner::tune(const std::string &dist_type, const flann::Matrix<float> &dataset, const flann::Matrix<float> &queries,
+                          const std::vector<int> &excluded, KnnIndexParams &params)
+    {
+        m_results.clear();
+
+        if (queries.rows == 0 || dataset.rows < 2)
+        {
+            LOG_WARN("not enough descriptors for index tuning");
+            return false;
+        }
+        if (!excluded.empty() && excluded.size() != queries.rows)
+        {
+            LOG_ERROR("number of excluded rows does not match the number of queries");
+            return false;
+        }
+
+        switch (toIndexDistance(dist_type))
+        {
+        case IndexDistance::Euclidean:
+            return tuneIndex<DistanceEuclidean::DistanceType>(dataset, queries, excluded, params);
+        case IndexDistance::ChiSquared:
+            return tuneIndex<DistanceChiSquared::DistanceType>(dataset, queries, excluded, params);
+        case IndexDistance::Hellinger:
+            return tuneIndex<DistanceHellinger::DistanceType>(dataset, queries, excluded, params);
+        case IndexDistance::HistIntersection:
+            return tuneIndex<DistanceHistIntersection::DistanceType>(dataset, queries, excluded, params);
+        default:
+            LOG_WARN("index tuning is not available for distance type " << dist_type);
+            return false;
+        }
+    }
+
+    template<typename T>
+    bool IndexTuner::tuneIndex(const flann::Matrix<float> &dataset, const flann::Matrix<float> &queries,
+                               const std::vector<int> &excluded, KnnIndexParams &params)
+    {
+        // a query that is part of the dataset has one candidate less
+        m_k = std::min(m_k, (int)dataset.rows - (excluded.empty() ? 0 : 1));
+
+        LOG_INFO("tuning " << params.type << " index with " << queries.rows << " queries on " << dataset.rows <<
+                 " descriptors for a recall@" << m_k << " of " << m_target_recall);
+
+        std::vector<float> kthDistances;
+        computeGroundTruth<T>(dataset, queries, excluded, kthDistances);
+
+        if (params.type == "HNSW")
+        {
+            HnswIndex<T> index(dataset, params.hnsw_m, params.hnsw_ef_construction, params.hnsw_ef_search);
+            index.buildIndex();
+
+            // larger candidate lists only increase the recall and the cost
+            for (int ef : m_ef_grid)
+            {
+                KnnIndexParams candidate = params;
+                candidate.hnsw_ef_search = ef;
+                index.setEfSearch(ef);
+                m_results.push_back(evaluate(index, candidate, queries, excluded, kthDistances));
+                if (m_results.back().recall >= m_target_recall)
+                    break;
+            }
+        }
+        else
+        {
+            for (int trees : m_tree_grid)
+            {
+                FlannKdTreeIndex<T> index(dataset, trees, params.checks);
+                index.buildIndex();
+
+                // more checks only increase the recall and the cost
+                for (int checks : m_checks_grid)
+                {
+                    KnnIndexParams candidate = params;
+                    candidate.kd_trees = trees;
+                    candidate.checks = checks;
+                    index.setChecks(checks);
+                    m_results.push_back(evaluate(index, candidate, queries, excluded, kthDistances));
+                    if (m_results.back().recall >= m_target_recall)
+                        break;
+                }
+            }
+        }
+
+        for (const IndexTuningResult &result : m_results)
+        {
+            if (params.type == "HNSW")
+                LOG_INFO("  ef " << result.params.hnsw_ef_search << ": recall " << result.recall <<
+                         ", " << result.latency << " us per query");
+            else
+                LOG_INFO("  trees " << result.params.kd_trees << ", checks " << result.params.checks << ": recall " <<
+                         result.recall << ", " << result.latency << " us per query");
+        }
+
+        return select(params);
+    }
+
+    template<typename T>
+    void IndexTuner::computeGroundTruth(const flann::Matrix<float> &dataset, const flann::Matrix<float> &queries,
+                                        const std::vector<int> &excluded, std::vector<float> &kth_distances) const
+    {
+        kth_distances.resize(queries.rows);
+        T distance;
+
+#pragma omp parallel for schedule(dynamic, 16)
+        for (int q = 0; q < (int)queries.rows; q++)
+        {
+            const int skip = excluded.empty() ? -1 : excluded[q];
+            std::vector<float> distances;
+            distances.reserve(dataset.rows);
+            for (int i = 0; i < (int)dataset.rows; i++)
+            {
+                if (i != skip)
+                    distances.push_back(distance(queries[q], dataset[i], dataset.cols));
+            }
+            std::nth_element(distances.begin(), distances.begin() + (m_k - 1), distances.end());
+            kth_distances[q] = distances[m_k - 1];
+        }
+    }
+
+    template<typename T>
+    IndexTuningResult IndexTuner::evaluate(const KnnIndex<T> &index, const KnnIndexParams &params, const flann::Matrix<float> &queries,
+                                           const std::vector<int> &excluded, const std::vector<float> &kth_distances) const
+    {
+        // the excluded row may be among the results
+        const int k = excluded.empty() ? m_k : m_k + 1;
+        std::vector<std::vector<int> > indices;
+        std::vector<std::vector<float> > distances;
+
+        boost::timer::cpu_timer timer;
+        index.knnSearch(queries, indices, distances, k, false, 1);
+        timer.stop();
+
+        // neighbors within the distance of the true k-th neighbor are correct, this also counts ties as found
+        long found = 0;
+        for (int q = 0; q < (int)queries.rows; q++)
+        {
+            const int skip = excluded.empty() ? -1 : excluded[q];
+            const float maxDistance = kth_distances[q] * (1 + 1e-5f) + std::numeric_limits<float>::epsilon();
+            int hits = 0;
+            for (int j = 0; j < (int)indices[q].size() && hits < m_k; j++)
+            {
+                if (indices[q][j] != skip && indices[q][j] >= 0 && distances[q][j] <= maxDistance)
+                    hits++;
+            }
+            found += hits;
+        }
+
+        IndexTuningResult result;
+        result.params = params;
+        result.recall = (float)((double)found / ((double)queries.rows * m_k));
+        result.latency = (double)timer.elapsed().wall / 1000.0 / queries.rows;
+        return result;
+    }
+
+    bool IndexTuner::select(KnnIndexParams &params) const
+    {
+        if (m_results.empty())
+            return false;
+
+        const IndexTuningResult *best = 0;
+        for (const IndexTuningResult &result : m_results)
+        {
+            if (result.recall >= m_target_recall && (!best || result.latency < best->latency))
+                best = &result;
+        }
+
+        const bool reached = best != 0;
+        if (!reached)
+        {
+            // fall back to the most accurate setting
+            for (const IndexTuningResult &result : m_results)
+            {
+                if (!best || result.recall > best->recall)
+                    best = &result;
+            }
+            LOG_WARN("no setting reaches the target recall of " << m_target_recall << ", best recall: " << best->recall);
+        }
+
+        params = best->params;
+        return reached;
+    }
+}
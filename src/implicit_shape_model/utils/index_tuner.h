@@ -0,0 +1,109 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_INDEX_TUNER_H
+#define ISM3D_INDEX_TUNER_H
+
+#include <vector>
+#include <string>
+#include <flann/flann.hpp>
+
+#include "knn_index.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The IndexTuningResult struct
+     * Quality and cost of one evaluated index setting.
+     */
+    struct IndexTuningResult
+    {
+        KnnIndexParams params;
+        float recall;       // mean recall@k against the exact search
+        double latency;     // mean single-threaded search time per query in microseconds
+    };
+
+    /**
+     * @brief The IndexTuner class
+     * Selects the search parameters of the approximate codebook index. A set of queries is searched exactly to
+     * obtain the true k nearest neighbors, afterwards a grid of settings is evaluated: number of kd-trees and
+     * checks for the KDTree index, or the candidate list size for the HNSW index. The construction parameters
+     * of HNSW are taken from the given params. The cheapest setting, i.e. the one with the lowest measured
+     * latency, that reaches the target recall is selected.
+     * Queries can be rows of the dataset itself, in that case the row is excluded from the neighbors of the
+     * query (leave-one-out), since finding the query itself would overestimate the recall.
+     */
+    class IndexTuner
+    {
+    public:
+        /**
+         * @param k the number of neighbors for which the recall is measured
+         * @param target_recall the recall the selected setting must reach
+         */
+        IndexTuner(int k, float target_recall);
+
+        /**
+         * @brief Evaluate the settings of the index type in params and select the cheapest one.
+         * @param dist_type the distance type, binary descriptors are not supported
+         * @param dataset the indexed descriptors
+         * @param queries the query descriptors
+         * @param excluded for each query the dataset row to exclude (-1: none), may be empty
+         * @param params input: index type and construction parameters, output: the selected setting
+         * @return true if a setting reaches the target recall, otherwise params holds the one with the highest recall
+         */
+        bool tune(const std::string &dist_type, const flann::Matrix<float> &dataset, const flann::Matrix<float> &queries,
+                  const std::vector<int> &excluded, KnnIndexParams &params);
+
+        // all evaluated settings of the last call to tune()
+        const std::vector<IndexTuningResult>& getResults() const
+        {
+            return m_results;
+        }
+
+        void setTreeGrid(const std::vector<int> &trees)
+        {
+            m_tree_grid = trees;
+        }
+
+        void setChecksGrid(const std::vector<int> &checks)
+        {
+            m_checks_grid = checks;
+        }
+
+        void setEfGrid(const std::vector<int> &ef)
+        {
+            m_ef_grid = ef;
+        }
+
+    private:
+        template<typename T>
+        bool tuneIndex(const flann::Matrix<float> &dataset, const flann::Matrix<float> &queries,
+                       const std::vector<int> &excluded, KnnIndexParams &params);
+
+        template<typename T>
+        void computeGroundTruth(const flann::Matrix<float> &dataset, const flann::Matrix<float> &queries,
+                                const std::vector<int> &excluded, std::vector<float> &kth_distances) const;
+
+        template<typename T>
+        IndexTuningResult evaluate(const KnnIndex<T> &index, const KnnIndexParams &params, const flann::Matrix<float> &queries,
+                                   const std::vector<int> &excluded, const std::vector<float> &kth_distances) const;
+
+        bool select(KnnIndexParams &params) const;
+
+        int m_k;
+        float m_target_recall;
+        std::vector<int> m_tree_grid;
+        std::vector<int> m_checks_grid;
+        std::vector<int> m_ef_grid;
+        std::vector<IndexTuningResult> m_results;
+    };
+}
+
+#endif // ISM3D_INDEX_TUNER_H
@@ -18,5 +18,6 @@ namespace ism3d
         globalDescriptorRadius = -1;
         classId = -1;
         centerDist = 0;
+        weight = 1;
     }
 }
@@ -13,7 +13,6 @@
 
 #define PCL_NO_PRECOMPILE
 #include <pcl/point_types.h>
-#include <pcl/point_representation.h>
 
 namespace ism3d
 {
@@ -39,34 +38,11 @@ namespace ism3d
         //   2) local features during training (weights computation)
         int classId;
 
+        // number of training features this feature stands for after deduplication, 1 otherwise
+        float weight;
+
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW
     } EIGEN_ALIGN16;
-
-    // ISM Feature point representation used to create custom k-D tree
-    class ISMFeaturePointRepresentation : public pcl::PointRepresentation <ISMFeature>
-    {
-      using pcl::PointRepresentation<ISMFeature>::nr_dimensions_;
-    public:
-      ISMFeaturePointRepresentation ()
-      {
-        // Define the number of dimensions
-        nr_dimensions_ = 1;
-      }
-
-      ISMFeaturePointRepresentation (int dim)
-      {
-          nr_dimensions_ = dim;
-      }
-
-      // Override the copyToFloatArray method to define our feature vector
-      virtual void copyToFloatArray (const ISMFeature &p, float * out) const
-      {
-        for(int i = 0; i < nr_dimensions_; i++)
-        {
-            out[i] = p.descriptor.at(i);
-        }
-      }
-    };
 }
 
 POINT_CLOUD_REGISTER_POINT_STRUCT(
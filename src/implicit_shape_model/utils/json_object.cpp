@@ -9,8 +9,12 @@
  */
 
 #include "json_object.h"
+#include "block_compression.h"
+#include "flat_model.h"
+#include "json_stream.h"
 #include "utils.h"
 #include <fstream>
+#include <sstream>
 
 /*
 namespace boost {
@@ -104,11 +108,30 @@ namespace ism3d
             // NOTE: in case this name is changed in config, it needs to be forwarded to data while loading
         }
 
-        // create boost data object
-        std::ofstream ofs(fileData);
-        boost::archive::binary_oarchive oa(ofs);
-        saveData(oa);
-        ofs.close();
+        if (iUseFlatData())
+        {
+            if (!iSaveFlatData(fileData))
+                return false;
+        }
+        else if (iUseCompressedData())
+        {
+            // the archive is assembled in memory and compressed in blocks
+            std::ostringstream archive;
+            {
+                boost::archive::binary_oarchive oa(archive);
+                saveData(oa);
+            }
+            if (!BlockCompression::write(fileData, archive.str()))
+                return false;
+        }
+        else
+        {
+            // create boost data object
+            std::ofstream ofs(fileData);
+            boost::archive::binary_oarchive oa(ofs);
+            saveData(oa);
+            ofs.close();
+        }
 
         if (!write(configJson, file, true))
             return false;
@@ -175,6 +198,35 @@ namespace ism3d
                 return false;
             }
 
+            // flat models are mapped instead of read
+            if (FlatModel::isFlatModel(fileData))
+            {
+                if (!iLoadFlatData(fileData))
+                {
+                    LOG_ERROR("Error loading flat model: " << fileData);
+                    return false;
+                }
+                LOG_INFO("reading successful");
+                return true;
+            }
+
+            // compressed archives are decompressed in parallel and read from memory
+            if (BlockCompression::isCompressed(fileData))
+            {
+                std::vector<char> archive;
+                if (!BlockCompression::read(fileData, archive))
+                {
+                    LOG_ERROR("Error loading compressed file: " << fileData);
+                    return false;
+                }
+                MemoryStreamBuffer buffer(archive.data(), archive.size());
+                std::istream stream(&buffer);
+                boost::archive::binary_iarchive ia(stream);
+                loadData(ia);
+                LOG_INFO("reading successful");
+                return true;
+            }
+
             // read boost data object
             std::ifstream ifs(fileData);
             if(ifs)
@@ -290,6 +342,109 @@ namespace ism3d
         return true;
     }
 
+    bool JSONObject::writeJsonData(const std::string &file, bool packFloats) const
+    {
+        LOG_INFO("writing object data as json to file: " << file);
+
+        // make sure the decimal mark is a point
+        setlocale(LC_NUMERIC, "C");
+
+        std::ofstream stream(file.c_str());
+        if (!stream.is_open())
+        {
+            LOG_ERROR("could not open file " << file);
+            return false;
+        }
+
+        JsonStreamWriter writer(stream, packFloats);
+        dataToJsonStream(writer);
+        stream.close();
+        if (!stream)
+        {
+            LOG_ERROR("could not write json data to " << file);
+            return false;
+        }
+        return true;
+    }
+
+    bool JSONObject::readJsonData(const std::string &file)
+    {
+        LOG_INFO("reading object data from json file: " << file);
+
+        // make sure the decimal mark is a point
+        setlocale(LC_NUMERIC, "C");
+
+        std::ifstream stream(file.c_str());
+        if (!stream.is_open())
+        {
+            LOG_ERROR("could not open file " << file);
+            return false;
+        }
+
+        JsonStreamReader reader(stream);
+        if (!dataFromJsonStream(reader))
+        {
+            LOG_ERROR("could not read json data from " << file << (reader.failed() ? ": " + reader.getError() : ""));
+            return false;
+        }
+        return true;
+    }
+
+    void JSONObject::dataToJsonStream(JsonStreamWriter &writer) const
+    {
+        writer.beginObject();
+
+        // the type first, so that readers know it before the data
+        std::string type = getType();
+        if (type.length() > 0) {
+            writer.key("Type");
+            writer.value(Json::Value(type));
+        }
+
+        writer.key("Data");
+        iDataToJsonStream(writer);
+        writer.endObject();
+    }
+
+    bool JSONObject::dataFromJsonStream(JsonStreamReader &reader)
+    {
+        if (!reader.beginObject())
+            return false;
+
+        std::string key;
+        while (reader.nextMember(key))
+        {
+            if (key == "Type")
+            {
+                Json::Value type;
+                if (!reader.readValue(type))
+                    return false;
+                if (type.isString() && !getType().empty() && type.asString() != getType())
+                {
+                    LOG_ERROR("json data of type " << type.asString() << " can not be read by type " << getType());
+                    return false;
+                }
+            }
+            else if (key == "Data" && !reader.nextIsNull())
+            {
+                if (!iDataFromJsonStream(reader))
+                    return false;
+            }
+            else if (!reader.skipValue())
+            {
+                return false;
+            }
+        }
+        return !reader.failed();
+    }
+
+    MemoryUsage JSONObject::memoryUsage() const
+    {
+        MemoryUsage usage(getType());
+        iMemoryUsage(usage);
+        return usage;
+    }
+
     Json::Value JSONObject::iChildConfigsToJson() const
     {
         Json::Value object(Json::nullValue);
@@ -312,6 +467,28 @@ namespace ism3d
         return true;
     }
 
+    bool JSONObject::iUseFlatData() const
+    {
+        return false;
+    }
+
+    bool JSONObject::iSaveFlatData(const std::string &file) const
+    {
+        LOG_ERROR("object type " << getType() << " can not be stored as a flat model");
+        return false;
+    }
+
+    bool JSONObject::iLoadFlatData(const std::string &file)
+    {
+        LOG_ERROR("object type " << getType() << " can not be loaded from a flat model");
+        return false;
+    }
+
+    bool JSONObject::iUseCompressedData() const
+    {
+        return false;
+    }
+
     Json::Value JSONObject::iDataToJson() const
     {
         Json::Value object(Json::nullValue);
@@ -323,10 +500,28 @@ namespace ism3d
         return true;
     }
 
+    void JSONObject::iDataToJsonStream(JsonStreamWriter &writer) const
+    {
+        writer.value(iDataToJson());
+    }
+
+    bool JSONObject::iDataFromJsonStream(JsonStreamReader &reader)
+    {
+        // as dataFromJson(), data that is not an object is ignored
+        Json::Value data;
+        if (!reader.readValue(data))
+            return false;
+        return !data.isObject() || iDataFromJson(data);
+    }
+
     void JSONObject::iPostInitConfig()
     {
     }
 
+    void JSONObject::iMemoryUsage(MemoryUsage &usage) const
+    {
+    }
+
     bool JSONObject::write(const Json::Value& json, const std::string& filename, bool styled) const
     {
         std::ofstream file;
@@ -17,9 +17,13 @@
 #include <boost/serialization/vector.hpp>
 
 #include "json_parameter.h"
+#include "memory_usage.h"
 
 namespace ism3d
 {
+    class JsonStreamWriter;
+    class JsonStreamReader;
+
     /**
      * @brief The JSONObject class
      * The base class for object which can be (de-)serialized to JSON. The object
@@ -74,8 +78,35 @@ namespace ism3d
         Json::Value dataToJson() const;
         bool dataFromJson(const Json::Value&);
 
+        /**
+         * @brief Write the object data as JSON in the format of dataToJson(), but incrementally, so that large data is
+         * never held as one Json::Value tree.
+         * @param file the data filename
+         * @param packFloats write arrays of floats as base64 strings instead of numbers, see JsonStreamWriter
+         * @return true if successful
+         */
+        bool writeJsonData(const std::string &file, bool packFloats = false) const;
+
+        /**
+         * @brief Read object data written by writeJsonData() or in the format of dataToJson(), incrementally. The
+         * configuration has to be read before, e.g. with readObject(file, true).
+         * @param file the data filename
+         * @return true if successful
+         */
+        bool readJsonData(const std::string &file);
+
+        // the streaming versions of dataToJson() and dataFromJson(), the type is written before the data
+        void dataToJsonStream(JsonStreamWriter &writer) const;
+        bool dataFromJsonStream(JsonStreamReader &reader);
+
         void setOutputFilename(std::string file);
 
+        /**
+         * @brief Estimate the memory held by the object, split into its parts and classes.
+         * @return the memory usage named by the object type
+         */
+        MemoryUsage memoryUsage() const;
+
     protected:
         template <typename T>
         void addParameter(T& param, std::string name, T defaultValue) {
@@ -91,8 +122,28 @@ namespace ism3d
         virtual Json::Value iDataToJson() const;
         virtual bool iDataFromJson(const Json::Value&);
 
+        // the streaming versions of iDataToJson() and iDataFromJson(), the default converts the data as one tree;
+        // objects with large data write and read it in parts
+        virtual void iDataToJsonStream(JsonStreamWriter &writer) const;
+        virtual bool iDataFromJsonStream(JsonStreamReader &reader);
+
+        // objects that can store their data as a flat model (see FlatModel) instead of an archive; writeObject() uses
+        // the flat model if iUseFlatData() is true, readObject() recognizes it by its header
+        virtual bool iUseFlatData() const;
+        virtual bool iSaveFlatData(const std::string &file) const;
+        virtual bool iLoadFlatData(const std::string &file);
+
+        // objects whose archive is written block compressed (see BlockCompression) if iUseCompressedData() is true,
+        // readObject() recognizes compressed archives by their header
+        virtual bool iUseCompressedData() const;
+
         virtual void iPostInitConfig();
 
+        // adds the parts of the object to the memory usage, objects without noteworthy data add nothing
+        virtual void iMemoryUsage(MemoryUsage &usage) const;
+
+        std::string toJsonString(const Json::Value&, bool) const;
+
         bool m_use_svm;
         bool m_svm_1_vs_all_train;
         std::string m_svm_path;
@@ -101,7 +152,6 @@ namespace ism3d
     private:
         bool write(const Json::Value&, const std::string&, bool) const;
         Json::Value read(const std::string&);
-        std::string toJsonString(const Json::Value&, bool) const;
         Json::Value fromJsonString(const std::string&);
 
         std::vector<JSONParameterBase*> m_params;
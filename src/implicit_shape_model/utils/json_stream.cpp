@@ -0,0 +1,647 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "json_stream.h"
+
+#include <cstdint>
+#include <cstring>
+#include <locale>
+#include <sstream>
+
+namespace ism3d
+{
+    namespace
+    {
+        const char Base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        const int MaxDepth = 1000;
+
+        std::string encodeFloats(const Json::Value &array)
+        {
+            std::vector<unsigned char> bytes;
+            bytes.reserve(array.size() * 4);
+            for (Json::ArrayIndex i = 0; i < array.size(); i++)
+            {
+                float value = array[i].asFloat();
+                uint32_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                for (int b = 0; b < 4; b++)
+                    bytes.push_back((bits >> (8 * b)) & 0xFF);
+            }
+
+            std::string result;
+            result.reserve((bytes.size() + 2) / 3 * 4);
+            for (std::size_t i = 0; i < bytes.size(); i += 3)
+            {
+                uint32_t group = bytes[i] << 16;
+                if (i + 1 < bytes.size())
+                    group |= bytes[i + 1] << 8;
+                if (i + 2 < bytes.size())
+                    group |= bytes[i + 2];
+                result += Base64Chars[(group >> 18) & 0x3F];
+                result += Base64Chars[(group >> 12) & 0x3F];
+                result += i + 1 < bytes.size() ? Base64Chars[(group >> 6) & 0x3F] : '=';
+                result += i + 2 < bytes.size() ? Base64Chars[group & 0x3F] : '=';
+            }
+            return result;
+        }
+
+        bool decodeFloats(const char *text, std::size_t length, Json::Value &array)
+        {
+            if (length % 4 != 0)
+                return false;
+
+            std::vector<unsigned char> bytes;
+            bytes.reserve(length / 4 * 3);
+            for (std::size_t i = 0; i < length; i += 4)
+            {
+                uint32_t group = 0;
+                int padding = 0;
+                for (int c = 0; c < 4; c++)
+                {
+                    // padding is only allowed at the end
+                    const char ch = text[i + c];
+                    if (ch == '=' && i + 4 == length && c >= 2)
+                    {
+                        padding++;
+                        group <<= 6;
+                        continue;
+                    }
+                    const char *pos = ch ? std::strchr(Base64Chars, ch) : 0;
+                    if (!pos || padding > 0)
+                        return false;
+                    group = (group << 6) | (pos - Base64Chars);
+                }
+                bytes.push_back((group >> 16) & 0xFF);
+                if (padding < 2)
+                    bytes.push_back((group >> 8) & 0xFF);
+                if (padding < 1)
+                    bytes.push_back(group & 0xFF);
+            }
+            if (bytes.size() % 4 != 0)
+                return false;
+
+            array = Json::Value(Json::arrayValue);
+            array.resize(bytes.size() / 4);
+            for (std::size_t i = 0; i < bytes.size(); i += 4)
+            {
+                uint32_t bits = bytes[i] | (bytes[i + 1] << 8) | (bytes[i + 2] << 16) | ((uint32_t)bytes[i + 3] << 24);
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                array[(Json::ArrayIndex)(i / 4)] = Json::Value(value);
+            }
+            return true;
+        }
+    }
+
+    const char JsonStreamWriter::PackedPrefix[] = "base64f32:";
+    const std::size_t JsonStreamWriter::PackedMinSize;
+
+    JsonStreamWriter::JsonStreamWriter(std::ostream &stream, bool packFloats)
+        : m_stream(stream), m_pack_floats(packFloats), m_after_key(false)
+    {
+    }
+
+    void JsonStreamWriter::beginObject()
+    {
+        beginValue();
+        m_stream << '{';
+        m_empty.push_back(true);
+    }
+
+    void JsonStreamWriter::endObject()
+    {
+        bool empty = m_empty.back();
+        m_empty.pop_back();
+        if (!empty)
+            newLine();
+        m_stream << '}';
+        if (m_empty.empty())
+            m_stream << '\n';
+    }
+
+    void JsonStreamWriter::beginArray()
+    {
+        beginValue();
+        m_stream << '[';
+        m_empty.push_back(true);
+    }
+
+    void JsonStreamWriter::endArray()
+    {
+        bool empty = m_empty.back();
+        m_empty.pop_back();
+        if (!empty)
+            newLine();
+        m_stream << ']';
+        if (m_empty.empty())
+            m_stream << '\n';
+    }
+
+    void JsonStreamWriter::key(const std::string &name)
+    {
+        if (!m_empty.back())
+            m_stream << ',';
+        m_empty.back() = false;
+        newLine();
+        m_stream << Json::valueToQuotedString(name.c_str()) << " : ";
+        m_after_key = true;
+    }
+
+    void JsonStreamWriter::value(const Json::Value &value)
+    {
+        if (value.isObject() && !isInline(value))
+        {
+            beginObject();
+            for (const std::string &name : value.getMemberNames())
+            {
+                key(name);
+                this->value(value[name]);
+            }
+            endObject();
+        }
+        else if (value.isArray() && !isInline(value))
+        {
+            beginArray();
+            for (Json::ArrayIndex i = 0; i < value.size(); i++)
+                this->value(value[i]);
+            endArray();
+        }
+        else
+        {
+            beginValue();
+            writeInline(value);
+            if (m_empty.empty())
+                m_stream << '\n';
+        }
+    }
+
+    bool JsonStreamWriter::good() const
+    {
+        return m_stream.good();
+    }
+
+    void JsonStreamWriter::beginValue()
+    {
+        if (m_after_key)
+        {
+            m_after_key = false;
+            return;
+        }
+        if (m_empty.empty())
+            return;
+
+        // an array element
+        if (!m_empty.back())
+            m_stream << ',';
+        m_empty.back() = false;
+        newLine();
+    }
+
+    void JsonStreamWriter::newLine()
+    {
+        m_stream << '\n' << std::string(3 * m_empty.size(), ' ');
+    }
+
+    void JsonStreamWriter::writeInline(const Json::Value &value)
+    {
+        switch (value.type())
+        {
+        case Json::nullValue:
+            m_stream << "null";
+            break;
+        case Json::intValue:
+            m_stream << Json::valueToString(value.asLargestInt());
+            break;
+        case Json::uintValue:
+            m_stream << Json::valueToString(value.asLargestUInt());
+            break;
+        case Json::realValue:
+            m_stream << Json::valueToString(value.asDouble());
+            break;
+        case Json::stringValue:
+            m_stream << Json::valueToQuotedString(value.asCString());
+            break;
+        case Json::booleanValue:
+            m_stream << Json::valueToString(value.asBool());
+            break;
+        case Json::arrayValue:
+            if (isPackable(value))
+            {
+                m_stream << '"' << PackedPrefix << encodeFloats(value) << '"';
+                break;
+            }
+            m_stream << '[';
+            for (Json::ArrayIndex i = 0; i < value.size(); i++)
+            {
+                if (i > 0)
+                    m_stream << ", ";
+                writeInline(value[i]);
+            }
+            m_stream << ']';
+            break;
+        case Json::objectValue:
+            m_stream << "{}";
+            break;
+        }
+    }
+
+    bool JsonStreamWriter::isInline(const Json::Value &value) const
+    {
+        // empty containers and arrays of scalars are written on one line
+        if (value.isObject())
+            return value.empty();
+        for (Json::ArrayIndex i = 0; i < value.size(); i++)
+        {
+            if (value[i].isObject() || value[i].isArray())
+                return false;
+        }
+        return true;
+    }
+
+    bool JsonStreamWriter::isPackable(const Json::Value &value) const
+    {
+        if (!m_pack_floats || value.size() < PackedMinSize)
+            return false;
+        for (Json::ArrayIndex i = 0; i < value.size(); i++)
+        {
+            if (value[i].type() != Json::realValue)
+                return false;
+        }
+        return true;
+    }
+
+    JsonStreamReader::JsonStreamReader(std::istream &stream)
+        : m_buffer(stream.rdbuf()), m_offset(0)
+    {
+    }
+
+    bool JsonStreamReader::beginObject()
+    {
+        if (!expect('{'))
+            return false;
+        m_empty.push_back(true);
+        return true;
+    }
+
+    bool JsonStreamReader::nextMember(std::string &key)
+    {
+        if (failed() || m_empty.empty())
+            return fail("not in an object");
+
+        if (peek() == '}')
+        {
+            get();
+            m_empty.pop_back();
+            return false;
+        }
+        if (!m_empty.back() && !expect(','))
+            return false;
+        m_empty.back() = false;
+
+        if (peek() != '"')
+            return fail("expected a key");
+        return parseString(&key) && expect(':');
+    }
+
+    bool JsonStreamReader::beginArray()
+    {
+        if (!expect('['))
+            return false;
+        m_empty.push_back(true);
+        return true;
+    }
+
+    bool JsonStreamReader::nextElement()
+    {
+        if (failed() || m_empty.empty())
+            return fail("not in an array");
+
+        if (peek() == ']')
+        {
+            get();
+            m_empty.pop_back();
+            return false;
+        }
+        if (!m_empty.back() && !expect(','))
+            return false;
+        m_empty.back() = false;
+        return true;
+    }
+
+    bool JsonStreamReader::readValue(Json::Value &value)
+    {
+        return !failed() && parseValue(&value, 0);
+    }
+
+    bool JsonStreamReader::skipValue()
+    {
+        return !failed() && parseValue(0, 0);
+    }
+
+    bool JsonStreamReader::nextIsNull()
+    {
+        return peek() == 'n';
+    }
+
+    bool JsonStreamReader::failed() const
+    {
+        return !m_error.empty();
+    }
+
+    const std::string& JsonStreamReader::getError() const
+    {
+        return m_error;
+    }
+
+    int JsonStreamReader::peek()
+    {
+        int c = m_buffer->sgetc();
+        while (c == ' ' || c == '\n' || c == '\r' || c == '\t')
+        {
+            m_buffer->sbumpc();
+            m_offset++;
+            c = m_buffer->sgetc();
+        }
+        return c;
+    }
+
+    int JsonStreamReader::get()
+    {
+        int c = m_buffer->sbumpc();
+        if (c != std::char_traits<char>::eof())
+            m_offset++;
+        return c;
+    }
+
+    bool JsonStreamReader::expect(char c)
+    {
+        if (peek() != c)
+            return fail(std::string("expected '") + c + "'");
+        get();
+        return true;
+    }
+
+    bool JsonStreamReader::fail(const std::string &message)
+    {
+        if (m_error.empty())
+        {
+            std::ostringstream error;
+            error << message << " at byte " << m_offset;
+            m_error = error.str();
+        }
+        return false;
+    }
+
+    bool JsonStreamReader::parseValue(Json::Value *value, int depth)
+    {
+        if (depth > MaxDepth)
+            return fail("nesting too deep");
+
+        int c = peek();
+        if (c == '{')
+        {
+            get();
+            if (value)
+                *value = Json::Value(Json::objectValue);
+            bool first = true;
+            while (peek() != '}')
+            {
+                if (!first && !expect(','))
+                    return false;
+                first = false;
+
+                std::string key;
+                if (peek() != '"')
+                    return fail("expected a key");
+                if (!parseString(&key) || !expect(':') || !parseValue(value ? &(*value)[key] : 0, depth + 1))
+                    return false;
+            }
+            get();
+            return true;
+        }
+        if (c == '[')
+        {
+            get();
+            if (value)
+                *value = Json::Value(Json::arrayValue);
+            bool first = true;
+            while (peek() != ']')
+            {
+                if (!first && !expect(','))
+                    return false;
+                first = false;
+
+                if (!parseValue(value ? &value->append(Json::Value()) : 0, depth + 1))
+                    return false;
+            }
+            get();
+            return true;
+        }
+        if (c == '"')
+        {
+            std::string text;
+            if (!parseString(&text))
+                return false;
+            if (!value)
+                return true;
+
+            // packed floats are restored as arrays
+            const std::size_t prefixLength = std::strlen(JsonStreamWriter::PackedPrefix);
+            if (text.compare(0, prefixLength, JsonStreamWriter::PackedPrefix) == 0)
+            {
+                if (!decodeFloats(text.data() + prefixLength, text.size() - prefixLength, *value))
+                    return fail("invalid packed floats");
+                return true;
+            }
+            *value = Json::Value(text);
+            return true;
+        }
+        if (c == 't')
+        {
+            if (value)
+                *value = Json::Value(true);
+            return parseLiteral("true");
+        }
+        if (c == 'f')
+        {
+            if (value)
+                *value = Json::Value(false);
+            return parseLiteral("false");
+        }
+        if (c == 'n')
+        {
+            if (value)
+                *value = Json::Value(Json::nullValue);
+            return parseLiteral("null");
+        }
+        if (c == '-' || (c >= '0' && c <= '9'))
+            return parseNumber(value);
+        if (c == std::char_traits<char>::eof())
+            return fail("unexpected end of the document");
+        return fail("unexpected character");
+    }
+
+    bool JsonStreamReader::parseString(std::string *value)
+    {
+        get(); // the quote
+        std::string result;
+        while (true)
+        {
+            int c = get();
+            if (c == std::char_traits<char>::eof())
+                return fail("unterminated string");
+            if (c == '"')
+                break;
+            if (c != '\\')
+            {
+                result += (char)c;
+                continue;
+            }
+
+            c = get();
+            switch (c)
+            {
+            case '"': result += '"'; break;
+            case '\\': result += '\\'; break;
+            case '/': result += '/'; break;
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            case 't': result += '\t'; break;
+            case 'u':
+            {
+                uint32_t codePoint = 0;
+                for (int units = 0; units < 2; units++)
+                {
+                    uint32_t unit = 0;
+                    for (int i = 0; i < 4; i++)
+                    {
+                        int h = get();
+                        int digit = h >= '0' && h <= '9' ? h - '0' : h >= 'a' && h <= 'f' ? h - 'a' + 10 :
+                                    h >= 'A' && h <= 'F' ? h - 'A' + 10 : -1;
+                        if (digit < 0)
+                            return fail("invalid unicode escape");
+                        unit = (unit << 4) | digit;
+                    }
+
+                    // a high surrogate is followed by the escaped low surrogate
+                    if (units == 0 && unit >= 0xD800 && unit <= 0xDBFF)
+                    {
+                        if (get() != '\\' || get() != 'u')
+                            return fail("invalid unicode surrogate");
+                        codePoint = unit;
+                        continue;
+                    }
+                    if (units == 1)
+                    {
+                        if (unit < 0xDC00 || unit > 0xDFFF)
+                            return fail("invalid unicode surrogate");
+                        unit = 0x10000 + ((codePoint - 0xD800) << 10) + (unit - 0xDC00);
+                    }
+                    codePoint = unit;
+                    break;
+                }
+
+                // UTF-8
+                if (codePoint < 0x80)
+                {
+                    result += (char)codePoint;
+                }
+                else if (codePoint < 0x800)
+                {
+                    result += (char)(0xC0 | (codePoint >> 6));
+                    result += (char)(0x80 | (codePoint & 0x3F));
+                }
+                else if (codePoint < 0x10000)
+                {
+                    result += (char)(0xE0 | (codePoint >> 12));
+                    result += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                    result += (char)(0x80 | (codePoint & 0x3F));
+                }
+                else
+                {
+                    result += (char)(0xF0 | (codePoint >> 18));
+                    result += (char)(0x80 | ((codePoint >> 12) & 0x3F));
+                    result += (char)(0x80 | ((codePoint >> 6) & 0x3F));
+                    result += (char)(0x80 | (codePoint & 0x3F));
+                }
+                break;
+            }
+            default:
+                return fail("invalid escape");
+            }
+        }
+
+        if (value)
+            value->swap(result);
+        return true;
+    }
+
+    bool JsonStreamReader::parseNumber(Json::Value *value)
+    {
+        std::string text;
+        bool real = false;
+        while (true)
+        {
+            int c = m_buffer->sgetc();
+            if ((c >= '0' && c <= '9') || c == '-' || c == '+')
+                text += (char)c;
+            else if (c == '.' || c == 'e' || c == 'E')
+            {
+                text += (char)c;
+                real = true;
+            }
+            else
+                break;
+            get();
+        }
+        if (!value)
+            return true;
+
+        // independent of the locale, as the writer
+        std::istringstream stream(text);
+        stream.imbue(std::locale::classic());
+        if (real)
+        {
+            double number;
+            stream >> number;
+            *value = Json::Value(number);
+        }
+        else if (text[0] == '-')
+        {
+            Json::LargestInt number;
+            stream >> number;
+            *value = Json::Value(number);
+        }
+        else
+        {
+            Json::LargestUInt number;
+            stream >> number;
+            if (number <= (Json::LargestUInt)Json::Value::maxLargestInt)
+                *value = Json::Value((Json::LargestInt)number);
+            else
+                *value = Json::Value(number);
+        }
+        if (stream.fail() || !stream.eof())
+            return fail("invalid number " + text);
+        return true;
+    }
+
+    bool JsonStreamReader::parseLiteral(const char *literal)
+    {
+        for (const char *c = literal; *c; c++)
+        {
+            if (get() != *c)
+                return fail(std::string("expected ") + literal);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,148 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_JSON_STREAM_H
+#define ISM3D_JSON_STREAM_H
+
+#include <cstddef>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <jsoncpp/json/json.h>
+
+namespace ism3d
+{
+    /**
+     * @brief The JsonStreamWriter class
+     * Writes a JSON document incrementally, so that large data is never assembled as one Json::Value tree. Objects
+     * and arrays are opened and closed explicitly, small parts are written as Json::Value. Objects and arrays of
+     * objects are written one member per line, arrays of numbers on a single line, so that documents can be compared
+     * line by line. With packed floats, arrays of at least PackedMinSize floating point numbers are written as a
+     * string of the prefix PackedPrefix followed by the base64 encoded little endian 32 bit floats, which
+     * JsonStreamReader restores as arrays.
+     */
+    class JsonStreamWriter
+    {
+    public:
+        static const char PackedPrefix[];
+        static const std::size_t PackedMinSize = 4;
+
+        JsonStreamWriter(std::ostream &stream, bool packFloats = false);
+
+        void beginObject();
+        void endObject();
+        void beginArray();
+        void endArray();
+
+        /**
+         * @brief Write the key of the next member of the current object.
+         */
+        void key(const std::string &name);
+
+        /**
+         * @brief Write a value as the next array element or as the value of the last key.
+         */
+        void value(const Json::Value &value);
+
+        bool good() const;
+
+    private:
+        // separator, line break and indentation before the next value
+        void beginValue();
+        void newLine();
+        void writeInline(const Json::Value &value);
+        bool isInline(const Json::Value &value) const;
+        bool isPackable(const Json::Value &value) const;
+
+        std::ostream &m_stream;
+        bool m_pack_floats;
+        std::vector<bool> m_empty; // per open object or array, true until the first member is written
+        bool m_after_key;
+    };
+
+    /**
+     * @brief The JsonStreamReader class
+     * Reads a JSON document incrementally: objects and arrays are entered explicitly and iterated member by member,
+     * values can be read as Json::Value trees or skipped without building them. Packed float arrays written by
+     * JsonStreamWriter are restored as arrays. After a method returned false, failed() tells an error from the end
+     * of an object or array.
+     */
+    class JsonStreamReader
+    {
+    public:
+        explicit JsonStreamReader(std::istream &stream);
+
+        /**
+         * @brief Enter the object that is the next value, its members are read with nextMember().
+         */
+        bool beginObject();
+
+        /**
+         * @brief Read the key of the next member of the current object, followed by reading or skipping its value.
+         * @param key the key
+         * @return false at the end of the object, which is left, or on an error
+         */
+        bool nextMember(std::string &key);
+
+        /**
+         * @brief Enter the array that is the next value, its elements are found with nextElement().
+         */
+        bool beginArray();
+
+        /**
+         * @brief Check for the next element of the current array, followed by reading or skipping it.
+         * @return false at the end of the array, which is left, or on an error
+         */
+        bool nextElement();
+
+        /**
+         * @brief Read the next value as a tree.
+         */
+        bool readValue(Json::Value &value);
+
+        /**
+         * @brief Skip the next value without building it.
+         */
+        bool skipValue();
+
+        /**
+         * @brief Check whether the next value is null, without reading it.
+         */
+        bool nextIsNull();
+
+        bool failed() const;
+
+        /**
+         * @brief Get the error and the byte offset at which it occurred.
+         */
+        const std::string& getError() const;
+
+    private:
+        int peek();
+        int get();
+        bool expect(char c);
+        bool fail(const std::string &message);
+
+        // value is null to skip
+        bool parseValue(Json::Value *value, int depth);
+        bool parseString(std::string *value);
+        bool parseNumber(Json::Value *value);
+        bool parseLiteral(const char *literal);
+
+        std::streambuf *m_buffer;
+        std::size_t m_offset;
+        std::vector<bool> m_empty; // per open object or array, true until the first member is read
+        std::string m_error;
+    };
+}
+
+#endif // ISM3D_JSON_STREAM_H
@@ -0,0 +1,223 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_KNN_INDEX_H
+#define ISM3D_KNN_INDEX_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <flann/flann.hpp>
+
+namespace ism3d
+{
+    /**
+     * @brief The KnnIndexParams struct
+     * Selects the nearest neighbor backend and holds its parameters.
+     */
+    struct KnnIndexParams
+    {
+        KnnIndexParams()
+            : type("KDTree"), kd_trees(4), checks(128), hnsw_m(16), hnsw_ef_construction(200), hnsw_ef_search(128), mih_tables(0),
+              embed_histograms(false), embedding_order(2), embedding_rerank(0)
+        {
+        }
+
+        std::string type;           // "KDTree" or "HNSW", binary descriptors always use multi-index hashing
+        int kd_trees;               // number of randomized kd-trees
+        int checks;                 // number of leaves to check in approximate kd-tree searches
+        int hnsw_m;                 // number of links per node in the graph layers above 0 (twice as many in layer 0)
+        int hnsw_ef_construction;   // size of the candidate list during construction
+        int hnsw_ef_search;         // size of the candidate list during approximate searches
+        int mih_tables;             // number of hash tables for binary descriptors (0: automatic)
+        bool embed_histograms;      // search the chi-squared and hellinger distances with a euclidean index
+        int embedding_order;        // order of the kernel map embedding the chi-squared distance
+        int embedding_rerank;       // number of embedded candidates ranked with the exact distance (0: k)
+    };
+
+    /**
+     * @brief The KnnIndex class
+     * Interface of a k nearest neighbor index over a flann dataset. The distance functor T is a flann
+     * distance, reported distances are the values returned by the functor.
+     */
+    template<typename T>
+    class KnnIndex
+    {
+    public:
+        virtual ~KnnIndex()
+        {
+        }
+
+        virtual void buildIndex() = 0;
+
+        /**
+         * @brief Search the k nearest neighbors of all queries. Rows with less than k results are filled with -1.
+         * @param queries the query descriptors, one per row
+         * @param indices output: dataset rows of the neighbors, must hold queries.rows x k entries
+         * @param distances output: distances to the neighbors, must hold queries.rows x k entries
+         * @param k the number of neighbors
+         * @param exact true to search exhaustively
+         * @param cores the number of threads (0: use all available cores)
+         */
+        virtual void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                               flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const = 0;
+
+        /**
+         * @brief Search the k nearest neighbors of all queries, only found neighbors are returned.
+         */
+        virtual void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                               std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const = 0;
+
+        /**
+         * @brief Search the neighbors of all queries with a distance below the radius, at most the max_neighbors
+         * nearest ones per query. The default implementation truncates the result of a k nearest neighbor search,
+         * without a limit the queries whose k neighbors are all inside the radius are searched again with twice k.
+         * @param queries the query descriptors, one per row
+         * @param indices output: dataset rows of the neighbors of each query, in increasing distance
+         * @param distances output: distances to the neighbors of each query
+         * @param radius the distance bound, neighbors must be closer than this value
+         * @param max_neighbors the maximum number of neighbors per query, 0 for all neighbors inside the radius
+         * @param exact true to search exhaustively
+         * @param cores the number of threads (0: use all available cores)
+         */
+        virtual void radiusSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                                  std::vector<std::vector<float> > &distances, float radius, int max_neighbors,
+                                  bool exact, int cores = 1) const
+        {
+            int k = max_neighbors > 0 ? max_neighbors : 32;
+            knnSearch(queries, indices, distances, k, exact, cores);
+
+            std::vector<int> rows(indices.size());
+            for (std::size_t q = 0; q < rows.size(); q++)
+                rows[q] = (int)q;
+            while (true)
+            {
+                // a query is searched again if all of its k neighbors are inside the radius
+                std::vector<int> saturated;
+                for (int q : rows)
+                {
+                    std::size_t count = 0;
+                    while (count < distances[q].size() && indices[q][count] >= 0 && distances[q][count] < radius)
+                        count++;
+                    if (max_neighbors <= 0 && count == (std::size_t)k)
+                        saturated.push_back(q);
+                    indices[q].resize(count);
+                    distances[q].resize(count);
+                }
+                if (saturated.empty())
+                    break;
+
+                k *= 2;
+                std::vector<float> data(saturated.size() * queries.cols);
+                for (std::size_t i = 0; i < saturated.size(); i++)
+                    std::copy(queries[saturated[i]], queries[saturated[i]] + queries.cols, data.begin() + i * queries.cols);
+                const flann::Matrix<float> again(data.data(), saturated.size(), queries.cols);
+                std::vector<std::vector<int> > againIndices;
+                std::vector<std::vector<float> > againDistances;
+                knnSearch(again, againIndices, againDistances, k, exact, cores);
+                for (std::size_t i = 0; i < saturated.size(); i++)
+                {
+                    indices[saturated[i]].swap(againIndices[i]);
+                    distances[saturated[i]].swap(againDistances[i]);
+                }
+                rows.swap(saturated);
+            }
+        }
+
+        // write the index structure (without the dataset) to a file
+        virtual void save(const std::string &filename) = 0;
+
+        // estimated bytes of the index structure in host memory, without the dataset
+        virtual std::size_t getMemoryUsage() const = 0;
+    };
+
+    /**
+     * @brief The FlannKdTreeIndex class
+     * Randomized kd-trees of flann.
+     */
+    template<typename T>
+    class FlannKdTreeIndex : public KnnIndex<T>
+    {
+    public:
+        FlannKdTreeIndex(const flann::Matrix<float> &dataset, int kd_trees, int checks)
+            : m_index(dataset, flann::KDTreeIndexParams(kd_trees)), m_checks(checks)
+        {
+        }
+
+        // restore an index that was written with save(), the dataset must be the one used for building
+        FlannKdTreeIndex(const flann::Matrix<float> &dataset, const std::string &filename, int checks)
+            : m_index(dataset, flann::SavedIndexParams(filename)), m_checks(checks)
+        {
+        }
+
+        void buildIndex()
+        {
+            m_index.buildIndex();
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            m_index.knnSearch(queries, indices, distances, k, getSearchParams(exact, cores));
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            m_index.knnSearch(queries, indices, distances, k, getSearchParams(exact, cores));
+        }
+
+        void radiusSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                          std::vector<std::vector<float> > &distances, float radius, int max_neighbors,
+                          bool exact, int cores = 1) const
+        {
+            // flann keeps the max_neighbors nearest points inside the radius, -1 keeps all of them
+            flann::SearchParams params = getSearchParams(exact, cores);
+            params.max_neighbors = max_neighbors > 0 ? max_neighbors : -1;
+            params.sorted = true;
+            m_index.radiusSearch(queries, indices, distances, radius, params);
+        }
+
+        void save(const std::string &filename)
+        {
+            m_index.save(filename);
+        }
+
+        std::size_t getMemoryUsage() const
+        {
+            return (std::size_t)m_index.usedMemory();
+        }
+
+        void setChecks(int checks)
+        {
+            m_checks = checks;
+        }
+
+        // the underlying flann index, e.g. for searches with custom search parameters
+        flann::Index<T> &getFlannIndex()
+        {
+            return m_index;
+        }
+
+    private:
+        flann::SearchParams getSearchParams(bool exact, int cores) const
+        {
+            flann::SearchParams params(exact ? -1 : m_checks);
+            params.cores = cores;
+            return params;
+        }
+
+        flann::Index<T> m_index;
+        int m_checks;
+    };
+}
+
+#endif // ISM3D_KNN_INDEX_H
@@ -0,0 +1,112 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "memory_report.h"
+#include "ism_feature.h"
+#include "utils.h"
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace ism3d
+{
+    namespace
+    {
+        std::string toMegabytes(std::size_t bytes)
+        {
+            std::ostringstream stream;
+            stream << std::fixed << std::setprecision(1) << bytes / (1024.0 * 1024.0) << " MB";
+            return stream.str();
+        }
+    }
+
+    void MemoryReport::add(const std::string &stage, const std::string &structure, std::size_t bytes)
+    {
+        Structure entry = {structure, bytes};
+        getStage(stage).structures.push_back(entry);
+    }
+
+    void MemoryReport::endStage(const std::string &stage)
+    {
+        getStage(stage).residentBytes = getResidentBytes();
+    }
+
+    void MemoryReport::log() const
+    {
+        for (const Stage &stage : m_stages)
+        {
+            std::size_t total = 0;
+            for (const Structure &structure : stage.structures)
+            {
+                LOG_INFO("memory after " << stage.name << ": " << structure.name << " " << toMegabytes(structure.bytes));
+                total += structure.bytes;
+            }
+            LOG_INFO("memory after " << stage.name << ": structures " << toMegabytes(total) << ", resident " <<
+                     toMegabytes(stage.residentBytes));
+        }
+        LOG_INFO("peak resident memory: " << toMegabytes(getPeakResidentBytes()));
+    }
+
+    std::size_t MemoryReport::getResidentBytes()
+    {
+        // the second value is the number of resident pages
+        std::ifstream statm("/proc/self/statm");
+        std::size_t pages = 0, resident = 0;
+        if (!(statm >> pages >> resident))
+            return 0;
+        return resident * (std::size_t)sysconf(_SC_PAGESIZE);
+    }
+
+    std::size_t MemoryReport::getPeakResidentBytes()
+    {
+        // linux reports the maximum resident set size in kilobytes
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        return (std::size_t)usage.ru_maxrss * 1024;
+    }
+
+    std::size_t MemoryReport::estimateBytes(const pcl::PointCloud<ISMFeature> &features)
+    {
+        std::size_t bytes = features.points.capacity() * sizeof(ISMFeature);
+        for (const ISMFeature &feature : features.points)
+            bytes += feature.descriptor.capacity() * sizeof(float);
+        return bytes;
+    }
+
+    std::size_t MemoryReport::estimateBytes(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features)
+    {
+        std::size_t bytes = 0;
+        for (auto it = features.begin(); it != features.end(); it++)
+        {
+            for (const pcl::PointCloud<ISMFeature>::Ptr &cloud : it->second)
+            {
+                if (cloud)
+                    bytes += estimateBytes(*cloud);
+            }
+        }
+        return bytes;
+    }
+
+    MemoryReport::Stage &MemoryReport::getStage(const std::string &stage)
+    {
+        for (Stage &entry : m_stages)
+        {
+            if (entry.name == stage)
+                return entry;
+        }
+        Stage entry = {stage, std::vector<Structure>(), 0};
+        m_stages.push_back(entry);
+        return m_stages.back();
+    }
+}
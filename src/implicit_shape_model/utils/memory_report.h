@@ -0,0 +1,83 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_MEMORY_REPORT_H
+#define ISM3D_MEMORY_REPORT_H
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+namespace ism3d
+{
+    class ISMFeature;
+
+    /**
+     * @brief The MemoryReport class
+     * Collects the estimated sizes of the data structures of each processing stage together with the resident
+     * memory of the process at the end of the stage. Sizes are estimated from the container capacities, the
+     * overhead of the allocator is not included.
+     */
+    class MemoryReport
+    {
+    public:
+        /**
+         * @brief Record the size of a data structure held at the current stage.
+         * @param stage the stage name
+         * @param structure the structure name
+         * @param bytes the estimated size in bytes
+         */
+        void add(const std::string &stage, const std::string &structure, std::size_t bytes);
+
+        /**
+         * @brief Record the resident memory of the process at the end of a stage.
+         * @param stage the stage name
+         */
+        void endStage(const std::string &stage);
+
+        /**
+         * @brief Log all stages with their structures, resident memory and the peak resident memory.
+         */
+        void log() const;
+
+        // resident set size of the process in bytes, 0 if not available
+        static std::size_t getResidentBytes();
+
+        // peak resident set size of the process in bytes, 0 if not available
+        static std::size_t getPeakResidentBytes();
+
+        static std::size_t estimateBytes(const pcl::PointCloud<ISMFeature> &features);
+        static std::size_t estimateBytes(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features);
+
+    private:
+        struct Structure
+        {
+            std::string name;
+            std::size_t bytes;
+        };
+
+        struct Stage
+        {
+            std::string name;
+            std::vector<Structure> structures;
+            std::size_t residentBytes;
+        };
+
+        Stage &getStage(const std::string &stage);
+
+        std::vector<Stage> m_stages;
+    };
+}
+
+#endif // ISM3D_MEMORY_REPORT_H
@@ -0,0 +1,85 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "memory_usage.h"
+
+#include <iomanip>
+
+namespace ism3d
+{
+    namespace
+    {
+        void writeMegabytes(std::ostream &stream, std::size_t bytes)
+        {
+            std::ios::fmtflags flags = stream.flags();
+            std::streamsize precision = stream.precision();
+            stream << std::fixed << std::setprecision(3) << bytes / (1024.0 * 1024.0) << " MB";
+            stream.flags(flags);
+            stream.precision(precision);
+        }
+    }
+
+    MemoryUsage::MemoryUsage(const std::string &name, std::size_t bytes)
+        : name(name), bytes(bytes)
+    {
+    }
+
+    MemoryUsage& MemoryUsage::addPart(const std::string &name, std::size_t bytes)
+    {
+        parts.push_back(MemoryUsage(name, bytes));
+        return parts.back();
+    }
+
+    void MemoryUsage::addPart(const MemoryUsage &part)
+    {
+        parts.push_back(part);
+    }
+
+    void MemoryUsage::addClassBytes(unsigned classId, std::size_t bytes)
+    {
+        classBytes[classId] += bytes;
+    }
+
+    std::size_t MemoryUsage::getTotalBytes() const
+    {
+        std::size_t total = bytes;
+        for (const MemoryUsage &part : parts)
+            total += part.getTotalBytes();
+        return total;
+    }
+
+    std::map<unsigned, std::size_t> MemoryUsage::getTotalClassBytes() const
+    {
+        std::map<unsigned, std::size_t> total = classBytes;
+        for (const MemoryUsage &part : parts)
+        {
+            for (const std::pair<const unsigned, std::size_t> &entry : part.getTotalClassBytes())
+                total[entry.first] += entry.second;
+        }
+        return total;
+    }
+
+    void MemoryUsage::write(std::ostream &stream, int indent) const
+    {
+        stream << std::string(indent, ' ') << name << ": ";
+        writeMegabytes(stream, getTotalBytes());
+        stream << std::endl;
+
+        for (const std::pair<const unsigned, std::size_t> &entry : getTotalClassBytes())
+        {
+            stream << std::string(indent + 4, ' ') << "class " << entry.first << ": ";
+            writeMegabytes(stream, entry.second);
+            stream << std::endl;
+        }
+
+        for (const MemoryUsage &part : parts)
+            part.write(stream, indent + 2);
+    }
+}
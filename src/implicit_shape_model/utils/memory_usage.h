@@ -0,0 +1,73 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_MEMORY_USAGE_H
+#define ISM3D_MEMORY_USAGE_H
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The MemoryUsage struct
+     * The estimated memory held by an object, split into its parts. Each entry has its own bytes, which do not
+     * include the parts, and optionally the share of its own bytes that belongs to each class. Sizes are estimated
+     * from the container capacities, the overhead of the allocator is not included.
+     */
+    struct MemoryUsage
+    {
+        MemoryUsage(const std::string &name = "", std::size_t bytes = 0);
+
+        /**
+         * @brief Add a part of the object.
+         * @param name the part name
+         * @param bytes the bytes of the part
+         * @return the added part, e.g. to add its own parts or its per-class bytes
+         */
+        MemoryUsage& addPart(const std::string &name, std::size_t bytes = 0);
+
+        /**
+         * @brief Add the memory usage of a sub-object as a part.
+         * @param part the memory usage of the sub-object
+         */
+        void addPart(const MemoryUsage &part);
+
+        /**
+         * @brief Add bytes of the entry that belong to a class, they have to be added to the bytes as well.
+         * @param classId the class id
+         * @param bytes the bytes of the class
+         */
+        void addClassBytes(unsigned classId, std::size_t bytes);
+
+        // the bytes of the entry with all its parts
+        std::size_t getTotalBytes() const;
+
+        // the bytes of each class of the entry with all its parts
+        std::map<unsigned, std::size_t> getTotalClassBytes() const;
+
+        /**
+         * @brief Write the entry and its parts as an indented list with their total sizes and per-class sizes.
+         * @param stream the output stream
+         * @param indent the indentation of the entry
+         */
+        void write(std::ostream &stream, int indent = 0) const;
+
+        std::string name;
+        std::size_t bytes;
+        std::map<unsigned, std::size_t> classBytes;
+        std::vector<MemoryUsage> parts;
+    };
+}
+
+#endif // ISM3D_MEMORY_USAGE_H
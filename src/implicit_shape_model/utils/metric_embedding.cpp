@@ -0,0 +1,92 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "metric_embedding.h"
+#include "exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+namespace ism3d
+{
+    MetricEmbedding::MetricEmbedding(IndexDistance distance, int dim, int order)
+        : m_distance(distance), m_dim(dim), m_order(std::max(order, 1)), m_values_per_dim(1), m_period(0)
+    {
+        if (!isSupported(distance))
+            throw RuntimeException("the distance can not be embedded into the euclidean space");
+
+        if (m_distance == IndexDistance::ChiSquared)
+        {
+            // the chi-squared kernel k(x, y) = 2xy / (x + y) has the spectrum sech(pi * w), which is sampled at
+            // multiples of the period; the period trades the aliasing against the truncation of the spectrum
+            m_values_per_dim = 2 * m_order + 1;
+            m_period = 2.4f / (m_order + 2);
+            m_scales.resize(m_order + 1);
+            for (int j = 0; j <= m_order; j++)
+            {
+                const float spectrum = 1.0f / std::cosh(float(M_PI) * j * m_period);
+                m_scales[j] = std::sqrt((j == 0 ? 1.0f : 2.0f) * m_period * spectrum);
+            }
+        }
+    }
+
+    bool MetricEmbedding::isSupported(IndexDistance distance)
+    {
+        return distance == IndexDistance::Hellinger || distance == IndexDistance::ChiSquared;
+    }
+
+    bool MetricEmbedding::isExact() const
+    {
+        return m_distance == IndexDistance::Hellinger;
+    }
+
+    void MetricEmbedding::embed(const float *descriptor, float *embedded) const
+    {
+        if (m_distance == IndexDistance::Hellinger)
+        {
+            for (int i = 0; i < m_dim; i++)
+                embedded[i] = std::sqrt(std::max(descriptor[i], 0.0f));
+            return;
+        }
+
+        // the values of a dimension are stored in consecutive blocks of getDim() values per frequency
+        for (int i = 0; i < m_dim; i++)
+        {
+            const float x = descriptor[i];
+            if (x <= 0)
+            {
+                for (int v = 0; v < m_values_per_dim; v++)
+                    embedded[v * m_dim + i] = 0;
+                continue;
+            }
+
+            const float root = std::sqrt(x);
+            const float logX = std::log(x);
+            embedded[i] = root * m_scales[0];
+            for (int j = 1; j <= m_order; j++)
+            {
+                const float amplitude = root * m_scales[j];
+                const float phase = j * m_period * logX;
+                embedded[(2 * j - 1) * m_dim + i] = amplitude * std::cos(phase);
+                embedded[2 * j * m_dim + i] = amplitude * std::sin(phase);
+            }
+        }
+    }
+
+    void MetricEmbedding::embed(const float *descriptors, int rows, float *embedded, int numThreads) const
+    {
+        const int embeddedDim = getEmbeddedDim();
+
+#pragma omp parallel for if(rows > 256) num_threads(numThreads > 0 ? numThreads : omp_get_max_threads())
+        for (int row = 0; row < rows; row++)
+            embed(descriptors + (std::size_t)row * m_dim, embedded + (std::size_t)row * embeddedDim);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_METRIC_EMBEDDING_H
+#define ISM3D_METRIC_EMBEDDING_H
+
+#include <vector>
+#include "distance_dispatch.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The MetricEmbedding class
+     * Maps histogram descriptors into a space in which the squared euclidean distance equals or approximates a
+     * histogram distance, so that the distance can be searched with euclidean indices. The Hellinger distance is
+     * the euclidean distance of the square-rooted histograms and is embedded exactly. The chi-squared distance is
+     * the distance induced by the additive chi-squared kernel and is approximated with the homogeneous kernel map
+     * (Vedaldi and Zisserman, 2012), each dimension is mapped to 2 * order + 1 values. Negative values are treated
+     * as zero.
+     */
+    class MetricEmbedding
+    {
+    public:
+        /**
+         * @param distance the distance to embed, must be supported
+         * @param dim the descriptor dimension
+         * @param order the order of the kernel map for the chi-squared distance
+         */
+        MetricEmbedding(IndexDistance distance, int dim, int order);
+
+        // true if the distance can be embedded
+        static bool isSupported(IndexDistance distance);
+
+        // true if the squared euclidean distance of the embedding equals the distance
+        bool isExact() const;
+
+        int getDim() const
+        {
+            return m_dim;
+        }
+
+        int getEmbeddedDim() const
+        {
+            return m_dim * m_values_per_dim;
+        }
+
+        // map a descriptor of getDim() values to getEmbeddedDim() values
+        void embed(const float *descriptor, float *embedded) const;
+
+        // map rows descriptors, which are stored consecutively
+        void embed(const float *descriptors, int rows, float *embedded, int numThreads) const;
+
+    private:
+        IndexDistance m_distance;
+        int m_dim;
+        int m_order;
+        int m_values_per_dim;
+        float m_period;
+        std::vector<float> m_scales; // square roots of the sampled kernel spectrum, one per frequency
+    };
+}
+
+#endif // ISM3D_METRIC_EMBEDDING_H
@@ -0,0 +1,349 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_MIH_INDEX_H
+#define ISM3D_MIH_INDEX_H
+
+#include <vector>
+#include <queue>
+#include <limits>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <omp.h>
+
+#include "knn_index.h"
+#include "binary_codes.h"
+#include "exception.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The MultiIndexHashingIndex class
+     * Exact k nearest neighbor search in Hamming space by multi-index hashing (Norouzi et al., 2012). The
+     * binary codes are split into m disjoint substrings, each of which is stored in its own hash table. If two
+     * codes differ in d bits, at least one of their substrings differs in at most floor(d / m) bits. Searching
+     * all buckets within substring radius s in all tables therefore finds every code within distance
+     * m * (s + 1) - 1. The radius is increased until the k nearest neighbors are certain. When the number of
+     * buckets to probe exceeds the number of codes, the remaining search is a linear popcount scan.
+     * The dataset is packed into a BinaryCodes object at construction and is not referenced afterwards. Since
+     * the search is always exact, the exact flag of knnSearch is ignored. The distance functor T is only used
+     * to identify the index type, reported distances are numbers of differing bits.
+     */
+    template<typename T>
+    class MultiIndexHashingIndex : public KnnIndex<T>
+    {
+    public:
+        typedef std::pair<float, int> Candidate; // distance and dataset row
+
+        /**
+         * @param dataset the binary descriptors, one per row
+         * @param num_tables the number of substrings, 0 selects about log2(dataset.rows) bits per substring
+         */
+        MultiIndexHashingIndex(const flann::Matrix<float> &dataset, int num_tables)
+            : m_requested_tables(num_tables)
+        {
+            m_codes.assign(dataset);
+        }
+
+        void buildIndex()
+        {
+            const int numBits = m_codes.getNumBits();
+            const int numCodes = m_codes.size();
+
+            // substrings of about log2(n) bits give buckets with about one code on average
+            int numTables = m_requested_tables;
+            if (numTables <= 0)
+            {
+                int substringBits = (int)std::round(std::log2(std::max(numCodes, 2)));
+                numTables = (numBits + substringBits - 1) / std::max(substringBits, 1);
+            }
+            numTables = std::max(1, std::min(numTables, std::max(numBits, 1)));
+            while ((numBits + numTables - 1) / numTables > 32)
+                numTables++;
+
+            m_tables.assign(numTables, Table());
+            for (int t = 0; t < numTables; t++)
+            {
+                Table &table = m_tables[t];
+                table.start = (int)((long)numBits * t / numTables);
+                table.length = (int)((long)numBits * (t + 1) / numTables) - table.start;
+
+                std::vector<std::pair<uint32_t, int> > entries(numCodes);
+                for (int i = 0; i < numCodes; i++)
+                    entries[i] = std::make_pair(BinaryCodes::getSubstring(m_codes.getCode(i), table.start, table.length), i);
+                std::sort(entries.begin(), entries.end());
+
+                table.keys.clear();
+                table.offsets.clear();
+                table.ids.resize(numCodes);
+                for (int i = 0; i < numCodes; i++)
+                {
+                    if (i == 0 || entries[i].first != entries[i - 1].first)
+                    {
+                        table.keys.push_back(entries[i].first);
+                        table.offsets.push_back(i);
+                    }
+                    table.ids[i] = entries[i].second;
+                }
+                table.offsets.push_back(numCodes);
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+
+#pragma omp parallel num_threads(cores > 0 ? cores : omp_get_max_threads())
+            {
+                SearchBuffer buffer(m_codes.size(), m_codes.getNumWords());
+#pragma omp for schedule(dynamic, 16)
+                for (int q = 0; q < numQueries; q++)
+                {
+                    std::vector<Candidate> result;
+                    search(queries[q], k, buffer, result);
+
+                    for (int j = 0; j < k; j++)
+                    {
+                        indices[q][j] = j < (int)result.size() ? result[j].second : -1;
+                        distances[q][j] = j < (int)result.size() ? result[j].first : std::numeric_limits<float>::max();
+                    }
+                }
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+            indices.resize(numQueries);
+            distances.resize(numQueries);
+
+#pragma omp parallel num_threads(cores > 0 ? cores : omp_get_max_threads())
+            {
+                SearchBuffer buffer(m_codes.size(), m_codes.getNumWords());
+#pragma omp for schedule(dynamic, 16)
+                for (int q = 0; q < numQueries; q++)
+                {
+                    std::vector<Candidate> result;
+                    search(queries[q], k, buffer, result);
+
+                    indices[q].resize(result.size());
+                    distances[q].resize(result.size());
+                    for (int j = 0; j < (int)result.size(); j++)
+                    {
+                        indices[q][j] = result[j].second;
+                        distances[q][j] = result[j].first;
+                    }
+                }
+            }
+        }
+
+        // the tables are fully determined by the dataset, only the layout is stored
+        void save(const std::string &filename)
+        {
+            std::ofstream ofs(filename, std::ios::binary);
+            if (!ofs)
+                throw RuntimeException("could not open file for writing: " + filename);
+
+            const int header[] = {s_version, m_codes.size(), m_codes.getNumBits(), (int)m_tables.size()};
+            ofs.write(s_magic, sizeof(s_magic));
+            ofs.write((const char*)header, sizeof(header));
+
+            if (!ofs)
+                throw RuntimeException("could not write multi-index hashing index: " + filename);
+        }
+
+        // the bit-packed codes and the hash tables
+        std::size_t getMemoryUsage() const
+        {
+            std::size_t bytes = (std::size_t)m_codes.size() * m_codes.getNumWords() * sizeof(uint64_t);
+            for (const Table &table : m_tables)
+            {
+                bytes += table.keys.capacity() * sizeof(uint32_t) + table.offsets.capacity() * sizeof(int) +
+                        table.ids.capacity() * sizeof(int);
+            }
+            return bytes;
+        }
+
+        /**
+         * @brief Restore an index that was written with save(). The dataset must be the one used for building.
+         * @param filename the index file
+         * @return false if the file does not match the dataset
+         */
+        bool load(const std::string &filename)
+        {
+            std::ifstream ifs(filename, std::ios::binary);
+            char magic[sizeof(s_magic)];
+            int header[4];
+            ifs.read(magic, sizeof(magic));
+            ifs.read((char*)header, sizeof(header));
+            if (!ifs || std::memcmp(magic, s_magic, sizeof(s_magic)) != 0 || header[0] != s_version ||
+                    header[1] != m_codes.size() || header[2] != m_codes.getNumBits())
+                return false;
+
+            m_requested_tables = header[3];
+            buildIndex();
+            return true;
+        }
+
+    private:
+        // sorted unique substrings, the codes with substring keys[i] are ids[offsets[i]] to ids[offsets[i+1] - 1]
+        struct Table
+        {
+            int start;
+            int length;
+            std::vector<uint32_t> keys;
+            std::vector<int> offsets;
+            std::vector<int> ids;
+        };
+
+        // per thread search state, codes are marked with the id of the current search
+        struct SearchBuffer
+        {
+            std::vector<unsigned> tags;
+            unsigned current;
+            std::vector<uint64_t> query;
+
+            SearchBuffer(int numCodes, int numWords) : tags(numCodes, 0), current(0), query(numWords, 0)
+            {
+            }
+
+            void next()
+            {
+                if (++current == 0)
+                {
+                    std::fill(tags.begin(), tags.end(), 0);
+                    current = 1;
+                }
+            }
+        };
+
+        static double binomial(int n, int k)
+        {
+            double result = 1;
+            for (int i = 1; i <= k; i++)
+                result = result * (n - k + i) / i;
+            return result;
+        }
+
+        void search(const float *descriptor, int k, SearchBuffer &buffer, std::vector<Candidate> &result) const
+        {
+            result.clear();
+            const int numCodes = m_codes.size();
+            const int numWords = m_codes.getNumWords();
+            if (numCodes == 0 || k <= 0)
+                return;
+
+            buffer.next();
+            BinaryCodes::pack(descriptor, m_codes.getNumBits(), buffer.query.data());
+            const uint64_t *query = buffer.query.data();
+
+            std::priority_queue<Candidate> best;
+            auto addCandidate = [&](int id)
+            {
+                if (buffer.tags[id] == buffer.current)
+                    return;
+                buffer.tags[id] = buffer.current;
+
+                float dist = (float)BinaryCodes::hammingDistance(query, m_codes.getCode(id), numWords);
+                Candidate candidate(dist, id);
+                if ((int)best.size() < k)
+                    best.push(candidate);
+                else if (candidate < best.top())
+                {
+                    best.pop();
+                    best.push(candidate);
+                }
+            };
+
+            const int numTables = (int)m_tables.size();
+            int maxLength = 0;
+            for (const Table &table : m_tables)
+                maxLength = std::max(maxLength, table.length);
+
+            bool complete = false;
+            double probes = 0;
+            for (int radius = 0; radius <= maxLength && !complete; radius++)
+            {
+                // probing more buckets than there are codes is slower than checking all codes
+                double levelProbes = 0;
+                for (const Table &table : m_tables)
+                    levelProbes += radius <= table.length ? binomial(table.length, radius) : 0;
+                if (probes + levelProbes > numCodes)
+                {
+                    for (int id = 0; id < numCodes; id++)
+                        addCandidate(id);
+                    break;
+                }
+                probes += levelProbes;
+
+                for (const Table &table : m_tables)
+                {
+                    if (radius > table.length)
+                        continue;
+
+                    const uint32_t key = BinaryCodes::getSubstring(query, table.start, table.length);
+                    const uint64_t limit = (uint64_t)1 << table.length;
+
+                    // enumerate all bit masks with radius set bits in increasing order (Gosper's hack)
+                    uint64_t mask = ((uint64_t)1 << radius) - 1;
+                    while (mask < limit)
+                    {
+                        probeBucket(table, key ^ (uint32_t)mask, addCandidate);
+                        if (mask == 0)
+                            break;
+                        uint64_t lowest = mask & (~mask + 1);
+                        uint64_t ripple = mask + lowest;
+                        mask = (((ripple ^ mask) >> 2) / lowest) | ripple;
+                    }
+                }
+
+                // all codes within distance numTables * (radius + 1) - 1 have been seen
+                if ((int)best.size() == std::min(k, numCodes) &&
+                        best.top().first <= numTables * (radius + 1) - 1)
+                    complete = true;
+            }
+
+            result.resize(best.size());
+            for (int i = (int)best.size() - 1; i >= 0; i--)
+            {
+                result[i] = best.top();
+                best.pop();
+            }
+        }
+
+        template<typename Func>
+        void probeBucket(const Table &table, uint32_t key, Func &func) const
+        {
+            std::vector<uint32_t>::const_iterator it = std::lower_bound(table.keys.begin(), table.keys.end(), key);
+            if (it == table.keys.end() || *it != key)
+                return;
+
+            const int bucket = (int)(it - table.keys.begin());
+            for (int i = table.offsets[bucket]; i < table.offsets[bucket + 1]; i++)
+                func(table.ids[i]);
+        }
+
+        static constexpr char s_magic[8] = {'I', 'S', 'M', 'M', 'I', 'H', '\0', '\0'};
+        static const int s_version = 1;
+
+        BinaryCodes m_codes;
+        int m_requested_tables;
+        std::vector<Table> m_tables;
+    };
+
+    template<typename T>
+    constexpr char MultiIndexHashingIndex<T>::s_magic[8];
+}
+
+#endif // ISM3D_MIH_INDEX_H
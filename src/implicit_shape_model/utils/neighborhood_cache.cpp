@@ -0,0 +1,142 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "neighborhood_cache.h"
+
+#include <algorithm>
+#include <omp.h>
+
+namespace ism3d
+{
+    NeighborhoodCache::NeighborhoodCache(pcl::search::Search<PointT>::Ptr search, pcl::PointCloud<PointT>::ConstPtr keypoints,
+                                         double radius, int num_threads)
+        : pcl::search::Search<PointT>("NeighborhoodCache", true),
+          m_search(search), m_keypoints(keypoints), m_radius(radius), m_num_threads(std::max(num_threads, 1)),
+          m_current(0), m_num_cached(0), m_num_forwarded(0)
+    {
+        m_queries = keypoints;
+        m_query_keypoint_indices.resize(keypoints->size());
+        for (int i = 0; i < (int)keypoints->size(); i++)
+            m_query_keypoint_indices[i] = i;
+    }
+
+    void NeighborhoodCache::setQueryCloud(pcl::PointCloud<PointT>::ConstPtr queries, const std::vector<int> &keypoint_indices)
+    {
+        LOG_ASSERT(queries->size() == keypoint_indices.size());
+        m_queries = queries;
+        m_query_keypoint_indices = keypoint_indices;
+    }
+
+    void NeighborhoodCache::setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices)
+    {
+        input_ = cloud;
+        indices_ = indices;
+        m_search->setInputCloud(cloud, indices);
+
+        // a subset of the surface changes the neighborhoods
+        m_current = 0;
+        if (indices || !cloud)
+            return;
+
+        std::map<const PointCloud*, Neighborhoods>::iterator it = m_neighborhoods.find(cloud.get());
+        if (it == m_neighborhoods.end())
+        {
+            Neighborhoods &neighborhoods = m_neighborhoods[cloud.get()];
+            neighborhoods.surface = cloud;
+            computeNeighborhoods(neighborhoods);
+            m_current = &neighborhoods;
+        }
+        else
+        {
+            m_current = &it->second;
+        }
+    }
+
+    int NeighborhoodCache::nearestKSearch(const PointT &point, int k, std::vector<int> &k_indices,
+                                          std::vector<float> &k_sqr_distances) const
+    {
+        return m_search->nearestKSearch(point, k, k_indices, k_sqr_distances);
+    }
+
+    int NeighborhoodCache::radiusSearch(const PointT &point, double radius, std::vector<int> &k_indices,
+                                        std::vector<float> &k_sqr_distances, unsigned int max_nn) const
+    {
+        return m_search->radiusSearch(point, radius, k_indices, k_sqr_distances, max_nn);
+    }
+
+    int NeighborhoodCache::radiusSearch(const PointCloud &cloud, int index, double radius, std::vector<int> &k_indices,
+                                        std::vector<float> &k_sqr_distances, unsigned int max_nn) const
+    {
+        int keypoint = -1;
+        if (&cloud == m_queries.get() && index >= 0 && index < (int)m_query_keypoint_indices.size())
+            keypoint = m_query_keypoint_indices[index];
+
+        if (!m_current || keypoint < 0 || radius > m_radius)
+        {
+#pragma omp atomic
+            m_num_forwarded++;
+            return m_search->radiusSearch(cloud.at(index), radius, k_indices, k_sqr_distances, max_nn);
+        }
+
+#pragma omp atomic
+        m_num_cached++;
+
+        // neighbors are sorted, the neighbors within the radius are a prefix
+        const std::vector<float> &sqrDistances = m_current->sqrDistances[keypoint];
+        const double sqrRadius = radius * radius;
+        int count = (int)(std::upper_bound(sqrDistances.begin(), sqrDistances.end(), sqrRadius) - sqrDistances.begin());
+        if (max_nn > 0 && count > (int)max_nn)
+            count = (int)max_nn;
+
+        const std::vector<int> &indices = m_current->indices[keypoint];
+        k_indices.assign(indices.begin(), indices.begin() + count);
+        k_sqr_distances.assign(sqrDistances.begin(), sqrDistances.begin() + count);
+        return count;
+    }
+
+    long NeighborhoodCache::getNumCachedSearches() const
+    {
+        return m_num_cached;
+    }
+
+    long NeighborhoodCache::getNumForwardedSearches() const
+    {
+        return m_num_forwarded;
+    }
+
+    void NeighborhoodCache::computeNeighborhoods(Neighborhoods &neighborhoods) const
+    {
+        const int num_keypoints = (int)m_keypoints->size();
+        neighborhoods.indices.resize(num_keypoints);
+        neighborhoods.sqrDistances.resize(num_keypoints);
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(m_num_threads)
+        for (int i = 0; i < num_keypoints; i++)
+        {
+            std::vector<int> indices;
+            std::vector<float> sqrDistances;
+            m_search->radiusSearch(m_keypoints->at(i), m_radius, indices, sqrDistances);
+
+            // not all searches return sorted results
+            std::vector<std::pair<float, int> > neighbors(indices.size());
+            for (int j = 0; j < (int)indices.size(); j++)
+                neighbors[j] = std::make_pair(sqrDistances[j], indices[j]);
+            std::sort(neighbors.begin(), neighbors.end());
+
+            neighborhoods.indices[i].resize(neighbors.size());
+            neighborhoods.sqrDistances[i].resize(neighbors.size());
+            for (int j = 0; j < (int)neighbors.size(); j++)
+            {
+                neighborhoods.sqrDistances[i][j] = neighbors[j].first;
+                neighborhoods.indices[i][j] = neighbors[j].second;
+            }
+        }
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_NEIGHBORHOOD_CACHE_H
+#define ISM3D_NEIGHBORHOOD_CACHE_H
+
+#include <map>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+#include <pcl/search/search.h>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The NeighborhoodCache class
+     * Search adapter that computes the neighborhood of every keypoint once at the largest radius used by the
+     * pipeline. Neighbors are sorted by distance, so that a search with a smaller radius only takes a prefix
+     * of the cached neighborhood. Reference frame and descriptor estimation search around keypoints on a
+     * surface cloud, these searches are answered from the cache. A cache is kept for each surface cloud, it
+     * is created when the surface is set as input. All other searches are forwarded to the wrapped search.
+     */
+    class NeighborhoodCache
+            : public pcl::search::Search<PointT>
+    {
+    public:
+        typedef boost::shared_ptr<NeighborhoodCache> Ptr;
+        typedef pcl::search::Search<PointT>::PointCloud PointCloud;
+        typedef pcl::search::Search<PointT>::PointCloudConstPtr PointCloudConstPtr;
+        typedef pcl::search::Search<PointT>::IndicesConstPtr IndicesConstPtr;
+
+        /**
+         * @brief Create the cache.
+         * @param search the search used to compute the neighborhoods and for all other searches
+         * @param keypoints the keypoints for which neighborhoods are cached
+         * @param radius the largest search radius, searches with a larger radius are forwarded
+         * @param num_threads the number of threads used to compute the neighborhoods
+         */
+        NeighborhoodCache(pcl::search::Search<PointT>::Ptr search, pcl::PointCloud<PointT>::ConstPtr keypoints,
+                          double radius, int num_threads);
+
+        /**
+         * @brief Set the cloud that is used as query cloud in later searches. The query cloud is a subset
+         * of the keypoints, e.g. after removing keypoints with invalid reference frames.
+         * @param queries the query cloud
+         * @param keypoint_indices for each query point its index in the keypoints
+         */
+        void setQueryCloud(pcl::PointCloud<PointT>::ConstPtr queries, const std::vector<int> &keypoint_indices);
+
+        void setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr());
+
+        int nearestKSearch(const PointT &point, int k, std::vector<int> &k_indices,
+                           std::vector<float> &k_sqr_distances) const;
+
+        int radiusSearch(const PointT &point, double radius, std::vector<int> &k_indices,
+                         std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const;
+
+        // searches around a keypoint are answered from the cache
+        int radiusSearch(const PointCloud &cloud, int index, double radius, std::vector<int> &k_indices,
+                         std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const;
+
+        // number of searches answered from the cache and forwarded to the wrapped search
+        long getNumCachedSearches() const;
+        long getNumForwardedSearches() const;
+
+    private:
+        struct Neighborhoods
+        {
+            PointCloudConstPtr surface; // keeps the surface alive, so that its address identifies it
+            std::vector<std::vector<int> > indices;
+            std::vector<std::vector<float> > sqrDistances;
+        };
+
+        void computeNeighborhoods(Neighborhoods &neighborhoods) const;
+
+        pcl::search::Search<PointT>::Ptr m_search;
+        pcl::PointCloud<PointT>::ConstPtr m_keypoints;
+        double m_radius;
+        int m_num_threads;
+
+        pcl::PointCloud<PointT>::ConstPtr m_queries;
+        std::vector<int> m_query_keypoint_indices;
+
+        // neighborhoods for each surface cloud and the neighborhoods of the current input
+        std::map<const PointCloud*, Neighborhoods> m_neighborhoods;
+        const Neighborhoods *m_current;
+
+        mutable long m_num_cached;
+        mutable long m_num_forwarded;
+    };
+}
+
+#endif // ISM3D_NEIGHBORHOOD_CACHE_H
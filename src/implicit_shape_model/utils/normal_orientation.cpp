@@ -13,6 +13,15 @@
 #include <pcl/features/shot_lrf_omp.h>
 #include <pcl/features/normal_3d_omp.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <queue>
+
 #ifdef USE_VCGLIB
     #include <vcg/complex/complex.h>
     #include <vcg/complex/algorithms/pointcloud_normal.h>
@@ -20,6 +29,43 @@
 
 namespace ism3d
 {
+    namespace
+    {
+        // edge of the neighborhood graph, weighted by the angle between the normals
+        struct GraphEdge
+        {
+            int source;
+            int target;
+            float weight;
+        };
+
+        int findComponent(std::vector<int> &parents, int index)
+        {
+            while (parents[index] != index)
+            {
+                parents[index] = parents[parents[index]];
+                index = parents[index];
+            }
+            return index;
+        }
+
+        // edges are ordered by weight and index, non-negative floats keep their order as unsigned integers
+        uint64_t edgeKey(float weight, int index)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &weight, sizeof(bits));
+            return ((uint64_t)bits << 32) | (uint32_t)index;
+        }
+
+        void updateCheapest(std::atomic<uint64_t> &cheapest, uint64_t key)
+        {
+            uint64_t current = cheapest.load(std::memory_order_relaxed);
+            while (key < current && !cheapest.compare_exchange_weak(current, key, std::memory_order_relaxed))
+            {
+            }
+        }
+    }
+
     NormalOrientation::NormalOrientation()
         : m_k(10), m_radius(0)
     {
@@ -109,6 +155,220 @@ namespace ism3d
         return true;
     }
 
+    void NormalOrientation::orientUsingMST(pcl::PointCloud<PointT>::ConstPtr pointCloud,
+                                           pcl::PointCloud<pcl::Normal>::Ptr normals,
+                                           pcl::search::Search<PointT>::Ptr searchTree, int numThreads) const
+    {
+        LOG_ASSERT(pointCloud->size() == normals->size());
+
+        const int numPoints = (int)pointCloud->size();
+        numThreads = std::max(numThreads, 1);
+
+        std::vector<char> valid(numPoints);
+        for (int i = 0; i < numPoints; i++)
+        {
+            const pcl::Normal &normal = normals->points[i];
+            valid[i] = pcl::isFinite(pointCloud->points[i]) && pcl_isfinite(normal.normal_x) &&
+                    pcl_isfinite(normal.normal_y) && pcl_isfinite(normal.normal_z);
+        }
+
+        // neighborhood graph
+        searchTree->setInputCloud(pointCloud);
+        std::vector<std::vector<GraphEdge> > pointEdges(numPoints);
+
+        #pragma omp parallel num_threads(numThreads)
+        {
+            std::vector<int> indices;
+            std::vector<float> distances;
+
+            #pragma omp for schedule(dynamic, 256)
+            for (int i = 0; i < numPoints; i++)
+            {
+                if (!valid[i])
+                    continue;
+
+                int found = m_k > 0 ? searchTree->nearestKSearch(*pointCloud, i, m_k + 1, indices, distances)
+                                    : searchTree->radiusSearch(*pointCloud, i, m_radius, indices, distances);
+
+                const pcl::Normal &normal = normals->points[i];
+                for (int j = 0; j < found; j++)
+                {
+                    int neighbor = indices[j];
+                    if (neighbor == i || !valid[neighbor])
+                        continue;
+
+                    const pcl::Normal &other = normals->points[neighbor];
+                    float dot = normal.normal_x * other.normal_x + normal.normal_y * other.normal_y +
+                            normal.normal_z * other.normal_z;
+                    GraphEdge edge = {i, neighbor, std::max(0.0f, 1.0f - std::fabs(dot))};
+                    pointEdges[i].push_back(edge);
+                }
+            }
+        }
+
+        std::vector<std::size_t> edgeOffsets(numPoints + 1, 0);
+        for (int i = 0; i < numPoints; i++)
+            edgeOffsets[i + 1] = edgeOffsets[i] + pointEdges[i].size();
+
+        std::vector<GraphEdge> edges(edgeOffsets.back());
+        #pragma omp parallel for num_threads(numThreads)
+        for (int i = 0; i < numPoints; i++)
+        {
+            std::copy(pointEdges[i].begin(), pointEdges[i].end(), edges.begin() + edgeOffsets[i]);
+            std::vector<GraphEdge>().swap(pointEdges[i]);
+        }
+
+        // Boruvka: in each round every component selects its cheapest outgoing edge in parallel, the total order
+        // on the edges guarantees that the selected edges do not form cycles
+        const uint64_t noEdge = std::numeric_limits<uint64_t>::max();
+        std::vector<int> parents(numPoints);
+        std::iota(parents.begin(), parents.end(), 0);
+        std::vector<int> components(parents);
+        std::vector<std::atomic<uint64_t> > cheapest(numPoints);
+        std::vector<int> active(edges.size());
+        std::iota(active.begin(), active.end(), 0);
+        std::vector<char> internal(edges.size(), 0);
+        std::vector<int> treeEdges;
+
+        while (!active.empty())
+        {
+            #pragma omp parallel for num_threads(numThreads)
+            for (int i = 0; i < numPoints; i++)
+                cheapest[i].store(noEdge, std::memory_order_relaxed);
+
+            const int numActive = (int)active.size();
+            #pragma omp parallel for num_threads(numThreads)
+            for (int a = 0; a < numActive; a++)
+            {
+                const GraphEdge &edge = edges[active[a]];
+                int source = components[edge.source];
+                int target = components[edge.target];
+                if (source == target)
+                {
+                    internal[active[a]] = 1;
+                    continue;
+                }
+
+                uint64_t key = edgeKey(edge.weight, active[a]);
+                updateCheapest(cheapest[source], key);
+                updateCheapest(cheapest[target], key);
+            }
+
+            bool merged = false;
+            for (int i = 0; i < numPoints; i++)
+            {
+                uint64_t key = cheapest[i].load(std::memory_order_relaxed);
+                if (key == noEdge)
+                    continue;
+
+                int index = (int)(key & 0xffffffff);
+                int source = findComponent(parents, edges[index].source);
+                int target = findComponent(parents, edges[index].target);
+                if (source != target)
+                {
+                    parents[source] = target;
+                    treeEdges.push_back(index);
+                    merged = true;
+                }
+            }
+
+            if (!merged)
+                break;
+
+            for (int i = 0; i < numPoints; i++)
+                components[i] = findComponent(parents, i);
+
+            active.erase(std::remove_if(active.begin(), active.end(), [&internal](int index) { return internal[index] != 0; }),
+                         active.end());
+        }
+
+        // adjacency of the spanning forest
+        std::vector<int> treeOffsets(numPoints + 1, 0);
+        for (int index : treeEdges)
+        {
+            treeOffsets[edges[index].source + 1]++;
+            treeOffsets[edges[index].target + 1]++;
+        }
+        for (int i = 0; i < numPoints; i++)
+            treeOffsets[i + 1] += treeOffsets[i];
+
+        std::vector<int> treeNeighbors(treeOffsets.back());
+        std::vector<int> fill(treeOffsets.begin(), treeOffsets.end() - 1);
+        for (int index : treeEdges)
+        {
+            treeNeighbors[fill[edges[index].source]++] = edges[index].target;
+            treeNeighbors[fill[edges[index].target]++] = edges[index].source;
+        }
+
+        // the point farthest from the centroid of each component is oriented away from the centroid
+        Eigen::Vector3f centroid(0, 0, 0);
+        int numValid = 0;
+        for (int i = 0; i < numPoints; i++)
+        {
+            if (valid[i])
+            {
+                centroid += pointCloud->points[i].getVector3fMap();
+                numValid++;
+            }
+        }
+        if (numValid == 0)
+            return;
+        centroid /= (float)numValid;
+
+        std::vector<int> seeds(numPoints, -1);
+        std::vector<float> seedDistances(numPoints, -1);
+        for (int i = 0; i < numPoints; i++)
+        {
+            if (!valid[i])
+                continue;
+
+            float distance = (pointCloud->points[i].getVector3fMap() - centroid).squaredNorm();
+            int component = components[i];
+            if (distance > seedDistances[component])
+            {
+                seedDistances[component] = distance;
+                seeds[component] = i;
+            }
+        }
+
+        // propagate the orientation of the seeds along the tree
+        std::vector<char> visited(numPoints, 0);
+        std::queue<int> queue;
+        for (int component = 0; component < numPoints; component++)
+        {
+            int seed = seeds[component];
+            if (seed < 0)
+                continue;
+
+            pcl::Normal &seedNormal = normals->points[seed];
+            if (seedNormal.getNormalVector3fMap().dot(pointCloud->points[seed].getVector3fMap() - centroid) < 0)
+                seedNormal.getNormalVector3fMap() *= -1;
+
+            visited[seed] = 1;
+            queue.push(seed);
+            while (!queue.empty())
+            {
+                int current = queue.front();
+                queue.pop();
+
+                const pcl::Normal &normal = normals->points[current];
+                for (int j = treeOffsets[current]; j < treeOffsets[current + 1]; j++)
+                {
+                    int neighbor = treeNeighbors[j];
+                    if (visited[neighbor])
+                        continue;
+
+                    pcl::Normal &other = normals->points[neighbor];
+                    if (normal.getNormalVector3fMap().dot(other.getNormalVector3fMap()) < 0)
+                        other.getNormalVector3fMap() *= -1;
+
+                    visited[neighbor] = 1;
+                    queue.push(neighbor);
+                }
+            }
+        }
+    }
+
 #ifdef USE_VCGLIB
     void NormalOrientation::computeUsingEMST(pcl::PointCloud<PointT>::ConstPtr model,
                                              pcl::PointCloud<pcl::Normal>::Ptr normals)
@@ -47,6 +47,16 @@ namespace ism3d
                                         pcl::PointCloud<pcl::Normal>::ConstPtr normals,
                                         pcl::PointCloud<pcl::Normal>::Ptr& orientedNormals, pcl::search::Search<PointT>::Ptr searchTree);
 
+        // Orientation propagated along a minimum spanning tree of the k nearest neighbor graph (radius graph if k < 1).
+        // Edges are weighted by 1 - |n_i * n_j|, so that the orientation is propagated between similar normals first.
+        // The graph is built in parallel, the tree is computed with Boruvka's algorithm and the orientation is
+        // propagated by a breadth first search from the point farthest from the centroid in each connected component,
+        // whose normal is oriented away from the centroid. Only the signs of the normals are changed, i.e. normals and
+        // curvatures of a single normal estimation are kept. Points with NaN normals are ignored.
+        void orientUsingMST(pcl::PointCloud<PointT>::ConstPtr pointCloud,
+                            pcl::PointCloud<pcl::Normal>::Ptr normals,
+                            pcl::search::Search<PointT>::Ptr searchTree, int numThreads) const;
+
 #ifdef USE_VCGLIB
         // normal computation and orientation using the VCG library
         void computeUsingEMST(pcl::PointCloud<PointT>::ConstPtr model,
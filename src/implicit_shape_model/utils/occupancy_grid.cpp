@@ -0,0 +1,176 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "occupancy_grid.h"
+#include "exception.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace ism3d
+{
+    OccupancyGrid::OccupancyGrid()
+        : m_origin(Eigen::Vector3f::Zero()), m_voxel_size(1)
+    {
+    }
+
+    void OccupancyGrid::build(const pcl::PointCloud<PointT> &points, float voxelSize)
+    {
+        if (!(voxelSize > 0))
+            throw BadParamExceptionType<float>("invalid voxel size", voxelSize);
+
+        m_voxel_size = voxelSize;
+        m_brick_indices.clear();
+        m_bricks.clear();
+
+        Eigen::Vector3f minPoint = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+        Eigen::Vector3f maxPoint = Eigen::Vector3f::Constant(-std::numeric_limits<float>::max());
+        for (const PointT &point : points.points)
+        {
+            if (!pcl::isFinite(point))
+                continue;
+            minPoint = minPoint.cwiseMin(point.getVector3fMap());
+            maxPoint = maxPoint.cwiseMax(point.getVector3fMap());
+        }
+        if (minPoint.x() > maxPoint.x())
+            return;
+
+        // the neighbors of the voxels at the border are occupied as well
+        m_origin = minPoint - Eigen::Vector3f::Constant(2 * voxelSize);
+        if (((maxPoint - m_origin) / voxelSize).maxCoeff() >= (float)((1 << 21) - 2))
+            throw RuntimeException("the point cloud is too large for an occupancy grid of this voxel size");
+
+        // voxels of several points are occupied once, sorted so that consecutive voxels mostly share a brick
+        std::vector<std::uint64_t> voxels;
+        voxels.reserve(points.size());
+        for (const PointT &point : points.points)
+        {
+            if (!pcl::isFinite(point))
+                continue;
+            const Eigen::Vector3f position = toGrid(point.getVector3fMap());
+            voxels.push_back(getBrickKey((int)position.x(), (int)position.y(), (int)position.z()));
+        }
+        std::sort(voxels.begin(), voxels.end());
+        voxels.erase(std::unique(voxels.begin(), voxels.end()), voxels.end());
+
+        const std::uint64_t mask = (1 << 21) - 1;
+        std::uint64_t lastKey = std::numeric_limits<std::uint64_t>::max();
+        int lastIndex = -1;
+        for (std::uint64_t voxel : voxels)
+        {
+            const int vx = (int)(voxel >> 42);
+            const int vy = (int)((voxel >> 21) & mask);
+            const int vz = (int)(voxel & mask);
+            for (int z = vz - 1; z <= vz + 1; z++)
+            {
+                for (int y = vy - 1; y <= vy + 1; y++)
+                {
+                    for (int x = vx - 1; x <= vx + 1; x++)
+                    {
+                        const std::uint64_t key = getBrickKey(x >> 3, y >> 3, z >> 3);
+                        if (key != lastKey)
+                        {
+                            std::unordered_map<std::uint64_t, int>::iterator it = m_brick_indices.find(key);
+                            if (it == m_brick_indices.end())
+                            {
+                                it = m_brick_indices.insert(std::make_pair(key, (int)m_bricks.size())).first;
+                                m_bricks.push_back(Brick());
+                                m_bricks.back().fill(0);
+                            }
+                            lastKey = key;
+                            lastIndex = it->second;
+                        }
+                        m_bricks[lastIndex][z & 7] |= std::uint64_t(1) << ((x & 7) + 8 * (y & 7));
+                    }
+                }
+            }
+        }
+    }
+
+    const OccupancyGrid::Brick* OccupancyGrid::findBrick(int x, int y, int z) const
+    {
+        if (x < 0 || y < 0 || z < 0)
+            return 0;
+        std::unordered_map<std::uint64_t, int>::const_iterator it = m_brick_indices.find(getBrickKey(x >> 3, y >> 3, z >> 3));
+        return it != m_brick_indices.end() ? &m_bricks[it->second] : 0;
+    }
+
+    bool OccupancyGrid::isOccupied(int x, int y, int z) const
+    {
+        const Brick *brick = findBrick(x, y, z);
+        return brick && ((*brick)[z & 7] >> ((x & 7) + 8 * (y & 7)) & 1);
+    }
+
+    void OccupancyGrid::traceLine(const Eigen::Vector3i &from, const Eigen::Vector3i &to, int &numVoxels, int &numOccupied) const
+    {
+        // the brick of the last visited voxel is kept, the walk mostly stays inside of it
+        std::uint64_t lastKey = std::numeric_limits<std::uint64_t>::max();
+        const Brick *brick = 0;
+        auto visit = [&](const Eigen::Vector3i &voxel)
+        {
+            numVoxels++;
+            if (voxel.minCoeff() < 0)
+                return;
+            const std::uint64_t key = getBrickKey(voxel.x() >> 3, voxel.y() >> 3, voxel.z() >> 3);
+            if (key != lastKey)
+            {
+                brick = findBrick(voxel.x(), voxel.y(), voxel.z());
+                lastKey = key;
+            }
+            if (brick && ((*brick)[voxel.z() & 7] >> ((voxel.x() & 7) + 8 * (voxel.y() & 7)) & 1))
+                numOccupied++;
+        };
+
+        numVoxels = 0;
+        numOccupied = 0;
+
+        // the axis of the largest difference is stepped every time, the others when their error is positive
+        const Eigen::Vector3i delta = to - from;
+        int major = 0;
+        if (std::abs(delta.y()) > std::abs(delta[major]))
+            major = 1;
+        if (std::abs(delta.z()) > std::abs(delta[major]))
+            major = 2;
+        const int minor1 = (major + 1) % 3;
+        const int minor2 = (major + 2) % 3;
+
+        const int length = std::abs(delta[major]);
+        const int step1 = delta[minor1] < 0 ? -1 : 1;
+        const int step2 = delta[minor2] < 0 ? -1 : 1;
+        const int stepMajor = delta[major] < 0 ? -1 : 1;
+        const int twiceLength = 2 * length;
+        const int twice1 = 2 * std::abs(delta[minor1]);
+        const int twice2 = 2 * std::abs(delta[minor2]);
+        int error1 = twice1 - length;
+        int error2 = twice2 - length;
+
+        Eigen::Vector3i voxel = from;
+        for (int i = 1; i < length; i++)
+        {
+            visit(voxel);
+            if (error1 > 0)
+            {
+                voxel[minor1] += step1;
+                error1 -= twiceLength;
+            }
+            if (error2 > 0)
+            {
+                voxel[minor2] += step2;
+                error2 -= twiceLength;
+            }
+            error1 += twice1;
+            error2 += twice2;
+            voxel[major] += stepMajor;
+        }
+        visit(voxel);
+    }
+}
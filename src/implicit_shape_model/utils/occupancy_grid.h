@@ -0,0 +1,93 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_OCCUPANCY_GRID_H
+#define ISM3D_OCCUPANCY_GRID_H
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+#include <Eigen/Core>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The OccupancyGrid class
+     * Sparse occupancy of the voxels of a point cloud, for line tests as in the Ensemble of Shape Functions. As in
+     * the voxelization of PCL's ESF, the voxel of each point and its 26 neighbors are occupied. The voxels are
+     * stored as bits in bricks of 8x8x8 voxels, only bricks with occupied voxels are allocated, so that a grid over
+     * a whole scene stays small and lines of neighboring voxels mostly read the same brick. The grid is only read
+     * after build(), which allows any number of threads to trace lines at once.
+     */
+    class OccupancyGrid
+    {
+    public:
+        OccupancyGrid();
+
+        /**
+         * @brief Build the occupancy of a point cloud, non-finite points are skipped.
+         * @param points the points
+         * @param voxelSize the edge length of a voxel
+         */
+        void build(const pcl::PointCloud<PointT> &points, float voxelSize);
+
+        float getVoxelSize() const
+        {
+            return m_voxel_size;
+        }
+
+        // position in voxel units relative to the grid origin, the voxel of a point is its integer part
+        Eigen::Vector3f toGrid(const Eigen::Vector3f &position) const
+        {
+            return (position - m_origin) / m_voxel_size;
+        }
+
+        bool isOccupied(int x, int y, int z) const;
+
+        /**
+         * @brief Traverse the voxels of the line between two voxels with a 3D Bresenham walk along the axis of the
+         * largest difference, as PCL's ESF does: the voxel of from is visited, the voxel of to is not.
+         * @param from the first voxel
+         * @param to the last voxel
+         * @param numVoxels output: the number of visited voxels, at least 1
+         * @param numOccupied output: the number of visited voxels that are occupied
+         */
+        void traceLine(const Eigen::Vector3i &from, const Eigen::Vector3i &to, int &numVoxels, int &numOccupied) const;
+
+        // number of allocated bricks of 8x8x8 voxels
+        int getNumBricks() const
+        {
+            return (int)m_bricks.size();
+        }
+
+    private:
+        typedef std::array<std::uint64_t, 8> Brick; // one word per z layer, bit x + 8 * y
+
+        static std::uint64_t getBrickKey(int bx, int by, int bz)
+        {
+            return ((std::uint64_t)bx << 42) | ((std::uint64_t)by << 21) | (std::uint64_t)bz;
+        }
+
+        const Brick* findBrick(int x, int y, int z) const;
+
+        Eigen::Vector3f m_origin;
+        float m_voxel_size;
+        std::unordered_map<std::uint64_t, int> m_brick_indices;
+        std::vector<Brick> m_bricks;
+    };
+}
+
+#endif // ISM3D_OCCUPANCY_GRID_H
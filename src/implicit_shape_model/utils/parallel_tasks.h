@@ -0,0 +1,91 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_PARALLEL_TASKS_H
+#define ISM3D_PARALLEL_TASKS_H
+
+#include <omp.h>
+
+namespace ism3d
+{
+    /**
+     * @brief The ParallelTasks class
+     * Parallel loops as OpenMP tasks instead of worksharing loops, so that nested loops compose. The range of a
+     * loop is split recursively into tasks of at most grain iterations; idle threads take the pending tasks of
+     * busy threads, which balances iterations of very different cost. A loop started inside a parallel region, e.g.
+     * from an iteration or a task of an outer loop, adds its tasks to the team of that region instead of opening a
+     * nested team: the threads of the team that finished their own work execute them, and the number of threads
+     * never exceeds the size of the team. Outside of a parallel region a team is started for the loop.
+     * The body must not throw and must not depend on the thread that executes an iteration, except for state that
+     * is not shared with other iterations while one runs, like per-thread buffers that are only appended to.
+     */
+    class ParallelTasks
+    {
+    public:
+        /**
+         * @brief Run body(i) for all i in [begin, end).
+         * @param begin the first index
+         * @param end the end of the range
+         * @param grain the maximal number of iterations of a task
+         * @param body the loop body
+         * @param numThreads the number of threads of a new team, 0 for the OpenMP default
+         */
+        template<typename Body>
+        static void parallelFor(int begin, int end, int grain, const Body &body, int numThreads = 0)
+        {
+            grain = grain > 0 ? grain : 1;
+            if (end - begin <= grain || omp_in_parallel())
+            {
+                // small ranges run inline, nested loops add their tasks to the current team
+                spawn(begin, end, grain, &body);
+                return;
+            }
+
+            #pragma omp parallel num_threads(numThreads > 0 ? numThreads : omp_get_max_threads())
+            {
+                #pragma omp single
+                spawn(begin, end, grain, &body);
+            }
+        }
+
+        /**
+         * @brief The number of threads for a library call that opens its own OpenMP team, like the *OMP classes
+         * of PCL: inside a parallel region, i.e. inside a task or an iteration of an outer loop, the call runs with
+         * one thread instead of oversubscribing the cores.
+         * @param numThreads the number of threads outside of parallel regions, 0 for the OpenMP default
+         */
+        static int getNestedThreads(int numThreads)
+        {
+            if (omp_in_parallel())
+                return 1;
+            return numThreads > 0 ? numThreads : omp_get_max_threads();
+        }
+
+    private:
+        // splits off the upper half of the range as a task until it fits the grain, runs the rest and waits for the
+        // split tasks; the oldest tasks, which are taken first by idle threads, hold the largest ranges
+        template<typename Body>
+        static void spawn(int begin, int end, int grain, const Body *body)
+        {
+            while (end - begin > grain)
+            {
+                const int middle = begin + (end - begin) / 2;
+                #pragma omp task firstprivate(middle, end, grain, body)
+                spawn(middle, end, grain, body);
+                end = middle;
+            }
+            for (int i = begin; i < end; i++)
+                (*body)(i);
+            #pragma omp taskwait
+        }
+    };
+}
+
+#endif // ISM3D_PARALLEL_TASKS_H
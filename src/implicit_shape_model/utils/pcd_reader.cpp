@@ -0,0 +1,307 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "pcd_reader.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <omp.h>
+
+extern "C"
+{
+#include "../third_party/liblzf-3.6/lzf.h"
+}
+
+namespace ism3d
+{
+    namespace
+    {
+        // read only memory mapping of a file, unmapped on destruction
+        struct MappedFile
+        {
+            MappedFile(const std::string &filename)
+                : data(0), size(0)
+            {
+                int fd = open(filename.c_str(), O_RDONLY);
+                if (fd < 0)
+                    return;
+
+                struct stat info;
+                if (fstat(fd, &info) == 0 && info.st_size > 0) {
+                    void *mapped = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (mapped != MAP_FAILED) {
+                        data = (const char*)mapped;
+                        size = info.st_size;
+                    }
+                }
+                close(fd);
+            }
+
+            ~MappedFile()
+            {
+                if (data)
+                    munmap((void*)data, size);
+            }
+
+            const char *data;
+            std::size_t size;
+        };
+
+        // location of a field of the point type in the file data
+        struct FieldSource
+        {
+            const char *base;
+            std::size_t stride;
+            int size;      // 4 or 8 for floats, 4 for colors
+            int offset;    // offset of the field in PointNormalT
+            bool isColor;
+        };
+
+        bool matchesTarget(const std::string &name, int &offset, bool &isColor)
+        {
+            static const PointNormalT point;
+            const char *base = (const char*)&point;
+
+            isColor = false;
+            if (name == "x") offset = (const char*)&point.x - base;
+            else if (name == "y") offset = (const char*)&point.y - base;
+            else if (name == "z") offset = (const char*)&point.z - base;
+            else if (name == "normal_x") offset = (const char*)&point.normal_x - base;
+            else if (name == "normal_y") offset = (const char*)&point.normal_y - base;
+            else if (name == "normal_z") offset = (const char*)&point.normal_z - base;
+            else if (name == "curvature") offset = (const char*)&point.curvature - base;
+#ifndef ISM3D_COLORLESS_POINTS
+            else if (name == "rgb" || name == "rgba") {
+                offset = (const char*)&point.rgba - base;
+                isColor = true;
+            }
+#endif
+            else
+                return false;
+            return true;
+        }
+    }
+
+    PCDReader::Status PCDReader::read(const std::string &filename, pcl::PointCloud<PointNormalT> &cloud, bool &hasNormals)
+    {
+        MappedFile file(filename);
+        if (!file.data) {
+            LOG_ERROR("could not map pcd file: " << filename);
+            return Failed;
+        }
+
+        Header header;
+        if (!parseHeader(file.data, file.size, header))
+            return Unsupported;
+
+        int numNormalFields = 0;
+        for (const Field &field : header.fields) {
+            if (field.name == "normal_x" || field.name == "normal_y" || field.name == "normal_z")
+                numNormalFields++;
+        }
+        hasNormals = numNormalFields == 3;
+
+        if (header.data != "binary" && header.data != "binary_compressed")
+            return Unsupported;
+
+        const std::size_t numPoints = header.points;
+        const char *data = file.data + header.dataOffset;
+        const std::size_t dataSize = file.size - header.dataOffset;
+
+        // binary data is stored point by point, compressed data field by field without padding fields
+        std::size_t pointSize = 0;
+        for (const Field &field : header.fields) {
+            if (header.data == "binary" || field.name != "_")
+                pointSize += (std::size_t)field.size * field.count;
+        }
+
+        std::vector<char> decompressed;
+        if (header.data == "binary_compressed") {
+            if (dataSize < 8) {
+                LOG_ERROR("invalid compressed pcd file: " << filename);
+                return Failed;
+            }
+
+            uint32_t compressedSize, uncompressedSize;
+            std::memcpy(&compressedSize, data, 4);
+            std::memcpy(&uncompressedSize, data + 4, 4);
+            if (compressedSize > dataSize - 8 || uncompressedSize != numPoints * pointSize) {
+                LOG_ERROR("invalid compressed pcd file: " << filename);
+                return Failed;
+            }
+
+            decompressed.resize(uncompressedSize);
+            if (uncompressedSize > 0 &&
+                    lzf_decompress(data + 8, compressedSize, decompressed.data(), uncompressedSize) != uncompressedSize) {
+                LOG_ERROR("could not decompress pcd file: " << filename);
+                return Failed;
+            }
+        }
+        else if (dataSize < numPoints * pointSize) {
+            LOG_ERROR("pcd file is truncated: " << filename);
+            return Failed;
+        }
+
+        // source of each field of the point type
+        std::vector<FieldSource> sources;
+        std::size_t fieldOffset = 0;
+        for (const Field &field : header.fields) {
+            const std::size_t fieldSize = (std::size_t)field.size * field.count;
+            if (header.data == "binary_compressed" && field.name == "_")
+                continue;
+
+            FieldSource source;
+            bool floatField = field.type == 'F' && (field.size == 4 || field.size == 8);
+            bool colorField = field.size == 4 && (field.type == 'F' || field.type == 'U');
+            if (field.count == 1 && matchesTarget(field.name, source.offset, source.isColor) &&
+                    (source.isColor ? colorField : floatField)) {
+                if (header.data == "binary") {
+                    source.base = data + fieldOffset;
+                    source.stride = pointSize;
+                }
+                else {
+                    source.base = decompressed.data() + fieldOffset * numPoints;
+                    source.stride = fieldSize;
+                }
+                source.size = field.size;
+                sources.push_back(source);
+            }
+            else if (field.name != "_") {
+                LOG_WARN("pcd field " << field.name << " is not read into the point cloud");
+            }
+
+            fieldOffset += fieldSize;
+        }
+
+        cloud.points.resize(numPoints);
+        cloud.width = header.width;
+        cloud.height = header.height;
+        cloud.sensor_origin_ = header.origin;
+        cloud.sensor_orientation_ = header.orientation;
+
+        bool isDense = true;
+        #pragma omp parallel for reduction(&&:isDense) if(numPoints > 10000)
+        for (int i = 0; i < (int)numPoints; i++) {
+            PointNormalT point;
+            char *target = (char*)&point;
+            for (const FieldSource &source : sources) {
+                const char *value = source.base + (std::size_t)i * source.stride;
+                if (source.size == 8) {
+                    double converted;
+                    std::memcpy(&converted, value, 8);
+                    float result = (float)converted;
+                    std::memcpy(target + source.offset, &result, 4);
+                }
+                else {
+                    std::memcpy(target + source.offset, value, 4);
+                }
+            }
+
+            isDense = isDense && pcl::isFinite(point);
+            cloud.points[i] = point;
+        }
+        cloud.is_dense = isDense;
+
+        return Success;
+    }
+
+    bool PCDReader::parseHeader(const char *begin, std::size_t size, Header &header)
+    {
+        header.width = 0;
+        header.height = 1;
+        header.points = -1;
+        header.origin = Eigen::Vector4f::Zero();
+        header.orientation = Eigen::Quaternionf::Identity();
+
+        std::vector<int> sizes;
+        std::vector<char> types;
+        std::vector<int> counts;
+
+        std::size_t position = 0;
+        while (position < size) {
+            const char *lineEnd = (const char*)std::memchr(begin + position, '\n', size - position);
+            std::size_t end = lineEnd ? lineEnd - begin : size;
+            std::istringstream line(std::string(begin + position, end - position));
+            position = end + 1;
+
+            std::string key;
+            if (!(line >> key) || key[0] == '#')
+                continue;
+
+            if (key == "FIELDS") {
+                std::string name;
+                while (line >> name) {
+                    Field field;
+                    field.name = name;
+                    header.fields.push_back(field);
+                }
+            }
+            else if (key == "SIZE") {
+                int value;
+                while (line >> value)
+                    sizes.push_back(value);
+            }
+            else if (key == "TYPE") {
+                char value;
+                while (line >> value)
+                    types.push_back(value);
+            }
+            else if (key == "COUNT") {
+                int value;
+                while (line >> value)
+                    counts.push_back(value);
+            }
+            else if (key == "WIDTH")
+                line >> header.width;
+            else if (key == "HEIGHT")
+                line >> header.height;
+            else if (key == "POINTS")
+                line >> header.points;
+            else if (key == "VIEWPOINT") {
+                float tx, ty, tz, qw, qx, qy, qz;
+                if (line >> tx >> ty >> tz >> qw >> qx >> qy >> qz) {
+                    header.origin = Eigen::Vector4f(tx, ty, tz, 0);
+                    header.orientation = Eigen::Quaternionf(qw, qx, qy, qz);
+                }
+            }
+            else if (key == "DATA") {
+                line >> header.data;
+                header.dataOffset = std::min(position, size);
+                break;
+            }
+        }
+
+        if (header.data.empty() || header.fields.empty() ||
+                sizes.size() != header.fields.size() || types.size() != header.fields.size())
+            return false;
+
+        // older versions of the format have no counts
+        if (counts.empty())
+            counts.assign(header.fields.size(), 1);
+        if (counts.size() != header.fields.size())
+            return false;
+
+        for (int i = 0; i < (int)header.fields.size(); i++) {
+            header.fields[i].size = sizes[i];
+            header.fields[i].type = types[i];
+            header.fields[i].count = counts[i];
+        }
+
+        if (header.points < 0)
+            header.points = header.width * header.height;
+        return header.points == header.width * header.height;
+    }
+}
@@ -0,0 +1,76 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_PCDREADER_H
+#define ISM3D_PCDREADER_H
+
+#include <string>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The PCDReader class
+     * Reads binary and binary compressed PCD files directly into point clouds with normals. The file is memory mapped,
+     * the header is parsed once and the fields of the points are converted in parallel without the intermediate
+     * pcl::PCLPointCloud2. Fields are matched by name like pcl::io::loadPCDFile. Since the header is always parsed, the
+     * reader also tells whether a file contains normals, even for ASCII files that are left to PCL.
+     */
+    class PCDReader
+    {
+    public:
+        enum Status
+        {
+            Success,     // the cloud was read
+            Unsupported, // the data format is not supported, the cloud has to be read with PCL
+            Failed       // the file could not be read
+        };
+
+        /**
+         * @brief Read a PCD file.
+         * @param filename the PCD file
+         * @param cloud the point cloud, fields missing in the file are default initialized
+         * @param hasNormals return parameter: true if the file contains the normal fields, also set if the data
+         *        format is unsupported
+         * @return the read status
+         */
+        static Status read(const std::string &filename, pcl::PointCloud<PointNormalT> &cloud, bool &hasNormals);
+
+    private:
+        struct Field
+        {
+            std::string name;
+            int size;
+            char type;
+            int count;
+        };
+
+        struct Header
+        {
+            std::vector<Field> fields;
+            int width;
+            int height;
+            int points;
+            Eigen::Vector4f origin;
+            Eigen::Quaternionf orientation;
+            std::string data;
+            std::size_t dataOffset;
+        };
+
+        static bool parseHeader(const char *begin, std::size_t size, Header &header);
+    };
+}
+
+#endif // ISM3D_PCDREADER_H
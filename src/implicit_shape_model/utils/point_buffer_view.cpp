@@ -0,0 +1,85 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "point_buffer_view.h"
+
+#include <cmath>
+#include <limits>
+
+namespace ism3d
+{
+    namespace
+    {
+        template<typename T>
+        const T* at(const T *data, int stride, int index)
+        {
+            return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(data) + (size_t)stride * index);
+        }
+    }
+
+    pcl::PointCloud<PointNormalT>::Ptr PointBufferView::toPointCloud(bool keepOrganized) const
+    {
+        pcl::PointCloud<PointNormalT>::Ptr cloud(new pcl::PointCloud<PointNormalT>());
+        const bool organized = keepOrganized && isOrganized();
+        cloud->points.reserve(numPoints);
+
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        bool dense = true;
+        for (int i = 0; i < numPoints; i++)
+        {
+            const float *position = at(xyz, xyzStride, i);
+            const bool valid = std::isfinite(position[0]) && std::isfinite(position[1]) && std::isfinite(position[2]);
+            if (!valid && !organized)
+                continue;
+
+            PointNormalT point;
+            point.x = valid ? position[0] : nan;
+            point.y = valid ? position[1] : nan;
+            point.z = valid ? position[2] : nan;
+            dense = dense && valid;
+            if (rgb)
+            {
+                const uint8_t *color = at(rgb, rgbStride, i);
+                setPointColor(point, color[0], color[1], color[2]);
+            }
+            else
+            {
+                setPointColor(point, 0, 0, 0);
+            }
+            if (normals)
+            {
+                const float *normal = at(normals, normalStride, i);
+                point.normal_x = normal[0];
+                point.normal_y = normal[1];
+                point.normal_z = normal[2];
+                point.curvature = curvature ? *at(curvature, curvatureStride, i) : 0.0f;
+            }
+            else
+            {
+                point.normal_x = point.normal_y = point.normal_z = nan;
+                point.curvature = nan;
+            }
+            cloud->points.push_back(point);
+        }
+
+        if (organized)
+        {
+            cloud->width = width;
+            cloud->height = height;
+        }
+        else
+        {
+            cloud->width = (uint32_t)cloud->points.size();
+            cloud->height = 1;
+        }
+        cloud->is_dense = dense;
+        return cloud;
+    }
+}
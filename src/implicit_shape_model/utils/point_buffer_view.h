@@ -0,0 +1,61 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_POINT_BUFFER_VIEW_H
+#define ISM3D_POINT_BUFFER_VIEW_H
+
+#include <cstdint>
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The PointBufferView struct
+     * A strided view over point data owned by the caller, e.g. the interleaved float buffer of a sensor driver.
+     * The strides are in bytes between consecutive points, so the same buffer can be referenced by several
+     * pointers. Colors and normals are optional, an organized buffer is stored row by row.
+     */
+    struct PointBufferView
+    {
+        PointBufferView()
+            : numPoints(0), width(0), height(0), xyz(0), xyzStride(3 * sizeof(float)), rgb(0), rgbStride(3),
+              normals(0), normalStride(3 * sizeof(float)), curvature(0), curvatureStride(sizeof(float))
+        {
+        }
+
+        int numPoints;
+        int width;  // organized layout with width * height == numPoints, 0 if unorganized
+        int height;
+
+        const float *xyz;           // x, y and z of each point
+        int xyzStride;
+        const uint8_t *rgb;         // optional r, g and b of each point
+        int rgbStride;
+        const float *normals;       // optional normal x, y and z of each point
+        int normalStride;
+        const float *curvature;     // optional curvature of each point, used with the normals
+        int curvatureStride;
+
+        bool isOrganized() const
+        {
+            return width > 0 && height > 1 && width * height == numPoints;
+        }
+
+        /**
+         * @brief Convert the view into a point cloud in a single pass. Unless the organization is kept, points
+         * without finite coordinates are skipped, so that the result needs no further NAN removal.
+         * @param keepOrganized keep all points of an organized view in their image layout
+         * @return the converted point cloud
+         */
+        pcl::PointCloud<PointNormalT>::Ptr toPointCloud(bool keepOrganized) const;
+    };
+}
+
+#endif // ISM3D_POINT_BUFFER_VIEW_H
@@ -0,0 +1,157 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "point_cloud_loader.h"
+#include "pcd_reader.h"
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/io/ply_io.h>
+
+namespace ism3d
+{
+    namespace
+    {
+        std::size_t getBytes(const pcl::PointCloud<PointNormalT>::Ptr &cloud)
+        {
+            return cloud ? cloud->points.size() * sizeof(PointNormalT) : 0;
+        }
+    }
+
+    PointCloudLoader::PointCloudLoader(const std::vector<std::string> &filenames, int maxPrefetched, std::size_t maxBytes)
+        : m_filenames(filenames), m_maxPrefetched(maxPrefetched), m_maxBytes(maxBytes),
+          m_loadedBytes(0), m_numReturned(0), m_stop(false)
+    {
+        if (m_maxPrefetched > 0 && !m_filenames.empty())
+            m_thread = std::thread(&PointCloudLoader::run, this);
+    }
+
+    PointCloudLoader::~PointCloudLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_consumedCondition.notify_all();
+
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    pcl::PointCloud<PointNormalT>::Ptr PointCloudLoader::next(bool *hasNormals)
+    {
+        if (!hasNext()) {
+            LOG_ERROR("no more point clouds to load");
+            return pcl::PointCloud<PointNormalT>::Ptr();
+        }
+
+        if (!m_thread.joinable())
+            return load(m_filenames[m_numReturned++], hasNormals);
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_loadedCondition.wait(lock, [this]{ return !m_loaded.empty(); });
+
+        pcl::PointCloud<PointNormalT>::Ptr cloud = m_loaded.front().first;
+        if (hasNormals)
+            *hasNormals = m_loaded.front().second;
+        m_loaded.pop_front();
+        m_loadedBytes -= getBytes(cloud);
+        m_numReturned++;
+        lock.unlock();
+
+        m_consumedCondition.notify_all();
+        return cloud;
+    }
+
+    bool PointCloudLoader::hasNext() const
+    {
+        return m_numReturned < (int)m_filenames.size();
+    }
+
+    void PointCloudLoader::run()
+    {
+        for (int i = 0; i < (int)m_filenames.size(); i++) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_consumedCondition.wait(lock, [this]{ return m_stop || canPrefetch(); });
+                if (m_stop)
+                    return;
+            }
+
+            bool hasNormals = false;
+            pcl::PointCloud<PointNormalT>::Ptr cloud = load(m_filenames[i], &hasNormals);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_loaded.push_back(std::make_pair(cloud, hasNormals));
+                m_loadedBytes += getBytes(cloud);
+            }
+            m_loadedCondition.notify_all();
+        }
+    }
+
+    bool PointCloudLoader::canPrefetch() const
+    {
+        if (m_loaded.empty())
+            return true;
+
+        return (int)m_loaded.size() < m_maxPrefetched && (m_maxBytes == 0 || m_loadedBytes < m_maxBytes);
+    }
+
+    pcl::PointCloud<PointNormalT>::Ptr PointCloudLoader::load(const std::string &filename, bool *hasNormals)
+    {
+        pcl::PointCloud<PointNormalT>::Ptr pointCloud(new pcl::PointCloud<PointNormalT>());
+        bool normals = false;
+
+        // filename needs to have at least an extension like .pcd or .ply
+        if (filename.size() < 5) {
+            LOG_ERROR("invalid filename: " << filename);
+            return pcl::PointCloud<PointNormalT>::Ptr();
+        }
+
+        std::string extension = filename.substr(filename.size() - 4, 4);
+
+        // load the point cloud
+        if (extension == ".pcd") {
+            PCDReader::Status status = PCDReader::read(filename, *pointCloud, normals);
+            if (status == PCDReader::Failed ||
+                    (status == PCDReader::Unsupported && pcl::io::loadPCDFile(filename, *pointCloud) < 0)) {
+                LOG_ERROR("could not load pcd file: " << filename);
+                return pcl::PointCloud<PointNormalT>::Ptr();
+            }
+        }
+        else if (extension == ".ply") {
+            if (pcl::io::loadPLYFile(filename, *pointCloud) < 0) {
+                LOG_ERROR("could not load ply file: " << filename);
+                return pcl::PointCloud<PointNormalT>::Ptr();
+            }
+
+            // the fields are not known, so the first normal has to be valid
+            if (pointCloud->size() > 0) {
+                const PointNormalT& firstNormal = pointCloud->at(0);
+                normals = !(firstNormal.normal_x == 0 && firstNormal.normal_y == 0 && firstNormal.normal_z == 0) &&
+                        pcl_isfinite(firstNormal.normal_x) && pcl_isfinite(firstNormal.normal_y) &&
+                        pcl_isfinite(firstNormal.normal_z) && pcl_isfinite(firstNormal.curvature);
+            }
+        }
+        else {
+            LOG_ERROR("Unknown extension: " << extension);
+            return pcl::PointCloud<PointNormalT>::Ptr();
+        }
+
+        if (pointCloud->size() == 0) {
+            LOG_ERROR("point cloud is empty");
+            return pcl::PointCloud<PointNormalT>::Ptr();
+        }
+
+        if (hasNormals)
+            *hasNormals = normals;
+        return pointCloud;
+    }
+}
@@ -0,0 +1,88 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_POINTCLOUDLOADER_H
+#define ISM3D_POINTCLOUDLOADER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The PointCloudLoader class
+     * Loads a list of point cloud files in a background thread while the previous clouds are processed. The clouds
+     * are returned in the order of the filenames. At most a given number of clouds and bytes are kept ahead of the
+     * consumer, but at least one cloud is always loaded ahead. Without prefetching the clouds are loaded on request.
+     */
+    class PointCloudLoader
+    {
+    public:
+        /**
+         * @brief Start loading the given files.
+         * @param filenames the files to load, with the extension .pcd or .ply
+         * @param maxPrefetched the maximum number of clouds loaded ahead, 0 disables prefetching
+         * @param maxBytes the maximum memory of the clouds loaded ahead, 0 for no limit
+         */
+        PointCloudLoader(const std::vector<std::string> &filenames, int maxPrefetched = 2, std::size_t maxBytes = 0);
+        ~PointCloudLoader();
+
+        /**
+         * @brief Get the next point cloud, waits until it is loaded.
+         * @param hasNormals optional return parameter: true if the point cloud contains normals
+         * @return the point cloud or an empty pointer if it could not be loaded
+         */
+        pcl::PointCloud<PointNormalT>::Ptr next(bool *hasNormals = 0);
+
+        /**
+         * @brief Check whether there are remaining point clouds.
+         */
+        bool hasNext() const;
+
+        /**
+         * @brief Load a single point cloud file.
+         * Binary PCD files are read with the PCDReader. Whether a PCD file contains normals is determined from its
+         * fields, for PLY files the first normal is checked.
+         * @param filename the file to load, with the extension .pcd or .ply
+         * @param hasNormals optional return parameter: true if the point cloud contains normals
+         * @return the point cloud or an empty pointer if it could not be loaded or is empty
+         */
+        static pcl::PointCloud<PointNormalT>::Ptr load(const std::string &filename, bool *hasNormals = 0);
+
+    private:
+        void run();
+        bool canPrefetch() const;
+
+        std::vector<std::string> m_filenames;
+        int m_maxPrefetched;
+        std::size_t m_maxBytes;
+
+        std::mutex m_mutex;
+        std::condition_variable m_loadedCondition;
+        std::condition_variable m_consumedCondition;
+        std::deque<std::pair<pcl::PointCloud<PointNormalT>::Ptr, bool> > m_loaded;
+        std::size_t m_loadedBytes;
+        int m_numReturned;
+        bool m_stop;
+        std::thread m_thread;
+    };
+}
+
+#endif // ISM3D_POINTCLOUDLOADER_H
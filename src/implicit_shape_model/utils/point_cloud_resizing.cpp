@@ -9,13 +9,51 @@
  */
 
 #include "point_cloud_resizing.h"
-#include <pcl/search/organized.h>
 #include "exception.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <omp.h>
+
 namespace ism3d
 {
+    namespace
+    {
+        // summed area table entry of the finite points
+        struct BlockSums
+        {
+            BlockSums()
+                : count(0), x(0), y(0), z(0), zz(0)
+            {
+            }
+
+            void add(const BlockSums &other)
+            {
+                count += other.count;
+                x += other.x;
+                y += other.y;
+                z += other.z;
+                zz += other.zz;
+            }
+
+            void subtract(const BlockSums &other)
+            {
+                count -= other.count;
+                x -= other.x;
+                y -= other.y;
+                z -= other.z;
+                zz -= other.zz;
+            }
+
+            double count;
+            double x, y, z;
+            double zz;
+        };
+    }
+
     PointCloudResizing::PointCloudResizing()
-        : m_resizeFactor(2.0f)
+        : m_resizeFactor(2.0f), m_method(RadiusSearch), m_numThreads(0)
     {
     }
 
@@ -44,9 +82,20 @@ namespace ism3d
         Eigen::Matrix3f cameraMatrix;
         search.computeCameraMatrix(cameraMatrix);
 
-        for (int i = 0; i < (int)downsampled->width; i++) {
-            for (int j = 0; j < (int)downsampled->height; j++) {
-                PointT& point = downsampled->at(i, j);
+        if (m_method == BlockAverage)
+            resizeBlockAverage(*pointCloud, cameraMatrix, *downsampled);
+        else
+            resizeRadiusSearch(*pointCloud, search, cameraMatrix, *downsampled);
+
+        return downsampled;
+    }
+
+    void PointCloudResizing::resizeRadiusSearch(const pcl::PointCloud<PointT> &pointCloud, const pcl::search::OrganizedNeighbor<PointT> &search,
+                                                const Eigen::Matrix3f &cameraMatrix, pcl::PointCloud<PointT> &downsampled) const
+    {
+        for (int i = 0; i < (int)downsampled.width; i++) {
+            for (int j = 0; j < (int)downsampled.height; j++) {
+                PointT& point = downsampled.at(i, j);
 
                 // retrieve nearest neighbors with organized nearest neighbor, using a dynamic distance
                 // depending on the spatial resolution at the point
@@ -59,7 +108,7 @@ namespace ism3d
                 float middleWidth = startWidth + ((endWidth - startWidth) / 2.0f);
                 float middleHeight = startHeight + ((endHeight - startHeight) / 2.0f);
 
-                const PointT& queryPoint = pointCloud->at((int)middleWidth, (int)middleHeight);
+                const PointT& queryPoint = pointCloud.at((int)middleWidth, (int)middleHeight);
 
                 if (pcl::isFinite(queryPoint)) {
                     Eigen::Vector3f centerPoint(queryPoint.x, queryPoint.y, queryPoint.z);
@@ -78,7 +127,7 @@ namespace ism3d
                     point.x = point.y = point.z = 0;
                     float totalWeight = 0;
                     for (int k = 0; k < (int)indices.size(); k++) {
-                        const PointT& curPoint = pointCloud->at(indices[k]);
+                        const PointT& curPoint = pointCloud.at(indices[k]);
                         point.x += curPoint.x;
                         point.y += curPoint.y;
                         point.z += curPoint.z;
@@ -92,8 +141,122 @@ namespace ism3d
                     point = queryPoint;
             }
         }
+    }
 
-        return downsampled;
+    void PointCloudResizing::resizeBlockAverage(const pcl::PointCloud<PointT> &pointCloud, const Eigen::Matrix3f &cameraMatrix,
+                                                pcl::PointCloud<PointT> &downsampled) const
+    {
+        const int width = (int)pointCloud.width;
+        const int height = (int)pointCloud.height;
+        const int stride = width + 1;
+        const int numThreads = m_numThreads > 0 ? m_numThreads : omp_get_max_threads();
+
+        // summed area tables with an additional leading row and column of zeros
+        std::vector<BlockSums> sums((std::size_t)stride * (height + 1));
+
+        #pragma omp parallel for num_threads(numThreads)
+        for (int j = 0; j < height; j++) {
+            BlockSums *row = &sums[(std::size_t)(j + 1) * stride];
+            for (int i = 0; i < width; i++) {
+                const PointT& point = pointCloud.at(i, j);
+                row[i + 1] = row[i];
+                if (pcl::isFinite(point)) {
+                    row[i + 1].count += 1;
+                    row[i + 1].x += point.x;
+                    row[i + 1].y += point.y;
+                    row[i + 1].z += point.z;
+                    row[i + 1].zz += (double)point.z * point.z;
+                }
+            }
+        }
+
+        #pragma omp parallel for num_threads(numThreads)
+        for (int i = 1; i <= width; i++) {
+            for (int j = 1; j <= height; j++)
+                sums[(std::size_t)j * stride + i].add(sums[(std::size_t)(j - 1) * stride + i]);
+        }
+
+        #pragma omp parallel for num_threads(numThreads) schedule(dynamic, 4)
+        for (int j = 0; j < (int)downsampled.height; j++) {
+            for (int i = 0; i < (int)downsampled.width; i++) {
+                PointT& point = downsampled.at(i, j);
+
+                // same blocks and reference pixels as the radius search
+                const int startWidth = (int)(i * m_resizeFactor);
+                const int endWidth = std::min((int)((i + 1) * m_resizeFactor), width);
+                const int startHeight = (int)(j * m_resizeFactor);
+                const int endHeight = std::min((int)((j + 1) * m_resizeFactor), height);
+                const float middleWidth = i * m_resizeFactor + m_resizeFactor / 2.0f;
+                const float middleHeight = j * m_resizeFactor + m_resizeFactor / 2.0f;
+
+                const PointT& queryPoint = pointCloud.at((int)middleWidth, (int)middleHeight);
+                point = queryPoint;
+
+                BlockSums block = sums[(std::size_t)endHeight * stride + endWidth];
+                block.subtract(sums[(std::size_t)startHeight * stride + endWidth]);
+                block.subtract(sums[(std::size_t)endHeight * stride + startWidth]);
+                block.add(sums[(std::size_t)startHeight * stride + startWidth]);
+
+                if (block.count < 0.5) {
+                    // no finite point in this block
+                    point.x = point.y = point.z = std::numeric_limits<float>::quiet_NaN();
+                    continue;
+                }
+
+                const double meanZ = block.z / block.count;
+                const double varianceZ = std::max(block.zz / block.count - meanZ * meanZ, 0.0);
+                Eigen::Vector3f reference(block.x / block.count, block.y / block.count, meanZ);
+                if (pcl::isFinite(queryPoint))
+                    reference = Eigen::Vector3f(queryPoint.x, queryPoint.y, queryPoint.z);
+
+                float radius = getRadius(cameraMatrix, reference, startWidth, endWidth, startHeight, endHeight);
+
+                // a continuous surface within the block is averaged directly from the tables
+                if (std::sqrt(varianceZ) <= 0.5f * radius) {
+                    point.x = block.x / block.count;
+                    point.y = block.y / block.count;
+                    point.z = meanZ;
+                    continue;
+                }
+
+                // at depth discontinuities the foreground point is the reference if the center is invalid
+                if (!pcl::isFinite(queryPoint)) {
+                    float minZ = std::numeric_limits<float>::max();
+                    for (int y = startHeight; y < endHeight; y++) {
+                        for (int x = startWidth; x < endWidth; x++) {
+                            const PointT& curPoint = pointCloud.at(x, y);
+                            if (pcl::isFinite(curPoint) && curPoint.z < minZ) {
+                                minZ = curPoint.z;
+                                reference = curPoint.getVector3fMap();
+                                copyPointColor(curPoint, point);
+                            }
+                        }
+                    }
+                    radius = getRadius(cameraMatrix, reference, startWidth, endWidth, startHeight, endHeight);
+                }
+
+                // average the points of the block within the radius around the reference
+                Eigen::Vector3f sum = Eigen::Vector3f::Zero();
+                float totalWeight = 0;
+                for (int y = startHeight; y < endHeight; y++) {
+                    for (int x = startWidth; x < endWidth; x++) {
+                        const PointT& curPoint = pointCloud.at(x, y);
+                        if (pcl::isFinite(curPoint) && (curPoint.getVector3fMap() - reference).norm() <= radius) {
+                            sum += curPoint.getVector3fMap();
+                            totalWeight += 1;
+                        }
+                    }
+                }
+
+                if (totalWeight > 0)
+                    sum /= totalWeight;
+                else
+                    sum = reference;
+                point.x = sum[0];
+                point.y = sum[1];
+                point.z = sum[2];
+            }
+        }
     }
 
     Eigen::Vector3f PointCloudResizing::getPoint(const Eigen::Matrix3f& cameraMatrix, int i, int j, float z) const
@@ -131,4 +294,24 @@ namespace ism3d
 
         m_resizeFactor = factor;
     }
+
+    void PointCloudResizing::setMethod(Method method)
+    {
+        m_method = method;
+    }
+
+    void PointCloudResizing::setMethod(const std::string &method)
+    {
+        if (method == "RadiusSearch")
+            m_method = RadiusSearch;
+        else if (method == "BlockAverage")
+            m_method = BlockAverage;
+        else
+            throw BadParamExceptionType<std::string>("invalid resizing method", method);
+    }
+
+    void PointCloudResizing::setNumThreads(int numThreads)
+    {
+        m_numThreads = numThreads;
+    }
 }
@@ -14,6 +14,8 @@
 #include "utils.h"
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
+#include <pcl/search/organized.h>
+#include <string>
 
 namespace ism3d
 {
@@ -27,10 +29,19 @@ namespace ism3d
      * cloud.
      * Note however, that the point cloud might contain NaN values which cannot be
      * removed without loosing the organized structure.
+     * Alternatively, the block method averages the finite points of each block of input
+     * pixels with summed area tables computed in parallel over rows. Blocks with a depth
+     * discontinuity only average the points within the radius of the reference point.
      */
     class PointCloudResizing
     {
     public:
+        enum Method
+        {
+            RadiusSearch, // average within a radius around the block center with organized neighbor search
+            BlockAverage  // average the finite points of a block with summed area tables
+        };
+
         PointCloudResizing();
         ~PointCloudResizing();
 
@@ -47,11 +58,35 @@ namespace ism3d
          */
         void setResizeFactor(float factor);
 
+        /**
+         * @brief Set the resizing method.
+         * @param method the resizing method, RadiusSearch by default
+         */
+        void setMethod(Method method);
+
+        /**
+         * @brief Set the method by name, either "RadiusSearch" or "BlockAverage".
+         * @param method the name of the resizing method
+         */
+        void setMethod(const std::string &method);
+
+        /**
+         * @brief Set the number of threads for the block method, a value of 0 uses the OpenMP default.
+         */
+        void setNumThreads(int numThreads);
+
     private:
+        void resizeRadiusSearch(const pcl::PointCloud<PointT> &pointCloud, const pcl::search::OrganizedNeighbor<PointT> &search,
+                                const Eigen::Matrix3f &cameraMatrix, pcl::PointCloud<PointT> &downsampled) const;
+        void resizeBlockAverage(const pcl::PointCloud<PointT> &pointCloud, const Eigen::Matrix3f &cameraMatrix,
+                                pcl::PointCloud<PointT> &downsampled) const;
+
         Eigen::Vector3f getPoint(const Eigen::Matrix3f&, int, int, float) const;
         float getRadius(const Eigen::Matrix3f&, const Eigen::Vector3f&, int, int, int, int) const;
 
         float m_resizeFactor;
+        Method m_method;
+        int m_numThreads;
     };
 }
 
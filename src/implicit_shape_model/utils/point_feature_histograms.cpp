@@ -0,0 +1,269 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "point_feature_histograms.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <omp.h>
+
+#include <pcl/common/point_tests.h>
+#include <pcl/features/pfh_tools.h>
+
+namespace ism3d
+{
+    namespace
+    {
+        // spreads the lower 21 bits of a coordinate to every third bit of a morton code
+        uint64_t spreadBits(uint64_t x)
+        {
+            x &= 0x1fffff;
+            x = (x | x << 32) & 0x1f00000000ffffULL;
+            x = (x | x << 16) & 0x1f0000ff0000ffULL;
+            x = (x | x << 8) & 0x100f00f00f00f00fULL;
+            x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+            x = (x | x << 2) & 0x1249249249249249ULL;
+            return x;
+        }
+    }
+
+    const int PointFeatureHistograms::PFHSize;
+    const int PointFeatureHistograms::FPFHSize;
+
+    PointFeatureHistograms::PointFeatureHistograms(const pcl::PointCloud<PointT> &surface,
+                                                   const pcl::PointCloud<pcl::Normal> &normals,
+                                                   pcl::search::Search<PointT> &search, float radius, int numThreads)
+        : m_surface(surface), m_normals(normals), m_search(search), m_radius(radius), m_num_threads(numThreads)
+    {
+    }
+
+    int PointFeatureHistograms::getBin(float value, int numBins)
+    {
+        const int bin = (int)std::floor(numBins * ((value + 1.0) * 0.5));
+        return std::max(0, std::min(numBins - 1, bin));
+    }
+
+    int PointFeatureHistograms::getAngleBin(float angle, int numBins)
+    {
+        static const float invTwoPi = 1.0f / (2.0f * (float)M_PI);
+        const int bin = (int)std::floor(numBins * ((angle + M_PI) * invTwoPi));
+        return std::max(0, std::min(numBins - 1, bin));
+    }
+
+    int PointFeatureHistograms::getPairBin(int first, int second) const
+    {
+        // pairs of equal points have zero features and are counted as in PCL
+        float f1, f2, f3, f4;
+        pcl::computePairFeatures(m_surface.points[first].getVector4fMap(), m_normals.points[first].getNormalVector4fMap(),
+                                 m_surface.points[second].getVector4fMap(), m_normals.points[second].getNormalVector4fMap(),
+                                 f1, f2, f3, f4);
+        return getAngleBin(f1, 5) + 5 * getBin(f2, 5) + 25 * getBin(f3, 5);
+    }
+
+    void PointFeatureHistograms::searchKeypoints(const pcl::PointCloud<PointT> &keypoints,
+                                                 std::vector<std::vector<int> > &indices,
+                                                 std::vector<std::vector<float> > &sqrDists,
+                                                 std::vector<char> &valid) const
+    {
+        const int numKeypoints = (int)keypoints.size();
+        indices.assign(numKeypoints, std::vector<int>());
+        sqrDists.assign(numKeypoints, std::vector<float>());
+        valid.assign(numKeypoints, 0);
+
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(m_num_threads)
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            valid[i] = pcl::isFinite(keypoints.points[i]) &&
+                    m_search.radiusSearch(keypoints, i, m_radius, indices[i], sqrDists[i]) > 0;
+        }
+    }
+
+    void PointFeatureHistograms::computePFH(const pcl::PointCloud<PointT> &keypoints, std::vector<float> &descriptors) const
+    {
+        const int numKeypoints = (int)keypoints.size();
+        descriptors.assign((size_t)numKeypoints * PFHSize, 0.0f);
+
+        std::vector<std::vector<int> > neighbors;
+        std::vector<std::vector<float> > sqrDists;
+        std::vector<char> valid;
+        searchKeypoints(keypoints, neighbors, sqrDists, valid);
+
+        // morton order of the keypoints on a grid of the neighborhood radius, consecutive keypoints share most pairs
+        Eigen::Vector3f minPoint = Eigen::Vector3f::Constant(std::numeric_limits<float>::max());
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (valid[i])
+                minPoint = minPoint.cwiseMin(keypoints.points[i].getVector3fMap());
+        }
+        std::vector<std::pair<uint64_t, int> > order;
+        order.reserve(numKeypoints);
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (!valid[i])
+                continue;
+            const Eigen::Vector3f cell = (keypoints.points[i].getVector3fMap() - minPoint) / m_radius;
+            order.push_back(std::make_pair(spreadBits((uint64_t)cell[0]) | spreadBits((uint64_t)cell[1]) << 1 |
+                                           spreadBits((uint64_t)cell[2]) << 2, i));
+        }
+        std::sort(order.begin(), order.end());
+
+        // an entry of the pair cache packs the smaller and the larger index with 28 bits each and the bin above
+        const bool useCache = m_surface.size() < (1u << 28);
+        const uint64_t empty = std::numeric_limits<uint64_t>::max();
+        const int cacheBits = 16;
+        const uint64_t pairMask = (1ULL << 56) - 1;
+
+        #pragma omp parallel num_threads(m_num_threads)
+        {
+            std::vector<uint64_t> cache(useCache ? (size_t)1 << cacheBits : 0, empty);
+
+            #pragma omp for schedule(dynamic, 64)
+            for (int n = 0; n < (int)order.size(); n++)
+            {
+                const int i = order[n].second;
+                const std::vector<int> &indices = neighbors[i];
+                float *descriptor = descriptors.data() + (size_t)i * PFHSize;
+                const float increment = 100.0f / (float)(indices.size() * (indices.size() - 1) / 2);
+
+                for (int a = 0; a < (int)indices.size(); a++)
+                {
+                    for (int b = 0; b < a; b++)
+                    {
+                        // the features of a pair are symmetric, the cache computes them in the order of the indices
+                        const int first = std::min(indices[a], indices[b]);
+                        const int second = std::max(indices[a], indices[b]);
+                        int bin;
+                        if (useCache)
+                        {
+                            const uint64_t pair = (uint64_t)first | (uint64_t)second << 28;
+                            const size_t slot = (size_t)((((uint64_t)first * 0x9E3779B97F4A7C15ULL ^ (uint64_t)second) *
+                                                          0xC2B2AE3D27D4EB4FULL) >> (64 - cacheBits));
+                            if (cache[slot] != empty && (cache[slot] & pairMask) == pair)
+                            {
+                                bin = (int)(cache[slot] >> 56);
+                            }
+                            else
+                            {
+                                bin = getPairBin(first, second);
+                                cache[slot] = pair | (uint64_t)bin << 56;
+                            }
+                        }
+                        else
+                        {
+                            bin = getPairBin(first, second);
+                        }
+                        descriptor[bin] += increment;
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (!valid[i])
+                std::fill(descriptors.begin() + (size_t)i * PFHSize, descriptors.begin() + (size_t)(i + 1) * PFHSize,
+                          std::numeric_limits<float>::quiet_NaN());
+        }
+    }
+
+    void PointFeatureHistograms::computeFPFH(const pcl::PointCloud<PointT> &keypoints, std::vector<float> &descriptors) const
+    {
+        const int numKeypoints = (int)keypoints.size();
+        descriptors.assign((size_t)numKeypoints * FPFHSize, 0.0f);
+
+        std::vector<std::vector<int> > neighbors;
+        std::vector<std::vector<float> > sqrDists;
+        std::vector<char> valid;
+        searchKeypoints(keypoints, neighbors, sqrDists, valid);
+
+        // each surface point in a neighborhood gets one row of SPFH histograms, shared by all keypoints
+        std::vector<int> rows(m_surface.size(), -1);
+        std::vector<int> spfhPoints;
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (!valid[i])
+                continue;
+            for (int index : neighbors[i])
+            {
+                if (rows[index] < 0)
+                {
+                    rows[index] = (int)spfhPoints.size();
+                    spfhPoints.push_back(index);
+                }
+            }
+        }
+
+        std::vector<float> spfh(spfhPoints.size() * FPFHSize, 0.0f);
+        #pragma omp parallel num_threads(m_num_threads)
+        {
+            std::vector<int> indices;
+            std::vector<float> distances;
+
+            #pragma omp for schedule(dynamic, 64)
+            for (int row = 0; row < (int)spfhPoints.size(); row++)
+            {
+                const int point = spfhPoints[row];
+                if (m_search.radiusSearch(m_surface.points[point], m_radius, indices, distances) == 0)
+                    continue;
+
+                float *histogram = spfh.data() + (size_t)row * FPFHSize;
+                const float increment = 100.0f / (float)(indices.size() - 1);
+                for (int index : indices)
+                {
+                    float f1, f2, f3, f4;
+                    if (index == point ||
+                            !pcl::computePairFeatures(m_surface.points[point].getVector4fMap(), m_normals.points[point].getNormalVector4fMap(),
+                                                      m_surface.points[index].getVector4fMap(), m_normals.points[index].getNormalVector4fMap(),
+                                                      f1, f2, f3, f4))
+                        continue;
+                    histogram[getAngleBin(f1, 11)] += increment;
+                    histogram[11 + getBin(f2, 11)] += increment;
+                    histogram[22 + getBin(f3, 11)] += increment;
+                }
+            }
+        }
+
+        // the SPFH of the neighbors are weighted by their inverse squared distance, each part sums up to 100
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(m_num_threads)
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            float *descriptor = descriptors.data() + (size_t)i * FPFHSize;
+            if (!valid[i])
+            {
+                std::fill(descriptor, descriptor + FPFHSize, std::numeric_limits<float>::quiet_NaN());
+                continue;
+            }
+
+            double sums[3] = {0, 0, 0};
+            for (int n = 0; n < (int)neighbors[i].size(); n++)
+            {
+                if (sqrDists[i][n] == 0)
+                    continue;
+                const float weight = 1.0f / sqrDists[i][n];
+                const float *histogram = spfh.data() + (size_t)rows[neighbors[i][n]] * FPFHSize;
+                for (int bin = 0; bin < FPFHSize; bin++)
+                {
+                    const float value = histogram[bin] * weight;
+                    sums[bin / 11] += value;
+                    descriptor[bin] += value;
+                }
+            }
+
+            for (int part = 0; part < 3; part++)
+            {
+                const float scale = sums[part] != 0 ? (float)(100.0 / sums[part]) : 0.0f;
+                for (int bin = part * 11; bin < (part + 1) * 11; bin++)
+                    descriptor[bin] *= scale;
+            }
+        }
+    }
+}
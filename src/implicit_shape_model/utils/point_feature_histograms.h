@@ -0,0 +1,83 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_POINT_FEATURE_HISTOGRAMS_H
+#define ISM3D_POINT_FEATURE_HISTOGRAMS_H
+
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl/search/search.h>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The PointFeatureHistograms class
+     * Parallel computation of PFH and FPFH descriptors with the pair features and binning of PCL. The neighborhoods
+     * of the keypoints are searched once, in parallel and with a search that is shared by all threads.
+     * FPFH: the SPFH of every surface point in the union of the keypoint neighborhoods is computed once and then
+     * weighted into the descriptors of all keypoints it is a neighbor of.
+     * PFH: the keypoints are processed in spatial order and each thread keeps the bins of the recent point pairs, so
+     * that the pairs that lie in the overlapping neighborhoods of nearby keypoints are computed once.
+     */
+    class PointFeatureHistograms
+    {
+    public:
+        /**
+         * @param surface the search surface
+         * @param normals the normals of the surface
+         * @param search a search whose input cloud is the surface, it is used concurrently
+         * @param radius the radius of the neighborhoods
+         * @param numThreads the number of threads
+         */
+        PointFeatureHistograms(const pcl::PointCloud<PointT> &surface, const pcl::PointCloud<pcl::Normal> &normals,
+                               pcl::search::Search<PointT> &search, float radius, int numThreads);
+
+        /**
+         * @brief Compute the PFH descriptors with 5 subdivisions of each feature.
+         * @param keypoints the keypoints
+         * @param descriptors output: the descriptors, one after another, NaN for keypoints without neighbors
+         */
+        void computePFH(const pcl::PointCloud<PointT> &keypoints, std::vector<float> &descriptors) const;
+
+        /**
+         * @brief Compute the FPFH descriptors with 11 bins of each feature.
+         * @param keypoints the keypoints
+         * @param descriptors output: the descriptors, one after another, NaN for keypoints without neighbors
+         */
+        void computeFPFH(const pcl::PointCloud<PointT> &keypoints, std::vector<float> &descriptors) const;
+
+        static const int PFHSize = 125;
+        static const int FPFHSize = 33;
+
+    private:
+        // neighborhoods of the keypoints, false for keypoints without neighbors
+        void searchKeypoints(const pcl::PointCloud<PointT> &keypoints, std::vector<std::vector<int> > &indices,
+                             std::vector<std::vector<float> > &sqrDists, std::vector<char> &valid) const;
+
+        // bin of a feature in [-1, 1] or of an angle in [-pi, pi]
+        static int getBin(float value, int numBins);
+        static int getAngleBin(float angle, int numBins);
+
+        // the PFH bin of a pair of surface points
+        int getPairBin(int first, int second) const;
+
+        const pcl::PointCloud<PointT> &m_surface;
+        const pcl::PointCloud<pcl::Normal> &m_normals;
+        pcl::search::Search<PointT> &m_search;
+        float m_radius;
+        int m_num_threads;
+    };
+}
+
+#endif // ISM3D_POINT_FEATURE_HISTOGRAMS_H
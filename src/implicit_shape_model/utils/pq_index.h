@@ -0,0 +1,165 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_PQ_INDEX_H
+#define ISM3D_PQ_INDEX_H
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+
+#include "knn_index.h"
+#include "product_quantizer.h"
+#include "exception.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ProductQuantizationIndex class
+     * Exhaustive search over product quantization codes with asymmetric distance computation: for each query a
+     * table with the distances of its subvectors to all centroids is computed once, after which the distance to
+     * a code is the sum of one table entry per subspace. Optionally, the best candidates are re-ranked with the
+     * exact distance to the uncompressed descriptors. The search does not depend on the exact flag, since the
+     * quality is determined by the quantization and the re-ranking.
+     */
+    template<typename T>
+    class ProductQuantizationIndex : public KnnIndex<T>
+    {
+    public:
+        typedef std::pair<float, int> Candidate; // distance and code index
+
+        /**
+         * @param quantizer the trained quantizer
+         * @param codes the codes, getNumSubspaces() bytes per descriptor
+         * @param dataset the uncompressed descriptors in code order, only used for re-ranking and may be empty
+         * @param rerank the number of candidates that are re-ranked with the exact distance (0: no re-ranking)
+         */
+        ProductQuantizationIndex(std::shared_ptr<const ProductQuantizer> quantizer, const std::vector<uint8_t> &codes,
+                                 const flann::Matrix<float> &dataset, int rerank)
+            : m_quantizer(quantizer), m_codes(codes), m_dataset(dataset),
+              m_num_codes((int)(codes.size() / std::max(quantizer->getNumSubspaces(), 1))), m_rerank(rerank)
+        {
+            if ((int)m_dataset.rows != m_num_codes || (int)m_dataset.cols != m_quantizer->getDim())
+                m_rerank = 0;
+        }
+
+        void buildIndex()
+        {
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                search(queries[q], k, result);
+
+                for (int j = 0; j < k; j++)
+                {
+                    indices[q][j] = j < (int)result.size() ? result[j].second : -1;
+                    distances[q][j] = j < (int)result.size() ? result[j].first : std::numeric_limits<float>::max();
+                }
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+            indices.resize(numQueries);
+            distances.resize(numQueries);
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                search(queries[q], k, result);
+
+                indices[q].resize(result.size());
+                distances[q].resize(result.size());
+                for (int j = 0; j < (int)result.size(); j++)
+                {
+                    indices[q][j] = result[j].second;
+                    distances[q][j] = result[j].first;
+                }
+            }
+        }
+
+        void save(const std::string &filename)
+        {
+            throw RuntimeException("product quantization codes are stored with the codebook, not in an index file");
+        }
+
+        // the quantizer is shared with the codebook
+        std::size_t getMemoryUsage() const
+        {
+            return m_codes.capacity();
+        }
+
+    private:
+        void search(const float *query, int k, std::vector<Candidate> &result) const
+        {
+            result.clear();
+            if (k <= 0 || m_num_codes == 0)
+                return;
+
+            std::vector<float> table;
+            m_quantizer->computeDistanceTable(query, m_distance, table);
+
+            const int numSubspaces = m_quantizer->getNumSubspaces();
+            const int numCandidates = std::max(k, m_rerank);
+            std::priority_queue<Candidate> best;
+            for (int i = 0; i < m_num_codes; i++)
+            {
+                Candidate candidate(m_quantizer->getDistance(table, &m_codes[(size_t)i * numSubspaces]), i);
+                if ((int)best.size() < numCandidates)
+                    best.push(candidate);
+                else if (candidate < best.top())
+                {
+                    best.pop();
+                    best.push(candidate);
+                }
+            }
+
+            result.resize(best.size());
+            for (int i = (int)best.size() - 1; i >= 0; i--)
+            {
+                result[i] = best.top();
+                best.pop();
+            }
+
+            if (m_rerank > 0)
+            {
+                for (Candidate &candidate : result)
+                    candidate.first = m_distance(query, m_dataset[candidate.second], m_dataset.cols);
+                std::sort(result.begin(), result.end());
+            }
+
+            if ((int)result.size() > k)
+                result.resize(k);
+        }
+
+        std::shared_ptr<const ProductQuantizer> m_quantizer;
+        std::vector<uint8_t> m_codes;
+        flann::Matrix<float> m_dataset;
+        int m_num_codes;
+        int m_rerank;
+        T m_distance;
+    };
+}
+
+#endif // ISM3D_PQ_INDEX_H
@@ -0,0 +1,190 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "product_quantizer.h"
+#include "utils.h"
+
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+
+namespace ism3d
+{
+    ProductQuantizer::ProductQuantizer()
+        : m_dim(0), m_num_subspaces(0), m_num_centroids(0)
+    {
+    }
+
+    static float squaredDistance(const float *a, const float *b, int length)
+    {
+        float result = 0;
+        for (int i = 0; i < length; i++)
+        {
+            float diff = a[i] - b[i];
+            result += diff * diff;
+        }
+        return result;
+    }
+
+    static int findNearest(const float *vec, const float *centroids, int numCentroids, int length)
+    {
+        int best = 0;
+        float bestDistance = std::numeric_limits<float>::max();
+        for (int c = 0; c < numCentroids; c++)
+        {
+            float dist = squaredDistance(vec, centroids + (size_t)c * length, length);
+            if (dist < bestDistance)
+            {
+                bestDistance = dist;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    void ProductQuantizer::train(const flann::Matrix<float> &data, int num_subspaces, int num_centroids,
+                                 int iterations, int max_samples)
+    {
+        m_dim = (int)data.cols;
+        m_num_subspaces = std::max(1, std::min(num_subspaces, m_dim));
+        m_subspace_offsets.resize(m_num_subspaces + 1);
+        for (int s = 0; s <= m_num_subspaces; s++)
+            m_subspace_offsets[s] = (int)((long)m_dim * s / m_num_subspaces);
+
+        // random training subset, the seed is fixed to obtain reproducible codebooks
+        std::vector<int> samples(data.rows);
+        for (int i = 0; i < (int)samples.size(); i++)
+            samples[i] = i;
+        std::mt19937 rng(42);
+        if (max_samples > 0 && (int)samples.size() > max_samples)
+        {
+            std::shuffle(samples.begin(), samples.end(), rng);
+            samples.resize(max_samples);
+            std::sort(samples.begin(), samples.end());
+        }
+
+        const int numSamples = (int)samples.size();
+        m_num_centroids = std::max(1, std::min(std::min(num_centroids, 256), numSamples));
+        m_centroids.assign((size_t)m_num_centroids * m_dim, 0.0f);
+        if (numSamples == 0)
+            return;
+
+        // initial centroids are distinct random samples, shared by all subspaces
+        std::vector<int> initial = samples;
+        std::shuffle(initial.begin(), initial.end(), rng);
+        initial.resize(m_num_centroids);
+
+        // subspaces are independent
+#pragma omp parallel for schedule(dynamic, 1)
+        for (int s = 0; s < m_num_subspaces; s++)
+        {
+            const int offset = m_subspace_offsets[s];
+            const int length = m_subspace_offsets[s + 1] - offset;
+            float *centroids = &m_centroids[(size_t)m_num_centroids * offset];
+
+            for (int c = 0; c < m_num_centroids; c++)
+                std::copy(data[initial[c]] + offset, data[initial[c]] + offset + length, centroids + (size_t)c * length);
+
+            std::vector<int> assignment(numSamples, -1);
+            std::vector<float> sums((size_t)m_num_centroids * length);
+            std::vector<int> counts(m_num_centroids);
+            std::mt19937 subspaceRng(s);
+
+            for (int it = 0; it < iterations; it++)
+            {
+                bool changed = false;
+                for (int i = 0; i < numSamples; i++)
+                {
+                    int nearest = findNearest(data[samples[i]] + offset, centroids, m_num_centroids, length);
+                    if (nearest != assignment[i])
+                    {
+                        assignment[i] = nearest;
+                        changed = true;
+                    }
+                }
+                if (!changed && it > 0)
+                    break;
+
+                std::fill(sums.begin(), sums.end(), 0.0f);
+                std::fill(counts.begin(), counts.end(), 0);
+                for (int i = 0; i < numSamples; i++)
+                {
+                    const float *vec = data[samples[i]] + offset;
+                    float *sum = &sums[(size_t)assignment[i] * length];
+                    for (int d = 0; d < length; d++)
+                        sum[d] += vec[d];
+                    counts[assignment[i]]++;
+                }
+
+                for (int c = 0; c < m_num_centroids; c++)
+                {
+                    float *centroid = centroids + (size_t)c * length;
+                    if (counts[c] > 0)
+                    {
+                        for (int d = 0; d < length; d++)
+                            centroid[d] = sums[(size_t)c * length + d] / counts[c];
+                    }
+                    else
+                    {
+                        // empty clusters are moved to a random sample
+                        const float *vec = data[samples[subspaceRng() % numSamples]] + offset;
+                        std::copy(vec, vec + length, centroid);
+                    }
+                }
+            }
+        }
+
+        LOG_INFO("trained product quantizer with " << m_num_subspaces << " subspaces and " <<
+                 m_num_centroids << " centroids on " << numSamples << " descriptors");
+    }
+
+    void ProductQuantizer::encode(const float *descriptor, uint8_t *code) const
+    {
+        for (int s = 0; s < m_num_subspaces; s++)
+        {
+            const int offset = m_subspace_offsets[s];
+            const int length = m_subspace_offsets[s + 1] - offset;
+            code[s] = (uint8_t)findNearest(descriptor + offset, getCentroid(s, 0), m_num_centroids, length);
+        }
+    }
+
+    void ProductQuantizer::decode(const uint8_t *code, float *descriptor) const
+    {
+        for (int s = 0; s < m_num_subspaces; s++)
+        {
+            const int offset = m_subspace_offsets[s];
+            const int length = m_subspace_offsets[s + 1] - offset;
+            const float *centroid = getCentroid(s, code[s]);
+            std::copy(centroid, centroid + length, descriptor + offset);
+        }
+    }
+
+    void ProductQuantizer::saveData(boost::archive::binary_oarchive &oa) const
+    {
+        oa << m_dim;
+        oa << m_num_subspaces;
+        oa << m_num_centroids;
+        oa << m_subspace_offsets;
+        oa << m_centroids;
+    }
+
+    bool ProductQuantizer::loadData(boost::archive::binary_iarchive &ia)
+    {
+        ia >> m_dim;
+        ia >> m_num_subspaces;
+        ia >> m_num_centroids;
+        ia >> m_subspace_offsets;
+        ia >> m_centroids;
+
+        return (int)m_subspace_offsets.size() == m_num_subspaces + 1 &&
+                m_centroids.size() == (size_t)m_num_centroids * m_dim;
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_PRODUCT_QUANTIZER_H
+#define ISM3D_PRODUCT_QUANTIZER_H
+
+#include <vector>
+#include <cstdint>
+#include <flann/flann.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace ism3d
+{
+    /**
+     * @brief The ProductQuantizer class
+     * Product quantization (Jegou et al., 2011) of descriptors. The descriptor is split into consecutive
+     * subspaces, each of which is quantized with its own k-means codebook of at most 256 centroids. A
+     * descriptor is thus stored as one byte per subspace. Distances between a query and a code are
+     * approximated by the sum of the distances between the query subvectors and the selected centroids
+     * (asymmetric distance computation), which is exact for all distances that are sums over the dimensions.
+     */
+    class ProductQuantizer
+    {
+    public:
+        ProductQuantizer();
+
+        /**
+         * @brief Learn the subspace centroids with k-means.
+         * @param data the training descriptors, one per row
+         * @param num_subspaces the number of subspaces (i.e. bytes per code)
+         * @param num_centroids the number of centroids per subspace, at most 256
+         * @param iterations the number of k-means iterations
+         * @param max_samples the maximum number of rows used for training, a random subset is used for larger data
+         */
+        void train(const flann::Matrix<float> &data, int num_subspaces, int num_centroids, int iterations, int max_samples);
+
+        /**
+         * @brief Encode a descriptor by the nearest centroid in each subspace.
+         * @param descriptor the descriptor of size getDim()
+         * @param code output: getNumSubspaces() bytes
+         */
+        void encode(const float *descriptor, uint8_t *code) const;
+
+        /**
+         * @brief Reconstruct the approximate descriptor of a code.
+         * @param code the code
+         * @param descriptor output: getDim() values
+         */
+        void decode(const uint8_t *code, float *descriptor) const;
+
+        /**
+         * @brief Compute the table of distances between the query subvectors and all centroids.
+         * @param query the query descriptor
+         * @param distance the flann style distance functor
+         * @param table output: the distance to centroid c of subspace s is at s * getNumCentroids() + c
+         */
+        template<typename T>
+        void computeDistanceTable(const float *query, const T &distance, std::vector<float> &table) const
+        {
+            table.resize((size_t)m_num_subspaces * m_num_centroids);
+            for (int s = 0; s < m_num_subspaces; s++)
+            {
+                const int offset = m_subspace_offsets[s];
+                const int length = m_subspace_offsets[s + 1] - offset;
+                for (int c = 0; c < m_num_centroids; c++)
+                    table[s * m_num_centroids + c] = distance(query + offset, getCentroid(s, c), length);
+            }
+        }
+
+        // approximate distance of a code with a table from computeDistanceTable()
+        float getDistance(const std::vector<float> &table, const uint8_t *code) const
+        {
+            float result = 0;
+            for (int s = 0; s < m_num_subspaces; s++)
+                result += table[s * m_num_centroids + code[s]];
+            return result;
+        }
+
+        bool isTrained() const
+        {
+            return m_num_subspaces > 0;
+        }
+
+        int getDim() const
+        {
+            return m_dim;
+        }
+
+        int getNumSubspaces() const
+        {
+            return m_num_subspaces;
+        }
+
+        int getNumCentroids() const
+        {
+            return m_num_centroids;
+        }
+
+        void saveData(boost::archive::binary_oarchive &oa) const;
+        bool loadData(boost::archive::binary_iarchive &ia);
+
+    private:
+        const float* getCentroid(int subspace, int centroid) const
+        {
+            const int offset = m_subspace_offsets[subspace];
+            const int length = m_subspace_offsets[subspace + 1] - offset;
+            return &m_centroids[(size_t)m_num_centroids * offset + (size_t)centroid * length];
+        }
+
+        int m_dim;
+        int m_num_subspaces;
+        int m_num_centroids;
+
+        // subspace s covers the dimensions [m_subspace_offsets[s], m_subspace_offsets[s+1])
+        std::vector<int> m_subspace_offsets;
+
+        // centroids of each subspace are stored contiguously, subspace by subspace
+        std::vector<float> m_centroids;
+    };
+}
+
+#endif // ISM3D_PRODUCT_QUANTIZER_H
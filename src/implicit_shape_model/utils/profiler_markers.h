@@ -0,0 +1,128 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_PROFILER_MARKERS_H
+#define ISM3D_PROFILER_MARKERS_H
+
+// ISM3D_PROFILER_MARKERS selects the markers at compile time, see the CMake option of the same name:
+// 1 emits USDT probes (perf, bpftrace, SystemTap), 2 emits ITT tasks (VTune), 0 or undefined compiles them out
+#ifndef ISM3D_PROFILER_MARKERS
+#define ISM3D_PROFILER_MARKERS 0
+#endif
+
+#if ISM3D_PROFILER_MARKERS == 1
+#include <sys/sdt.h>
+#elif ISM3D_PROFILER_MARKERS == 2
+#include <ittnotify.h>
+#endif
+
+namespace ism3d
+{
+    /**
+     * @brief The ProfilerStage class
+     * Marks a stage of training or detection for external sampling profilers from its construction to its
+     * destruction or to stop(), so that samples can be attributed to stages and classes. USDT probes are
+     * ism3d:stage_begin and ism3d:stage_end with the stage name and the class id (-1: all classes) as arguments.
+     * ITT tasks are named after the stage in the domain "ism3d" and carry the class id as metadata. The stage name
+     * has to outlive the marker, e.g. a string literal. Without markers compiled in, the class is empty.
+     */
+    class ProfilerStage
+    {
+    public:
+        // a marker that is not started, see next()
+        ProfilerStage()
+#if ISM3D_PROFILER_MARKERS != 0
+            : m_stage(0), m_class_id(-1)
+#endif
+        {
+        }
+
+        explicit ProfilerStage(const char *stage, int classId = -1)
+#if ISM3D_PROFILER_MARKERS != 0
+            : m_stage(0), m_class_id(-1)
+        {
+            begin(stage, classId);
+        }
+#else
+        {
+            (void)stage;
+            (void)classId;
+        }
+#endif
+
+        ~ProfilerStage()
+        {
+            stop();
+        }
+
+        // ends the current stage and begins the next one
+        void next(const char *stage, int classId = -1)
+        {
+            stop();
+#if ISM3D_PROFILER_MARKERS != 0
+            begin(stage, classId);
+#else
+            (void)stage;
+            (void)classId;
+#endif
+        }
+
+        // ends the stage if not ended before
+        void stop()
+        {
+#if ISM3D_PROFILER_MARKERS == 1
+            if (m_stage)
+                DTRACE_PROBE2(ism3d, stage_end, m_stage, m_class_id);
+#elif ISM3D_PROFILER_MARKERS == 2
+            if (m_stage)
+                __itt_task_end(getDomain());
+#endif
+#if ISM3D_PROFILER_MARKERS != 0
+            m_stage = 0;
+#endif
+        }
+
+    private:
+        ProfilerStage(const ProfilerStage&) = delete;
+        ProfilerStage& operator=(const ProfilerStage&) = delete;
+
+#if ISM3D_PROFILER_MARKERS != 0
+        void begin(const char *stage, int classId)
+        {
+            m_stage = stage;
+            m_class_id = classId;
+#if ISM3D_PROFILER_MARKERS == 1
+            DTRACE_PROBE2(ism3d, stage_begin, m_stage, m_class_id);
+#else
+            __itt_task_begin(getDomain(), __itt_null, __itt_null, __itt_string_handle_create(m_stage));
+            if (m_class_id >= 0)
+            {
+                static __itt_string_handle *classKey = __itt_string_handle_create("class");
+                long long classId64 = m_class_id;
+                __itt_metadata_add(getDomain(), __itt_null, classKey, __itt_metadata_s64, 1, &classId64);
+            }
+#endif
+        }
+
+        const char *m_stage; // 0 if stopped
+        int m_class_id;
+#endif
+
+#if ISM3D_PROFILER_MARKERS == 2
+        static __itt_domain* getDomain()
+        {
+            static __itt_domain *domain = __itt_domain_create("ism3d");
+            return domain;
+        }
+#endif
+    };
+}
+
+#endif // ISM3D_PROFILER_MARKERS_H
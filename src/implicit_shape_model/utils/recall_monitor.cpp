@@ -0,0 +1,201 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "recall_monitor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace ism3d
+{
+    RecallMonitor::RecallMonitor()
+        : m_sample_rate(0), m_max_pending(0), m_sample_position(0), m_pending(0), m_busy(false), m_stopping(false),
+          m_samples(0), m_dropped(0), m_expected(0), m_found(0), m_ratios(0), m_ratio_sum(0), m_ratio_max(0)
+    {
+    }
+
+    RecallMonitor::~RecallMonitor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_changed.notify_all();
+        if (m_thread.joinable())
+            m_thread.join();
+    }
+
+    void RecallMonitor::configure(float sampleRate, int maxPending)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_sample_rate = std::min(std::max(sampleRate, 0.0f), 1.0f);
+        m_max_pending = std::max(maxPending, 1);
+    }
+
+    std::vector<int> RecallMonitor::selectSamples(int numQueries)
+    {
+        std::vector<int> rows;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_sample_rate <= 0)
+            return rows;
+
+        // a query is sampled whenever the position passes the next integer
+        for (int i = 0; i < numQueries; i++)
+        {
+            const double next = m_sample_position + m_sample_rate;
+            if (std::floor(next) > std::floor(m_sample_position))
+                rows.push_back(i);
+            m_sample_position = next;
+        }
+        return rows;
+    }
+
+    void RecallMonitor::submit(std::vector<Sample> &samples, int k, float radius, const ExactSearch &search)
+    {
+        if (samples.empty() || k <= 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_pending + (int)samples.size() > m_max_pending)
+            {
+                m_dropped += (long)samples.size();
+                return;
+            }
+
+            Job job;
+            job.samples.swap(samples);
+            job.k = k;
+            job.radius = radius;
+            job.search = search;
+            m_pending += (int)job.samples.size();
+            m_jobs.push_back(std::move(job));
+            if (!m_thread.joinable())
+                m_thread = std::thread(&RecallMonitor::run, this);
+        }
+        m_changed.notify_all();
+    }
+
+    RecallMonitor::Statistics RecallMonitor::getStatistics() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Statistics statistics;
+        statistics.samples = m_samples;
+        statistics.dropped = m_dropped;
+        statistics.recall = m_expected > 0 ? (double)m_found / m_expected : 0.0;
+        statistics.meanDistanceRatio = m_ratios > 0 ? m_ratio_sum / m_ratios : 0.0;
+        statistics.maxDistanceRatio = m_ratio_max;
+        return statistics;
+    }
+
+    void RecallMonitor::flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() { return m_jobs.empty() && !m_busy; });
+    }
+
+    void RecallMonitor::resetCounters()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_samples = 0;
+        m_dropped = 0;
+        m_expected = 0;
+        m_found = 0;
+        m_ratios = 0;
+        m_ratio_sum = 0;
+        m_ratio_max = 0;
+    }
+
+    void RecallMonitor::run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+            m_changed.wait(lock, [this]() { return m_stopping || !m_jobs.empty(); });
+            if (m_stopping)
+                return;
+
+            Job job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            m_busy = true;
+            lock.unlock();
+            evaluate(job);
+            lock.lock();
+            m_busy = false;
+            m_pending -= (int)job.samples.size();
+            m_changed.notify_all();
+        }
+    }
+
+    void RecallMonitor::evaluate(const Job &job)
+    {
+        long samples = 0;
+        long expected = 0;
+        long found = 0;
+        long ratios = 0;
+        double ratioSum = 0;
+        double ratioMax = 0;
+
+        std::vector<float> distances;
+        std::vector<int> order;
+        for (const Sample &sample : job.samples)
+        {
+            job.search(sample.descriptor.data(), (int)sample.descriptor.size(), distances);
+
+            // the exact neighbors: the k nearest codewords closer than the radius
+            order.resize(distances.size());
+            std::iota(order.begin(), order.end(), 0);
+            const int k = std::min(job.k, (int)order.size());
+            std::partial_sort(order.begin(), order.begin() + k, order.end(), [&distances](int a, int b)
+            {
+                return distances[a] < distances[b] || (distances[a] == distances[b] && a < b);
+            });
+            int numExact = 0;
+            while (numExact < k && distances[order[numExact]] < job.radius)
+                numExact++;
+            if (numExact == 0)
+                continue;
+
+            // codewords at the same distance as the last exact neighbor are as good as the exact ones
+            const float lastExact = distances[order[numExact - 1]];
+            int numFound = 0;
+            float lastFound = 0;
+            for (int index : sample.approximate)
+            {
+                if (index < 0 || index >= (int)distances.size())
+                    continue;
+                if (distances[index] <= lastExact)
+                    numFound++;
+                lastFound = std::max(lastFound, distances[index]);
+            }
+
+            samples++;
+            expected += numExact;
+            found += std::min(numFound, numExact);
+            if (!sample.approximate.empty() && lastExact > 0)
+            {
+                const double ratio = (double)lastFound / lastExact;
+                ratios++;
+                ratioSum += ratio;
+                ratioMax = std::max(ratioMax, ratio);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_samples += samples;
+        m_expected += expected;
+        m_found += found;
+        m_ratios += ratios;
+        m_ratio_sum += ratioSum;
+        m_ratio_max = std::max(m_ratio_max, ratioMax);
+    }
+}
@@ -0,0 +1,134 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_RECALL_MONITOR_H
+#define ISM3D_RECALL_MONITOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The RecallMonitor class
+     * Measures the recall of the approximate codeword search during detection. A fraction of the activation
+     * queries is sampled and searched exhaustively on a background thread, the exact neighbors are compared with
+     * the neighbors found by the index. Detections never wait for the exact searches: if too many samples are
+     * pending, new samples are dropped. The statistics are accumulated over all detections, so they lag behind the
+     * last detection by the pending samples.
+     */
+    class RecallMonitor
+    {
+    public:
+        // a sampled query with the codewords activated by the approximate search
+        struct Sample
+        {
+            std::vector<float> descriptor;
+            std::vector<int> approximate;
+        };
+
+        // computes the distances of a descriptor to all codewords of the searched index
+        typedef std::function<void(const float *descriptor, int dim, std::vector<float> &distances)> ExactSearch;
+
+        struct Statistics
+        {
+            Statistics()
+                : samples(0), dropped(0), recall(0), meanDistanceRatio(0), maxDistanceRatio(0)
+            {
+            }
+
+            long samples;              // sampled queries with at least one exact neighbor
+            long dropped;              // sampled queries dropped while too many samples were pending
+            double recall;             // fraction of the exact neighbors that were found, recall@k
+            double meanDistanceRatio;  // mean ratio of the distances of the last found and the last exact neighbor
+            double maxDistanceRatio;
+        };
+
+        RecallMonitor();
+        ~RecallMonitor();
+
+        /**
+         * @brief Set the fraction of the queries that are sampled.
+         * @param sampleRate the fraction, 0 disables the monitor
+         * @param maxPending the maximum number of sampled queries waiting for their exact search
+         */
+        void configure(float sampleRate, int maxPending);
+
+        bool isEnabled() const
+        {
+            return m_sample_rate > 0;
+        }
+
+        /**
+         * @brief Select the queries of a search to sample. The samples are spread evenly over all queries seen by
+         * the monitor, so that the sampled fraction is exact even for small searches.
+         * @param numQueries the number of queries of the search
+         * @return the rows of the sampled queries
+         */
+        std::vector<int> selectSamples(int numQueries);
+
+        /**
+         * @brief Queue the exact search of sampled queries, the search runs on the thread of the monitor.
+         * @param samples the sampled queries, moved from
+         * @param k the number of nearest neighbors of the approximate search
+         * @param radius only neighbors closer than radius are expected, e.g. of a radius search
+         * @param search the exhaustive search, must keep the codewords it uses alive
+         */
+        void submit(std::vector<Sample> &samples, int k, float radius, const ExactSearch &search);
+
+        Statistics getStatistics() const;
+
+        // waits until all queued samples are searched
+        void flush();
+
+        void resetCounters();
+
+    private:
+        struct Job
+        {
+            std::vector<Sample> samples;
+            int k;
+            float radius;
+            ExactSearch search;
+        };
+
+        RecallMonitor(const RecallMonitor&) = delete;
+        RecallMonitor& operator=(const RecallMonitor&) = delete;
+
+        void run();
+        void evaluate(const Job &job);
+
+        float m_sample_rate;
+        int m_max_pending;
+        double m_sample_position; // queries seen times the sample rate
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::deque<Job> m_jobs;
+        int m_pending;
+        bool m_busy;
+        bool m_stopping;
+        std::thread m_thread; // started with the first job
+
+        long m_samples;
+        long m_dropped;
+        long m_expected;
+        long m_found;
+        long m_ratios;
+        double m_ratio_sum;
+        double m_ratio_max;
+    };
+}
+
+#endif // ISM3D_RECALL_MONITOR_H
@@ -0,0 +1,89 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_REGION_OF_INTEREST_H
+#define ISM3D_REGION_OF_INTEREST_H
+
+#include <vector>
+#include <Eigen/Core>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The RegionOfInterest class
+     * The union of oriented boxes in which objects are searched. A box is given as Utils::BoundingBox with the full
+     * edge lengths as size, rotated by its quaternion around its center. An empty region contains every point.
+     */
+    class RegionOfInterest
+    {
+    public:
+        RegionOfInterest()
+        {
+        }
+
+        explicit RegionOfInterest(const std::vector<Utils::BoundingBox> &boxes)
+        {
+            m_boxes.reserve(boxes.size());
+            for (const Utils::BoundingBox &box : boxes)
+            {
+                // rotation into the box frame, the inverse of the rotation of the box
+                Box localBox;
+                localBox.center = box.position;
+                for (int c = 0; c < 3; c++)
+                {
+                    Eigen::Vector3f axis = Eigen::Vector3f::Unit(c);
+                    Utils::quatRotateInv(box.rotQuat, axis);
+                    localBox.rotation.col(c) = axis;
+                }
+                localBox.halfSize = box.size.cwiseAbs() * 0.5f;
+                m_boxes.push_back(localBox);
+            }
+        }
+
+        bool empty() const
+        {
+            return m_boxes.empty();
+        }
+
+        /**
+         * @brief Check whether a point lies in one of the boxes.
+         * @param point the point
+         * @param margin distance by which each box is enlarged in all directions
+         * @return true if the point is inside or the region is empty
+         */
+        bool contains(const Eigen::Vector3f &point, float margin = 0) const
+        {
+            if (m_boxes.empty())
+                return true;
+
+            for (const Box &box : m_boxes)
+            {
+                Eigen::Vector3f local = box.rotation * (point - box.center);
+                if ((local.cwiseAbs() - box.halfSize).maxCoeff() <= margin)
+                    return true;
+            }
+            return false;
+        }
+
+    private:
+        struct Box
+        {
+            Eigen::Vector3f center;
+            Eigen::Matrix3f rotation;
+            Eigen::Vector3f halfSize;
+        };
+
+        std::vector<Box> m_boxes;
+    };
+}
+
+#endif // ISM3D_REGION_OF_INTEREST_H
@@ -0,0 +1,131 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "scalar_quantizer.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+namespace ism3d
+{
+    ScalarQuantizer::ScalarQuantizer()
+        : m_dim(0), m_precision(FP16),
+          m_half_kernel(DistanceKernels::euclideanHalf()), m_byte_kernel(DistanceKernels::euclideanByte())
+    {
+    }
+
+    void ScalarQuantizer::train(const flann::Matrix<float> &data, Precision precision)
+    {
+        m_dim = (int)data.cols;
+        m_precision = precision;
+        m_offsets.clear();
+        m_scales.clear();
+        if (m_precision != UInt8)
+            return;
+
+        std::vector<float> minValues(m_dim, std::numeric_limits<float>::max());
+        std::vector<float> maxValues(m_dim, -std::numeric_limits<float>::max());
+        for (size_t row = 0; row < data.rows; row++)
+        {
+            for (int i = 0; i < m_dim; i++)
+            {
+                minValues[i] = std::min(minValues[i], data[row][i]);
+                maxValues[i] = std::max(maxValues[i], data[row][i]);
+            }
+        }
+
+        m_offsets.resize(m_dim, 0);
+        m_scales.resize(m_dim, 0);
+        for (int i = 0; i < m_dim && data.rows > 0; i++)
+        {
+            m_offsets[i] = minValues[i];
+            m_scales[i] = (maxValues[i] - minValues[i]) / 255.0f;
+        }
+    }
+
+    void ScalarQuantizer::encode(const float *descriptor, uint8_t *code) const
+    {
+        if (m_precision == FP16)
+        {
+            for (int i = 0; i < m_dim; i++)
+            {
+                uint16_t value = DistanceKernels::floatToHalf(descriptor[i]);
+                std::memcpy(code + i * sizeof(uint16_t), &value, sizeof(uint16_t));
+            }
+            return;
+        }
+
+        if (m_precision == Binary)
+        {
+            std::memset(code, 0, getCodeSize());
+            for (int i = 0; i < m_dim; i++)
+            {
+                if (descriptor[i] > 0.5f)
+                    code[i / 8] |= (uint8_t)(1 << (i % 8));
+            }
+            return;
+        }
+
+        for (int i = 0; i < m_dim; i++)
+        {
+            float value = m_scales[i] > 0 ? std::round((descriptor[i] - m_offsets[i]) / m_scales[i]) : 0.0f;
+            code[i] = (uint8_t)std::max(0.0f, std::min(255.0f, value));
+        }
+    }
+
+    void ScalarQuantizer::decode(const uint8_t *code, float *descriptor) const
+    {
+        if (m_precision == FP16)
+        {
+            for (int i = 0; i < m_dim; i++)
+            {
+                uint16_t value;
+                std::memcpy(&value, code + i * sizeof(uint16_t), sizeof(uint16_t));
+                descriptor[i] = DistanceKernels::halfToFloat(value);
+            }
+            return;
+        }
+
+        if (m_precision == Binary)
+        {
+            for (int i = 0; i < m_dim; i++)
+                descriptor[i] = (code[i / 8] >> (i % 8)) & 1 ? 1.0f : 0.0f;
+            return;
+        }
+
+        for (int i = 0; i < m_dim; i++)
+            descriptor[i] = m_offsets[i] + m_scales[i] * code[i];
+    }
+
+    void ScalarQuantizer::saveData(boost::archive::binary_oarchive &oa) const
+    {
+        int precision = (int)m_precision;
+        oa << m_dim;
+        oa << precision;
+        oa << m_offsets;
+        oa << m_scales;
+    }
+
+    bool ScalarQuantizer::loadData(boost::archive::binary_iarchive &ia)
+    {
+        int precision;
+        ia >> m_dim;
+        ia >> precision;
+        ia >> m_offsets;
+        ia >> m_scales;
+        m_precision = (Precision)precision;
+
+        if (m_precision == FP16 || m_precision == Binary)
+            return m_offsets.empty() && m_scales.empty();
+        return precision == (int)UInt8 && (int)m_offsets.size() == m_dim && (int)m_scales.size() == m_dim;
+    }
+}
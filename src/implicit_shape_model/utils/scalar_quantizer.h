@@ -0,0 +1,133 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SCALAR_QUANTIZER_H
+#define ISM3D_SCALAR_QUANTIZER_H
+
+#include <vector>
+#include <cstdint>
+#include <flann/flann.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "distance_kernels.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ScalarQuantizer class
+     * Stores each dimension of a descriptor with reduced precision: either as half precision float (2 bytes) or
+     * as one byte with a per dimension offset and scale learned from the range of the training data. Normalized
+     * histogram descriptors lose little accuracy in both cases. Binary descriptors stored as floats with values 0
+     * and 1 are packed into one bit per dimension without loss, values above 0.5 are set bits as in BinaryHamming.
+     * The squared euclidean distance is computed on the byte and half precision codes directly, all other distances
+     * on the decoded descriptor.
+     */
+    class ScalarQuantizer
+    {
+    public:
+        enum Precision
+        {
+            FP16,
+            UInt8,
+            Binary
+        };
+
+        ScalarQuantizer();
+
+        /**
+         * @brief Learn the per dimension range for byte codes, half precision and binary codes do not need training.
+         * @param data the training descriptors, one per row
+         * @param precision the storage precision
+         */
+        void train(const flann::Matrix<float> &data, Precision precision);
+
+        /**
+         * @brief Encode a descriptor, values outside of the trained range are clamped.
+         * @param descriptor the descriptor of size getDim()
+         * @param code output: getCodeSize() bytes
+         */
+        void encode(const float *descriptor, uint8_t *code) const;
+
+        /**
+         * @brief Reconstruct the approximate descriptor of a code.
+         * @param code the code
+         * @param descriptor output: getDim() values
+         */
+        void decode(const uint8_t *code, float *descriptor) const;
+
+        /**
+         * @brief Compute the distance between a query and a code.
+         * @param query the query descriptor
+         * @param code the code
+         * @param distance the flann style distance functor
+         * @param buffer getDim() values for the decoded descriptor
+         */
+        template<typename T>
+        float getDistance(const float *query, const uint8_t *code, const T &distance, float *buffer) const
+        {
+            decode(code, buffer);
+            return distance(query, buffer, m_dim);
+        }
+
+        // the squared euclidean distance does not need to decode the code
+        float getDistance(const float *query, const uint8_t *code, const flann::L2<float> &distance, float *buffer) const
+        {
+            if (m_precision == FP16)
+                return m_half_kernel(query, reinterpret_cast<const uint16_t*>(code), m_dim);
+            if (m_precision == Binary)
+            {
+                decode(code, buffer);
+                return distance(query, buffer, m_dim);
+            }
+            return m_byte_kernel(query, code, m_offsets.data(), m_scales.data(), m_dim);
+        }
+
+        bool isTrained() const
+        {
+            return m_dim > 0;
+        }
+
+        int getDim() const
+        {
+            return m_dim;
+        }
+
+        Precision getPrecision() const
+        {
+            return m_precision;
+        }
+
+        // number of bytes per code
+        int getCodeSize() const
+        {
+            if (m_precision == Binary)
+                return (m_dim + 7) / 8;
+            return m_precision == FP16 ? m_dim * (int)sizeof(uint16_t) : m_dim;
+        }
+
+        void saveData(boost::archive::binary_oarchive &oa) const;
+        bool loadData(boost::archive::binary_iarchive &ia);
+
+    private:
+        int m_dim;
+        Precision m_precision;
+
+        // byte code c of dimension i represents the value m_offsets[i] + m_scales[i] * c
+        std::vector<float> m_offsets;
+        std::vector<float> m_scales;
+
+        DistanceKernels::HalfKernel m_half_kernel;
+        DistanceKernels::ByteKernel m_byte_kernel;
+    };
+}
+
+#endif // ISM3D_SCALAR_QUANTIZER_H
@@ -0,0 +1,194 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "shape_context.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <omp.h>
+
+#include <pcl/common/point_tests.h>
+
+namespace ism3d
+{
+    ShapeContext::ShapeContext(int azimuthBins, int elevationBins, int radiusBins, float minRadius, float radius)
+        : m_azimuth_bins(azimuthBins), m_elevation_bins(elevationBins), m_radius_bins(radiusBins), m_radius(radius)
+    {
+        // logarithmic radii between the minimal and the descriptor radius
+        std::vector<float> radii(radiusBins + 1);
+        for (int j = 0; j <= radiusBins; j++)
+            radii[j] = std::exp(std::log(minRadius) + ((float)j / radiusBins) * std::log(radius / minRadius));
+        for (int j = 1; j <= radiusBins; j++)
+            m_sqr_radii.push_back(radii[j] * radii[j]);
+
+        const float elevationStep = 180.0f / elevationBins;
+        for (int k = 1; k <= elevationBins; k++)
+            m_cos_elevations.push_back(std::cos(Utils::deg2rad(k * elevationStep)));
+
+        // an azimuth boundary of at least 180 degrees contains the whole upper half plane
+        const float azimuthStep = 360.0f / azimuthBins;
+        for (int l = 1; l <= azimuthBins; l++)
+        {
+            m_cos_azimuths.push_back(std::cos(Utils::deg2rad(l * azimuthStep)));
+            m_reaches_lower_half.push_back(l * azimuthStep >= 180.0f);
+        }
+
+        const float azimuthVolume = Utils::deg2rad(azimuthStep);
+        m_volume_weights.resize(elevationBins * radiusBins);
+        for (int k = 0; k < elevationBins; k++)
+        {
+            const float elevationVolume = std::cos(Utils::deg2rad(k * elevationStep)) - std::cos(Utils::deg2rad((k + 1) * elevationStep));
+            for (int j = 0; j < radiusBins; j++)
+            {
+                const float radiusVolume = (radii[j + 1] * radii[j + 1] * radii[j + 1] - radii[j] * radii[j] * radii[j]) / 3.0f;
+                m_volume_weights[k * radiusBins + j] = 1.0f / std::cbrt(azimuthVolume * elevationVolume * radiusVolume);
+            }
+        }
+    }
+
+    const ShapeContext &ShapeContext::get(int azimuthBins, int elevationBins, int radiusBins, float minRadius, float radius)
+    {
+        typedef std::tuple<int, int, int, float, float> Key;
+        static std::map<Key, std::unique_ptr<ShapeContext> > tables;
+        static std::mutex mutex;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::unique_ptr<ShapeContext> &table = tables[Key(azimuthBins, elevationBins, radiusBins, minRadius, radius)];
+        if (!table)
+            table.reset(new ShapeContext(azimuthBins, elevationBins, radiusBins, minRadius, radius));
+        return *table;
+    }
+
+    int ShapeContext::getSize() const
+    {
+        return m_azimuth_bins * m_elevation_bins * m_radius_bins;
+    }
+
+    int ShapeContext::getBin(float x, float y, float z, float sqrDist) const
+    {
+        // the first bin whose upper boundary contains the neighbor, the first bin if none does
+        int j = std::lower_bound(m_sqr_radii.begin(), m_sqr_radii.end(), sqrDist) - m_sqr_radii.begin();
+        if (j == m_radius_bins)
+            j = 0;
+
+        const float cosElevation = std::max(-1.0f, std::min(1.0f, z / std::sqrt(sqrDist)));
+        int k = 0;
+        for (int ang = 0; ang < m_elevation_bins; ang++)
+        {
+            if (cosElevation >= m_cos_elevations[ang])
+            {
+                k = ang;
+                break;
+            }
+        }
+
+        // the azimuth is measured counterclockwise from the x axis, neighbors on the z axis have none
+        int l = 0;
+        const float sqrPlanar = x * x + y * y;
+        if (sqrPlanar > 0)
+        {
+            const float cosAzimuth = x / std::sqrt(sqrPlanar);
+            for (int ang = 0; ang < m_azimuth_bins; ang++)
+            {
+                const bool inside = y >= 0 ? m_reaches_lower_half[ang] || cosAzimuth >= m_cos_azimuths[ang]
+                                           : m_reaches_lower_half[ang] && cosAzimuth <= m_cos_azimuths[ang];
+                if (inside)
+                {
+                    l = ang;
+                    break;
+                }
+            }
+        }
+
+        return (l * m_elevation_bins + k) * m_radius_bins + j;
+    }
+
+    void ShapeContext::compute(const pcl::PointCloud<PointT> &surface, const pcl::PointCloud<PointT> &keypoints,
+                               pcl::search::Search<PointT> &search, float densityRadius, const FrameFunction &frames,
+                               int numThreads, std::vector<float> &descriptors) const
+    {
+        const int numKeypoints = (int)keypoints.size();
+        const int size = getSize();
+        descriptors.assign((size_t)numKeypoints * size, 0.0f);
+
+        std::vector<std::vector<int> > neighbors(numKeypoints);
+        std::vector<std::vector<float> > sqrDists(numKeypoints);
+        std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > xAxes(numKeypoints);
+        std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f> > zAxes(numKeypoints);
+        std::vector<char> valid(numKeypoints, 0);
+
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(numThreads)
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (!pcl::isFinite(keypoints.points[i]) ||
+                    search.radiusSearch(keypoints.points[i], m_radius, neighbors[i], sqrDists[i]) == 0)
+                continue;
+            valid[i] = frames(i, neighbors[i], sqrDists[i], xAxes[i], zAxes[i]);
+        }
+
+        // the density of a surface point is shared by all keypoints it is a neighbor of
+        std::vector<int> density(surface.size(), 0);
+        std::vector<char> needed(surface.size(), 0);
+        std::vector<int> densityPoints;
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            if (!valid[i])
+                continue;
+            for (int index : neighbors[i])
+            {
+                if (!needed[index])
+                {
+                    needed[index] = 1;
+                    densityPoints.push_back(index);
+                }
+            }
+        }
+
+        #pragma omp parallel for schedule(dynamic, 64) num_threads(numThreads)
+        for (int n = 0; n < (int)densityPoints.size(); n++)
+        {
+            std::vector<int> indices;
+            std::vector<float> distances;
+            density[densityPoints[n]] = search.radiusSearch(surface.points[densityPoints[n]], densityRadius, indices, distances);
+        }
+
+        const int volumes = m_elevation_bins * m_radius_bins;
+        #pragma omp parallel for schedule(dynamic, 16) num_threads(numThreads)
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            float *descriptor = descriptors.data() + (size_t)i * size;
+            if (!valid[i])
+            {
+                std::fill(descriptor, descriptor + size, std::numeric_limits<float>::quiet_NaN());
+                continue;
+            }
+
+            const Eigen::Vector3f origin = keypoints.points[i].getVector3fMap();
+            const Eigen::Vector3f &xAxis = xAxes[i];
+            const Eigen::Vector3f &zAxis = zAxes[i];
+            const Eigen::Vector3f yAxis = zAxis.cross(xAxis);
+            for (int n = 0; n < (int)neighbors[i].size(); n++)
+            {
+                const int index = neighbors[i][n];
+                if (sqrDists[i][n] == 0 || density[index] == 0)
+                    continue;
+
+                const Eigen::Vector3f offset = surface.points[index].getVector3fMap() - origin;
+                const int bin = getBin(offset.dot(xAxis), offset.dot(yAxis), offset.dot(zAxis), sqrDists[i][n]);
+                descriptor[bin] += m_volume_weights[bin % volumes] / density[index];
+            }
+        }
+    }
+}
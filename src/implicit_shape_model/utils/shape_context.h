@@ -0,0 +1,108 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SHAPE_CONTEXT_H
+#define ISM3D_SHAPE_CONTEXT_H
+
+#include <functional>
+#include <vector>
+
+#include <pcl/point_cloud.h>
+#include <pcl/search/search.h>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ShapeContext class
+     * Histogram computation of 3D shape context descriptors (3DSC and USC): the sphere around a keypoint is split
+     * into azimuth, elevation and logarithmic radius bins, each neighbor adds the inverse of the local point density
+     * of its position, scaled by the inverse cube root of the volume of its bin. The bin boundaries are stored as
+     * squared radii, cosines of the elevations and directions of the azimuths, so that a neighbor is assigned to its
+     * bin without logarithms and inverse trigonometric functions. The tables only depend on the number of bins and
+     * the radii, the tables of local descriptors are computed once per configuration and shared by all calls. The
+     * point density of each surface point is computed at most once per call, even if it is a neighbor of many
+     * keypoints.
+     */
+    class ShapeContext
+    {
+    public:
+        /**
+         * @brief Callback that computes the local reference frame of a keypoint.
+         * @param keypoint the index of the keypoint
+         * @param indices the indices of the neighbors on the surface
+         * @param sqrDists the squared distances of the neighbors to the keypoint
+         * @param xAxis output: the azimuth reference
+         * @param zAxis output: the elevation reference, orthogonal to xAxis
+         * @return false if the keypoint has no valid frame, its descriptor is NaN
+         */
+        typedef std::function<bool(int keypoint, const std::vector<int> &indices, const std::vector<float> &sqrDists,
+                                   Eigen::Vector3f &xAxis, Eigen::Vector3f &zAxis)> FrameFunction;
+
+        /**
+         * @brief Create the tables of a configuration.
+         * @param azimuthBins the number of azimuth bins
+         * @param elevationBins the number of elevation bins
+         * @param radiusBins the number of radius bins
+         * @param minRadius the inner radius of the first radius bin
+         * @param radius the descriptor radius
+         */
+        ShapeContext(int azimuthBins, int elevationBins, int radiusBins, float minRadius, float radius);
+
+        /**
+         * @brief Get the shared tables of a configuration with a fixed radius, they are created on first use.
+         * @param azimuthBins the number of azimuth bins
+         * @param elevationBins the number of elevation bins
+         * @param radiusBins the number of radius bins
+         * @param minRadius the inner radius of the first radius bin
+         * @param radius the descriptor radius
+         * @return the shared tables
+         */
+        static const ShapeContext &get(int azimuthBins, int elevationBins, int radiusBins, float minRadius, float radius);
+
+        // the length of the descriptors
+        int getSize() const;
+
+        /**
+         * @brief Compute the descriptors of keypoints in parallel.
+         * @param surface the search surface
+         * @param keypoints the keypoints
+         * @param search a search whose input cloud is the surface, it is used concurrently
+         * @param densityRadius the radius of the point density of a neighbor
+         * @param frames computes the local reference frame of each keypoint, called concurrently
+         * @param numThreads the number of threads
+         * @param descriptors output: the descriptors, one after another, NaN for keypoints without frame
+         */
+        void compute(const pcl::PointCloud<PointT> &surface, const pcl::PointCloud<PointT> &keypoints,
+                     pcl::search::Search<PointT> &search, float densityRadius, const FrameFunction &frames,
+                     int numThreads, std::vector<float> &descriptors) const;
+
+    private:
+        // the bin of a neighbor in local coordinates, with its squared distance to the keypoint
+        int getBin(float x, float y, float z, float sqrDist) const;
+
+        int m_azimuth_bins;
+        int m_elevation_bins;
+        int m_radius_bins;
+        float m_radius;
+
+        // upper boundaries of the bins: squared radii, cosines of the elevations, azimuth directions
+        std::vector<float> m_sqr_radii;
+        std::vector<float> m_cos_elevations;
+        std::vector<float> m_cos_azimuths;
+        std::vector<bool> m_reaches_lower_half;
+
+        // inverse cube root of the volume of each elevation and radius bin, equal for all azimuths
+        std::vector<float> m_volume_weights;
+    };
+}
+
+#endif // ISM3D_SHAPE_CONTEXT_H
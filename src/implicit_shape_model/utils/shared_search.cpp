@@ -0,0 +1,97 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "shared_search.h"
+#include "exception.h"
+
+#include <pcl/search/kdtree.h>
+#include <pcl/search/organized.h>
+
+namespace ism3d
+{
+    SharedSearch::SharedSearch(const EstimatorCache::Ptr &cache)
+        : pcl::search::Search<PointT>("SharedSearch", true),
+          m_cache(cache), m_num_built(0), m_num_reused(0)
+    {
+    }
+
+    void SharedSearch::setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices)
+    {
+        input_ = cloud;
+        indices_ = indices;
+
+        // a subset of a cloud gets its own index that is not kept
+        if (indices || !cloud)
+        {
+            m_current = createSearch(cloud);
+            m_current->setInputCloud(cloud, indices);
+            m_num_built++;
+            return;
+        }
+
+        std::map<const PointCloud*, Index>::iterator it = m_indices.find(cloud.get());
+        if (it == m_indices.end())
+        {
+            Index &index = m_indices[cloud.get()];
+            index.cloud = cloud;
+            index.search = createSearch(cloud);
+            index.search->setInputCloud(cloud);
+            m_current = index.search;
+            m_num_built++;
+        }
+        else
+        {
+            m_current = it->second.search;
+            m_num_reused++;
+        }
+    }
+
+    int SharedSearch::nearestKSearch(const PointT &point, int k, std::vector<int> &k_indices,
+                                     std::vector<float> &k_sqr_distances) const
+    {
+        if (!m_current)
+            throw RuntimeException("shared search is used without input cloud");
+        return m_current->nearestKSearch(point, k, k_indices, k_sqr_distances);
+    }
+
+    int SharedSearch::radiusSearch(const PointT &point, double radius, std::vector<int> &k_indices,
+                                   std::vector<float> &k_sqr_distances, unsigned int max_nn) const
+    {
+        if (!m_current)
+            throw RuntimeException("shared search is used without input cloud");
+        return m_current->radiusSearch(point, radius, k_indices, k_sqr_distances, max_nn);
+    }
+
+    SharedSearch::Ptr SharedSearch::fork() const
+    {
+        // built indices are only searched, which does not change them
+        Ptr search(new SharedSearch(m_cache.lock()));
+        search->m_indices = m_indices;
+        return search;
+    }
+
+    int SharedSearch::getNumBuiltIndices() const
+    {
+        return m_num_built;
+    }
+
+    int SharedSearch::getNumReusedIndices() const
+    {
+        return m_num_reused;
+    }
+
+    pcl::search::Search<PointT>::Ptr SharedSearch::createSearch(const PointCloudConstPtr &cloud) const
+    {
+        EstimatorCache::Ptr cache = m_cache.lock();
+        if (cloud && cloud->isOrganized())
+            return EstimatorCache::acquire<pcl::search::OrganizedNeighbor<PointT> >(cache);
+        return EstimatorCache::acquire<pcl::search::KdTree<PointT> >(cache);
+    }
+}
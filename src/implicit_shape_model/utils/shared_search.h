@@ -0,0 +1,80 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SHARED_SEARCH_H
+#define ISM3D_SHARED_SEARCH_H
+
+#include <map>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+#include <pcl/search/search.h>
+
+#include "utils.h"
+#include "estimator_cache.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The SharedSearch class
+     * Search that owns the spatial index of every cloud it was set to during one detection or training model.
+     * PCL estimators set their surface as input on each call, which rebuilds a kd-tree every time. This search
+     * builds the index of a cloud the first time the cloud is set and reuses it afterwards, so that normals,
+     * keypoints, reference frames, descriptors and the segmentation of global features around maxima share a
+     * single index over the same cloud. Organized clouds are searched with an organized neighbor search, all
+     * other clouds with a kd-tree. Clouds are identified by their address and kept alive by the search. With an
+     * estimator cache the searches are leased from it, so that the next detection reuses them.
+     */
+    class SharedSearch
+            : public pcl::search::Search<PointT>
+    {
+    public:
+        typedef boost::shared_ptr<SharedSearch> Ptr;
+        typedef pcl::search::Search<PointT>::PointCloud PointCloud;
+        typedef pcl::search::Search<PointT>::PointCloudConstPtr PointCloudConstPtr;
+        typedef pcl::search::Search<PointT>::IndicesConstPtr IndicesConstPtr;
+
+        SharedSearch(const EstimatorCache::Ptr &cache = EstimatorCache::Ptr());
+
+        void setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr());
+
+        int nearestKSearch(const PointT &point, int k, std::vector<int> &k_indices,
+                           std::vector<float> &k_sqr_distances) const;
+
+        int radiusSearch(const PointT &point, double radius, std::vector<int> &k_indices,
+                         std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const;
+
+        // a search that shares the indices built so far but selects its input cloud independently, so that
+        // several threads can search the same clouds, indices built later are not shared
+        Ptr fork() const;
+
+        // number of indices that were built and number of times an existing index was reused
+        int getNumBuiltIndices() const;
+        int getNumReusedIndices() const;
+
+    private:
+        struct Index
+        {
+            PointCloudConstPtr cloud; // keeps the cloud alive, so that its address identifies it
+            pcl::search::Search<PointT>::Ptr search;
+        };
+
+        pcl::search::Search<PointT>::Ptr createSearch(const PointCloudConstPtr &cloud) const;
+
+        boost::weak_ptr<EstimatorCache> m_cache; // weak, the cache may keep estimators that keep this search
+        std::map<const PointCloud*, Index> m_indices;
+        pcl::search::Search<PointT>::Ptr m_current;
+
+        int m_num_built;
+        int m_num_reused;
+    };
+}
+
+#endif // ISM3D_SHARED_SEARCH_H
@@ -0,0 +1,372 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "shot_kernels.h"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ISM3D_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+namespace ism3d
+{
+    namespace
+    {
+        const float Pi = 3.14159265358979323846f;
+        const float Rad45 = Pi / 4;
+        const float Rad135 = 3 * Pi / 4;
+        const float RadPi78 = 7 * Pi / 8;
+
+        // neighbors closer than this to the keypoint do not vote
+        const float MinDistance = 1e-15f;
+
+        // smaller coordinates in the local reference frame are set to zero to avoid numerical problems
+        const float MinCoordinate = 1e-30f;
+
+        typedef void (*VolumeKernel)(const float *x, const float *y, const float *z, const float *sqr_dists,
+                                     int begin, int end, int stride, const float *frame, float radius,
+                                     int *volumes, float *weights);
+
+        struct KernelTable
+        {
+            VolumeKernel volumes;
+            const char *name;
+        };
+
+        void computeVolumesScalar(const float *x, const float *y, const float *z, const float *sqr_dists,
+                                  int begin, int end, int stride, const float *frame, float radius,
+                                  int *volumes, float *weights)
+        {
+            const float radius1_4 = radius / 4;
+            const float radius1_2 = radius / 2;
+            const float radius3_4 = radius * 3 / 4;
+
+            for (int i = begin; i < end; i++)
+            {
+                for (int k = 0; k < 4; k++)
+                {
+                    volumes[k * stride + i] = -1;
+                    weights[k * stride + i] = 0;
+                }
+
+                const float distance = std::sqrt(sqr_dists[i]);
+                if (distance < MinDistance)
+                    continue;
+
+                float lx = x[i] * frame[0] + y[i] * frame[1] + z[i] * frame[2];
+                float ly = x[i] * frame[3] + y[i] * frame[4] + z[i] * frame[5];
+                float lz = x[i] * frame[6] + y[i] * frame[7] + z[i] * frame[8];
+                if (std::fabs(lx) < MinCoordinate)
+                    lx = 0;
+                if (std::fabs(ly) < MinCoordinate)
+                    ly = 0;
+                if (std::fabs(lz) < MinCoordinate)
+                    lz = 0;
+
+                // azimuth sector from the quadrant and the octant within the quadrant
+                const int bit4 = (ly > 0 || (ly == 0 && lx < 0)) ? 1 : 0;
+                const int bit3 = (lx > 0 || (lx == 0 && ly > 0)) ? 1 - bit4 : bit4;
+                int volume = (bit4 << 4) + (bit3 << 3);
+                const bool sameSign = (lx > 0 && ly > 0) || (lx < 0 && ly < 0) || lx == 0;
+                if (sameSign ? std::fabs(lx) < std::fabs(ly) : std::fabs(lx) > std::fabs(ly))
+                    volume += 4;
+                volume += lz > 0 ? 1 : 0;
+                volume += distance > radius1_2 ? 2 : 0;
+
+                float weight = 0;
+
+                // interpolation on the distance (adjacent shells)
+                const bool outer = distance > radius1_2;
+                const float radiusDistance = (distance - (outer ? radius3_4 : radius1_4)) / radius1_2;
+                weight += 1 - std::fabs(radiusDistance);
+                if (outer ? distance <= radius3_4 : distance >= radius1_4)
+                {
+                    volumes[stride + i] = outer ? volume - 2 : volume + 2;
+                    weights[stride + i] = std::fabs(radiusDistance);
+                }
+
+                // interpolation on the inclination (adjacent vertical volumes)
+                const float inclination = std::acos(std::max(-1.0f, std::min(1.0f, lz / distance)));
+                const bool lower = lz <= 0;
+                const float inclinationDistance = (inclination - (lower ? Rad135 : Rad45)) / (2 * Rad45);
+                weight += 1 - std::fabs(inclinationDistance);
+                if (lower ? inclination <= Rad135 : inclination >= Rad45)
+                {
+                    volumes[2 * stride + i] = lower ? volume + 1 : volume - 1;
+                    weights[2 * stride + i] = std::fabs(inclinationDistance);
+                }
+
+                // interpolation on the azimuth (adjacent horizontal volumes)
+                if (lx != 0 || ly != 0)
+                {
+                    const float azimuth = std::atan2(ly, lx);
+                    float azimuthDistance = (azimuth - (-RadPi78 + Rad45 * (volume >> 2))) / Rad45;
+                    azimuthDistance = std::max(-0.5f, std::min(azimuthDistance, 0.5f));
+                    weight += 1 - std::fabs(azimuthDistance);
+                    volumes[3 * stride + i] = azimuthDistance > 0 ? (volume + 4) & 31 : (volume + 28) & 31;
+                    weights[3 * stride + i] = std::fabs(azimuthDistance);
+                }
+
+                volumes[i] = volume;
+                weights[i] = weight;
+            }
+        }
+
+#ifdef ISM3D_KERNELS_X86
+        // arc cosine with the polynomial of the cephes single precision arc sine
+        __attribute__((target("avx2,fma")))
+        inline __m256 acosAVX2(__m256 c)
+        {
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 half = _mm256_set1_ps(0.5f);
+            const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+            __m256 a = _mm256_andnot_ps(signMask, c);
+            __m256 large = _mm256_cmp_ps(a, half, _CMP_GT_OQ);
+            __m256 zLarge = _mm256_mul_ps(half, _mm256_sub_ps(one, a));
+            __m256 z = _mm256_blendv_ps(_mm256_mul_ps(a, a), zLarge, large);
+            __m256 s = _mm256_blendv_ps(a, _mm256_sqrt_ps(zLarge), large);
+
+            __m256 p = _mm256_set1_ps(4.2163199048e-2f);
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(2.4181311049e-2f));
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(4.5470025998e-2f));
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(7.4953002686e-2f));
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.6666752422e-1f));
+            p = _mm256_fmadd_ps(_mm256_mul_ps(p, z), s, s); // arc sine of s
+
+            // |c| > 0.5: acos(|c|) = 2 asin(sqrt((1 - |c|) / 2)), otherwise acos(|c|) = pi / 2 - asin(|c|)
+            __m256 result = _mm256_blendv_ps(_mm256_sub_ps(_mm256_set1_ps(Pi / 2), p), _mm256_add_ps(p, p), large);
+            __m256 negative = _mm256_cmp_ps(c, _mm256_setzero_ps(), _CMP_LT_OQ);
+            return _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(Pi), result), negative);
+        }
+
+        // two argument arc tangent with the polynomial of the cephes single precision arc tangent
+        __attribute__((target("avx2,fma")))
+        inline __m256 atan2AVX2(__m256 y, __m256 x)
+        {
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+            __m256 ax = _mm256_andnot_ps(signMask, x);
+            __m256 ay = _mm256_andnot_ps(signMask, y);
+            __m256 swap = _mm256_cmp_ps(ay, ax, _CMP_GT_OQ);
+            __m256 denominator = _mm256_max_ps(_mm256_max_ps(ax, ay), _mm256_set1_ps(1e-37f));
+            __m256 t = _mm256_div_ps(_mm256_min_ps(ax, ay), denominator);
+
+            // reduce to |t| <= tan(pi / 8)
+            __m256 reduce = _mm256_cmp_ps(t, _mm256_set1_ps(0.4142135623730950f), _CMP_GT_OQ);
+            t = _mm256_blendv_ps(t, _mm256_div_ps(_mm256_sub_ps(t, one), _mm256_add_ps(t, one)), reduce);
+            __m256 offset = _mm256_and_ps(reduce, _mm256_set1_ps(Pi / 4));
+
+            __m256 z = _mm256_mul_ps(t, t);
+            __m256 p = _mm256_set1_ps(8.05374449538e-2f);
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-1.38776856032e-1f));
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.99777106478e-1f));
+            p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-3.33329491539e-1f));
+            __m256 result = _mm256_add_ps(_mm256_fmadd_ps(_mm256_mul_ps(p, z), t, t), offset);
+
+            result = _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(Pi / 2), result), swap);
+            result = _mm256_blendv_ps(result, _mm256_sub_ps(_mm256_set1_ps(Pi), result), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+            return _mm256_blendv_ps(result, _mm256_sub_ps(zero, result), _mm256_cmp_ps(y, zero, _CMP_LT_OQ));
+        }
+
+        __attribute__((target("avx2,fma")))
+        inline __m256i maskedInt(__m256 mask, int value)
+        {
+            return _mm256_and_si256(_mm256_castps_si256(mask), _mm256_set1_epi32(value));
+        }
+
+        // volume where the mask is set, -1 otherwise
+        __attribute__((target("avx2,fma")))
+        inline __m256i selectVolume(__m256i volume, __m256 mask)
+        {
+            return _mm256_or_si256(_mm256_and_si256(_mm256_castps_si256(mask), volume),
+                                   _mm256_andnot_si256(_mm256_castps_si256(mask), _mm256_set1_epi32(-1)));
+        }
+
+        __attribute__((target("avx2,fma")))
+        void computeVolumesAVX2(const float *x, const float *y, const float *z, const float *sqr_dists,
+                                int begin, int end, int stride, const float *frame, float radius,
+                                int *volumes, float *weights)
+        {
+            const __m256 zero = _mm256_setzero_ps();
+            const __m256 one = _mm256_set1_ps(1.0f);
+            const __m256 signMask = _mm256_set1_ps(-0.0f);
+            const __m256 minCoordinate = _mm256_set1_ps(MinCoordinate);
+            const __m256 radius1_4 = _mm256_set1_ps(radius / 4);
+            const __m256 radius1_2 = _mm256_set1_ps(radius / 2);
+            const __m256 radius3_4 = _mm256_set1_ps(radius * 3 / 4);
+            const __m256 inverseRadius1_2 = _mm256_set1_ps(2 / radius);
+            const __m256 inverseRad45 = _mm256_set1_ps(1 / Rad45);
+            const __m256 inverseRad90 = _mm256_set1_ps(1 / (2 * Rad45));
+
+            __m256 axis[9];
+            for (int k = 0; k < 9; k++)
+                axis[k] = _mm256_set1_ps(frame[k]);
+
+            int i = begin;
+            for (; i + 8 <= end; i += 8)
+            {
+                __m256 px = _mm256_loadu_ps(x + i);
+                __m256 py = _mm256_loadu_ps(y + i);
+                __m256 pz = _mm256_loadu_ps(z + i);
+                __m256 distance = _mm256_sqrt_ps(_mm256_loadu_ps(sqr_dists + i));
+                __m256 valid = _mm256_cmp_ps(distance, _mm256_set1_ps(MinDistance), _CMP_GE_OQ);
+
+                // projection into the local reference frame
+                __m256 lx = _mm256_fmadd_ps(pz, axis[2], _mm256_fmadd_ps(py, axis[1], _mm256_mul_ps(px, axis[0])));
+                __m256 ly = _mm256_fmadd_ps(pz, axis[5], _mm256_fmadd_ps(py, axis[4], _mm256_mul_ps(px, axis[3])));
+                __m256 lz = _mm256_fmadd_ps(pz, axis[8], _mm256_fmadd_ps(py, axis[7], _mm256_mul_ps(px, axis[6])));
+                __m256 ax = _mm256_andnot_ps(signMask, lx);
+                __m256 ay = _mm256_andnot_ps(signMask, ly);
+                __m256 az = _mm256_andnot_ps(signMask, lz);
+                lx = _mm256_and_ps(lx, _mm256_cmp_ps(ax, minCoordinate, _CMP_GE_OQ));
+                ly = _mm256_and_ps(ly, _mm256_cmp_ps(ay, minCoordinate, _CMP_GE_OQ));
+                lz = _mm256_and_ps(lz, _mm256_cmp_ps(az, minCoordinate, _CMP_GE_OQ));
+                ax = _mm256_andnot_ps(signMask, lx);
+                ay = _mm256_andnot_ps(signMask, ly);
+
+                // azimuth sector from the quadrant and the octant within the quadrant
+                __m256 xPositive = _mm256_cmp_ps(lx, zero, _CMP_GT_OQ);
+                __m256 xNegative = _mm256_cmp_ps(lx, zero, _CMP_LT_OQ);
+                __m256 xZero = _mm256_cmp_ps(lx, zero, _CMP_EQ_OQ);
+                __m256 yPositive = _mm256_cmp_ps(ly, zero, _CMP_GT_OQ);
+                __m256 yNegative = _mm256_cmp_ps(ly, zero, _CMP_LT_OQ);
+                __m256 yZero = _mm256_cmp_ps(ly, zero, _CMP_EQ_OQ);
+                __m256 bit4 = _mm256_or_ps(yPositive, _mm256_and_ps(yZero, xNegative));
+                __m256 bit3 = _mm256_xor_ps(bit4, _mm256_or_ps(xPositive, _mm256_and_ps(xZero, yPositive)));
+                __m256 sameSign = _mm256_or_ps(_mm256_or_ps(_mm256_and_ps(xPositive, yPositive),
+                                                            _mm256_and_ps(xNegative, yNegative)), xZero);
+                __m256 octant = _mm256_blendv_ps(_mm256_cmp_ps(ax, ay, _CMP_GT_OQ), _mm256_cmp_ps(ax, ay, _CMP_LT_OQ), sameSign);
+                __m256 outer = _mm256_cmp_ps(distance, radius1_2, _CMP_GT_OQ);
+
+                __m256i volume = _mm256_add_epi32(maskedInt(bit4, 16), maskedInt(bit3, 8));
+                volume = _mm256_add_epi32(volume, maskedInt(octant, 4));
+                volume = _mm256_add_epi32(volume, maskedInt(_mm256_cmp_ps(lz, zero, _CMP_GT_OQ), 1));
+                volume = _mm256_add_epi32(volume, maskedInt(outer, 2));
+
+                // interpolation on the distance (adjacent shells)
+                __m256 radiusDistance = _mm256_mul_ps(_mm256_sub_ps(distance, _mm256_blendv_ps(radius1_4, radius3_4, outer)),
+                                                      inverseRadius1_2);
+                radiusDistance = _mm256_andnot_ps(signMask, radiusDistance);
+                __m256 weight = _mm256_sub_ps(one, radiusDistance);
+                __m256 radiusAdjacent = _mm256_blendv_ps(_mm256_cmp_ps(distance, radius1_4, _CMP_GE_OQ),
+                                                         _mm256_cmp_ps(distance, radius3_4, _CMP_LE_OQ), outer);
+                radiusAdjacent = _mm256_and_ps(radiusAdjacent, valid);
+                __m256i radiusVolume = _mm256_add_epi32(volume, _mm256_blendv_epi8(_mm256_set1_epi32(2), _mm256_set1_epi32(-2),
+                                                                                   _mm256_castps_si256(outer)));
+
+                // interpolation on the inclination (adjacent vertical volumes)
+                __m256 cosine = _mm256_min_ps(one, _mm256_max_ps(_mm256_set1_ps(-1.0f), _mm256_div_ps(lz, distance)));
+                __m256 inclination = acosAVX2(cosine);
+                __m256 lower = _mm256_cmp_ps(lz, zero, _CMP_LE_OQ);
+                __m256 inclinationDistance = _mm256_mul_ps(_mm256_sub_ps(inclination,
+                                                                         _mm256_blendv_ps(_mm256_set1_ps(Rad45), _mm256_set1_ps(Rad135), lower)),
+                                                           inverseRad90);
+                inclinationDistance = _mm256_andnot_ps(signMask, inclinationDistance);
+                weight = _mm256_add_ps(weight, _mm256_sub_ps(one, inclinationDistance));
+                __m256 inclinationAdjacent = _mm256_blendv_ps(_mm256_cmp_ps(inclination, _mm256_set1_ps(Rad45), _CMP_GE_OQ),
+                                                              _mm256_cmp_ps(inclination, _mm256_set1_ps(Rad135), _CMP_LE_OQ), lower);
+                inclinationAdjacent = _mm256_and_ps(inclinationAdjacent, valid);
+                __m256i inclinationVolume = _mm256_add_epi32(volume, _mm256_blendv_epi8(_mm256_set1_epi32(-1), _mm256_set1_epi32(1),
+                                                                                        _mm256_castps_si256(lower)));
+
+                // interpolation on the azimuth (adjacent horizontal volumes)
+                __m256 hasAzimuth = _mm256_andnot_ps(_mm256_and_ps(xZero, yZero), valid);
+                __m256 sectorStart = _mm256_fmadd_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(volume, 2)), _mm256_set1_ps(Rad45),
+                                                     _mm256_set1_ps(-RadPi78));
+                __m256 azimuthDistance = _mm256_mul_ps(_mm256_sub_ps(atan2AVX2(ly, lx), sectorStart), inverseRad45);
+                azimuthDistance = _mm256_max_ps(_mm256_set1_ps(-0.5f), _mm256_min_ps(azimuthDistance, _mm256_set1_ps(0.5f)));
+                __m256 azimuthPositive = _mm256_cmp_ps(azimuthDistance, zero, _CMP_GT_OQ);
+                azimuthDistance = _mm256_and_ps(_mm256_andnot_ps(signMask, azimuthDistance), hasAzimuth);
+                weight = _mm256_add_ps(weight, _mm256_and_ps(_mm256_sub_ps(one, azimuthDistance), hasAzimuth));
+                __m256i azimuthVolume = _mm256_add_epi32(volume, _mm256_blendv_epi8(_mm256_set1_epi32(28), _mm256_set1_epi32(4),
+                                                                                    _mm256_castps_si256(azimuthPositive)));
+                azimuthVolume = _mm256_and_si256(azimuthVolume, _mm256_set1_epi32(31));
+
+                _mm256_storeu_si256((__m256i*)(volumes + i), selectVolume(volume, valid));
+                _mm256_storeu_si256((__m256i*)(volumes + stride + i), selectVolume(radiusVolume, radiusAdjacent));
+                _mm256_storeu_si256((__m256i*)(volumes + 2 * stride + i), selectVolume(inclinationVolume, inclinationAdjacent));
+                _mm256_storeu_si256((__m256i*)(volumes + 3 * stride + i), selectVolume(azimuthVolume, hasAzimuth));
+                _mm256_storeu_ps(weights + i, _mm256_and_ps(weight, valid));
+                _mm256_storeu_ps(weights + stride + i, _mm256_and_ps(radiusDistance, radiusAdjacent));
+                _mm256_storeu_ps(weights + 2 * stride + i, _mm256_and_ps(inclinationDistance, inclinationAdjacent));
+                _mm256_storeu_ps(weights + 3 * stride + i, azimuthDistance);
+            }
+            computeVolumesScalar(x, y, z, sqr_dists, i, end, stride, frame, radius, volumes, weights);
+        }
+#endif
+
+        KernelTable selectKernels()
+        {
+#ifdef ISM3D_KERNELS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return {computeVolumesAVX2, "AVX2"};
+#endif
+            return {computeVolumesScalar, "scalar"};
+        }
+
+        const KernelTable& getKernels()
+        {
+            static const KernelTable kernels = selectKernels();
+            return kernels;
+        }
+    }
+
+    void ShotKernels::computeVolumes(const float *x, const float *y, const float *z, const float *sqr_dists,
+                                     int num_neighbors, const float *frame, float radius, ShotBins &bins)
+    {
+        bins.numNeighbors = num_neighbors;
+        bins.volumes.resize(4 * (size_t)num_neighbors);
+        bins.weights.resize(4 * (size_t)num_neighbors);
+        getKernels().volumes(x, y, z, sqr_dists, 0, num_neighbors, num_neighbors, frame, radius,
+                             bins.volumes.data(), bins.weights.data());
+    }
+
+    void ShotKernels::accumulate(const ShotBins &bins, const float *bin_distances, int num_bins, float *histograms)
+    {
+        const int n = bins.numNeighbors;
+        const int histogramSize = num_bins + 1;
+        const int *volumes = bins.volumes.data();
+        const float *weights = bins.weights.data();
+
+        for (int i = 0; i < n; i++)
+        {
+            if (volumes[i] < 0)
+                continue;
+
+            // interpolation on the histogram (adjacent bins)
+            const int step = (int)std::floor(bin_distances[i] + 0.5f);
+            const float binDistance = bin_distances[i] - step;
+            float *histogram = histograms + volumes[i] * histogramSize;
+            histogram[step] += weights[i] + 1 - std::fabs(binDistance);
+            if (binDistance > 0)
+                histogram[(step + 1) % num_bins] += binDistance;
+            else
+                histogram[(step - 1 + num_bins) % num_bins] -= binDistance;
+
+            for (int k = 1; k < 4; k++)
+            {
+                if (volumes[k * n + i] >= 0)
+                    histograms[volumes[k * n + i] * histogramSize + step] += weights[k * n + i];
+            }
+        }
+    }
+
+    std::string ShotKernels::getInstructionSet()
+    {
+        return getKernels().name;
+    }
+}
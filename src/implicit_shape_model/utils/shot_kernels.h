@@ -0,0 +1,74 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SHOT_KERNELS_H
+#define ISM3D_SHOT_KERNELS_H
+
+#include <string>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The ShotBins struct
+     * The spatial volumes of the neighbors of a keypoint in the SHOT grid (2 radii, 2 elevations, 8 azimuths).
+     * Each neighbor votes for its own volume and, by quadrilinear interpolation, for up to three adjacent volumes
+     * (radial, inclination and azimuth). Entry k of neighbor i is stored at k * numNeighbors + i, k = 0 is the
+     * own volume. Volumes of -1 receive no vote, that includes the own volume of neighbors on the keypoint.
+     */
+    struct ShotBins
+    {
+        int numNeighbors;
+        std::vector<int> volumes;
+
+        // weights of the adjacent volumes, the entry of the own volume is the sum of its spatial weights
+        std::vector<float> weights;
+    };
+
+    /**
+     * @brief The ShotKernels class
+     * Histogram computation of SHOT style descriptors, split into a vectorized part that projects the neighbors
+     * into the local reference frame and computes their volumes and spatial weights, and a scalar part that adds
+     * the votes of one channel (e.g. shape or color) to the histograms. The votes of different neighbors can
+     * hit the same bin, which is why they are not scattered with vector instructions. The vectorized part uses
+     * AVX2 on x86 processors that support it and scalar code otherwise, the results differ only by the rounding
+     * of the trigonometric functions.
+     */
+    class ShotKernels
+    {
+    public:
+        /**
+         * @brief Compute the volumes of the neighbors of a keypoint.
+         * @param x, y, z the neighbor coordinates relative to the keypoint
+         * @param sqr_dists the squared distances of the neighbors to the keypoint
+         * @param num_neighbors the number of neighbors
+         * @param frame the local reference frame: x, y and z axis
+         * @param radius the descriptor radius
+         * @param bins output: the volumes and weights
+         */
+        static void computeVolumes(const float *x, const float *y, const float *z, const float *sqr_dists,
+                                   int num_neighbors, const float *frame, float radius, ShotBins &bins);
+
+        /**
+         * @brief Add the votes of all neighbors to the histograms of one channel, including the interpolation
+         * between adjacent bins of a histogram.
+         * @param bins the volumes of the neighbors
+         * @param bin_distances for each neighbor its position in the histogram, between 0 and num_bins
+         * @param num_bins the number of bins, the histogram of a volume has num_bins + 1 entries
+         * @param histograms the histograms of all volumes of the channel
+         */
+        static void accumulate(const ShotBins &bins, const float *bin_distances, int num_bins, float *histograms);
+
+        // name of the selected instruction set
+        static std::string getInstructionSet();
+    };
+}
+
+#endif // ISM3D_SHOT_KERNELS_H
@@ -0,0 +1,143 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SQ_INDEX_H
+#define ISM3D_SQ_INDEX_H
+
+#include <vector>
+#include <queue>
+#include <memory>
+#include <limits>
+#include <algorithm>
+#include <omp.h>
+
+#include "knn_index.h"
+#include "scalar_quantizer.h"
+#include "exception.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The ScalarQuantizationIndex class
+     * Exhaustive search over scalar quantization codes. The squared euclidean distance is computed directly on
+     * the reduced precision codes, so that only a half or a quarter of the memory of the float descriptors is
+     * read per query. Other distances decode each code first. The search does not depend on the exact flag.
+     */
+    template<typename T>
+    class ScalarQuantizationIndex : public KnnIndex<T>
+    {
+    public:
+        typedef std::pair<float, int> Candidate; // distance and code index
+
+        /**
+         * @param quantizer the trained quantizer
+         * @param codes the codes, getCodeSize() bytes per descriptor
+         */
+        ScalarQuantizationIndex(std::shared_ptr<const ScalarQuantizer> quantizer, const std::vector<uint8_t> &codes)
+            : m_quantizer(quantizer), m_codes(codes),
+              m_num_codes((int)(codes.size() / std::max(quantizer->getCodeSize(), 1)))
+        {
+        }
+
+        void buildIndex()
+        {
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, flann::Matrix<int> &indices,
+                       flann::Matrix<float> &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                search(queries[q], k, result);
+
+                for (int j = 0; j < k; j++)
+                {
+                    indices[q][j] = j < (int)result.size() ? result[j].second : -1;
+                    distances[q][j] = j < (int)result.size() ? result[j].first : std::numeric_limits<float>::max();
+                }
+            }
+        }
+
+        void knnSearch(const flann::Matrix<float> &queries, std::vector<std::vector<int> > &indices,
+                       std::vector<std::vector<float> > &distances, int k, bool exact, int cores = 1) const
+        {
+            const int numQueries = (int)queries.rows;
+            indices.resize(numQueries);
+            distances.resize(numQueries);
+
+#pragma omp parallel for schedule(dynamic, 16) num_threads(cores > 0 ? cores : omp_get_max_threads())
+            for (int q = 0; q < numQueries; q++)
+            {
+                std::vector<Candidate> result;
+                search(queries[q], k, result);
+
+                indices[q].resize(result.size());
+                distances[q].resize(result.size());
+                for (int j = 0; j < (int)result.size(); j++)
+                {
+                    indices[q][j] = result[j].second;
+                    distances[q][j] = result[j].first;
+                }
+            }
+        }
+
+        void save(const std::string &filename)
+        {
+            throw RuntimeException("scalar quantization codes are stored with the codebook, not in an index file");
+        }
+
+        // the quantizer is shared with the codebook
+        std::size_t getMemoryUsage() const
+        {
+            return m_codes.capacity();
+        }
+
+    private:
+        void search(const float *query, int k, std::vector<Candidate> &result) const
+        {
+            result.clear();
+            if (k <= 0 || m_num_codes == 0)
+                return;
+
+            const int codeSize = m_quantizer->getCodeSize();
+            std::vector<float> buffer(m_quantizer->getDim());
+            std::priority_queue<Candidate> best;
+            for (int i = 0; i < m_num_codes; i++)
+            {
+                Candidate candidate(m_quantizer->getDistance(query, &m_codes[(size_t)i * codeSize], m_distance, buffer.data()), i);
+                if ((int)best.size() < k)
+                    best.push(candidate);
+                else if (candidate < best.top())
+                {
+                    best.pop();
+                    best.push(candidate);
+                }
+            }
+
+            result.resize(best.size());
+            for (int i = (int)best.size() - 1; i >= 0; i--)
+            {
+                result[i] = best.top();
+                best.pop();
+            }
+        }
+
+        std::shared_ptr<const ScalarQuantizer> m_quantizer;
+        std::vector<uint8_t> m_codes;
+        int m_num_codes;
+        T m_distance;
+    };
+}
+
+#endif // ISM3D_SQ_INDEX_H
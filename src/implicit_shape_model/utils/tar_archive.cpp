@@ -0,0 +1,314 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "tar_archive.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <zlib.h>
+#include <boost/filesystem.hpp>
+
+namespace ism3d
+{
+    namespace
+    {
+        const int BlockSize = 512;
+
+        // writes the value as zero padded octal number with a terminating null into the field
+        void writeOctal(char *field, int length, uint64_t value)
+        {
+            std::snprintf(field, length, "%0*llo", length - 1, (unsigned long long)value);
+        }
+
+        uint64_t readOctal(const char *field, int length)
+        {
+            uint64_t value = 0;
+            for (int i = 0; i < length && field[i] != 0 && field[i] != ' '; i++)
+            {
+                if (field[i] < '0' || field[i] > '7')
+                    break;
+                value = value * 8 + (field[i] - '0');
+            }
+            return value;
+        }
+
+        unsigned computeChecksum(const char *header)
+        {
+            // the checksum field itself counts as spaces
+            unsigned sum = 0;
+            for (int i = 0; i < BlockSize; i++)
+                sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)header[i];
+            return sum;
+        }
+
+        // splits a name into the ustar prefix and name fields
+        bool setName(char *header, const std::string &name)
+        {
+            if (name.size() <= 100)
+            {
+                std::memcpy(header, name.data(), name.size());
+                return true;
+            }
+
+            std::size_t split = name.rfind('/', 155);
+            if (split == std::string::npos || name.size() - split - 1 > 100 || split == 0)
+                return false;
+
+            std::memcpy(header + 345, name.data(), split);
+            std::memcpy(header, name.data() + split + 1, name.size() - split - 1);
+            return true;
+        }
+
+        bool isSafeName(const std::string &name)
+        {
+            if (name.empty() || name[0] == '/')
+                return false;
+            boost::filesystem::path path(name);
+            for (auto it = path.begin(); it != path.end(); it++)
+            {
+                if (it->string() == "..")
+                    return false;
+            }
+            return true;
+        }
+
+        bool readBlock(gzFile file, char *block)
+        {
+            return gzread(file, block, BlockSize) == BlockSize;
+        }
+
+        // reads the data of an entry, the size is rounded up to whole blocks in the archive
+        bool readData(gzFile file, uint64_t size, std::vector<char> &data)
+        {
+            const uint64_t padded = (size + BlockSize - 1) / BlockSize * BlockSize;
+            data.resize(padded);
+            uint64_t done = 0;
+            while (done < padded)
+            {
+                const unsigned chunk = (unsigned)std::min<uint64_t>(padded - done, 1 << 20);
+                if (gzread(file, data.data() + done, chunk) != (int)chunk)
+                    return false;
+                done += chunk;
+            }
+            data.resize(size);
+            return true;
+        }
+
+        // the path of a pax extended header, empty if it does not contain one
+        std::string readPaxPath(const std::vector<char> &data)
+        {
+            std::string path;
+            std::size_t pos = 0;
+            while (pos < data.size())
+            {
+                // records have the form "<length> <key>=<value>\n"
+                std::size_t space = pos;
+                while (space < data.size() && data[space] != ' ')
+                    space++;
+                const std::size_t length = std::strtoul(std::string(data.data() + pos, space - pos).c_str(), 0, 10);
+                if (length == 0 || pos + length > data.size() || space >= pos + length)
+                    break;
+
+                std::string record(data.data() + space + 1, pos + length - space - 2);
+                if (record.compare(0, 5, "path=") == 0)
+                    path = record.substr(5);
+                pos += length;
+            }
+            return path;
+        }
+    }
+
+    bool TarArchive::pack(const std::string &archive, const std::vector<std::string> &files)
+    {
+        gzFile out = gzopen(archive.c_str(), "wb");
+        if (!out)
+        {
+            LOG_ERROR("could not create archive " << archive);
+            return false;
+        }
+
+        bool success = true;
+        std::vector<char> data;
+        for (const std::string &file : files)
+        {
+            std::ifstream in(file.c_str(), std::ios::binary);
+            if (!in)
+            {
+                LOG_ERROR("could not read " << file << " for archive " << archive);
+                success = false;
+                break;
+            }
+            data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+
+            // leading slashes are removed from entry names like tar does
+            std::string name = file;
+            name.erase(0, name.find_first_not_of('/'));
+
+            char header[BlockSize];
+            std::memset(header, 0, sizeof(header));
+            if (!setName(header, name))
+            {
+                LOG_ERROR("file name too long for archive: " << name);
+                success = false;
+                break;
+            }
+            writeOctal(header + 100, 8, 0644);
+            writeOctal(header + 108, 8, 0);
+            writeOctal(header + 116, 8, 0);
+            writeOctal(header + 124, 12, data.size());
+            writeOctal(header + 136, 12, (uint64_t)std::time(0));
+            header[156] = '0';
+            std::memcpy(header + 257, "ustar", 6);
+            std::memcpy(header + 263, "00", 2);
+            std::snprintf(header + 148, 8, "%06o", computeChecksum(header));
+            header[155] = ' ';
+
+            data.resize((data.size() + BlockSize - 1) / BlockSize * BlockSize, 0);
+            if (gzwrite(out, header, BlockSize) != BlockSize ||
+                    (!data.empty() && gzwrite(out, data.data(), data.size()) != (int)data.size()))
+            {
+                LOG_ERROR("could not write archive " << archive);
+                success = false;
+                break;
+            }
+        }
+
+        // the archive ends with two empty blocks
+        char end[2 * BlockSize];
+        std::memset(end, 0, sizeof(end));
+        if (success && gzwrite(out, end, sizeof(end)) != (int)sizeof(end))
+        {
+            LOG_ERROR("could not write archive " << archive);
+            success = false;
+        }
+
+        if (gzclose(out) != Z_OK)
+            success = false;
+        return success;
+    }
+
+    bool TarArchive::extract(const std::string &archive, std::vector<std::string> &files)
+    {
+        files.clear();
+        std::vector<std::pair<std::string, std::vector<char> > > entries;
+        if (!read(archive, entries))
+            return false;
+
+        for (const std::pair<std::string, std::vector<char> > &entry : entries)
+        {
+            if (!isSafeName(entry.first))
+            {
+                LOG_ERROR("refusing to extract " << entry.first << " from archive " << archive);
+                return false;
+            }
+
+            boost::filesystem::path path = boost::filesystem::complete(boost::filesystem::path(entry.first));
+            boost::system::error_code error;
+            if (path.has_parent_path())
+                boost::filesystem::create_directories(path.parent_path(), error);
+
+            std::ofstream out(path.string().c_str(), std::ios::binary | std::ios::trunc);
+            out.write(entry.second.data(), entry.second.size());
+            if (!out)
+            {
+                LOG_ERROR("could not extract " << path.string() << " from archive " << archive);
+                return false;
+            }
+            files.push_back(path.string());
+        }
+        return true;
+    }
+
+    bool TarArchive::read(const std::string &archive, std::vector<std::pair<std::string, std::vector<char> > > &entries)
+    {
+        entries.clear();
+        gzFile in = gzopen(archive.c_str(), "rb");
+        if (!in)
+        {
+            LOG_ERROR("could not open archive " << archive);
+            return false;
+        }
+
+        bool success = true;
+        std::string long_name;
+        std::vector<char> data;
+        char header[BlockSize];
+        while (true)
+        {
+            if (!readBlock(in, header))
+            {
+                LOG_ERROR("unexpected end of archive " << archive);
+                success = false;
+                break;
+            }
+
+            // an empty block marks the end of the archive
+            bool empty = true;
+            for (int i = 0; i < BlockSize && empty; i++)
+                empty = header[i] == 0;
+            if (empty)
+                break;
+
+            if (readOctal(header + 148, 8) != computeChecksum(header))
+            {
+                LOG_ERROR("corrupt archive " << archive);
+                success = false;
+                break;
+            }
+
+            const uint64_t size = readOctal(header + 124, 12);
+            const char type = header[156];
+            if (!readData(in, size, data))
+            {
+                LOG_ERROR("unexpected end of archive " << archive);
+                success = false;
+                break;
+            }
+
+            // long names of the following entry are stored in gnu or pax headers
+            if (type == 'L')
+            {
+                long_name.assign(data.data(), strnlen(data.data(), data.size()));
+                continue;
+            }
+            if (type == 'x')
+            {
+                long_name = readPaxPath(data);
+                continue;
+            }
+
+            std::string name = long_name;
+            long_name.clear();
+            if (name.empty())
+            {
+                name.assign(header, strnlen(header, 100));
+                const std::string prefix(header + 345, strnlen(header + 345, 155));
+                if (!prefix.empty())
+                    name = prefix + "/" + name;
+            }
+
+            // only regular files are of interest
+            if (type != '0' && type != 0)
+                continue;
+
+            entries.push_back(std::make_pair(name, std::vector<char>()));
+            entries.back().second.swap(data);
+        }
+
+        gzclose(in);
+        return success;
+    }
+}
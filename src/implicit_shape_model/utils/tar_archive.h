@@ -0,0 +1,55 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_TAR_ARCHIVE_H
+#define ISM3D_TAR_ARCHIVE_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ism3d
+{
+    /**
+     * @brief The TarArchive class
+     * Writes and reads gzip compressed tar archives of regular files in process, the archives are compatible with
+     * "tar -czf" and "tar -xzf". Entries are named by the paths of the packed files relative to the root, as tar
+     * does, and are extracted relative to the current directory or read into memory.
+     */
+    class TarArchive
+    {
+    public:
+        /**
+         * @brief Pack files into an archive.
+         * @param archive the path of the archive
+         * @param files the paths of the files to pack
+         * @return false if a file could not be read or the archive could not be written
+         */
+        static bool pack(const std::string &archive, const std::vector<std::string> &files);
+
+        /**
+         * @brief Extract the files of an archive relative to the current directory.
+         * @param archive the path of the archive
+         * @param files output: the paths of the extracted files in archive order
+         * @return false if the archive could not be read or a file could not be written
+         */
+        static bool extract(const std::string &archive, std::vector<std::string> &files);
+
+        /**
+         * @brief Read the regular files of an archive into memory.
+         * @param archive the path of the archive
+         * @param entries output: the names and contents of the files in archive order
+         * @return false if the archive could not be read
+         */
+        static bool read(const std::string &archive, std::vector<std::pair<std::string, std::vector<char> > > &entries);
+    };
+}
+
+#endif // ISM3D_TAR_ARCHIVE_H
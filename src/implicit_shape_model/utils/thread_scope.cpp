@@ -0,0 +1,126 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "thread_scope.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <sstream>
+#include <omp.h>
+
+namespace ism3d
+{
+    ThreadScope::ThreadScope(int numThreads, const std::vector<int> &cpus)
+        : m_previous_threads(0), m_restore_affinity(false)
+    {
+        if (numThreads > 0)
+        {
+            m_previous_threads = omp_get_max_threads();
+            omp_set_num_threads(numThreads);
+        }
+
+#ifdef __linux__
+        if (!cpus.empty())
+        {
+            cpu_set_t affinity;
+            CPU_ZERO(&affinity);
+            for (int cpu : cpus)
+                CPU_SET(cpu, &affinity);
+
+            if (pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &m_previous_affinity) != 0)
+            {
+                LOG_WARN("could not set the cpu affinity");
+                return;
+            }
+
+            // the workers are pinned before the calling thread, so that the workers created by this region save the
+            // affinity they would have without the scope; threads created later inherit the affinity of the caller
+            m_previous_worker_affinities.resize(omp_get_max_threads());
+            for (WorkerAffinity &worker : m_previous_worker_affinities)
+                worker.saved = false;
+            #pragma omp parallel num_threads((int)m_previous_worker_affinities.size())
+            {
+                const int thread = omp_get_thread_num();
+                WorkerAffinity &worker = m_previous_worker_affinities[thread];
+                worker.thread = pthread_self();
+                if (thread > 0 && pthread_getaffinity_np(worker.thread, sizeof(cpu_set_t), &worker.affinity) == 0)
+                    worker.saved = pthread_setaffinity_np(worker.thread, sizeof(cpu_set_t), &affinity) == 0;
+            }
+
+            if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &affinity) != 0)
+                LOG_WARN("could not set the cpu affinity");
+            m_restore_affinity = true;
+        }
+#else
+        if (!cpus.empty())
+            LOG_WARN("cpu affinity is not supported on this platform");
+#endif
+    }
+
+    ThreadScope::~ThreadScope()
+    {
+#ifdef __linux__
+        if (m_restore_affinity)
+        {
+            // a region of the same size runs on the same workers, workers created inside of the scope inherited the
+            // pinned affinity instead of the previous one of the calling thread
+            #pragma omp parallel num_threads((int)m_previous_worker_affinities.size())
+            {
+                if (omp_get_thread_num() > 0)
+                {
+                    const cpu_set_t *previous = &m_previous_affinity;
+                    for (const WorkerAffinity &worker : m_previous_worker_affinities)
+                    {
+                        if (worker.saved && pthread_equal(worker.thread, pthread_self()))
+                        {
+                            previous = &worker.affinity;
+                            break;
+                        }
+                    }
+                    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), previous);
+                }
+            }
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &m_previous_affinity);
+        }
+#endif
+        if (m_previous_threads > 0)
+            omp_set_num_threads(m_previous_threads);
+    }
+
+    bool ThreadScope::parseCpuList(const std::string &list, std::vector<int> &cpus)
+    {
+        cpus.clear();
+        std::stringstream stream(list);
+        std::string range;
+        while (std::getline(stream, range, ','))
+        {
+            int first, last;
+            char separator;
+            std::stringstream rangeStream(range);
+            if (!(rangeStream >> first))
+                return false;
+            last = first;
+            if (rangeStream >> separator && (separator != '-' || !(rangeStream >> last)))
+                return false;
+            if (first < 0 || last < first)
+                return false;
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+
+        std::sort(cpus.begin(), cpus.end());
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+#ifdef __linux__
+        if (!cpus.empty() && cpus.back() >= CPU_SETSIZE)
+            return false;
+#endif
+        return true;
+    }
+}
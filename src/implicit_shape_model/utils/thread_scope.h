@@ -0,0 +1,72 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_THREAD_SCOPE_H
+#define ISM3D_THREAD_SCOPE_H
+
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace ism3d
+{
+    /**
+     * @brief The ThreadScope class
+     * Limits the OpenMP parallel regions started by the calling thread to a number of threads until it is
+     * destroyed, and optionally pins the calling thread and its OpenMP worker threads to a set of cpus. Unlike a
+     * plain omp_set_num_threads(), the previous limit and the affinity of the calling thread are restored on
+     * destruction, so the setting does not leak into other models or into the code of the caller. The workers are
+     * pinned and restored in a parallel region of the limited size, OpenMP reuses the same threads for the regions of
+     * the calling thread; workers that were created inside of the scope get the previous affinity of the calling
+     * thread, which they would have inherited otherwise. Pinning is only supported on Linux.
+     */
+    class ThreadScope
+    {
+    public:
+        /**
+         * @param numThreads the number of threads, 0 keeps the current limit
+         * @param cpus the cpus to run on, empty to keep the current affinity
+         */
+        ThreadScope(int numThreads, const std::vector<int> &cpus = std::vector<int>());
+        ~ThreadScope();
+
+        /**
+         * @brief Parse a list of cpus like "0-3,8,10-11".
+         * @param list the list, empty for no cpus
+         * @param cpus the cpus in the list
+         * @return false if the list is not valid
+         */
+        static bool parseCpuList(const std::string &list, std::vector<int> &cpus);
+
+    private:
+        ThreadScope(const ThreadScope&) = delete;
+        ThreadScope& operator=(const ThreadScope&) = delete;
+
+        int m_previous_threads; // 0 if the limit was not changed
+        bool m_restore_affinity;
+#ifdef __linux__
+        struct WorkerAffinity
+        {
+            pthread_t thread;
+            cpu_set_t affinity;
+            bool saved;
+        };
+
+        cpu_set_t m_previous_affinity;
+        std::vector<WorkerAffinity> m_previous_worker_affinities; // by thread number, the calling thread is 0
+#endif
+    };
+}
+
+#endif // ISM3D_THREAD_SCOPE_H
@@ -0,0 +1,366 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "training_checkpoint.h"
+#include "feature_cache.h"
+#include "../codebook/codebook.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace ism3d
+{
+    namespace
+    {
+        const uint32_t CheckpointMagic = 0x4b435349; // "ISCK"
+        const uint32_t CheckpointVersion = 2;
+
+        typedef std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > FeatureMap;
+
+        void writeFeatures(std::ofstream &file, const FeatureMap &features)
+        {
+            uint32_t numClasses = features.size();
+            file.write((const char*)&numClasses, sizeof(numClasses));
+            for (auto it = features.begin(); it != features.end(); it++)
+            {
+                uint32_t classId = it->first;
+                uint32_t numModels = it->second.size();
+                file.write((const char*)&classId, sizeof(classId));
+                file.write((const char*)&numModels, sizeof(numModels));
+                for (const pcl::PointCloud<ISMFeature>::Ptr &cloud : it->second)
+                    FeatureCache::writeCloud(file, *cloud);
+            }
+        }
+
+        bool readFeatures(std::ifstream &file, FeatureMap &features)
+        {
+            features.clear();
+            uint32_t numClasses = 0;
+            if (!file.read((char*)&numClasses, sizeof(numClasses)))
+                return false;
+
+            for (uint32_t i = 0; i < numClasses; i++)
+            {
+                uint32_t classId, numModels;
+                if (!file.read((char*)&classId, sizeof(classId)) || !file.read((char*)&numModels, sizeof(numModels)))
+                    return false;
+
+                std::vector<pcl::PointCloud<ISMFeature>::Ptr> &models = features[classId];
+                for (uint32_t j = 0; j < numModels; j++)
+                {
+                    pcl::PointCloud<ISMFeature>::Ptr cloud(new pcl::PointCloud<ISMFeature>());
+                    if (!FeatureCache::readCloud(file, *cloud))
+                        return false;
+                    models.push_back(cloud);
+                }
+            }
+            return true;
+        }
+
+        void writeBoundingBoxes(std::ofstream &file, const std::map<unsigned, std::vector<Utils::BoundingBox> > &boxes)
+        {
+            uint32_t numClasses = boxes.size();
+            file.write((const char*)&numClasses, sizeof(numClasses));
+            for (auto it = boxes.begin(); it != boxes.end(); it++)
+            {
+                uint32_t classId = it->first;
+                uint32_t numBoxes = it->second.size();
+                file.write((const char*)&classId, sizeof(classId));
+                file.write((const char*)&numBoxes, sizeof(numBoxes));
+                for (const Utils::BoundingBox &box : it->second)
+                {
+                    float values[10] = {box.position[0], box.position[1], box.position[2],
+                                        box.rotQuat.R_component_1(), box.rotQuat.R_component_2(),
+                                        box.rotQuat.R_component_3(), box.rotQuat.R_component_4(),
+                                        box.size[0], box.size[1], box.size[2]};
+                    file.write((const char*)values, sizeof(values));
+                }
+            }
+        }
+
+        bool readBoundingBoxes(std::ifstream &file, std::map<unsigned, std::vector<Utils::BoundingBox> > &boxes)
+        {
+            boxes.clear();
+            uint32_t numClasses = 0;
+            if (!file.read((char*)&numClasses, sizeof(numClasses)))
+                return false;
+
+            for (uint32_t i = 0; i < numClasses; i++)
+            {
+                uint32_t classId, numBoxes;
+                if (!file.read((char*)&classId, sizeof(classId)) || !file.read((char*)&numBoxes, sizeof(numBoxes)))
+                    return false;
+
+                std::vector<Utils::BoundingBox> &classBoxes = boxes[classId];
+                classBoxes.resize(numBoxes);
+                for (Utils::BoundingBox &box : classBoxes)
+                {
+                    float values[10];
+                    if (!file.read((char*)values, sizeof(values)))
+                        return false;
+                    box.position = Eigen::Vector3f(values[0], values[1], values[2]);
+                    box.rotQuat = boost::math::quaternion<float>(values[3], values[4], values[5], values[6]);
+                    box.size = Eigen::Vector3f(values[7], values[8], values[9]);
+                }
+            }
+            return true;
+        }
+    }
+
+    TrainingCheckpoint::TrainingCheckpoint(const std::string &directory)
+        : m_directory(directory)
+    {
+        boost::system::error_code error;
+        boost::filesystem::create_directories(m_directory, error);
+        if (error)
+            LOG_WARN("could not create checkpoint directory " << m_directory << ": " << error.message());
+    }
+
+    bool TrainingCheckpoint::isValid(Stage stage, const std::string &key) const
+    {
+        std::ifstream file;
+        return openRead(stage, key, file);
+    }
+
+    bool TrainingCheckpoint::storeTrainingData(const std::string &key, const FeatureMap &features,
+                                               const FeatureMap &global_features,
+                                               const std::map<unsigned, std::vector<Utils::BoundingBox> > &bounding_boxes) const
+    {
+        std::ofstream file;
+        std::string temp_path;
+        if (!openWrite(TrainingData, key, file, temp_path))
+            return false;
+
+        // the local features are last, so that resuming a later stage can skip them
+        writeBoundingBoxes(file, bounding_boxes);
+        writeFeatures(file, global_features);
+        writeFeatures(file, features);
+        return commit(TrainingData, file, temp_path);
+    }
+
+    bool TrainingCheckpoint::loadTrainingData(const std::string &key, FeatureMap *features, FeatureMap &global_features,
+                                              std::map<unsigned, std::vector<Utils::BoundingBox> > &bounding_boxes) const
+    {
+        std::ifstream file;
+        if (!openRead(TrainingData, key, file))
+            return false;
+
+        if (!readBoundingBoxes(file, bounding_boxes) || !readFeatures(file, global_features) ||
+                (features && !readFeatures(file, *features)))
+        {
+            LOG_WARN("truncated checkpoint " << getPath(TrainingData));
+            return false;
+        }
+        return true;
+    }
+
+    bool TrainingCheckpoint::storeRanking(const std::string &key, const FeatureMap &features_ranked) const
+    {
+        std::ofstream file;
+        std::string temp_path;
+        if (!openWrite(Ranking, key, file, temp_path))
+            return false;
+
+        writeFeatures(file, features_ranked);
+        return commit(Ranking, file, temp_path);
+    }
+
+    bool TrainingCheckpoint::loadRanking(const std::string &key, FeatureMap &features_ranked) const
+    {
+        std::ifstream file;
+        if (!openRead(Ranking, key, file))
+            return false;
+
+        if (!readFeatures(file, features_ranked))
+        {
+            LOG_WARN("truncated checkpoint " << getPath(Ranking));
+            return false;
+        }
+        return true;
+    }
+
+    bool TrainingCheckpoint::storeClustering(const std::string &key, const std::vector<std::vector<float> > &centers,
+                                             const std::vector<int> &indices) const
+    {
+        std::ofstream file;
+        std::string temp_path;
+        if (!openWrite(Clustering, key, file, temp_path))
+            return false;
+
+        uint64_t numCenters = centers.size();
+        uint32_t dim = centers.empty() ? 0 : centers[0].size();
+        uint64_t numIndices = indices.size();
+        file.write((const char*)&numCenters, sizeof(numCenters));
+        file.write((const char*)&dim, sizeof(dim));
+        for (const std::vector<float> &center : centers)
+            file.write((const char*)center.data(), dim * sizeof(float));
+        file.write((const char*)&numIndices, sizeof(numIndices));
+        file.write((const char*)indices.data(), numIndices * sizeof(int));
+        return commit(Clustering, file, temp_path);
+    }
+
+    bool TrainingCheckpoint::loadClustering(const std::string &key, std::vector<std::vector<float> > &centers,
+                                            std::vector<int> &indices) const
+    {
+        std::ifstream file;
+        if (!openRead(Clustering, key, file))
+            return false;
+
+        uint64_t numCenters = 0, numIndices = 0;
+        uint32_t dim = 0;
+        bool success = (bool)file.read((char*)&numCenters, sizeof(numCenters)) &&
+                (bool)file.read((char*)&dim, sizeof(dim));
+        centers.assign(success ? numCenters : 0, std::vector<float>(dim));
+        for (std::vector<float> &center : centers)
+            success = success && file.read((char*)center.data(), dim * sizeof(float));
+        success = success && file.read((char*)&numIndices, sizeof(numIndices));
+        indices.resize(success ? numIndices : 0);
+        success = success && file.read((char*)indices.data(), numIndices * sizeof(int));
+
+        if (!success)
+        {
+            LOG_WARN("truncated checkpoint " << getPath(Clustering));
+            return false;
+        }
+        return true;
+    }
+
+    bool TrainingCheckpoint::storeActivation(const std::string &key, const Codebook &codebook,
+                                             const std::vector<std::vector<float> > &tuning_descriptors,
+                                             const std::vector<int> &tuning_codeword_ids) const
+    {
+        std::ofstream file;
+        std::string temp_path;
+        if (!openWrite(Activation, key, file, temp_path))
+            return false;
+
+        {
+            boost::archive::binary_oarchive oa(file, boost::archive::no_header);
+            codebook.saveData(oa);
+            oa << tuning_descriptors;
+            oa << tuning_codeword_ids;
+        }
+        return commit(Activation, file, temp_path);
+    }
+
+    bool TrainingCheckpoint::loadActivation(const std::string &key, Codebook &codebook,
+                                            std::vector<std::vector<float> > &tuning_descriptors,
+                                            std::vector<int> &tuning_codeword_ids) const
+    {
+        std::ifstream file;
+        if (!openRead(Activation, key, file))
+            return false;
+
+        try
+        {
+            boost::archive::binary_iarchive ia(file, boost::archive::no_header);
+            if (!codebook.loadData(ia))
+                return false;
+            ia >> tuning_descriptors;
+            ia >> tuning_codeword_ids;
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARN("could not read checkpoint " << getPath(Activation) << ": " << e.what());
+            return false;
+        }
+        return true;
+    }
+
+    std::string TrainingCheckpoint::getStageName(Stage stage)
+    {
+        switch (stage)
+        {
+        case TrainingData:
+            return "training data";
+        case Ranking:
+            return "ranking";
+        case Clustering:
+            return "clustering";
+        case Activation:
+            return "activation";
+        default:
+            return "unknown";
+        }
+    }
+
+    std::string TrainingCheckpoint::getPath(Stage stage) const
+    {
+        static const char *names[NumStages] = {"training_data", "ranking", "clustering", "activation"};
+        return (boost::filesystem::path(m_directory) / (std::string(names[stage]) + ".ismck")).string();
+    }
+
+    bool TrainingCheckpoint::openRead(Stage stage, const std::string &key, std::ifstream &file) const
+    {
+        file.open(getPath(stage).c_str(), std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t magic = 0, version = 0, fileStage = 0, keySize = 0;
+        file.read((char*)&magic, sizeof(magic));
+        file.read((char*)&version, sizeof(version));
+        file.read((char*)&fileStage, sizeof(fileStage));
+        file.read((char*)&keySize, sizeof(keySize));
+        if (!file || magic != CheckpointMagic || version != CheckpointVersion || fileStage != (uint32_t)stage ||
+                keySize != key.size())
+            return false;
+
+        std::string fileKey(keySize, 0);
+        return file.read(&fileKey[0], keySize) && fileKey == key;
+    }
+
+    bool TrainingCheckpoint::openWrite(Stage stage, const std::string &key, std::ofstream &file,
+                                       std::string &temp_path) const
+    {
+        temp_path = getPath(stage) + "." + boost::filesystem::unique_path().string() + ".tmp";
+        file.open(temp_path.c_str(), std::ios::binary);
+        if (!file)
+        {
+            LOG_WARN("could not write checkpoint " << temp_path);
+            return false;
+        }
+
+        uint32_t fileStage = stage;
+        uint32_t keySize = key.size();
+        file.write((const char*)&CheckpointMagic, sizeof(CheckpointMagic));
+        file.write((const char*)&CheckpointVersion, sizeof(CheckpointVersion));
+        file.write((const char*)&fileStage, sizeof(fileStage));
+        file.write((const char*)&keySize, sizeof(keySize));
+        file.write(key.data(), keySize);
+        return true;
+    }
+
+    bool TrainingCheckpoint::commit(Stage stage, std::ofstream &file, const std::string &temp_path) const
+    {
+        file.close();
+        if (!file)
+        {
+            LOG_WARN("could not write checkpoint " << temp_path);
+            std::remove(temp_path.c_str());
+            return false;
+        }
+
+        // rename is atomic, an interrupted run never leaves a partially written checkpoint
+        const std::string path = getPath(stage);
+        boost::system::error_code error;
+        boost::filesystem::rename(temp_path, path, error);
+        if (error)
+        {
+            LOG_WARN("could not write checkpoint " << path << ": " << error.message());
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_TRAINING_CHECKPOINT_H
+#define ISM3D_TRAINING_CHECKPOINT_H
+
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+
+#include "ism_feature.h"
+#include "utils.h"
+
+namespace ism3d
+{
+    class Codebook;
+
+    /**
+     * @brief The TrainingCheckpoint class
+     * Stores the results of the training stages in a directory, one file per stage. Each file carries the key of
+     * the configuration the stage was computed with, the key of a stage covers the configuration of the stage and
+     * of all stages before it. A stage is resumed if its key matches, so that a run that only changes parameters
+     * of later stages reuses the results of the earlier ones. Files are written to a temporary file first and then
+     * renamed, an interrupted run leaves the previous checkpoint of a stage intact.
+     */
+    class TrainingCheckpoint
+    {
+    public:
+        enum Stage
+        {
+            TrainingData = 0,   // local and global features and bounding boxes of the training models
+            Ranking,            // the ranked local features
+            Clustering,         // cluster centers and the cluster index of each ranked feature
+            Activation,         // the activated codebook and the index tuning descriptors
+            NumStages
+        };
+
+        /**
+         * @brief Use checkpoints in the given directory, the directory is created if it does not exist.
+         * @param directory the checkpoint directory
+         */
+        TrainingCheckpoint(const std::string &directory);
+
+        /**
+         * @brief Check the header of a stage checkpoint.
+         * @param stage the stage
+         * @param key the configuration key of the stage
+         * @return true if the checkpoint exists and was computed with the given configuration
+         */
+        bool isValid(Stage stage, const std::string &key) const;
+
+        bool storeTrainingData(const std::string &key,
+                               const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features,
+                               const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &global_features,
+                               const std::map<unsigned, std::vector<Utils::BoundingBox> > &bounding_boxes) const;
+
+        /**
+         * @brief Load the training data checkpoint.
+         * @param key the configuration key of the stage
+         * @param features output: the local features, they are skipped if null
+         * @param global_features output: the global features
+         * @param bounding_boxes output: the bounding boxes
+         * @return false if the checkpoint is missing, outdated or truncated
+         */
+        bool loadTrainingData(const std::string &key,
+                              std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > *features,
+                              std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &global_features,
+                              std::map<unsigned, std::vector<Utils::BoundingBox> > &bounding_boxes) const;
+
+        bool storeRanking(const std::string &key,
+                          const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features_ranked) const;
+        bool loadRanking(const std::string &key,
+                         std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &features_ranked) const;
+
+        bool storeClustering(const std::string &key, const std::vector<std::vector<float> > &centers,
+                             const std::vector<int> &indices) const;
+        bool loadClustering(const std::string &key, std::vector<std::vector<float> > &centers,
+                            std::vector<int> &indices) const;
+
+        bool storeActivation(const std::string &key, const Codebook &codebook,
+                             const std::vector<std::vector<float> > &tuning_descriptors,
+                             const std::vector<int> &tuning_codeword_ids) const;
+        bool loadActivation(const std::string &key, Codebook &codebook,
+                            std::vector<std::vector<float> > &tuning_descriptors,
+                            std::vector<int> &tuning_codeword_ids) const;
+
+        static std::string getStageName(Stage stage);
+
+    private:
+        std::string getPath(Stage stage) const;
+        bool openRead(Stage stage, const std::string &key, std::ifstream &file) const;
+        bool openWrite(Stage stage, const std::string &key, std::ofstream &file, std::string &temp_path) const;
+        bool commit(Stage stage, std::ofstream &file, const std::string &temp_path) const;
+
+        std::string m_directory;
+    };
+}
+
+#endif // ISM3D_TRAINING_CHECKPOINT_H
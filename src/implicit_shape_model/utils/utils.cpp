@@ -9,6 +9,7 @@
  */
 
 #include "utils.h"
+#include "voxel_hash_grid.h"
 #include <Eigen/Eigenvalues>
 
 #include "../third_party/libgdiam-1.3/gdiam.hpp"
@@ -233,33 +234,71 @@ namespace ism3d
     }
 
     template
-    Utils::BoundingBox Utils::computeMVBB<PointT>(const pcl::PointCloud<PointT>::ConstPtr&);
+    Utils::BoundingBox Utils::computeMVBB<PointT>(const pcl::PointCloud<PointT>::ConstPtr&, float, float);
 
     template
-    Utils::BoundingBox Utils::computeMVBB<PointNormalT>(const pcl::PointCloud<PointNormalT>::ConstPtr&);
+    Utils::BoundingBox Utils::computeMVBB<PointNormalT>(const pcl::PointCloud<PointNormalT>::ConstPtr&, float, float);
 
     template<typename T>
-    Utils::BoundingBox Utils::computeMVBB(const typename pcl::PointCloud<T>::ConstPtr &model)
-    {       
-        // remove nan points to avoid infinite loops
-        typename pcl::PointCloud<T>::Ptr cloud(new pcl::PointCloud<T>());
-        std::vector<int> indices;
-        pcl::removeNaNFromPointCloud(*model,*cloud, indices);
-
-        gdiam_real* points = (gdiam_point)malloc(sizeof(gdiam_point_t) * cloud->points.size());
-        assert(points != NULL);
-
-        for (int i = 0; i < (int)cloud->size(); i++) {
-            const T& point = cloud->at(i);
-            points[i * 3 + 0] = point.x;
-            points[i * 3 + 1] = point.y;
-            points[i * 3 + 2] = point.z;
+    Utils::BoundingBox Utils::computeMVBB(const typename pcl::PointCloud<T>::ConstPtr &model, float eps, float leafSize)
+    {
+        // only finite points are used to avoid infinite loops
+        std::vector<gdiam_real> points;
+        points.reserve(model->size() * 3);
+        for (int i = 0; i < (int)model->size(); i++) {
+            const T& point = model->points[i];
+            if (!pcl::isFinite(point))
+                continue;
+            points.push_back(point.x);
+            points.push_back(point.y);
+            points.push_back(point.z);
+        }
+
+        const int numPoints = (int)points.size() / 3;
+        if (numPoints == 0) {
+            LOG_WARN("no valid points to compute a bounding box");
+            Utils::BoundingBox box;
+            box.rotQuat = boost::math::quaternion<float>(1, 0, 0, 0);
+            box.size = Eigen::Vector3f::Zero();
+            box.position = Eigen::Vector3f::Zero();
+            return box;
+        }
+
+        // the box directions are computed on the voxel centroids, which are within a voxel of the surface
+        std::vector<gdiam_real> samples;
+        if (leafSize > 0) {
+            pcl::PointCloud<T> voxels;
+            VoxelHashGrid grid;
+            grid.setNumThreads(1);
+            grid.filter(*model, leafSize, voxels);
+
+            samples.reserve(voxels.size() * 3);
+            for (int i = 0; i < (int)voxels.size(); i++) {
+                samples.push_back(voxels.points[i].x);
+                samples.push_back(voxels.points[i].y);
+                samples.push_back(voxels.points[i].z);
+            }
         }
 
-        // compute minimum volume bounding box
-        gdiam_point* pnt_arr = gdiam_convert((gdiam_real*)points, cloud->points.size());
-        gdiam_bbox bb = gdiam_approx_mvbb(pnt_arr, cloud->points.size(), 0.0);
-        free(points);
+        gdiam_point* pnt_arr = gdiam_convert(points.data(), numPoints);
+        gdiam_bbox bb;
+        if (samples.size() >= 3 * 4 && samples.size() < points.size()) {
+            const int numSamples = (int)samples.size() / 3;
+            gdiam_point* sample_arr = gdiam_convert(samples.data(), numSamples);
+            bb = gdiam_approx_const_mvbb(sample_arr, numSamples, eps, NULL);
+            bb = gdiam_mvbb_optimize(sample_arr, numSamples, bb, 10);
+            free(sample_arr);
+
+            // extend the box to contain all points
+            for (int i = 0; i < numPoints; i++)
+                bb.bound(pnt_arr[i]);
+        }
+        else {
+            // compute minimum volume bounding box
+            bb = gdiam_approx_const_mvbb(pnt_arr, numPoints, eps, NULL);
+            bb = gdiam_mvbb_optimize(pnt_arr, numPoints, bb, 10);
+        }
+        free(pnt_arr);
 
         Eigen::Vector3d minP, maxP;
         bb.get_min(&minP[0], &minP[1], &minP[2]);
@@ -572,49 +611,35 @@ namespace ism3d
                                     const std::vector<float>& weights,
                                     boost::math::quaternion<float>& result)
     {
-        Eigen::Matrix4f scatterMatrix;
-        scatterMatrix.setZero();
-
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-                float value = 0;
-
-                #pragma omp parallel for
-                for (int k = 0; k < (int)quaternions.size(); k++)
-                {
-                    const boost::math::quaternion<float>& quat1 = quaternions[k];
-                    Eigen::Vector4f quatVec1(quat1.R_component_1(), quat1.R_component_2(), quat1.R_component_3(), quat1.R_component_4());
-                    float weight = weights[k];
-                    float factor = weight * quatVec1[i] * quatVec1[j];
-                    #pragma omp critical
-                    {
-                        value += factor;
-                    }
-                }
-                scatterMatrix(i, j) = value;
-            }
-        }
+        QuaternionAverage average;
+        for (int i = 0; i < (int)quaternions.size(); i++)
+            average.add(quaternions[i], weights[i]);
+        return average.compute(result);
+    }
 
-        Eigen::EigenSolver<Eigen::Matrix4f> solver(scatterMatrix);
-        Eigen::EigenSolver<Eigen::Matrix4f>::EigenvalueType eigenvalues = solver.eigenvalues();
-        Eigen::EigenSolver<Eigen::Matrix4f>::EigenvectorsType eigenvectors = solver.eigenvectors();
-
-        int maxEigenvalueIndex = 0;
-        float maxEigenvalue = 0;
-        for (int i = 0; i < eigenvalues.cols(); i++) {
-            const std::complex<float> eigenvalue = eigenvalues[i];
-            if (eigenvalue.real() > maxEigenvalue) {
-                maxEigenvalue = eigenvalue.real();
-                maxEigenvalueIndex = i;
-            }
-        }
+    QuaternionAverage::QuaternionAverage()
+        : m_scatter(Eigen::Matrix4f::Zero()), m_weight(0)
+    {
+    }
 
-        Eigen::Vector4cf maxEigenvector(eigenvectors(0, maxEigenvalueIndex),
-                                       eigenvectors(1, maxEigenvalueIndex),
-                                       eigenvectors(2, maxEigenvalueIndex),
-                                       eigenvectors(3, maxEigenvalueIndex));
+    void QuaternionAverage::add(const boost::math::quaternion<float>& quat, float weight)
+    {
+        const Eigen::Vector4f vec(quat.R_component_1(), quat.R_component_2(), quat.R_component_3(), quat.R_component_4());
+        m_scatter.noalias() += weight * vec * vec.transpose();
+        m_weight += weight;
+    }
 
-        result = boost::math::quaternion<float>(maxEigenvector[0].real(), maxEigenvector[1].real(),
-                maxEigenvector[2].real(), maxEigenvector[3].real());
+    bool QuaternionAverage::compute(boost::math::quaternion<float>& result) const
+    {
+        if (!(m_weight > 0))
+            return false;
+
+        // the scatter matrix is symmetric, its eigenvalues are sorted in increasing order
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix4f> solver(m_scatter / m_weight);
+        if (solver.info() != Eigen::Success)
+            return false;
+        const Eigen::Vector4f average = solver.eigenvectors().col(3);
+        result = boost::math::quaternion<float>(average[0], average[1], average[2], average[3]);
+        return true;
     }
 }
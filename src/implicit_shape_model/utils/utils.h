@@ -25,19 +25,77 @@ namespace ism3d
 {
     #define GET_MACRO(_1, _2, NAME, ...) NAME
 
-    // logging
-    #define LOG_WARN(message) LOG4CXX_WARN(log4cxx::Logger::getRootLogger(), message)
+    // logging, messages below the compile time level ISM3D_LOG_LEVEL (0: debug, 1: info, 2: warn, 3: error) are
+    // removed by the preprocessor, so that neither the message nor the level check is evaluated
+    #ifndef ISM3D_LOG_LEVEL
+    #define ISM3D_LOG_LEVEL 0
+    #endif
+    #define LOG_DISABLED(message) do {} while (0)
+
+    #if ISM3D_LOG_LEVEL <= 0
+    #define LOG_DEBUG(message) LOG4CXX_DEBUG(log4cxx::Logger::getRootLogger(), message)
+    #else
+    #define LOG_DEBUG(message) LOG_DISABLED(message)
+    #endif
+    #if ISM3D_LOG_LEVEL <= 1
     #define LOG_INFO(message) LOG4CXX_INFO(log4cxx::Logger::getRootLogger(), message)
+    #else
+    #define LOG_INFO(message) LOG_DISABLED(message)
+    #endif
+    #if ISM3D_LOG_LEVEL <= 2
+    #define LOG_WARN(message) LOG4CXX_WARN(log4cxx::Logger::getRootLogger(), message)
+    #else
+    #define LOG_WARN(message) LOG_DISABLED(message)
+    #endif
+    #if ISM3D_LOG_LEVEL <= 3
     #define LOG_ERROR(message) LOG4CXX_ERROR(log4cxx::Logger::getRootLogger(), message)
-    #define LOG_DEBUG(message) LOG4CXX_DEBUG(log4cxx::Logger::getRootLogger(), message)
+    #else
+    #define LOG_ERROR(message) LOG_DISABLED(message)
+    #endif
     #define LOG_FATAL(message) LOG4CXX_FATAL(log4cxx::Logger::getRootLogger(), message)
 
     #define LOG_ASSERT(...) GET_MACRO(__VA_ARGS__, LOG_ASSERT_MSG, LOG_ASSERT_COND)(__VA_ARGS__)
     #define LOG_ASSERT_MSG(condition, message) LOG4CXX_ASSERT(log4cxx::Logger::getRootLogger(), condition, message)
     #define LOG_ASSERT_COND(condition) LOG4CXX_ASSERT(log4cxx::Logger::getRootLogger(), condition, "assertion failed: " << #condition)
 
+    // built with ISM3D_COLORLESS_POINTS, the points have no color: PointT takes half the memory, the normal
+    // type keeps its size, and the color based descriptors (CSHOT) are not available
+#ifdef ISM3D_COLORLESS_POINTS
+    typedef pcl::PointXYZ PointT;
+    typedef pcl::PointNormal PointNormalT;
+#else
     typedef pcl::PointXYZRGB PointT;
     typedef pcl::PointXYZRGBNormal PointNormalT;
+#endif
+
+    // color access for both point configurations, points without color read as black and ignore colors
+    template<typename Point>
+    inline void setPointColor(Point &point, uint8_t r, uint8_t g, uint8_t b)
+    {
+        point.r = r;
+        point.g = g;
+        point.b = b;
+    }
+    inline void setPointColor(pcl::PointXYZ &, uint8_t, uint8_t, uint8_t) {}
+    inline void setPointColor(pcl::PointNormal &, uint8_t, uint8_t, uint8_t) {}
+
+    template<typename Point>
+    inline void getPointColor(const Point &point, uint8_t &r, uint8_t &g, uint8_t &b)
+    {
+        r = point.r;
+        g = point.g;
+        b = point.b;
+    }
+    inline void getPointColor(const pcl::PointXYZ &, uint8_t &r, uint8_t &g, uint8_t &b) { r = g = b = 0; }
+    inline void getPointColor(const pcl::PointNormal &, uint8_t &r, uint8_t &g, uint8_t &b) { r = g = b = 0; }
+
+    template<typename PointIn, typename PointOut>
+    inline void copyPointColor(const PointIn &in, PointOut &out)
+    {
+        uint8_t r, g, b;
+        getPointColor(in, r, g, b);
+        setPointColor(out, r, g, b);
+    }
 
     /**
      * @brief The Utils class
@@ -80,8 +138,10 @@ namespace ism3d
 
         template<typename T>
         static BoundingBox computeAABB(const typename pcl::PointCloud<T>::ConstPtr &cloud);
+        // the box directions are approximated with eps on the points of a voxel grid with the given leaf size,
+        // a leaf size of 0 uses all points, the box always contains all points
         template<typename T>
-        static BoundingBox computeMVBB(const typename pcl::PointCloud<T>::ConstPtr &cloud);
+        static BoundingBox computeMVBB(const typename pcl::PointCloud<T>::ConstPtr &cloud, float eps = 0.0f, float leafSize = 0.0f);
 
         // misc helper functions
         template<typename T>
@@ -114,6 +174,28 @@ namespace ism3d
         Utils();
         ~Utils();
     };
+
+    /**
+     * @brief The QuaternionAverage class
+     * Weighted average of rotations after Markley et al.: the quaternions are accumulated into their weighted
+     * scatter matrix, the average is its eigenvector with the largest eigenvalue. Neither the quaternions
+     * nor the weights are stored and the weights need not be normalized, the sign of a quaternion does not
+     * matter.
+     */
+    class QuaternionAverage
+    {
+    public:
+        QuaternionAverage();
+
+        void add(const boost::math::quaternion<float>& quat, float weight);
+
+        // returns false if no rotation with a positive weight was added, the result is then not changed
+        bool compute(boost::math::quaternion<float>& result) const;
+
+    private:
+        Eigen::Matrix4f m_scatter;
+        float m_weight;
+    };
 }
 
 #endif // ISM3D_UTILS_H
@@ -0,0 +1,313 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "vocabulary_tree.h"
+#include "distance.h"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <random>
+
+namespace ism3d
+{
+    VocabularyTree::VocabularyTree()
+        : m_dim(0), m_branching(0), m_depth(0), m_iterations(0)
+    {
+    }
+
+    void VocabularyTree::build(const float *data, int num_rows, int dim, int branching, int depth, int iterations,
+                               const Distance &distance)
+    {
+        m_dim = dim;
+        m_branching = std::max(2, branching);
+        m_depth = std::max(1, depth);
+        m_iterations = std::max(1, iterations);
+
+        m_centers.clear();
+        m_first_child.clear();
+        m_num_children.clear();
+        m_leaf_index.clear();
+        m_leaf_nodes.clear();
+        m_leaf_offsets.assign(1, 0);
+        m_rows.resize(num_rows);
+        for (int i = 0; i < num_rows; i++)
+            m_rows[i] = i;
+        if (num_rows == 0)
+            return;
+
+        // the root center is the mean of all rows
+        std::vector<double> mean(dim, 0);
+        for (int i = 0; i < num_rows; i++)
+        {
+            const float *row = data + (size_t)i * dim;
+            for (int d = 0; d < dim; d++)
+                mean[d] += row[d];
+        }
+        for (int d = 0; d < dim; d++)
+            m_centers.push_back(mean[d] / num_rows);
+        m_first_child.push_back(-1);
+        m_num_children.push_back(0);
+        m_leaf_index.push_back(-1);
+
+        split(data, 0, 0, num_rows, 0, distance);
+    }
+
+    void VocabularyTree::split(const float *data, int node, int begin, int end, int depth, const Distance &distance)
+    {
+        // the rows of a node are the range [begin, end) of m_rows, leaves are created in depth first order and
+        // thus cover consecutive ranges
+        std::vector<float> centers;
+        std::vector<int> assignment;
+        int k = 0;
+        if (depth < m_depth && end - begin > m_branching)
+            k = kMeans(data, begin, end, m_branching, node, distance, centers, assignment);
+
+        if (k <= 1)
+        {
+            m_leaf_index[node] = (int)m_leaf_nodes.size();
+            m_leaf_nodes.push_back(node);
+            m_leaf_offsets.push_back(end);
+            return;
+        }
+
+        // sort the rows of the node by child
+        std::vector<int> childOffsets(k + 1, 0);
+        for (int i = 0; i < end - begin; i++)
+            childOffsets[assignment[i] + 1]++;
+        for (int c = 0; c < k; c++)
+            childOffsets[c + 1] += childOffsets[c];
+        std::vector<int> next(childOffsets.begin(), childOffsets.end() - 1);
+        std::vector<int> sorted(end - begin);
+        for (int i = 0; i < end - begin; i++)
+            sorted[next[assignment[i]]++] = m_rows[begin + i];
+        std::copy(sorted.begin(), sorted.end(), m_rows.begin() + begin);
+
+        const int firstChild = (int)m_first_child.size();
+        m_first_child[node] = firstChild;
+        m_num_children[node] = k;
+        m_centers.insert(m_centers.end(), centers.begin(), centers.end());
+        m_first_child.insert(m_first_child.end(), k, -1);
+        m_num_children.insert(m_num_children.end(), k, 0);
+        m_leaf_index.insert(m_leaf_index.end(), k, -1);
+
+        for (int c = 0; c < k; c++)
+            split(data, firstChild + c, begin + childOffsets[c], begin + childOffsets[c + 1], depth + 1, distance);
+    }
+
+    int VocabularyTree::kMeans(const float *data, int begin, int end, int k, unsigned seed, const Distance &distance,
+                               std::vector<float> &centers, std::vector<int> &assignment) const
+    {
+        const int numRows = end - begin;
+        const int dim = m_dim;
+        const int *rows = &m_rows[begin];
+        std::mt19937 rng(seed);
+
+        // k-means++ seeding
+        centers.clear();
+        centers.reserve((size_t)k * dim);
+        std::vector<float> minDist(numRows, std::numeric_limits<float>::max());
+        int chosen = std::uniform_int_distribution<int>(0, numRows - 1)(rng);
+        for (int c = 0; c < k; c++)
+        {
+            const float *center = data + (size_t)rows[chosen] * dim;
+            centers.insert(centers.end(), center, center + dim);
+            if (c + 1 == k)
+                break;
+
+            double total = 0;
+#pragma omp parallel for reduction(+:total) if(numRows > 10000)
+            for (int i = 0; i < numRows; i++)
+            {
+                minDist[i] = std::min(minDist[i], distance(data + (size_t)rows[i] * dim, center, dim));
+                total += minDist[i];
+            }
+
+            // all remaining rows coincide with a center
+            if (total <= 0)
+                break;
+
+            double threshold = std::uniform_real_distribution<double>(0, total)(rng);
+            chosen = numRows - 1;
+            for (int i = 0; i < numRows; i++)
+            {
+                threshold -= minDist[i];
+                if (threshold <= 0 && minDist[i] > 0)
+                {
+                    chosen = i;
+                    break;
+                }
+            }
+        }
+        k = (int)(centers.size() / dim);
+
+        // lloyd iterations
+        assignment.assign(numRows, -1);
+        std::vector<double> sums((size_t)k * dim);
+        std::vector<int> counts(k);
+        for (int it = 0; it < m_iterations; it++)
+        {
+            int changed = 0;
+#pragma omp parallel for reduction(+:changed) if(numRows > 10000)
+            for (int i = 0; i < numRows; i++)
+            {
+                const float *row = data + (size_t)rows[i] * dim;
+                int best = 0;
+                float bestDist = std::numeric_limits<float>::max();
+                for (int c = 0; c < k; c++)
+                {
+                    float dist = distance(row, &centers[(size_t)c * dim], dim);
+                    if (dist < bestDist)
+                    {
+                        bestDist = dist;
+                        best = c;
+                    }
+                }
+                if (assignment[i] != best)
+                {
+                    assignment[i] = best;
+                    changed++;
+                }
+            }
+
+            std::fill(sums.begin(), sums.end(), 0.0);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (int i = 0; i < numRows; i++)
+            {
+                const float *row = data + (size_t)rows[i] * dim;
+                double *sum = &sums[(size_t)assignment[i] * dim];
+                for (int d = 0; d < dim; d++)
+                    sum[d] += row[d];
+                counts[assignment[i]]++;
+            }
+            for (int c = 0; c < k; c++)
+            {
+                if (counts[c] == 0)
+                    continue;
+                for (int d = 0; d < dim; d++)
+                    centers[(size_t)c * dim + d] = sums[(size_t)c * dim + d] / counts[c];
+            }
+
+            if (changed == 0)
+                break;
+        }
+
+        // remove empty clusters
+        std::vector<int> remap(k, -1);
+        int numClusters = 0;
+        for (int c = 0; c < k; c++)
+        {
+            if (counts[c] == 0)
+                continue;
+            if (numClusters != c)
+                std::copy(&centers[(size_t)c * dim], &centers[(size_t)c * dim] + dim, &centers[(size_t)numClusters * dim]);
+            remap[c] = numClusters++;
+        }
+        centers.resize((size_t)numClusters * dim);
+        for (int i = 0; i < numRows; i++)
+            assignment[i] = remap[assignment[i]];
+        return numClusters;
+    }
+
+    int VocabularyTree::nearestChild(const float *query, int node, const Distance &distance, float &min_dist) const
+    {
+        int best = m_first_child[node];
+        min_dist = std::numeric_limits<float>::max();
+        for (int child = m_first_child[node]; child < m_first_child[node] + m_num_children[node]; child++)
+        {
+            float dist = distance(query, &m_centers[(size_t)child * m_dim], m_dim);
+            if (dist < min_dist)
+            {
+                min_dist = dist;
+                best = child;
+            }
+        }
+        return best;
+    }
+
+    int VocabularyTree::findLeaf(const float *query, const Distance &distance) const
+    {
+        if (empty())
+            return -1;
+
+        int node = 0;
+        float dist;
+        while (m_num_children[node] > 0)
+            node = nearestChild(query, node, distance, dist);
+        return m_leaf_index[node];
+    }
+
+    void VocabularyTree::search(const float *query, int num_rows, const Distance &distance, std::vector<int> &rows) const
+    {
+        rows.clear();
+        if (empty())
+            return;
+
+        // unvisited branches ordered by the distance of the query to their centers
+        typedef std::pair<float, int> Branch;
+        std::priority_queue<Branch, std::vector<Branch>, std::greater<Branch> > branches;
+        branches.push(Branch(0, 0));
+        while (!branches.empty() && (int)rows.size() < num_rows)
+        {
+            int node = branches.top().second;
+            branches.pop();
+            while (m_num_children[node] > 0)
+            {
+                float minDist;
+                int best = nearestChild(query, node, distance, minDist);
+                for (int child = m_first_child[node]; child < m_first_child[node] + m_num_children[node]; child++)
+                {
+                    if (child != best)
+                        branches.push(Branch(distance(query, &m_centers[(size_t)child * m_dim], m_dim), child));
+                }
+                node = best;
+            }
+
+            const int leaf = m_leaf_index[node];
+            rows.insert(rows.end(), m_rows.begin() + m_leaf_offsets[leaf], m_rows.begin() + m_leaf_offsets[leaf + 1]);
+        }
+    }
+
+    void VocabularyTree::saveData(boost::archive::binary_oarchive &oa) const
+    {
+        oa << m_dim;
+        oa << m_branching;
+        oa << m_depth;
+        oa << m_iterations;
+        oa << m_centers;
+        oa << m_first_child;
+        oa << m_num_children;
+        oa << m_leaf_index;
+        oa << m_leaf_nodes;
+        oa << m_leaf_offsets;
+        oa << m_rows;
+    }
+
+    bool VocabularyTree::loadData(boost::archive::binary_iarchive &ia)
+    {
+        ia >> m_dim;
+        ia >> m_branching;
+        ia >> m_depth;
+        ia >> m_iterations;
+        ia >> m_centers;
+        ia >> m_first_child;
+        ia >> m_num_children;
+        ia >> m_leaf_index;
+        ia >> m_leaf_nodes;
+        ia >> m_leaf_offsets;
+        ia >> m_rows;
+
+        const size_t numNodes = m_first_child.size();
+        return m_centers.size() == numNodes * m_dim && m_num_children.size() == numNodes &&
+                m_leaf_index.size() == numNodes && m_leaf_offsets.size() == m_leaf_nodes.size() + 1 &&
+                m_leaf_offsets.back() == (int)m_rows.size();
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_VOCABULARY_TREE_H
+#define ISM3D_VOCABULARY_TREE_H
+
+#include <vector>
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+namespace ism3d
+{
+    struct Distance;
+
+    /**
+     * @brief The VocabularyTree class
+     * Hierarchical k-means tree (Nister and Stewenius, 2006). Each inner node is split into at most "branching"
+     * children by k-means on the rows assigned to it, until the maximum depth is reached or a node has no more
+     * rows than the branching factor. The rows of the data are stored in the leaves, a query descends to the
+     * leaf of the nearest child center on each level with branching * depth distance evaluations. Nodes are
+     * stored in flat arrays, the children of a node are consecutive.
+     */
+    class VocabularyTree
+    {
+    public:
+        VocabularyTree();
+
+        /**
+         * @brief Build the tree on the rows of a data matrix.
+         * @param data the data, one row per item
+         * @param num_rows the number of rows
+         * @param dim the row length
+         * @param branching the maximum number of children of a node
+         * @param depth the maximum depth of a leaf, the root has depth 0
+         * @param iterations the maximum number of k-means iterations per node
+         * @param distance the distance for assigning rows to centers, centers are means
+         */
+        void build(const float *data, int num_rows, int dim, int branching, int depth, int iterations,
+                   const Distance &distance);
+
+        /**
+         * @brief Find the leaf of a query by descending to the nearest child on each level.
+         * @param query the query of length getDim()
+         * @param distance the distance the tree was built with
+         * @return the leaf index
+         */
+        int findLeaf(const float *query, const Distance &distance) const;
+
+        /**
+         * @brief Collect the rows of the leaves closest to a query. Leaves are visited best bin first, starting
+         * with the leaf found by findLeaf(), until at least num_rows rows are collected or all leaves are visited.
+         * @param query the query of length getDim()
+         * @param num_rows the minimum number of rows to collect
+         * @param distance the distance the tree was built with
+         * @param rows output: the collected rows in leaf order
+         */
+        void search(const float *query, int num_rows, const Distance &distance, std::vector<int> &rows) const;
+
+        int getNumLeaves() const
+        {
+            return m_leaf_offsets.empty() ? 0 : (int)m_leaf_offsets.size() - 1;
+        }
+
+        int getNumNodes() const
+        {
+            return (int)m_first_child.size();
+        }
+
+        int getDim() const
+        {
+            return m_dim;
+        }
+
+        bool empty() const
+        {
+            return m_first_child.empty();
+        }
+
+        // center of a leaf, the mean of its rows
+        const float* getLeafCenter(int leaf) const
+        {
+            return &m_centers[(size_t)m_leaf_nodes[leaf] * m_dim];
+        }
+
+        // the rows of a leaf are getLeafRows()[getLeafOffset(leaf)] to getLeafRows()[getLeafOffset(leaf + 1) - 1]
+        int getLeafOffset(int leaf) const
+        {
+            return m_leaf_offsets[leaf];
+        }
+
+        const std::vector<int>& getLeafRows() const
+        {
+            return m_rows;
+        }
+
+        void saveData(boost::archive::binary_oarchive &oa) const;
+        bool loadData(boost::archive::binary_iarchive &ia);
+
+    private:
+        void split(const float *data, int node, int begin, int end, int depth, const Distance &distance);
+        int kMeans(const float *data, int begin, int end, int k, unsigned seed, const Distance &distance,
+                   std::vector<float> &centers, std::vector<int> &assignment) const;
+        int nearestChild(const float *query, int node, const Distance &distance, float &min_dist) const;
+
+        int m_dim;
+        int m_branching;
+        int m_depth;
+        int m_iterations;
+
+        // per node: the node centers, the index of the first child and the number of children (0 for leaves)
+        // and the leaf index (-1 for inner nodes)
+        std::vector<float> m_centers;
+        std::vector<int> m_first_child;
+        std::vector<int> m_num_children;
+        std::vector<int> m_leaf_index;
+
+        // per leaf: the node index and the range of the leaf rows in m_rows
+        std::vector<int> m_leaf_nodes;
+        std::vector<int> m_leaf_offsets;
+        std::vector<int> m_rows;
+    };
+}
+
+#endif // ISM3D_VOCABULARY_TREE_H
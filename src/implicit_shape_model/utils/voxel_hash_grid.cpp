@@ -0,0 +1,206 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "voxel_hash_grid.h"
+
+#include <cmath>
+#include <omp.h>
+
+namespace ism3d
+{
+    namespace
+    {
+        // sum of the fields of the points in a voxel, colors are averaged per channel as pcl::VoxelGrid does
+        struct PointSum
+        {
+            PointSum()
+                : x(0), y(0), z(0), r(0), g(0), b(0), normal_x(0), normal_y(0), normal_z(0), curvature(0)
+            {
+            }
+
+            void add(const PointT &point)
+            {
+                x += point.x;
+                y += point.y;
+                z += point.z;
+                addColor(point);
+            }
+
+            void add(const PointNormalT &point)
+            {
+                x += point.x;
+                y += point.y;
+                z += point.z;
+                addColor(point);
+                normal_x += point.normal_x;
+                normal_y += point.normal_y;
+                normal_z += point.normal_z;
+                curvature += point.curvature;
+            }
+
+            void get(int count, PointT &point) const
+            {
+                const float scale = 1.0f / count;
+                point.x = x * scale;
+                point.y = y * scale;
+                point.z = z * scale;
+                setPointColor(point, (uint8_t)(r * scale), (uint8_t)(g * scale), (uint8_t)(b * scale));
+            }
+
+            void get(int count, PointNormalT &point) const
+            {
+                const float scale = 1.0f / count;
+                point.x = x * scale;
+                point.y = y * scale;
+                point.z = z * scale;
+                setPointColor(point, (uint8_t)(r * scale), (uint8_t)(g * scale), (uint8_t)(b * scale));
+                point.normal_x = normal_x * scale;
+                point.normal_y = normal_y * scale;
+                point.normal_z = normal_z * scale;
+                point.curvature = curvature * scale;
+            }
+
+            template<typename Point>
+            void addColor(const Point &point)
+            {
+                uint8_t red, green, blue;
+                getPointColor(point, red, green, blue);
+                r += red;
+                g += green;
+                b += blue;
+            }
+
+            float x, y, z;
+            float r, g, b;
+            float normal_x, normal_y, normal_z;
+            float curvature;
+        };
+    }
+
+    VoxelHashGrid::VoxelHashGrid()
+        : m_num_threads(0)
+    {
+    }
+
+    void VoxelHashGrid::setNumThreads(int num_threads)
+    {
+        m_num_threads = num_threads;
+    }
+
+    void VoxelHashGrid::filter(const pcl::PointCloud<PointNormalT> &input, float leaf_size, pcl::PointCloud<PointNormalT> &output)
+    {
+        group(input, leaf_size);
+        average(input, output);
+    }
+
+    void VoxelHashGrid::filter(const pcl::PointCloud<PointT> &input, float leaf_size, pcl::PointCloud<PointT> &output)
+    {
+        group(input, leaf_size);
+        average(input, output);
+    }
+
+    void VoxelHashGrid::filter(const pcl::PointCloud<PointNormalT> &input, float leaf_size, float coarse_leaf_size,
+                               pcl::PointCloud<PointNormalT> &output, pcl::PointCloud<PointT> &coarse)
+    {
+        group(input, leaf_size);
+        average(input, output);
+
+        // the coarse voxels only visit the fine voxels
+        group(output, coarse_leaf_size);
+        average(output, coarse);
+    }
+
+    template<typename PointInT>
+    void VoxelHashGrid::group(const pcl::PointCloud<PointInT> &input, float leaf_size)
+    {
+        const int num_points = (int)input.size();
+        const float inverse_leaf_size = 1.0f / leaf_size;
+
+        m_keys.resize(num_points);
+        m_valid.resize(num_points);
+
+        #pragma omp parallel for num_threads(getNumThreadsToUse()) if(num_points > 10000)
+        for (int i = 0; i < num_points; i++)
+        {
+            const PointInT &point = input.points[i];
+            m_valid[i] = pcl_isfinite(point.x) && pcl_isfinite(point.y) && pcl_isfinite(point.z);
+            if (!m_valid[i])
+                continue;
+
+            VoxelKey &key = m_keys[i];
+            key.x = (int64_t)std::floor(point.x * inverse_leaf_size);
+            key.y = (int64_t)std::floor(point.y * inverse_leaf_size);
+            key.z = (int64_t)std::floor(point.z * inverse_leaf_size);
+        }
+
+        // voxel indices in the order of their first point
+        m_voxels.clear();
+        m_point_voxels.resize(num_points);
+        m_voxel_offsets.assign(1, 0);
+        for (int i = 0; i < num_points; i++)
+        {
+            if (!m_valid[i])
+            {
+                m_point_voxels[i] = -1;
+                continue;
+            }
+
+            std::pair<std::unordered_map<VoxelKey, int, VoxelKeyHash>::iterator, bool> inserted =
+                    m_voxels.insert(std::make_pair(m_keys[i], (int)m_voxels.size()));
+            const int voxel = inserted.first->second;
+            if (inserted.second)
+                m_voxel_offsets.push_back(0);
+            m_point_voxels[i] = voxel;
+            m_voxel_offsets[voxel + 1]++;
+        }
+
+        for (int i = 1; i < (int)m_voxel_offsets.size(); i++)
+            m_voxel_offsets[i] += m_voxel_offsets[i - 1];
+
+        // points sorted by voxel with a counting sort
+        m_voxel_points.resize(m_voxel_offsets.back());
+        m_voxel_fill.assign(m_voxel_offsets.begin(), m_voxel_offsets.end() - 1);
+        for (int i = 0; i < num_points; i++)
+        {
+            const int voxel = m_point_voxels[i];
+            if (voxel >= 0)
+                m_voxel_points[m_voxel_fill[voxel]++] = i;
+        }
+    }
+
+    template<typename PointInT, typename PointOutT>
+    void VoxelHashGrid::average(const pcl::PointCloud<PointInT> &input, pcl::PointCloud<PointOutT> &output) const
+    {
+        const int num_voxels = (int)m_voxel_offsets.size() - 1;
+        output.header = input.header;
+        output.points.resize(num_voxels);
+
+        #pragma omp parallel for num_threads(getNumThreadsToUse()) if(num_voxels > 1000)
+        for (int i = 0; i < num_voxels; i++)
+        {
+            PointSum sum;
+            for (int j = m_voxel_offsets[i]; j < m_voxel_offsets[i + 1]; j++)
+                sum.add(input.points[m_voxel_points[j]]);
+
+            PointOutT point;
+            sum.get(m_voxel_offsets[i + 1] - m_voxel_offsets[i], point);
+            output.points[i] = point;
+        }
+
+        output.width = (uint32_t)output.points.size();
+        output.height = 1;
+        output.is_dense = true;
+    }
+
+    int VoxelHashGrid::getNumThreadsToUse() const
+    {
+        return m_num_threads > 0 ? m_num_threads : omp_get_max_threads();
+    }
+}
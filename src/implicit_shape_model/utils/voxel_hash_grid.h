@@ -0,0 +1,103 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_VOXEL_HASH_GRID_H
+#define ISM3D_VOXEL_HASH_GRID_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include "utils.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The VoxelHashGrid class
+     * Replaces each voxel of a point cloud by the average of its points, like pcl::VoxelGrid with all fields. Points
+     * are assigned to voxels by hashing their integer voxel coordinates instead of sorting linear voxel indices, so
+     * that there is no limit on the number of voxels and the voxel averages are computed in parallel. A coarser
+     * voxelization of the filtered cloud, e.g. voxel grid keypoints, can be computed in the same call from the fine
+     * voxels. Voxels are output in the order of their first point. The buffers are kept between calls.
+     */
+    class VoxelHashGrid
+    {
+    public:
+        VoxelHashGrid();
+
+        /**
+         * @brief Set the number of threads to use, a value of 0 uses the OpenMP default.
+         */
+        void setNumThreads(int num_threads);
+
+        void filter(const pcl::PointCloud<PointNormalT> &input, float leaf_size, pcl::PointCloud<PointNormalT> &output);
+        void filter(const pcl::PointCloud<PointT> &input, float leaf_size, pcl::PointCloud<PointT> &output);
+
+        /**
+         * @brief Filter the input and voxelize the filtered cloud again with a coarser leaf size.
+         * @param input the input cloud
+         * @param leaf_size the leaf size of the filtered cloud
+         * @param coarse_leaf_size the leaf size of the coarse voxels
+         * @param output the filtered cloud
+         * @param coarse the coarse voxels of the filtered cloud, the same as filter(output, coarse_leaf_size, coarse)
+         */
+        void filter(const pcl::PointCloud<PointNormalT> &input, float leaf_size, float coarse_leaf_size,
+                    pcl::PointCloud<PointNormalT> &output, pcl::PointCloud<PointT> &coarse);
+
+    private:
+        struct VoxelKey
+        {
+            int64_t x;
+            int64_t y;
+            int64_t z;
+
+            bool operator==(const VoxelKey &other) const
+            {
+                return x == other.x && y == other.y && z == other.z;
+            }
+        };
+
+        struct VoxelKeyHash
+        {
+            std::size_t operator()(const VoxelKey &key) const
+            {
+                uint64_t hash = (uint64_t)key.x * 73856093ULL;
+                hash ^= (uint64_t)key.y * 19349663ULL;
+                hash ^= (uint64_t)key.z * 83492791ULL;
+                return (std::size_t)hash;
+            }
+        };
+
+        // assigns the points to voxels, afterwards the points of voxel i are m_voxel_points[m_voxel_offsets[i]...]
+        template<typename PointInT>
+        void group(const pcl::PointCloud<PointInT> &input, float leaf_size);
+
+        template<typename PointInT, typename PointOutT>
+        void average(const pcl::PointCloud<PointInT> &input, pcl::PointCloud<PointOutT> &output) const;
+
+        int getNumThreadsToUse() const;
+
+        int m_num_threads;
+
+        std::vector<VoxelKey> m_keys;
+        std::vector<char> m_valid;
+        std::vector<int> m_point_voxels;
+        std::vector<int> m_voxel_offsets;
+        std::vector<int> m_voxel_points;
+        std::vector<int> m_voxel_fill;
+        std::unordered_map<VoxelKey, int, VoxelKeyHash> m_voxels;
+    };
+}
+
+#endif // ISM3D_VOXEL_HASH_GRID_H
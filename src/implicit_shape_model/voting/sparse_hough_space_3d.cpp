@@ -0,0 +1,445 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "sparse_hough_space_3d.h"
+#include "../utils/utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace ism3d
+{
+    SparseHoughSpace3D::SparseHoughSpace3D()
+        : m_min_coord(0, 0, 0), m_bin_size(1, 1, 1), m_bin_count(0, 0, 0),
+          m_partial_bin_products(0, 0, 0), m_table_mask(0)
+    {
+        rehash(16);
+    }
+
+    void SparseHoughSpace3D::reset(const Eigen::Vector3d& minCoord, const Eigen::Vector3d& binSize,
+                                   const Eigen::Vector3d& maxCoord)
+    {
+        LOG_ASSERT(binSize.minCoeff() > 0);
+
+        m_min_coord = minCoord;
+        m_bin_size = binSize;
+        for (int i = 0; i < 3; i++)
+            m_bin_count[i] = std::max((int)std::ceil((maxCoord[i] - minCoord[i]) / binSize[i]), 0);
+
+        m_partial_bin_products[0] = 1;
+        m_partial_bin_products[1] = m_bin_count[0];
+        m_partial_bin_products[2] = (int64_t)m_bin_count[0] * m_bin_count[1];
+
+        reset();
+    }
+
+    void SparseHoughSpace3D::reset()
+    {
+        m_bin_keys.clear();
+        m_bin_coords.clear();
+        m_bin_values.clear();
+        m_voters.clear();
+        std::fill(m_table.begin(), m_table.end(), -1);
+    }
+
+    void SparseHoughSpace3D::reserve(int numBins)
+    {
+        m_bin_keys.reserve(numBins);
+        m_bin_coords.reserve(numBins);
+        m_bin_values.reserve(numBins);
+
+        size_t tableSize = m_table.size();
+        while (tableSize < (size_t)numBins * 2)
+            tableSize *= 2;
+        if (tableSize != m_table.size())
+            rehash(tableSize);
+    }
+
+    int64_t SparseHoughSpace3D::vote(const Eigen::Vector3d& position, double weight, int voterId)
+    {
+        Eigen::Vector3i coords;
+        int64_t key = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            coords[i] = (int)std::floor((position[i] - m_min_coord[i]) / m_bin_size[i]);
+            if (coords[i] < 0 || coords[i] >= m_bin_count[i])
+                return -1;
+            key += m_partial_bin_products[i] * coords[i];
+        }
+
+        addVote(key, weight, voterId);
+        return key;
+    }
+
+    int64_t SparseHoughSpace3D::voteInt(const Eigen::Vector3d& position, double weight, int voterId)
+    {
+        Eigen::Vector3i central;
+        Eigen::Vector3i direction;
+        Eigen::Vector3d offset;
+        int64_t centralKey = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            double pos = (position[i] - m_min_coord[i]) / m_bin_size[i];
+            central[i] = (int)std::floor(pos);
+            if (central[i] < 0 || central[i] >= m_bin_count[i])
+                return -1;
+            centralKey += m_partial_bin_products[i] * central[i];
+
+            // offset from the bin center, the second bin in this dimension is on the side of the vote
+            double rel = pos - central[i] - 0.5;
+            direction[i] = rel >= 0 ? 1 : -1;
+            offset[i] = std::fabs(rel);
+        }
+
+        for (int n = 0; n < 8; n++)
+        {
+            Eigen::Vector3i coords = central;
+            double binWeight = weight;
+            bool valid = true;
+            for (int i = 0; i < 3; i++)
+            {
+                if ((n >> i) & 1)
+                {
+                    coords[i] += direction[i];
+                    binWeight *= offset[i];
+                    if (coords[i] < 0 || coords[i] >= m_bin_count[i])
+                    {
+                        valid = false;
+                        break;
+                    }
+                }
+                else
+                {
+                    binWeight *= 1 - offset[i];
+                }
+            }
+
+            if (valid)
+            {
+                int64_t key = m_partial_bin_products[0] * coords[0] +
+                        m_partial_bin_products[1] * coords[1] +
+                        m_partial_bin_products[2] * coords[2];
+                addVote(key, binWeight, voterId);
+            }
+        }
+
+        return centralKey;
+    }
+
+    void SparseHoughSpace3D::voteParallel(const float* x, const float* y, const float* z, const float* weights,
+                                          int numVotes, bool interpolate, int numThreads)
+    {
+        numThreads = std::max(1, std::min(numThreads, 255));
+        const int numEntries = interpolate ? 8 : 1;
+        const float minX = (float)m_min_coord[0], minY = (float)m_min_coord[1], minZ = (float)m_min_coord[2];
+        const float scaleX = (float)(1 / m_bin_size[0]), scaleY = (float)(1 / m_bin_size[1]), scaleZ = (float)(1 / m_bin_size[2]);
+
+        // continuous bin coordinates of the votes, vectorized
+        std::vector<float> binX(numVotes), binY(numVotes), binZ(numVotes);
+        #pragma omp parallel for simd num_threads(numThreads) schedule(static)
+        for (int i = 0; i < numVotes; i++)
+        {
+            binX[i] = (x[i] - minX) * scaleX;
+            binY[i] = (y[i] - minY) * scaleY;
+            binZ[i] = (z[i] - minZ) * scaleZ;
+        }
+
+        // the bins and weights of each vote, -1 for bins outside of the voting space
+        std::vector<int64_t> keys((size_t)numVotes * numEntries, -1);
+        std::vector<float> entryWeights((size_t)numVotes * numEntries, 0);
+        std::vector<unsigned char> owners((size_t)numVotes * numEntries, 0);
+        #pragma omp parallel for num_threads(numThreads) schedule(static)
+        for (int i = 0; i < numVotes; i++)
+        {
+            const float pos[3] = {binX[i], binY[i], binZ[i]};
+            int central[3], direction[3];
+            float offset[3];
+            bool inside = true;
+            for (int d = 0; d < 3; d++)
+            {
+                central[d] = (int)std::floor(pos[d]);
+                inside = inside && central[d] >= 0 && central[d] < m_bin_count[d];
+                const float rel = pos[d] - central[d] - 0.5f;
+                direction[d] = rel >= 0 ? 1 : -1;
+                offset[d] = interpolate ? std::fabs(rel) : 0.0f;
+            }
+            if (!inside)
+                continue;
+
+            for (int n = 0; n < numEntries; n++)
+            {
+                int64_t key = 0;
+                float binWeight = weights[i];
+                bool valid = true;
+                for (int d = 0; d < 3; d++)
+                {
+                    int coord = central[d];
+                    if ((n >> d) & 1)
+                    {
+                        coord += direction[d];
+                        binWeight *= offset[d];
+                        valid = valid && coord >= 0 && coord < m_bin_count[d];
+                    }
+                    else
+                    {
+                        binWeight *= 1 - offset[d];
+                    }
+                    key += m_partial_bin_products[d] * coord;
+                }
+
+                if (valid)
+                {
+                    const size_t entry = (size_t)i * numEntries + n;
+                    keys[entry] = key;
+                    entryWeights[entry] = binWeight;
+                    owners[entry] = (unsigned char)((hashKey(key) >> 32) % numThreads);
+                }
+            }
+        }
+
+        // each thread accumulates its share of the bins, in the order of the votes
+        std::vector<SparseHoughSpace3D> shares(numThreads);
+        #pragma omp parallel for num_threads(numThreads) schedule(static, 1)
+        for (int t = 0; t < numThreads; t++)
+        {
+            SparseHoughSpace3D& share = shares[t];
+            share.m_bin_count = m_bin_count;
+            share.m_partial_bin_products = m_partial_bin_products;
+            for (size_t entry = 0; entry < keys.size(); entry++)
+            {
+                if (keys[entry] >= 0 && owners[entry] == t)
+                    share.addVote(keys[entry], entryWeights[entry], (int)(entry / numEntries));
+            }
+        }
+
+        // the shares contain disjoint bins
+        for (const SparseHoughSpace3D& share : shares)
+        {
+            std::vector<int> bins(share.m_bin_keys.size());
+            for (int b = 0; b < (int)share.m_bin_keys.size(); b++)
+            {
+                bins[b] = findOrInsertBin(share.m_bin_keys[b]);
+                m_bin_values[bins[b]] += share.m_bin_values[b];
+            }
+            for (const std::pair<int, int>& voter : share.m_voters)
+                m_voters.push_back({bins[voter.first], voter.second});
+        }
+    }
+
+    double SparseHoughSpace3D::findMaxima(double minThreshold, std::vector<double>& maxima,
+                                          std::vector<std::vector<int> >& voterIds) const
+    {
+        std::vector<int> maximaBins;
+        minThreshold = findMaximaBins(minThreshold, maximaBins);
+
+        std::vector<int> maximumIndex(m_bin_keys.size(), -1);
+        maxima.resize(maximaBins.size());
+        voterIds.clear();
+        voterIds.resize(maximaBins.size());
+        for (int i = 0; i < (int)maximaBins.size(); i++)
+        {
+            maximumIndex[maximaBins[i]] = i;
+            maxima[i] = m_bin_values[maximaBins[i]];
+        }
+
+        for (int i = 0; i < (int)m_voters.size(); i++)
+        {
+            int index = maximumIndex[m_voters[i].first];
+            if (index >= 0)
+                voterIds[index].push_back(m_voters[i].second);
+        }
+
+        return minThreshold;
+    }
+
+    double SparseHoughSpace3D::findMaxima(double minThreshold, std::vector<double>& maxima,
+                                          std::vector<Eigen::Vector3i>& bins) const
+    {
+        std::vector<int> maximaBins;
+        minThreshold = findMaximaBins(minThreshold, maximaBins);
+
+        maxima.resize(maximaBins.size());
+        bins.resize(maximaBins.size());
+        for (int i = 0; i < (int)maximaBins.size(); i++)
+        {
+            maxima[i] = m_bin_values[maximaBins[i]];
+            bins[i] = m_bin_coords[maximaBins[i]];
+        }
+        return minThreshold;
+    }
+
+    double SparseHoughSpace3D::findMaximaBins(double minThreshold, std::vector<int>& maximaBins) const
+    {
+        // a negative threshold is relative to the global maximum
+        if (minThreshold < 0)
+        {
+            double houghMaximum = std::numeric_limits<double>::min();
+            for (int i = 0; i < (int)m_bin_values.size(); i++)
+                houghMaximum = std::max(houghMaximum, m_bin_values[i]);
+            minThreshold = minThreshold >= -1 ? -minThreshold * houghMaximum : houghMaximum;
+        }
+
+        // only non-empty bins can be maxima, bins that are not stored have a value of 0
+        maximaBins.clear();
+        for (int b = 0; b < (int)m_bin_keys.size(); b++)
+        {
+            const double value = m_bin_values[b];
+            if (value < minThreshold)
+                continue;
+
+            const Eigen::Vector3i& coords = m_bin_coords[b];
+            bool isMaximum = true;
+            for (int dz = -1; dz <= 1 && isMaximum; dz++)
+            {
+                for (int dy = -1; dy <= 1 && isMaximum; dy++)
+                {
+                    for (int dx = -1; dx <= 1 && isMaximum; dx++)
+                    {
+                        if (dx == 0 && dy == 0 && dz == 0)
+                            continue;
+
+                        int64_t key = getBinKey(coords + Eigen::Vector3i(dx, dy, dz));
+                        if (key < 0)
+                            continue;
+
+                        int neighborBin = findBin(key);
+                        double neighborValue = neighborBin < 0 ? 0.0 : m_bin_values[neighborBin];
+                        if (neighborValue > value)
+                            isMaximum = false;
+                    }
+                }
+            }
+
+            if (isMaximum)
+                maximaBins.push_back(b);
+        }
+
+        // report maxima in the order of the dense pcl implementation
+        std::sort(maximaBins.begin(), maximaBins.end(), [this](int a, int b)
+        {
+            return m_bin_keys[a] < m_bin_keys[b];
+        });
+
+        return minThreshold;
+    }
+
+    void SparseHoughSpace3D::addBins(const SparseHoughSpace3D& other)
+    {
+        LOG_ASSERT(other.m_bin_count == m_bin_count);
+
+        for (int b = 0; b < (int)other.m_bin_keys.size(); b++)
+        {
+            int bin = findOrInsertBin(other.m_bin_keys[b]);
+            m_bin_values[bin] += other.m_bin_values[b];
+        }
+    }
+
+    bool SparseHoughSpace3D::votesInto(const Eigen::Vector3d& position, const Eigen::Vector3i& bin, bool interpolate) const
+    {
+        // same bins as vote() and voteInt()
+        for (int i = 0; i < 3; i++)
+        {
+            double pos = (position[i] - m_min_coord[i]) / m_bin_size[i];
+            int central = (int)std::floor(pos);
+            if (central < 0 || central >= m_bin_count[i])
+                return false;
+
+            int direction = pos - central - 0.5 >= 0 ? 1 : -1;
+            if (bin[i] != central && (!interpolate || bin[i] != central + direction))
+                return false;
+        }
+        return true;
+    }
+
+    int64_t SparseHoughSpace3D::getBinKey(const Eigen::Vector3i& bin) const
+    {
+        if ((bin.array() < 0).any() || (bin.array() >= m_bin_count.array()).any())
+            return -1;
+
+        return m_partial_bin_products[0] * bin[0] +
+                m_partial_bin_products[1] * bin[1] +
+                m_partial_bin_products[2] * bin[2];
+    }
+
+    int SparseHoughSpace3D::findBin(int64_t key) const
+    {
+        uint64_t slot = hashKey(key) & m_table_mask;
+        while (true)
+        {
+            int bin = m_table[slot];
+            if (bin < 0)
+                return -1;
+            if (m_bin_keys[bin] == key)
+                return bin;
+            slot = (slot + 1) & m_table_mask;
+        }
+    }
+
+    int SparseHoughSpace3D::findOrInsertBin(int64_t key)
+    {
+        // keep the load factor at most 0.5
+        if ((m_bin_keys.size() + 1) * 2 > m_table.size())
+            rehash(m_table.size() * 2);
+
+        uint64_t slot = hashKey(key) & m_table_mask;
+        while (true)
+        {
+            int bin = m_table[slot];
+            if (bin < 0)
+                break;
+            if (m_bin_keys[bin] == key)
+                return bin;
+            slot = (slot + 1) & m_table_mask;
+        }
+
+        int bin = (int)m_bin_keys.size();
+        m_table[slot] = bin;
+        m_bin_keys.push_back(key);
+        m_bin_coords.push_back(Eigen::Vector3i(key % m_bin_count[0], (key / m_partial_bin_products[1]) % m_bin_count[1],
+                                               key / m_partial_bin_products[2]));
+        m_bin_values.push_back(0);
+        return bin;
+    }
+
+    void SparseHoughSpace3D::addVote(int64_t key, double weight, int voterId)
+    {
+        int bin = findOrInsertBin(key);
+        m_bin_values[bin] += weight;
+        if (voterId >= 0)
+            m_voters.push_back({bin, voterId});
+    }
+
+    void SparseHoughSpace3D::rehash(size_t tableSize)
+    {
+        m_table.assign(tableSize, -1);
+        m_table_mask = tableSize - 1;
+
+        for (int b = 0; b < (int)m_bin_keys.size(); b++)
+        {
+            uint64_t slot = hashKey(m_bin_keys[b]) & m_table_mask;
+            while (m_table[slot] >= 0)
+                slot = (slot + 1) & m_table_mask;
+            m_table[slot] = b;
+        }
+    }
+
+    uint64_t SparseHoughSpace3D::hashKey(int64_t key)
+    {
+        // 64 bit finalizer of MurmurHash3
+        uint64_t h = (uint64_t)key;
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+}
@@ -0,0 +1,153 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_SPARSEHOUGHSPACE3D_H
+#define ISM3D_SPARSEHOUGHSPACE3D_H
+
+#include <vector>
+#include <cstdint>
+#include <Eigen/Core>
+
+namespace ism3d
+{
+    /**
+     * @brief The SparseHoughSpace3D class
+     * Sparse replacement for pcl::recognition::HoughSpace3D. Bins are laid out exactly as in the pcl
+     * implementation (aligned to the minimum coordinate, votes outside of [min, max) are rejected),
+     * but only bins that received votes are stored in an open addressing hash table. Memory and reset
+     * time therefore grow with the number of votes instead of the volume of the voting space. All buffers
+     * keep their capacity across reset() calls, so that one instance can be reused for all classes and scenes.
+     */
+    class SparseHoughSpace3D
+    {
+    public:
+        SparseHoughSpace3D();
+
+        /**
+         * @brief Remove all votes and set up the bin layout.
+         * @param minCoord the minimum coordinate of the voting space
+         * @param binSize the bin size in each dimension
+         * @param maxCoord the maximum coordinate of the voting space
+         */
+        void reset(const Eigen::Vector3d& minCoord, const Eigen::Vector3d& binSize, const Eigen::Vector3d& maxCoord);
+
+        /**
+         * @brief Remove all votes, but keep the bin layout.
+         */
+        void reset();
+
+        /**
+         * @brief Reserve space for the expected number of voted bins.
+         * @param numBins the expected number of non-empty bins
+         */
+        void reserve(int numBins);
+
+        /**
+         * @brief Add a vote to the bin containing the given position.
+         * @param position the vote position
+         * @param weight the vote weight
+         * @param voterId the id of the voter, negative to only add the weight
+         * @return the linear index of the bin or -1 if the position is outside the voting space
+         */
+        int64_t vote(const Eigen::Vector3d& position, double weight, int voterId);
+
+        /**
+         * @brief Add a vote to the 8 bins surrounding the given position using trilinear interpolation.
+         * @param position the vote position
+         * @param weight the vote weight
+         * @param voterId the id of the voter, negative to only add the weight
+         * @return the linear index of the central bin or -1 if the position is outside the voting space
+         */
+        int64_t voteInt(const Eigen::Vector3d& position, double weight, int voterId);
+
+        /**
+         * @brief Add many votes in parallel, with the bins of vote() or voteInt(). The bins and interpolation weights
+         * are computed in single precision in a vectorized pass. Each thread then accumulates the bins whose hash
+         * falls into its share, the shares are merged afterwards. Each bin is accumulated by a single thread in the
+         * order of the votes, so the values and voters do not depend on the number of threads.
+         * @param x, y, z the vote positions
+         * @param weights the vote weights
+         * @param numVotes the number of votes, the voter id of a vote is its index
+         * @param interpolate true to interpolate between the 8 surrounding bins as voteInt()
+         * @param numThreads the number of threads
+         */
+        void voteParallel(const float* x, const float* y, const float* z, const float* weights, int numVotes,
+                          bool interpolate, int numThreads);
+
+        /**
+         * @brief Find bins that are local maxima with respect to their 26 neighbors.
+         * @param minThreshold the minimum bin value, a value in [-1, 0) is interpreted as fraction of the
+         * global maximum, a value below -1 only accepts the global maximum
+         * @param maxima the values of the maxima, ordered by linear bin index
+         * @param voterIds the voters of each maximum in the order they voted
+         * @return the absolute threshold that was used
+         */
+        double findMaxima(double minThreshold, std::vector<double>& maxima, std::vector<std::vector<int> >& voterIds) const;
+
+        /**
+         * @brief Find the maxima as above, but report their bins instead of their voters.
+         * @param bins the coordinates of the bins of the maxima
+         */
+        double findMaxima(double minThreshold, std::vector<double>& maxima, std::vector<Eigen::Vector3i>& bins) const;
+
+        /**
+         * @brief Add the bin values of a voting space with the same bin layout, its voters are not added.
+         * @param other the voting space
+         */
+        void addBins(const SparseHoughSpace3D& other);
+
+        /**
+         * @brief Check whether vote() or voteInt() add the weight of a position to a bin.
+         * @param position the vote position
+         * @param bin the coordinates of the bin
+         * @param interpolate true for voteInt()
+         */
+        bool votesInto(const Eigen::Vector3d& position, const Eigen::Vector3i& bin, bool interpolate) const;
+
+        /**
+         * @brief The linear index of a bin as returned by vote(), -1 for coordinates outside the voting space.
+         */
+        int64_t getBinKey(const Eigen::Vector3i& bin) const;
+
+        int getNumBins() const
+        {
+            return (int)m_bin_keys.size();
+        }
+
+    private:
+        // the non-empty bins that are maxima, ordered by linear bin index
+        double findMaximaBins(double minThreshold, std::vector<int>& maximaBins) const;
+
+        int findBin(int64_t key) const;
+        int findOrInsertBin(int64_t key);
+        void addVote(int64_t key, double weight, int voterId);
+        void rehash(size_t tableSize);
+        static uint64_t hashKey(int64_t key);
+
+        Eigen::Vector3d m_min_coord;
+        Eigen::Vector3d m_bin_size;
+        Eigen::Vector3i m_bin_count;
+        Eigen::Matrix<int64_t, 3, 1> m_partial_bin_products;
+
+        // non-empty bins in order of their first vote
+        std::vector<int64_t> m_bin_keys;
+        std::vector<Eigen::Vector3i> m_bin_coords;
+        std::vector<double> m_bin_values;
+
+        // all (bin, voter) pairs in the order of voting
+        std::vector<std::pair<int, int> > m_voters;
+
+        // open addressing hash table mapping linear bin indices to bins (-1: empty slot)
+        std::vector<int> m_table;
+        uint64_t m_table_mask;
+    };
+}
+
+#endif // ISM3D_SPARSEHOUGHSPACE3D_H
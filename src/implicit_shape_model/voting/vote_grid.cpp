@@ -0,0 +1,148 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "vote_grid.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ism3d
+{
+    // cell coordinates are stored with 21 bits per dimension
+    static const int KEY_BITS = 21;
+    static const int64_t KEY_OFFSET = (int64_t)1 << (KEY_BITS - 1);
+    static const uint64_t KEY_MASK = ((uint64_t)1 << KEY_BITS) - 1;
+
+    VoteGrid::VoteGrid()
+        : m_cell_size(0), m_table_mask(0)
+    {
+    }
+
+    void VoteGrid::build(const std::vector<Voting::Vote>& votes, float cellSize)
+    {
+        LOG_ASSERT(cellSize > 0);
+        m_cell_size = cellSize;
+
+        // sort votes by cell key
+        const int numVotes = (int)votes.size();
+        std::vector<std::pair<uint64_t, int> > keys(numVotes);
+#pragma omp parallel for
+        for (int i = 0; i < numVotes; i++)
+            keys[i] = {packKey(getCellCoords(votes[i].position)), i};
+        std::sort(keys.begin(), keys.end());
+
+        m_x.resize(numVotes);
+        m_y.resize(numVotes);
+        m_z.resize(numVotes);
+        m_weights.resize(numVotes);
+        m_vote_indices.resize(numVotes);
+        m_cell_keys.clear();
+        m_cell_offsets.clear();
+
+        for (int i = 0; i < numVotes; i++)
+        {
+            const Voting::Vote& vote = votes[keys[i].second];
+            m_x[i] = vote.position[0];
+            m_y[i] = vote.position[1];
+            m_z[i] = vote.position[2];
+            m_weights[i] = vote.weight;
+            m_vote_indices[i] = keys[i].second;
+
+            if (i == 0 || keys[i].first != keys[i - 1].first)
+            {
+                m_cell_keys.push_back(keys[i].first);
+                m_cell_offsets.push_back(i);
+            }
+        }
+        m_cell_offsets.push_back(numVotes);
+
+        // hash table with a load factor of at most 0.5
+        size_t tableSize = 16;
+        while (tableSize < m_cell_keys.size() * 2)
+            tableSize *= 2;
+        m_table.assign(tableSize, -1);
+        m_table_mask = tableSize - 1;
+
+        for (int c = 0; c < (int)m_cell_keys.size(); c++)
+        {
+            uint64_t slot = hashKey(m_cell_keys[c]) & m_table_mask;
+            while (m_table[slot] >= 0)
+                slot = (slot + 1) & m_table_mask;
+            m_table[slot] = c;
+        }
+    }
+
+    void VoteGrid::build(const std::vector<Eigen::Vector3f>& positions, float cellSize)
+    {
+        std::vector<Voting::Vote> votes(positions.size());
+        for (int i = 0; i < (int)positions.size(); i++)
+        {
+            votes[i].position = positions[i];
+            votes[i].weight = 1;
+        }
+        build(votes, cellSize);
+    }
+
+    Eigen::Vector3i VoteGrid::getCellCoords(int cell) const
+    {
+        return unpackKey(m_cell_keys[cell]);
+    }
+
+    Eigen::Vector3i VoteGrid::getCellCoords(const Eigen::Vector3f& position) const
+    {
+        return Eigen::Vector3i((int)std::floor(position[0] / m_cell_size + 0.5f),
+                               (int)std::floor(position[1] / m_cell_size + 0.5f),
+                               (int)std::floor(position[2] / m_cell_size + 0.5f));
+    }
+
+    uint64_t VoteGrid::packKey(const Eigen::Vector3i& coords)
+    {
+        uint64_t key = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            int64_t c = std::min(std::max((int64_t)coords[i] + KEY_OFFSET, (int64_t)0), (int64_t)KEY_MASK);
+            key |= (uint64_t)c << (i * KEY_BITS);
+        }
+        return key;
+    }
+
+    Eigen::Vector3i VoteGrid::unpackKey(uint64_t key)
+    {
+        Eigen::Vector3i coords;
+        for (int i = 0; i < 3; i++)
+            coords[i] = (int)((int64_t)((key >> (i * KEY_BITS)) & KEY_MASK) - KEY_OFFSET);
+        return coords;
+    }
+
+    uint64_t VoteGrid::hashKey(uint64_t key)
+    {
+        // 64 bit finalizer of MurmurHash3
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    int VoteGrid::findCell(uint64_t key) const
+    {
+        uint64_t slot = hashKey(key) & m_table_mask;
+        while (true)
+        {
+            int cell = m_table[slot];
+            if (cell < 0)
+                return -1;
+            if (m_cell_keys[cell] == key)
+                return cell;
+            slot = (slot + 1) & m_table_mask;
+        }
+    }
+}
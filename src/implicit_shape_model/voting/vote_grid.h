@@ -0,0 +1,200 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_VOTEGRID_H
+#define ISM3D_VOTEGRID_H
+
+#include <vector>
+#include <cstdint>
+#include <Eigen/Core>
+
+#include "voting.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The VoteGrid class
+     * Uniform grid over the votes of one class, used for fixed radius neighbor searches. Votes are
+     * stored sorted by their cell, so that all votes of a cell are contiguous in memory. Non-empty cells
+     * are found with an open addressing hash table. Cells are centered on multiples of the cell size,
+     * i.e. a position p falls into the cell floor(p / cellSize + 0.5).
+     * A radius search is exact for any radius up to the cell size, since only the 27 surrounding cells
+     * need to be visited. Positions are stored as separate coordinate arrays, so that loops over the votes of
+     * a cell can be vectorized.
+     */
+    class VoteGrid
+    {
+    public:
+        VoteGrid();
+
+        /**
+         * @brief Build the grid for the given votes.
+         * @param votes the votes
+         * @param cellSize the edge length of a grid cell
+         */
+        void build(const std::vector<Voting::Vote>& votes, float cellSize);
+
+        /**
+         * @brief Build the grid for positions without weights, e.g. to find neighboring maxima. The weight of each
+         * position is 1, getVoteIndex() returns the index in positions.
+         * @param positions the positions
+         * @param cellSize the edge length of a grid cell
+         */
+        void build(const std::vector<Eigen::Vector3f>& positions, float cellSize);
+
+        /**
+         * @brief Call func(sortedIndex, squaredDistance) for every vote within radius of the query.
+         * @param query the query position
+         * @param radius the search radius, must not be larger than the cell size
+         * @param func the function to call for each neighbor
+         */
+        template<typename Func>
+        void forEachNeighbor(const Eigen::Vector3f& query, float radius, Func func) const
+        {
+            if (m_x.empty())
+                return;
+
+            const float radiusSqr = radius * radius;
+            forEachCandidateRange(query, [&](int begin, int end)
+            {
+                for (int i = begin; i < end; i++)
+                {
+                    float dx = m_x[i] - query[0];
+                    float dy = m_y[i] - query[1];
+                    float dz = m_z[i] - query[2];
+                    float distanceSqr = dx * dx + dy * dy + dz * dz;
+                    if (distanceSqr <= radiusSqr)
+                        func(i, distanceSqr);
+                }
+            });
+        }
+
+        /**
+         * @brief Call func(begin, end) for the sorted index range of each non-empty cell around the query. The
+         * ranges contain all votes within the cell size of the query, but also farther votes that the caller
+         * has to reject, e.g. in a vectorized loop over the coordinate arrays.
+         * @param query the query position
+         * @param func the function to call for each range
+         */
+        template<typename Func>
+        void forEachCandidateRange(const Eigen::Vector3f& query, Func func) const
+        {
+            if (m_x.empty())
+                return;
+
+            const Eigen::Vector3i center = getCellCoords(query);
+            for (int dz = -1; dz <= 1; dz++)
+            {
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int cell = findCell(packKey(center + Eigen::Vector3i(dx, dy, dz)));
+                        if (cell >= 0)
+                            func(m_cell_offsets[cell], m_cell_offsets[cell + 1]);
+                    }
+                }
+            }
+        }
+
+        int size() const
+        {
+            return (int)m_x.size();
+        }
+
+        float getCellSize() const
+        {
+            return m_cell_size;
+        }
+
+        // access to the votes in cell order
+        Eigen::Vector3f getPosition(int sortedIndex) const
+        {
+            return Eigen::Vector3f(m_x[sortedIndex], m_y[sortedIndex], m_z[sortedIndex]);
+        }
+
+        float getWeight(int sortedIndex) const
+        {
+            return m_weights[sortedIndex];
+        }
+
+        // coordinate and weight arrays in cell order
+        const float* getX() const
+        {
+            return m_x.data();
+        }
+
+        const float* getY() const
+        {
+            return m_y.data();
+        }
+
+        const float* getZ() const
+        {
+            return m_z.data();
+        }
+
+        const float* getWeights() const
+        {
+            return m_weights.data();
+        }
+
+        // index of the vote in the vote list passed to build()
+        int getVoteIndex(int sortedIndex) const
+        {
+            return m_vote_indices[sortedIndex];
+        }
+
+        // access to the non-empty cells, ordered by z, y, x cell coordinate
+        int getNumCells() const
+        {
+            return (int)m_cell_keys.size();
+        }
+
+        Eigen::Vector3i getCellCoords(int cell) const;
+
+        int getCellBegin(int cell) const
+        {
+            return m_cell_offsets[cell];
+        }
+
+        int getCellEnd(int cell) const
+        {
+            return m_cell_offsets[cell + 1];
+        }
+
+    private:
+        Eigen::Vector3i getCellCoords(const Eigen::Vector3f& position) const;
+        static uint64_t packKey(const Eigen::Vector3i& coords);
+        static Eigen::Vector3i unpackKey(uint64_t key);
+        static uint64_t hashKey(uint64_t key);
+
+        int findCell(uint64_t key) const;
+
+        float m_cell_size;
+
+        // votes sorted by cell
+        std::vector<float> m_x;
+        std::vector<float> m_y;
+        std::vector<float> m_z;
+        std::vector<float> m_weights;
+        std::vector<int> m_vote_indices;
+
+        // non-empty cells, the votes of cell c are in [m_cell_offsets[c], m_cell_offsets[c+1])
+        std::vector<uint64_t> m_cell_keys;
+        std::vector<int> m_cell_offsets;
+
+        // open addressing hash table mapping cell keys to cell indices (-1: empty slot)
+        std::vector<int> m_table;
+        uint64_t m_table_mask;
+    };
+}
+
+#endif // ISM3D_VOTEGRID_H
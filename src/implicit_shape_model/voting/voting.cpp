@@ -11,101 +11,624 @@
 #include "voting.h"
 #include "voting_factory.h"
 #include "../codebook/codeword_distribution.h"
+#include "vote_grid.h"
+#include "../utils/memory_report.h"
+#include "../utils/json_stream.h"
+#include "../utils/profiler_markers.h"
+#include "../utils/cancellation.h"
+#include "../utils/parallel_tasks.h"
+#include "../utils/distance.h"
 
 #include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <omp.h>
 #include <pcl/common/centroid.h>
 
 namespace ism3d
 {
 
-std::string exec(const char *cmd); // defined at the end of file
-
 Voting::Voting()
 {
     addParameter(m_minThreshold, "MinThreshold", 0.0f);
     addParameter(m_minVotesThreshold, "MinVotesThreshold", 1);
     addParameter(m_bestK, "BestK", -1);
+    addParameter(m_max_votes, "MaxVotes", 0);
     addParameter(m_averageRotation, "AverageRotation", false);
     addParameter(m_radiusType, "BinOrBandwidthType", std::string("Config"));
     addParameter(m_radiusFactor, "BinOrBandwidthFactor", 1.0f);
     addParameter(m_max_filter_type, "MaxFilterType", std::string("None"));
     addParameter(m_single_object_max_type, "SingleObjectMaxType", std::string("None"));
+    addParameter(m_classification_only, "ClassificationOnly", false);
 
     addParameter(m_use_global_features, "UseGlobalFeatures", false);
     addParameter(m_global_feature_method, "GlobalFeaturesStrategy", std::string("KNN"));
     addParameter(m_global_feature_influence_type, "GlobalFeatureInfluenceType", 3);
     addParameter(m_k_global_features, "GlobalFeaturesK", 1);
+    addParameter(m_global_feature_region_overlap, "GlobalFeatureRegionOverlap", 0.9f);
     addParameter(m_global_param_min_svm_score, "GlobalParamMinSvmScore", 0.70f);
+    addParameter(m_global_early_exit, "GlobalEarlyExit", false);
     addParameter(m_global_param_rate_limit, "GlobalParamRateLimit", 0.60f);
     addParameter(m_global_param_weight_factor, "GlobalParamWeightFactor", 1.5f);
+    addParameter(m_linear_svm_features, "LinearSvmFeatures", 1024);
+    addParameter(m_linear_svm_gamma, "LinearSvmGamma", 2.96f);
+    addParameter(m_linear_svm_c, "LinearSvmC", 7.41f);
+    addParameter(m_linear_svm_epochs, "LinearSvmEpochs", 20);
 
     m_index_created = false;
+    // global features are few, a single kd-tree is sufficient, as in setIndexParams()
+    m_index_params.kd_trees = 1;
     m_svm_error = false;
+    m_svm = std::make_shared<CustomSVM>();
     m_single_object_mode = false;
+    m_mvbb_eps = 0.0f;
+    m_mvbb_leaf_size = 0.0f;
+    m_lean_maxima = false;
+    m_fused_voting = false;
+    m_normalize_weights = true;
+
+    Voting::iPostInitConfig();
+}
+
+void Voting::iPostInitConfig()
+{
+    if (m_radiusType == "Config")
+        m_radius_mode = RadiusConfig;
+    else if (m_radiusType == "FirstDim")
+        m_radius_mode = RadiusFirstDim;
+    else if (m_radiusType == "SecondDim")
+        m_radius_mode = RadiusSecondDim;
+    else
+        throw RuntimeException("invalid bin or bandwidth type: " + m_radiusType);
+
+    if (m_max_filter_type == "None")
+        m_max_filter = MaxFilterNone;
+    else if (m_max_filter_type == "Simple")
+        m_max_filter = MaxFilterSimple;
+    else if (m_max_filter_type == "Merge")
+        m_max_filter = MaxFilterMerge;
+    else
+        throw RuntimeException("invalid max filter type: " + m_max_filter_type);
+
+    // the types are named after the region and whether the votes or the maxima are used
+    const std::string &type = m_single_object_max_type;
+    m_single_object_max = type != "None";
+    m_single_object_max_from_votes = type.size() > 5 && type.compare(type.size() - 5, 5, "Votes") == 0;
+    if (type == "VotingSpaceVotes" || type == "VotingSpaceMaxima")
+        m_single_object_max_region = SingleObjectMaxType::COMPLETE_VOTING_SPACE;
+    else if (type == "BandwidthVotes" || type == "BandwidthMaxima")
+        m_single_object_max_region = SingleObjectMaxType::BANDWIDTH;
+    else if (type == "ModelRadiusVotes" || type == "ModelRadiusMaxima")
+        m_single_object_max_region = SingleObjectMaxType::MODEL_RADIUS;
+    else if (m_single_object_max)
+        throw RuntimeException("invalid single object max type: " + type);
 }
 
 Voting::~Voting()
 {
     m_votes.clear();
+}
+
+Voting::VoteSlot::VoteSlot(DetectionArena *arena)
+    : activations(ArenaAllocator<Activation>(arena)), acquired(false)
+{
+}
+
+Voting::VoteSlot::~VoteSlot()
+{
+}
+
+std::unique_ptr<Voting::VoteSlot> Voting::iCreateSlot()
+{
+    return std::unique_ptr<VoteSlot>(new VoteSlot(&m_arena));
+}
+
+const std::vector<std::unique_ptr<Voting::VoteSlot> >& Voting::getSlots() const
+{
+    return m_slots;
+}
+
+std::vector<Voting::VoteSlot*> Voting::acquireSlots(int count)
+{
+    std::lock_guard<std::mutex> lock(m_slots_mutex);
 
-    // delete files that were unpacked for recognition
-    if(m_svm_files.size() > 1)
+    // free slots of previous vote loops first, they keep the memory of their buffers
+    std::vector<VoteSlot*> slots;
+    for (int i = 0; i < (int)m_slots.size() && (int)slots.size() < count; i++)
     {
-        for(std::string s : m_svm_files)
-        {
-            int ret = std::system(("rm " + s).c_str());
-        }
+        if (!m_slots[i]->acquired)
+            slots.push_back(m_slots[i].get());
+    }
+    while ((int)slots.size() < count)
+    {
+        m_slots.push_back(iCreateSlot());
+        slots.push_back(m_slots.back().get());
     }
+
+    for (VoteSlot *slot : slots)
+        slot->acquired = true;
+    return slots;
+}
+
+void Voting::releaseSlots(const std::vector<VoteSlot*> &slots)
+{
+    std::lock_guard<std::mutex> lock(m_slots_mutex);
+    for (VoteSlot *slot : slots)
+        slot->acquired = false;
+}
+
+unsigned Voting::addActivation(VoteSlot &slot,
+                               const CodewordDistribution* distribution,
+                               const boost::math::quaternion<float>& rotQuat,
+                               const Eigen::Vector3f& keyPos)
+{
+    Activation activation;
+    activation.distribution = distribution;
+    activation.rotQuat = rotQuat;
+    activation.keyPos = keyPos;
+
+    // activation ids are local to the slot and made global in mergeVotes()
+    unsigned activationId = (unsigned)slot.activations.size();
+    slot.activations.push_back(activation);
+    return activationId;
 }
 
-void Voting::vote(Eigen::Vector3f position, float weight, unsigned classId,
-                  const Eigen::Vector3f& keypoint, const Utils::BoundingBox& boundingBox, int codewordId)
+void Voting::vote(VoteSlot &slot, const Eigen::Vector3f& position, float weight, unsigned classId,
+                  unsigned activationId, unsigned voteIndex)
 {
+    if (m_fused_voting)
+    {
+        iFuseVote(slot, position, weight, classId, activationId, voteIndex);
+        return;
+    }
+
     // add the vote
     Vote newVote;
     newVote.position = position; // position of object center the vote votes for
     newVote.weight = weight;
     newVote.classId = classId;
-    newVote.keypoint = keypoint;
-    newVote.boundingBox = boundingBox;
-    newVote.codewordId = codewordId;
+    newVote.activationId = activationId;
+    newVote.voteIndex = voteIndex;
+
+    // the slot belongs to the calling worker, no lock is needed
+    std::map<unsigned, ArenaVector<Vote> >::iterator it = slot.votes.find(classId);
+    if (it == slot.votes.end())
+        it = slot.votes.insert(std::make_pair(classId, ArenaVector<Vote>(ArenaAllocator<Vote>(&m_arena)))).first;
+    it->second.push_back(newVote);
+}
+
+void Voting::accumulateVote(VoteSlot &slot, const Eigen::Vector3f& position, float weight, unsigned classId)
+{
+    if (classId >= slot.masses.size())
+    {
+        ClassMass empty = {0, Eigen::Vector3d::Zero(), 0};
+        slot.masses.resize(classId + 1, empty);
+    }
+    ClassMass &mass = slot.masses[classId];
+    mass.weight += weight;
+    mass.weightedPosition += (double)weight * position.cast<double>();
+    mass.numVotes++;
+}
+
+void Voting::mergeVotes()
+{
+    // count votes per class to allocate them only once
+    std::map<unsigned, size_t> numVotes;
+    for (const std::unique_ptr<VoteSlot> &slot : m_slots)
+        for (const auto &classVotes : slot->votes)
+            numVotes[classVotes.first] += classVotes.second.size();
+
+    for (const auto &count : numVotes)
+    {
+        std::vector<Vote> &votes = m_votes[count.first];
+        votes.reserve(votes.size() + count.second);
+    }
+
+    // concatenate the slots in their order and turn slot-local activation ids into global ones
+    std::vector<unsigned> activationOffsets(m_slots.size());
+    for (int t = 0; t < (int)m_slots.size(); t++)
+    {
+        unsigned offset = (unsigned)m_activations.size();
+        activationOffsets[t] = offset;
+        ArenaVector<Activation> &activations = m_slots[t]->activations;
+        m_activations.insert(m_activations.end(), activations.begin(), activations.end());
+        activations.clear();
+
+        for (auto &classVotes : m_slots[t]->votes)
+        {
+            std::vector<Vote> &votes = m_votes[classVotes.first];
+            size_t first = votes.size();
+            votes.insert(votes.end(), classVotes.second.begin(), classVotes.second.end());
+            for (size_t i = first; i < votes.size(); i++)
+                votes[i].activationId += offset;
+        }
+        m_slots[t]->votes.clear();
+    }
+
+    // the maxima of fused votes refer to their votes by index already
+    if (m_fused_voting)
+    {
+        iMergeFusedVotes(activationOffsets, m_votes);
+        return;
+    }
+
+    limitVotes();
+    sortVotesSpatially();
+}
+
+// interleaves the lower 21 bits of the coordinates, x in the lowest bit
+static uint64_t mortonCode(uint32_t x, uint32_t y, uint32_t z)
+{
+    uint64_t code = 0;
+    uint64_t coords[3] = {x, y, z};
+    for (int i = 0; i < 3; i++)
+    {
+        uint64_t v = coords[i] & 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffffULL;
+        v = (v | v << 16) & 0x1f0000ff0000ffULL;
+        v = (v | v << 8) & 0x100f00f00f00f00fULL;
+        v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+        v = (v | v << 2) & 0x1249249249249249ULL;
+        code |= v << i;
+    }
+    return code;
+}
+
+void Voting::sortVotesSpatially()
+{
+    for (auto &classVotes : m_votes)
+    {
+        std::vector<Vote> &votes = classVotes.second;
+        const int numVotes = (int)votes.size();
+        if (numVotes < 2)
+            continue;
+
+        Eigen::Vector3f minPosition = votes[0].position;
+        Eigen::Vector3f maxPosition = votes[0].position;
+        for (const Vote &vote : votes)
+        {
+            minPosition = minPosition.cwiseMin(vote.position);
+            maxPosition = maxPosition.cwiseMax(vote.position);
+        }
+
+        // 21 bits per dimension over the bounding box of the class votes
+        const float maxCell = (float)((1 << 21) - 1);
+        Eigen::Vector3f scale;
+        for (int i = 0; i < 3; i++)
+        {
+            float extent = maxPosition[i] - minPosition[i];
+            scale[i] = extent > 0 ? maxCell / extent : 0;
+        }
+
+        // the vote index breaks ties, so that equal codes keep the merge order
+        std::vector<std::pair<uint64_t, int> > keys(numVotes);
+        #pragma omp parallel for
+        for (int i = 0; i < numVotes; i++)
+        {
+            Eigen::Vector3f cell = (votes[i].position - minPosition).cwiseProduct(scale);
+            keys[i] = {mortonCode((uint32_t)std::min(std::max(cell[0], 0.0f), maxCell),
+                                  (uint32_t)std::min(std::max(cell[1], 0.0f), maxCell),
+                                  (uint32_t)std::min(std::max(cell[2], 0.0f), maxCell)), i};
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<Vote> sorted(numVotes);
+        #pragma omp parallel for
+        for (int i = 0; i < numVotes; i++)
+            sorted[i] = votes[keys[i].second];
+        votes.swap(sorted);
+    }
+}
+
+void Voting::limitVotes()
+{
+    size_t numVotes = 0;
+    double totalWeight = 0;
+    for (const auto &classVotes : m_votes)
+    {
+        numVotes += classVotes.second.size();
+        for (const Vote &vote : classVotes.second)
+            totalWeight += vote.weight;
+    }
+
+    if (m_max_votes <= 0 || numVotes <= (size_t)m_max_votes)
+        return;
+
+    // weighted reservoir sampling (Efraimidis and Spirakis): the votes with the largest keys log(u) / weight are
+    // kept, the generator is seeded with the number of votes so that detections are reproducible
+    std::mt19937 generator((unsigned)numVotes);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> keys;
+    keys.reserve(numVotes);
+    for (const auto &classVotes : m_votes)
+    {
+        for (const Vote &vote : classVotes.second)
+        {
+            float u = uniform(generator);
+            keys.push_back(u > 0 && vote.weight > 0 ? std::log(u) / vote.weight : -std::numeric_limits<float>::infinity());
+        }
+    }
+
+    std::vector<float> sortedKeys = keys;
+    std::nth_element(sortedKeys.begin(), sortedKeys.begin() + (numVotes - m_max_votes), sortedKeys.end());
+    const float threshold = sortedKeys[numVotes - m_max_votes];
+    size_t numAbove = 0;
+    for (float key : keys)
+        if (key > threshold)
+            numAbove++;
+    size_t numAtThreshold = m_max_votes - numAbove;
+
+    // the kept votes share the total weight, which keeps the expected weight of each region of the voting space
+    const float weight = (float)(totalWeight / m_max_votes);
+    size_t index = 0;
+    for (auto &classVotes : m_votes)
+    {
+        std::vector<Vote> &votes = classVotes.second;
+        size_t numKept = 0;
+        for (size_t i = 0; i < votes.size(); i++, index++)
+        {
+            bool keep = keys[index] > threshold;
+            if (!keep && keys[index] == threshold && numAtThreshold > 0)
+            {
+                keep = true;
+                numAtThreshold--;
+            }
+
+            if (keep)
+            {
+                votes[numKept] = votes[i];
+                votes[numKept].weight = weight;
+                numKept++;
+            }
+        }
+        votes.resize(numKept);
+    }
+
+    // classes without votes are not searched for maxima
+    for (auto it = m_votes.begin(); it != m_votes.end();)
+    {
+        if (it->second.empty())
+            it = m_votes.erase(it);
+        else
+            it++;
+    }
+    LOG_INFO("kept " << m_max_votes << " of " << numVotes << " votes");
+}
+
+Utils::BoundingBox Voting::getVoteBoundingBox(const Vote& vote) const
+{
+    LOG_ASSERT(vote.activationId < m_activations.size());
+    const Activation& activation = m_activations[vote.activationId];
+
+    // transform bounding box coordinate system from reference frame back into world coordinate system
+    Utils::BoundingBox boundingBox = activation.distribution->getBoundingBox(vote.voteIndex);
+    boundingBox.rotQuat = boundingBox.rotQuat * activation.rotQuat;
+    return boundingBox;
+}
+
+Eigen::Vector3f Voting::getVotePosition(unsigned activationId, unsigned voteIndex) const
+{
+    LOG_ASSERT(activationId < m_activations.size());
+    const Activation& activation = m_activations[activationId];
+
+    // same transformation as CodewordDistribution::castVotes()
+    Eigen::Vector3f position = activation.distribution->getVote(voteIndex);
+    Utils::quatRotate(activation.rotQuat, position);
+    return position + activation.keyPos;
+}
+
+void Voting::iFuseVote(VoteSlot&, const Eigen::Vector3f&, float, unsigned, unsigned, unsigned)
+{
+}
+
+void Voting::iMergeFusedVotes(const std::vector<unsigned>&, std::map<unsigned, std::vector<Vote> >&)
+{
+}
+
+int Voting::getVoteCodewordId(const Vote& vote) const
+{
+    LOG_ASSERT(vote.activationId < m_activations.size());
+    return m_activations[vote.activationId].distribution->getCodewordId();
+}
+
+VotingReport Voting::createReport(const std::vector<VotingMaximum>& maxima, int numTopCodewords) const
+{
+    VotingReport report;
+
+    // votes are counted per activation first, which avoids a map lookup per vote
+    std::vector<std::size_t> activationVotes(m_activations.size(), 0);
+    for (const std::pair<const unsigned, std::vector<Vote> >& classVotes : m_votes)
+    {
+        VotingReport::ClassReport& classReport = report.classes[classVotes.first];
+        classReport.numVotes = classVotes.second.size();
+        for (const Vote& vote : classVotes.second)
+        {
+            classReport.weightSum += vote.weight;
+            classReport.weightHistogram[VotingReport::getWeightBin(vote.weight)]++;
+            if (vote.activationId < activationVotes.size())
+                activationVotes[vote.activationId]++;
+        }
+
+        const std::string suffix = "_class_" + std::to_string(classVotes.first);
+        std::map<std::string, double>::const_iterator it = m_counters.find("mean_shift_seeds" + suffix);
+        if (it != m_counters.end())
+            classReport.numSeeds = it->second;
+        it = m_counters.find("mean_shift_iterations" + suffix);
+        if (it != m_counters.end())
+            classReport.numIterations = it->second;
+    }
+
+    for (const VotingMaximum& maximum : maxima)
+        report.classes[maximum.classId].numMaxima++;
 
-#pragma omp critical
+    std::map<int, std::size_t> codewordVotes;
+    for (int i = 0; i < (int)m_activations.size(); i++)
     {
-        m_votes[classId].push_back(newVote);
+        if (activationVotes[i] > 0)
+            codewordVotes[m_activations[i].distribution->getCodewordId()] += activationVotes[i];
     }
+
+    report.topCodewords.assign(codewordVotes.begin(), codewordVotes.end());
+    const int numTop = std::min(std::max(numTopCodewords, 0), (int)report.topCodewords.size());
+    std::partial_sort(report.topCodewords.begin(), report.topCodewords.begin() + numTop, report.topCodewords.end(),
+                      [](const std::pair<int, std::size_t>& a, const std::pair<int, std::size_t>& b)
+    {
+        return a.second > b.second || (a.second == b.second && a.first < b.first);
+    });
+    report.topCodewords.resize(numTop);
+    return report;
+}
+
+int VotingReport::getNumWeightBins()
+{
+    return 6;
+}
+
+int VotingReport::getWeightBin(float weight)
+{
+    // decades from below 1e-4 to 1 and above
+    if (!(weight > 0))
+        return 0;
+    const int bin = (int)std::floor(std::log10(weight)) + 5;
+    return std::min(std::max(bin, 0), getNumWeightBins() - 1);
+}
+
+Json::Value VotingReport::toJson() const
+{
+    Json::Value json(Json::objectValue);
+    Json::Value& classesJson = json["classes"];
+    classesJson = Json::Value(Json::objectValue);
+    for (const std::pair<const unsigned, ClassReport>& entry : classes)
+    {
+        const ClassReport& classReport = entry.second;
+        Json::Value classJson(Json::objectValue);
+        classJson["votes"] = (Json::UInt64)classReport.numVotes;
+        classJson["mean_weight"] = classReport.numVotes > 0 ? classReport.weightSum / classReport.numVotes : 0.0;
+        classJson["weight_histogram"] = Json::Value(Json::arrayValue);
+        for (std::size_t count : classReport.weightHistogram)
+            classJson["weight_histogram"].append((Json::UInt64)count);
+        classJson["maxima"] = classReport.numMaxima;
+        classJson["mean_shift_seeds"] = classReport.numSeeds;
+        classJson["mean_shift_iterations"] = classReport.numIterations;
+        classJson["mean_shift_iterations_per_seed"] = classReport.numSeeds > 0 ? classReport.numIterations / classReport.numSeeds : 0.0;
+        classesJson[std::to_string(entry.first)] = classJson;
+    }
+
+    json["top_codewords"] = Json::Value(Json::arrayValue);
+    for (const std::pair<int, std::size_t>& codeword : topCodewords)
+    {
+        Json::Value codewordJson(Json::objectValue);
+        codewordJson["id"] = codeword.first;
+        codewordJson["votes"] = (Json::UInt64)codeword.second;
+        json["top_codewords"].append(codewordJson);
+    }
+    return json;
 }
 
 std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr &points,
-                                              pcl::PointCloud<pcl::Normal>::ConstPtr &normals)
+                                              pcl::PointCloud<pcl::Normal>::ConstPtr &normals,
+                                              pcl::search::Search<PointT>::Ptr search)
 {
-    if (m_votes.size() == 0)
+    ProfilerStage profilerStage("find_maxima");
+    mergeVotes();
+    m_counters.clear();
+
+    // the classes are ranked by their vote mass, no votes are stored and searched
+    const bool classificationOnly = isClassificationOnly();
+    if (m_votes.size() == 0 && !classificationOnly)
         return std::vector<VotingMaximum>();
 
-    // used to extract a portion of the input cloud to estimage a global feature
-    pcl::KdTreeFLANN<PointT> input_points_kdtree;
-    if(m_use_global_features)
+    // used to extract a portion of the input cloud to estimage a global feature, a shared search reuses the
+    // index built over the points during feature computation
+    if(m_use_global_features && !m_single_object_mode)
     {
-        input_points_kdtree.setInputCloud(points);
+        if(!search)
+        {
+            // the fallback search is kept, so that its kd-tree is rebuilt in place by the next detection
+            if (!m_maxima_search)
+                m_maxima_search.reset(new pcl::search::KdTree<PointT>());
+            search = m_maxima_search;
+        }
+        search->setInputCloud(points);
     }
 
     std::vector<VotingMaximum> maxima;
 
-    // find votes for each class individually
-    // iterate over map that assigns each class id with a list of votes
-    for (std::map<unsigned, std::vector<Voting::Vote> >::const_iterator it = m_votes.begin();
-         it != m_votes.end(); it++)
+    // maxima results of a single class
+    struct ClassMaxima
     {
-        unsigned classId = it->first;
-        const std::vector<Voting::Vote>& votes = it->second; // all votes for this class
-
+        unsigned classId;
+        const std::vector<Voting::Vote>* votes; // all votes for this class
         std::vector<Eigen::Vector3f> clusters;  // positions of maxima
         std::vector<double> maximaValues;       // weights of maxima
         std::vector<std::vector<int> > voteIndices; // list of indices of all votes for each maximum
         std::vector<std::vector<float> > reweightedVotes; // reweighted votes, a list for each maximum
+        float radius;
+        bool searched;                          // false if the class can not reach the thresholds
+        bool collected;                         // true once the maxima of the class are created
+        std::vector<VotingMaximum> maxima;      // maxima of this class
+    };
+
+    std::vector<ClassMaxima> classMaxima(m_votes.size());
+    int classIndex = 0;
+    for (std::map<unsigned, std::vector<Voting::Vote> >::const_iterator it = m_votes.begin();
+         it != m_votes.end(); it++, classIndex++)
+    {
+        classMaxima[classIndex].classId = it->first;
+        classMaxima[classIndex].votes = &it->second;
+        classMaxima[classIndex].radius = m_radius;
+        classMaxima[classIndex].collected = false;
+
+        // a maximum has at most the votes of its class and, since kernels and interpolation weights are at most 1,
+        // at most the positive vote mass as weight; classes below the thresholds are not searched
+        double mass = 0;
+        for (const Voting::Vote& vote : it->second)
+            mass += std::max(vote.weight, 0.0f);
+        classMaxima[classIndex].searched = (int)it->second.size() >= m_minVotesThreshold &&
+                mass * (1 + 1e-4) >= m_minThreshold;
+    }
+
+    // classes are independent, so they are processed as parallel tasks; the classes with most votes are
+    // dispatched first to reduce the load imbalance at the end
+    std::vector<int> classOrder(classMaxima.size());
+    for (int i = 0; i < (int)classOrder.size(); i++)
+        classOrder[i] = i;
+    std::stable_sort(classOrder.begin(), classOrder.end(), [&classMaxima](int a, int b)
+    {
+        return classMaxima[a].votes->size() > classMaxima[b].votes->size();
+    });
+
+    classOrder.erase(std::remove_if(classOrder.begin(), classOrder.end(), [&classMaxima](int i)
+    {
+        return !classMaxima[i].searched;
+    }), classOrder.end());
+    if (classOrder.size() < classMaxima.size())
+        LOG_DEBUG("skipping the maxima search of " << classMaxima.size() - classOrder.size() << " of " <<
+                  classMaxima.size() << " classes below the thresholds");
+
+    const CancellationToken cancellation = CancellationToken::current();
+
+    // process the algorithm to find maxima on the votes of a class
+    auto searchClass = [&](ClassMaxima& result)
+    {
+        ProfilerStage classStage("find_maxima_class", (int)result.classId);
+        iFindMaxima(*result.votes, result.clusters, result.maximaValues, result.voteIndices,
+                    result.reweightedVotes, result.classId, result.radius);
+    };
 
-        // process the algorithm to find maxima on the votes of the current class
-        iFindMaxima(votes, clusters, maximaValues, voteIndices, reweightedVotes, classId, m_radius);
+    // create the maxima of a searched class and deliver them to the class maxima callback
+    auto collectClass = [&](ClassMaxima& result)
+    {
+        unsigned classId = result.classId;
+        const std::vector<Voting::Vote>& votes = *result.votes;
+        const std::vector<Eigen::Vector3f>& clusters = result.clusters;
+        const std::vector<double>& maximaValues = result.maximaValues;
+        const std::vector<std::vector<int> >& voteIndices = result.voteIndices;
+        const std::vector<std::vector<float> >& reweightedVotes = result.reweightedVotes;
+        std::vector<VotingMaximum>& classResult = result.maxima;
+        m_radius = result.radius;
 
         LOG_ASSERT(clusters.size() == maximaValues.size());
         LOG_ASSERT(clusters.size() == voteIndices.size());
@@ -113,72 +636,134 @@ std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr
         // TODO VS: look here for bounding box filtering (i.e. remove outliers) (to determine an orientation during detection)
         // also use m_id_bb_dimensions_map and m_id_bb_variances_map
 
-        // iterate through all found maxima for current class ID
-        #pragma omp parallel for
-        for (int i = 0; i < (int)clusters.size(); i++)
+        // iterate through all found maxima for current class ID, their numbers of votes differ a lot
+        ParallelTasks::parallelFor(0, (int)clusters.size(), 1, [&](int i)
         {
-            if (maximaValues[i] < m_minThreshold || voteIndices.at(i).size() < m_minVotesThreshold)
-                continue;
+            if (maximaValues[i] < m_minThreshold || voteIndices.at(i).size() < m_minVotesThreshold ||
+                    cancellation.isCancelled())
+                return;
 
             const std::vector<int>& clusterVotes = voteIndices[i];
             const std::vector<float>& reweightedClusterVotes = reweightedVotes[i];
             if (clusterVotes.size() == 0)
-                continue;
+                return;
 
             VotingMaximum maximum;
             maximum.classId = classId;
             maximum.position = clusters[i];
             maximum.weight = maximaValues[i];
-            maximum.voteIndices = voteIndices[i];
-
-            std::vector<boost::math::quaternion<float> > quats;
-            std::vector<float> weights;
+            if (!m_lean_maxima)
+                maximum.voteIndices = voteIndices[i];
 
-            // compute weighted maximum values
-            float maxWeight = 0;
-            maximum.boundingBox.size = Eigen::Vector3f(0, 0, 0);
+            // one pass over the votes accumulates the size and the rotation, weighted by the reweighted votes
+            float sumWeights = 0;
+            Eigen::Vector3f sumSize(0, 0, 0);
+            QuaternionAverage rotation;
             for (int j = 0; j < (int)clusterVotes.size(); j++)
             {
-                int id = clusterVotes[j];
-                const Voting::Vote& vote = votes[id];
-                float newWeight = reweightedClusterVotes[j];
-
-                boost::math::quaternion<float> rotQuat = vote.boundingBox.rotQuat;
-                quats.push_back(rotQuat);
-                weights.push_back(newWeight);
-
-                maximum.boundingBox.size += newWeight * vote.boundingBox.size;
-                maxWeight += newWeight;
+                const Voting::Vote& vote = votes[clusterVotes[j]];
+                const float newWeight = reweightedClusterVotes[j];
+
+                // bounding boxes are only reconstructed for votes that contribute to a maximum
+                const Utils::BoundingBox voteBoundingBox = getVoteBoundingBox(vote);
+                if (m_averageRotation)
+                    rotation.add(voteBoundingBox.rotQuat, newWeight);
+                sumSize += newWeight * voteBoundingBox.size;
+                sumWeights += newWeight;
             }
 
-            // weights should sum up to one
-            for (int j = 0; j < (int)weights.size(); j++)
-                weights[j] /= maxWeight;
-
             maximum.boundingBox.position = maximum.position;
-            maximum.boundingBox.size /= maxWeight;
-
-            // compute interpolation between quaternions
+            maximum.boundingBox.size = sumSize / sumWeights;
             if (m_averageRotation)
-            {
-                boost::math::quaternion<float> rotQuat;
-                Utils::quatWeightedAverage(quats, weights, rotQuat);
-                maximum.boundingBox.rotQuat = rotQuat;
-            }
+                rotation.compute(maximum.boundingBox.rotQuat);
 
-            // in non-single object mode: extract points around maxima region and compute global features
-            if(m_use_global_features && !m_single_object_mode)
+            #pragma omp critical
             {
-                verifyMaxHypothesisWithGlobalFeatures(points, normals, input_points_kdtree, maximum);
+                classResult.push_back(maximum);
             }
+        });
 
-            #pragma omp critical
+        // lean maxima do not refer to their votes, the per class vote lists are not needed anymore
+        if (m_lean_maxima)
+        {
+            std::vector<std::vector<int> >().swap(result.voteIndices);
+            std::vector<std::vector<float> >().swap(result.reweightedVotes);
+        }
+
+        result.collected = true;
+        if (m_class_maxima_callback && !cancellation.isCancelled())
+            m_class_maxima_callback(classId, classResult);
+    };
+
+    // classes below the thresholds have no maxima, the callback learns about them first
+    if (m_class_maxima_callback)
+    {
+        for (ClassMaxima& result : classMaxima)
+        {
+            if (!result.searched)
+                m_class_maxima_callback(result.classId, result.maxima);
+        }
+    }
+
+    // the priority classes are searched one after another with all threads, so that the first one is delivered
+    // after its own search instead of after the search of all classes
+    if (m_class_maxima_callback)
+    {
+        for (unsigned classId : m_priority_classes)
+        {
+            std::vector<int>::iterator it = std::find_if(classOrder.begin(), classOrder.end(), [&](int i)
             {
-                maxima.push_back(maximum);
-            }
+                return classMaxima[i].classId == classId;
+            });
+            if (it == classOrder.end() || cancellation.isCancelled())
+                continue;
+
+            ClassMaxima& result = classMaxima[*it];
+            classOrder.erase(it);
+            searchClass(result);
+            collectClass(result);
         }
     }
 
+    // each class is a task, the loops inside of iFindMaxima add their tasks to the same team, so the threads that
+    // finished the small classes help with the large ones; a single class runs inline with all threads, the classes
+    // of a cancelled detection are skipped; the token is thread local, so the tasks running on workers take over the
+    // one of this thread for iFindMaxima
+    ParallelTasks::parallelFor(0, (int)classOrder.size(), 1, [&](int i)
+    {
+        if (cancellation.isCancelled())
+            return;
+        CancellationToken::Scope scope(cancellation);
+        searchClass(classMaxima[classOrder[i]]);
+    });
+
+    // find votes for each class individually
+    for (ClassMaxima& result : classMaxima)
+    {
+        if (!result.searched)
+            continue;
+
+        m_radius = result.radius;
+        if (!result.collected)
+            collectClass(result);
+        maxima.insert(maxima.end(), result.maxima.begin(), result.maxima.end());
+        std::vector<VotingMaximum>().swap(result.maxima);
+    }
+
+    if (classificationOnly)
+        maxima = computeClassificationMaxima(points);
+
+    // the maxima are verified with their global features
+    CancellationToken::check();
+
+    // in non-single object mode: extract points around maxima regions, compute and classify their global features
+    if(m_use_global_features && !m_single_object_mode)
+    {
+        std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> maxima_global_features =
+                computeGlobalFeatures(points, normals, search, maxima);
+        classifyGlobalFeatures(maxima_global_features, maxima);
+    }
+
     // in single object mode: classify global features instead of maxima points
     if(m_use_global_features && m_single_object_mode)
     {
@@ -192,12 +777,7 @@ std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr
         // if no maxima found in single object mode, use global hypothesis and fill in values
         if(maxima.size() == 0)
         {
-            global_max.classId = global_max.globalHypothesis.first;
-            global_max.weight = global_max.globalHypothesis.second;
-            Eigen::Vector4d centroid;
-            pcl::compute3DCentroid(*points, centroid);
-            global_max.position = Eigen::Vector3f(centroid.x(), centroid.y(), centroid.z());
-            global_max.boundingBox = Utils::computeMVBB<PointT>(points);
+            setGlobalMaximum(points, global_max);
             maxima.push_back(global_max);
         }
     }
@@ -206,32 +786,22 @@ std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr
     std::vector<VotingMaximum> filtered_maxima = maxima; // init for the case that no filtering type is selected
 
     // TODO VS: global features do not work with the singele object max types: seems like global results are not merged in maxima
-    if(m_single_object_mode)
+    if(m_single_object_mode && !classificationOnly)
     {
         pcl::PointCloud<PointNormalT>::Ptr pointsWithNormals(new pcl::PointCloud<PointNormalT>());
         pcl::concatenateFields(*points, *normals, *pointsWithNormals);
 
-        // vote based single maxima computation
-        if(m_single_object_max_type == "VotingSpaceVotes")
-            filtered_maxima  = computeSingleMaxPerClass(pointsWithNormals, SingleObjectMaxType::COMPLETE_VOTING_SPACE);
-        if(m_single_object_max_type == "BandwidthVotes")
-            filtered_maxima  = computeSingleMaxPerClass(pointsWithNormals, SingleObjectMaxType::BANDWIDTH);
-        if(m_single_object_max_type == "ModelRadiusVotes")
-            filtered_maxima  = computeSingleMaxPerClass(pointsWithNormals, SingleObjectMaxType::MODEL_RADIUS);
-
-        // maxima based single maxima computation
-        if(m_single_object_max_type == "VotingSpaceMaxima")
-            filtered_maxima = mergeMaximaForEachClass(maxima, pointsWithNormals, SingleObjectMaxType::COMPLETE_VOTING_SPACE);
-        if(m_single_object_max_type == "BandwidthMaxima")
-            filtered_maxima = mergeMaximaForEachClass(maxima, pointsWithNormals, SingleObjectMaxType::BANDWIDTH);
-        if(m_single_object_max_type == "ModelRadiusMaxima")
-            filtered_maxima = mergeMaximaForEachClass(maxima, pointsWithNormals, SingleObjectMaxType::MODEL_RADIUS);
+        // vote based or maxima based single maxima computation
+        if(m_single_object_max && m_single_object_max_from_votes)
+            filtered_maxima  = computeSingleMaxPerClass(pointsWithNormals, m_single_object_max_region);
+        else if(m_single_object_max)
+            filtered_maxima = mergeMaximaForEachClass(maxima, pointsWithNormals, m_single_object_max_region);
     }
     else
     {
-        if(m_max_filter_type == "Simple") // search in bandwith radius and keep only maximum with the highest weight
+        if(m_max_filter == MaxFilterSimple) // search in bandwith radius and keep only maximum with the highest weight
             filtered_maxima = filterMaxima(maxima);
-        if(m_max_filter_type == "Merge")  // search in bandwith radius, merge maxima of same class and keep only maximum with the highest weight
+        if(m_max_filter == MaxFilterMerge)  // search in bandwith radius, merge maxima of same class and keep only maximum with the highest weight
             filtered_maxima = mergeAndFilterMaxima(maxima);
     }
     maxima = filtered_maxima;
@@ -240,7 +810,8 @@ std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr
     std::sort(maxima.begin(), maxima.end(), Voting::sortMaxima);
 
     // apply normlization: turn weights to probabilities
-    normalizeWeights(maxima);
+    if(m_normalize_weights)
+        normalizeWeights(maxima);
 
     // add global features to result classification
     if(m_use_global_features) // here we have a sorted list of local maxima, all maxima have a global feature result
@@ -333,7 +904,8 @@ std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr
 
         // sort maxima and normalize again - global features might have changed weights
         std::sort(maxima.begin(), maxima.end(), Voting::sortMaxima);
-        normalizeWeights(maxima);
+        if(m_normalize_weights)
+            normalizeWeights(maxima);
     }
 
     // only keep the best k maxima, if specified
@@ -348,6 +920,64 @@ std::vector<VotingMaximum> Voting::findMaxima(pcl::PointCloud<PointT>::ConstPtr
                  ", this: (" << max.currentClassHypothesis.first << ", " << max.currentClassHypothesis.second << ")" <<
                  ", num votes: " << max.voteIndices.size());
     }
+    m_counters["maxima"] = maxima.size();
+    return maxima;
+}
+
+std::vector<VotingMaximum> Voting::computeClassificationMaxima(const pcl::PointCloud<PointT>::ConstPtr &points)
+{
+    // the masses of the slots are summed per class
+    std::vector<ClassMass> masses;
+    for (const std::unique_ptr<VoteSlot> &slot : m_slots)
+    {
+        const std::vector<ClassMass> &slotMasses = slot->masses;
+        if (slotMasses.size() > masses.size())
+        {
+            ClassMass empty = {0, Eigen::Vector3d::Zero(), 0};
+            masses.resize(slotMasses.size(), empty);
+        }
+        for (int classId = 0; classId < (int)slotMasses.size(); classId++)
+        {
+            masses[classId].weight += slotMasses[classId].weight;
+            masses[classId].weightedPosition += slotMasses[classId].weightedPosition;
+            masses[classId].numVotes += slotMasses[classId].numVotes;
+        }
+    }
+
+    // the bounding box only depends on the points and is shared by the maxima of all classes
+    std::vector<VotingMaximum> maxima;
+    std::size_t numVotes = 0;
+    bool hasMaxima = false;
+    Utils::BoundingBox boundingBox;
+    for (int classId = 0; classId < (int)masses.size(); classId++)
+    {
+        const ClassMass &mass = masses[classId];
+        numVotes += mass.numVotes;
+        if (mass.numVotes == 0)
+            continue;
+
+        std::vector<VotingMaximum> classResult;
+        if ((int)mass.numVotes >= m_minVotesThreshold && mass.weight >= m_minThreshold && mass.weight > 0)
+        {
+            if (!hasMaxima)
+            {
+                boundingBox = Utils::computeMVBB<PointT>(points, m_mvbb_eps, m_mvbb_leaf_size);
+                hasMaxima = true;
+            }
+
+            VotingMaximum maximum;
+            maximum.classId = (unsigned)classId;
+            maximum.position = (mass.weightedPosition / mass.weight).cast<float>();
+            maximum.weight = (float)mass.weight;
+            maximum.boundingBox = boundingBox;
+            classResult.push_back(maximum);
+            maxima.push_back(maximum);
+        }
+        if (m_class_maxima_callback)
+            m_class_maxima_callback((unsigned)classId, classResult);
+    }
+
+    m_counters["votes"] = numVotes;
     return maxima;
 }
 
@@ -372,93 +1002,87 @@ std::vector<VotingMaximum> Voting::computeSingleMaxPerClass(const pcl::PointClou
         if(dist > model_radius) model_radius = dist;
     }
 
-    // compute densities for each class and create a maximum
-    for (std::map<unsigned, std::vector<Voting::Vote> >::const_iterator it = m_votes.begin();
-         it != m_votes.end(); it++)
-    {
-        unsigned classId = it->first;
-        const std::vector<Voting::Vote>& votes = it->second; // all votes for this class
-
-        float search_dist = 0;
-        std::vector<int> indices;
-        std::vector<float> distances;
+    // the bounding box only depends on the points and is shared by the maxima of all classes
+    const Utils::BoundingBox boundingBox = Utils::computeMVBB<PointNormalT>(points, m_mvbb_eps, m_mvbb_leaf_size);
+    const Eigen::Vector3f query_vec = query.getVector3fMap();
 
-        // create dataset and use radius search
-        if(max_type != SingleObjectMaxType::COMPLETE_VOTING_SPACE)
-        {
-            if(max_type == SingleObjectMaxType::BANDWIDTH)
-                search_dist = getSearchDistForClass(classId);
-            if(max_type == SingleObjectMaxType::MODEL_RADIUS)
-                search_dist = model_radius;
-
-            // build dataset
-            pcl::PointCloud<PointT>::Ptr dataset(new pcl::PointCloud<PointT>());
-            dataset->resize(votes.size());
-            for (int i = 0; i < (int)votes.size(); i++)
-            {
-                const Voting::Vote& vote = votes[i];
-                PointT votePoint;
-                votePoint.x = vote.position[0];
-                votePoint.y = vote.position[1];
-                votePoint.z = vote.position[2];
-                dataset->at(i) = votePoint;
-            }
-            dataset->height = 1;
-            dataset->width = dataset->size();
-            dataset->is_dense = false;
+    // one maximum per class, the classes are independent and scan their votes in parallel
+    std::vector<std::pair<unsigned, const std::vector<Voting::Vote>*> > classVotes;
+    for (std::map<unsigned, std::vector<Voting::Vote> >::const_iterator it = m_votes.begin(); it != m_votes.end(); it++)
+        classVotes.push_back(std::make_pair(it->first, &it->second));
+    maxima.resize(classVotes.size());
 
-            // use a kd-tree for exact nearest neighbor search
-            pcl::search::KdTree<PointT>::Ptr search(new pcl::search::KdTree<PointT>());
-            search->setInputCloud(dataset);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < (int)classVotes.size(); c++)
+    {
+        const unsigned classId = classVotes[c].first;
+        const std::vector<Voting::Vote>& votes = *classVotes[c].second; // all votes for this class
 
-            // find nearest points within search window
-            search->radiusSearch(query, search_dist, indices, distances);
-        }
-        else // use all votes: manually compute distances
+        // a single radius search per class: the votes are scanned instead of building a kd-tree over them
+        float search_dist = 0;
+        if(max_type == SingleObjectMaxType::BANDWIDTH)
+            search_dist = getSearchDistForClass(classId);
+        else if(max_type == SingleObjectMaxType::MODEL_RADIUS)
+            search_dist = model_radius;
+        else if(max_type == SingleObjectMaxType::COMPLETE_VOTING_SPACE)
         {
+            // all votes are used, the farthest one defines the kernel size
             float max_dist = 0;
-            Eigen::Vector3f query_vec = query.getArray3fMap();
-            for(int i = 0; i < votes.size(); i++)
-            {
-                Voting::Vote v = votes.at(i);
-                float dist = (v.position - query_vec).squaredNorm();
-                max_dist = max_dist > dist ? max_dist : dist;
-                distances.push_back(dist);
-                indices.push_back(i);
-            }
-            search_dist = sqrt(max_dist);
+            for(const Voting::Vote &vote : votes)
+                max_dist = std::max(max_dist, (vote.position - query_vec).squaredNorm());
+            search_dist = std::sqrt(max_dist);
         }
+        const bool use_all = max_type == SingleObjectMaxType::COMPLETE_VOTING_SPACE;
+        const float search_dist_sqr = search_dist * search_dist;
 
         // NOTE: this is modified code from voting_mean_shift.cpp
-        // compute density
+        // the density is accumulated in the same pass, with a Gaussian kernel on the normalized distance
+        VotingMaximum& new_max = maxima[c];
         float density = 0;
-        for (int i = 0; i < (int)indices.size(); i++)
+        for(int i = 0; i < (int)votes.size(); i++)
         {
-            const Voting::Vote& vote = votes[indices[i]];
-
-            // get euclidean distance between current center and nearest neighbor
-            float distanceSqr = distances[i];
-
-            // compute a normalized distance in {0, 1}
-            float u = distanceSqr / (search_dist * search_dist);
-
-            // compute weights wigh Gaussian kernel
-            float weight = std::exp(-0.5 * u) * vote.weight;
-            density += weight;
+            const float distanceSqr = (votes[i].position - query_vec).squaredNorm();
+            if(!use_all && !(distanceSqr < search_dist_sqr))
+                continue;
+            const float u = distanceSqr / search_dist_sqr;
+            density += std::exp(-0.5 * u) * votes[i].weight;
+            if (!m_lean_maxima)
+                new_max.voteIndices.push_back(i);
         }
 
-        // create one maximum per class
-        VotingMaximum new_max;
         new_max.classId = classId;
-        new_max.position = query.getVector3fMap();
+        new_max.position = query_vec;
         new_max.weight = density;
-        new_max.voteIndices = indices;
-        new_max.boundingBox = Utils::computeMVBB<PointNormalT>(points);
-        maxima.push_back(new_max);
+        new_max.boundingBox = boundingBox;
     }
     return maxima;
 }
 
+std::vector<VotingMaximum> Voting::mergePartialMaxima(const std::vector<VotingMaximum> &maxima)
+{
+    std::vector<VotingMaximum> merged = maxima;
+    if(m_max_filter == MaxFilterSimple)
+        merged = filterMaxima(maxima);
+    if(m_max_filter == MaxFilterMerge)
+        merged = mergeAndFilterMaxima(maxima);
+
+    std::sort(merged.begin(), merged.end(), Voting::sortMaxima);
+    normalizeWeights(merged);
+    if (m_bestK > 0 && merged.size() >= m_bestK)
+        merged.erase(merged.begin() + m_bestK, merged.end());
+    return merged;
+}
+
+float Voting::getMaxObjectRadius() const
+{
+    float radius = 0;
+    for(const auto &classRadius : m_average_radii)
+        radius = std::max(radius, classRadius.second);
+    for(const auto &dimensions : m_id_bb_dimensions_map)
+        radius = std::max(radius, dimensions.second.first);
+    return radius;
+}
+
 std::vector<VotingMaximum> Voting::mergeAndFilterMaxima(const std::vector<VotingMaximum> &maxima) const
 {
     return filterMaxima(maxima, true);
@@ -471,24 +1095,57 @@ std::vector<VotingMaximum> Voting::filterMaxima(const std::vector<VotingMaximum>
     std::vector<VotingMaximum> filtered_maxima;
     std::vector<bool> dirty_list(maxima.size(), false);
 
+    // adaptive search distance depending on config and class id, computed once per class
+    std::map<unsigned, float> class_search_dists;
+    std::vector<float> search_dists(maxima.size());
+    float max_search_dist = 0;
+    for(unsigned i = 0; i < maxima.size(); i++)
+    {
+        unsigned class_id = maxima.at(i).classId;
+        std::map<unsigned, float>::const_iterator it = class_search_dists.find(class_id);
+        if(it == class_search_dists.end())
+            it = class_search_dists.insert({class_id, getSearchDistForClass(class_id)}).first;
+        search_dists[i] = it->second;
+        max_search_dist = std::max(max_search_dist, it->second);
+    }
+
+    // maxima are searched in a grid with the largest search distance as cell size
+    std::vector<Eigen::Vector3f> positions(maxima.size());
+    for(unsigned i = 0; i < maxima.size(); i++)
+        positions[i] = maxima.at(i).position;
+    VoteGrid grid;
+    if(max_search_dist > 0)
+        grid.build(positions, max_search_dist);
+
+    std::vector<int> neighbors;
     for(unsigned i = 0; i < maxima.size(); i++)
     {
         if(dirty_list.at(i))
             continue;
 
-        // set adaptive search distance depending on config and class id
-        float search_dist = getSearchDistForClass(maxima.at(i).classId);
+        float search_dist = search_dists[i];
+
+        // check distance to other maxima, in index order
+        neighbors.clear();
+        if(search_dist > 0)
+        {
+            grid.forEachNeighbor(positions[i], search_dist, [&](int index, float)
+            {
+                int j = grid.getVoteIndex(index);
+                if(j > (int)i)
+                    neighbors.push_back(j);
+            });
+            std::sort(neighbors.begin(), neighbors.end());
+        }
 
-        // check distance to other maxima
-        for(unsigned j = i+1; j < maxima.size(); j++)
+        for(int j : neighbors)
         {
             if(dirty_list.at(j))
                 continue;
 
             float dist = (maxima.at(j).position - maxima.at(i).position).norm();
-            float other_search_dist = getSearchDistForClass(maxima.at(j).classId);
             // only subsume maxima of classes with a smaller or equal search dist
-            if(dist < search_dist && other_search_dist <= search_dist)
+            if(dist < search_dist && search_dists[j] <= search_dist)
             {
                 close_maxima.push_back(maxima.at(j));
                 dirty_list.at(j) = true;
@@ -572,68 +1229,49 @@ std::vector<VotingMaximum> Voting::mergeMaximaForEachClass(const std::vector<Vot
         if(dist > model_radius) model_radius = dist;
     }
 
-    std::vector<bool> used(max_list.size(), false);
-    std::vector<VotingMaximum> class_maxima;
-    std::vector<VotingMaximum> result_maxima;
-
-    for(int i = 0; i < max_list.size(); i++)
+    // maxima are grouped by class in one pass, the merged maximum of a class is added at the position of the
+    // first maximum of the class
+    std::map<unsigned, std::vector<VotingMaximum> > class_maxima;
+    std::vector<unsigned> class_order;
+    std::map<unsigned, float> class_search_dists;
+    for(int i = 0; i < (int)max_list.size(); i++)
     {
-        if(used.at(i)) continue;
-
-        class_maxima.clear();
-
         VotingMaximum max_i = max_list.at(i);
         unsigned current_class_id = max_i.classId;
 
-        float search_dist = 0;
-        if(max_type == SingleObjectMaxType::BANDWIDTH)
-            search_dist = getSearchDistForClass(current_class_id);
-        if(max_type == SingleObjectMaxType::MODEL_RADIUS)
-            search_dist = model_radius;
-
-        if(max_type == SingleObjectMaxType::COMPLETE_VOTING_SPACE)
+        std::map<unsigned, float>::const_iterator dist_it = class_search_dists.find(current_class_id);
+        if(dist_it == class_search_dists.end())
         {
-            class_maxima.push_back(max_i);
-            used.at(i) = true;
+            class_order.push_back(current_class_id);
+            class_maxima[current_class_id];
+
+            float search_dist = 0;
+            if(max_type == SingleObjectMaxType::BANDWIDTH)
+                search_dist = getSearchDistForClass(current_class_id);
+            if(max_type == SingleObjectMaxType::MODEL_RADIUS)
+                search_dist = model_radius;
+            dist_it = class_search_dists.insert({current_class_id, search_dist}).first;
         }
-        else
+        float search_dist = dist_it->second;
+
+        if(max_type == SingleObjectMaxType::COMPLETE_VOTING_SPACE)
         {
-            if((max_i.position - query_vec).norm() < search_dist)
-            {
-                max_i.weight = reweightMaximum(max_i, query_vec, search_dist);
-                class_maxima.push_back(max_i);
-                used.at(i) = true;
-            }
+            class_maxima[current_class_id].push_back(max_i);
         }
-
-        // search for maxima with same classID
-        for(int j = i+1; j < max_list.size(); j++)
+        else if((max_i.position - query_vec).norm() < search_dist)
         {
-            if(used.at(j)) continue;
-
-            VotingMaximum max_j = max_list.at(j);
-            if(max_j.classId == current_class_id)
-            {
-                if(max_type == SingleObjectMaxType::COMPLETE_VOTING_SPACE)
-                {
-                    class_maxima.push_back(max_j);
-                    used.at(j) = true;
-                }
-                else
-                {
-                    if((max_j.position - query_vec).norm() < search_dist)
-                    {
-                        max_j.weight = reweightMaximum(max_j, query_vec, search_dist);
-                        class_maxima.push_back(max_j);
-                        used.at(j) = true;
-                    }
-                }
-            }
+            max_i.weight = reweightMaximum(max_i, query_vec, search_dist);
+            class_maxima[current_class_id].push_back(max_i);
         }
+    }
 
-        if(class_maxima.size() > 0)
+    std::vector<VotingMaximum> result_maxima;
+    for(unsigned class_id : class_order)
+    {
+        const std::vector<VotingMaximum> &maxima = class_maxima[class_id];
+        if(maxima.size() > 0)
         {
-            VotingMaximum m = mergeMaxima(class_maxima);
+            VotingMaximum m = mergeMaxima(maxima);
             result_maxima.push_back(m);
         }
     }
@@ -643,18 +1281,21 @@ std::vector<VotingMaximum> Voting::mergeMaximaForEachClass(const std::vector<Vot
 
 VotingMaximum Voting::mergeMaxima(const std::vector<VotingMaximum> &max_list) const
 {
+    // position, size and rotation are averaged with the weights of the maxima in a single pass
     VotingMaximum result;
-    for(VotingMaximum m : max_list)
-    {
-        // NOTE: position and bounding box must be handled before changing weight!
-        result.position = result.position * result.weight + m.position * m.weight;
-        result.position /= (result.weight + m.weight);
-        result.boundingBox.position = result.position;
-        result.boundingBox.size = result.boundingBox.size * result.weight + m.boundingBox.size * m.weight;
-        result.boundingBox.size /= (result.weight + m.weight);
-        boost::math::quaternion<float> rotQuat;
-        Utils::quatWeightedAverage({result.boundingBox.rotQuat, m.boundingBox.rotQuat}, {result.weight, m.weight}, rotQuat);
-        result.boundingBox.rotQuat = rotQuat;
+    Eigen::Vector3f sumPosition(0, 0, 0);
+    Eigen::Vector3f sumSize(0, 0, 0);
+    QuaternionAverage rotation;
+    size_t numVoteIndices = 0;
+    for (const VotingMaximum &m : max_list)
+        numVoteIndices += m.voteIndices.size();
+    result.voteIndices.reserve(numVoteIndices);
+
+    for (const VotingMaximum &m : max_list)
+    {
+        sumPosition += m.weight * m.position;
+        sumSize += m.weight * m.boundingBox.size;
+        rotation.add(m.boundingBox.rotQuat, m.weight);
 
         result.classId = m.classId;
         result.weight += m.weight;
@@ -664,6 +1305,14 @@ VotingMaximum Voting::mergeMaxima(const std::vector<VotingMaximum> &max_list) co
         result.globalHypothesis = m.globalHypothesis;
         result.currentClassHypothesis = m.currentClassHypothesis;
     }
+
+    if (result.weight > 0)
+    {
+        result.position = sumPosition / result.weight;
+        result.boundingBox.size = sumSize / result.weight;
+    }
+    result.boundingBox.position = result.position;
+    rotation.compute(result.boundingBox.rotQuat);
     return result;
 }
 
@@ -681,219 +1330,348 @@ float Voting::reweightMaximum(const VotingMaximum &max, const Eigen::Vector3f &q
 float Voting::getSearchDistForClass(const unsigned class_id) const
 {
     float search_dist = 0;
-    if(m_radiusType == "Config")
+    if(m_radius_mode == RadiusConfig)
         search_dist = m_radius;
-    if(m_radiusType == "FirstDim")
+    if(m_radius_mode == RadiusFirstDim)
         search_dist = m_id_bb_dimensions_map.at(class_id).first * m_radiusFactor;
-    if(m_radiusType == "SecondDim")
+    if(m_radius_mode == RadiusSecondDim)
         search_dist = m_id_bb_dimensions_map.at(class_id).second * m_radiusFactor;
     return search_dist;
 }
 
 
-void Voting::verifyMaxHypothesisWithGlobalFeatures(const pcl::PointCloud<PointT>::ConstPtr &points, const pcl::PointCloud<pcl::Normal>::ConstPtr &normals,
-                                                   const pcl::KdTreeFLANN<PointT> &input_points_kdtree, VotingMaximum &maximum)
+std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> Voting::computeGlobalFeatures(const pcl::PointCloud<PointT>::ConstPtr &points,
+                                                                                const pcl::PointCloud<pcl::Normal>::ConstPtr &normals,
+                                                                                const pcl::search::Search<PointT>::Ptr &search,
+                                                                                const std::vector<VotingMaximum> &maxima) const
 {
-    // first segment region cloud from input with typical radius for this class id
-    pcl::PointCloud<PointT>::Ptr segmented_points(new pcl::PointCloud<PointT>());
-    pcl::PointCloud<pcl::Normal>::Ptr segmented_normals(new pcl::PointCloud<pcl::Normal>());
-    std::vector<int> pointIdxRadiusSearch;
-    std::vector<float> pointRadiusSquaredDistance;
-    float radius = m_average_radii.at(maximum.classId);
-    PointT query;
-    query.x = maximum.position.x();
-    query.y = maximum.position.y();
-    query.z = maximum.position.z();
-
-    if(input_points_kdtree.radiusSearch(query, radius, pointIdxRadiusSearch, pointRadiusSquaredDistance) > 0)
-    {
-        // segment points
-        pcl::ExtractIndices<PointT> extract;
-        extract.setInputCloud(points);
-        pcl::PointIndices::Ptr indices (new pcl::PointIndices());
-        indices->indices = pointIdxRadiusSearch;
-        extract.setIndices(indices);
-        extract.filter(*segmented_points);
-        // segment normals
-        pcl::ExtractIndices<pcl::Normal> extract_normals;
-        extract_normals.setInputCloud(normals);
-        extract_normals.setIndices(indices); // use same indices
-        extract_normals.filter(*segmented_normals);
+    // segment the region of each maximum from the input with the typical radius for its class id, regions are
+    // kept as sorted point indices
+    std::vector<std::vector<int> > regions(maxima.size());
+    int numFailed = 0;
+    #pragma omp parallel for reduction(+:numFailed)
+    for(int i = 0; i < (int)maxima.size(); i++)
+    {
+        const VotingMaximum &maximum = maxima[i];
+        std::vector<float> pointRadiusSquaredDistance;
+        PointT query;
+        query.x = maximum.position.x();
+        query.y = maximum.position.y();
+        query.z = maximum.position.z();
+
+        if(search->radiusSearch(query, m_average_radii.at(maximum.classId), regions[i], pointRadiusSquaredDistance) > 0)
+            std::sort(regions[i].begin(), regions[i].end());
+        else
+            numFailed++;
     }
-    else
+    if(numFailed > 0)
+        LOG_WARN("Error during nearest neighbor search for " << numFailed << " maxima.");
+
+    // maxima of different classes often cover almost the same region: a maximum shares the descriptor of a
+    // stronger maximum if the intersection over union of their regions reaches the overlap threshold
+    std::vector<int> order(maxima.size());
+    for(int i = 0; i < (int)order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&maxima](int a, int b)
+    {
+        return maxima[a].weight > maxima[b].weight;
+    });
+
+    std::vector<int> representatives; // maxima whose region is described
+    std::vector<int> shared_region(maxima.size(), -1); // index into representatives for each maximum
+    for(int i : order)
     {
-        LOG_WARN("Error during nearest neighbor search.");
+        const std::vector<int> &region = regions[i];
+        for(int r = 0; r < (int)representatives.size() && !region.empty(); r++)
+        {
+            const std::vector<int> &other = regions[representatives[r]];
+            if(other.empty())
+                continue;
+
+            // an upper bound of the overlap that avoids the intersection for regions of very different size
+            float max_overlap = (float)std::min(region.size(), other.size()) / std::max(region.size(), other.size());
+            if(max_overlap < m_global_feature_region_overlap)
+                continue;
+
+            int intersection = 0;
+            std::vector<int>::const_iterator a = region.begin(), b = other.begin();
+            while(a != region.end() && b != other.end())
+            {
+                if(*a < *b)
+                    a++;
+                else if(*b < *a)
+                    b++;
+                else
+                {
+                    intersection++;
+                    a++;
+                    b++;
+                }
+            }
+
+            float overlap = (float)intersection / (region.size() + other.size() - intersection);
+            if(overlap >= m_global_feature_region_overlap)
+            {
+                shared_region[i] = r;
+                break;
+            }
+        }
+
+        if(shared_region[i] == -1)
+        {
+            shared_region[i] = (int)representatives.size();
+            representatives.push_back(i);
+        }
     }
 
-    // compute global feature on segmented points
-    pcl::PointCloud<PointT>::ConstPtr dummy_keypoints(new pcl::PointCloud<PointT>());
-    pcl::search::Search<PointT>::Ptr search = pcl::search::KdTree<PointT>::Ptr(new pcl::search::KdTree<PointT>());
-    pcl::PointCloud<ISMFeature>::ConstPtr global_features =
-            (*m_globalFeatureDescriptor)(segmented_points, segmented_normals, segmented_points, segmented_normals, dummy_keypoints, search);
+    if(representatives.size() < maxima.size())
+        LOG_INFO("computing global features for " << representatives.size() << " regions of " << maxima.size() << " maxima");
 
-    classifyGlobalFeatures(global_features, maximum);
+    // compute global features on the points of each distinct region in one batch
+    std::vector<std::vector<int> > representative_regions(representatives.size());
+    for(int r = 0; r < (int)representatives.size(); r++)
+        representative_regions[r].swap(regions[representatives[r]]);
+    std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> region_features =
+            m_globalFeatureDescriptor->computeGlobalFeatures(points, normals, representative_regions, search);
+
+    std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> global_features(maxima.size());
+    for(int i = 0; i < (int)maxima.size(); i++)
+        global_features[i] = region_features[shared_region[i]];
+    return global_features;
 }
 
 void Voting::classifyGlobalFeatures(const pcl::PointCloud<ISMFeature>::ConstPtr global_features, VotingMaximum &maximum)
 {
-    // if no SVM data available defaul to KNN
-    if(m_svm_error) m_global_feature_method = "KNN";
+    std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> features_list(1, global_features);
+    std::vector<VotingMaximum> maxima(1, maximum);
+    classifyGlobalFeatures(features_list, maxima);
+    maximum = maxima[0];
+}
 
-    // process current global features according to some strategy
-    std::pair<unsigned, float> best_overall; // pair of class id and score
-    std::pair<unsigned, float> best_this_classId;
-    CustomSVM::SVMResponse svm_response;
+void Voting::setGlobalMaximum(const pcl::PointCloud<PointT>::ConstPtr &points, VotingMaximum &maximum) const
+{
+    maximum.classId = maximum.globalHypothesis.first;
+    maximum.weight = maximum.globalHypothesis.second;
+    Eigen::Vector4d centroid;
+    pcl::compute3DCentroid(*points, centroid);
+    maximum.position = Eigen::Vector3f(centroid.x(), centroid.y(), centroid.z());
+    maximum.boundingBox = Utils::computeMVBB<PointT>(points, m_mvbb_eps, m_mvbb_leaf_size);
+}
+
+bool Voting::usesGlobalEarlyExit() const
+{
+    // the KNN fallback of a model without SVM data has no comparable score
+    const bool svm = (m_global_feature_method == "SVM" && !m_svm_error) || m_global_feature_method == "LinearSVM";
+    return m_global_early_exit && m_use_global_features && svm;
+}
+
+bool Voting::classifyGlobalEarly(pcl::PointCloud<ISMFeature>::ConstPtr globalFeatures,
+                                 pcl::PointCloud<PointT>::ConstPtr points, VotingMaximum &maximum)
+{
+    if(!usesGlobalEarlyExit() || !globalFeatures || globalFeatures->empty() || points->empty())
+        return false;
+
+    VotingMaximum global_max;
+    classifyGlobalFeatures(globalFeatures, global_max);
+    if(global_max.globalHypothesis.first < 0 || global_max.globalHypothesis.second <= m_global_param_min_svm_score)
+        return false;
+
+    LOG_INFO("global classification with score " << global_max.globalHypothesis.second << ", skipping local features");
+    setGlobalMaximum(points, global_max);
+    global_max.currentClassHypothesis = global_max.globalHypothesis;
+    if(m_normalize_weights)
+        global_max.weight = 1.0f;
+    maximum = global_max;
+    return true;
+}
+
+void Voting::classifyGlobalFeatures(const std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> &global_features,
+                                    std::vector<VotingMaximum> &maxima)
+{
+    LOG_ASSERT(global_features.size() == maxima.size());
 
-    if(!m_index_created)
+    // if no SVM data available defaul to KNN
+    if(m_svm_error && m_global_feature_method == "SVM") m_global_feature_method = "KNN";
+
+    // the global features of all maxima are classified together, offsets mark the features of each maximum
+    std::vector<int> offsets(maxima.size() + 1, 0);
+    for(int i = 0; i < (int)global_features.size(); i++)
     {
-        LOG_INFO("creating flann index for global features");
-        m_flann_helper->buildIndex(m_distanceType, 1);
-        m_index_created = true;
+        int num_features = global_features[i] ? (int)global_features[i]->size() : 0;
+        offsets[i + 1] = offsets[i] + num_features;
     }
 
     if(m_global_feature_method == "KNN")
     {
-        int new_k = m_k_global_features;
-
-        std::map<unsigned, unsigned> max_global_voting; // maps class id to number of occurences
-        int all_entries = 0;
+        if(!m_index_created)
+        {
+            LOG_ERROR("flann index for global features is not available");
+            return;
+        }
 
-        // find nearest neighbors to current global features in learned data
-        for(ISMFeature query_feature : global_features->points)
+        std::vector<std::vector<int> > indices;
+        std::vector<std::vector<float> > distances;
+        int num_queries = offsets.back();
+        if(num_queries > 0)
         {
-            // insert the query point
-            flann::Matrix<float> query(new float[query_feature.descriptor.size()], 1, query_feature.descriptor.size());
-            for(int i = 0; i < query_feature.descriptor.size(); i++)
+            int dim = m_flann_helper->dataset.cols;
+            flann::Matrix<float> query(new float[num_queries * dim], num_queries, dim);
+            for(int i = 0; i < (int)global_features.size(); i++)
             {
-                query[0][i] = query_feature.descriptor.at(i);
+                for(int j = offsets[i]; j < offsets[i + 1]; j++)
+                {
+                    const std::vector<float> &descriptor = global_features[i]->at(j - offsets[i]).descriptor;
+                    std::copy(descriptor.begin(), descriptor.end(), query[j]);
+                }
             }
 
-            // search
-            std::vector<std::vector<int> > indices;
-            std::vector<std::vector<float> > distances;
-            if(m_flann_helper->getDistType() == "Euclidean")
-            {
-                m_flann_helper->getIndexL2()->knnSearch(query, indices, distances, new_k, flann::SearchParams(-1));
-            }
-            else if(m_flann_helper->getDistType() == "ChiSquared")
-            {
-                m_flann_helper->getIndexChi()->knnSearch(query, indices, distances, new_k, flann::SearchParams(-1));
-            }
-            else if(m_flann_helper->getDistType() == "Hellinger")
-            {
-                m_flann_helper->getIndexHel()->knnSearch(query, indices, distances, new_k, flann::SearchParams(-1));
-            }
-            else if(m_flann_helper->getDistType() == "HistIntersection")
-            {
-                m_flann_helper->getIndexHist()->knnSearch(query, indices, distances, new_k, flann::SearchParams(-1));
-            }
+            // kd-tree searches are exact, the graph index uses approximate search
+            bool exact = m_index_params.type != "HNSW";
+            m_flann_helper->knnSearch(query, indices, distances, m_k_global_features, exact, omp_get_max_threads());
             delete[] query.ptr();
+        }
+
+        for(int i = 0; i < (int)maxima.size(); i++)
+        {
+            std::map<unsigned, unsigned> max_global_voting; // maps class id to number of occurences
+            int all_entries = 0;
 
             // classic KNN approach
-            all_entries += indices[0].size(); // NOTE: is not necessaraly k, because only (k-x) might have been found
-            // loop over results
-            for(int i = 0; i < indices[0].size(); i++)
+            for(int j = offsets[i]; j < offsets[i + 1]; j++)
             {
-                // insert result
-                ISMFeature temp = m_all_global_features_cloud->at(indices[0].at(i));
-                insertGlobalResult(max_global_voting, temp.classId);
+                all_entries += indices[j].size(); // NOTE: is not necessaraly k, because only (k-x) might have been found
+                // loop over results
+                for(int n = 0; n < indices[j].size(); n++)
+                {
+                    // insert result
+                    const ISMFeature &temp = m_all_global_features_cloud->at(indices[j].at(n));
+                    insertGlobalResult(max_global_voting, temp.classId);
+                }
             }
+            setGlobalKnnResult(max_global_voting, all_entries, maxima[i]);
+        }
+    }
+    else if(m_global_feature_method == "SVM" || m_global_feature_method == "LinearSVM")
+    {
+        const bool linear = m_global_feature_method == "LinearSVM";
+        if(linear && (!m_linear_svm || !m_linear_svm->isTrained()))
+        {
+            LOG_ERROR("linear SVM for global features is not available");
+            return;
         }
 
-        // normalize list and create result for score with current class id and ...
-        best_this_classId = {maximum.classId, 0};
-        if(all_entries > 0 && max_global_voting.find(maximum.classId) != max_global_voting.end())
+        // one sample matrix for all maxima, predicted in one batch
+        const int num_samples = offsets.back();
+        if(num_samples == 0)
+            return;
+        int dim = 0;
+        for(int i = 0; i < (int)global_features.size() && dim == 0; i++)
         {
-            float score = max_global_voting.at(maximum.classId) / (float) all_entries;
-            best_this_classId = {maximum.classId, score};
+            if(offsets[i + 1] > offsets[i])
+                dim = (int)global_features[i]->at(0).descriptor.size();
         }
-        // ... overall best score
-        best_overall = {0, 0};
-        for(auto it : max_global_voting)
+        cv::Mat samples(num_samples, dim, CV_32FC1);
+        for(int i = 0; i < (int)global_features.size(); i++)
         {
-            float score = all_entries == 0 ? 0 : it.second / (float) all_entries;
-            if(score > best_overall.second)
+            for(int j = offsets[i]; j < offsets[i + 1]; j++)
             {
-                best_overall = {it.first, score};
+                const std::vector<float> &descriptor = global_features[i]->at(j - offsets[i]).descriptor;
+                std::copy(descriptor.begin(), descriptor.end(), samples.ptr<float>(j));
             }
         }
-    }
-    else if(m_global_feature_method == "SVM")
-    {
-        std::vector<CustomSVM::SVMResponse> all_responses; // in case one object has multiple global features
-        for(ISMFeature query_feature : global_features->points)
+        const std::vector<CustomSVM::SVMResponse> responses = linear ? m_linear_svm->predict(samples)
+                                                                     : m_svm->predictUnifyScoreBatch(samples);
+
+        for(int i = 0; i < (int)maxima.size(); i++)
         {
-            // convert to SVM data format
-            std::vector<float> data_raw = query_feature.descriptor;
-            float data[data_raw.size()];
-            for(unsigned i = 0; i < data_raw.size(); i++)
+            // maxima without global features keep their hypotheses
+            if(offsets[i + 1] > offsets[i])
             {
-                data[i] = data_raw.at(i);
+                setGlobalSvmResult(std::vector<CustomSVM::SVMResponse>(responses.begin() + offsets[i],
+                                                                       responses.begin() + offsets[i + 1]), maxima[i]);
             }
-            cv::Mat data_svm(1, data_raw.size(), CV_32FC1, data);
+        }
+    }
+}
 
-            CustomSVM::SVMResponse temp_response = m_svm.predictUnifyScore(data_svm, m_svm_files);
-            all_responses.push_back(temp_response);
+void Voting::setGlobalKnnResult(const std::map<unsigned, unsigned> &max_global_voting, int all_entries, VotingMaximum &maximum) const
+{
+    // normalize list and create result for score with current class id and ...
+    std::pair<unsigned, float> best_this_classId = {maximum.classId, 0};
+    if(all_entries > 0 && max_global_voting.find(maximum.classId) != max_global_voting.end())
+    {
+        float score = max_global_voting.at(maximum.classId) / (float) all_entries;
+        best_this_classId = {maximum.classId, score};
+    }
+    // ... overall best score
+    std::pair<unsigned, float> best_overall = {0, 0};
+    for(auto it : max_global_voting)
+    {
+        float score = all_entries == 0 ? 0 : it.second / (float) all_entries;
+        if(score > best_overall.second)
+        {
+            best_overall = {it.first, score};
         }
+    }
 
-        // check if several responses are available
-        if(all_responses.size() > 1)
+    // pass the results to the maximum object
+    maximum.globalHypothesis = best_overall;
+    maximum.currentClassHypothesis = best_this_classId;
+}
+
+void Voting::setGlobalSvmResult(const std::vector<CustomSVM::SVMResponse> &all_responses, VotingMaximum &maximum) const
+{
+    CustomSVM::SVMResponse svm_response;
+
+    // check if several responses are available
+    if(all_responses.size() > 1)
+    {
+        std::map<unsigned, unsigned> num_of_occurences; // count number of class labels
+        for(CustomSVM::SVMResponse resp : all_responses)
         {
-            std::map<unsigned, unsigned> num_of_occurences; // count number of class labels
-            for(CustomSVM::SVMResponse resp : all_responses)
-            {
-                insertGlobalResult(num_of_occurences, (unsigned) resp.label);
-            }
+            insertGlobalResult(num_of_occurences, (unsigned) resp.label);
+        }
 
-            int best_class = 0;
-            int best_occurences = 0;
-            for(auto it : num_of_occurences)
+        int best_class = 0;
+        int best_occurences = 0;
+        for(auto it : num_of_occurences)
+        {
+            // NOTE: what if there are 2 equal classes?
+            if(it.second > best_occurences) // find highest number of occurences
             {
-                // NOTE: what if there are 2 equal classes?
-                if(it.second > best_occurences) // find highest number of occurences
-                {
-                    best_occurences = it.second;
-                    best_class = it.first;
-                }
+                best_occurences = it.second;
+                best_class = it.first;
             }
+        }
 
-            // find best class in list of responses with "best" (highest) score
-            float best_score = -999999;
-            CustomSVM::SVMResponse best_response = all_responses.at(0); // init with first value
-            for(int i = 0; i < all_responses.size(); i++)
+        // find best class in list of responses with "best" (highest) score
+        float best_score = -999999;
+        CustomSVM::SVMResponse best_response = all_responses.at(0); // init with first value
+        for(int i = 0; i < all_responses.size(); i++)
+        {
+            if(all_responses.at(i).label == best_class)
             {
-                if(all_responses.at(i).label == best_class)
+                if(all_responses.at(i).score > best_score)
                 {
-                    if(all_responses.at(i).score > best_score)
-                    {
-                        best_score = all_responses.at(i).score;
-                        best_response = all_responses.at(i);
-                    }
+                    best_score = all_responses.at(i).score;
+                    best_response = all_responses.at(i);
                 }
             }
-            svm_response = best_response;
-        }
-        else if(all_responses.size() == 1)
-        {
-            svm_response = all_responses.at(0);
         }
+        svm_response = best_response;
     }
-
-    // pass the results to the maximum object
-    if(m_global_feature_method == "KNN")
-    {
-        maximum.globalHypothesis = best_overall;
-        maximum.currentClassHypothesis = best_this_classId;
-    }
-    else if(m_global_feature_method == "SVM")
+    else if(all_responses.size() == 1)
     {
-        float cur_score = m_single_object_mode ? 0 : svm_response.all_scores.at(maximum.classId);
-        maximum.globalHypothesis = {svm_response.label, svm_response.score};
-        maximum.currentClassHypothesis = {maximum.classId, cur_score};
+        svm_response = all_responses.at(0);
     }
+
+    // pass the results to the maximum object
+    float cur_score = m_single_object_mode ? 0 : svm_response.all_scores.at(maximum.classId);
+    maximum.globalHypothesis = {svm_response.label, svm_response.score};
+    maximum.currentClassHypothesis = {maximum.classId, cur_score};
 }
 
-void Voting::insertGlobalResult(std::map<unsigned, unsigned> &max_global_voting, unsigned found_class)
+void Voting::insertGlobalResult(std::map<unsigned, unsigned> &max_global_voting, unsigned found_class) const
 {
     if(max_global_voting.find(found_class) != max_global_voting.end())
     {
@@ -918,6 +1696,58 @@ const std::map<unsigned, std::vector<Voting::Vote> >& Voting::getVotes() const
     return m_votes;
 }
 
+DetectionArena& Voting::getArena() const
+{
+    return m_arena;
+}
+
+const std::map<std::string, double>& Voting::getCounters() const
+{
+    return m_counters;
+}
+
+void Voting::iMemoryUsage(MemoryUsage &usage) const
+{
+    // the votes of the current detection, the buffers of the threads are part of the arena
+    MemoryUsage &votes = usage.addPart("votes", m_activations.capacity() * sizeof(Activation));
+    for (const std::pair<const unsigned, std::vector<Vote> > &classVotes : m_votes)
+    {
+        std::size_t bytes = classVotes.second.capacity() * sizeof(Vote);
+        votes.bytes += bytes;
+        votes.addClassBytes(classVotes.first, bytes);
+    }
+    usage.addPart("detection arena", m_arena.getCapacity());
+
+    MemoryUsage &globalFeatures = usage.addPart("global features");
+    for (const std::pair<const unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &classFeatures : m_global_features)
+    {
+        std::size_t bytes = 0;
+        for (const pcl::PointCloud<ISMFeature>::Ptr &features : classFeatures.second)
+        {
+            if (features)
+                bytes += MemoryReport::estimateBytes(*features);
+        }
+        globalFeatures.bytes += bytes;
+        globalFeatures.addClassBytes(classFeatures.first, bytes);
+    }
+    if (m_global_features_single_object)
+        globalFeatures.bytes += MemoryReport::estimateBytes(*m_global_features_single_object);
+    if (m_all_global_features_cloud)
+        globalFeatures.bytes += MemoryReport::estimateBytes(*m_all_global_features_cloud);
+    if (m_flann_helper)
+        globalFeatures.addPart(m_flann_helper->memoryUsage());
+
+    // the support vectors of the resident svm models
+    usage.addPart("svm", m_svm->getSupportVectorBytes());
+    usage.addPart("linear svm", m_linear_svm ? m_linear_svm->getBytes() : 0);
+}
+
+void Voting::addCounter(const std::string &name, double value) const
+{
+    #pragma omp critical(voting_counters)
+    m_counters[name] += value;
+}
+
 const std::vector<Voting::Vote>& Voting::getVotes(unsigned classId) const
 {
     if (m_votes.find(classId) == m_votes.end()) {
@@ -931,6 +1761,24 @@ const std::vector<Voting::Vote>& Voting::getVotes(unsigned classId) const
 void Voting::clear()
 {
     m_votes.clear();
+    m_activations.clear();
+    m_counters.clear();
+
+    // the arena is reset after the buffers allocated in it are released, the masses keep their memory for the
+    // next detection
+    for (std::unique_ptr<VoteSlot> &slot : m_slots)
+    {
+        slot->votes.clear();
+        ArenaVector<Activation>(ArenaAllocator<Activation>(&m_arena)).swap(slot->activations);
+        slot->masses.clear();
+    }
+    m_arena.reset();
+}
+
+void Voting::releaseVotes()
+{
+    std::map<unsigned, std::vector<Vote> >().swap(m_votes);
+    std::vector<Activation>().swap(m_activations);
 }
 
 void Voting::determineAverageBoundingBoxDimensions(const std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes)
@@ -940,46 +1788,64 @@ void Voting::determineAverageBoundingBoxDimensions(const std::map<unsigned, std:
 
     for(auto it : boundingBoxes)
     {
-        unsigned classId = it.first;
-        float max_accu = 0;
-        float max_accuSqr = 0;
-        float med_accu = 0;
-        float med_accuSqr = 0;
+        insertBoundingBoxDimensions(it.first, it.second);
+    }
+}
+
+void Voting::addAverageBoundingBoxDimensions(const std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes)
+{
+    for(auto it : boundingBoxes)
+    {
+        // the number of models of a known class is not stored, so their averages can not be updated
+        if(m_id_bb_dimensions_map.find(it.first) != m_id_bb_dimensions_map.end())
+        {
+            LOG_INFO("keeping the bounding box dimensions of class " << it.first);
+            continue;
+        }
+        insertBoundingBoxDimensions(it.first, it.second);
+    }
+}
+
+void Voting::insertBoundingBoxDimensions(unsigned classId, const std::vector<Utils::BoundingBox> &boxes)
+{
+    float max_accu = 0;
+    float max_accuSqr = 0;
+    float med_accu = 0;
+    float med_accuSqr = 0;
 
-        // check each bounding box of this class id
-        for(auto box : it.second)
+    // check each bounding box of this class id
+    for(auto box : boxes)
+    {
+        float max = box.size.maxCoeff();
+        float min = box.size.minCoeff();
+        // find the other value
+        float med = box.size[0];
+        for(int i = 1; i < 3; i++)
         {
-            float max = box.size.maxCoeff();
-            float min = box.size.minCoeff();
-            // find the other value
-            float med = box.size[0];
-            for(int i = 1; i < 3; i++)
+            if(med == max || med == min)
             {
-                if(med == max || med == min)
-                {
-                    med = box.size[i];
-                }
+                med = box.size[i];
             }
-
-            // use "radius" of bb dimensions, i.e. half of the sizes
-            max_accu += max/2;
-            med_accu += med/2;
-            max_accuSqr += ((max/2)*(max/2));
-            med_accuSqr += ((med/2)*(med/2));
         }
 
-        // compute average
-        max_accu /= it.second.size();
-        med_accu /= it.second.size();
-        max_accuSqr /= it.second.size();
-        med_accuSqr /= it.second.size();
-
-        // compute variance
-        float max_var = max_accuSqr - (max_accu*max_accu);
-        float med_var = med_accuSqr - (med_accu*med_accu);
-        m_id_bb_dimensions_map.insert({classId, {max_accu, med_accu}});
-        m_id_bb_variance_map.insert({classId, {max_var, med_var}});
+        // use "radius" of bb dimensions, i.e. half of the sizes
+        max_accu += max/2;
+        med_accu += med/2;
+        max_accuSqr += ((max/2)*(max/2));
+        med_accuSqr += ((med/2)*(med/2));
     }
+
+    // compute average
+    max_accu /= boxes.size();
+    med_accu /= boxes.size();
+    max_accuSqr /= boxes.size();
+    med_accuSqr /= boxes.size();
+
+    // compute variance
+    float max_var = max_accuSqr - (max_accu*max_accu);
+    float med_var = med_accuSqr - (med_accu*med_accu);
+    m_id_bb_dimensions_map.insert({classId, {max_accu, med_accu}});
+    m_id_bb_variance_map.insert({classId, {max_var, med_var}});
 }
 
 void Voting::normalizeWeights(std::vector<VotingMaximum> &maxima)
@@ -1005,6 +1871,228 @@ void Voting::setGlobalFeatures(pcl::PointCloud<ISMFeature>::Ptr &globalFeatures)
 void Voting::forwardGlobalFeatures(std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures)
 {
     m_global_features = globalFeatures;
+
+    // the index is rebuilt on the new features
+    m_flann_helper.reset();
+    m_index_created = false;
+}
+
+void Voting::addGlobalFeatures(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures)
+{
+    for(auto it : globalFeatures)
+    {
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> &classFeatures = m_global_features[it.first];
+        classFeatures.insert(classFeatures.end(), it.second.begin(), it.second.end());
+    }
+    computeAverageRadii();
+
+    // the index is rebuilt on all features
+    m_flann_helper.reset();
+    m_index_created = false;
+}
+
+Voting* Voting::createDetectionCopy() const
+{
+    Voting* voting = Factory<Voting>::create(configToJson());
+
+    voting->m_use_svm = m_use_svm;
+    voting->m_svm_path = m_svm_path;
+    voting->m_svm_error = m_svm_error;
+    voting->m_svm = m_svm;
+    voting->m_linear_svm = m_linear_svm;
+
+    voting->m_id_bb_dimensions_map = m_id_bb_dimensions_map;
+    voting->m_id_bb_variance_map = m_id_bb_variance_map;
+    voting->m_global_features = m_global_features;
+    voting->m_all_global_features_cloud = m_all_global_features_cloud;
+    voting->m_average_radii = m_average_radii;
+    voting->m_globalFeatureDescriptor = m_globalFeatureDescriptor;
+
+    voting->m_distanceType = m_distanceType;
+    voting->m_index_params = m_index_params;
+    voting->m_mvbb_eps = m_mvbb_eps;
+    voting->m_mvbb_leaf_size = m_mvbb_leaf_size;
+    voting->m_lean_maxima = m_lean_maxima;
+    voting->m_region_of_interest = m_region_of_interest;
+
+    // the index is only searched during detection
+    voting->m_flann_helper = m_flann_helper;
+    voting->m_index_created = m_index_created;
+    return voting;
+}
+
+void Voting::computeAverageRadii()
+{
+    m_average_radii.clear();
+    for(auto it = m_global_features.begin(); it != m_global_features.end(); it++)
+    {
+        float avg_radius = 0;
+        int num_points = 0;
+        unsigned classID = it->first;
+
+        std::vector<pcl::PointCloud<ISMFeature>::Ptr> cloud_vector = it->second;
+        for(auto cloud : cloud_vector)
+        {
+            for(ISMFeature ism_feature : cloud->points)
+            {
+                avg_radius += ism_feature.globalDescriptorRadius;
+                num_points += 1;
+            }
+        }
+        m_average_radii.insert({classID, avg_radius / num_points});
+    }
+}
+
+void Voting::buildGlobalFeatureIndex()
+{
+    if(!m_use_global_features)
+        return;
+
+    // during training the dataset is created from the forwarded global features
+    if(!m_flann_helper && !m_global_features.empty())
+    {
+        m_all_global_features_cloud = pcl::PointCloud<ISMFeature>::Ptr(new pcl::PointCloud<ISMFeature>());
+        for(auto it : m_global_features)
+        {
+            for(auto feat_cloud : it.second)
+            {
+                for(ISMFeature ism_feature : feat_cloud->points)
+                {
+                    ism_feature.classId = it.first;
+                    m_all_global_features_cloud->push_back(ism_feature);
+                }
+            }
+        }
+        createGlobalFeatureDataset();
+    }
+
+    if(m_global_feature_method == "LinearSVM" && !m_linear_svm)
+        trainLinearSvm();
+
+    if(m_index_created || !m_flann_helper)
+        return;
+
+    LOG_INFO("creating flann index for global features");
+    m_flann_helper->buildIndex(getGlobalDistanceType(), m_index_params);
+    m_index_created = true;
+}
+
+void Voting::trainLinearSvm()
+{
+    if(!m_all_global_features_cloud || m_all_global_features_cloud->empty())
+    {
+        LOG_WARN("no global features available for the linear SVM");
+        return;
+    }
+
+    std::vector<std::vector<float> > samples;
+    std::vector<int> labels;
+    samples.reserve(m_all_global_features_cloud->size());
+    labels.reserve(m_all_global_features_cloud->size());
+    for(const ISMFeature &feature : m_all_global_features_cloud->points)
+    {
+        samples.push_back(feature.descriptor);
+        labels.push_back((int)feature.classId);
+    }
+
+    RandomFeatureSVM::Params params;
+    params.numFeatures = m_linear_svm_features;
+    params.gamma = m_linear_svm_gamma;
+    params.c = m_linear_svm_c;
+    params.epochs = m_linear_svm_epochs;
+
+    LOG_INFO("training linear SVM for global features on " << samples.size() << " features");
+    std::shared_ptr<RandomFeatureSVM> svm = std::make_shared<RandomFeatureSVM>(params);
+    if(svm->train(samples, labels))
+        m_linear_svm = svm;
+    else
+        LOG_ERROR("could not train linear SVM for global features");
+}
+
+void Voting::saveGlobalFeatureIndex(boost::archive::binary_oarchive &oa) const
+{
+    std::vector<char> indexData;
+    bool hasIndex = m_index_created && m_flann_helper->saveIndex(indexData);
+    oa << hasIndex;
+    if(hasIndex)
+    {
+        std::string distType = m_flann_helper->getDistType();
+        const KnnIndexParams& params = m_flann_helper->getIndexParams();
+        int numFeatures = m_flann_helper->dataset.rows;
+        oa << distType;
+        oa << params.type;
+        oa << params.kd_trees;
+        oa << params.hnsw_m;
+        oa << params.hnsw_ef_construction;
+        oa << numFeatures;
+        oa << indexData;
+    }
+}
+
+bool Voting::loadGlobalFeatureIndex(boost::archive::binary_iarchive &ia)
+{
+    bool hasIndex;
+    ia >> hasIndex;
+    if(!hasIndex)
+        return false;
+
+    std::string distType;
+    KnnIndexParams params = m_index_params;
+    int numFeatures;
+    std::vector<char> indexData;
+    ia >> distType;
+    ia >> params.type;
+    ia >> params.kd_trees;
+    ia >> params.hnsw_m;
+    ia >> params.hnsw_ef_construction;
+    ia >> numFeatures;
+    ia >> indexData;
+
+    if(!m_use_global_features || !m_flann_helper || m_index_created)
+        return false;
+
+    // the stored index covers the features of all classes
+    if(!m_class_filter.empty())
+        return false;
+
+    // the index is only used if it was built with the current configuration, search parameters may differ
+    if(distType == getGlobalDistanceType() && params.type == m_index_params.type &&
+            params.kd_trees == m_index_params.kd_trees && params.hnsw_m == m_index_params.hnsw_m &&
+            params.hnsw_ef_construction == m_index_params.hnsw_ef_construction &&
+            numFeatures == (int)m_flann_helper->dataset.rows &&
+            m_flann_helper->loadIndex(distType, m_index_params, indexData))
+    {
+        m_index_created = true;
+        return true;
+    }
+
+    LOG_WARN("stored flann index for global features does not match the configuration, it will be rebuilt");
+    return false;
+}
+
+std::string Voting::getGlobalDistanceType() const
+{
+    // global descriptors are histograms, binarizing them for the Hamming distance of binary local descriptors
+    // would lose their values
+    if(m_distanceType == DistanceHamming::getTypeStatic())
+        return DistanceEuclidean::getTypeStatic();
+    return m_distanceType;
+}
+
+void Voting::createGlobalFeatureDataset()
+{
+    m_flann_helper.reset();
+    m_index_created = false;
+    m_linear_svm.reset();
+
+    if(!m_all_global_features_cloud || m_all_global_features_cloud->empty())
+    {
+        LOG_WARN("no global features available for the flann index");
+        return;
+    }
+
+    m_flann_helper = std::make_shared<FlannHelper>(m_all_global_features_cloud->at(0).descriptor.size(), m_all_global_features_cloud->size());
+    m_flann_helper->createDataset(m_all_global_features_cloud);
 }
 
 void Voting::iSaveData(boost::archive::binary_oarchive &oa) const
@@ -1080,7 +2168,8 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
         ia >> classId;
         ia >> firstDim;
         ia >> secondDim;
-        m_id_bb_dimensions_map.insert({classId, {firstDim, secondDim}});
+        if(m_class_filter.empty() || m_class_filter.count(classId))
+            m_id_bb_dimensions_map.insert({classId, {firstDim, secondDim}});
     }
 
     int bb_vars_size;
@@ -1093,7 +2182,8 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
         ia >> classId;
         ia >> firstVar;
         ia >> secondVar;
-        m_id_bb_variance_map.insert({classId, {firstVar, secondVar}});
+        if(m_class_filter.empty() || m_class_filter.count(classId))
+            m_id_bb_variance_map.insert({classId, {firstVar, secondVar}});
     }
 
     // read global features
@@ -1112,6 +2202,8 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
             unsigned classId;
             ia >> classId;
 
+            // the features of other classes are only read from the archive
+            const bool keepClass = m_class_filter.empty() || m_class_filter.count(classId);
             std::vector<pcl::PointCloud<ISMFeature>::Ptr> cloud_vector;
 
             int cloud_size;
@@ -1142,6 +2234,8 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
                     ism_feature.descriptor = descriptor;
                     ism_feature.globalDescriptorRadius =  radius;
                     ism_feature.classId = classId;
+                    if(!keepClass)
+                        continue;
                     feature_cloud->push_back(ism_feature);
                     m_all_global_features_cloud->push_back(ism_feature);
                     descriptor_length = ism_feature.descriptor.size(); // are all the same just overwrite
@@ -1151,36 +2245,15 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
                 feature_cloud->is_dense = false;
                 cloud_vector.push_back(feature_cloud);
             }
-            m_global_features.insert({classId, cloud_vector});
+            if(keepClass)
+                m_global_features.insert({classId, cloud_vector});
         }
 
-        // create flann index
-        m_flann_helper = std::make_shared<FlannHelper>(m_all_global_features_cloud->at(0).descriptor.size(), m_all_global_features_cloud->size());
-        m_flann_helper->createDataset(m_all_global_features_cloud);
-        // NOTE: index will be build when the first object is recognized - otherwise parameters are not initialized from config, but with default values
-        //m_flann_helper->buildIndex(m_distanceType, m_num_kd_trees);
-
-        // compute average radii
-        for(auto it = m_global_features.begin(); it != m_global_features.end(); it++)
-        {
-            float avg_radius = 0;
-            int num_points = 0;
-            unsigned classID = it->first;
-
-            std::vector<pcl::PointCloud<ISMFeature>::Ptr> cloud_vector = it->second;
-            for(auto cloud : cloud_vector)
-            {
-                for(ISMFeature ism_feature : cloud->points)
-                {
-                    avg_radius += ism_feature.globalDescriptorRadius;
-                    num_points += 1;
-                }
-            }
-            m_average_radii.insert({classID, avg_radius / num_points});
-        }
+        // create flann dataset, the index is loaded or built by the implicit shape model after all data is read
+        createGlobalFeatureDataset();
 
-        // NOTE: not needed anymore
-        m_global_features.clear();
+        // the global features are kept, so that models can be added and the model can be saved again
+        computeAverageRadii();
 
         // load SVM for global features
         // NOTE: if SVM works better than nearest neighbor, all of the above with global features can be removed ... except the radius
@@ -1192,31 +2265,15 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
 
             if(boost::filesystem::exists(p_comp) && boost::filesystem::is_regular_file(p_comp))
             {
-                m_svm_files.clear();
-                // check if multiple svm files are available (i.e. 1 vs all svm)
-                if(m_svm_path.find("tar") != std::string::npos)
+                // a tar archive contains multiple svm files (i.e. 1 vs all svm), otherwise it is a standard OpenCV SVM
+                // (i.e. pairwise 1 vs 1 svm); the models are loaded once and kept for all predictions
+                std::shared_ptr<CustomSVM> svm = std::make_shared<CustomSVM>();
+                if(!svm->loadModels(p_comp.string(), m_svm_path.find("tar") != std::string::npos, m_class_filter))
                 {
-                    // show the content of the tar file
-                    std::string result = exec(("tar -tf " + p_comp.string()).c_str());
-                    // split the string and add to list
-                    std::stringstream sstr;
-                    sstr.str(result);
-                    std::string item;
-                    while (std::getline(sstr, item, '\n'))
-                    {
-                        boost::filesystem::path paths(item);
-                        boost::filesystem::path ppp = boost::filesystem::complete(paths);
-                        m_svm_files.push_back(ppp.string());
-                    }
-                    // unzip tar file
-                    int ret = std::system(("tar -xzf " + p_comp.string()).c_str());
-                    sleep(2);
-                }
-                else
-                {
-                    // only one file: standard OpenCV SVM (i.e. pairwise 1 vs 1 svm)
-                    m_svm_files.push_back(p_comp.string());
+                    LOG_ERROR("could not load SVM models from " << p_comp.string());
+                    m_svm_error = true;
                 }
+                m_svm = svm;
             }
             else
             {
@@ -1234,6 +2291,38 @@ bool Voting::iLoadData(boost::archive::binary_iarchive &ia)
 }
 
 Json::Value Voting::iDataToJson() const
+{
+    Json::Value data = boundingBoxesToJson();
+
+    // fill in global features
+    Json::Value globalFeatures(Json::arrayValue);
+    for(auto it : m_global_features)
+        globalFeatures.append(globalFeaturesToJson(it.first, it.second));
+
+    data["GlobalFeatures"] = globalFeatures;
+
+    return data;
+}
+
+void Voting::iDataToJsonStream(JsonStreamWriter &writer) const
+{
+    // the same members as iDataToJson(), only the global features of one class are converted at a time
+    writer.beginObject();
+    Json::Value boxes = boundingBoxesToJson();
+    for(const std::string &name : boxes.getMemberNames())
+    {
+        writer.key(name);
+        writer.value(boxes[name]);
+    }
+    writer.key("GlobalFeatures");
+    writer.beginArray();
+    for(auto it : m_global_features)
+        writer.value(globalFeaturesToJson(it.first, it.second));
+    writer.endArray();
+    writer.endObject();
+}
+
+Json::Value Voting::boundingBoxesToJson() const
 {
     Json::Value data(Json::objectValue);
 
@@ -1267,51 +2356,44 @@ Json::Value Voting::iDataToJson() const
 
     data["BoundingBoxDimensions"] = bbDimensions;
     data["BoundingBoxVariances"] = bbVariances;
+    return data;
+}
 
+Json::Value Voting::globalFeaturesToJson(unsigned classId, const std::vector<pcl::PointCloud<ISMFeature>::Ptr> &clouds) const
+{
+    // descriptor type is same for all features, only store it once
 
-    // fill in global features
-    Json::Value globalFeatures(Json::arrayValue);
-    for(auto it : m_global_features)
+    Json::Value cloud_list(Json::arrayValue);
+    for(auto feat_cloud : clouds) // iterate over each vector element (point cloud) of one class
     {
-        int classId = it.first;
-        // descriptor type is same for all features, only store it once
-
-        Json::Value cloud_list(Json::arrayValue);
-        for(auto feat_cloud : it.second) // iterate over each vector element (point cloud) of one class
+        Json::Value cloud(Json::arrayValue);
+        for(auto feat : feat_cloud->points) // iterate over each descriptor (point in the cloud)
         {
-            Json::Value cloud(Json::arrayValue);
-            for(auto feat : feat_cloud->points) // iterate over each descriptor (point in the cloud)
+            // save reference frame
+            Json::Value ref_frame(Json::arrayValue);
+            for(unsigned i = 0; i < 9; i++)
             {
-                // save reference frame
-                Json::Value ref_frame(Json::arrayValue);
-                for(unsigned i = 0; i < 9; i++)
-                {
-                    ref_frame.append(feat.referenceFrame.rf[i]);
-                }
-                // save descriptor
-                Json::Value descr(Json::arrayValue);
-                for(unsigned i = 0; i < feat.descriptor.size(); i++)
-                {
-                    descr.append(feat.descriptor.at(i));
-                }
-                Json::Value cloud_point(Json::objectValue);
-                cloud_point["ReferenceFrame"] = Json::Value(ref_frame);
-                cloud_point["Descriptor"] = Json::Value(descr);
-                cloud_point["GlobalDescriptorRadius"] = Json::Value(feat.globalDescriptorRadius);
-                cloud.append(cloud_point);
+                ref_frame.append(feat.referenceFrame.rf[i]);
+            }
+            // save descriptor
+            Json::Value descr(Json::arrayValue);
+            for(unsigned i = 0; i < feat.descriptor.size(); i++)
+            {
+                descr.append(feat.descriptor.at(i));
             }
-            cloud_list.append(cloud);
+            Json::Value cloud_point(Json::objectValue);
+            cloud_point["ReferenceFrame"] = Json::Value(ref_frame);
+            cloud_point["Descriptor"] = Json::Value(descr);
+            cloud_point["GlobalDescriptorRadius"] = Json::Value(feat.globalDescriptorRadius);
+            cloud.append(cloud_point);
         }
-
-        Json::Value all_class_features(Json::objectValue);
-        all_class_features["ClassId"] = classId;
-        all_class_features["FeatureList"] = cloud_list;
-        globalFeatures.append(all_class_features);
+        cloud_list.append(cloud);
     }
 
-    data["GlobalFeatures"] = globalFeatures;
-
-    return data;
+    Json::Value all_class_features(Json::objectValue);
+    all_class_features["ClassId"] = classId;
+    all_class_features["FeatureList"] = cloud_list;
+    return all_class_features;
 }
 
 
@@ -1414,33 +2496,11 @@ bool Voting::iDataFromJson(const Json::Value& data)
             m_global_features.insert({classId, cloud_vector});
         }
 
-        // create flann index
-        m_flann_helper = std::make_shared<FlannHelper>(m_all_global_features_cloud->at(0).descriptor.size(), m_all_global_features_cloud->size());
-        m_flann_helper->createDataset(m_all_global_features_cloud);
-        // NOTE: index will be build when the first object is recognized - otherwise parameters are not initialized from config, but with default values
-        //m_flann_helper->buildIndex(m_distanceType, m_num_kd_trees);
-
-        // compute average radii
-        for(auto it = m_global_features.begin(); it != m_global_features.end(); it++)
-        {
-            float avg_radius = 0;
-            int num_points = 0;
-            unsigned classID = it->first;
-
-            std::vector<pcl::PointCloud<ISMFeature>::Ptr> cloud_vector = it->second;
-            for(auto cloud : cloud_vector)
-            {
-                for(ISMFeature ism_feature : cloud->points)
-                {
-                    avg_radius += ism_feature.globalDescriptorRadius;
-                    num_points += 1;
-                }
-            }
-            m_average_radii.insert({classID, avg_radius / num_points});
-        }
+        // create flann dataset, the index is loaded or built by the implicit shape model after all data is read
+        createGlobalFeatureDataset();
 
-        // NOTE: not needed anymore
-        m_global_features.clear();
+        // the global features are kept, so that models can be added and the model can be saved again
+        computeAverageRadii();
 
         // load SVM for global features
         // NOTE: if SVM works better than nearest neighbor, all of the above with global features can be removed ... except the radius
@@ -1455,31 +2515,15 @@ bool Voting::iDataFromJson(const Json::Value& data)
 
             if(boost::filesystem::exists(p_comp) && boost::filesystem::is_regular_file(p_comp))
             {
-                m_svm_files.clear();
-                // check if multiple svm files are available (i.e. 1 vs all svm)
-                if(svm_path.find("tar") != std::string::npos)
-                {
-                    // show the content of the tar file
-                    std::string result = exec(("tar -tf " + p_comp.string()).c_str());
-                    // split the string and add to list
-                    std::stringstream sstr;
-                    sstr.str(result);
-                    std::string item;
-                    while (std::getline(sstr, item, '\n'))
-                    {
-                        boost::filesystem::path paths(item);
-                        boost::filesystem::path ppp = boost::filesystem::complete(paths);
-                        m_svm_files.push_back(ppp.string());
-                    }
-                    // unzip tar file
-                    int ret = std::system(("tar -xzf " + p_comp.string()).c_str());
-                    sleep(2);
-                }
-                else
+                // a tar archive contains multiple svm files (i.e. 1 vs all svm), otherwise it is a standard OpenCV SVM
+                // (i.e. pairwise 1 vs 1 svm); the models are loaded once and kept for all predictions
+                std::shared_ptr<CustomSVM> svm = std::make_shared<CustomSVM>();
+                if(!svm->loadModels(p_comp.string(), svm_path.find("tar") != std::string::npos))
                 {
-                    // only one file: standard OpenCV SVM (i.e. pairwise 1 vs 1 svm)
-                    m_svm_files.push_back(p_comp.string());
+                    LOG_ERROR("could not load SVM models from " << p_comp.string());
+                    m_svm_error = true;
                 }
+                m_svm = svm;
             }
             else
             {
@@ -1496,18 +2540,4 @@ bool Voting::iDataFromJson(const Json::Value& data)
     return true;
 }
 
-// NOTE: from http://stackoverflow.com/questions/478898/how-to-execute-a-command-and-get-output-of-command-within-c-using-posix
-std::string exec(const char* cmd)
-{
-    std::array<char, 128> buffer;
-    std::string result;
-    std::shared_ptr<FILE> pipe(popen(cmd, "r"), pclose);
-    if (!pipe) throw std::runtime_error("popen() failed!");
-    while (!feof(pipe.get())) {
-        if (fgets(buffer.data(), 128, pipe.get()) != NULL)
-            result += buffer.data();
-    }
-    return result;
-}
-
 }
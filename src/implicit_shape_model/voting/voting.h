@@ -13,15 +13,22 @@
 
 #include <vector>
 #include <map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <Eigen/Core>
 #include <boost/shared_ptr.hpp>
 
 #include "../features/features.h"
 #include "../classifier/custom_SVM.h"
+#include "../classifier/random_feature_svm.h"
 #include "../utils/utils.h"
+#include "../utils/detection_arena.h"
 #include "../utils/json_object.h"
 #include "../utils/ism_feature.h"
 #include "../utils/flann_helper.h"
+#include "../utils/region_of_interest.h"
 
 // to use SVM
 #include <opencv2/ml/ml.hpp>
@@ -29,7 +36,7 @@
 #define PCL_NO_PRECOMPILE
 #include <pcl/point_types.h>
 #include <pcl/recognition/cg/hough_3d.h>
-#include <pcl/filters/extract_indices.h>
+#include <pcl/common/io.h>
 
 // TODO VS X: clean up
 // - there are multiple global feature members
@@ -40,6 +47,8 @@
 
 namespace ism3d
 {
+    class CodewordDistribution;
+
     /**
      * @brief The VotingMaximum struct
      * A voting maximum represents a found object occurrence and is characterized
@@ -71,6 +80,37 @@ namespace ism3d
         std::pair<int, float> currentClassHypothesis; // pair of: this class_id and score
     };
 
+    /**
+     * @brief The VotingReport struct
+     * Counter based analysis of a detection to tune the bandwidth, the codebook pruning and the class weights: the
+     * votes, their weights and the work of the maxima search per class, and the codewords that cast the most votes.
+     * It is computed in one pass over the votes without copying them.
+     */
+    struct VotingReport
+    {
+        struct ClassReport
+        {
+            ClassReport() : numVotes(0), weightSum(0), weightHistogram(getNumWeightBins(), 0), numMaxima(0),
+                numSeeds(0), numIterations(0) {}
+
+            std::size_t numVotes;
+            double weightSum;
+            std::vector<std::size_t> weightHistogram; // number of votes per decade of the weight, see getWeightBin()
+            int numMaxima;
+            double numSeeds;        // seeds of the mean shift, 0 for other maxima searches
+            double numIterations;   // iterations of the mean shift including the coarse level
+        };
+
+        std::map<unsigned, ClassReport> classes;
+        std::vector<std::pair<int, std::size_t> > topCodewords; // codeword ids and their votes, most votes first
+
+        // bin i holds the weights in [10^(i - 5), 10^(i - 4)), the first and last bin are open
+        static int getNumWeightBins();
+        static int getWeightBin(float weight);
+
+        Json::Value toJson() const;
+    };
+
     enum SingleObjectMaxType
     {
         COMPLETE_VOTING_SPACE,
@@ -95,43 +135,160 @@ namespace ism3d
 
         /**
          * @brief The Vote struct
-         * The internal vote representation
+         * The internal vote representation. To keep votes small, the bounding box is not stored with
+         * the vote. It can be reconstructed from the activation the vote originated from with getVoteBoundingBox().
          */
         struct Vote
         {
             Eigen::Vector3f position;
             float weight;
             unsigned classId;
-            Eigen::Vector3f keypoint;       // associated keypoint position
-            Utils::BoundingBox boundingBox; // associated bounding box
-            int codewordId;                 // codeword the vote belongs to
+            unsigned activationId;          // activation (codeword distribution and feature) the vote belongs to
+            unsigned voteIndex;             // index of the vote inside the codeword distribution
+        };
+
+        /**
+         * @brief The Activation struct
+         * Stores the data that is shared by all votes cast by one feature for one activated codeword.
+         */
+        struct Activation
+        {
+            const CodewordDistribution* distribution;   // activated distribution, owned by the codebook
+            boost::math::quaternion<float> rotQuat;     // rotation of the activating feature's reference frame
+            Eigen::Vector3f keyPos;                     // position of the activating feature
+        };
+
+        // the vote mass of a class accumulated in classification only mode
+        struct ClassMass
+        {
+            double weight;
+            Eigen::Vector3d weightedPosition; // sum of the vote positions times their weights
+            std::size_t numVotes;
         };
 
+        /**
+         * @brief The VoteSlot struct
+         * The buffers that one worker of a vote loop appends its activations and votes to without locking. The slots
+         * are handed out by acquireSlots() for one vote loop, so that no two workers share a slot, regardless of the
+         * team or the detection they belong to. mergeVotes() collects the contents of all slots.
+         */
+        struct VoteSlot
+        {
+            explicit VoteSlot(DetectionArena *arena);
+            virtual ~VoteSlot();
+
+            std::map<unsigned, ArenaVector<Vote> > votes;   // votes per class id, allocated in the arena
+            ArenaVector<Activation> activations;            // the activation ids are local to the slot until mergeVotes()
+            std::vector<ClassMass> masses;                  // vote masses indexed by class id
+            bool acquired;
+        };
+
+        /**
+         * @brief acquire a slot for each worker of a vote loop, the slots are owned by the voting and are valid until
+         * it is destroyed; concurrent vote loops get different slots
+         * @param count the number of workers
+         * @return the slots
+         */
+        std::vector<VoteSlot*> acquireSlots(int count);
+
+        /**
+         * @brief return the slots of a finished vote loop, their contents are kept until mergeVotes()
+         * @param slots the slots returned by acquireSlots()
+         */
+        void releaseSlots(const std::vector<VoteSlot*> &slots);
+
+        /**
+         * @brief register an activation, i.e. a feature activating a codeword distribution, to which votes can refer
+         * @param slot the slot of the calling worker
+         * @param distribution the activated codeword distribution, must stay valid as long as the votes are used
+         * @param rotQuat the rotation of the reference frame of the activating feature
+         * @param keyPos the position of the activating feature
+         * @return the activation id to be passed to vote() (only valid within the slot until mergeVotes())
+         */
+        unsigned addActivation(VoteSlot &slot,
+                               const CodewordDistribution* distribution,
+                               const boost::math::quaternion<float>& rotQuat,
+                               const Eigen::Vector3f& keyPos = Eigen::Vector3f::Zero());
+
         /**
          * @brief cast a vote into the hough space
+         * @param slot the slot of the calling worker
          * @param position the vote position
          * @param weight the vote weight
          * @param classId the class id for the vote
-         * @param keypoint the keypoint position from which the vote originated
-         * @param boundingBox the bounding box for the object that casted the vote
-         * @param codewordId the id of the codeword the vote belongs to
+         * @param activationId the id of the activation returned by addActivation() with the same slot
+         * @param voteIndex the index of the vote inside the activated codeword distribution
          */
-        void vote(Eigen::Vector3f position,
+        void vote(VoteSlot &slot,
+                  const Eigen::Vector3f& position,
                   float weight,
                   unsigned classId,
-                  const Eigen::Vector3f& keypoint,
-                  const Utils::BoundingBox& boundingBox, int codewordId);
+                  unsigned activationId,
+                  unsigned voteIndex);
+
+        // in single object mode with ClassificationOnly, votes are accumulated with accumulateVote() instead of
+        // being cast with vote(), no activations are needed
+        bool isClassificationOnly() const
+        {
+            return m_classification_only && m_single_object_mode;
+        }
+
+        /**
+         * @brief add a vote to the vote mass and the weighted vote centroid of its class, in the slot of the
+         * calling worker; the vote itself is not stored
+         * @param slot the slot of the calling worker
+         * @param position the vote position
+         * @param weight the vote weight
+         * @param classId the class id for the vote
+         */
+        void accumulateVote(VoteSlot &slot, const Eigen::Vector3f& position, float weight, unsigned classId);
+
+        /**
+         * @brief reconstruct the rotated bounding box of a vote
+         * @param vote the vote
+         * @return the bounding box of the training object, rotated into the world coordinate system
+         */
+        Utils::BoundingBox getVoteBoundingBox(const Vote& vote) const;
+
+        /**
+         * @brief get the codeword id of the codeword a vote belongs to
+         * @param vote the vote
+         * @return the codeword id
+         */
+        int getVoteCodewordId(const Vote& vote) const;
+
+        /**
+         * @brief analyze the current votes and the counters of the last search for maxima
+         * @param maxima the maxima found on the current votes
+         * @param numTopCodewords the number of codewords with the most votes to report
+         * @return the report
+         */
+        VotingReport createReport(const std::vector<VotingMaximum>& maxima, int numTopCodewords) const;
+
+        /**
+         * @brief merge the votes collected in the slots into the per-class vote lists, must not be called during a
+         * vote loop; needs to be called after voting and before accessing the votes (is called by findMaxima). If there are
+         * more votes than MaxVotes, a sample drawn with probability proportional to the vote weights is kept.
+         * The votes of each class are then ordered along a Z-order curve over their positions, so that votes
+         * close in space are close in memory for the maxima search. With fused voting, the votes were accumulated
+         * while they were cast and only the votes of the maxima are created here, they are neither limited nor
+         * reordered.
+         */
+        void mergeVotes();
 
         /**
          * @brief find maxima in the hough voting space in order to identify object occurrences
          * @param points used to calculate global features
          * @param normals used to calculate global features
+         * @param search search used to extract the points around maxima, e.g. the search of the feature computation
+         * that already holds an index over the points, a new kd-tree is built if empty
          * @return a list of maxima representing found object occurrences
          */
-        std::vector<VotingMaximum> findMaxima(pcl::PointCloud<PointT>::ConstPtr &points, pcl::PointCloud<pcl::Normal>::ConstPtr &normals);
+        std::vector<VotingMaximum> findMaxima(pcl::PointCloud<PointT>::ConstPtr &points, pcl::PointCloud<pcl::Normal>::ConstPtr &normals,
+                                              pcl::search::Search<PointT>::Ptr search = pcl::search::Search<PointT>::Ptr());
 
         /**
-         * @brief get all votes
+         * @brief get all votes, with fused voting only the votes of the maxima
          * @return a map of votes, the key represents the class id
          */
         const std::map<unsigned, std::vector<Voting::Vote> >& getVotes() const;
@@ -143,6 +300,20 @@ namespace ism3d
          */
         const std::vector<Voting::Vote>& getVotes(unsigned classId) const;
 
+        /**
+         * @brief get the counters of the last search for maxima, i.e. the number of maxima and the counters added
+         * by the maxima detection, e.g. the seeds and iterations of the mean shift
+         * @return a map of counter names and values
+         */
+        const std::map<std::string, double>& getCounters() const;
+
+        /**
+         * @brief get the arena of the temporaries of a detection, it is reset by clear() and thus only holds the
+         * data of one detection
+         * @return the arena
+         */
+        DetectionArena& getArena() const;
+
         /**
          * @brief calculate average bounding box dimensions during training to be used as hints for bin size and bandwidth during recognition
          * @param boundingBoxes bounding boxes of trained objects
@@ -156,6 +327,20 @@ namespace ism3d
          */
         void forwardGlobalFeatures(std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures);
 
+        /**
+         * @brief addAverageBoundingBoxDimensions compute the average bounding box dimensions of classes that are added
+         *        to a trained model, known classes keep their dimensions
+         * @param boundingBoxes bounding boxes of the added objects
+         */
+        void addAverageBoundingBoxDimensions(const std::map<unsigned, std::vector<Utils::BoundingBox> > &boundingBoxes);
+
+        /**
+         * @brief addGlobalFeatures add the global features of models that are added to a trained model, the index is
+         *        rebuilt on all global features with buildGlobalFeatureIndex()
+         * @param globalFeatures map with the global features of the added models
+         */
+        void addGlobalFeatures(const std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > &globalFeatures);
+
         /**
          * @brief setGlobalFeatures set a PointCloud with global featues to be used during detection in single-object-mode
          * @param globalFeatures
@@ -181,21 +366,191 @@ namespace ism3d
             m_distanceType = dist;
         }
 
+        // backend of the FLANN index for global features, set in ImplicitShapeModel.cpp
+        void setIndexParams(const KnnIndexParams &params)
+        {
+            m_index_params = params;
+            // global features are few, a single kd-tree is sufficient
+            m_index_params.kd_trees = 1;
+        }
+
+        // approximation of minimum volume bounding boxes, set in ImplicitShapeModel.cpp
+        void setMVBBParams(float eps, float leafSize)
+        {
+            m_mvbb_eps = eps;
+            m_mvbb_leaf_size = leafSize;
+        }
+
+        // maxima without the indices of their votes, for callers that only need class, weight, position and
+        // bounding box, set in ImplicitShapeModel.cpp
+        void setLeanMaxima(bool lean)
+        {
+            m_lean_maxima = lean;
+        }
+
+        /**
+         * @brief Free the votes and activations of the last detection, the counters are kept. The votes are only
+         * needed while maxima are searched, getVotes() is empty afterwards.
+         */
+        void releaseVotes();
+
+        // region in which votes are cast, votes with centers outside are discarded, set in ImplicitShapeModel.cpp
+        void setRegionOfInterest(const RegionOfInterest &region)
+        {
+            m_region_of_interest = region;
+        }
+
+        const RegionOfInterest& getRegionOfInterest() const
+        {
+            return m_region_of_interest;
+        }
+
+        // receives the maxima of one class as soon as its search has finished
+        typedef std::function<void(unsigned classId, const std::vector<VotingMaximum>& maxima)> ClassMaximaCallback;
+
+        /**
+         * @brief Deliver the maxima of each class during findMaxima() as soon as the class is searched, set in
+         * ImplicitShapeModel.cpp. The priority classes are searched first, one after another in the given order
+         * and each with all threads, the other classes follow in parallel. Every class with votes is delivered
+         * once on the thread that calls findMaxima(), classes below the thresholds first and without maxima.
+         * The delivered maxima are not yet filtered against the maxima of other classes, normalized or verified
+         * with global features, findMaxima() still returns the final maxima of all classes.
+         * @param callback the callback, empty to deliver the maxima only as result of findMaxima()
+         * @param priorityClasses the classes searched first, in this order
+         */
+        void setClassMaximaCallback(const ClassMaximaCallback &callback, const std::vector<unsigned> &priorityClasses)
+        {
+            m_class_maxima_callback = callback;
+            m_priority_classes = priorityClasses;
+        }
+
+        // the maxima are verified with global features computed on the points around them
+        bool usesGlobalFeatures() const
+        {
+            return m_use_global_features;
+        }
+
+        // in single object mode, a confident SVM classification of the global features is the result of the
+        // detection and the local features are not computed
+        bool usesGlobalEarlyExit() const;
+
+        /**
+         * @brief classifyGlobalEarly classify the global features of a point cloud in single object mode before the
+         *        local features are computed
+         * @param globalFeatures the global features of the point cloud
+         * @param points the points of the object
+         * @param maximum output: the global hypothesis at the centroid of the points with their bounding box
+         * @return true if the SVM score exceeds GlobalParamMinSvmScore, the local pipeline can be skipped
+         */
+        bool classifyGlobalEarly(pcl::PointCloud<ISMFeature>::ConstPtr globalFeatures,
+                                 pcl::PointCloud<PointT>::ConstPtr points, VotingMaximum &maximum);
+
+        // maxima of tiles and shards keep their weights until they are merged with mergePartialMaxima(), set in
+        // TiledDetector and ShardedDetector
+        void setNormalizeWeights(bool normalize)
+        {
+            m_normalize_weights = normalize;
+        }
+
+        /**
+         * @brief mergePartialMaxima combine the maxima found in parts of a detection, i.e. the tiles of a scene or
+         *        the class shards of a model: filters them as configured (MaxFilterType), sorts them, normalizes
+         *        their weights and keeps the best k
+         * @param maxima the maxima of all parts, found with unnormalized weights
+         * @return the maxima of the scene
+         */
+        std::vector<VotingMaximum> mergePartialMaxima(const std::vector<VotingMaximum> &maxima);
+
+        /**
+         * @brief getMaxObjectRadius the largest radius of the trained classes: the average radius of their global
+         *        features or half the longest dimension of their bounding boxes
+         * @return the radius, 0 if no class is trained
+         */
+        float getMaxObjectRadius() const;
+
         void setSVMPath(std::string path)
         {
             m_svm_path = path;
         }
 
+        // restricts the following loads to the bounding boxes, global features and 1 vs all SVMs of these classes,
+        // empty for all classes, set in ImplicitShapeModel.cpp
+        void setClassFilter(const std::set<unsigned> &classIds)
+        {
+            m_class_filter = classIds;
+        }
+
+        /**
+         * @brief buildGlobalFeatureIndex build the flann index for global features if it is not available yet, must be
+         *        called after the distance type and index parameters are set and before detection
+         */
+        void buildGlobalFeatureIndex();
+
+        /**
+         * @brief saveGlobalFeatureIndex store the flann index for global features, the features themselves are saved with
+         *        the data of this object
+         * @param oa the archive
+         */
+        void saveGlobalFeatureIndex(boost::archive::binary_oarchive &oa) const;
+
+        /**
+         * @brief loadGlobalFeatureIndex restore the flann index for global features, if it matches the loaded features
+         *        and the current configuration
+         * @param ia the archive
+         * @return true if the index was restored
+         */
+        bool loadGlobalFeatureIndex(boost::archive::binary_iarchive &ia);
+
+        /**
+         * @brief createDetectionCopy create a voting with the same configuration and trained data, but with its own
+         *        votes, so that several detections can run concurrently. The trained data and the index for global
+         *        features and the SVM models are shared and must not change while the copy is used.
+         * @return the copy, owned by the caller
+         */
+        Voting* createDetectionCopy() const;
+
     protected:
         Voting();
 
-        void verifyMaxHypothesisWithGlobalFeatures(const pcl::PointCloud<PointT>::ConstPtr &points,
-                                                   const pcl::PointCloud<pcl::Normal>::ConstPtr &normals,
-                                                   const pcl::KdTreeFLANN<PointT> &input_points_kdtree, VotingMaximum &maximum);
+        // extracts the points around each maximum and computes their global features, maxima with overlapping
+        // regions share the features of one region
+        std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> computeGlobalFeatures(const pcl::PointCloud<PointT>::ConstPtr &points,
+                                                                                 const pcl::PointCloud<pcl::Normal>::ConstPtr &normals,
+                                                                                 const pcl::search::Search<PointT>::Ptr &search,
+                                                                                 const std::vector<VotingMaximum> &maxima) const;
 
         void classifyGlobalFeatures(const pcl::PointCloud<ISMFeature>::ConstPtr global_features, VotingMaximum &maximum);
 
+        // uses the global hypothesis of a maximum as its class and places it at the centroid of the points
+        void setGlobalMaximum(const pcl::PointCloud<PointT>::ConstPtr &points, VotingMaximum &maximum) const;
+
+        // classifies the global features of all maxima, a single batched query is used for KNN
+        void classifyGlobalFeatures(const std::vector<pcl::PointCloud<ISMFeature>::ConstPtr> &global_features,
+                                    std::vector<VotingMaximum> &maxima);
 
+
+        // the position a vote was cast to, reconstructed from its activation, up to rounding
+        Eigen::Vector3f getVotePosition(unsigned activationId, unsigned voteIndex) const;
+
+        // creates the slots handed out by acquireSlots(), implementations extend them with their own buffers
+        virtual std::unique_ptr<VoteSlot> iCreateSlot();
+
+        // all slots created so far, in the order of their creation
+        const std::vector<std::unique_ptr<VoteSlot> >& getSlots() const;
+
+        // implementations that accumulate the votes while they are cast set m_fused_voting, vote() then passes the
+        // votes to iFuseVote() instead of storing them; called concurrently with different slots, the activation id
+        // is local to the slot
+        virtual void iFuseVote(VoteSlot &slot, const Eigen::Vector3f& position, float weight, unsigned classId,
+                               unsigned activationId, unsigned voteIndex);
+
+        // called by mergeVotes() with fused voting after the activations are merged: the activation ids of slot
+        // t of getSlots() are made global by adding activationOffsets[t], the votes that contribute to maxima are
+        // added to votes
+        virtual void iMergeFusedVotes(const std::vector<unsigned>& activationOffsets,
+                                      std::map<unsigned, std::vector<Vote> >& votes);
+
+        // called concurrently for different classes, implementations must not modify shared state
         virtual void iFindMaxima(const std::vector<Voting::Vote>&,
                                  std::vector<Eigen::Vector3f>&,
                                  std::vector<double>&,
@@ -209,9 +564,19 @@ namespace ism3d
         Json::Value iDataToJson() const;
         bool iDataFromJson(const Json::Value& data);
 
+        // the global features are written class by class
+        void iDataToJsonStream(JsonStreamWriter &writer) const;
+
+        void iMemoryUsage(MemoryUsage &usage) const;
+
+        // validates the string parameters and resolves them into the settings below
+        void iPostInitConfig();
+
         float m_radius;              // holds the bin size or the bandwith
 
         std::string m_radiusType; // take value from config or used learned average bounding box dimensions
+        enum RadiusType { RadiusConfig, RadiusFirstDim, RadiusSecondDim };
+        RadiusType m_radius_mode; // m_radiusType resolved by iPostInitConfig()
         float m_radiusFactor; // factor for radius, in case radius type is NOT Config
 
         // maps class ids to average pairs of two longest bounding box dimensions <first radius, second radius>
@@ -222,12 +587,17 @@ namespace ism3d
         bool m_use_global_features;
         Features* m_globalFeatureDescriptor;
 
-        CustomSVM m_svm; // for global feature classification
+        std::set<unsigned> m_class_filter;
+        std::shared_ptr<const CustomSVM> m_svm; // for global feature classification, loaded once and shared with detection copies
         bool m_svm_error;
-        std::vector<std::string> m_svm_files;
+        std::shared_ptr<const RandomFeatureSVM> m_linear_svm; // trained from the global features when the index is built
+        int m_linear_svm_features;
+        float m_linear_svm_gamma;
+        float m_linear_svm_c;
+        int m_linear_svm_epochs;
 
         // maps class ids to a vector of global features, number of models per class = number of global features per class
-        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > m_global_features; // used only during training
+        std::map<unsigned, std::vector<pcl::PointCloud<ISMFeature>::Ptr> > m_global_features; // stored with the model, only used to build the index
 
         // all global features as a cloud
         pcl::PointCloud<ISMFeature>::Ptr m_global_features_single_object; // used during detection in single-object-mode
@@ -238,17 +608,41 @@ namespace ism3d
 
         std::string m_global_feature_method;
         int m_k_global_features;
+        float m_global_feature_region_overlap; // minimum intersection over union of regions that share global features
         bool m_single_object_mode;
         int m_global_feature_influence_type;
         float m_global_param_min_svm_score;
+        bool m_global_early_exit;
         float m_global_param_rate_limit;
         float m_global_param_weight_factor;
 
         // used to create FLANN index in FLANN helper
         std::string m_distanceType;
+        KnnIndexParams m_index_params;
+
+        float m_mvbb_eps;
+        float m_mvbb_leaf_size;
+        bool m_lean_maxima;
+        bool m_fused_voting;
+
+        RegionOfInterest m_region_of_interest;
+
+        ClassMaximaCallback m_class_maxima_callback;
+        std::vector<unsigned> m_priority_classes;
+
+        bool m_normalize_weights;
 
     private:
 
+        // keeps at most m_max_votes votes by weighted reservoir sampling
+        void limitVotes();
+
+        // sorts the votes of each class by the Morton code of their position quantized in their bounding box
+        void sortVotesSpatially();
+
+        // one maximum per class from the accumulated vote masses, at the weighted vote centroid
+        std::vector<VotingMaximum> computeClassificationMaxima(const pcl::PointCloud<PointT>::ConstPtr &points);
+
         std::vector<VotingMaximum> computeSingleMaxPerClass(const pcl::PointCloud<PointNormalT>::ConstPtr &points,
                                                             const SingleObjectMaxType max_typ) const;
 
@@ -262,7 +656,26 @@ namespace ism3d
         float reweightMaximum(const VotingMaximum &max, const Eigen::Vector3f &query, const float search_dist) const;
         float getSearchDistForClass(const unsigned class_id) const;
 
-        void insertGlobalResult(std::map<unsigned, unsigned> &max_global_voting, unsigned found_class);
+        void insertGlobalResult(std::map<unsigned, unsigned> &max_global_voting, unsigned found_class) const;
+        void setGlobalKnnResult(const std::map<unsigned, unsigned> &max_global_voting, int all_entries, VotingMaximum &maximum) const;
+        // combines the SVM responses of the global features of a maximum into its hypotheses
+        void setGlobalSvmResult(const std::vector<CustomSVM::SVMResponse> &responses, VotingMaximum &maximum) const;
+
+        // trains the linear SVM of the "LinearSVM" strategy from all global features
+        void trainLinearSvm();
+
+        // creates the flann dataset from all global features, the index is built separately
+        void createGlobalFeatureDataset();
+
+        // the distance of the global feature index, the local distance type unless it is for binary descriptors
+        std::string getGlobalDistanceType() const;
+
+        void insertBoundingBoxDimensions(unsigned classId, const std::vector<Utils::BoundingBox> &boxes);
+        void computeAverageRadii();
+
+        // the parts of the json data: the bounding box members and the global features of a class
+        Json::Value boundingBoxesToJson() const;
+        Json::Value globalFeaturesToJson(unsigned classId, const std::vector<pcl::PointCloud<ISMFeature>::Ptr> &clouds) const;
 
         static bool sortMaxima(const VotingMaximum&, const VotingMaximum&);
 
@@ -270,13 +683,39 @@ namespace ism3d
 
         std::map<unsigned, std::vector<Vote> > m_votes;
 
+        // counters of the last search for maxima, iFindMaxima adds them concurrently for different classes
+        void addCounter(const std::string &name, double value) const;
+        mutable std::map<std::string, double> m_counters;
+
+        std::vector<Activation> m_activations;
+
+        // search of findMaxima if the detection does not pass one, reused by the next detection
+        pcl::search::Search<PointT>::Ptr m_maxima_search;
+
+        // the temporaries of the current detection, declared before the containers that use it
+        mutable DetectionArena m_arena;
+
+        // votes are first collected per slot to avoid locking in vote(), the slots are reused by the following
+        // vote loops and detections; the mutex guards the list and the acquired flags
+        std::vector<std::unique_ptr<VoteSlot> > m_slots;
+        std::mutex m_slots_mutex;
+        bool m_classification_only;
+
         float m_minThreshold;   // retrieve all maxima above the weight threshold
         int m_minVotesThreshold; // retrieve all maxima above the vote threshold
         int m_bestK;            // additionally retrieve only the k best maxima
+        int m_max_votes;        // votes kept per scene by weighted sampling, 0 keeps all votes
         bool m_averageRotation;
         std::string m_max_filter_type;
         std::string m_single_object_max_type;
 
+        // m_max_filter_type and m_single_object_max_type resolved by iPostInitConfig()
+        enum MaxFilter { MaxFilterNone, MaxFilterSimple, MaxFilterMerge };
+        MaxFilter m_max_filter;
+        bool m_single_object_max;              // false for "None"
+        bool m_single_object_max_from_votes;   // computed from the votes instead of merged from the maxima
+        SingleObjectMaxType m_single_object_max_region;
+
         std::shared_ptr<FlannHelper> m_flann_helper;
         bool m_index_created;
 
@@ -9,24 +9,33 @@
  */
 
 #include "voting_hough_3d.h"
+#include "../utils/exception.h"
+#include "../utils/parallel_tasks.h"
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#ifdef USE_CUDA
+#include "../utils/cuda_hough.h"
+#endif
 
 namespace ism3d
 {
     VotingHough3D::VotingHough3D()
-        : m_houghSpace(0)
     {
         addParameter(m_useInterpolation, "UseInterpolation", true);
         addParameter(m_minCoord, "MinCoord", Eigen::Vector3d(-5, -5, -5));
         addParameter(m_maxCoord, "MaxCoord", Eigen::Vector3d(5, 5, 5));
         addParameter(m_binSize, "BinSize", Eigen::Vector3d(0.2, 0.2, 0.2));
         addParameter(m_relThreshold, "RelThreshold", 0.8f);
+        addParameter(m_backend, "Backend", std::string("CPU"));
+        addParameter(m_fused, "FusedVoting", false);
 
         iPostInitConfig();
     }
 
     VotingHough3D::~VotingHough3D()
     {
-        delete m_houghSpace;
     }
 
     void VotingHough3D::iFindMaxima(const std::vector<Voting::Vote>& votes,
@@ -36,45 +45,66 @@ namespace ism3d
                                     std::vector<std::vector<float> >& reweightedVotes,
                                     unsigned classId, float& radius)
     {
-        if(m_radiusType == "Config")
-        {
-            // leave bin size as it is from config
-        }
-        else if(m_radiusType == "FirstDim")
-        {
-            float temp = m_id_bb_dimensions_map.at(classId).first * m_radiusFactor;
-            temp *= 2; // bins are conceptually a "diameter" instead of radius
-            m_binSize = Eigen::Vector3d(temp, temp, temp);
-        }
-        else if(m_radiusType == "SecondDim")
-        {
-            float temp = m_id_bb_dimensions_map.at(classId).second * m_radiusFactor;
-            temp *= 2; // bins are conceptually a "diameter" instead of radius
-            m_binSize = Eigen::Vector3d(temp, temp, temp);
-        }
+        // classes are processed concurrently, so the bin size is kept local
+        const Eigen::Vector3d binSize = getClassBinSize(classId);
 
         // forward bin size to voting class
-        radius = m_binSize[0];
+        radius = binSize[0];
 
-        // cast votes into own voting space
-        iPostInitConfig();
-        m_houghSpace->reset();
-
-        for (int i = 0; i < (int)votes.size(); i++)
+        if (m_fused_voting)
         {
-            const Voting::Vote& vote = votes[i];
-            if (m_useInterpolation) {
-                m_houghSpace->voteInt(Eigen::Vector3d(vote.position[0], vote.position[1], vote.position[2]),
-                        vote.weight, i);
-            }
-            else {
-                m_houghSpace->vote(Eigen::Vector3d(vote.position[0], vote.position[1], vote.position[2]),
-                        vote.weight, i);
+            // the maxima were found when the fused votes were merged, the votes are those of the maxima
+            std::map<unsigned, FusedMaxima>::const_iterator it = m_fused_maxima.find(classId);
+            if (it != m_fused_maxima.end())
+            {
+                maxima = it->second.values;
+                voteIndices = it->second.voteIndices;
             }
         }
+        else if (!m_use_cuda || !findMaximaOnDevice(votes, binSize, maxima, voteIndices))
+        {
+            // cast votes into the voting space of this thread, only the bin layout changes between classes
+            int threadId = omp_get_thread_num();
+            SparseHoughSpace3D localHoughSpace; // only used if the thread count changed since configuration
+            SparseHoughSpace3D& houghSpace = threadId < (int)m_houghSpaces.size() ? m_houghSpaces[threadId] : localHoughSpace;
+            houghSpace.reset(m_minCoord, binSize, m_maxCoord);
+            houghSpace.reserve((int)votes.size());
 
-        // find maxima
-        m_houghSpace->findMaxima(-m_relThreshold, maxima, voteIndices);
+            // a single class uses all threads, concurrent classes vote serially
+            const int numThreads = omp_in_parallel() ? 1 : omp_get_max_threads();
+            if (numThreads > 1 && votes.size() >= 10000)
+            {
+                const int numVotes = (int)votes.size();
+                std::vector<float> x(numVotes), y(numVotes), z(numVotes), weights(numVotes);
+                #pragma omp parallel for num_threads(numThreads) schedule(static)
+                for (int i = 0; i < numVotes; i++)
+                {
+                    x[i] = votes[i].position[0];
+                    y[i] = votes[i].position[1];
+                    z[i] = votes[i].position[2];
+                    weights[i] = votes[i].weight;
+                }
+                houghSpace.voteParallel(x.data(), y.data(), z.data(), weights.data(), numVotes, m_useInterpolation, numThreads);
+            }
+            else
+            {
+                for (int i = 0; i < (int)votes.size(); i++)
+                {
+                    const Voting::Vote& vote = votes[i];
+                    if (m_useInterpolation) {
+                        houghSpace.voteInt(Eigen::Vector3d(vote.position[0], vote.position[1], vote.position[2]),
+                                vote.weight, i);
+                    }
+                    else {
+                        houghSpace.vote(Eigen::Vector3d(vote.position[0], vote.position[1], vote.position[2]),
+                                vote.weight, i);
+                    }
+                }
+            }
+
+            // find maxima
+            houghSpace.findMaxima(-m_relThreshold, maxima, voteIndices);
+        }
 
         // iterate through all found maxima and create a weighted cluster center
         reweightedVotes.resize(voteIndices.size());
@@ -103,8 +133,174 @@ namespace ism3d
 
     void VotingHough3D::clear()
     {
-        m_houghSpace->reset();
+        for (SparseHoughSpace3D& houghSpace : m_houghSpaces)
+            houghSpace.reset();
         Voting::clear();
+
+        // the voting spaces of the classes keep their layout and capacity for the next scene
+        for (const std::unique_ptr<VoteSlot>& slot : getSlots())
+        {
+            for (std::pair<const unsigned, FusedClass>& fused : static_cast<FusedSlot&>(*slot).classes)
+            {
+                fused.second.houghSpace.reset();
+                fused.second.votes.clear();
+            }
+        }
+        m_fused_maxima.clear();
+    }
+
+    std::unique_ptr<Voting::VoteSlot> VotingHough3D::iCreateSlot()
+    {
+        return std::unique_ptr<VoteSlot>(new FusedSlot(&getArena()));
+    }
+
+    void VotingHough3D::iFuseVote(VoteSlot& slot, const Eigen::Vector3f& position, float weight, unsigned classId,
+                                  unsigned activationId, unsigned voteIndex)
+    {
+        // all slots are created by iCreateSlot()
+        fuseVote(static_cast<FusedSlot&>(slot).classes, position, weight, classId, activationId, voteIndex);
+    }
+
+    void VotingHough3D::fuseVote(std::map<unsigned, FusedClass>& classes, const Eigen::Vector3f& position,
+                                 float weight, unsigned classId, unsigned activationId, unsigned voteIndex) const
+    {
+        std::map<unsigned, FusedClass>::iterator it = classes.find(classId);
+        if (it == classes.end())
+        {
+            it = classes.insert(std::make_pair(classId, FusedClass())).first;
+            it->second.houghSpace.reset(m_minCoord, getClassBinSize(classId), m_maxCoord);
+        }
+
+        FusedClass& fused = it->second;
+        const Eigen::Vector3d pos(position[0], position[1], position[2]);
+        const int64_t bin = m_useInterpolation ? fused.houghSpace.voteInt(pos, weight, -1) :
+                                                 fused.houghSpace.vote(pos, weight, -1);
+
+        // votes outside of the voting space can not contribute to a maximum
+        if (bin < 0)
+            return;
+
+        FusedVote vote = {bin, weight, activationId, voteIndex};
+        fused.votes.push_back(vote);
+    }
+
+    void VotingHough3D::iMergeFusedVotes(const std::vector<unsigned>& activationOffsets,
+                                         std::map<unsigned, std::vector<Vote> >& votes)
+    {
+        // the votes of each class from all slots
+        const std::vector<std::unique_ptr<VoteSlot> >& slots = getSlots();
+        std::map<unsigned, std::vector<std::pair<int, FusedClass*> > > classParts;
+        for (int t = 0; t < (int)slots.size(); t++)
+        {
+            for (std::pair<const unsigned, FusedClass>& fused : static_cast<FusedSlot&>(*slots[t]).classes)
+            {
+                if (!fused.second.votes.empty())
+                    classParts[fused.first].push_back(std::make_pair(t, &fused.second));
+            }
+        }
+
+        // nothing was voted since the last merge, e.g. when the maxima are searched again with other settings
+        if (classParts.empty())
+            return;
+
+        votes.clear();
+        m_fused_maxima.clear();
+        std::vector<unsigned> classIds;
+        std::vector<const std::vector<std::pair<int, FusedClass*> >*> fusedClasses;
+        std::vector<std::vector<Vote>*> classVotes;
+        std::vector<FusedMaxima*> classMaxima;
+        for (const auto& parts : classParts)
+        {
+            classIds.push_back(parts.first);
+            fusedClasses.push_back(&parts.second);
+            classVotes.push_back(&votes[parts.first]);
+            classMaxima.push_back(&m_fused_maxima[parts.first]);
+        }
+
+        ParallelTasks::parallelFor(0, (int)classIds.size(), 1, [&](int i)
+        {
+            mergeFusedClass(classIds[i], *fusedClasses[i], activationOffsets, *classVotes[i], *classMaxima[i]);
+        });
+
+        // classes without maxima have no votes
+        for (unsigned classId : classIds)
+        {
+            if (votes[classId].empty())
+            {
+                votes.erase(classId);
+                m_fused_maxima.erase(classId);
+            }
+        }
+
+        for (const std::unique_ptr<VoteSlot>& slot : slots)
+        {
+            for (std::pair<const unsigned, FusedClass>& fused : static_cast<FusedSlot&>(*slot).classes)
+            {
+                fused.second.houghSpace.reset();
+                fused.second.votes.clear();
+            }
+        }
+    }
+
+    void VotingHough3D::mergeFusedClass(unsigned classId, const std::vector<std::pair<int, FusedClass*> >& parts,
+                                        const std::vector<unsigned>& activationOffsets, std::vector<Vote>& votes,
+                                        FusedMaxima& maxima) const
+    {
+        // the bins of all slots are summed in the voting space of the first one
+        SparseHoughSpace3D& houghSpace = parts[0].second->houghSpace;
+        for (int p = 1; p < (int)parts.size(); p++)
+            houghSpace.addBins(parts[p].second->houghSpace);
+
+        std::vector<Eigen::Vector3i> bins;
+        houghSpace.findMaxima(-m_relThreshold, maxima.values, bins);
+        maxima.voteIndices.assign(bins.size(), std::vector<int>());
+
+        // a vote adds to the bin of its position and, with interpolation, to neighbors of it
+        const int reach = m_useInterpolation ? 1 : 0;
+        std::unordered_map<int64_t, std::vector<int> > candidates;
+        for (int i = 0; i < (int)bins.size(); i++)
+        {
+            for (int dz = -reach; dz <= reach; dz++)
+                for (int dy = -reach; dy <= reach; dy++)
+                    for (int dx = -reach; dx <= reach; dx++)
+                    {
+                        int64_t key = houghSpace.getBinKey(bins[i] + Eigen::Vector3i(dx, dy, dz));
+                        if (key >= 0)
+                            candidates[key].push_back(i);
+                    }
+        }
+
+        for (const std::pair<int, FusedClass*>& part : parts)
+        {
+            const unsigned offset = part.first < (int)activationOffsets.size() ? activationOffsets[part.first] : 0;
+            for (const FusedVote& fused : part.second->votes)
+            {
+                std::unordered_map<int64_t, std::vector<int> >::const_iterator it = candidates.find(fused.bin);
+                if (it == candidates.end())
+                    continue;
+
+                Vote vote;
+                vote.activationId = fused.activationId + offset;
+                vote.voteIndex = fused.voteIndex;
+                vote.weight = fused.weight;
+                vote.classId = classId;
+                vote.position = getVotePosition(vote.activationId, vote.voteIndex);
+
+                const Eigen::Vector3d position(vote.position[0], vote.position[1], vote.position[2]);
+                int index = -1;
+                for (int maximum : it->second)
+                {
+                    if (!houghSpace.votesInto(position, bins[maximum], m_useInterpolation))
+                        continue;
+                    if (index < 0)
+                    {
+                        index = (int)votes.size();
+                        votes.push_back(vote);
+                    }
+                    maxima.voteIndices[maximum].push_back(index);
+                }
+            }
+        }
     }
 
     std::string VotingHough3D::getTypeStatic()
@@ -119,7 +315,88 @@ namespace ism3d
 
     void VotingHough3D::iPostInitConfig()
     {
-        delete m_houghSpace;
-        m_houghSpace = new pcl::recognition::HoughSpace3D(m_minCoord, m_binSize, m_maxCoord);
+        Voting::iPostInitConfig();
+
+        m_houghSpaces.resize(omp_get_max_threads());
+        for (SparseHoughSpace3D& houghSpace : m_houghSpaces)
+            houghSpace.reset(m_minCoord, m_binSize, m_maxCoord);
+
+        // the bin layout may have changed
+        m_fused_voting = m_fused;
+        for (const std::unique_ptr<VoteSlot>& slot : getSlots())
+            static_cast<FusedSlot&>(*slot).classes.clear();
+        m_fused_maxima.clear();
+
+        if (m_backend != "CPU" && m_backend != "CUDA")
+            throw RuntimeException("invalid Hough voting backend: " + m_backend);
+        m_use_cuda = false;
+        if (m_backend == "CUDA")
+        {
+#ifdef USE_CUDA
+            m_use_cuda = CudaHough::isAvailable();
+            if (!m_use_cuda)
+                LOG_WARN("No CUDA device available, using the CPU for Hough voting!");
+#else
+            LOG_WARN("Built without CUDA support, using the CPU for Hough voting!");
+#endif
+            if (m_use_cuda && m_fused_voting)
+                LOG_WARN("Fused voting accumulates the votes while they are cast, the CUDA backend is not used!");
+        }
+    }
+
+    bool VotingHough3D::findMaximaOnDevice(const std::vector<Voting::Vote>& votes, const Eigen::Vector3d& binSize,
+                                           std::vector<double>& maxima, std::vector<std::vector<int> >& voteIndices) const
+    {
+#ifdef USE_CUDA
+        // same bin layout as SparseHoughSpace3D::reset()
+        int binCount[3];
+        for (int i = 0; i < 3; i++)
+            binCount[i] = std::max((int)std::ceil((m_maxCoord[i] - m_minCoord[i]) / binSize[i]), 0);
+
+        std::vector<double> positions(3 * votes.size());
+        std::vector<double> weights(votes.size());
+        for (int i = 0; i < (int)votes.size(); i++)
+        {
+            positions[3 * i] = votes[i].position[0];
+            positions[3 * i + 1] = votes[i].position[1];
+            positions[3 * i + 2] = votes[i].position[2];
+            weights[i] = votes[i].weight;
+        }
+
+        try
+        {
+            CudaHough::findMaxima(positions.data(), weights.data(), (int)votes.size(), m_minCoord.data(),
+                                  binSize.data(), binCount, m_useInterpolation, -m_relThreshold, maxima, voteIndices);
+        }
+        catch (const RuntimeException &e)
+        {
+            LOG_WARN("CUDA Hough voting failed (" << e.what() << "), using the CPU!");
+            maxima.clear();
+            voteIndices.clear();
+            return false;
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    Eigen::Vector3d VotingHough3D::getClassBinSize(unsigned classId) const
+    {
+        if(m_radius_mode == RadiusFirstDim)
+        {
+            float temp = m_id_bb_dimensions_map.at(classId).first * m_radiusFactor;
+            temp *= 2; // bins are conceptually a "diameter" instead of radius
+            return Eigen::Vector3d(temp, temp, temp);
+        }
+        else if(m_radius_mode == RadiusSecondDim)
+        {
+            float temp = m_id_bb_dimensions_map.at(classId).second * m_radiusFactor;
+            temp *= 2; // bins are conceptually a "diameter" instead of radius
+            return Eigen::Vector3d(temp, temp, temp);
+        }
+
+        // leave bin size as it is from config
+        return m_binSize;
     }
 }
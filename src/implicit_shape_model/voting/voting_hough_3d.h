@@ -12,13 +12,19 @@
 #define ISM3D_VOTINGHOUGH3D_H
 
 #include "voting.h"
+#include "sparse_hough_space_3d.h"
 
 namespace ism3d
 {
     /**
      * @brief The VotingHough3D class
      * Detects maxima in the voting space by using a binned voting accumulator and finding
-     * bins with the highest accumulator value.
+     * bins with the highest accumulator value. The accumulator is sparse, only bins that received
+     * votes are stored, and it is reused for all classes and scenes. Classes are voted concurrently, the votes of a
+     * single class with many votes are accumulated by all threads.
+     * With FusedVoting, the votes are accumulated into per-slot voting spaces while they are cast. Only a compact
+     * reference is kept per vote, the votes that contribute to the maxima are reconstructed from their activations
+     * once the maxima are known. The bins and maxima are fixed by the first search for maxima after voting.
      */
     class VotingHough3D
             : public Voting
@@ -40,14 +46,71 @@ namespace ism3d
         void iPostInitConfig();
         void clear();
 
+        std::unique_ptr<VoteSlot> iCreateSlot();
+        void iFuseVote(VoteSlot& slot, const Eigen::Vector3f& position, float weight, unsigned classId,
+                       unsigned activationId, unsigned voteIndex);
+        void iMergeFusedVotes(const std::vector<unsigned>& activationOffsets,
+                              std::map<unsigned, std::vector<Vote> >& votes);
+
     private:
-        pcl::recognition::HoughSpace3D* m_houghSpace;
+        // a vote accumulated with FusedVoting, its position follows from the activation
+        struct FusedVote
+        {
+            int64_t bin;            // linear index of the bin of the vote position
+            float weight;
+            unsigned activationId;  // local to the slot until the votes are merged
+            unsigned voteIndex;
+        };
+
+        // the votes of one class accumulated in one slot
+        struct FusedClass
+        {
+            SparseHoughSpace3D houghSpace;
+            std::vector<FusedVote> votes;
+        };
+
+        // a slot with the voting spaces of the classes it voted for, they keep their layout and capacity for the
+        // next vote loops
+        struct FusedSlot : public VoteSlot
+        {
+            explicit FusedSlot(DetectionArena *arena) : VoteSlot(arena) {}
+            std::map<unsigned, FusedClass> classes;
+        };
+
+        // the maxima of a class found when the fused votes were merged, the indices refer to the merged votes
+        struct FusedMaxima
+        {
+            std::vector<double> values;
+            std::vector<std::vector<int> > voteIndices;
+        };
+
+        Eigen::Vector3d getClassBinSize(unsigned classId) const;
+
+        void fuseVote(std::map<unsigned, FusedClass>& classes, const Eigen::Vector3f& position, float weight,
+                      unsigned classId, unsigned activationId, unsigned voteIndex) const;
+
+        // sums the voting spaces of all slots for a class, finds the maxima and creates the votes of the maxima
+        void mergeFusedClass(unsigned classId, const std::vector<std::pair<int, FusedClass*> >& parts,
+                             const std::vector<unsigned>& activationOffsets, std::vector<Vote>& votes,
+                             FusedMaxima& maxima) const;
+
+        // votes and finds the maxima on the GPU, returns false if the CPU has to be used
+        bool findMaximaOnDevice(const std::vector<Voting::Vote>& votes, const Eigen::Vector3d& binSize,
+                                std::vector<double>& maxima, std::vector<std::vector<int> >& voteIndices) const;
+
+        // one voting space per thread, since classes are processed concurrently
+        std::vector<SparseHoughSpace3D> m_houghSpaces;
 
         bool m_useInterpolation;
         Eigen::Vector3d m_minCoord;
         Eigen::Vector3d m_maxCoord;
-        Eigen::Vector3d m_binSize;
+        Eigen::Vector3d m_binSize; // if radius type is Config
         float m_relThreshold;
+        std::string m_backend;  // CPU or CUDA
+        bool m_use_cuda;        // m_backend resolved by iPostInitConfig(), false without device
+        bool m_fused;
+
+        std::map<unsigned, FusedMaxima> m_fused_maxima;
     };
 }
 
@@ -9,8 +9,18 @@
  */
 
 #include "voting_mean_shift.h"
+#include "../utils/cancellation.h"
+#include "../utils/parallel_tasks.h"
 #include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+#include <unordered_set>
 #include <pcl/filters/filter.h>
+#ifdef USE_CUDA
+#include "../utils/cuda_mean_shift.h"
+#endif
 
 namespace ism3d
 {
@@ -21,16 +31,71 @@ VotingMeanShift::VotingMeanShift()
     addParameter(m_maxIter, "MaxIter", 1000);
     addParameter(m_kernel, "Kernel", std::string("Gaussian"));
     addParameter(m_maxima_suppression_type, "MaximaSuppression", std::string("Average"));
+    addParameter(m_multi_resolution, "MultiResolution", false);
+    addParameter(m_coarse_cell_factor, "CoarseCellFactor", 0.25f);
+    addParameter(m_basin_cell_factor, "BasinCellFactor", 0.0f);
+    addParameter(m_backend, "Backend", std::string("CPU"));
+
+    m_record_trajectories = false;
+
+    iPostInitConfig();
+}
+
+void VotingMeanShift::iPostInitConfig()
+{
+    Voting::iPostInitConfig();
+
+    if (m_kernel == "Gaussian")
+        m_kernel_type = KernelGaussian;
+    else if (m_kernel == "Uniform")
+        m_kernel_type = KernelUniform;
+    else
+        throw RuntimeException("invalid mean shift kernel: " + m_kernel);
+    buildKernelTables();
+
+    if (m_maxima_suppression_type == "Suppress")
+        m_maxima_suppression = SuppressionSuppress;
+    else if (m_maxima_suppression_type == "Average")
+        m_maxima_suppression = SuppressionAverage;
+    else if (m_maxima_suppression_type == "AverageShift")
+        m_maxima_suppression = SuppressionAverageShift;
+    else
+        throw RuntimeException("invalid maxima suppression type: " + m_maxima_suppression_type);
+
+    if (m_backend != "CPU" && m_backend != "CUDA")
+        throw RuntimeException("invalid mean shift backend: " + m_backend);
+    m_use_cuda = false;
+    if (m_backend == "CUDA")
+    {
+#ifdef USE_CUDA
+        m_use_cuda = CudaMeanShift::isAvailable();
+        if (!m_use_cuda)
+            LOG_WARN("No CUDA device available, using the CPU for mean shift!");
+#else
+        LOG_WARN("Built without CUDA support, using the CPU for mean shift!");
+#endif
+    }
 }
 
 VotingMeanShift::~VotingMeanShift()
 {
 }
 
-float VotingMeanShift::iGetSeedsRange() const
+float VotingMeanShift::iGetSeedsRange(float bandwidth) const
 {
-    // a cube with this length fits perfectly inside the circle with radius m_bandwidth
-    return (m_bandwidth * 2.0f) / sqrtf(2);
+    // a cube with this length fits perfectly inside the circle with radius bandwidth
+    return (bandwidth * 2.0f) / sqrtf(2);
+}
+
+float VotingMeanShift::getClassBandwidth(unsigned classId) const
+{
+    if(m_radius_mode == RadiusFirstDim)
+        return m_id_bb_dimensions_map.at(classId).first * m_radiusFactor;
+    else if(m_radius_mode == RadiusSecondDim)
+        return m_id_bb_dimensions_map.at(classId).second * m_radiusFactor;
+
+    // leave bandwidth as it is from config
+    return m_bandwidth;
 }
 
 void VotingMeanShift::iFindMaxima(const std::vector<Voting::Vote>& votes, // all votes in the voting space for this class ID
@@ -45,61 +110,81 @@ void VotingMeanShift::iFindMaxima(const std::vector<Voting::Vote>& votes, // all
     // https://github.com/daviddoria/vtkMeanShiftClustering/blob/master/vtkMeanShiftClustering.cxx and
     // https://code.google.com/p/accord/source/browse/trunk/Sources/Accord.MachineLearning/Clustering/MeanShift.cs
 
-    if(m_radiusType == "Config")
-    {
-        // leave bandwidth as it is from config
-    }
-    else if(m_radiusType == "FirstDim")
-    {
-        m_bandwidth = m_id_bb_dimensions_map.at(classId).first * m_radiusFactor;
-    }
-    else if(m_radiusType == "SecondDim")
-    {
-        m_bandwidth = m_id_bb_dimensions_map.at(classId).second * m_radiusFactor;
-    }
+    // classes are processed concurrently, so all per-class state is kept local
+    const float bandwidth = getClassBandwidth(classId);
 
     // forward bandwith to voting class
-    radius = m_bandwidth;
+    radius = bandwidth;
 
-    // build dataset
-    pcl::PointCloud<PointT>::Ptr dataset(new pcl::PointCloud<PointT>());
-    dataset->resize(votes.size());
-    for (int i = 0; i < (int)votes.size(); i++)
-    {
-        const Voting::Vote& vote = votes[i];
-        PointT votePoint;
-        votePoint.x = vote.position[0];
-        votePoint.y = vote.position[1];
-        votePoint.z = vote.position[2];
-        dataset->at(i) = votePoint;
-    }
-    dataset->height = 1;
-    dataset->width = dataset->size();
-    dataset->is_dense = false;
+    // the bandwidth is constant, so a uniform grid with a cell size of at least the bandwidth gives exact
+    // radius searches; using the seed bin size as cell size lets seeding and shifting share the grid
+    float seedsRange = iGetSeedsRange(bandwidth);
+    VoteGrid grid;
+    grid.build(votes, std::max(seedsRange, bandwidth));
 
     // create seed points using binning strategy
-    std::vector<Voting::Vote> seeds = createSeeds(votes, iGetSeedsRange());
-
-    // use a kd-tree for exact nearest neighbor search
-    pcl::search::KdTree<PointT>::Ptr search(new pcl::search::KdTree<PointT>());
-    search->setInputCloud(dataset);
+    std::vector<Voting::Vote> seeds;
+    long long numIterations = 0;
+    if (m_multi_resolution && m_coarse_cell_factor > 0)
+    {
+        // locate the modes cheaply on the votes aggregated per coarse cell, they are refined on all votes below
+        const float coarseCellSize = bandwidth * m_coarse_cell_factor;
+        std::vector<Voting::Vote> coarseVotes = aggregateVotes(votes, coarseCellSize);
+        VoteGrid coarseGrid;
+        coarseGrid.build(coarseVotes, std::max(seedsRange, bandwidth));
+        std::vector<Voting::Vote> coarseSeeds = seedsRange > 0 ? createSeeds(coarseGrid) : coarseVotes;
+
+        std::vector<Eigen::Vector3f> coarseCenters;
+        numIterations += iDoMeanShift(coarseSeeds, coarseCenters, 0, coarseGrid, bandwidth);
+        addCounter("mean_shift_coarse_seeds", coarseSeeds.size());
+
+        // seeds that converged to the same coarse mode are refined once
+        std::vector<Eigen::Vector3f> candidates;
+        suppressNeighborMaxima(coarseCenters, candidates, coarseCellSize);
+        seeds.resize(candidates.size());
+        for (int i = 0; i < (int)candidates.size(); i++)
+        {
+            seeds[i].position = candidates[i];
+            seeds[i].weight = 0;
+        }
+        LOG_INFO("class " << classId << ": " << votes.size() << " votes aggregated to " << coarseVotes.size() <<
+                 ", refining " << seeds.size() << " of " << coarseSeeds.size() << " seeds");
+    }
+    else
+    {
+        seeds = seedsRange > 0 ? createSeeds(grid) : votes;
+    }
 
     // perform mean shift
     std::vector<Eigen::Vector3f> clusterCenters;
-    iDoMeanShift(seeds, votes, clusterCenters, m_trajectories[classId], search);
+    std::vector<std::vector<Eigen::Vector3f> > trajectories;
+    numIterations += iDoMeanShift(seeds, clusterCenters, m_record_trajectories ? &trajectories : 0, grid, bandwidth);
+    addCounter("mean_shift_seeds", seeds.size());
+    addCounter("mean_shift_seeds_class_" + std::to_string(classId), seeds.size());
+    addCounter("mean_shift_iterations_class_" + std::to_string(classId), numIterations);
+
+    if (m_record_trajectories)
+    {
+        #pragma omp critical
+        {
+            std::vector<std::vector<Eigen::Vector3f> >& classTrajectories = m_trajectories[classId];
+            classTrajectories.insert(classTrajectories.end(), std::make_move_iterator(trajectories.begin()),
+                                     std::make_move_iterator(trajectories.end()));
+        }
+    }
 
     // retrieve maximum points
-    if(m_maxima_suppression_type == "Suppress")
+    if(m_maxima_suppression == SuppressionSuppress)
     {
-        suppressNeighborMaxima(clusterCenters, clusters);
+        suppressNeighborMaxima(clusterCenters, clusters, bandwidth);
     }
-    else if(m_maxima_suppression_type == "Average")
+    else if(m_maxima_suppression == SuppressionAverage)
     {
-        averageNeighborMaxima(clusterCenters, clusters);
+        averageNeighborMaxima(clusterCenters, clusters, bandwidth);
     }
-    else if(m_maxima_suppression_type == "AverageShift")
+    else if(m_maxima_suppression == SuppressionAverageShift)
     {
-        averageShiftNeighborMaxima(clusterCenters, clusters);
+        averageShiftNeighborMaxima(clusterCenters, clusters, bandwidth);
     }
 
     voteIndicesPerCluster.resize(clusters.size());
@@ -108,8 +193,8 @@ void VotingMeanShift::iFindMaxima(const std::vector<Voting::Vote>& votes, // all
     maxima_weights.assign(maxima_weights.size(), 0);
 
     // assign all cluster indices to -1 initially
-    m_clusterIndices.resize(votes.size());
-    m_clusterIndices.assign(m_clusterIndices.size(), -1);
+    // each position index in this vector represents a vote index, at each position index is the cluster index, the vote belongs to
+    std::vector<int> clusterIndices(votes.size(), -1);
 
     // estimate densities
     std::vector<float> newVoteWeights;
@@ -118,12 +203,12 @@ void VotingMeanShift::iFindMaxima(const std::vector<Voting::Vote>& votes, // all
     // estimate densities for cluster positions and reweight votes by the kernel value
     for (int i = 0; i < (int)maxima_weights.size(); i++) {
         // assigned clusters indices are changed
-        maxima_weights[i] = estimateDensity(clusters[i], i, newVoteWeights, votes, search);
+        maxima_weights[i] = estimateDensity(clusters[i], i, clusterIndices, newVoteWeights, grid, bandwidth);
     }
 
-    for (int i = 0; i < (int)m_clusterIndices.size(); i++)
+    for (int i = 0; i < (int)clusterIndices.size(); i++)
     {
-        int clusterIndex = m_clusterIndices[i];
+        int clusterIndex = clusterIndices[i];
         // if clusterIndex == -1, the vote does not belong to a cluster (i.e. its distance to the cluster is too high)
         if (clusterIndex >= 0)
         {
@@ -133,130 +218,332 @@ void VotingMeanShift::iFindMaxima(const std::vector<Voting::Vote>& votes, // all
     }
 }
 
-void VotingMeanShift::iDoMeanShift(const std::vector<Voting::Vote>& seeds,
-                                   const std::vector<Voting::Vote>& votes,
-                                   std::vector<Eigen::Vector3f>& clusterCenters,
-                                   std::vector<std::vector<Eigen::Vector3f> >& trajectories,
-                                   pcl::search::KdTree<PointT>::Ptr& search)
+// cells of the points visited by converged trajectories, every trajectory that enters one of them climbs to an
+// already found mode
+class BasinCells
+{
+public:
+    explicit BasinCells(float cellSize)
+        : m_cell_size(cellSize)
+    {
+    }
+
+    void insert(const Eigen::Vector3f& position)
+    {
+        m_cells.insert(key(position));
+    }
+
+    bool contains(const Eigen::Vector3f& position) const
+    {
+        return !m_cells.empty() && m_cells.count(key(position)) > 0;
+    }
+
+private:
+    uint64_t key(const Eigen::Vector3f& position) const
+    {
+        // 21 bits per dimension, as in VoteGrid
+        uint64_t key = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            int64_t c = (int64_t)std::floor(position[i] / m_cell_size) + ((int64_t)1 << 20);
+            key |= (uint64_t)(c & (((int64_t)1 << 21) - 1)) << (i * 21);
+        }
+        return key;
+    }
+
+    float m_cell_size;
+    std::unordered_set<uint64_t> m_cells;
+};
+
+long long VotingMeanShift::iDoMeanShift(const std::vector<Voting::Vote>& seeds,
+                                        std::vector<Eigen::Vector3f>& clusterCenters,
+                                        std::vector<std::vector<Eigen::Vector3f> >* trajectories,
+                                        const VoteGrid& grid,
+                                        float bandwidth) const
 {
-    // iterate all the points
-    // OMP causes memory allocation errors in vector clusterCenters
-    //#pragma omp parallel for shared(seeds, trajectories, clusterCenters)
-    for (int i = 0; i < (int)seeds.size(); i++)
-    {
-        const Voting::Vote& seed = seeds[i];
-
-        Eigen::Vector3f currentCenter = seed.position;
-
-        // find cluster center for current point
-        int iter = 0;
-        float diff = 0;
-        bool skipVote = false;
-        std::vector<Eigen::Vector3f> trajectory;
-        do {
-            Eigen::Vector3f shiftedCenter;
-            if (!computeMeanShift(votes, currentCenter, shiftedCenter, search))
+    // each seed writes into its own slot, results are collected in seed order afterwards
+    enum SeedState { SeedSkipped = 0, SeedConverged, SeedJoined };
+    std::vector<Eigen::Vector3f> seedCenters(seeds.size());
+    // the trajectories grow in the arena of the detection, each thread in its own sub-arena
+    std::vector<ArenaVector<Eigen::Vector3f> > seedTrajectories(
+                seeds.size(), ArenaVector<Eigen::Vector3f>(ArenaAllocator<Eigen::Vector3f>(&getArena())));
+    std::vector<char> seedState(seeds.size(), SeedSkipped);
+    long long numIterations = 0;
+    int numJoined = 0;
+
+    // with basin caching the seeds are shifted in batches of decreasing weight, each batch stops at the
+    // trajectories of the previous batches; the batches keep the result independent of the number of threads
+    const int numSeeds = (int)seeds.size();
+    const bool useBasins = m_basin_cell_factor > 0 && bandwidth > 0;
+    // the positions are only kept for the basins or when the caller asked for the trajectories
+    const bool keepTrajectories = useBasins || trajectories;
+
+    // seeds on the GPU do not see each other's trajectories, so basin caching stays on the CPU
+    if (m_use_cuda && !useBasins &&
+            doMeanShiftOnDevice(seeds, clusterCenters, trajectories, grid, bandwidth, numIterations))
+    {
+        addCounter("mean_shift_iterations", numIterations);
+        return numIterations;
+    }
+    BasinCells basins(m_basin_cell_factor * bandwidth);
+    std::vector<int> order(numSeeds);
+    std::iota(order.begin(), order.end(), 0);
+    if (useBasins)
+    {
+        std::stable_sort(order.begin(), order.end(), [&seeds](int a, int b)
+        {
+            return seeds[a].weight > seeds[b].weight;
+        });
+    }
+    const int batchSize = useBasins ? 256 : std::max(numSeeds, 1);
+
+    // the seeds of a cancelled detection are skipped, the caller throws at the end of the stage
+    const CancellationToken cancellation = CancellationToken::current();
+    for (int batchBegin = 0; batchBegin < numSeeds; batchBegin += batchSize)
+    {
+        const int batchEnd = std::min(batchBegin + batchSize, numSeeds);
+
+        // iterate all the points, the seeds of concurrently processed classes share the threads of the team
+        ParallelTasks::parallelFor(batchBegin, batchEnd, 8, [&](int k)
+        {
+            const int i = order[k];
+            const Voting::Vote& seed = seeds[i];
+            if (cancellation.isCancelled())
+                return;
+
+            Eigen::Vector3f currentCenter = seed.position;
+
+            // a seed in the basin of a found mode is skipped
+            if (useBasins && basins.contains(currentCenter))
+            {
+                #pragma omp atomic
+                numJoined++;
+                return;
+            }
+
+            // find cluster center for current point
+            int iter = 0;
+            float diff = 0;
+            bool skipVote = false;
+            bool joined = false;
+            ArenaVector<Eigen::Vector3f>& trajectory = seedTrajectories[i];
+            do {
+                Eigen::Vector3f shiftedCenter;
+                if (!computeMeanShift(currentCenter, shiftedCenter, grid, bandwidth))
+                {
+                    skipVote = true;
+                    break;
+                }
+                else if (keepTrajectories)
+                    trajectory.push_back(currentCenter);
+
+                diff = (currentCenter - shiftedCenter).norm();
+
+                currentCenter = shiftedCenter;
+
+                iter++;
+
+                if (useBasins && basins.contains(currentCenter))
+                {
+                    joined = true;
+                    break;
+                }
+            } while (diff > m_threshold && iter <= m_maxIter && !cancellation.isCancelled());
+            #pragma omp atomic
+            numIterations += iter;
+
+            if (joined) {
+                // the mode was already found by a previous trajectory
+                if (keepTrajectories)
+                    trajectory.push_back(currentCenter);
+                seedState[i] = SeedJoined;
+                #pragma omp atomic
+                numJoined++;
+            }
+            else if (!skipVote) {
+                seedCenters[i] = currentCenter;
+                if (keepTrajectories)
+                    trajectory.push_back(currentCenter);
+                seedState[i] = SeedConverged;
+            }
+        });
+
+        if (useBasins)
+        {
+            for (int k = batchBegin; k < batchEnd; k++)
             {
-                skipVote = true;
-                break;
+                const int i = order[k];
+                if (seedState[i] != SeedSkipped)
+                {
+                    for (const Eigen::Vector3f& position : seedTrajectories[i])
+                        basins.insert(position);
+                }
             }
-            else
-                trajectory.push_back(currentCenter);
+        }
+    }
 
-            diff = (currentCenter - shiftedCenter).norm();
+    for (int i = 0; i < numSeeds; i++)
+    {
+        if (seedState[i] == SeedConverged)
+            clusterCenters.push_back(seedCenters[i]);
+        if (trajectories && seedState[i] != SeedSkipped)
+            trajectories->push_back(std::vector<Eigen::Vector3f>(seedTrajectories[i].begin(), seedTrajectories[i].end()));
+    }
+    addCounter("mean_shift_iterations", numIterations);
+    if (useBasins)
+        addCounter("mean_shift_basin_joins", numJoined);
+    return numIterations;
+}
 
-            currentCenter = shiftedCenter;
+bool VotingMeanShift::doMeanShiftOnDevice(const std::vector<Voting::Vote>& seeds,
+                                          std::vector<Eigen::Vector3f>& clusterCenters,
+                                          std::vector<std::vector<Eigen::Vector3f> >* trajectories,
+                                          const VoteGrid& grid,
+                                          float bandwidth,
+                                          long long& numIterations) const
+{
+#ifdef USE_CUDA
+    const int numSeeds = (int)seeds.size();
+    const int numCells = grid.getNumCells();
+    std::vector<int> cellCoords(3 * numCells);
+    std::vector<int> cellOffsets(numCells + 1);
+    for (int c = 0; c < numCells; c++)
+    {
+        Eigen::Vector3i coords = grid.getCellCoords(c);
+        cellCoords[3 * c] = coords[0];
+        cellCoords[3 * c + 1] = coords[1];
+        cellCoords[3 * c + 2] = coords[2];
+        cellOffsets[c] = grid.getCellBegin(c);
+    }
+    cellOffsets[numCells] = grid.size();
+
+    std::vector<float> seedPositions(3 * numSeeds);
+    for (int i = 0; i < numSeeds; i++)
+    {
+        seedPositions[3 * i] = seeds[i].position[0];
+        seedPositions[3 * i + 1] = seeds[i].position[1];
+        seedPositions[3 * i + 2] = seeds[i].position[2];
+    }
 
-            iter++;
-        } while (diff > m_threshold && iter <= m_maxIter);
+    std::vector<float> centers(3 * numSeeds);
+    std::vector<char> valid(numSeeds);
+    std::vector<int> iterations(numSeeds);
+    try
+    {
+        CudaMeanShift meanShift;
+        meanShift.upload(grid.getX(), grid.getY(), grid.getZ(), grid.getWeights(), grid.size(),
+                         cellCoords.data(), cellOffsets.data(), numCells, grid.getCellSize());
+        meanShift.shift(seedPositions.data(), numSeeds, m_shift_table.data(), KernelTableSize, bandwidth,
+                        m_threshold, m_maxIter, centers.data(), valid.data(), iterations.data());
+    }
+    catch (const RuntimeException &e)
+    {
+        LOG_WARN("CUDA mean shift failed (" << e.what() << "), using the CPU!");
+        return false;
+    }
 
-        if (!skipVote) {
-            clusterCenters.push_back(currentCenter);
-            trajectory.push_back(currentCenter);
-            trajectories.push_back(trajectory);
+    // only the seed and its mode are known of each trajectory
+    numIterations = 0;
+    for (int i = 0; i < numSeeds; i++)
+    {
+        numIterations += iterations[i];
+        if (valid[i])
+        {
+            Eigen::Vector3f center(centers[3 * i], centers[3 * i + 1], centers[3 * i + 2]);
+            clusterCenters.push_back(center);
+            if (trajectories)
+                trajectories->push_back({seeds[i].position, center});
         }
     }
+    return true;
+#else
+    return false;
+#endif
 }
 
 float VotingMeanShift::estimateDensity(Eigen::Vector3f position,
                                        int clusterIndex,
+                                       std::vector<int>& clusterIndices,
                                        std::vector<float>& newVoteWeights,
-                                       const std::vector<Voting::Vote>& votes,
-                                       pcl::search::KdTree<PointT>::Ptr& search)
+                                       const VoteGrid& grid,
+                                       float bandwidth) const
 {
-    // find nearest points within search window
-    PointT query;
-    query.x = position[0];
-    query.y = position[1];
-    query.z = position[2];
-    std::vector<int> indices;
-    std::vector<float> distances;
-    search->radiusSearch(query, m_bandwidth, indices, distances);
-
-    // shouldn't happen
-    if (indices.size() == 0 || distances.size() == 0)
-        return 0;
+    const float bandwidthSqr = bandwidth * bandwidth;
+    const float* kernelTable = m_kernel_table.data();
 
+    // find nearest points within search window
     float density = 0;
-    for (int i = 0; i < (int)indices.size(); i++)
+    grid.forEachNeighbor(position, bandwidth, [&](int index, float distanceSqr)
     {
-        const Voting::Vote& vote = votes[indices[i]];
-
-        // get euclidean distance between current center and nearest neighbor
-        float distanceSqr = distances[i];
-
         // compute a normalized distance in {0, 1}
-        float u = distanceSqr / (m_bandwidth * m_bandwidth);
+        float u = distanceSqr / bandwidthSqr;
 
         // compute weights
-        float weight = kernel(u) * vote.weight;
+        float weight = lookupProfile(kernelTable, u) * grid.getWeight(index);
 
         // NOTE: can it happen that a votes 'should' be assigned to more than 1 cluster?
-        m_clusterIndices[indices[i]] = clusterIndex;
-        newVoteWeights[indices[i]] = weight;
+        int voteIndex = grid.getVoteIndex(index);
+        clusterIndices[voteIndex] = clusterIndex;
+        newVoteWeights[voteIndex] = weight;
 
         density += weight;
-    }
+    });
+
     return density;
 }
 
-bool VotingMeanShift::computeMeanShift(const std::vector<Voting::Vote>& votes,
-                                       const Eigen::Vector3f& center,
+bool VotingMeanShift::computeMeanShift(const Eigen::Vector3f& center,
                                        Eigen::Vector3f& newCenter,
-                                       pcl::search::KdTree<PointT>::Ptr& search) const
+                                       const VoteGrid& grid,
+                                       float bandwidth) const
 {
-    // find nearest points within search window
-    PointT query;
-    query.x = center[0];
-    query.y = center[1];
-    query.z = center[2];
-    std::vector<int> indices;
-    std::vector<float> distances;
-    search->radiusSearch(query, m_bandwidth, indices, distances);
-
-    // shouldn't happen
-    if (indices.size() == 0 || distances.size() == 0)
-        return false;
-
+    const float bandwidthSqr = bandwidth * bandwidth;
+    const float invBandwidthSqr = 1.0f / bandwidthSqr;
+    const float cx = center[0];
+    const float cy = center[1];
+    const float cz = center[2];
+    const float* x = grid.getX();
+    const float* y = grid.getY();
+    const float* z = grid.getZ();
+    const float* weights = grid.getWeights();
+    const float* shiftTable = m_shift_table.data();
+
+    // the votes of each cell around the center are accumulated in one vectorized pass, votes outside of the
+    // bandwidth get a weight of 0
     Eigen::Vector3f shifted(0, 0, 0);
     double totalWeight = 0;
-    for (int i = 0; i < (int)indices.size(); i++)
+    int numNeighbors = 0;
+    grid.forEachCandidateRange(center, [&](int begin, int end)
     {
-        const Voting::Vote& vote = votes[indices[i]];
-
-        // get euclidean distance between current center and nearest neighbor
-        float distanceSqr = distances[i];
-
-        // compute a normalized distance in {0, 1}
-        float u = distanceSqr / (m_bandwidth * m_bandwidth);
-
-        // compute weights
-        float g = -kernelDerivative(u) * vote.weight;
+        float sumX = 0, sumY = 0, sumZ = 0, sumWeight = 0;
+        int count = 0;
+        #pragma omp simd reduction(+:sumX, sumY, sumZ, sumWeight, count)
+        for (int i = begin; i < end; i++)
+        {
+            float dx = x[i] - cx;
+            float dy = y[i] - cy;
+            float dz = z[i] - cz;
+            float distanceSqr = dx * dx + dy * dy + dz * dz;
+            float inside = distanceSqr <= bandwidthSqr ? 1.0f : 0.0f;
+
+            // compute weights
+            float g = inside * lookupProfile(shiftTable, distanceSqr * invBandwidthSqr) * weights[i];
+
+            // update shifted position
+            sumX += g * x[i];
+            sumY += g * y[i];
+            sumZ += g * z[i];
+            sumWeight += g;
+            count += (int)inside;
+        }
+        shifted += Eigen::Vector3f(sumX, sumY, sumZ);
+        totalWeight += sumWeight;
+        numNeighbors += count;
+    });
 
-        // update shifted position
-        shifted += g * vote.position;
-        totalWeight += g;
-    }
+    // shouldn't happen
+    if (numNeighbors == 0)
+        return false;
 
     // normalize by sum of weights
     if (totalWeight != 0)
@@ -267,31 +554,45 @@ bool VotingMeanShift::computeMeanShift(const std::vector<Voting::Vote>& votes,
     return true;
 }
 
+// neighbors j > i of maximum i closer than the bandwidth, in increasing index order
+static void findLaterNeighbors(const VoteGrid& grid, const std::vector<Eigen::Vector3f>& maxima, int i,
+                               float bandwidth, std::vector<int>& neighbors)
+{
+    neighbors.clear();
+    const float bandwidthSqr = bandwidth * bandwidth;
+    grid.forEachNeighbor(maxima[i], bandwidth, [&](int index, float distanceSqr)
+    {
+        int j = grid.getVoteIndex(index);
+        if (j > i && distanceSqr < bandwidthSqr)
+            neighbors.push_back(j);
+    });
+    std::sort(neighbors.begin(), neighbors.end());
+}
+
 void VotingMeanShift::suppressNeighborMaxima(const std::vector<Eigen::Vector3f>& maxima,
-                                             std::vector<Eigen::Vector3f>& clusters) const
+                                             std::vector<Eigen::Vector3f>& clusters,
+                                             float bandwidth) const
 {
-    std::vector<bool> duplicate(maxima.size());
-    duplicate.assign(duplicate.size(), false);
+    if (bandwidth <= 0)
+    {
+        clusters.insert(clusters.end(), maxima.begin(), maxima.end());
+        return;
+    }
+
+    // maxima are searched in a grid with the bandwidth as cell size
+    VoteGrid grid;
+    grid.build(maxima, bandwidth);
 
+    std::vector<bool> duplicate(maxima.size(), false);
+    std::vector<int> neighbors;
     for (int i = 0; i < (int)maxima.size(); i++)
     {
-        const Eigen::Vector3f& pointA = maxima[i];
-
         if (duplicate[i])
             continue;
 
-        for (int j = i + 1; j < (int)maxima.size(); j++)
-        {
-            const Eigen::Vector3f& pointB = maxima[j];
-
-            if (duplicate[j])
-                continue;
-
-            float distance = (pointA - pointB).norm();
-
-            if (distance < m_bandwidth)
-                duplicate[j] = true;
-        }
+        findLaterNeighbors(grid, maxima, i, bandwidth, neighbors);
+        for (int j : neighbors)
+            duplicate[j] = true;
     }
 
     // add correct cluster centers
@@ -302,149 +603,121 @@ void VotingMeanShift::suppressNeighborMaxima(const std::vector<Eigen::Vector3f>&
 }
 
 void VotingMeanShift::averageNeighborMaxima(const std::vector<Eigen::Vector3f>& maxima,
-                                             std::vector<Eigen::Vector3f>& clusters) const
+                                             std::vector<Eigen::Vector3f>& clusters,
+                                             float bandwidth) const
 {
-    std::vector<std::vector<int>> duplicate_indices(maxima.size());
-    for(int i = 0; i < duplicate_indices.size(); i++)
+    if (bandwidth <= 0)
     {
-        // add itself for simpler averaging later
-        duplicate_indices.at(i).push_back(i);
+        clusters.insert(clusters.end(), maxima.begin(), maxima.end());
+        return;
     }
 
-    std::vector<bool> duplicate(maxima.size());
-    duplicate.assign(duplicate.size(), false);
+    // maxima are searched in a grid with the bandwidth as cell size
+    VoteGrid grid;
+    grid.build(maxima, bandwidth);
 
+    std::vector<bool> duplicate(maxima.size(), false);
+    std::vector<int> neighbors;
     for (int k = 0; k < (int)maxima.size(); k++)
     {
-        const Eigen::Vector3f& pointA = maxima[k];
-
+        // a maximum that was averaged into a previous one is still added as it is
         if (duplicate[k])
+        {
+            clusters.push_back(maxima[k]);
             continue;
+        }
 
-        for (int j = k + 1; j < (int)maxima.size(); j++)
-        {
-            const Eigen::Vector3f& pointB = maxima[j];
+        findLaterNeighbors(grid, maxima, k, bandwidth, neighbors);
 
+        // compute average of maximum and all neighbors that are not assigned to a previous maximum
+        Eigen::Vector3f average = maxima[k];
+        int count = 1;
+        for (int j : neighbors)
+        {
             if (duplicate[j])
                 continue;
 
-            float distance = (pointA - pointB).norm();
-
-            if (distance < m_bandwidth)
-            {
-                duplicate[j] = true;
-                duplicate_indices.at(k).push_back(j);
-            }
-        }
-    }
-
-    // add correct cluster centers
-    for (int i = 0; i < (int)duplicate_indices.size(); i++)
-    {
-        std::vector<int> index_list = duplicate_indices.at(i);
-        if(index_list.size() == 1)
-        {
-            // maximum without neighbors can be added directly
-            clusters.push_back(maxima[index_list.at(0)]);
-        }
-        else
-        {
-            // compute average of maximum and all neighbors
-            Eigen::Vector3f average(0, 0, 0);
-            for (int i = 0; i < index_list.size(); i++)
-            {
-                // update shifted position
-                average += maxima[index_list.at(i)];
-            }
-            average /= index_list.size();
-            clusters.push_back(average);
+            duplicate[j] = true;
+            average += maxima[j];
+            count++;
         }
+        clusters.push_back(average / (float)count);
     }
 }
 
 
 void VotingMeanShift::averageShiftNeighborMaxima(const std::vector<Eigen::Vector3f>& maxima,
-                                            std::vector<Eigen::Vector3f>& clusters) const
+                                            std::vector<Eigen::Vector3f>& clusters,
+                                            float bandwidth) const
 {
-    std::vector<std::vector<int>> duplicate_indices(maxima.size());
-    for(int i = 0; i < duplicate_indices.size(); i++)
+    if (bandwidth <= 0)
     {
-        // add itself as seedpoint for maxima suppression
-        duplicate_indices.at(i).push_back(i);
+        clusters.insert(clusters.end(), maxima.begin(), maxima.end());
+        return;
     }
 
-    std::vector<bool> duplicate(maxima.size());
-    duplicate.assign(duplicate.size(), false);
+    // maxima are searched in a grid with the bandwidth as cell size
+    VoteGrid grid;
+    grid.build(maxima, bandwidth);
+    const float bandwidthSqr = bandwidth * bandwidth;
 
-    // for each maximum ...
-    for(int k = 0; k < (int)maxima.size(); k++)
+    // each maximum that is not reached from a previous one collects its neighbors, their neighbors etc.
+    std::vector<bool> assigned(maxima.size(), false);
+    std::vector<int> component;
+    for (int k = 0; k < (int)maxima.size(); k++)
     {
-        if (duplicate[k])
+        if (assigned[k])
             continue;
 
-        // ... take the seedpoint
-        for(int i : duplicate_indices.at(k))
+        assigned[k] = true;
+        component.assign(1, k);
+        for (int c = 0; c < (int)component.size(); c++)
         {
-            const Eigen::Vector3f& pointA = maxima[i];
-
-            // check all maxima within bandwidth
-            for (int j = i + 1; j < (int)maxima.size(); j++)
+            grid.forEachNeighbor(maxima[component[c]], bandwidth, [&](int index, float distanceSqr)
             {
-                const Eigen::Vector3f& pointB = maxima[j];
-
-                float distance = (pointA - pointB).norm();
-
-                if (distance < m_bandwidth)
+                int j = grid.getVoteIndex(index);
+                if (!assigned[j] && distanceSqr < bandwidthSqr)
                 {
-                    // enables to check neighbors of neighbors etc.
-                    duplicate[j] = true;
-                    duplicate_indices.at(i).push_back(j);
+                    assigned[j] = true;
+                    component.push_back(j);
                 }
-            }
+            });
         }
+
+        // compute average of maximum and all neighbors, in index order
+        std::sort(component.begin(), component.end());
+        Eigen::Vector3f shifted(0, 0, 0);
+        for (int i : component)
+            shifted += maxima[i];
+        clusters.push_back(shifted / (float)component.size());
     }
+}
 
-    // add correct cluster centers
-    for (int i = 0; i < (int)duplicate_indices.size(); i++)
+
+void VotingMeanShift::buildKernelTables()
+{
+    m_kernel_table.resize(KernelTableSize + 1);
+    m_shift_table.resize(KernelTableSize + 1);
+    for (int i = 0; i <= KernelTableSize; i++)
     {
-        std::vector<int> index_list = duplicate_indices.at(i);
-        if(index_list.size() == 1)
-        {
-            // maximum without neighbors can be added directly
-            clusters.push_back(maxima[index_list.at(0)]);
-        }
-        else
-        {
-            // compute average of maximum and all neighbors
-            Eigen::Vector3f shifted(0, 0, 0);
-            for (int i = 0; i < index_list.size(); i++)
-            {
-                // update shifted position
-                shifted += maxima[index_list.at(i)];
-            }
-            shifted /= index_list.size();
-            clusters.push_back(shifted);
-        }
+        float u = (float)i / KernelTableSize;
+        m_kernel_table[i] = kernel(u);
+        m_shift_table[i] = -kernelDerivative(u);
     }
 }
 
-
 float VotingMeanShift::kernel(float x) const
 {
-    if (m_kernel == "Gaussian")
+    if (m_kernel_type == KernelGaussian)
         return kernelGaussian(x);
-    else if (m_kernel == "Uniform")
-        return kernelUniform(x);
-    return 0;
+    return kernelUniform(x);
 }
 
 float VotingMeanShift::kernelDerivative(float x) const
 {
-    if (m_kernel == "Gaussian")
+    if (m_kernel_type == KernelGaussian)
         return kernelDerivedGaussian(x);
-    else if (m_kernel == "Uniform")
-        return kernelDerivedUniform(x);
-    return 0;
+    return kernelDerivedUniform(x);
 }
 
 float VotingMeanShift::kernelGaussian(float x) const
@@ -470,77 +743,83 @@ float VotingMeanShift::kernelDerivedUniform(float x) const
     return 1;
 }
 
-bool VotingMeanShift::mapCompareVector(const Eigen::Vector3i& vec1, const Eigen::Vector3i& vec2)
+std::vector<Voting::Vote> VotingMeanShift::createSeeds(const VoteGrid& grid) const
 {
-    if (vec1[2] < vec2[2])
-        return true;
-    if ((vec1[2] == vec2[2]) && (vec1[1] < vec2[1]))
-        return true;
-    if ((vec1[2] == vec2[2]) && (vec1[1] == vec2[1]) && (vec1[0] < vec2[0]))
-        return true;
-
-    return false;
-}
-
-std::vector<Voting::Vote> VotingMeanShift::createSeeds(const std::vector<Voting::Vote>& votes,
-                                                       float binSize)
-{
-    if (binSize == 0)
-        return votes;
-    else
+    // every non-empty grid cell is a bin, cells are ordered by z, y, x
+    const int minBin = 1;
+    const int numCells = grid.getNumCells();
+    const float binSize = grid.getCellSize();
+
+    std::vector<float> binWeights(numCells, 0);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int c = 0; c < numCells; c++)
     {
-        int minBin = 1;
-
-        // allow custom hashing for Eigen::Vector3f
-        bool(*compFunc)(const Eigen::Vector3i&, const Eigen::Vector3i&) = VotingMeanShift::mapCompareVector;
-        std::map<Eigen::Vector3i, std::pair<int, float>, bool(*)(const Eigen::Vector3i&, const Eigen::Vector3i&)> map(compFunc);
+        float weight = 0;
+        for (int i = grid.getCellBegin(c); i < grid.getCellEnd(c); i++)
+            weight += grid.getWeight(i);
+        binWeights[c] = weight;
+    }
 
-        for (int i = 0; i < (int)votes.size(); i++)
+    // create seeds for bins which contain more than one point
+    // alternatively: create seeds for bins which have a weight above a threshold
+    std::vector<Voting::Vote> seeds;
+    seeds.reserve(numCells);
+    for (int c = 0; c < numCells; c++)
+    {
+        if (grid.getCellEnd(c) - grid.getCellBegin(c) >= minBin)
         {
-            const Eigen::Vector3f& pos = votes[i].position;
-            Eigen::Vector3i key((int)std::floor((pos[0] / binSize) + 0.5),
-                    (int)std::floor((pos[1] / binSize) + 0.5),
-                    (int)std::floor((pos[2] / binSize) + 0.5));
-
-            // increase counter and weight
-            if (map.find(key) != map.end()) {
-                map[key].first = map[key].first + 1;
-                map[key].second = map[key].second + votes[i].weight;
-            }
-            else {
-                map[key].first = 1;
-                map[key].second = votes[i].weight;
-            }
+            Voting::Vote newVote;
+            newVote.position = grid.getCellCoords(c).cast<float>() * binSize;
+            newVote.weight = binWeights[c];
+            seeds.push_back(newVote);
         }
+    }
 
-        // create seeds for bins which contain more than one point
-        // alternatively: create seeds for bins which have a weight above a threshold
-        std::vector<Voting::Vote> seeds;
+    return seeds;
+}
 
-        for (std::map<Eigen::Vector3i, std::pair<int, float> >::const_iterator it = map.begin();
-             it != map.end(); it++)
+std::vector<Voting::Vote> VotingMeanShift::aggregateVotes(const std::vector<Voting::Vote>& votes, float cellSize) const
+{
+    VoteGrid grid;
+    grid.build(votes, cellSize);
+
+    // each non-empty cell is replaced by the weighted centroid of its votes carrying their total weight
+    const int numCells = grid.getNumCells();
+    std::vector<Voting::Vote> aggregated(numCells);
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int c = 0; c < numCells; c++)
+    {
+        Eigen::Vector3f sum(0, 0, 0);
+        Eigen::Vector3f weightedSum(0, 0, 0);
+        float weight = 0;
+        for (int i = grid.getCellBegin(c); i < grid.getCellEnd(c); i++)
         {
-            if (it->second.first >= minBin) {
-                Voting::Vote newVote;
-                newVote.position = Eigen::Vector3f(it->first[0] * binSize,
-                        it->first[1] * binSize,
-                        it->first[2] * binSize);
-                newVote.weight = it->second.second;
-                seeds.push_back(newVote);
-            }
+            sum += grid.getPosition(i);
+            weightedSum += grid.getWeight(i) * grid.getPosition(i);
+            weight += grid.getWeight(i);
         }
 
-        return seeds;
+        Voting::Vote &vote = aggregated[c];
+        vote = votes[grid.getVoteIndex(grid.getCellBegin(c))];
+        vote.position = weight > 0 ? Eigen::Vector3f(weightedSum / weight)
+                                   : Eigen::Vector3f(sum / (float)(grid.getCellEnd(c) - grid.getCellBegin(c)));
+        vote.weight = weight;
     }
+
+    return aggregated;
 }
 
 void VotingMeanShift::clear()
 {
-    m_clusterIndices.clear();
     m_trajectories.clear();
     Voting::clear();
 }
 
+void VotingMeanShift::setRecordTrajectories(bool record)
+{
+    m_record_trajectories = record;
+}
+
 const std::map<unsigned, std::vector<std::vector<Eigen::Vector3f> > >& VotingMeanShift::getTrajectories() const
 {
     return m_trajectories;
@@ -12,6 +12,8 @@
 #define ISM3D_VOTINGMEANSHIFT_H
 
 #include "voting.h"
+#include "vote_grid.h"
+#include <algorithm>
 #include <map>
 
 namespace ism3d
@@ -23,6 +25,8 @@ namespace ism3d
      * bandwidth radius and shifts the position onto the mean. The algorithm is repeated until the
      * seed points converge to a maximum. Non-maxima supression is then performed to filter out those
      * points that ended up on the same maximum.
+     * With MultiResolution, the modes are first located on the votes aggregated per coarse cell and only the
+     * distinct modes are refined on all votes.
      */
     class VotingMeanShift
             : public Voting
@@ -36,6 +40,8 @@ namespace ism3d
 
         virtual void clear();
 
+        // the trajectories are only recorded on request, e.g. for a voting analysis; they are kept until clear()
+        void setRecordTrajectories(bool record);
         const std::map<unsigned, std::vector<std::vector<Eigen::Vector3f> > >& getTrajectories() const;
 
     protected:
@@ -45,37 +51,66 @@ namespace ism3d
                          std::vector<std::vector<int> >&,
                          std::vector<std::vector<float> >&,
                          unsigned, float &radius);
-        float iGetSeedsRange() const;
-        void iDoMeanShift(const std::vector<Voting::Vote>&,
-                          const std::vector<Voting::Vote>&,
-                          std::vector<Eigen::Vector3f>&,
-                          std::vector<std::vector<Eigen::Vector3f> >&,
-                          pcl::search::KdTree<PointT>::Ptr& search);
+        float iGetSeedsRange(float bandwidth) const;
+        // returns the number of iterations of all seeds, the trajectories are only collected if not 0
+        long long iDoMeanShift(const std::vector<Voting::Vote>&,
+                               std::vector<Eigen::Vector3f>&,
+                               std::vector<std::vector<Eigen::Vector3f> >*,
+                               const VoteGrid& grid,
+                               float bandwidth) const;
         float estimateDensity(Eigen::Vector3f,
                               int,
+                              std::vector<int>&,
                               std::vector<float>&,
-                              const std::vector<Voting::Vote>&,
-                              pcl::search::KdTree<PointT>::Ptr& search);
+                              const VoteGrid& grid,
+                              float bandwidth) const;
 
         // only the first maximum in the radius is retained
         void suppressNeighborMaxima(const std::vector<Eigen::Vector3f>&,
-                                  std::vector<Eigen::Vector3f>&) const;
+                                  std::vector<Eigen::Vector3f>&, float bandwidth) const;
         // the average of the maxima in the radius is retained
         void averageNeighborMaxima(const std::vector<Eigen::Vector3f>&,
-                                  std::vector<Eigen::Vector3f>&) const;
+                                  std::vector<Eigen::Vector3f>&, float bandwidth) const;
         // the average of the maxima and its [neighbor's neighbor's ...] neighbors in the radius is retained
         void averageShiftNeighborMaxima(const std::vector<Eigen::Vector3f>&,
-                                  std::vector<Eigen::Vector3f>&) const;
+                                  std::vector<Eigen::Vector3f>&, float bandwidth) const;
+
+        // validates the kernel and the maxima suppression and resolves them, in addition to Voting
+        void iPostInitConfig();
 
     private:
-        bool computeMeanShift(const std::vector<Voting::Vote>&,
-                              const Eigen::Vector3f& center,
+        float getClassBandwidth(unsigned classId) const;
+
+        // shifts the seeds on the GPU, returns false if the CPU has to be used
+        bool doMeanShiftOnDevice(const std::vector<Voting::Vote>& seeds,
+                                 std::vector<Eigen::Vector3f>& clusterCenters,
+                                 std::vector<std::vector<Eigen::Vector3f> >* trajectories,
+                                 const VoteGrid& grid,
+                                 float bandwidth,
+                                 long long& numIterations) const;
+
+        bool computeMeanShift(const Eigen::Vector3f& center,
                               Eigen::Vector3f& newCenter,
-                              pcl::search::KdTree<PointT>::Ptr& search) const;
+                              const VoteGrid& grid,
+                              float bandwidth) const;
+
 
+        std::vector<Vote> createSeeds(const VoteGrid& grid) const;
 
-        static bool mapCompareVector(const Eigen::Vector3i&, const Eigen::Vector3i&);
-        std::vector<Vote> createSeeds(const std::vector<Voting::Vote>&, float);
+        // replaces the votes in each cell of the given size by one vote at their weighted centroid
+        std::vector<Vote> aggregateVotes(const std::vector<Vote>& votes, float cellSize) const;
+
+        // fills the kernel tables with the profile of the resolved kernel
+        void buildKernelTables();
+
+        // kernel profile at the squared normalized distance u in [0, 1], interpolated from the table
+        static float lookupProfile(const float* table, float u)
+        {
+            float position = std::min(std::max(u, 0.0f), 1.0f) * KernelTableSize;
+            int index = std::min((int)position, KernelTableSize - 1);
+            float fraction = position - index;
+            return table[index] + fraction * (table[index + 1] - table[index]);
+        }
 
         float kernel(float) const;
         float kernelDerivative(float) const;
@@ -84,18 +119,30 @@ namespace ism3d
         float kernelUniform(float) const;
         float kernelDerivedUniform(float) const;
 
-        // each position index in this vector represents a vote index, at each position index is the cluster index, the vote belongs to
-        std::vector<int> m_clusterIndices;
-
         // NOTE: trajectories are saved for each class id and store a path of 3d positions for each
         // seed point
         std::map<unsigned, std::vector<std::vector<Eigen::Vector3f> > > m_trajectories;
+        bool m_record_trajectories;
 
         std::string m_kernel; // kernel type
-        float m_bandwidth;  // radius
+        enum Kernel { KernelGaussian, KernelUniform };
+        Kernel m_kernel_type; // m_kernel resolved by iPostInitConfig()
+
+        // kernel profile and negative derivative sampled at KernelTableSize + 1 squared normalized distances in [0, 1]
+        static const int KernelTableSize = 1024;
+        std::vector<float> m_kernel_table;
+        std::vector<float> m_shift_table;
+        float m_bandwidth;  // radius, if radius type is Config
         float m_threshold;  // termination threshold
         int m_maxIter;      // maximum number of iterations until termination
         std::string m_maxima_suppression_type;
+        enum MaximaSuppression { SuppressionSuppress, SuppressionAverage, SuppressionAverageShift };
+        MaximaSuppression m_maxima_suppression; // m_maxima_suppression_type resolved by iPostInitConfig()
+        bool m_multi_resolution;    // find the modes on aggregated votes first, then refine them on all votes
+        float m_coarse_cell_factor; // cell size of the aggregated votes relative to the bandwidth
+        float m_basin_cell_factor;  // cell size of the visited trajectory points relative to the bandwidth, 0 to disable
+        std::string m_backend;      // CPU or CUDA
+        bool m_use_cuda;            // m_backend resolved by iPostInitConfig(), false without device
     };
 }
 
@@ -0,0 +1,234 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "voting_capture.h"
+
+#include <algorithm>
+#include <set>
+#include <pcl/io/pcd_io.h>
+
+namespace ism3d
+{
+
+VotingCapture::VotingCapture(int queueSize, int sampling, int maxVotes)
+    : m_queue_size(std::max(queueSize, 1)), m_sampling(std::max(sampling, 1)), m_max_votes(std::max(maxVotes, 0)),
+      m_next_id(0), m_channels(0), m_busy(false), m_stop(false), m_num_detections(0), m_num_dropped(0)
+{
+    m_thread = std::thread(&VotingCapture::run, this);
+}
+
+VotingCapture::~VotingCapture()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+int VotingCapture::subscribe(int channels, Consumer consumer)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int id = m_next_id++;
+    m_consumers[id] = std::make_pair(channels, consumer);
+    m_channels |= channels;
+    return id;
+}
+
+void VotingCapture::unsubscribe(int id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_consumers.erase(id);
+    m_channels = 0;
+    for (const auto &consumer : m_consumers)
+        m_channels |= consumer.second.first;
+}
+
+int VotingCapture::getChannels() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_channels;
+}
+
+bool VotingCapture::beginDetection()
+{
+    if (getChannels() == 0)
+        return false;
+    return m_num_detections++ % m_sampling == 0;
+}
+
+std::shared_ptr<VotingCaptureFrame> VotingCapture::createFrame(pcl::PointCloud<PointNormalT>::ConstPtr points,
+                                                               const std::map<unsigned, std::vector<Voting::Vote> > &votes) const
+{
+    std::shared_ptr<VotingCaptureFrame> frame = std::make_shared<VotingCaptureFrame>();
+    frame->detection = m_num_detections - 1;
+    if (!(getChannels() & ChannelVotes))
+        return frame;
+
+    // the points are shared, only the positions of the sampled votes are copied
+    frame->points = points;
+    for (const auto &classVotes : votes)
+    {
+        const std::vector<Voting::Vote> &all = classVotes.second;
+        const int step = m_max_votes > 0 ? ((int)all.size() + m_max_votes - 1) / m_max_votes : 1;
+        std::vector<Eigen::Vector3f> &sampled = frame->votes[classVotes.first];
+        sampled.reserve(all.size() / std::max(step, 1) + 1);
+        for (int i = 0; i < (int)all.size(); i += std::max(step, 1))
+            sampled.push_back(all[i].position);
+        frame->numVotes[classVotes.first] = (int)all.size();
+    }
+    return frame;
+}
+
+void VotingCapture::setTrajectories(VotingCaptureFrame &frame,
+                                    const std::map<unsigned, std::vector<std::vector<Eigen::Vector3f> > > &trajectories) const
+{
+    for (const auto &classTrajectories : trajectories)
+    {
+        const std::vector<std::vector<Eigen::Vector3f> > &all = classTrajectories.second;
+        const int step = m_max_votes > 0 ? std::max(((int)all.size() + m_max_votes - 1) / m_max_votes, 1) : 1;
+        std::vector<std::vector<Eigen::Vector3f> > &sampled = frame.trajectories[classTrajectories.first];
+        for (int i = 0; i < (int)all.size(); i += step)
+            sampled.push_back(all[i]);
+    }
+}
+
+void VotingCapture::post(std::shared_ptr<VotingCaptureFrame> frame)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if ((int)m_queue.size() >= m_queue_size)
+    {
+        m_num_dropped++;
+        return;
+    }
+    m_queue.push_back(frame);
+    m_condition.notify_one();
+}
+
+void VotingCapture::flush()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() { return m_queue.empty() && !m_busy; });
+}
+
+int VotingCapture::getNumDropped() const
+{
+    return m_num_dropped;
+}
+
+void VotingCapture::run()
+{
+    while (true)
+    {
+        std::shared_ptr<const VotingCaptureFrame> frame;
+        std::vector<Consumer> consumers;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_busy = false;
+            if (m_queue.empty())
+                m_idle.notify_all();
+            // the queued frames are still delivered when stopping
+            m_condition.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+            if (m_queue.empty())
+                return;
+            frame = m_queue.front();
+            m_queue.pop_front();
+            m_busy = true;
+            for (const auto &consumer : m_consumers)
+                consumers.push_back(consumer.second.second);
+        }
+
+        for (const Consumer &consumer : consumers)
+        {
+            try
+            {
+                consumer(frame);
+            }
+            catch (const std::exception &e)
+            {
+                LOG_WARN("voting capture consumer failed: " << e.what());
+            }
+        }
+    }
+}
+
+VotingCapture::Consumer VotingCapture::createPCDWriter(const std::string &folder)
+{
+    std::string path = folder;
+    if (path.empty() || path[path.size() - 1] != '/')
+        path += "/";
+
+    return [path](std::shared_ptr<const VotingCaptureFrame> frame)
+    {
+        std::set<unsigned> classIds;
+        for (const auto &votes : frame->votes)
+            classIds.insert(votes.first);
+        for (const auto &trajectories : frame->trajectories)
+            classIds.insert(trajectories.first);
+        for (const VotingMaximum &maximum : frame->maxima)
+            classIds.insert(maximum.classId);
+
+        for (unsigned classId : classIds)
+        {
+            pcl::PointCloud<PointT> dataset;
+            auto addPoint = [&dataset](const Eigen::Vector3f &position, uint8_t r, uint8_t g, uint8_t b)
+            {
+                PointT point;
+                point.x = position[0];
+                point.y = position[1];
+                point.z = position[2];
+                setPointColor(point, r, g, b);
+                dataset.push_back(point);
+            };
+
+            if (frame->points)
+            {
+                for (const PointNormalT &p : frame->points->points)
+                {
+                    PointT point;
+                    point.x = p.x;
+                    point.y = p.y;
+                    point.z = p.z;
+                    copyPointColor(p, point);
+                    dataset.push_back(point);
+                }
+            }
+
+            auto votes = frame->votes.find(classId);
+            if (votes != frame->votes.end())
+            {
+                for (const Eigen::Vector3f &position : votes->second)
+                    addPoint(position, 0, 0, 255);
+            }
+
+            auto trajectories = frame->trajectories.find(classId);
+            if (trajectories != frame->trajectories.end())
+            {
+                for (const std::vector<Eigen::Vector3f> &trajectory : trajectories->second)
+                    for (const Eigen::Vector3f &position : trajectory)
+                        addPoint(position, 0, 255, 0);
+            }
+
+            for (const VotingMaximum &maximum : frame->maxima)
+            {
+                if (maximum.classId == classId)
+                    addPoint(maximum.position, 255, 0, 0);
+            }
+
+            dataset.height = 1;
+            dataset.width = dataset.size();
+            dataset.is_dense = false;
+            pcl::io::savePCDFileBinary(path + std::to_string(classId) + ".pcd", dataset);
+        }
+    };
+}
+
+}
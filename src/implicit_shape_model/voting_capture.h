@@ -0,0 +1,131 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_VOTING_CAPTURE_H
+#define ISM3D_VOTING_CAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utils/utils.h"
+#include "voting/voting.h"
+
+namespace ism3d
+{
+    /**
+     * @brief The VotingCaptureFrame struct
+     * The voting space of one captured detection. Only the channels subscribed by any consumer are filled.
+     */
+    struct VotingCaptureFrame
+    {
+        int detection; // number of the detection since the capture was created
+        pcl::PointCloud<PointNormalT>::ConstPtr points; // the input points, with the votes channel
+        std::map<unsigned, std::vector<Eigen::Vector3f> > votes; // vote positions per class, sampled to the limit
+        std::map<unsigned, int> numVotes; // number of all votes per class
+        std::vector<VotingMaximum> maxima;
+        std::map<unsigned, std::vector<std::vector<Eigen::Vector3f> > > trajectories; // mean shift paths per class
+    };
+
+    /**
+     * @brief The VotingCapture class
+     * Captures the voting space of detections for analysis. Consumers subscribe to the channels they need and
+     * are called on a separate thread, so serializing a capture does not delay the detection. Only every
+     * n-th detection is captured, the votes and trajectories of a class are sampled down to a limit and at
+     * most a limited number of frames wait for the consumers, further frames are dropped.
+     */
+    class VotingCapture
+    {
+    public:
+        enum Channel
+        {
+            ChannelVotes = 1,
+            ChannelMaxima = 2,
+            ChannelTrajectories = 4
+        };
+
+        typedef std::function<void(std::shared_ptr<const VotingCaptureFrame>)> Consumer;
+
+        /**
+         * @param queueSize the number of frames that may wait for the consumers
+         * @param sampling capture every sampling-th detection
+         * @param maxVotes the number of votes and trajectories kept per class, 0 keeps all
+         */
+        VotingCapture(int queueSize, int sampling, int maxVotes);
+
+        // delivers the waiting frames before it returns
+        ~VotingCapture();
+
+        // returns an id for unsubscribe(); must not be called while a detection is captured
+        int subscribe(int channels, Consumer consumer);
+        void unsubscribe(int id);
+
+        // the channels subscribed by any consumer
+        int getChannels() const;
+
+        // counts a detection and returns whether it is captured
+        bool beginDetection();
+
+        // fills the channels of a frame from the voting, the votes and trajectories are sampled
+        std::shared_ptr<VotingCaptureFrame> createFrame(pcl::PointCloud<PointNormalT>::ConstPtr points,
+                                                        const std::map<unsigned, std::vector<Voting::Vote> > &votes) const;
+        void setTrajectories(VotingCaptureFrame &frame,
+                             const std::map<unsigned, std::vector<std::vector<Eigen::Vector3f> > > &trajectories) const;
+
+        // queues the frame for the consumers, drops it if the queue is full
+        void post(std::shared_ptr<VotingCaptureFrame> frame);
+
+        // waits until the consumers have received all queued frames
+        void flush();
+
+        // the number of frames dropped because the consumers were busy
+        int getNumDropped() const;
+
+        /**
+         * @brief Create a consumer that writes a PCD file of each class into the folder: the input points,
+         * the votes in blue, the trajectories in green and the maxima in red. Files of a frame replace those of
+         * the previous one.
+         * @param folder the output folder
+         */
+        static Consumer createPCDWriter(const std::string &folder);
+
+    private:
+        VotingCapture(const VotingCapture&) = delete;
+        VotingCapture& operator=(const VotingCapture&) = delete;
+
+        void run();
+
+        const int m_queue_size;
+        const int m_sampling;
+        const int m_max_votes;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_condition;
+        std::condition_variable m_idle;
+        std::deque<std::shared_ptr<const VotingCaptureFrame> > m_queue;
+        std::map<int, std::pair<int, Consumer> > m_consumers; // id to channels and consumer
+        int m_next_id;
+        int m_channels;
+        bool m_busy;
+        bool m_stop;
+        std::atomic<int> m_num_detections;
+        std::atomic<int> m_num_dropped;
+        std::thread m_thread;
+    };
+}
+
+#endif // ISM3D_VOTING_CAPTURE_H
@@ -0,0 +1,653 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <omp.h>
+#include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/filter.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/search/kdtree.h>
+
+#include "../implicit_shape_model/implicit_shape_model.h"
+#include "../implicit_shape_model/activation_strategy/activation_strategy.h"
+#include "../implicit_shape_model/codebook/codebook.h"
+#include "../implicit_shape_model/codebook/codeword.h"
+#include "../implicit_shape_model/codebook/codeword_distribution.h"
+#include "../implicit_shape_model/features/features.h"
+#include "../implicit_shape_model/utils/distance.h"
+#include "../implicit_shape_model/utils/factory.h"
+#include "../implicit_shape_model/utils/flann_helper.h"
+#include "../implicit_shape_model/utils/utils.h"
+#include "../implicit_shape_model/voting/voting_hough_3d.h"
+#include "../implicit_shape_model/voting/voting_mean_shift.h"
+
+bool write_log_to_files = false;
+bool log_info = false;
+
+using ism3d::PointT;
+
+namespace
+{
+    const int votesPerActivation = 10;
+
+    struct Options
+    {
+        std::vector<int> cloudSizes;
+        std::vector<int> codebookSizes;
+        std::vector<int> threads;
+        std::vector<std::string> features;
+        std::vector<std::string> distances;
+        std::set<std::string> benchmarks;
+        std::string cloudFile;
+        std::string modelFile;
+        int descriptorSize;
+        int numClasses;
+        float radius;
+        float leaf;
+        int repetitions;
+        unsigned seed;
+    };
+
+    struct Result
+    {
+        std::string name;
+        std::string parameters;
+        double meanMs;
+        double minMs;
+        double maxMs;
+    };
+
+    template<typename T>
+    std::vector<T> parseList(const std::string &list)
+    {
+        std::vector<T> values;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            if (item.empty())
+                continue;
+            std::stringstream itemStream(item);
+            T value;
+            itemStream >> value;
+            values.push_back(value);
+        }
+        return values;
+    }
+
+    // runs the function once untimed and then the given number of times, prepare is called before every run and
+    // is not timed
+    Result measure(const std::string &name, const std::string &parameters, int repetitions,
+                   const std::function<void()> &prepare, const std::function<void()> &run)
+    {
+        prepare();
+        run();
+
+        Result result = {name, parameters, 0, std::numeric_limits<double>::max(), 0};
+        for (int i = 0; i < repetitions; i++)
+        {
+            prepare();
+            boost::timer::cpu_timer timer;
+            run();
+            double time = timer.elapsed().wall / 1e6;
+            result.meanMs += time / repetitions;
+            result.minMs = std::min(result.minMs, time);
+            result.maxMs = std::max(result.maxMs, time);
+        }
+
+        std::cout << std::left << std::setw(24) << name << std::setw(48) << parameters << std::right << std::fixed <<
+                     std::setprecision(3) << std::setw(12) << result.meanMs << " ms (min " << result.minMs <<
+                     ", max " << result.maxMs << ")" << std::endl;
+        return result;
+    }
+
+    std::string describe(int cloudSize, int codebookSize, int threads)
+    {
+        std::ostringstream stream;
+        if (cloudSize > 0)
+            stream << "points=" << cloudSize << " ";
+        if (codebookSize > 0)
+            stream << "codewords=" << codebookSize << " ";
+        stream << "threads=" << threads;
+        return stream.str();
+    }
+
+    void setThreads(int threads)
+    {
+        omp_set_num_threads(threads > 0 ? threads : omp_get_num_procs());
+    }
+
+    // a reproducible scene of boxes and spheres with surface noise, similar in density to a segmented depth image
+    pcl::PointCloud<PointT>::Ptr createScene(int numPoints, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::normal_distribution<float> noise(0.0f, 0.002f);
+
+        const int numObjects = 8;
+        std::vector<Eigen::Vector3f> centers(numObjects);
+        std::vector<float> sizes(numObjects);
+        for (int i = 0; i < numObjects; i++)
+        {
+            centers[i] = Eigen::Vector3f(unit(random), unit(random), unit(random)) * 2.0f;
+            sizes[i] = 0.1f + 0.1f * (unit(random) + 1.0f);
+        }
+
+        pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+        cloud->reserve(numPoints);
+        for (int i = 0; i < numPoints; i++)
+        {
+            const int object = i % numObjects;
+            Eigen::Vector3f direction(unit(random), unit(random), unit(random));
+            if (direction.norm() < 1e-3f)
+                direction = Eigen::Vector3f::UnitZ();
+            Eigen::Vector3f surface;
+            if (object % 2 == 0)
+            {
+                // sphere
+                surface = direction.normalized() * sizes[object];
+            }
+            else
+            {
+                // cube, the direction is projected onto the face of its largest coordinate
+                int axis;
+                direction.cwiseAbs().maxCoeff(&axis);
+                surface = direction / std::abs(direction[axis]) * sizes[object];
+            }
+
+            PointT point;
+            point.getVector3fMap() = centers[object] + surface + Eigen::Vector3f(noise(random), noise(random), noise(random));
+            ism3d::setPointColor(point, 128, 128, 128);
+            cloud->push_back(point);
+        }
+        return cloud;
+    }
+
+    pcl::PointCloud<pcl::Normal>::Ptr computeNormals(pcl::PointCloud<PointT>::ConstPtr cloud, float radius)
+    {
+        pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>());
+        pcl::NormalEstimationOMP<PointT, pcl::Normal> normalEst;
+        normalEst.setInputCloud(cloud);
+        normalEst.setSearchMethod(pcl::search::KdTree<PointT>::Ptr(new pcl::search::KdTree<PointT>()));
+        normalEst.setRadiusSearch(radius);
+        normalEst.compute(*normals);
+        return normals;
+    }
+
+    std::vector<float> randomDescriptor(int size, bool binary, std::mt19937 &random)
+    {
+        std::uniform_real_distribution<float> value(0.0f, 1.0f);
+        std::vector<float> descriptor(size);
+        for (float &entry : descriptor)
+            entry = binary ? (value(random) < 0.5f ? 0.0f : 1.0f) : value(random);
+        return descriptor;
+    }
+
+    ism3d::Distance* createDistance(const std::string &type)
+    {
+        if (type == ism3d::DistanceChiSquared::getTypeStatic())
+            return new ism3d::DistanceChiSquared;
+        if (type == ism3d::DistanceHellinger::getTypeStatic())
+            return new ism3d::DistanceHellinger;
+        if (type == ism3d::DistanceHistIntersection::getTypeStatic())
+            return new ism3d::DistanceHistIntersection;
+        if (type == ism3d::DistanceHamming::getTypeStatic())
+            return new ism3d::DistanceHamming;
+        return new ism3d::DistanceEuclidean;
+    }
+
+    // a synthetic trained codebook: random codewords activated by training features that are noisy copies of them
+    struct CodebookFixture
+    {
+        std::vector<std::shared_ptr<ism3d::Codeword> > codewords;
+        std::unique_ptr<ism3d::Distance> distance;
+        std::unique_ptr<ism3d::FlannHelper> flannHelper;
+        ism3d::Codebook codebook;
+
+        CodebookFixture(const Options &options, int numCodewords, const std::string &distanceType)
+            : distance(createDistance(distanceType))
+        {
+            std::mt19937 random(options.seed);
+            const bool binary = distanceType == ism3d::DistanceHamming::getTypeStatic();
+            for (int i = 0; i < numCodewords; i++)
+                codewords.push_back(std::make_shared<ism3d::Codeword>(randomDescriptor(options.descriptorSize, binary, random), 1, 1.0f));
+
+            flannHelper.reset(new ism3d::FlannHelper(options.descriptorSize, numCodewords));
+            flannHelper->createDataset(codewords);
+            flannHelper->buildIndex(distanceType, ism3d::KnnIndexParams());
+
+            // every codeword is activated by two training features on average
+            const int modelsPerClass = 2;
+            const int featuresPerModel = std::max(1, 2 * numCodewords / (options.numClasses * modelsPerClass));
+            std::uniform_int_distribution<int> codewordIndex(0, numCodewords - 1);
+            std::uniform_real_distribution<float> position(-0.2f, 0.2f);
+            std::map<unsigned, std::vector<pcl::PointCloud<ism3d::ISMFeature>::Ptr> > features;
+            std::map<unsigned, std::vector<ism3d::Utils::BoundingBox> > boundingBoxes;
+            for (unsigned classId = 0; classId < (unsigned)options.numClasses; classId++)
+            {
+                for (int model = 0; model < modelsPerClass; model++)
+                {
+                    pcl::PointCloud<ism3d::ISMFeature>::Ptr modelFeatures(new pcl::PointCloud<ism3d::ISMFeature>());
+                    for (int i = 0; i < featuresPerModel; i++)
+                        modelFeatures->push_back(createFeature(codewords[codewordIndex(random)]->getData(),
+                                                               Eigen::Vector3f(position(random), position(random), position(random)),
+                                                               classId, random));
+                    features[classId].push_back(modelFeatures);
+
+                    ism3d::Utils::BoundingBox box;
+                    box.size = Eigen::Vector3f(0.4f, 0.4f, 0.4f);
+                    boundingBoxes[classId].push_back(box);
+                }
+            }
+            codebook.activate(codewords, features, boundingBoxes, distance.get(), *flannHelper, false);
+        }
+
+        static ism3d::ISMFeature createFeature(const std::vector<float> &descriptor, const Eigen::Vector3f &position,
+                                               unsigned classId, std::mt19937 &random)
+        {
+            std::normal_distribution<float> noise(0.0f, 0.01f);
+            ism3d::ISMFeature feature;
+            feature.getVector3fMap() = position;
+            feature.descriptor = descriptor;
+            for (float &entry : feature.descriptor)
+                entry = std::max(0.0f, entry + noise(random));
+            feature.classId = classId;
+
+            // a random rotation as reference frame
+            std::normal_distribution<float> component(0.0f, 1.0f);
+            Eigen::Quaternionf rotation(component(random), component(random), component(random), component(random));
+            rotation.normalize();
+            Eigen::Matrix3f frame = rotation.toRotationMatrix();
+            for (int axis = 0; axis < 3; axis++)
+            {
+                feature.referenceFrame.x_axis[axis] = frame(0, axis);
+                feature.referenceFrame.y_axis[axis] = frame(1, axis);
+                feature.referenceFrame.z_axis[axis] = frame(2, axis);
+            }
+            return feature;
+        }
+
+        // detection features at the points of a scene that match random codewords
+        pcl::PointCloud<ism3d::ISMFeature>::Ptr createQueries(const pcl::PointCloud<PointT> &scene, int numQueries, unsigned seed) const
+        {
+            std::mt19937 random(seed);
+            std::uniform_int_distribution<int> codewordIndex(0, (int)codewords.size() - 1);
+            std::uniform_int_distribution<int> pointIndex(0, (int)scene.size() - 1);
+            pcl::PointCloud<ism3d::ISMFeature>::Ptr queries(new pcl::PointCloud<ism3d::ISMFeature>());
+            for (int i = 0; i < numQueries; i++)
+                queries->push_back(createFeature(codewords[codewordIndex(random)]->getData(),
+                                                 scene.at(pointIndex(random)).getVector3fMap(), 0, random));
+            return queries;
+        }
+    };
+
+    void benchmarkDescriptors(const Options &options, pcl::PointCloud<PointT>::Ptr scene, int cloudSize, std::vector<Result> &results)
+    {
+        pcl::PointCloud<pcl::Normal>::Ptr normals = computeNormals(scene, options.radius / 2);
+
+        pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
+        pcl::VoxelGrid<PointT> voxelGrid;
+        voxelGrid.setInputCloud(scene);
+        voxelGrid.setLeafSize(options.leaf, options.leaf, options.leaf);
+        voxelGrid.filter(*keypoints);
+
+        for (const std::string &type : options.features)
+        {
+            Json::Value config;
+            config["Type"] = type;
+            config["Parameters"]["Radius"] = options.radius;
+            config["Parameters"]["ReferenceFrameRadius"] = options.radius;
+            std::unique_ptr<ism3d::Features> features(ism3d::Factory<ism3d::Features>::create(config));
+
+            for (int threads : options.threads)
+            {
+                features->setNumThreads(threads);
+                setThreads(threads);
+                pcl::search::KdTree<PointT>::Ptr search;
+                results.push_back(measure("descriptors " + type, describe(cloudSize, 0, threads) + " keypoints=" +
+                                          std::to_string(keypoints->size()), options.repetitions,
+                                          [&]() { search.reset(new pcl::search::KdTree<PointT>()); },
+                                          [&]() { (*features)(scene, normals, scene, normals, keypoints, search); }));
+            }
+        }
+    }
+
+    void benchmarkIndex(const Options &options, std::vector<Result> &results)
+    {
+        for (const std::string &distanceType : options.distances)
+        {
+            for (int codebookSize : options.codebookSizes)
+            {
+                std::mt19937 random(options.seed);
+                const bool binary = distanceType == ism3d::DistanceHamming::getTypeStatic();
+                std::vector<std::shared_ptr<ism3d::Codeword> > codewords;
+                for (int i = 0; i < codebookSize; i++)
+                    codewords.push_back(std::make_shared<ism3d::Codeword>(randomDescriptor(options.descriptorSize, binary, random), 1, 1.0f));
+
+                std::unique_ptr<ism3d::FlannHelper> helper;
+                results.push_back(measure("index build " + distanceType, describe(0, codebookSize, 1), options.repetitions,
+                                          [&]() { helper.reset(new ism3d::FlannHelper(options.descriptorSize, codebookSize)); },
+                                          [&]()
+                {
+                    helper->createDataset(codewords);
+                    helper->buildIndex(distanceType, ism3d::KnnIndexParams());
+                }));
+
+                const int numQueries = 1000;
+                std::vector<float> queryData;
+                for (int i = 0; i < numQueries; i++)
+                {
+                    std::vector<float> descriptor = randomDescriptor(options.descriptorSize, binary, random);
+                    queryData.insert(queryData.end(), descriptor.begin(), descriptor.end());
+                }
+                flann::Matrix<float> queries(queryData.data(), numQueries, options.descriptorSize);
+
+                for (int threads : options.threads)
+                {
+                    const int cores = threads > 0 ? threads : omp_get_num_procs();
+                    std::vector<std::vector<int> > indices;
+                    std::vector<std::vector<float> > distances;
+                    results.push_back(measure("index query " + distanceType, describe(0, codebookSize, threads) + " queries=" +
+                                              std::to_string(numQueries), options.repetitions, []() {},
+                                              [&]() { helper->knnSearch(queries, indices, distances, 1, false, cores); }));
+                }
+            }
+        }
+    }
+
+    void benchmarkCastVotes(const Options &options, pcl::PointCloud<PointT>::Ptr scene, int cloudSize, std::vector<Result> &results)
+    {
+        for (int codebookSize : options.codebookSizes)
+        {
+            CodebookFixture fixture(options, codebookSize, ism3d::DistanceEuclidean::getTypeStatic());
+            pcl::PointCloud<ism3d::ISMFeature>::Ptr queries = fixture.createQueries(*scene, std::max(1, cloudSize / 20), options.seed);
+
+            ism3d::ActivationResult activation;
+            fixture.codebook.activateFeatures(queries, fixture.distance.get(), *fixture.flannHelper, false, activation);
+
+            for (int threads : options.threads)
+            {
+                setThreads(threads);
+                ism3d::VotingMeanShift voting;
+                results.push_back(measure("codebook castVotes", describe(cloudSize, codebookSize, threads) + " features=" +
+                                          std::to_string(queries->size()), options.repetitions,
+                                          [&]() { voting.clear(); },
+                                          [&]() { fixture.codebook.castVotes(*queries, activation, voting); }));
+            }
+        }
+    }
+
+    // votes around the objects of the scene, the activation id of a vote is the index of the distribution it
+    // refers to, consecutive votes share their activation as the votes of one activated codeword
+    std::vector<ism3d::Voting::Vote> createVotes(const pcl::PointCloud<PointT> &scene, int numVotes, int numClasses,
+                                                 int numDistributions, unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::uniform_int_distribution<int> pointIndex(0, (int)scene.size() - 1);
+        std::uniform_int_distribution<int> classIndex(0, numClasses - 1);
+        std::uniform_int_distribution<int> distributionIndex(0, numDistributions - 1);
+        std::normal_distribution<float> spread(0.0f, 0.05f);
+        std::uniform_real_distribution<float> weight(0.0f, 1.0f);
+
+        std::vector<ism3d::Voting::Vote> votes(numVotes);
+        for (int i = 0; i < numVotes; i++)
+        {
+            votes[i].position = scene.at(pointIndex(random)).getVector3fMap() +
+                    Eigen::Vector3f(spread(random), spread(random), spread(random));
+            votes[i].weight = weight(random);
+            votes[i].classId = classIndex(random);
+            votes[i].activationId = i % votesPerActivation == 0 ? distributionIndex(random) : votes[i - 1].activationId;
+            votes[i].voteIndex = 0;
+        }
+        return votes;
+    }
+
+    void castVotes(ism3d::Voting &voting, const std::vector<ism3d::Voting::Vote> &votes,
+                   const std::vector<const ism3d::CodewordDistribution*> &distributions)
+    {
+        const boost::math::quaternion<float> identity(1, 0, 0, 0);
+        const std::vector<ism3d::Voting::VoteSlot*> slots = voting.acquireSlots(omp_get_max_threads());
+        #pragma omp parallel for num_threads(slots.size())
+        for (int i = 0; i < (int)votes.size(); i += votesPerActivation)
+        {
+            ism3d::Voting::VoteSlot &slot = *slots[omp_get_thread_num()];
+            unsigned activationId = voting.addActivation(slot, distributions[votes[i].activationId], identity);
+            const int end = std::min(i + votesPerActivation, (int)votes.size());
+            for (int j = i; j < end; j++)
+                voting.vote(slot, votes[j].position, votes[j].weight, votes[j].classId, activationId, votes[j].voteIndex);
+        }
+        voting.releaseSlots(slots);
+    }
+
+    void benchmarkVoting(const Options &options, pcl::PointCloud<PointT>::Ptr scene, int cloudSize,
+                         bool vote, bool maxima, std::vector<Result> &results)
+    {
+        // the maxima search reconstructs the bounding boxes of votes from their distributions
+        CodebookFixture fixture(options, options.codebookSizes.front(), ism3d::DistanceEuclidean::getTypeStatic());
+        std::vector<const ism3d::CodewordDistribution*> distributions;
+        for (const auto &entry : fixture.codebook.getDistribution())
+            distributions.push_back(entry.second.get());
+
+        // about ten votes per point, as with a few hundred codewords per class
+        const int numVotes = cloudSize * 10;
+        std::vector<ism3d::Voting::Vote> votes = createVotes(*scene, numVotes, options.numClasses, (int)distributions.size(), options.seed);
+        pcl::PointCloud<PointT>::ConstPtr points = scene;
+        pcl::PointCloud<pcl::Normal>::ConstPtr normals = computeNormals(scene, options.radius / 2);
+
+        for (int threads : options.threads)
+        {
+            setThreads(threads);
+            const std::string parameters = describe(cloudSize, 0, threads) + " votes=" + std::to_string(numVotes);
+
+            if (vote)
+            {
+                ism3d::VotingMeanShift voting;
+                results.push_back(measure("voting vote", parameters, options.repetitions,
+                                          [&]() { voting.clear(); }, [&]() { castVotes(voting, votes, distributions); }));
+            }
+
+            if (maxima)
+            {
+                ism3d::VotingMeanShift meanShift;
+                results.push_back(measure("maxima MeanShift", parameters, options.repetitions,
+                                          [&]() { meanShift.clear(); castVotes(meanShift, votes, distributions); },
+                                          [&]() { meanShift.findMaxima(points, normals); }));
+
+                ism3d::VotingHough3D hough;
+                results.push_back(measure("maxima Hough3D", parameters, options.repetitions,
+                                          [&]() { hough.clear(); castVotes(hough, votes, distributions); },
+                                          [&]() { hough.findMaxima(points, normals); }));
+            }
+        }
+    }
+
+    // vote throughput from 1 to 64 threads, independent of the thread option; a run casts the votes into the slots
+    // and merges them once, as before the search for maxima. Thread counts above the number of cores oversubscribe.
+    void benchmarkVoteScaling(const Options &options, pcl::PointCloud<PointT>::Ptr scene, int cloudSize,
+                              std::vector<Result> &results)
+    {
+        CodebookFixture fixture(options, options.codebookSizes.front(), ism3d::DistanceEuclidean::getTypeStatic());
+        std::vector<const ism3d::CodewordDistribution*> distributions;
+        for (const auto &entry : fixture.codebook.getDistribution())
+            distributions.push_back(entry.second.get());
+
+        const int numVotes = cloudSize * 10;
+        std::vector<ism3d::Voting::Vote> votes = createVotes(*scene, numVotes, options.numClasses, (int)distributions.size(), options.seed);
+
+        double serialMs = 0;
+        for (int threads = 1; threads <= 64; threads *= 2)
+        {
+            setThreads(threads);
+            ism3d::VotingMeanShift voting;
+            results.push_back(measure("vote scaling", describe(cloudSize, 0, threads) + " votes=" + std::to_string(numVotes),
+                                      options.repetitions, [&]() { voting.clear(); },
+                                      [&]() { castVotes(voting, votes, distributions); voting.mergeVotes(); }));
+
+            const double meanMs = results.back().meanMs;
+            if (threads == 1)
+                serialMs = meanMs;
+            std::cout << std::setw(72) << "" << std::setw(12) << numVotes / meanMs / 1000 << " Mvotes/s (speedup " <<
+                         serialMs / meanMs << ")" << std::endl;
+        }
+    }
+
+    void benchmarkMVBB(const Options &options, pcl::PointCloud<PointT>::Ptr scene, int cloudSize, std::vector<Result> &results)
+    {
+        pcl::PointCloud<PointT>::ConstPtr points = scene;
+        results.push_back(measure("computeMVBB", describe(cloudSize, 0, 1), options.repetitions, []() {},
+                                  [&]() { ism3d::Utils::computeMVBB<PointT>(points); }));
+    }
+
+    void benchmarkLoad(const Options &options, std::vector<Result> &results)
+    {
+        std::unique_ptr<ism3d::ImplicitShapeModel> ism;
+        results.push_back(measure("model load", options.modelFile, options.repetitions,
+                                  [&]()
+        {
+            ism.reset(new ism3d::ImplicitShapeModel());
+            ism->setLogging(false);
+        },
+                                  [&]()
+        {
+            if (!ism->readObject(options.modelFile))
+                throw std::runtime_error("could not read model " + options.modelFile);
+        }));
+    }
+}
+
+// measures the hot paths of the detection on reproducible synthetic data or given files, for comparisons between
+// versions of the dependencies and configurations
+int main(int argc, char **argv)
+{
+    boost::program_options::options_description desc("Options");
+    desc.add_options()
+            ("help,h", "Display this help message")
+            ("benchmarks,b", boost::program_options::value<std::string>()->default_value("descriptors,index,castvotes,vote,maxima,mvbb,load"),
+             "Comma separated benchmarks: descriptors, index, castvotes, vote, votescaling, maxima, mvbb, load")
+            ("points,p", boost::program_options::value<std::string>()->default_value("10000,100000"), "Comma separated sizes of the synthetic scene")
+            ("codewords,w", boost::program_options::value<std::string>()->default_value("1000,10000"), "Comma separated codebook sizes")
+            ("threads,t", boost::program_options::value<std::string>()->default_value("1,0"), "Comma separated numbers of threads (0: all cores)")
+            ("features,f", boost::program_options::value<std::string>()->default_value("SHOT,SHORT_SHOT,FPFH"), "Comma separated descriptor types")
+            ("distances,d", boost::program_options::value<std::string>()->default_value("Euclidean,ChiSquared,Hellinger,Hamming"),
+             "Comma separated distance types of the index")
+            ("cloud,c", boost::program_options::value<std::string>(), "Point cloud (pcd) used instead of the synthetic scene")
+            ("model,m", boost::program_options::value<std::string>(), "Trained model (ism) for the load benchmark")
+            ("dim", boost::program_options::value<int>()->default_value(352), "Descriptor size of the synthetic codebooks")
+            ("classes", boost::program_options::value<int>()->default_value(4), "Number of classes of the synthetic codebooks")
+            ("radius,r", boost::program_options::value<float>()->default_value(0.1f), "Descriptor and reference frame radius")
+            ("leaf,l", boost::program_options::value<float>()->default_value(0.02f), "Voxel grid leaf size for the keypoints")
+            ("repetitions,n", boost::program_options::value<int>()->default_value(5), "Number of timed repetitions")
+            ("seed,s", boost::program_options::value<unsigned>()->default_value(42), "Seed of the synthetic data")
+            ("csv", boost::program_options::value<std::string>(), "Write the results to this csv file");
+
+    boost::program_options::variables_map variables;
+    boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), variables);
+    boost::program_options::notify(variables);
+
+    if (variables.count("help"))
+    {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    Options options;
+    options.cloudSizes = parseList<int>(variables["points"].as<std::string>());
+    options.codebookSizes = parseList<int>(variables["codewords"].as<std::string>());
+    options.threads = parseList<int>(variables["threads"].as<std::string>());
+    options.features = parseList<std::string>(variables["features"].as<std::string>());
+    options.distances = parseList<std::string>(variables["distances"].as<std::string>());
+    std::vector<std::string> benchmarks = parseList<std::string>(variables["benchmarks"].as<std::string>());
+    options.benchmarks.insert(benchmarks.begin(), benchmarks.end());
+    options.cloudFile = variables.count("cloud") ? variables["cloud"].as<std::string>() : "";
+    options.modelFile = variables.count("model") ? variables["model"].as<std::string>() : "";
+    options.descriptorSize = std::max(1, variables["dim"].as<int>());
+    options.numClasses = std::max(1, variables["classes"].as<int>());
+    options.radius = variables["radius"].as<float>();
+    options.leaf = variables["leaf"].as<float>();
+    options.repetitions = std::max(1, variables["repetitions"].as<int>());
+    options.seed = variables["seed"].as<unsigned>();
+
+    // a given point cloud replaces the synthetic scenes of all sizes
+    std::vector<std::pair<int, pcl::PointCloud<PointT>::Ptr> > scenes;
+    if (!options.cloudFile.empty())
+    {
+        pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+        if (pcl::io::loadPCDFile(options.cloudFile, *cloud) < 0)
+            return 1;
+        std::vector<int> dummy;
+        pcl::removeNaNFromPointCloud(*cloud, *cloud, dummy);
+        scenes.push_back({(int)cloud->size(), cloud});
+    }
+    else
+    {
+        for (int cloudSize : options.cloudSizes)
+            scenes.push_back({cloudSize, createScene(cloudSize, options.seed)});
+    }
+
+    std::vector<Result> results;
+    try
+    {
+        if (options.benchmarks.count("index"))
+            benchmarkIndex(options, results);
+
+        for (const std::pair<int, pcl::PointCloud<PointT>::Ptr> &scene : scenes)
+        {
+            if (options.benchmarks.count("descriptors"))
+                benchmarkDescriptors(options, scene.second, scene.first, results);
+            if (options.benchmarks.count("castvotes"))
+                benchmarkCastVotes(options, scene.second, scene.first, results);
+            if (options.benchmarks.count("vote") || options.benchmarks.count("maxima"))
+                benchmarkVoting(options, scene.second, scene.first, options.benchmarks.count("vote") > 0,
+                                options.benchmarks.count("maxima") > 0, results);
+            if (options.benchmarks.count("votescaling"))
+                benchmarkVoteScaling(options, scene.second, scene.first, results);
+            if (options.benchmarks.count("mvbb"))
+                benchmarkMVBB(options, scene.second, scene.first, results);
+        }
+
+        if (options.benchmarks.count("load"))
+        {
+            if (options.modelFile.empty())
+                std::cout << "no model given, skipping the load benchmark" << std::endl;
+            else
+                benchmarkLoad(options, results);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (variables.count("csv"))
+    {
+        std::ofstream csv(variables["csv"].as<std::string>().c_str());
+        csv << "benchmark,parameters,mean_ms,min_ms,max_ms\n";
+        for (const Result &result : results)
+            csv << result.name << "," << result.parameters << "," << result.meanMs << "," << result.minMs << "," <<
+                   result.maxMs << "\n";
+    }
+    return 0;
+}
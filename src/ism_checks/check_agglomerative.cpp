@@ -0,0 +1,110 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "checks.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../implicit_shape_model/clustering/clustering_agglomerative.h"
+#include "../implicit_shape_model/utils/distance.h"
+#include "../implicit_shape_model/utils/ism_feature.h"
+
+namespace ism3d_checks
+{
+    namespace
+    {
+        // labels each feature with the smallest feature index of its cluster, so that partitions can be compared
+        // independently of the order of the clusters
+        std::vector<int> canonicalLabels(const std::vector<int> &indices)
+        {
+            std::vector<int> first;
+            std::vector<int> labels(indices.size());
+            for (int i = 0; i < (int)indices.size(); i++)
+            {
+                if (indices[i] >= (int)first.size())
+                    first.resize(indices[i] + 1, -1);
+                if (first[indices[i]] < 0)
+                    first[indices[i]] = i;
+                labels[i] = first[indices[i]];
+            }
+            return labels;
+        }
+
+        std::vector<int> clusterFeatures(pcl::PointCloud<ism3d::ISMFeature>::ConstPtr features,
+                                         const std::string &method, float threshold, int &numClusters)
+        {
+            ism3d::ClusteringAgglomerative clustering;
+            Json::Value config = clustering.configToJson();
+            config["Parameters"]["Method"] = method;
+            config["Parameters"]["Threshold"] = threshold;
+            clustering.configFromJson(config);
+
+            ism3d::DistanceEuclidean distance;
+            const std::vector<int> &indices = clustering(features, &distance);
+            numClusters = (int)clustering.getClusterCenters().size();
+            return canonicalLabels(indices);
+        }
+    }
+
+    bool checkAgglomerative()
+    {
+        const int numFeatures = 300;
+        const int numBlobs = 30;
+        const int dim = 16;
+
+        // blobs of different spread, so that the thresholds cut the dendrogram at different levels
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<std::vector<float> > centers(numBlobs, std::vector<float>(dim));
+        std::vector<float> spreads(numBlobs);
+        for (int blob = 0; blob < numBlobs; blob++)
+        {
+            for (float &value : centers[blob])
+                value = unit(random);
+            spreads[blob] = 0.02f + 0.1f * unit(random);
+        }
+
+        pcl::PointCloud<ism3d::ISMFeature>::Ptr features(new pcl::PointCloud<ism3d::ISMFeature>());
+        for (int i = 0; i < numFeatures; i++)
+        {
+            const int blob = i % numBlobs;
+            std::normal_distribution<float> noise(0.0f, spreads[blob]);
+            ism3d::ISMFeature feature;
+            feature.descriptor.resize(dim);
+            for (int d = 0; d < dim; d++)
+                feature.descriptor[d] = centers[blob][d] + noise(random);
+            features->push_back(feature);
+        }
+
+        // similarity thresholds, the inverse of the largest average squared distance of merged clusters
+        const float thresholds[] = {0.3f, 1.0f, 3.0f, 10.0f, 30.0f, 100.0f};
+
+        bool passed = true;
+        for (float threshold : thresholds)
+        {
+            int numGreedy, numNNChain;
+            const std::vector<int> greedy = clusterFeatures(features, "Greedy", threshold, numGreedy);
+            const std::vector<int> nnChain = clusterFeatures(features, "NNChain", threshold, numNNChain);
+
+            int numDifferent = 0;
+            for (int i = 0; i < numFeatures; i++)
+                numDifferent += greedy[i] != nnChain[i] ? 1 : 0;
+
+            std::cout << "  threshold " << threshold << ": " << numGreedy << " clusters with Greedy, " << numNNChain <<
+                         " with NNChain, " << numDifferent << " features in different clusters: " <<
+                         (numDifferent == 0 ? "ok" : "FAILED") << std::endl;
+            passed = passed && numDifferent == 0;
+        }
+        return passed;
+    }
+}
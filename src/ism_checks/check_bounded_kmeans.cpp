@@ -0,0 +1,131 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "checks.h"
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+#include <boost/timer/timer.hpp>
+
+#include "../implicit_shape_model/clustering/bounded_kmeans.h"
+#include "../implicit_shape_model/utils/distance.h"
+#include "../implicit_shape_model/utils/feature_block.h"
+
+namespace ism3d_checks
+{
+    namespace
+    {
+        // Lloyd's algorithm, all distances in every iteration, starting from the given centers and assignment
+        int lloyd(const ism3d::FeatureBlock &block, int k, std::vector<float> &centers, std::vector<int> &indices)
+        {
+            const int numFeatures = block.size();
+            const int dim = block.dim();
+            ism3d::DistanceEuclidean distance;
+
+            int iteration = 0;
+            while (true)
+            {
+                // an empty cluster keeps its center
+                std::vector<double> sums((size_t)k * dim, 0);
+                std::vector<int> counts(k, 0);
+                for (int i = 0; i < numFeatures; i++)
+                {
+                    for (int j = 0; j < dim; j++)
+                        sums[(size_t)indices[i] * dim + j] += block.descriptor(i)[j];
+                    counts[indices[i]]++;
+                }
+                for (int c = 0; c < k; c++)
+                {
+                    if (counts[c] > 0)
+                        for (int j = 0; j < dim; j++)
+                            centers[(size_t)c * dim + j] = sums[(size_t)c * dim + j] / counts[c];
+                }
+
+                int changed = 0;
+                #pragma omp parallel for reduction(+:changed)
+                for (int i = 0; i < numFeatures; i++)
+                {
+                    int closest = 0;
+                    float closestDist = std::numeric_limits<float>::max();
+                    for (int c = 0; c < k; c++)
+                    {
+                        const float dist = distance(block.descriptor(i), centers.data() + (size_t)c * dim, dim);
+                        if (dist < closestDist)
+                        {
+                            closestDist = dist;
+                            closest = c;
+                        }
+                    }
+                    if (closest != indices[i])
+                    {
+                        indices[i] = closest;
+                        changed++;
+                    }
+                }
+
+                iteration++;
+                if (changed == 0)
+                    return iteration;
+            }
+        }
+    }
+
+    bool checkBoundedKMeans()
+    {
+        const int numFeatures = 20000;
+        const int dim = 32;
+        const int numBlobs = 50;
+        const int k = 200;
+        const unsigned seed = 3;
+
+        // overlapping blobs, so that many features change their cluster in the first iterations
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 10.0f);
+        std::normal_distribution<float> noise(0.0f, 1.0f);
+        std::vector<float> blobCenters(numBlobs * dim);
+        for (float &value : blobCenters)
+            value = unit(random);
+
+        ism3d::FeatureBlock block(numFeatures, dim);
+        for (int i = 0; i < numFeatures; i++)
+        {
+            const int blob = i % numBlobs;
+            for (int j = 0; j < dim; j++)
+                block.descriptor(i)[j] = blobCenters[blob * dim + j] + noise(random);
+        }
+
+        // the bounded version, it logs the number of distances it computed
+        std::vector<float> centers;
+        std::vector<int> indices;
+        boost::timer::cpu_timer boundedTimer;
+        ism3d::BoundedKMeans(1000, flann::FLANN_CENTERS_KMEANSPP, seed).cluster(block, k, centers, indices);
+        const double boundedMs = boundedTimer.elapsed().wall / 1e6;
+
+        // no iterations: the same seeds and their assignment
+        std::vector<float> lloydCenters;
+        std::vector<int> lloydIndices;
+        ism3d::BoundedKMeans(0, flann::FLANN_CENTERS_KMEANSPP, seed).cluster(block, k, lloydCenters, lloydIndices);
+        boost::timer::cpu_timer lloydTimer;
+        const int iterations = lloyd(block, k, lloydCenters, lloydIndices);
+        const double lloydMs = lloydTimer.elapsed().wall / 1e6;
+
+        int numDifferent = 0;
+        for (int i = 0; i < numFeatures; i++)
+            numDifferent += indices[i] != lloydIndices[i] ? 1 : 0;
+
+        std::cout << "  " << numFeatures << " features, k=" << k << ": Lloyd converged after " << iterations <<
+                     " iterations with " << (long long)numFeatures * k * (iterations + 1) << " distances in " << lloydMs <<
+                     " ms, bounded in " << boundedMs << " ms, " << numDifferent << " features assigned differently: " <<
+                     (numDifferent == 0 ? "ok" : "FAILED") << std::endl;
+        return numDifferent == 0;
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "checks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "../implicit_shape_model/voting/sparse_hough_space_3d.h"
+
+namespace ism3d_checks
+{
+    bool checkHoughSpace()
+    {
+        const int numVotes = 300000;
+        const int threadCounts[] = {1, 8};
+
+        // votes around the origin, denser in the center, the outer votes fall outside of the voting space
+        std::mt19937 random(42);
+        std::normal_distribution<float> position(0.0f, 1.5f);
+        std::uniform_real_distribution<float> weight(0.0f, 1.0f);
+        std::vector<float> x(numVotes), y(numVotes), z(numVotes), weights(numVotes);
+        for (int i = 0; i < numVotes; i++)
+        {
+            x[i] = position(random);
+            y[i] = position(random);
+            z[i] = position(random);
+            weights[i] = weight(random);
+        }
+
+        const Eigen::Vector3d minCoord(-4, -4, -4);
+        const Eigen::Vector3d binSize(0.2, 0.2, 0.2);
+        const Eigen::Vector3d maxCoord(4, 4, 4);
+
+        bool passed = true;
+        for (int interpolate = 0; interpolate < 2; interpolate++)
+        {
+            ism3d::SparseHoughSpace3D serial;
+            serial.reset(minCoord, binSize, maxCoord);
+            for (int i = 0; i < numVotes; i++)
+            {
+                const Eigen::Vector3d vote(x[i], y[i], z[i]);
+                if (interpolate)
+                    serial.voteInt(vote, weights[i], i);
+                else
+                    serial.vote(vote, weights[i], i);
+            }
+
+            // all local maxima, with their voters and with their bins
+            std::vector<double> serialMaxima;
+            std::vector<std::vector<int> > serialVoters;
+            std::vector<Eigen::Vector3i> serialBins;
+            serial.findMaxima(0, serialMaxima, serialVoters);
+            serial.findMaxima(0, serialMaxima, serialBins);
+
+            for (int threads : threadCounts)
+            {
+                ism3d::SparseHoughSpace3D parallel;
+                parallel.reset(minCoord, binSize, maxCoord);
+                parallel.voteParallel(x.data(), y.data(), z.data(), weights.data(), numVotes, interpolate != 0, threads);
+
+                std::vector<double> maxima;
+                std::vector<std::vector<int> > voters;
+                std::vector<Eigen::Vector3i> bins;
+                parallel.findMaxima(0, maxima, voters);
+                parallel.findMaxima(0, maxima, bins);
+
+                // the interpolation weights of the parallel votes are computed in single precision
+                bool same = parallel.getNumBins() == serial.getNumBins() && maxima.size() == serialMaxima.size() &&
+                        voters == serialVoters && bins == serialBins;
+                double maxDifference = 0;
+                for (size_t i = 0; same && i < maxima.size(); i++)
+                    maxDifference = std::max(maxDifference, std::fabs(maxima[i] - serialMaxima[i]) /
+                                                            std::max(1.0, std::fabs(serialMaxima[i])));
+                same = same && maxDifference <= 1e-5;
+
+                std::cout << "  " << (interpolate ? "interpolated" : "nearest bin") << ", " << threads << " threads: " <<
+                             parallel.getNumBins() << " bins (serial " << serial.getNumBins() << "), " << maxima.size() <<
+                             " maxima (serial " << serialMaxima.size() << "), max relative difference " <<
+                             maxDifference << ": " << (same ? "ok" : "FAILED") << std::endl;
+                passed = passed && same;
+            }
+        }
+        return passed;
+    }
+}
@@ -0,0 +1,138 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "checks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define PCL_NO_PRECOMPILE
+#include <pcl/features/fpfh.h>
+#include <pcl/features/pfh.h>
+#include <pcl/search/kdtree.h>
+
+#include "../implicit_shape_model/utils/point_feature_histograms.h"
+
+using ism3d::PointT;
+
+namespace ism3d_checks
+{
+    namespace
+    {
+        // the largest difference of two descriptor lists, the bins are percentages; NaN descriptors have to match
+        bool compareDescriptors(const std::string &name, const std::vector<float> &descriptors,
+                                const std::vector<float> &expected)
+        {
+            bool same = descriptors.size() == expected.size();
+            float maxDifference = 0;
+            int numNaN = 0;
+            for (size_t i = 0; same && i < descriptors.size(); i++)
+            {
+                if (std::isnan(descriptors[i]) || std::isnan(expected[i]))
+                {
+                    same = std::isnan(descriptors[i]) && std::isnan(expected[i]);
+                    numNaN++;
+                    continue;
+                }
+                maxDifference = std::max(maxDifference, std::fabs(descriptors[i] - expected[i]));
+            }
+            same = same && maxDifference <= 1e-4f;
+
+            std::cout << "  " << name << ": max bin difference " << maxDifference << ", " << numNaN <<
+                         " NaN bins: " << (same ? "ok" : "FAILED") << std::endl;
+            return same;
+        }
+
+        template<typename Signature, typename Estimator>
+        void computeReference(Estimator &estimator, pcl::PointCloud<PointT>::ConstPtr surface,
+                              pcl::PointCloud<pcl::Normal>::ConstPtr normals, pcl::PointCloud<PointT>::ConstPtr keypoints,
+                              pcl::search::Search<PointT>::Ptr search, float radius, std::vector<float> &descriptors)
+        {
+            estimator.setInputCloud(keypoints);
+            estimator.setSearchSurface(surface);
+            estimator.setInputNormals(normals);
+            estimator.setSearchMethod(search);
+            estimator.setRadiusSearch(radius);
+
+            pcl::PointCloud<Signature> signatures;
+            estimator.compute(signatures);
+
+            const int size = (int)(sizeof(signatures.points[0].histogram) / sizeof(float));
+            descriptors.clear();
+            for (const Signature &signature : signatures.points)
+                descriptors.insert(descriptors.end(), signature.histogram, signature.histogram + size);
+        }
+    }
+
+    bool checkPointFeatureHistograms()
+    {
+        const int numPoints = 3000;
+        const int numKeypoints = 200;
+        const float radius = 0.25f;
+
+        // a unit sphere with noisy normals and one duplicate point, for which PCL's pair features fail
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_real_distribution<float> noise(-0.1f, 0.1f);
+        pcl::PointCloud<PointT>::Ptr surface(new pcl::PointCloud<PointT>());
+        pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>());
+        for (int i = 0; i < numPoints; i++)
+        {
+            const float azimuth = unit(random) * 2 * M_PI;
+            const float inclination = std::acos(1 - 2 * unit(random));
+            PointT point;
+            point.getVector3fMap() = Eigen::Vector3f(std::cos(azimuth) * std::sin(inclination),
+                                                     std::sin(azimuth) * std::sin(inclination), std::cos(inclination));
+            surface->push_back(point);
+
+            pcl::Normal normal;
+            normal.getNormalVector3fMap() = (point.getVector3fMap() +
+                                             Eigen::Vector3f(noise(random), noise(random), noise(random))).normalized();
+            normals->push_back(normal);
+        }
+        surface->push_back(surface->points[5]);
+        normals->push_back(normals->points[7]);
+
+        // keypoints next to the surface and one without neighbors, whose descriptor is NaN
+        pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
+        for (int i = 0; i < numKeypoints; i++)
+        {
+            PointT keypoint = surface->points[i * (numPoints / numKeypoints)];
+            keypoint.x += 0.01f;
+            keypoints->push_back(keypoint);
+        }
+        PointT far = keypoints->points[0];
+        far.getVector3fMap() = Eigen::Vector3f(10, 0, 0);
+        keypoints->push_back(far);
+
+        // the same search for both, so that the neighbors are visited in the same order
+        pcl::search::Search<PointT>::Ptr search(new pcl::search::KdTree<PointT>());
+        search->setInputCloud(surface);
+        ism3d::PointFeatureHistograms histograms(*surface, *normals, *search, radius, 4);
+
+        std::vector<float> pfh, expectedPFH;
+        histograms.computePFH(*keypoints, pfh);
+        pcl::PFHEstimation<PointT, pcl::Normal, pcl::PFHSignature125> pfhEst;
+        computeReference<pcl::PFHSignature125>(pfhEst, surface, normals, keypoints, search, radius, expectedPFH);
+
+        std::vector<float> fpfh, expectedFPFH;
+        histograms.computeFPFH(*keypoints, fpfh);
+        pcl::FPFHEstimation<PointT, pcl::Normal, pcl::FPFHSignature33> fpfhEst;
+        computeReference<pcl::FPFHSignature33>(fpfhEst, surface, normals, keypoints, search, radius, expectedFPFH);
+
+        const bool samePFH = compareDescriptors("PFH", pfh, expectedPFH);
+        const bool sameFPFH = compareDescriptors("FPFH", fpfh, expectedFPFH);
+        return samePFH && sameFPFH;
+    }
+}
@@ -0,0 +1,244 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include "checks.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <Eigen/Geometry>
+
+#include "../implicit_shape_model/utils/shot_kernels.h"
+
+namespace ism3d_checks
+{
+    namespace
+    {
+        const double Rad45 = 0.78539816339744830961566084581988;
+        const double Rad90 = 1.5707963267948966192313216916398;
+        const double Rad135 = 2.3561944901923449288469825374596;
+        const double RadPi78 = 2.7488935718910690836548129603691;
+
+        // the per-neighbor loop of FeaturesSHORTCSHOT::interpolateDoubleChannel before the ShotKernels, reduced
+        // to one channel, the spatial weights of the shape and color channel are the same
+        void interpolateReference(const std::vector<float> &x, const std::vector<float> &y, const std::vector<float> &z,
+                                  const std::vector<float> &sqr_dists, const float *frame, double radius,
+                                  const std::vector<double> &bin_distances, int nr_bins, std::vector<float> &shot)
+        {
+            const double radius1_4 = radius / 4;
+            const double radius1_2 = radius / 2;
+            const double radius3_4 = (radius * 3) / 4;
+            const int maxAngularSectors = 32;
+
+            for (size_t i_idx = 0; i_idx < x.size(); ++i_idx)
+            {
+                double binDistance = bin_distances[i_idx];
+
+                double distance = std::sqrt(sqr_dists[i_idx]);
+                if (std::fabs(distance) <= 1e-15)
+                    continue;
+
+                // the projection was computed in single precision
+                double xInFeatRef = x[i_idx] * frame[0] + y[i_idx] * frame[1] + z[i_idx] * frame[2];
+                double yInFeatRef = x[i_idx] * frame[3] + y[i_idx] * frame[4] + z[i_idx] * frame[5];
+                double zInFeatRef = x[i_idx] * frame[6] + y[i_idx] * frame[7] + z[i_idx] * frame[8];
+
+                if (std::fabs(yInFeatRef) < 1E-30)
+                    yInFeatRef = 0;
+                if (std::fabs(xInFeatRef) < 1E-30)
+                    xInFeatRef = 0;
+                if (std::fabs(zInFeatRef) < 1E-30)
+                    zInFeatRef = 0;
+
+                unsigned char bit4 = ((yInFeatRef > 0) || ((yInFeatRef == 0.0) && (xInFeatRef < 0))) ? 1 : 0;
+                unsigned char bit3 = static_cast<unsigned char>(((xInFeatRef > 0) || ((xInFeatRef == 0.0) && (yInFeatRef > 0))) ? !bit4 : bit4);
+
+                int desc_index = (bit4 << 3) + (bit3 << 2);
+                desc_index = desc_index << 1;
+
+                if ((xInFeatRef * yInFeatRef > 0) || (xInFeatRef == 0.0))
+                    desc_index += (std::fabs(xInFeatRef) >= std::fabs(yInFeatRef)) ? 0 : 4;
+                else
+                    desc_index += (std::fabs(xInFeatRef) > std::fabs(yInFeatRef)) ? 4 : 0;
+
+                desc_index += zInFeatRef > 0 ? 1 : 0;
+                desc_index += (distance > radius1_2) ? 2 : 0;
+
+                int step_index = static_cast<int>(std::floor(binDistance + 0.5));
+                int volume_index = desc_index * (nr_bins + 1);
+
+                binDistance -= step_index;
+                double intWeight = (1 - std::fabs(binDistance));
+
+                if (binDistance > 0)
+                    shot[volume_index + ((step_index + 1) % nr_bins)] += static_cast<float>(binDistance);
+                else
+                    shot[volume_index + ((step_index - 1 + nr_bins) % nr_bins)] -= static_cast<float>(binDistance);
+
+                if (distance > radius1_2)
+                {
+                    double radiusDistance = (distance - radius3_4) / radius1_2;
+                    if (distance > radius3_4)
+                    {
+                        intWeight += 1 - radiusDistance;
+                    }
+                    else
+                    {
+                        intWeight += 1 + radiusDistance;
+                        shot[(desc_index - 2) * (nr_bins + 1) + step_index] -= static_cast<float>(radiusDistance);
+                    }
+                }
+                else
+                {
+                    double radiusDistance = (distance - radius1_4) / radius1_2;
+                    if (distance < radius1_4)
+                    {
+                        intWeight += 1 + radiusDistance;
+                    }
+                    else
+                    {
+                        intWeight += 1 - radiusDistance;
+                        shot[(desc_index + 2) * (nr_bins + 1) + step_index] += static_cast<float>(radiusDistance);
+                    }
+                }
+
+                double inclinationCos = zInFeatRef / distance;
+                inclinationCos = std::max(-1.0, std::min(inclinationCos, 1.0));
+                double inclination = std::acos(inclinationCos);
+
+                if (inclination > Rad90 || (std::fabs(inclination - Rad90) < 1e-30 && zInFeatRef <= 0))
+                {
+                    double inclinationDistance = (inclination - Rad135) / Rad90;
+                    if (inclination > Rad135)
+                    {
+                        intWeight += 1 - inclinationDistance;
+                    }
+                    else
+                    {
+                        intWeight += 1 + inclinationDistance;
+                        shot[(desc_index + 1) * (nr_bins + 1) + step_index] -= static_cast<float>(inclinationDistance);
+                    }
+                }
+                else
+                {
+                    double inclinationDistance = (inclination - Rad45) / Rad90;
+                    if (inclination < Rad45)
+                    {
+                        intWeight += 1 + inclinationDistance;
+                    }
+                    else
+                    {
+                        intWeight += 1 - inclinationDistance;
+                        shot[(desc_index - 1) * (nr_bins + 1) + step_index] += static_cast<float>(inclinationDistance);
+                    }
+                }
+
+                if (yInFeatRef != 0.0 || xInFeatRef != 0.0)
+                {
+                    double azimuth = std::atan2(yInFeatRef, xInFeatRef);
+                    int sel = desc_index >> 2;
+                    double azimuthDistance = (azimuth - (-RadPi78 + Rad45 * sel)) / Rad45;
+                    azimuthDistance = std::max(-0.5, std::min(azimuthDistance, 0.5));
+
+                    if (azimuthDistance > 0)
+                    {
+                        intWeight += 1 - azimuthDistance;
+                        int interp_index = (desc_index + 4) % maxAngularSectors;
+                        shot[interp_index * (nr_bins + 1) + step_index] += static_cast<float>(azimuthDistance);
+                    }
+                    else
+                    {
+                        int interp_index = (desc_index - 4 + maxAngularSectors) % maxAngularSectors;
+                        intWeight += 1 + azimuthDistance;
+                        shot[interp_index * (nr_bins + 1) + step_index] -= static_cast<float>(azimuthDistance);
+                    }
+                }
+
+                shot[volume_index + step_index] += static_cast<float>(intWeight);
+            }
+        }
+    }
+
+    bool checkShotKernels()
+    {
+        const int numKeypoints = 200;
+        const float radius = 0.1f;
+        const int numBins[] = {10, 30};
+        // relative to the bin value, bins sum the votes of up to 300 neighbors
+        const float tolerance = 1e-5f;
+
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::uniform_int_distribution<int> numNeighbors(1, 300);
+
+        float maxDifference = 0;
+        for (int keypoint = 0; keypoint < numKeypoints; keypoint++)
+        {
+            const Eigen::Matrix3f rotation = Eigen::Quaternionf(unit(random), unit(random), unit(random), unit(random))
+                    .normalized().toRotationMatrix();
+            float frame[9];
+            for (int axis = 0; axis < 3; axis++)
+                for (int d = 0; d < 3; d++)
+                    frame[axis * 3 + d] = rotation(d, axis);
+
+            // neighbors inside the support, including one on the keypoint, which does not vote
+            const int n = numNeighbors(random);
+            std::vector<float> x(n), y(n), z(n), sqrDists(n);
+            for (int i = 0; i < n; i++)
+            {
+                Eigen::Vector3f position;
+                do
+                {
+                    position = Eigen::Vector3f(unit(random), unit(random), unit(random));
+                } while (position.norm() > 1.0f);
+                if (i == 0)
+                    position.setZero();
+                position *= radius;
+
+                x[i] = position[0];
+                y[i] = position[1];
+                z[i] = position[2];
+                sqrDists[i] = position.squaredNorm();
+            }
+
+            ism3d::ShotBins bins;
+            ism3d::ShotKernels::computeVolumes(x.data(), y.data(), z.data(), sqrDists.data(), n, frame, radius, bins);
+
+            for (int channel = 0; channel < 2; channel++)
+            {
+                // the shape channel has a constant bin distance, the color channel one in [0, bins]
+                const int nrBins = numBins[channel];
+                std::vector<double> binDistances(n, 5.0);
+                if (channel == 1)
+                    for (int i = 0; i < n; i++)
+                        binDistances[i] = (unit(random) + 1.0f) / 2.0f * nrBins;
+
+                std::vector<float> expected(32 * (nrBins + 1), 0.0f);
+                interpolateReference(x, y, z, sqrDists, frame, radius, binDistances, nrBins, expected);
+
+                std::vector<float> binDistancesFloat(binDistances.begin(), binDistances.end());
+                std::vector<float> histograms(32 * (nrBins + 1), 0.0f);
+                ism3d::ShotKernels::accumulate(bins, binDistancesFloat.data(), nrBins, histograms.data());
+
+                for (size_t bin = 0; bin < histograms.size(); bin++)
+                    maxDifference = std::max(maxDifference, std::fabs(histograms[bin] - expected[bin]) /
+                                                            std::max(1.0f, std::fabs(expected[bin])));
+            }
+        }
+
+        const bool passed = maxDifference <= tolerance;
+        std::cout << "  " << ism3d::ShotKernels::getInstructionSet() << " kernel, " << numKeypoints <<
+                     " keypoints, max relative bin difference " << maxDifference << " (tolerance " << tolerance << "): " <<
+                     (passed ? "ok" : "FAILED") << std::endl;
+        return passed;
+    }
+}
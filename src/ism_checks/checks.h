@@ -0,0 +1,35 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#ifndef ISM3D_CHECKS_H
+#define ISM3D_CHECKS_H
+
+namespace ism3d_checks
+{
+    // each check compares an optimized implementation to the code it replaced, prints its result and returns
+    // false on a mismatch
+
+    // SHORT_CSHOT: ShotKernels against the previous per-neighbor interpolation
+    bool checkShotKernels();
+
+    // agglomerative clustering: the NNChain method against the Greedy method
+    bool checkAgglomerative();
+
+    // k-means: BoundedKMeans against Lloyd's algorithm from the same seeds
+    bool checkBoundedKMeans();
+
+    // Hough voting: SparseHoughSpace3D::voteParallel against serial votes
+    bool checkHoughSpace();
+
+    // PFH and FPFH: PointFeatureHistograms against the estimators of PCL
+    bool checkPointFeatureHistograms();
+}
+
+#endif // ISM3D_CHECKS_H
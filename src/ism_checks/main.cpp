@@ -0,0 +1,65 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <string>
+
+#include "checks.h"
+
+bool write_log_to_files = false;
+bool log_info = false;
+
+namespace
+{
+    struct Check
+    {
+        const char *name;
+        bool (*run)();
+    };
+
+    const Check checks[] = {
+        {"shot_kernels", ism3d_checks::checkShotKernels},
+        {"agglomerative", ism3d_checks::checkAgglomerative},
+        {"bounded_kmeans", ism3d_checks::checkBoundedKMeans},
+        {"hough_space", ism3d_checks::checkHoughSpace},
+        {"point_feature_histograms", ism3d_checks::checkPointFeatureHistograms},
+    };
+}
+
+// runs the checks given on the command line, or all checks, the exit code is non-zero if one of them fails
+int main(int argc, char **argv)
+{
+    bool passed = true;
+    int numRun = 0;
+    for (const Check &check : checks)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected = selected || check.name == std::string(argv[i]);
+        if (!selected)
+            continue;
+
+        std::cout << "[" << check.name << "]" << std::endl;
+        passed = check.run() && passed;
+        numRun++;
+    }
+
+    if (numRun == 0)
+    {
+        std::cerr << "usage: " << argv[0] << " [check...], checks:";
+        for (const Check &check : checks)
+            std::cerr << " " << check.name;
+        std::cerr << std::endl;
+        return 1;
+    }
+
+    std::cout << (passed ? "all checks passed" : "checks FAILED") << std::endl;
+    return passed ? 0 : 1;
+}
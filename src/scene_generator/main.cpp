@@ -0,0 +1,453 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/common/centroid.h>
+#include <pcl/common/point_tests.h>
+
+#include "../implicit_shape_model/utils/point_cloud_loader.h"
+#include "../implicit_shape_model/utils/utils.h"
+
+bool write_log_to_files = false;
+bool log_info = false;
+
+using ism3d::PointT;
+using ism3d::PointNormalT;
+
+namespace
+{
+    struct Options
+    {
+        std::vector<int> pointCounts;
+        std::vector<int> objectCounts;
+        std::vector<int> classCounts;
+        int scenes;
+        int clutter;
+        int occluders;
+        float noise;
+        float resolution;
+        bool plane;
+        unsigned seed;
+    };
+
+    // a training model centered at the origin, with the radius of its bounding sphere
+    struct Model
+    {
+        std::string filename;
+        unsigned classId;
+        pcl::PointCloud<PointT>::Ptr cloud;
+        float radius;
+    };
+
+    // an object placed in a scene and the number of its points that are visible from the sensor
+    struct Placement
+    {
+        const Model *model;
+        Eigen::Matrix3f rotation;
+        Eigen::Vector3f position;
+        int visiblePoints;
+    };
+
+    template<typename T>
+    std::vector<T> parseList(const std::string &list)
+    {
+        std::vector<T> values;
+        std::stringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ','))
+        {
+            if (item.empty())
+                continue;
+            std::stringstream itemStream(item);
+            T value;
+            itemStream >> value;
+            values.push_back(value);
+        }
+        return values;
+    }
+
+    bool readDatasetList(const std::string &listFile, std::vector<std::string> &filenames, std::vector<unsigned> &labels)
+    {
+        std::ifstream infile(listFile);
+        if (!infile)
+            return false;
+
+        std::string file;
+        std::string label;
+        while (infile >> file >> label)
+        {
+            if (file == "#")
+                continue;
+            filenames.push_back(file);
+            labels.push_back(std::stoul(label));
+        }
+        return !filenames.empty();
+    }
+
+    bool loadModel(const std::string &filename, unsigned classId, Model &model)
+    {
+        pcl::PointCloud<PointNormalT>::Ptr cloud = ism3d::PointCloudLoader::load(filename);
+        if (!cloud)
+            return false;
+
+        Eigen::Vector4f centroid;
+        pcl::compute3DCentroid(*cloud, centroid);
+
+        model.filename = filename;
+        model.classId = classId;
+        model.cloud.reset(new pcl::PointCloud<PointT>());
+        model.cloud->reserve(cloud->size());
+        model.radius = 0;
+        for (const PointNormalT &point : cloud->points)
+        {
+            if (!pcl::isFinite(point))
+                continue;
+            PointT centered;
+            centered.getVector3fMap() = point.getVector3fMap() - centroid.head<3>();
+            ism3d::copyPointColor(point, centered);
+            model.cloud->push_back(centered);
+            model.radius = std::max(model.radius, centered.getVector3fMap().norm());
+        }
+        return !model.cloud->empty();
+    }
+
+    // uniformly distributed rotation from a normalized four dimensional gaussian
+    Eigen::Matrix3f randomRotation(std::mt19937 &random)
+    {
+        std::normal_distribution<float> gaussian(0.0f, 1.0f);
+        Eigen::Quaternionf rotation(gaussian(random), gaussian(random), gaussian(random), gaussian(random));
+        if (rotation.norm() < 1e-6f)
+            return Eigen::Matrix3f::Identity();
+        return rotation.normalized().toRotationMatrix();
+    }
+
+    // points on the surface of an axis aligned box or a sphere, with a random gray level
+    void addPrimitive(const Eigen::Vector3f &center, const Eigen::Vector3f &size, bool sphere, int numPoints,
+                      std::mt19937 &random, pcl::PointCloud<PointT> &cloud)
+    {
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        std::uniform_int_distribution<int> gray(64, 192);
+        const uint8_t level = (uint8_t)gray(random);
+        for (int i = 0; i < numPoints; i++)
+        {
+            Eigen::Vector3f direction(unit(random), unit(random), unit(random));
+            if (direction.norm() < 1e-3f)
+                direction = Eigen::Vector3f::UnitZ();
+            Eigen::Vector3f surface;
+            if (sphere)
+            {
+                surface = direction.normalized();
+            }
+            else
+            {
+                // the direction is projected onto the face of its largest coordinate
+                int axis;
+                direction.cwiseAbs().maxCoeff(&axis);
+                surface = direction / std::abs(direction[axis]);
+            }
+
+            PointT point;
+            point.getVector3fMap() = center + surface.cwiseProduct(size * 0.5f);
+            ism3d::setPointColor(point, level, level, level);
+            cloud.push_back(point);
+        }
+    }
+
+    /**
+     * Composes a scene of the given number of objects of at most the given number of classes on the xy-plane,
+     * with clutter primitives around them, occluders between the objects and the sensor and a ground plane.
+     * All points are then sampled like a depth sensor above the scene: a z-buffer with the angular resolution
+     * of the options keeps the closest point of each pixel, the depth of the kept points is disturbed by
+     * gaussian noise along the viewing ray and the result is subsampled to the requested number of points.
+     * Returns the placed objects, their visible points are counted after sampling.
+     */
+    std::vector<Placement> createScene(const std::map<unsigned, std::vector<Model> > &models, int numPoints,
+                                       int numObjects, int numClasses, const Options &options, unsigned seed,
+                                       pcl::PointCloud<PointT> &scene)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        // the classes of the scene, every selected class occurs at least once if there are enough objects
+        std::vector<unsigned> classes;
+        for (const auto &entry : models)
+            classes.push_back(entry.first);
+        std::shuffle(classes.begin(), classes.end(), random);
+        if (numClasses > 0 && numClasses < (int)classes.size())
+            classes.resize(numClasses);
+
+        float meanRadius = 0;
+        std::vector<Placement> placements;
+        for (int i = 0; i < numObjects; i++)
+        {
+            const std::vector<Model> &classModels = models.at(classes[i % classes.size()]);
+            Placement placement;
+            placement.model = &classModels[std::uniform_int_distribution<int>(0, (int)classModels.size() - 1)(random)];
+            placement.rotation = randomRotation(random);
+            placement.visiblePoints = 0;
+            placements.push_back(placement);
+            meanRadius += placement.model->radius / numObjects;
+        }
+
+        // objects are placed on the plane without overlapping bounding spheres where possible, the area grows
+        // with the number of objects
+        const float extent = meanRadius * 3.0f * std::sqrt((float)std::max(numObjects, 1));
+        for (int i = 0; i < (int)placements.size(); i++)
+        {
+            Placement &placement = placements[i];
+            const float radius = placement.model->radius;
+            for (int attempt = 0; attempt < 100; attempt++)
+            {
+                placement.position = Eigen::Vector3f((unit(random) - 0.5f) * extent, (unit(random) - 0.5f) * extent, radius);
+                bool overlaps = false;
+                for (int j = 0; j < i && !overlaps; j++)
+                    overlaps = (placements[j].position - placement.position).head<2>().norm() < placements[j].model->radius + radius;
+                if (!overlaps)
+                    break;
+            }
+        }
+
+        // the label of every point is the index of its object, clutter and the plane have no label
+        pcl::PointCloud<PointT> points;
+        std::vector<int> labels;
+        for (int i = 0; i < (int)placements.size(); i++)
+        {
+            const Placement &placement = placements[i];
+            for (const PointT &modelPoint : placement.model->cloud->points)
+            {
+                PointT point = modelPoint;
+                point.getVector3fMap() = placement.rotation * modelPoint.getVector3fMap() + placement.position;
+                points.push_back(point);
+                labels.push_back(i);
+            }
+        }
+
+        // the sensor looks at the center of the scene from above and in front of it
+        const float sceneRadius = 0.5f * std::sqrt(2.0f) * extent + meanRadius;
+        const Eigen::Vector3f sensor(0.0f, -1.5f * sceneRadius, 1.5f * sceneRadius);
+
+        const int primitivePoints = std::max(100, (int)(points.size() / std::max(numObjects, 1)));
+        for (int i = 0; i < options.clutter; i++)
+        {
+            const Eigen::Vector3f size = Eigen::Vector3f(0.5f + unit(random), 0.5f + unit(random), 0.5f + unit(random)) * meanRadius;
+            const Eigen::Vector3f center((unit(random) - 0.5f) * 2.0f * sceneRadius, (unit(random) - 0.5f) * 2.0f * sceneRadius, 0.5f * size[2]);
+            addPrimitive(center, size, unit(random) < 0.5f, primitivePoints, random, points);
+        }
+        for (int i = 0; i < options.occluders && !placements.empty(); i++)
+        {
+            // somewhere on the line of sight to a random object, small enough to hide only a part of it
+            const Placement &target = placements[std::uniform_int_distribution<int>(0, (int)placements.size() - 1)(random)];
+            const Eigen::Vector3f toSensor = sensor - target.position;
+            const Eigen::Vector3f center = target.position + toSensor.normalized() *
+                    (2.0f * target.model->radius + 0.3f * unit(random) * toSensor.norm());
+            const Eigen::Vector3f size = Eigen::Vector3f::Constant(target.model->radius * (0.5f + unit(random)));
+            addPrimitive(center, size, unit(random) < 0.5f, primitivePoints, random, points);
+        }
+        if (options.plane)
+        {
+            const int planePoints = (int)points.size();
+            const uint8_t level = 160;
+            for (int i = 0; i < planePoints; i++)
+            {
+                PointT point;
+                point.getVector3fMap() = Eigen::Vector3f((unit(random) - 0.5f) * 2.0f * sceneRadius, (unit(random) - 0.5f) * 2.0f * sceneRadius, 0.0f);
+                ism3d::setPointColor(point, level, level, level);
+                points.push_back(point);
+            }
+        }
+        labels.resize(points.size(), -1);
+
+        // z-buffer in spherical coordinates around the viewing direction of the sensor
+        const Eigen::Vector3f forward = -sensor.normalized();
+        const Eigen::Vector3f right = forward.cross(Eigen::Vector3f::UnitZ()).normalized();
+        const Eigen::Vector3f up = right.cross(forward);
+        const float resolution = options.resolution * (float)M_PI / 180.0f;
+        std::map<std::pair<int, int>, int> pixels;
+        std::vector<float> depths(points.size());
+        for (int i = 0; i < (int)points.size(); i++)
+        {
+            const Eigen::Vector3f ray = points.points[i].getVector3fMap() - sensor;
+            depths[i] = ray.norm();
+            const float z = ray.dot(forward);
+            if (z <= 0)
+                continue;
+            const std::pair<int, int> pixel((int)std::floor(std::atan2(ray.dot(right), z) / resolution),
+                                            (int)std::floor(std::atan2(ray.dot(up), z) / resolution));
+            auto it = pixels.find(pixel);
+            if (it == pixels.end())
+                pixels[pixel] = i;
+            else if (depths[i] < depths[it->second])
+                it->second = i;
+        }
+
+        std::vector<int> visible;
+        visible.reserve(pixels.size());
+        for (const auto &entry : pixels)
+            visible.push_back(entry.second);
+        std::shuffle(visible.begin(), visible.end(), random);
+        if (numPoints > 0 && (int)visible.size() > numPoints)
+            visible.resize(numPoints);
+        if (numPoints > 0 && (int)visible.size() < numPoints)
+            std::cerr << "scene with " << visible.size() << " visible points, less than the requested " << numPoints <<
+                         ", use a finer --resolution or denser models" << std::endl;
+
+        std::normal_distribution<float> noise(0.0f, options.noise);
+        scene.clear();
+        scene.reserve(visible.size());
+        for (int index : visible)
+        {
+            PointT point = points.points[index];
+            if (options.noise > 0)
+            {
+                const Eigen::Vector3f ray = (point.getVector3fMap() - sensor) / depths[index];
+                point.getVector3fMap() += ray * noise(random);
+            }
+            scene.push_back(point);
+            if (labels[index] >= 0)
+                placements[labels[index]].visiblePoints++;
+        }
+        scene.width = scene.size();
+        scene.height = 1;
+        scene.is_dense = true;
+        return placements;
+    }
+}
+
+// composes synthetic scenes of training models for load and scalability tests of the detection, for every
+// combination of scene size, number of objects and number of classes a list of scenes in the dataset list
+// format of eval_tool and the ground truth poses of their objects are written to the output folder
+int main(int argc, char **argv)
+{
+    boost::program_options::options_description desc("Options");
+    desc.add_options()
+            ("help,h", "Display this help message")
+            ("inputfile,f", boost::program_options::value<std::string>(), "Dataset list of the training models and their class ids, in the format of eval_tool -f")
+            ("output,o", boost::program_options::value<std::string>(), "Output folder of the scenes, the lists and the ground truth")
+            ("points,p", boost::program_options::value<std::string>()->default_value("50000"), "Comma separated numbers of points per scene (0: all visible points)")
+            ("objects", boost::program_options::value<std::string>()->default_value("1,4"), "Comma separated numbers of objects per scene")
+            ("classes", boost::program_options::value<std::string>()->default_value("0"), "Comma separated maximal numbers of classes per scene (0: all classes)")
+            ("scenes,n", boost::program_options::value<int>()->default_value(10), "Number of scenes of every combination")
+            ("clutter", boost::program_options::value<int>()->default_value(4), "Number of clutter primitives around the objects")
+            ("occluders", boost::program_options::value<int>()->default_value(0), "Number of primitives between the sensor and the objects")
+            ("noise", boost::program_options::value<float>()->default_value(0.001f), "Standard deviation of the depth noise")
+            ("resolution", boost::program_options::value<float>()->default_value(0.05f), "Angular resolution of the sensor in degrees")
+            ("no-plane", "Do not add a ground plane below the objects")
+            ("seed,s", boost::program_options::value<unsigned>()->default_value(42), "Seed of the scenes");
+
+    boost::program_options::variables_map variables;
+    boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), variables);
+    boost::program_options::notify(variables);
+
+    if (variables.count("help") || !variables.count("inputfile") || !variables.count("output"))
+    {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    Options options;
+    options.pointCounts = parseList<int>(variables["points"].as<std::string>());
+    options.objectCounts = parseList<int>(variables["objects"].as<std::string>());
+    options.classCounts = parseList<int>(variables["classes"].as<std::string>());
+    options.scenes = std::max(1, variables["scenes"].as<int>());
+    options.clutter = std::max(0, variables["clutter"].as<int>());
+    options.occluders = std::max(0, variables["occluders"].as<int>());
+    options.noise = std::max(0.0f, variables["noise"].as<float>());
+    options.resolution = std::max(1e-4f, variables["resolution"].as<float>());
+    options.plane = variables.count("no-plane") == 0;
+    options.seed = variables["seed"].as<unsigned>();
+
+    std::vector<std::string> filenames;
+    std::vector<unsigned> classIds;
+    if (!readDatasetList(variables["inputfile"].as<std::string>(), filenames, classIds))
+    {
+        std::cerr << "could not read the dataset list: " << variables["inputfile"].as<std::string>() << std::endl;
+        return 1;
+    }
+
+    std::map<unsigned, std::vector<Model> > models;
+    for (int i = 0; i < (int)filenames.size(); i++)
+    {
+        Model model;
+        if (!loadModel(filenames[i], classIds[i], model))
+        {
+            std::cerr << "could not load training model: " << filenames[i] << std::endl;
+            return 1;
+        }
+        models[classIds[i]].push_back(model);
+    }
+
+    const boost::filesystem::path folder(variables["output"].as<std::string>());
+    boost::filesystem::create_directories(folder / "scenes");
+
+    unsigned sceneSeed = options.seed;
+    for (int numPoints : options.pointCounts)
+    {
+        for (int numObjects : options.objectCounts)
+        {
+            for (int numClasses : options.classCounts)
+            {
+                std::ostringstream name;
+                name << "p" << numPoints << "_o" << numObjects << "_c" << numClasses;
+                const std::string listFile = (folder / ("list_" + name.str() + ".txt")).string();
+                const std::string groundTruthFile = (folder / ("ground_truth_" + name.str() + ".txt")).string();
+                std::ofstream list(listFile.c_str());
+                std::ofstream groundTruth(groundTruthFile.c_str());
+                list << "# test\n";
+                groundTruth << "# scene class model x y z qw qx qy qz visible_points\n";
+
+                for (int i = 0; i < options.scenes; i++)
+                {
+                    pcl::PointCloud<PointT> scene;
+                    std::vector<Placement> placements = createScene(models, numPoints, std::max(1, numObjects), numClasses,
+                                                                    options, sceneSeed++, scene);
+
+                    std::ostringstream sceneName;
+                    sceneName << "scene_" << name.str() << "_" << std::setfill('0') << std::setw(4) << i << ".pcd";
+                    const std::string sceneFile = (folder / "scenes" / sceneName.str()).string();
+                    if (scene.empty() || pcl::io::savePCDFileBinary(sceneFile, scene) < 0)
+                    {
+                        std::cerr << "could not write scene: " << sceneFile << std::endl;
+                        return 1;
+                    }
+
+                    // the list holds one class per scene, the class of the most visible object
+                    const Placement *dominant = &placements.front();
+                    for (const Placement &placement : placements)
+                    {
+                        if (placement.visiblePoints > dominant->visiblePoints)
+                            dominant = &placement;
+                        const Eigen::Quaternionf rotation(placement.rotation);
+                        groundTruth << sceneFile << " " << placement.model->classId << " " << placement.model->filename << " " <<
+                                       placement.position.x() << " " << placement.position.y() << " " << placement.position.z() << " " <<
+                                       rotation.w() << " " << rotation.x() << " " << rotation.y() << " " <<
+                                       rotation.z() << " " << placement.visiblePoints << "\n";
+                    }
+                    list << sceneFile << " " << dominant->model->classId << "\n";
+                }
+                std::cout << "wrote " << options.scenes << " scenes to " << listFile << std::endl;
+            }
+        }
+    }
+    return 0;
+}
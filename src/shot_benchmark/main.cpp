@@ -0,0 +1,120 @@
+/*
+ * BSD 3-Clause License
+ *
+ * Full text: https://opensource.org/licenses/BSD-3-Clause
+ *
+ * Copyright (c) 2018, Viktor Seib
+ * All rights reserved.
+ *
+ */
+
+#include <iostream>
+#include <string>
+#include <memory>
+#include <boost/program_options.hpp>
+#include <boost/timer/timer.hpp>
+
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/features/normal_3d_omp.h>
+#include <pcl/features/shot_omp.h>
+#include <pcl/search/kdtree.h>
+
+#include "../implicit_shape_model/features/features.h"
+#include "../implicit_shape_model/utils/factory.h"
+#include "../implicit_shape_model/utils/shot_kernels.h"
+
+bool write_log_to_files = false;
+bool log_info = false;
+
+using ism3d::PointT;
+
+// compares the SHORT_CSHOT features, which use the vectorized histogram kernel, to the color SHOT of pcl
+int main(int argc, char **argv)
+{
+    boost::program_options::options_description desc("Options");
+    desc.add_options()
+            ("help,h", "Display this help message")
+            ("cloud,c", boost::program_options::value<std::string>(), "Input point cloud with colors (pcd)")
+            ("radius,r", boost::program_options::value<float>()->default_value(0.1f), "Descriptor and reference frame radius")
+            ("leaf,l", boost::program_options::value<float>()->default_value(0.02f), "Voxel grid leaf size for the keypoints")
+            ("threads,t", boost::program_options::value<int>()->default_value(0), "Number of threads (0: OpenMP default)")
+            ("repetitions,n", boost::program_options::value<int>()->default_value(5), "Number of timed repetitions");
+
+    boost::program_options::variables_map variables;
+    boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), variables);
+    boost::program_options::notify(variables);
+
+    if (variables.count("help") || !variables.count("cloud"))
+    {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    const float radius = variables["radius"].as<float>();
+    const float leaf = variables["leaf"].as<float>();
+    const int threads = variables["threads"].as<int>();
+    const int repetitions = std::max(1, variables["repetitions"].as<int>());
+
+    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+    if (pcl::io::loadPCDFile(variables["cloud"].as<std::string>(), *cloud) < 0)
+        return 1;
+
+    // shared input: normals and keypoints
+    pcl::search::KdTree<PointT>::Ptr search(new pcl::search::KdTree<PointT>());
+    pcl::PointCloud<pcl::Normal>::Ptr normals(new pcl::PointCloud<pcl::Normal>());
+    pcl::NormalEstimationOMP<PointT, pcl::Normal> normalEst;
+    normalEst.setInputCloud(cloud);
+    normalEst.setSearchMethod(search);
+    normalEst.setRadiusSearch(radius / 2);
+    normalEst.setNumberOfThreads(threads);
+    normalEst.compute(*normals);
+
+    pcl::PointCloud<PointT>::Ptr keypoints(new pcl::PointCloud<PointT>());
+    pcl::VoxelGrid<PointT> voxelGrid;
+    voxelGrid.setInputCloud(cloud);
+    voxelGrid.setLeafSize(leaf, leaf, leaf);
+    voxelGrid.filter(*keypoints);
+
+    std::cout << "points: " << cloud->size() << ", keypoints: " << keypoints->size() << ", histogram kernel: " <<
+                 ism3d::ShotKernels::getInstructionSet() << std::endl;
+
+    // reference frames are computed by both implementations
+    double pclTime = 0;
+    for (int i = 0; i < repetitions; i++)
+    {
+        pcl::PointCloud<pcl::SHOT1344> descriptors;
+        pcl::SHOTColorEstimationOMP<PointT, pcl::Normal, pcl::SHOT1344> shotEst;
+        shotEst.setInputCloud(keypoints);
+        shotEst.setSearchSurface(cloud);
+        shotEst.setInputNormals(normals);
+        shotEst.setSearchMethod(pcl::search::KdTree<PointT>::Ptr(new pcl::search::KdTree<PointT>()));
+        shotEst.setRadiusSearch(radius);
+        shotEst.setLRFRadius(radius);
+        shotEst.setNumberOfThreads(threads);
+
+        boost::timer::cpu_timer timer;
+        shotEst.compute(descriptors);
+        pclTime += timer.elapsed().wall / 1e6;
+    }
+
+    Json::Value config;
+    config["Type"] = "SHORT_CSHOT";
+    config["Radius"] = radius;
+    config["ReferenceFrameRadius"] = radius;
+    config["ReferenceFrameType"] = "SHOT";
+    std::unique_ptr<ism3d::Features> features(ism3d::Factory<ism3d::Features>::create(config));
+    features->setNumThreads(threads);
+
+    double kernelTime = 0;
+    for (int i = 0; i < repetitions; i++)
+    {
+        boost::timer::cpu_timer timer;
+        (*features)(cloud, normals, cloud, normals, keypoints, pcl::search::KdTree<PointT>::Ptr(new pcl::search::KdTree<PointT>()));
+        kernelTime += timer.elapsed().wall / 1e6;
+    }
+
+    std::cout << "pcl::SHOTColorEstimationOMP: " << pclTime / repetitions << " ms" << std::endl;
+    std::cout << "SHORT_CSHOT:                 " << kernelTime / repetitions << " ms" << std::endl;
+    return 0;
+}